@@ -24,6 +24,7 @@
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
+#include "qapi/qapi-commands-misc.h"
 #include "hw/hw.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
@@ -53,6 +54,11 @@
  */
 #define PAGE_SIZE getpagesize()
 
+/* Only some architectures provide a dirty ring; KVM rejects it elsewhere */
+#ifndef KVM_DIRTY_LOG_PAGE_OFFSET
+#define KVM_DIRTY_LOG_PAGE_OFFSET 0
+#endif
+
 //#define DEBUG_KVM
 
 #ifdef DEBUG_KVM
@@ -68,6 +74,8 @@
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
+    /* Position in the vcpu's dirty ring, which survives the unplug */
+    uint32_t kvm_fetch_index;
     QLIST_ENTRY(KVMParkedVcpu) node;
 };
 
@@ -106,6 +114,17 @@ struct KVMState
 #endif
     KVMMemoryListener memory_listener;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
+    /* Memory listeners indexed by KVM address space id */
+    KVMMemoryListener **as_listeners;
+    int nr_as;
+
+    /* KVM_DIRTY_LOG_* flags enabled for KVM_CAP_MANUAL_DIRTY_LOG_PROTECT */
+    uint64_t manual_dirty_log_protect;
+
+    /* Number of entries of each vcpu's dirty ring, 0 if not used */
+    uint32_t kvm_dirty_ring_size;
+    uint32_t kvm_dirty_ring_bytes;
+    QemuThread kvm_dirty_ring_reaper;
 
     /* memory encryption */
     void *memcrypt_handle;
@@ -131,6 +150,50 @@ bool kvm_ioeventfd_any_length_allowed;
 bool kvm_msi_use_devid;
 static bool kvm_immediate_exit;
 
+static uint64_t kvm_dirty_ring_reap(KVMState *s);
+
+/* Exit reasons from here on share the last bucket */
+#define KVM_EXIT_STATS_NR 32
+/* Bucket i counts the exits handled in [2^i, 2^(i+1)) ns */
+#define KVM_EXIT_HIST_NR 32
+
+typedef struct KVMExitReasonStats {
+    uint64_t count;
+    uint64_t ns;        /* spent in QEMU handling the exits */
+    uint64_t max_ns;
+    uint64_t hist[KVM_EXIT_HIST_NR];
+} KVMExitReasonStats;
+
+/*
+ * Distinct MMIO and PIO addresses whose exits are counted per vCPU, in an
+ * open addressed hash table; the MemoryRegion they belong to is only looked
+ * up when queried, so that exits don't pay for it.
+ */
+#define KVM_EXIT_ADDR_BITS 8
+#define KVM_EXIT_ADDR_NR (1 << KVM_EXIT_ADDR_BITS)
+#define KVM_EXIT_ADDR_PROBES 16
+#define KVM_EXIT_ADDR_USED (1ULL << 63)
+#define KVM_EXIT_ADDR_PIO (1ULL << 62)
+
+typedef struct KVMExitAddrStats {
+    uint64_t key;       /* address | KVM_EXIT_ADDR_USED [| _PIO] */
+    uint64_t count;
+    uint64_t ns;
+} KVMExitAddrStats;
+
+/*
+ * Only updated from the vCPU thread without any lock, so readers may see
+ * slightly stale values.
+ */
+typedef struct KVMExitStats {
+    KVMExitReasonStats reasons[KVM_EXIT_STATS_NR];
+    KVMExitAddrStats addrs[KVM_EXIT_ADDR_NR];
+    uint64_t untracked_count;
+} KVMExitStats;
+
+#define kvm_slots_lock(kml)      qemu_mutex_lock(&(kml)->slots_lock)
+#define kvm_slots_unlock(kml)    qemu_mutex_unlock(&(kml)->slots_lock)
+
 static const KVMCapabilityInfo kvm_required_capabilites[] = {
     KVM_CAP_INFO(USER_MEMORY),
     KVM_CAP_INFO(DESTROY_MEMORY_REGION_WORKS),
@@ -304,15 +367,30 @@ int kvm_destroy_vcpu(CPUState *cpu)
         goto err;
     }
 
+    if (cpu->kvm_dirty_gfns) {
+        /* Don't lose the pages that are still sitting in the ring */
+        kvm_dirty_ring_reap(s);
+        ret = munmap(cpu->kvm_dirty_gfns, s->kvm_dirty_ring_bytes);
+        if (ret < 0) {
+            goto err;
+        }
+        cpu->kvm_dirty_gfns = NULL;
+    }
+
+    g_free(cpu->kvm_exit_stats);
+    cpu->kvm_exit_stats = NULL;
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
+    vcpu->kvm_fetch_index = cpu->kvm_fetch_index;
     QLIST_INSERT_HEAD(&kvm_state->kvm_parked_vcpus, vcpu, node);
 err:
     return ret;
 }
 
-static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
+static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id,
+                        uint32_t *fetch_index)
 {
     struct KVMParkedVcpu *cpu;
 
@@ -322,11 +400,13 @@ static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
 
             QLIST_REMOVE(cpu, node);
             kvm_fd = cpu->kvm_fd;
+            *fetch_index = cpu->kvm_fetch_index;
             g_free(cpu);
             return kvm_fd;
         }
     }
 
+    *fetch_index = 0;
     return kvm_vm_ioctl(s, KVM_CREATE_VCPU, (void *)vcpu_id);
 }
 
@@ -338,7 +418,7 @@ int kvm_init_vcpu(CPUState *cpu)
 
     DPRINTF("kvm_init_vcpu\n");
 
-    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu));
+    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu), &cpu->kvm_fetch_index);
     if (ret < 0) {
         DPRINTF("kvm_create_vcpu failed\n");
         goto err;
@@ -347,6 +427,7 @@ int kvm_init_vcpu(CPUState *cpu)
     cpu->kvm_fd = ret;
     cpu->kvm_state = s;
     cpu->vcpu_dirty = true;
+    cpu->kvm_exit_stats = g_new0(KVMExitStats, 1);
 
     mmap_size = kvm_ioctl(s, KVM_GET_VCPU_MMAP_SIZE, 0);
     if (mmap_size < 0) {
@@ -368,6 +449,20 @@ int kvm_init_vcpu(CPUState *cpu)
             (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
     }
 
+    if (s->kvm_dirty_ring_size) {
+        /* Use MAP_SHARED to share pages with the kernel */
+        cpu->kvm_dirty_gfns = mmap(NULL, s->kvm_dirty_ring_bytes,
+                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                   cpu->kvm_fd,
+                                   PAGE_SIZE * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            cpu->kvm_dirty_gfns = NULL;
+            ret = -errno;
+            DPRINTF("mmap'ing vcpu dirty ring failed\n");
+            goto err;
+        }
+    }
+
     ret = kvm_arch_init_vcpu(cpu);
 err:
     return ret;
@@ -435,7 +530,9 @@ static void kvm_log_start(MemoryListener *listener,
         return;
     }
 
+    kvm_slots_lock(kml);
     r = kvm_section_update_flags(kml, section);
+    kvm_slots_unlock(kml);
     if (r < 0) {
         abort();
     }
@@ -452,7 +549,9 @@ static void kvm_log_stop(MemoryListener *listener,
         return;
     }
 
+    kvm_slots_lock(kml);
     r = kvm_section_update_flags(kml, section);
+    kvm_slots_unlock(kml);
     if (r < 0) {
         abort();
     }
@@ -473,13 +572,15 @@ static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
 #define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
 
 /**
- * kvm_physical_sync_dirty_bitmap - Grab dirty bitmap from kernel space
- * This function updates qemu's dirty bitmap using
- * memory_region_set_dirty().  This means all bits are set
- * to dirty.
+ * kvm_physical_sync_dirty_bitmap - Sync dirty bitmap from kernel space
+ *
+ * This function will first try to fetch dirty bitmap from the kernel,
+ * and then updates qemu's dirty bitmap.
+ *
+ * NOTE: caller must be with kml->slots_lock held.
  *
- * @start_add: start of logged region.
- * @end_addr: end of logged region.
+ * @kml: the KVM memory listener object
+ * @section: the memory section to sync the dirty bitmap with
  */
 static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
                                           MemoryRegionSection *section)
@@ -511,22 +612,428 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
          */
         size = ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
                      /*HOST_LONG_BITS*/ 64) / 8;
-        d.dirty_bitmap = g_malloc0(size);
+        if (!mem->dirty_bmap) {
+            /*
+             * Allocate on the first log_sync, once and for all.  With
+             * manual dirty log protection the bitmap is kept until the
+             * pages are cleared, so that only the pages that were
+             * reported dirty get write-protected again.
+             */
+            mem->dirty_bmap = g_malloc0(size);
+        }
 
+        d.dirty_bitmap = mem->dirty_bmap;
         d.slot = mem->slot | (kml->as_id << 16);
         if (kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d) == -1) {
             DPRINTF("ioctl failed %d\n", errno);
-            g_free(d.dirty_bitmap);
             return -1;
         }
 
         kvm_get_dirty_pages_log_range(section, d.dirty_bitmap);
-        g_free(d.dirty_bitmap);
     }
 
     return 0;
 }
 
+/* Alignment requirement for KVM_CLEAR_DIRTY_LOG - 64 pages */
+#define KVM_CLEAR_LOG_SHIFT  6
+#define KVM_CLEAR_LOG_ALIGN  ((uint64_t)PAGE_SIZE << KVM_CLEAR_LOG_SHIFT)
+#define KVM_CLEAR_LOG_MASK   (-KVM_CLEAR_LOG_ALIGN)
+
+/*
+ * Re-protect the pages of [start, start + size) of the slot that were
+ * reported dirty, @start being relative to the start of the slot.
+ */
+static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
+                                  uint64_t size)
+{
+    KVMState *s = kvm_state;
+    uint64_t end, bmap_start, start_delta, bmap_npages;
+    struct kvm_clear_dirty_log d;
+    unsigned long *bmap_clear = NULL, psize = PAGE_SIZE;
+    int ret;
+
+    /*
+     * We need to extend either the start or the size or both to
+     * satisfy the KVM interface requirement.  Firstly, do the start
+     * page alignment on 64 host pages
+     */
+    bmap_start = start & KVM_CLEAR_LOG_MASK;
+    start_delta = start - bmap_start;
+    bmap_start /= psize;
+
+    /*
+     * The kernel interface has restriction on the size too, that either:
+     *
+     * (1) the size is 64 host pages aligned (just like the start), or
+     * (2) the size fills up until the end of the KVM memslot.
+     */
+    bmap_npages = DIV_ROUND_UP(size + start_delta, KVM_CLEAR_LOG_ALIGN)
+        << KVM_CLEAR_LOG_SHIFT;
+    end = mem->memory_size / psize;
+    if (bmap_npages > end - bmap_start) {
+        bmap_npages = end - bmap_start;
+    }
+    start_delta /= psize;
+
+    /*
+     * Prepare the bitmap to clear dirty bits.  Here we must guarantee
+     * that we won't clear any unknown dirty bits otherwise we might
+     * accidentally clear some set bits which are not yet synced from
+     * the kernel into QEMU's bitmap, then we'll lose track of the
+     * guest modifications upon those pages (which can directly lead
+     * to guest data loss or panic after migration).
+     *
+     * Layout of the KVMSlot.dirty_bmap:
+     *
+     *                   |<-------- bmap_npages -----------..>|
+     *                                                     [1]
+     *                     start_delta         size
+     *  |----------------|-------------|------------------|------------|
+     *  ^                ^             ^                               ^
+     *  |                |             |                               |
+     * start          bmap_start     (start)                         end
+     * of memslot                                             of memslot
+     *
+     * [1] bmap_npages can be aligned to either 64 pages or the end of slot
+     */
+
+    assert(bmap_start % BITS_PER_LONG == 0);
+    if (start_delta || bmap_npages - size / psize) {
+        /* Slow path - we need to manipulate a temp bitmap */
+        bmap_clear = bitmap_new(bmap_npages);
+        bitmap_copy_with_src_offset(bmap_clear, mem->dirty_bmap,
+                                    bmap_start, start_delta + size / psize);
+        /*
+         * We need to fill the holes at start because that was not
+         * specified by the caller and we extended the bitmap only for
+         * 64 pages alignment
+         */
+        bitmap_clear(bmap_clear, 0, start_delta);
+        d.dirty_bitmap = bmap_clear;
+    } else {
+        /*
+         * Fast path - both start and size align well with BITS_PER_LONG
+         * (or the end of memory slot)
+         */
+        d.dirty_bitmap = mem->dirty_bmap + BIT_WORD(bmap_start);
+    }
+
+    d.first_page = bmap_start;
+    /* It should never overflow.  If it happens, say something */
+    assert(bmap_npages <= UINT32_MAX);
+    d.num_pages = bmap_npages;
+    d.slot = mem->slot | (as_id << 16);
+
+    ret = kvm_vm_ioctl(s, KVM_CLEAR_DIRTY_LOG, &d);
+    if (ret < 0 && ret != -ENOENT) {
+        error_report("%s: KVM_CLEAR_DIRTY_LOG failed, slot=%d, "
+                     "start=0x%"PRIx64", size=0x%"PRIx32", errno=%d",
+                     __func__, d.slot, (uint64_t)d.first_page,
+                     (uint32_t)d.num_pages, ret);
+    } else {
+        ret = 0;
+        trace_kvm_clear_dirty_log(d.slot, d.first_page, d.num_pages);
+    }
+
+    /*
+     * After we have updated the remote dirty bitmap, we update the
+     * cached bitmap as well for the memslot, then if another user
+     * clears the same region we know we shouldn't clear it again on
+     * the remote otherwise it's data loss as well.
+     */
+    bitmap_clear(mem->dirty_bmap, bmap_start + start_delta, size / psize);
+    /* This handles the NULL case well */
+    g_free(bmap_clear);
+    return ret;
+}
+
+/**
+ * kvm_physical_log_clear - Clear the kernel's dirty bitmap for range
+ *
+ * NOTE: this will be a no-op if we haven't enabled manual dirty log
+ * protection in the host kernel because in that case this operation
+ * will be done within log_sync().
+ *
+ * @kml:     the kvm memory listener
+ * @section: the memory range to clear dirty bitmap
+ */
+static int kvm_physical_log_clear(KVMMemoryListener *kml,
+                                  MemoryRegionSection *section)
+{
+    KVMState *s = kvm_state;
+    uint64_t start, size, offset, count;
+    KVMSlot *mem;
+    int ret = 0, i;
+
+    if (!s->manual_dirty_log_protect) {
+        /* No need to do explicit clear */
+        return ret;
+    }
+
+    start = section->offset_within_address_space;
+    size = int128_get64(section->size);
+
+    if (!size) {
+        /* Nothing more we can do... */
+        return ret;
+    }
+
+    kvm_slots_lock(kml);
+
+    for (i = 0; i < s->nr_slots; i++) {
+        mem = &kml->slots[i];
+        /* Discard slots that are empty or do not overlap the section */
+        if (!mem->memory_size ||
+            mem->start_addr > start + size - 1 ||
+            start > mem->start_addr + mem->memory_size - 1) {
+            continue;
+        }
+
+        if (start > mem->start_addr) {
+            /* The slot starts before the section */
+            offset = start - mem->start_addr;
+            count = MIN(mem->memory_size - offset, size);
+        } else {
+            /* The slot starts after (or at) the section */
+            offset = 0;
+            count = MIN(mem->memory_size, size - (mem->start_addr - start));
+        }
+
+        /* Nothing was ever reported as dirty for this slot */
+        if (!mem->dirty_bmap) {
+            continue;
+        }
+
+        ret = kvm_log_clear_one_slot(mem, kml->as_id, offset, count);
+        if (ret < 0) {
+            break;
+        }
+    }
+
+    kvm_slots_unlock(kml);
+
+    return ret;
+}
+
+/*
+ * Dirty ring support.  Instead of a per-slot bitmap that has to be
+ * fetched and walked in full on every sync, the kernel appends the
+ * (slot, offset) of every page dirtied by a vcpu to a ring shared with
+ * that vcpu.  The rings are harvested by a reaper thread, when a ring
+ * fills up, and when the dirty log is synced; the entries are marked
+ * straight into the RAM dirty bitmaps, so the cost of a sync grows with
+ * the number of dirtied pages rather than with the size of guest memory.
+ *
+ * All harvesting is done with the BQL held, which also protects the
+ * memory slots against concurrent updates.
+ */
+
+static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
+{
+    return atomic_load_acquire(&gfn->flags) == KVM_DIRTY_GFN_F_DIRTY;
+}
+
+static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
+{
+    atomic_store_release(&gfn->flags, KVM_DIRTY_GFN_F_RESET);
+}
+
+static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
+                                     uint32_t slot_id, uint64_t offset)
+{
+    KVMMemoryListener *kml;
+    KVMSlot *mem;
+
+    if (as_id >= s->nr_as || slot_id >= s->nr_slots) {
+        return;
+    }
+
+    kml = s->as_listeners[as_id];
+    if (!kml) {
+        return;
+    }
+
+    mem = &kml->slots[slot_id];
+    /* The slot may have been removed since the page was dirtied */
+    if (offset >= mem->memory_size / PAGE_SIZE) {
+        return;
+    }
+
+    cpu_physical_memory_set_dirty_range(mem->ram_start_offset +
+                                        offset * PAGE_SIZE, PAGE_SIZE,
+                                        DIRTY_CLIENTS_NOCODE);
+}
+
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+{
+    struct kvm_dirty_gfn *gfns = cpu->kvm_dirty_gfns, *cur;
+    uint32_t ring_size = s->kvm_dirty_ring_size;
+    uint32_t count = 0, fetch = cpu->kvm_fetch_index;
+
+    while (true) {
+        cur = &gfns[fetch % ring_size];
+        if (!dirty_gfn_is_dirtied(cur)) {
+            break;
+        }
+        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
+                                 cur->offset);
+        dirty_gfn_set_collected(cur);
+        fetch++;
+        count++;
+    }
+    cpu->kvm_fetch_index = fetch;
+    cpu->dirty_pages += count;
+
+    return count;
+}
+
+/* Must be called with the BQL held */
+static uint64_t kvm_dirty_ring_reap(KVMState *s)
+{
+    CPUState *cpu;
+    uint64_t total = 0;
+    int64_t stamp = get_clock();
+    int ret;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->kvm_dirty_gfns) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+    }
+
+    if (total) {
+        /* Let the kernel recycle the entries we have collected */
+        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS, NULL);
+        assert(ret == total);
+    }
+
+    trace_kvm_dirty_ring_reap(total, (get_clock() - stamp) / 1000);
+
+    return total;
+}
+
+bool kvm_dirty_ring_enabled(void)
+{
+    return kvm_state && kvm_state->kvm_dirty_ring_size;
+}
+
+void kvm_dirty_ring_sync(void)
+{
+    if (kvm_dirty_ring_enabled()) {
+        kvm_dirty_ring_reap(kvm_state);
+    }
+}
+
+static void do_kvm_cpu_synchronize_kick(CPUState *cpu, run_on_cpu_data arg)
+{
+    /* Nothing to do, the vcpu exit itself is what we are after */
+}
+
+/*
+ * Dirty GFNs can be buffered by the hardware (e.g. Intel PML) and are
+ * only pushed to the ring when the vcpu exits; kick every vcpu out of
+ * the guest before harvesting so that none of them is missed.
+ */
+static void kvm_dirty_ring_flush(KVMState *s)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->kvm_dirty_gfns) {
+            run_on_cpu(cpu, do_kvm_cpu_synchronize_kick, RUN_ON_CPU_NULL);
+        }
+    }
+
+    kvm_dirty_ring_reap(s);
+}
+
+static void *kvm_dirty_ring_reaper_thread(void *opaque)
+{
+    KVMState *s = opaque;
+
+    rcu_register_thread();
+
+    while (true) {
+        /*
+         * Rings that fill up are reaped by their vcpu anyway; the
+         * periodic pass is only meant to keep them from getting there.
+         */
+        g_usleep(G_USEC_PER_SEC);
+
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap(s);
+        qemu_mutex_unlock_iothread();
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * With manual dirty log protection, KVM_GET_DIRTY_LOG no longer
+ * write-protects the pages it reports; they are re-protected with
+ * KVM_CLEAR_DIRTY_LOG by the log_clear listener hook instead.  This
+ * lets migration clear the dirty log in small chunks right before the
+ * pages are sent, rather than write-protecting all of guest memory at
+ * every sync.
+ */
+static void kvm_dirty_log_manual_protect_init(KVMState *s)
+{
+    uint64_t caps = KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE;
+    int cap = KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2;
+    int ret;
+
+    if (!(kvm_check_extension(s, cap) & caps)) {
+        /* The original capability of Linux 5.0 - 5.2 */
+        cap = KVM_CAP_MANUAL_DIRTY_LOG_PROTECT;
+        if (!kvm_check_extension(s, cap)) {
+            return;
+        }
+    }
+
+    ret = kvm_vm_enable_cap(s, cap, 0, caps);
+    if (ret) {
+        warn_report("Trying to enable KVM manual dirty log protection "
+                    "failed: %s.  Falling back to the legacy mode.",
+                    strerror(-ret));
+        return;
+    }
+
+    s->manual_dirty_log_protect = caps;
+}
+
+static int kvm_dirty_ring_init(KVMState *s)
+{
+    uint64_t ring_bytes = (uint64_t)s->kvm_dirty_ring_size *
+                          sizeof(struct kvm_dirty_gfn);
+    int max_bytes;
+    int ret;
+
+    max_bytes = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+    if (max_bytes <= 0) {
+        error_report("KVM dirty ring is not supported by this host");
+        return -ENOTSUP;
+    }
+
+    if (ring_bytes > max_bytes) {
+        error_report("KVM dirty ring size %" PRIu32 " too big (maximum is %zu)."
+                     " Please use a smaller value.", s->kvm_dirty_ring_size,
+                     max_bytes / sizeof(struct kvm_dirty_gfn));
+        return -EINVAL;
+    }
+
+    ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+    if (ret) {
+        error_report("Enabling of KVM dirty ring failed: %s",
+                     strerror(-ret));
+        return ret;
+    }
+
+    s->kvm_dirty_ring_bytes = ring_bytes;
+    return 0;
+}
+
 static void kvm_coalesce_mmio_region(MemoryListener *listener,
                                      MemoryRegionSection *secion,
                                      hwaddr start, hwaddr size)
@@ -792,10 +1299,16 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             return;
         }
         if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-            kvm_physical_sync_dirty_bitmap(kml, section);
+            if (kvm_state->kvm_dirty_ring_size) {
+                kvm_dirty_ring_reap(kvm_state);
+            } else {
+                kvm_physical_sync_dirty_bitmap(kml, section);
+            }
         }
 
         /* unregister the slot */
+        g_free(mem->dirty_bmap);
+        mem->dirty_bmap = NULL;
         mem->memory_size = 0;
         mem->flags = 0;
         err = kvm_set_user_memory_region(kml, mem, false);
@@ -812,6 +1325,9 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     mem->memory_size = size;
     mem->start_addr = start_addr;
     mem->ram = ram;
+    mem->ram_start_offset = memory_region_get_ram_addr(mr) +
+                            section->offset_within_region +
+                            (start_addr - section->offset_within_address_space);
     mem->flags = kvm_mem_flags(mr);
 
     err = kvm_set_user_memory_region(kml, mem, true);
@@ -828,7 +1344,9 @@ static void kvm_region_add(MemoryListener *listener,
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
 
     memory_region_ref(section->mr);
+    kvm_slots_lock(kml);
     kvm_set_phys_mem(kml, section, true);
+    kvm_slots_unlock(kml);
 }
 
 static void kvm_region_del(MemoryListener *listener,
@@ -836,7 +1354,9 @@ static void kvm_region_del(MemoryListener *listener,
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
 
+    kvm_slots_lock(kml);
     kvm_set_phys_mem(kml, section, false);
+    kvm_slots_unlock(kml);
     memory_region_unref(section->mr);
 }
 
@@ -846,12 +1366,35 @@ static void kvm_log_sync(MemoryListener *listener,
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
     int r;
 
+    kvm_slots_lock(kml);
     r = kvm_physical_sync_dirty_bitmap(kml, section);
+    kvm_slots_unlock(kml);
+    if (r < 0) {
+        abort();
+    }
+}
+
+static void kvm_log_clear(MemoryListener *listener,
+                          MemoryRegionSection *section)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    int r;
+
+    r = kvm_physical_log_clear(kml, section);
     if (r < 0) {
+        error_report_once("%s: kvm log clear failed: mr=%s "
+                          "offset=%"HWADDR_PRIx" size=%"PRIx64, __func__,
+                          section->mr->name, section->offset_within_region,
+                          int128_get64(section->size));
         abort();
     }
 }
 
+static void kvm_log_sync_global(MemoryListener *listener)
+{
+    kvm_dirty_ring_flush(kvm_state);
+}
+
 static void kvm_mem_ioeventfd_add(MemoryListener *listener,
                                   MemoryRegionSection *section,
                                   bool match_data, uint64_t data,
@@ -926,9 +1469,13 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 {
     int i;
 
+    qemu_mutex_init(&kml->slots_lock);
     kml->slots = g_malloc0(s->nr_slots * sizeof(KVMSlot));
     kml->as_id = as_id;
 
+    assert(as_id < s->nr_as);
+    s->as_listeners[as_id] = kml;
+
     for (i = 0; i < s->nr_slots; i++) {
         kml->slots[i].slot = i;
     }
@@ -937,7 +1484,14 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
     kml->listener.region_del = kvm_region_del;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
-    kml->listener.log_sync = kvm_log_sync;
+    if (s->kvm_dirty_ring_size) {
+        kml->listener.log_sync_global = kvm_log_sync_global;
+    } else {
+        kml->listener.log_sync = kvm_log_sync;
+        if (s->manual_dirty_log_protect) {
+            kml->listener.log_clear = kvm_log_clear;
+        }
+    }
     kml->listener.priority = 10;
 
     memory_listener_register(&kml->listener, as);
@@ -1626,6 +2180,12 @@ static int kvm_init(MachineState *ms)
 
     s->vmfd = ret;
 
+    s->nr_as = kvm_check_extension(s, KVM_CAP_MULTI_ADDRESS_SPACE);
+    if (s->nr_as <= 1) {
+        s->nr_as = 1;
+    }
+    s->as_listeners = g_new0(KVMMemoryListener *, s->nr_as);
+
     /* check the vcpu limits */
     soft_vcpus_limit = kvm_recommended_vcpus(s);
     hard_vcpus_limit = kvm_max_vcpus(s);
@@ -1702,6 +2262,17 @@ static int kvm_init(MachineState *ms)
     kvm_ioeventfd_any_length_allowed =
         (kvm_check_extension(s, KVM_CAP_IOEVENTFD_ANY_LENGTH) > 0);
 
+    /* The dirty ring must be enabled before any vcpu is created */
+    s->kvm_dirty_ring_size = machine_kvm_dirty_ring_size(ms);
+    if (s->kvm_dirty_ring_size) {
+        ret = kvm_dirty_ring_init(s);
+        if (ret < 0) {
+            goto err;
+        }
+    } else {
+        kvm_dirty_log_manual_protect_init(s);
+    }
+
     kvm_state = s;
 
     /*
@@ -1748,6 +2319,12 @@ static int kvm_init(MachineState *ms)
         qemu_balloon_inhibit(true);
     }
 
+    if (s->kvm_dirty_ring_size) {
+        qemu_thread_create(&s->kvm_dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+
     return 0;
 
 err:
@@ -1759,6 +2336,7 @@ err:
         close(s->fd);
     }
     g_free(s->memory_listener.slots);
+    g_free(s->as_listeners);
 
     return ret;
 }
@@ -1768,18 +2346,50 @@ void kvm_set_sigmask_len(KVMState *s, unsigned int sigmask_len)
     s->sigmask_len = sigmask_len;
 }
 
+static bool kvm_io_global_locking(uint16_t port, MemTxAttrs attrs, int size,
+                                  bool is_write)
+{
+    MemoryRegion *mr;
+    hwaddr xlat, len = size;
+    bool locking;
+
+    rcu_read_lock();
+    mr = address_space_translate(&address_space_io, port, &xlat, &len,
+                                 is_write, attrs);
+    locking = mr->global_locking;
+    rcu_read_unlock();
+
+    return locking;
+}
+
 static void kvm_handle_io(uint16_t port, MemTxAttrs attrs, void *data, int direction,
                           int size, uint32_t count)
 {
+    bool is_write = direction == KVM_EXIT_IO_OUT;
+    bool release_lock = false;
     int i;
     uint8_t *ptr = data;
 
+    /*
+     * A string instruction accesses the same port count times: take the
+     * BQL once around all of them rather than once per access, and only
+     * if the port's MemoryRegion needs it.
+     */
+    if (count > 1 && !qemu_mutex_iothread_locked() &&
+        kvm_io_global_locking(port, attrs, size, is_write)) {
+        qemu_mutex_lock_iothread();
+        release_lock = true;
+    }
+
     for (i = 0; i < count; i++) {
         address_space_rw(&address_space_io, port, attrs,
-                         ptr, size,
-                         direction == KVM_EXIT_IO_OUT);
+                         ptr, size, is_write);
         ptr += size;
     }
+
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 static int kvm_handle_internal_error(CPUState *cpu, struct kvm_run *run)
@@ -1840,6 +2450,244 @@ void kvm_flush_coalesced_mmio_buffer(void)
     s->coalesced_flush_in_progress = false;
 }
 
+/* May be called without the BQL, to avoid taking it for an empty ring */
+bool kvm_coalesced_mmio_pending(void)
+{
+    struct kvm_coalesced_mmio_ring *ring = kvm_state->coalesced_mmio_ring;
+
+    return ring && atomic_read(&ring->first) != atomic_read(&ring->last);
+}
+
+static const char *const kvm_exit_reason_names[KVM_EXIT_STATS_NR] = {
+    [KVM_EXIT_UNKNOWN] = "unknown",
+    [KVM_EXIT_EXCEPTION] = "exception",
+    [KVM_EXIT_IO] = "io",
+    [KVM_EXIT_HYPERCALL] = "hypercall",
+    [KVM_EXIT_DEBUG] = "debug",
+    [KVM_EXIT_HLT] = "hlt",
+    [KVM_EXIT_MMIO] = "mmio",
+    [KVM_EXIT_IRQ_WINDOW_OPEN] = "irq-window-open",
+    [KVM_EXIT_SHUTDOWN] = "shutdown",
+    [KVM_EXIT_FAIL_ENTRY] = "fail-entry",
+    [KVM_EXIT_INTR] = "intr",
+    [KVM_EXIT_SET_TPR] = "set-tpr",
+    [KVM_EXIT_TPR_ACCESS] = "tpr-access",
+    [KVM_EXIT_S390_SIEIC] = "s390-sieic",
+    [KVM_EXIT_S390_RESET] = "s390-reset",
+    [KVM_EXIT_DCR] = "dcr",
+    [KVM_EXIT_NMI] = "nmi",
+    [KVM_EXIT_INTERNAL_ERROR] = "internal-error",
+    [KVM_EXIT_OSI] = "osi",
+    [KVM_EXIT_PAPR_HCALL] = "papr-hcall",
+    [KVM_EXIT_S390_UCONTROL] = "s390-ucontrol",
+    [KVM_EXIT_WATCHDOG] = "watchdog",
+    [KVM_EXIT_S390_TSCH] = "s390-tsch",
+    [KVM_EXIT_EPR] = "epr",
+    [KVM_EXIT_SYSTEM_EVENT] = "system-event",
+    [KVM_EXIT_S390_STSI] = "s390-stsi",
+    [KVM_EXIT_IOAPIC_EOI] = "ioapic-eoi",
+    [KVM_EXIT_HYPERV] = "hyperv",
+    [KVM_EXIT_DIRTY_RING_FULL] = "dirty-ring-full",
+};
+
+static void kvm_account_exit_addr(KVMExitStats *stats, uint64_t key,
+                                 uint64_t ns)
+{
+    unsigned int i, h;
+
+    key |= KVM_EXIT_ADDR_USED;
+    h = (key * 0x9e3779b97f4a7c15ULL) >> (64 - KVM_EXIT_ADDR_BITS);
+
+    for (i = 0; i < KVM_EXIT_ADDR_PROBES; i++) {
+        KVMExitAddrStats *addr = &stats->addrs[(h + i) % KVM_EXIT_ADDR_NR];
+
+        if (!addr->key) {
+            addr->key = key;
+        }
+        if (addr->key == key) {
+            addr->count++;
+            addr->ns += ns;
+            return;
+        }
+    }
+
+    stats->untracked_count++;
+}
+
+static void kvm_account_exit(CPUState *cpu, struct kvm_run *run, int64_t start)
+{
+    KVMExitStats *stats = cpu->kvm_exit_stats;
+    KVMExitReasonStats *reason;
+    uint64_t ns = get_clock() - start;
+
+    reason = &stats->reasons[MIN(run->exit_reason, KVM_EXIT_STATS_NR - 1)];
+    reason->count++;
+    reason->ns += ns;
+    reason->max_ns = MAX(reason->max_ns, ns);
+    reason->hist[MIN(63 - clz64(ns | 1), KVM_EXIT_HIST_NR - 1)]++;
+
+    switch (run->exit_reason) {
+    case KVM_EXIT_MMIO:
+        kvm_account_exit_addr(stats, run->mmio.phys_addr, ns);
+        break;
+    case KVM_EXIT_IO:
+        kvm_account_exit_addr(stats, KVM_EXIT_ADDR_PIO | run->io.port, ns);
+        break;
+    }
+}
+
+static KvmExitReasonStatsList *kvm_exit_reason_stats(KVMExitStats *stats)
+{
+    KvmExitReasonStatsList *head = NULL, **tail = &head;
+    int i, j, nr;
+
+    for (i = 0; i < KVM_EXIT_STATS_NR; i++) {
+        KVMExitReasonStats *reason = &stats->reasons[i];
+        KvmExitReasonStatsList *entry;
+        KvmExitReasonStats *value;
+        uint64List **hist_tail;
+
+        if (!reason->count) {
+            continue;
+        }
+
+        value = g_new0(KvmExitReasonStats, 1);
+        if (kvm_exit_reason_names[i]) {
+            value->reason = g_strdup(kvm_exit_reason_names[i]);
+        } else {
+            value->reason = g_strdup_printf("%s%d",
+                                            i == KVM_EXIT_STATS_NR - 1 ?
+                                            ">=" : "", i);
+        }
+        value->count = reason->count;
+        value->total_ns = reason->ns;
+        value->max_ns = reason->max_ns;
+
+        for (nr = KVM_EXIT_HIST_NR; nr > 0 && !reason->hist[nr - 1]; nr--) {
+            /* skip trailing empty buckets */
+        }
+        hist_tail = &value->histogram;
+        for (j = 0; j < nr; j++) {
+            uint64List *bin = g_new0(uint64List, 1);
+
+            bin->value = reason->hist[j];
+            *hist_tail = bin;
+            hist_tail = &bin->next;
+        }
+
+        entry = g_new0(KvmExitReasonStatsList, 1);
+        entry->value = value;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return head;
+}
+
+static gint kvm_exit_region_cmp(gconstpointer a, gconstpointer b)
+{
+    const KvmExitRegionStats *ra = *(KvmExitRegionStats * const *)a;
+    const KvmExitRegionStats *rb = *(KvmExitRegionStats * const *)b;
+
+    return ra->count < rb->count ? 1 : ra->count > rb->count ? -1 : 0;
+}
+
+static KvmExitRegionStatsList *kvm_exit_region_stats(KVMExitStats *stats)
+{
+    KvmExitRegionStatsList *head = NULL;
+    GHashTable *by_name;
+    GPtrArray *regions;
+    int i;
+
+    /* Addresses are merged by the name of the MemoryRegion they hit */
+    by_name = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    regions = g_ptr_array_new();
+
+    rcu_read_lock();
+    for (i = 0; i < KVM_EXIT_ADDR_NR; i++) {
+        KVMExitAddrStats *addr = &stats->addrs[i];
+        bool pio = addr->key & KVM_EXIT_ADDR_PIO;
+        KvmExitRegionStats *value;
+        MemoryRegion *mr;
+        hwaddr xlat, len = 1;
+        char *key;
+
+        if (!addr->key || !addr->count) {
+            continue;
+        }
+
+        mr = address_space_translate(pio ? &address_space_io :
+                                           &address_space_memory,
+                                     addr->key & ~(KVM_EXIT_ADDR_USED |
+                                                   KVM_EXIT_ADDR_PIO),
+                                     &xlat, &len, false,
+                                     MEMTXATTRS_UNSPECIFIED);
+        key = g_strdup_printf("%d:%s", pio, memory_region_name(mr));
+
+        value = g_hash_table_lookup(by_name, key);
+        if (value) {
+            g_free(key);
+        } else {
+            value = g_new0(KvmExitRegionStats, 1);
+            value->name = g_strdup(memory_region_name(mr));
+            value->pio = pio;
+            g_hash_table_insert(by_name, key, value);
+            g_ptr_array_add(regions, value);
+        }
+        value->count += addr->count;
+        value->total_ns += addr->ns;
+    }
+    rcu_read_unlock();
+
+    g_ptr_array_sort(regions, kvm_exit_region_cmp);
+    for (i = regions->len; i > 0; i--) {
+        KvmExitRegionStatsList *entry = g_new0(KvmExitRegionStatsList, 1);
+
+        entry->value = g_ptr_array_index(regions, i - 1);
+        entry->next = head;
+        head = entry;
+    }
+
+    g_ptr_array_free(regions, true);
+    g_hash_table_destroy(by_name);
+    return head;
+}
+
+KvmExitStatsList *qmp_query_kvm_exit_stats(Error **errp)
+{
+    KvmExitStatsList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    if (!kvm_enabled()) {
+        error_setg(errp, "KVM is not enabled");
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        KVMExitStats *stats = cpu->kvm_exit_stats;
+        KvmExitStatsList *entry;
+        KvmExitStats *value;
+
+        if (!stats) {
+            continue;
+        }
+
+        value = g_new0(KvmExitStats, 1);
+        value->cpu_index = cpu->cpu_index;
+        value->qom_path = object_get_canonical_path(OBJECT(cpu));
+        value->reasons = kvm_exit_reason_stats(stats);
+        value->regions = kvm_exit_region_stats(stats);
+        value->untracked_count = stats->untracked_count;
+
+        entry = g_new0(KvmExitStatsList, 1);
+        entry->value = value;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return head;
+}
+
 static void do_kvm_cpu_synchronize_state(CPUState *cpu, run_on_cpu_data arg)
 {
     if (!cpu->vcpu_dirty) {
@@ -1946,6 +2794,7 @@ int kvm_cpu_exec(CPUState *cpu)
 {
     struct kvm_run *run = cpu->kvm_run;
     int ret, run_ret;
+    int64_t exit_start;
 
     DPRINTF("kvm_cpu_exec()\n");
 
@@ -2016,6 +2865,7 @@ int kvm_cpu_exec(CPUState *cpu)
             break;
         }
 
+        exit_start = get_clock();
         trace_kvm_run_exit(cpu->cpu_index, run->exit_reason);
         switch (run->exit_reason) {
         case KVM_EXIT_IO:
@@ -2031,11 +2881,11 @@ int kvm_cpu_exec(CPUState *cpu)
         case KVM_EXIT_MMIO:
             DPRINTF("handle_mmio\n");
             /* Called outside BQL */
-            address_space_rw(&address_space_memory,
-                             run->mmio.phys_addr, attrs,
-                             run->mmio.data,
-                             run->mmio.len,
-                             run->mmio.is_write);
+            address_space_mmio_rw(cpu, &address_space_memory,
+                                  run->mmio.phys_addr, attrs,
+                                  run->mmio.data,
+                                  run->mmio.len,
+                                  run->mmio.is_write);
             ret = 0;
             break;
         case KVM_EXIT_IRQ_WINDOW_OPEN:
@@ -2055,6 +2905,17 @@ int kvm_cpu_exec(CPUState *cpu)
         case KVM_EXIT_INTERNAL_ERROR:
             ret = kvm_handle_internal_error(cpu, run);
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            /*
+             * The ring of this vcpu is full; the kernel won't let it run
+             * again until some entries have been harvested and reset.
+             */
+            trace_kvm_dirty_ring_full(cpu->cpu_index);
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_reap(kvm_state);
+            qemu_mutex_unlock_iothread();
+            ret = 0;
+            break;
         case KVM_EXIT_SYSTEM_EVENT:
             switch (run->system_event.type) {
             case KVM_SYSTEM_EVENT_SHUTDOWN:
@@ -2083,6 +2944,7 @@ int kvm_cpu_exec(CPUState *cpu)
             ret = kvm_arch_handle_exit(cpu, run);
             break;
         }
+        kvm_account_exit(cpu, run, exit_start);
     } while (ret == 0);
 
     cpu_exec_end(cpu);
@@ -47,6 +47,17 @@ void kvm_flush_coalesced_mmio_buffer(void)
 {
 }
 
+bool kvm_coalesced_mmio_pending(void)
+{
+    return false;
+}
+
+KvmExitStatsList *qmp_query_kvm_exit_stats(Error **errp)
+{
+    error_setg(errp, "KVM is not supported by this QEMU binary");
+    return NULL;
+}
+
 void kvm_cpu_synchronize_state(CPUState *cpu)
 {
 }
@@ -69,6 +80,15 @@ bool kvm_has_sync_mmu(void)
     return false;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return false;
+}
+
+void kvm_dirty_ring_sync(void)
+{
+}
+
 int kvm_has_many_ioeventfds(void)
 {
     return 0;
@@ -212,11 +212,11 @@ static void cpu_exec_nocache(CPUState *cpu, int max_cycles,
        We only end up here when an existing TB is too long.  */
     cflags |= MIN(max_cycles, CF_COUNT_MASK);
 
-    mmap_lock();
+    tb_gen_lock();
     tb = tb_gen_code(cpu, orig_tb->pc, orig_tb->cs_base,
                      orig_tb->flags, cflags);
     tb->orig_tb = orig_tb;
-    mmap_unlock();
+    tb_gen_unlock();
 
     /* execute the generated code */
     trace_exec_tb_nocache(tb, tb->pc);
@@ -243,9 +243,9 @@ void cpu_exec_step_atomic(CPUState *cpu)
     if (sigsetjmp(cpu->jmp_env, 0) == 0) {
         tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
         if (tb == NULL) {
-            mmap_lock();
+            tb_gen_lock();
             tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
-            mmap_unlock();
+            tb_gen_unlock();
         }
 
         start_exclusive();
@@ -260,11 +260,12 @@ void cpu_exec_step_atomic(CPUState *cpu)
         cc->cpu_exec_exit(cpu);
     } else {
         /*
-         * The mmap_lock is dropped by tb_gen_code if it runs out of
+         * The tb_gen_lock is dropped by tb_gen_code if it runs out of
          * memory.
          */
 #ifndef CONFIG_SOFTMMU
         tcg_debug_assert(!have_mmap_lock());
+        tcg_debug_assert(!have_tb_gen_lock());
 #endif
         if (qemu_mutex_iothread_locked()) {
             qemu_mutex_unlock_iothread();
@@ -393,6 +394,31 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
     return;
 }
 
+/*
+ * Replace a TB that reached tcg_hot_tb_threshold executions with one
+ * translated with CF_HOT, which drops the execution counter and runs
+ * the extra optimization passes.  Invalidating the old TB unlinks every
+ * jump into it, so the chained callers pick the new one up through
+ * tb_find.
+ */
+static void tb_retranslate_hot(CPUState *cpu)
+{
+    TranslationBlock *tb = cpu->hot_tb;
+
+    cpu->hot_tb = NULL;
+    tb_gen_lock();
+    mmap_lock();
+    if (atomic_read(&tb->cflags) & (CF_INVALID | CF_HOT)) {
+        mmap_unlock();
+    } else {
+        tb_phys_invalidate(tb, -1);
+        mmap_unlock();
+        tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags,
+                    (tb->cflags & CF_HASH_MASK) | CF_HOT);
+    }
+    tb_gen_unlock();
+}
+
 static inline TranslationBlock *tb_find(CPUState *cpu,
                                         TranslationBlock *last_tb,
                                         int tb_exit, uint32_t cf_mask)
@@ -403,9 +429,9 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
 
     tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
     if (tb == NULL) {
-        mmap_lock();
+        tb_gen_lock();
         tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
-        mmap_unlock();
+        tb_gen_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
         atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
     }
@@ -698,6 +724,7 @@ int cpu_exec(CPUState *cpu)
 #endif /* buggy compiler */
 #ifndef CONFIG_SOFTMMU
         tcg_debug_assert(!have_mmap_lock());
+        tcg_debug_assert(!have_tb_gen_lock());
 #endif
         if (qemu_mutex_iothread_locked()) {
             qemu_mutex_unlock_iothread();
@@ -725,6 +752,11 @@ int cpu_exec(CPUState *cpu)
                 cpu->cflags_next_tb = -1;
             }
 
+            if (unlikely(cpu->hot_tb)) {
+                tb_retranslate_hot(cpu);
+                last_tb = NULL;
+            }
+
             tb = tb_find(cpu, last_tb, tb_exit, cflags);
             cpu_loop_exec_tb(cpu, tb, &last_tb, &tb_exit);
             /* Try to align the host and virtual clocks
@@ -74,6 +74,8 @@ QEMU_BUILD_BUG_ON(sizeof(target_ulong) > sizeof(run_on_cpu_data));
 QEMU_BUILD_BUG_ON(NB_MMU_MODES > 16);
 #define ALL_MMUIDX_BITS ((1 << NB_MMU_MODES) - 1)
 
+unsigned int cpu_vtlb_size = CPU_VTLB_SIZE_DEFAULT;
+
 static inline size_t sizeof_tlb(CPUArchState *env, uintptr_t mmu_idx)
 {
     return env->tlb_mask[mmu_idx] + (1 << CPU_TLB_ENTRY_BITS);
@@ -99,6 +101,8 @@ static void tlb_dyn_init(CPUArchState *env)
         env->tlb_mask[i] = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
         env->tlb_table[i] = g_new(CPUTLBEntry, n_entries);
         env->iotlb[i] = g_new(CPUIOTLBEntry, n_entries);
+        env->tlb_v_table[i] = g_new(CPUTLBEntry, cpu_vtlb_size);
+        env->iotlb_v[i] = g_new(CPUIOTLBEntry, cpu_vtlb_size);
     }
 }
 
@@ -282,13 +286,40 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_mmu_idx_counts(int mmu_idx, size_t *pflush, size_t *pvictim,
+                        size_t *plarge, size_t *pfill)
+{
+    CPUState *cpu;
+    size_t flush = 0, victim = 0, large = 0, fill = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+        CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+
+        flush += atomic_read(&desc->flush_count);
+        victim += atomic_read(&desc->victim_hit_count);
+        large += atomic_read(&desc->large_hit_count);
+        fill += atomic_read(&desc->fill_count);
+    }
+    *pflush = flush;
+    *pvictim = victim;
+    *plarge = large;
+    *pfill = fill;
+}
+
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx)
 {
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+
     tlb_table_flush_by_mmuidx(env, mmu_idx);
-    memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
-    env->tlb_d[mmu_idx].large_page_addr = -1;
-    env->tlb_d[mmu_idx].large_page_mask = -1;
-    env->tlb_d[mmu_idx].vindex = 0;
+    memset(env->tlb_v_table[mmu_idx], -1,
+           cpu_vtlb_size * sizeof(CPUTLBEntry));
+    desc->large_page_addr = -1;
+    desc->large_page_mask = -1;
+    desc->vindex = 0;
+    memset(desc->large, 0, sizeof(desc->large));
+    desc->lindex = 0;
+    atomic_set(&desc->flush_count, desc->flush_count + 1);
 }
 
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
@@ -315,7 +346,14 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 
     qemu_spin_unlock(&env->tlb_c.lock);
 
-    cpu_tb_jmp_cache_clear(cpu);
+    /*
+     * The jump cache is only filled through TLB lookups, so it need not be
+     * cleared if none of the flushed TLBs had any entry: it was cleared when
+     * they were last flushed.
+     */
+    if (to_clean) {
+        cpu_tb_jmp_cache_clear(cpu);
+    }
 
     if (to_clean == ALL_MMUIDX_BITS) {
         atomic_set(&env->tlb_c.full_flush_count,
@@ -413,7 +451,7 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     int k;
 
     assert_cpu_is_self(ENV_GET_CPU(env));
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+    for (k = 0; k < cpu_vtlb_size; k++) {
         if (tlb_flush_entry_locked(&env->tlb_v_table[mmu_idx][k], page)) {
             tlb_n_used_entries_dec(env, mmu_idx);
         }
@@ -537,6 +575,127 @@ void tlb_flush_page_all_cpus_synced(CPUState *src, target_ulong addr)
     tlb_flush_page_by_mmuidx_all_cpus_synced(src, addr, ALL_MMUIDX_BITS);
 }
 
+/*
+ * Above this many pages, a range flush flushes the whole of the MMU
+ * indexes instead of visiting each page.
+ */
+#define TLB_FLUSH_RANGE_MAX_PAGES 64
+
+typedef struct TLBFlushRangeData {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+    bool full;
+} TLBFlushRangeData;
+
+static TLBFlushRangeData tlb_flush_range_data(target_ulong addr,
+                                              target_ulong len,
+                                              uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    /* Page align the range; it may wrap around the end of the address space */
+    d.addr = addr & TARGET_PAGE_MASK;
+    d.len = len ? ((addr + len - 1) & TARGET_PAGE_MASK) - d.addr +
+                  TARGET_PAGE_SIZE : 0;
+    d.idxmap = idxmap;
+    d.full = len > TLB_FLUSH_RANGE_MAX_PAGES * TARGET_PAGE_SIZE;
+    return d;
+}
+
+static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
+                                              TLBFlushRangeData d)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong ofs;
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("range addr:" TARGET_FMT_lx "/" TARGET_FMT_lx
+              " mmu_map:0x%" PRIx16 "\n", d.addr, d.len, d.idxmap);
+
+    if (d.full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(d.idxmap));
+        return;
+    }
+
+    qemu_spin_lock(&env->tlb_c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (d.idxmap & (1 << mmu_idx)) {
+            for (ofs = 0; ofs < d.len; ofs += TARGET_PAGE_SIZE) {
+                tlb_flush_page_locked(env, mmu_idx, d.addr + ofs);
+            }
+        }
+    }
+    qemu_spin_unlock(&env->tlb_c.lock);
+
+    for (ofs = 0; ofs < d.len; ofs += TARGET_PAGE_SIZE) {
+        tb_flush_jmp_cache(cpu, d.addr + ofs);
+    }
+}
+
+static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
+                                              run_on_cpu_data data)
+{
+    TLBFlushRangeData *d = data.host_ptr;
+
+    tlb_flush_range_by_mmuidx_async_0(cpu, *d);
+    g_free(d);
+}
+
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d = tlb_flush_range_data(addr, len, idxmap);
+
+    if (qemu_cpu_is_self(cpu)) {
+        tlb_flush_range_by_mmuidx_async_0(cpu, d);
+    } else {
+        /* Each queued work item owns a copy of the range */
+        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
+                         RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+    }
+}
+
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len)
+{
+    tlb_flush_range_by_mmuidx(cpu, addr, len, ALL_MMUIDX_BITS);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                        target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d = tlb_flush_range_data(addr, len, idxmap);
+    CPUState *dst_cpu;
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
+                             RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+        }
+    }
+    tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                               target_ulong addr,
+                                               target_ulong len,
+                                               uint16_t idxmap)
+{
+    TLBFlushRangeData d = tlb_flush_range_data(addr, len, idxmap);
+    CPUState *dst_cpu;
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
+                             RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+        }
+    }
+    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
+                          RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+}
+
 /* update the TLBs so that writes to code in the virtual page 'addr'
    can be detected */
 void tlb_protect_code(ram_addr_t ram_addr)
@@ -619,7 +778,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                          length);
         }
 
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        for (i = 0; i < cpu_vtlb_size; i++) {
             tlb_reset_dirty_range_locked(&env->tlb_v_table[mmu_idx][i], start1,
                                          length);
         }
@@ -653,7 +812,7 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        for (k = 0; k < cpu_vtlb_size; k++) {
             tlb_set_dirty1_locked(&env->tlb_v_table[mmu_idx][k], vaddr);
         }
     }
@@ -684,6 +843,39 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     env->tlb_d[mmu_idx].large_page_mask = lp_mask;
 }
 
+/*
+ * Remember a large page, so that misses on the rest of it can be filled
+ * by tlb_fill_from_large_page().  This is safe because a flush of any page
+ * within the region of tlb_add_large_page() flushes the whole MMU mode,
+ * and with it the remembered pages.
+ */
+static void tlb_remember_large_page(CPUArchState *env, int mmu_idx,
+                                    target_ulong vaddr, hwaddr paddr,
+                                    MemTxAttrs attrs, int prot,
+                                    target_ulong size)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    target_ulong lp_vaddr = vaddr & -size;
+    CPUTLBLargePage *lp = NULL;
+    int i;
+
+    for (i = 0; i < CPU_TLB_LARGE_SIZE; i++) {
+        if (desc->large[i].size == size && desc->large[i].vaddr == lp_vaddr) {
+            lp = &desc->large[i];
+            break;
+        }
+    }
+    if (lp == NULL) {
+        lp = &desc->large[desc->lindex++ % CPU_TLB_LARGE_SIZE];
+    }
+    lp->vaddr = lp_vaddr;
+    lp->size = size;
+    lp->paddr = (paddr & TARGET_PAGE_MASK) - ((vaddr & TARGET_PAGE_MASK) -
+                                              lp_vaddr);
+    lp->attrs = attrs;
+    lp->prot = prot;
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
  * supplied size is only used by tlb_flush_page.
@@ -712,6 +904,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
         sz = TARGET_PAGE_SIZE;
     } else {
         tlb_add_large_page(env, mmu_idx, vaddr, size);
+        tlb_remember_large_page(env, mmu_idx, vaddr, paddr, attrs, prot, size);
         sz = size;
     }
     vaddr_page = vaddr & TARGET_PAGE_MASK;
@@ -770,7 +963,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, vaddr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = env->tlb_d[mmu_idx].vindex++ % CPU_VTLB_SIZE;
+        unsigned vidx = env->tlb_d[mmu_idx].vindex++ % cpu_vtlb_size;
         CPUTLBEntry *tv = &env->tlb_v_table[mmu_idx][vidx];
 
         /* Evict the old entry into the victim tlb.  */
@@ -995,7 +1188,7 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
     size_t vidx;
 
     assert_cpu_is_self(ENV_GET_CPU(env));
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+    for (vidx = 0; vidx < cpu_vtlb_size; ++vidx) {
         CPUTLBEntry *vtlb = &env->tlb_v_table[mmu_idx][vidx];
         target_ulong cmp;
 
@@ -1019,12 +1212,65 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUIOTLBEntry tmpio, *io = &env->iotlb[mmu_idx][index];
             CPUIOTLBEntry *vio = &env->iotlb_v[mmu_idx][vidx];
             tmpio = *io; *io = *vio; *vio = tmpio;
+            atomic_set(&env->tlb_d[mmu_idx].victim_hit_count,
+                       env->tlb_d[mmu_idx].victim_hit_count + 1);
             return true;
         }
     }
     return false;
 }
 
+/*
+ * Return true if ADDR is within a large page remembered for MMU_IDX that
+ * allows ACCESS_TYPE, and its page has been added to the main tlb.
+ */
+static bool tlb_fill_from_large_page(CPUArchState *env, target_ulong addr,
+                                     MMUAccessType access_type, int mmu_idx)
+{
+    static const int access_prot[] = {
+        [MMU_DATA_LOAD] = PAGE_READ,
+        [MMU_DATA_STORE] = PAGE_WRITE,
+        [MMU_INST_FETCH] = PAGE_EXEC,
+    };
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    int i;
+
+    for (i = 0; i < CPU_TLB_LARGE_SIZE; i++) {
+        CPUTLBLargePage *lp = &desc->large[i];
+        target_ulong page = addr & TARGET_PAGE_MASK;
+
+        if (lp->size && (addr & -lp->size) == lp->vaddr &&
+            (lp->prot & access_prot[access_type])) {
+            /* This remembers the page again, which only refreshes it.  */
+            CPUTLBLargePage l = *lp;
+
+            tlb_set_page_with_attrs(ENV_GET_CPU(env), page,
+                                    l.paddr + (page - l.vaddr), l.attrs,
+                                    l.prot, mmu_idx, l.size);
+            atomic_set(&desc->large_hit_count, desc->large_hit_count + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * tlb_fill(), unless the page can be filled from a large page that was
+ * added to the tlb before without walking the guest page tables again.
+ */
+static void tlb_fill_cached(CPUState *cpu, target_ulong addr, int size,
+                            MMUAccessType access_type, int mmu_idx,
+                            uintptr_t retaddr)
+{
+    CPUArchState *env = cpu->env_ptr;
+
+    if (!tlb_fill_from_large_page(env, addr, access_type, mmu_idx)) {
+        atomic_set(&env->tlb_d[mmu_idx].fill_count,
+                   env->tlb_d[mmu_idx].fill_count + 1);
+        tlb_fill(cpu, addr, size, access_type, mmu_idx, retaddr);
+    }
+}
+
 /* Macro to call the above, with local variables from the use context.  */
 #define VICTIM_TLB_HIT(TY, ADDR) \
   victim_tlb_hit(env, mmu_idx, index, offsetof(CPUTLBEntry, TY), \
@@ -1044,7 +1290,8 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr)
 
     if (unlikely(!tlb_hit(entry->addr_code, addr))) {
         if (!VICTIM_TLB_HIT(addr_code, addr)) {
-            tlb_fill(ENV_GET_CPU(env), addr, 0, MMU_INST_FETCH, mmu_idx, 0);
+            tlb_fill_cached(ENV_GET_CPU(env), addr, 0, MMU_INST_FETCH,
+                            mmu_idx, 0);
             index = tlb_index(env, mmu_idx, addr);
             entry = tlb_entry(env, mmu_idx, addr);
         }
@@ -1082,8 +1329,8 @@ void probe_write(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
     if (!tlb_hit(tlb_addr_write(entry), addr)) {
         /* TLB entry is for a different page */
         if (!VICTIM_TLB_HIT(addr_write, addr)) {
-            tlb_fill(ENV_GET_CPU(env), addr, size, MMU_DATA_STORE,
-                     mmu_idx, retaddr);
+            tlb_fill_cached(ENV_GET_CPU(env), addr, size, MMU_DATA_STORE,
+                            mmu_idx, retaddr);
         }
     }
 }
@@ -1125,8 +1372,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
     /* Check TLB entry and enforce page permissions.  */
     if (!tlb_hit(tlb_addr, addr)) {
         if (!VICTIM_TLB_HIT(addr_write, addr)) {
-            tlb_fill(ENV_GET_CPU(env), addr, 1 << s_bits, MMU_DATA_STORE,
-                     mmu_idx, retaddr);
+            tlb_fill_cached(ENV_GET_CPU(env), addr, 1 << s_bits,
+                            MMU_DATA_STORE, mmu_idx, retaddr);
             index = tlb_index(env, mmu_idx, addr);
             tlbe = tlb_entry(env, mmu_idx, addr);
         }
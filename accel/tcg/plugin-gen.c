@@ -0,0 +1,287 @@
+/*
+ * Instrumentation of translated code for TCG plugins
+ *
+ * The plugins only get to see a block once it is translated, since that
+ * is when its instructions are known.  Their callbacks are emitted at
+ * the end of the op stream, like any other op, and then moved to where
+ * they belong: after the insn_start op of an instruction, or after one
+ * of its guest memory accesses.
+ *
+ * tcg-op.c copies the address of each access to a temporary that stays
+ * valid until right after the access, since the access itself may
+ * overwrite the address (e.g. "ld r1, [r1]").  Nothing uses the copy
+ * when there is no memory callback, and liveness analysis drops it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "tcg/tcg.h"
+#include "tcg/tcg-op.h"
+#include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
+#include "exec/helper-proto.h"
+#include "exec/helper-gen.h"
+#include "exec/translator.h"
+#include "exec/plugin-gen.h"
+
+struct plugin_gen_mem_op {
+    TCGOp *op;
+    TCGv vaddr;
+    uint32_t info;
+};
+
+/*
+ * Temporaries of the callbacks, allocated before the guest code is
+ * translated so that they cannot be one that the translator uses.
+ */
+static __thread struct {
+    TCGv_i32 cpu_index;
+    TCGv_i32 info;
+    TCGv_i64 val;
+    TCGv_ptr f;
+    TCGv_ptr udata;
+} plugin_gen_temps;
+
+void HELPER(plugin_vcpu_udata_cb)(uint32_t cpu_index, void *f, void *udata)
+{
+    ((qemu_plugin_vcpu_udata_cb_t)f)(cpu_index, udata);
+}
+
+void HELPER(plugin_vcpu_mem_cb)(uint32_t cpu_index, uint32_t info,
+                                uint64_t vaddr, void *f, void *udata)
+{
+    ((qemu_plugin_vcpu_mem_cb_t)f)(cpu_index, info, vaddr, udata);
+}
+
+static void gen_movi_ptr(TCGv_ptr ret, const void *p)
+{
+#if UINTPTR_MAX == UINT32_MAX
+    tcg_gen_movi_i32((TCGv_i32)ret, (intptr_t)p);
+#else
+    tcg_gen_movi_i64((TCGv_i64)ret, (intptr_t)p);
+#endif
+}
+
+/*
+ * Move the ops emitted after @last to just after @pos, and return the
+ * last of them so that the next ones can follow.
+ */
+static TCGOp *plugin_gen_move_ops(TCGOp *last, TCGOp *pos)
+{
+    TCGOp *op;
+
+    if (pos == last) {
+        return tcg_last_op();
+    }
+    while ((op = QTAILQ_NEXT(last, link))) {
+        QTAILQ_REMOVE(&tcg_ctx->ops, op, link);
+        QTAILQ_INSERT_AFTER(&tcg_ctx->ops, pos, op, link);
+        pos = op;
+    }
+    return pos;
+}
+
+static void gen_cpu_index(void)
+{
+    tcg_gen_ld_i32(plugin_gen_temps.cpu_index, cpu_env,
+                   -ENV_OFFSET + offsetof(CPUState, cpu_index));
+}
+
+static void gen_inline_op(const struct qemu_plugin_dyn_cb *cb)
+{
+    gen_movi_ptr(plugin_gen_temps.udata, cb->userp);
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        tcg_gen_ld_i64(plugin_gen_temps.val, plugin_gen_temps.udata, 0);
+        tcg_gen_addi_i64(plugin_gen_temps.val, plugin_gen_temps.val,
+                         cb->inline_insn.imm);
+        tcg_gen_st_i64(plugin_gen_temps.val, plugin_gen_temps.udata, 0);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static TCGOp *plugin_gen_exec_cbs(GArray *cbs, TCGOp *pos)
+{
+    guint i;
+
+    for (i = 0; cbs && i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+        TCGOp *last = tcg_last_op();
+
+        if (cb->type == PLUGIN_CB_INLINE) {
+            gen_inline_op(cb);
+        } else {
+            gen_cpu_index();
+            gen_movi_ptr(plugin_gen_temps.f, cb->f);
+            gen_movi_ptr(plugin_gen_temps.udata, cb->userp);
+            gen_helper_plugin_vcpu_udata_cb(plugin_gen_temps.cpu_index,
+                                            plugin_gen_temps.f,
+                                            plugin_gen_temps.udata);
+        }
+        pos = plugin_gen_move_ops(last, pos);
+    }
+    return pos;
+}
+
+static void plugin_gen_mem_cbs(struct qemu_plugin_insn *insn)
+{
+    guint i, j;
+
+    for (i = 0; insn->mem_ops && i < insn->mem_ops->len; i++) {
+        struct plugin_gen_mem_op *mem =
+            &g_array_index(insn->mem_ops, struct plugin_gen_mem_op, i);
+        enum qemu_plugin_mem_rw rw = mem->info & PLUGIN_MEMINFO_STORE ?
+                                     QEMU_PLUGIN_MEM_W : QEMU_PLUGIN_MEM_R;
+        TCGOp *pos = mem->op;
+
+        for (j = 0; j < insn->mem_cbs->len; j++) {
+            struct qemu_plugin_dyn_cb *cb =
+                &g_array_index(insn->mem_cbs, struct qemu_plugin_dyn_cb, j);
+            TCGOp *last = tcg_last_op();
+
+            if (!(cb->rw & rw)) {
+                continue;
+            }
+            if (cb->type == PLUGIN_CB_INLINE) {
+                gen_inline_op(cb);
+            } else {
+                gen_cpu_index();
+                tcg_gen_movi_i32(plugin_gen_temps.info, mem->info);
+                tcg_gen_extu_tl_i64(plugin_gen_temps.val, mem->vaddr);
+                gen_movi_ptr(plugin_gen_temps.f, cb->mem_f);
+                gen_movi_ptr(plugin_gen_temps.udata, cb->userp);
+                gen_helper_plugin_vcpu_mem_cb(plugin_gen_temps.cpu_index,
+                                              plugin_gen_temps.info,
+                                              plugin_gen_temps.val,
+                                              plugin_gen_temps.f,
+                                              plugin_gen_temps.udata);
+            }
+            pos = plugin_gen_move_ops(last, pos);
+        }
+    }
+}
+
+static void plugin_insn_free(gpointer data)
+{
+    struct qemu_plugin_insn *insn = data;
+
+    g_byte_array_unref(insn->data);
+    if (insn->exec_cbs) {
+        g_array_free(insn->exec_cbs, true);
+    }
+    if (insn->mem_cbs) {
+        g_array_free(insn->mem_cbs, true);
+    }
+    if (insn->mem_ops) {
+        g_array_free(insn->mem_ops, true);
+    }
+    g_free(insn);
+}
+
+bool plugin_gen_tb_start(CPUState *cpu, const TranslationBlock *tb)
+{
+    struct qemu_plugin_tb *ptb;
+
+    if (!qemu_plugin_tb_trans_enabled()) {
+        return false;
+    }
+
+    ptb = g_new0(struct qemu_plugin_tb, 1);
+    ptb->vaddr = tb->pc;
+    ptb->insns = g_ptr_array_new_with_free_func(plugin_insn_free);
+    tcg_ctx->plugin_tb = ptb;
+
+    plugin_gen_temps.cpu_index = tcg_temp_new_i32();
+    plugin_gen_temps.info = tcg_temp_new_i32();
+    plugin_gen_temps.val = tcg_temp_new_i64();
+    plugin_gen_temps.f = tcg_temp_new_ptr();
+    plugin_gen_temps.udata = tcg_temp_new_ptr();
+    return true;
+}
+
+void plugin_gen_insn_start(CPUState *cpu, const DisasContextBase *db)
+{
+    struct qemu_plugin_insn *insn = g_new0(struct qemu_plugin_insn, 1);
+
+    insn->vaddr = db->pc_next;
+    insn->data = g_byte_array_new();
+    insn->start = tcg_last_op();
+    g_ptr_array_add(tcg_ctx->plugin_tb->insns, insn);
+    tcg_ctx->plugin_insn = insn;
+}
+
+void plugin_gen_insn_end(CPUState *cpu, const DisasContextBase *db)
+{
+    struct qemu_plugin_insn *insn = tcg_ctx->plugin_insn;
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong pc;
+
+    insn->size = db->pc_next - insn->vaddr;
+    for (pc = insn->vaddr; pc != db->pc_next; pc++) {
+        uint8_t byte = cpu_ldub_code(env, pc);
+
+        g_byte_array_append(insn->data, &byte, 1);
+    }
+    tcg_ctx->plugin_insn = NULL;
+}
+
+void plugin_gen_mem_access(TCGv vaddr, uint32_t info)
+{
+    struct qemu_plugin_insn *insn = tcg_ctx->plugin_insn;
+    struct plugin_gen_mem_op mem = {
+        .op = tcg_last_op(),
+        .vaddr = vaddr,
+        .info = info,
+    };
+
+    if (!insn->mem_ops) {
+        insn->mem_ops = g_array_new(false, false, sizeof(mem));
+    }
+    g_array_append_val(insn->mem_ops, mem);
+}
+
+void plugin_gen_tb_end(CPUState *cpu)
+{
+    struct qemu_plugin_tb *ptb = tcg_ctx->plugin_tb;
+    guint i;
+
+    /* An instruction that hit a breakpoint was never translated */
+    if (tcg_ctx->plugin_insn) {
+        g_ptr_array_remove_index(ptb->insns, ptb->insns->len - 1);
+        tcg_ctx->plugin_insn = NULL;
+    }
+
+    qemu_plugin_tb_trans_cb(ptb);
+
+    for (i = 0; i < ptb->insns->len; i++) {
+        struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, i);
+        TCGOp *pos = insn->start;
+
+        if (i == 0) {
+            pos = plugin_gen_exec_cbs(ptb->exec_cbs, pos);
+        }
+        plugin_gen_exec_cbs(insn->exec_cbs, pos);
+        if (insn->mem_cbs) {
+            plugin_gen_mem_cbs(insn);
+        }
+    }
+
+    tcg_temp_free_i32(plugin_gen_temps.cpu_index);
+    tcg_temp_free_i32(plugin_gen_temps.info);
+    tcg_temp_free_i64(plugin_gen_temps.val);
+    tcg_temp_free_ptr(plugin_gen_temps.f);
+    tcg_temp_free_ptr(plugin_gen_temps.udata);
+
+    g_ptr_array_free(ptb->insns, true);
+    if (ptb->exec_cbs) {
+        g_array_free(ptb->exec_cbs, true);
+    }
+    g_free(ptb);
+    tcg_ctx->plugin_tb = NULL;
+}
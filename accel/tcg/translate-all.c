@@ -132,20 +132,26 @@ struct page_entry {
     bool locked;
 };
 
+#define PAGE_COLLECTION_INLINE 8
+
 /**
  * struct page_collection - tracks a set of pages (i.e. &struct page_entry's)
- * @tree:   Binary search tree (BST) of the pages, with key == page index
- * @max:    Pointer to the page in @tree with the highest page index
+ * @entries: Array of the pages, sorted by ascending page index
+ * @nb:      Number of pages in @entries
+ * @size:    Allocated size of @entries
+ * @inline_entries: Initial storage for @entries
  *
  * To avoid deadlock we lock pages in ascending order of page index.
  * When operating on a set of pages, we need to keep track of them so that
  * we can lock them in order and also unlock them later. For this we collect
- * pages (i.e. &struct page_entry's) in a binary search @tree. Given that the
- * @tree implementation we use does not provide an O(1) operation to obtain the
- * highest-ranked element, we use @max to keep track of the inserted page
- * with the highest index. This is valuable because if a page is not in
- * the tree and its index is higher than @max's, then we can lock it
- * without breaking the locking order rule.
+ * pages (i.e. &struct page_entry's) in the sorted array @entries, which is
+ * searched with a binary search. The last entry has the highest index, so
+ * if a page is not in the set and its index is higher than the last one's,
+ * then we can lock it without breaking the locking order rule.
+ *
+ * Most collections only hold the page being written to and maybe one
+ * neighbour, so the entries start out in @inline_entries and no memory
+ * is allocated per page.
  *
  * Note on naming: 'struct page_set' would be shorter, but we already have a few
  * page_set_*() helpers, so page_collection is used instead to avoid confusion.
@@ -153,8 +159,10 @@ struct page_entry {
  * See also: page_collection_lock().
  */
 struct page_collection {
-    GTree *tree;
-    struct page_entry *max;
+    struct page_entry *entries;
+    size_t nb;
+    size_t size;
+    struct page_entry inline_entries[PAGE_COLLECTION_INLINE];
 };
 
 /* list iterators for lists of tagged pointers in TranslationBlock */
@@ -211,6 +219,8 @@ TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
+/* 0 disables execution counting and the hot TB tier */
+uint32_t tcg_hot_tb_threshold;
 
 static void page_table_config_init(void)
 {
@@ -551,6 +561,57 @@ static void page_lock_pair(PageDesc **ret_p1, tb_page_addr_t phys1,
 /* In user-mode page locks aren't used; mmap_lock is enough */
 #ifdef CONFIG_USER_ONLY
 
+/*
+ * All threads translate with the same TCGContext in user-mode, so
+ * tb_gen_code() is serialized by tb_gen_lock.  It is separate from
+ * mmap_lock, which is only taken to link the new TB to its pages, so
+ * that guest mmap/munmap/mprotect and page faults on code pages do not
+ * wait for translations to finish.  Lock order: tb_gen_lock, then
+ * mmap_lock.
+ */
+static pthread_mutex_t tb_gen_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int tb_gen_lock_count;
+
+/*
+ * Bumped under mmap_lock whenever guest memory that may hold code goes
+ * away or changes; a translation that ran across a bump is redone.
+ */
+static unsigned int tb_invalidate_gen;
+
+void tb_gen_lock(void)
+{
+    if (tb_gen_lock_count++ == 0) {
+        pthread_mutex_lock(&tb_gen_mutex);
+    }
+}
+
+void tb_gen_unlock(void)
+{
+    if (--tb_gen_lock_count == 0) {
+        pthread_mutex_unlock(&tb_gen_mutex);
+    }
+}
+
+bool have_tb_gen_lock(void)
+{
+    return tb_gen_lock_count > 0;
+}
+
+void tb_gen_fork_start(void)
+{
+    assert(!tb_gen_lock_count);
+    pthread_mutex_lock(&tb_gen_mutex);
+}
+
+void tb_gen_fork_end(int child)
+{
+    if (child) {
+        pthread_mutex_init(&tb_gen_mutex, NULL);
+    } else {
+        pthread_mutex_unlock(&tb_gen_mutex);
+    }
+}
+
 #define assert_page_locked(pd) tcg_debug_assert(have_mmap_lock())
 
 static inline void page_lock(PageDesc *pd)
@@ -677,24 +738,56 @@ static inline void page_unlock_tb(const TranslationBlock *tb)
     }
 }
 
-static inline struct page_entry *
-page_entry_new(PageDesc *pd, tb_page_addr_t index)
+/*
+ * Return the entry for page @index in @set, or NULL if there is none.
+ * In both cases, @pos is set to where the entry is or would be inserted.
+ */
+static struct page_entry *
+page_collection_find(struct page_collection *set, tb_page_addr_t index,
+                     size_t *pos)
 {
-    struct page_entry *pe = g_malloc(sizeof(*pe));
+    size_t lo = 0, hi = set->nb;
 
-    pe->index = index;
-    pe->pd = pd;
-    pe->locked = false;
-    return pe;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (set->entries[mid].index < index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *pos = lo;
+    if (lo < set->nb && set->entries[lo].index == index) {
+        return &set->entries[lo];
+    }
+    return NULL;
 }
 
-static void page_entry_destroy(gpointer p)
+static struct page_entry *
+page_collection_insert(struct page_collection *set, size_t pos, PageDesc *pd,
+                       tb_page_addr_t index)
 {
-    struct page_entry *pe = p;
+    struct page_entry *pe;
 
-    g_assert(pe->locked);
-    page_unlock(pe->pd);
-    g_free(pe);
+    if (set->nb == set->size) {
+        set->size *= 2;
+        if (set->entries == set->inline_entries) {
+            set->entries = g_new(struct page_entry, set->size);
+            memcpy(set->entries, set->inline_entries,
+                   sizeof(set->inline_entries));
+        } else {
+            set->entries = g_renew(struct page_entry, set->entries, set->size);
+        }
+    }
+    pe = &set->entries[pos];
+    memmove(pe + 1, pe, (set->nb - pos) * sizeof(*pe));
+    set->nb++;
+
+    pe->index = index;
+    pe->pd = pd;
+    pe->locked = false;
+    return pe;
 }
 
 /* returns false on success */
@@ -718,23 +811,31 @@ static void do_page_entry_lock(struct page_entry *pe)
     pe->locked = true;
 }
 
-static gboolean page_entry_lock(gpointer key, gpointer value, gpointer data)
+static void page_collection_lock_all(struct page_collection *set)
 {
-    struct page_entry *pe = value;
+    size_t i;
 
-    do_page_entry_lock(pe);
-    return FALSE;
+    for (i = 0; i < set->nb; i++) {
+        do_page_entry_lock(&set->entries[i]);
+    }
 }
 
-static gboolean page_entry_unlock(gpointer key, gpointer value, gpointer data)
+/* Drop the locks taken so far, to take them again in order */
+static void page_collection_backoff(struct page_collection *set)
 {
-    struct page_entry *pe = value;
+    size_t i;
+
+    atomic_set(&tcg_ctx->page_lock_retry_count,
+               tcg_ctx->page_lock_retry_count + 1);
+
+    for (i = 0; i < set->nb; i++) {
+        struct page_entry *pe = &set->entries[i];
 
-    if (pe->locked) {
-        pe->locked = false;
-        page_unlock(pe->pd);
+        if (pe->locked) {
+            pe->locked = false;
+            page_unlock(pe->pd);
+        }
     }
-    return FALSE;
 }
 
 /*
@@ -746,8 +847,9 @@ static bool page_trylock_add(struct page_collection *set, tb_page_addr_t addr)
     tb_page_addr_t index = addr >> TARGET_PAGE_BITS;
     struct page_entry *pe;
     PageDesc *pd;
+    size_t pos;
 
-    pe = g_tree_lookup(set->tree, &index);
+    pe = page_collection_find(set, index, &pos);
     if (pe) {
         return false;
     }
@@ -757,15 +859,13 @@ static bool page_trylock_add(struct page_collection *set, tb_page_addr_t addr)
         return false;
     }
 
-    pe = page_entry_new(pd, index);
-    g_tree_insert(set->tree, &pe->index, pe);
+    pe = page_collection_insert(set, pos, pd, index);
 
     /*
      * If this is either (1) the first insertion or (2) a page whose index
      * is higher than any other so far, just lock the page and move on.
      */
-    if (set->max == NULL || pe->index > set->max->index) {
-        set->max = pe;
+    if (pos == set->nb - 1) {
         do_page_entry_lock(pe);
         return false;
     }
@@ -776,17 +876,14 @@ static bool page_trylock_add(struct page_collection *set, tb_page_addr_t addr)
     return page_entry_trylock(pe);
 }
 
-static gint tb_page_addr_cmp(gconstpointer ap, gconstpointer bp, gpointer udata)
+static struct page_collection *page_collection_new(void)
 {
-    tb_page_addr_t a = *(const tb_page_addr_t *)ap;
-    tb_page_addr_t b = *(const tb_page_addr_t *)bp;
+    struct page_collection *set = g_malloc(sizeof(*set));
 
-    if (a == b) {
-        return 0;
-    } else if (a < b) {
-        return -1;
-    }
-    return 1;
+    set->entries = set->inline_entries;
+    set->nb = 0;
+    set->size = PAGE_COLLECTION_INLINE;
+    return set;
 }
 
 /*
@@ -797,7 +894,7 @@ static gint tb_page_addr_cmp(gconstpointer ap, gconstpointer bp, gpointer udata)
 struct page_collection *
 page_collection_lock(tb_page_addr_t start, tb_page_addr_t end)
 {
-    struct page_collection *set = g_malloc(sizeof(*set));
+    struct page_collection *set = page_collection_new();
     tb_page_addr_t index;
     PageDesc *pd;
 
@@ -805,13 +902,10 @@ page_collection_lock(tb_page_addr_t start, tb_page_addr_t end)
     end   >>= TARGET_PAGE_BITS;
     g_assert(start <= end);
 
-    set->tree = g_tree_new_full(tb_page_addr_cmp, NULL, NULL,
-                                page_entry_destroy);
-    set->max = NULL;
     assert_no_pages_locked();
 
  retry:
-    g_tree_foreach(set->tree, page_entry_lock, NULL);
+    page_collection_lock_all(set);
 
     for (index = start; index <= end; index++) {
         TranslationBlock *tb;
@@ -822,7 +916,7 @@ page_collection_lock(tb_page_addr_t start, tb_page_addr_t end)
             continue;
         }
         if (page_trylock_add(set, index << TARGET_PAGE_BITS)) {
-            g_tree_foreach(set->tree, page_entry_unlock, NULL);
+            page_collection_backoff(set);
             goto retry;
         }
         assert_page_locked(pd);
@@ -831,7 +925,7 @@ page_collection_lock(tb_page_addr_t start, tb_page_addr_t end)
                 (tb->page_addr[1] != -1 &&
                  page_trylock_add(set, tb->page_addr[1]))) {
                 /* drop all locks, and reacquire in order */
-                g_tree_foreach(set->tree, page_entry_unlock, NULL);
+                page_collection_backoff(set);
                 goto retry;
             }
         }
@@ -841,8 +935,15 @@ page_collection_lock(tb_page_addr_t start, tb_page_addr_t end)
 
 void page_collection_unlock(struct page_collection *set)
 {
-    /* entries are unlocked and freed via page_entry_destroy */
-    g_tree_destroy(set->tree);
+    size_t i;
+
+    for (i = 0; i < set->nb; i++) {
+        g_assert(set->entries[i].locked);
+        page_unlock(set->entries[i].pd);
+    }
+    if (set->entries != set->inline_entries) {
+        g_free(set->entries);
+    }
     g_free(set);
 }
 
@@ -1025,6 +1126,29 @@ static inline void *alloc_code_gen_buffer(void)
                         PAGE_EXECUTE_READWRITE);
 }
 #else
+/* Map the buffer so that it starts on a huge page, which lets the regions
+   of tcg_region_init start on one as well.  */
+static void *mmap_code_gen_buffer(void *start, size_t size, int prot,
+                                  int flags)
+{
+    size_t align = QEMU_VMALLOC_ALIGN;
+    void *buf, *aligned;
+
+    if (align <= qemu_real_host_page_size) {
+        return mmap(start, size, prot, flags, -1, 0);
+    }
+    buf = mmap(start, size + align, prot, flags, -1, 0);
+    if (buf == MAP_FAILED) {
+        return buf;
+    }
+    aligned = QEMU_ALIGN_PTR_UP(buf, align);
+    if (aligned != buf) {
+        munmap(buf, aligned - buf);
+    }
+    munmap(aligned + size, buf + align - aligned);
+    return aligned;
+}
+
 static inline void *alloc_code_gen_buffer(void)
 {
     int prot = PROT_WRITE | PROT_READ | PROT_EXEC;
@@ -1061,7 +1185,7 @@ static inline void *alloc_code_gen_buffer(void)
 #  endif
 # endif
 
-    buf = mmap((void *)start, size, prot, flags, -1, 0);
+    buf = mmap_code_gen_buffer((void *)start, size, prot, flags);
     if (buf == MAP_FAILED) {
         return NULL;
     }
@@ -1247,6 +1371,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 
     CPU_FOREACH(cpu) {
         cpu_tb_jmp_cache_clear(cpu);
+        cpu->hot_tb = NULL;
     }
 
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
@@ -1270,6 +1395,50 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+static void tb_evict_invalidate(TranslationBlock *tb)
+{
+    tb_phys_invalidate(tb, -1);
+}
+
+/*
+ * Make room in the code cache by evicting the oldest region, rather than
+ * flushing all of it; fall back to a full flush if no region can go.
+ */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    bool done;
+
+    mmap_lock();
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
+        /* flushed in the meantime */
+        done = true;
+    } else {
+        CPUState *other;
+
+        /* hot_tb may point into the region we evict */
+        CPU_FOREACH(other) {
+            other->hot_tb = NULL;
+        }
+        done = tcg_region_evict(tb_evict_invalidate);
+        if (done) {
+            atomic_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+        }
+    }
+    mmap_unlock();
+
+    if (!done) {
+        do_tb_flush(cpu, tb_flush_count);
+    }
+}
+
+static void tb_evict(CPUState *cpu)
+{
+    unsigned tb_flush_count = atomic_mb_read(&tb_ctx.tb_flush_count);
+
+    async_safe_run_on_cpu(cpu, do_tb_evict,
+                          RUN_ON_CPU_HOST_INT(tb_flush_count));
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1664,6 +1833,15 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
 }
 
 /* Called with mmap_lock held for user mode emulation.  */
+/* Give back the code buffer space of a TB that was never linked */
+static void tb_discard_gen_code(tcg_insn_unit *gen_code_buf)
+{
+    uintptr_t orig_aligned = (uintptr_t)gen_code_buf;
+
+    orig_aligned -= ROUND_UP(sizeof(TranslationBlock), qemu_icache_linesize);
+    atomic_set(&tcg_ctx->code_gen_ptr, (void *)orig_aligned);
+}
+
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags, int cflags)
@@ -1674,11 +1852,16 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size;
+#ifdef CONFIG_USER_ONLY
+    unsigned int invalidate_gen;
+#endif
 #ifdef CONFIG_PROFILER
     TCGProfile *prof = &tcg_ctx->prof;
     int64_t ti;
 #endif
-    assert_memory_lock();
+#ifdef CONFIG_USER_ONLY
+    tcg_debug_assert(have_tb_gen_lock());
+#endif
 
     phys_pc = get_page_addr_code(env, pc);
 
@@ -1691,12 +1874,16 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     cflags &= ~CF_CLUSTER_MASK;
     cflags |= cpu->cluster_index << CF_CLUSTER_SHIFT;
 
+ retranslate:
+#ifdef CONFIG_USER_ONLY
+    invalidate_gen = atomic_read(&tb_invalidate_gen);
+#endif
  buffer_overflow:
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
-        mmap_unlock();
+        /* eviction or flush must be done */
+        tb_evict(cpu);
+        tb_gen_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
         cpu_loop_exit(cpu);
@@ -1823,17 +2010,24 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if ((pc & TARGET_PAGE_MASK) != virt_page2) {
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
+    mmap_lock();
+#ifdef CONFIG_USER_ONLY
+    /* The guest code may have changed under the translator */
+    if (unlikely(invalidate_gen != tb_invalidate_gen)) {
+        mmap_unlock();
+        tb_discard_gen_code(gen_code_buf);
+        goto retranslate;
+    }
+#endif
     /*
      * No explicit memory barrier is required -- tb_link_page() makes the
      * TB visible in a consistent state.
      */
     existing_tb = tb_link_page(tb, phys_pc, phys_page2);
+    mmap_unlock();
     /* if the TB already exists, discard what we just translated */
     if (unlikely(existing_tb != tb)) {
-        uintptr_t orig_aligned = (uintptr_t)gen_code_buf;
-
-        orig_aligned -= ROUND_UP(sizeof(*tb), qemu_icache_linesize);
-        atomic_set(&tcg_ctx->code_gen_ptr, (void *)orig_aligned);
+        tb_discard_gen_code(gen_code_buf);
         return existing_tb;
     }
     tcg_tb_insert(tb);
@@ -1994,6 +2188,9 @@ void tb_invalidate_phys_range(target_ulong start, target_ulong end)
         tb_invalidate_phys_page_range__locked(pages, pd, start, bound, 0);
     }
     page_collection_unlock(pages);
+#ifdef CONFIG_USER_ONLY
+    atomic_set(&tb_invalidate_gen, tb_invalidate_gen + 1);
+#endif
 }
 
 #ifdef CONFIG_SOFTMMU
@@ -2001,20 +2198,28 @@ void tb_invalidate_phys_range(target_ulong start, target_ulong end)
  * Called via softmmu_template.h when code areas are written to with
  * iothread mutex not held.
  *
- * Call with all @pages in the range [@start, @start + len[ locked.
+ * Returns the pages that must stay locked until the write is done, to be
+ * released with page_collection_unlock(); NULL if there are none.
+ * Writes that the page's code bitmap shows miss all TBs only lock the
+ * page written to.  The pages of the TBs on it are locked only when
+ * some TB has to be invalidated.
  */
-void tb_invalidate_phys_page_fast(struct page_collection *pages,
-                                  tb_page_addr_t start, int len)
+struct page_collection *
+tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
 {
+    struct page_collection *pages;
     PageDesc *p;
 
     assert_memory_lock();
 
     p = page_find(start >> TARGET_PAGE_BITS);
     if (!p) {
-        return;
+        return NULL;
     }
+    atomic_set(&tcg_ctx->smc_write_count, tcg_ctx->smc_write_count + 1);
 
+    pages = page_collection_new();
+    page_trylock_add(pages, start);
     assert_page_locked(p);
     if (!p->code_bitmap &&
         ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
@@ -2026,13 +2231,17 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
 
         nr = start & ~TARGET_PAGE_MASK;
         b = p->code_bitmap[BIT_WORD(nr)] >> (nr & (BITS_PER_LONG - 1));
-        if (b & ((1 << len) - 1)) {
-            goto do_invalidate;
+        if (!(b & ((1 << len) - 1))) {
+            atomic_set(&tcg_ctx->smc_fast_write_count,
+                       tcg_ctx->smc_fast_write_count + 1);
+            return pages;
         }
-    } else {
-    do_invalidate:
-        tb_invalidate_phys_page_range__locked(pages, p, start, start + len, 1);
     }
+
+    page_collection_unlock(pages);
+    pages = page_collection_lock(start, start + len);
+    tb_invalidate_phys_page_range__locked(pages, p, start, start + len, 1);
+    return pages;
 }
 #else
 /* Called with mmap_lock held. If pc is not 0 then it indicates the
@@ -2260,6 +2469,7 @@ struct tb_tree_stats {
     size_t direct_jmp_count;
     size_t direct_jmp2_count;
     size_t cross_page;
+    size_t hot;
 };
 
 static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
@@ -2276,6 +2486,9 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     if (tb->page_addr[1] != -1) {
         tst->cross_page++;
     }
+    if (tb->cflags & CF_HOT) {
+        tst->hot++;
+    }
     if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
         tst->direct_jmp_count++;
         if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
@@ -2290,6 +2503,10 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t smc_writes, smc_fast_writes, lock_retries;
+    uint64_t itlb_misses, host_insns;
+    CPUState *cpu;
+    int i;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2311,6 +2528,8 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 tst.target_size ? (double)tst.host_size / tst.target_size : 0);
     cpu_fprintf(f, "cross page TB count %zu (%zu%%)\n", tst.cross_page,
             nb_tbs ? (tst.cross_page * 100) / nb_tbs : 0);
+    cpu_fprintf(f, "hot TB count        %zu (%zu%%)\n", tst.hot,
+                nb_tbs ? (tst.hot * 100) / nb_tbs : 0);
     cpu_fprintf(f, "direct jump count   %zu (%zu%%) (2 jumps=%zu %zu%%)\n",
                 tst.direct_jmp_count,
                 nb_tbs ? (tst.direct_jmp_count * 100) / nb_tbs : 0,
@@ -2324,12 +2543,38 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %u\n",
                 atomic_read(&tb_ctx.tb_flush_count));
+    cpu_fprintf(f, "TB region evictions %u\n",
+                atomic_read(&tb_ctx.tb_evict_count));
+    CPU_FOREACH(cpu) {
+        cpu_fprintf(f, "CPU %d jmp cache    %zu hits, %zu misses\n",
+                    cpu->cpu_index, atomic_read(&cpu->tb_jmp_cache_hits),
+                    atomic_read(&cpu->tb_jmp_cache_misses));
+    }
     cpu_fprintf(f, "TB invalidate count %zu\n", tcg_tb_phys_invalidate_count());
 
+    tcg_smc_counts(&smc_writes, &smc_fast_writes, &lock_retries);
+    cpu_fprintf(f, "SMC writes          %zu (%zu not hitting code)\n",
+                smc_writes, smc_fast_writes);
+    cpu_fprintf(f, "page lock retries   %zu\n", lock_retries);
+
+    if (tcg_itlb_counts(&itlb_misses, &host_insns)) {
+        cpu_fprintf(f, "host iTLB misses    %" PRIu64
+                    " (%0.2f per 1000 insns)\n", itlb_misses,
+                    host_insns ? itlb_misses * 1000.0 / host_insns : 0);
+    }
+
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     cpu_fprintf(f, "TLB full flushes    %zu\n", flush_full);
     cpu_fprintf(f, "TLB partial flushes %zu\n", flush_part);
     cpu_fprintf(f, "TLB elided flushes  %zu\n", flush_elide);
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        size_t flushes, victim_hits, large_hits, fills;
+
+        tlb_mmu_idx_counts(i, &flushes, &victim_hits, &large_hits, &fills);
+        cpu_fprintf(f, "TLB mmu_idx %d       %zu flushes, %zu victim hits, "
+                    "%zu large page hits, %zu fills\n",
+                    i, flushes, victim_hits, large_hits, fills);
+    }
     tcg_dump_info(f, cpu_fprintf);
 }
 
@@ -2459,6 +2704,111 @@ void page_dump(FILE *f)
     walk_memory_regions(f, dump_region);
 }
 
+/*
+ * The valid parts of the guest address space, as [start, last] ranges that
+ * never overlap nor touch, so that free space can be found by jumping from
+ * mapping to mapping instead of probing every page.  Protected by the
+ * mmap_lock like the page flags.
+ */
+typedef struct PageVMA {
+    target_ulong start;
+    target_ulong last;
+} PageVMA;
+
+static GTree *page_vmas;
+
+/* Ranges that overlap compare equal, so a lookup finds any of them */
+static gint page_vma_cmp(gconstpointer ap, gconstpointer bp)
+{
+    const PageVMA *a = ap;
+    const PageVMA *b = bp;
+
+    if (a->last < b->start) {
+        return -1;
+    }
+    if (a->start > b->last) {
+        return 1;
+    }
+    return 0;
+}
+
+static void page_vma_add(target_ulong start, target_ulong last)
+{
+    PageVMA *vma = g_new(PageVMA, 1);
+
+    vma->start = start;
+    vma->last = last;
+    g_tree_insert(page_vmas, vma, vma);
+}
+
+static void page_vma_insert(target_ulong start, target_ulong last)
+{
+    PageVMA key, *vma;
+
+    if (!page_vmas) {
+        page_vmas = g_tree_new_full((GCompareDataFunc)page_vma_cmp, NULL,
+                                    g_free, NULL);
+    }
+
+    /* Swallow the mappings that overlap or touch the new one */
+    for (;;) {
+        key.start = start ? start - 1 : 0;
+        key.last = last + 1 ? last + 1 : last;
+        vma = g_tree_lookup(page_vmas, &key);
+        if (!vma) {
+            break;
+        }
+        start = MIN(start, vma->start);
+        last = MAX(last, vma->last);
+        g_tree_remove(page_vmas, vma);
+    }
+    page_vma_add(start, last);
+}
+
+static void page_vma_remove(target_ulong start, target_ulong last)
+{
+    PageVMA key = { .start = start, .last = last };
+    PageVMA *vma;
+
+    if (!page_vmas) {
+        return;
+    }
+
+    while ((vma = g_tree_lookup(page_vmas, &key))) {
+        PageVMA old = *vma;
+
+        g_tree_remove(page_vmas, vma);
+        if (old.start < start) {
+            page_vma_add(old.start, start - 1);
+        }
+        if (old.last > last) {
+            page_vma_add(last + 1, old.last);
+        }
+    }
+}
+
+/*
+ * Return true if any page in [start, last] is valid, and store in
+ * @vma_start the start of one of the mappings covering them.
+ */
+bool page_range_busy(target_ulong start, target_ulong last,
+                     target_ulong *vma_start)
+{
+    PageVMA key = { .start = start, .last = last };
+    PageVMA *vma;
+
+    assert_memory_lock();
+    if (!page_vmas) {
+        return false;
+    }
+    vma = g_tree_lookup(page_vmas, &key);
+    if (!vma) {
+        return false;
+    }
+    *vma_start = vma->start;
+    return true;
+}
+
 int page_get_flags(target_ulong address)
 {
     PageDesc *p;
@@ -2493,6 +2843,12 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
         flags |= PAGE_WRITE_ORG;
     }
 
+    if (flags & PAGE_VALID) {
+        page_vma_insert(start, end - 1);
+    } else {
+        page_vma_remove(start, end - 1);
+    }
+
     for (addr = start, len = end - start;
          len != 0;
          len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
@@ -17,6 +17,7 @@
 #include "exec/gen-icount.h"
 #include "exec/log.h"
 #include "exec/translator.h"
+#include "exec/plugin-gen.h"
 
 /* Pairs with tcg_clear_temp_count.
    To be called by #TranslatorOps.{translate_insn,tb_stop} if
@@ -31,10 +32,19 @@ void translator_loop_temp_check(DisasContextBase *db)
     }
 }
 
+bool translator_trace_jump(DisasContextBase *db, target_ulong dest)
+{
+    return (tb_cflags(db->tb) & CF_HOT)
+        && !db->singlestep_enabled && !singlestep
+        && dest > db->pc_next
+        && (dest & TARGET_PAGE_MASK) == (db->pc_first & TARGET_PAGE_MASK);
+}
+
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb)
 {
     int bp_insn = 0;
+    bool plugin_enabled;
 
     /* Initialize DisasContext */
     db->tb = tb;
@@ -59,6 +69,9 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
+    /* Before the reset: the plugin temporaries live until the end */
+    plugin_enabled = plugin_gen_tb_start(cpu, tb);
+
     /* Reset the temp count so that we can identify leaks */
     tcg_clear_temp_count();
 
@@ -72,6 +85,10 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
         ops->insn_start(db, cpu);
         tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
+        if (plugin_enabled) {
+            plugin_gen_insn_start(cpu, db);
+        }
+
         /* Pass breakpoint hits to target for further processing */
         if (!db->singlestep_enabled
             && unlikely(!QTAILQ_EMPTY(&cpu->breakpoints))) {
@@ -107,6 +124,10 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
             ops->translate_insn(db, cpu);
         }
 
+        if (plugin_enabled) {
+            plugin_gen_insn_end(cpu, db);
+        }
+
         /* Stop translation if translate_insn so indicated.  */
         if (db->is_jmp != DISAS_NEXT) {
             break;
@@ -122,6 +143,9 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
     /* Emit code to exit the TB, as indicated by db->is_jmp.  */
     ops->tb_stop(db, cpu);
+    if (plugin_enabled) {
+        plugin_gen_tb_end(cpu);
+    }
     gen_tb_end(db->tb, db->num_insns - bp_insn);
 
     /* The disas_log hook may use these values rather than recompute.  */
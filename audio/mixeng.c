@@ -158,6 +158,94 @@
 #undef ITYPE
 #undef SHIFT
 
+#if defined(__SSE2__) && !defined(FLOAT_MIXENG)
+#include <emmintrin.h>
+
+/*
+ * Signed 16 bit native endian stereo is what nearly every guest and host
+ * use, so it gets vectorized kernels.  They give exactly the same results
+ * as the templated ones, which handle whatever does not fill a vector.
+ */
+static void conv_natural_int16_t_to_stereo_sse2(struct st_sample *dst,
+                                                const void *src, int samples)
+{
+    const __m128i *in = src;
+    __m128i *out = (__m128i *)dst;
+    __m128i zero = _mm_setzero_si128();
+
+    /* Four frames at a time: x << 16 is the sign extension of x:0 */
+    for (; samples >= 4; samples -= 4) {
+        __m128i x = _mm_loadu_si128(in++);
+        __m128i lo = _mm_unpacklo_epi16(zero, x);
+        __m128i hi = _mm_unpackhi_epi16(zero, x);
+        __m128i lo_sign = _mm_srai_epi32(lo, 31);
+        __m128i hi_sign = _mm_srai_epi32(hi, 31);
+
+        _mm_storeu_si128(out++, _mm_unpacklo_epi32(lo, lo_sign));
+        _mm_storeu_si128(out++, _mm_unpackhi_epi32(lo, lo_sign));
+        _mm_storeu_si128(out++, _mm_unpacklo_epi32(hi, hi_sign));
+        _mm_storeu_si128(out++, _mm_unpackhi_epi32(hi, hi_sign));
+    }
+    conv_natural_int16_t_to_stereo((struct st_sample *)out, in, samples);
+}
+
+/* Clip two frames to four int32; SSE2 has no 64 bit compares */
+static inline __m128i clip_int16_sse2(__m128i a, __m128i b)
+{
+    const __m128i minus_one = _mm_set1_epi32(-1);
+    const __m128i sign = _mm_set1_epi32(INT32_MIN);
+    const __m128i max = _mm_set1_epi32((0x7f000000 ^ INT32_MIN) - 1);
+    __m128i lo, hi, over, under, mid;
+
+    /* Split the int64 samples into their low and high halves */
+    a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+    b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+    lo = _mm_unpacklo_epi64(a, b);
+    hi = _mm_unpackhi_epi64(a, b);
+
+    /* v >= 0x7f000000, with an unsigned compare of the low halves */
+    over = _mm_or_si128(_mm_cmpgt_epi32(hi, _mm_setzero_si128()),
+                        _mm_and_si128(_mm_cmpeq_epi32(hi, _mm_setzero_si128()),
+                                      _mm_cmpgt_epi32(_mm_xor_si128(lo, sign),
+                                                      max)));
+    /* v < -2^31 */
+    under = _mm_or_si128(_mm_cmpgt_epi32(minus_one, hi),
+                         _mm_and_si128(_mm_cmpeq_epi32(hi, minus_one),
+                                       _mm_cmpgt_epi32(lo, minus_one)));
+    mid = _mm_srai_epi32(lo, 16);
+
+    mid = _mm_andnot_si128(_mm_or_si128(over, under), mid);
+    mid = _mm_or_si128(mid, _mm_and_si128(over, _mm_set1_epi32(SHRT_MAX)));
+    return _mm_or_si128(mid, _mm_and_si128(under, _mm_set1_epi32(SHRT_MIN)));
+}
+
+static void clip_natural_int16_t_from_stereo_sse2(void *dst,
+                                                  const struct st_sample *src,
+                                                  int samples)
+{
+    const __m128i *in = (const __m128i *)src;
+    __m128i *out = dst;
+
+    for (; samples >= 4; samples -= 4) {
+        __m128i x = clip_int16_sse2(_mm_loadu_si128(in),
+                                    _mm_loadu_si128(in + 1));
+        __m128i y = clip_int16_sse2(_mm_loadu_si128(in + 2),
+                                    _mm_loadu_si128(in + 3));
+
+        _mm_storeu_si128(out++, _mm_packs_epi32(x, y));
+        in += 4;
+    }
+    clip_natural_int16_t_from_stereo(out, (const struct st_sample *)in,
+                                     samples);
+}
+
+#define conv_s16_stereo conv_natural_int16_t_to_stereo_sse2
+#define clip_s16_stereo clip_natural_int16_t_from_stereo_sse2
+#else
+#define conv_s16_stereo conv_natural_int16_t_to_stereo
+#define clip_s16_stereo clip_natural_int16_t_from_stereo
+#endif
+
 t_sample *mixeng_conv[2][2][2][3] = {
     {
         {
@@ -201,7 +289,7 @@ t_sample *mixeng_conv[2][2][2][3] = {
         {
             {
                 conv_natural_int8_t_to_stereo,
-                conv_natural_int16_t_to_stereo,
+                conv_s16_stereo,
                 conv_natural_int32_t_to_stereo
             },
             {
@@ -256,7 +344,7 @@ f_sample *mixeng_clip[2][2][2][3] = {
         {
             {
                 clip_natural_int8_t_from_stereo,
-                clip_natural_int16_t_from_stereo,
+                clip_s16_stereo,
                 clip_natural_int32_t_from_stereo
             },
             {
@@ -362,12 +450,37 @@ void *st_rate_start (int inrate, int outrate)
     return rate;
 }
 
+static void mixeng_mix(struct st_sample *dst, const struct st_sample *src,
+                       int n)
+{
+#if defined(__SSE2__) && !defined(FLOAT_MIXENG)
+    /* A sample fills a vector, so this is a plain vector add */
+    __m128i *out = (__m128i *)dst;
+    const __m128i *in = (const __m128i *)src;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        _mm_storeu_si128(out + i, _mm_add_epi64(_mm_loadu_si128(out + i),
+                                                _mm_loadu_si128(in + i)));
+    }
+#else
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i].l += src[i].l;
+        dst[i].r += src[i].r;
+    }
+#endif
+}
+
 #define NAME st_rate_flow_mix
 #define OP(a, b) a += b
+#define OP_N(dst, src, n) mixeng_mix(dst, src, n)
 #include "rate_template.h"
 
 #define NAME st_rate_flow
 #define OP(a, b) a = b
+#define OP_N(dst, src, n) memcpy(dst, src, (n) * sizeof(struct st_sample))
 #include "rate_template.h"
 
 void st_rate_stop (void *opaque)
@@ -386,6 +499,10 @@ void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
         mixeng_clear (buf, len);
         return;
     }
+    if (vol->l == nominal_volume.l && vol->r == nominal_volume.r) {
+        /* Full volume, which is what every voice starts with */
+        return;
+    }
 
     while (len--) {
 #ifdef FLOAT_MIXENG
@@ -25,6 +25,10 @@
 #include "sysemu/cryptodev.h"
 #include "hw/boards.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
+#include "qemu/main-loop.h"
+#include "qemu/thread.h"
+#include "block/thread-pool.h"
 #include "standard-headers/linux/virtio_crypto.h"
 #include "crypto/cipher.h"
 
@@ -46,24 +50,62 @@ typedef struct CryptoDevBackendBuiltinSession {
     QCryptoCipher *cipher;
     uint8_t direction; /* encryption or decryption */
     uint8_t type; /* cipher? hash? aead? */
+    /* Serializes the workers using @cipher, whose IV is state */
+    QemuMutex lock;
+    /* Queued or running requests; the session is freed when both are 0 */
+    unsigned int inflight;
+    bool closed;
     QTAILQ_ENTRY(CryptoDevBackendBuiltinSession) next;
 } CryptoDevBackendBuiltinSession;
 
+/* A request of the asynchronous mode */
+typedef struct CryptoDevBackendBuiltinReq {
+    CryptoDevBackendBuiltinSession *sess;
+    CryptoDevBackendSymOpInfo *op_info;
+    CryptoDevCompletionFunc *cb;
+    void *opaque;
+    int ret;
+    Error *err;
+    QSIMPLEQ_ENTRY(CryptoDevBackendBuiltinReq) next;
+} CryptoDevBackendBuiltinReq;
+
+typedef QSIMPLEQ_HEAD(, CryptoDevBackendBuiltinReq)
+        CryptoDevBackendBuiltinReqList;
+
+/* Requests handed to a worker thread at once */
+typedef struct CryptoDevBackendBuiltinBatch {
+    CryptoDevBackendBuiltinReqList reqs;
+} CryptoDevBackendBuiltinBatch;
+
 /* Max number of symmetric sessions */
 #define MAX_NUM_SESSIONS 256
 
 #define CRYPTODEV_BUITLIN_MAX_AUTH_KEY_LEN    512
 #define CRYPTODEV_BUITLIN_MAX_CIPHER_KEY_LEN  64
 
+#define CRYPTODEV_BUILTIN_DEFAULT_BATCH_SIZE  32
+
 struct CryptoDevBackendBuiltin {
     CryptoDevBackend parent_obj;
 
     CryptoDevBackendBuiltinSession *sessions[MAX_NUM_SESSIONS];
+
+    /* Run the operations in the thread pool instead of the main loop */
+    bool async;
+    uint32_t batch_size;
+    /* Requests that wait for submit_bh, at most batch_size of them */
+    CryptoDevBackendBuiltinReqList pending;
+    uint32_t npending;
+    QEMUBH *submit_bh;
 };
 
+static void cryptodev_builtin_submit_bh(void *opaque);
+
 static void cryptodev_builtin_init(
              CryptoDevBackend *backend, Error **errp)
 {
+    CryptoDevBackendBuiltin *builtin =
+                      CRYPTODEV_BACKEND_BUILTIN(backend);
     /* Only support one queue */
     int queues = backend->conf.peers.queues;
     CryptoDevBackendClient *cc;
@@ -81,6 +123,11 @@ static void cryptodev_builtin_init(
     cc->type = CRYPTODEV_BACKEND_TYPE_BUILTIN;
     backend->conf.peers.ccs[0] = cc;
 
+    if (builtin->async) {
+        QSIMPLEQ_INIT(&builtin->pending);
+        builtin->submit_bh = qemu_bh_new(cryptodev_builtin_submit_bh, builtin);
+    }
+
     backend->conf.crypto_services =
                          1u << VIRTIO_CRYPTO_SERVICE_CIPHER |
                          1u << VIRTIO_CRYPTO_SERVICE_HASH |
@@ -238,6 +285,7 @@ static int cryptodev_builtin_create_cipher_session(
     sess->cipher = cipher;
     sess->direction = sess_info->direction;
     sess->type = sess_info->op_type;
+    qemu_mutex_init(&sess->lock);
 
     builtin->sessions[index] = sess;
 
@@ -275,6 +323,14 @@ static int64_t cryptodev_builtin_sym_create_session(
     return session_id;
 }
 
+static void cryptodev_builtin_free_session(
+           CryptoDevBackendBuiltinSession *sess)
+{
+    qcrypto_cipher_free(sess->cipher);
+    qemu_mutex_destroy(&sess->lock);
+    g_free(sess);
+}
+
 static int cryptodev_builtin_sym_close_session(
            CryptoDevBackend *backend,
            uint64_t session_id,
@@ -282,6 +338,7 @@ static int cryptodev_builtin_sym_close_session(
 {
     CryptoDevBackendBuiltin *builtin =
                       CRYPTODEV_BACKEND_BUILTIN(backend);
+    CryptoDevBackendBuiltinSession *sess;
 
     if (session_id >= MAX_NUM_SESSIONS ||
               builtin->sessions[session_id] == NULL) {
@@ -290,36 +347,44 @@ static int cryptodev_builtin_sym_close_session(
         return -1;
     }
 
-    qcrypto_cipher_free(builtin->sessions[session_id]->cipher);
-    g_free(builtin->sessions[session_id]);
+    /* Requests still using the session free it when they complete */
+    sess = builtin->sessions[session_id];
     builtin->sessions[session_id] = NULL;
+    sess->closed = true;
+    if (!sess->inflight) {
+        cryptodev_builtin_free_session(sess);
+    }
     return 0;
 }
 
-static int cryptodev_builtin_sym_operation(
-                 CryptoDevBackend *backend,
-                 CryptoDevBackendSymOpInfo *op_info,
-                 uint32_t queue_index, Error **errp)
+static CryptoDevBackendBuiltinSession *cryptodev_builtin_get_session(
+                 CryptoDevBackendBuiltin *builtin,
+                 CryptoDevBackendSymOpInfo *op_info, int *ret,
+                 Error **errp)
 {
-    CryptoDevBackendBuiltin *builtin =
-                      CRYPTODEV_BACKEND_BUILTIN(backend);
-    CryptoDevBackendBuiltinSession *sess;
-    int ret;
-
     if (op_info->session_id >= MAX_NUM_SESSIONS ||
               builtin->sessions[op_info->session_id] == NULL) {
         error_setg(errp, "Cannot find a valid session id: %" PRIu64 "",
                    op_info->session_id);
-        return -VIRTIO_CRYPTO_INVSESS;
+        *ret = -VIRTIO_CRYPTO_INVSESS;
+        return NULL;
     }
 
     if (op_info->op_type == VIRTIO_CRYPTO_SYM_OP_ALGORITHM_CHAINING) {
         error_setg(errp,
                "Algorithm chain is unsupported for cryptdoev-builtin");
-        return -VIRTIO_CRYPTO_NOTSUPP;
+        *ret = -VIRTIO_CRYPTO_NOTSUPP;
+        return NULL;
     }
 
-    sess = builtin->sessions[op_info->session_id];
+    return builtin->sessions[op_info->session_id];
+}
+
+static int cryptodev_builtin_sym_do_cipher(
+                 CryptoDevBackendBuiltinSession *sess,
+                 CryptoDevBackendSymOpInfo *op_info, Error **errp)
+{
+    int ret;
 
     if (op_info->iv_len > 0) {
         ret = qcrypto_cipher_setiv(sess->cipher, op_info->iv,
@@ -345,6 +410,127 @@ static int cryptodev_builtin_sym_operation(
     return VIRTIO_CRYPTO_OK;
 }
 
+static int cryptodev_builtin_sym_operation(
+                 CryptoDevBackend *backend,
+                 CryptoDevBackendSymOpInfo *op_info,
+                 uint32_t queue_index, Error **errp)
+{
+    CryptoDevBackendBuiltin *builtin =
+                      CRYPTODEV_BACKEND_BUILTIN(backend);
+    CryptoDevBackendBuiltinSession *sess;
+    int ret;
+
+    sess = cryptodev_builtin_get_session(builtin, op_info, &ret, errp);
+    if (!sess) {
+        return ret;
+    }
+    return cryptodev_builtin_sym_do_cipher(sess, op_info, errp);
+}
+
+/* Runs in a worker thread */
+static int cryptodev_builtin_batch_worker(void *opaque)
+{
+    CryptoDevBackendBuiltinBatch *batch = opaque;
+    CryptoDevBackendBuiltinReq *req;
+
+    QSIMPLEQ_FOREACH(req, &batch->reqs, next) {
+        qemu_mutex_lock(&req->sess->lock);
+        req->ret = cryptodev_builtin_sym_do_cipher(req->sess, req->op_info,
+                                                   &req->err);
+        qemu_mutex_unlock(&req->sess->lock);
+    }
+    return 0;
+}
+
+static void cryptodev_builtin_batch_complete(void *opaque, int ret)
+{
+    CryptoDevBackendBuiltinBatch *batch = opaque;
+    CryptoDevBackendBuiltinReq *req, *next;
+
+    QSIMPLEQ_FOREACH_SAFE(req, &batch->reqs, next, next) {
+        if (req->err) {
+            error_report_err(req->err);
+        }
+        if (!--req->sess->inflight && req->sess->closed) {
+            cryptodev_builtin_free_session(req->sess);
+        }
+        req->cb(req->opaque, req->ret);
+        g_free(req);
+    }
+    g_free(batch);
+}
+
+static void cryptodev_builtin_submit(CryptoDevBackendBuiltin *builtin)
+{
+    CryptoDevBackendBuiltinBatch *batch;
+    ThreadPool *pool = aio_get_thread_pool(qemu_get_aio_context());
+
+    if (QSIMPLEQ_EMPTY(&builtin->pending)) {
+        return;
+    }
+
+    batch = g_new(CryptoDevBackendBuiltinBatch, 1);
+    QSIMPLEQ_INIT(&batch->reqs);
+    QSIMPLEQ_CONCAT(&batch->reqs, &builtin->pending);
+    builtin->npending = 0;
+    thread_pool_submit_aio(pool, cryptodev_builtin_batch_worker, batch,
+                           cryptodev_builtin_batch_complete, batch);
+}
+
+static void cryptodev_builtin_submit_bh(void *opaque)
+{
+    cryptodev_builtin_submit(opaque);
+}
+
+/*
+ * The requests that virtio-crypto pops from a ring in one go are
+ * collected until submit_bh runs, and go to the same worker.
+ */
+static void cryptodev_builtin_sym_operation_async(
+                 CryptoDevBackend *backend,
+                 CryptoDevBackendSymOpInfo *op_info,
+                 uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb, void *opaque)
+{
+    CryptoDevBackendBuiltin *builtin =
+                      CRYPTODEV_BACKEND_BUILTIN(backend);
+    CryptoDevBackendBuiltinSession *sess;
+    CryptoDevBackendBuiltinReq *req;
+    Error *local_err = NULL;
+    int ret;
+
+    if (!builtin->async) {
+        ret = cryptodev_builtin_sym_operation(backend, op_info,
+                                              queue_index, &local_err);
+        if (local_err) {
+            error_report_err(local_err);
+        }
+        cb(opaque, ret);
+        return;
+    }
+
+    sess = cryptodev_builtin_get_session(builtin, op_info, &ret, &local_err);
+    if (!sess) {
+        error_report_err(local_err);
+        cb(opaque, ret);
+        return;
+    }
+
+    req = g_new0(CryptoDevBackendBuiltinReq, 1);
+    req->sess = sess;
+    req->op_info = op_info;
+    req->cb = cb;
+    req->opaque = opaque;
+    sess->inflight++;
+    QSIMPLEQ_INSERT_TAIL(&builtin->pending, req, next);
+
+    if (++builtin->npending >= builtin->batch_size) {
+        cryptodev_builtin_submit(builtin);
+    } else {
+        qemu_bh_schedule(builtin->submit_bh);
+    }
+}
+
 static void cryptodev_builtin_cleanup(
              CryptoDevBackend *backend,
              Error **errp)
@@ -370,9 +556,75 @@ static void cryptodev_builtin_cleanup(
         }
     }
 
+    if (builtin->submit_bh) {
+        qemu_bh_delete(builtin->submit_bh);
+        builtin->submit_bh = NULL;
+    }
+
     cryptodev_backend_set_ready(backend, false);
 }
 
+static bool cryptodev_builtin_get_async(Object *obj, Error **errp)
+{
+    return CRYPTODEV_BACKEND_BUILTIN(obj)->async;
+}
+
+static void cryptodev_builtin_set_async(Object *obj, bool value,
+                                        Error **errp)
+{
+    if (cryptodev_backend_is_ready(CRYPTODEV_BACKEND(obj))) {
+        error_setg(errp, "Property 'async' can't be changed once the "
+                   "backend is created");
+        return;
+    }
+    CRYPTODEV_BACKEND_BUILTIN(obj)->async = value;
+}
+
+static void
+cryptodev_builtin_get_batch_size(Object *obj, Visitor *v, const char *name,
+                                 void *opaque, Error **errp)
+{
+    CryptoDevBackendBuiltin *builtin = CRYPTODEV_BACKEND_BUILTIN(obj);
+    uint32_t value = builtin->batch_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void
+cryptodev_builtin_set_batch_size(Object *obj, Visitor *v, const char *name,
+                                 void *opaque, Error **errp)
+{
+    CryptoDevBackendBuiltin *builtin = CRYPTODEV_BACKEND_BUILTIN(obj);
+    Error *local_err = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+    if (!value) {
+        error_setg(&local_err, "Property '%s.%s' doesn't take value '%"
+                   PRIu32 "'", object_get_typename(obj), name, value);
+        goto out;
+    }
+    builtin->batch_size = value;
+out:
+    error_propagate(errp, local_err);
+}
+
+static void cryptodev_builtin_instance_init(Object *obj)
+{
+    CryptoDevBackendBuiltin *builtin = CRYPTODEV_BACKEND_BUILTIN(obj);
+
+    builtin->batch_size = CRYPTODEV_BUILTIN_DEFAULT_BATCH_SIZE;
+    object_property_add_bool(obj, "async", cryptodev_builtin_get_async,
+                             cryptodev_builtin_set_async, NULL);
+    object_property_add(obj, "batch-size", "uint32",
+                        cryptodev_builtin_get_batch_size,
+                        cryptodev_builtin_set_batch_size,
+                        NULL, NULL, NULL);
+}
+
 static void
 cryptodev_builtin_class_init(ObjectClass *oc, void *data)
 {
@@ -383,12 +635,14 @@ cryptodev_builtin_class_init(ObjectClass *oc, void *data)
     bc->create_session = cryptodev_builtin_sym_create_session;
     bc->close_session = cryptodev_builtin_sym_close_session;
     bc->do_sym_op = cryptodev_builtin_sym_operation;
+    bc->do_sym_op_async = cryptodev_builtin_sym_operation_async;
 }
 
 static const TypeInfo cryptodev_builtin_info = {
     .name = TYPE_CRYPTODEV_BACKEND_BUILTIN,
     .parent = TYPE_CRYPTODEV_BACKEND,
     .class_init = cryptodev_builtin_class_init,
+    .instance_init = cryptodev_builtin_instance_init,
     .instance_size = sizeof(CryptoDevBackendBuiltin),
 };
 
@@ -140,6 +140,31 @@ int cryptodev_backend_crypto_operation(
     return -VIRTIO_CRYPTO_ERR;
 }
 
+void cryptodev_backend_crypto_operation_async(
+                 CryptoDevBackend *backend,
+                 void *opaque, uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb)
+{
+    VirtIOCryptoReq *req = opaque;
+    CryptoDevBackendClass *bc =
+                      CRYPTODEV_BACKEND_GET_CLASS(backend);
+    Error *local_err = NULL;
+    int ret;
+
+    if (req->flags == CRYPTODEV_BACKEND_ALG_SYM && bc->do_sym_op_async) {
+        bc->do_sym_op_async(backend, req->u.sym_op_info, queue_index,
+                            cb, opaque);
+        return;
+    }
+
+    ret = cryptodev_backend_crypto_operation(backend, opaque,
+                                             queue_index, &local_err);
+    if (local_err) {
+        error_report_err(local_err);
+    }
+    cb(opaque, ret);
+}
+
 static void
 cryptodev_backend_get_queues(Object *obj, Visitor *v, const char *name,
                              void *opaque, Error **errp)
@@ -36,8 +36,21 @@ struct HostMemoryBackendFile {
     uint64_t align;
     bool discard_data;
     bool is_pmem;
+    bool ram_image;
+    VMChangeStateEntry *vmstate;
 };
 
+static void file_backend_vm_state_change(void *opaque, int running,
+                                         RunState state)
+{
+    HostMemoryBackend *backend = opaque;
+
+    /* From now on the guest's writes make the RAM differ from the image */
+    if (running && backend->mr.ram_block) {
+        qemu_ram_unset_image(backend->mr.ram_block);
+    }
+}
+
 static void
 file_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
 {
@@ -85,9 +98,15 @@ file_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
                                      name,
                                      backend->size, fb->align,
                                      (backend->share ? RAM_SHARED : 0) |
-                                     (fb->is_pmem ? RAM_PMEM : 0),
+                                     (fb->is_pmem ? RAM_PMEM : 0) |
+                                     (fb->ram_image ? RAM_IMAGE : 0),
                                      fb->mem_path, errp);
     g_free(name);
+
+    if (fb->ram_image && !fb->vmstate) {
+        fb->vmstate = qemu_add_vm_change_state_handler(
+            file_backend_vm_state_change, backend);
+    }
 #endif
 }
 
@@ -191,6 +210,25 @@ static void file_memory_backend_set_pmem(Object *o, bool value, Error **errp)
     fb->is_pmem = value;
 }
 
+static bool file_memory_backend_get_ram_image(Object *o, Error **errp)
+{
+    return MEMORY_BACKEND_FILE(o)->ram_image;
+}
+
+static void file_memory_backend_set_ram_image(Object *o, bool value,
+                                              Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(o);
+    HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(o);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property 'ram-image' of %s",
+                   object_get_typename(o));
+        return;
+    }
+    fb->ram_image = value;
+}
+
 static void file_backend_unparent(Object *obj)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -225,12 +263,18 @@ file_backend_class_init(ObjectClass *oc, void *data)
     object_class_property_add_bool(oc, "pmem",
         file_memory_backend_get_pmem, file_memory_backend_set_pmem,
         &error_abort);
+    object_class_property_add_bool(oc, "ram-image",
+        file_memory_backend_get_ram_image, file_memory_backend_set_ram_image,
+        &error_abort);
 }
 
 static void file_backend_instance_finalize(Object *o)
 {
     HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(o);
 
+    if (fb->vmstate) {
+        qemu_del_vm_change_state_handler(fb->vmstate);
+    }
     g_free(fb->mem_path);
 }
 
@@ -17,8 +17,10 @@
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/visitor.h"
 #include "qemu/config-file.h"
+#include "qemu/error-report.h"
 #include "qom/object_interfaces.h"
 #include "qemu/mmap-alloc.h"
+#include "sysemu/sysemu.h"
 
 #ifdef CONFIG_NUMA
 #include <numaif.h>
@@ -210,6 +212,69 @@ static void host_memory_backend_set_dump(Object *obj, bool value, Error **errp)
     }
 }
 
+/* Backends whose preallocation runs in the background */
+static GSList *prealloc_pending_backends;
+static Notifier prealloc_done_notifier;
+
+/*
+ * Wait for background preallocations before the guest can run; there is
+ * no way to report errors at this point other than exiting.
+ */
+static void host_memory_backend_prealloc_done(Notifier *notifier, void *data)
+{
+    GSList *l;
+
+    for (l = prealloc_pending_backends; l; l = l->next) {
+        HostMemoryBackend *backend = l->data;
+        Error *local_err = NULL;
+
+        os_mem_prealloc_finish(backend->prealloc_pending, &local_err);
+        backend->prealloc_pending = NULL;
+        if (local_err) {
+            error_report_err(local_err);
+            exit(1);
+        }
+    }
+    g_slist_free(prealloc_pending_backends);
+    prealloc_pending_backends = NULL;
+}
+
+/*
+ * Preallocate @sz bytes at @ptr, from threads that run on the backend's
+ * host nodes.  With prealloc-async, do not wait for them until machine
+ * init is done, so that preallocation overlaps with device creation.
+ */
+static void host_memory_backend_do_prealloc(HostMemoryBackend *backend,
+                                            void *ptr, uint64_t sz,
+                                            Error **errp)
+{
+    const unsigned long *host_nodes = NULL;
+    MemPrealloc *prealloc;
+
+    if (backend->policy != HOST_MEM_POLICY_DEFAULT) {
+        host_nodes = backend->host_nodes;
+    }
+    prealloc = os_mem_prealloc_start(memory_region_get_fd(&backend->mr),
+                                     ptr, sz, smp_cpus,
+                                     backend->prealloc_threads,
+                                     host_nodes, MAX_NODES, errp);
+    if (!prealloc) {
+        return;
+    }
+
+    if (backend->prealloc_async && !machine_init_done) {
+        backend->prealloc_pending = prealloc;
+        if (!prealloc_pending_backends) {
+            prealloc_done_notifier.notify = host_memory_backend_prealloc_done;
+            qemu_add_machine_init_done_notifier(&prealloc_done_notifier);
+        }
+        prealloc_pending_backends = g_slist_prepend(prealloc_pending_backends,
+                                                    backend);
+        return;
+    }
+    os_mem_prealloc_finish(prealloc, errp);
+}
+
 static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -237,11 +302,10 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 
     if (value && !backend->prealloc) {
-        int fd = memory_region_get_fd(&backend->mr);
         void *ptr = memory_region_get_ram_ptr(&backend->mr);
         uint64_t sz = memory_region_size(&backend->mr);
 
-        os_mem_prealloc(fd, ptr, sz, smp_cpus, &local_err);
+        host_memory_backend_do_prealloc(backend, ptr, sz, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -250,6 +314,52 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 }
 
+static void
+host_memory_backend_get_prealloc_threads(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    visit_type_uint32(v, name, &backend->prealloc_threads, errp);
+}
+
+static void
+host_memory_backend_set_prealloc_threads(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    Error *local_err = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+    backend->prealloc_threads = value;
+}
+
+static bool host_memory_backend_get_prealloc_async(Object *obj, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->prealloc_async;
+}
+
+static void host_memory_backend_set_prealloc_async(Object *obj, bool value,
+                                                   Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+    backend->prealloc_async = value;
+}
+
 static void host_memory_backend_init(Object *obj)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -374,8 +484,7 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * specified NUMA policy in place.
          */
         if (backend->prealloc) {
-            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
-                            smp_cpus, &local_err);
+            host_memory_backend_do_prealloc(backend, ptr, sz, &local_err);
             if (local_err) {
                 goto out;
             }
@@ -388,7 +497,9 @@ out:
 static bool
 host_memory_backend_can_be_deleted(UserCreatable *uc)
 {
-    if (host_memory_backend_is_mapped(MEMORY_BACKEND(uc))) {
+    HostMemoryBackend *backend = MEMORY_BACKEND(uc);
+
+    if (host_memory_backend_is_mapped(backend) || backend->prealloc_pending) {
         return false;
     } else {
         return true;
@@ -453,6 +564,18 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         host_memory_backend_set_prealloc, &error_abort);
     object_class_property_set_description(oc, "prealloc",
         "Preallocate memory", &error_abort);
+    object_class_property_add(oc, "prealloc-threads", "int",
+        host_memory_backend_get_prealloc_threads,
+        host_memory_backend_set_prealloc_threads,
+        NULL, NULL, &error_abort);
+    object_class_property_set_description(oc, "prealloc-threads",
+        "Number of CPU threads to use for prealloc", &error_abort);
+    object_class_property_add_bool(oc, "prealloc-async",
+        host_memory_backend_get_prealloc_async,
+        host_memory_backend_set_prealloc_async, &error_abort);
+    object_class_property_set_description(oc, "prealloc-async",
+        "Preallocate in the background while the machine is created",
+        &error_abort);
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
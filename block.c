@@ -4091,6 +4091,7 @@ static void bdrv_delete(BlockDriverState *bs)
     }
     QTAILQ_REMOVE(&all_bdrv_states, bs, bs_list);
 
+    g_free(bs->sched);
     g_free(bs);
 }
 
@@ -4102,7 +4103,9 @@ static void bdrv_delete(BlockDriverState *bs)
  * check are stored in res.
  */
 static int coroutine_fn bdrv_co_check(BlockDriverState *bs,
-                                      BdrvCheckResult *res, BdrvCheckMode fix)
+                                      BdrvCheckResult *res, BdrvCheckMode fix,
+                                      BlockDriverCheckStatusCB *status_cb,
+                                      void *cb_opaque)
 {
     if (bs->drv == NULL) {
         return -ENOMEDIUM;
@@ -4112,25 +4115,29 @@ static int coroutine_fn bdrv_co_check(BlockDriverState *bs,
     }
 
     memset(res, 0, sizeof(*res));
-    return bs->drv->bdrv_co_check(bs, res, fix);
+    return bs->drv->bdrv_co_check(bs, res, fix, status_cb, cb_opaque);
 }
 
 typedef struct CheckCo {
     BlockDriverState *bs;
     BdrvCheckResult *res;
     BdrvCheckMode fix;
+    BlockDriverCheckStatusCB *status_cb;
+    void *cb_opaque;
     int ret;
 } CheckCo;
 
 static void bdrv_check_co_entry(void *opaque)
 {
     CheckCo *cco = opaque;
-    cco->ret = bdrv_co_check(cco->bs, cco->res, cco->fix);
+    cco->ret = bdrv_co_check(cco->bs, cco->res, cco->fix, cco->status_cb,
+                             cco->cb_opaque);
     aio_wait_kick();
 }
 
 int bdrv_check(BlockDriverState *bs,
-               BdrvCheckResult *res, BdrvCheckMode fix)
+               BdrvCheckResult *res, BdrvCheckMode fix,
+               BlockDriverCheckStatusCB *status_cb, void *cb_opaque)
 {
     Coroutine *co;
     CheckCo cco = {
@@ -4138,6 +4145,8 @@ int bdrv_check(BlockDriverState *bs,
         .res = res,
         .ret = -EINPROGRESS,
         .fix = fix,
+        .status_cb = status_cb,
+        .cb_opaque = cb_opaque,
     };
 
     if (qemu_in_coroutine()) {
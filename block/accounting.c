@@ -182,6 +182,93 @@ void block_latency_histograms_clear(BlockAcctStats *stats)
     }
 }
 
+/* Buckets 0-3 cover [0, 4) us in steps of 1 us; after that, each power of
+ * two [2^e, 2^(e+1)) us is split into four buckets of equal width. */
+static int block_acct_latency_bucket(int64_t latency_ns)
+{
+    uint64_t us = latency_ns / SCALE_US;
+    int e;
+
+    if (us < 4) {
+        return us;
+    }
+
+    e = 63 - clz64(us);
+    return MIN(4 * (e - 1) + ((us >> (e - 2)) & 3),
+               BLOCK_ACCT_LATENCY_BUCKETS - 1);
+}
+
+/* Upper bound of the latencies counted in @bucket, in ns */
+static int64_t block_acct_latency_bucket_limit(int bucket)
+{
+    int e = bucket / 4 + 1;
+
+    if (bucket < 4) {
+        return (bucket + 1) * SCALE_US;
+    }
+
+    return ((int64_t)(5 + bucket % 4) << (e - 2)) * SCALE_US;
+}
+
+void block_acct_get_latency_buckets(BlockAcctStats *stats,
+                                    enum BlockAcctType type,
+                                    uint64_t *buckets)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    qemu_mutex_lock(&stats->lock);
+    memcpy(buckets, stats->latency_buckets[type],
+           sizeof(stats->latency_buckets[type]));
+    qemu_mutex_unlock(&stats->lock);
+}
+
+void block_acct_get_stage_buckets(BlockAcctStats *stats,
+                                  enum BlockAcctStage stage,
+                                  uint64_t *buckets)
+{
+    assert(stage < BLOCK_MAX_STAGE);
+
+    qemu_mutex_lock(&stats->lock);
+    memcpy(buckets, stats->stage_buckets[stage],
+           sizeof(stats->stage_buckets[stage]));
+    qemu_mutex_unlock(&stats->lock);
+}
+
+/**
+ * block_acct_latency_percentile:
+ * @buckets: BLOCK_ACCT_LATENCY_BUCKETS counters as returned by
+ *           block_acct_get_latency_buckets(), or differences of them
+ * @permille: the percentile to return, in tenths of a percent
+ *
+ * Returns an upper bound for the given percentile of the latencies
+ * counted in @buckets in ns, or 0 if they are all zero.
+ */
+int64_t block_acct_latency_percentile(const uint64_t *buckets,
+                                      unsigned permille)
+{
+    uint64_t total = 0, sum = 0, threshold;
+    int i;
+
+    assert(permille <= 1000);
+
+    for (i = 0; i < BLOCK_ACCT_LATENCY_BUCKETS; i++) {
+        total += buckets[i];
+    }
+    if (!total) {
+        return 0;
+    }
+
+    threshold = DIV_ROUND_UP(total * permille, 1000);
+    for (i = 0; i < BLOCK_ACCT_LATENCY_BUCKETS - 1; i++) {
+        sum += buckets[i];
+        if (sum >= threshold) {
+            break;
+        }
+    }
+
+    return block_acct_latency_bucket_limit(i);
+}
+
 static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                  bool failed)
 {
@@ -197,6 +284,8 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
 
     qemu_mutex_lock(&stats->lock);
 
+    /* Take the time with the lock held, see block_acct_last_update_ns() */
+    stats->last_update_ns = qemu_clock_get_ns(clock_type);
     if (failed) {
         stats->failed_ops[cookie->type]++;
     } else {
@@ -210,6 +299,8 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
     if (!failed || stats->account_failed) {
         stats->total_time_ns[cookie->type] += latency_ns;
         stats->last_access_time_ns = time_ns;
+        stats->latency_buckets[cookie->type]
+                              [block_acct_latency_bucket(latency_ns)]++;
 
         QSLIST_FOREACH(s, &stats->intervals, entries) {
             timed_average_account(&s->latency[cookie->type], latency_ns);
@@ -238,6 +329,7 @@ void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type)
      * submission, therefore there's no actual I/O involved.
      */
     qemu_mutex_lock(&stats->lock);
+    stats->last_update_ns = qemu_clock_get_ns(clock_type);
     stats->invalid_ops[type]++;
 
     if (stats->account_invalid) {
@@ -252,6 +344,7 @@ void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
     assert(type < BLOCK_MAX_IOTYPE);
 
     qemu_mutex_lock(&stats->lock);
+    stats->last_update_ns = qemu_clock_get_ns(clock_type);
     stats->merged[type] += num_requests;
     qemu_mutex_unlock(&stats->lock);
 }
@@ -261,6 +354,40 @@ int64_t block_acct_idle_time_ns(BlockAcctStats *stats)
     return qemu_clock_get_ns(clock_type) - stats->last_access_time_ns;
 }
 
+/*
+ * When the counters of @stats last changed.  Updates take the time with
+ * the lock held, so once this returns, every update stamped before a
+ * time taken earlier by block_acct_time_ns() is visible in @stats: a
+ * query that takes that time first and then reads the counters can hand
+ * it out as the cursor for the next query.
+ */
+int64_t block_acct_last_update_ns(BlockAcctStats *stats)
+{
+    int64_t ret;
+
+    qemu_mutex_lock(&stats->lock);
+    ret = stats->last_update_ns;
+    qemu_mutex_unlock(&stats->lock);
+    return ret;
+}
+
+/* The clock that the start and end times of stages must be taken from */
+int64_t block_acct_time_ns(void)
+{
+    return qemu_clock_get_ns(clock_type);
+}
+
+void block_acct_stage_done(BlockAcctStats *stats, enum BlockAcctStage stage,
+                           int64_t start_ns, int64_t end_ns)
+{
+    assert(stage < BLOCK_MAX_STAGE);
+
+    qemu_mutex_lock(&stats->lock);
+    stats->stage_buckets[stage]
+                        [block_acct_latency_bucket(end_ns - start_ns)]++;
+    qemu_mutex_unlock(&stats->lock);
+}
+
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
                               enum BlockAcctType type)
 {
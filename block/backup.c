@@ -27,6 +27,11 @@
 #include "qemu/error-report.h"
 
 #define BACKUP_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BACKUP_MAX_BOUNCE_BUFFER (1 << 20)
+
+/* Amount of old data read by before-write notifiers that may still wait
+ * to be written to the target when the guest write goes ahead */
+#define BACKUP_MAX_ASYNC_WRITE_BYTES (16 << 20)
 
 typedef struct CowRequest {
     int64_t start_byte;
@@ -56,8 +61,19 @@ typedef struct BackupBlockJob {
     int64_t copy_range_size;
 
     bool serialize_target_writes;
+
+    /* Target writes still pending for copies done by the notifier */
+    int64_t async_write_bytes;
+    int async_write_ret;
 } BackupBlockJob;
 
+typedef struct BackupAsyncWrite {
+    BackupBlockJob *job;
+    CowRequest req;
+    QEMUIOVector qiov;
+    void *buf;
+} BackupAsyncWrite;
+
 static const BlockJobDriver backup_job_driver;
 
 /* See if in-flight requests overlap and wait for them to complete */
@@ -97,6 +113,78 @@ static void cow_request_end(CowRequest *req)
     qemu_co_queue_restart_all(&req->wait_queue);
 }
 
+static int coroutine_fn backup_cow_write(BackupBlockJob *job, int64_t start,
+                                         QEMUIOVector *qiov)
+{
+    int write_flags = job->serialize_target_writes ? BDRV_REQ_SERIALISING : 0;
+
+    if (qemu_iovec_is_zero(qiov)) {
+        return blk_co_pwrite_zeroes(job->target, start, qiov->size,
+                                    write_flags | BDRV_REQ_MAY_UNMAP);
+    } else {
+        return blk_co_pwritev(job->target, start, qiov->size, qiov,
+                              write_flags |
+                              (job->compress ? BDRV_REQ_WRITE_COMPRESSED : 0));
+    }
+}
+
+static void coroutine_fn backup_async_write_entry(void *opaque)
+{
+    BackupAsyncWrite *w = opaque;
+    BackupBlockJob *job = w->job;
+    int ret;
+
+    /* Taken before the first yield, while the notifier that created us
+     * still holds the lock as well, so this never blocks */
+    qemu_co_rwlock_rdlock(&job->flush_rwlock);
+
+    ret = backup_cow_write(job, w->req.start_byte, &w->qiov);
+    if (ret < 0) {
+        trace_backup_do_cow_write_fail(job, w->req.start_byte, ret);
+        /* The guest has overwritten the data on the source in the meantime,
+         * so there is nothing left to retry.  Fail the whole job. */
+        if (job->async_write_ret == 0) {
+            job->async_write_ret = ret;
+            job_enter(&job->common.job);
+        }
+    }
+
+    job->async_write_bytes -= w->qiov.size;
+    cow_request_end(&w->req);
+    qemu_vfree(w->buf);
+    g_free(w);
+
+    qemu_co_rwlock_unlock(&job->flush_rwlock);
+}
+
+/* A before-write notifier only has to wait until the old data has been
+ * read.  Write it to the target in the background, unless readers of the
+ * target (image fleecing) could otherwise see the new data through the
+ * backing chain of the target before the old one has arrived there. */
+static bool backup_may_write_async(BackupBlockJob *job, int64_t bytes)
+{
+    return !job->serialize_target_writes && job->async_write_ret == 0 &&
+           job->async_write_bytes + bytes <= BACKUP_MAX_ASYNC_WRITE_BYTES;
+}
+
+static void backup_write_async(BackupBlockJob *job, int64_t start,
+                               QEMUIOVector *qiov, void *buf)
+{
+    BackupAsyncWrite *w = g_new0(BackupAsyncWrite, 1);
+    Coroutine *co;
+
+    w->job = job;
+    w->buf = buf;
+    qemu_iovec_init_buf(&w->qiov, buf, qiov->size);
+
+    /* Overlapping copy requests must not pass this one */
+    cow_request_begin(&w->req, job, start, start + qiov->size);
+    job->async_write_bytes += qiov->size;
+
+    co = qemu_coroutine_create(backup_async_write_entry, w);
+    qemu_coroutine_enter(co);
+}
+
 /* Copy range to target with a bounce buffer and return the bytes copied. If
  * error occurred, return a negative error number */
 static int coroutine_fn backup_cow_with_bounce_buffer(BackupBlockJob *job,
@@ -109,14 +197,25 @@ static int coroutine_fn backup_cow_with_bounce_buffer(BackupBlockJob *job,
     int ret;
     QEMUIOVector qiov;
     BlockBackend *blk = job->common.blk;
+    int64_t max_bytes = MIN(end - start,
+                            MAX(job->cluster_size, BACKUP_MAX_BOUNCE_BUFFER));
+    int64_t cluster = start / job->cluster_size;
+    int64_t nr_clusters, next_clean;
     int nbytes;
     int read_flags = is_write_notifier ? BDRV_REQ_NO_SERIALISING : 0;
-    int write_flags = job->serialize_target_writes ? BDRV_REQ_SERIALISING : 0;
 
-    hbitmap_reset(job->copy_bitmap, start / job->cluster_size, 1);
-    nbytes = MIN(job->cluster_size, job->len - start);
+    /* Copy all consecutive clusters that still need copying at once */
+    nr_clusters = DIV_ROUND_UP(max_bytes, job->cluster_size);
+    next_clean = hbitmap_next_zero(job->copy_bitmap, cluster, nr_clusters);
+    if (next_clean != -1) {
+        nr_clusters = next_clean - cluster;
+    }
+    assert(nr_clusters > 0);
+
+    hbitmap_reset(job->copy_bitmap, cluster, nr_clusters);
+    nbytes = MIN(nr_clusters * job->cluster_size, job->len - start);
     if (!*bounce_buffer) {
-        *bounce_buffer = blk_blockalign(blk, job->cluster_size);
+        *bounce_buffer = blk_blockalign(blk, max_bytes);
     }
     qemu_iovec_init_buf(&qiov, *bounce_buffer, nbytes);
 
@@ -129,14 +228,14 @@ static int coroutine_fn backup_cow_with_bounce_buffer(BackupBlockJob *job,
         goto fail;
     }
 
-    if (qemu_iovec_is_zero(&qiov)) {
-        ret = blk_co_pwrite_zeroes(job->target, start,
-                                   qiov.size, write_flags | BDRV_REQ_MAY_UNMAP);
-    } else {
-        ret = blk_co_pwritev(job->target, start,
-                             qiov.size, &qiov, write_flags |
-                             (job->compress ? BDRV_REQ_WRITE_COMPRESSED : 0));
+    if (is_write_notifier && backup_may_write_async(job, nbytes)) {
+        /* The buffer now belongs to the background write */
+        backup_write_async(job, start, &qiov, *bounce_buffer);
+        *bounce_buffer = NULL;
+        return nbytes;
     }
+
+    ret = backup_cow_write(job, start, &qiov);
     if (ret < 0) {
         trace_backup_do_cow_write_fail(job, start, ret);
         if (error_is_read) {
@@ -147,7 +246,7 @@ static int coroutine_fn backup_cow_with_bounce_buffer(BackupBlockJob *job,
 
     return nbytes;
 fail:
-    hbitmap_set(job->copy_bitmap, start / job->cluster_size, 1);
+    hbitmap_set(job->copy_bitmap, cluster, nr_clusters);
     return ret;
 
 }
@@ -357,7 +456,7 @@ static bool coroutine_fn yield_and_check(BackupBlockJob *job)
 {
     uint64_t delay_ns;
 
-    if (job_is_cancelled(&job->common.job)) {
+    if (job_is_cancelled(&job->common.job) || job->async_write_ret < 0) {
         return true;
     }
 
@@ -367,7 +466,7 @@ static bool coroutine_fn yield_and_check(BackupBlockJob *job)
     job->bytes_read = 0;
     job_sleep_ns(&job->common.job, delay_ns);
 
-    if (job_is_cancelled(&job->common.job)) {
+    if (job_is_cancelled(&job->common.job) || job->async_write_ret < 0) {
         return true;
     }
 
@@ -469,7 +568,7 @@ static int coroutine_fn backup_run(Job *job, Error **errp)
     if (s->sync_mode == MIRROR_SYNC_MODE_NONE) {
         /* All bits are set in copy_bitmap to allow any cluster to be copied.
          * This does not actually require them to be copied. */
-        while (!job_is_cancelled(job)) {
+        while (!job_is_cancelled(job) && s->async_write_ret == 0) {
             /* Yield until the job is cancelled.  We just let our before_write
              * notify callback service CoW requests. */
             job_yield(job);
@@ -540,11 +639,16 @@ static int coroutine_fn backup_run(Job *job, Error **errp)
 
     notifier_with_return_remove(&s->before_write);
 
-    /* wait until pending backup_do_cow() calls have completed */
+    /* wait until pending backup_do_cow() calls and the target writes they
+     * started in the background have completed */
     qemu_co_rwlock_wrlock(&s->flush_rwlock);
     qemu_co_rwlock_unlock(&s->flush_rwlock);
     hbitmap_free(s->copy_bitmap);
 
+    if (ret >= 0 && s->async_write_ret < 0) {
+        ret = s->async_write_ret;
+    }
+
     return ret;
 }
 
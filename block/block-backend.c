@@ -86,6 +86,39 @@ struct BlockBackend {
      * Accessed with atomic ops.
      */
     unsigned int in_flight;
+
+    /* class of the requests that do not have BDRV_REQ_PRIO_* */
+    BlockIOPriority io_priority;
+};
+
+typedef struct BlockSchedWaiter {
+    int64_t deadline;           /* in ns, QEMU_CLOCK_REALTIME */
+    QSIMPLEQ_ENTRY(BlockSchedWaiter) next;
+} BlockSchedWaiter;
+
+/* Requests of each class waiting for a slot, see blk_sched_enter() */
+typedef struct BlockSchedClass {
+    CoQueue queue;
+    QSIMPLEQ_HEAD(, BlockSchedWaiter) waiters;  /* in the order of queue */
+} BlockSchedClass;
+
+/*
+ * Requests to a node that run at once.  Fewer favour the higher classes
+ * at the cost of throughput; this is about the queue depth of a disk.
+ */
+#define BLK_SCHED_MAX_IN_FLIGHT 32
+
+typedef struct BlockSched {
+    CoMutex lock;
+    unsigned int in_flight;
+    BlockSchedClass classes[BLK_IO_PRIO__MAX];
+} BlockSched;
+
+/* How long a request waits before it goes first, whatever its class */
+static const int64_t blk_sched_deadline_ns[BLK_IO_PRIO__MAX] = {
+    [BLK_IO_PRIO_HIGH]      = 10 * SCALE_MS,
+    [BLK_IO_PRIO_NORMAL]    = 50 * SCALE_MS,
+    [BLK_IO_PRIO_LOW]       = 500 * SCALE_MS,
 };
 
 typedef struct BlockBackendAIOCB {
@@ -322,6 +355,7 @@ BlockBackend *blk_new(uint64_t perm, uint64_t shared_perm)
     blk->perm = perm;
     blk->shared_perm = shared_perm;
     blk_set_enable_write_cache(blk, true);
+    blk->io_priority = BLK_IO_PRIO_NORMAL;
 
     blk->on_read_error = BLOCKDEV_ON_ERROR_REPORT;
     blk->on_write_error = BLOCKDEV_ON_ERROR_ENOSPC;
@@ -1115,12 +1149,114 @@ static int blk_check_byte_request(BlockBackend *blk, int64_t offset,
     return 0;
 }
 
+static BlockIOPriority blk_request_priority(BlockBackend *blk,
+                                            BdrvRequestFlags flags)
+{
+    if (flags & BDRV_REQ_PRIO_HIGH) {
+        return BLK_IO_PRIO_HIGH;
+    } else if (flags & BDRV_REQ_PRIO_LOW) {
+        return BLK_IO_PRIO_LOW;
+    }
+    return blk->io_priority;
+}
+
+/*
+ * Wait until the scheduler of @bs lets a request of class @prio run.
+ * Returns the scheduler, to be passed to blk_sched_exit() once the
+ * request is done, or NULL if requests to @bs are not scheduled.
+ */
+static BlockSched *coroutine_fn blk_sched_enter(BlockDriverState *bs,
+                                                BlockIOPriority prio)
+{
+    BlockSched *sched = atomic_read(&bs->sched);
+    BlockSchedWaiter waiter;
+    BlockSchedClass *c;
+    int i;
+
+    if (!sched) {
+        if (prio == BLK_IO_PRIO_NORMAL) {
+            return NULL;
+        }
+        /* The first request with a class: schedule the node from now on */
+        sched = g_new0(BlockSched, 1);
+        qemu_co_mutex_init(&sched->lock);
+        for (i = 0; i < BLK_IO_PRIO__MAX; i++) {
+            qemu_co_queue_init(&sched->classes[i].queue);
+            QSIMPLEQ_INIT(&sched->classes[i].waiters);
+        }
+        if (atomic_cmpxchg(&bs->sched, NULL, sched)) {
+            g_free(sched);
+            sched = bs->sched;
+        }
+    }
+
+    qemu_co_mutex_lock(&sched->lock);
+    if (sched->in_flight < BLK_SCHED_MAX_IN_FLIGHT) {
+        for (i = 0; i < BLK_IO_PRIO__MAX; i++) {
+            if (!QSIMPLEQ_EMPTY(&sched->classes[i].waiters)) {
+                break;
+            }
+        }
+        if (i == BLK_IO_PRIO__MAX) {
+            sched->in_flight++;
+            qemu_co_mutex_unlock(&sched->lock);
+            return sched;
+        }
+    }
+
+    c = &sched->classes[prio];
+    waiter.deadline = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                      blk_sched_deadline_ns[prio];
+    QSIMPLEQ_INSERT_TAIL(&c->waiters, &waiter, next);
+    trace_blk_sched_wait(bs, prio, sched->in_flight);
+    /* blk_sched_exit() hands its slot over to us */
+    qemu_co_queue_wait(&c->queue, &sched->lock);
+    qemu_co_mutex_unlock(&sched->lock);
+    return sched;
+}
+
+static void coroutine_fn blk_sched_exit(BlockSched *sched)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t oldest = INT64_MAX;
+    int i, pick = -1, late = -1;
+
+    qemu_co_mutex_lock(&sched->lock);
+    for (i = 0; i < BLK_IO_PRIO__MAX; i++) {
+        BlockSchedWaiter *w = QSIMPLEQ_FIRST(&sched->classes[i].waiters);
+
+        if (!w) {
+            continue;
+        }
+        if (pick < 0) {
+            pick = i;
+        }
+        if (w->deadline <= now && w->deadline < oldest) {
+            late = i;
+            oldest = w->deadline;
+        }
+    }
+    if (late >= 0) {
+        pick = late;
+    }
+
+    if (pick >= 0) {
+        QSIMPLEQ_REMOVE_HEAD(&sched->classes[pick].waiters, next);
+        qemu_co_queue_next(&sched->classes[pick].queue);
+    } else {
+        sched->in_flight--;
+    }
+    qemu_co_mutex_unlock(&sched->lock);
+}
+
 int coroutine_fn blk_co_preadv(BlockBackend *blk, int64_t offset,
                                unsigned int bytes, QEMUIOVector *qiov,
                                BdrvRequestFlags flags)
 {
     int ret;
     BlockDriverState *bs = blk_bs(blk);
+    BlockIOPriority prio = blk_request_priority(blk, flags);
+    BlockSched *sched;
 
     trace_blk_co_preadv(blk, bs, offset, bytes, flags);
 
@@ -1137,7 +1273,12 @@ int coroutine_fn blk_co_preadv(BlockBackend *blk, int64_t offset,
                 bytes, false);
     }
 
+    flags &= ~(BDRV_REQ_PRIO_HIGH | BDRV_REQ_PRIO_LOW);
+    sched = blk_sched_enter(bs, prio);
     ret = bdrv_co_preadv(blk->root, offset, bytes, qiov, flags);
+    if (sched) {
+        blk_sched_exit(sched);
+    }
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -1148,6 +1289,8 @@ int coroutine_fn blk_co_pwritev(BlockBackend *blk, int64_t offset,
 {
     int ret;
     BlockDriverState *bs = blk_bs(blk);
+    BlockIOPriority prio = blk_request_priority(blk, flags);
+    BlockSched *sched;
 
     trace_blk_co_pwritev(blk, bs, offset, bytes, flags);
 
@@ -1167,7 +1310,12 @@ int coroutine_fn blk_co_pwritev(BlockBackend *blk, int64_t offset,
         flags |= BDRV_REQ_FUA;
     }
 
+    flags &= ~(BDRV_REQ_PRIO_HIGH | BDRV_REQ_PRIO_LOW);
+    sched = blk_sched_enter(bs, prio);
     ret = bdrv_co_pwritev(blk->root, offset, bytes, qiov, flags);
+    if (sched) {
+        blk_sched_exit(sched);
+    }
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -1703,6 +1851,13 @@ void blk_set_enable_write_cache(BlockBackend *blk, bool wce)
     blk->enable_write_cache = wce;
 }
 
+/* Set the class of the requests that do not have one of their own */
+void blk_set_io_priority(BlockBackend *blk, BlockIOPriority prio)
+{
+    assert(prio < BLK_IO_PRIO__MAX);
+    blk->io_priority = prio;
+}
+
 void blk_invalidate_cache(BlockBackend *blk, Error **errp)
 {
     BlockDriverState *bs = blk_bs(blk);
@@ -22,6 +22,7 @@
 
 #include "block/block_int.h"
 #include "block/qdict.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -31,10 +32,22 @@
 #include "qemu/option.h"
 #include "crypto.h"
 
+/*
+ * Requests are split between up to this many worker threads, each with
+ * its own cipher, but not into pieces smaller than BLOCK_CRYPTO_MIN_CHUNK
+ * which are cheaper to do in the coroutine itself.
+ */
+#define BLOCK_CRYPTO_MAX_THREADS 4
+#define BLOCK_CRYPTO_MIN_CHUNK (64 * 1024)
+
 typedef struct BlockCrypto BlockCrypto;
 
 struct BlockCrypto {
     QCryptoBlock *block;
+
+    /* Ciphers in use, by worker threads or inline */
+    int nb_busy;
+    CoQueue busy_queue;
 };
 
 
@@ -229,13 +242,14 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
-                                       1,
+                                       BLOCK_CRYPTO_MAX_THREADS,
                                        errp);
 
     if (!crypto->block) {
         ret = -EIO;
         goto cleanup;
     }
+    qemu_co_queue_init(&crypto->busy_queue);
 
     bs->encrypted = true;
 
@@ -324,6 +338,117 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+typedef struct BlockCryptoWork {
+    Coroutine *co;
+    int in_flight;
+    bool waiting;
+    int ret;
+} BlockCryptoWork;
+
+typedef struct BlockCryptoTask {
+    BlockCrypto *crypto;
+    BlockCryptoWork *work;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    bool encrypt;
+} BlockCryptoTask;
+
+static int block_crypto_task_run(BlockCryptoTask *task)
+{
+    int ret;
+
+    if (task->encrypt) {
+        ret = qcrypto_block_encrypt(task->crypto->block, task->offset,
+                                    task->buf, task->len, NULL);
+    } else {
+        ret = qcrypto_block_decrypt(task->crypto->block, task->offset,
+                                    task->buf, task->len, NULL);
+    }
+    return ret < 0 ? -EIO : 0;
+}
+
+static int block_crypto_pool_func(void *opaque)
+{
+    return block_crypto_task_run(opaque);
+}
+
+static void block_crypto_pool_complete(void *opaque, int ret)
+{
+    BlockCryptoTask *task = opaque;
+    BlockCrypto *crypto = task->crypto;
+    BlockCryptoWork *work = task->work;
+
+    if (ret < 0) {
+        work->ret = ret;
+    }
+    crypto->nb_busy--;
+    qemu_co_enter_next(&crypto->busy_queue, NULL);
+
+    /* Once the request goes on, @task and @work are gone */
+    if (--work->in_flight == 0 && work->waiting) {
+        aio_co_wake(work->co);
+    }
+}
+
+/* Encrypt or decrypt @buf in place, in pieces that are done in parallel */
+static int coroutine_fn
+block_crypto_co_encdec(BlockDriverState *bs, uint64_t offset,
+                       uint8_t *buf, uint64_t len, bool encrypt)
+{
+    BlockCrypto *crypto = bs->opaque;
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
+    BlockCryptoTask tasks[BLOCK_CRYPTO_MAX_THREADS];
+    BlockCryptoWork work = {
+        .co = qemu_coroutine_self(),
+    };
+    uint64_t chunk;
+    int i, n;
+
+    chunk = MAX(DIV_ROUND_UP(len, BLOCK_CRYPTO_MAX_THREADS),
+                BLOCK_CRYPTO_MIN_CHUNK);
+    chunk = QEMU_ALIGN_UP(chunk, sector_size);
+    n = DIV_ROUND_UP(len, chunk);
+    assert(n <= BLOCK_CRYPTO_MAX_THREADS);
+
+    for (i = 0; i < n; i++) {
+        BlockCryptoTask *task = &tasks[i];
+
+        *task = (BlockCryptoTask) {
+            .crypto = crypto,
+            .work = &work,
+            .offset = offset + i * chunk,
+            .buf = buf + i * chunk,
+            .len = MIN(chunk, len - i * chunk),
+            .encrypt = encrypt,
+        };
+
+        while (crypto->nb_busy >= BLOCK_CRYPTO_MAX_THREADS) {
+            qemu_co_queue_wait(&crypto->busy_queue, NULL);
+        }
+        crypto->nb_busy++;
+
+        if (n == 1) {
+            work.ret = block_crypto_task_run(task);
+            crypto->nb_busy--;
+            qemu_co_queue_next(&crypto->busy_queue);
+            break;
+        }
+
+        work.in_flight++;
+        thread_pool_submit_aio(pool, block_crypto_pool_func, task,
+                               block_crypto_pool_complete, task);
+    }
+
+    if (work.in_flight) {
+        work.waiting = true;
+        qemu_coroutine_yield();
+    }
+
+    return work.ret;
+}
+
 static coroutine_fn int
 block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                        QEMUIOVector *qiov, int flags)
@@ -367,9 +492,9 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done,
+                                     cipher_data, cur_bytes, false);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -423,9 +548,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done,
+                                     cipher_data, cur_bytes, true);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -59,9 +59,15 @@ static CURLMcode __curl_multi_socket_action(CURLM *multi_handle,
 #define PROTOCOLS (CURLPROTO_HTTP | CURLPROTO_HTTPS | \
                    CURLPROTO_FTP | CURLPROTO_FTPS)
 
-#define CURL_NUM_STATES 8
 #define CURL_NUM_ACB    8
 #define CURL_TIMEOUT_MAX 10000
+#define CURL_MAX_STATES 64
+
+/* Transfers start and end on cache block boundaries */
+#define CURL_CACHE_BLOCK_SIZE (64 * 1024)
+
+/* Read-ahead doubles with each sequential read, up to this */
+#define CURL_READAHEAD_MAX (16 * 1024 * 1024)
 
 #define CURL_BLOCK_OPT_URL       "url"
 #define CURL_BLOCK_OPT_READAHEAD "readahead"
@@ -73,10 +79,14 @@ static CURLMcode __curl_multi_socket_action(CURLM *multi_handle,
 #define CURL_BLOCK_OPT_PASSWORD_SECRET "password-secret"
 #define CURL_BLOCK_OPT_PROXY_USERNAME "proxy-username"
 #define CURL_BLOCK_OPT_PROXY_PASSWORD_SECRET "proxy-password-secret"
+#define CURL_BLOCK_OPT_PARALLEL_REQUESTS "parallel-requests"
+#define CURL_BLOCK_OPT_CACHE_SIZE "cache-size"
 
 #define CURL_BLOCK_OPT_READAHEAD_DEFAULT (256 * 1024)
 #define CURL_BLOCK_OPT_SSLVERIFY_DEFAULT true
 #define CURL_BLOCK_OPT_TIMEOUT_DEFAULT 5
+#define CURL_BLOCK_OPT_PARALLEL_REQUESTS_DEFAULT 8
+#define CURL_BLOCK_OPT_CACHE_SIZE_DEFAULT (16 * 1024 * 1024)
 
 struct BDRVCURLState;
 
@@ -94,17 +104,28 @@ typedef struct CURLAIOCB {
     size_t end;
 } CURLAIOCB;
 
+/*
+ * With HTTP/2 several transfers share a connection, so sockets belong to
+ * the BDRVCURLState rather than to any CURLState.
+ */
 typedef struct CURLSocket {
     int fd;
+    struct BDRVCURLState *s;
     QLIST_ENTRY(CURLSocket) next;
 } CURLSocket;
 
+typedef struct CURLCacheBlock {
+    uint64_t index;             /* offset / CURL_CACHE_BLOCK_SIZE */
+    size_t len;                 /* shorter at the end of the image */
+    QTAILQ_ENTRY(CURLCacheBlock) next;
+    char data[];
+} CURLCacheBlock;
+
 typedef struct CURLState
 {
     struct BDRVCURLState *s;
     CURLAIOCB *acb[CURL_NUM_ACB];
     CURL *curl;
-    QLIST_HEAD(, CURLSocket) sockets;
     char *orig_buf;
     uint64_t buf_start;
     size_t buf_off;
@@ -118,9 +139,24 @@ typedef struct BDRVCURLState {
     CURLM *multi;
     QEMUTimer timer;
     uint64_t len;
-    CURLState states[CURL_NUM_STATES];
+    CURLState *states;
+    int num_states;
+    int states_in_use;
+    QLIST_HEAD(, CURLSocket) sockets;
     char *url;
     size_t readahead_size;
+
+    /* Blocks of the image shared by all states, least recently used first */
+    GHashTable *cache;
+    QTAILQ_HEAD(, CURLCacheBlock) cache_lru;
+    size_t cache_size;
+    size_t cache_used;
+
+    /* Sequential access detection */
+    uint64_t last_end;          /* of the last read */
+    uint64_t fetch_end;         /* of the data requested so far */
+    size_t seq_readahead;
+
     bool sslverify;
     uint64_t timeout;
     char *cookie;
@@ -160,46 +196,43 @@ static int curl_timer_cb(CURLM *multi, long timeout_ms, void *opaque)
 static int curl_sock_cb(CURL *curl, curl_socket_t fd, int action,
                         void *userp, void *sp)
 {
-    BDRVCURLState *s;
-    CURLState *state = NULL;
+    BDRVCURLState *s = userp;
     CURLSocket *socket;
 
-    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&state);
-    s = state->s;
-
-    QLIST_FOREACH(socket, &state->sockets, next) {
+    QLIST_FOREACH(socket, &s->sockets, next) {
         if (socket->fd == fd) {
-            if (action == CURL_POLL_REMOVE) {
-                QLIST_REMOVE(socket, next);
-                g_free(socket);
-            }
             break;
         }
     }
     if (!socket) {
+        if (action == CURL_POLL_REMOVE) {
+            return 0;
+        }
         socket = g_new0(CURLSocket, 1);
         socket->fd = fd;
-        QLIST_INSERT_HEAD(&state->sockets, socket, next);
+        socket->s = s;
+        QLIST_INSERT_HEAD(&s->sockets, socket, next);
     }
-    socket = NULL;
 
     trace_curl_sock_cb(action, (int)fd);
     switch (action) {
         case CURL_POLL_IN:
             aio_set_fd_handler(s->aio_context, fd, false,
-                               curl_multi_read, NULL, NULL, state);
+                               curl_multi_read, NULL, NULL, socket);
             break;
         case CURL_POLL_OUT:
             aio_set_fd_handler(s->aio_context, fd, false,
-                               NULL, curl_multi_do, NULL, state);
+                               NULL, curl_multi_do, NULL, socket);
             break;
         case CURL_POLL_INOUT:
             aio_set_fd_handler(s->aio_context, fd, false,
-                               curl_multi_read, curl_multi_do, NULL, state);
+                               curl_multi_read, curl_multi_do, NULL, socket);
             break;
         case CURL_POLL_REMOVE:
             aio_set_fd_handler(s->aio_context, fd, false,
                                NULL, NULL, NULL, NULL);
+            QLIST_REMOVE(socket, next);
+            g_free(socket);
             break;
     }
 
@@ -221,11 +254,120 @@ static size_t curl_header_cb(void *ptr, size_t size, size_t nmemb, void *opaque)
     return realsize;
 }
 
+/* Called with s->mutex held.  */
+static void curl_cache_remove(BDRVCURLState *s, CURLCacheBlock *blk)
+{
+    g_hash_table_remove(s->cache, &blk->index);
+    QTAILQ_REMOVE(&s->cache_lru, blk, next);
+    s->cache_used -= CURL_CACHE_BLOCK_SIZE;
+    g_free(blk);
+}
+
+/* Called with s->mutex held.  */
+static void curl_cache_insert(BDRVCURLState *s, uint64_t index,
+                              const char *data, size_t len)
+{
+    CURLCacheBlock *blk;
+
+    if (!s->cache || g_hash_table_contains(s->cache, &index)) {
+        return;
+    }
+
+    while (s->cache_used + CURL_CACHE_BLOCK_SIZE > s->cache_size) {
+        curl_cache_remove(s, QTAILQ_FIRST(&s->cache_lru));
+    }
+
+    blk = g_malloc(sizeof(*blk) + len);
+    blk->index = index;
+    blk->len = len;
+    memcpy(blk->data, data, len);
+    g_hash_table_insert(s->cache, &blk->index, blk);
+    QTAILQ_INSERT_TAIL(&s->cache_lru, blk, next);
+    s->cache_used += CURL_CACHE_BLOCK_SIZE;
+}
+
+/* Called with s->mutex held.  */
+static void curl_cache_free(BDRVCURLState *s)
+{
+    if (!s->cache) {
+        return;
+    }
+    while (!QTAILQ_EMPTY(&s->cache_lru)) {
+        curl_cache_remove(s, QTAILQ_FIRST(&s->cache_lru));
+    }
+    g_hash_table_destroy(s->cache);
+    s->cache = NULL;
+}
+
+/*
+ * Copy [start, start + len) to @qiov if the cache has all of it.
+ * Called with s->mutex held.
+ */
+static bool curl_cache_read(BDRVCURLState *s, uint64_t start, uint64_t len,
+                            QEMUIOVector *qiov)
+{
+    uint64_t first = start / CURL_CACHE_BLOCK_SIZE;
+    uint64_t last = (start + len - 1) / CURL_CACHE_BLOCK_SIZE;
+    uint64_t i;
+
+    for (i = first; i <= last; i++) {
+        if (!g_hash_table_contains(s->cache, &i)) {
+            return false;
+        }
+    }
+
+    for (i = first; i <= last; i++) {
+        CURLCacheBlock *blk = g_hash_table_lookup(s->cache, &i);
+        uint64_t blk_start = i * CURL_CACHE_BLOCK_SIZE;
+        uint64_t from = MAX(start, blk_start);
+        uint64_t to = MIN(start + len, blk_start + blk->len);
+
+        if (to > from) {
+            qemu_iovec_from_buf(qiov, from - start,
+                                blk->data + (from - blk_start), to - from);
+        }
+        QTAILQ_REMOVE(&s->cache_lru, blk, next);
+        QTAILQ_INSERT_TAIL(&s->cache_lru, blk, next);
+    }
+    return true;
+}
+
+/*
+ * Add the blocks the last write to @state's buffer completed to the cache;
+ * the buffer starts on a block boundary.  Called with s->mutex held.
+ */
+static void curl_cache_fill(CURLState *state, size_t old_off)
+{
+    BDRVCURLState *s = state->s;
+    bool at_end = state->buf_start + state->buf_off == s->len;
+    uint64_t k;
+
+    if (!s->cache) {
+        return;
+    }
+
+    for (k = old_off / CURL_CACHE_BLOCK_SIZE;; k++) {
+        size_t off = k * CURL_CACHE_BLOCK_SIZE;
+        size_t len;
+
+        if (off + CURL_CACHE_BLOCK_SIZE <= state->buf_off) {
+            len = CURL_CACHE_BLOCK_SIZE;
+        } else if (at_end && off < state->buf_off) {
+            len = state->buf_off - off;
+        } else {
+            break;
+        }
+        curl_cache_insert(s, state->buf_start / CURL_CACHE_BLOCK_SIZE + k,
+                          state->orig_buf + off, len);
+    }
+}
+
 /* Called from curl_multi_do_locked, with s->mutex held.  */
 static size_t curl_read_cb(void *ptr, size_t size, size_t nmemb, void *opaque)
 {
     CURLState *s = ((CURLState*)opaque);
     size_t realsize = size * nmemb;
+    size_t old_off;
     int i;
 
     trace_curl_read_cb(realsize);
@@ -240,7 +382,9 @@ static size_t curl_read_cb(void *ptr, size_t size, size_t nmemb, void *opaque)
     }
     realsize = MIN(realsize, s->buf_len - s->buf_off);
     memcpy(s->orig_buf + s->buf_off, ptr, realsize);
+    old_off = s->buf_off;
     s->buf_off += realsize;
+    curl_cache_fill(s, old_off);
 
     for(i=0; i<CURL_NUM_ACB; i++) {
         CURLAIOCB *acb = s->acb[i];
@@ -282,7 +426,16 @@ static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
     uint64_t clamped_end = MIN(end, s->len);
     uint64_t clamped_len = clamped_end - start;
 
-    for (i=0; i<CURL_NUM_STATES; i++) {
+    if (s->cache && clamped_len &&
+        curl_cache_read(s, start, clamped_len, acb->qiov)) {
+        if (clamped_len < len) {
+            qemu_iovec_memset(acb->qiov, clamped_len, 0, len - clamped_len);
+        }
+        acb->ret = 0;
+        return true;
+    }
+
+    for (i = 0; i < s->num_states; i++) {
         CURLState *state = &s->states[i];
         uint64_t buf_end = (state->buf_start + state->buf_off);
         uint64_t buf_fend = (state->buf_start + state->buf_len);
@@ -349,12 +502,12 @@ static void curl_multi_check_completion(BDRVCURLState *s)
 
         if (msg->msg == CURLMSG_DONE) {
             CURLState *state = NULL;
+            int i;
+
             curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
                               (char **)&state);
 
-            /* ACBs for successful messages get completed in curl_read_cb */
             if (msg->data.result != CURLE_OK) {
-                int i;
                 static int errcount = 100;
 
                 /* Don't lose the original error message from curl, since
@@ -366,65 +519,67 @@ static void curl_multi_check_completion(BDRVCURLState *s)
                         error_report("curl: further errors suppressed");
                     }
                 }
+            }
 
-                for (i = 0; i < CURL_NUM_ACB; i++) {
-                    CURLAIOCB *acb = state->acb[i];
-
-                    if (acb == NULL) {
-                        continue;
-                    }
+            /* ACBs get completed in curl_read_cb; those left waited for
+             * data that did not come */
+            for (i = 0; i < CURL_NUM_ACB; i++) {
+                CURLAIOCB *acb = state->acb[i];
 
-                    acb->ret = -EIO;
-                    state->acb[i] = NULL;
-                    qemu_mutex_unlock(&s->mutex);
-                    aio_co_wake(acb->co);
-                    qemu_mutex_lock(&s->mutex);
+                if (acb == NULL) {
+                    continue;
                 }
+
+                acb->ret = -EIO;
+                state->acb[i] = NULL;
+                qemu_mutex_unlock(&s->mutex);
+                aio_co_wake(acb->co);
+                qemu_mutex_lock(&s->mutex);
             }
 
             curl_clean_state(state);
-            break;
         }
     }
 }
 
 /* Called with s->mutex held.  */
-static void curl_multi_do_locked(CURLState *s)
+static void curl_multi_do_locked(CURLSocket *socket)
 {
-    CURLSocket *socket, *next_socket;
+    BDRVCURLState *s = socket->s;
+    int fd = socket->fd;
     int running;
     int r;
 
-    if (!s->s->multi) {
+    if (!s->multi) {
         return;
     }
 
-    /* Need to use _SAFE because curl_multi_socket_action() may trigger
-     * curl_sock_cb() which might modify this list */
-    QLIST_FOREACH_SAFE(socket, &s->sockets, next, next_socket) {
-        do {
-            r = curl_multi_socket_action(s->s->multi, socket->fd, 0, &running);
-        } while (r == CURLM_CALL_MULTI_PERFORM);
-    }
+    /* curl_multi_socket_action() may trigger curl_sock_cb(), which might
+     * free @socket, so do not look at it again */
+    do {
+        r = curl_multi_socket_action(s->multi, fd, 0, &running);
+    } while (r == CURLM_CALL_MULTI_PERFORM);
 }
 
 static void curl_multi_do(void *arg)
 {
-    CURLState *s = (CURLState *)arg;
+    CURLSocket *socket = arg;
+    BDRVCURLState *s = socket->s;
 
-    qemu_mutex_lock(&s->s->mutex);
-    curl_multi_do_locked(s);
-    qemu_mutex_unlock(&s->s->mutex);
+    qemu_mutex_lock(&s->mutex);
+    curl_multi_do_locked(socket);
+    qemu_mutex_unlock(&s->mutex);
 }
 
 static void curl_multi_read(void *arg)
 {
-    CURLState *s = (CURLState *)arg;
+    CURLSocket *socket = arg;
+    BDRVCURLState *s = socket->s;
 
-    qemu_mutex_lock(&s->s->mutex);
-    curl_multi_do_locked(s);
-    curl_multi_check_completion(s->s);
-    qemu_mutex_unlock(&s->s->mutex);
+    qemu_mutex_lock(&s->mutex);
+    curl_multi_do_locked(socket);
+    curl_multi_check_completion(s);
+    qemu_mutex_unlock(&s->mutex);
 }
 
 static void curl_multi_timeout_do(void *arg)
@@ -453,10 +608,12 @@ static CURLState *curl_find_state(BDRVCURLState *s)
     CURLState *state = NULL;
     int i;
 
-    for (i = 0; i < CURL_NUM_STATES; i++) {
+    for (i = 0; i < s->num_states; i++) {
         if (!s->states[i].in_use) {
             state = &s->states[i];
             state->in_use = 1;
+            state->s = s;
+            s->states_in_use++;
             break;
         }
     }
@@ -515,12 +672,18 @@ static int curl_init_state(BDRVCURLState *s, CURLState *state)
         curl_easy_setopt(state->curl, CURLOPT_REDIR_PROTOCOLS, PROTOCOLS);
 #endif
 
+#if LIBCURL_VERSION_NUM >= 0x072f00
+        /* Let transfers to the same server share one HTTP/2 connection */
+        curl_easy_setopt(state->curl, CURLOPT_HTTP_VERSION,
+                         (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(state->curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+
 #ifdef DEBUG_VERBOSE
         curl_easy_setopt(state->curl, CURLOPT_VERBOSE, 1);
 #endif
     }
 
-    QLIST_INIT(&state->sockets);
     state->s = s;
 
     return 0;
@@ -537,14 +700,8 @@ static void curl_clean_state(CURLState *s)
     if (s->s->multi)
         curl_multi_remove_handle(s->s->multi, s->curl);
 
-    while (!QLIST_EMPTY(&s->sockets)) {
-        CURLSocket *socket = QLIST_FIRST(&s->sockets);
-
-        QLIST_REMOVE(socket, next);
-        g_free(socket);
-    }
-
     s->in_use = 0;
+    s->s->states_in_use--;
 
     qemu_co_enter_next(&s->s->free_state_waitq, &s->s->mutex);
 }
@@ -561,7 +718,7 @@ static void curl_detach_aio_context(BlockDriverState *bs)
     int i;
 
     qemu_mutex_lock(&s->mutex);
-    for (i = 0; i < CURL_NUM_STATES; i++) {
+    for (i = 0; i < s->num_states; i++) {
         if (s->states[i].in_use) {
             curl_clean_state(&s->states[i]);
         }
@@ -576,6 +733,14 @@ static void curl_detach_aio_context(BlockDriverState *bs)
         curl_multi_cleanup(s->multi);
         s->multi = NULL;
     }
+    while (!QLIST_EMPTY(&s->sockets)) {
+        CURLSocket *socket = QLIST_FIRST(&s->sockets);
+
+        aio_set_fd_handler(s->aio_context, socket->fd, false,
+                           NULL, NULL, NULL, NULL);
+        QLIST_REMOVE(socket, next);
+        g_free(socket);
+    }
     qemu_mutex_unlock(&s->mutex);
 
     timer_del(&s->timer);
@@ -593,7 +758,11 @@ static void curl_attach_aio_context(BlockDriverState *bs,
     assert(!s->multi);
     s->multi = curl_multi_init();
     s->aio_context = new_context;
+    curl_multi_setopt(s->multi, CURLMOPT_SOCKETDATA, s);
     curl_multi_setopt(s->multi, CURLMOPT_SOCKETFUNCTION, curl_sock_cb);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    curl_multi_setopt(s->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 #ifdef NEED_CURL_TIMER_CALLBACK
     curl_multi_setopt(s->multi, CURLMOPT_TIMERDATA, s);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERFUNCTION, curl_timer_cb);
@@ -654,6 +823,16 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "ID of secret used as password for HTTP proxy auth",
         },
+        {
+            .name = CURL_BLOCK_OPT_PARALLEL_REQUESTS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of ranges fetched at the same time",
+        },
+        {
+            .name = CURL_BLOCK_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of the cache of fetched data (0 to disable)",
+        },
         { /* end of list */ }
     },
 };
@@ -712,6 +891,25 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
         goto out_noclean;
     }
 
+    s->num_states = qemu_opt_get_number(
+        opts, CURL_BLOCK_OPT_PARALLEL_REQUESTS,
+        CURL_BLOCK_OPT_PARALLEL_REQUESTS_DEFAULT);
+    if (s->num_states < 1 || s->num_states > CURL_MAX_STATES) {
+        error_setg(errp, "parallel-requests must be between 1 and %d",
+                   CURL_MAX_STATES);
+        goto out_noclean;
+    }
+    s->states = g_new0(CURLState, s->num_states);
+    QLIST_INIT(&s->sockets);
+
+    s->cache_size = qemu_opt_get_size(opts, CURL_BLOCK_OPT_CACHE_SIZE,
+                                      CURL_BLOCK_OPT_CACHE_SIZE_DEFAULT);
+    QTAILQ_INIT(&s->cache_lru);
+    if (s->cache_size >= CURL_CACHE_BLOCK_SIZE) {
+        s->cache = g_hash_table_new(g_int64_hash, g_int64_equal);
+    }
+    s->seq_readahead = s->readahead_size;
+
     s->sslverify = qemu_opt_get_bool(opts, CURL_BLOCK_OPT_SSLVERIFY,
                                      CURL_BLOCK_OPT_SSLVERIFY_DEFAULT);
 
@@ -840,6 +1038,8 @@ out:
     state->curl = NULL;
 out_noclean:
     qemu_mutex_destroy(&s->mutex);
+    curl_cache_free(s);
+    g_free(s->states);
     g_free(s->cookie);
     g_free(s->url);
     g_free(s->username);
@@ -849,18 +1049,103 @@ out_noclean:
     return -EINVAL;
 }
 
+/*
+ * Fetch [start, end) with @state, which curl_init_state() has set up; the
+ * first waiter, if any, must already be in state->acb[0].
+ * Called with s->mutex held.
+ */
+static int curl_start_transfer(BDRVCURLState *s, CURLState *state,
+                               uint64_t start, uint64_t end)
+{
+    int running;
+
+    state->buf_off = 0;
+    g_free(state->orig_buf);
+    state->buf_start = start;
+    state->buf_len = end - start;
+    state->orig_buf = g_try_malloc(state->buf_len);
+    if (state->buf_len && state->orig_buf == NULL) {
+        return -ENOMEM;
+    }
+
+    snprintf(state->range, 127, "%" PRIu64 "-%" PRIu64, start, end - 1);
+    curl_easy_setopt(state->curl, CURLOPT_RANGE, state->range);
+
+    curl_multi_add_handle(s->multi, state->curl);
+
+    /* Tell curl it needs to kick things off */
+    curl_multi_socket_action(s->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    return 0;
+}
+
+/*
+ * Grow the read-ahead while the guest reads sequentially, and drop back to
+ * the configured size as soon as it seeks.  Called with s->mutex held.
+ */
+static bool curl_update_readahead(BDRVCURLState *s, uint64_t start,
+                                  uint64_t bytes)
+{
+    bool sequential = start && start == s->last_end;
+
+    if (sequential) {
+        s->seq_readahead = MIN(s->seq_readahead * 2,
+                               MAX(CURL_READAHEAD_MAX, s->readahead_size));
+    } else {
+        s->seq_readahead = s->readahead_size;
+    }
+    s->last_end = start + bytes;
+    return sequential;
+}
+
+/*
+ * Start fetching what a sequential reader will ask for next, without
+ * waiting for a state and leaving half of them for other requests.
+ * Called with s->mutex held.
+ */
+static void curl_prefetch(BDRVCURLState *s)
+{
+    CURLState *state;
+    uint64_t start, end;
+
+    if (!s->cache || s->states_in_use * 2 >= s->num_states - 1) {
+        return;
+    }
+
+    start = MAX(s->fetch_end, QEMU_ALIGN_DOWN(s->last_end,
+                                              CURL_CACHE_BLOCK_SIZE));
+    end = MIN(QEMU_ALIGN_UP(s->last_end + s->seq_readahead,
+                            CURL_CACHE_BLOCK_SIZE), s->len);
+    if (start >= end) {
+        return;
+    }
+
+    state = curl_find_state(s);
+    if (!state) {
+        return;
+    }
+    if (curl_init_state(s, state) < 0 ||
+        curl_start_transfer(s, state, start, end) < 0) {
+        curl_clean_state(state);
+        return;
+    }
+    trace_curl_prefetch(start, end);
+    s->fetch_end = end;
+}
+
 static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
 {
     CURLState *state;
-    int running;
 
     BDRVCURLState *s = bs->opaque;
 
     uint64_t start = acb->offset;
-    uint64_t end;
+    uint64_t fetch_start, fetch_end;
+    bool sequential;
 
     qemu_mutex_lock(&s->mutex);
 
+    sequential = curl_update_readahead(s, start, acb->bytes);
+
     // In case we have the requested data already (e.g. read-ahead),
     // we can just call the callback and be done.
     if (curl_find_buf(s, start, acb->bytes, acb)) {
@@ -882,32 +1167,27 @@ static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
         goto out;
     }
 
-    acb->start = 0;
-    acb->end = MIN(acb->bytes, s->len - start);
+    /* Fetch whole cache blocks, so that all of the transfer can be kept */
+    fetch_start = QEMU_ALIGN_DOWN(start, CURL_CACHE_BLOCK_SIZE);
+    acb->start = start - fetch_start;
+    acb->end = acb->start + MIN(acb->bytes, s->len - start);
+    fetch_end = MIN(QEMU_ALIGN_UP(fetch_start + acb->end + s->seq_readahead,
+                                  CURL_CACHE_BLOCK_SIZE), s->len);
 
-    state->buf_off = 0;
-    g_free(state->orig_buf);
-    state->buf_start = start;
-    state->buf_len = MIN(acb->end + s->readahead_size, s->len - start);
-    end = start + state->buf_len - 1;
-    state->orig_buf = g_try_malloc(state->buf_len);
-    if (state->buf_len && state->orig_buf == NULL) {
+    state->acb[0] = acb;
+    if (curl_start_transfer(s, state, fetch_start, fetch_end) < 0) {
+        state->acb[0] = NULL;
         curl_clean_state(state);
         acb->ret = -ENOMEM;
         goto out;
     }
-    state->acb[0] = acb;
-
-    snprintf(state->range, 127, "%" PRIu64 "-%" PRIu64, start, end);
     trace_curl_setup_preadv(acb->bytes, start, state->range);
-    curl_easy_setopt(state->curl, CURLOPT_RANGE, state->range);
-
-    curl_multi_add_handle(s->multi, state->curl);
-
-    /* Tell curl it needs to kick things off */
-    curl_multi_socket_action(s->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    s->fetch_end = sequential ? MAX(s->fetch_end, fetch_end) : fetch_end;
 
 out:
+    if (sequential) {
+        curl_prefetch(s);
+    }
     qemu_mutex_unlock(&s->mutex);
 }
 
@@ -937,6 +1217,8 @@ static void curl_close(BlockDriverState *bs)
     curl_detach_aio_context(bs);
     qemu_mutex_destroy(&s->mutex);
 
+    curl_cache_free(s);
+    g_free(s->states);
     g_free(s->cookie);
     g_free(s->url);
     g_free(s->username);
@@ -954,8 +1236,8 @@ static void curl_refresh_filename(BlockDriverState *bs)
 {
     BDRVCURLState *s = bs->opaque;
 
-    /* "readahead" and "timeout" do not change the guest-visible data,
-     * so ignore them */
+    /* "readahead", "timeout", "parallel-requests" and "cache-size" do not
+     * change the guest-visible data, so ignore them */
     if (s->sslverify != CURL_BLOCK_OPT_SSLVERIFY_DEFAULT ||
         s->cookie || s->username || s->password || s->proxyusername ||
         s->proxypassword)
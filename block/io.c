@@ -488,23 +488,25 @@ void bdrv_drain(BlockDriverState *bs)
     bdrv_drained_end(bs);
 }
 
-static void bdrv_drain_assert_idle(BlockDriverState *bs)
-{
-    BdrvChild *child, *next;
-
-    assert(atomic_read(&bs->in_flight) == 0);
-    QLIST_FOREACH_SAFE(child, &bs->children, next, next) {
-        bdrv_drain_assert_idle(child->bs);
-    }
-}
-
 unsigned int bdrv_drain_all_count = 0;
 
+/* The sum of the in_flight counters of all nodes */
+unsigned int bdrv_in_flight_total;
+
 static bool bdrv_drain_all_poll(void)
 {
     BlockDriverState *bs = NULL;
     bool result = false;
 
+    /*
+     * Checking the counter is enough while any request is in flight, which
+     * is most of the wait; the nodes are only scanned, for parents that are
+     * still busy, once all their requests are done.
+     */
+    if (atomic_read(&bdrv_in_flight_total)) {
+        return true;
+    }
+
     /* bdrv_drain_poll() can't make changes to the graph and we are holding the
      * main AioContext lock, so iterating bdrv_next_all_states() is safe. */
     while ((bs = bdrv_next_all_states(bs))) {
@@ -557,9 +559,7 @@ void bdrv_drain_all_begin(void)
     /* Now poll the in-flight requests */
     AIO_WAIT_WHILE(NULL, bdrv_drain_all_poll());
 
-    while ((bs = bdrv_next_all_states(bs))) {
-        bdrv_drain_assert_idle(bs);
-    }
+    assert(atomic_read(&bdrv_in_flight_total) == 0);
 }
 
 void bdrv_drain_all_end(void)
@@ -597,6 +597,7 @@ static void tracked_request_end(BdrvTrackedRequest *req)
 
     qemu_co_mutex_lock(&req->bs->reqs_lock);
     QLIST_REMOVE(req, list);
+    interval_tree_remove(&req->bs->tracked_tree, &req->overlap_node);
     qemu_co_queue_restart_all(&req->wait_queue);
     qemu_co_mutex_unlock(&req->bs->reqs_lock);
 }
@@ -621,28 +622,49 @@ static void tracked_request_begin(BdrvTrackedRequest *req,
         .serialising    = false,
         .overlap_offset = offset,
         .overlap_bytes  = bytes,
+        .overlap_node   = {
+            .start      = offset,
+            .end        = offset + bytes,
+        },
     };
 
     qemu_co_queue_init(&req->wait_queue);
 
     qemu_co_mutex_lock(&bs->reqs_lock);
     QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
+    interval_tree_insert(&bs->tracked_tree, &req->overlap_node);
     qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
-static void mark_request_serialising(BdrvTrackedRequest *req, uint64_t align)
+static void coroutine_fn mark_request_serialising(BdrvTrackedRequest *req,
+                                                  uint64_t align)
 {
+    BlockDriverState *bs = req->bs;
     int64_t overlap_offset = req->offset & ~(align - 1);
     uint64_t overlap_bytes = ROUND_UP(req->offset + req->bytes, align)
                                - overlap_offset;
 
     if (!req->serialising) {
-        atomic_inc(&req->bs->serialising_in_flight);
+        atomic_inc(&bs->serialising_in_flight);
         req->serialising = true;
     }
 
-    req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
-    req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    overlap_offset = MIN(req->overlap_offset, overlap_offset);
+    overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    if (overlap_offset == req->overlap_offset &&
+        overlap_bytes == req->overlap_bytes) {
+        return;
+    }
+
+    /* The range is the key in tracked_tree, so move the node */
+    qemu_co_mutex_lock(&bs->reqs_lock);
+    interval_tree_remove(&bs->tracked_tree, &req->overlap_node);
+    req->overlap_offset = overlap_offset;
+    req->overlap_bytes = overlap_bytes;
+    req->overlap_node.start = overlap_offset;
+    req->overlap_node.end = overlap_offset + overlap_bytes;
+    interval_tree_insert(&bs->tracked_tree, &req->overlap_node);
+    qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
 static bool is_request_serialising_and_aligned(BdrvTrackedRequest *req)
@@ -690,23 +712,36 @@ static int bdrv_get_cluster_size(BlockDriverState *bs)
     }
 }
 
-static bool tracked_request_overlaps(BdrvTrackedRequest *req,
-                                     int64_t offset, uint64_t bytes)
+/*
+ * Called by interval_tree_find() for each tracked request that overlaps
+ * @opaque; returns true if @opaque has to wait for it.
+ */
+static bool tracked_request_conflicts(IntervalTreeNode *node, void *opaque)
 {
-    /*        aaaa   bbbb */
-    if (offset >= req->overlap_offset + req->overlap_bytes) {
-        return false;
-    }
-    /* bbbb   aaaa        */
-    if (req->overlap_offset >= offset + bytes) {
+    BdrvTrackedRequest *self = opaque;
+    BdrvTrackedRequest *req = container_of(node, BdrvTrackedRequest,
+                                           overlap_node);
+
+    if (req == self || (!req->serialising && !self->serialising)) {
         return false;
     }
-    return true;
+
+    /* Hitting this means there was a reentrant request, for
+     * example, a block driver issuing nested requests.  This must
+     * never happen since it means deadlock.
+     */
+    assert(qemu_coroutine_self() != req->co);
+
+    /* If the request is already (indirectly) waiting for us, or
+     * will wait for us as soon as it wakes up, then just go on
+     * (instead of producing a deadlock in the former case). */
+    return !req->waiting_for;
 }
 
 void bdrv_inc_in_flight(BlockDriverState *bs)
 {
     atomic_inc(&bs->in_flight);
+    atomic_inc(&bdrv_in_flight_total);
 }
 
 void bdrv_wakeup(BlockDriverState *bs)
@@ -717,51 +752,44 @@ void bdrv_wakeup(BlockDriverState *bs)
 void bdrv_dec_in_flight(BlockDriverState *bs)
 {
     atomic_dec(&bs->in_flight);
+    atomic_dec(&bdrv_in_flight_total);
     bdrv_wakeup(bs);
 }
 
 static bool coroutine_fn wait_serialising_requests(BdrvTrackedRequest *self)
 {
     BlockDriverState *bs = self->bs;
+    IntervalTreeNode *node;
     BdrvTrackedRequest *req;
-    bool retry;
+    int64_t start_ns = 0;
     bool waited = false;
 
     if (!atomic_read(&bs->serialising_in_flight)) {
         return false;
     }
 
-    do {
-        retry = false;
-        qemu_co_mutex_lock(&bs->reqs_lock);
-        QLIST_FOREACH(req, &bs->tracked_requests, list) {
-            if (req == self || (!req->serialising && !self->serialising)) {
-                continue;
-            }
-            if (tracked_request_overlaps(req, self->overlap_offset,
-                                         self->overlap_bytes))
-            {
-                /* Hitting this means there was a reentrant request, for
-                 * example, a block driver issuing nested requests.  This must
-                 * never happen since it means deadlock.
-                 */
-                assert(qemu_coroutine_self() != req->co);
-
-                /* If the request is already (indirectly) waiting for us, or
-                 * will wait for us as soon as it wakes up, then just go on
-                 * (instead of producing a deadlock in the former case). */
-                if (!req->waiting_for) {
-                    self->waiting_for = req;
-                    qemu_co_queue_wait(&req->wait_queue, &bs->reqs_lock);
-                    self->waiting_for = NULL;
-                    retry = true;
-                    waited = true;
-                    break;
-                }
-            }
-        }
-        qemu_co_mutex_unlock(&bs->reqs_lock);
-    } while (retry);
+    qemu_co_mutex_lock(&bs->reqs_lock);
+    while ((node = interval_tree_find(&bs->tracked_tree,
+                                      self->overlap_offset,
+                                      self->overlap_offset +
+                                      self->overlap_bytes,
+                                      tracked_request_conflicts, self))) {
+        req = container_of(node, BdrvTrackedRequest, overlap_node);
+        if (!waited) {
+            start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+            waited = true;
+        }
+        self->waiting_for = req;
+        qemu_co_queue_wait(&req->wait_queue, &bs->reqs_lock);
+        self->waiting_for = NULL;
+    }
+    qemu_co_mutex_unlock(&bs->reqs_lock);
+
+    if (waited) {
+        stat64_add(&bs->serialising_waits, 1);
+        stat64_add(&bs->serialising_wait_ns,
+                   qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns);
+    }
 
     return waited;
 }
@@ -1617,6 +1645,13 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, uint64_t bytes,
 
     atomic_inc(&bs->write_gen);
 
+    /* Discards and zero writes may leave holes in cached data extents */
+    if (req->type == BDRV_TRACKED_TRUNCATE) {
+        bs->block_status_cache.valid = false;
+    } else {
+        bdrv_bsc_invalidate_range(bs, offset, bytes);
+    }
+
     /*
      * Discard cannot extend the image, but in error handling cases, such as
      * when reverting a qcow2 cluster allocation, the discarded range can pass
@@ -1646,6 +1681,17 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, uint64_t bytes,
     }
 }
 
+static void bdrv_bsc_invalidate_range(BlockDriverState *bs,
+                                      int64_t offset, int64_t bytes)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+
+    if (bsc->valid && offset < bsc->data_end &&
+        offset + bytes > bsc->data_start) {
+        bsc->valid = false;
+    }
+}
+
 /*
  * Forwards an already correctly aligned write request to the BlockDriver,
  * after possibly fragmenting it.
@@ -2107,12 +2153,34 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
     aligned_offset = QEMU_ALIGN_DOWN(offset, align);
     aligned_bytes = ROUND_UP(offset + bytes, align) - aligned_offset;
 
-    ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
-                                        aligned_bytes, pnum, &local_map,
-                                        &local_file);
-    if (ret < 0) {
-        *pnum = 0;
-        goto out;
+    if (bs->drv->protocol_name && want_zero &&
+        bs->block_status_cache.valid &&
+        aligned_offset >= bs->block_status_cache.data_start &&
+        aligned_offset < bs->block_status_cache.data_end) {
+        *pnum = bs->block_status_cache.data_end - aligned_offset;
+        ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+        local_map = aligned_offset;
+        local_file = bs;
+    } else {
+        ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
+                                            aligned_bytes, pnum, &local_map,
+                                            &local_file);
+        if (ret < 0) {
+            *pnum = 0;
+            goto out;
+        }
+
+        /* Without want_zero, data may just mean the driver did not look */
+        if (bs->drv->protocol_name && want_zero &&
+            ret == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) &&
+            local_file == bs && local_map == aligned_offset &&
+            QEMU_IS_ALIGNED(*pnum, align)) {
+            bs->block_status_cache = (BdrvBlockStatusCache) {
+                .valid = true,
+                .data_start = aligned_offset,
+                .data_end = aligned_offset + *pnum,
+            };
+        }
     }
 
     /*
@@ -59,14 +59,26 @@ QEMU_BUILD_BUG_ON((int)SCSI_XFER_NONE != (int)ISCSI_XFER_NONE);
 #include <scsi/sg.h>
 #endif
 
-typedef struct IscsiLun {
+/*
+ * A login to the target.  Reads, writes and GET LBA STATUS are spread over
+ * the sessions of a LUN; everything else goes through the first one.
+ */
+typedef struct IscsiSession {
     struct iscsi_context *iscsi;
+    struct IscsiLun *iscsilun;
+    int events;
+    unsigned in_flight;
+} IscsiSession;
+
+typedef struct IscsiLun {
+    struct iscsi_context *iscsi;    /* sessions[0].iscsi */
+    IscsiSession *sessions;
+    int nb_sessions;
     AioContext *aio_context;
     int lun;
     enum scsi_inquiry_peripheral_device_type type;
     int block_size;
     uint64_t num_blocks;
-    int events;
     QEMUTimer *nop_timer;
     QEMUTimer *event_timer;
     QemuMutex mutex;
@@ -99,6 +111,8 @@ typedef struct IscsiLun {
     bool dpofua;
     bool has_write_same;
     bool request_timed_out;
+    bool lba_status_prefetching;
+    int64_t lba_status_prefetch_offset;
 } IscsiLun;
 
 typedef struct IscsiTask {
@@ -145,6 +159,11 @@ static const unsigned iscsi_retry_times[] = {8, 32, 128, 512, 2048, 8192, 32768}
  * unallocated. */
 #define ISCSI_CHECKALLOC_THRES 64
 
+/* Descriptors asked for by each GET LBA STATUS, all go to the allocmap */
+#define ISCSI_LBA_STATUS_DESCRIPTORS 32
+
+#define ISCSI_MAX_SESSIONS 16
+
 #ifdef __linux__
 
 static void
@@ -351,34 +370,70 @@ static void iscsi_process_write(void *arg);
 
 /* Called with QemuMutex held.  */
 static void
-iscsi_set_events(IscsiLun *iscsilun)
+iscsi_session_set_events(IscsiSession *ses)
 {
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    struct iscsi_context *iscsi = ses->iscsi;
     int ev = iscsi_which_events(iscsi);
 
-    if (ev != iscsilun->events) {
-        aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(iscsi),
+    if (ev != ses->events) {
+        aio_set_fd_handler(ses->iscsilun->aio_context, iscsi_get_fd(iscsi),
                            false,
                            (ev & POLLIN) ? iscsi_process_read : NULL,
                            (ev & POLLOUT) ? iscsi_process_write : NULL,
                            NULL,
-                           iscsilun);
-        iscsilun->events = ev;
+                           ses);
+        ses->events = ev;
+    }
+}
+
+/* Called with QemuMutex held.  */
+static void
+iscsi_set_events(IscsiLun *iscsilun)
+{
+    int i;
+
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        iscsi_session_set_events(&iscsilun->sessions[i]);
     }
 }
 
+/* Pick the least busy session for a command.  Called with QemuMutex held. */
+static IscsiSession *iscsi_session_get(IscsiLun *iscsilun)
+{
+    IscsiSession *ses = &iscsilun->sessions[0];
+    int i;
+
+    for (i = 1; i < iscsilun->nb_sessions; i++) {
+        if (iscsilun->sessions[i].in_flight < ses->in_flight) {
+            ses = &iscsilun->sessions[i];
+        }
+    }
+    ses->in_flight++;
+    return ses;
+}
+
+static void iscsi_session_put(IscsiSession *ses)
+{
+    ses->in_flight--;
+}
+
 static void iscsi_timed_check_events(void *opaque)
 {
     IscsiLun *iscsilun = opaque;
+    int i;
 
     qemu_mutex_lock(&iscsilun->mutex);
 
     /* check for timed out requests */
-    iscsi_service(iscsilun->iscsi, 0);
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        iscsi_service(iscsilun->sessions[i].iscsi, 0);
+    }
 
     if (iscsilun->request_timed_out) {
         iscsilun->request_timed_out = false;
-        iscsi_reconnect(iscsilun->iscsi);
+        for (i = 0; i < iscsilun->nb_sessions; i++) {
+            iscsi_reconnect(iscsilun->sessions[i].iscsi);
+        }
     }
 
     /* newer versions of libiscsi may return zero events. Ensure we are able
@@ -394,24 +449,24 @@ static void iscsi_timed_check_events(void *opaque)
 static void
 iscsi_process_read(void *arg)
 {
-    IscsiLun *iscsilun = arg;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    IscsiSession *ses = arg;
+    IscsiLun *iscsilun = ses->iscsilun;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    iscsi_service(iscsi, POLLIN);
-    iscsi_set_events(iscsilun);
+    iscsi_service(ses->iscsi, POLLIN);
+    iscsi_session_set_events(ses);
     qemu_mutex_unlock(&iscsilun->mutex);
 }
 
 static void
 iscsi_process_write(void *arg)
 {
-    IscsiLun *iscsilun = arg;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    IscsiSession *ses = arg;
+    IscsiLun *iscsilun = ses->iscsilun;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    iscsi_service(iscsi, POLLOUT);
-    iscsi_set_events(iscsilun);
+    iscsi_service(ses->iscsi, POLLOUT);
+    iscsi_session_set_events(ses);
     qemu_mutex_unlock(&iscsilun->mutex);
 }
 
@@ -602,6 +657,7 @@ iscsi_co_writev(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
 {
     IscsiLun *iscsilun = bs->opaque;
     struct IscsiTask iTask;
+    IscsiSession *ses;
     uint64_t lba;
     uint32_t num_sectors;
     bool fua = flags & BDRV_REQ_FUA;
@@ -622,34 +678,36 @@ iscsi_co_writev(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
     num_sectors = sector_qemu2lun(nb_sectors, iscsilun);
     iscsi_co_init_iscsitask(iscsilun, &iTask);
     qemu_mutex_lock(&iscsilun->mutex);
+    ses = iscsi_session_get(iscsilun);
 retry:
     if (iscsilun->use_16_for_rw) {
 #if LIBISCSI_API_VERSION >= (20160603)
-        iTask.task = iscsi_write16_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write16_iov_task(ses->iscsi, iscsilun->lun, lba,
                                             NULL, num_sectors * iscsilun->block_size,
                                             iscsilun->block_size, 0, 0, fua, 0, 0,
                                             iscsi_co_generic_cb, &iTask,
                                             (struct scsi_iovec *)iov->iov, iov->niov);
     } else {
-        iTask.task = iscsi_write10_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write10_iov_task(ses->iscsi, iscsilun->lun, lba,
                                             NULL, num_sectors * iscsilun->block_size,
                                             iscsilun->block_size, 0, 0, fua, 0, 0,
                                             iscsi_co_generic_cb, &iTask,
                                             (struct scsi_iovec *)iov->iov, iov->niov);
     }
 #else
-        iTask.task = iscsi_write16_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write16_task(ses->iscsi, iscsilun->lun, lba,
                                         NULL, num_sectors * iscsilun->block_size,
                                         iscsilun->block_size, 0, 0, fua, 0, 0,
                                         iscsi_co_generic_cb, &iTask);
     } else {
-        iTask.task = iscsi_write10_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write10_task(ses->iscsi, iscsilun->lun, lba,
                                         NULL, num_sectors * iscsilun->block_size,
                                         iscsilun->block_size, 0, 0, fua, 0, 0,
                                         iscsi_co_generic_cb, &iTask);
     }
 #endif
     if (iTask.task == NULL) {
+        iscsi_session_put(ses);
         qemu_mutex_unlock(&iscsilun->mutex);
         return -ENOMEM;
     }
@@ -682,6 +740,7 @@ retry:
                                  nb_sectors * BDRV_SECTOR_SIZE);
 
 out_unlock:
+    iscsi_session_put(ses);
     qemu_mutex_unlock(&iscsilun->mutex);
     g_free(iTask.err_str);
     return r;
@@ -689,42 +748,86 @@ out_unlock:
 
 
 
-static int coroutine_fn iscsi_co_block_status(BlockDriverState *bs,
-                                              bool want_zero, int64_t offset,
-                                              int64_t bytes, int64_t *pnum,
-                                              int64_t *map,
-                                              BlockDriverState **file)
+/* Record a GET LBA STATUS descriptor in the allocmap */
+static void iscsi_allocmap_record(IscsiLun *iscsilun,
+                                  struct scsi_lba_status_descriptor *lbasd)
+{
+    int64_t offset = lbasd->lba * iscsilun->block_size;
+    int64_t bytes = (int64_t) lbasd->num_blocks * iscsilun->block_size;
+
+    if ((lbasd->provisioning == SCSI_PROVISIONING_TYPE_DEALLOCATED ||
+         lbasd->provisioning == SCSI_PROVISIONING_TYPE_ANCHORED) &&
+        iscsilun->lbprz) {
+        iscsi_allocmap_set_unallocated(iscsilun, offset, bytes);
+    } else {
+        iscsi_allocmap_set_allocated(iscsilun, offset, bytes);
+    }
+}
+
+/*
+ * Answer a block status query from the allocmap if it knows the cluster at
+ * @offset: returns the BDRV_BLOCK_* flags for as many bytes from @offset
+ * (at most @bytes) as are in the same state and sets @pnum to it, or
+ * returns -1.  Called with QemuMutex held.
+ */
+static int iscsi_allocmap_block_status(IscsiLun *iscsilun, int64_t offset,
+                                       int64_t bytes, int64_t *pnum)
+{
+    long cl, valid_end, end;
+    bool allocated;
+
+    if (!iscsilun->allocmap_valid) {
+        return -1;
+    }
+    cl = offset / iscsilun->cluster_size;
+    if (cl >= iscsilun->allocmap_size ||
+        !test_bit(cl, iscsilun->allocmap_valid)) {
+        return -1;
+    }
+
+    valid_end = find_next_zero_bit(iscsilun->allocmap_valid,
+                                   iscsilun->allocmap_size, cl);
+    allocated = test_bit(cl, iscsilun->allocmap);
+    if (allocated) {
+        end = find_next_zero_bit(iscsilun->allocmap, valid_end, cl);
+    } else {
+        end = find_next_bit(iscsilun->allocmap, valid_end, cl);
+    }
+
+    *pnum = MIN((int64_t) end * iscsilun->cluster_size - offset, bytes);
+    /* The allocmap only exists if unmapped blocks read as zero */
+    return allocated ? BDRV_BLOCK_DATA : BDRV_BLOCK_ZERO;
+}
+
+/*
+ * Send GET LBA STATUS for @offset, put all the descriptors the target
+ * returns into the allocmap and return the BDRV_BLOCK_* flags of the first.
+ */
+static int coroutine_fn iscsi_co_get_lba_status(IscsiLun *iscsilun,
+                                                int64_t offset, int64_t bytes,
+                                                int64_t *pnum)
 {
-    IscsiLun *iscsilun = bs->opaque;
     struct scsi_get_lba_status *lbas = NULL;
     struct scsi_lba_status_descriptor *lbasd = NULL;
     struct IscsiTask iTask;
+    IscsiSession *ses;
     uint64_t lba;
-    int ret;
+    int i, ret;
 
     iscsi_co_init_iscsitask(iscsilun, &iTask);
 
-    assert(QEMU_IS_ALIGNED(offset | bytes, iscsilun->block_size));
-
     /* default to all sectors allocated */
     ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
-    if (map) {
-        *map = offset;
-    }
     *pnum = bytes;
 
-    /* LUN does not support logical block provisioning */
-    if (!iscsilun->lbpme) {
-        goto out;
-    }
-
     lba = offset / iscsilun->block_size;
 
     qemu_mutex_lock(&iscsilun->mutex);
+    ses = iscsi_session_get(iscsilun);
 retry:
-    if (iscsi_get_lba_status_task(iscsilun->iscsi, iscsilun->lun,
-                                  lba, 8 + 16, iscsi_co_generic_cb,
-                                  &iTask) == NULL) {
+    if (iscsi_get_lba_status_task(ses->iscsi, iscsilun->lun, lba,
+                                  8 + 16 * ISCSI_LBA_STATUS_DESCRIPTORS,
+                                  iscsi_co_generic_cb, &iTask) == NULL) {
         ret = -ENOMEM;
         goto out_unlock;
     }
@@ -750,7 +853,7 @@ retry:
     }
 
     lbas = scsi_datain_unmarshall(iTask.task);
-    if (lbas == NULL) {
+    if (lbas == NULL || lbas->num_descriptors == 0) {
         ret = -EIO;
         goto out_unlock;
     }
@@ -772,22 +875,104 @@ retry:
         }
     }
 
-    if (ret & BDRV_BLOCK_ZERO) {
-        iscsi_allocmap_set_unallocated(iscsilun, offset, *pnum);
-    } else {
-        iscsi_allocmap_set_allocated(iscsilun, offset, *pnum);
+    for (i = 0; i < lbas->num_descriptors; i++) {
+        iscsi_allocmap_record(iscsilun, &lbas->descriptors[i]);
     }
 
     if (*pnum > bytes) {
         *pnum = bytes;
     }
 out_unlock:
+    iscsi_session_put(ses);
     qemu_mutex_unlock(&iscsilun->mutex);
     g_free(iTask.err_str);
-out:
     if (iTask.task != NULL) {
         scsi_free_scsi_task(iTask.task);
     }
+    return ret;
+}
+
+static void coroutine_fn iscsi_lba_status_prefetch_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    IscsiLun *iscsilun = bs->opaque;
+    int64_t offset = iscsilun->lba_status_prefetch_offset;
+    int64_t pnum;
+
+    iscsi_co_get_lba_status(iscsilun, offset,
+                            MIN(bs->total_sectors * BDRV_SECTOR_SIZE - offset,
+                                QEMU_ALIGN_DOWN(BDRV_REQUEST_MAX_BYTES,
+                                                iscsilun->block_size)),
+                            &pnum);
+    iscsilun->lba_status_prefetching = false;
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Whoever asks for the block status of one extent usually asks for the
+ * next one right after (mirror, backup, qemu-img convert); if the allocmap
+ * does not know about it yet, ask the target in the background.
+ */
+static void iscsi_lba_status_prefetch(BlockDriverState *bs, int64_t offset)
+{
+    IscsiLun *iscsilun = bs->opaque;
+    long cl;
+
+    if (!iscsilun->allocmap_valid || iscsilun->lba_status_prefetching ||
+        offset >= bs->total_sectors * BDRV_SECTOR_SIZE) {
+        return;
+    }
+    cl = offset / iscsilun->cluster_size;
+    if (cl >= iscsilun->allocmap_size ||
+        test_bit(cl, iscsilun->allocmap_valid)) {
+        return;
+    }
+
+    iscsilun->lba_status_prefetching = true;
+    iscsilun->lba_status_prefetch_offset = offset;
+    bdrv_inc_in_flight(bs);
+    aio_co_schedule(iscsilun->aio_context,
+                    qemu_coroutine_create(iscsi_lba_status_prefetch_entry,
+                                          bs));
+}
+
+static int coroutine_fn iscsi_co_block_status(BlockDriverState *bs,
+                                              bool want_zero, int64_t offset,
+                                              int64_t bytes, int64_t *pnum,
+                                              int64_t *map,
+                                              BlockDriverState **file)
+{
+    IscsiLun *iscsilun = bs->opaque;
+    int ret;
+
+    assert(QEMU_IS_ALIGNED(offset | bytes, iscsilun->block_size));
+
+    /* default to all sectors allocated */
+    ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+    if (map) {
+        *map = offset;
+    }
+    *pnum = bytes;
+
+    /* LUN does not support logical block provisioning */
+    if (!iscsilun->lbpme) {
+        goto out;
+    }
+
+    qemu_mutex_lock(&iscsilun->mutex);
+    ret = iscsi_allocmap_block_status(iscsilun, offset, bytes, pnum);
+    qemu_mutex_unlock(&iscsilun->mutex);
+    if (ret >= 0) {
+        ret |= BDRV_BLOCK_OFFSET_VALID;
+    } else {
+        ret = iscsi_co_get_lba_status(iscsilun, offset, bytes, pnum);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    iscsi_lba_status_prefetch(bs, offset + *pnum);
+
+out:
     if (ret > 0 && ret & BDRV_BLOCK_OFFSET_VALID && file) {
         *file = bs;
     }
@@ -800,6 +985,7 @@ static int coroutine_fn iscsi_co_readv(BlockDriverState *bs,
 {
     IscsiLun *iscsilun = bs->opaque;
     struct IscsiTask iTask;
+    IscsiSession *ses;
     uint64_t lba;
     uint32_t num_sectors;
     int r = 0;
@@ -856,16 +1042,17 @@ static int coroutine_fn iscsi_co_readv(BlockDriverState *bs,
 
     iscsi_co_init_iscsitask(iscsilun, &iTask);
     qemu_mutex_lock(&iscsilun->mutex);
+    ses = iscsi_session_get(iscsilun);
 retry:
     if (iscsilun->use_16_for_rw) {
 #if LIBISCSI_API_VERSION >= (20160603)
-        iTask.task = iscsi_read16_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read16_iov_task(ses->iscsi, iscsilun->lun, lba,
                                            num_sectors * iscsilun->block_size,
                                            iscsilun->block_size, 0, 0, 0, 0, 0,
                                            iscsi_co_generic_cb, &iTask,
                                            (struct scsi_iovec *)iov->iov, iov->niov);
     } else {
-        iTask.task = iscsi_read10_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read10_iov_task(ses->iscsi, iscsilun->lun, lba,
                                            num_sectors * iscsilun->block_size,
                                            iscsilun->block_size,
                                            0, 0, 0, 0, 0,
@@ -873,12 +1060,12 @@ retry:
                                            (struct scsi_iovec *)iov->iov, iov->niov);
     }
 #else
-        iTask.task = iscsi_read16_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read16_task(ses->iscsi, iscsilun->lun, lba,
                                        num_sectors * iscsilun->block_size,
                                        iscsilun->block_size, 0, 0, 0, 0, 0,
                                        iscsi_co_generic_cb, &iTask);
     } else {
-        iTask.task = iscsi_read10_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read10_task(ses->iscsi, iscsilun->lun, lba,
                                        num_sectors * iscsilun->block_size,
                                        iscsilun->block_size,
                                        0, 0, 0, 0, 0,
@@ -886,6 +1073,7 @@ retry:
     }
 #endif
     if (iTask.task == NULL) {
+        iscsi_session_put(ses);
         qemu_mutex_unlock(&iscsilun->mutex);
         return -ENOMEM;
     }
@@ -910,6 +1098,7 @@ retry:
         r = iTask.err_code;
     }
 
+    iscsi_session_put(ses);
     qemu_mutex_unlock(&iscsilun->mutex);
     g_free(iTask.err_str);
     return r;
@@ -1391,14 +1580,20 @@ static char *get_initiator_name(QemuOpts *opts)
 static void iscsi_nop_timed_event(void *opaque)
 {
     IscsiLun *iscsilun = opaque;
+    int i;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    if (iscsi_get_nops_in_flight(iscsilun->iscsi) >= MAX_NOP_FAILURES) {
-        error_report("iSCSI: NOP timeout. Reconnecting...");
-        iscsilun->request_timed_out = true;
-    } else if (iscsi_nop_out_async(iscsilun->iscsi, NULL, NULL, 0, NULL) != 0) {
-        error_report("iSCSI: failed to sent NOP-Out. Disabling NOP messages.");
-        goto out;
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        struct iscsi_context *iscsi = iscsilun->sessions[i].iscsi;
+
+        if (iscsi_get_nops_in_flight(iscsi) >= MAX_NOP_FAILURES) {
+            error_report("iSCSI: NOP timeout. Reconnecting...");
+            iscsilun->request_timed_out = true;
+        } else if (iscsi_nop_out_async(iscsi, NULL, NULL, 0, NULL) != 0) {
+            error_report("iSCSI: failed to sent NOP-Out. "
+                         "Disabling NOP messages.");
+            goto out;
+        }
     }
 
     timer_mod(iscsilun->nop_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + NOP_INTERVAL);
@@ -1519,10 +1714,15 @@ fail_with_err:
 static void iscsi_detach_aio_context(BlockDriverState *bs)
 {
     IscsiLun *iscsilun = bs->opaque;
+    int i;
+
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        IscsiSession *ses = &iscsilun->sessions[i];
 
-    aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(iscsilun->iscsi),
-                       false, NULL, NULL, NULL, NULL);
-    iscsilun->events = 0;
+        aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(ses->iscsi),
+                           false, NULL, NULL, NULL, NULL);
+        ses->events = 0;
+    }
 
     if (iscsilun->nop_timer) {
         timer_del(iscsilun->nop_timer);
@@ -1747,6 +1947,10 @@ static QemuOptsList runtime_opts = {
             .name = "timeout",
             .type = QEMU_OPT_NUMBER,
         },
+        {
+            .name = "sessions",
+            .type = QEMU_OPT_NUMBER,
+        },
         { /* end of list */ }
     },
 };
@@ -1775,6 +1979,103 @@ static void iscsi_save_designator(IscsiLun *lun,
     }
 }
 
+/* Log in to the LUN of @opts, which iscsi_open() has checked */
+static int iscsi_login(QemuOpts *opts, const char *initiator_name,
+                       struct iscsi_context **piscsi, Error **errp)
+{
+    struct iscsi_context *iscsi;
+    Error *local_err = NULL;
+    const char *portal = qemu_opt_get(opts, "portal");
+    const char *target = qemu_opt_get(opts, "target");
+    int lun = qemu_opt_get_number(opts, "lun", 0);
+    int ret, timeout;
+
+    iscsi = iscsi_create_context(initiator_name);
+    if (iscsi == NULL) {
+        error_setg(errp, "iSCSI: Failed to create iSCSI context.");
+        return -ENOMEM;
+    }
+#if LIBISCSI_API_VERSION >= (20160603)
+    if (iscsi_init_transport(iscsi,
+                             !strcmp(qemu_opt_get(opts, "transport"), "iser") ?
+                             ISER_TRANSPORT : TCP_TRANSPORT)) {
+        error_setg(errp, ("Error initializing transport."));
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif
+    if (iscsi_set_targetname(iscsi, target)) {
+        error_setg(errp, "iSCSI: Failed to set target name.");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    /* check if we got CHAP username/password via the options */
+    apply_chap(iscsi, opts, &local_err);
+    if (local_err != NULL) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    if (iscsi_set_session_type(iscsi, ISCSI_SESSION_NORMAL) != 0) {
+        error_setg(errp, "iSCSI: Failed to set session type to normal.");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    /* check if we got HEADER_DIGEST via the options */
+    apply_header_digest(iscsi, opts, &local_err);
+    if (local_err != NULL) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    /* timeout handling is broken in libiscsi before 1.15.0 */
+    timeout = qemu_opt_get_number(opts, "timeout", 0);
+#if LIBISCSI_API_VERSION >= 20150621
+    iscsi_set_timeout(iscsi, timeout);
+#else
+    if (timeout) {
+        warn_report("iSCSI: ignoring timeout value for libiscsi <1.15.0");
+    }
+#endif
+
+    if (iscsi_full_connect_sync(iscsi, portal, lun) != 0) {
+        error_setg(errp, "iSCSI: Failed to connect to LUN : %s",
+            iscsi_get_error(iscsi));
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    *piscsi = iscsi;
+    return 0;
+
+fail:
+    iscsi_destroy_context(iscsi);
+    return ret;
+}
+
+/* Log out of all the sessions of @iscsilun and free them */
+static void iscsi_logout_all(IscsiLun *iscsilun)
+{
+    int i;
+
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        struct iscsi_context *iscsi = iscsilun->sessions[i].iscsi;
+
+        if (iscsi_is_logged_in(iscsi)) {
+            iscsi_logout_sync(iscsi);
+        }
+        iscsi_destroy_context(iscsi);
+    }
+    g_free(iscsilun->sessions);
+    iscsilun->sessions = NULL;
+    iscsilun->nb_sessions = 0;
+    iscsilun->iscsi = NULL;
+}
+
 static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
                       Error **errp)
 {
@@ -1787,10 +2088,7 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
     QemuOpts *opts;
     Error *local_err = NULL;
     const char *transport_name, *portal, *target;
-#if LIBISCSI_API_VERSION >= (20160603)
-    enum iscsi_transport_type transport;
-#endif
-    int i, ret = 0, timeout = 0, lun;
+    int i, ret = 0, lun, nb_sessions;
 
     opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
     qemu_opts_absorb_qdict(opts, options, &local_err);
@@ -1813,9 +2111,7 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
 
     if (!strcmp(transport_name, "tcp")) {
 #if LIBISCSI_API_VERSION >= (20160603)
-        transport = TCP_TRANSPORT;
     } else if (!strcmp(transport_name, "iser")) {
-        transport = ISER_TRANSPORT;
 #else
         /* TCP is what older libiscsi versions always use */
 #endif
@@ -1825,66 +2121,36 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
         goto out;
     }
 
-    memset(iscsilun, 0, sizeof(IscsiLun));
-
-    initiator_name = get_initiator_name(opts);
-
-    iscsi = iscsi_create_context(initiator_name);
-    if (iscsi == NULL) {
-        error_setg(errp, "iSCSI: Failed to create iSCSI context.");
-        ret = -ENOMEM;
-        goto out;
-    }
-#if LIBISCSI_API_VERSION >= (20160603)
-    if (iscsi_init_transport(iscsi, transport)) {
-        error_setg(errp, ("Error initializing transport."));
-        ret = -EINVAL;
-        goto out;
-    }
-#endif
-    if (iscsi_set_targetname(iscsi, target)) {
-        error_setg(errp, "iSCSI: Failed to set target name.");
+    nb_sessions = qemu_opt_get_number(opts, "sessions", 1);
+    if (nb_sessions < 1 || nb_sessions > ISCSI_MAX_SESSIONS) {
+        error_setg(errp, "sessions must be between 1 and %d",
+                   ISCSI_MAX_SESSIONS);
         ret = -EINVAL;
         goto out;
     }
 
-    /* check if we got CHAP username/password via the options */
-    apply_chap(iscsi, opts, &local_err);
-    if (local_err != NULL) {
-        error_propagate(errp, local_err);
-        ret = -EINVAL;
-        goto out;
-    }
+    memset(iscsilun, 0, sizeof(IscsiLun));
 
-    if (iscsi_set_session_type(iscsi, ISCSI_SESSION_NORMAL) != 0) {
-        error_setg(errp, "iSCSI: Failed to set session type to normal.");
-        ret = -EINVAL;
-        goto out;
-    }
+    initiator_name = get_initiator_name(opts);
 
-    /* check if we got HEADER_DIGEST via the options */
-    apply_header_digest(iscsi, opts, &local_err);
-    if (local_err != NULL) {
-        error_propagate(errp, local_err);
-        ret = -EINVAL;
+    ret = iscsi_login(opts, initiator_name, &iscsi, errp);
+    if (ret < 0) {
         goto out;
     }
+    iscsilun->sessions = g_new0(IscsiSession, nb_sessions);
+    iscsilun->sessions[0].iscsi = iscsi;
+    iscsilun->sessions[0].iscsilun = iscsilun;
+    iscsilun->nb_sessions = 1;
 
-    /* timeout handling is broken in libiscsi before 1.15.0 */
-    timeout = qemu_opt_get_number(opts, "timeout", 0);
-#if LIBISCSI_API_VERSION >= 20150621
-    iscsi_set_timeout(iscsi, timeout);
-#else
-    if (timeout) {
-        warn_report("iSCSI: ignoring timeout value for libiscsi <1.15.0");
-    }
-#endif
+    while (iscsilun->nb_sessions < nb_sessions) {
+        IscsiSession *ses = &iscsilun->sessions[iscsilun->nb_sessions];
 
-    if (iscsi_full_connect_sync(iscsi, portal, lun) != 0) {
-        error_setg(errp, "iSCSI: Failed to connect to LUN : %s",
-            iscsi_get_error(iscsi));
-        ret = -EINVAL;
-        goto out;
+        ret = iscsi_login(opts, initiator_name, &ses->iscsi, errp);
+        if (ret < 0) {
+            goto out;
+        }
+        ses->iscsilun = iscsilun;
+        iscsilun->nb_sessions++;
     }
 
     iscsilun->iscsi = iscsi;
@@ -2015,12 +2281,7 @@ out:
     }
 
     if (ret) {
-        if (iscsi != NULL) {
-            if (iscsi_is_logged_in(iscsi)) {
-                iscsi_logout_sync(iscsi);
-            }
-            iscsi_destroy_context(iscsi);
-        }
+        iscsi_logout_all(iscsilun);
         memset(iscsilun, 0, sizeof(IscsiLun));
     }
 
@@ -2030,13 +2291,9 @@ out:
 static void iscsi_close(BlockDriverState *bs)
 {
     IscsiLun *iscsilun = bs->opaque;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
 
     iscsi_detach_aio_context(bs);
-    if (iscsi_is_logged_in(iscsi)) {
-        iscsi_logout_sync(iscsi);
-    }
-    iscsi_destroy_context(iscsi);
+    iscsi_logout_all(iscsilun);
     if (iscsilun->dd) {
         g_free(iscsilun->dd->designator);
         g_free(iscsilun->dd);
@@ -2198,9 +2455,7 @@ static int coroutine_fn iscsi_co_create_opts(const char *filename, QemuOpts *opt
 
     ret = 0;
 out:
-    if (iscsilun->iscsi != NULL) {
-        iscsi_destroy_context(iscsilun->iscsi);
-    }
+    iscsi_logout_all(iscsilun);
     g_free(bs->opaque);
     bs->opaque = NULL;
     bdrv_unref(bs);
@@ -28,6 +28,12 @@
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/* Bounds for the in-flight window, which starts at MAX_IN_FLIGHT */
+#define MIN_ADAPTIVE_IN_FLIGHT 1
+#define MAX_ADAPTIVE_IN_FLIGHT 256
+/* Limit up to which the default-sized buffer may grow */
+#define MAX_MIRROR_BUF_SIZE (8 * DEFAULT_MIRROR_BUF_SIZE)
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -60,11 +66,14 @@ typedef struct MirrorBlockJob {
     bool should_complete;
     int64_t granularity;
     size_t buf_size;
+    size_t max_buf_size;
     int64_t bdev_length;
     unsigned long *cow_bitmap;
     BdrvDirtyBitmap *dirty_bitmap;
     BdrvDirtyBitmapIter *dbi;
     uint8_t *buf;
+    /* Regions added to the buffer by mirror_grow_buffer() */
+    GSList *buf_extra;
     QSIMPLEQ_HEAD(, MirrorBuffer) buf_free;
     int buf_free_count;
 
@@ -73,6 +82,20 @@ typedef struct MirrorBlockJob {
     int in_flight;
     int64_t bytes_in_flight;
     QTAILQ_HEAD(, MirrorOp) ops_in_flight;
+
+    /* In-flight window, adjusted by mirror_update_window() */
+    int max_in_flight;
+    int window_completions;
+    /* Moving average of the target write latency */
+    int64_t write_latency_ns;
+    /* Moving average and minimum of the write latency per MAX_IO_BYTES */
+    int64_t write_cost_ns;
+    int64_t min_write_cost_ns;
+    /* Bytes written in the current throughput interval */
+    int64_t throughput_start_ns;
+    uint64_t throughput_bytes;
+    uint64_t throughput;
+
     int ret;
     bool unmap;
     int target_cluster_size;
@@ -159,6 +182,59 @@ static void coroutine_fn mirror_wait_on_conflicts(MirrorOp *self,
     }
 }
 
+static void mirror_account_throughput(MirrorBlockJob *s, uint64_t bytes)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - s->throughput_start_ns;
+
+    s->throughput_bytes += bytes;
+    if (elapsed >= NANOSECONDS_PER_SECOND) {
+        s->throughput = s->throughput_bytes * NANOSECONDS_PER_SECOND / elapsed;
+        s->throughput_start_ns = now;
+        s->throughput_bytes = 0;
+    }
+}
+
+/* Adjust the in-flight window once per window's worth of completed
+ * copies.  The window grows as long as the write latency stays close to
+ * the lowest one seen so far, and shrinks once it rises because requests
+ * start to queue up somewhere on the way to the target.  The latency is
+ * scaled to MAX_IO_BYTES so that requests of different size compare.
+ */
+static void mirror_update_window(MirrorBlockJob *s, uint64_t bytes,
+                                 int64_t latency_ns)
+{
+    int64_t cost_ns = MAX(latency_ns * MAX_IO_BYTES / bytes, 1);
+
+    if (!s->write_latency_ns) {
+        s->write_latency_ns = latency_ns;
+        s->write_cost_ns = cost_ns;
+    } else {
+        s->write_latency_ns = (7 * s->write_latency_ns + latency_ns) / 8;
+        s->write_cost_ns = (7 * s->write_cost_ns + cost_ns) / 8;
+    }
+    if (!s->min_write_cost_ns || cost_ns < s->min_write_cost_ns) {
+        s->min_write_cost_ns = cost_ns;
+    }
+
+    if (++s->window_completions < s->max_in_flight) {
+        return;
+    }
+    s->window_completions = 0;
+
+    if (s->write_cost_ns > 2 * s->min_write_cost_ns) {
+        s->max_in_flight = MAX(s->max_in_flight * 3 / 4,
+                               MIN_ADAPTIVE_IN_FLIGHT);
+    } else if (s->in_flight >= s->max_in_flight) {
+        /* Only grow the window if it is actually the limiting factor */
+        s->max_in_flight = MIN(s->max_in_flight +
+                               MAX(s->max_in_flight / 8, 1),
+                               MAX_ADAPTIVE_IN_FLIGHT);
+    }
+    trace_mirror_update_window(s, s->max_in_flight, s->write_cost_ns,
+                               s->min_write_cost_ns);
+}
+
 static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -188,6 +264,7 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
         }
         if (!s->initial_zeroing_ongoing) {
             job_progress_update(&s->common.job, op->bytes);
+            mirror_account_throughput(s, op->bytes);
         }
     }
     qemu_iovec_destroy(&op->qiov);
@@ -216,6 +293,7 @@ static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
 static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
+    int64_t start_ns;
 
     if (ret < 0) {
         BlockErrorAction action;
@@ -230,7 +308,12 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
+    start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
+    if (ret >= 0) {
+        mirror_update_window(s, op->qiov.size,
+                             qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns);
+    }
     mirror_write_complete(op, ret);
 }
 
@@ -278,6 +361,44 @@ static int mirror_cow_align(MirrorBlockJob *s, int64_t *offset,
     return ret;
 }
 
+static void mirror_free_add(MirrorBlockJob *s, uint8_t *buf, size_t buf_size)
+{
+    while (buf_size != 0) {
+        MirrorBuffer *cur = (MirrorBuffer *)buf;
+        QSIMPLEQ_INSERT_TAIL(&s->buf_free, cur, next);
+        s->buf_free_count++;
+        buf_size -= s->granularity;
+        buf += s->granularity;
+    }
+}
+
+/* Double the buffer, up to s->max_buf_size, if the in-flight window
+ * would allow more requests than the buffer can hold.  Returns true if
+ * new chunks have been added to s->buf_free. */
+static bool mirror_grow_buffer(MirrorBlockJob *s)
+{
+    size_t bytes;
+    uint8_t *buf;
+
+    if (s->in_flight >= s->max_in_flight || s->buf_size >= s->max_buf_size) {
+        return false;
+    }
+
+    bytes = MIN(s->buf_size, s->max_buf_size - s->buf_size);
+    buf = qemu_try_blockalign(s->mirror_top_bs->backing->bs, bytes);
+    if (buf == NULL) {
+        /* Stay with what we have */
+        s->max_buf_size = s->buf_size;
+        return false;
+    }
+
+    s->buf_extra = g_slist_prepend(s->buf_extra, buf);
+    mirror_free_add(s, buf, bytes);
+    s->buf_size += bytes;
+    trace_mirror_grow_buffer(s, s->buf_size);
+    return true;
+}
+
 static inline void coroutine_fn
 mirror_wait_for_any_operation(MirrorBlockJob *s, bool active)
 {
@@ -343,6 +464,9 @@ static void coroutine_fn mirror_co_read(void *opaque)
     nb_chunks = DIV_ROUND_UP(op->bytes, s->granularity);
 
     while (s->buf_free_count < nb_chunks) {
+        if (mirror_grow_buffer(s)) {
+            continue;
+        }
         trace_mirror_yield_in_flight(s, op->offset, s->in_flight);
         mirror_wait_for_free_in_flight_slot(s);
     }
@@ -451,7 +575,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = MAX(s->buf_size / s->max_in_flight, MAX_IO_BYTES);
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -532,6 +656,15 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             io_bytes = MIN(io_bytes, max_io_bytes);
         }
 
+        /* When splitting a longer run of dirty chunks, end the request
+         * on a target cluster boundary so that neither this nor the next
+         * request only partially overwrites a target cluster. */
+        if (io_bytes < nb_chunks * s->granularity &&
+            io_bytes > s->target_cluster_size) {
+            io_bytes = QEMU_ALIGN_DOWN(offset + io_bytes,
+                                       s->target_cluster_size) - offset;
+        }
+
         io_bytes -= io_bytes % s->granularity;
         if (io_bytes < s->granularity) {
             io_bytes = s->granularity;
@@ -548,7 +681,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -582,19 +715,9 @@ fail:
 
 static void mirror_free_init(MirrorBlockJob *s)
 {
-    int granularity = s->granularity;
-    size_t buf_size = s->buf_size;
-    uint8_t *buf = s->buf;
-
     assert(s->buf_free_count == 0);
     QSIMPLEQ_INIT(&s->buf_free);
-    while (buf_size != 0) {
-        MirrorBuffer *cur = (MirrorBuffer *)buf;
-        QSIMPLEQ_INSERT_TAIL(&s->buf_free, cur, next);
-        s->buf_free_count++;
-        buf_size -= granularity;
-        buf += granularity;
-    }
+    mirror_free_add(s, s->buf, s->buf_size);
 }
 
 /* This is also used for the .pause callback. There is no matching
@@ -780,7 +903,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -906,6 +1029,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     if (backing_filename[0] && !target_bs->backing &&
         s->granularity < s->target_cluster_size) {
         s->buf_size = MAX(s->buf_size, s->target_cluster_size);
+        s->max_buf_size = MAX(s->max_buf_size, s->buf_size);
         s->cow_bitmap = bitmap_new(length);
     }
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
@@ -919,6 +1043,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     mirror_free_init(s);
 
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->throughput_start_ns = s->last_pause_ns;
     if (!s->is_none_mode) {
         ret = mirror_dirty_init(s);
         if (ret < 0 || job_is_cancelled(&s->common.job)) {
@@ -959,7 +1084,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         delta = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - s->last_pause_ns;
         if (delta < BLOCK_JOB_SLICE_TIME &&
             s->common.iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight ||
+                (s->buf_free_count == 0 && !mirror_grow_buffer(s)) ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1055,6 +1181,7 @@ immediate_exit:
 
     assert(s->in_flight == 0);
     qemu_vfree(s->buf);
+    g_slist_free_full(s->buf_extra, qemu_vfree);
     g_free(s->cow_bitmap);
     g_free(s->in_flight_bitmap);
     bdrv_dirty_iter_free(s->dbi);
@@ -1164,6 +1291,30 @@ static void mirror_drain(BlockJob *job)
     }
 }
 
+static void mirror_query(BlockJob *job, BlockJobInfo *info)
+{
+    MirrorBlockJob *s = container_of(job, MirrorBlockJob, common);
+    int64_t elapsed = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                      s->throughput_start_ns;
+    uint64_t throughput = s->throughput;
+
+    /* Let the value decay if nothing has completed for a while */
+    if (s->throughput_start_ns && elapsed > NANOSECONDS_PER_SECOND) {
+        throughput = MIN(throughput, s->throughput_bytes *
+                                     NANOSECONDS_PER_SECOND / elapsed);
+    }
+
+    info->has_mirror = true;
+    info->mirror = g_new0(BlockJobInfoMirror, 1);
+    *info->mirror = (BlockJobInfoMirror) {
+        .in_flight      = s->in_flight,
+        .max_in_flight  = s->max_in_flight,
+        .buf_size       = s->buf_size,
+        .write_latency  = s->write_latency_ns,
+        .throughput     = throughput,
+    };
+}
+
 static const BlockJobDriver mirror_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(MirrorBlockJob),
@@ -1180,6 +1331,7 @@ static const BlockJobDriver mirror_job_driver = {
     .drained_poll           = mirror_drained_poll,
     .attached_aio_context   = mirror_attached_aio_context,
     .drain                  = mirror_drain,
+    .query                  = mirror_query,
 };
 
 static const BlockJobDriver commit_active_job_driver = {
@@ -1198,6 +1350,7 @@ static const BlockJobDriver commit_active_job_driver = {
     .drained_poll           = mirror_drained_poll,
     .attached_aio_context   = mirror_attached_aio_context,
     .drain                  = mirror_drain,
+    .query                  = mirror_query,
 };
 
 static void coroutine_fn
@@ -1513,6 +1666,7 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
     bool target_graph_mod;
     bool target_is_backing;
     Error *local_err = NULL;
+    int64_t max_buf_size;
     int ret;
 
     if (granularity == 0) {
@@ -1526,8 +1680,13 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
         return;
     }
 
+    /* Only a buffer of the default size may grow; an explicit buf-size
+     * is taken as the upper limit of memory to use */
     if (buf_size == 0) {
         buf_size = DEFAULT_MIRROR_BUF_SIZE;
+        max_buf_size = MAX_MIRROR_BUF_SIZE;
+    } else {
+        max_buf_size = buf_size;
     }
 
     if (bs == target) {
@@ -1622,6 +1781,8 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
     s->base = base;
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
+    s->max_buf_size = ROUND_UP(max_buf_size, granularity);
+    s->max_in_flight = MAX_IN_FLIGHT;
     s->unmap = unmap;
     if (auto_complete) {
         s->should_complete = true;
@@ -36,7 +36,7 @@
 #define HANDLE_TO_INDEX(bs, handle) ((handle) ^ (uint64_t)(intptr_t)(bs))
 #define INDEX_TO_HANDLE(bs, index)  ((index)  ^ (uint64_t)(intptr_t)(bs))
 
-static void nbd_recv_coroutines_wake_all(NBDClientSession *s)
+static void nbd_recv_coroutines_wake_all(NBDClientConnection *s)
 {
     int i;
 
@@ -49,28 +49,47 @@ static void nbd_recv_coroutines_wake_all(NBDClientSession *s)
     }
 }
 
+static bool nbd_client_has_connection_co(NBDClientSession *client)
+{
+    int i;
+
+    for (i = 0; i < client->num_conns; i++) {
+        if (client->conns[i].connection_co) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void nbd_teardown_connection(BlockDriverState *bs)
 {
     NBDClientSession *client = nbd_get_client_session(bs);
-
-    assert(client->ioc);
+    int i;
 
     /* finish any pending coroutines */
-    qio_channel_shutdown(client->ioc,
-                         QIO_CHANNEL_SHUTDOWN_BOTH,
-                         NULL);
-    BDRV_POLL_WHILE(bs, client->connection_co);
+    for (i = 0; i < client->num_conns; i++) {
+        assert(client->conns[i].ioc);
+        qio_channel_shutdown(client->conns[i].ioc,
+                             QIO_CHANNEL_SHUTDOWN_BOTH,
+                             NULL);
+    }
+    BDRV_POLL_WHILE(bs, nbd_client_has_connection_co(client));
 
     nbd_client_detach_aio_context(bs);
-    object_unref(OBJECT(client->sioc));
-    client->sioc = NULL;
-    object_unref(OBJECT(client->ioc));
-    client->ioc = NULL;
+    for (i = 0; i < client->num_conns; i++) {
+        NBDClientConnection *conn = &client->conns[i];
+
+        object_unref(OBJECT(conn->sioc));
+        conn->sioc = NULL;
+        object_unref(OBJECT(conn->ioc));
+        conn->ioc = NULL;
+    }
+    client->num_conns = 0;
 }
 
 static coroutine_fn void nbd_connection_entry(void *opaque)
 {
-    NBDClientSession *s = opaque;
+    NBDClientConnection *s = opaque;
     uint64_t i;
     int ret = 0;
     Error *local_err = NULL;
@@ -86,7 +105,8 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
          * only drop it temporarily here.
          */
         assert(s->reply.handle == 0);
-        ret = nbd_receive_reply(s->bs, s->ioc, &s->reply, &local_err);
+        ret = nbd_receive_reply(s->session->bs, s->ioc, &s->reply,
+                                &local_err);
 
         if (local_err) {
             trace_nbd_read_reply_entry_fail(ret, error_get_pretty(local_err));
@@ -104,7 +124,8 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
         if (i >= MAX_NBD_REQUESTS ||
             !s->requests[i].coroutine ||
             !s->requests[i].receiving ||
-            (nbd_reply_is_structured(&s->reply) && !s->info.structured_reply))
+            (nbd_reply_is_structured(&s->reply) &&
+             !s->session->info.structured_reply))
         {
             break;
         }
@@ -126,17 +147,45 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
 
     s->quit = true;
     nbd_recv_coroutines_wake_all(s);
-    bdrv_dec_in_flight(s->bs);
+    bdrv_dec_in_flight(s->session->bs);
 
     s->connection_co = NULL;
     aio_wait_kick();
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+/*
+ * Choose the connection for a new request: the least loaded one that is
+ * still up, starting the search at a different connection each time so
+ * that requests are spread evenly when all of them are idle.
+ */
+static NBDClientConnection *nbd_client_get_connection(BlockDriverState *bs)
+{
+    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientConnection *best = NULL;
+    int i;
+
+    if (client->num_conns == 1) {
+        return &client->conns[0];
+    }
+
+    for (i = 0; i < client->num_conns; i++) {
+        NBDClientConnection *conn =
+            &client->conns[(client->next_conn + i) % client->num_conns];
+
+        if (!conn->quit && (!best || conn->in_flight < best->in_flight)) {
+            best = conn;
+        }
+    }
+    client->next_conn++;
+
+    /* If all connections are down, the request fails on the first one */
+    return best ?: &client->conns[0];
+}
+
+static int nbd_co_send_request(NBDClientConnection *s,
                                NBDRequest *request,
                                QEMUIOVector *qiov)
 {
-    NBDClientSession *s = nbd_get_client_session(bs);
     int rc, i;
 
     qemu_co_mutex_lock(&s->send_mutex);
@@ -364,7 +413,7 @@ static int nbd_parse_error_payload(NBDStructuredReplyChunk *chunk,
     return 0;
 }
 
-static int nbd_co_receive_offset_data_payload(NBDClientSession *s,
+static int nbd_co_receive_offset_data_payload(NBDClientConnection *s,
                                               uint64_t orig_offset,
                                               QEMUIOVector *qiov, Error **errp)
 {
@@ -395,7 +444,8 @@ static int nbd_co_receive_offset_data_payload(NBDClientSession *s,
                          " region");
         return -EINVAL;
     }
-    if (s->info.min_block && !QEMU_IS_ALIGNED(data_size, s->info.min_block)) {
+    if (s->session->info.min_block &&
+        !QEMU_IS_ALIGNED(data_size, s->session->info.min_block)) {
         trace_nbd_structured_read_compliance("data");
     }
 
@@ -411,7 +461,7 @@ static int nbd_co_receive_offset_data_payload(NBDClientSession *s,
 /* nbd_co_receive_structured_payload
  */
 static coroutine_fn int nbd_co_receive_structured_payload(
-        NBDClientSession *s, void **payload, Error **errp)
+        NBDClientConnection *s, void **payload, Error **errp)
 {
     int ret;
     uint32_t len;
@@ -460,7 +510,7 @@ static coroutine_fn int nbd_co_receive_structured_payload(
  * corresponding to the server's error reply), and errp is unchanged.
  */
 static coroutine_fn int nbd_co_do_receive_one_chunk(
-        NBDClientSession *s, uint64_t handle, bool only_structured,
+        NBDClientConnection *s, uint64_t handle, bool only_structured,
         int *request_ret, QEMUIOVector *qiov, void **payload, Error **errp)
 {
     int ret;
@@ -502,7 +552,7 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
     }
 
     /* handle structured reply chunk */
-    assert(s->info.structured_reply);
+    assert(s->session->info.structured_reply);
     chunk = &s->reply.structured;
 
     if (chunk->type == NBD_REPLY_TYPE_NONE) {
@@ -552,7 +602,7 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
  * Return value is a fatal error code or normal nbd reply error code
  */
 static coroutine_fn int nbd_co_receive_one_chunk(
-        NBDClientSession *s, uint64_t handle, bool only_structured,
+        NBDClientConnection *s, uint64_t handle, bool only_structured,
         int *request_ret, QEMUIOVector *qiov, NBDReply *reply, void **payload,
         Error **errp)
 {
@@ -616,7 +666,7 @@ static void nbd_iter_request_error(NBDReplyChunkIter *iter, int ret)
 
 /* nbd_reply_chunk_iter_receive
  */
-static bool nbd_reply_chunk_iter_receive(NBDClientSession *s,
+static bool nbd_reply_chunk_iter_receive(NBDClientConnection *s,
                                          NBDReplyChunkIter *iter,
                                          uint64_t handle,
                                          QEMUIOVector *qiov, NBDReply *reply,
@@ -683,7 +733,7 @@ break_loop:
     return false;
 }
 
-static int nbd_co_receive_return_code(NBDClientSession *s, uint64_t handle,
+static int nbd_co_receive_return_code(NBDClientConnection *s, uint64_t handle,
                                       int *request_ret, Error **errp)
 {
     NBDReplyChunkIter iter;
@@ -697,8 +747,9 @@ static int nbd_co_receive_return_code(NBDClientSession *s, uint64_t handle,
     return iter.ret;
 }
 
-static int nbd_co_receive_cmdread_reply(NBDClientSession *s, uint64_t handle,
-                                        uint64_t offset, QEMUIOVector *qiov,
+static int nbd_co_receive_cmdread_reply(NBDClientConnection *s,
+                                        uint64_t handle, uint64_t offset,
+                                        QEMUIOVector *qiov,
                                         int *request_ret, Error **errp)
 {
     NBDReplyChunkIter iter;
@@ -706,7 +757,7 @@ static int nbd_co_receive_cmdread_reply(NBDClientSession *s, uint64_t handle,
     void *payload = NULL;
     Error *local_err = NULL;
 
-    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, s->info.structured_reply,
+    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, s->session->info.structured_reply,
                             qiov, &reply, &payload)
     {
         int ret;
@@ -720,8 +771,9 @@ static int nbd_co_receive_cmdread_reply(NBDClientSession *s, uint64_t handle,
              * in qiov */
             break;
         case NBD_REPLY_TYPE_OFFSET_HOLE:
-            ret = nbd_parse_offset_hole_payload(s, &reply.structured, payload,
-                                                offset, qiov, &local_err);
+            ret = nbd_parse_offset_hole_payload(s->session, &reply.structured,
+                                                payload, offset, qiov,
+                                                &local_err);
             if (ret < 0) {
                 s->quit = true;
                 nbd_iter_channel_error(&iter, ret, &local_err);
@@ -747,7 +799,7 @@ static int nbd_co_receive_cmdread_reply(NBDClientSession *s, uint64_t handle,
     return iter.ret;
 }
 
-static int nbd_co_receive_blockstatus_reply(NBDClientSession *s,
+static int nbd_co_receive_blockstatus_reply(NBDClientConnection *s,
                                             uint64_t handle, uint64_t length,
                                             NBDExtent *extent,
                                             int *request_ret, Error **errp)
@@ -774,7 +826,7 @@ static int nbd_co_receive_blockstatus_reply(NBDClientSession *s,
             }
             received = true;
 
-            ret = nbd_parse_blockstatus_payload(s, &reply.structured,
+            ret = nbd_parse_blockstatus_payload(s->session, &reply.structured,
                                                 payload, length, extent,
                                                 &local_err);
             if (ret < 0) {
@@ -812,7 +864,7 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientConnection *conn = nbd_client_get_connection(bs);
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -821,12 +873,12 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     } else {
         assert(request->type != NBD_CMD_WRITE);
     }
-    ret = nbd_co_send_request(bs, request, write_qiov);
+    ret = nbd_co_send_request(conn, request, write_qiov);
     if (ret < 0) {
         return ret;
     }
 
-    ret = nbd_co_receive_return_code(client, request->handle,
+    ret = nbd_co_receive_return_code(conn, request->handle,
                                      &request_ret, &local_err);
     if (local_err) {
         trace_nbd_co_request_fail(request->from, request->len, request->handle,
@@ -844,6 +896,7 @@ int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     int ret, request_ret;
     Error *local_err = NULL;
     NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientConnection *conn;
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -875,12 +928,13 @@ int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
         request.len -= slop;
     }
 
-    ret = nbd_co_send_request(bs, &request, NULL);
+    conn = nbd_client_get_connection(bs);
+    ret = nbd_co_send_request(conn, &request, NULL);
     if (ret < 0) {
         return ret;
     }
 
-    ret = nbd_co_receive_cmdread_reply(client, request.handle, offset, qiov,
+    ret = nbd_co_receive_cmdread_reply(conn, request.handle, offset, qiov,
                                        &request_ret, &local_err);
     if (local_err) {
         trace_nbd_co_request_fail(request.from, request.len, request.handle,
@@ -938,6 +992,10 @@ int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
     if (!(flags & BDRV_REQ_MAY_UNMAP)) {
         request.flags |= NBD_CMD_FLAG_NO_HOLE;
     }
+    if (flags & BDRV_REQ_NO_FALLBACK) {
+        assert(client->info.flags & NBD_FLAG_SEND_FAST_ZERO);
+        request.flags |= NBD_CMD_FLAG_FAST_ZERO;
+    }
 
     if (!bytes) {
         return 0;
@@ -986,6 +1044,7 @@ int coroutine_fn nbd_client_co_block_status(BlockDriverState *bs,
     int ret, request_ret;
     NBDExtent extent = { 0 };
     NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientConnection *conn;
     Error *local_err = NULL;
 
     NBDRequest request = {
@@ -1022,12 +1081,13 @@ int coroutine_fn nbd_client_co_block_status(BlockDriverState *bs,
     if (client->info.min_block) {
         assert(QEMU_IS_ALIGNED(request.len, client->info.min_block));
     }
-    ret = nbd_co_send_request(bs, &request, NULL);
+    conn = nbd_client_get_connection(bs);
+    ret = nbd_co_send_request(conn, &request, NULL);
     if (ret < 0) {
         return ret;
     }
 
-    ret = nbd_co_receive_blockstatus_reply(client, request.handle, bytes,
+    ret = nbd_co_receive_blockstatus_reply(conn, request.handle, bytes,
                                            &extent, &request_ret, &local_err);
     if (local_err) {
         trace_nbd_co_request_fail(request.from, request.len, request.handle,
@@ -1052,19 +1112,23 @@ int coroutine_fn nbd_client_co_block_status(BlockDriverState *bs,
 void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
     NBDClientSession *client = nbd_get_client_session(bs);
-    qio_channel_detach_aio_context(QIO_CHANNEL(client->ioc));
+    int i;
+
+    for (i = 0; i < client->num_conns; i++) {
+        qio_channel_detach_aio_context(QIO_CHANNEL(client->conns[i].ioc));
+    }
 }
 
 static void nbd_client_attach_aio_context_bh(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientConnection *conn = opaque;
+    BlockDriverState *bs = conn->session->bs;
 
     /* The node is still drained, so we know the coroutine has yielded in
      * nbd_read_eof(), the only place where bs->in_flight can reach 0, or it is
      * entered for the first time. Both places are safe for entering the
      * coroutine.*/
-    qemu_aio_coroutine_enter(bs->aio_context, client->connection_co);
+    qemu_aio_coroutine_enter(bs->aio_context, conn->connection_co);
     bdrv_dec_in_flight(bs);
 }
 
@@ -1072,23 +1136,37 @@ void nbd_client_attach_aio_context(BlockDriverState *bs,
                                    AioContext *new_context)
 {
     NBDClientSession *client = nbd_get_client_session(bs);
-    qio_channel_attach_aio_context(QIO_CHANNEL(client->ioc), new_context);
+    int i;
 
-    bdrv_inc_in_flight(bs);
+    for (i = 0; i < client->num_conns; i++) {
+        NBDClientConnection *conn = &client->conns[i];
+
+        qio_channel_attach_aio_context(QIO_CHANNEL(conn->ioc), new_context);
+
+        /* A connection that was closed by the server has nothing to run */
+        if (!conn->connection_co) {
+            continue;
+        }
+
+        bdrv_inc_in_flight(bs);
 
-    /* Need to wait here for the BH to run because the BH must run while the
-     * node is still drained. */
-    aio_wait_bh_oneshot(new_context, nbd_client_attach_aio_context_bh, bs);
+        /* Need to wait here for the BH to run because the BH must run while
+         * the node is still drained. */
+        aio_wait_bh_oneshot(new_context, nbd_client_attach_aio_context_bh,
+                            conn);
+    }
 }
 
 void nbd_client_close(BlockDriverState *bs)
 {
     NBDClientSession *client = nbd_get_client_session(bs);
     NBDRequest request = { .type = NBD_CMD_DISC };
+    int i;
 
-    assert(client->ioc);
-
-    nbd_send_request(client->ioc, &request);
+    for (i = 0; i < client->num_conns; i++) {
+        assert(client->conns[i].ioc);
+        nbd_send_request(client->conns[i].ioc, &request);
+    }
 
     nbd_teardown_connection(bs);
 }
@@ -1114,7 +1192,30 @@ static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
     return sioc;
 }
 
-static int nbd_client_connect(BlockDriverState *bs,
+/*
+ * We have connected, but must fail for other reasons. The
+ * connection is still blocking; send NBD_CMD_DISC as a courtesy
+ * to the server.
+ */
+static void nbd_client_abort_connection(NBDClientConnection *conn)
+{
+    NBDRequest request = { .type = NBD_CMD_DISC };
+
+    nbd_send_request(conn->ioc, &request);
+
+    object_unref(OBJECT(conn->sioc));
+    conn->sioc = NULL;
+    object_unref(OBJECT(conn->ioc));
+    conn->ioc = NULL;
+}
+
+/*
+ * Open @conn and negotiate the export on it, storing what the server
+ * reported in @info.  The channel is left in blocking mode until
+ * nbd_client_connection_start().
+ */
+static int nbd_client_connect(NBDClientConnection *conn,
+                              NBDExportInfo *info,
                               SocketAddress *saddr,
                               const char *export,
                               QCryptoTLSCreds *tlscreds,
@@ -1122,7 +1223,6 @@ static int nbd_client_connect(BlockDriverState *bs,
                               const char *x_dirty_bitmap,
                               Error **errp)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
     int ret;
 
     /*
@@ -1139,26 +1239,77 @@ static int nbd_client_connect(BlockDriverState *bs,
     logout("session init %s\n", export);
     qio_channel_set_blocking(QIO_CHANNEL(sioc), true, NULL);
 
-    client->info.request_sizes = true;
-    client->info.structured_reply = true;
-    client->info.base_allocation = true;
-    client->info.x_dirty_bitmap = g_strdup(x_dirty_bitmap);
-    client->info.name = g_strdup(export ?: "");
+    info->request_sizes = true;
+    info->structured_reply = true;
+    info->base_allocation = true;
+    info->x_dirty_bitmap = g_strdup(x_dirty_bitmap);
+    info->name = g_strdup(export ?: "");
     ret = nbd_receive_negotiate(QIO_CHANNEL(sioc), tlscreds, hostname,
-                                &client->ioc, &client->info, errp);
-    g_free(client->info.x_dirty_bitmap);
-    g_free(client->info.name);
+                                &conn->ioc, info, errp);
+    g_free(info->x_dirty_bitmap);
+    g_free(info->name);
     if (ret < 0) {
         logout("Failed to negotiate with the NBD server\n");
         object_unref(OBJECT(sioc));
         return ret;
     }
-    if (x_dirty_bitmap && !client->info.base_allocation) {
+
+    conn->sioc = sioc;
+
+    if (!conn->ioc) {
+        conn->ioc = QIO_CHANNEL(sioc);
+        object_ref(OBJECT(conn->ioc));
+    }
+
+    if (x_dirty_bitmap && !info->base_allocation) {
         error_setg(errp, "requested x-dirty-bitmap %s not found",
                    x_dirty_bitmap);
-        ret = -EINVAL;
-        goto fail;
+        nbd_client_abort_connection(conn);
+        return -EINVAL;
     }
+
+    return 0;
+}
+
+static void nbd_client_connection_start(BlockDriverState *bs,
+                                        NBDClientConnection *conn)
+{
+    /* Now that we're connected, set the socket to be non-blocking and
+     * kick the reply mechanism.  */
+    qio_channel_set_blocking(QIO_CHANNEL(conn->sioc), false, NULL);
+    conn->connection_co = qemu_coroutine_create(nbd_connection_entry, conn);
+    bdrv_inc_in_flight(bs);
+}
+
+int nbd_client_init(BlockDriverState *bs,
+                    SocketAddress *saddr,
+                    const char *export,
+                    QCryptoTLSCreds *tlscreds,
+                    const char *hostname,
+                    const char *x_dirty_bitmap,
+                    int connections,
+                    Error **errp)
+{
+    NBDClientSession *client = nbd_get_client_session(bs);
+    int i, ret;
+
+    assert(connections >= 1 && connections <= MAX_NBD_CONNECTIONS);
+
+    client->bs = bs;
+    for (i = 0; i < MAX_NBD_CONNECTIONS; i++) {
+        client->conns[i].session = client;
+        qemu_co_mutex_init(&client->conns[i].send_mutex);
+        qemu_co_queue_init(&client->conns[i].free_sema);
+    }
+
+    ret = nbd_client_connect(&client->conns[0], &client->info, saddr,
+                             export, tlscreds, hostname, x_dirty_bitmap,
+                             errp);
+    if (ret < 0) {
+        return ret;
+    }
+    client->num_conns = 1;
+
     if (client->info.flags & NBD_FLAG_READ_ONLY) {
         ret = bdrv_apply_auto_read_only(bs, "NBD export is read-only", errp);
         if (ret < 0) {
@@ -1171,56 +1322,56 @@ static int nbd_client_connect(BlockDriverState *bs,
     }
     if (client->info.flags & NBD_FLAG_SEND_WRITE_ZEROES) {
         bs->supported_zero_flags |= BDRV_REQ_MAY_UNMAP;
+        if (client->info.flags & NBD_FLAG_SEND_FAST_ZERO) {
+            bs->supported_zero_flags |= BDRV_REQ_NO_FALLBACK;
+        }
     }
 
-    client->sioc = sioc;
+    /*
+     * Without multi-conn, a flush on one connection need not cover writes
+     * completed on another, so only ever use a single one.
+     */
+    if (connections > 1 && !(client->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        trace_nbd_client_multi_conn_unsupported(connections);
+        connections = 1;
+    }
+
+    while (client->num_conns < connections) {
+        NBDExportInfo info = { 0 };
 
-    if (!client->ioc) {
-        client->ioc = QIO_CHANNEL(sioc);
-        object_ref(OBJECT(client->ioc));
+        ret = nbd_client_connect(&client->conns[client->num_conns], &info,
+                                 saddr, export, tlscreds, hostname,
+                                 x_dirty_bitmap, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+        client->num_conns++;
+
+        if (info.size != client->info.size ||
+            info.flags != client->info.flags ||
+            info.structured_reply != client->info.structured_reply ||
+            info.base_allocation != client->info.base_allocation ||
+            info.context_id != client->info.context_id) {
+            error_setg(errp, "NBD server negotiated a different export on "
+                       "connection %d", client->num_conns - 1);
+            ret = -EINVAL;
+            goto fail;
+        }
     }
 
-    /* Now that we're connected, set the socket to be non-blocking and
-     * kick the reply mechanism.  */
-    qio_channel_set_blocking(QIO_CHANNEL(sioc), false, NULL);
-    client->connection_co = qemu_coroutine_create(nbd_connection_entry, client);
-    bdrv_inc_in_flight(bs);
+    for (i = 0; i < client->num_conns; i++) {
+        nbd_client_connection_start(bs, &client->conns[i]);
+    }
     nbd_client_attach_aio_context(bs, bdrv_get_aio_context(bs));
 
-    logout("Established connection with NBD server\n");
+    logout("Established %d connection(s) with NBD server\n",
+           client->num_conns);
     return 0;
 
  fail:
-    /*
-     * We have connected, but must fail for other reasons. The
-     * connection is still blocking; send NBD_CMD_DISC as a courtesy
-     * to the server.
-     */
-    {
-        NBDRequest request = { .type = NBD_CMD_DISC };
-
-        nbd_send_request(client->ioc ?: QIO_CHANNEL(sioc), &request);
-
-        object_unref(OBJECT(sioc));
-
-        return ret;
+    for (i = 0; i < client->num_conns; i++) {
+        nbd_client_abort_connection(&client->conns[i]);
     }
-}
-
-int nbd_client_init(BlockDriverState *bs,
-                    SocketAddress *saddr,
-                    const char *export,
-                    QCryptoTLSCreds *tlscreds,
-                    const char *hostname,
-                    const char *x_dirty_bitmap,
-                    Error **errp)
-{
-    NBDClientSession *client = nbd_get_client_session(bs);
-
-    client->bs = bs;
-    qemu_co_mutex_init(&client->send_mutex);
-    qemu_co_queue_init(&client->free_sema);
-
-    return nbd_client_connect(bs, saddr, export, tlscreds, hostname,
-                              x_dirty_bitmap, errp);
+    client->num_conns = 0;
+    return ret;
 }
@@ -16,6 +16,9 @@
 #endif
 
 #define MAX_NBD_REQUESTS    16
+#define MAX_NBD_CONNECTIONS 16
+
+typedef struct NBDClientSession NBDClientSession;
 
 typedef struct {
     Coroutine *coroutine;
@@ -23,10 +26,11 @@ typedef struct {
     bool receiving;         /* waiting for connection_co? */
 } NBDClientRequest;
 
-typedef struct NBDClientSession {
+/* One socket to the server, with its own requests and reply coroutine */
+typedef struct NBDClientConnection {
+    NBDClientSession *session;
     QIOChannelSocket *sioc; /* The master data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
-    NBDExportInfo info;
 
     CoMutex send_mutex;
     CoQueue free_sema;
@@ -35,9 +39,21 @@ typedef struct NBDClientSession {
 
     NBDClientRequest requests[MAX_NBD_REQUESTS];
     NBDReply reply;
-    BlockDriverState *bs;
     bool quit;
-} NBDClientSession;
+} NBDClientConnection;
+
+struct NBDClientSession {
+    NBDExportInfo info;
+    BlockDriverState *bs;
+
+    /*
+     * Requests are spread across all connections; more than one is only
+     * used if the server advertises NBD_FLAG_CAN_MULTI_CONN.
+     */
+    NBDClientConnection conns[MAX_NBD_CONNECTIONS];
+    int num_conns;
+    unsigned next_conn;
+};
 
 NBDClientSession *nbd_get_client_session(BlockDriverState *bs);
 
@@ -47,6 +63,7 @@ int nbd_client_init(BlockDriverState *bs,
                     QCryptoTLSCreds *tlscreds,
                     const char *hostname,
                     const char *x_dirty_bitmap,
+                    int connections,
                     Error **errp);
 void nbd_client_close(BlockDriverState *bs);
 
@@ -29,6 +29,8 @@
 #define NVME_CQ_ENTRY_BYTES 16
 #define NVME_QUEUE_SIZE 128
 #define NVME_BAR_SIZE 8192
+/* Bounce buffers kept mapped for unaligned requests */
+#define NVME_MAX_BOUNCE_BUFS 16
 
 typedef struct {
     int32_t  head, tail;
@@ -96,6 +98,8 @@ typedef struct {
      */
     NVMeQueuePair **queues;
     int nr_queues;
+    /* I/O queue to try first when choosing one for a request */
+    unsigned next_queue;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -112,12 +116,17 @@ typedef struct {
     /* Total size of mapped qiov, accessed under dma_map_lock */
     int dma_map_count;
 
+    /* Free bounce buffers of max_transfer bytes, with a fixed IOVA mapping */
+    GSList *bounce_bufs;
+    int nr_bounce_bufs;
+
     /* PCI address (required for nvme_refresh_filename()) */
     char *device;
 } BDRVNVMeState;
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_QUEUES "queues"
 
 static QemuOptsList runtime_opts = {
     .name = "nvme",
@@ -133,6 +142,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs to create (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -537,6 +551,67 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     return true;
 }
 
+/*
+ * Ask the controller for @nr_io_queues I/O queue pairs and create up to that
+ * many.  Only the first one is mandatory; controllers may grant fewer queues
+ * than requested, in which case the request load is spread across those that
+ * could be created.
+ */
+static bool nvme_add_io_queues(BlockDriverState *bs, int nr_io_queues,
+                               Error **errp)
+{
+    BDRVNVMeState *s = bs->opaque;
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((nr_io_queues - 1) << 16) | (nr_io_queues - 1)),
+    };
+    Error *local_err = NULL;
+
+    if (nr_io_queues > 1 && nvme_cmd_sync(bs, s->queues[0], &cmd)) {
+        nr_io_queues = 1;
+    }
+
+    if (!nvme_add_io_queue(bs, errp)) {
+        return false;
+    }
+    while (s->nr_queues <= nr_io_queues) {
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            error_free(local_err);
+            break;
+        }
+    }
+    trace_nvme_add_io_queues(s, nr_io_queues, s->nr_queues - 1);
+    return true;
+}
+
+/*
+ * Pick the I/O queue with the fewest requests in flight, starting the
+ * search at a different queue each time so that idle queues share the load.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    int nr_io_queues = s->nr_queues - 1;
+    NVMeQueuePair *best = NULL;
+    int i;
+
+    assert(nr_io_queues > 0);
+    if (nr_io_queues == 1) {
+        return s->queues[1];
+    }
+
+    for (i = 0; i < nr_io_queues; i++) {
+        NVMeQueuePair *q = s->queues[1 + (s->next_queue + i) % nr_io_queues];
+
+        if (!best ||
+            q->inflight + q->need_kick < best->inflight + best->need_kick) {
+            best = q;
+        }
+    }
+    s->next_queue++;
+    return best;
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -549,7 +624,7 @@ static bool nvme_poll_cb(void *opaque)
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     int nr_io_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     int ret;
@@ -593,6 +668,17 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
 
     s->page_size = MAX(4096, 1 << (12 + ((cap >> 48) & 0xF)));
     s->doorbell_scale = (4 << (((cap >> 32) & 0xF))) / sizeof(uint32_t);
+    /* The doorbells of all queues, admin queue included, must fit the BAR */
+    nr_io_queues = MIN(nr_io_queues,
+                       (NVME_BAR_SIZE - offsetof(NVMeRegs, doorbells)) /
+                       (2 * sizeof(uint32_t) * s->doorbell_scale) - 1);
+    /* Queue IDs are 16 bits, and CAP.MQES limits only the queue size */
+    nr_io_queues = MIN(nr_io_queues, 0xFFFF);
+    if (nr_io_queues < 1) {
+        error_setg(errp, "NVMe doorbell stride too large for the BAR mapping");
+        ret = -EINVAL;
+        goto out;
+    }
     bs->bl.opt_mem_alignment = s->page_size;
     timeout_ms = MIN(500 * ((cap >> 24) & 0xFF), 30000);
 
@@ -656,7 +742,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
+    if (!nvme_add_io_queues(bs, nr_io_queues, errp)) {
         ret = -EIO;
     }
 out:
@@ -733,6 +819,7 @@ static void nvme_close(BlockDriverState *bs)
     event_notifier_cleanup(&s->irq_notifier);
     qemu_vfio_pci_unmap_bar(s->vfio, 0, (void *)s->regs, 0, NVME_BAR_SIZE);
     qemu_vfio_close(s->vfio);
+    g_slist_free_full(s->bounce_bufs, qemu_vfree);
 
     g_free(s->device);
 }
@@ -743,6 +830,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t nr_io_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -756,7 +844,14 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    nr_io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_QUEUES, 1);
+    if (nr_io_queues < 1 || nr_io_queues > 0xFFFF) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_QUEUES "' must be between 1 and "
+                   "65535");
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, nr_io_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -914,7 +1009,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     uint32_t cdw12 = (((bytes >> BDRV_SECTOR_BITS) - 1) & 0xFFFF) |
                        (flags & BDRV_REQ_FUA ? 1 << 30 : 0);
@@ -977,12 +1072,44 @@ static inline bool nvme_qiov_aligned(BlockDriverState *bs,
     return true;
 }
 
+/*
+ * Return a bounce buffer of s->max_transfer bytes that the device can
+ * access without a temporary IOVA mapping, or NULL if all of them are in
+ * use.  Buffers are mapped the first time they are needed and then kept.
+ */
+static void *nvme_get_bounce_buf(BlockDriverState *bs)
+{
+    BDRVNVMeState *s = bs->opaque;
+    void *buf;
+
+    if (s->bounce_bufs) {
+        buf = s->bounce_bufs->data;
+        s->bounce_bufs = g_slist_delete_link(s->bounce_bufs, s->bounce_bufs);
+        return buf;
+    }
+    if (s->nr_bounce_bufs == NVME_MAX_BOUNCE_BUFS) {
+        return NULL;
+    }
+
+    buf = qemu_try_blockalign(bs, s->max_transfer);
+    if (!buf) {
+        return NULL;
+    }
+    if (qemu_vfio_dma_map(s->vfio, buf, s->max_transfer, false, NULL)) {
+        qemu_vfree(buf);
+        return NULL;
+    }
+    s->nr_bounce_bufs++;
+    return buf;
+}
+
 static int nvme_co_prw(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                        QEMUIOVector *qiov, bool is_write, int flags)
 {
     BDRVNVMeState *s = bs->opaque;
     int r;
     uint8_t *buf = NULL;
+    bool bounce_buf;
     QEMUIOVector local_qiov;
 
     assert(QEMU_IS_ALIGNED(offset, s->page_size));
@@ -992,7 +1119,11 @@ static int nvme_co_prw(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
         return nvme_co_prw_aligned(bs, offset, bytes, qiov, is_write, flags);
     }
     trace_nvme_prw_buffered(s, offset, bytes, qiov->niov, is_write);
-    buf = qemu_try_blockalign(bs, bytes);
+    buf = nvme_get_bounce_buf(bs);
+    bounce_buf = buf != NULL;
+    if (!bounce_buf) {
+        buf = qemu_try_blockalign(bs, bytes);
+    }
 
     if (!buf) {
         return -ENOMEM;
@@ -1007,7 +1138,11 @@ static int nvme_co_prw(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     if (!r && !is_write) {
         qemu_iovec_from_buf(qiov, 0, buf, bytes);
     }
-    qemu_vfree(buf);
+    if (bounce_buf) {
+        s->bounce_bufs = g_slist_prepend(s->bounce_bufs, buf);
+    } else {
+        qemu_vfree(buf);
+    }
     return r;
 }
 
@@ -1028,7 +1163,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -29,6 +29,8 @@
 #include "block/write-threshold.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block-core.h"
+#include "qapi/json-output-visitor.h"
+#include "qapi/qobject-input-visitor.h"
 #include "qapi/qobject-output-visitor.h"
 #include "qapi/qapi-visit-block-core.h"
 #include "qapi/qmp/qbool.h"
@@ -426,10 +428,28 @@ static void bdrv_latency_histogram_stats(BlockLatencyHistogram *hist,
     }
 }
 
-static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
+static void bdrv_latency_percentiles(const uint64_t *buckets,
+                                     bool *not_null,
+                                     BlockLatencyPercentiles **info)
+{
+    *not_null = block_acct_latency_percentile(buckets, 1000) != 0;
+    if (*not_null) {
+        *info = g_new0(BlockLatencyPercentiles, 1);
+        (*info)->p50 = block_acct_latency_percentile(buckets, 500);
+        (*info)->p99 = block_acct_latency_percentile(buckets, 990);
+        (*info)->p999 = block_acct_latency_percentile(buckets, 999);
+    }
+}
+
+/* Bits of (1 << BlockStatsGroup) for what is optional in a query */
+#define BLOCK_STATS_ALL_GROUPS ((1 << BLOCK_STATS_GROUP__MAX) - 1)
+
+static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk,
+                                 unsigned groups)
 {
     BlockAcctStats *stats = blk_get_stats(blk);
     BlockAcctTimedStats *ts = NULL;
+    uint64_t buckets[BLOCK_ACCT_LATENCY_BUCKETS];
 
     ds->rd_bytes = stats->nr_bytes[BLOCK_ACCT_READ];
     ds->wr_bytes = stats->nr_bytes[BLOCK_ACCT_WRITE];
@@ -460,7 +480,8 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
     ds->account_invalid = stats->account_invalid;
     ds->account_failed = stats->account_failed;
 
-    while ((ts = block_acct_interval_next(stats, ts))) {
+    while ((groups & (1 << BLOCK_STATS_GROUP_TIMED_STATS)) &&
+           (ts = block_acct_interval_next(stats, ts))) {
         BlockDeviceTimedStatsList *timed_stats =
             g_malloc0(sizeof(*timed_stats));
         BlockDeviceTimedStats *dev_stats = g_malloc0(sizeof(*dev_stats));
@@ -492,19 +513,48 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
             block_acct_queue_depth(ts, BLOCK_ACCT_WRITE);
     }
 
-    bdrv_latency_histogram_stats(&stats->latency_histogram[BLOCK_ACCT_READ],
-                                 &ds->has_rd_latency_histogram,
-                                 &ds->rd_latency_histogram);
-    bdrv_latency_histogram_stats(&stats->latency_histogram[BLOCK_ACCT_WRITE],
-                                 &ds->has_wr_latency_histogram,
-                                 &ds->wr_latency_histogram);
-    bdrv_latency_histogram_stats(&stats->latency_histogram[BLOCK_ACCT_FLUSH],
-                                 &ds->has_flush_latency_histogram,
-                                 &ds->flush_latency_histogram);
+    if (groups & (1 << BLOCK_STATS_GROUP_HISTOGRAMS)) {
+        BlockLatencyHistogram *hist = stats->latency_histogram;
+
+        bdrv_latency_histogram_stats(&hist[BLOCK_ACCT_READ],
+                                     &ds->has_rd_latency_histogram,
+                                     &ds->rd_latency_histogram);
+        bdrv_latency_histogram_stats(&hist[BLOCK_ACCT_WRITE],
+                                     &ds->has_wr_latency_histogram,
+                                     &ds->wr_latency_histogram);
+        bdrv_latency_histogram_stats(&hist[BLOCK_ACCT_FLUSH],
+                                     &ds->has_flush_latency_histogram,
+                                     &ds->flush_latency_histogram);
+    }
+
+    if (groups & (1 << BLOCK_STATS_GROUP_PERCENTILES)) {
+        block_acct_get_latency_buckets(stats, BLOCK_ACCT_READ, buckets);
+        bdrv_latency_percentiles(buckets, &ds->has_rd_latency_percentiles,
+                                 &ds->rd_latency_percentiles);
+        block_acct_get_latency_buckets(stats, BLOCK_ACCT_WRITE, buckets);
+        bdrv_latency_percentiles(buckets, &ds->has_wr_latency_percentiles,
+                                 &ds->wr_latency_percentiles);
+        block_acct_get_latency_buckets(stats, BLOCK_ACCT_FLUSH, buckets);
+        bdrv_latency_percentiles(buckets, &ds->has_flush_latency_percentiles,
+                                 &ds->flush_latency_percentiles);
+        block_acct_get_latency_buckets(stats, BLOCK_ACCT_UNMAP, buckets);
+        bdrv_latency_percentiles(buckets, &ds->has_unmap_latency_percentiles,
+                                 &ds->unmap_latency_percentiles);
+
+        block_acct_get_stage_buckets(stats, BLOCK_ACCT_STAGE_QUEUE, buckets);
+        bdrv_latency_percentiles(buckets, &ds->has_queue_latency_percentiles,
+                                 &ds->queue_latency_percentiles);
+        block_acct_get_stage_buckets(stats, BLOCK_ACCT_STAGE_DEVICE, buckets);
+        bdrv_latency_percentiles(buckets, &ds->has_device_latency_percentiles,
+                                 &ds->device_latency_percentiles);
+        block_acct_get_stage_buckets(stats, BLOCK_ACCT_STAGE_NOTIFY, buckets);
+        bdrv_latency_percentiles(buckets, &ds->has_notify_latency_percentiles,
+                                 &ds->notify_latency_percentiles);
+    }
 }
 
 static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
-                                        bool blk_level)
+                                        bool blk_level, bool children)
 {
     BlockStats *s = NULL;
 
@@ -529,17 +579,51 @@ static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
     }
 
     s->stats->wr_highest_offset = stat64_get(&bs->wr_highest_offset);
+    s->stats->serialising_waits = stat64_get(&bs->serialising_waits);
+    s->stats->has_serialising_waits = s->stats->serialising_waits != 0;
+    if (s->stats->has_serialising_waits) {
+        s->stats->has_serialising_wait_time_ns = true;
+        s->stats->serialising_wait_time_ns =
+            stat64_get(&bs->serialising_wait_ns);
+    }
 
-    if (bs->file) {
+    if (children && bs->file) {
         s->has_parent = true;
-        s->parent = bdrv_query_bds_stats(bs->file->bs, blk_level);
+        s->parent = bdrv_query_bds_stats(bs->file->bs, blk_level, true);
     }
 
-    if (blk_level && bs->backing) {
+    if (children && blk_level && bs->backing) {
         s->has_backing = true;
-        s->backing = bdrv_query_bds_stats(bs->backing->bs, blk_level);
+        s->backing = bdrv_query_bds_stats(bs->backing->bs, blk_level, true);
+    }
+
+    return s;
+}
+
+static BlockStats *bdrv_query_blk_stats_one(BlockBackend *blk,
+                                            unsigned groups)
+{
+    AioContext *ctx = blk_get_aio_context(blk);
+    BlockStats *s;
+    char *qdev;
+
+    aio_context_acquire(ctx);
+    s = bdrv_query_bds_stats(blk_bs(blk), true,
+                             groups & (1 << BLOCK_STATS_GROUP_CHILDREN));
+    s->has_device = true;
+    s->device = g_strdup(blk_name(blk));
+
+    qdev = blk_get_attached_dev_id(blk);
+    if (qdev && *qdev) {
+        s->has_qdev = true;
+        s->qdev = qdev;
+    } else {
+        g_free(qdev);
     }
 
+    bdrv_query_blk_stats(s->stats, blk, groups);
+    aio_context_release(ctx);
+
     return s;
 }
 
@@ -587,7 +671,7 @@ BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
             AioContext *ctx = bdrv_get_aio_context(bs);
 
             aio_context_acquire(ctx);
-            info->value = bdrv_query_bds_stats(bs, false);
+            info->value = bdrv_query_bds_stats(bs, false, true);
             aio_context_release(ctx);
 
             *p_next = info;
@@ -596,32 +680,13 @@ BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
     } else {
         for (blk = blk_all_next(NULL); blk; blk = blk_all_next(blk)) {
             BlockStatsList *info;
-            AioContext *ctx = blk_get_aio_context(blk);
-            BlockStats *s;
-            char *qdev;
 
             if (!*blk_name(blk) && !blk_get_attached_dev(blk)) {
                 continue;
             }
 
-            aio_context_acquire(ctx);
-            s = bdrv_query_bds_stats(blk_bs(blk), true);
-            s->has_device = true;
-            s->device = g_strdup(blk_name(blk));
-
-            qdev = blk_get_attached_dev_id(blk);
-            if (qdev && *qdev) {
-                s->has_qdev = true;
-                s->qdev = qdev;
-            } else {
-                g_free(qdev);
-            }
-
-            bdrv_query_blk_stats(s->stats, blk);
-            aio_context_release(ctx);
-
             info = g_malloc0(sizeof(*info));
-            info->value = s;
+            info->value = bdrv_query_blk_stats_one(blk, BLOCK_STATS_ALL_GROUPS);
             *p_next = info;
             p_next = &info->next;
         }
@@ -630,6 +695,103 @@ BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
     return head;
 }
 
+static bool blockstats_query_match(BlockBackend *blk, strList *devices)
+{
+    char *qdev;
+    bool ret = false;
+
+    if (!devices) {
+        return true;
+    }
+
+    qdev = blk_get_attached_dev_id(blk);
+    for (; devices && !ret; devices = devices->next) {
+        ret = !strcmp(devices->value, blk_name(blk)) ||
+              (qdev && *qdev && !strcmp(devices->value, qdev));
+    }
+    g_free(qdev);
+    return ret;
+}
+
+static BlockStatsDelta *blockstats_query_delta(BlockStatsQuery *q)
+{
+    BlockStatsDelta *delta = g_new0(BlockStatsDelta, 1);
+    BlockStatsList **p_next = &delta->stats;
+    BlockStatsGroupList *g;
+    BlockBackend *blk;
+    unsigned groups = 0;
+
+    for (g = q->groups; g; g = g->next) {
+        groups |= 1 << g->value;
+    }
+
+    /* See block_acct_last_update_ns() for why this comes first */
+    delta->cursor = block_acct_time_ns();
+
+    for (blk = blk_all_next(NULL); blk; blk = blk_all_next(blk)) {
+        BlockStatsList *info;
+
+        if ((!*blk_name(blk) && !blk_get_attached_dev(blk)) ||
+            !blockstats_query_match(blk, q->devices) ||
+            (q->has_since &&
+             block_acct_last_update_ns(blk_get_stats(blk)) < q->since)) {
+            continue;
+        }
+
+        info = g_malloc0(sizeof(*info));
+        info->value = bdrv_query_blk_stats_one(blk, groups);
+        *p_next = info;
+        p_next = &info->next;
+    }
+
+    return delta;
+}
+
+/*
+ * Generated marshalling suppressed for this command ('gen': false in
+ * the schema): the reply is written as JSON text by the JSON output
+ * visitor, instead of being built as a QObject tree first that the
+ * monitor then walks to write the same text.
+ */
+void qmp_query_blockstats_delta(QDict *args, QObject **ret_data,
+                                Error **errp)
+{
+    Error *err = NULL;
+    BlockStatsQuery *q = g_new0(BlockStatsQuery, 1);
+    BlockStatsDelta *delta;
+    QString *json;
+    Visitor *v;
+
+    v = qobject_input_visitor_new(QOBJECT(args));
+    visit_start_struct(v, NULL, NULL, 0, &err);
+    if (!err) {
+        visit_type_BlockStatsQuery_members(v, q, &err);
+        if (!err) {
+            visit_check_struct(v, &err);
+        }
+        visit_end_struct(v, NULL);
+    }
+    visit_free(v);
+    if (err) {
+        error_propagate(errp, err);
+        qapi_free_BlockStatsQuery(q);
+        return;
+    }
+
+    delta = blockstats_query_delta(q);
+    qapi_free_BlockStatsQuery(q);
+
+    v = json_output_visitor_new(&json);
+    visit_type_BlockStatsDelta(v, "unused", &delta, &error_abort);
+    visit_complete(v, &json);
+    visit_free(v);
+    qapi_free_BlockStatsDelta(delta);
+
+    /* The monitor copies it into the reply as is */
+    json->json = true;
+    *ret_data = QOBJECT(json);
+}
+
 #define NB_SUFFIXES 4
 
 static char *get_human_readable_size(char *buf, int buf_size, int64_t size)
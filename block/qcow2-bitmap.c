@@ -85,11 +85,30 @@ typedef struct Qcow2Bitmap {
     char *name;
 
     BdrvDirtyBitmap *dirty_bitmap;
+    Qcow2DurableBitmap *durable; /* Stored in place of the table it has */
 
     QSIMPLEQ_ENTRY(Qcow2Bitmap) entry;
 } Qcow2Bitmap;
 typedef QSIMPLEQ_HEAD(Qcow2BitmapList, Qcow2Bitmap) Qcow2BitmapList;
 
+/*
+ * A bitmap that was consistent when the image was opened read-write is not
+ * marked in-use.  Instead, before a request may dirty an area that is clean
+ * in the image, the bitmap clusters covering it are written with the area
+ * set and flushed.  The image then always has a superset of the bits in
+ * memory, a crash loses nothing, and storing the bitmap on close only writes
+ * the clusters that differ from the image.
+ */
+struct Qcow2DurableBitmap {
+    char *name;
+    HBitmap *disk;          /* Bits as they are in the image */
+    uint64_t table_offset;
+    uint32_t table_size;
+    uint64_t *table;        /* In CPU byte order */
+    bool failed;            /* Must be marked in use instead */
+    QLIST_ENTRY(Qcow2DurableBitmap) next;
+};
+
 typedef enum BitmapType {
     BT_DIRTY_TRACKING_BITMAP = 1
 } BitmapType;
@@ -280,11 +299,11 @@ static uint64_t bytes_covered_by_bitmap_cluster(const BDRVQcow2State *s,
 
 /* load_bitmap_data
  * @bitmap_table entries must satisfy specification constraints.
- * @bitmap must be cleared */
+ * @bitmap and @disk, if not NULL, must be cleared */
 static int load_bitmap_data(BlockDriverState *bs,
                             const uint64_t *bitmap_table,
                             uint32_t bitmap_table_size,
-                            BdrvDirtyBitmap *bitmap)
+                            BdrvDirtyBitmap *bitmap, HBitmap *disk)
 {
     int ret = 0;
     BDRVQcow2State *s = bs->opaque;
@@ -312,6 +331,9 @@ static int load_bitmap_data(BlockDriverState *bs,
             if (entry & BME_TABLE_ENTRY_FLAG_ALL_ONES) {
                 bdrv_dirty_bitmap_deserialize_ones(bitmap, offset, count,
                                                    false);
+                if (disk) {
+                    hbitmap_deserialize_ones(disk, offset, count, false);
+                }
             } else {
                 /* No need to deserialize zeros because the dirty bitmap is
                  * already cleared */
@@ -323,11 +345,17 @@ static int load_bitmap_data(BlockDriverState *bs,
             }
             bdrv_dirty_bitmap_deserialize_part(bitmap, buf, offset, count,
                                                false);
+            if (disk) {
+                hbitmap_deserialize_part(disk, buf, offset, count, false);
+            }
         }
     }
     ret = 0;
 
     bdrv_dirty_bitmap_deserialize_finish(bitmap);
+    if (disk) {
+        hbitmap_deserialize_finish(disk);
+    }
 
 finish:
     g_free(buf);
@@ -335,13 +363,28 @@ finish:
     return ret;
 }
 
+static void durable_bitmap_free(Qcow2DurableBitmap *db)
+{
+    QLIST_REMOVE(db, next);
+    hbitmap_free(db->disk);
+    g_free(db->table);
+    g_free(db->name);
+    g_free(db);
+}
+
+/* load_bitmap
+ * If @durable is not NULL and the bitmap is not in use, a Qcow2DurableBitmap
+ * mirroring the image is returned in it as well. */
 static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
-                                    Qcow2Bitmap *bm, Error **errp)
+                                    Qcow2Bitmap *bm,
+                                    Qcow2DurableBitmap **durable,
+                                    Error **errp)
 {
     int ret;
     uint64_t *bitmap_table = NULL;
     uint32_t granularity;
     BdrvDirtyBitmap *bitmap = NULL;
+    HBitmap *disk = NULL;
 
     granularity = 1U << bm->granularity_bits;
     bitmap = bdrv_create_dirty_bitmap(bs, granularity, bm->name, errp);
@@ -362,17 +405,37 @@ static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
         goto fail;
     }
 
-    ret = load_bitmap_data(bs, bitmap_table, bm->table.size, bitmap);
+    if (durable) {
+        disk = hbitmap_alloc(bdrv_dirty_bitmap_size(bitmap),
+                             bm->granularity_bits);
+    }
+
+    ret = load_bitmap_data(bs, bitmap_table, bm->table.size, bitmap, disk);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Could not read bitmap '%s' from image",
                          bm->name);
         goto fail;
     }
 
+    if (durable) {
+        Qcow2DurableBitmap *db = g_new0(Qcow2DurableBitmap, 1);
+
+        db->name = g_strdup(bm->name);
+        db->disk = disk;
+        db->table_offset = bm->table.offset;
+        db->table_size = bm->table.size;
+        db->table = bitmap_table;
+        *durable = db;
+        return bitmap;
+    }
+
     g_free(bitmap_table);
     return bitmap;
 
 fail:
+    if (disk) {
+        hbitmap_free(disk);
+    }
     g_free(bitmap_table);
     if (bitmap != NULL) {
         bdrv_release_dirty_bitmap(bs, bitmap);
@@ -979,7 +1042,10 @@ bool qcow2_load_dirty_bitmaps(BlockDriverState *bs, Error **errp)
     }
 
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
-        BdrvDirtyBitmap *bitmap = load_bitmap(bs, bm, errp);
+        Qcow2DurableBitmap *db = NULL;
+        BdrvDirtyBitmap *bitmap = load_bitmap(bs, bm,
+                                              can_write(bs) ? &db : NULL,
+                                              errp);
         if (bitmap == NULL) {
             goto fail;
         }
@@ -987,6 +1053,9 @@ bool qcow2_load_dirty_bitmaps(BlockDriverState *bs, Error **errp)
         bdrv_dirty_bitmap_set_persistence(bitmap, true);
         if (bm->flags & BME_FLAG_IN_USE) {
             bdrv_dirty_bitmap_set_inconsistent(bitmap);
+        } else if (db) {
+            /* Kept consistent in the image, no need to mark it in use */
+            QLIST_INSERT_HEAD(&s->durable_bitmaps, db, next);
         } else {
             /* NB: updated flags only get written if can_write(bs) is true. */
             bm->flags |= BME_FLAG_IN_USE;
@@ -1020,6 +1089,7 @@ bool qcow2_load_dirty_bitmaps(BlockDriverState *bs, Error **errp)
     return header_updated;
 
 fail:
+    qcow2_free_durable_bitmaps(bs);
     g_slist_foreach(created_dirty_bitmaps, release_dirty_bitmap_helper, bs);
     g_slist_free(created_dirty_bitmaps);
     bitmap_list_free(bm_list);
@@ -1221,6 +1291,232 @@ out:
     return ret;
 }
 
+/*
+ * Durable bitmaps
+ */
+
+static Qcow2DurableBitmap *find_durable_bitmap(BDRVQcow2State *s,
+                                               const char *name)
+{
+    Qcow2DurableBitmap *db;
+
+    QLIST_FOREACH(db, &s->durable_bitmaps, next) {
+        if (strcmp(name, db->name) == 0) {
+            return db;
+        }
+    }
+
+    return NULL;
+}
+
+/* Mark @only, or all durable bitmaps if it is NULL, in use in the image and
+ * stop keeping them up to date there. They are stored in full on close. */
+static int durable_bitmaps_mark_in_use(BlockDriverState *bs,
+                                       Qcow2DurableBitmap *only)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2BitmapList *bm_list;
+    Qcow2Bitmap *bm;
+    Qcow2DurableBitmap *db, *next_db;
+    int ret;
+
+    if (s->nb_bitmaps != 0) {
+        bm_list = bitmap_list_load(bs, s->bitmap_directory_offset,
+                                   s->bitmap_directory_size, NULL);
+        if (bm_list == NULL) {
+            return -EIO;
+        }
+
+        QSIMPLEQ_FOREACH(bm, bm_list, entry) {
+            db = find_durable_bitmap(s, bm->name);
+            if (db != NULL && (only == NULL || db == only)) {
+                bm->flags |= BME_FLAG_IN_USE;
+            }
+        }
+
+        ret = update_ext_header_and_dir_in_place(bs, bm_list);
+        bitmap_list_free(bm_list);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    QLIST_FOREACH_SAFE(db, &s->durable_bitmaps, next, next_db) {
+        if (only == NULL || db == only) {
+            durable_bitmap_free(db);
+        }
+    }
+
+    return 0;
+}
+
+/* Write cluster @i of @db with the bits of @db->disk merged with those of
+ * @bitmap. @buf and @tmp must be cluster sized. */
+static int durable_bitmap_write_cluster(BlockDriverState *bs,
+                                        Qcow2DurableBitmap *db,
+                                        BdrvDirtyBitmap *bitmap, uint64_t i,
+                                        uint8_t *buf, uint8_t *tmp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t limit = bytes_covered_by_bitmap_cluster(s, bitmap);
+    uint64_t offset = i * limit;
+    uint64_t count = MIN(bdrv_dirty_bitmap_size(bitmap) - offset, limit);
+    uint64_t size = hbitmap_serialization_size(db->disk, offset, count);
+    uint64_t data_offset = db->table[i] & BME_TABLE_ENTRY_OFFSET_MASK;
+    uint64_t entry;
+    int64_t off;
+    uint64_t j;
+    int ret;
+
+    assert(size <= s->cluster_size);
+    hbitmap_serialize_part(db->disk, buf, offset, count);
+    bdrv_dirty_bitmap_serialize_part(bitmap, tmp, offset, count);
+    for (j = 0; j < size; j++) {
+        buf[j] |= tmp[j];
+    }
+    memset(buf + size, 0, s->cluster_size - size);
+    hbitmap_deserialize_part(db->disk, buf, offset, count, true);
+
+    if (data_offset != 0) {
+        ret = qcow2_pre_write_overlap_check(bs, 0, data_offset,
+                                            s->cluster_size, false);
+        if (ret < 0) {
+            return ret;
+        }
+        ret = bdrv_pwrite(bs->file, data_offset, buf, s->cluster_size);
+        return ret < 0 ? ret : 0;
+    }
+
+    /* A new cluster must be in the image before the table points to it */
+    off = qcow2_alloc_clusters(bs, s->cluster_size);
+    if (off < 0) {
+        return off;
+    }
+
+    ret = qcow2_pre_write_overlap_check(bs, 0, off, s->cluster_size, false);
+    if (ret >= 0) {
+        ret = bdrv_pwrite(bs->file, off, buf, s->cluster_size);
+    }
+    if (ret >= 0) {
+        ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+    }
+    if (ret >= 0) {
+        ret = bdrv_flush(bs->file->bs);
+    }
+    if (ret < 0) {
+        qcow2_free_clusters(bs, off, s->cluster_size, QCOW2_DISCARD_OTHER);
+        return ret;
+    }
+
+    entry = cpu_to_be64(off);
+    ret = bdrv_pwrite(bs->file, db->table_offset + i * sizeof(entry),
+                      &entry, sizeof(entry));
+    if (ret < 0) {
+        return ret;
+    }
+    db->table[i] = off;
+
+    return 0;
+}
+
+/* qcow2_co_persist_dirty_bitmaps()
+ * Make sure that the durable bitmaps have [@offset, @offset + @bytes) set in
+ * the image before a request dirties it. Called with s->lock held; requests
+ * waiting for the lock find the bits set once they get it.
+ */
+int coroutine_fn qcow2_co_persist_dirty_bitmaps(BlockDriverState *bs,
+                                                uint64_t offset,
+                                                uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DurableBitmap *db, *next_db;
+    uint8_t *buf = NULL, *tmp = NULL;
+    bool written = false;
+    int ret = 0;
+
+    QLIST_FOREACH_SAFE(db, &s->durable_bitmaps, next, next_db) {
+        BdrvDirtyBitmap *bitmap = bdrv_find_dirty_bitmap(bs, db->name);
+        uint64_t limit, pos, end;
+
+        if (db->failed) {
+            ret = durable_bitmaps_mark_in_use(bs, db);
+            if (ret < 0) {
+                goto out;
+            }
+            continue;
+        }
+
+        /* A frozen bitmap gets the bits of its successor back later */
+        if (bitmap == NULL || !(bdrv_dirty_bitmap_enabled(bitmap) ||
+                                bdrv_dirty_bitmap_has_successor(bitmap))) {
+            continue;
+        }
+
+        limit = bytes_covered_by_bitmap_cluster(s, bitmap);
+        end = MIN(offset + bytes, bdrv_dirty_bitmap_size(bitmap));
+        for (pos = offset; pos < end;
+             pos = QEMU_ALIGN_DOWN(pos, limit) + limit) {
+            uint64_t count = MIN(QEMU_ALIGN_DOWN(pos, limit) + limit, end) -
+                             pos;
+
+            if (hbitmap_next_zero(db->disk, pos, count) < 0) {
+                continue;
+            }
+
+            if (buf == NULL) {
+                buf = g_malloc(s->cluster_size);
+                tmp = g_malloc(s->cluster_size);
+            }
+
+            hbitmap_set(db->disk, pos, count);
+            ret = durable_bitmap_write_cluster(bs, db, bitmap, pos / limit,
+                                               buf, tmp);
+            if (ret < 0) {
+                /* @db->disk is not what the image has any more */
+                db->failed = true;
+                ret = durable_bitmaps_mark_in_use(bs, db);
+                if (ret < 0) {
+                    goto out;
+                }
+                break;
+            }
+            written = true;
+        }
+    }
+
+    if (written) {
+        ret = bdrv_flush(bs->file->bs);
+    }
+
+out:
+    g_free(buf);
+    g_free(tmp);
+
+    return ret;
+}
+
+/* Stop keeping bitmaps up to date in the image, e.g. because they are about
+ * to be resized. */
+int qcow2_drop_durable_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (QLIST_EMPTY(&s->durable_bitmaps)) {
+        return 0;
+    }
+
+    return durable_bitmaps_mark_in_use(bs, NULL);
+}
+
+void qcow2_free_durable_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    while (!QLIST_EMPTY(&s->durable_bitmaps)) {
+        durable_bitmap_free(QLIST_FIRST(&s->durable_bitmaps));
+    }
+}
+
 /* store_bitmap_data()
  * Store bitmap to image, filling bitmap table accordingly.
  */
@@ -1391,6 +1687,160 @@ fail:
     return ret;
 }
 
+/* store_durable_bitmap()
+ * Store bm->dirty_bitmap to the bitmap table the image has for it, writing
+ * only the clusters that differ from the image.
+ */
+static int store_durable_bitmap(BlockDriverState *bs, Qcow2Bitmap *bm,
+                                Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DurableBitmap *db = bm->durable;
+    BdrvDirtyBitmap *bitmap = bm->dirty_bitmap;
+    const char *bm_name = bdrv_dirty_bitmap_name(bitmap);
+    uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
+    uint64_t limit = bytes_covered_by_bitmap_cluster(s, bitmap);
+    uint8_t *buf, *disk_buf;
+    uint64_t *tb, *be_tb = NULL;
+    bool table_changed = false;
+    uint64_t i;
+    int ret = 0;
+
+    assert(db->table_size == bm->table.size &&
+           DIV_ROUND_UP(bm_size, limit) == db->table_size);
+
+    tb = g_memdup(db->table, db->table_size * sizeof(tb[0]));
+    buf = g_malloc(s->cluster_size);
+    disk_buf = g_malloc(s->cluster_size);
+
+    for (i = 0; i < db->table_size; i++) {
+        uint64_t offset = i * limit;
+        uint64_t count = MIN(bm_size - offset, limit);
+        uint64_t size = bdrv_dirty_bitmap_serialization_size(bitmap, offset,
+                                                             count);
+        uint64_t data_offset = tb[i] & BME_TABLE_ENTRY_OFFSET_MASK;
+        int64_t off;
+
+        bdrv_dirty_bitmap_serialize_part(bitmap, buf, offset, count);
+        hbitmap_serialize_part(db->disk, disk_buf, offset, count);
+        if (memcmp(buf, disk_buf, size) == 0) {
+            continue;
+        }
+
+        if (buffer_is_zero(buf, size)) {
+            /* The cluster is freed once the table is updated */
+            tb[i] = 0;
+            table_changed = true;
+            continue;
+        }
+
+        memset(buf + size, 0, s->cluster_size - size);
+        if (data_offset != 0) {
+            off = data_offset;
+        } else {
+            off = qcow2_alloc_clusters(bs, s->cluster_size);
+            if (off < 0) {
+                error_setg_errno(errp, -off,
+                                 "Failed to allocate clusters for bitmap '%s'",
+                                 bm_name);
+                ret = off;
+                goto fail;
+            }
+            tb[i] = off;
+            table_changed = true;
+        }
+
+        ret = qcow2_pre_write_overlap_check(bs, 0, off, s->cluster_size,
+                                            false);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Qcow2 overlap check failed");
+            goto fail;
+        }
+
+        ret = bdrv_pwrite(bs->file, off, buf, s->cluster_size);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to write bitmap '%s' to file",
+                             bm_name);
+            goto fail;
+        }
+
+        if (off == data_offset) {
+            hbitmap_deserialize_part(db->disk, buf, offset, count, true);
+        }
+    }
+
+    if (!table_changed) {
+        goto out;
+    }
+
+    /* New clusters must be in the image before the table points to them */
+    ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+    if (ret >= 0) {
+        ret = bdrv_flush(bs->file->bs);
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to flush bitmap '%s'", bm_name);
+        goto fail;
+    }
+
+    be_tb = g_memdup(tb, db->table_size * sizeof(tb[0]));
+    bitmap_table_to_be(be_tb, db->table_size);
+    ret = bdrv_pwrite(bs->file, db->table_offset, be_tb,
+                      db->table_size * sizeof(tb[0]));
+    if (ret >= 0) {
+        ret = bdrv_flush(bs->file->bs);
+    }
+    if (ret < 0) {
+        /* Nobody knows which entries made it; keep every cluster */
+        error_setg_errno(errp, -ret, "Failed to write bitmap '%s' to file",
+                         bm_name);
+        db->failed = true;
+        goto out;
+    }
+
+    for (i = 0; i < db->table_size; i++) {
+        uint64_t old_offset = db->table[i] & BME_TABLE_ENTRY_OFFSET_MASK;
+        uint64_t offset = i * limit;
+        uint64_t count = MIN(bm_size - offset, limit);
+
+        if (tb[i] == db->table[i]) {
+            continue;
+        }
+
+        if (old_offset != 0 && old_offset != tb[i]) {
+            qcow2_free_clusters(bs, old_offset, s->cluster_size,
+                                QCOW2_DISCARD_OTHER);
+        }
+        if (tb[i] == 0) {
+            hbitmap_deserialize_zeroes(db->disk, offset, count, true);
+        } else {
+            bdrv_dirty_bitmap_serialize_part(bitmap, buf, offset, count);
+            hbitmap_deserialize_part(db->disk, buf, offset, count, true);
+        }
+        db->table[i] = tb[i];
+    }
+    goto out;
+
+fail:
+    /* Drop what was allocated; the table in the image is still the old one */
+    for (i = 0; i < db->table_size; i++) {
+        uint64_t offset = tb[i] & BME_TABLE_ENTRY_OFFSET_MASK;
+
+        if (offset != 0 && tb[i] != db->table[i]) {
+            qcow2_free_clusters(bs, offset, s->cluster_size,
+                                QCOW2_DISCARD_OTHER);
+        }
+    }
+
+out:
+    g_free(be_tb);
+    g_free(disk_buf);
+    g_free(buf);
+    g_free(tb);
+
+    return ret < 0 ? ret : 0;
+}
+
 static Qcow2Bitmap *find_bitmap_by_name(Qcow2BitmapList *bm_list,
                                         const char *name)
 {
@@ -1413,6 +1863,7 @@ void qcow2_remove_persistent_dirty_bitmap(BlockDriverState *bs,
     BDRVQcow2State *s = bs->opaque;
     Qcow2Bitmap *bm;
     Qcow2BitmapList *bm_list;
+    Qcow2DurableBitmap *db;
 
     if (s->nb_bitmaps == 0) {
         /* Absence of the bitmap is not an error: see explanation above
@@ -1420,9 +1871,13 @@ void qcow2_remove_persistent_dirty_bitmap(BlockDriverState *bs,
         return;
     }
 
+    /* Requests may be updating the durable bitmap in the image */
+    bdrv_drained_begin(bs);
+
     bm_list = bitmap_list_load(bs, s->bitmap_directory_offset,
                                s->bitmap_directory_size, errp);
     if (bm_list == NULL) {
+        bdrv_drained_end(bs);
         return;
     }
 
@@ -1439,11 +1894,16 @@ void qcow2_remove_persistent_dirty_bitmap(BlockDriverState *bs,
         goto fail;
     }
 
+    db = find_durable_bitmap(s, name);
+    if (db != NULL) {
+        durable_bitmap_free(db);
+    }
     free_bitmap_clusters(bs, &bm->table);
 
 fail:
     bitmap_free(bm);
     bitmap_list_free(bm_list);
+    bdrv_drained_end(bs);
 }
 
 void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
@@ -1517,15 +1977,22 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
             bm->name = g_strdup(name);
             QSIMPLEQ_INSERT_TAIL(bm_list, bm, entry);
         } else {
-            if (!(bm->flags & BME_FLAG_IN_USE)) {
+            Qcow2DurableBitmap *db = find_durable_bitmap(s, name);
+
+            if (!(bm->flags & BME_FLAG_IN_USE) && db == NULL) {
                 error_setg(errp, "Bitmap '%s' already exists in the image",
                            name);
                 goto fail;
             }
-            tb = g_memdup(&bm->table, sizeof(bm->table));
-            bm->table.offset = 0;
-            bm->table.size = 0;
-            QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            if (db != NULL && !db->failed) {
+                /* Updated in place */
+                bm->durable = db;
+            } else {
+                tb = g_memdup(&bm->table, sizeof(bm->table));
+                bm->table.offset = 0;
+                bm->table.size = 0;
+                QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            }
         }
         bm->flags = bdrv_dirty_bitmap_enabled(bitmap) ? BME_FLAG_AUTO : 0;
         bm->granularity_bits = ctz32(bdrv_dirty_bitmap_granularity(bitmap));
@@ -1538,7 +2005,11 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
             continue;
         }
 
-        ret = store_bitmap(bs, bm, errp);
+        if (bm->durable != NULL) {
+            ret = store_durable_bitmap(bs, bm, errp);
+        } else {
+            ret = store_bitmap(bs, bm, errp);
+        }
         if (ret < 0) {
             goto fail;
         }
@@ -1573,12 +2044,14 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
         bdrv_release_dirty_bitmap(bs, bm->dirty_bitmap);
     }
 
+    qcow2_free_durable_bitmaps(bs);
     bitmap_list_free(bm_list);
     return;
 
 fail:
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
-        if (bm->dirty_bitmap == NULL || bm->table.offset == 0) {
+        if (bm->dirty_bitmap == NULL || bm->table.offset == 0 ||
+            bm->durable != NULL) {
             continue;
         }
 
@@ -37,6 +37,8 @@ typedef struct Qcow2CachedTable {
 
 struct Qcow2Cache {
     Qcow2CachedTable       *entries;
+    /* Maps table offsets to the Qcow2CachedTable::offset of their entry */
+    GHashTable             *index;
     struct Qcow2Cache      *depends;
     int                     size;
     int                     table_size;
@@ -59,6 +61,30 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline int qcow2_cache_find(Qcow2Cache *c, uint64_t offset)
+{
+    int64_t *key = g_hash_table_lookup(c->index, &offset);
+
+    if (!key) {
+        return -1;
+    }
+    return container_of(key, Qcow2CachedTable, offset) - c->entries;
+}
+
+static inline void qcow2_cache_set_offset(Qcow2Cache *c, int i,
+                                          int64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (t->offset) {
+        g_hash_table_remove(c->index, &t->offset);
+    }
+    t->offset = offset;
+    if (offset) {
+        g_hash_table_add(c->index, &t->offset);
+    }
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -106,7 +132,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_set_offset(c, i, 0);
             c->entries[i].lru_counter = 0;
             i++;
             to_clean++;
@@ -135,11 +161,13 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->size = num_tables;
     c->table_size = table_size;
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
+    c->index = g_hash_table_new(g_int64_hash, g_int64_equal);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
     if (!c->entries || !c->table_array) {
         qemu_vfree(c->table_array);
+        g_hash_table_destroy(c->index);
         g_free(c->entries);
         g_free(c);
         c = NULL;
@@ -157,6 +185,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_hash_table_destroy(c->index);
     g_free(c->entries);
     g_free(c);
 
@@ -190,6 +219,11 @@ static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
     trace_qcow2_cache_entry_flush(qemu_coroutine_self(),
                                   c == s->l2_table_cache, i);
 
+    if (s->journal_active) {
+        /* Writes back this entry together with all other dirty tables */
+        return qcow2_journal_commit(bs);
+    }
+
     if (c->depends) {
         ret = qcow2_cache_flush_dependency(bs, c);
     } else if (c->depends_on_flush) {
@@ -256,9 +290,11 @@ int qcow2_cache_write(BlockDriverState *bs, Qcow2Cache *c)
 
 int qcow2_cache_flush(BlockDriverState *bs, Qcow2Cache *c)
 {
+    BDRVQcow2State *s = bs->opaque;
     int result = qcow2_cache_write(bs, c);
 
-    if (result == 0) {
+    /* Tables written back through the journal are safe on disk already */
+    if (result == 0 && !s->journal_active) {
         int ret = bdrv_flush(bs->file->bs);
         if (ret < 0) {
             result = ret;
@@ -271,8 +307,14 @@ int qcow2_cache_flush(BlockDriverState *bs, Qcow2Cache *c)
 int qcow2_cache_set_dependency(BlockDriverState *bs, Qcow2Cache *c,
     Qcow2Cache *dependency)
 {
+    BDRVQcow2State *s = bs->opaque;
     int ret;
 
+    if (s->journal_active) {
+        /* Journal transactions update both caches atomically */
+        return 0;
+    }
+
     if (dependency->depends) {
         ret = qcow2_cache_flush_dependency(bs, dependency);
         if (ret < 0) {
@@ -305,6 +347,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
         return ret;
     }
 
+    g_hash_table_remove_all(c->index);
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
         c->entries[i].offset = 0;
@@ -324,7 +367,6 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
     uint64_t min_lru_counter = UINT64_MAX;
     int min_lru_index = -1;
 
@@ -341,20 +383,19 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
+    i = qcow2_cache_find(c, offset);
+    if (i >= 0) {
+        goto found;
+    }
+
+    /* Cache miss: find the least recently used table that is not in use */
+    for (i = 0; i < c->size; i++) {
         const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
         if (t->ref == 0 && t->lru_counter < min_lru_counter) {
             min_lru_counter = t->lru_counter;
             min_lru_index = i;
         }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    }
 
     if (min_lru_index == -1) {
         /* This can't happen in current synchronous code, but leave the check
@@ -374,7 +415,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -388,7 +429,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
@@ -436,14 +477,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_find(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -452,9 +488,69 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     c->entries[i].lru_counter = 0;
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+int qcow2_cache_dirty_tables(Qcow2Cache *c)
+{
+    int i, n = 0;
+
+    for (i = 0; i < c->size; i++) {
+        if (c->entries[i].dirty && c->entries[i].offset) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+int qcow2_cache_nb_tables(Qcow2Cache *c)
+{
+    return c->size;
+}
+
+unsigned qcow2_cache_table_size(Qcow2Cache *c)
+{
+    return c->table_size;
+}
+
+/*
+ * Copies the dirty tables of @c to @buf and stores their offsets in @offsets;
+ * both must have room for qcow2_cache_dirty_tables() entries.  The tables stay
+ * dirty until qcow2_cache_mark_all_clean() is called.
+ */
+int qcow2_cache_copy_dirty(Qcow2Cache *c, uint64_t *offsets, uint8_t *buf)
+{
+    int i, n = 0;
+
+    for (i = 0; i < c->size; i++) {
+        if (c->entries[i].dirty && c->entries[i].offset) {
+            offsets[n] = c->entries[i].offset;
+            memcpy(buf + (size_t) n * c->table_size,
+                   qcow2_cache_get_table_addr(c, i), c->table_size);
+            n++;
+        }
+    }
+
+    return n;
+}
+
+void qcow2_cache_mark_all_clean(Qcow2Cache *c)
+{
+    int i;
+
+    for (i = 0; i < c->size; i++) {
+        c->entries[i].dirty = false;
+    }
+    c->depends = NULL;
+    c->depends_on_flush = false;
+}
+
+bool qcow2_cache_needs_flush(Qcow2Cache *c)
+{
+    return c->depends_on_flush;
+}
@@ -0,0 +1,583 @@
+/*
+ * Metadata journal for the QCOW2 format
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Without a journal, qcow2 keeps its on-disk metadata consistent by ordering
+ * the writeback of the L2 and refcount block caches (see
+ * qcow2_cache_set_dependency()), which costs a flush of the image file every
+ * time the direction of the dependency changes.
+ *
+ * With a journal, all dirty tables of both caches are instead written as one
+ * transaction into a preallocated journal area, which is followed by a single
+ * flush.  Only then are the tables written to their actual location, in any
+ * order and without flushing: a crash before those writes are stable is
+ * repaired by replaying the journal on the next read-write open.
+ *
+ * While the journal may contain transactions that are needed to repair the
+ * image, QCOW2_INCOMPAT_JOURNAL is set.  A checkpoint makes all in-place
+ * writes stable, clears the bit and starts a new generation of transactions
+ * at the beginning of the journal; this happens when the journal is full, on
+ * inactivation and before a cluster that holds a journaled table is freed
+ * (so that a replay can never overwrite whatever it is reused for).
+ *
+ * Each transaction consists of a Qcow2JournalTxHeader, the table references
+ * (padded to a multiple of 512 bytes) and the table contents.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/crc32c.h"
+#include "qemu/error-report.h"
+#include "qemu/range.h"
+#include "block/block_int.h"
+#include "qcow2.h"
+#include "trace.h"
+
+#define QCOW2_JOURNAL_TX_MAGIC 0x716a7478 /* "qjtx" */
+
+typedef struct Qcow2JournalTxHeader {
+    uint32_t magic;
+    uint32_t crc;           /* crc32c of the transaction with crc = 0 */
+    uint64_t generation;
+    uint64_t sequence;
+    uint32_t nb_tables;
+    uint32_t reserved;
+} QEMU_PACKED Qcow2JournalTxHeader;
+
+typedef struct Qcow2JournalTableRef {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t reserved;
+} QEMU_PACKED Qcow2JournalTableRef;
+
+static uint64_t journal_tx_header_size(uint64_t nb_tables)
+{
+    return ROUND_UP(sizeof(Qcow2JournalTxHeader) +
+                    nb_tables * sizeof(Qcow2JournalTableRef),
+                    BDRV_SECTOR_SIZE);
+}
+
+/* Size of the largest transaction, which contains both caches entirely */
+static uint64_t journal_max_tx_size(BDRVQcow2State *s)
+{
+    Qcow2Cache *l2 = s->l2_table_cache;
+    Qcow2Cache *rb = s->refcount_block_cache;
+    uint64_t nb_l2 = qcow2_cache_nb_tables(l2);
+    uint64_t nb_rb = qcow2_cache_nb_tables(rb);
+
+    return journal_tx_header_size(nb_l2 + nb_rb) +
+           nb_l2 * qcow2_cache_table_size(l2) +
+           nb_rb * qcow2_cache_table_size(rb);
+}
+
+/*
+ * Decides whether metadata updates go through the journal.  Must only be
+ * called while the journal holds no transactions.
+ */
+void qcow2_journal_update_active(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    assert(s->journal_pos == 0);
+
+    s->journal_active = false;
+    if (!s->journal_offset || s->journal_needs_replay) {
+        return;
+    }
+
+    if (journal_max_tx_size(s) > s->journal_size) {
+        warn_report("qcow2: The metadata journal (%" PRIu64 " bytes) is "
+                    "too small for the metadata caches (%" PRIu64 " bytes); "
+                    "not using it", s->journal_size, journal_max_tx_size(s));
+        return;
+    }
+
+    s->journal_active = true;
+}
+
+int qcow2_journal_create(BlockDriverState *bs, int64_t size, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t offset;
+    int ret;
+
+    assert(!s->journal_offset);
+
+    if (size <= 0 || size > QCOW2_MAX_JOURNAL_SIZE) {
+        error_setg(errp, "Metadata journal size must be between 1 and %"
+                   PRId64 " bytes", QCOW2_MAX_JOURNAL_SIZE);
+        return -EINVAL;
+    }
+    size = ROUND_UP(size, s->cluster_size);
+
+    offset = qcow2_alloc_clusters(bs, size);
+    if (offset < 0) {
+        error_setg_errno(errp, -offset, "Could not allocate the metadata "
+                         "journal");
+        return offset;
+    }
+
+    ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not allocate the metadata "
+                         "journal");
+        return ret;
+    }
+
+    s->journal_offset = offset;
+    s->journal_size = size;
+    s->journal_generation = 1;
+    s->journal_tables = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                              g_free, NULL);
+    s->autoclear_features |= QCOW2_AUTOCLEAR_JOURNAL;
+
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not update qcow2 header");
+        return ret;
+    }
+
+    qcow2_journal_update_active(bs);
+    return 0;
+}
+
+/*
+ * Writes the tables of the transaction at @pos in the journal to their
+ * location.  Returns the transaction length, 0 if there is no valid
+ * transaction at @pos (the end of the journal), or a negative errno.
+ */
+static int64_t journal_replay_tx(BlockDriverState *bs, uint64_t pos,
+                                 uint64_t sequence, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2JournalTxHeader tx;
+    Qcow2JournalTableRef *refs;
+    uint64_t avail = s->journal_size - pos;
+    uint64_t header_len, len, table_offset, nb_tables, i;
+    uint8_t *buf;
+    uint32_t crc;
+    int64_t ret;
+
+    if (avail < BDRV_SECTOR_SIZE) {
+        return 0;
+    }
+
+    ret = bdrv_pread(bs->file, s->journal_offset + pos, &tx, sizeof(tx));
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the metadata journal");
+        return ret;
+    }
+
+    nb_tables = be32_to_cpu(tx.nb_tables);
+    if (be32_to_cpu(tx.magic) != QCOW2_JOURNAL_TX_MAGIC ||
+        be64_to_cpu(tx.generation) != s->journal_generation ||
+        be64_to_cpu(tx.sequence) != sequence ||
+        nb_tables == 0 || journal_tx_header_size(nb_tables) > avail)
+    {
+        return 0;
+    }
+
+    header_len = journal_tx_header_size(nb_tables);
+    buf = qemu_try_blockalign(bs->file->bs, header_len);
+    if (buf == NULL) {
+        error_setg(errp, "Could not allocate the metadata journal buffer");
+        return -ENOMEM;
+    }
+
+    ret = bdrv_pread(bs->file, s->journal_offset + pos, buf, header_len);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the metadata journal");
+        goto out;
+    }
+
+    /* Anything that does not look sane is an incompletely written tail */
+    refs = (Qcow2JournalTableRef *) (buf + sizeof(tx));
+    len = header_len;
+    for (i = 0; i < nb_tables; i++) {
+        uint32_t size = be32_to_cpu(refs[i].size);
+
+        if (size < BDRV_SECTOR_SIZE || size > s->cluster_size ||
+            !is_power_of_2(size) || len + size > avail)
+        {
+            ret = 0;
+            goto out;
+        }
+        len += size;
+    }
+
+    qemu_vfree(buf);
+    buf = qemu_try_blockalign(bs->file->bs, len);
+    if (buf == NULL) {
+        error_setg(errp, "Could not allocate the metadata journal buffer");
+        return -ENOMEM;
+    }
+    refs = (Qcow2JournalTableRef *) (buf + sizeof(tx));
+
+    ret = bdrv_pread(bs->file, s->journal_offset + pos, buf, len);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the metadata journal");
+        goto out;
+    }
+
+    crc = be32_to_cpu(((Qcow2JournalTxHeader *) buf)->crc);
+    ((Qcow2JournalTxHeader *) buf)->crc = 0;
+    if (crc32c(0xffffffff, buf, len) != crc) {
+        ret = 0;
+        goto out;
+    }
+
+    /* The transaction is complete, so its tables must be valid */
+    table_offset = header_len;
+    for (i = 0; i < nb_tables; i++) {
+        uint64_t offset = be64_to_cpu(refs[i].offset);
+        uint32_t size = be32_to_cpu(refs[i].size);
+
+        if (offset < s->cluster_size || !QEMU_IS_ALIGNED(offset, size) ||
+            offset > QCOW_MAX_CLUSTER_OFFSET ||
+            ranges_overlap(offset, size, s->journal_offset, s->journal_size))
+        {
+            error_setg(errp, "Metadata journal transaction %" PRIu64
+                       " references an invalid table offset %#" PRIx64,
+                       sequence, offset);
+            ret = -EINVAL;
+            goto out;
+        }
+
+        ret = bdrv_pwrite(bs->file, offset, buf + table_offset, size);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not replay the metadata "
+                             "journal");
+            goto out;
+        }
+        table_offset += size;
+    }
+
+    ret = len;
+out:
+    qemu_vfree(buf);
+    return ret;
+}
+
+static int journal_replay(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t pos = 0, sequence = 0;
+    int64_t len;
+    int ret;
+
+    while ((len = journal_replay_tx(bs, pos, sequence, errp)) > 0) {
+        pos += len;
+        sequence++;
+    }
+    if (len < 0) {
+        return len;
+    }
+
+    trace_qcow2_journal_replay(bs, s->journal_generation, sequence);
+
+    ret = bdrv_flush(bs->file->bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not replay the metadata journal");
+        return ret;
+    }
+
+    s->journal_generation++;
+    s->incompatible_features &= ~QCOW2_INCOMPAT_JOURNAL;
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not update qcow2 header");
+        return ret;
+    }
+
+    ret = bdrv_flush(bs->file->bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not replay the metadata journal");
+        return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Called on open once the header extensions have been read.  Replays the
+ * journal if necessary and possible.
+ */
+int qcow2_journal_open(BlockDriverState *bs, int flags, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (!s->journal_offset) {
+        return 0;
+    }
+
+    s->journal_tables = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                              g_free, NULL);
+
+    if (s->incompatible_features & QCOW2_INCOMPAT_JOURNAL) {
+        if (bs->read_only || (flags & BDRV_O_INACTIVE)) {
+            /* Someone else may still be using the journal, or we cannot
+             * write; either way, the on-disk tables may be stale */
+            s->journal_needs_replay = true;
+        } else {
+            ret = journal_replay(bs, errp);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+
+    qcow2_journal_update_active(bs);
+    return 0;
+}
+
+void qcow2_journal_close(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->journal_tables) {
+        g_hash_table_destroy(s->journal_tables);
+        s->journal_tables = NULL;
+    }
+}
+
+/*
+ * Writes back all dirty tables of both metadata caches in one journal
+ * transaction.
+ */
+int qcow2_journal_commit(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2Cache *caches[] = { s->refcount_block_cache, s->l2_table_cache };
+    int ign[] = { QCOW2_OL_REFCOUNT_BLOCK, QCOW2_OL_ACTIVE_L2 };
+    Qcow2JournalTxHeader *tx;
+    Qcow2JournalTableRef *refs;
+    uint64_t *offsets = NULL;
+    uint8_t *buf = NULL, *p;
+    int nb[ARRAY_SIZE(caches)];
+    int nb_tables = 0;
+    size_t header_len, len;
+    int i, j, n, ret;
+
+    assert(s->journal_active);
+
+    for (i = 0; i < ARRAY_SIZE(caches); i++) {
+        nb[i] = qcow2_cache_dirty_tables(caches[i]);
+        nb_tables += nb[i];
+    }
+    if (nb_tables == 0) {
+        return 0;
+    }
+
+    header_len = journal_tx_header_size(nb_tables);
+    len = header_len;
+    for (i = 0; i < ARRAY_SIZE(caches); i++) {
+        len += (size_t) nb[i] * qcow2_cache_table_size(caches[i]);
+    }
+    assert(len <= s->journal_size);
+
+    if (len > s->journal_size - s->journal_pos) {
+        ret = qcow2_journal_checkpoint(bs);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    buf = qemu_try_blockalign(bs->file->bs, len);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    memset(buf, 0, header_len);
+    offsets = g_new(uint64_t, nb_tables);
+
+    tx = (Qcow2JournalTxHeader *) buf;
+    refs = (Qcow2JournalTableRef *) (tx + 1);
+    p = buf + header_len;
+    n = 0;
+    for (i = 0; i < ARRAY_SIZE(caches); i++) {
+        unsigned size = qcow2_cache_table_size(caches[i]);
+
+        qcow2_cache_copy_dirty(caches[i], offsets + n, p);
+        for (j = 0; j < nb[i]; j++, n++) {
+            ret = qcow2_pre_write_overlap_check(bs, ign[i], offsets[n], size,
+                                                false);
+            if (ret < 0) {
+                goto out;
+            }
+            refs[n].offset = cpu_to_be64(offsets[n]);
+            refs[n].size = cpu_to_be32(size);
+        }
+        p += (size_t) nb[i] * size;
+    }
+
+    tx->magic = cpu_to_be32(QCOW2_JOURNAL_TX_MAGIC);
+    tx->generation = cpu_to_be64(s->journal_generation);
+    tx->sequence = cpu_to_be64(s->journal_sequence);
+    tx->nb_tables = cpu_to_be32(nb_tables);
+    tx->crc = cpu_to_be32(crc32c(0xffffffff, buf, len));
+
+    /* Data that the new metadata points to must be stable before it */
+    if (qcow2_cache_needs_flush(s->l2_table_cache) ||
+        qcow2_cache_needs_flush(s->refcount_block_cache))
+    {
+        ret = bdrv_flush(bs->file->bs);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    if (!(s->incompatible_features & QCOW2_INCOMPAT_JOURNAL)) {
+        uint64_t val;
+
+        val = cpu_to_be64(s->incompatible_features | QCOW2_INCOMPAT_JOURNAL);
+        ret = bdrv_pwrite(bs->file,
+                          offsetof(QCowHeader, incompatible_features),
+                          &val, sizeof(val));
+        if (ret < 0) {
+            goto out;
+        }
+        s->incompatible_features |= QCOW2_INCOMPAT_JOURNAL;
+    }
+
+    trace_qcow2_journal_commit(qemu_coroutine_self(), nb_tables,
+                               s->journal_generation, s->journal_sequence);
+
+    ret = bdrv_pwrite(bs->file, s->journal_offset + s->journal_pos, buf, len);
+    if (ret < 0) {
+        goto out;
+    }
+    ret = bdrv_flush(bs->file->bs);
+    if (ret < 0) {
+        goto out;
+    }
+
+    s->journal_pos += len;
+    s->journal_sequence++;
+    for (n = 0; n < nb_tables; n++) {
+        uint64_t *cluster = g_new(uint64_t, 1);
+
+        *cluster = start_of_cluster(s, offsets[n]);
+        g_hash_table_add(s->journal_tables, cluster);
+    }
+
+    /* The transaction is stable, so the order of these writes is irrelevant */
+    p = buf + header_len;
+    n = 0;
+    for (i = 0; i < ARRAY_SIZE(caches); i++) {
+        unsigned size = qcow2_cache_table_size(caches[i]);
+
+        if (caches[i] == s->refcount_block_cache) {
+            BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_UPDATE_PART);
+        } else {
+            BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE);
+        }
+
+        for (j = 0; j < nb[i]; j++, n++) {
+            ret = bdrv_pwrite(bs->file, offsets[n], p, size);
+            if (ret < 0) {
+                goto out;
+            }
+            p += size;
+        }
+        qcow2_cache_mark_all_clean(caches[i]);
+    }
+
+    ret = 0;
+out:
+    g_free(offsets);
+    qemu_vfree(buf);
+    return ret;
+}
+
+/*
+ * Makes all in-place table writes stable and empties the journal.
+ */
+int qcow2_journal_checkpoint(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (s->journal_pos == 0) {
+        return 0;
+    }
+
+    trace_qcow2_journal_checkpoint(bs, s->journal_generation);
+
+    ret = bdrv_flush(bs->file->bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->journal_generation++;
+    s->incompatible_features &= ~QCOW2_INCOMPAT_JOURNAL;
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        /* Keep appending to the current generation */
+        s->journal_generation--;
+        s->incompatible_features |= QCOW2_INCOMPAT_JOURNAL;
+        return ret;
+    }
+
+    s->journal_sequence = 0;
+    s->journal_pos = 0;
+    g_hash_table_remove_all(s->journal_tables);
+
+    return bdrv_flush(bs->file->bs);
+}
+
+/*
+ * Stops using the journal, for operations that write tables directly rather
+ * than through the metadata caches.
+ */
+int qcow2_journal_suspend(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (!s->journal_active) {
+        return 0;
+    }
+
+    ret = qcow2_cache_write(bs, s->l2_table_cache);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = qcow2_cache_write(bs, s->refcount_block_cache);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = qcow2_journal_checkpoint(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->journal_active = false;
+    return 0;
+}
+
+void qcow2_journal_resume(BlockDriverState *bs)
+{
+    qcow2_journal_update_active(bs);
+}
+
+/*
+ * Must be called before the refcount of the cluster at @cluster_offset drops
+ * to zero.
+ */
+int qcow2_journal_table_freed(BlockDriverState *bs, uint64_t cluster_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->journal_tables ||
+        !g_hash_table_contains(s->journal_tables, &cluster_offset))
+    {
+        return 0;
+    }
+
+    return qcow2_journal_checkpoint(bs);
+}
@@ -133,10 +133,311 @@ int qcow2_refcount_init(BlockDriverState *bs)
 void qcow2_refcount_close(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
+    qcow2_drop_free_index(bs);
     g_free(s->refcount_table);
 }
 
 
+/*********************************************************/
+/* free cluster index */
+
+/*
+ * The runs of clusters with a refcount of 0 below @end, the first cluster
+ * that no refblock covers when the index was built; everything from @end
+ * on is free.  The extent that ends at @end (if any) is the tail of the
+ * image and is not kept by size, so that an allocation only grows the image
+ * if no hole can take it.
+ *
+ * The index is built on the first allocation and follows update_refcount();
+ * code that sets refcounts behind its back either keeps it up to date too
+ * or drops it.  alloc_clusters_noref() still checks the refcounts of the
+ * clusters it picks, so a stale index costs a rebuild, not a corruption.
+ */
+typedef struct Qcow2FreeExtent {
+    uint64_t start;
+    uint64_t end;               /* exclusive */
+} Qcow2FreeExtent;
+
+struct Qcow2FreeIndex {
+    GTree *extents;             /* all extents, by start */
+    GTree *by_size[64];         /* the others, by log2 of their length */
+    uint64_t end;
+    uint64_t next;              /* where the last allocation ended */
+};
+
+static gint free_extent_cmp(gconstpointer a, gconstpointer b,
+                            gpointer opaque)
+{
+    const Qcow2FreeExtent *ea = a, *eb = b;
+
+    return ea->start < eb->start ? -1 : ea->start > eb->start;
+}
+
+static gint free_extent_search(gconstpointer key, gconstpointer data)
+{
+    const Qcow2FreeExtent *ext = key;
+    uint64_t cluster = *(const uint64_t *)data;
+
+    if (cluster < ext->start) {
+        return -1;
+    }
+    return cluster >= ext->end;
+}
+
+static Qcow2FreeExtent *free_index_find(Qcow2FreeIndex *fi, uint64_t cluster)
+{
+    return g_tree_search(fi->extents, free_extent_search, &cluster);
+}
+
+static GTree **free_extent_class(Qcow2FreeIndex *fi, Qcow2FreeExtent *ext)
+{
+    if (ext->end == fi->end) {
+        return NULL;
+    }
+    return &fi->by_size[63 - clz64(ext->end - ext->start)];
+}
+
+static void free_extent_attach(Qcow2FreeIndex *fi, Qcow2FreeExtent *ext)
+{
+    GTree **class = free_extent_class(fi, ext);
+
+    g_tree_insert(fi->extents, ext, ext);
+    if (class) {
+        if (!*class) {
+            *class = g_tree_new_full(free_extent_cmp, NULL, NULL, NULL);
+        }
+        g_tree_insert(*class, ext, ext);
+    }
+}
+
+static void free_extent_detach(Qcow2FreeIndex *fi, Qcow2FreeExtent *ext)
+{
+    GTree **class = free_extent_class(fi, ext);
+
+    g_tree_steal(fi->extents, ext);
+    if (class) {
+        g_tree_remove(*class, ext);
+    }
+}
+
+static void free_extent_add(Qcow2FreeIndex *fi, uint64_t start, uint64_t end)
+{
+    Qcow2FreeExtent *ext = g_new(Qcow2FreeExtent, 1);
+
+    ext->start = start;
+    ext->end = end;
+    free_extent_attach(fi, ext);
+}
+
+/* Move @end up to @new_end, the clusters between them are free */
+static void free_index_grow(Qcow2FreeIndex *fi, uint64_t new_end)
+{
+    Qcow2FreeExtent *tail = fi->end ? free_index_find(fi, fi->end - 1) : NULL;
+
+    if (tail) {
+        free_extent_detach(fi, tail);
+        fi->end = new_end;
+        tail->end = new_end;
+        free_extent_attach(fi, tail);
+    } else {
+        uint64_t old_end = fi->end;
+
+        fi->end = new_end;
+        free_extent_add(fi, old_end, new_end);
+    }
+}
+
+/* Mark @cluster as used */
+static void free_index_take(BDRVQcow2State *s, uint64_t cluster)
+{
+    Qcow2FreeIndex *fi = s->free_index;
+    Qcow2FreeExtent *ext;
+
+    if (!fi) {
+        return;
+    }
+    if (cluster >= fi->end) {
+        free_index_grow(fi, cluster + 1);
+    }
+    ext = free_index_find(fi, cluster);
+    if (!ext) {
+        return;
+    }
+
+    free_extent_detach(fi, ext);
+    if (ext->start == cluster && ext->end == cluster + 1) {
+        g_free(ext);
+        return;
+    }
+    if (ext->start == cluster) {
+        ext->start++;
+    } else if (ext->end == cluster + 1) {
+        ext->end--;
+    } else {
+        free_extent_add(fi, cluster + 1, ext->end);
+        ext->end = cluster;
+    }
+    free_extent_attach(fi, ext);
+}
+
+/* Mark @cluster as free */
+static void free_index_put(BDRVQcow2State *s, uint64_t cluster)
+{
+    Qcow2FreeIndex *fi = s->free_index;
+    Qcow2FreeExtent *prev, *next;
+
+    if (!fi || cluster >= fi->end || free_index_find(fi, cluster)) {
+        return;
+    }
+
+    prev = cluster > 0 ? free_index_find(fi, cluster - 1) : NULL;
+    next = cluster + 1 < fi->end ? free_index_find(fi, cluster + 1) : NULL;
+    if (prev && next) {
+        free_extent_detach(fi, prev);
+        free_extent_detach(fi, next);
+        prev->end = next->end;
+        g_free(next);
+        free_extent_attach(fi, prev);
+    } else if (prev) {
+        free_extent_detach(fi, prev);
+        prev->end = cluster + 1;
+        free_extent_attach(fi, prev);
+    } else if (next) {
+        free_extent_detach(fi, next);
+        next->start = cluster;
+        free_extent_attach(fi, next);
+    } else {
+        free_extent_add(fi, cluster, cluster + 1);
+    }
+}
+
+static int free_index_build(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2FreeIndex *fi = g_new0(Qcow2FreeIndex, 1);
+    uint64_t run_start = 0, run_end = 0;
+    uint64_t i, j;
+    int ret;
+
+    fi->extents = g_tree_new_full(free_extent_cmp, NULL, g_free, NULL);
+    fi->end = s->refcount_table_size ?
+              ((uint64_t)s->max_refcount_table_index + 1)
+              << s->refcount_block_bits : 0;
+    s->free_index = fi;
+
+    for (i = 0; i < fi->end; i += s->refcount_block_size) {
+        uint64_t offset = s->refcount_table[i >> s->refcount_block_bits] &
+                          REFT_OFFSET_MASK;
+        void *refblock;
+
+        if (!offset) {
+            if (run_end != i) {
+                if (run_end > run_start) {
+                    free_extent_add(fi, run_start, run_end);
+                }
+                run_start = i;
+            }
+            run_end = i + s->refcount_block_size;
+            continue;
+        }
+
+        ret = qcow2_cache_get(bs, s->refcount_block_cache, offset, &refblock);
+        if (ret < 0) {
+            qcow2_drop_free_index(bs);
+            return ret;
+        }
+        for (j = 0; j < s->refcount_block_size; j++) {
+            if (s->get_refcount(refblock, j)) {
+                continue;
+            }
+            if (run_end != i + j) {
+                if (run_end > run_start) {
+                    free_extent_add(fi, run_start, run_end);
+                }
+                run_start = i + j;
+            }
+            run_end = i + j + 1;
+        }
+        qcow2_cache_put(s->refcount_block_cache, &refblock);
+    }
+    if (run_end > run_start) {
+        free_extent_add(fi, run_start, run_end);
+    }
+
+    fi->next = s->free_cluster_index;
+    return 0;
+}
+
+void qcow2_drop_free_index(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2FreeIndex *fi = s->free_index;
+    int i;
+
+    if (!fi) {
+        return;
+    }
+    for (i = 0; i < ARRAY_SIZE(fi->by_size); i++) {
+        if (fi->by_size[i]) {
+            g_tree_destroy(fi->by_size[i]);
+        }
+    }
+    g_tree_destroy(fi->extents);
+    g_free(fi);
+    s->free_index = NULL;
+}
+
+typedef struct FreeIndexFit {
+    uint64_t n;
+    Qcow2FreeExtent *ext;
+} FreeIndexFit;
+
+static gboolean free_index_fit(gpointer key, gpointer value, gpointer opaque)
+{
+    Qcow2FreeExtent *ext = value;
+    FreeIndexFit *fit = opaque;
+
+    if (ext->end - ext->start >= fit->n) {
+        fit->ext = ext;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Pick @n free clusters: right after the previous allocation if they fit
+ * there, so that data written in sequence stays in sequence; else at the
+ * lowest address of the largest hole that can take them, which leaves the
+ * most room for the allocations that follow; else at the tail.
+ */
+static uint64_t free_index_pick(Qcow2FreeIndex *fi, uint64_t n)
+{
+    Qcow2FreeExtent *ext;
+    FreeIndexFit fit = { .n = n };
+    int i;
+
+    if (fi->next >= fi->end) {
+        return fi->next;
+    }
+    ext = free_index_find(fi, fi->next);
+    if (ext && (ext->end == fi->end || ext->end - fi->next >= n)) {
+        return fi->next;
+    }
+
+    for (i = ARRAY_SIZE(fi->by_size) - 1; i >= 63 - clz64(n); i--) {
+        if (fi->by_size[i]) {
+            g_tree_foreach(fi->by_size[i], free_index_fit, &fit);
+            if (fit.ext) {
+                return fit.ext->start;
+            }
+        }
+    }
+
+    ext = fi->end ? free_index_find(fi, fi->end - 1) : NULL;
+    return ext ? ext->start : fi->end;
+}
+
+
 static uint64_t get_refcount_ro0(const void *refcount_array, uint64_t index)
 {
     return (((const uint8_t *)refcount_array)[index / 8] >> (index % 8)) & 0x1;
@@ -398,6 +699,7 @@ static int alloc_refcount_block(BlockDriverState *bs,
         int block_index = (new_block >> s->cluster_bits) &
             (s->refcount_block_size - 1);
         s->set_refcount(*refcount_block, block_index, 1);
+        free_index_take(s, new_block >> s->cluster_bits);
     } else {
         /* Described somewhere else. This can recurse at most twice before we
          * arrive at a block that describes itself. */
@@ -658,6 +960,7 @@ int64_t qcow2_refcount_area(BlockDriverState *bs, uint64_t start_offset,
                 /* The caller guaranteed us this space would be empty */
                 assert(s->get_refcount(refblock_data, j) == 0);
                 s->set_refcount(refblock_data, j, 1);
+                free_index_take(s, first_offset_covered / s->cluster_size + j);
             }
 
             qcow2_cache_entry_mark_dirty(s->refcount_block_cache,
@@ -833,7 +1136,7 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
         cluster_offset += s->cluster_size)
     {
         int block_index;
-        uint64_t refcount;
+        uint64_t refcount, old_refcount;
         int64_t cluster_index = cluster_offset >> s->cluster_bits;
         int64_t table_index = cluster_index >> s->refcount_block_bits;
 
@@ -849,6 +1152,10 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
                 if (s->free_cluster_index > (start >> s->cluster_bits)) {
                     s->free_cluster_index = (start >> s->cluster_bits);
                 }
+                if (s->free_index &&
+                    s->free_index->next > (start >> s->cluster_bits)) {
+                    s->free_index->next = start >> s->cluster_bits;
+                }
             }
             if (ret < 0) {
                 goto fail;
@@ -869,15 +1176,29 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
             ret = -EINVAL;
             goto fail;
         }
+        old_refcount = refcount;
         if (decrease) {
             refcount -= addend;
         } else {
             refcount += addend;
         }
+        if (refcount == 0 && s->journal_offset) {
+            /* Replaying old table copies must not overwrite whatever the
+             * cluster is reused for */
+            ret = qcow2_journal_table_freed(bs, cluster_offset);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
         if (refcount == 0 && cluster_index < s->free_cluster_index) {
             s->free_cluster_index = cluster_index;
         }
         s->set_refcount(refcount_block, block_index, refcount);
+        if (refcount == 0) {
+            free_index_put(s, cluster_index);
+        } else if (old_refcount == 0) {
+            free_index_take(s, cluster_index);
+        }
 
         if (refcount == 0) {
             void *table;
@@ -920,6 +1241,21 @@ fail:
         dummy = update_refcount(bs, offset, cluster_offset - offset, addend,
                                 !decrease, QCOW2_DISCARD_NEVER);
         (void)dummy;
+
+        /* alloc_clusters_noref() took the clusters out of the free index
+         * already, give back those that stayed free */
+        if (s->free_index && !decrease) {
+            for (cluster_offset = start; cluster_offset <= last;
+                 cluster_offset += s->cluster_size)
+            {
+                uint64_t refcount;
+
+                if (qcow2_get_refcount(bs, cluster_offset >> s->cluster_bits,
+                                       &refcount) == 0 && refcount == 0) {
+                    free_index_put(s, cluster_offset >> s->cluster_bits);
+                }
+            }
+        }
     }
 
     return ret;
@@ -971,6 +1307,36 @@ static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
     }
 
     nb_clusters = size_to_clusters(s, size);
+
+    if (!s->free_index) {
+        /* On failure, fall back to the scan below */
+        free_index_build(bs);
+    }
+    if (s->free_index) {
+        uint64_t start = free_index_pick(s->free_index, nb_clusters);
+
+        for (i = 0; i < nb_clusters; i++) {
+            ret = qcow2_get_refcount(bs, start + i, &refcount);
+            if (ret < 0) {
+                return ret;
+            } else if (refcount != 0) {
+                break;
+            }
+        }
+        if (i == nb_clusters) {
+            if (start + nb_clusters - 1 > (max >> s->cluster_bits)) {
+                return -EFBIG;
+            }
+            for (i = 0; i < nb_clusters; i++) {
+                free_index_take(s, start + i);
+            }
+            s->free_index->next = start + nb_clusters;
+            return start << s->cluster_bits;
+        }
+        /* Somebody changed refcounts without telling the index */
+        qcow2_drop_free_index(bs);
+    }
+
 retry:
     for(i = 0; i < nb_clusters; i++) {
         uint64_t next_cluster_index = s->free_cluster_index++;
@@ -1251,7 +1617,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     l2_slice = NULL;
     l1_table = NULL;
     l1_size2 = l1_size * sizeof(uint64_t);
-    slice_size2 = s->l2_slice_size * sizeof(uint64_t);
+    slice_size2 = s->l2_slice_size * l2_entry_size(s);
     n_slices = s->cluster_size / slice_size2;
 
     s->cache_discards = true;
@@ -1307,7 +1673,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                     uint64_t cluster_index;
                     uint64_t offset;
 
-                    entry = be64_to_cpu(l2_slice[j]);
+                    entry = get_l2_entry(s, l2_slice, j);
                     old_entry = entry;
                     entry &= ~QCOW_OFLAG_COPIED;
                     offset = entry & L2E_OFFSET_MASK;
@@ -1378,7 +1744,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                             qcow2_cache_set_dependency(bs, s->l2_table_cache,
                                                        s->refcount_block_cache);
                         }
-                        l2_slice[j] = cpu_to_be64(entry);
+                        set_l2_entry(s, l2_slice, j, entry);
                         qcow2_cache_entry_mark_dirty(s->l2_table_cache,
                                                      l2_slice);
                     }
@@ -1561,10 +1927,142 @@ enum {
     CHECK_FRAG_INFO = 0x2,      /* update BlockFragInfo counters */
 };
 
+/* Progress of qcow2_check_refcounts(), in L1 entries looked at */
+typedef struct Qcow2CheckProgress {
+    BlockDriverCheckStatusCB *cb;
+    void *opaque;
+    int64_t done;
+    int64_t total;
+} Qcow2CheckProgress;
+
+static void check_progress_step(BlockDriverState *bs,
+                                Qcow2CheckProgress *progress)
+{
+    progress->done++;
+    if (progress->cb) {
+        progress->cb(bs, progress->done, progress->total, progress->opaque);
+    }
+}
+
+/*
+ * The checks walk the L2 tables in L1 order, but read up to this many of
+ * them ahead of the one they look at, so that the latency of the image
+ * file is not paid for each table in turn.
+ */
+#define CHECK_L2_READAHEAD 16
+
+typedef struct CheckL2Read {
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t *table;
+    int ret;                    /* -EINPROGRESS while the read is running */
+    Coroutine *waiter;
+} CheckL2Read;
+
+typedef struct CheckL2Reader {
+    const uint64_t *l1_table;   /* in host byte order */
+    int l1_size;
+    int depth;                  /* tables read at once */
+    int issued;                 /* L1 entries whose table has been read */
+    CheckL2Read reads[CHECK_L2_READAHEAD];
+} CheckL2Reader;
+
+static void check_l2_read_entry(void *opaque)
+{
+    CheckL2Read *rd = opaque;
+    BDRVQcow2State *s = rd->bs->opaque;
+    int ret;
+
+    ret = bdrv_pread(rd->bs->file, rd->offset, rd->table,
+                     s->l2_size * l2_entry_size(s));
+    rd->ret = ret < 0 ? ret : 0;
+    if (rd->waiter) {
+        aio_co_wake(rd->waiter);
+    }
+}
+
+static void check_l2_read_wait(CheckL2Read *rd)
+{
+    while (rd->ret == -EINPROGRESS) {
+        rd->waiter = qemu_coroutine_self();
+        qemu_coroutine_yield();
+        rd->waiter = NULL;
+    }
+}
+
+/*
+ * Reads ahead only happen in coroutine context, and when @parallel:
+ * repairs may write to an L2 table that a later L1 entry points to, too.
+ */
+static void check_l2_reader_init(BlockDriverState *bs, CheckL2Reader *r,
+                                 const uint64_t *l1_table, int l1_size,
+                                 bool parallel)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+
+    *r = (CheckL2Reader) {
+        .l1_table   = l1_table,
+        .l1_size    = l1_size,
+        .depth      = parallel && qemu_in_coroutine() ? CHECK_L2_READAHEAD : 1,
+    };
+    for (i = 0; i < r->depth; i++) {
+        r->reads[i].bs = bs;
+        r->reads[i].table = g_malloc(s->l2_size * l2_entry_size(s));
+    }
+}
+
+static void check_l2_reader_cleanup(CheckL2Reader *r)
+{
+    int i;
+
+    for (i = 0; i < r->depth; i++) {
+        check_l2_read_wait(&r->reads[i]);
+        g_free(r->reads[i].table);
+    }
+}
+
+/*
+ * Returns the L2 table of L1 entry @l1_index in *@l2_table, or -errno if
+ * it could not be read.  @l1_index must not decrease between calls, but
+ * may skip entries.
+ */
+static int check_l2_reader_get(CheckL2Reader *r, int l1_index,
+                               uint64_t **l2_table)
+{
+    int end = MIN(l1_index + r->depth, r->l1_size);
+    CheckL2Read *rd;
+
+    assert(l1_index >= r->issued - r->depth);
+    while (r->issued < end) {
+        int i = r->issued++;
+
+        rd = &r->reads[i % r->depth];
+        check_l2_read_wait(rd);
+        if (!r->l1_table[i]) {
+            rd->ret = 0;
+            continue;
+        }
+        rd->offset = r->l1_table[i] & L1E_OFFSET_MASK;
+        rd->ret = -EINPROGRESS;
+        if (r->depth > 1) {
+            qemu_coroutine_enter(qemu_coroutine_create(check_l2_read_entry,
+                                                       rd));
+        } else {
+            check_l2_read_entry(rd);
+        }
+    }
+
+    rd = &r->reads[l1_index % r->depth];
+    check_l2_read_wait(rd);
+    *l2_table = rd->table;
+    return rd->ret;
+}
+
 /*
  * Increases the refcount in the given refcount table for the all clusters
- * referenced in the L2 table. While doing so, performs some checks on L2
- * entries.
+ * referenced in the L2 table at @l2_offset, whose contents the caller has
+ * read into @l2_table. While doing so, performs some checks on L2 entries.
  *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
@@ -1572,27 +2070,16 @@ enum {
 static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                               void **refcount_table,
                               int64_t *refcount_table_size, int64_t l2_offset,
-                              int flags, BdrvCheckMode fix)
+                              uint64_t *l2_table, int flags, BdrvCheckMode fix)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l2_table, l2_entry;
+    uint64_t l2_entry;
     uint64_t next_contiguous_offset = 0;
-    int i, l2_size, nb_csectors, ret;
-
-    /* Read L2 table from disk */
-    l2_size = s->l2_size * sizeof(uint64_t);
-    l2_table = g_malloc(l2_size);
-
-    ret = bdrv_pread(bs->file, l2_offset, l2_table, l2_size);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        goto fail;
-    }
+    int i, nb_csectors, ret;
 
     /* Do the actual checks */
     for(i = 0; i < s->l2_size; i++) {
-        l2_entry = be64_to_cpu(l2_table[i]);
+        l2_entry = get_l2_entry(s, l2_table, i);
 
         switch (qcow2_get_cluster_type(bs, l2_entry)) {
         case QCOW2_CLUSTER_COMPRESSED:
@@ -1620,7 +2107,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                                            refcount_table, refcount_table_size,
                                            l2_entry & ~511, nb_csectors * 512);
             if (ret < 0) {
-                goto fail;
+                return ret;
             }
 
             if (flags & CHECK_FRAG_INFO) {
@@ -1661,24 +2148,26 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                             fix & BDRV_FIX_ERRORS ? "Repairing" : "ERROR",
                             offset);
                     if (fix & BDRV_FIX_ERRORS) {
+                        int idx = i * (l2_entry_size(s) / sizeof(uint64_t));
                         uint64_t l2e_offset =
-                            l2_offset + (uint64_t)i * sizeof(uint64_t);
+                            l2_offset + (uint64_t)i * l2_entry_size(s);
 
                         l2_entry = QCOW_OFLAG_ZERO;
-                        l2_table[i] = cpu_to_be64(l2_entry);
+                        set_l2_entry(s, l2_table, i, l2_entry);
                         ret = qcow2_pre_write_overlap_check(bs,
                                 QCOW2_OL_ACTIVE_L2 | QCOW2_OL_INACTIVE_L2,
-                                l2e_offset, sizeof(uint64_t), false);
+                                l2e_offset, l2_entry_size(s), false);
                         if (ret < 0) {
                             fprintf(stderr, "ERROR: Overlap check failed\n");
                             res->check_errors++;
                             /* Something is seriously wrong, so abort checking
                              * this L2 table */
-                            goto fail;
+                            return ret;
                         }
 
                         ret = bdrv_pwrite_sync(bs->file, l2e_offset,
-                                               &l2_table[i], sizeof(uint64_t));
+                                               &l2_table[idx],
+                                               l2_entry_size(s));
                         if (ret < 0) {
                             fprintf(stderr, "ERROR: Failed to overwrite L2 "
                                     "table entry: %s\n", strerror(-ret));
@@ -1707,7 +2196,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                                                refcount_table_size,
                                                offset, s->cluster_size);
                 if (ret < 0) {
-                    goto fail;
+                    return ret;
                 }
             }
             break;
@@ -1722,12 +2211,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
-    g_free(l2_table);
     return 0;
-
-fail:
-    g_free(l2_table);
-    return ret;
 }
 
 /*
@@ -1743,10 +2227,12 @@ static int check_refcounts_l1(BlockDriverState *bs,
                               void **refcount_table,
                               int64_t *refcount_table_size,
                               int64_t l1_table_offset, int l1_size,
-                              int flags, BdrvCheckMode fix)
+                              int flags, BdrvCheckMode fix,
+                              Qcow2CheckProgress *progress)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l1_table = NULL, l2_offset, l1_size2;
+    uint64_t *l1_table = NULL, *l2_table, l2_offset, l1_size2;
+    CheckL2Reader reader;
     int i, ret;
 
     l1_size2 = l1_size * sizeof(uint64_t);
@@ -1777,7 +2263,10 @@ static int check_refcounts_l1(BlockDriverState *bs,
     }
 
     /* Do the actual checks */
+    check_l2_reader_init(bs, &reader, l1_table, l1_size,
+                         !(fix & BDRV_FIX_ERRORS));
     for(i = 0; i < l1_size; i++) {
+        check_progress_step(bs, progress);
         l2_offset = l1_table[i];
         if (l2_offset) {
             /* Mark L2 table as used */
@@ -1796,18 +2285,29 @@ static int check_refcounts_l1(BlockDriverState *bs,
                 res->corruptions++;
             }
 
+            ret = check_l2_reader_get(&reader, i, &l2_table);
+            if (ret < 0) {
+                fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+                res->check_errors++;
+                goto fail_reader;
+            }
+
             /* Process and check L2 entries */
             ret = check_refcounts_l2(bs, res, refcount_table,
-                                     refcount_table_size, l2_offset, flags,
-                                     fix);
+                                     refcount_table_size, l2_offset, l2_table,
+                                     flags, fix);
             if (ret < 0) {
-                goto fail;
+                goto fail_reader;
             }
         }
     }
+    check_l2_reader_cleanup(&reader);
     g_free(l1_table);
     return 0;
 
+fail_reader:
+    check_l2_reader_cleanup(&reader);
+
 fail:
     g_free(l1_table);
     return ret;
@@ -1822,10 +2322,11 @@ fail:
  * (qcow2_check_refcounts) by the time this function is called).
  */
 static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
-                              BdrvCheckMode fix)
+                              BdrvCheckMode fix, Qcow2CheckProgress *progress)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l2_table = qemu_blockalign(bs, s->cluster_size);
+    uint64_t *l2_table;
+    CheckL2Reader reader;
     int ret;
     uint64_t refcount;
     int i, j;
@@ -1843,11 +2344,13 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
         repair = false;
     }
 
+    check_l2_reader_init(bs, &reader, s->l1_table, s->l1_size, !repair);
     for (i = 0; i < s->l1_size; i++) {
         uint64_t l1_entry = s->l1_table[i];
         uint64_t l2_offset = l1_entry & L1E_OFFSET_MASK;
         bool l2_dirty = false;
 
+        check_progress_step(bs, progress);
         if (!l2_offset) {
             continue;
         }
@@ -1877,8 +2380,7 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
             }
         }
 
-        ret = bdrv_pread(bs->file, l2_offset, l2_table,
-                         s->l2_size * sizeof(uint64_t));
+        ret = check_l2_reader_get(&reader, i, &l2_table);
         if (ret < 0) {
             fprintf(stderr, "ERROR: Could not read L2 table: %s\n",
                     strerror(-ret));
@@ -1887,7 +2389,7 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
         }
 
         for (j = 0; j < s->l2_size; j++) {
-            uint64_t l2_entry = be64_to_cpu(l2_table[j]);
+            uint64_t l2_entry = get_l2_entry(s, l2_table, j);
             uint64_t data_offset = l2_entry & L2E_OFFSET_MASK;
             QCow2ClusterType cluster_type = qcow2_get_cluster_type(bs, l2_entry);
 
@@ -1909,9 +2411,9 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
                             "l2_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
                             repair ? "Repairing" : "ERROR", l2_entry, refcount);
                     if (repair) {
-                        l2_table[j] = cpu_to_be64(refcount == 1
-                                    ? l2_entry |  QCOW_OFLAG_COPIED
-                                    : l2_entry & ~QCOW_OFLAG_COPIED);
+                        set_l2_entry(s, l2_table, j, refcount == 1
+                                     ? l2_entry |  QCOW_OFLAG_COPIED
+                                     : l2_entry & ~QCOW_OFLAG_COPIED);
                         l2_dirty = true;
                         res->corruptions_fixed++;
                     } else {
@@ -1946,7 +2448,7 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
     ret = 0;
 
 fail:
-    qemu_vfree(l2_table);
+    check_l2_reader_cleanup(&reader);
     return ret;
 }
 
@@ -2063,7 +2565,8 @@ resize_fail:
  */
 static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
                                BdrvCheckMode fix, bool *rebuild,
-                               void **refcount_table, int64_t *nb_clusters)
+                               void **refcount_table, int64_t *nb_clusters,
+                               Qcow2CheckProgress *progress)
 {
     BDRVQcow2State *s = bs->opaque;
     int64_t i;
@@ -2090,7 +2593,7 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     /* current L1 table */
     ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
                              s->l1_table_offset, s->l1_size, CHECK_FRAG_INFO,
-                             fix);
+                             fix, progress);
     if (ret < 0) {
         return ret;
     }
@@ -2119,7 +2622,8 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
             continue;
         }
         ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
-                                 sn->l1_table_offset, sn->l1_size, 0, fix);
+                                 sn->l1_table_offset, sn->l1_size, 0, fix,
+                                 progress);
         if (ret < 0) {
             return ret;
         }
@@ -2148,6 +2652,15 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
+    /* metadata journal */
+    if (s->journal_offset) {
+        ret = qcow2_inc_refcounts_imrt(bs, res, refcount_table, nb_clusters,
+                                       s->journal_offset, s->journal_size);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
     /* bitmaps */
     ret = qcow2_check_bitmaps_refcounts(bs, res, refcount_table, nb_clusters);
     if (ret < 0) {
@@ -2498,14 +3011,33 @@ fail:
  * Returns 0 if no errors are found, the number of errors in case the image is
  * detected as corrupted, and -errno when an internal error occurred.
  */
+/* The L1 entries that calculate_refcounts() looks at */
+static int64_t calculate_refcounts_work(BDRVQcow2State *s)
+{
+    int64_t work = s->l1_size;
+    int i;
+
+    for (i = 0; i < s->nb_snapshots; i++) {
+        work += s->snapshots[i].l1_size;
+    }
+    return work;
+}
+
 int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
-                          BdrvCheckMode fix)
+                          BdrvCheckMode fix,
+                          BlockDriverCheckStatusCB *status_cb, void *cb_opaque)
 {
     BDRVQcow2State *s = bs->opaque;
     BdrvCheckResult pre_compare_res;
     int64_t size, highest_cluster, nb_clusters;
     void *refcount_table = NULL;
     bool rebuild = false;
+    Qcow2CheckProgress progress = {
+        .cb     = status_cb,
+        .opaque = cb_opaque,
+        /* and check_oflag_copied() goes over the active L1 table again */
+        .total  = calculate_refcounts_work(s) + s->l1_size,
+    };
     int ret;
 
     size = bdrv_getlength(bs->file->bs);
@@ -2524,7 +3056,7 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
         size_to_clusters(s, bs->total_sectors * BDRV_SECTOR_SIZE);
 
     ret = calculate_refcounts(bs, res, fix, &rebuild, &refcount_table,
-                              &nb_clusters);
+                              &nb_clusters, &progress);
     if (ret < 0) {
         goto fail;
     }
@@ -2554,8 +3086,9 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
          * references have to be recalculated */
         rebuild = false;
         memset(refcount_table, 0, refcount_array_byte_size(s, nb_clusters));
+        progress.total += calculate_refcounts_work(s);
         ret = calculate_refcounts(bs, res, 0, &rebuild, &refcount_table,
-                                  &nb_clusters);
+                                  &nb_clusters, &progress);
         if (ret < 0) {
             goto fail;
         }
@@ -2604,7 +3137,7 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     }
 
     /* check OFLAG_COPIED */
-    ret = check_oflag_copied(bs, res, fix);
+    ret = check_oflag_copied(bs, res, fix, &progress);
     if (ret < 0) {
         goto fail;
     }
@@ -2613,6 +3146,10 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     ret = 0;
 
 fail:
+    if (fix) {
+        /* Repairs rewrite refcounts directly */
+        qcow2_drop_free_index(bs);
+    }
     g_free(refcount_table);
 
     return ret;
@@ -3254,6 +3791,7 @@ done:
         }
     }
 
+    qcow2_drop_free_index(bs);
     qemu_vfree(new_refblock);
     return ret;
 }
@@ -3314,6 +3852,7 @@ static int qcow2_discard_refcount_block(BlockDriverState *bs,
         return -EINVAL;
     }
     s->set_refcount(refblock, block_index, 0);
+    free_index_put(s, cluster_index);
 
     qcow2_cache_entry_mark_dirty(s->refcount_block_cache, refblock);
 
@@ -74,13 +74,112 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_CRYPTO_HEADER 0x0537be77
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
 #define  QCOW2_EXT_MAGIC_DATA_FILE 0x44415441
+#define  QCOW2_EXT_MAGIC_JOURNAL 0x6a726e6c
+
+#define MAX_COMPRESS_THREADS 4
+
+/* Reads that start where the previous one ended before a stream is assumed */
+#define SEQUENTIAL_READS 3
+
+/* Largest backing-readahead-size */
+#define MAX_BACKING_READAHEAD (64 * MiB)
 
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t file_cluster_offset,
                            uint64_t offset,
                            uint64_t bytes,
-                           QEMUIOVector *qiov);
+                           QEMUIOVector *qiov,
+                           size_t qiov_offset);
+
+static int coroutine_fn
+qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
+                                 uint64_t offset, uint64_t bytes,
+                                 QEMUIOVector *qiov, size_t qiov_offset);
+
+/*
+ * Compressed clusters are processed one coroutine per cluster, so that the
+ * (de)compression of several clusters of a single request can run in
+ * parallel in the thread pool.  At most MAX_COMPRESS_THREADS of them are in
+ * flight for each request.
+ */
+typedef struct Qcow2CompressedIO {
+    BlockDriverState *bs;
+    Coroutine *waiter;
+    int in_flight;
+    int ret;
+} Qcow2CompressedIO;
+
+typedef struct Qcow2CompressedTask {
+    Qcow2CompressedIO *cio;
+    bool is_write;
+    uint64_t file_cluster_offset;
+    uint64_t offset;
+    uint64_t bytes;
+    QEMUIOVector *qiov;
+    size_t qiov_offset;
+} Qcow2CompressedTask;
+
+static void coroutine_fn qcow2_compressed_task_entry(void *opaque)
+{
+    Qcow2CompressedTask *t = opaque;
+    Qcow2CompressedIO *cio = t->cio;
+    int ret;
+
+    if (t->is_write) {
+        ret = qcow2_co_pwritev_compressed_part(cio->bs, t->offset, t->bytes,
+                                               t->qiov, t->qiov_offset);
+    } else {
+        ret = qcow2_co_preadv_compressed(cio->bs, t->file_cluster_offset,
+                                         t->offset, t->bytes,
+                                         t->qiov, t->qiov_offset);
+    }
+    if (ret < 0 && cio->ret == 0) {
+        cio->ret = ret;
+    }
+    g_free(t);
+
+    cio->in_flight--;
+    if (cio->waiter) {
+        Coroutine *co = cio->waiter;
+        cio->waiter = NULL;
+        aio_co_wake(co);
+    }
+}
+
+/* Wait until no more than @limit tasks of @cio are in flight */
+static void coroutine_fn qcow2_compressed_io_wait(Qcow2CompressedIO *cio,
+                                                  int limit)
+{
+    while (cio->in_flight > limit) {
+        cio->waiter = qemu_coroutine_self();
+        qemu_coroutine_yield();
+    }
+}
+
+static void coroutine_fn
+qcow2_compressed_io_start(Qcow2CompressedIO *cio, bool is_write,
+                          uint64_t file_cluster_offset,
+                          uint64_t offset, uint64_t bytes,
+                          QEMUIOVector *qiov, size_t qiov_offset)
+{
+    Qcow2CompressedTask *t = g_new(Qcow2CompressedTask, 1);
+
+    *t = (Qcow2CompressedTask) {
+        .cio                    = cio,
+        .is_write               = is_write,
+        .file_cluster_offset    = file_cluster_offset,
+        .offset                 = offset,
+        .bytes                  = bytes,
+        .qiov                   = qiov,
+        .qiov_offset            = qiov_offset,
+    };
+
+    qcow2_compressed_io_wait(cio, MAX_COMPRESS_THREADS - 1);
+    cio->in_flight++;
+    qemu_coroutine_enter(qemu_coroutine_create(qcow2_compressed_task_entry,
+                                               t));
+}
 
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -413,6 +512,65 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             break;
         }
 
+        case QCOW2_EXT_MAGIC_JOURNAL:
+        {
+            Qcow2JournalHeaderExt journal_ext;
+
+            if (ext.len != sizeof(journal_ext)) {
+                error_setg(errp, "journal_ext: Invalid extension length");
+                return -EINVAL;
+            }
+
+            if (!(s->autoclear_features & QCOW2_AUTOCLEAR_JOURNAL)) {
+                warn_report("a program lacking metadata journal support "
+                            "modified this file, so its journal is dropped");
+                error_printf("Some clusters may be leaked, "
+                             "run 'qemu-img check -r' on the image "
+                             "file to fix.");
+                if (need_update_header != NULL) {
+                    /* Updating is needed to drop the journal extension. */
+                    *need_update_header = true;
+                }
+                break;
+            }
+
+            ret = bdrv_pread(bs->file, offset, &journal_ext, ext.len);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "journal_ext: "
+                                 "Could not read ext header");
+                return ret;
+            }
+
+            be64_to_cpus(&journal_ext.journal_offset);
+            be64_to_cpus(&journal_ext.journal_size);
+            be64_to_cpus(&journal_ext.generation);
+
+            if (journal_ext.journal_size == 0 ||
+                offset_into_cluster(s, journal_ext.journal_size) != 0) {
+                error_setg(errp, "journal_ext: Invalid journal size");
+                return -EINVAL;
+            }
+
+            ret = qcow2_validate_table(bs, journal_ext.journal_offset,
+                                       journal_ext.journal_size, 1,
+                                       QCOW2_MAX_JOURNAL_SIZE,
+                                       "Metadata journal", errp);
+            if (ret < 0) {
+                return ret;
+            }
+
+            s->journal_offset = journal_ext.journal_offset;
+            s->journal_size = journal_ext.journal_size;
+            s->journal_generation = journal_ext.generation;
+
+#ifdef DEBUG_EXT
+            printf("Qcow2: Got metadata journal extension: "
+                   "offset=%" PRIu64 " size=%" PRIu64 "\n",
+                   s->journal_offset, s->journal_size);
+#endif
+            break;
+        }
+
         default:
             /* unknown magic - save it in case we need to rewrite the header */
             /* If you add a new feature, make sure to also update the fast
@@ -572,11 +730,25 @@ int qcow2_mark_consistent(BlockDriverState *bs)
     return 0;
 }
 
-static int coroutine_fn qcow2_co_check_locked(BlockDriverState *bs,
-                                              BdrvCheckResult *result,
-                                              BdrvCheckMode fix)
+static int coroutine_fn
+qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
+                      BdrvCheckMode fix, BlockDriverCheckStatusCB *status_cb,
+                      void *cb_opaque)
 {
-    int ret = qcow2_check_refcounts(bs, result, fix);
+    int ret;
+
+    /* Repairing writes tables directly, which the journal must not undo */
+    if (fix) {
+        ret = qcow2_journal_suspend(bs);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    ret = qcow2_check_refcounts(bs, result, fix, status_cb, cb_opaque);
+    if (fix) {
+        qcow2_journal_resume(bs);
+    }
     if (ret < 0) {
         return ret;
     }
@@ -593,13 +765,15 @@ static int coroutine_fn qcow2_co_check_locked(BlockDriverState *bs,
 
 static int coroutine_fn qcow2_co_check(BlockDriverState *bs,
                                        BdrvCheckResult *result,
-                                       BdrvCheckMode fix)
+                                       BdrvCheckMode fix,
+                                       BlockDriverCheckStatusCB *status_cb,
+                                       void *cb_opaque)
 {
     BDRVQcow2State *s = bs->opaque;
     int ret;
 
     qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_co_check_locked(bs, result, fix);
+    ret = qcow2_co_check_locked(bs, result, fix, status_cb, cb_opaque);
     qemu_co_mutex_unlock(&s->lock);
     return ret;
 }
@@ -759,6 +933,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_BACKING_READAHEAD_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Data to read ahead from the backing file for sequential "
+                    "reads",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -831,7 +1011,8 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     bool l2_cache_entry_size_set;
     int min_refcount_cache = MIN_REFCOUNT_CACHE_SIZE * s->cluster_size;
     uint64_t virtual_disk_size = bs->total_sectors * BDRV_SECTOR_SIZE;
-    uint64_t max_l2_cache = virtual_disk_size / (s->cluster_size / 8);
+    uint64_t max_l2_cache =
+        virtual_disk_size / (s->cluster_size / l2_entry_size(s));
 
     combined_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_CACHE_SIZE);
     l2_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_L2_CACHE_SIZE);
@@ -914,6 +1095,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    uint64_t backing_readahead_size;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -991,7 +1173,15 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         }
     }
 
-    r->l2_slice_size = l2_cache_entry_size / sizeof(uint64_t);
+    /* The new caches may not fit into the metadata journal any more */
+    ret = qcow2_journal_checkpoint(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to checkpoint the metadata "
+                         "journal");
+        goto fail;
+    }
+
+    r->l2_slice_size = l2_cache_entry_size / l2_entry_size(s);
     r->l2_table_cache = qcow2_cache_create(bs, l2_cache_size,
                                            l2_cache_entry_size);
     r->refcount_block_cache = qcow2_cache_create(bs, refcount_cache_size,
@@ -1020,6 +1210,15 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->backing_readahead_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_BACKING_READAHEAD_SIZE, 0);
+    if (r->backing_readahead_size > MAX_BACKING_READAHEAD) {
+        error_setg(errp, QCOW2_OPT_BACKING_READAHEAD_SIZE
+                   " must be at most 64 MiB");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1160,6 +1359,8 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     s->overlap_check = r->overlap_check;
     s->use_lazy_refcounts = r->use_lazy_refcounts;
 
+    qcow2_journal_update_active(bs);
+
     for (i = 0; i < QCOW2_DISCARD_MAX; i++) {
         s->discard_passthrough[i] = r->discard_passthrough[i];
     }
@@ -1170,6 +1371,13 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    if (s->backing_readahead_size != r->backing_readahead_size) {
+        qemu_vfree(s->readahead_buf);
+        s->readahead_buf = NULL;
+        s->readahead_bytes = 0;
+        s->backing_readahead_size = r->backing_readahead_size;
+    }
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1381,7 +1589,26 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         bs->encrypted = true;
     }
 
-    s->l2_bits = s->cluster_bits - 3; /* L2 is always one cluster */
+    s->subclusters_per_cluster =
+        has_subclusters(s) ? QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER : 1;
+    s->subcluster_size = s->cluster_size / s->subclusters_per_cluster;
+    s->subcluster_bits = ctz32(s->subcluster_size);
+
+    if (s->subcluster_size < (1 << MIN_CLUSTER_BITS)) {
+        error_setg(errp, "Unsupported subcluster size: %d", s->subcluster_size);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    if (has_subclusters(s) && (flags & BDRV_O_RDWR)) {
+        error_setg(errp, "Images with extended L2 entries can only be opened "
+                   "read-only");
+        ret = -ENOTSUP;
+        goto fail;
+    }
+
+    /* L2 is always one cluster */
+    s->l2_bits = s->cluster_bits - ctz32(l2_entry_size(s));
     s->l2_size = 1 << s->l2_bits;
     /* 2^(s->refcount_order - 3) is the refcount width in bytes */
     s->refcount_block_bits = s->cluster_bits - (s->refcount_order - 3);
@@ -1588,6 +1815,12 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         goto fail;
     }
 
+    /* Replay the metadata journal before anything reads tables */
+    ret = qcow2_journal_open(bs, flags, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
     /* Clear unknown autoclear feature bits */
     update_header |= s->autoclear_features & ~QCOW2_AUTOCLEAR_MASK;
     update_header =
@@ -1682,7 +1915,8 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         BdrvCheckResult result = {0};
 
         ret = qcow2_co_check_locked(bs, &result,
-                                    BDRV_FIX_ERRORS | BDRV_FIX_LEAKS);
+                                    BDRV_FIX_ERRORS | BDRV_FIX_LEAKS,
+                                    NULL, NULL);
         if (ret < 0 || result.check_errors) {
             if (ret >= 0) {
                 ret = -EIO;
@@ -1695,7 +1929,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
 #ifdef DEBUG_ALLOC
     {
         BdrvCheckResult result = {0};
-        qcow2_check_refcounts(bs, &result, 0);
+        qcow2_check_refcounts(bs, &result, 0, NULL, NULL);
     }
 #endif
 
@@ -1711,6 +1945,8 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
     qcow2_free_snapshots(bs);
+    qcow2_free_durable_bitmaps(bs);
+    qcow2_journal_close(bs);
     qcow2_refcount_close(bs);
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
@@ -1792,9 +2028,22 @@ static void qcow2_refresh_limits(BlockDriverState *bs, Error **errp)
 static int qcow2_reopen_prepare(BDRVReopenState *state,
                                 BlockReopenQueue *queue, Error **errp)
 {
+    BDRVQcow2State *s = state->bs->opaque;
     Qcow2ReopenState *r;
     int ret;
 
+    if (has_subclusters(s) && (state->flags & BDRV_O_RDWR)) {
+        error_setg(errp, "Images with extended L2 entries can only be opened "
+                   "read-only");
+        return -ENOTSUP;
+    }
+
+    if (s->journal_needs_replay && (state->flags & BDRV_O_RDWR)) {
+        error_setg(errp, "The metadata journal of this image needs to be "
+                   "replayed; open it read-write to do so");
+        return -ENOTSUP;
+    }
+
     r = g_new0(Qcow2ReopenState, 1);
     state->opaque = r;
 
@@ -1960,6 +2209,117 @@ out:
     return ret;
 }
 
+typedef struct Qcow2L2Prefetch {
+    BlockDriverState *bs;
+    uint64_t offset;
+} Qcow2L2Prefetch;
+
+static void coroutine_fn qcow2_l2_prefetch_entry(void *opaque)
+{
+    Qcow2L2Prefetch *p = opaque;
+    BlockDriverState *bs = p->bs;
+    BDRVQcow2State *s = bs->opaque;
+
+    qemu_co_mutex_lock(&s->lock);
+    /* An error will show again when a request gets there */
+    qcow2_prefetch_l2_slice(bs, p->offset);
+    s->l2_prefetch_in_flight = false;
+    qemu_co_mutex_unlock(&s->lock);
+
+    bdrv_dec_in_flight(bs);
+    g_free(p);
+}
+
+/*
+ * Sequential reads that have got to @offset load the L2 slices one after
+ * the other; fetch the next one in the background before they need it.
+ * Called with s->lock held.
+ */
+static void qcow2_prefetch_next_l2(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes = (uint64_t) s->l2_slice_size << s->cluster_bits;
+    uint64_t next = QEMU_ALIGN_DOWN(offset, slice_bytes) + slice_bytes;
+    Qcow2L2Prefetch *p;
+
+    if (next >= bs->total_sectors * BDRV_SECTOR_SIZE ||
+        next == s->l2_prefetch_offset || s->l2_prefetch_in_flight) {
+        return;
+    }
+
+    s->l2_prefetch_offset = next;
+    s->l2_prefetch_in_flight = true;
+    p = g_new(Qcow2L2Prefetch, 1);
+    *p = (Qcow2L2Prefetch) { .bs = bs, .offset = next };
+    bdrv_inc_in_flight(bs);
+    aio_co_schedule(bdrv_get_aio_context(bs),
+                    qemu_coroutine_create(qcow2_l2_prefetch_entry, p));
+}
+
+/*
+ * Read unallocated clusters from the backing file.  A sequential reader
+ * also gets the data that follows, up to backing-readahead-size, kept in
+ * s->readahead_buf for the reads after it.  The buffer is only used for
+ * clusters that are still unallocated when they are read, so writes to
+ * this image never make it stale.  Called with s->lock held, which is
+ * dropped while reading.
+ */
+static int coroutine_fn qcow2_co_read_backing(BlockDriverState *bs,
+                                              uint64_t offset, uint64_t bytes,
+                                              QEMUIOVector *qiov,
+                                              bool sequential)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QEMUIOVector ra_qiov;
+    uint64_t len;
+    unsigned gen;
+    int ret;
+
+    if (s->readahead_bytes && offset >= s->readahead_offset &&
+        offset + bytes <= s->readahead_offset + s->readahead_bytes) {
+        qemu_iovec_from_buf(qiov, 0,
+                            s->readahead_buf + (offset - s->readahead_offset),
+                            bytes);
+        return 0;
+    }
+
+    BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
+    if (sequential && bytes < s->backing_readahead_size &&
+        !s->readahead_in_flight && !s->readahead_buf) {
+        s->readahead_buf = qemu_try_blockalign(bs->backing->bs,
+                                               s->backing_readahead_size);
+    }
+    if (!sequential || bytes >= s->backing_readahead_size ||
+        s->readahead_in_flight || !s->readahead_buf) {
+        qemu_co_mutex_unlock(&s->lock);
+        ret = bdrv_co_preadv(bs->backing, offset, bytes, qiov, 0);
+        qemu_co_mutex_lock(&s->lock);
+        return ret;
+    }
+
+    len = MIN(s->backing_readahead_size,
+              bs->total_sectors * BDRV_SECTOR_SIZE - offset);
+    gen = s->readahead_gen;
+    s->readahead_bytes = 0;
+    s->readahead_in_flight = true;
+    qemu_iovec_init_buf(&ra_qiov, s->readahead_buf, len);
+
+    qemu_co_mutex_unlock(&s->lock);
+    ret = bdrv_co_preadv(bs->backing, offset, len, &ra_qiov, 0);
+    qemu_co_mutex_lock(&s->lock);
+
+    s->readahead_in_flight = false;
+    if (ret < 0) {
+        return ret;
+    }
+    qemu_iovec_from_buf(qiov, 0, s->readahead_buf, bytes);
+    if (gen == s->readahead_gen) {
+        s->readahead_offset = offset;
+        s->readahead_bytes = len;
+    }
+    return 0;
+}
+
 static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
                                         uint64_t bytes, QEMUIOVector *qiov,
                                         int flags)
@@ -1972,11 +2332,17 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
     uint64_t bytes_done = 0;
     QEMUIOVector hd_qiov;
     uint8_t *cluster_data = NULL;
+    Qcow2CompressedIO cio = { .bs = bs };
+    bool sequential;
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
     qemu_co_mutex_lock(&s->lock);
 
+    s->seq_reads = offset == s->seq_read_end ? s->seq_reads + 1 : 0;
+    s->seq_read_end = offset + bytes;
+    sequential = s->seq_reads >= SEQUENTIAL_READS;
+
     while (bytes != 0) {
 
         /* prepare next request */
@@ -2000,11 +2366,8 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
         case QCOW2_CLUSTER_UNALLOCATED:
 
             if (bs->backing) {
-                BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
-                qemu_co_mutex_unlock(&s->lock);
-                ret = bdrv_co_preadv(bs->backing, offset, cur_bytes,
-                                     &hd_qiov, 0);
-                qemu_co_mutex_lock(&s->lock);
+                ret = qcow2_co_read_backing(bs, offset, cur_bytes, &hd_qiov,
+                                            sequential);
                 if (ret < 0) {
                     goto fail;
                 }
@@ -2021,11 +2384,11 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
 
         case QCOW2_CLUSTER_COMPRESSED:
             qemu_co_mutex_unlock(&s->lock);
-            ret = qcow2_co_preadv_compressed(bs, cluster_offset,
-                                             offset, cur_bytes,
-                                             &hd_qiov);
+            qcow2_compressed_io_start(&cio, false, cluster_offset,
+                                      offset, cur_bytes, qiov, bytes_done);
             qemu_co_mutex_lock(&s->lock);
-            if (ret < 0) {
+            if (cio.ret < 0) {
+                ret = cio.ret;
                 goto fail;
             }
 
@@ -2097,11 +2460,21 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
         offset += cur_bytes;
         bytes_done += cur_bytes;
     }
+
+    if (sequential) {
+        qcow2_prefetch_next_l2(bs, offset);
+    }
     ret = 0;
 
 fail:
     qemu_co_mutex_unlock(&s->lock);
 
+    /* The compressed clusters may still be in flight */
+    qcow2_compressed_io_wait(&cio, 0);
+    if (ret == 0) {
+        ret = cio.ret;
+    }
+
     qemu_iovec_destroy(&hd_qiov);
     qemu_vfree(cluster_data);
 
@@ -2121,6 +2494,11 @@ static bool merge_cow(uint64_t offset, unsigned bytes,
             continue;
         }
 
+        /* If COW regions are handled already, skip this too */
+        if (m->skip_cow) {
+            continue;
+        }
+
         /* The data (middle) region must be immediately after the
          * start region */
         if (l2meta_cow_start(m) + m->cow_start.nb_bytes != offset) {
@@ -2146,6 +2524,88 @@ static bool merge_cow(uint64_t offset, unsigned bytes,
     return false;
 }
 
+static bool is_unallocated(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    int64_t nr;
+    return !bytes ||
+        (!bdrv_is_allocated_above(bs, NULL, offset, bytes, &nr) && nr == bytes);
+}
+
+static bool is_zero_cow(BlockDriverState *bs, QCowL2Meta *m)
+{
+    /*
+     * This check is designed for optimization shortcut so it must be
+     * efficient.
+     * Instead of is_zero(), use is_unallocated() as it is faster (but not
+     * as accurate and can result in false negatives).
+     */
+    return is_unallocated(bs, m->offset + m->cow_start.offset,
+                          m->cow_start.nb_bytes) &&
+           is_unallocated(bs, m->offset + m->cow_end.offset,
+                          m->cow_end.nb_bytes);
+}
+
+/*
+ * If the COW regions of a new allocation would only copy zeroes, write
+ * zeroes to the whole allocated area instead.  This replaces reading and
+ * writing bounce buffers with a single (usually metadata-only) operation
+ * on the host.  Must be called without s->lock held, as checking the
+ * allocation status of the image takes it.
+ */
+static int coroutine_fn handle_alloc_space(BlockDriverState *bs,
+                                           QCowL2Meta *l2meta)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QCowL2Meta *m;
+
+    if (!(s->data_file->bs->supported_zero_flags & BDRV_REQ_NO_FALLBACK)) {
+        return 0;
+    }
+
+    if (bs->encrypted) {
+        return 0;
+    }
+
+    for (m = l2meta; m != NULL; m = m->next) {
+        int ret;
+
+        if (!m->cow_start.nb_bytes && !m->cow_end.nb_bytes) {
+            continue;
+        }
+
+        if (!is_zero_cow(bs, m)) {
+            continue;
+        }
+
+        /*
+         * instead of writing zero COW buffers,
+         * efficiently zero out the whole clusters
+         */
+
+        ret = qcow2_pre_write_overlap_check(bs, 0, m->alloc_offset,
+                                            m->nb_clusters * s->cluster_size,
+                                            true);
+        if (ret < 0) {
+            return ret;
+        }
+
+        BLKDBG_EVENT(bs->file, BLKDBG_CLUSTER_ALLOC_SPACE);
+        ret = bdrv_co_pwrite_zeroes(s->data_file, m->alloc_offset,
+                                    m->nb_clusters * s->cluster_size,
+                                    BDRV_REQ_NO_FALLBACK);
+        if (ret < 0) {
+            if (ret != -ENOTSUP && ret != -EAGAIN) {
+                return ret;
+            }
+            continue;
+        }
+
+        trace_qcow2_skip_cow(qemu_coroutine_self(), m->offset, m->nb_clusters);
+        m->skip_cow = true;
+    }
+    return 0;
+}
+
 static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                          uint64_t bytes, QEMUIOVector *qiov,
                                          int flags)
@@ -2166,6 +2626,12 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* The bitmaps in the image must have the area dirty before it is */
+    ret = qcow2_co_persist_dirty_bitmaps(bs, offset, bytes);
+    if (ret < 0) {
+        goto fail;
+    }
+
     while (bytes != 0) {
 
         l2meta = NULL;
@@ -2226,23 +2692,34 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
             goto fail;
         }
 
+        /* The new clusters are tracked in s->cluster_allocs, so overlapping
+         * requests wait for us and the lock can be dropped for the I/O. */
+        qemu_co_mutex_unlock(&s->lock);
+
+        /* Try to efficiently initialize the physical space with zeroes */
+        ret = handle_alloc_space(bs, l2meta);
+        if (ret < 0) {
+            qemu_co_mutex_lock(&s->lock);
+            goto fail;
+        }
+
         /* If we need to do COW, check if it's possible to merge the
          * writing of the guest data together with that of the COW regions.
          * If it's not possible (or not necessary) then write the
          * guest data now. */
         if (!merge_cow(offset, cur_bytes, &hd_qiov, l2meta)) {
-            qemu_co_mutex_unlock(&s->lock);
             BLKDBG_EVENT(bs->file, BLKDBG_WRITE_AIO);
             trace_qcow2_writev_data(qemu_coroutine_self(),
                                     cluster_offset + offset_in_cluster);
             ret = bdrv_co_pwritev(s->data_file,
                                   cluster_offset + offset_in_cluster,
                                   cur_bytes, &hd_qiov, 0);
-            qemu_co_mutex_lock(&s->lock);
             if (ret < 0) {
+                qemu_co_mutex_lock(&s->lock);
                 goto fail;
             }
         }
+        qemu_co_mutex_lock(&s->lock);
 
         ret = qcow2_handle_l2meta(bs, &l2meta, true);
         if (ret) {
@@ -2296,6 +2773,15 @@ static int qcow2_inactivate(BlockDriverState *bs)
                      strerror(-ret));
     }
 
+    if (result == 0) {
+        ret = qcow2_journal_checkpoint(bs);
+        if (ret) {
+            result = ret;
+            error_report("Failed to checkpoint the metadata journal: %s",
+                         strerror(-ret));
+        }
+    }
+
     if (result == 0) {
         qcow2_mark_clean(bs);
     }
@@ -2303,6 +2789,15 @@ static int qcow2_inactivate(BlockDriverState *bs)
     return result;
 }
 
+static void coroutine_fn qcow2_co_drain_begin(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    /* The backing chain may change while we are drained */
+    s->readahead_bytes = 0;
+    s->readahead_gen++;
+}
+
 static void qcow2_close(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -2317,6 +2812,8 @@ static void qcow2_close(BlockDriverState *bs)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qemu_vfree(s->readahead_buf);
+    s->readahead_buf = NULL;
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -2332,6 +2829,8 @@ static void qcow2_close(BlockDriverState *bs)
         bdrv_unref_child(bs, s->data_file);
     }
 
+    qcow2_free_durable_bitmaps(bs);
+    qcow2_journal_close(bs);
     qcow2_refcount_close(bs);
     qcow2_free_snapshots(bs);
 }
@@ -2583,6 +3082,23 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /* Metadata journal */
+    if (s->journal_offset) {
+        Qcow2JournalHeaderExt journal_header = {
+            .journal_offset = cpu_to_be64(s->journal_offset),
+            .journal_size   = cpu_to_be64(s->journal_size),
+            .generation     = cpu_to_be64(s->journal_generation),
+        };
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_JOURNAL,
+                             &journal_header, sizeof(journal_header),
+                             buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
     /* Keep unknown header extensions */
     QLIST_FOREACH(uext, &s->unknown_header_ext, next) {
         ret = header_ext_add(buf, uext->magic, uext->data, uext->len, buflen);
@@ -3033,6 +3549,13 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         goto out;
     }
 
+    if (qcow2_opts->has_journal_size && version < 3) {
+        error_setg(errp, "Metadata journal only supported with compatibility "
+                   "level 1.1 and above (use version=v3 or greater)");
+        ret = -EINVAL;
+        goto out;
+    }
+
     if (!qcow2_opts->has_refcount_bits) {
         qcow2_opts->refcount_bits = 16;
     }
@@ -3191,6 +3714,14 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         goto out;
     }
 
+    /* Want a metadata journal? There you go. */
+    if (qcow2_opts->has_journal_size) {
+        ret = qcow2_journal_create(blk_bs(blk), qcow2_opts->journal_size, errp);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
     /* Okay, now that we have a valid image, let's give it the right size */
     ret = blk_truncate(blk, qcow2_opts->size, qcow2_opts->preallocation, errp);
     if (ret < 0) {
@@ -3307,6 +3838,7 @@ static int coroutine_fn qcow2_co_create_opts(const char *filename, QemuOpts *opt
         { BLOCK_OPT_ENCRYPT,            BLOCK_OPT_ENCRYPT_FORMAT },
         { BLOCK_OPT_COMPAT_LEVEL,       "version" },
         { BLOCK_OPT_DATA_FILE_RAW,      "data-file-raw" },
+        { BLOCK_OPT_JOURNAL_SIZE,       "journal-size" },
         { NULL, NULL },
     };
 
@@ -3450,6 +3982,12 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
 
     trace_qcow2_pwrite_zeroes(qemu_coroutine_self(), offset, bytes);
 
+    ret = qcow2_co_persist_dirty_bitmaps(bs, offset, bytes);
+    if (ret < 0) {
+        qemu_co_mutex_unlock(&s->lock);
+        return ret;
+    }
+
     /* Whatever is left can use real zero clusters */
     ret = qcow2_cluster_zeroize(bs, offset, bytes, flags);
     qemu_co_mutex_unlock(&s->lock);
@@ -3474,8 +4012,11 @@ static coroutine_fn int qcow2_co_pdiscard(BlockDriverState *bs,
     }
 
     qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_cluster_discard(bs, offset, bytes, QCOW2_DISCARD_REQUEST,
-                                false);
+    ret = qcow2_co_persist_dirty_bitmaps(bs, offset, bytes);
+    if (ret == 0) {
+        ret = qcow2_cluster_discard(bs, offset, bytes, QCOW2_DISCARD_REQUEST,
+                                    false);
+    }
     qemu_co_mutex_unlock(&s->lock);
     return ret;
 }
@@ -3583,6 +4124,11 @@ qcow2_co_copy_range_to(BlockDriverState *bs,
 
     qemu_co_mutex_lock(&s->lock);
 
+    ret = qcow2_co_persist_dirty_bitmaps(bs, dst_offset, bytes);
+    if (ret < 0) {
+        goto fail;
+    }
+
     while (bytes != 0) {
 
         l2meta = NULL;
@@ -3676,6 +4222,13 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
         goto fail;
     }
 
+    /* The bitmaps are resized in memory only, store them in full on close */
+    ret = qcow2_drop_durable_bitmaps(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to mark bitmaps in use");
+        goto fail;
+    }
+
     old_length = bs->total_sectors * BDRV_SECTOR_SIZE;
     new_l1_size = size_to_l1(s, offset);
 
@@ -4001,8 +4554,6 @@ static ssize_t qcow2_decompress(void *dest, size_t dest_size,
     return ret;
 }
 
-#define MAX_COMPRESS_THREADS 4
-
 typedef ssize_t (*Qcow2CompressFunc)(void *dest, size_t dest_size,
                                      const void *src, size_t src_size);
 typedef struct Qcow2CompressData {
@@ -4084,46 +4635,26 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
 /* XXX: put compressed sectors first, then all the cluster aligned
    tables to avoid losing bytes in alignment */
 static coroutine_fn int
-qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
-                            uint64_t bytes, QEMUIOVector *qiov)
+qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
+                                 uint64_t offset, uint64_t bytes,
+                                 QEMUIOVector *qiov, size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
     QEMUIOVector hd_qiov;
     int ret;
-    size_t out_len;
+    ssize_t out_len;
     uint8_t *buf, *out_buf;
     uint64_t cluster_offset;
 
-    if (has_data_file(bs)) {
-        return -ENOTSUP;
-    }
-
-    if (bytes == 0) {
-        /* align end of file to a sector boundary to ease reading with
-           sector based I/Os */
-        int64_t len = bdrv_getlength(bs->file->bs);
-        if (len < 0) {
-            return len;
-        }
-        return bdrv_co_truncate(bs->file, len, PREALLOC_MODE_OFF, NULL);
-    }
-
-    if (offset_into_cluster(s, offset)) {
-        return -EINVAL;
-    }
+    assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
+           (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
 
     buf = qemu_blockalign(bs, s->cluster_size);
-    if (bytes != s->cluster_size) {
-        if (bytes > s->cluster_size ||
-            offset + bytes != bs->total_sectors << BDRV_SECTOR_BITS)
-        {
-            qemu_vfree(buf);
-            return -EINVAL;
-        }
+    if (bytes < s->cluster_size) {
         /* Zero-pad last write if image size is not cluster aligned */
         memset(buf + bytes, 0, s->cluster_size - bytes);
     }
-    qemu_iovec_to_buf(qiov, 0, buf, bytes);
+    qemu_iovec_to_buf(qiov, qiov_offset, buf, bytes);
 
     out_buf = g_malloc(s->cluster_size);
 
@@ -4134,7 +4665,10 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
         goto fail;
     } else if (out_len == -1) {
         /* could not compress: write normal cluster */
-        ret = qcow2_co_pwritev(bs, offset, bytes, qiov, 0);
+        qemu_iovec_init(&hd_qiov, qiov->niov);
+        qemu_iovec_concat(&hd_qiov, qiov, qiov_offset, bytes);
+        ret = qcow2_co_pwritev(bs, offset, bytes, &hd_qiov, 0);
+        qemu_iovec_destroy(&hd_qiov);
         if (ret < 0) {
             goto fail;
         }
@@ -4142,8 +4676,11 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
     }
 
     qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
-                                                &cluster_offset);
+    ret = qcow2_co_persist_dirty_bitmaps(bs, offset, bytes);
+    if (ret == 0) {
+        ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
+                                                    &cluster_offset);
+    }
     if (ret < 0) {
         qemu_co_mutex_unlock(&s->lock);
         goto fail;
@@ -4170,12 +4707,63 @@ fail:
     return ret;
 }
 
+static coroutine_fn int
+qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
+                            uint64_t bytes, QEMUIOVector *qiov)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressedIO cio = { .bs = bs };
+    uint64_t bytes_done = 0;
+
+    if (has_data_file(bs)) {
+        return -ENOTSUP;
+    }
+
+    if (bytes == 0) {
+        /* align end of file to a sector boundary to ease reading with
+           sector based I/Os */
+        int64_t len = bdrv_getlength(bs->file->bs);
+        if (len < 0) {
+            return len;
+        }
+        return bdrv_co_truncate(bs->file, len, PREALLOC_MODE_OFF, NULL);
+    }
+
+    if (offset_into_cluster(s, offset)) {
+        return -EINVAL;
+    }
+
+    /* Only the last cluster of the image may be written partially */
+    if (offset_into_cluster(s, bytes) &&
+        offset + bytes != bs->total_sectors << BDRV_SECTOR_BITS)
+    {
+        return -EINVAL;
+    }
+
+    if (bytes <= s->cluster_size) {
+        return qcow2_co_pwritev_compressed_part(bs, offset, bytes, qiov, 0);
+    }
+
+    while (bytes_done < bytes && cio.ret == 0) {
+        uint64_t chunk_size = MIN(bytes - bytes_done, s->cluster_size);
+
+        qcow2_compressed_io_start(&cio, true, 0, offset + bytes_done,
+                                  chunk_size, qiov, bytes_done);
+        bytes_done += chunk_size;
+    }
+
+    qcow2_compressed_io_wait(&cio, 0);
+
+    return cio.ret;
+}
+
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t file_cluster_offset,
                            uint64_t offset,
                            uint64_t bytes,
-                           QEMUIOVector *qiov)
+                           QEMUIOVector *qiov,
+                           size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
     int ret = 0, csize, nb_csectors;
@@ -4207,7 +4795,7 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         goto fail;
     }
 
-    qemu_iovec_from_buf(qiov, 0, out_buf + offset_in_cluster, bytes);
+    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
 
 fail:
     qemu_vfree(out_buf);
@@ -4326,6 +4914,7 @@ static int make_completely_empty(BlockDriverState *bs)
     }
     s->refcount_table[0] = 2 * s->cluster_size;
 
+    qcow2_drop_free_index(bs);
     s->free_cluster_index = 0;
     assert(3 + l1_clusters <= s->refcount_block_size);
     offset = qcow2_alloc_clusters(bs, 3 * s->cluster_size + l1_size2);
@@ -4378,13 +4967,13 @@ static int qcow2_make_empty(BlockDriverState *bs)
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
         3 + l1_clusters <= s->refcount_block_size &&
-        s->crypt_method_header != QCOW_CRYPT_LUKS) {
+        s->crypt_method_header != QCOW_CRYPT_LUKS && !s->journal_offset) {
         /* The following function only works for qcow2 v3 images (it
          * requires the dirty flag) and only as long as there are no
          * features that reserve extra clusters (such as snapshots,
-         * LUKS header, or persistent bitmaps), because it completely
-         * empties the image.  Furthermore, the L1 table and three
-         * additional clusters (image header, refcount table, one
+         * LUKS header, persistent bitmaps, or a metadata journal), because
+         * it completely empties the image.  Furthermore, the L1 table and
+         * three additional clusters (image header, refcount table, one
          * refcount block) have to fit inside one refcount block. */
         return make_completely_empty(bs);
     }
@@ -4756,6 +5345,11 @@ static int qcow2_downgrade(BlockDriverState *bs, int target_version,
         return -ENOTSUP;
     }
 
+    if (s->journal_offset) {
+        error_setg(errp, "Cannot downgrade an image with a metadata journal");
+        return -ENOTSUP;
+    }
+
     /* clear incompatible features */
     if (s->incompatible_features & QCOW2_INCOMPAT_DIRTY) {
         ret = qcow2_mark_clean(bs);
@@ -4975,6 +5569,9 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
                                  "images");
                 return -EINVAL;
             }
+        } else if (!strcmp(desc->name, BLOCK_OPT_JOURNAL_SIZE)) {
+            error_setg(errp, "Changing the metadata journal is not supported");
+            return -ENOTSUP;
         } else {
             /* if this point is reached, this probably means a new option was
              * added without having it covered here */
@@ -5012,10 +5609,19 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
             return -EINVAL;
         }
 
+        /* The refcount structures are rewritten in place */
+        ret = qcow2_journal_suspend(bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to checkpoint the metadata "
+                             "journal");
+            return ret;
+        }
+
         helper_cb_info.current_operation = QCOW2_CHANGING_REFCOUNT_ORDER;
         ret = qcow2_change_refcount_order(bs, refcount_order,
                                           &qcow2_amend_helper_cb,
                                           &helper_cb_info, errp);
+        qcow2_journal_resume(bs);
         if (ret < 0) {
             return ret;
         }
@@ -5239,6 +5845,11 @@ static QemuOptsList qcow2_create_opts = {
             .help = "Width of a reference count entry in bits",
             .def_value_str = "16"
         },
+        {
+            .name = BLOCK_OPT_JOURNAL_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of the metadata journal (no journal if not given)"
+        },
         { /* end of list */ }
     }
 };
@@ -5267,6 +5878,7 @@ BlockDriver bdrv_qcow2 = {
 
     .bdrv_co_preadv         = qcow2_co_preadv,
     .bdrv_co_pwritev        = qcow2_co_pwritev,
+    .bdrv_co_drain_begin    = qcow2_co_drain_begin,
     .bdrv_co_flush_to_os    = qcow2_co_flush_to_os,
 
     .bdrv_co_pwrite_zeroes  = qcow2_co_pwrite_zeroes,
@@ -64,6 +64,9 @@
 #define QCOW2_MAX_BITMAPS 65535
 #define QCOW2_MAX_BITMAP_DIRECTORY_SIZE (1024 * QCOW2_MAX_BITMAPS)
 
+/* Metadata journal constraints */
+#define QCOW2_MAX_JOURNAL_SIZE (1 * GiB)
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -71,6 +74,20 @@
 /* The cluster reads as all zeros */
 #define QCOW_OFLAG_ZERO (1ULL << 0)
 
+/* Size of normal and extended L2 entries */
+#define L2E_SIZE_NORMAL   (sizeof(uint64_t))
+#define L2E_SIZE_EXTENDED (sizeof(uint64_t) * 2)
+
+/* Number of subclusters per cluster with extended L2 entries */
+#define QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER 32
+
+/* Subcluster bitmap of an extended L2 entry: one allocation bit and one
+ * "reads as zeroes" bit per subcluster */
+#define QCOW_L2_BITMAP_ALL_ALLOC  ((1ULL << 32) - 1)
+#define QCOW_L2_BITMAP_ALL_ZEROES (QCOW_L2_BITMAP_ALL_ALLOC << 32)
+#define QCOW_OFLAG_SUB_ALLOC(X)   (1ULL << (X))
+#define QCOW_OFLAG_SUB_ZERO(X)    (QCOW_OFLAG_SUB_ALLOC(X) << 32)
+
 #define MIN_CLUSTER_BITS 9
 #define MAX_CLUSTER_BITS 21
 
@@ -112,6 +129,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_BACKING_READAHEAD_SIZE "backing-readahead-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -177,6 +195,7 @@ typedef struct QCowSnapshot {
 
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
+typedef struct Qcow2FreeIndex Qcow2FreeIndex;
 
 typedef struct Qcow2CryptoHeaderExtension {
     uint64_t offset;
@@ -201,13 +220,19 @@ enum {
     QCOW2_INCOMPAT_DIRTY_BITNR      = 0,
     QCOW2_INCOMPAT_CORRUPT_BITNR    = 1,
     QCOW2_INCOMPAT_DATA_FILE_BITNR  = 2,
+    QCOW2_INCOMPAT_EXTL2_BITNR      = 4,
+    QCOW2_INCOMPAT_JOURNAL_BITNR    = 5,
     QCOW2_INCOMPAT_DIRTY            = 1 << QCOW2_INCOMPAT_DIRTY_BITNR,
     QCOW2_INCOMPAT_CORRUPT          = 1 << QCOW2_INCOMPAT_CORRUPT_BITNR,
     QCOW2_INCOMPAT_DATA_FILE        = 1 << QCOW2_INCOMPAT_DATA_FILE_BITNR,
+    QCOW2_INCOMPAT_EXTL2            = 1 << QCOW2_INCOMPAT_EXTL2_BITNR,
+    QCOW2_INCOMPAT_JOURNAL          = 1 << QCOW2_INCOMPAT_JOURNAL_BITNR,
 
     QCOW2_INCOMPAT_MASK             = QCOW2_INCOMPAT_DIRTY
                                     | QCOW2_INCOMPAT_CORRUPT
-                                    | QCOW2_INCOMPAT_DATA_FILE,
+                                    | QCOW2_INCOMPAT_DATA_FILE
+                                    | QCOW2_INCOMPAT_EXTL2
+                                    | QCOW2_INCOMPAT_JOURNAL,
 };
 
 /* Compatible feature bits */
@@ -222,11 +247,14 @@ enum {
 enum {
     QCOW2_AUTOCLEAR_BITMAPS_BITNR       = 0,
     QCOW2_AUTOCLEAR_DATA_FILE_RAW_BITNR = 1,
+    QCOW2_AUTOCLEAR_JOURNAL_BITNR       = 2,
     QCOW2_AUTOCLEAR_BITMAPS             = 1 << QCOW2_AUTOCLEAR_BITMAPS_BITNR,
     QCOW2_AUTOCLEAR_DATA_FILE_RAW       = 1 << QCOW2_AUTOCLEAR_DATA_FILE_RAW_BITNR,
+    QCOW2_AUTOCLEAR_JOURNAL             = 1 << QCOW2_AUTOCLEAR_JOURNAL_BITNR,
 
     QCOW2_AUTOCLEAR_MASK                = QCOW2_AUTOCLEAR_BITMAPS
-                                        | QCOW2_AUTOCLEAR_DATA_FILE_RAW,
+                                        | QCOW2_AUTOCLEAR_DATA_FILE_RAW
+                                        | QCOW2_AUTOCLEAR_JOURNAL,
 };
 
 enum qcow2_discard_type {
@@ -263,10 +291,21 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
+typedef struct Qcow2DurableBitmap Qcow2DurableBitmap;
+
+typedef struct Qcow2JournalHeaderExt {
+    uint64_t journal_offset;
+    uint64_t journal_size;
+    uint64_t generation;
+} QEMU_PACKED Qcow2JournalHeaderExt;
+
 typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
     int cluster_sectors;
+    int subclusters_per_cluster;
+    int subcluster_size;
+    int subcluster_bits;
     int l2_slice_size;
     int l2_bits;
     int l2_size;
@@ -285,6 +324,18 @@ typedef struct BDRVQcow2State {
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
+    /* Sequential reads, see qcow2_co_preadv() */
+    uint64_t seq_read_end;
+    unsigned seq_reads;
+    uint64_t l2_prefetch_offset; /* Guest offset of the last slice fetched */
+    bool l2_prefetch_in_flight;
+    uint64_t backing_readahead_size;
+    uint8_t *readahead_buf;
+    uint64_t readahead_offset;
+    uint64_t readahead_bytes;    /* 0 if readahead_buf holds nothing */
+    unsigned readahead_gen;
+    bool readahead_in_flight;
+
     uint8_t *cluster_cache;
     uint8_t *cluster_data;
     uint64_t cluster_cache_offset;
@@ -296,6 +347,7 @@ typedef struct BDRVQcow2State {
     uint32_t max_refcount_table_index; /* Last used entry in refcount_table */
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
+    Qcow2FreeIndex *free_index; /* Free clusters, built on first allocation */
 
     CoMutex lock;
 
@@ -313,6 +365,20 @@ typedef struct BDRVQcow2State {
     uint32_t nb_bitmaps;
     uint64_t bitmap_directory_size;
     uint64_t bitmap_directory_offset;
+    /* Bitmaps kept up to date in the image at runtime, see qcow2-bitmap.c */
+    QLIST_HEAD(, Qcow2DurableBitmap) durable_bitmaps;
+
+    /* Metadata journal, see qcow2-journal.c; journal_offset is 0 if the
+     * image has none */
+    uint64_t journal_offset;
+    uint64_t journal_size;
+    uint64_t journal_generation;
+    uint64_t journal_sequence;  /* of the next transaction */
+    uint64_t journal_pos;       /* where the next transaction goes */
+    /* Clusters of tables with a copy in the current journal generation */
+    GHashTable *journal_tables;
+    bool journal_active;        /* metadata updates go through the journal */
+    bool journal_needs_replay;  /* pending journal left by a read-only open */
 
     int flags;
     int qcow_version;
@@ -399,6 +465,12 @@ typedef struct QCowL2Meta
      */
     Qcow2COWRegion cow_end;
 
+    /**
+     * Indicates that COW regions are already handled and do not require
+     * any more processing.
+     */
+    bool skip_cow;
+
     /**
      * The I/O vector with the data from the actual guest write request.
      * If non-NULL, this is meant to be merged together with the data
@@ -481,6 +553,53 @@ static inline bool data_file_is_raw(BlockDriverState *bs)
     return !!(s->autoclear_features & QCOW2_AUTOCLEAR_DATA_FILE_RAW);
 }
 
+static inline bool has_subclusters(BDRVQcow2State *s)
+{
+    return s->incompatible_features & QCOW2_INCOMPAT_EXTL2;
+}
+
+static inline size_t l2_entry_size(BDRVQcow2State *s)
+{
+    return has_subclusters(s) ? L2E_SIZE_EXTENDED : L2E_SIZE_NORMAL;
+}
+
+/*
+ * Return the descriptor part of L2 entry @idx of @l2_slice.  With extended
+ * L2 entries each entry is followed by its 64-bit subcluster bitmap.
+ */
+static inline uint64_t get_l2_entry(BDRVQcow2State *s, uint64_t *l2_slice,
+                                    int idx)
+{
+    idx *= l2_entry_size(s) / sizeof(uint64_t);
+    return be64_to_cpu(l2_slice[idx]);
+}
+
+static inline uint64_t get_l2_bitmap(BDRVQcow2State *s, uint64_t *l2_slice,
+                                     int idx)
+{
+    if (has_subclusters(s)) {
+        idx *= l2_entry_size(s) / sizeof(uint64_t);
+        return be64_to_cpu(l2_slice[idx + 1]);
+    } else {
+        return 0; /* For convenience only; this value has no meaning. */
+    }
+}
+
+static inline void set_l2_entry(BDRVQcow2State *s, uint64_t *l2_slice,
+                                int idx, uint64_t entry)
+{
+    idx *= l2_entry_size(s) / sizeof(uint64_t);
+    l2_slice[idx] = cpu_to_be64(entry);
+}
+
+static inline void set_l2_bitmap(BDRVQcow2State *s, uint64_t *l2_slice,
+                                 int idx, uint64_t bitmap)
+{
+    assert(has_subclusters(s));
+    idx *= l2_entry_size(s) / sizeof(uint64_t);
+    l2_slice[idx + 1] = cpu_to_be64(bitmap);
+}
+
 static inline int64_t start_of_cluster(BDRVQcow2State *s, int64_t offset)
 {
     return offset & ~(s->cluster_size - 1);
@@ -496,6 +615,11 @@ static inline uint64_t size_to_clusters(BDRVQcow2State *s, uint64_t size)
     return (size + (s->cluster_size - 1)) >> s->cluster_bits;
 }
 
+static inline int offset_to_sc_index(BDRVQcow2State *s, int64_t offset)
+{
+    return offset_into_cluster(s, offset) >> s->subcluster_bits;
+}
+
 static inline int64_t size_to_l1(BDRVQcow2State *s, int64_t size)
 {
     int shift = s->cluster_bits + s->l2_bits;
@@ -596,6 +720,7 @@ int qcow2_validate_table(BlockDriverState *bs, uint64_t offset,
 /* qcow2-refcount.c functions */
 int qcow2_refcount_init(BlockDriverState *bs);
 void qcow2_refcount_close(BlockDriverState *bs);
+void qcow2_drop_free_index(BlockDriverState *bs);
 
 int qcow2_get_refcount(BlockDriverState *bs, int64_t cluster_index,
                        uint64_t *refcount);
@@ -625,7 +750,8 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
 int coroutine_fn qcow2_flush_caches(BlockDriverState *bs);
 int coroutine_fn qcow2_write_caches(BlockDriverState *bs);
 int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
-                          BdrvCheckMode fix);
+                          BdrvCheckMode fix,
+                          BlockDriverCheckStatusCB *status_cb, void *cb_opaque);
 
 void qcow2_process_discards(BlockDriverState *bs, int ret);
 
@@ -654,6 +780,8 @@ int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
 
 int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
                              unsigned int *bytes, uint64_t *cluster_offset);
+int coroutine_fn qcow2_prefetch_l2_slice(BlockDriverState *bs,
+                                         uint64_t offset);
 int qcow2_alloc_cluster_offset(BlockDriverState *bs, uint64_t offset,
                                unsigned int *bytes, uint64_t *host_offset,
                                QCowL2Meta **m);
@@ -712,6 +840,23 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+int qcow2_cache_dirty_tables(Qcow2Cache *c);
+int qcow2_cache_nb_tables(Qcow2Cache *c);
+unsigned qcow2_cache_table_size(Qcow2Cache *c);
+int qcow2_cache_copy_dirty(Qcow2Cache *c, uint64_t *offsets, uint8_t *buf);
+void qcow2_cache_mark_all_clean(Qcow2Cache *c);
+bool qcow2_cache_needs_flush(Qcow2Cache *c);
+
+/* qcow2-journal.c functions */
+int qcow2_journal_create(BlockDriverState *bs, int64_t size, Error **errp);
+int qcow2_journal_open(BlockDriverState *bs, int flags, Error **errp);
+void qcow2_journal_close(BlockDriverState *bs);
+void qcow2_journal_update_active(BlockDriverState *bs);
+int qcow2_journal_commit(BlockDriverState *bs);
+int qcow2_journal_checkpoint(BlockDriverState *bs);
+int qcow2_journal_suspend(BlockDriverState *bs);
+void qcow2_journal_resume(BlockDriverState *bs);
+int qcow2_journal_table_freed(BlockDriverState *bs, uint64_t cluster_offset);
 
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
@@ -733,5 +878,10 @@ bool qcow2_can_store_new_dirty_bitmap(BlockDriverState *bs,
 void qcow2_remove_persistent_dirty_bitmap(BlockDriverState *bs,
                                           const char *name,
                                           Error **errp);
+int coroutine_fn qcow2_co_persist_dirty_bitmaps(BlockDriverState *bs,
+                                                uint64_t offset,
+                                                uint64_t bytes);
+int qcow2_drop_durable_bitmaps(BlockDriverState *bs);
+void qcow2_free_durable_bitmaps(BlockDriverState *bs);
 
 #endif
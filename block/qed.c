@@ -1607,7 +1607,9 @@ static void coroutine_fn bdrv_qed_co_invalidate_cache(BlockDriverState *bs,
 }
 
 static int bdrv_qed_co_check(BlockDriverState *bs, BdrvCheckResult *result,
-                             BdrvCheckMode fix)
+                             BdrvCheckMode fix,
+                             BlockDriverCheckStatusCB *status_cb,
+                             void *cb_opaque)
 {
     BDRVQEDState *s = bs->opaque;
     int ret;
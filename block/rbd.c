@@ -71,30 +71,36 @@
 #define LIBRBD_USE_IOVEC 0
 #endif
 
+/* rbd_lock_acquire and rbd_lock_release added in Luminous */
+#if LIBRBD_VERSION_CODE >= LIBRBD_VERSION(1, 12, 0)
+#define LIBRBD_SUPPORTS_LOCKING
+#else
+#undef LIBRBD_SUPPORTS_LOCKING
+#endif
+
+/* Returned by qemu_rbd_diff_iterate_cb() to stop rbd_diff_iterate2() early */
+#define QEMU_RBD_EXIT_DIFF_ITERATE2 -9000
+
 typedef enum {
     RBD_AIO_READ,
     RBD_AIO_WRITE,
     RBD_AIO_DISCARD,
-    RBD_AIO_FLUSH
+    RBD_AIO_FLUSH,
+    RBD_AIO_WRITE_ZEROES
 } RBDAIOCmd;
 
-typedef struct RBDAIOCB {
-    BlockAIOCB common;
-    int64_t ret;
-    QEMUIOVector *qiov;
-    char *bounce;
-    RBDAIOCmd cmd;
-    int error;
-    struct BDRVRBDState *s;
-} RBDAIOCB;
-
-typedef struct RADOSCB {
-    RBDAIOCB *acb;
-    struct BDRVRBDState *s;
-    int64_t size;
-    char *buf;
+typedef struct RBDTask {
+    BlockDriverState *bs;
+    Coroutine *co;
+    bool complete;
     int64_t ret;
-} RADOSCB;
+} RBDTask;
+
+typedef struct RBDDiffIterateReq {
+    uint64_t offs;
+    uint64_t bytes;
+    bool exists;
+} RBDDiffIterateReq;
 
 typedef struct BDRVRBDState {
     rados_t cluster;
@@ -102,6 +108,7 @@ typedef struct BDRVRBDState {
     rbd_image_t image;
     char *image_name;
     char *snap;
+    bool lock_acquired;
 } BDRVRBDState;
 
 static int qemu_rbd_connect(rados_t *cluster, rados_ioctx_t *io_ctx,
@@ -320,17 +327,6 @@ static int qemu_rbd_set_keypairs(rados_t cluster, const char *keypairs_json,
     return ret;
 }
 
-static void qemu_rbd_memset(RADOSCB *rcb, int64_t offs)
-{
-    if (LIBRBD_USE_IOVEC) {
-        RBDAIOCB *acb = rcb->acb;
-        iov_memset(acb->qiov->iov, acb->qiov->niov, offs, 0,
-                   acb->qiov->size - offs);
-    } else {
-        memset(rcb->buf + offs, 0, rcb->size - offs);
-    }
-}
-
 static QemuOptsList runtime_opts = {
     .name = "rbd",
     .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
@@ -483,53 +479,6 @@ exit:
     return ret;
 }
 
-/*
- * This aio completion is being called from rbd_finish_bh() and runs in qemu
- * BH context.
- */
-static void qemu_rbd_complete_aio(RADOSCB *rcb)
-{
-    RBDAIOCB *acb = rcb->acb;
-    int64_t r;
-
-    r = rcb->ret;
-
-    if (acb->cmd != RBD_AIO_READ) {
-        if (r < 0) {
-            acb->ret = r;
-            acb->error = 1;
-        } else if (!acb->error) {
-            acb->ret = rcb->size;
-        }
-    } else {
-        if (r < 0) {
-            qemu_rbd_memset(rcb, 0);
-            acb->ret = r;
-            acb->error = 1;
-        } else if (r < rcb->size) {
-            qemu_rbd_memset(rcb, r);
-            if (!acb->error) {
-                acb->ret = rcb->size;
-            }
-        } else if (!acb->error) {
-            acb->ret = r;
-        }
-    }
-
-    g_free(rcb);
-
-    if (!LIBRBD_USE_IOVEC) {
-        if (acb->cmd == RBD_AIO_READ) {
-            qemu_iovec_from_buf(acb->qiov, 0, acb->bounce, acb->qiov->size);
-        }
-        qemu_vfree(acb->bounce);
-    }
-
-    acb->common.cb(acb->common.opaque, (acb->ret > 0 ? 0 : acb->ret));
-
-    qemu_aio_unref(acb);
-}
-
 static char *qemu_rbd_mon_host(BlockdevOptionsRbd *opts, Error **errp)
 {
     const char **vals;
@@ -705,6 +654,69 @@ static int qemu_rbd_attempt_legacy_options(QDict *options,
     return r;
 }
 
+#ifdef LIBRBD_SUPPORTS_LOCKING
+/*
+ * With the exclusive-lock feature, librbd takes the lock on the first write
+ * and hands it to any other client asking for it, dropping its write-back
+ * cache each time.  While the node is writable and active, take the lock up
+ * front instead: writes do not wait for it, the cache stays valid, and a
+ * second writer fails to open the image rather than silently taking turns.
+ * It is handed over explicitly when the node is inactivated for migration.
+ */
+static int qemu_rbd_acquire_lock(BDRVRBDState *s, int flags, Error **errp)
+{
+    uint64_t features;
+    int r;
+
+    if (s->snap || !(flags & BDRV_O_RDWR) || (flags & BDRV_O_INACTIVE) ||
+        s->lock_acquired) {
+        return 0;
+    }
+
+    r = rbd_get_features(s->image, &features);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "error getting features of %s",
+                         s->image_name);
+        return r;
+    }
+
+    if (!(features & RBD_FEATURE_EXCLUSIVE_LOCK)) {
+        return 0;
+    }
+
+    r = rbd_lock_acquire(s->image, RBD_LOCK_MODE_EXCLUSIVE);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "error acquiring exclusive lock of %s",
+                         s->image_name);
+        return r;
+    }
+
+    s->lock_acquired = true;
+    return 0;
+}
+
+static int qemu_rbd_inactivate(BlockDriverState *bs)
+{
+    BDRVRBDState *s = bs->opaque;
+    int r;
+
+    if (!s->lock_acquired) {
+        return 0;
+    }
+
+    /* Writes back the cache before another client can take the lock */
+    r = rbd_lock_release(s->image);
+    if (r < 0) {
+        error_report("error releasing exclusive lock of %s: %s",
+                     s->image_name, strerror(-r));
+        return r;
+    }
+
+    s->lock_acquired = false;
+    return 0;
+}
+#endif
+
 static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
                          Error **errp)
 {
@@ -787,6 +799,18 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
         }
     }
 
+#ifdef LIBRBD_SUPPORTS_LOCKING
+    r = qemu_rbd_acquire_lock(s, flags, errp);
+    if (r < 0) {
+        rbd_close(s->image);
+        goto failed_open;
+    }
+#endif
+
+#ifdef LIBRBD_SUPPORTS_WRITE_ZEROES
+    bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP;
+#endif
+
     r = 0;
     goto out;
 
@@ -833,181 +857,166 @@ static void qemu_rbd_close(BlockDriverState *bs)
     rados_shutdown(s->cluster);
 }
 
-static const AIOCBInfo rbd_aiocb_info = {
-    .aiocb_size = sizeof(RBDAIOCB),
-};
-
-static void rbd_finish_bh(void *opaque)
+static void qemu_rbd_finish_bh(void *opaque)
 {
-    RADOSCB *rcb = opaque;
-    qemu_rbd_complete_aio(rcb);
+    RBDTask *task = opaque;
+    task->complete = true;
+    aio_co_wake(task->co);
 }
 
 /*
- * This is the callback function for rbd_aio_read and _write
+ * This is the completion callback function for all rbd aio calls
+ * started from qemu_rbd_start_co().
  *
  * Note: this function is being called from a non qemu thread so
  * we need to be careful about what we do here. Generally we only
  * schedule a BH, and do the rest of the io completion handling
- * from rbd_finish_bh() which runs in a qemu context.
+ * from qemu_rbd_finish_bh() which runs in a qemu context.
  */
-static void rbd_finish_aiocb(rbd_completion_t c, RADOSCB *rcb)
+static void qemu_rbd_completion_cb(rbd_completion_t c, RBDTask *task)
 {
-    RBDAIOCB *acb = rcb->acb;
-
-    rcb->ret = rbd_aio_get_return_value(c);
+    task->ret = rbd_aio_get_return_value(c);
     rbd_aio_release(c);
-
-    aio_bh_schedule_oneshot(bdrv_get_aio_context(acb->common.bs),
-                            rbd_finish_bh, rcb);
+    aio_bh_schedule_oneshot(bdrv_get_aio_context(task->bs),
+                            qemu_rbd_finish_bh, task);
 }
 
-static int rbd_aio_discard_wrapper(rbd_image_t image,
-                                   uint64_t off,
-                                   uint64_t len,
-                                   rbd_completion_t comp)
+static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
+                                          uint64_t offset,
+                                          uint64_t bytes,
+                                          QEMUIOVector *qiov,
+                                          int flags,
+                                          RBDAIOCmd cmd)
 {
-#ifdef LIBRBD_SUPPORTS_DISCARD
-    return rbd_aio_discard(image, off, len, comp);
-#else
-    return -ENOTSUP;
-#endif
-}
-
-static int rbd_aio_flush_wrapper(rbd_image_t image,
-                                 rbd_completion_t comp)
-{
-#ifdef LIBRBD_SUPPORTS_AIO_FLUSH
-    return rbd_aio_flush(image, comp);
-#else
-    return -ENOTSUP;
-#endif
-}
-
-static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
-                                 int64_t off,
-                                 QEMUIOVector *qiov,
-                                 int64_t size,
-                                 BlockCompletionFunc *cb,
-                                 void *opaque,
-                                 RBDAIOCmd cmd)
-{
-    RBDAIOCB *acb;
-    RADOSCB *rcb = NULL;
+    BDRVRBDState *s = bs->opaque;
+    RBDTask task = { .bs = bs, .co = qemu_coroutine_self() };
     rbd_completion_t c;
+    char *bounce = NULL;
     int r;
 
-    BDRVRBDState *s = bs->opaque;
+    assert(!qiov || qiov->size == bytes);
 
-    acb = qemu_aio_get(&rbd_aiocb_info, bs, cb, opaque);
-    acb->cmd = cmd;
-    acb->qiov = qiov;
-    assert(!qiov || qiov->size == size);
-
-    rcb = g_new(RADOSCB, 1);
-
-    if (!LIBRBD_USE_IOVEC) {
-        if (cmd == RBD_AIO_DISCARD || cmd == RBD_AIO_FLUSH) {
-            acb->bounce = NULL;
-        } else {
-            acb->bounce = qemu_try_blockalign(bs, qiov->size);
-            if (acb->bounce == NULL) {
-                goto failed;
-            }
+    /* librbd without iovec support needs a linear buffer */
+    if (!LIBRBD_USE_IOVEC && qiov) {
+        bounce = qemu_try_blockalign(bs, bytes);
+        if (bounce == NULL) {
+            return -ENOMEM;
         }
         if (cmd == RBD_AIO_WRITE) {
-            qemu_iovec_to_buf(acb->qiov, 0, acb->bounce, qiov->size);
+            qemu_iovec_to_buf(qiov, 0, bounce, bytes);
         }
-        rcb->buf = acb->bounce;
     }
 
-    acb->ret = 0;
-    acb->error = 0;
-    acb->s = s;
-
-    rcb->acb = acb;
-    rcb->s = acb->s;
-    rcb->size = size;
-    r = rbd_aio_create_completion(rcb, (rbd_callback_t) rbd_finish_aiocb, &c);
+    r = rbd_aio_create_completion(&task,
+                                  (rbd_callback_t) qemu_rbd_completion_cb, &c);
     if (r < 0) {
-        goto failed;
+        goto out;
     }
 
     switch (cmd) {
     case RBD_AIO_WRITE:
 #ifdef LIBRBD_SUPPORTS_IOVEC
-            r = rbd_aio_writev(s->image, qiov->iov, qiov->niov, off, c);
+        r = rbd_aio_writev(s->image, qiov->iov, qiov->niov, offset, c);
 #else
-            r = rbd_aio_write(s->image, off, size, rcb->buf, c);
+        r = rbd_aio_write(s->image, offset, bytes, bounce, c);
 #endif
         break;
     case RBD_AIO_READ:
 #ifdef LIBRBD_SUPPORTS_IOVEC
-            r = rbd_aio_readv(s->image, qiov->iov, qiov->niov, off, c);
+        r = rbd_aio_readv(s->image, qiov->iov, qiov->niov, offset, c);
 #else
-            r = rbd_aio_read(s->image, off, size, rcb->buf, c);
+        r = rbd_aio_read(s->image, offset, bytes, bounce, c);
 #endif
         break;
     case RBD_AIO_DISCARD:
-        r = rbd_aio_discard_wrapper(s->image, off, size, c);
+#ifdef LIBRBD_SUPPORTS_DISCARD
+        r = rbd_aio_discard(s->image, offset, bytes, c);
+#else
+        r = -ENOTSUP;
+#endif
         break;
     case RBD_AIO_FLUSH:
-        r = rbd_aio_flush_wrapper(s->image, c);
+#ifdef LIBRBD_SUPPORTS_AIO_FLUSH
+        r = rbd_aio_flush(s->image, c);
+#else
+        r = -ENOTSUP;
+#endif
         break;
+    case RBD_AIO_WRITE_ZEROES: {
+#ifdef LIBRBD_SUPPORTS_WRITE_ZEROES
+        int zero_flags = 0;
+#ifdef RBD_WRITE_ZEROES_FLAG_THICK_PROVISION
+        if (!(flags & BDRV_REQ_MAY_UNMAP)) {
+            zero_flags = RBD_WRITE_ZEROES_FLAG_THICK_PROVISION;
+        }
+#else
+        if (!(flags & BDRV_REQ_MAY_UNMAP)) {
+            /* librbd would deallocate; let the block layer write zeroes */
+            r = -ENOTSUP;
+            break;
+        }
+#endif
+        r = rbd_aio_write_zeroes(s->image, offset, bytes, c, zero_flags, 0);
+#else
+        r = -ENOTSUP;
+#endif
+        break;
+    }
     default:
         r = -EINVAL;
     }
 
     if (r < 0) {
-        goto failed_completion;
+        rbd_aio_release(c);
+        goto out;
     }
-    return &acb->common;
 
-failed_completion:
-    rbd_aio_release(c);
-failed:
-    g_free(rcb);
-    if (!LIBRBD_USE_IOVEC) {
-        qemu_vfree(acb->bounce);
+    while (!task.complete) {
+        qemu_coroutine_yield();
     }
 
-    qemu_aio_unref(acb);
-    return NULL;
-}
+    if (task.ret < 0) {
+        r = task.ret;
+        goto out;
+    }
 
-static BlockAIOCB *qemu_rbd_aio_preadv(BlockDriverState *bs,
-                                       uint64_t offset, uint64_t bytes,
-                                       QEMUIOVector *qiov, int flags,
-                                       BlockCompletionFunc *cb,
-                                       void *opaque)
-{
-    return rbd_start_aio(bs, offset, qiov, bytes, cb, opaque,
-                         RBD_AIO_READ);
+    if (cmd == RBD_AIO_READ) {
+        uint64_t done = MIN(task.ret, bytes);
+
+        if (bounce) {
+            qemu_iovec_from_buf(qiov, 0, bounce, done);
+        }
+        /* zero pad short reads */
+        if (done < bytes) {
+            qemu_iovec_memset(qiov, done, 0, bytes - done);
+        }
+    }
+    r = 0;
+
+out:
+    qemu_vfree(bounce);
+    return r;
 }
 
-static BlockAIOCB *qemu_rbd_aio_pwritev(BlockDriverState *bs,
-                                        uint64_t offset, uint64_t bytes,
-                                        QEMUIOVector *qiov, int flags,
-                                        BlockCompletionFunc *cb,
-                                        void *opaque)
+static int coroutine_fn qemu_rbd_co_preadv(BlockDriverState *bs,
+                                           uint64_t offset, uint64_t bytes,
+                                           QEMUIOVector *qiov, int flags)
 {
-    return rbd_start_aio(bs, offset, qiov, bytes, cb, opaque,
-                         RBD_AIO_WRITE);
+    return qemu_rbd_start_co(bs, offset, bytes, qiov, flags, RBD_AIO_READ);
 }
 
-#ifdef LIBRBD_SUPPORTS_AIO_FLUSH
-static BlockAIOCB *qemu_rbd_aio_flush(BlockDriverState *bs,
-                                      BlockCompletionFunc *cb,
-                                      void *opaque)
+static int coroutine_fn qemu_rbd_co_pwritev(BlockDriverState *bs,
+                                            uint64_t offset, uint64_t bytes,
+                                            QEMUIOVector *qiov, int flags)
 {
-    return rbd_start_aio(bs, 0, NULL, 0, cb, opaque, RBD_AIO_FLUSH);
+    return qemu_rbd_start_co(bs, offset, bytes, qiov, flags, RBD_AIO_WRITE);
 }
 
-#else
-
-static int qemu_rbd_co_flush(BlockDriverState *bs)
+static int coroutine_fn qemu_rbd_co_flush(BlockDriverState *bs)
 {
-#if LIBRBD_VERSION_CODE >= LIBRBD_VERSION(0, 1, 1)
+#ifdef LIBRBD_SUPPORTS_AIO_FLUSH
+    return qemu_rbd_start_co(bs, 0, 0, NULL, 0, RBD_AIO_FLUSH);
+#elif LIBRBD_VERSION_CODE >= LIBRBD_VERSION(0, 1, 1)
     /* rbd_flush added in 0.1.1 */
     BDRVRBDState *s = bs->opaque;
     return rbd_flush(s->image);
@@ -1015,8 +1024,103 @@ static int qemu_rbd_co_flush(BlockDriverState *bs)
     return 0;
 #endif
 }
+
+#ifdef LIBRBD_SUPPORTS_DISCARD
+static int coroutine_fn qemu_rbd_co_pdiscard(BlockDriverState *bs,
+                                             int64_t offset, int bytes)
+{
+    return qemu_rbd_start_co(bs, offset, bytes, NULL, 0, RBD_AIO_DISCARD);
+}
 #endif
 
+#ifdef LIBRBD_SUPPORTS_WRITE_ZEROES
+static int coroutine_fn qemu_rbd_co_pwrite_zeroes(BlockDriverState *bs,
+                                                  int64_t offset, int bytes,
+                                                  BdrvRequestFlags flags)
+{
+    return qemu_rbd_start_co(bs, offset, bytes, NULL, flags,
+                             RBD_AIO_WRITE_ZEROES);
+}
+#endif
+
+/*
+ * Called for each extent rbd_diff_iterate2() reports, in order.  @req
+ * collects the first run of extents with the same allocation state.
+ */
+static int qemu_rbd_diff_iterate_cb(uint64_t offs, size_t len,
+                                    int exists, void *opaque)
+{
+    RBDDiffIterateReq *req = opaque;
+
+    assert(req->offs + req->bytes <= offs);
+
+    if (req->exists && offs > req->offs + req->bytes) {
+        /* The allocated run ended with a hole that is not reported */
+        return QEMU_RBD_EXIT_DIFF_ITERATE2;
+    }
+    if (req->exists && !exists) {
+        /* The allocated run ended with a hole */
+        return QEMU_RBD_EXIT_DIFF_ITERATE2;
+    }
+    if (!req->exists && exists && offs > req->offs) {
+        /* The unallocated run ended with data */
+        req->bytes = offs - req->offs;
+        return QEMU_RBD_EXIT_DIFF_ITERATE2;
+    }
+
+    req->exists = exists;
+    req->bytes = offs + len - req->offs;
+    return 0;
+}
+
+static int coroutine_fn qemu_rbd_co_block_status(BlockDriverState *bs,
+                                                 bool want_zero,
+                                                 int64_t offset,
+                                                 int64_t bytes,
+                                                 int64_t *pnum,
+                                                 int64_t *map,
+                                                 BlockDriverState **file)
+{
+    BDRVRBDState *s = bs->opaque;
+    RBDDiffIterateReq req = { .offs = offset };
+    uint64_t features, flags;
+    int status, r;
+
+    /* Without a valid object map everything is reported as data */
+    status = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+    *pnum = bytes;
+    *map = offset;
+    *file = bs;
+
+    r = rbd_get_features(s->image, &features);
+    if (r < 0 || !(features & RBD_FEATURE_FAST_DIFF)) {
+        return status;
+    }
+
+    r = rbd_get_flags(s->image, &flags);
+    if (r < 0 || (flags & RBD_FLAG_FAST_DIFF_INVALID)) {
+        return status;
+    }
+
+    r = rbd_diff_iterate2(s->image, NULL, offset, bytes, true, true,
+                          qemu_rbd_diff_iterate_cb, &req);
+    if (r < 0 && r != QEMU_RBD_EXIT_DIFF_ITERATE2) {
+        return status;
+    }
+    assert(req.bytes <= bytes);
+
+    if (!req.exists) {
+        if (r == 0) {
+            /* No extent at all, or only unallocated ones up to the end */
+            req.bytes = bytes;
+        }
+        status = BDRV_BLOCK_ZERO | BDRV_BLOCK_OFFSET_VALID;
+    }
+
+    *pnum = req.bytes;
+    return status;
+}
+
 static int qemu_rbd_getinfo(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
     BDRVRBDState *s = bs->opaque;
@@ -1181,27 +1285,22 @@ static int qemu_rbd_snap_list(BlockDriverState *bs,
     return snap_count;
 }
 
-#ifdef LIBRBD_SUPPORTS_DISCARD
-static BlockAIOCB *qemu_rbd_aio_pdiscard(BlockDriverState *bs,
-                                         int64_t offset,
-                                         int bytes,
-                                         BlockCompletionFunc *cb,
-                                         void *opaque)
-{
-    return rbd_start_aio(bs, offset, NULL, bytes, cb, opaque,
-                         RBD_AIO_DISCARD);
-}
-#endif
-
-#ifdef LIBRBD_SUPPORTS_INVALIDATE
+#if defined(LIBRBD_SUPPORTS_INVALIDATE) || defined(LIBRBD_SUPPORTS_LOCKING)
 static void coroutine_fn qemu_rbd_co_invalidate_cache(BlockDriverState *bs,
                                                       Error **errp)
 {
     BDRVRBDState *s = bs->opaque;
+#ifdef LIBRBD_SUPPORTS_INVALIDATE
     int r = rbd_invalidate_cache(s->image);
     if (r < 0) {
         error_setg_errno(errp, -r, "Failed to invalidate the cache");
+        return;
     }
+#endif
+#ifdef LIBRBD_SUPPORTS_LOCKING
+    /* The source of the migration has handed it over by now */
+    qemu_rbd_acquire_lock(s, bdrv_get_flags(bs), errp);
+#endif
 }
 #endif
 
@@ -1257,26 +1356,28 @@ static BlockDriver bdrv_rbd = {
     .bdrv_co_truncate       = qemu_rbd_co_truncate,
     .protocol_name          = "rbd",
 
-    .bdrv_aio_preadv        = qemu_rbd_aio_preadv,
-    .bdrv_aio_pwritev       = qemu_rbd_aio_pwritev,
-
-#ifdef LIBRBD_SUPPORTS_AIO_FLUSH
-    .bdrv_aio_flush         = qemu_rbd_aio_flush,
-#else
+    .bdrv_co_preadv         = qemu_rbd_co_preadv,
+    .bdrv_co_pwritev        = qemu_rbd_co_pwritev,
     .bdrv_co_flush_to_disk  = qemu_rbd_co_flush,
-#endif
+    .bdrv_co_block_status   = qemu_rbd_co_block_status,
 
 #ifdef LIBRBD_SUPPORTS_DISCARD
-    .bdrv_aio_pdiscard      = qemu_rbd_aio_pdiscard,
+    .bdrv_co_pdiscard       = qemu_rbd_co_pdiscard,
+#endif
+#ifdef LIBRBD_SUPPORTS_WRITE_ZEROES
+    .bdrv_co_pwrite_zeroes  = qemu_rbd_co_pwrite_zeroes,
 #endif
 
     .bdrv_snapshot_create   = qemu_rbd_snap_create,
     .bdrv_snapshot_delete   = qemu_rbd_snap_remove,
     .bdrv_snapshot_list     = qemu_rbd_snap_list,
     .bdrv_snapshot_goto     = qemu_rbd_snap_rollback,
-#ifdef LIBRBD_SUPPORTS_INVALIDATE
+#if defined(LIBRBD_SUPPORTS_INVALIDATE) || defined(LIBRBD_SUPPORTS_LOCKING)
     .bdrv_co_invalidate_cache = qemu_rbd_co_invalidate_cache,
 #endif
+#ifdef LIBRBD_SUPPORTS_LOCKING
+    .bdrv_inactivate        = qemu_rbd_inactivate,
+#endif
 
     .strong_runtime_opts    = qemu_rbd_strong_runtime_opts,
 };
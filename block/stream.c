@@ -22,11 +22,19 @@
 
 enum {
     /*
-     * Size of data buffer for populating the image file.  This should be large
-     * enough to process multiple clusters in a single call, so that populating
+     * Largest range populated by a single request.  Adjacent clusters that
+     * need to be copied are coalesced up to this size, so that populating
      * contiguous regions of the image is efficient.
      */
-    STREAM_BUFFER_SIZE = 512 * 1024, /* in bytes */
+    STREAM_CHUNK_SIZE = 4 * 1024 * 1024, /* in bytes */
+
+    /*
+     * Populate requests in flight at once, and the bytes they may read
+     * together.  Streaming from a remote backing file is bound by its
+     * latency unless several requests are outstanding.
+     */
+    STREAM_MAX_IN_FLIGHT = 16,
+    STREAM_MAX_BYTES_IN_FLIGHT = 16 * 1024 * 1024, /* in bytes */
 };
 
 typedef struct StreamBlockJob {
@@ -36,18 +44,87 @@ typedef struct StreamBlockJob {
     char *backing_file_str;
     bool bs_read_only;
     bool chain_frozen;
+
+    int in_flight;
+    int64_t bytes_in_flight;
+    CoQueue op_done;            /* stream_run() waits here for a slot */
+
+    /* First error of the populate requests, and the lowest failed offset */
+    int op_ret;
+    int64_t op_err_offset;
 } StreamBlockJob;
 
-static int coroutine_fn stream_populate(BlockBackend *blk,
-                                        int64_t offset, uint64_t bytes,
-                                        void *buf)
+typedef struct StreamOp {
+    StreamBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+    bool zero;                  /* reads as zeroes from the backing chain */
+} StreamOp;
+
+static void coroutine_fn stream_co_populate(void *opaque)
 {
-    QEMUIOVector qiov = QEMU_IOVEC_INIT_BUF(qiov, buf, bytes);
+    StreamOp *op = opaque;
+    StreamBlockJob *s = op->s;
+    BlockBackend *blk = s->common.blk;
+    int ret;
+
+    if (op->zero) {
+        /* The data does not change, so no need to read it */
+        ret = blk_co_pwrite_zeroes(blk, op->offset, op->bytes,
+                                   BDRV_REQ_WRITE_UNCHANGED);
+    } else {
+        void *buf = qemu_blockalign(blk_bs(blk), op->bytes);
+        QEMUIOVector qiov = QEMU_IOVEC_INIT_BUF(qiov, buf, op->bytes);
+
+        /* Copy-on-read the unallocated clusters */
+        ret = blk_co_preadv(blk, op->offset, qiov.size, &qiov,
+                            BDRV_REQ_COPY_ON_READ);
+        qemu_vfree(buf);
+    }
+    trace_stream_populate_done(s, op->offset, op->bytes, op->zero, ret);
 
-    assert(bytes < SIZE_MAX);
+    if (ret < 0) {
+        if (s->op_ret == 0) {
+            s->op_ret = ret;
+        }
+        s->op_err_offset = MIN(s->op_err_offset, op->offset);
+    }
+    job_progress_update(&s->common.job, op->bytes);
 
-    /* Copy-on-read the unallocated clusters */
-    return blk_co_preadv(blk, offset, qiov.size, &qiov, BDRV_REQ_COPY_ON_READ);
+    s->in_flight--;
+    s->bytes_in_flight -= op->bytes;
+    qemu_co_queue_restart_all(&s->op_done);
+    g_free(op);
+}
+
+static void coroutine_fn stream_populate(StreamBlockJob *s, int64_t offset,
+                                         int64_t bytes, bool zero)
+{
+    StreamOp *op;
+
+    assert(bytes <= STREAM_CHUNK_SIZE);
+    while (s->in_flight >= STREAM_MAX_IN_FLIGHT ||
+           s->bytes_in_flight + bytes > STREAM_MAX_BYTES_IN_FLIGHT) {
+        qemu_co_queue_wait(&s->op_done, NULL);
+    }
+
+    op = g_new(StreamOp, 1);
+    *op = (StreamOp) {
+        .s      = s,
+        .offset = offset,
+        .bytes  = bytes,
+        .zero   = zero,
+    };
+    s->in_flight++;
+    s->bytes_in_flight += bytes;
+    qemu_coroutine_enter(qemu_coroutine_create(stream_co_populate, op));
+}
+
+static void coroutine_fn stream_wait_for_populate(StreamBlockJob *s)
+{
+    while (s->in_flight > 0) {
+        qemu_co_queue_wait(&s->op_done, NULL);
+    }
 }
 
 static void stream_abort(Job *job)
@@ -119,7 +196,6 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     int error = 0;
     int ret = 0;
     int64_t n = 0; /* bytes */
-    void *buf;
 
     if (!bs->backing) {
         goto out;
@@ -132,7 +208,8 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     }
     job_progress_set_remaining(&s->common.job, len);
 
-    buf = qemu_blockalign(bs, STREAM_BUFFER_SIZE);
+    qemu_co_queue_init(&s->op_done);
+    s->op_err_offset = INT64_MAX;
 
     /* Turn on copy-on-read for the whole block device so that guest read
      * requests help us make progress.  Only do this when copying the entire
@@ -143,20 +220,61 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
         bdrv_enable_copy_on_read(bs);
     }
 
-    for ( ; offset < len; offset += n) {
-        bool copy;
+    for ( ; ; offset += n) {
+        bool copy, zero;
 
         /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+         * here so that bdrv_drain_all() returns.  It waits for the populate
+         * requests in flight, and the job does not issue new ones while
+         * it is paused.
          */
         job_sleep_ns(&s->common.job, delay_ns);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
 
+        if (offset >= len) {
+            stream_wait_for_populate(s);
+            if (s->op_ret == 0) {
+                break;
+            }
+        }
+
+        if (s->op_ret < 0) {
+            /* Handle the error once all requests are done */
+            BlockErrorAction action;
+            int64_t err_offset = s->op_err_offset;
+
+            stream_wait_for_populate(s);
+            ret = s->op_ret;
+            s->op_ret = 0;
+            s->op_err_offset = INT64_MAX;
+            action = block_job_error_action(&s->common, s->on_error, true,
+                                            -ret);
+            if (action == BLOCK_ERROR_ACTION_STOP) {
+                /* Retry from the first failed request; what was copied
+                 * after it is allocated now and will only be skipped */
+                offset = err_offset;
+                job_progress_set_remaining(&s->common.job, len - offset);
+                n = 0;
+                continue;
+            }
+            if (error == 0) {
+                error = ret;
+            }
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                break;
+            }
+            ret = 0;
+            if (offset >= len) {
+                break;
+            }
+        }
+
         copy = false;
+        zero = false;
 
-        ret = bdrv_is_allocated(bs, offset, STREAM_BUFFER_SIZE, &n);
+        ret = bdrv_is_allocated(bs, offset, STREAM_CHUNK_SIZE, &n);
         if (ret == 1) {
             /* Allocated in the top, no need to copy.  */
         } else if (ret >= 0) {
@@ -172,9 +290,20 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
 
             copy = (ret == 1);
         }
+        if (copy) {
+            /* Zeroes in the backing chain need not be read to be copied */
+            ret = bdrv_block_status_above(backing_bs(bs), base, offset, n,
+                                          &n, NULL, NULL);
+            if (ret >= 0) {
+                zero = ret & BDRV_BLOCK_ZERO;
+                ret = 1;
+            } else {
+                copy = false;
+            }
+        }
         trace_stream_one_iteration(s, offset, n, ret);
         if (copy) {
-            ret = stream_populate(blk, offset, n, buf);
+            stream_populate(s, offset, n, zero);
         }
         if (ret < 0) {
             BlockErrorAction action =
@@ -192,15 +321,19 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
         }
         ret = 0;
 
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
-        if (copy) {
+        /* Publish progress; populate requests do it once they are done */
+        if (!copy) {
+            job_progress_update(&s->common.job, n);
+        }
+        if (copy && !zero) {
             delay_ns = block_job_ratelimit_get_delay(&s->common, n);
         } else {
             delay_ns = 0;
         }
     }
 
+    stream_wait_for_populate(s);
+
     if (!base) {
         bdrv_disable_copy_on_read(bs);
     }
@@ -208,8 +341,6 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     /* Do not remove the backing file if an error was there but ignored.  */
     ret = error;
 
-    qemu_vfree(buf);
-
 out:
     /* Modify backing chain and close BDSes in main loop */
     return ret;
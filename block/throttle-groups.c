@@ -190,6 +190,26 @@ static ThrottleGroupMember *throttle_group_next_tgm(ThrottleGroupMember *tgm)
     return next;
 }
 
+/* Make @tgm the member whose request goes next.  A member that already
+ * has the token uses up one more of its shares, one that gets a new turn
+ * starts with all of them.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void throttle_group_set_token(ThrottleGroupMember *tgm, bool is_write)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    if (tg->tokens[is_write] == tgm) {
+        if (tgm->rr_credit[is_write]) {
+            tgm->rr_credit[is_write]--;
+        }
+    } else {
+        tg->tokens[is_write] = tgm;
+        tgm->rr_credit[is_write] = MAX(tgm->shares, 1) - 1;
+    }
+}
+
 /*
  * Return whether a ThrottleGroupMember has pending requests.
  *
@@ -233,6 +253,11 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
 
     start = token = tg->tokens[is_write];
 
+    /* The current token keeps its turn until it has used up its shares */
+    if (token->rr_credit[is_write] && tgm_has_pending_reqs(token, is_write)) {
+        return token;
+    }
+
     /* get next bs round in round robin style */
     token = throttle_group_next_tgm(token);
     while (token != start && !tgm_has_pending_reqs(token, is_write)) {
@@ -284,7 +309,7 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
 
     /* If a timer just got armed, set tgm as the current token */
     if (must_wait) {
-        tg->tokens[is_write] = tgm;
+        throttle_group_set_token(tgm, is_write);
         tg->any_timer_armed[is_write] = true;
     }
 
@@ -344,7 +369,7 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
             timer_mod(tt->timers[is_write], now);
             tg->any_timer_armed[is_write] = true;
         }
-        tg->tokens[is_write] = token;
+        throttle_group_set_token(token, is_write);
     }
 }
 
@@ -458,6 +483,26 @@ void throttle_group_restart_tgm(ThrottleGroupMember *tgm)
     }
 }
 
+/* Set the number of requests a ThrottleGroupMember may send in a row when
+ * it is its turn, which gives it that many times the share of the group's
+ * limits of a member with the default of 1 while both are throttled.
+ *
+ * @tgm:    a ThrottleGroupMember that is a member of a group
+ * @shares: the new weight, between 1 and THROTTLE_GROUP_MAX_SHARES
+ */
+void throttle_group_set_shares(ThrottleGroupMember *tgm, unsigned shares)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    assert(shares >= 1 && shares <= THROTTLE_GROUP_MAX_SHARES);
+
+    qemu_mutex_lock(&tg->lock);
+    tgm->shares = shares;
+    tgm->rr_credit[0] = MIN(tgm->rr_credit[0], shares - 1);
+    tgm->rr_credit[1] = MIN(tgm->rr_credit[1], shares - 1);
+    qemu_mutex_unlock(&tg->lock);
+}
+
 /* Update the throttle configuration for a particular group. Similar
  * to throttle_config(), but guarantees atomicity within the
  * throttling group.
@@ -543,6 +588,7 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
 
     tgm->throttle_state = ts;
     tgm->aio_context = ctx;
+    tgm->rr_credit[0] = tgm->rr_credit[1] = 0;
     atomic_set(&tgm->restart_pending, 0);
 
     qemu_mutex_lock(&tg->lock);
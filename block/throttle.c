@@ -32,19 +32,26 @@ static QemuOptsList throttle_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Name of the throttle group",
         },
+        {
+            .name = QEMU_OPT_THROTTLE_SHARES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Weight of this node within its throttle group",
+        },
         { /* end of list */ }
     },
 };
 
 /*
  * If this function succeeds then the throttle group name is stored in
- * @group and must be freed by the caller.
- * If there's an error then @group remains unmodified.
+ * @group and must be freed by the caller, and the weight in @shares.
+ * If there's an error then @group and @shares remain unmodified.
  */
-static int throttle_parse_options(QDict *options, char **group, Error **errp)
+static int throttle_parse_options(QDict *options, char **group,
+                                  unsigned *shares, Error **errp)
 {
     int ret;
     const char *group_name;
+    uint64_t group_shares;
     Error *local_err = NULL;
     QemuOpts *opts = qemu_opts_create(&throttle_opts, NULL, 0, &error_abort);
 
@@ -66,7 +73,16 @@ static int throttle_parse_options(QDict *options, char **group, Error **errp)
         goto fin;
     }
 
+    group_shares = qemu_opt_get_number(opts, QEMU_OPT_THROTTLE_SHARES, 1);
+    if (group_shares < 1 || group_shares > THROTTLE_GROUP_MAX_SHARES) {
+        error_setg(errp, "'" QEMU_OPT_THROTTLE_SHARES "' must be between 1 "
+                   "and %d", THROTTLE_GROUP_MAX_SHARES);
+        ret = -EINVAL;
+        goto fin;
+    }
+
     *group = g_strdup(group_name);
+    *shares = group_shares;
     ret = 0;
 fin:
     qemu_opts_del(opts);
@@ -78,6 +94,7 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
 {
     ThrottleGroupMember *tgm = bs->opaque;
     char *group;
+    unsigned shares;
     int ret;
 
     bs->file = bdrv_open_child(NULL, options, "file", bs,
@@ -90,10 +107,11 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
     bs->supported_zero_flags = bs->file->bs->supported_zero_flags |
                                BDRV_REQ_WRITE_UNCHANGED;
 
-    ret = throttle_parse_options(options, &group, errp);
+    ret = throttle_parse_options(options, &group, &shares, errp);
     if (ret == 0) {
         /* Register membership to group with name group_name */
         throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
+        throttle_group_set_shares(tgm, shares);
         g_free(group);
     }
 
@@ -170,17 +188,28 @@ static void throttle_attach_aio_context(BlockDriverState *bs,
     throttle_group_attach_aio_context(tgm, new_context);
 }
 
+typedef struct ThrottleReopenState {
+    char *group;
+    unsigned shares;
+} ThrottleReopenState;
+
 static int throttle_reopen_prepare(BDRVReopenState *reopen_state,
                                    BlockReopenQueue *queue, Error **errp)
 {
+    ThrottleReopenState *rs;
     int ret;
-    char *group = NULL;
 
     assert(reopen_state != NULL);
     assert(reopen_state->bs != NULL);
 
-    ret = throttle_parse_options(reopen_state->options, &group, errp);
-    reopen_state->opaque = group;
+    rs = g_new0(ThrottleReopenState, 1);
+    ret = throttle_parse_options(reopen_state->options, &rs->group,
+                                 &rs->shares, errp);
+    if (ret < 0) {
+        g_free(rs);
+        rs = NULL;
+    }
+    reopen_state->opaque = rs;
     return ret;
 }
 
@@ -188,21 +217,29 @@ static void throttle_reopen_commit(BDRVReopenState *reopen_state)
 {
     BlockDriverState *bs = reopen_state->bs;
     ThrottleGroupMember *tgm = bs->opaque;
-    char *group = reopen_state->opaque;
+    ThrottleReopenState *rs = reopen_state->opaque;
 
-    assert(group);
+    assert(rs && rs->group);
 
-    if (strcmp(group, throttle_group_get_name(tgm))) {
+    if (strcmp(rs->group, throttle_group_get_name(tgm))) {
         throttle_group_unregister_tgm(tgm);
-        throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
+        throttle_group_register_tgm(tgm, rs->group, bdrv_get_aio_context(bs));
     }
-    g_free(reopen_state->opaque);
+    throttle_group_set_shares(tgm, rs->shares);
+
+    g_free(rs->group);
+    g_free(rs);
     reopen_state->opaque = NULL;
 }
 
 static void throttle_reopen_abort(BDRVReopenState *reopen_state)
 {
-    g_free(reopen_state->opaque);
+    ThrottleReopenState *rs = reopen_state->opaque;
+
+    if (rs) {
+        g_free(rs->group);
+        g_free(rs);
+    }
     reopen_state->opaque = NULL;
 }
 
@@ -35,6 +35,9 @@
 #include "qemu/bswap.h"
 #include "migration/blocker.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
+#include "qemu/coroutine.h"
+#include "block/thread-pool.h"
 #include <zlib.h>
 
 #define VMDK3_MAGIC (('C' << 24) | ('O' << 16) | ('W' << 8) | 'D')
@@ -91,7 +94,13 @@ typedef struct {
     uint16_t compressAlgorithm;
 } QEMU_PACKED VMDK4Header;
 
-#define L2_CACHE_SIZE 16
+#define VMDK_OPT_L2_CACHE_SIZE "l2-cache-size"
+
+/* Default size of the grain table cache of each extent, in bytes */
+#define VMDK_DEFAULT_L2_CACHE_SIZE (1 * MiB)
+
+/* Compressed grains of one read request that are decompressed at once */
+#define VMDK_MAX_GRAIN_READS 8
 
 typedef struct VmdkExtent {
     BdrvChild *file;
@@ -111,9 +120,11 @@ typedef struct VmdkExtent {
     uint32_t l1_entry_sectors;
 
     unsigned int l2_size;
-    uint32_t *l2_cache;
-    uint32_t l2_cache_offsets[L2_CACHE_SIZE];
-    uint32_t l2_cache_counts[L2_CACHE_SIZE];
+    unsigned int l2_cache_entries;
+    uint32_t *l2_cache;             /* l2_cache_entries tables of l2_size */
+    uint32_t *l2_cache_offsets;
+    uint64_t *l2_cache_lru;
+    uint64_t l2_cache_lru_counter;
 
     int64_t cluster_sectors;
     int64_t next_cluster_sector;
@@ -132,8 +143,22 @@ typedef struct BDRVVmdkState {
     VmdkExtent *extents;
     Error *migration_blocker;
     char *create_type;
+    uint64_t l2_cache_size;         /* per extent, in bytes */
 } BDRVVmdkState;
 
+static QemuOptsList vmdk_runtime_opts = {
+    .name = "vmdk",
+    .head = QTAILQ_HEAD_INITIALIZER(vmdk_runtime_opts.head),
+    .desc = {
+        {
+            .name = VMDK_OPT_L2_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum grain table cache size of each extent",
+        },
+        { /* end of list */ },
+    },
+};
+
 typedef struct VmdkMetaData {
     unsigned int l1_index;
     unsigned int l2_index;
@@ -228,6 +253,8 @@ static void vmdk_free_extents(BlockDriverState *bs)
         e = &s->extents[i];
         g_free(e->l1_table);
         g_free(e->l2_cache);
+        g_free(e->l2_cache_offsets);
+        g_free(e->l2_cache_lru);
         g_free(e->l1_backup_table);
         g_free(e->type);
         if (e->file != bs->file) {
@@ -468,6 +495,7 @@ static int vmdk_add_extent(BlockDriverState *bs,
 static int vmdk_init_tables(BlockDriverState *bs, VmdkExtent *extent,
                             Error **errp)
 {
+    BDRVVmdkState *s = bs->opaque;
     int ret;
     size_t l1_size;
     int i;
@@ -516,8 +544,15 @@ static int vmdk_init_tables(BlockDriverState *bs, VmdkExtent *extent,
         }
     }
 
+    /* A table per L1 entry is all that the extent can ever use */
+    extent->l2_cache_entries =
+        s->l2_cache_size / (extent->l2_size * sizeof(uint32_t));
+    extent->l2_cache_entries =
+        MAX(MIN(extent->l2_cache_entries, extent->l1_size), 1);
     extent->l2_cache =
-        g_new(uint32_t, extent->l2_size * L2_CACHE_SIZE);
+        g_new(uint32_t, extent->l2_size * extent->l2_cache_entries);
+    extent->l2_cache_offsets = g_new0(uint32_t, extent->l2_cache_entries);
+    extent->l2_cache_lru = g_new0(uint64_t, extent->l2_cache_entries);
     return 0;
  fail_l1b:
     g_free(extent->l1_backup_table);
@@ -970,6 +1005,7 @@ static int vmdk_open(BlockDriverState *bs, QDict *options, int flags,
     int ret;
     BDRVVmdkState *s = bs->opaque;
     uint32_t magic;
+    QemuOpts *opts;
     Error *local_err = NULL;
 
     bs->file = bdrv_open_child(NULL, options, "file", bs, &child_file,
@@ -978,6 +1014,17 @@ static int vmdk_open(BlockDriverState *bs, QDict *options, int flags,
         return -EINVAL;
     }
 
+    opts = qemu_opts_create(&vmdk_runtime_opts, NULL, 0, &error_abort);
+    qemu_opts_absorb_qdict(opts, options, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    s->l2_cache_size = qemu_opt_get_size(opts, VMDK_OPT_L2_CACHE_SIZE,
+                                         VMDK_DEFAULT_L2_CACHE_SIZE);
+    qemu_opts_del(opts);
+
     buf = vmdk_read_desc(bs->file, 0, errp);
     if (!buf) {
         return -EINVAL;
@@ -1198,8 +1245,9 @@ static int get_cluster_offset(BlockDriverState *bs,
                               uint64_t skip_end_bytes)
 {
     unsigned int l1_index, l2_offset, l2_index;
-    int min_index, i, j;
-    uint32_t min_count, *l2_table;
+    unsigned int min_index, start, i, j;
+    uint64_t min_lru;
+    uint32_t *l2_table;
     bool zeroed = false;
     int64_t ret;
     int64_t cluster_sector;
@@ -1221,28 +1269,35 @@ static int get_cluster_offset(BlockDriverState *bs,
     if (!l2_offset) {
         return VMDK_UNALLOC;
     }
-    for (i = 0; i < L2_CACHE_SIZE; i++) {
+
+    /*
+     * The search starts where the table would be if the cache were a hash
+     * table, so that sequential accesses usually hit the first entry they
+     * look at even with a large cache.
+     */
+    start = l1_index % extent->l2_cache_entries;
+    for (j = 0; j < extent->l2_cache_entries; j++) {
+        i = start + j;
+        if (i >= extent->l2_cache_entries) {
+            i -= extent->l2_cache_entries;
+        }
         if (l2_offset == extent->l2_cache_offsets[i]) {
-            /* increment the hit count */
-            if (++extent->l2_cache_counts[i] == 0xffffffff) {
-                for (j = 0; j < L2_CACHE_SIZE; j++) {
-                    extent->l2_cache_counts[j] >>= 1;
-                }
-            }
+            extent->l2_cache_lru[i] = ++extent->l2_cache_lru_counter;
             l2_table = extent->l2_cache + (i * extent->l2_size);
             goto found;
         }
     }
-    /* not found: load a new entry in the least used one */
-    min_index = 0;
-    min_count = 0xffffffff;
-    for (i = 0; i < L2_CACHE_SIZE; i++) {
-        if (extent->l2_cache_counts[i] < min_count) {
-            min_count = extent->l2_cache_counts[i];
+    /* not found: load a new entry in the least recently used one */
+    min_index = start;
+    min_lru = UINT64_MAX;
+    for (i = 0; i < extent->l2_cache_entries; i++) {
+        if (extent->l2_cache_lru[i] < min_lru) {
+            min_lru = extent->l2_cache_lru[i];
             min_index = i;
         }
     }
     l2_table = extent->l2_cache + (min_index * extent->l2_size);
+    extent->l2_cache_offsets[min_index] = 0;
     BLKDBG_EVENT(extent->file, BLKDBG_L2_LOAD);
     if (bdrv_pread(extent->file,
                 (int64_t)l2_offset * 512,
@@ -1253,7 +1308,7 @@ static int get_cluster_offset(BlockDriverState *bs,
     }
 
     extent->l2_cache_offsets[min_index] = l2_offset;
-    extent->l2_cache_counts[min_index] = 1;
+    extent->l2_cache_lru[min_index] = ++extent->l2_cache_lru_counter;
  found:
     l2_index = ((offset >> 9) / extent->cluster_sectors) % extent->l2_size;
     cluster_sector = le32_to_cpu(l2_table[l2_index]);
@@ -1442,9 +1497,48 @@ static int vmdk_write_extent(VmdkExtent *extent, int64_t cluster_offset,
     return ret;
 }
 
-static int vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
-                            int64_t offset_in_cluster, QEMUIOVector *qiov,
-                            int bytes)
+typedef struct VmdkUncompressData {
+    uint8_t *dest;
+    uLongf dest_len;
+    const uint8_t *src;
+    uLong src_len;
+    int ret;
+} VmdkUncompressData;
+
+static int vmdk_uncompress_pool_func(void *opaque)
+{
+    VmdkUncompressData *data = opaque;
+
+    data->ret = uncompress(data->dest, &data->dest_len,
+                           data->src, data->src_len);
+    return 0;
+}
+
+/*
+ * Inflate a grain in the thread pool, so that the grains of a request can
+ * be decompressed on several host CPUs at once.
+ */
+static int coroutine_fn vmdk_co_uncompress(VmdkExtent *extent, uint8_t *dest,
+                                           uLongf *dest_len,
+                                           const uint8_t *src, uLong src_len)
+{
+    ThreadPool *pool =
+        aio_get_thread_pool(bdrv_get_aio_context(extent->file->bs));
+    VmdkUncompressData arg = {
+        .dest = dest,
+        .dest_len = *dest_len,
+        .src = src,
+        .src_len = src_len,
+    };
+
+    thread_pool_submit_co(pool, vmdk_uncompress_pool_func, &arg);
+    *dest_len = arg.dest_len;
+    return arg.ret;
+}
+
+static int coroutine_fn
+vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
+                 int64_t offset_in_cluster, QEMUIOVector *qiov, int bytes)
 {
     int ret;
     int cluster_bytes, buf_bytes;
@@ -1489,7 +1583,8 @@ static int vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
         ret = -EINVAL;
         goto out;
     }
-    ret = uncompress(uncomp_buf, &buf_len, compressed_data, data_len);
+    ret = vmdk_co_uncompress(extent, uncomp_buf, &buf_len,
+                             compressed_data, data_len);
     if (ret != Z_OK) {
         ret = -EINVAL;
         goto out;
@@ -1509,6 +1604,72 @@ static int vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
     return ret;
 }
 
+/* The compressed grains of a read request that are being read */
+typedef struct VmdkGrainReads {
+    int in_flight;
+    int ret;
+    CoQueue done;
+} VmdkGrainReads;
+
+typedef struct VmdkGrainRead {
+    VmdkGrainReads *reads;
+    VmdkExtent *extent;
+    uint64_t cluster_offset;
+    uint64_t offset_in_cluster;
+    uint64_t bytes;
+    QEMUIOVector qiov;
+} VmdkGrainRead;
+
+static void coroutine_fn vmdk_co_read_grain(void *opaque)
+{
+    VmdkGrainRead *gr = opaque;
+    VmdkGrainReads *reads = gr->reads;
+    int ret;
+
+    ret = vmdk_read_extent(gr->extent, gr->cluster_offset,
+                           gr->offset_in_cluster, &gr->qiov, gr->bytes);
+    if (ret < 0 && reads->ret == 0) {
+        reads->ret = ret;
+    }
+
+    qemu_iovec_destroy(&gr->qiov);
+    g_free(gr);
+    reads->in_flight--;
+    qemu_co_queue_restart_all(&reads->done);
+}
+
+/*
+ * Start reading a compressed grain.  Compressed grains are never rewritten
+ * once they are in the image, so this only needs s->lock until the grain
+ * is found, and several grains are decompressed at once without it.
+ */
+static void coroutine_fn
+vmdk_start_grain_read(BDRVVmdkState *s, VmdkGrainReads *reads,
+                      VmdkExtent *extent, uint64_t cluster_offset,
+                      uint64_t offset_in_cluster, QEMUIOVector *qiov,
+                      uint64_t qiov_offset, uint64_t bytes)
+{
+    VmdkGrainRead *gr;
+
+    while (reads->in_flight >= VMDK_MAX_GRAIN_READS) {
+        qemu_co_queue_wait(&reads->done, &s->lock);
+    }
+
+    gr = g_new(VmdkGrainRead, 1);
+    *gr = (VmdkGrainRead) {
+        .reads              = reads,
+        .extent             = extent,
+        .cluster_offset     = cluster_offset,
+        .offset_in_cluster  = offset_in_cluster,
+        .bytes              = bytes,
+    };
+    qemu_iovec_init(&gr->qiov, qiov->niov);
+    qemu_iovec_concat(&gr->qiov, qiov, qiov_offset, bytes);
+
+    reads->in_flight++;
+    qemu_coroutine_enter(qemu_coroutine_create(vmdk_co_read_grain, gr));
+}
+
 static int coroutine_fn
 vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                QEMUIOVector *qiov, int flags)
@@ -1520,11 +1681,13 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     QEMUIOVector local_qiov;
     uint64_t cluster_offset;
     uint64_t bytes_done = 0;
+    VmdkGrainReads reads = { 0 };
 
     qemu_iovec_init(&local_qiov, qiov->niov);
+    qemu_co_queue_init(&reads.done);
     qemu_co_mutex_lock(&s->lock);
 
-    while (bytes > 0) {
+    while (bytes > 0 && reads.ret == 0) {
         extent = find_extent(s, offset >> BDRV_SECTOR_BITS, extent);
         if (!extent) {
             ret = -EIO;
@@ -1558,6 +1721,10 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             } else {
                 qemu_iovec_memset(qiov, bytes_done, 0, n_bytes);
             }
+        } else if (extent->compressed) {
+            vmdk_start_grain_read(s, &reads, extent, cluster_offset,
+                                  offset_in_cluster, qiov, bytes_done,
+                                  n_bytes);
         } else {
             qemu_iovec_reset(&local_qiov);
             qemu_iovec_concat(&local_qiov, qiov, bytes_done, n_bytes);
@@ -1575,6 +1742,13 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
     ret = 0;
 fail:
+    /* The grain reads write into @qiov, so they must be over on return */
+    while (reads.in_flight > 0) {
+        qemu_co_queue_wait(&reads.done, &s->lock);
+    }
+    if (ret == 0) {
+        ret = reads.ret;
+    }
     qemu_co_mutex_unlock(&s->lock);
     qemu_iovec_destroy(&local_qiov);
 
@@ -2490,7 +2664,9 @@ static ImageInfo *vmdk_get_extent_info(VmdkExtent *extent)
 
 static int coroutine_fn vmdk_co_check(BlockDriverState *bs,
                                       BdrvCheckResult *result,
-                                      BdrvCheckMode fix)
+                                      BdrvCheckMode fix,
+                                      BlockDriverCheckStatusCB *status_cb,
+                                      void *cb_opaque)
 {
     BDRVVmdkState *s = bs->opaque;
     VmdkExtent *extent = NULL;
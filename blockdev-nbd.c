@@ -146,7 +146,8 @@ void qmp_nbd_server_start(SocketAddressLegacy *addr,
 
 void qmp_nbd_server_add(const char *device, bool has_name, const char *name,
                         bool has_writable, bool writable,
-                        bool has_bitmap, const char *bitmap, Error **errp)
+                        bool has_bitmap, const char *bitmap,
+                        bool has_multi_conn, bool multi_conn, Error **errp)
 {
     BlockDriverState *bs = NULL;
     BlockBackend *on_eject_blk;
@@ -188,8 +189,13 @@ void qmp_nbd_server_add(const char *device, bool has_name, const char *name,
         writable = false;
     }
 
+    if (!has_multi_conn) {
+        multi_conn = !writable;
+    }
+
     exp = nbd_export_new(bs, 0, len, name, NULL, bitmap,
-                         writable ? 0 : NBD_FLAG_READ_ONLY,
+                         (writable ? 0 : NBD_FLAG_READ_ONLY) |
+                         (multi_conn ? NBD_FLAG_CAN_MULTI_CONN : 0),
                          NULL, false, on_eject_blk, errp);
     if (!exp) {
         return;
@@ -385,6 +385,10 @@ static void extract_common_blockdev_options(QemuOpts *opts, int *bdrv_flags,
         if ((aio = qemu_opt_get(opts, "aio")) != NULL) {
             if (!strcmp(aio, "native")) {
                 *bdrv_flags |= BDRV_O_NATIVE_AIO;
+#ifdef CONFIG_LINUX_IO_URING
+            } else if (!strcmp(aio, "io_uring")) {
+                *bdrv_flags |= BDRV_O_IO_URING;
+#endif
             } else if (!strcmp(aio, "threads")) {
                 /* this is the default */
             } else {
@@ -3101,24 +3105,13 @@ void hmp_drive_del(Monitor *mon, const QDict *qdict)
     aio_context_release(aio_context);
 }
 
-void qmp_block_resize(bool has_device, const char *device,
-                      bool has_node_name, const char *node_name,
-                      int64_t size, Error **errp)
+static void block_resize_bs(BlockDriverState *bs, const char *device,
+                            int64_t size, Error **errp)
 {
-    Error *local_err = NULL;
     BlockBackend *blk = NULL;
-    BlockDriverState *bs;
     AioContext *aio_context;
     int ret;
 
-    bs = bdrv_lookup_bs(has_device ? device : NULL,
-                        has_node_name ? node_name : NULL,
-                        &local_err);
-    if (local_err) {
-        error_propagate(errp, local_err);
-        return;
-    }
-
     aio_context = bdrv_get_aio_context(bs);
     aio_context_acquire(aio_context);
 
@@ -3152,6 +3145,63 @@ out:
     aio_context_release(aio_context);
 }
 
+typedef struct BlockResizeCo {
+    Coroutine *co;
+    BlockDriverState *bs;
+    const char *device;
+    int64_t size;
+    Error **errp;
+} BlockResizeCo;
+
+static void block_resize_bh(void *opaque)
+{
+    BlockResizeCo *rco = opaque;
+
+    block_resize_bs(rco->bs, rco->device, rco->size, rco->errp);
+    aio_co_wake(rco->co);
+}
+
+void qmp_block_resize(bool has_device, const char *device,
+                      bool has_node_name, const char *node_name,
+                      int64_t size, Error **errp)
+{
+    Error *local_err = NULL;
+    BlockDriverState *bs;
+
+    bs = bdrv_lookup_bs(has_device ? device : NULL,
+                        has_node_name ? node_name : NULL,
+                        &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    /*
+     * In coroutine context the drain and the truncation yield, and the
+     * main loop keeps running meanwhile.  The AioContext lock of a node
+     * in an I/O thread must not be held across a yield, though, so resize
+     * those outside of coroutine context.
+     */
+    if (qemu_in_coroutine() &&
+        bdrv_get_aio_context(bs) != qemu_get_aio_context()) {
+        BlockResizeCo rco = {
+            .co     = qemu_coroutine_self(),
+            .bs     = bs,
+            .device = device,
+            .size   = size,
+            .errp   = errp,
+        };
+
+        bdrv_ref(bs);
+        aio_bh_schedule_oneshot(qemu_get_aio_context(), block_resize_bh, &rco);
+        qemu_coroutine_yield();
+        bdrv_unref(bs);
+        return;
+    }
+
+    block_resize_bs(bs, device, size, errp);
+}
+
 void qmp_block_stream(bool has_job_id, const char *job_id, const char *device,
                       bool has_base, const char *base,
                       bool has_base_node, const char *base_node,
@@ -4012,16 +4062,23 @@ static BlockJob *find_block_job(const char *id, AioContext **aio_context,
     return job;
 }
 
-void qmp_block_job_set_speed(const char *device, int64_t speed, Error **errp)
+void qmp_block_job_set_speed(const char *device, int64_t speed,
+                             bool has_latency_target, int64_t latency_target,
+                             Error **errp)
 {
     AioContext *aio_context;
     BlockJob *job = find_block_job(device, &aio_context, errp);
+    Error *local_err = NULL;
 
     if (!job) {
         return;
     }
 
-    block_job_set_speed(job, speed, errp);
+    block_job_set_speed(job, speed, &local_err);
+    if (!local_err && has_latency_target) {
+        block_job_set_latency_target(job, latency_target, &local_err);
+    }
+    error_propagate(errp, local_err);
     aio_context_release(aio_context);
 }
 
@@ -36,6 +36,13 @@
 #include "qemu/coroutine.h"
 #include "qemu/timer.h"
 
+/* How often the guest latency is checked against the target */
+#define BLOCK_JOB_LATENCY_INTERVAL (2 * BLOCK_JOB_SLICE_TIME)
+/* Speed limits while a latency target is set, in bytes per second */
+#define BLOCK_JOB_LATENCY_MIN_SPEED (1 << 20)
+#define BLOCK_JOB_LATENCY_START_SPEED (64 << 20)
+#define BLOCK_JOB_LATENCY_MAX_SPEED (1LL << 40)
+
 /*
  * The block job API is composed of two categories of functions.
  *
@@ -85,12 +92,19 @@ static void block_job_attached_aio_context(AioContext *new_context,
                                            void *opaque);
 static void block_job_detach_aio_context(void *opaque);
 
+static void block_job_latency_blks_free(BlockJob *job)
+{
+    g_slist_free_full(job->latency_blks, (GDestroyNotify)blk_unref);
+    job->latency_blks = NULL;
+}
+
 void block_job_free(Job *job)
 {
     BlockJob *bjob = container_of(job, BlockJob, job);
     BlockDriverState *bs = blk_bs(bjob->blk);
 
     bs->job = NULL;
+    block_job_latency_blks_free(bjob);
     block_job_remove_all_bdrv(bjob);
     blk_remove_aio_context_notifier(bjob->blk,
                                     block_job_attached_aio_context,
@@ -254,9 +268,17 @@ void block_job_set_speed(BlockJob *job, int64_t speed, Error **errp)
         return;
     }
 
-    ratelimit_set_speed(&job->limit, speed, BLOCK_JOB_SLICE_TIME);
-
     job->speed = speed;
+    if (job->latency_target_ns) {
+        if (speed) {
+            job->latency_speed = MIN(job->latency_speed, speed);
+        }
+        ratelimit_set_speed(&job->limit, job->latency_speed,
+                            BLOCK_JOB_SLICE_TIME);
+    } else {
+        ratelimit_set_speed(&job->limit, speed, BLOCK_JOB_SLICE_TIME);
+    }
+
     if (speed && speed <= old_speed) {
         return;
     }
@@ -265,9 +287,111 @@ void block_job_set_speed(BlockJob *job, int64_t speed, Error **errp)
     job_enter_cond(&job->job, job_timer_pending);
 }
 
+static void block_job_get_latency_buckets(BlockJob *job, uint64_t *buckets)
+{
+    static const enum BlockAcctType types[] = {
+        BLOCK_ACCT_READ, BLOCK_ACCT_WRITE
+    };
+    uint64_t blk_buckets[BLOCK_ACCT_LATENCY_BUCKETS];
+    GSList *l;
+    int i, t;
+
+    memset(buckets, 0, sizeof(blk_buckets));
+    for (l = job->latency_blks; l; l = l->next) {
+        for (t = 0; t < ARRAY_SIZE(types); t++) {
+            block_acct_get_latency_buckets(blk_get_stats(l->data), types[t],
+                                           blk_buckets);
+            for (i = 0; i < BLOCK_ACCT_LATENCY_BUCKETS; i++) {
+                buckets[i] += blk_buckets[i];
+            }
+        }
+    }
+}
+
+void block_job_set_latency_target(BlockJob *job, int64_t target_us,
+                                  Error **errp)
+{
+    BlockDriverState *bs = blk_bs(job->blk);
+    BlockBackend *blk = NULL;
+
+    if (job_apply_verb(&job->job, JOB_VERB_SET_SPEED, errp)) {
+        return;
+    }
+    if (target_us < 0 || target_us > INT64_MAX / SCALE_US) {
+        error_setg(errp, QERR_INVALID_PARAMETER, "latency-target");
+        return;
+    }
+
+    block_job_latency_blks_free(job);
+    job->latency_target_ns = target_us * SCALE_US;
+    if (!target_us) {
+        ratelimit_set_speed(&job->limit, job->speed, BLOCK_JOB_SLICE_TIME);
+        job_enter_cond(&job->job, job_timer_pending);
+        return;
+    }
+
+    /* Watch the guest devices that (indirectly) use the job's node */
+    while ((blk = blk_all_next(blk)) != NULL) {
+        if (blk != job->blk && blk_get_attached_dev(blk) &&
+            bdrv_chain_contains(blk_bs(blk), bs))
+        {
+            blk_ref(blk);
+            job->latency_blks = g_slist_prepend(job->latency_blks, blk);
+        }
+    }
+
+    job->latency_speed = BLOCK_JOB_LATENCY_START_SPEED;
+    if (job->speed) {
+        job->latency_speed = MIN(job->latency_speed, job->speed);
+    }
+    ratelimit_set_speed(&job->limit, job->latency_speed, BLOCK_JOB_SLICE_TIME);
+
+    job->latency_check_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    block_job_get_latency_buckets(job, job->latency_buckets);
+}
+
+/* Halve the speed when the guest latency exceeded the target since the
+ * last check, otherwise increase it by a quarter */
+static void block_job_check_latency(BlockJob *job)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    uint64_t buckets[BLOCK_ACCT_LATENCY_BUCKETS];
+    int64_t p99, speed;
+    int i;
+
+    if (now - job->latency_check_ns < BLOCK_JOB_LATENCY_INTERVAL) {
+        return;
+    }
+    job->latency_check_ns = now;
+
+    block_job_get_latency_buckets(job, buckets);
+    for (i = 0; i < BLOCK_ACCT_LATENCY_BUCKETS; i++) {
+        uint64_t n = buckets[i];
+        buckets[i] -= job->latency_buckets[i];
+        job->latency_buckets[i] = n;
+    }
+    p99 = block_acct_latency_percentile(buckets, 990);
+
+    if (p99 > job->latency_target_ns) {
+        speed = job->latency_speed / 2;
+    } else {
+        speed = job->latency_speed + job->latency_speed / 4;
+    }
+    speed = MAX(speed, BLOCK_JOB_LATENCY_MIN_SPEED);
+    speed = MIN(speed, job->speed ?: BLOCK_JOB_LATENCY_MAX_SPEED);
+
+    trace_block_job_check_latency(job, p99, speed);
+    if (speed != job->latency_speed) {
+        job->latency_speed = speed;
+        ratelimit_set_speed(&job->limit, speed, BLOCK_JOB_SLICE_TIME);
+    }
+}
+
 int64_t block_job_ratelimit_get_delay(BlockJob *job, uint64_t n)
 {
-    if (!job->speed) {
+    if (job->latency_target_ns) {
+        block_job_check_latency(job);
+    } else if (!job->speed) {
         return 0;
     }
 
@@ -276,6 +400,7 @@ int64_t block_job_ratelimit_get_delay(BlockJob *job, uint64_t n)
 
 BlockJobInfo *block_job_query(BlockJob *job, Error **errp)
 {
+    const BlockJobDriver *drv = block_job_driver(job);
     BlockJobInfo *info;
 
     if (block_job_is_internal(job)) {
@@ -297,6 +422,15 @@ BlockJobInfo *block_job_query(BlockJob *job, Error **errp)
     info->auto_dismiss  = job->job.auto_dismiss;
     info->has_error = job->job.ret != 0;
     info->error     = job->job.ret ? g_strdup(strerror(-job->job.ret)) : NULL;
+    if (job->latency_target_ns) {
+        info->has_latency_target = true;
+        info->latency_target = job->latency_target_ns / SCALE_US;
+        info->has_latency_speed = true;
+        info->latency_speed = job->latency_speed;
+    }
+    if (drv->query) {
+        drv->query(job, info);
+    }
     return info;
 }
 
@@ -402,6 +536,8 @@ void *block_job_create(const char *job_id, const BlockJobDriver *driver,
         blk_unref(blk);
         return NULL;
     }
+    /* Let the guest go first on the node */
+    blk_set_io_priority(blk, BLK_IO_PRIO_LOW);
 
     job = job_create(job_id, &driver->job_driver, txn, blk_get_aio_context(blk),
                      flags, cb, opaque, errp);
@@ -22,6 +22,7 @@
  * THE SOFTWARE.
  */
 #include "qemu/osdep.h"
+#include "qemu/iov.h"
 #include "chardev/char-io.h"
 
 typedef struct IOWatchPoll {
@@ -109,38 +110,57 @@ void remove_fd_in_watch(Chardev *chr)
     }
 }
 
-int io_channel_send_full(QIOChannel *ioc,
-                         const void *buf, size_t len,
-                         int *fds, size_t nfds)
+int io_channel_sendv_full(QIOChannel *ioc,
+                          const struct iovec *iov, unsigned int niov,
+                          int *fds, size_t nfds)
 {
+    size_t len = iov_size(iov, niov);
     size_t offset = 0;
+    /* Only copied if a short write has to be resumed */
+    struct iovec *local_iov = NULL, *cur = NULL;
 
     while (offset < len) {
         ssize_t ret = 0;
-        struct iovec iov = { .iov_base = (char *)buf + offset,
-                             .iov_len = len - offset };
 
         ret = qio_channel_writev_full(
-            ioc, &iov, 1,
-            fds, nfds, NULL);
+            ioc, cur ? cur : iov, niov,
+            fds, nfds, 0, NULL);
         if (ret == QIO_CHANNEL_ERR_BLOCK) {
             if (offset) {
-                return offset;
+                break;
             }
 
+            g_free(local_iov);
             errno = EAGAIN;
             return -1;
         } else if (ret < 0) {
+            g_free(local_iov);
             errno = EINVAL;
             return -1;
         }
 
         offset += ret;
+        if (offset < len) {
+            if (!local_iov) {
+                cur = local_iov = g_memdup(iov, niov * sizeof(*iov));
+            }
+            iov_discard_front(&cur, &niov, ret);
+        }
     }
 
+    g_free(local_iov);
     return offset;
 }
 
+int io_channel_send_full(QIOChannel *ioc,
+                         const void *buf, size_t len,
+                         int *fds, size_t nfds)
+{
+    struct iovec iov = { .iov_base = (char *)buf, .iov_len = len };
+
+    return io_channel_sendv_full(ioc, &iov, 1, fds, nfds);
+}
+
 int io_channel_send(QIOChannel *ioc, const void *buf, size_t len)
 {
     return io_channel_send_full(ioc, buf, len, NULL, 0);
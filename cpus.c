@@ -41,6 +41,7 @@
 #include "sysemu/hvf.h"
 #include "sysemu/whpx.h"
 #include "exec/exec-all.h"
+#include "exec/cputlb.h"
 
 #include "qemu/thread.h"
 #include "sysemu/cpus.h"
@@ -53,6 +54,8 @@
 #include "hw/nmi.h"
 #include "sysemu/replay.h"
 #include "hw/boards.h"
+#include "sysemu/numa.h"
+#include "trace-root.h"
 
 #ifdef CONFIG_LINUX
 
@@ -93,6 +96,9 @@ static bool cpu_thread_is_idle(CPUState *cpu)
     if (cpu->stop || cpu->queued_work_first) {
         return false;
     }
+    if (cpu->icount_quantum_wait) {
+        return true;
+    }
     if (cpu_is_stopped(cpu)) {
         return true;
     }
@@ -123,6 +129,8 @@ static bool all_cpu_threads_idle(void)
 static bool icount_sleep = true;
 /* Arbitrarily pick 1MIPS as the minimum allowable speed.  */
 #define MAX_ICOUNT_SHIFT 10
+/* Default length of the quanta of icount with MTTCG, in instructions */
+#define ICOUNT_QUANTUM_DEFAULT 100000
 
 typedef struct TimersState {
     /* Protected by BQL.  */
@@ -158,6 +166,21 @@ typedef struct TimersState {
 static TimersState timers_state;
 bool mttcg_enabled;
 
+/*
+ * icount with MTTCG: vCPUs run in parallel, but virtual time only moves
+ * at the end of a quantum, once every vCPU that is not halted has run
+ * the same number of instructions.  A vCPU that reads the clock sees
+ * its own progress in the quantum on top of that.  Virtual timers fire
+ * at the end of a quantum, which never goes past the deadline that was
+ * known when it started.  Protected by BQL.
+ */
+static struct {
+    uint64_t gen;           /* Number of the current quantum */
+    int64_t len;            /* Its length in instructions */
+    int active;             /* vCPUs that have yet to finish it */
+} icount_quantum;
+static int64_t icount_quantum_max = ICOUNT_QUANTUM_DEFAULT;
+
 /*
  * We default to false if we know other options have been enabled
  * which are currently incompatible with MTTCG. Otherwise when each
@@ -200,15 +223,32 @@ static bool default_mttcg_enabled(void)
     }
 }
 
+void qemu_halt_poll_configure(QemuOpts *opts, Error **errp)
+{
+    uint64_t poll_ns = qemu_opt_get_number(opts, "halt-poll-ns", 0);
+
+    if (poll_ns > HALT_POLL_NS_MAX) {
+        error_setg(errp, "'halt-poll-ns' must be at most %d",
+                   HALT_POLL_NS_MAX);
+        return;
+    }
+    halt_poll_ns_default = poll_ns;
+}
+
 void qemu_tcg_configure(QemuOpts *opts, Error **errp)
 {
     const char *t = qemu_opt_get(opts, "thread");
+    uint64_t bits;
+#ifdef CONFIG_TCG
+    uint64_t vtlb_size;
+#endif
+
     if (t) {
         if (strcmp(t, "multi") == 0) {
             if (TCG_OVERSIZED_GUEST) {
                 error_setg(errp, "No MTTCG when guest word size > hosts");
-            } else if (use_icount) {
-                error_setg(errp, "No MTTCG when icount is enabled");
+            } else if (replay_mode != REPLAY_MODE_NONE) {
+                error_setg(errp, "No MTTCG when record/replay is enabled");
             } else {
 #ifndef TARGET_SUPPORTS_MTTCG
                 warn_report("Guest not yet converted to MTTCG - "
@@ -229,6 +269,28 @@ void qemu_tcg_configure(QemuOpts *opts, Error **errp)
     } else {
         mttcg_enabled = default_mttcg_enabled();
     }
+
+#ifdef CONFIG_TCG
+    tcg_hot_tb_threshold = MIN(qemu_opt_get_number(opts, "hot-tb-threshold",
+                                                   0), UINT32_MAX);
+
+    vtlb_size = qemu_opt_get_number(opts, "vtlb-size", CPU_VTLB_SIZE_DEFAULT);
+    if (vtlb_size < 1 || vtlb_size > CPU_VTLB_SIZE_MAX) {
+        error_setg(errp, "'vtlb-size' must be between 1 and %d",
+                   CPU_VTLB_SIZE_MAX);
+        return;
+    }
+    cpu_vtlb_size = vtlb_size;
+#endif
+
+    bits = qemu_opt_get_number(opts, "tb-jmp-cache-bits",
+                               TB_JMP_CACHE_BITS_DEFAULT);
+    if (bits < TB_JMP_CACHE_BITS_MIN || bits > TB_JMP_CACHE_BITS_MAX) {
+        error_setg(errp, "'tb-jmp-cache-bits' must be between %d and %d",
+                   TB_JMP_CACHE_BITS_MIN, TB_JMP_CACHE_BITS_MAX);
+        return;
+    }
+    tb_jmp_cache_bits = bits;
 }
 
 /* The current number of executed instructions is based on what we
@@ -250,6 +312,12 @@ static void cpu_update_icount_locked(CPUState *cpu)
     int64_t executed = cpu_get_icount_executed(cpu);
     cpu->icount_budget -= executed;
 
+    if (qemu_tcg_mttcg_enabled()) {
+        /* Global time only moves at the end of a quantum */
+        cpu->icount_quantum_done += executed;
+        return;
+    }
+
     atomic_set_i64(&timers_state.qemu_icount,
                    timers_state.qemu_icount + executed);
 }
@@ -280,6 +348,11 @@ static int64_t cpu_get_icount_raw_locked(void)
         /* Take into account what has run */
         cpu_update_icount_locked(cpu);
     }
+    if (cpu && cpu->icount_in_quantum) {
+        /* With MTTCG, add what this vCPU ran since the quantum started */
+        return atomic_read_i64(&timers_state.qemu_icount) +
+               cpu->icount_quantum_done;
+    }
     /* The read is protected by the seqlock, but needs atomic64 to avoid UB */
     return atomic_read_i64(&timers_state.qemu_icount);
 }
@@ -868,6 +941,13 @@ void configure_icount(QemuOpts *opts, Error **errp)
 
     icount_align_option = qemu_opt_get_bool(opts, "align", false);
 
+    icount_quantum_max = qemu_opt_get_number(opts, "quantum",
+                                             ICOUNT_QUANTUM_DEFAULT);
+    if (icount_quantum_max < 1 || icount_quantum_max > INT32_MAX) {
+        error_setg(errp, "icount: quantum must be between 1 and %d",
+                   INT32_MAX);
+    }
+
     if (icount_align_option && !icount_sleep) {
         error_setg(errp, "align=on and sleep=off are incompatible");
     }
@@ -924,10 +1004,20 @@ static QEMUTimer *tcg_kick_vcpu_timer;
 static CPUState *tcg_current_rr_cpu;
 
 #define TCG_KICK_PERIOD (NANOSECONDS_PER_SECOND / 10)
+#define TCG_KICK_PERIOD_MIN (NANOSECONDS_PER_SECOND / 1000)
+
+/*
+ * The time slice shrinks while vCPUs keep giving spin-loop hints, since
+ * they are then likely waiting for a lock held by a vCPU that is not
+ * running, and grows back to TCG_KICK_PERIOD when they stop.  Both are
+ * protected by the BQL.
+ */
+static int64_t tcg_kick_period = TCG_KICK_PERIOD;
+static unsigned int tcg_spin_hints;
 
 static inline int64_t qemu_tcg_next_kick(void)
 {
-    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + TCG_KICK_PERIOD;
+    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + tcg_kick_period;
 }
 
 /* Kick the currently round-robin scheduled vCPU */
@@ -973,6 +1063,12 @@ void qemu_timer_notify_cb(void *opaque, QEMUClockType type)
 
 static void kick_tcg_thread(void *opaque)
 {
+    if (tcg_spin_hints) {
+        tcg_kick_period = MAX(tcg_kick_period / 2, TCG_KICK_PERIOD_MIN);
+    } else {
+        tcg_kick_period = MIN(tcg_kick_period * 2, TCG_KICK_PERIOD);
+    }
+    tcg_spin_hints = 0;
     timer_mod(tcg_kick_vcpu_timer, qemu_tcg_next_kick());
     qemu_cpu_kick_rr_cpu();
 }
@@ -1236,8 +1332,59 @@ static void qemu_tcg_rr_wait_io_event(void)
     }
 }
 
+/*
+ * Busy wait for up to cpu->halt_poll_ns for the halted vCPU to be woken
+ * up, and only then fall back to sleeping on halt_cond: an interrupt that
+ * comes in that window reaches the guest without a futex sleep and wakeup.
+ * This covers the paths where KVM cannot poll itself, i.e. TCG and KVM
+ * without the in-kernel irqchip.
+ *
+ * Called with the BQL held, released while polling.
+ */
+static void qemu_halt_poll(CPUState *cpu)
+{
+    uint64_t poll_ns = atomic_read(&cpu->halt_poll_ns);
+    uint32_t interrupt_request;
+    int64_t start;
+
+    if (!poll_ns || !cpu_thread_is_idle(cpu) || cpu_is_stopped(cpu)) {
+        return;
+    }
+
+    /*
+     * Whatever wakes the vCPU up changes one of these fields, so there's
+     * no need for the BQL until something does.
+     */
+    interrupt_request = atomic_read(&cpu->interrupt_request);
+    qemu_mutex_unlock_iothread();
+
+    start = get_clock();
+    do {
+        if (atomic_read(&cpu->interrupt_request) != interrupt_request ||
+            atomic_read(&cpu->exit_request) ||
+            atomic_read(&cpu->thread_kicked) ||
+            atomic_read(&cpu->queued_work_first) ||
+            atomic_read(&cpu->stop)) {
+            break;
+        }
+        cpu_relax();
+    } while (get_clock() - start < poll_ns);
+
+    qemu_mutex_lock_iothread();
+
+    if (cpu_thread_is_idle(cpu)) {
+        cpu->halt_poll_failures++;
+        trace_qemu_halt_poll(cpu->cpu_index, false, get_clock() - start);
+    } else {
+        cpu->halt_poll_successes++;
+        trace_qemu_halt_poll(cpu->cpu_index, true, get_clock() - start);
+    }
+}
+
 static void qemu_wait_io_event(CPUState *cpu)
 {
+    qemu_halt_poll(cpu);
+
     while (cpu_thread_is_idle(cpu)) {
         qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
     }
@@ -1376,6 +1523,77 @@ static void handle_icount_deadline(void)
     }
 }
 
+static int64_t icount_quantum_limit(void)
+{
+    return MAX(1, MIN(icount_quantum_max, tcg_get_icount_limit()));
+}
+
+/* Called with BQL before @cpu runs, in icount with MTTCG */
+static void icount_quantum_join(CPUState *cpu)
+{
+    if (cpu->icount_in_quantum) {
+        return;
+    }
+    if (!icount_quantum.active) {
+        /* All vCPUs were idle, account the time they slept */
+        qemu_account_warp_timer();
+        if (!icount_quantum.len) {
+            icount_quantum.len = icount_quantum_limit();
+        }
+    }
+    if (cpu->icount_quantum_gen != icount_quantum.gen) {
+        cpu->icount_quantum_gen = icount_quantum.gen;
+        cpu->icount_quantum_done = 0;
+    }
+    cpu->icount_in_quantum = true;
+    icount_quantum.active++;
+}
+
+/* Called with BQL by the last vCPU to finish a quantum */
+static void icount_quantum_end(void)
+{
+    CPUState *cpu;
+
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    atomic_set_i64(&timers_state.qemu_icount,
+                   timers_state.qemu_icount + icount_quantum.len);
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+    icount_quantum.gen++;
+
+    handle_icount_deadline();
+    icount_quantum.len = icount_quantum_limit();
+
+    CPU_FOREACH(cpu) {
+        if (cpu->icount_quantum_wait) {
+            cpu->icount_quantum_wait = false;
+            qemu_cond_broadcast(cpu->halt_cond);
+        }
+    }
+}
+
+/*
+ * Called with BQL after @cpu ran, in icount with MTTCG.  A vCPU that
+ * halts leaves the quantum, one that finished it waits for the others.
+ */
+static void icount_quantum_check(CPUState *cpu)
+{
+    bool finished = cpu->icount_quantum_done >= icount_quantum.len;
+
+    if (!cpu->icount_in_quantum ||
+        (!finished && !cpu->halted && !cpu->unplug)) {
+        return;
+    }
+
+    cpu->icount_in_quantum = false;
+    if (--icount_quantum.active == 0) {
+        icount_quantum_end();
+    } else if (finished) {
+        cpu->icount_quantum_wait = true;
+    }
+}
+
 static void prepare_icount_for_run(CPUState *cpu)
 {
     if (use_icount) {
@@ -1388,7 +1606,11 @@ static void prepare_icount_for_run(CPUState *cpu)
         g_assert(cpu->icount_decr.u16.low == 0);
         g_assert(cpu->icount_extra == 0);
 
-        cpu->icount_budget = tcg_get_icount_limit();
+        if (qemu_tcg_mttcg_enabled()) {
+            cpu->icount_budget = icount_quantum.len - cpu->icount_quantum_done;
+        } else {
+            cpu->icount_budget = tcg_get_icount_limit();
+        }
         insns_left = MIN(0xffff, cpu->icount_budget);
         cpu->icount_decr.u16.low = insns_left;
         cpu->icount_extra = cpu->icount_budget - insns_left;
@@ -1525,6 +1747,12 @@ static void *qemu_tcg_rr_cpu_thread_fn(void *arg)
             if (cpu_can_run(cpu)) {
                 int r;
 
+                if (cpu->halted && !cpu_has_work(cpu)) {
+                    /* Nothing for it to do until it is woken up */
+                    cpu = CPU_NEXT(cpu);
+                    continue;
+                }
+
                 qemu_mutex_unlock_iothread();
                 prepare_icount_for_run(cpu);
 
@@ -1541,6 +1769,12 @@ static void *qemu_tcg_rr_cpu_thread_fn(void *arg)
                     cpu_exec_step_atomic(cpu);
                     qemu_mutex_lock_iothread();
                     break;
+                } else if (r == EXCP_YIELD) {
+                    /* Give the next vCPU a whole slice of its own */
+                    tcg_spin_hints++;
+                    if (tcg_kick_vcpu_timer) {
+                        timer_mod(tcg_kick_vcpu_timer, qemu_tcg_next_kick());
+                    }
                 }
             } else if (cpu->stop) {
                 if (cpu->unplug) {
@@ -1710,7 +1944,6 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     CPUState *cpu = arg;
 
     assert(tcg_enabled());
-    g_assert(!use_icount);
 
     rcu_register_thread();
     tcg_register_thread();
@@ -1728,10 +1961,16 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     cpu->exit_request = 1;
 
     do {
-        if (cpu_can_run(cpu)) {
+        if (cpu_can_run(cpu) && !cpu->icount_quantum_wait) {
             int r;
+
+            if (use_icount) {
+                icount_quantum_join(cpu);
+            }
             qemu_mutex_unlock_iothread();
+            prepare_icount_for_run(cpu);
             r = tcg_cpu_exec(cpu);
+            process_icount_data(cpu);
             qemu_mutex_lock_iothread();
             switch (r) {
             case EXCP_DEBUG:
@@ -1755,12 +1994,19 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
                 /* Ignore everything else? */
                 break;
             }
+            if (use_icount) {
+                icount_quantum_check(cpu);
+            }
         }
 
         atomic_mb_set(&cpu->exit_request, 0);
         qemu_wait_io_event(cpu);
     } while (!cpu->unplug || cpu_can_run(cpu));
 
+    if (use_icount) {
+        /* Don't let the others wait for us */
+        icount_quantum_check(cpu);
+    }
     qemu_tcg_destroy_vcpu(cpu);
     cpu->created = false;
     qemu_cond_signal(&qemu_cpu_cond);
@@ -2065,6 +2311,38 @@ static void qemu_dummy_start_vcpu(CPUState *cpu)
                        QEMU_THREAD_JOINABLE);
 }
 
+/*
+ * Pin the thread of @cpu to the host-cpus of its NUMA node.  With
+ * single-threaded TCG, one thread runs all VCPUs and is left alone.
+ */
+static void qemu_vcpu_set_affinity(CPUState *cpu)
+{
+    MachineClass *mc = MACHINE_GET_CLASS(current_machine);
+    CpuInstanceProperties props;
+    int ret;
+
+    if (!nb_numa_nodes || !mc->cpu_index_to_instance_props ||
+        (tcg_enabled() && !qemu_tcg_mttcg_enabled())) {
+        return;
+    }
+
+    props = mc->cpu_index_to_instance_props(current_machine, cpu->cpu_index);
+    if (!props.has_node_id ||
+        bitmap_empty(numa_info[props.node_id].host_cpus,
+                     QEMU_THREAD_MAX_CPUS)) {
+        return;
+    }
+
+    ret = qemu_thread_set_affinity(cpu->thread,
+                                   numa_info[props.node_id].host_cpus,
+                                   QEMU_THREAD_MAX_CPUS);
+    if (ret < 0) {
+        warn_report("Could not pin the thread of CPU %d to the host-cpus "
+                    "of node %" PRId64 ": %s", cpu->cpu_index,
+                    props.node_id, strerror(-ret));
+    }
+}
+
 void qemu_init_vcpu(CPUState *cpu)
 {
     cpu->nr_cores = smp_cores;
@@ -2092,6 +2370,7 @@ void qemu_init_vcpu(CPUState *cpu)
     } else {
         qemu_dummy_start_vcpu(cpu);
     }
+    qemu_vcpu_set_affinity(cpu);
 
     while (!cpu->created) {
         qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
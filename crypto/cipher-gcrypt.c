@@ -59,7 +59,9 @@ bool qcrypto_cipher_supports(QCryptoCipherAlgorithm alg,
 typedef struct QCryptoCipherGcrypt QCryptoCipherGcrypt;
 struct QCryptoCipherGcrypt {
     gcry_cipher_hd_t handle;
+#ifndef CONFIG_GCRYPT_XTS
     gcry_cipher_hd_t tweakhandle;
+#endif
     size_t blocksize;
     /* Initialization vector or Counter */
     uint8_t *iv;
@@ -74,9 +76,11 @@ qcrypto_gcrypt_cipher_free_ctx(QCryptoCipherGcrypt *ctx,
     }
 
     gcry_cipher_close(ctx->handle);
+#ifndef CONFIG_GCRYPT_XTS
     if (mode == QCRYPTO_CIPHER_MODE_XTS) {
         gcry_cipher_close(ctx->tweakhandle);
     }
+#endif
     g_free(ctx->iv);
     g_free(ctx);
 }
@@ -94,8 +98,15 @@ static QCryptoCipherGcrypt *qcrypto_cipher_ctx_new(QCryptoCipherAlgorithm alg,
 
     switch (mode) {
     case QCRYPTO_CIPHER_MODE_ECB:
+        gcrymode = GCRY_CIPHER_MODE_ECB;
+        break;
     case QCRYPTO_CIPHER_MODE_XTS:
+#ifdef CONFIG_GCRYPT_XTS
+        /* Whole sectors at a time, and with AES-NI where there is one */
+        gcrymode = GCRY_CIPHER_MODE_XTS;
+#else
         gcrymode = GCRY_CIPHER_MODE_ECB;
+#endif
         break;
     case QCRYPTO_CIPHER_MODE_CBC:
         gcrymode = GCRY_CIPHER_MODE_CBC;
@@ -172,6 +183,7 @@ static QCryptoCipherGcrypt *qcrypto_cipher_ctx_new(QCryptoCipherAlgorithm alg,
                    gcry_strerror(err));
         goto error;
     }
+#ifndef CONFIG_GCRYPT_XTS
     if (mode == QCRYPTO_CIPHER_MODE_XTS) {
         err = gcry_cipher_open(&ctx->tweakhandle, gcryalg, gcrymode, 0);
         if (err != 0) {
@@ -180,6 +192,7 @@ static QCryptoCipherGcrypt *qcrypto_cipher_ctx_new(QCryptoCipherAlgorithm alg,
             goto error;
         }
     }
+#endif
 
     if (alg == QCRYPTO_CIPHER_ALG_DES_RFB) {
         /* We're using standard DES cipher from gcrypt, so we need
@@ -191,6 +204,7 @@ static QCryptoCipherGcrypt *qcrypto_cipher_ctx_new(QCryptoCipherAlgorithm alg,
         g_free(rfbkey);
         ctx->blocksize = 8;
     } else {
+#ifndef CONFIG_GCRYPT_XTS
         if (mode == QCRYPTO_CIPHER_MODE_XTS) {
             nkey /= 2;
             err = gcry_cipher_setkey(ctx->handle, key, nkey);
@@ -203,6 +217,9 @@ static QCryptoCipherGcrypt *qcrypto_cipher_ctx_new(QCryptoCipherAlgorithm alg,
         } else {
             err = gcry_cipher_setkey(ctx->handle, key, nkey);
         }
+#else
+        err = gcry_cipher_setkey(ctx->handle, key, nkey);
+#endif
         if (err != 0) {
             error_setg(errp, "Cannot set key: %s",
                        gcry_strerror(err));
@@ -253,6 +270,7 @@ qcrypto_gcrypt_cipher_ctx_free(QCryptoCipher *cipher)
 }
 
 
+#ifndef CONFIG_GCRYPT_XTS
 static void qcrypto_gcrypt_xts_encrypt(const void *ctx,
                                        size_t length,
                                        uint8_t *dst,
@@ -272,6 +290,7 @@ static void qcrypto_gcrypt_xts_decrypt(const void *ctx,
     err = gcry_cipher_decrypt((gcry_cipher_hd_t)ctx, dst, length, src, length);
     g_assert(err == 0);
 }
+#endif
 
 static int
 qcrypto_gcrypt_cipher_encrypt(QCryptoCipher *cipher,
@@ -290,10 +309,23 @@ qcrypto_gcrypt_cipher_encrypt(QCryptoCipher *cipher,
     }
 
     if (cipher->mode == QCRYPTO_CIPHER_MODE_XTS) {
+#ifdef CONFIG_GCRYPT_XTS
+        /* gcrypt moves the tweak on, but each call starts from the IV */
+        err = gcry_cipher_setiv(ctx->handle, ctx->iv, ctx->blocksize);
+        if (err == 0) {
+            err = gcry_cipher_encrypt(ctx->handle, out, len, in, len);
+        }
+        if (err != 0) {
+            error_setg(errp, "Cannot encrypt data: %s",
+                       gcry_strerror(err));
+            return -1;
+        }
+#else
         xts_encrypt(ctx->handle, ctx->tweakhandle,
                     qcrypto_gcrypt_xts_encrypt,
                     qcrypto_gcrypt_xts_decrypt,
                     ctx->iv, len, out, in);
+#endif
     } else {
         err = gcry_cipher_encrypt(ctx->handle,
                                   out, len,
@@ -326,10 +358,23 @@ qcrypto_gcrypt_cipher_decrypt(QCryptoCipher *cipher,
     }
 
     if (cipher->mode == QCRYPTO_CIPHER_MODE_XTS) {
+#ifdef CONFIG_GCRYPT_XTS
+        /* gcrypt moves the tweak on, but each call starts from the IV */
+        err = gcry_cipher_setiv(ctx->handle, ctx->iv, ctx->blocksize);
+        if (err == 0) {
+            err = gcry_cipher_decrypt(ctx->handle, out, len, in, len);
+        }
+        if (err != 0) {
+            error_setg(errp, "Cannot decrypt data: %s",
+                       gcry_strerror(err));
+            return -1;
+        }
+#else
         xts_decrypt(ctx->handle, ctx->tweakhandle,
                     qcrypto_gcrypt_xts_encrypt,
                     qcrypto_gcrypt_xts_decrypt,
                     ctx->iv, len, out, in);
+#endif
     } else {
         err = gcry_cipher_decrypt(ctx->handle,
                                   out, len,
@@ -31,6 +31,14 @@
 
 
 #include <gnutls/x509.h>
+#ifdef CONFIG_GNUTLS_KTLS
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
 
 
 struct QCryptoTLSSession {
@@ -548,6 +556,131 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 }
 
 
+#ifdef CONFIG_GNUTLS_KTLS
+typedef union {
+    struct tls_crypto_info info;
+    struct tls12_crypto_info_aes_gcm_128 aes128;
+#ifdef TLS_CIPHER_AES_GCM_256
+    struct tls12_crypto_info_aes_gcm_256 aes256;
+#endif
+} QCryptoTLSSessionKTLSInfo;
+
+#define QCRYPTO_TLS_KTLS_FILL(ci, salt, seq, key)               \
+    do {                                                        \
+        /* The explicit nonce of TLS 1.2 GCM is the sequence */ \
+        memcpy((ci).iv, (seq), sizeof((ci).iv));                \
+        memcpy((ci).rec_seq, (seq), sizeof((ci).rec_seq));      \
+        memcpy((ci).salt, (salt)->data, sizeof((ci).salt));     \
+        memcpy((ci).key, (key)->data, sizeof((ci).key));        \
+    } while (0)
+
+static int
+qcrypto_tls_session_offload_one(QCryptoTLSSession *session,
+                                int fd, bool read,
+                                Error **errp)
+{
+    QCryptoTLSSessionKTLSInfo ci = {
+        .info.version = TLS_1_2_VERSION,
+    };
+    gnutls_datum_t mac, salt, key;
+    unsigned char seq[8];
+    socklen_t len;
+    int ret;
+
+    ret = gnutls_record_get_state(session->handle, read,
+                                  &mac, &salt, &key, seq);
+    if (ret < 0) {
+        error_setg(errp, "Cannot get TLS record state: %s",
+                   gnutls_strerror(ret));
+        return -1;
+    }
+
+    switch (gnutls_cipher_get(session->handle)) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        ci.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        QCRYPTO_TLS_KTLS_FILL(ci.aes128, &salt, seq, &key);
+        len = sizeof(ci.aes128);
+        break;
+#ifdef TLS_CIPHER_AES_GCM_256
+    case GNUTLS_CIPHER_AES_256_GCM:
+        ci.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        QCRYPTO_TLS_KTLS_FILL(ci.aes256, &salt, seq, &key);
+        len = sizeof(ci.aes256);
+        break;
+#endif
+    default:
+        error_setg(errp, "Kernel TLS does not support cipher %s",
+                   gnutls_cipher_get_name(
+                       gnutls_cipher_get(session->handle)));
+        return -1;
+    }
+
+    ret = setsockopt(fd, SOL_TLS, read ? TLS_RX : TLS_TX, &ci, len);
+    memset(&ci, 0, sizeof(ci));
+    if (ret < 0) {
+        error_setg_errno(errp, errno, "Cannot set kernel TLS %s keys",
+                         read ? "receive" : "transmit");
+        return -1;
+    }
+    return 0;
+}
+
+
+int
+qcrypto_tls_session_offload(QCryptoTLSSession *session,
+                            int fd,
+                            Error **errp)
+{
+    int ret = 0;
+
+    if (!session->handshakeComplete) {
+        error_setg(errp, "TLS handshake is not complete");
+        return -1;
+    }
+    /* TLS 1.3 also sends handshake records after the handshake */
+    if (gnutls_protocol_get_version(session->handle) != GNUTLS_TLS1_2) {
+        error_setg(errp, "Kernel TLS is only used with TLS 1.2");
+        return -1;
+    }
+    if (gnutls_record_check_pending(session->handle)) {
+        error_setg(errp, "TLS session has pending data");
+        return -1;
+    }
+
+    if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        error_setg_errno(errp, errno, "Cannot enable kernel TLS");
+        return -1;
+    }
+
+    /*
+     * Until keys are set for a direction the socket passes data through
+     * as it is, so a direction the kernel refuses stays with gnutls.
+     * Receive needs the more recent kernel: try it first, and report
+     * only the error of the transmit side if both fail.
+     */
+    if (qcrypto_tls_session_offload_one(session, fd, true, NULL) == 0) {
+        ret |= QCRYPTO_TLS_OFFLOAD_READ;
+    }
+    if (qcrypto_tls_session_offload_one(session, fd, false,
+                                        ret ? NULL : errp) == 0) {
+        ret |= QCRYPTO_TLS_OFFLOAD_WRITE;
+    }
+    trace_qcrypto_tls_session_offload(session, fd, ret);
+
+    return ret ? ret : -1;
+}
+#else /* ! CONFIG_GNUTLS_KTLS */
+int
+qcrypto_tls_session_offload(QCryptoTLSSession *session,
+                            int fd,
+                            Error **errp)
+{
+    error_setg(errp, "Kernel TLS is not supported");
+    return -1;
+}
+#endif /* ! CONFIG_GNUTLS_KTLS */
+
+
 #else /* ! CONFIG_GNUTLS */
 
 
@@ -639,4 +772,14 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
     return NULL;
 }
 
+
+int
+qcrypto_tls_session_offload(QCryptoTLSSession *sess,
+                            int fd,
+                            Error **errp)
+{
+    error_setg(errp, "TLS requires GNUTLS support");
+    return -1;
+}
+
 #endif
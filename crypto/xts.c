@@ -99,6 +99,46 @@ static inline void xts_tweak_encdec(const void *ctx,
 }
 
 
+#define XTS_BATCH_BLOCKS 16
+
+/**
+ * xts_tweak_encdec_batch:
+ * @param ctxt: the cipher context
+ * @param func: the cipher function
+ * @src: buffer providing @nblocks blocks of input text
+ * @dst: buffer to output @nblocks blocks of output text
+ * @nblocks: number of blocks, at most XTS_BATCH_BLOCKS
+ * @iv: the initialization vector tweak of XTS_BLOCK_SIZE bytes
+ *
+ * Like xts_tweak_encdec for consecutive blocks, but with a single call
+ * to the cipher function so that it can work on several blocks at once
+ */
+static void xts_tweak_encdec_batch(const void *ctx,
+                                   xts_cipher_func *func,
+                                   const uint8_t *src,
+                                   uint8_t *dst,
+                                   unsigned long nblocks,
+                                   xts_uint128 *iv)
+{
+    xts_uint128 B[XTS_BATCH_BLOCKS], T[XTS_BATCH_BLOCKS];
+    unsigned long i;
+
+    memcpy(B, src, nblocks * XTS_BLOCK_SIZE);
+    for (i = 0; i < nblocks; i++) {
+        T[i] = *iv;
+        xts_uint128_xor(&B[i], &B[i], &T[i]);
+        xts_mult_x(iv);
+    }
+
+    func(ctx, nblocks * XTS_BLOCK_SIZE, B[0].b, B[0].b);
+
+    for (i = 0; i < nblocks; i++) {
+        xts_uint128_xor(&B[i], &B[i], &T[i]);
+    }
+    memcpy(dst, B, nblocks * XTS_BLOCK_SIZE);
+}
+
+
 void xts_decrypt(const void *datactx,
                  const void *tweakctx,
                  xts_cipher_func *encfunc,
@@ -109,7 +149,7 @@ void xts_decrypt(const void *datactx,
                  const uint8_t *src)
 {
     xts_uint128 PP, CC, T;
-    unsigned long i, m, mo, lim;
+    unsigned long i, n, m, mo, lim;
 
     /* get number of blocks */
     m = length >> 4;
@@ -127,23 +167,11 @@ void xts_decrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, decfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, decfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-            src += XTS_BLOCK_SIZE;
-            dst += XTS_BLOCK_SIZE;
-        }
+    for (i = 0; i < lim; i += n) {
+        n = MIN(lim - i, XTS_BATCH_BLOCKS);
+        xts_tweak_encdec_batch(datactx, decfunc, src, dst, n, &T);
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
     }
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
@@ -185,7 +213,7 @@ void xts_encrypt(const void *datactx,
                  const uint8_t *src)
 {
     xts_uint128 PP, CC, T;
-    unsigned long i, m, mo, lim;
+    unsigned long i, n, m, mo, lim;
 
     /* get number of blocks */
     m = length >> 4;
@@ -203,24 +231,11 @@ void xts_encrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, encfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, encfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-
-            dst += XTS_BLOCK_SIZE;
-            src += XTS_BLOCK_SIZE;
-        }
+    for (i = 0; i < lim; i += n) {
+        n = MIN(lim - i, XTS_BATCH_BLOCKS);
+        xts_tweak_encdec_batch(datactx, encfunc, src, dst, n, &T);
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
     }
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
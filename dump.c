@@ -28,6 +28,7 @@
 #include "qapi/qmp/qerror.h"
 #include "qemu/error-report.h"
 #include "hw/misc/vmcoreinfo.h"
+#include "migration/postcopy-ram.h"
 
 #ifdef TARGET_X86_64
 #include "win_dump.h"
@@ -1299,20 +1300,378 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
+/*
+ * Pages are compressed by nr_threads threads, DUMP_BATCH_PAGES at a time.
+ * Batches are handed to the threads in turn and collected in the same
+ * order, so that page descriptors and data are still written in pfn order.
+ */
+#define DUMP_BATCH_PAGES 256
+#define DUMP_DEFAULT_THREADS 4
+#define DUMP_MAX_THREADS 64
+
+typedef struct DumpCompressJob {
+    DumpState *s;
+    QemuThread thread;
+    QemuSemaphore work;         /* posted when the batch is ready */
+    QemuSemaphore done;         /* posted when it is compressed */
+    bool quit;
+
+    size_t len_buf_out;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+    uint64_t nr_pages;
+    uint8_t *src[DUMP_BATCH_PAGES];
+    uint8_t *copy;              /* the pages, for live dumps */
+    uint8_t *out;               /* len_buf_out bytes per page */
+    uint32_t size[DUMP_BATCH_PAGES];    /* 0 for zero pages */
+    uint32_t flags[DUMP_BATCH_PAGES];
+} DumpCompressJob;
+
+/*
+ * only one compression format will be used here, for s->flag_compress is
+ * set. But when compression fails to work, or does not make the page
+ * smaller, we fall back to save in plaintext.
+ */
+static void dump_compress_page(DumpCompressJob *job, uint64_t i)
+{
+    DumpState *s = job->s;
+    uint8_t *buf = job->src[i];
+    uint8_t *buf_out = job->out + i * job->len_buf_out;
+    size_t size_out = job->len_buf_out;
+
+    if (is_zero_page(buf, s->dump_info.page_size)) {
+        job->size[i] = 0;
+        return;
+    }
+
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+        (compress2(buf_out, (uLongf *)&size_out, buf,
+                   s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
+        (size_out < s->dump_info.page_size)) {
+        job->flags[i] = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+               (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
+                                 (lzo_uint *)&size_out,
+                                 job->wrkmem) == LZO_E_OK) &&
+               (size_out < s->dump_info.page_size)) {
+        job->flags[i] = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+               (snappy_compress((char *)buf, s->dump_info.page_size,
+                                (char *)buf_out, &size_out) == SNAPPY_OK) &&
+               (size_out < s->dump_info.page_size)) {
+        job->flags[i] = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+    } else {
+        job->flags[i] = 0;
+        size_out = s->dump_info.page_size;
+    }
+    job->size[i] = size_out;
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressJob *job = opaque;
+    uint64_t i;
+
+    for (;;) {
+        qemu_sem_wait(&job->work);
+        if (atomic_read(&job->quit)) {
+            break;
+        }
+        for (i = 0; i < job->nr_pages; i++) {
+            dump_compress_page(job, i);
+        }
+        qemu_sem_post(&job->done);
+    }
+
+    return NULL;
+}
+
+static void dump_compress_jobs_init(DumpState *s, DumpCompressJob *jobs,
+                                    size_t len_buf_out)
+{
+    uint32_t i;
+
+    for (i = 0; i < s->nr_threads; i++) {
+        DumpCompressJob *job = &jobs[i];
+
+        job->s = s;
+        job->len_buf_out = len_buf_out;
+        job->out = g_malloc(DUMP_BATCH_PAGES * len_buf_out);
+#ifdef CONFIG_LZO
+        job->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+        if (s->live) {
+            job->copy = g_malloc(DUMP_BATCH_PAGES * s->dump_info.page_size);
+        }
+        qemu_sem_init(&job->work, 0);
+        qemu_sem_init(&job->done, 0);
+        qemu_thread_create(&job->thread, "dump_compress",
+                           dump_compress_thread, job, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void dump_compress_jobs_cleanup(DumpState *s, DumpCompressJob *jobs)
+{
+    uint32_t i;
+
+    for (i = 0; i < s->nr_threads; i++) {
+        DumpCompressJob *job = &jobs[i];
+
+        if (job->nr_pages) {
+            qemu_sem_wait(&job->done);
+        }
+        atomic_set(&job->quit, true);
+        qemu_sem_post(&job->work);
+        qemu_thread_join(&job->thread);
+
+        qemu_sem_destroy(&job->work);
+        qemu_sem_destroy(&job->done);
+        g_free(job->out);
+        g_free(job->copy);
+#ifdef CONFIG_LZO
+        g_free(job->wrkmem);
+#endif
+    }
+}
+
+/*
+ * Live dumps
+ *
+ * Guest memory is write-protected through a userfaultfd before the guest
+ * is resumed.  When the guest writes to a page that was not dumped yet,
+ * dump_wp_thread() saves a copy of the host page before lifting the
+ * protection; the dump then uses the copy.  The other pages are copied
+ * by the dump itself, which lifts the protection once it has them.
+ */
+static void dump_live_unprotect(DumpState *s, uint8_t *start, uint8_t *end)
+{
+    size_t host_page_size = qemu_real_host_page_size;
+
+    /* Host pages that were only partly dumped stay protected */
+    start = (uint8_t *)QEMU_ALIGN_UP((uintptr_t)start, host_page_size);
+    end = QEMU_ALIGN_PTR_DOWN(end, host_page_size);
+    if (end > start) {
+        uffd_wp_protect(s->uffd, start, end - start, false);
+    }
+}
+
+/* Context: dump thread, copies the pages of @job before they can change */
+static void dump_live_copy_pages(DumpState *s, DumpCompressJob *job)
+{
+    size_t page_size = s->dump_info.page_size;
+    size_t host_page_size = qemu_real_host_page_size;
+    uint8_t *run_start = NULL, *run_end = NULL;
+    uint64_t i;
+
+    qemu_mutex_lock(&s->wp_lock);
+    for (i = 0; i < job->nr_pages; i++) {
+        uint8_t *page = job->src[i];
+        uint8_t *host_page = QEMU_ALIGN_PTR_DOWN(page, host_page_size);
+        uint8_t *copy = NULL;
+
+        if (g_hash_table_size(s->wp_copies)) {
+            copy = g_hash_table_lookup(s->wp_copies, host_page);
+        }
+        job->src[i] = job->copy + i * page_size;
+        memcpy(job->src[i], copy ? copy + (page - host_page) : page,
+               page_size);
+        if (copy && QEMU_IS_ALIGNED((uintptr_t)page + page_size,
+                                    host_page_size)) {
+            g_hash_table_remove(s->wp_copies, host_page);
+        }
+
+        if (page != run_end) {
+            dump_live_unprotect(s, run_start, run_end);
+            run_start = page;
+        }
+        run_end = page + page_size;
+    }
+    dump_live_unprotect(s, run_start, run_end);
+    qemu_mutex_unlock(&s->wp_lock);
+}
+
+static void *dump_wp_thread(void *opaque)
+{
+    DumpState *s = opaque;
+    size_t host_page_size = qemu_real_host_page_size;
+    GPollFD pfd = { .fd = s->uffd, .events = G_IO_IN };
+    void *addr;
+
+    while (!atomic_read(&s->wp_quit)) {
+        if (g_poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+
+        while ((addr = uffd_wp_read_fault(s->uffd))) {
+            void *host_page = QEMU_ALIGN_PTR_DOWN(addr, host_page_size);
+
+            qemu_mutex_lock(&s->wp_lock);
+            if (!g_hash_table_contains(s->wp_copies, host_page)) {
+                g_hash_table_insert(s->wp_copies, host_page,
+                                    g_memdup(host_page, host_page_size));
+            }
+            uffd_wp_protect(s->uffd, host_page, host_page_size, false);
+            qemu_mutex_unlock(&s->wp_lock);
+        }
+    }
+
+    return NULL;
+}
+
+static void dump_live_block_range(GuestPhysBlock *block,
+                                  uint8_t **start, uint64_t *len)
+{
+    size_t host_page_size = qemu_real_host_page_size;
+    uint8_t *end = block->host_addr +
+                   (block->target_end - block->target_start);
+
+    *start = QEMU_ALIGN_PTR_DOWN(block->host_addr, host_page_size);
+    *len = QEMU_ALIGN_UP((uintptr_t)end, host_page_size) - (uintptr_t)*start;
+}
+
+static void dump_live_stop(DumpState *s)
+{
+    GuestPhysBlock *block;
+    uint8_t *start;
+    uint64_t len;
+
+    if (!s->wp_copies) {
+        return;
+    }
+
+    atomic_set(&s->wp_quit, true);
+    qemu_thread_join(&s->wp_thread);
+
+    /* Also wakes up whoever still waits for a page to be saved */
+    QTAILQ_FOREACH(block, &s->guest_phys_blocks.head, next) {
+        dump_live_block_range(block, &start, &len);
+        uffd_wp_protect(s->uffd, start, len, false);
+        uffd_wp_unregister(s->uffd, start, len);
+    }
+    close(s->uffd);
+
+    g_hash_table_destroy(s->wp_copies);
+    s->wp_copies = NULL;
+    qemu_mutex_destroy(&s->wp_lock);
+}
+
+/* Context: dump thread, with the guest stopped */
+static void dump_live_start(DumpState *s, Error **errp)
+{
+    GuestPhysBlock *block;
+    uint8_t *start;
+    uint64_t len, offset;
+    int ret;
+
+    s->uffd = uffd_wp_open(errp);
+    if (s->uffd < 0) {
+        return;
+    }
+
+    QTAILQ_FOREACH(block, &s->guest_phys_blocks.head, next) {
+        dump_live_block_range(block, &start, &len);
+
+        /* Only mapped pages can be write-protected, map the others */
+        for (offset = 0; offset < len; offset += qemu_real_host_page_size) {
+            (void)*(volatile uint8_t *)(start + offset);
+        }
+
+        ret = uffd_wp_register(s->uffd, start, len);
+        if (!ret) {
+            ret = uffd_wp_protect(s->uffd, start, len, true);
+        }
+        if (ret) {
+            error_setg_errno(errp, -ret,
+                             "dump: failed to write-protect guest memory");
+            QTAILQ_FOREACH(block, &s->guest_phys_blocks.head, next) {
+                dump_live_block_range(block, &start, &len);
+                uffd_wp_protect(s->uffd, start, len, false);
+                uffd_wp_unregister(s->uffd, start, len);
+            }
+            close(s->uffd);
+            return;
+        }
+    }
+
+    qemu_mutex_init(&s->wp_lock);
+    s->wp_copies = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    s->wp_quit = false;
+    qemu_thread_create(&s->wp_thread, "dump_wp", dump_wp_thread, s,
+                       QEMU_THREAD_JOINABLE);
+
+    if (s->resume) {
+        qemu_mutex_lock_iothread();
+        vm_start();
+        qemu_mutex_unlock_iothread();
+        s->resume = false;
+    }
+}
+
+/* write the page descriptors and data of a compressed batch */
+static int write_compressed_pages(DumpState *s, DumpCompressJob *job,
+                                  DataCache *page_desc, DataCache *page_data,
+                                  PageDescriptor *pd_zero, off_t *offset_data,
+                                  Error **errp)
+{
+    PageDescriptor pd;
+    uint64_t i;
+    int ret;
+
+    for (i = 0; i < job->nr_pages; i++) {
+        if (!job->size[i]) {
+            ret = write_cache(page_desc, pd_zero, sizeof(PageDescriptor),
+                              false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return ret;
+            }
+            s->written_size += s->dump_info.page_size;
+            continue;
+        }
+
+        ret = write_cache(page_data, job->flags[i] ?
+                          job->out + i * job->len_buf_out : job->src[i],
+                          job->size[i], false);
+        if (ret < 0) {
+            error_setg(errp, "dump: failed to write page data");
+            return ret;
+        }
+
+        pd.flags = cpu_to_dump32(s, job->flags[i]);
+        pd.size = cpu_to_dump32(s, job->size[i]);
+        pd.page_flags = cpu_to_dump64(s, 0);
+        pd.offset = cpu_to_dump64(s, *offset_data);
+        *offset_data += job->size[i];
+
+        ret = write_cache(page_desc, &pd, sizeof(PageDescriptor), false);
+        if (ret < 0) {
+            error_setg(errp, "dump: failed to write page desc");
+            return ret;
+        }
+        s->written_size += s->dump_info.page_size;
+    }
+
+    return 0;
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    size_t len_buf_out;
     off_t offset_desc, offset_data;
-    PageDescriptor pd, pd_zero;
+    PageDescriptor pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
+    DumpCompressJob *jobs, *job;
+    uint32_t next = 0, busy = 0;
+    bool more = true;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1325,11 +1684,8 @@ static void write_dump_pages(DumpState *s, Error **errp)
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    jobs = g_new0(DumpCompressJob, s->nr_threads);
+    dump_compress_jobs_init(s, jobs, len_buf_out);
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1349,101 +1705,48 @@ static void write_dump_pages(DumpState *s, Error **errp)
 
     offset_data += s->dump_info.page_size;
 
+    if (s->live) {
+        Error *local_err = NULL;
+
+        dump_live_start(s, &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            goto out;
+        }
+    }
+
     /*
-     * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * dump memory to vmcore batch by batch. zero page will all be resided in
+     * the first page of page section
      */
-    while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
-        /* check zero page */
-        if (is_zero_page(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
+    while (more || busy) {
+        job = &jobs[next];
+        next = (next + 1) % s->nr_threads;
+
+        if (job->nr_pages) {
+            qemu_sem_wait(&job->done);
+            busy--;
+            ret = write_compressed_pages(s, job, &page_desc, &page_data,
+                                         &pd_zero, &offset_data, errp);
+            job->nr_pages = 0;
             if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
                 goto out;
             }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-            }
-
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+        }
 
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+        while (more && job->nr_pages < DUMP_BATCH_PAGES) {
+            more = get_next_page(&block_iter, &pfn_iter, &buf, s);
+            if (more) {
+                job->src[job->nr_pages++] = buf;
             }
         }
-        s->written_size += s->dump_info.page_size;
+        if (job->nr_pages) {
+            if (s->live) {
+                dump_live_copy_pages(s, job);
+            }
+            qemu_sem_post(&job->work);
+            busy++;
+        }
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1458,14 +1761,12 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
 out:
+    dump_compress_jobs_cleanup(s, jobs);
+    g_free(jobs);
+    dump_live_stop(s);
+
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1643,7 +1944,8 @@ static void vmcoreinfo_update_phys_base(DumpState *s)
 
 static void dump_init(DumpState *s, int fd, bool has_format,
                       DumpGuestMemoryFormat format, bool paging, bool has_filter,
-                      int64_t begin, int64_t length, Error **errp)
+                      int64_t begin, int64_t length, uint32_t nr_threads,
+                      bool live, Error **errp)
 {
     VMCoreInfoState *vmci = vmcoreinfo_find();
     CPUState *cpu;
@@ -1654,6 +1956,8 @@ static void dump_init(DumpState *s, int fd, bool has_format,
     s->has_format = has_format;
     s->format = format;
     s->written_size = 0;
+    s->nr_threads = nr_threads;
+    s->live = live;
 
     /* kdump-compressed is conflict with paging and filter */
     if (has_format && format != DUMP_GUEST_MEMORY_FORMAT_ELF) {
@@ -1921,7 +2225,9 @@ void qmp_dump_guest_memory(bool paging, const char *file,
                            bool has_detach, bool detach,
                            bool has_begin, int64_t begin, bool has_length,
                            int64_t length, bool has_format,
-                           DumpGuestMemoryFormat format, Error **errp)
+                           DumpGuestMemoryFormat format,
+                           bool has_threads, int64_t threads,
+                           bool has_live, bool live, Error **errp)
 {
     const char *p;
     int fd = -1;
@@ -1962,6 +2268,31 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     if (has_detach) {
         detach_p = detach;
     }
+    if (!has_threads) {
+        threads = DUMP_DEFAULT_THREADS;
+    } else if (threads < 1 || threads > DUMP_MAX_THREADS) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "threads",
+                   "a value between 1 and " stringify(DUMP_MAX_THREADS));
+        return;
+    }
+    if (!has_live) {
+        live = false;
+    }
+    if (live) {
+        if (!has_format || format == DUMP_GUEST_MEMORY_FORMAT_ELF ||
+            format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP) {
+            error_setg(errp, "live dump needs a kdump-compressed format");
+            return;
+        }
+        if (!detach_p) {
+            error_setg(errp, "live dump needs detach");
+            return;
+        }
+        if (!uffd_wp_supported_by_host()) {
+            error_setg(errp, "live dump needs userfault write protection");
+            return;
+        }
+    }
 
     /* check whether lzo/snappy is supported */
 #ifndef CONFIG_LZO
@@ -2011,7 +2342,7 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     dump_state_prepare(s);
 
     dump_init(s, fd, has_format, format, paging, has_begin,
-              begin, length, &local_err);
+              begin, length, threads, live, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         atomic_set(&s->status, DUMP_STATUS_FAILED);
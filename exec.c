@@ -1348,19 +1348,25 @@ bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
                                               unsigned client)
 {
     DirtyMemoryBlocks *blocks;
-    unsigned long end, page;
+    unsigned long end, page, start_page;
     bool dirty = false;
+    RAMBlock *ramblock;
 
     if (length == 0) {
         return false;
     }
 
     end = TARGET_PAGE_ALIGN(start + length) >> TARGET_PAGE_BITS;
-    page = start >> TARGET_PAGE_BITS;
+    start_page = start >> TARGET_PAGE_BITS;
+    page = start_page;
 
     rcu_read_lock();
 
     blocks = atomic_rcu_read(&ram_list.dirty_memory[client]);
+    ramblock = qemu_get_ram_block(start);
+    /* Range sanity check on the ramblock */
+    assert(start >= ramblock->offset &&
+           start + length <= ramblock->offset + ramblock->used_length);
 
     while (page < end) {
         unsigned long idx = page / DIRTY_MEMORY_BLOCK_SIZE;
@@ -1372,6 +1378,15 @@ bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
         page += num;
     }
 
+    if (dirty) {
+        /* Let the listeners track writes to these pages again */
+        memory_region_clear_dirty_bitmap(ramblock->mr,
+                                         (start_page << TARGET_PAGE_BITS) -
+                                         ramblock->offset,
+                                         (end - start_page) <<
+                                         TARGET_PAGE_BITS);
+    }
+
     rcu_read_unlock();
 
     if (dirty && tcg_enabled()) {
@@ -1555,9 +1570,9 @@ static void phys_sections_free(PhysPageMap *map)
     g_free(map->nodes);
 }
 
-static void register_subpage(FlatView *fv, MemoryRegionSection *section)
+static void register_subpage(AddressSpaceDispatch *d, FlatView *fv,
+                             MemoryRegionSection *section)
 {
-    AddressSpaceDispatch *d = flatview_to_dispatch(fv);
     subpage_t *subpage;
     hwaddr base = section->offset_within_address_space
         & TARGET_PAGE_MASK;
@@ -1586,10 +1601,9 @@ static void register_subpage(FlatView *fv, MemoryRegionSection *section)
 }
 
 
-static void register_multipage(FlatView *fv,
+static void register_multipage(AddressSpaceDispatch *d,
                                MemoryRegionSection *section)
 {
-    AddressSpaceDispatch *d = flatview_to_dispatch(fv);
     hwaddr start_addr = section->offset_within_address_space;
     uint16_t section_index = phys_section_add(&d->map, section);
     uint64_t num_pages = int128_get64(int128_rshift(section->size,
@@ -1606,7 +1620,8 @@ static void register_multipage(FlatView *fv,
  *
  * where s stands for subpage and P for page.
  */
-void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section)
+void flatview_add_to_dispatch(AddressSpaceDispatch *d, FlatView *fv,
+                              MemoryRegionSection *section)
 {
     MemoryRegionSection remain = *section;
     Int128 page_size = int128_make64(TARGET_PAGE_SIZE);
@@ -1618,7 +1633,7 @@ void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section)
 
         MemoryRegionSection now = remain;
         now.size = int128_min(int128_make64(left), now.size);
-        register_subpage(fv, &now);
+        register_subpage(d, fv, &now);
         if (int128_eq(remain.size, now.size)) {
             return;
         }
@@ -1631,7 +1646,7 @@ void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section)
     if (int128_ge(remain.size, page_size)) {
         MemoryRegionSection now = remain;
         now.size = int128_and(now.size, int128_neg(page_size));
-        register_multipage(fv, &now);
+        register_multipage(d, &now);
         if (int128_eq(remain.size, now.size)) {
             return;
         }
@@ -1641,7 +1656,7 @@ void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section)
     }
 
     /* register last subpage */
-    register_subpage(fv, &remain);
+    register_subpage(d, fv, &remain);
 }
 
 void qemu_flush_coalesced_mmio_buffer(void)
@@ -1650,6 +1665,11 @@ void qemu_flush_coalesced_mmio_buffer(void)
         kvm_flush_coalesced_mmio_buffer();
 }
 
+bool qemu_coalesced_mmio_pending(void)
+{
+    return kvm_enabled() && kvm_coalesced_mmio_pending();
+}
+
 void qemu_mutex_lock_ramlist(void)
 {
     qemu_mutex_lock(&ram_list.mutex);
@@ -2028,6 +2048,16 @@ void qemu_ram_set_migratable(RAMBlock *rb)
     rb->flags |= RAM_MIGRATABLE;
 }
 
+bool qemu_ram_is_image(RAMBlock *rb)
+{
+    return rb->flags & RAM_IMAGE;
+}
+
+void qemu_ram_unset_image(RAMBlock *rb)
+{
+    rb->flags &= ~RAM_IMAGE;
+}
+
 void qemu_ram_unset_migratable(RAMBlock *rb)
 {
     rb->flags &= ~RAM_MIGRATABLE;
@@ -2274,7 +2304,7 @@ RAMBlock *qemu_ram_alloc_from_fd(ram_addr_t size, MemoryRegion *mr,
     int64_t file_size;
 
     /* Just support these ram flags by now. */
-    assert((ram_flags & ~(RAM_SHARED | RAM_PMEM)) == 0);
+    assert((ram_flags & ~(RAM_SHARED | RAM_PMEM | RAM_IMAGE)) == 0);
 
     if (xen_enabled()) {
         error_setg(errp, "-mem-path not supported with Xen");
@@ -2306,6 +2336,11 @@ RAMBlock *qemu_ram_alloc_from_fd(ram_addr_t size, MemoryRegion *mr,
                    mem_path, file_size, size);
         return NULL;
     }
+    if ((ram_flags & RAM_IMAGE) && file_size < (int64_t)size) {
+        error_setg(errp, "RAM image of %s is smaller than 'size' option 0x"
+                   RAM_ADDR_FMT, memory_region_name(mr), size);
+        return NULL;
+    }
 
     new_block = g_malloc0(sizeof(*new_block));
     new_block->mr = mr;
@@ -2689,8 +2724,7 @@ void memory_notdirty_write_prepare(NotDirtyInfo *ndi,
 
     assert(tcg_enabled());
     if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
-        ndi->pages = page_collection_lock(ram_addr, ram_addr + size);
-        tb_invalidate_phys_page_fast(ndi->pages, ram_addr, size);
+        ndi->pages = tb_invalidate_phys_page_fast(ram_addr, size);
     }
 }
 
@@ -3244,7 +3278,13 @@ static bool prepare_mmio_access(MemoryRegion *mr)
         unlocked = false;
         release_lock = true;
     }
-    if (mr->flush_coalesced_mmio) {
+    /*
+     * The coalesced writes are replayed under the BQL, which keeps them
+     * ordered with the accesses of the other vCPUs; only take it if
+     * there's something to replay.
+     */
+    if (mr->flush_coalesced_mmio &&
+        (!unlocked || qemu_coalesced_mmio_pending())) {
         if (unlocked) {
             qemu_mutex_lock_iothread();
         }
@@ -3422,6 +3462,117 @@ MemTxResult address_space_rw(AddressSpace *as, hwaddr addr, MemTxAttrs attrs,
     }
 }
 
+/*
+ * MMIO exits of hardware accelerators keep hitting the same few device
+ * registers (doorbells, interrupt controllers), so every vCPU remembers
+ * the MMIO sections it accessed last.  Entries are tagged with
+ * flatview_generation and are stale as soon as any address space
+ * changes its FlatView; the MemoryRegion of a current entry is kept
+ * alive by the FlatView for the duration of the RCU critical section.
+ *
+ * Called from RCU critical section.
+ */
+static CPUMMIOCacheEntry *cpu_mmio_cache_lookup(CPUState *cpu,
+                                                AddressSpace *as,
+                                                hwaddr addr, hwaddr len)
+{
+    unsigned int generation = atomic_read(&flatview_generation);
+    int i;
+
+    for (i = 0; i < CPU_MMIO_CACHE_SIZE; i++) {
+        CPUMMIOCacheEntry *e = &cpu->mmio_cache[i];
+
+        if (e->mr && e->generation == generation && e->as == as &&
+            addr >= e->addr && addr - e->addr < e->size &&
+            len <= e->size - (addr - e->addr)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Called from RCU critical section.  */
+static CPUMMIOCacheEntry *cpu_mmio_cache_fill(CPUState *cpu,
+                                              AddressSpace *as,
+                                              hwaddr addr, hwaddr len)
+{
+    unsigned int generation = atomic_read(&flatview_generation);
+    FlatView *fv = address_space_to_flatview(as);
+    MemoryRegionSection *section;
+    CPUMMIOCacheEntry *e;
+    hwaddr xlat, plen = len;
+
+    section = address_space_translate_internal(flatview_to_dispatch(fv),
+                                               addr, &xlat, &plen, true);
+
+    /* RAM is not accessed through exits, IOMMU mappings change anytime */
+    if (memory_region_is_ram(section->mr) ||
+        memory_region_get_iommu(section->mr) ||
+        int128_gethi(section->size)) {
+        return NULL;
+    }
+
+    e = &cpu->mmio_cache[cpu->mmio_cache_next];
+    cpu->mmio_cache_next = (cpu->mmio_cache_next + 1) % CPU_MMIO_CACHE_SIZE;
+    e->as = as;
+    e->addr = section->offset_within_address_space;
+    e->size = int128_get64(section->size);
+    e->xlat = section->offset_within_region;
+    e->mr = section->mr;
+    e->generation = generation;
+
+    if (len > e->size - (addr - e->addr)) {
+        return NULL;
+    }
+    return e;
+}
+
+MemTxResult address_space_mmio_rw(CPUState *cpu, AddressSpace *as,
+                                  hwaddr addr, MemTxAttrs attrs,
+                                  uint8_t *buf, hwaddr len, bool is_write)
+{
+    CPUMMIOCacheEntry *e;
+    MemoryRegion *mr;
+    MemTxResult result;
+    hwaddr addr1;
+    uint64_t val;
+    bool release_lock;
+
+    rcu_read_lock();
+    e = cpu_mmio_cache_lookup(cpu, as, addr, len);
+    if (!e) {
+        e = cpu_mmio_cache_fill(cpu, as, addr, len);
+    }
+
+    /* Anything that needs more than one access takes the slow path */
+    if (!e || memory_access_is_direct(e->mr, is_write)) {
+        goto slow;
+    }
+    mr = e->mr;
+    addr1 = addr - e->addr + e->xlat;
+    if (memory_access_size(mr, len, addr1) != len) {
+        goto slow;
+    }
+
+    release_lock = prepare_mmio_access(mr);
+    if (is_write) {
+        val = ldn_p(buf, len);
+        result = memory_region_dispatch_write(mr, addr1, val, len, attrs);
+    } else {
+        result = memory_region_dispatch_read(mr, addr1, &val, len, attrs);
+        stn_p(buf, len, val);
+    }
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
+    rcu_read_unlock();
+    return result;
+
+slow:
+    rcu_read_unlock();
+    return address_space_rw(as, addr, attrs, buf, len, is_write);
+}
+
 void cpu_physical_memory_rw(hwaddr addr, uint8_t *buf,
                             hwaddr len, int is_write)
 {
@@ -3501,53 +3652,50 @@ void cpu_flush_icache_range(hwaddr start, hwaddr len)
                                      NULL, len, FLUSH_CACHE);
 }
 
-typedef struct {
+/* A bounce buffer of address_space_map(), in the pool of its AddressSpace */
+typedef struct BounceBuffer {
     MemoryRegion *mr;
-    void *buffer;
     hwaddr addr;
     hwaddr len;
-    bool in_use;
+    QLIST_ENTRY(BounceBuffer) link;
+    uint8_t buffer[];
 } BounceBuffer;
 
-static BounceBuffer bounce;
-
 typedef struct MapClient {
     QEMUBH *bh;
     QLIST_ENTRY(MapClient) link;
 } MapClient;
 
-QemuMutex map_client_list_lock;
-static QLIST_HEAD(, MapClient) map_client_list
-    = QLIST_HEAD_INITIALIZER(map_client_list);
-
-static void cpu_unregister_map_client_do(MapClient *client)
+/* Called with as->bounce_lock held.  */
+static void address_space_unregister_map_client_do(MapClient *client)
 {
     QLIST_REMOVE(client, link);
     g_free(client);
 }
 
-static void cpu_notify_map_clients_locked(void)
+/* Called with as->bounce_lock held.  */
+static void address_space_notify_map_clients_locked(AddressSpace *as)
 {
     MapClient *client;
 
-    while (!QLIST_EMPTY(&map_client_list)) {
-        client = QLIST_FIRST(&map_client_list);
+    while (!QLIST_EMPTY(&as->map_client_list)) {
+        client = QLIST_FIRST(&as->map_client_list);
         qemu_bh_schedule(client->bh);
-        cpu_unregister_map_client_do(client);
+        address_space_unregister_map_client_do(client);
     }
 }
 
-void cpu_register_map_client(QEMUBH *bh)
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh)
 {
     MapClient *client = g_malloc(sizeof(*client));
 
-    qemu_mutex_lock(&map_client_list_lock);
+    qemu_mutex_lock(&as->bounce_lock);
     client->bh = bh;
-    QLIST_INSERT_HEAD(&map_client_list, client, link);
-    if (!atomic_read(&bounce.in_use)) {
-        cpu_notify_map_clients_locked();
+    QLIST_INSERT_HEAD(&as->map_client_list, client, link);
+    if (as->bounce_buffer_size < as->max_bounce_buffer_size) {
+        address_space_notify_map_clients_locked(as);
     }
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_unlock(&as->bounce_lock);
 }
 
 void cpu_exec_init_all(void)
@@ -3563,28 +3711,20 @@ void cpu_exec_init_all(void)
     finalize_target_page_bits();
     io_mem_init();
     memory_map_init();
-    qemu_mutex_init(&map_client_list_lock);
 }
 
-void cpu_unregister_map_client(QEMUBH *bh)
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh)
 {
     MapClient *client;
 
-    qemu_mutex_lock(&map_client_list_lock);
-    QLIST_FOREACH(client, &map_client_list, link) {
+    qemu_mutex_lock(&as->bounce_lock);
+    QLIST_FOREACH(client, &as->map_client_list, link) {
         if (client->bh == bh) {
-            cpu_unregister_map_client_do(client);
+            address_space_unregister_map_client_do(client);
             break;
         }
     }
-    qemu_mutex_unlock(&map_client_list_lock);
-}
-
-static void cpu_notify_map_clients(void)
-{
-    qemu_mutex_lock(&map_client_list_lock);
-    cpu_notify_map_clients_locked();
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_unlock(&as->bounce_lock);
 }
 
 static bool flatview_access_valid(FlatView *fv, hwaddr addr, hwaddr len,
@@ -3654,8 +3794,12 @@ flatview_extend_translation(FlatView *fv, hwaddr addr,
  * May map a subset of the requested range, given by and returned in *plen.
  * May return NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
+ *
+ * Regions that cannot be accessed directly go through bounce buffers, taken
+ * from a pool of at most as->max_bounce_buffer_size bytes, so that several
+ * such mappings can be in flight at once.
  */
 void *address_space_map(AddressSpace *as,
                         hwaddr addr,
@@ -3679,26 +3823,37 @@ void *address_space_map(AddressSpace *as,
     mr = flatview_translate(fv, addr, &xlat, &l, is_write, attrs);
 
     if (!memory_access_is_direct(mr, is_write)) {
-        if (atomic_xchg(&bounce.in_use, true)) {
+        BounceBuffer *bounce;
+
+        /* Avoid unbounded allocations */
+        qemu_mutex_lock(&as->bounce_lock);
+        l = MIN(l, as->max_bounce_buffer_size - as->bounce_buffer_size);
+        as->bounce_buffer_size += l;
+        qemu_mutex_unlock(&as->bounce_lock);
+        if (l == 0) {
             rcu_read_unlock();
+            *plen = 0;
             return NULL;
         }
-        /* Avoid unbounded allocations */
-        l = MIN(l, TARGET_PAGE_SIZE);
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
-        bounce.addr = addr;
-        bounce.len = l;
+
+        bounce = g_malloc(sizeof(*bounce) + l);
+        bounce->addr = addr;
+        bounce->len = l;
 
         memory_region_ref(mr);
-        bounce.mr = mr;
+        bounce->mr = mr;
         if (!is_write) {
             flatview_read(fv, addr, MEMTXATTRS_UNSPECIFIED,
-                               bounce.buffer, l);
+                          bounce->buffer, l);
         }
 
+        qemu_mutex_lock(&as->bounce_lock);
+        QLIST_INSERT_HEAD(&as->bounce_buffers, bounce, link);
+        qemu_mutex_unlock(&as->bounce_lock);
+
         rcu_read_unlock();
         *plen = l;
-        return bounce.buffer;
+        return bounce->buffer;
     }
 
 
@@ -3718,7 +3873,24 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
+    BounceBuffer *bounce = NULL;
+
+    /*
+     * The caller's own bounce buffer, if it has one, was counted before
+     * address_space_map() returned it; nothing to look up otherwise.
+     */
+    if (atomic_read(&as->bounce_buffer_size)) {
+        qemu_mutex_lock(&as->bounce_lock);
+        QLIST_FOREACH(bounce, &as->bounce_buffers, link) {
+            if (bounce->buffer == buffer) {
+                QLIST_REMOVE(bounce, link);
+                break;
+            }
+        }
+        qemu_mutex_unlock(&as->bounce_lock);
+    }
+
+    if (!bounce) {
         MemoryRegion *mr;
         ram_addr_t addr1;
 
@@ -3734,14 +3906,16 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
         return;
     }
     if (is_write) {
-        address_space_write(as, bounce.addr, MEMTXATTRS_UNSPECIFIED,
-                            bounce.buffer, access_len);
-    }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    atomic_mb_set(&bounce.in_use, false);
-    cpu_notify_map_clients();
+        address_space_write(as, bounce->addr, MEMTXATTRS_UNSPECIFIED,
+                            bounce->buffer, access_len);
+    }
+    memory_region_unref(bounce->mr);
+
+    qemu_mutex_lock(&as->bounce_lock);
+    as->bounce_buffer_size -= bounce->len;
+    address_space_notify_map_clients_locked(as);
+    qemu_mutex_unlock(&as->bounce_lock);
+    g_free(bounce);
 }
 
 void *cpu_physical_memory_map(hwaddr addr,
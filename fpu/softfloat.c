@@ -217,16 +217,19 @@ GEN_INPUT_FLUSH3(float64_input_flush3, float64)
 
 /*
  * Some targets clear the FP flags before most FP operations. This prevents
- * the use of hardfloat, since hardfloat relies on the inexact flag being
- * already set.
+ * the use of hardfloat for inexact operations, since hardfloat relies on the
+ * inexact flag being already set; can_use_fpu() then fails at run time.
+ * Operations whose hardfloat flavor never raises a flag (compares and exact
+ * conversions) remain usable, so only inline the soft paths for them.
  */
-#if defined(TARGET_PPC) || defined(__FAST_MATH__)
-# if defined(__FAST_MATH__)
-#  warning disabling hardfloat due to -ffast-math: hardfloat requires an exact \
+#if defined(__FAST_MATH__)
+# warning disabling hardfloat due to -ffast-math: hardfloat requires an exact \
     IEEE implementation
-# endif
 # define QEMU_NO_HARDFLOAT 1
 # define QEMU_SOFTFLOAT_ATTR QEMU_FLATTEN
+#elif defined(TARGET_PPC)
+# define QEMU_NO_HARDFLOAT 0
+# define QEMU_SOFTFLOAT_ATTR QEMU_FLATTEN
 #else
 # define QEMU_NO_HARDFLOAT 0
 # define QEMU_SOFTFLOAT_ATTR QEMU_FLATTEN __attribute__((noinline))
@@ -241,6 +244,15 @@ static inline bool can_use_fpu(const float_status *s)
                   s->float_rounding_mode == float_round_nearest_even);
 }
 
+/* As above, for operations whose result does not depend on the rounding mode */
+static inline bool can_use_fpu_any_rmode(const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return likely(s->float_exception_flags & float_flag_inexact);
+}
+
 /*
  * Hardfloat generation functions. Each operation can have two flavors:
  * either using softfloat primitives (e.g. float32_is_zero_or_normal) for
@@ -1938,13 +1950,35 @@ float16 float32_to_float16(float32 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(pr, s, fmt16);
 }
 
-float64 float32_to_float64(float32 a, float_status *s)
+static float64 QEMU_SOFTFLOAT_ATTR
+soft_f32_to_f64(float32 a, float_status *s)
 {
     FloatParts p = float32_unpack_canonical(a, s);
     FloatParts pr = float_to_float(p, &float64_params, s);
     return float64_round_pack_canonical(pr, s);
 }
 
+float64 QEMU_FLATTEN float32_to_float64(float32 xa, float_status *s)
+{
+    union_float32 ua;
+    union_float64 ur;
+
+    ua.s = xa;
+    if (QEMU_NO_HARDFLOAT) {
+        goto soft;
+    }
+
+    /* Widening zero or normal numbers is exact and raises no flags.  */
+    float32_input_flush1(&ua.s, s);
+    if (likely(float32_is_zero_or_normal(ua.s))) {
+        ur.h = ua.h;
+        return ur.s;
+    }
+
+ soft:
+    return soft_f32_to_f64(ua.s, s);
+}
+
 float16 float64_to_float16(float64 a, bool ieee, float_status *s)
 {
     const FloatFmt *fmt16 = ieee ? &float16_params : &float16_params_ahp;
@@ -1953,13 +1987,41 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(pr, s, fmt16);
 }
 
-float32 float64_to_float32(float64 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_f64_to_f32(float64 a, float_status *s)
 {
     FloatParts p = float64_unpack_canonical(a, s);
     FloatParts pr = float_to_float(p, &float32_params, s);
     return float32_round_pack_canonical(pr, s);
 }
 
+float32 QEMU_FLATTEN float64_to_float32(float64 xa, float_status *s)
+{
+    union_float64 ua;
+    union_float32 ur;
+
+    ua.s = xa;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    float64_input_flush1(&ua.s, s);
+    if (unlikely(!float64_is_zero_or_normal(ua.s))) {
+        goto soft;
+    }
+
+    ur.h = ua.h;
+    if (unlikely(f32_is_inf(ur))) {
+        s->float_exception_flags |= float_flag_overflow;
+    } else if (unlikely(fabsf(ur.h) <= FLT_MIN && !float64_is_zero(ua.s))) {
+        goto soft;
+    }
+    return ur.s;
+
+ soft:
+    return soft_f64_to_f32(ua.s, s);
+}
+
 /*
  * Rounds the floating-point value `a' to an integer, and returns the
  * result as a floating-point value. The operation is performed
@@ -2075,20 +2137,66 @@ float16 float16_round_to_int(float16 a, float_status *s)
     return float16_round_pack_canonical(pr, s);
 }
 
-float32 float32_round_to_int(float32 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_f32_round_to_int(float32 a, float_status *s)
 {
     FloatParts pa = float32_unpack_canonical(a, s);
     FloatParts pr = round_to_int(pa, s->float_rounding_mode, 0, s);
     return float32_round_pack_canonical(pr, s);
 }
 
-float64 float64_round_to_int(float64 a, float_status *s)
+static float64 QEMU_SOFTFLOAT_ATTR
+soft_f64_round_to_int(float64 a, float_status *s)
 {
     FloatParts pa = float64_unpack_canonical(a, s);
     FloatParts pr = round_to_int(pa, s->float_rounding_mode, 0, s);
     return float64_round_pack_canonical(pr, s);
 }
 
+/*
+ * The host rounds to nearest even, as can_use_fpu() requires of the guest,
+ * and the only flag rint() can raise is inexact, which is already set.
+ */
+float32 QEMU_FLATTEN float32_round_to_int(float32 xa, float_status *s)
+{
+    union_float32 ua, ur;
+
+    ua.s = xa;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    float32_input_flush1(&ua.s, s);
+    if (unlikely(!float32_is_zero_or_normal(ua.s))) {
+        goto soft;
+    }
+    ur.h = rintf(ua.h);
+    return ur.s;
+
+ soft:
+    return soft_f32_round_to_int(ua.s, s);
+}
+
+float64 QEMU_FLATTEN float64_round_to_int(float64 xa, float_status *s)
+{
+    union_float64 ua, ur;
+
+    ua.s = xa;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    float64_input_flush1(&ua.s, s);
+    if (unlikely(!float64_is_zero_or_normal(ua.s))) {
+        goto soft;
+    }
+    ur.h = rint(ua.h);
+    return ur.s;
+
+ soft:
+    return soft_f64_round_to_int(ua.s, s);
+}
+
 /*
  * Returns the result of converting the floating-point value `a' to
  * the two's complement integer format. The conversion is performed
@@ -2209,6 +2317,54 @@ int64_t float64_to_int64_scalbn(float64 a, int rmode, int scale,
                                  rmode, scale, INT64_MIN, INT64_MAX, s);
 }
 
+/*
+ * Hardfloat conversion of a zero or normal @d to an integer in [@min, -@min).
+ * Returns false, leaving the conversion to softfloat, for anything that may
+ * raise a flag other than inexact, which the caller has checked is set.
+ */
+static inline bool hard_to_int(double d, bool round_to_zero, int64_t min,
+                               int64_t *r)
+{
+    d = round_to_zero ? trunc(d) : rint(d);
+    if (unlikely(!(d >= (double)min && d < -(double)min))) {
+        return false;
+    }
+    *r = d;
+    return true;
+}
+
+static inline bool f32_to_int_hard(float32 xa, bool round_to_zero,
+                                   int64_t min, float_status *s, int64_t *r)
+{
+    union_float32 ua;
+
+    ua.s = xa;
+    if (round_to_zero ? !can_use_fpu_any_rmode(s) : !can_use_fpu(s)) {
+        return false;
+    }
+    float32_input_flush1(&ua.s, s);
+    if (unlikely(!float32_is_zero_or_normal(ua.s))) {
+        return false;
+    }
+    return hard_to_int(ua.h, round_to_zero, min, r);
+}
+
+static inline bool f64_to_int_hard(float64 xa, bool round_to_zero,
+                                   int64_t min, float_status *s, int64_t *r)
+{
+    union_float64 ua;
+
+    ua.s = xa;
+    if (round_to_zero ? !can_use_fpu_any_rmode(s) : !can_use_fpu(s)) {
+        return false;
+    }
+    float64_input_flush1(&ua.s, s);
+    if (unlikely(!float64_is_zero_or_normal(ua.s))) {
+        return false;
+    }
+    return hard_to_int(ua.h, round_to_zero, min, r);
+}
+
 int16_t float16_to_int16(float16 a, float_status *s)
 {
     return float16_to_int16_scalbn(a, s->float_rounding_mode, 0, s);
@@ -2229,13 +2385,23 @@ int16_t float32_to_int16(float32 a, float_status *s)
     return float32_to_int16_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
-int32_t float32_to_int32(float32 a, float_status *s)
+int32_t QEMU_FLATTEN float32_to_int32(float32 a, float_status *s)
 {
+    int64_t r;
+
+    if (f32_to_int_hard(a, false, INT32_MIN, s, &r)) {
+        return r;
+    }
     return float32_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
-int64_t float32_to_int64(float32 a, float_status *s)
+int64_t QEMU_FLATTEN float32_to_int64(float32 a, float_status *s)
 {
+    int64_t r;
+
+    if (f32_to_int_hard(a, false, INT64_MIN, s, &r)) {
+        return r;
+    }
     return float32_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -2244,13 +2410,23 @@ int16_t float64_to_int16(float64 a, float_status *s)
     return float64_to_int16_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
-int32_t float64_to_int32(float64 a, float_status *s)
+int32_t QEMU_FLATTEN float64_to_int32(float64 a, float_status *s)
 {
+    int64_t r;
+
+    if (f64_to_int_hard(a, false, INT32_MIN, s, &r)) {
+        return r;
+    }
     return float64_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
-int64_t float64_to_int64(float64 a, float_status *s)
+int64_t QEMU_FLATTEN float64_to_int64(float64 a, float_status *s)
 {
+    int64_t r;
+
+    if (f64_to_int_hard(a, false, INT64_MIN, s, &r)) {
+        return r;
+    }
     return float64_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -2274,13 +2450,25 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
     return float32_to_int16_scalbn(a, float_round_to_zero, 0, s);
 }
 
-int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
+int32_t QEMU_FLATTEN
+float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
+    int64_t r;
+
+    if (f32_to_int_hard(a, true, INT32_MIN, s, &r)) {
+        return r;
+    }
     return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
-int64_t float32_to_int64_round_to_zero(float32 a, float_status *s)
+int64_t QEMU_FLATTEN
+float32_to_int64_round_to_zero(float32 a, float_status *s)
 {
+    int64_t r;
+
+    if (f32_to_int_hard(a, true, INT64_MIN, s, &r)) {
+        return r;
+    }
     return float32_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -2289,13 +2477,25 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
     return float64_to_int16_scalbn(a, float_round_to_zero, 0, s);
 }
 
-int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
+int32_t QEMU_FLATTEN
+float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
+    int64_t r;
+
+    if (f64_to_int_hard(a, true, INT32_MIN, s, &r)) {
+        return r;
+    }
     return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
-int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
+int64_t QEMU_FLATTEN
+float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
+    int64_t r;
+
+    if (f64_to_int_hard(a, true, INT64_MIN, s, &r)) {
+        return r;
+    }
     return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -2593,11 +2793,23 @@ float32 int16_to_float32_scalbn(int16_t a, int scale, float_status *status)
 
 float32 int64_to_float32(int64_t a, float_status *status)
 {
+    if (can_use_fpu(status)) {
+        union_float32 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float32_scalbn(a, 0, status);
 }
 
 float32 int32_to_float32(int32_t a, float_status *status)
 {
+    if (can_use_fpu(status)) {
+        union_float32 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float32_scalbn(a, 0, status);
 }
 
@@ -2624,11 +2836,24 @@ float64 int16_to_float64_scalbn(int16_t a, int scale, float_status *status)
 
 float64 int64_to_float64(int64_t a, float_status *status)
 {
+    if (can_use_fpu(status)) {
+        union_float64 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float64_scalbn(a, 0, status);
 }
 
 float64 int32_to_float64(int32_t a, float_status *status)
 {
+    /* Always exact, so there is no flag to raise.  */
+    if (!QEMU_NO_HARDFLOAT) {
+        union_float64 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float64_scalbn(a, 0, status);
 }
 
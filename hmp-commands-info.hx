@@ -347,6 +347,21 @@ STEXI
 @item info kvm
 @findex info kvm
 Show KVM information.
+ETEXI
+
+    {
+        .name       = "kvm-exits",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show KVM exit statistics of each vCPU",
+        .cmd        = hmp_info_kvm_exits,
+    },
+
+STEXI
+@item info kvm-exits
+@findex info kvm-exits
+Show the number of KVM exits of each vCPU by exit reason and by the
+MemoryRegion accessed, and the time spent handling them in QEMU.
 ETEXI
 
     {
@@ -594,6 +609,20 @@ STEXI
 @item info migrate_parameters
 @findex info migrate_parameters
 Show current migration parameters.
+ETEXI
+
+    {
+        .name       = "dirty_rate",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show dirty page rate information",
+        .cmd        = hmp_info_dirty_rate,
+    },
+
+STEXI
+@item info dirty_rate
+@findex info dirty_rate
+Show the result of the last dirty page rate measurement.
 ETEXI
 
     {
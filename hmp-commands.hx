@@ -654,18 +654,20 @@ intercepts at low level, such as @code{ctrl-alt-f1} in X Window.
 ETEXI
     {
         .name       = "sync-profile",
-        .args_type  = "op:s?",
-        .params     = "[on|off|reset]",
-        .help       = "enable, disable or reset synchronization profiling. "
+        .args_type  = "op:s?,rate:i?",
+        .params     = "[on|off|reset|sample rate]",
+        .help       = "enable, disable or reset synchronization profiling, "
+                      "or only profile one in 'rate' acquisitions. "
                       "With no arguments, prints whether profiling is on or off.",
         .cmd        = hmp_sync_profile,
     },
 
 STEXI
-@item sync-profile [on|off|reset]
+@item sync-profile [on|off|reset|sample @var{rate}]
 @findex sync-profile
 Enable, disable or reset synchronization profiling. With no arguments, prints
-whether profiling is on or off.
+whether profiling is on or off. @code{sample} makes the profiler time only one
+in @var{rate} acquisitions, which reduces its overhead; the default rate is 1.
 ETEXI
 
     {
@@ -1140,6 +1142,23 @@ STEXI
 @findex migrate_start_postcopy
 Switch in-progress migration to postcopy mode. Ignored after the end of
 migration (or once already in postcopy).
+ETEXI
+
+    {
+        .name       = "calc_dirty_rate",
+        .args_type  = "second:l,sample_pages_per_GB:l?",
+        .params     = "second [sample_pages_per_GB]",
+        .help       = "start measuring the guest dirty page rate over "
+                      "'second' seconds",
+        .cmd        = hmp_calc_dirty_rate,
+    },
+
+STEXI
+@item calc_dirty_rate @var{second} [@var{sample_pages_per_GB}]
+@findex calc_dirty_rate
+Start measuring the guest dirty page rate over @var{second} seconds,
+hashing @var{sample_pages_per_GB} pages (512 by default) per GB of guest
+memory.  The result is shown by @code{info dirty_rate}.
 ETEXI
 
     {
@@ -1384,7 +1403,7 @@ ETEXI
     {
         .name       = "netdev_add",
         .args_type  = "netdev:O",
-        .params     = "[user|tap|socket|vde|bridge|hubport|netmap|vhost-user],id=str[,prop=value][,...]",
+        .params     = "[user|tap|socket|vde|bridge|hubport|netmap|af-xdp|vhost-user],id=str[,prop=value][,...]",
         .help       = "add host network device",
         .cmd        = hmp_netdev_add,
         .command_completion = netdev_add_completion,
@@ -38,6 +38,7 @@
 #include "qapi/qapi-commands-run-state.h"
 #include "qapi/qapi-commands-tpm.h"
 #include "qapi/qapi-commands-ui.h"
+#include "qapi/qapi-visit-migration.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qerror.h"
 #include "qapi/string-input-visitor.h"
@@ -106,6 +107,45 @@ void hmp_info_kvm(Monitor *mon, const QDict *qdict)
     qapi_free_KvmInfo(info);
 }
 
+void hmp_info_kvm_exits(Monitor *mon, const QDict *qdict)
+{
+    KvmExitStatsList *list, *l;
+    Error *err = NULL;
+
+    list = qmp_query_kvm_exit_stats(&err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    for (l = list; l; l = l->next) {
+        KvmExitStats *stats = l->value;
+        KvmExitReasonStatsList *r;
+        KvmExitRegionStatsList *g;
+
+        monitor_printf(mon, "CPU #%" PRId64 ":\n", stats->cpu_index);
+        for (r = stats->reasons; r; r = r->next) {
+            monitor_printf(mon, "  %-16s %12" PRIu64 " exits, avg %" PRIu64
+                           " ns, max %" PRIu64 " ns\n", r->value->reason,
+                           r->value->count,
+                           r->value->total_ns / r->value->count,
+                           r->value->max_ns);
+        }
+        for (g = stats->regions; g; g = g->next) {
+            monitor_printf(mon, "  %s %-24s %12" PRIu64 " exits, avg %" PRIu64
+                           " ns\n", g->value->pio ? "pio " : "mmio",
+                           g->value->name, g->value->count,
+                           g->value->total_ns / g->value->count);
+        }
+        if (stats->untracked_count) {
+            monitor_printf(mon, "  %" PRIu64 " exits to untracked addresses\n",
+                           stats->untracked_count);
+        }
+    }
+
+    qapi_free_KvmExitStatsList(list);
+}
+
 void hmp_info_status(Monitor *mon, const QDict *qdict)
 {
     StatusInfo *info;
@@ -260,6 +300,18 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->multifd_bytes >> 10);
         monitor_printf(mon, "pages-per-second: %" PRIu64 "\n",
                        info->ram->pages_per_second);
+        if (info->ram->free_pages) {
+            monitor_printf(mon, "free pages: %" PRIu64 " pages\n",
+                           info->ram->free_pages);
+            monitor_printf(mon, "free pages this round: %" PRIu64 " pages\n",
+                           info->ram->free_pages_round);
+        }
+        if (info->ram->copied_bytes) {
+            monitor_printf(mon, "copied bytes: %" PRIu64 " kbytes\n",
+                           info->ram->copied_bytes >> 10);
+            monitor_printf(mon, "copied bytes last round: %" PRIu64
+                           " kbytes\n", info->ram->copied_bytes_round >> 10);
+        }
 
         if (info->ram->dirty_pages_rate) {
             monitor_printf(mon, "dirty pages rate: %" PRIu64 " pages\n",
@@ -293,6 +345,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->cache_miss_rate);
         monitor_printf(mon, "xbzrle overflow : %" PRIu64 "\n",
                        info->xbzrle_cache->overflow);
+        monitor_printf(mon, "xbzrle cache hit rate: %0.2f\n",
+                       info->xbzrle_cache->cache_hit_rate);
+        monitor_printf(mon, "xbzrle cache evictions: %" PRIu64 "\n",
+                       info->xbzrle_cache->cache_evictions);
     }
 
     if (info->has_compression) {
@@ -328,6 +384,44 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
         g_free(str);
         visit_free(v);
     }
+
+    if (info->has_postcopy_latency_histogram) {
+        Visitor *v;
+        char *str;
+        v = string_output_visitor_new(false, &str);
+        visit_type_uint64List(v, NULL, &info->postcopy_latency_histogram,
+                              NULL);
+        visit_complete(v, &str);
+        monitor_printf(mon, "postcopy latency histogram (us, log2): %s\n",
+                       str);
+        g_free(str);
+        visit_free(v);
+    }
+    if (info->has_vhost_log_sync) {
+        VhostLogSyncInfoList *sync;
+
+        for (sync = info->vhost_log_sync; sync; sync = sync->next) {
+            monitor_printf(mon, "vhost log sync: %s vq %" PRId64
+                           " %" PRIu64 " us\n", sync->value->device,
+                           sync->value->vq_index, sync->value->time);
+        }
+    }
+    if (info->has_device_state) {
+        MigrationDeviceTimeList *dev;
+        int i;
+
+        /* The slowest ones are what matters for the downtime */
+        for (dev = info->device_state, i = 0; dev && i < 10;
+             dev = dev->next, i++) {
+            monitor_printf(mon, "device state: %s instance %" PRId64
+                           " %" PRIu64 " us", dev->value->name,
+                           dev->value->instance_id, dev->value->time);
+            if (dev->value->has_size) {
+                monitor_printf(mon, " %" PRIu64 " bytes", dev->value->size);
+            }
+            monitor_printf(mon, "\n");
+        }
+    }
     if (info->has_socket_address) {
         SocketAddressList *addr;
 
@@ -361,6 +455,30 @@ void hmp_info_migrate_capabilities(Monitor *mon, const QDict *qdict)
     qapi_free_MigrationCapabilityStatusList(caps);
 }
 
+void hmp_info_dirty_rate(Monitor *mon, const QDict *qdict)
+{
+    DirtyRateInfo *info = qmp_query_dirty_rate(NULL);
+    RAMBlockDirtyRateList *block;
+
+    monitor_printf(mon, "Status: %s\n", DirtyRateStatus_str(info->status));
+    monitor_printf(mon, "Start Time: %" PRId64 " (s)\n", info->start_time);
+    monitor_printf(mon, "Period: %" PRId64 " (s)\n", info->calc_time);
+    monitor_printf(mon, "Sample Pages: %" PRIu64 " (per GB)\n",
+                   info->sample_pages);
+    if (info->has_dirty_rate) {
+        monitor_printf(mon, "Dirty rate: %" PRId64 " (MB/s)\n",
+                       info->dirty_rate);
+    }
+    for (block = info->ramblocks; block; block = block->next) {
+        monitor_printf(mon, "  %s: %" PRId64 " (MB/s), %" PRIu32 " of %"
+                       PRIu32 " sampled pages dirty\n",
+                       block->value->id, block->value->dirty_rate,
+                       block->value->dirty_pages, block->value->sample_pages);
+    }
+
+    qapi_free_DirtyRateInfo(info);
+}
+
 void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
 {
     MigrationParameters *params;
@@ -435,6 +553,27 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %u\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_CHANNELS),
             params->multifd_channels);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_COMPRESSION),
+            MultiFDCompression_str(params->multifd_compression));
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_ZLIB_LEVEL),
+            params->multifd_zlib_level);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_ZSTD_LEVEL),
+            params->multifd_zstd_level);
+        monitor_printf(mon, "%s: %" PRIu64 " MB/s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_VCPU_DIRTY_LIMIT),
+            params->vcpu_dirty_limit);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_FAULT_AROUND),
+            params->postcopy_fault_around);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_LOAD_THREADS),
+            params->load_threads);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MAPPED_RAM_THREADS),
+            params->mapped_ram_threads);
         monitor_printf(mon, "%s: %" PRIu64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE),
             params->xbzrle_cache_size);
@@ -1168,7 +1307,8 @@ void hmp_sync_profile(Monitor *mon, const QDict *qdict)
     if (op == NULL) {
         bool on = qsp_is_enabled();
 
-        monitor_printf(mon, "sync-profile is %s\n", on ? "on" : "off");
+        monitor_printf(mon, "sync-profile is %s, sampling 1 in %u\n",
+                       on ? "on" : "off", qsp_get_sample_rate());
         return;
     }
     if (!strcmp(op, "on")) {
@@ -1177,6 +1317,18 @@ void hmp_sync_profile(Monitor *mon, const QDict *qdict)
         qsp_disable();
     } else if (!strcmp(op, "reset")) {
         qsp_reset();
+    } else if (!strcmp(op, "sample") && qdict_haskey(qdict, "rate")) {
+        int64_t rate = qdict_get_int(qdict, "rate");
+
+        if (rate < 1 || rate > UINT_MAX) {
+            Error *err = NULL;
+
+            error_setg(&err, QERR_INVALID_PARAMETER_VALUE, "rate",
+                       "a positive integer");
+            hmp_handle_error(mon, &err);
+            return;
+        }
+        qsp_set_sample_rate(rate);
     } else {
         Error *err = NULL;
 
@@ -1822,6 +1974,35 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_multifd_channels = true;
         visit_type_int(v, param, &p->multifd_channels, &err);
         break;
+    case MIGRATION_PARAMETER_MULTIFD_COMPRESSION:
+        p->has_multifd_compression = true;
+        visit_type_MultiFDCompression(v, param, &p->multifd_compression,
+                                      &err);
+        break;
+    case MIGRATION_PARAMETER_MULTIFD_ZLIB_LEVEL:
+        p->has_multifd_zlib_level = true;
+        visit_type_int(v, param, &p->multifd_zlib_level, &err);
+        break;
+    case MIGRATION_PARAMETER_MULTIFD_ZSTD_LEVEL:
+        p->has_multifd_zstd_level = true;
+        visit_type_int(v, param, &p->multifd_zstd_level, &err);
+        break;
+    case MIGRATION_PARAMETER_VCPU_DIRTY_LIMIT:
+        p->has_vcpu_dirty_limit = true;
+        visit_type_uint64(v, param, &p->vcpu_dirty_limit, &err);
+        break;
+    case MIGRATION_PARAMETER_POSTCOPY_FAULT_AROUND:
+        p->has_postcopy_fault_around = true;
+        visit_type_int(v, param, &p->postcopy_fault_around, &err);
+        break;
+    case MIGRATION_PARAMETER_LOAD_THREADS:
+        p->has_load_threads = true;
+        visit_type_int(v, param, &p->load_threads, &err);
+        break;
+    case MIGRATION_PARAMETER_MAPPED_RAM_THREADS:
+        p->has_mapped_ram_threads = true;
+        visit_type_int(v, param, &p->mapped_ram_threads, &err);
+        break;
     case MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE:
         p->has_xbzrle_cache_size = true;
         visit_type_size(v, param, &cache_size, &err);
@@ -1894,6 +2075,24 @@ void hmp_migrate_start_postcopy(Monitor *mon, const QDict *qdict)
     hmp_handle_error(mon, &err);
 }
 
+void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
+{
+    int64_t sec = qdict_get_int(qdict, "second");
+    bool has_sample_pages = qdict_haskey(qdict, "sample_pages_per_GB");
+    int64_t sample_pages = qdict_get_try_int(qdict, "sample_pages_per_GB", 0);
+    Error *err = NULL;
+
+    qmp_calc_dirty_rate(sec, has_sample_pages, sample_pages, &err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    monitor_printf(mon, "Started measuring the dirty page rate over %"
+                   PRId64 " seconds\n", sec);
+    monitor_printf(mon, "[Please use 'info dirty_rate' to check results]\n");
+}
+
 void hmp_x_colo_lost_heartbeat(Monitor *mon, const QDict *qdict)
 {
     Error *err = NULL;
@@ -2037,7 +2236,7 @@ void hmp_block_job_set_speed(Monitor *mon, const QDict *qdict)
     const char *device = qdict_get_str(qdict, "device");
     int64_t value = qdict_get_int(qdict, "speed");
 
-    qmp_block_job_set_speed(device, value, &error);
+    qmp_block_job_set_speed(device, value, false, 0, &error);
 
     hmp_handle_error(mon, &error);
 }
@@ -2232,7 +2431,8 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
     prot = g_strconcat("file:", file, NULL);
 
     qmp_dump_guest_memory(paging, prot, true, detach, has_begin, begin,
-                          has_length, length, true, dump_format, &err);
+                          has_length, length, true, dump_format,
+                          false, 0, false, false, &err);
     hmp_handle_error(mon, &err);
     g_free(prot);
 }
@@ -2425,7 +2625,8 @@ void hmp_nbd_server_start(Monitor *mon, const QDict *qdict)
         }
 
         qmp_nbd_server_add(info->value->device, false, NULL,
-                           true, writable, false, NULL, &local_err);
+                           true, writable, false, NULL, false, false,
+                           &local_err);
 
         if (local_err != NULL) {
             qmp_nbd_server_stop(NULL);
@@ -2447,7 +2648,7 @@ void hmp_nbd_server_add(Monitor *mon, const QDict *qdict)
     Error *local_err = NULL;
 
     qmp_nbd_server_add(device, !!name, name, true, writable,
-                       false, NULL, &local_err);
+                       false, NULL, false, false, &local_err);
     hmp_handle_error(mon, &local_err);
 }
 
@@ -2653,6 +2854,7 @@ void hmp_info_memory_devices(Monitor *mon, const QDict *qdict)
     MemoryDeviceInfoList *info_list = qmp_query_memory_devices(&err);
     MemoryDeviceInfoList *info;
     MemoryDeviceInfo *value;
+    VirtioMEMDeviceInfo *vmi;
     PCDIMMDeviceInfo *di;
 
     for (info = info_list; info; info = info->next) {
@@ -2668,6 +2870,25 @@ void hmp_info_memory_devices(Monitor *mon, const QDict *qdict)
                 di = value->u.nvdimm.data;
                 break;
 
+            case MEMORY_DEVICE_INFO_KIND_VIRTIO_MEM:
+                vmi = value->u.virtio_mem.data;
+                monitor_printf(mon, "Memory device [%s]: \"%s\"\n",
+                               MemoryDeviceInfoKind_str(value->type),
+                               vmi->id ? vmi->id : "");
+                monitor_printf(mon, "  memaddr: 0x%" PRIx64 "\n",
+                               vmi->memaddr);
+                monitor_printf(mon, "  node: %" PRId64 "\n", vmi->node);
+                monitor_printf(mon, "  requested-size: %" PRIu64 "\n",
+                               vmi->requested_size);
+                monitor_printf(mon, "  size: %" PRIu64 "\n", vmi->size);
+                monitor_printf(mon, "  max-size: %" PRIu64 "\n",
+                               vmi->max_size);
+                monitor_printf(mon, "  block-size: %" PRIu64 "\n",
+                               vmi->block_size);
+                monitor_printf(mon, "  memdev: %s\n", vmi->memdev);
+                di = NULL;
+                break;
+
             default:
                 di = NULL;
                 break;
@@ -2707,6 +2928,10 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
         monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        monitor_printf(mon, "  poll-time-ns=%" PRId64 "\n",
+                       value->poll_time_ns);
+        monitor_printf(mon, "  dispatch-time-ns=%" PRId64 "\n",
+                       value->dispatch_time_ns);
     }
 
     qapi_free_IOThreadInfoList(info_list);
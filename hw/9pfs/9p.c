@@ -18,6 +18,7 @@
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
 #include "qemu/sockets.h"
+#include "block/aio-wait.h"
 #include "virtio-9p.h"
 #include "fsdev/qemu-fsdev.h"
 #include "9p-xattr.h"
@@ -369,6 +370,30 @@ static int coroutine_fn free_fid(V9fsPDU *pdu, V9fsFidState *fidp)
     return retval;
 }
 
+/*
+ * Requests may be processed in an IOThread.  Anything that needs the BQL,
+ * like the migration blocker, is done after hopping over to the main loop
+ * with v9fs_co_enter_main_loop() and back with v9fs_co_leave_main_loop().
+ */
+static AioContext *coroutine_fn v9fs_co_enter_main_loop(void)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    if (ctx != qemu_get_aio_context()) {
+        aio_co_schedule(qemu_get_aio_context(), qemu_coroutine_self());
+        qemu_coroutine_yield();
+    }
+    return ctx;
+}
+
+static void coroutine_fn v9fs_co_leave_main_loop(AioContext *ctx)
+{
+    if (ctx != qemu_get_aio_context()) {
+        aio_co_schedule(ctx, qemu_coroutine_self());
+        qemu_coroutine_yield();
+    }
+}
+
 static int coroutine_fn put_fid(V9fsPDU *pdu, V9fsFidState *fidp)
 {
     BUG_ON(!fidp->ref);
@@ -385,9 +410,12 @@ static int coroutine_fn put_fid(V9fsPDU *pdu, V9fsFidState *fidp)
              * should be hooked to transport close notification
              */
             if (pdu->s->migration_blocker) {
+                AioContext *ctx = v9fs_co_enter_main_loop();
+
                 migrate_del_blocker(pdu->s->migration_blocker);
                 error_free(pdu->s->migration_blocker);
                 pdu->s->migration_blocker = NULL;
+                v9fs_co_leave_main_loop(ctx);
             }
         }
         return free_fid(pdu, fidp);
@@ -622,6 +650,8 @@ void pdu_free(V9fsPDU *pdu)
     g_assert(!pdu->cancelled);
     QLIST_REMOVE(pdu, next);
     QLIST_INSERT_HEAD(&s->free_list, pdu, next);
+    /* v9fs_reset() may be waiting for this one from the main loop */
+    aio_wait_kick();
 }
 
 static void coroutine_fn pdu_complete(V9fsPDU *pdu, ssize_t len)
@@ -960,6 +990,14 @@ static void coroutine_fn v9fs_version(void *opaque)
     }
     trace_v9fs_version(pdu->tag, pdu->id, s->msize, version.data);
 
+    if (s->msize < 8192) {
+        warn_report_once("9p: degraded performance: a reasonable high msize "
+                         "should be chosen on client/guest side (chosen msize "
+                         "is <= 8192). See "
+                         "https://wiki.qemu.org/Documentation/9psetup#msize "
+                         "for details.");
+    }
+
     virtfs_reset(pdu);
 
     if (!strcmp(version.data, "9P2000.u")) {
@@ -1026,10 +1064,14 @@ static void coroutine_fn v9fs_attach(void *opaque)
      * attach could get called multiple times for the same export.
      */
     if (!s->migration_blocker) {
+        AioContext *ctx;
+
         error_setg(&s->migration_blocker,
                    "Migration is disabled when VirtFS export path '%s' is mounted in the guest using mount_tag '%s'",
                    s->ctx.fs_root ? s->ctx.fs_root : "NULL", s->tag);
+        ctx = v9fs_co_enter_main_loop();
         err = migrate_add_blocker(s->migration_blocker, &local_err);
+        v9fs_co_leave_main_loop(ctx);
         if (local_err) {
             error_free(local_err);
             error_free(s->migration_blocker);
@@ -1894,7 +1936,7 @@ out_nofid:
     pdu_complete(pdu, err);
 }
 
-static size_t v9fs_readdir_data_size(V9fsString *name)
+size_t v9fs_readdir_response_size(V9fsString *name)
 {
     /*
      * Size of each dirent on the wire: size of qid (13) + size of offset (8)
@@ -1903,40 +1945,38 @@ static size_t v9fs_readdir_data_size(V9fsString *name)
     return 24 + v9fs_string_size(name);
 }
 
+void v9fs_free_dirents(V9fsDirEnt *e)
+{
+    V9fsDirEnt *next;
+
+    for (; e; e = next) {
+        next = e->next;
+        g_free(e->dent);
+        g_free(e);
+    }
+}
+
 static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
-                                        int32_t max_count)
+                                        off_t offset, int32_t max_count)
 {
     size_t size;
     V9fsQID qid;
     V9fsString name;
     int len, err = 0;
     int32_t count = 0;
-    off_t saved_dir_pos;
     struct dirent *dent;
+    V9fsDirEnt *entries, *e;
 
-    /* save the directory position */
-    saved_dir_pos = v9fs_co_telldir(pdu, fidp);
-    if (saved_dir_pos < 0) {
-        return saved_dir_pos;
+    count = v9fs_co_readdir_many(pdu, fidp, &entries, offset, max_count);
+    if (count < 0) {
+        return count;
     }
+    count = 0;
 
-    while (1) {
-        v9fs_readdir_lock(&fidp->fs.dir);
-
-        err = v9fs_co_readdir(pdu, fidp, &dent);
-        if (err || !dent) {
-            break;
-        }
+    for (e = entries; e; e = e->next) {
+        dent = e->dent;
         v9fs_string_init(&name);
         v9fs_string_sprintf(&name, "%s", dent->d_name);
-        if ((count + v9fs_readdir_data_size(&name)) > max_count) {
-            v9fs_readdir_unlock(&fidp->fs.dir);
-
-            /* Ran out of buffer. Set dir back to old position and return */
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_string_free(&name);
-            return count;
-        }
         /*
          * Fill up just the path field of qid because the client uses
          * only that. To fill the entire qid structure we will have
@@ -1952,21 +1992,15 @@ static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
         len = pdu_marshal(pdu, 11 + count, "Qqbs",
                           &qid, dent->d_off,
                           dent->d_type, &name);
-
-        v9fs_readdir_unlock(&fidp->fs.dir);
-
+        v9fs_string_free(&name);
         if (len < 0) {
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_string_free(&name);
-            return len;
+            err = len;
+            break;
         }
         count += len;
-        v9fs_string_free(&name);
-        saved_dir_pos = dent->d_off;
     }
 
-    v9fs_readdir_unlock(&fidp->fs.dir);
-
+    v9fs_free_dirents(entries);
     if (err < 0) {
         return err;
     }
@@ -2000,12 +2034,7 @@ static void coroutine_fn v9fs_readdir(void *opaque)
         retval = -EINVAL;
         goto out;
     }
-    if (initial_offset == 0) {
-        v9fs_co_rewinddir(pdu, fidp);
-    } else {
-        v9fs_co_seekdir(pdu, fidp, initial_offset);
-    }
-    count = v9fs_do_readdir(pdu, fidp, max_count);
+    count = v9fs_do_readdir(pdu, fidp, initial_offset, max_count);
     if (count < 0) {
         retval = count;
         goto out;
@@ -3679,9 +3708,8 @@ void v9fs_reset(V9fsState *s)
     VirtfsCoResetData data = { .pdu = { .s = s }, .done = false };
     Coroutine *co;
 
-    while (!QLIST_EMPTY(&s->active_list)) {
-        aio_poll(qemu_get_aio_context(), true);
-    }
+    /* Requests might still be running in an IOThread */
+    AIO_WAIT_WHILE(NULL, !QLIST_EMPTY(&s->active_list));
 
     co = qemu_coroutine_create(virtfs_co_reset, &data);
     qemu_coroutine_enter(co);
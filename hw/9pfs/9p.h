@@ -198,6 +198,12 @@ static inline void v9fs_readdir_unlock(V9fsDir *dir)
     qemu_mutex_unlock(&dir->readdir_mutex);
 }
 
+/* Directory entries collected by v9fs_co_readdir_many() */
+typedef struct V9fsDirEnt {
+    struct dirent *dent;
+    struct V9fsDirEnt *next;
+} V9fsDirEnt;
+
 static inline void v9fs_readdir_init(V9fsDir *dir)
 {
     qemu_mutex_init(&dir->readdir_mutex);
@@ -358,6 +364,8 @@ V9fsPDU *pdu_alloc(V9fsState *s);
 void pdu_free(V9fsPDU *pdu);
 void pdu_submit(V9fsPDU *pdu, P9MsgHeader *hdr);
 void v9fs_reset(V9fsState *s);
+size_t v9fs_readdir_response_size(V9fsString *name);
+void v9fs_free_dirents(V9fsDirEnt *e);
 
 struct V9fsTransport {
     ssize_t     (*pdu_vmarshal)(V9fsPDU *pdu, size_t offset, const char *fmt,
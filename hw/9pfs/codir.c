@@ -42,6 +42,81 @@ int coroutine_fn v9fs_co_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
     return err;
 }
 
+/*
+ * Seek to @offset and collect as many entries as fit in a reply of
+ * @maxsize bytes, all in a single trip to the worker thread.  The stream
+ * is left right after the last entry returned.  Returns the reply size
+ * of the entries, to be freed with v9fs_free_dirents(), or -errno.
+ */
+int coroutine_fn v9fs_co_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
+                                      V9fsDirEnt **entries, off_t offset,
+                                      int32_t maxsize)
+{
+    int err = 0;
+    int32_t size = 0;
+    V9fsState *s = pdu->s;
+
+    *entries = NULL;
+    if (v9fs_request_cancelled(pdu)) {
+        return -EINTR;
+    }
+    v9fs_co_run_in_worker(
+        {
+            V9fsDirEnt **tail = entries;
+            struct dirent *dent;
+            V9fsString name;
+            off_t saved_dir_pos;
+            size_t len;
+
+            v9fs_readdir_lock(&fidp->fs.dir);
+            if (offset == 0) {
+                s->ops->rewinddir(&s->ctx, &fidp->fs);
+            } else {
+                s->ops->seekdir(&s->ctx, &fidp->fs, offset);
+            }
+            saved_dir_pos = s->ops->telldir(&s->ctx, &fidp->fs);
+            if (saved_dir_pos < 0) {
+                err = -errno;
+            }
+
+            while (!err) {
+                if (v9fs_request_cancelled(pdu)) {
+                    err = -EINTR;
+                    break;
+                }
+                errno = 0;
+                dent = s->ops->readdir(&s->ctx, &fidp->fs);
+                if (!dent) {
+                    err = -errno;
+                    break;
+                }
+
+                v9fs_string_init(&name);
+                v9fs_string_sprintf(&name, "%s", dent->d_name);
+                len = v9fs_readdir_response_size(&name);
+                v9fs_string_free(&name);
+                if (size + len > maxsize) {
+                    /* Leave this one for the next request */
+                    s->ops->seekdir(&s->ctx, &fidp->fs, saved_dir_pos);
+                    break;
+                }
+
+                *tail = g_new0(V9fsDirEnt, 1);
+                (*tail)->dent = g_memdup(dent, sizeof(*dent));
+                tail = &(*tail)->next;
+                size += len;
+                saved_dir_pos = dent->d_off;
+            }
+            v9fs_readdir_unlock(&fidp->fs.dir);
+        });
+    if (err < 0) {
+        v9fs_free_dirents(*entries);
+        *entries = NULL;
+        return err;
+    }
+    return size;
+}
+
 off_t v9fs_co_telldir(V9fsPDU *pdu, V9fsFidState *fidp)
 {
     off_t err;
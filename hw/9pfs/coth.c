@@ -36,6 +36,6 @@ static int coroutine_enter_func(void *arg)
 void co_run_in_worker_bh(void *opaque)
 {
     Coroutine *co = opaque;
-    thread_pool_submit_aio(aio_get_thread_pool(qemu_get_aio_context()),
+    thread_pool_submit_aio(aio_get_thread_pool(qemu_get_current_aio_context()),
                            coroutine_enter_func, co, coroutine_enter_cb, co);
 }
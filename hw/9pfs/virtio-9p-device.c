@@ -18,7 +18,15 @@
 #include "fsdev/qemu-fsdev.h"
 #include "coth.h"
 #include "hw/virtio/virtio-access.h"
+#include "hw/virtio/virtio-bus.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
 #include "qemu/iov.h"
+#include "block/aio-wait.h"
+
+/* The generic ioeventfd handling, used when there is no IOThread */
+static int (*virtio_9p_parent_start_ioeventfd)(VirtIODevice *vdev);
+static void (*virtio_9p_parent_stop_ioeventfd)(VirtIODevice *vdev);
 
 static void virtio_9p_push_and_notify(V9fsPDU *pdu)
 {
@@ -32,16 +40,21 @@ static void virtio_9p_push_and_notify(V9fsPDU *pdu)
     v->elems[pdu->idx] = NULL;
 
     /* FIXME: we should batch these completions */
-    virtio_notify(VIRTIO_DEVICE(v), v->vq);
+    if (v->dataplane_started) {
+        virtio_notify_irqfd(VIRTIO_DEVICE(v), v->vq);
+    } else {
+        virtio_notify(VIRTIO_DEVICE(v), v->vq);
+    }
 }
 
-static void handle_9p_output(VirtIODevice *vdev, VirtQueue *vq)
+static bool virtio_9p_handle_vq(VirtIODevice *vdev, VirtQueue *vq)
 {
     V9fsVirtioState *v = (V9fsVirtioState *)vdev;
     V9fsState *s = &v->state;
     V9fsPDU *pdu;
     ssize_t len;
     VirtQueueElement *elem;
+    bool progress = false;
 
     while ((pdu = pdu_alloc(s))) {
         P9MsgHeader out;
@@ -50,6 +63,7 @@ static void handle_9p_output(VirtIODevice *vdev, VirtQueue *vq)
         if (!elem) {
             goto out_free_pdu;
         }
+        progress = true;
 
         if (iov_size(elem->in_sg, elem->in_num) < 7) {
             virtio_error(vdev,
@@ -70,13 +84,107 @@ static void handle_9p_output(VirtIODevice *vdev, VirtQueue *vq)
         pdu_submit(pdu, &out);
     }
 
-    return;
+    return progress;
 
 out_free_req:
     virtqueue_detach_element(vq, elem, 0);
     g_free(elem);
 out_free_pdu:
     pdu_free(pdu);
+    return progress;
+}
+
+static void handle_9p_output(VirtIODevice *vdev, VirtQueue *vq)
+{
+    V9fsVirtioState *v = (V9fsVirtioState *)vdev;
+
+    if (v->iothread) {
+        /*
+         * Some guests kick before setting VIRTIO_CONFIG_S_DRIVER_OK, so
+         * start the IOThread here instead of waiting for .set_status().
+         */
+        virtio_device_start_ioeventfd(vdev);
+        if (v->dataplane_started) {
+            return;
+        }
+    }
+    virtio_9p_handle_vq(vdev, vq);
+}
+
+/* Context: QEMU global mutex held */
+static int virtio_9p_start_ioeventfd(VirtIODevice *vdev)
+{
+    V9fsVirtioState *v = VIRTIO_9P(vdev);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    AioContext *ctx;
+    int r;
+
+    if (!v->iothread) {
+        return virtio_9p_parent_start_ioeventfd(vdev);
+    }
+    if (v->dataplane_started) {
+        return 0;
+    }
+
+    r = k->set_guest_notifiers(qbus->parent, 1, true);
+    if (r != 0) {
+        error_report("virtio-9p failed to set guest notifier (%d), "
+                     "falling back to the main loop", r);
+        return virtio_9p_parent_start_ioeventfd(vdev);
+    }
+    r = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), 0, true);
+    if (r != 0) {
+        error_report("virtio-9p failed to set host notifier (%d)", r);
+        k->set_guest_notifiers(qbus->parent, 1, false);
+        return r;
+    }
+    v->dataplane_started = true;
+
+    /* Kick right away to begin processing requests already in vring */
+    event_notifier_set(virtio_queue_get_host_notifier(v->vq));
+
+    ctx = iothread_get_aio_context(v->iothread);
+    aio_context_acquire(ctx);
+    virtio_queue_aio_set_host_notifier_handler(v->vq, ctx,
+                                               virtio_9p_handle_vq);
+    aio_context_release(ctx);
+    return 0;
+}
+
+static void virtio_9p_stop_bh(void *opaque)
+{
+    V9fsVirtioState *v = opaque;
+
+    virtio_queue_aio_set_host_notifier_handler(v->vq,
+                                               qemu_get_current_aio_context(),
+                                               NULL);
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_9p_stop_ioeventfd(VirtIODevice *vdev)
+{
+    V9fsVirtioState *v = VIRTIO_9P(vdev);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    AioContext *ctx;
+
+    if (!v->dataplane_started) {
+        virtio_9p_parent_stop_ioeventfd(vdev);
+        return;
+    }
+
+    /* Stop taking new requests and let the running ones complete */
+    ctx = iothread_get_aio_context(v->iothread);
+    aio_context_acquire(ctx);
+    aio_wait_bh_oneshot(ctx, virtio_9p_stop_bh, v);
+    AIO_WAIT_WHILE(ctx, !QLIST_EMPTY(&v->state.active_list));
+    aio_context_release(ctx);
+
+    virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), 0, false);
+    virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), 0);
+    k->set_guest_notifiers(qbus->parent, 1, false);
+    v->dataplane_started = false;
 }
 
 static uint64_t virtio_9p_get_features(VirtIODevice *vdev, uint64_t features,
@@ -205,6 +313,26 @@ static void virtio_9p_device_realize(DeviceState *dev, Error **errp)
     v->config_size = sizeof(struct virtio_9p_config) + strlen(s->fsconf.tag);
     virtio_init(vdev, "virtio-9p", VIRTIO_ID_9P, v->config_size);
     v->vq = virtio_add_queue(vdev, MAX_REQ, handle_9p_output);
+
+    if (v->iothread) {
+        BusState *qbus = BUS(qdev_get_parent_bus(dev));
+        VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+
+        if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+            error_setg(errp, "device is incompatible with iothread "
+                       "(transport does not support notifiers)");
+            goto out_err;
+        }
+        if (!virtio_device_ioeventfd_enabled(vdev)) {
+            error_setg(errp, "ioeventfd is required for iothread");
+            goto out_err;
+        }
+    }
+    return;
+
+out_err:
+    virtio_cleanup(vdev);
+    v9fs_device_unrealize_common(s, NULL);
 }
 
 static void virtio_9p_device_unrealize(DeviceState *dev, Error **errp)
@@ -232,6 +360,8 @@ static const VMStateDescription vmstate_virtio_9p = {
 static Property virtio_9p_properties[] = {
     DEFINE_PROP_STRING("mount_tag", V9fsVirtioState, state.fsconf.tag),
     DEFINE_PROP_STRING("fsdev", V9fsVirtioState, state.fsconf.fsdev_id),
+    DEFINE_PROP_LINK("iothread", V9fsVirtioState, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -248,6 +378,10 @@ static void virtio_9p_class_init(ObjectClass *klass, void *data)
     vdc->get_features = virtio_9p_get_features;
     vdc->get_config = virtio_9p_get_config;
     vdc->reset = virtio_9p_reset;
+    virtio_9p_parent_start_ioeventfd = vdc->start_ioeventfd;
+    virtio_9p_parent_stop_ioeventfd = vdc->stop_ioeventfd;
+    vdc->start_ioeventfd = virtio_9p_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_9p_stop_ioeventfd;
 }
 
 static const TypeInfo virtio_device_info = {
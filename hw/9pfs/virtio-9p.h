@@ -3,6 +3,7 @@
 
 #include "standard-headers/linux/virtio_9p.h"
 #include "hw/virtio/virtio.h"
+#include "sysemu/iothread.h"
 #include "9p.h"
 
 typedef struct V9fsVirtioState
@@ -12,6 +13,9 @@ typedef struct V9fsVirtioState
     size_t config_size;
     VirtQueueElement *elems[MAX_REQ];
     V9fsState state;
+    /* requests are processed in this IOThread instead of the main loop */
+    IOThread *iothread;
+    bool dataplane_started;
 } V9fsVirtioState;
 
 #define TYPE_VIRTIO_9P "virtio-9p-device"
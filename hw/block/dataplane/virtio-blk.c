@@ -34,6 +34,7 @@ struct VirtIOBlockDataPlane {
     QEMUBH *bh;                     /* bh for guest notification */
     unsigned long *batch_notify_vqs;
     bool batch_notifications;
+    int64_t batch_notify_ns;        /* first completion of the batch */
 
     /* Note that these EventNotifiers are assigned by value.  This is
      * fine as long as you do not call event_notifier_cleanup on them
@@ -45,25 +46,36 @@ struct VirtIOBlockDataPlane {
 };
 
 /* Raise an interrupt to signal guest, if necessary */
-void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
+void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq,
+                                  int64_t complete_ns)
 {
+    VirtIOBlock *vblk = VIRTIO_BLK(s->vdev);
+
     if (s->batch_notifications) {
+        if (!s->batch_notify_ns) {
+            s->batch_notify_ns = complete_ns;
+        }
         set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
         qemu_bh_schedule(s->bh);
     } else {
         virtio_notify_irqfd(s->vdev, vq);
+        block_acct_stage_done(blk_get_stats(vblk->blk), BLOCK_ACCT_STAGE_NOTIFY,
+                              complete_ns, block_acct_time_ns());
     }
 }
 
 static void notify_guest_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
+    BlockAcctStats *stats = blk_get_stats(VIRTIO_BLK(s->vdev)->blk);
     unsigned nvqs = s->conf->num_queues;
     unsigned long bitmap[BITS_TO_LONGS(nvqs)];
+    int64_t batch_ns = s->batch_notify_ns;
     unsigned j;
 
     memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
     memset(s->batch_notify_vqs, 0, sizeof(bitmap));
+    s->batch_notify_ns = 0;
 
     for (j = 0; j < nvqs; j += BITS_PER_LONG) {
         unsigned long bits = bitmap[j];
@@ -73,6 +85,9 @@ static void notify_guest_bh(void *opaque)
             VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
             virtio_notify_irqfd(s->vdev, vq);
+            /* One sample per virtqueue, for the longest wait of the batch */
+            block_acct_stage_done(stats, BLOCK_ACCT_STAGE_NOTIFY, batch_ns,
+                                  block_acct_time_ns());
 
             bits &= bits - 1; /* clear right-most bit */
         }
@@ -19,14 +19,24 @@
  *      -drive file=<file>,if=none,id=<drive_id>
  *      -device nvme,drive=<drive_id>,serial=<serial>,id=<id[optional]>, \
  *              cmb_size_mb=<cmb_size_mb[optional]>, \
- *              num_queues=<N[optional]>
+ *              num_queues=<N[optional]>, namespaces=<N[optional]>, \
+ *              iothread=<iothread_id[optional]>, ioeventfd=<on|off[optional]>
  *
  * Note cmb_size_mb denotes size of CMB in MB. CMB is assumed to be at
  * offset 0 in BAR2 and supports only WDS, RDS and SQS for now.
+ *
+ * namespaces splits the drive into that many namespaces of equal size.
+ *
+ * With iothread, the I/O queues are processed in that IOThread; the admin
+ * queues stay in the main loop.  ioeventfd is only used for the I/O
+ * submission queues once the host has set up shadow doorbells, since the
+ * new tail is then read from the shadow doorbell buffer.
  */
 
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/bitmap.h"
+#include "qemu/main-loop.h"
 #include "hw/block/block.h"
 #include "hw/hw.h"
 #include "hw/pci/msix.h"
@@ -48,6 +58,8 @@
             " in %s: " fmt "\n", __func__, ## __VA_ARGS__); \
     } while (0)
 
+#define NVME_MAX_NAMESPACES 256
+
 static void nvme_process_sq(void *opaque);
 
 static void nvme_addr_read(NvmeCtrl *n, hwaddr addr, void *buf, int size)
@@ -109,7 +121,11 @@ static void nvme_irq_check(NvmeCtrl *n)
 static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
 {
     if (cq->irq_enabled) {
-        if (msix_enabled(&(n->parent_obj))) {
+        if (!qemu_mutex_iothread_locked()) {
+            /* Called from the IOThread, let the main loop raise it */
+            set_bit(cq->cqid, n->irq_pending);
+            qemu_bh_schedule(n->irq_bh);
+        } else if (msix_enabled(&(n->parent_obj))) {
             trace_nvme_irq_msix(cq->vector);
             msix_notify(&(n->parent_obj), cq->vector);
         } else {
@@ -131,9 +147,77 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
         } else {
             assert(cq->cqid < 64);
             n->irq_status &= ~(1 << cq->cqid);
-            nvme_irq_check(n);
+            if (qemu_mutex_iothread_locked()) {
+                nvme_irq_check(n);
+            } else {
+                qemu_bh_schedule(n->irq_bh);
+            }
+        }
+    }
+}
+
+static void nvme_irq_bh(void *opaque)
+{
+    NvmeCtrl *n = opaque;
+    unsigned long cqid;
+
+    aio_context_acquire(n->ctx);
+    for (cqid = find_first_bit(n->irq_pending, n->num_queues);
+         cqid < n->num_queues;
+         cqid = find_next_bit(n->irq_pending, n->num_queues, cqid + 1)) {
+        clear_bit(cqid, n->irq_pending);
+        if (n->cq[cqid]) {
+            nvme_irq_assert(n, n->cq[cqid]);
         }
     }
+    nvme_irq_check(n);
+    aio_context_release(n->ctx);
+}
+
+/*
+ * Raise the interrupt of @cq, now or once enough completions have been
+ * posted or enough time has passed, as set by the Interrupt Coalescing
+ * feature.  Admin completions are never delayed.
+ */
+static void nvme_irq_coalesce(NvmeCtrl *n, NvmeCQueue *cq, uint32_t posted)
+{
+    uint32_t thr = NVME_INTC_THR(n->int_coalescing) + 1;
+    uint32_t time = NVME_INTC_TIME(n->int_coalescing);
+
+    if (!cq->cqid || !time || test_bit(cq->vector, n->int_vector_cd)) {
+        nvme_irq_assert(n, cq);
+        return;
+    }
+
+    cq->coalesced += posted;
+    if (cq->coalesced >= thr) {
+        cq->coalesced = 0;
+        timer_del(cq->irq_timer);
+        nvme_irq_assert(n, cq);
+    } else if (posted && !timer_pending(cq->irq_timer)) {
+        /* TIME is in 100 microsecond units */
+        timer_mod(cq->irq_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                  time * 100 * SCALE_US);
+    }
+}
+
+static void nvme_irq_timer(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+    NvmeCtrl *n = cq->ctrl;
+
+    aio_context_acquire(n->ctx);
+    cq->coalesced = 0;
+    if (n->cq[cq->cqid] == cq && cq->tail != cq->head) {
+        nvme_irq_assert(n, cq);
+    }
+    aio_context_release(n->ctx);
+}
+
+/* The admin queues stay in the main loop, where queues can be set up */
+static AioContext *nvme_queue_ctx(NvmeCtrl *n, uint16_t qid)
+{
+    return qid ? n->ctx : qemu_get_aio_context();
 }
 
 static uint16_t nvme_map_prp(QEMUSGList *qsg, QEMUIOVector *iov, uint64_t prp1,
@@ -247,11 +331,41 @@ static uint16_t nvme_dma_read_prp(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
     return status;
 }
 
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+    uint32_t head;
+
+    pci_dma_read(&n->parent_obj, cq->db_addr, &head, sizeof(head));
+    head = le32_to_cpu(head);
+    if (head < cq->size) {
+        cq->head = head;
+    }
+}
+
+static void nvme_update_cq_eventidx(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+    uint32_t ei = cpu_to_le32(cq->head);
+
+    pci_dma_write(&n->parent_obj, cq->ei_addr, &ei, sizeof(ei));
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
+    uint32_t posted = 0;
+
+    aio_context_acquire(n->ctx);
+    if (n->cq[cq->cqid] != cq) {
+        aio_context_release(n->ctx);
+        return;
+    }
+    if (cq->db_addr) {
+        nvme_update_cq_head(cq);
+    }
 
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
@@ -271,10 +385,16 @@ static void nvme_post_cqes(void *opaque)
         pci_dma_write(&n->parent_obj, addr, (void *)&req->cqe,
             sizeof(req->cqe));
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
+        posted++;
+    }
+    if (cq->db_addr) {
+        /* Have the host ring the doorbell on its next head update */
+        nvme_update_cq_eventidx(cq);
     }
     if (cq->tail != cq->head) {
-        nvme_irq_assert(n, cq);
+        nvme_irq_coalesce(n, cq, posted);
     }
+    aio_context_release(n->ctx);
 }
 
 static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
@@ -292,6 +412,7 @@ static void nvme_rw_cb(void *opaque, int ret)
     NvmeCtrl *n = sq->ctrl;
     NvmeCQueue *cq = n->cq[sq->cqid];
 
+    aio_context_acquire(n->ctx);
     if (!ret) {
         block_acct_done(blk_get_stats(n->conf.blk), &req->acct);
         req->status = NVME_SUCCESS;
@@ -303,6 +424,7 @@ static void nvme_rw_cb(void *opaque, int ret)
         qemu_sglist_destroy(&req->qsg);
     }
     nvme_enqueue_req_completion(cq, req);
+    aio_context_release(n->ctx);
 }
 
 static uint16_t nvme_flush(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
@@ -324,7 +446,7 @@ static uint16_t nvme_write_zeros(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     const uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
     uint64_t slba = le64_to_cpu(rw->slba);
     uint32_t nlb  = le16_to_cpu(rw->nlb) + 1;
-    uint64_t offset = slba << data_shift;
+    uint64_t offset = ns->start + (slba << data_shift);
     uint32_t count = nlb << data_shift;
 
     if (unlikely(slba + nlb > ns->id_ns.nsze)) {
@@ -352,7 +474,7 @@ static uint16_t nvme_rw(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     uint8_t lba_index  = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
     uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
     uint64_t data_size = (uint64_t)nlb << data_shift;
-    uint64_t data_offset = slba << data_shift;
+    uint64_t data_offset = ns->start + (slba << data_shift);
     int is_write = rw->opcode == NVME_CMD_WRITE ? 1 : 0;
     enum BlockAcctType acct = is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ;
 
@@ -414,15 +536,66 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     }
 }
 
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+    NvmeCtrl *n = sq->ctrl;
+
+    /* The queue may have been deleted while we waited for the lock */
+    aio_context_acquire(n->ctx);
+    if (sq->ioeventfd_enabled && event_notifier_test_and_clear(e)) {
+        nvme_process_sq(sq);
+    }
+    aio_context_release(n->ctx);
+}
+
+static void nvme_init_sq_ioeventfd(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+
+    if (event_notifier_init(&sq->notifier, 0) < 0) {
+        /* Doorbell writes keep exiting to QEMU */
+        return;
+    }
+    aio_set_event_notifier(n->ctx, &sq->notifier, true,
+                           nvme_sq_notifier, NULL);
+    memory_region_add_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                              false, 0, &sq->notifier);
+    sq->ioeventfd_enabled = true;
+}
+
+static void nvme_init_sq_dbbuf(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+    if (n->ioeventfd && !sq->ioeventfd_enabled) {
+        nvme_init_sq_ioeventfd(sq);
+    }
+}
+
+static void nvme_init_cq_dbbuf(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + 4;
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + 4;
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
+    if (sq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                                  false, 0, &sq->notifier);
+        aio_set_event_notifier(n->ctx, &sq->notifier, true, NULL, NULL);
+        event_notifier_cleanup(&sq->notifier);
+        sq->ioeventfd_enabled = false;
+    }
     timer_del(sq->timer);
     timer_free(sq->timer);
     g_free(sq->io_req);
-    if (sq->sqid) {
-        g_free(sq);
-    }
 }
 
 static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -483,12 +656,19 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    sq->timer = aio_timer_new(nvme_queue_ctx(n, sqid), QEMU_CLOCK_VIRTUAL,
+                              SCALE_NS, nvme_process_sq, sq);
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
+
+    /* Shadow doorbells are only used for the I/O queues */
+    sq->db_addr = sq->ei_addr = 0;
+    if (sqid && n->dbbuf_enabled) {
+        nvme_init_sq_dbbuf(sq);
+    }
 }
 
 static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -524,7 +704,7 @@ static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
         trace_nvme_err_invalid_create_sq_qflags(NVME_SQ_FLAGS_PC(qflags));
         return NVME_INVALID_FIELD | NVME_DNR;
     }
-    sq = g_malloc0(sizeof(*sq));
+    sq = &n->sq_mem[sqid];
     nvme_init_sq(sq, n, prp1, sqid, cqid, qsize + 1);
     return NVME_SUCCESS;
 }
@@ -534,10 +714,9 @@ static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
     n->cq[cq->cqid] = NULL;
     timer_del(cq->timer);
     timer_free(cq->timer);
+    timer_del(cq->irq_timer);
+    timer_free(cq->irq_timer);
     msix_vector_unuse(&n->parent_obj, cq->vector);
-    if (cq->cqid) {
-        g_free(cq);
-    }
 }
 
 static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -577,7 +756,15 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     QTAILQ_INIT(&cq->sq_list);
     msix_vector_use(&n->parent_obj, cq->vector);
     n->cq[cqid] = cq;
-    cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    cq->timer = aio_timer_new(nvme_queue_ctx(n, cqid), QEMU_CLOCK_VIRTUAL,
+                              SCALE_NS, nvme_post_cqes, cq);
+    cq->irq_timer = aio_timer_new(nvme_queue_ctx(n, cqid), QEMU_CLOCK_VIRTUAL,
+                                  SCALE_NS, nvme_irq_timer, cq);
+    cq->coalesced = 0;
+    cq->db_addr = cq->ei_addr = 0;
+    if (cqid && n->dbbuf_enabled) {
+        nvme_init_cq_dbbuf(cq);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -614,7 +801,7 @@ static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
         return NVME_INVALID_FIELD | NVME_DNR;
     }
 
-    cq = g_malloc0(sizeof(*cq));
+    cq = &n->cq_mem[cqid];
     nvme_init_cq(cq, n, prp1, cqid, vector, qsize + 1,
         NVME_CQ_FLAGS_IEN(qflags));
     return NVME_SUCCESS;
@@ -710,6 +897,19 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         result = cpu_to_le32((n->num_queues - 2) | ((n->num_queues - 2) << 16));
         trace_nvme_getfeat_numq(result);
         break;
+    case NVME_INTERRUPT_COALESCING:
+        result = cpu_to_le32(n->int_coalescing);
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF: {
+        uint32_t iv = NVME_INTVC_IV(le32_to_cpu(cmd->cdw11));
+
+        if (unlikely(iv > n->num_queues)) {
+            trace_nvme_err_invalid_int_vector(iv);
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+        result = cpu_to_le32(iv | (test_bit(iv, n->int_vector_cd) << 16));
+        break;
+    }
     default:
         trace_nvme_err_invalid_getfeat(dw10);
         return NVME_INVALID_FIELD | NVME_DNR;
@@ -735,6 +935,22 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         req->cqe.result =
             cpu_to_le32((n->num_queues - 2) | ((n->num_queues - 2) << 16));
         break;
+    case NVME_INTERRUPT_COALESCING:
+        trace_nvme_setfeat_intcoal(NVME_INTC_THR(dw11) + 1,
+                                   NVME_INTC_TIME(dw11));
+        n->int_coalescing = dw11 & 0xffff;
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        if (unlikely(NVME_INTVC_IV(dw11) > n->num_queues)) {
+            trace_nvme_err_invalid_int_vector(NVME_INTVC_IV(dw11));
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+        if (NVME_INTVC_CD(dw11)) {
+            set_bit(NVME_INTVC_IV(dw11), n->int_vector_cd);
+        } else {
+            clear_bit(NVME_INTVC_IV(dw11), n->int_vector_cd);
+        }
+        break;
     default:
         trace_nvme_err_invalid_setfeat(dw10);
         return NVME_INVALID_FIELD | NVME_DNR;
@@ -742,6 +958,35 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     return NVME_SUCCESS;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, NvmeCmd *cmd)
+{
+    uint64_t dbs_addr = le64_to_cpu(cmd->prp1);
+    uint64_t eis_addr = le64_to_cpu(cmd->prp2);
+    int i;
+
+    trace_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    if (unlikely(!dbs_addr || !eis_addr ||
+                 (dbs_addr | eis_addr) & (n->page_size - 1))) {
+        trace_nvme_err_invalid_dbbuf_config(dbs_addr, eis_addr);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+    n->dbbuf_enabled = true;
+
+    for (i = 1; i < n->num_queues; i++) {
+        if (n->sq[i]) {
+            nvme_init_sq_dbbuf(n->sq[i]);
+        }
+        if (n->cq[i]) {
+            nvme_init_cq_dbbuf(n->cq[i]);
+        }
+    }
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 {
     switch (cmd->opcode) {
@@ -759,23 +1004,56 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         return nvme_set_feature(n, cmd, req);
     case NVME_ADM_CMD_GET_FEATURES:
         return nvme_get_feature(n, cmd, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, cmd);
     default:
         trace_nvme_err_invalid_admin_opc(cmd->opcode);
         return NVME_INVALID_OPCODE | NVME_DNR;
     }
 }
 
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+    uint32_t tail;
+
+    pci_dma_read(&n->parent_obj, sq->db_addr, &tail, sizeof(tail));
+    tail = le32_to_cpu(tail);
+    if (tail < sq->size) {
+        sq->tail = tail;
+    }
+}
+
+static void nvme_update_sq_eventidx(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+    uint32_t ei = cpu_to_le32(sq->tail);
+
+    pci_dma_write(&n->parent_obj, sq->ei_addr, &ei, sizeof(ei));
+}
+
 static void nvme_process_sq(void *opaque)
 {
     NvmeSQueue *sq = opaque;
     NvmeCtrl *n = sq->ctrl;
-    NvmeCQueue *cq = n->cq[sq->cqid];
+    NvmeCQueue *cq;
 
     uint16_t status;
     hwaddr addr;
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    aio_context_acquire(n->ctx);
+    if (n->sq[sq->sqid] != sq) {
+        /* Deleted while the IOThread was about to run us */
+        goto out;
+    }
+    cq = n->cq[sq->cqid];
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
+
+again:
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
         addr = sq->dma_addr + sq->head * n->sqe_size;
         nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd));
@@ -794,6 +1072,21 @@ static void nvme_process_sq(void *opaque)
             nvme_enqueue_req_completion(cq, req);
         }
     }
+
+    if (sq->db_addr) {
+        /*
+         * Ask for a doorbell write past what we have seen, then pick up
+         * entries the host added without one in the meantime.
+         */
+        nvme_update_sq_eventidx(sq);
+        smp_mb();
+        nvme_update_sq_tail(sq);
+        if (!nvme_sq_empty(sq) && !QTAILQ_EMPTY(&sq->req_list)) {
+            goto again;
+        }
+    }
+out:
+    aio_context_release(n->ctx);
 }
 
 static void nvme_clear_ctrl(NvmeCtrl *n)
@@ -815,6 +1108,10 @@ static void nvme_clear_ctrl(NvmeCtrl *n)
 
     blk_flush(n->conf.blk);
     n->bar.cc = 0;
+    n->dbbuf_enabled = false;
+    n->dbbuf_dbs = n->dbbuf_eis = 0;
+    n->int_coalescing = 0;
+    bitmap_zero(n->int_vector_cd, n->num_queues + 1);
 }
 
 static int nvme_start_ctrl(NvmeCtrl *n)
@@ -1114,6 +1411,11 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         start_sqs = nvme_cq_full(cq) ? 1 : 0;
         cq->head = new_head;
+        if (cq->tail == cq->head) {
+            /* The host has seen everything, no interrupt is due anymore */
+            cq->coalesced = 0;
+            timer_del(cq->irq_timer);
+        }
         if (start_sqs) {
             NvmeSQueue *sq;
             QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
@@ -1159,11 +1461,14 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
     unsigned size)
 {
     NvmeCtrl *n = (NvmeCtrl *)opaque;
+
+    aio_context_acquire(n->ctx);
     if (addr < sizeof(n->bar)) {
         nvme_write_bar(n, addr, data, size);
     } else if (addr >= 0x1000) {
         nvme_process_db(n, addr, data);
     }
+    aio_context_release(n->ctx);
 }
 
 static const MemoryRegionOps nvme_mmio_ops = {
@@ -1213,6 +1518,12 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         return;
     }
 
+    if (!n->num_namespaces || n->num_namespaces > NVME_MAX_NAMESPACES) {
+        error_setg(errp, "namespaces must be between 1 and %d",
+                   NVME_MAX_NAMESPACES);
+        return;
+    }
+
     if (!n->conf.blk) {
         error_setg(errp, "drive property not set");
         return;
@@ -1240,13 +1551,33 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
     pci_config_set_class(pci_dev->config, PCI_CLASS_STORAGE_EXPRESS);
     pcie_endpoint_cap_init(pci_dev, 0x80);
 
-    n->num_namespaces = 1;
     n->reg_size = pow2ceil(0x1004 + 2 * (n->num_queues + 1) * 4);
-    n->ns_size = bs_size / (uint64_t)n->num_namespaces;
+    n->ns_size = QEMU_ALIGN_DOWN(bs_size / (uint64_t)n->num_namespaces,
+                                 BDRV_SECTOR_SIZE);
+    if (!n->ns_size) {
+        error_setg(errp, "drive is too small for %" PRIu32 " namespaces",
+                   n->num_namespaces);
+        return;
+    }
+
+    if (n->iothread) {
+        n->ctx = iothread_get_aio_context(n->iothread);
+        aio_context_acquire(n->ctx);
+        blk_set_aio_context(n->conf.blk, n->ctx);
+        aio_context_release(n->ctx);
+    } else {
+        n->ctx = qemu_get_aio_context();
+    }
+    n->irq_bh = qemu_bh_new(nvme_irq_bh, n);
+    n->irq_pending = bitmap_new(n->num_queues);
+    /* Vectors go up to num_queues, see nvme_create_cq() */
+    n->int_vector_cd = bitmap_new(n->num_queues + 1);
 
     n->namespaces = g_new0(NvmeNamespace, n->num_namespaces);
     n->sq = g_new0(NvmeSQueue *, n->num_queues);
     n->cq = g_new0(NvmeCQueue *, n->num_queues);
+    n->sq_mem = g_new0(NvmeSQueue, n->num_queues);
+    n->cq_mem = g_new0(NvmeCQueue, n->num_queues);
 
     memory_region_init_io(&n->iomem, OBJECT(n), &nvme_mmio_ops, n,
                           "nvme", n->reg_size);
@@ -1264,7 +1595,7 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
     id->ieee[0] = 0x00;
     id->ieee[1] = 0x02;
     id->ieee[2] = 0xb3;
-    id->oacs = cpu_to_le16(0);
+    id->oacs = cpu_to_le16(NVME_OACS_DBBUF);
     id->frmw = 7 << 1;
     id->lpa = 1 << 0;
     id->sqes = (0x6 << 4) | 0x6;
@@ -1327,17 +1658,34 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         id_ns->ncap  = id_ns->nuse = id_ns->nsze =
             cpu_to_le64(n->ns_size >>
                 id_ns->lbaf[NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas)].ds);
+        ns->start = i * n->ns_size;
     }
 }
 
+static void nvme_sync_bh(void *opaque)
+{
+}
+
 static void nvme_exit(PCIDevice *pci_dev)
 {
     NvmeCtrl *n = NVME(pci_dev);
 
+    aio_context_acquire(n->ctx);
     nvme_clear_ctrl(n);
+    if (n->iothread) {
+        /* Let callbacks that were about to run see that queues are gone */
+        aio_wait_bh_oneshot(n->ctx, nvme_sync_bh, NULL);
+        blk_set_aio_context(n->conf.blk, qemu_get_aio_context());
+    }
+    aio_context_release(n->ctx);
+    qemu_bh_delete(n->irq_bh);
+    g_free(n->irq_pending);
+    g_free(n->int_vector_cd);
     g_free(n->namespaces);
     g_free(n->cq);
     g_free(n->sq);
+    g_free(n->cq_mem);
+    g_free(n->sq_mem);
 
     if (n->cmb_size_mb) {
         g_free(n->cmbuf);
@@ -1350,6 +1698,10 @@ static Property nvme_props[] = {
     DEFINE_PROP_STRING("serial", NvmeCtrl, serial),
     DEFINE_PROP_UINT32("cmb_size_mb", NvmeCtrl, cmb_size_mb, 0),
     DEFINE_PROP_UINT32("num_queues", NvmeCtrl, num_queues, 64),
+    DEFINE_PROP_UINT32("namespaces", NvmeCtrl, num_namespaces, 1),
+    DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, ioeventfd, false),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
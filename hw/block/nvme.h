@@ -1,6 +1,7 @@
 #ifndef HW_NVME_H
 #define HW_NVME_H
 #include "block/nvme.h"
+#include "sysemu/iothread.h"
 
 typedef struct NvmeAsyncEvent {
     QSIMPLEQ_ENTRY(NvmeAsyncEvent) entry;
@@ -32,6 +33,11 @@ typedef struct NvmeSQueue {
     QTAILQ_HEAD(, NvmeRequest) req_list;
     QTAILQ_HEAD(, NvmeRequest) out_req_list;
     QTAILQ_ENTRY(NvmeSQueue) entry;
+    /* Shadow doorbell and event index, if the host set up the buffers */
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
+    EventNotifier notifier;
+    bool        ioeventfd_enabled;
 } NvmeSQueue;
 
 typedef struct NvmeCQueue {
@@ -47,10 +53,16 @@ typedef struct NvmeCQueue {
     QEMUTimer   *timer;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
+    /* Interrupt coalescing */
+    QEMUTimer   *irq_timer;
+    uint32_t    coalesced;
 } NvmeCQueue;
 
 typedef struct NvmeNamespace {
     NvmeIdNs        id_ns;
+    uint64_t        start;  /* Byte offset in the drive */
 } NvmeNamespace;
 
 #define TYPE_NVME "nvme"
@@ -79,11 +91,31 @@ typedef struct NvmeCtrl {
     uint32_t    cmbloc;
     uint8_t     *cmbuf;
     uint64_t    irq_status;
+    bool        ioeventfd;
+    IOThread    *iothread;
+
+    /* Where the I/O queues are processed */
+    AioContext  *ctx;
+    /* Interrupts raised from the IOThread, delivered by the main loop */
+    QEMUBH      *irq_bh;
+    unsigned long *irq_pending;
+
+    bool        dbbuf_enabled;
+    uint64_t    dbbuf_dbs;
+    uint64_t    dbbuf_eis;
+    uint32_t    int_coalescing;
+    unsigned long *int_vector_cd;   /* Vectors with coalescing disabled */
 
     char            *serial;
     NvmeNamespace   *namespaces;
     NvmeSQueue      **sq;
     NvmeCQueue      **cq;
+    /*
+     * I/O queues live here until the device goes away, so that a callback
+     * of the IOThread that still has one never sees freed memory.
+     */
+    NvmeSQueue      *sq_mem;
+    NvmeCQueue      *cq_mem;
     NvmeSQueue      admin_sq;
     NvmeCQueue      admin_cq;
     NvmeIdCtrl      id_ctrl;
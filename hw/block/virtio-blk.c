@@ -64,22 +64,29 @@ static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
 
 static void virtio_blk_free_request(VirtIOBlockReq *req)
 {
-    g_free(req);
+    virtqueue_recycle_element(req->vq, req);
 }
 
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 {
     VirtIOBlock *s = req->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    BlockAcctStats *stats = blk_get_stats(s->blk);
+    int64_t now;
 
     trace_virtio_blk_req_complete(vdev, req, status);
 
     stb_p(&req->in->status, status);
     virtqueue_push(req->vq, &req->elem, req->in_len);
+
+    now = block_acct_time_ns();
+    block_acct_stage_done(stats, BLOCK_ACCT_STAGE_DEVICE, req->start_ns, now);
     if (s->dataplane_started && !s->dataplane_disabled) {
-        virtio_blk_data_plane_notify(s->dataplane, req->vq);
+        virtio_blk_data_plane_notify(s->dataplane, req->vq, now);
     } else {
         virtio_notify(vdev, req->vq);
+        block_acct_stage_done(stats, BLOCK_ACCT_STAGE_NOTIFY, now,
+                              block_acct_time_ns());
     }
 }
 
@@ -173,20 +180,16 @@ static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
 {
     VirtIOBlockReq *req = opaque;
     VirtIOBlock *s = req->dev;
-    bool is_write_zeroes = (virtio_ldl_p(VIRTIO_DEVICE(s), &req->out.type) &
-                            ~VIRTIO_BLK_T_BARRIER) == VIRTIO_BLK_T_WRITE_ZEROES;
 
     aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
     if (ret) {
-        if (virtio_blk_handle_rw_error(req, -ret, false, is_write_zeroes)) {
+        if (virtio_blk_handle_rw_error(req, -ret, false, true)) {
             goto out;
         }
     }
 
     virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-    if (is_write_zeroes) {
-        block_acct_done(blk_get_stats(s->blk), &req->acct);
-    }
+    block_acct_done(blk_get_stats(s->blk), &req->acct);
     virtio_blk_free_request(req);
 
 out:
@@ -246,16 +249,6 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
-{
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
-
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
-    }
-    return req;
-}
-
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
 {
     int status = VIRTIO_BLK_S_OK;
@@ -382,9 +375,15 @@ static inline void submit_requests(BlockBackend *blk, MultiReqBuffer *mrb,
     QEMUIOVector *qiov = &mrb->reqs[start]->qiov;
     int64_t sector_num = mrb->reqs[start]->sector_num;
     bool is_write = mrb->is_write;
+    int64_t now = block_acct_time_ns();
+    int i;
+
+    for (i = start; i < start + num_reqs; i++) {
+        block_acct_stage_done(blk_get_stats(blk), BLOCK_ACCT_STAGE_QUEUE,
+                              mrb->reqs[i]->start_ns, now);
+    }
 
     if (num_reqs > 1) {
-        int i;
         struct iovec *tmp_iov = qiov->iov;
         int tmp_niov = qiov->niov;
 
@@ -413,11 +412,13 @@ static inline void submit_requests(BlockBackend *blk, MultiReqBuffer *mrb,
     }
 
     if (is_write) {
-        blk_aio_pwritev(blk, sector_num << BDRV_SECTOR_BITS, qiov, 0,
-                        virtio_blk_rw_complete, mrb->reqs[start]);
+        blk_aio_pwritev(blk, sector_num << BDRV_SECTOR_BITS, qiov,
+                        mrb->prio_flags, virtio_blk_rw_complete,
+                        mrb->reqs[start]);
     } else {
-        blk_aio_preadv(blk, sector_num << BDRV_SECTOR_BITS, qiov, 0,
-                       virtio_blk_rw_complete, mrb->reqs[start]);
+        blk_aio_preadv(blk, sector_num << BDRV_SECTOR_BITS, qiov,
+                       mrb->prio_flags, virtio_blk_rw_complete,
+                       mrb->reqs[start]);
     }
 }
 
@@ -490,6 +491,25 @@ static void virtio_blk_submit_multireq(BlockBackend *blk, MultiReqBuffer *mrb)
     mrb->num_reqs = 0;
 }
 
+/*
+ * The priority class of a request, from the I/O priority that Linux
+ * guests put in its header: IOPRIO_CLASS_RT (1) and IOPRIO_CLASS_IDLE (3)
+ * get their own, the others that of the BlockBackend.
+ */
+static BdrvRequestFlags virtio_blk_prio_flags(VirtIOBlockReq *req)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(req->dev);
+
+    switch (virtio_ldl_p(vdev, &req->out.ioprio) >> 13) {
+    case 1:
+        return BDRV_REQ_PRIO_HIGH;
+    case 3:
+        return BDRV_REQ_PRIO_LOW;
+    default:
+        return 0;
+    }
+}
+
 static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 {
     VirtIOBlock *s = req->dev;
@@ -503,6 +523,8 @@ static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     if (mrb->is_write && mrb->num_reqs > 0) {
         virtio_blk_submit_multireq(s->blk, mrb);
     }
+    block_acct_stage_done(blk_get_stats(s->blk), BLOCK_ACCT_STAGE_QUEUE,
+                          req->start_ns, req->acct.start_time_ns);
     blk_aio_flush(s->blk, virtio_blk_flush_complete, req);
 }
 
@@ -579,6 +601,8 @@ static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
 
         block_acct_start(blk_get_stats(s->blk), &req->acct, bytes,
                          BLOCK_ACCT_WRITE);
+        block_acct_stage_done(blk_get_stats(s->blk), BLOCK_ACCT_STAGE_QUEUE,
+                              req->start_ns, req->acct.start_time_ns);
 
         blk_aio_pwrite_zeroes(s->blk, sector << BDRV_SECTOR_BITS,
                               bytes, blk_aio_flags,
@@ -593,6 +617,11 @@ static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
             goto err;
         }
 
+        block_acct_start(blk_get_stats(s->blk), &req->acct, bytes,
+                         BLOCK_ACCT_UNMAP);
+        block_acct_stage_done(blk_get_stats(s->blk), BLOCK_ACCT_STAGE_QUEUE,
+                              req->start_ns, req->acct.start_time_ns);
+
         blk_aio_pdiscard(s->blk, sector << BDRV_SECTOR_BITS, bytes,
                          virtio_blk_discard_write_zeroes_complete, req);
     }
@@ -600,9 +629,8 @@ static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
     return VIRTIO_BLK_S_OK;
 
 err:
-    if (is_write_zeroes) {
-        block_acct_invalid(blk_get_stats(s->blk), BLOCK_ACCT_WRITE);
-    }
+    block_acct_invalid(blk_get_stats(s->blk), is_write_zeroes ?
+                       BLOCK_ACCT_WRITE : BLOCK_ACCT_UNMAP);
     return err_status;
 }
 
@@ -650,6 +678,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     case VIRTIO_BLK_T_IN:
     {
         bool is_write = type & VIRTIO_BLK_T_OUT;
+        BdrvRequestFlags prio_flags = virtio_blk_prio_flags(req);
         req->sector_num = virtio_ldq_p(vdev, &req->out.sector);
 
         if (is_write) {
@@ -674,9 +703,10 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
                          is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
 
         /* merge would exceed maximum number of requests or IO direction
-         * changes */
+         * or priority changes */
         if (mrb->num_reqs > 0 && (mrb->num_reqs == VIRTIO_BLK_MAX_MERGE_REQS ||
                                   is_write != mrb->is_write ||
+                                  prio_flags != mrb->prio_flags ||
                                   !s->conf.request_merging)) {
             virtio_blk_submit_multireq(s->blk, mrb);
         }
@@ -684,6 +714,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         assert(mrb->num_reqs < VIRTIO_BLK_MAX_MERGE_REQS);
         mrb->reqs[mrb->num_reqs++] = req;
         mrb->is_write = is_write;
+        mrb->prio_flags = prio_flags;
         break;
     }
     case VIRTIO_BLK_T_FLUSH:
@@ -755,23 +786,36 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     return 0;
 }
 
-bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
+static bool virtio_blk_handle_vq_plugged(VirtIOBlock *s, VirtQueue *vq,
+                                         MultiReqBuffer *mrb)
 {
-    VirtIOBlockReq *req;
-    MultiReqBuffer mrb = {};
+    VirtIOBlockReq *reqs[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int i, n;
     bool progress = false;
-
-    aio_context_acquire(blk_get_aio_context(s->blk));
-    blk_io_plug(s->blk);
+    int64_t now;
 
     do {
         virtio_queue_set_notification(vq, 0);
 
-        while ((req = virtio_blk_get_request(s, vq))) {
+        while ((n = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq),
+                                        (void **)reqs, ARRAY_SIZE(reqs)))) {
             progress = true;
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
+            now = block_acct_time_ns();
+            for (i = 0; i < n; i++) {
+                virtio_blk_init_request(s, vq, reqs[i]);
+                reqs[i]->start_ns = now;
+            }
+            for (i = 0; i < n; i++) {
+                if (virtio_blk_handle_request(reqs[i], mrb)) {
+                    break;
+                }
+            }
+            if (i < n) {
+                /* The device is broken, drop the rest of the batch as well */
+                for (; i < n; i++) {
+                    virtqueue_detach_element(vq, &reqs[i]->elem, 0);
+                    virtio_blk_free_request(reqs[i]);
+                }
                 break;
             }
         }
@@ -779,6 +823,37 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
         virtio_queue_set_notification(vq, 1);
     } while (!virtio_queue_empty(vq));
 
+    return progress;
+}
+
+bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    MultiReqBuffer mrb = {};
+    bool progress;
+    unsigned i;
+
+    aio_context_acquire(blk_get_aio_context(s->blk));
+    blk_io_plug(s->blk);
+
+    progress = virtio_blk_handle_vq_plugged(s, vq, &mrb);
+
+    /*
+     * All virtqueues of the device share one AioContext, so pick up whatever
+     * the other queues already have available while we are plugged.  With a
+     * multiqueue guest this turns one host submission per virtqueue into one
+     * per event loop iteration, and lets requests from different queues be
+     * merged.  The notifiers of those queues stay set; their handlers will
+     * simply find the rings empty.
+     */
+    for (i = 0; i < s->conf.num_queues; i++) {
+        VirtQueue *other = virtio_get_queue(vdev, i);
+
+        if (other != vq && !virtio_queue_empty(other)) {
+            progress |= virtio_blk_handle_vq_plugged(s, other, &mrb);
+        }
+    }
+
     if (mrb.num_reqs) {
         virtio_blk_submit_multireq(s->blk, &mrb);
     }
@@ -1047,7 +1122,7 @@ static void virtio_blk_save_device(VirtIODevice *vdev, QEMUFile *f)
             qemu_put_be32(f, virtio_get_queue_index(req->vq));
         }
 
-        qemu_put_virtqueue_element(f, &req->elem);
+        qemu_put_virtqueue_element(vdev, f, &req->elem);
         req = req->next;
     }
     qemu_put_sbyte(f, 0);
@@ -1075,6 +1150,7 @@ static int virtio_blk_load_device(VirtIODevice *vdev, QEMUFile *f,
 
         req = qemu_get_virtqueue_element(vdev, f, sizeof(VirtIOBlockReq));
         virtio_blk_init_request(s, virtio_get_queue(vdev, vq_idx), req);
+        req->start_ns = block_acct_time_ns();
         req->next = s->rq;
         s->rq = req;
     }
@@ -1182,13 +1258,20 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     blk_set_guest_block_size(s->blk, s->conf.conf.logical_block_size);
 
     blk_iostatus_enable(s->blk);
+
+    /* Keep enough coroutines around for half of the queues to be busy */
+    qemu_coroutine_increase_pool_batch_size(conf->num_queues *
+                                            conf->queue_size / 2);
 }
 
 static void virtio_blk_device_unrealize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBlock *s = VIRTIO_BLK(dev);
+    VirtIOBlkConf *conf = &s->conf;
 
+    qemu_coroutine_decrease_pool_batch_size(conf->num_queues *
+                                            conf->queue_size / 2);
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
     qemu_del_vm_change_state_handler(s->change);
@@ -13,10 +13,13 @@
 #include "qemu/osdep.h"
 #include "chardev/char-fe.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "trace.h"
 #include "hw/virtio/virtio-serial.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-char.h"
+#include "qemu/main-loop.h"
+#include "sysemu/iothread.h"
 
 #define TYPE_VIRTIO_CONSOLE_SERIAL_PORT "virtserialport"
 #define VIRTIO_CONSOLE(obj) \
@@ -27,8 +30,47 @@ typedef struct VirtConsole {
 
     CharBackend chr;
     guint watch;
+    IOThread *iothread;
 } VirtConsole;
 
+/*
+ * With iothread=, the chardev handlers run in the IOThread instead of
+ * the main loop, so that a busy main loop does not delay the port's
+ * I/O.  Touching the virtio-serial device still needs the BQL.
+ */
+static GMainContext *virtconsole_context(VirtConsole *vcon)
+{
+    return vcon->iothread ? iothread_get_g_main_context(vcon->iothread) : NULL;
+}
+
+static bool virtconsole_lock(void)
+{
+    if (qemu_mutex_iothread_locked()) {
+        return false;
+    }
+    qemu_mutex_lock_iothread();
+    return true;
+}
+
+static void virtconsole_unlock(bool locked)
+{
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+static void virtconsole_remove_watch(VirtConsole *vcon)
+{
+    GSource *source;
+
+    source = g_main_context_find_source_by_id(virtconsole_context(vcon),
+                                              vcon->watch);
+    if (source) {
+        g_source_destroy(source);
+    }
+    vcon->watch = 0;
+}
+
 /*
  * Callback function that's called from chardevs when backend becomes
  * writable.
@@ -37,17 +79,20 @@ static gboolean chr_write_unblocked(GIOChannel *chan, GIOCondition cond,
                                     void *opaque)
 {
     VirtConsole *vcon = opaque;
+    bool locked = virtconsole_lock();
 
     vcon->watch = 0;
     virtio_serial_throttle_port(VIRTIO_SERIAL_PORT(vcon), false);
+    virtconsole_unlock(locked);
     return FALSE;
 }
 
 /* Callback function that's called when the guest sends us data */
-static ssize_t flush_buf(VirtIOSerialPort *port,
-                         const uint8_t *buf, ssize_t len)
+static ssize_t flush_iov(VirtIOSerialPort *port,
+                         const struct iovec *iov, unsigned int iovcnt)
 {
     VirtConsole *vcon = VIRTIO_CONSOLE(port);
+    ssize_t len = iov_size(iov, iovcnt);
     ssize_t ret;
 
     if (!qemu_chr_fe_backend_connected(&vcon->chr)) {
@@ -55,7 +100,7 @@ static ssize_t flush_buf(VirtIOSerialPort *port,
         return len;
     }
 
-    ret = qemu_chr_fe_write(&vcon->chr, buf, len);
+    ret = qemu_chr_fe_writev(&vcon->chr, iov, iovcnt);
     trace_virtio_console_flush_buf(port->id, len, ret);
 
     if (ret < len) {
@@ -102,6 +147,14 @@ static ssize_t flush_buf(VirtIOSerialPort *port,
     return ret;
 }
 
+static ssize_t flush_buf(VirtIOSerialPort *port,
+                         const uint8_t *buf, ssize_t len)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+    return flush_iov(port, &iov, 1);
+}
+
 /* Callback function that's called when the guest opens/closes the port */
 static void set_guest_connected(VirtIOSerialPort *port, int guest_connected)
 {
@@ -129,8 +182,12 @@ static void guest_writable(VirtIOSerialPort *port)
 static int chr_can_read(void *opaque)
 {
     VirtConsole *vcon = opaque;
+    bool locked = virtconsole_lock();
+    int ret;
 
-    return virtio_serial_guest_ready(VIRTIO_SERIAL_PORT(vcon));
+    ret = virtio_serial_guest_ready(VIRTIO_SERIAL_PORT(vcon));
+    virtconsole_unlock(locked);
+    return ret;
 }
 
 /* Send data from a char device over to the guest */
@@ -138,15 +195,18 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
 {
     VirtConsole *vcon = opaque;
     VirtIOSerialPort *port = VIRTIO_SERIAL_PORT(vcon);
+    bool locked = virtconsole_lock();
 
     trace_virtio_console_chr_read(port->id, size);
     virtio_serial_write(port, buf, size);
+    virtconsole_unlock(locked);
 }
 
 static void chr_event(void *opaque, int event)
 {
     VirtConsole *vcon = opaque;
     VirtIOSerialPort *port = VIRTIO_SERIAL_PORT(vcon);
+    bool locked = virtconsole_lock();
 
     trace_virtio_console_chr_event(port->id, event);
     switch (event) {
@@ -155,12 +215,12 @@ static void chr_event(void *opaque, int event)
         break;
     case CHR_EVENT_CLOSED:
         if (vcon->watch) {
-            g_source_remove(vcon->watch);
-            vcon->watch = 0;
+            virtconsole_remove_watch(vcon);
         }
         virtio_serial_close(port);
         break;
     }
+    virtconsole_unlock(locked);
 }
 
 static int chr_be_change(void *opaque)
@@ -171,14 +231,16 @@ static int chr_be_change(void *opaque)
 
     if (k->is_console) {
         qemu_chr_fe_set_handlers(&vcon->chr, chr_can_read, chr_read,
-                                 NULL, chr_be_change, vcon, NULL, true);
+                                 NULL, chr_be_change, vcon,
+                                 virtconsole_context(vcon), true);
     } else {
         qemu_chr_fe_set_handlers(&vcon->chr, chr_can_read, chr_read,
-                                 chr_event, chr_be_change, vcon, NULL, false);
+                                 chr_event, chr_be_change, vcon,
+                                 virtconsole_context(vcon), false);
     }
 
     if (vcon->watch) {
-        g_source_remove(vcon->watch);
+        virtconsole_remove_watch(vcon);
         vcon->watch = qemu_chr_fe_add_watch(&vcon->chr,
                                             G_IO_OUT | G_IO_HUP,
                                             chr_write_unblocked, vcon);
@@ -200,10 +262,12 @@ static void virtconsole_enable_backend(VirtIOSerialPort *port, bool enable)
 
         qemu_chr_fe_set_handlers(&vcon->chr, chr_can_read, chr_read,
                                  k->is_console ? NULL : chr_event,
-                                 chr_be_change, vcon, NULL, false);
+                                 chr_be_change, vcon,
+                                 virtconsole_context(vcon), false);
     } else {
         qemu_chr_fe_set_handlers(&vcon->chr, NULL, NULL, NULL,
-                                 NULL, NULL, NULL, false);
+                                 NULL, NULL, virtconsole_context(vcon),
+                                 false);
     }
 }
 
@@ -232,12 +296,12 @@ static void virtconsole_realize(DeviceState *dev, Error **errp)
         if (k->is_console) {
             qemu_chr_fe_set_handlers(&vcon->chr, chr_can_read, chr_read,
                                      NULL, chr_be_change,
-                                     vcon, NULL, true);
+                                     vcon, virtconsole_context(vcon), true);
             virtio_serial_open(port);
         } else {
             qemu_chr_fe_set_handlers(&vcon->chr, chr_can_read, chr_read,
                                      chr_event, chr_be_change,
-                                     vcon, NULL, false);
+                                     vcon, virtconsole_context(vcon), false);
         }
     }
 }
@@ -247,7 +311,7 @@ static void virtconsole_unrealize(DeviceState *dev, Error **errp)
     VirtConsole *vcon = VIRTIO_CONSOLE(dev);
 
     if (vcon->watch) {
-        g_source_remove(vcon->watch);
+        virtconsole_remove_watch(vcon);
     }
 }
 
@@ -266,6 +330,8 @@ static const TypeInfo virtconsole_info = {
 
 static Property virtserialport_properties[] = {
     DEFINE_PROP_CHR("chardev", VirtConsole, chr),
+    DEFINE_PROP_LINK("iothread", VirtConsole, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -277,6 +343,7 @@ static void virtserialport_class_init(ObjectClass *klass, void *data)
     k->realize = virtconsole_realize;
     k->unrealize = virtconsole_unrealize;
     k->have_data = flush_buf;
+    k->have_data_iov = flush_iov;
     k->set_guest_connected = set_guest_connected;
     k->enable_backend = virtconsole_enable_backend;
     k->guest_writable = guest_writable;
@@ -28,6 +28,13 @@
 #include "trace.h"
 #include "hw/virtio/virtio-serial.h"
 #include "hw/virtio/virtio-access.h"
+#include "qemu/units.h"
+
+/* Elements of the output queue written to a port at once */
+#define VIRTIO_SERIAL_FLUSH_BATCH 64
+
+/* The most that a port is asked to read for the guest at once */
+#define VIRTIO_SERIAL_MAX_READ (64 * KiB)
 
 static struct VirtIOSerialDevices {
     QLIST_HEAD(, VirtIOSerial) devices;
@@ -154,6 +161,114 @@ static void discard_throttle_data(VirtIOSerialPort *port)
     }
 }
 
+/*
+ * Like do_flush_queued_data(), but hands the data of up to
+ * VIRTIO_SERIAL_FLUSH_BATCH elements to the port in a single call.
+ * port->elem is the first of them, so that a disconnection during the
+ * call still finds it.  The elements after the first one that the port
+ * did not entirely take go back to the ring.
+ */
+static void do_flush_queued_data_iov(VirtIOSerialPort *port, VirtQueue *vq,
+                                     VirtIODevice *vdev)
+{
+    VirtIOSerialPortClass *vsc = VIRTIO_SERIAL_PORT_GET_CLASS(port);
+    VirtQueueElement *elems[VIRTIO_SERIAL_FLUSH_BATCH];
+    struct iovec iov[VIRTQUEUE_MAX_SIZE];
+
+    while (!port->throttled) {
+        VirtQueueElement *elem;
+        unsigned int n, i, j = 0, iovcnt;
+        ssize_t ret;
+
+        if (!port->elem) {
+            port->elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
+            if (!port->elem) {
+                break;
+            }
+            port->iov_idx = 0;
+            port->iov_offset = 0;
+        }
+        elems[0] = port->elem;
+        n = 1;
+        iovcnt = iov_copy(iov, ARRAY_SIZE(iov),
+                          port->elem->out_sg + port->iov_idx,
+                          port->elem->out_num - port->iov_idx,
+                          port->iov_offset, SIZE_MAX);
+
+        while (n < VIRTIO_SERIAL_FLUSH_BATCH) {
+            elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
+            if (!elem) {
+                break;
+            }
+            if (iovcnt + elem->out_num > ARRAY_SIZE(iov)) {
+                virtqueue_unpop(vq, elem, 0);
+                g_free(elem);
+                break;
+            }
+            memcpy(iov + iovcnt, elem->out_sg, elem->out_num * sizeof(*iov));
+            iovcnt += elem->out_num;
+            elems[n++] = elem;
+        }
+
+        ret = vsc->have_data_iov(port, iov, iovcnt);
+        if (!port->elem) { /* bail if we got disconnected */
+            for (i = 1; i < n; i++) {
+                virtqueue_detach_element(vq, elems[i], 0);
+                g_free(elems[i]);
+            }
+            return;
+        }
+        if (ret < 0) {
+            ret = 0;
+        }
+
+        /* Return the elements that were entirely written */
+        for (i = 0; i < n; i++) {
+            elem = elems[i];
+            j = i ? 0 : port->iov_idx;
+            for (; j < elem->out_num; j++) {
+                size_t len = elem->out_sg[j].iov_len - port->iov_offset;
+
+                if (ret < len) {
+                    port->iov_offset += ret;
+                    break;
+                }
+                ret -= len;
+                port->iov_offset = 0;
+            }
+            if (j < elem->out_num) {
+                break;
+            }
+            virtqueue_push(vq, elem, 0);
+            g_free(elem);
+            port->iov_idx = 0;
+            port->iov_offset = 0;
+        }
+
+        port->elem = NULL;
+        if (i == n) {
+            continue;
+        }
+
+        /* The elements after the partly written one are popped again */
+        while (--n > i) {
+            virtqueue_unpop(vq, elems[n], 0);
+            g_free(elems[n]);
+        }
+        if (port->throttled) {
+            port->elem = elems[i];
+            port->iov_idx = j;
+        } else {
+            /* As in do_flush_queued_data(), the rest of it is dropped */
+            virtqueue_push(vq, elems[i], 0);
+            g_free(elems[i]);
+            port->iov_idx = 0;
+            port->iov_offset = 0;
+        }
+    }
+    virtio_notify(vdev, vq);
+}
+
 static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
                                  VirtIODevice *vdev)
 {
@@ -163,6 +278,10 @@ static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
     assert(virtio_queue_ready(vq));
 
     vsc = VIRTIO_SERIAL_PORT_GET_CLASS(port);
+    if (vsc->have_data_iov) {
+        do_flush_queued_data_iov(port, vq, vdev);
+        return;
+    }
 
     while (!port->throttled) {
         unsigned int i;
@@ -315,7 +434,7 @@ size_t virtio_serial_guest_ready(VirtIOSerialPort *port)
     if (use_multiport(port->vser) && !port->guest_connected) {
         return 0;
     }
-    virtqueue_get_avail_bytes(vq, &bytes, NULL, 4096, 0);
+    virtqueue_get_avail_bytes(vq, &bytes, NULL, VIRTIO_SERIAL_MAX_READ, 0);
     return bytes;
 }
 
@@ -704,7 +823,7 @@ static void virtio_serial_save_device(VirtIODevice *vdev, QEMUFile *f)
         if (elem_popped) {
             qemu_put_be32s(f, &port->iov_idx);
             qemu_put_be64s(f, &port->iov_offset);
-            qemu_put_virtqueue_element(f, port->elem);
+            qemu_put_virtqueue_element(vdev, f, port->elem);
         }
     }
 }
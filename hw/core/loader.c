@@ -55,6 +55,7 @@
 #include "exec/address-spaces.h"
 #include "hw/boards.h"
 #include "qemu/cutils.h"
+#include "trace.h"
 
 #include <zlib.h>
 
@@ -830,6 +831,8 @@ struct Rom {
     size_t datasize;
 
     uint8_t *data;
+    /* If not NULL, "data" points into this private mapping of the file */
+    GMappedFile *mapped_file;
     MemoryRegion *mr;
     AddressSpace *as;
     int isrom;
@@ -845,10 +848,21 @@ struct Rom {
 static FWCfgState *fw_cfg;
 static QTAILQ_HEAD(, Rom) roms = QTAILQ_HEAD_INITIALIZER(roms);
 
+static void rom_free_data(Rom *rom)
+{
+    if (rom->mapped_file) {
+        g_mapped_file_unref(rom->mapped_file);
+        rom->mapped_file = NULL;
+    } else {
+        g_free(rom->data);
+    }
+    rom->data = NULL;
+}
+
 /* rom->data must be heap-allocated (do not use with rom_add_elf_program()) */
 static void rom_free(Rom *rom)
 {
-    g_free(rom->data);
+    rom_free_data(rom);
     g_free(rom->path);
     g_free(rom->name);
     g_free(rom->fw_dir);
@@ -922,6 +936,7 @@ int rom_add_file(const char *file, const char *fw_dir,
     Rom *rom;
     int rc, fd = -1;
     char devpath[100];
+    GError *gerr = NULL;
 
     if (as && mr) {
         fprintf(stderr, "Specifying an Address Space and Memory Region is " \
@@ -958,15 +973,36 @@ int rom_add_file(const char *file, const char *fw_dir,
     }
 
     rom->datasize = rom->romsize;
-    rom->data     = g_malloc0(rom->datasize);
-    lseek(fd, 0, SEEK_SET);
-    rc = read(fd, rom->data, rom->datasize);
-    if (rc != rom->datasize) {
-        fprintf(stderr, "rom: file %-20s: read error: rc=%d (expected %zd)\n",
-                rom->name, rc, rom->datasize);
-        goto err;
+
+    /*
+     * Map the file instead of reading it, so that its pages are only faulted
+     * in when the ROM is first copied to the guest or read through fw_cfg.
+     * The mapping is private, writes to the data never reach the file.
+     */
+    rom->mapped_file = g_mapped_file_new(rom->path, TRUE, &gerr);
+    if (rom->mapped_file &&
+        g_mapped_file_get_length(rom->mapped_file) == rom->datasize) {
+        rom->data = (uint8_t *)g_mapped_file_get_contents(rom->mapped_file);
+    } else {
+        if (rom->mapped_file) {
+            g_mapped_file_unref(rom->mapped_file);
+            rom->mapped_file = NULL;
+        }
+        g_clear_error(&gerr);
+
+        /* Not mappable, e.g. a pipe: fall back to reading it */
+        rom->data = g_malloc0(rom->datasize);
+        lseek(fd, 0, SEEK_SET);
+        rc = read(fd, rom->data, rom->datasize);
+        if (rc != rom->datasize) {
+            fprintf(stderr,
+                    "rom: file %-20s: read error: rc=%d (expected %zd)\n",
+                    rom->name, rc, rom->datasize);
+            goto err;
+        }
     }
     close(fd);
+    trace_rom_add_file(rom->name, rom->datasize, rom->mapped_file != NULL);
     rom_insert(rom);
     if (rom->fw_file && fw_cfg) {
         const char *basename;
@@ -1103,8 +1139,7 @@ static void rom_reset(void *unused)
         }
         if (rom->isrom) {
             /* rom needs to be written only once */
-            g_free(rom->data);
-            rom->data = NULL;
+            rom_free_data(rom);
         }
         /*
          * The rom loader is really on the same level as firmware in the guest
@@ -34,9 +34,11 @@
 #include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
 #include "hw/hotplug.h"
 #include "hw/boards.h"
 #include "hw/sysbus.h"
+#include "trace.h"
 
 bool qdev_hotplug = false;
 static bool qdev_hot_added = false;
@@ -831,7 +833,12 @@ static void device_set_realized(Object *obj, bool value, Error **errp)
         }
 
         if (dc->realize) {
+            int64_t start = get_clock();
+
             dc->realize(dev, &local_err);
+            /* Includes the children that the device realizes itself */
+            trace_qdev_realize(object_get_typename(obj), dev->id ?: "",
+                               get_clock() - start);
         }
 
         if (local_err != NULL) {
@@ -466,6 +466,40 @@ static void qxl_ring_set_dirty(PCIQXLDevice *qxl)
  * keep track of some command state, for savevm/loadvm.
  * called from spice server thread context only
  */
+#define QXL_CMD_STATS_PERIOD_MS 1000
+
+/* Count commands by type and report the rates once per period */
+static void qxl_count_command(PCIQXLDevice *qxl, struct QXLCommandExt *ext)
+{
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+
+    switch (le32_to_cpu(ext->cmd.type)) {
+    case QXL_CMD_DRAW:
+        qxl->cmd_stats.draw++;
+        break;
+    case QXL_CMD_SURFACE:
+        qxl->cmd_stats.surface++;
+        break;
+    case QXL_CMD_CURSOR:
+        qxl->cmd_stats.cursor++;
+        break;
+    default:
+        qxl->cmd_stats.other++;
+        break;
+    }
+
+    if (!qxl->cmd_stats.start) {
+        qxl->cmd_stats.start = now;
+    } else if (now - qxl->cmd_stats.start >= QXL_CMD_STATS_PERIOD_MS) {
+        trace_qxl_command_rate(qxl->id, qxl->cmd_stats.draw,
+                               qxl->cmd_stats.surface, qxl->cmd_stats.cursor,
+                               qxl->cmd_stats.other,
+                               now - qxl->cmd_stats.start);
+        memset(&qxl->cmd_stats, 0, sizeof(qxl->cmd_stats));
+        qxl->cmd_stats.start = now;
+    }
+}
+
 static int qxl_track_command(PCIQXLDevice *qxl, struct QXLCommandExt *ext)
 {
     switch (le32_to_cpu(ext->cmd.type)) {
@@ -675,6 +709,7 @@ static int interface_get_command(QXLInstance *sin, struct QXLCommandExt *ext)
         }
         qxl->guest_primary.commands++;
         qxl_track_command(qxl, ext);
+        qxl_count_command(qxl, ext);
         qxl_log_command(qxl, "cmd", ext);
         {
             /*
@@ -848,6 +883,7 @@ static int interface_get_cursor_command(QXLInstance *sin, struct QXLCommandExt *
         }
         qxl->guest_primary.commands++;
         qxl_track_command(qxl, ext);
+        qxl_count_command(qxl, ext);
         qxl_log_command(qxl, "csr", ext);
         if (qxl->have_vga) {
             qxl_render_cursor(qxl, ext);
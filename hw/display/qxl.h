@@ -87,6 +87,15 @@ typedef struct PCIQXLDevice {
     /* thread signaling */
     QEMUBH             *update_irq;
 
+    /* command rates, only touched by the spice server thread */
+    struct {
+        int64_t        start;
+        uint32_t       draw;
+        uint32_t       surface;
+        uint32_t       cursor;
+        uint32_t       other;
+    } cmd_stats;
+
     /* ram pci bar */
     QXLRam             *ram;
     VGACommonState     vga;
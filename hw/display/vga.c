@@ -1445,14 +1445,76 @@ static bool vga_scanline_invalidated(VGACommonState *s, int y)
     return s->invalidated_y_table[y >> 5] & (1 << (y & 0x1f));
 }
 
+/* Dirty logging is only kept on while somebody looks at the display */
+static void vga_dirty_log_update(VGACommonState *s)
+{
+    bool log = s->dirty_log_count > 0 && !s->display_idle;
+
+    if (s->dirty_log != log) {
+        s->dirty_log = log;
+        memory_region_set_log(&s->vram, log, DIRTY_MEMORY_VGA);
+    }
+}
+
 void vga_dirty_log_start(VGACommonState *s)
 {
-    memory_region_set_log(&s->vram, true, DIRTY_MEMORY_VGA);
+    s->dirty_log_count++;
+    vga_dirty_log_update(s);
 }
 
 void vga_dirty_log_stop(VGACommonState *s)
 {
-    memory_region_set_log(&s->vram, false, DIRTY_MEMORY_VGA);
+    s->dirty_log_count--;
+    vga_dirty_log_update(s);
+}
+
+/*
+ * Fetching the dirty log costs a KVM ioctl per refresh even when the guest
+ * does not touch the framebuffer at all.  After VGA_DIRTY_IDLE_SYNCS syncs
+ * in a row found nothing, only sync on every other refresh, then every
+ * fourth and so on up to VGA_DIRTY_SKIP_MAX.  Nothing gets lost since the
+ * kernel keeps collecting dirty pages in between, the first write just
+ * shows up a little later.  Any change goes back to syncing every time.
+ */
+#define VGA_DIRTY_IDLE_SYNCS  16
+#define VGA_DIRTY_SKIP_MAX    8
+
+static bool vga_dirty_sync_skip(VGACommonState *s)
+{
+    int i;
+
+    if (s->dirty_skipped >= s->dirty_skip) {
+        s->dirty_skipped = 0;
+        return false;
+    }
+    /* the hardware cursor moved, that has to be drawn right away */
+    for (i = 0; i < ARRAY_SIZE(s->invalidated_y_table); i++) {
+        if (s->invalidated_y_table[i]) {
+            return false;
+        }
+    }
+    s->dirty_skipped++;
+    s->dirty_syncs_skipped++;
+    return true;
+}
+
+static void vga_dirty_sync_done(VGACommonState *s, bool changed)
+{
+    unsigned int skip = s->dirty_skip;
+
+    if (changed) {
+        s->dirty_clean = 0;
+        s->dirty_skip = 0;
+        s->dirty_skipped = 0;
+    } else if (++s->dirty_clean >= VGA_DIRTY_IDLE_SYNCS &&
+               s->dirty_skip < VGA_DIRTY_SKIP_MAX) {
+        s->dirty_clean = 0;
+        s->dirty_skip = s->dirty_skip ? s->dirty_skip * 2 : 1;
+    }
+    if (s->dirty_skip != skip) {
+        trace_vga_dirty_backoff(s->dirty_skip, s->dirty_syncs,
+                                s->dirty_syncs_skipped);
+    }
 }
 
 /*
@@ -1469,7 +1531,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
     uint8_t *d;
     uint32_t v, addr1, addr;
     vga_draw_line_func *vga_draw_line = NULL;
-    bool share_surface, force_shadow = false;
+    bool share_surface, force_shadow = false, changed = false;
     pixman_format_code_t format;
 #ifdef HOST_WORDS_BIGENDIAN
     bool byteswap = !s->big_endian_fb;
@@ -1478,6 +1540,8 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
 #endif
 
     full_update |= update_basic_params(s);
+    /* without dirty logging there is no telling what changed */
+    full_update |= s->display_idle;
 
     s->get_resolution(s, &width, &height);
     disp_width = width;
@@ -1634,6 +1698,10 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
     }
     vga_draw_line = vga_draw_line_table[v];
 
+    if (!full_update && vga_dirty_sync_skip(s)) {
+        return;
+    }
+
     if (!is_buffer_shared(surface) && s->cursor_invalidate) {
         s->cursor_invalidate(s);
     }
@@ -1658,6 +1726,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         snap = memory_region_snapshot_and_clear_dirty(&s->vram, region_start,
                                                       region_end - region_start,
                                                       DIRTY_MEMORY_VGA);
+        s->dirty_syncs++;
     }
 
     for(y = 0; y < height; y++) {
@@ -1689,6 +1758,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         }
         /* explicit invalidation for the hardware cursor (cirrus only) */
         update |= vga_scanline_invalidated(s, y);
+        changed |= update;
         if (update) {
             if (y_start < 0)
                 y_start = y;
@@ -1726,6 +1796,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
     }
     g_free(snap);
     memset(s->invalidated_y_table, 0, sizeof(s->invalidated_y_table));
+    vga_dirty_sync_done(s, changed);
 }
 
 static void vga_draw_blank(VGACommonState *s, int full_update)
@@ -1798,6 +1869,18 @@ static void vga_invalidate_display(void *opaque)
     s->last_height = -1;
 }
 
+static void vga_display_idle(void *opaque, bool idle)
+{
+    VGACommonState *s = opaque;
+
+    s->display_idle = idle;
+    vga_dirty_log_update(s);
+    if (!idle) {
+        /* writes done while idle were not logged */
+        vga_invalidate_display(s);
+    }
+}
+
 void vga_common_reset(VGACommonState *s)
 {
     s->sr_index = 0;
@@ -2149,6 +2232,7 @@ const VMStateDescription vmstate_vga_common = {
 static const GraphicHwOps vga_ops = {
     .invalidate  = vga_invalidate_display,
     .gfx_update  = vga_update_display,
+    .display_idle = vga_display_idle,
     .text_update = vga_update_text,
 };
 
@@ -124,6 +124,15 @@ typedef struct VGACommonState {
     uint32_t last_depth; /* in bits */
     bool last_byteswap;
     bool force_shadow;
+    int dirty_log_count;    /* vga_dirty_log_start() minus _stop() calls */
+    bool dirty_log;         /* vram dirty logging is actually enabled */
+    bool display_idle;      /* no display wants updates, see GraphicHwOps */
+    /* dirty log sync backoff while the framebuffer does not change */
+    unsigned int dirty_clean;   /* syncs in a row that found nothing */
+    unsigned int dirty_skip;    /* refreshes to skip between two syncs */
+    unsigned int dirty_skipped; /* refreshes skipped since the last sync */
+    uint64_t dirty_syncs;
+    uint64_t dirty_syncs_skipped;
     uint8_t cursor_start, cursor_end;
     bool cursor_visible_phase;
     int64_t cursor_blink_time;
@@ -544,6 +544,11 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
         return;
     }
 
+    if (res->zero_copy) {
+        /* The image already is the guest backing, nothing to copy */
+        return;
+    }
+
     format = pixman_image_get_format(res->image);
     bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
     stride = pixman_image_get_stride(res->image);
@@ -638,14 +643,51 @@ static void virtio_unref_resource(pixman_image_t *image, void *data)
     pixman_image_unref(data);
 }
 
+/*
+ * Point the display surface of @scanout_id at rectangle @r of @res,
+ * creating a new surface unless the current one already shows it.
+ */
+static bool
+virtio_gpu_update_scanout_surface(VirtIOGPU *g,
+                                  uint32_t scanout_id,
+                                  struct virtio_gpu_simple_resource *res,
+                                  struct virtio_gpu_rect *r)
+{
+    struct virtio_gpu_scanout *scanout = &g->scanout[scanout_id];
+    pixman_format_code_t format;
+    uint32_t offset;
+    int bpp;
+
+    format = pixman_image_get_format(res->image);
+    bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
+    offset = (r->x * bpp) + r->y * pixman_image_get_stride(res->image);
+    if (!scanout->ds || surface_data(scanout->ds)
+        != ((uint8_t *)pixman_image_get_data(res->image) + offset) ||
+        scanout->width != r->width ||
+        scanout->height != r->height) {
+        pixman_image_t *rect;
+        void *ptr = (uint8_t *)pixman_image_get_data(res->image) + offset;
+        rect = pixman_image_create_bits(format, r->width, r->height, ptr,
+                                        pixman_image_get_stride(res->image));
+        pixman_image_ref(res->image);
+        pixman_image_set_destroy_function(rect, virtio_unref_resource,
+                                          res->image);
+        /* realloc the surface ptr */
+        scanout->ds = qemu_create_displaysurface_pixman(rect);
+        if (!scanout->ds) {
+            return false;
+        }
+        pixman_image_unref(rect);
+        dpy_gfx_replace_surface(scanout->con, scanout->ds);
+    }
+    return true;
+}
+
 static void virtio_gpu_set_scanout(VirtIOGPU *g,
                                    struct virtio_gpu_ctrl_command *cmd)
 {
     struct virtio_gpu_simple_resource *res, *ores;
     struct virtio_gpu_scanout *scanout;
-    pixman_format_code_t format;
-    uint32_t offset;
-    int bpp;
     struct virtio_gpu_set_scanout ss;
 
     VIRTIO_GPU_FILL_CMD(ss);
@@ -691,28 +733,9 @@ static void virtio_gpu_set_scanout(VirtIOGPU *g,
 
     scanout = &g->scanout[ss.scanout_id];
 
-    format = pixman_image_get_format(res->image);
-    bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
-    offset = (ss.r.x * bpp) + ss.r.y * pixman_image_get_stride(res->image);
-    if (!scanout->ds || surface_data(scanout->ds)
-        != ((uint8_t *)pixman_image_get_data(res->image) + offset) ||
-        scanout->width != ss.r.width ||
-        scanout->height != ss.r.height) {
-        pixman_image_t *rect;
-        void *ptr = (uint8_t *)pixman_image_get_data(res->image) + offset;
-        rect = pixman_image_create_bits(format, ss.r.width, ss.r.height, ptr,
-                                        pixman_image_get_stride(res->image));
-        pixman_image_ref(res->image);
-        pixman_image_set_destroy_function(rect, virtio_unref_resource,
-                                          res->image);
-        /* realloc the surface ptr */
-        scanout->ds = qemu_create_displaysurface_pixman(rect);
-        if (!scanout->ds) {
-            cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
-            return;
-        }
-        pixman_image_unref(rect);
-        dpy_gfx_replace_surface(g->scanout[ss.scanout_id].con, scanout->ds);
+    if (!virtio_gpu_update_scanout_surface(g, ss.scanout_id, res, &ss.r)) {
+        cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
+        return;
     }
 
     ores = virtio_gpu_find_resource(g, scanout->resource_id);
@@ -812,6 +835,121 @@ static void virtio_gpu_cleanup_mapping(VirtIOGPU *g,
     res->addrs = NULL;
 }
 
+/* Let the scanouts showing @res pick up its new image */
+static void virtio_gpu_refresh_scanouts(VirtIOGPU *g,
+                                        struct virtio_gpu_simple_resource *res)
+{
+    struct virtio_gpu_scanout *scanout;
+    struct virtio_gpu_rect r;
+    int i;
+
+    for (i = 0; i < g->conf.max_outputs; i++) {
+        if (!(res->scanout_bitmask & (1 << i))) {
+            continue;
+        }
+        scanout = &g->scanout[i];
+        r.x = scanout->x;
+        r.y = scanout->y;
+        r.width = scanout->width;
+        r.height = scanout->height;
+        if (!virtio_gpu_update_scanout_surface(g, i, res, &r)) {
+            virtio_gpu_disable_scanout(g, i);
+            continue;
+        }
+        dpy_gfx_update(scanout->con, 0, 0, r.width, r.height);
+    }
+}
+
+/*
+ * If the backing of @res is one contiguous piece of guest RAM laid out like
+ * the host image, display it in place instead of copying it over on every
+ * transfer.  The host copy is freed; hostmem accounting is left alone so
+ * that going back to it on detach cannot fail.
+ */
+static void
+virtio_gpu_resource_map_backing(VirtIOGPU *g,
+                                struct virtio_gpu_simple_resource *res)
+{
+    pixman_format_code_t format = pixman_image_get_format(res->image);
+    uint32_t stride = pixman_image_get_stride(res->image);
+    size_t size = (size_t)stride * res->height;
+    pixman_image_t *image;
+    MemoryRegion *mr;
+    ram_addr_t offset;
+    uint8_t *base, *end;
+    unsigned int i;
+
+    if (!virtio_gpu_zero_copy_enabled(g->conf) || res->zero_copy ||
+        !res->iov_cnt) {
+        return;
+    }
+
+    base = end = res->iov[0].iov_base;
+    for (i = 0; i < res->iov_cnt && end < base + size; i++) {
+        if (res->iov[i].iov_base != end) {
+            return;
+        }
+        end += res->iov[i].iov_len;
+    }
+    if (end < base + size) {
+        return;
+    }
+
+    /* Bounce buffers are snapshots, only guest RAM can be shown in place */
+    mr = memory_region_from_host(base, &offset);
+    if (!mr || offset + size > memory_region_size(mr)) {
+        return;
+    }
+
+    image = pixman_image_create_bits(format, res->width, res->height,
+                                     (uint32_t *)base, stride);
+    if (!image) {
+        return;
+    }
+
+    pixman_image_unref(res->image);
+    res->image = image;
+    res->zero_copy = true;
+    trace_virtio_gpu_res_zero_copy(res->resource_id, true);
+    virtio_gpu_refresh_scanouts(g, res);
+}
+
+/*
+ * Go back to a host copy of the contents of @res before its guest backing
+ * goes away.
+ */
+static void
+virtio_gpu_resource_unmap_backing(VirtIOGPU *g,
+                                  struct virtio_gpu_simple_resource *res)
+{
+    pixman_image_t *image;
+    int i;
+
+    if (!res->zero_copy) {
+        return;
+    }
+
+    image = pixman_image_create_bits(pixman_image_get_format(res->image),
+                                     res->width, res->height, NULL, 0);
+    if (image) {
+        memcpy(pixman_image_get_data(image), pixman_image_get_data(res->image),
+               pixman_image_get_stride(image) * res->height);
+        pixman_image_unref(res->image);
+        res->image = image;
+        res->zero_copy = false;
+        trace_virtio_gpu_res_zero_copy(res->resource_id, false);
+        virtio_gpu_refresh_scanouts(g, res);
+        return;
+    }
+
+    /* Nothing must keep pointing at the guest memory */
+    for (i = 0; i < g->conf.max_outputs; i++) {
+        if (res->scanout_bitmask & (1 << i)) {
+            virtio_gpu_disable_scanout(g, i);
+        }
+    }
+}
+
 static void
 virtio_gpu_resource_attach_backing(VirtIOGPU *g,
                                    struct virtio_gpu_ctrl_command *cmd)
@@ -844,6 +982,7 @@ virtio_gpu_resource_attach_backing(VirtIOGPU *g,
     }
 
     res->iov_cnt = ab.nr_entries;
+    virtio_gpu_resource_map_backing(g, res);
 }
 
 static void
@@ -864,6 +1003,7 @@ virtio_gpu_resource_detach_backing(VirtIOGPU *g,
         cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
         return;
     }
+    virtio_gpu_resource_unmap_backing(g, res);
     virtio_gpu_cleanup_mapping(g, res);
 }
 
@@ -1236,6 +1376,7 @@ static int virtio_gpu_load(QEMUFile *f, void *opaque, size_t size,
 
         QTAILQ_INSERT_HEAD(&g->reslist, res, next);
         g->hostmem += res->hostmem;
+        virtio_gpu_resource_map_backing(g, res);
 
         resource_id = qemu_get_be32(f);
     }
@@ -1436,6 +1577,8 @@ static Property virtio_gpu_properties[] = {
 #endif
     DEFINE_PROP_BIT("edid", VirtIOGPU, conf.flags,
                     VIRTIO_GPU_FLAG_EDID_ENABLED, false),
+    DEFINE_PROP_BIT("zero-copy", VirtIOGPU, conf.flags,
+                    VIRTIO_GPU_FLAG_ZERO_COPY_ENABLED, false),
     DEFINE_PROP_UINT32("xres", VirtIOGPU, conf.xres, 1024),
     DEFINE_PROP_UINT32("yres", VirtIOGPU, conf.yres, 768),
     DEFINE_PROP_END_OF_LIST(),
@@ -188,14 +188,6 @@ static guint vtd_uint64_hash(gconstpointer v)
     return (guint)*(const uint64_t *)v;
 }
 
-static gboolean vtd_hash_remove_by_domain(gpointer key, gpointer value,
-                                          gpointer user_data)
-{
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    uint16_t domain_id = *(uint16_t *)user_data;
-    return entry->domain_id == domain_id;
-}
-
 /* The shift of an addr for a certain level of paging structure */
 static inline uint32_t vtd_slpt_level_shift(uint32_t level)
 {
@@ -208,16 +200,12 @@ static inline uint64_t vtd_slpt_level_page_mask(uint32_t level)
     return ~((1ULL << vtd_slpt_level_shift(level)) - 1);
 }
 
-static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
-                                        gpointer user_data)
+static bool vtd_iotlb_entry_in_range(VTDIOTLBEntry *entry,
+                                     VTDIOTLBPageInvInfo *info)
 {
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)user_data;
     uint64_t gfn = (info->addr >> VTD_PAGE_SHIFT_4K) & info->mask;
     uint64_t gfn_tlb = (info->addr & entry->mask) >> VTD_PAGE_SHIFT_4K;
-    return (entry->domain_id == info->domain_id) &&
-            (((entry->gfn & info->mask) == gfn) ||
-             (entry->gfn == gfn_tlb));
+    return ((entry->gfn & info->mask) == gfn) || (entry->gfn == gfn_tlb);
 }
 
 /* Reset all the gen of VTDAddressSpace to zero and set the gen of
@@ -246,11 +234,33 @@ static void vtd_reset_context_cache_locked(IntelIOMMUState *s)
     s->context_cache_gen = 1;
 }
 
+/* Must be called with IOMMU lock held. */
+static void vtd_iotlb_remove_entry(IntelIOMMUState *s, VTDIOTLBEntry *entry)
+{
+    VTDIOTLBDomain *domain = entry->domain;
+
+    g_hash_table_remove(s->iotlb, &entry->key);
+    QTAILQ_REMOVE(&s->iotlb_lru, entry, lru_link);
+    QLIST_REMOVE(entry, domain_link);
+    if (QLIST_EMPTY(&domain->entries)) {
+        g_hash_table_remove(s->iotlb_domains,
+                            GUINT_TO_POINTER(domain->domain_id));
+    }
+    g_free(entry);
+}
+
 /* Must be called with IOMMU lock held. */
 static void vtd_reset_iotlb_locked(IntelIOMMUState *s)
 {
+    VTDIOTLBEntry *entry, *next;
+
     assert(s->iotlb);
+    QTAILQ_FOREACH_SAFE(entry, &s->iotlb_lru, lru_link, next) {
+        g_free(entry);
+    }
+    QTAILQ_INIT(&s->iotlb_lru);
     g_hash_table_remove_all(s->iotlb);
+    g_hash_table_remove_all(s->iotlb_domains);
 }
 
 static void vtd_reset_iotlb(IntelIOMMUState *s)
@@ -293,6 +303,8 @@ static VTDIOTLBEntry *vtd_lookup_iotlb(IntelIOMMUState *s, uint16_t source_id,
                                 source_id, level);
         entry = g_hash_table_lookup(s->iotlb, &key);
         if (entry) {
+            QTAILQ_REMOVE(&s->iotlb_lru, entry, lru_link);
+            QTAILQ_INSERT_TAIL(&s->iotlb_lru, entry, lru_link);
             goto out;
         }
     }
@@ -306,23 +318,62 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
                              uint16_t domain_id, hwaddr addr, uint64_t slpte,
                              uint8_t access_flags, uint32_t level)
 {
-    VTDIOTLBEntry *entry = g_malloc(sizeof(*entry));
-    uint64_t *key = g_malloc(sizeof(*key));
+    VTDIOTLBEntry *entry;
+    VTDIOTLBDomain *domain;
     uint64_t gfn = vtd_get_iotlb_gfn(addr, level);
+    uint64_t key = vtd_get_iotlb_key(gfn, source_id, level);
 
     trace_vtd_iotlb_page_update(source_id, addr, slpte, domain_id);
-    if (g_hash_table_size(s->iotlb) >= VTD_IOTLB_MAX_SIZE) {
-        trace_vtd_iotlb_reset("iotlb exceeds size limit");
-        vtd_reset_iotlb_locked(s);
-    }
-
+    entry = g_hash_table_lookup(s->iotlb, &key);
+    if (entry) {
+        vtd_iotlb_remove_entry(s, entry);
+    } else if (g_hash_table_size(s->iotlb) >= s->iotlb_size) {
+        entry = QTAILQ_FIRST(&s->iotlb_lru);
+        trace_vtd_iotlb_evict(entry->key, entry->domain_id);
+        vtd_iotlb_remove_entry(s, entry);
+    }
+
+    domain = g_hash_table_lookup(s->iotlb_domains,
+                                 GUINT_TO_POINTER(domain_id));
+    if (!domain) {
+        domain = g_new0(VTDIOTLBDomain, 1);
+        domain->domain_id = domain_id;
+        QLIST_INIT(&domain->entries);
+        g_hash_table_insert(s->iotlb_domains, GUINT_TO_POINTER(domain_id),
+                            domain);
+    }
+
+    entry = g_new(VTDIOTLBEntry, 1);
+    entry->key = key;
     entry->gfn = gfn;
     entry->domain_id = domain_id;
     entry->slpte = slpte;
     entry->access_flags = access_flags;
     entry->mask = vtd_slpt_level_page_mask(level);
-    *key = vtd_get_iotlb_key(gfn, source_id, level);
-    g_hash_table_replace(s->iotlb, key, entry);
+    entry->domain = domain;
+    QLIST_INSERT_HEAD(&domain->entries, entry, domain_link);
+    QTAILQ_INSERT_TAIL(&s->iotlb_lru, entry, lru_link);
+    g_hash_table_insert(s->iotlb, &entry->key, entry);
+}
+
+/* Must be called with IOMMU lock held */
+static void vtd_iotlb_remove_domain(IntelIOMMUState *s, uint16_t domain_id,
+                                    VTDIOTLBPageInvInfo *info)
+{
+    VTDIOTLBDomain *domain;
+    VTDIOTLBEntry *entry, *next;
+
+    domain = g_hash_table_lookup(s->iotlb_domains,
+                                 GUINT_TO_POINTER(domain_id));
+    if (!domain) {
+        return;
+    }
+    /* The domain is freed with its last entry */
+    QLIST_FOREACH_SAFE(entry, &domain->entries, domain_link, next) {
+        if (!info || vtd_iotlb_entry_in_range(entry, info)) {
+            vtd_iotlb_remove_entry(s, entry);
+        }
+    }
 }
 
 /* Given the reg addr of both the message data and address, generate an
@@ -638,6 +689,32 @@ static uint64_t vtd_get_slpte(dma_addr_t base_addr, uint32_t index)
     return slpte;
 }
 
+/*
+ * Read the entries @first to @last of the page table at @base_addr into
+ * the same indexes of @slptes, with one access if the table can be read
+ * as a whole; entries that cannot be read are (uint64_t)-1 as with
+ * vtd_get_slpte().
+ */
+static void vtd_get_slptes(dma_addr_t base_addr, uint32_t first,
+                           uint32_t last, uint64_t *slptes)
+{
+    uint32_t i;
+
+    assert(first <= last && last < VTD_SL_PT_ENTRY_NR);
+
+    if (dma_memory_read(&address_space_memory,
+                        base_addr + first * sizeof(*slptes), &slptes[first],
+                        (last - first + 1) * sizeof(*slptes))) {
+        for (i = first; i <= last; i++) {
+            slptes[i] = vtd_get_slpte(base_addr, i);
+        }
+        return;
+    }
+    for (i = first; i <= last; i++) {
+        slptes[i] = le64_to_cpu(slptes[i]);
+    }
+}
+
 /* Given an iova and the level of paging structure, return the offset
  * of current level.
  */
@@ -1116,8 +1193,9 @@ static int vtd_page_walk_level(dma_addr_t addr, uint64_t start,
                                bool write, vtd_page_walk_info *info)
 {
     bool read_cur, write_cur, entry_valid;
-    uint32_t offset;
+    uint32_t offset, first, last;
     uint64_t slpte;
+    uint64_t slptes[VTD_SL_PT_ENTRY_NR];
     uint64_t subpage_size, subpage_mask;
     IOMMUTLBEntry entry;
     uint64_t iova = start;
@@ -1129,11 +1207,26 @@ static int vtd_page_walk_level(dma_addr_t addr, uint64_t start,
     subpage_size = 1ULL << vtd_slpt_level_shift(level);
     subpage_mask = vtd_slpt_level_page_mask(level);
 
+    /*
+     * Fetch all the entries the walk visits at once, instead of with one
+     * DMA read each: syncing a shadow page table reads many of them.
+     */
+    first = vtd_iova_level_offset(start, level);
+    last = vtd_iova_level_offset(end - 1, level);
+    if (((end - 1 - start) >> vtd_slpt_level_shift(level)) >=
+        VTD_SL_PT_ENTRY_NR || last < first) {
+        first = 0;
+        last = VTD_SL_PT_ENTRY_NR - 1;
+    }
+    if (start < end) {
+        vtd_get_slptes(addr, first, last, slptes);
+    }
+
     while (iova < end) {
         iova_next = (iova & subpage_mask) + subpage_size;
 
         offset = vtd_iova_level_offset(iova, level);
-        slpte = vtd_get_slpte(addr, offset);
+        slpte = slptes[offset];
 
         if (slpte == (uint64_t)-1) {
             trace_vtd_page_walk_skip_read(iova, iova_next);
@@ -1882,8 +1975,7 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
     trace_vtd_inv_desc_iotlb_domain(domain_id);
 
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_domain,
-                                &domain_id);
+    vtd_iotlb_remove_domain(s, domain_id, NULL);
     vtd_iommu_unlock(s);
 
     QLIST_FOREACH(vtd_as, &s->vtd_as_with_notifiers, next) {
@@ -1944,9 +2036,9 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
     assert(am <= VTD_MAMV);
     info.domain_id = domain_id;
     info.addr = addr;
-    info.mask = ~((1 << am) - 1);
+    info.mask = ~((1ULL << am) - 1);
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
+    vtd_iotlb_remove_domain(s, domain_id, &info);
     vtd_iommu_unlock(s);
     vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am);
 }
@@ -3014,6 +3106,8 @@ static Property vtd_properties[] = {
     DEFINE_PROP_BOOL("caching-mode", IntelIOMMUState, caching_mode, FALSE),
     DEFINE_PROP_BOOL("x-scalable-mode", IntelIOMMUState, scalable_mode, FALSE),
     DEFINE_PROP_BOOL("dma-drain", IntelIOMMUState, dma_drain, true),
+    DEFINE_PROP_UINT32("x-iotlb-size", IntelIOMMUState, iotlb_size,
+                       VTD_IOTLB_MAX_SIZE),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3648,6 +3742,11 @@ static bool vtd_decide_config(IntelIOMMUState *s, Error **errp)
         return false;
     }
 
+    if (!s->iotlb_size) {
+        error_setg(errp, "x-iotlb-size must be at least 1");
+        return false;
+    }
+
     if (s->intr_eim == ON_OFF_AUTO_AUTO) {
         s->intr_eim = (kvm_irqchip_in_kernel() || s->buggy_eim)
                       && x86_iommu_ir_supported(x86_iommu) ?
@@ -3717,8 +3816,9 @@ static void vtd_realize(DeviceState *dev, Error **errp)
 
     sysbus_init_mmio(SYS_BUS_DEVICE(s), &s->csrmem);
     /* No corresponding destroy */
-    s->iotlb = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
-                                     g_free, g_free);
+    s->iotlb = g_hash_table_new(vtd_uint64_hash, vtd_uint64_equal);
+    s->iotlb_domains = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    QTAILQ_INIT(&s->iotlb_lru);
     s->vtd_as_by_busptr = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
                                               g_free, g_free);
     vtd_init(s);
@@ -584,12 +584,21 @@ static void check_cmd(AHCIState *s, int port)
     uint8_t slot;
 
     if ((pr->cmd & PORT_CMD_START) && pr->cmd_issue) {
+        BlockBackend *blk = s->dev[port].port.ifs[0].blk;
+
+        /* Submit the NCQ commands issued together in one go */
+        if (blk) {
+            blk_io_plug(blk);
+        }
         for (slot = 0; (slot < 32) && pr->cmd_issue; slot++) {
             if ((pr->cmd_issue & (1U << slot)) &&
                 !handle_cmd(s, port, slot)) {
                 pr->cmd_issue &= ~(1U << slot);
             }
         }
+        if (blk) {
+            blk_io_unplug(blk);
+        }
     }
 }
 
@@ -654,6 +663,8 @@ static void ahci_reset_port(AHCIState *s, int port)
     pr->sig = 0xFFFFFFFF;
     d->busy_slot = -1;
     d->init_d2h_sent = false;
+    qemu_bh_cancel(d->sdb_bh);
+    d->finished = 0;
 
     ide_state = &s->dev[port].port.ifs[0];
     if (!ide_state->blk) {
@@ -765,9 +776,8 @@ static void ahci_unmap_clb_address(AHCIDevice *ad)
     ad->lst = NULL;
 }
 
-static void ahci_write_fis_sdb(AHCIState *s, NCQTransferState *ncq_tfs)
+static void ahci_write_fis_sdb(AHCIState *s, AHCIDevice *ad)
 {
-    AHCIDevice *ad = ncq_tfs->drive;
     AHCIPortRegs *pr = &ad->port_regs;
     IDEState *ide_state;
     SDBFIS *sdb_fis;
@@ -801,6 +811,17 @@ static void ahci_write_fis_sdb(AHCIState *s, NCQTransferState *ncq_tfs)
     }
 }
 
+/*
+ * NCQ commands that complete in the same iteration of the main loop
+ * are reported with a single SDB FIS, and so a single interrupt.
+ */
+static void ahci_sdb_bh(void *opaque)
+{
+    AHCIDevice *ad = opaque;
+
+    ahci_write_fis_sdb(ad->hba, ad);
+}
+
 static void ahci_write_fis_pio(AHCIDevice *ad, uint16_t len, bool pio_fis_i)
 {
     AHCIPortRegs *pr = &ad->port_regs;
@@ -1003,10 +1024,13 @@ static void ncq_finish(NCQTransferState *ncq_tfs)
      * clear the outstanding bit in scr_act (PxSACT). */
     if (!(ncq_tfs->drive->port_regs.scr_err & (1 << ncq_tfs->tag))) {
         ncq_tfs->drive->finished |= (1 << ncq_tfs->tag);
+        qemu_bh_schedule(ncq_tfs->drive->sdb_bh);
+    } else {
+        /* Report errors right away, together with what finished before */
+        qemu_bh_cancel(ncq_tfs->drive->sdb_bh);
+        ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs->drive);
     }
 
-    ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs);
-
     trace_ncq_finish(ncq_tfs->drive->hba, ncq_tfs->drive->port_no,
                      ncq_tfs->tag);
 
@@ -1550,6 +1574,7 @@ void ahci_realize(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
 
         ad->hba = s;
         ad->port_no = i;
+        ad->sdb_bh = qemu_bh_new(ahci_sdb_bh, ad);
         ad->port.dma = &ad->dma;
         ad->port.dma->ops = &ahci_dma_ops;
         ide_register_restart_cb(&ad->port);
@@ -1569,6 +1594,7 @@ void ahci_uninit(AHCIState *s)
 
             ide_exit(s);
         }
+        qemu_bh_delete(ad->sdb_bh);
         object_unparent(OBJECT(&ad->port));
     }
 
@@ -1679,6 +1705,11 @@ static int ahci_state_post_load(void *opaque, int version_id)
             return -1;
         }
 
+        /* The SDB FIS for these was not posted yet */
+        if (ad->finished) {
+            qemu_bh_schedule(ad->sdb_bh);
+        }
+
         for (j = 0; j < AHCI_MAX_CMDS; j++) {
             ncq_tfs = &ad->ncq_tfs[j];
             ncq_tfs->drive = ad;
@@ -313,6 +313,7 @@ struct AHCIDevice {
     AHCIPortRegs port_regs;
     struct AHCIState *hba;
     QEMUBH *check_bh;
+    QEMUBH *sdb_bh;     /* One SDB FIS for the NCQ commands finished since */
     uint8_t *lst;
     uint8_t *res_fis;
     bool done_first_drq;
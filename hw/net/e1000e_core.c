@@ -51,6 +51,7 @@
 #define E1000E_MIN_XITR     (500) /* No more then 7813 interrupts per
                                      second according to spec 10.2.4.2 */
 #define E1000E_MAX_TX_FRAGS (64)
+#define E1000E_TX_DESC_BATCH (32) /* descriptors fetched per DMA read */
 
 static inline void
 e1000e_set_interrupt_cause(E1000ECore *core, uint32_t val);
@@ -581,7 +582,7 @@ e1000e_rss_calc_hash(E1000ECore *core,
         type = NetPktRssIpV4Tcp;
         break;
     case E1000_MRQ_RSS_TYPE_IPV6TCP:
-        type = NetPktRssIpV6Tcp;
+        type = NetPktRssIpV6TcpEx;
         break;
     case E1000_MRQ_RSS_TYPE_IPV6:
         type = NetPktRssIpV6;
@@ -835,6 +836,26 @@ e1000e_ring_advance(E1000ECore *core, const E1000E_RingInfo *r, uint32_t count)
     }
 }
 
+/*
+ * Number of descriptors, at most @max, that follow the head up to the tail
+ * or the end of the ring, and so can be fetched with a single DMA read.
+ */
+static inline uint32_t
+e1000e_ring_contig_descr_num(E1000ECore *core, const E1000E_RingInfo *r,
+                             uint32_t max)
+{
+    uint32_t dh = core->mac[r->dh];
+    uint32_t dt = core->mac[r->dt];
+    uint32_t end = dh < dt ? dt : core->mac[r->dlen] / E1000_RING_DESC_LEN;
+
+    if (end <= dh) {
+        /* Head beyond the ring: fetch one descriptor, advancing wraps it */
+        return 1;
+    }
+
+    return MIN(end - dh, max);
+}
+
 static inline uint32_t
 e1000e_ring_free_descr_num(E1000ECore *core, const E1000E_RingInfo *r)
 {
@@ -912,10 +933,11 @@ static void
 e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 {
     dma_addr_t base;
-    struct e1000_tx_desc desc;
+    struct e1000_tx_desc descs[E1000E_TX_DESC_BATCH];
     bool ide = false;
     const E1000E_RingInfo *txi = txr->i;
     uint32_t cause = E1000_ICS_TXQE;
+    uint32_t i, num;
 
     if (!(core->mac[TCTL] & E1000_TCTL_EN)) {
         trace_e1000e_tx_disabled();
@@ -923,17 +945,27 @@ e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
     }
 
     while (!e1000e_ring_empty(core, txi)) {
+        /*
+         * Descriptors between head and tail belong to the device, so fetch
+         * as many of them as one DMA read can get instead of one by one.
+         */
+        num = e1000e_ring_contig_descr_num(core, txi, ARRAY_SIZE(descs));
         base = e1000e_ring_head_descr(core, txi);
 
-        pci_dma_read(core->owner, base, &desc, sizeof(desc));
+        pci_dma_read(core->owner, base, descs, num * sizeof(descs[0]));
+
+        for (i = 0; i < num; i++) {
+            struct e1000_tx_desc *desc = &descs[i];
 
-        trace_e1000e_tx_descr((void *)(intptr_t)desc.buffer_addr,
-                              desc.lower.data, desc.upper.data);
+            trace_e1000e_tx_descr((void *)(intptr_t)desc->buffer_addr,
+                                  desc->lower.data, desc->upper.data);
 
-        e1000e_process_tx_desc(core, txr->tx, &desc, txi->idx);
-        cause |= e1000e_txdesc_writeback(core, base, &desc, &ide, txi->idx);
+            e1000e_process_tx_desc(core, txr->tx, desc, txi->idx);
+            cause |= e1000e_txdesc_writeback(core, base + i * sizeof(*desc),
+                                             desc, &ide, txi->idx);
 
-        e1000e_ring_advance(core, txi, 1);
+            e1000e_ring_advance(core, txi, 1);
+        }
     }
 
     if (!ide || !e1000e_intrmgr_delay_tx_causes(core, &cause)) {
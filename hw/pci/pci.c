@@ -70,6 +70,8 @@ static Property pci_props[] = {
                     QEMU_PCIE_LNKSTA_DLLLA_BITNR, true),
     DEFINE_PROP_BIT("x-pcie-extcap-init", PCIDevice, cap_present,
                     QEMU_PCIE_EXTCAP_INIT_BITNR, true),
+    DEFINE_PROP_SIZE("x-max-bounce-buffer-size", PCIDevice,
+                     max_bounce_buffer_size, DEFAULT_MAX_BOUNCE_BUFFER_SIZE),
     DEFINE_PROP_END_OF_LIST()
 };
 
@@ -1075,6 +1077,13 @@ static PCIDevice *do_pci_register_device(PCIDevice *pci_dev,
        return NULL;
     }
 
+    if (pci_dev->max_bounce_buffer_size == 0 ||
+        pci_dev->max_bounce_buffer_size > SIZE_MAX) {
+        error_setg(errp, "PCI: x-max-bounce-buffer-size of %s must be "
+                   "between 1 and %zu", name, (size_t)SIZE_MAX);
+        return NULL;
+    }
+
     pci_dev->devfn = devfn;
     pci_dev->requester_id_cache = pci_req_id_cache_get(pci_dev);
     pstrcpy(pci_dev->name, sizeof(pci_dev->name), name);
@@ -1083,6 +1092,8 @@ static PCIDevice *do_pci_register_device(PCIDevice *pci_dev,
                        "bus master container", UINT64_MAX);
     address_space_init(&pci_dev->bus_master_as,
                        &pci_dev->bus_master_container_region, pci_dev->name);
+    pci_dev->bus_master_as.max_bounce_buffer_size =
+        pci_dev->max_bounce_buffer_size;
 
     if (qdev_hotplug) {
         pci_init_bus_master(pci_dev);
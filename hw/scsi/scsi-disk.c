@@ -40,6 +40,7 @@
 
 #define SCSI_WRITE_SAME_MAX         (512 * KiB)
 #define SCSI_DMA_BUF_SIZE           (128 * KiB)
+#define SCSI_DMA_BUF_MAX            (1 * MiB)
 #define SCSI_MAX_INQUIRY_LEN        256
 #define SCSI_MAX_MODE_LEN           256
 
@@ -77,6 +78,11 @@ typedef struct SCSIDiskReq {
     unsigned char *status;
 } SCSIDiskReq;
 
+/* Requests queued for merging at most, until the next flush */
+#define SCSI_DISK_MERGE_MAX               32
+
+struct SCSIDiskMergeReq;
+
 #define SCSI_DISK_F_REMOVABLE             0
 #define SCSI_DISK_F_DPOFUA                1
 #define SCSI_DISK_F_NO_REMOVABLE_DEVOPS   2
@@ -107,6 +113,10 @@ typedef struct SCSIDiskState
      * 0xffff        - reserved
      */
     uint16_t rotation_rate;
+    bool request_merging;
+    bool merge_bh_scheduled;
+    int merge_num;
+    struct SCSIDiskMergeReq *merge_reqs[SCSI_DISK_MERGE_MAX];
 } SCSIDiskState;
 
 static bool scsi_handle_rw_error(SCSIDiskReq *r, int error, bool acct_failed);
@@ -139,6 +149,17 @@ static void scsi_init_iovec(SCSIDiskReq *r, size_t size)
     qemu_iovec_init_external(&r->qiov, &r->iov, 1);
 }
 
+/*
+ * Size of the bounce buffer for HBAs that give us no scatter/gather list:
+ * the whole transfer if it is not too large, so that it is not split.
+ */
+static size_t scsi_dma_buf_size(SCSIDiskReq *r)
+{
+    uint64_t size = (uint64_t)r->sector_count * BDRV_SECTOR_SIZE;
+
+    return MAX(MIN(size, SCSI_DMA_BUF_MAX), SCSI_DMA_BUF_SIZE);
+}
+
 static void scsi_disk_save_request(QEMUFile *f, SCSIRequest *req)
 {
     SCSIDiskReq *r = DO_UPCAST(SCSIDiskReq, req, req);
@@ -356,7 +377,7 @@ static void scsi_do_read(SCSIDiskReq *r, int ret)
                                   sdc->dma_readv, r, scsi_dma_complete, r,
                                   DMA_DIRECTION_FROM_DEVICE);
     } else {
-        scsi_init_iovec(r, SCSI_DMA_BUF_SIZE);
+        scsi_init_iovec(r, scsi_dma_buf_size(r));
         block_acct_start(blk_get_stats(s->qdev.conf.blk), &r->acct,
                          r->qiov.size, BLOCK_ACCT_READ);
         r->req.aiocb = sdc->dma_readv(r->sector << BDRV_SECTOR_BITS, &r->qiov,
@@ -505,7 +526,7 @@ static void scsi_write_complete_noio(SCSIDiskReq *r, int ret)
         scsi_write_do_fua(r);
         return;
     } else {
-        scsi_init_iovec(r, SCSI_DMA_BUF_SIZE);
+        scsi_init_iovec(r, scsi_dma_buf_size(r));
         trace_scsi_disk_write_complete_noio(r->req.tag, r->qiov.size);
         scsi_req_data(&r->req, r->qiov.size);
     }
@@ -2888,6 +2909,175 @@ static int scsi_block_parse_cdb(SCSIDevice *d, SCSICommand *cmd,
 
 #endif
 
+/*
+ * Reads and writes submitted in the same iteration of the event loop,
+ * typically a batch of commands from the HBA, are sorted and sequential
+ * ones are merged into a single request, like virtio-blk does.
+ */
+typedef struct SCSIDiskMergeReq {
+    BlockAIOCB common;
+    SCSIDiskState *s;
+    int64_t offset;
+    QEMUIOVector *qiov;
+    bool is_write;
+    QEMUIOVector merged;            /* Set up in the first of a group only */
+    struct SCSIDiskMergeReq *next;  /* The rest of the group */
+} SCSIDiskMergeReq;
+
+static AioContext *scsi_disk_merge_get_aio_context(BlockAIOCB *acb)
+{
+    SCSIDiskMergeReq *m = container_of(acb, SCSIDiskMergeReq, common);
+
+    return blk_get_aio_context(m->s->qdev.conf.blk);
+}
+
+static const AIOCBInfo scsi_disk_merge_aiocb_info = {
+    .aiocb_size         = sizeof(SCSIDiskMergeReq),
+    .get_aio_context    = scsi_disk_merge_get_aio_context,
+};
+
+static void scsi_disk_merge_complete(void *opaque, int ret)
+{
+    SCSIDiskMergeReq *m = opaque;
+    SCSIDiskMergeReq *next;
+
+    if (m->next) {
+        qemu_iovec_destroy(&m->merged);
+    }
+    for (; m; m = next) {
+        next = m->next;
+        m->common.cb(m->common.opaque, ret);
+        qemu_aio_unref(m);
+    }
+}
+
+static void scsi_disk_merge_submit(SCSIDiskState *s, SCSIDiskMergeReq **reqs,
+                                   int num_reqs, int niov)
+{
+    BlockBackend *blk = s->qdev.conf.blk;
+    SCSIDiskMergeReq *m = reqs[0];
+    QEMUIOVector *qiov = m->qiov;
+    int i;
+
+    if (num_reqs > 1) {
+        qemu_iovec_init(&m->merged, niov);
+        for (i = 0; i < num_reqs; i++) {
+            qemu_iovec_concat(&m->merged, reqs[i]->qiov, 0,
+                              reqs[i]->qiov->size);
+            if (i > 0) {
+                reqs[i - 1]->next = reqs[i];
+            }
+        }
+        qiov = &m->merged;
+        trace_scsi_disk_merge(num_reqs, m->offset, qiov->size, m->is_write);
+        block_acct_merge_done(blk_get_stats(blk),
+                              m->is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ,
+                              num_reqs - 1);
+    }
+
+    if (m->is_write) {
+        blk_aio_pwritev(blk, m->offset, qiov, 0, scsi_disk_merge_complete, m);
+    } else {
+        blk_aio_preadv(blk, m->offset, qiov, 0, scsi_disk_merge_complete, m);
+    }
+}
+
+static int scsi_disk_merge_compare(const void *a, const void *b)
+{
+    const SCSIDiskMergeReq *m1 = *(SCSIDiskMergeReq **)a;
+    const SCSIDiskMergeReq *m2 = *(SCSIDiskMergeReq **)b;
+
+    if (m1->is_write != m2->is_write) {
+        return m1->is_write ? 1 : -1;
+    }
+    if (m1->offset > m2->offset) {
+        return 1;
+    } else if (m1->offset < m2->offset) {
+        return -1;
+    } else {
+        return 0;
+    }
+}
+
+static void scsi_disk_merge_flush(SCSIDiskState *s)
+{
+    SCSIDiskMergeReq *reqs[SCSI_DISK_MERGE_MAX];
+    uint64_t max_transfer = blk_get_max_transfer(s->qdev.conf.blk);
+    int max_iov = blk_get_max_iov(s->qdev.conf.blk);
+    int num_reqs = s->merge_num;
+    int i, start = 0, niov = 0;
+    uint64_t size = 0;
+
+    if (!num_reqs) {
+        return;
+    }
+    memcpy(reqs, s->merge_reqs, num_reqs * sizeof(reqs[0]));
+    s->merge_num = 0;
+
+    qsort(reqs, num_reqs, sizeof(reqs[0]), &scsi_disk_merge_compare);
+    for (i = 0; i < num_reqs; i++) {
+        SCSIDiskMergeReq *m = reqs[i];
+
+        if (i > start) {
+            SCSIDiskMergeReq *prev = reqs[i - 1];
+
+            if (m->is_write != prev->is_write ||
+                m->offset != prev->offset + prev->qiov->size ||
+                size + m->qiov->size > max_transfer ||
+                niov + m->qiov->niov > max_iov) {
+                scsi_disk_merge_submit(s, &reqs[start], i - start, niov);
+                start = i;
+                size = 0;
+                niov = 0;
+            }
+        }
+        size += m->qiov->size;
+        niov += m->qiov->niov;
+    }
+    scsi_disk_merge_submit(s, &reqs[start], num_reqs - start, niov);
+}
+
+static void scsi_disk_merge_bh(void *opaque)
+{
+    SCSIDiskState *s = opaque;
+    AioContext *ctx = blk_get_aio_context(s->qdev.conf.blk);
+
+    aio_context_acquire(ctx);
+    s->merge_bh_scheduled = false;
+    scsi_disk_merge_flush(s);
+    aio_context_release(ctx);
+    blk_dec_in_flight(s->qdev.conf.blk);
+}
+
+static BlockAIOCB *scsi_disk_merge_rw(SCSIDiskState *s, int64_t offset,
+                                      QEMUIOVector *iov, bool is_write,
+                                      BlockCompletionFunc *cb, void *cb_opaque)
+{
+    BlockBackend *blk = s->qdev.conf.blk;
+    SCSIDiskMergeReq *m;
+
+    m = blk_aio_get(&scsi_disk_merge_aiocb_info, blk, cb, cb_opaque);
+    m->s = s;
+    m->offset = offset;
+    m->qiov = iov;
+    m->is_write = is_write;
+    m->next = NULL;
+
+    if (s->merge_num == SCSI_DISK_MERGE_MAX) {
+        scsi_disk_merge_flush(s);
+    }
+    s->merge_reqs[s->merge_num++] = m;
+
+    /* Drains must wait for the requests that are still queued here */
+    if (!s->merge_bh_scheduled) {
+        s->merge_bh_scheduled = true;
+        blk_inc_in_flight(blk);
+        aio_bh_schedule_oneshot(blk_get_aio_context(blk),
+                                scsi_disk_merge_bh, s);
+    }
+    return &m->common;
+}
+
 static
 BlockAIOCB *scsi_dma_readv(int64_t offset, QEMUIOVector *iov,
                            BlockCompletionFunc *cb, void *cb_opaque,
@@ -2895,6 +3085,10 @@ BlockAIOCB *scsi_dma_readv(int64_t offset, QEMUIOVector *iov,
 {
     SCSIDiskReq *r = opaque;
     SCSIDiskState *s = DO_UPCAST(SCSIDiskState, qdev, r->req.dev);
+
+    if (s->request_merging) {
+        return scsi_disk_merge_rw(s, offset, iov, false, cb, cb_opaque);
+    }
     return blk_aio_preadv(s->qdev.conf.blk, offset, iov, 0, cb, cb_opaque);
 }
 
@@ -2905,6 +3099,10 @@ BlockAIOCB *scsi_dma_writev(int64_t offset, QEMUIOVector *iov,
 {
     SCSIDiskReq *r = opaque;
     SCSIDiskState *s = DO_UPCAST(SCSIDiskState, qdev, r->req.dev);
+
+    if (s->request_merging) {
+        return scsi_disk_merge_rw(s, offset, iov, true, cb, cb_opaque);
+    }
     return blk_aio_pwritev(s->qdev.conf.blk, offset, iov, 0, cb, cb_opaque);
 }
 
@@ -2936,7 +3134,9 @@ static const TypeInfo scsi_disk_base_info = {
     DEFINE_PROP_STRING("serial", SCSIDiskState, serial),             \
     DEFINE_PROP_STRING("vendor", SCSIDiskState, vendor),             \
     DEFINE_PROP_STRING("product", SCSIDiskState, product),           \
-    DEFINE_PROP_STRING("device_id", SCSIDiskState, device_id)
+    DEFINE_PROP_STRING("device_id", SCSIDiskState, device_id),       \
+    DEFINE_PROP_BOOL("request-merging", SCSIDiskState,               \
+                     request_merging, true)
 
 
 static Property scsi_hd_properties[] = {
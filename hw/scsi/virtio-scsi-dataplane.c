@@ -21,6 +21,53 @@
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
 
+/* Context: BH in the AioContext of the virtqueue */
+static void virtio_scsi_queue_bh(void *opaque)
+{
+    VirtIOSCSIQueue *q = opaque;
+    AioContext *ctx = virtio_scsi_vq_ctx(q->dev, q->vq);
+
+    aio_context_acquire(ctx);
+    virtio_scsi_complete_deferred(q);
+    aio_context_release(ctx);
+}
+
+/*
+ * The control and event virtqueues stay in s->ctx; command virtqueue i
+ * goes to cmd-iothreads[i % num_cmd_iothreads] if that is set.
+ */
+static void virtio_scsi_queues_init(VirtIOSCSI *s, AioContext **cmd_ctxs)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    uint32_t n = vs->conf.num_cmd_iothreads;
+    int i, j;
+
+    s->ctxs = g_new(AioContext *, n + 1);
+    s->ctxs[0] = s->ctx;
+    s->nb_ctxs = 1;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < s->nb_ctxs && s->ctxs[j] != cmd_ctxs[i]; j++) {
+            /* nothing */
+        }
+        if (j == s->nb_ctxs) {
+            s->ctxs[s->nb_ctxs++] = cmd_ctxs[i];
+        }
+    }
+
+    s->queues = g_new0(VirtIOSCSIQueue, vs->conf.num_queues + 2);
+    for (i = 0; i < vs->conf.num_queues + 2; i++) {
+        VirtIOSCSIQueue *q = &s->queues[i];
+
+        q->dev = s;
+        q->vq = virtio_get_queue(vdev, i);
+        q->ctx = i < 2 || !n ? s->ctx : cmd_ctxs[(i - 2) % n];
+        q->bh = aio_bh_new(q->ctx, virtio_scsi_queue_bh, q);
+        qemu_mutex_init(&q->lock);
+        QSIMPLEQ_INIT(&q->done);
+    }
+}
+
 /* Context: QEMU global mutex held */
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
 {
@@ -28,25 +75,69 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    AioContext **cmd_ctxs;
+    int i;
+
+    if (vs->conf.num_cmd_iothreads && !virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread");
+        return;
+    }
+    cmd_ctxs = g_new(AioContext *, vs->conf.num_cmd_iothreads);
+    for (i = 0; i < vs->conf.num_cmd_iothreads; i++) {
+        IOThread *iothread = iothread_by_id(vs->conf.cmd_iothreads[i]);
+
+        if (!iothread) {
+            error_setg(errp, "iothread '%s' not found",
+                       vs->conf.cmd_iothreads[i]);
+            g_free(cmd_ctxs);
+            return;
+        }
+        cmd_ctxs[i] = iothread_get_aio_context(iothread);
+    }
 
     if (vs->conf.iothread) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
                        "(transport does not support notifiers)");
+            g_free(cmd_ctxs);
             return;
         }
         if (!virtio_device_ioeventfd_enabled(vdev)) {
             error_setg(errp, "ioeventfd is required for iothread");
+            g_free(cmd_ctxs);
             return;
         }
         s->ctx = iothread_get_aio_context(vs->conf.iothread);
     } else {
         if (!virtio_device_ioeventfd_enabled(vdev)) {
+            g_free(cmd_ctxs);
             return;
         }
         s->ctx = qemu_get_aio_context();
     }
+    virtio_scsi_queues_init(s, cmd_ctxs);
+    g_free(cmd_ctxs);
+}
+
+/* Context: QEMU global mutex held */
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    int i;
+
+    if (!s->queues) {
+        return;
+    }
+    for (i = 0; i < vs->conf.num_queues + 2; i++) {
+        qemu_bh_delete(s->queues[i].bh);
+        qemu_mutex_destroy(&s->queues[i].lock);
+    }
+    g_free(s->queues);
+    g_free(s->ctxs);
+    s->queues = NULL;
+    s->ctxs = NULL;
+    s->nb_ctxs = 0;
 }
 
 static bool virtio_scsi_data_plane_handle_cmd(VirtIODevice *vdev,
@@ -54,11 +145,12 @@ static bool virtio_scsi_data_plane_handle_cmd(VirtIODevice *vdev,
 {
     bool progress;
     VirtIOSCSI *s = VIRTIO_SCSI(vdev);
+    AioContext *ctx = virtio_scsi_vq_ctx(s, vq);
 
-    virtio_scsi_acquire(s);
+    aio_context_acquire(ctx);
     assert(s->ctx && s->dataplane_started);
     progress = virtio_scsi_handle_cmd_vq(s, vq);
-    virtio_scsi_release(s);
+    aio_context_release(ctx);
     return progress;
 }
 
@@ -103,21 +195,54 @@ static int virtio_scsi_vring_init(VirtIOSCSI *s, VirtQueue *vq, int n,
         return rc;
     }
 
-    virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, fn);
+    virtio_queue_aio_set_host_notifier_handler(vq, s->queues[n].ctx, fn);
     return 0;
 }
 
-/* Context: BH in IOThread */
+/* Context: BH in IOThread, once for each of s->ctxs */
 static void virtio_scsi_dataplane_stop_bh(void *opaque)
 {
     VirtIOSCSI *s = opaque;
     VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    AioContext *ctx = qemu_get_current_aio_context();
     int i;
 
-    virtio_queue_aio_set_host_notifier_handler(vs->ctrl_vq, s->ctx, NULL);
-    virtio_queue_aio_set_host_notifier_handler(vs->event_vq, s->ctx, NULL);
-    for (i = 0; i < vs->conf.num_queues; i++) {
-        virtio_queue_aio_set_host_notifier_handler(vs->cmd_vqs[i], s->ctx, NULL);
+    for (i = 0; i < vs->conf.num_queues + 2; i++) {
+        VirtIOSCSIQueue *q = &s->queues[i];
+
+        if (q->ctx == ctx) {
+            virtio_queue_aio_set_host_notifier_handler(q->vq, ctx, NULL);
+        }
+    }
+}
+
+static void virtio_scsi_dataplane_acquire_all(VirtIOSCSI *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_ctxs; i++) {
+        aio_context_acquire(s->ctxs[i]);
+    }
+}
+
+static void virtio_scsi_dataplane_release_all(VirtIOSCSI *s)
+{
+    int i;
+
+    for (i = s->nb_ctxs - 1; i >= 0; i--) {
+        aio_context_release(s->ctxs[i]);
+    }
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_scsi_dataplane_detach(VirtIOSCSI *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_ctxs; i++) {
+        aio_context_acquire(s->ctxs[i]);
+        aio_wait_bh_oneshot(s->ctxs[i], virtio_scsi_dataplane_stop_bh, s);
+        aio_context_release(s->ctxs[i]);
     }
 }
 
@@ -147,7 +272,8 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
         goto fail_guest_notifiers;
     }
 
-    aio_context_acquire(s->ctx);
+    /* The handlers must not run before dataplane_started is set */
+    virtio_scsi_dataplane_acquire_all(s);
     rc = virtio_scsi_vring_init(s, vs->ctrl_vq, 0,
                                 virtio_scsi_data_plane_handle_ctrl);
     if (rc) {
@@ -168,12 +294,12 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
 
     s->dataplane_starting = false;
     s->dataplane_started = true;
-    aio_context_release(s->ctx);
+    virtio_scsi_dataplane_release_all(s);
     return 0;
 
 fail_vrings:
-    aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
-    aio_context_release(s->ctx);
+    virtio_scsi_dataplane_release_all(s);
+    virtio_scsi_dataplane_detach(s);
     for (i = 0; i < vs->conf.num_queues + 2; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
         virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
@@ -207,12 +333,19 @@ void virtio_scsi_dataplane_stop(VirtIODevice *vdev)
     }
     s->dataplane_stopping = true;
 
-    aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
-    aio_context_release(s->ctx);
+    virtio_scsi_dataplane_detach(s);
 
     blk_drain_all(); /* ensure there are no in-flight requests */
 
+    /* Requests completed in a LUN's AioContext may still wait for a BH */
+    for (i = 0; i < vs->conf.num_queues + 2; i++) {
+        VirtIOSCSIQueue *q = &s->queues[i];
+
+        aio_context_acquire(q->ctx);
+        virtio_scsi_complete_deferred(q);
+        aio_context_release(q->ctx);
+    }
+
     for (i = 0; i < vs->conf.num_queues + 2; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
         virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
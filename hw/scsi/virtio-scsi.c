@@ -58,30 +58,86 @@ void virtio_scsi_free_req(VirtIOSCSIReq *req)
 {
     qemu_iovec_destroy(&req->resp_iov);
     qemu_sglist_destroy(&req->qsgl);
-    g_free(req);
+    virtqueue_recycle_element(req->vq, req);
 }
 
-static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
+static void virtio_scsi_notify(VirtIOSCSI *s, VirtQueue *vq)
 {
-    VirtIOSCSI *s = req->dev;
-    VirtQueue *vq = req->vq;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
 
-    qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
-    virtqueue_push(vq, &req->elem, req->qsgl.size + req->resp_iov.size);
     if (s->dataplane_started && !s->dataplane_fenced) {
         virtio_notify_irqfd(vdev, vq);
     } else {
         virtio_notify(vdev, vq);
     }
+}
+
+static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
+{
+    VirtIOSCSI *s = req->dev;
+    VirtQueue *vq = req->vq;
 
+    qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
     if (req->sreq) {
         req->sreq->hba_private = NULL;
         scsi_req_unref(req->sreq);
+        req->sreq = NULL;
+    }
+
+    if (req->remote) {
+        /* We hold the LUN's AioContext, the virtqueue is not ours */
+        VirtIOSCSIQueue *q = &s->queues[virtio_get_queue_index(vq)];
+
+        qemu_mutex_lock(&q->lock);
+        QSIMPLEQ_INSERT_TAIL(&q->done, req, done_next);
+        qemu_mutex_unlock(&q->lock);
+        qemu_bh_schedule(q->bh);
+        return;
     }
+
+    virtqueue_push(vq, &req->elem, req->qsgl.size + req->resp_iov.size);
+    virtio_scsi_notify(s, vq);
     virtio_scsi_free_req(req);
 }
 
+/* Context: the AioContext of q->vq held */
+void virtio_scsi_complete_deferred(VirtIOSCSIQueue *q)
+{
+    QSIMPLEQ_HEAD(, VirtIOSCSIReq) reqs = QSIMPLEQ_HEAD_INITIALIZER(reqs);
+    VirtIOSCSIReq *req, *next;
+
+    qemu_mutex_lock(&q->lock);
+    QSIMPLEQ_CONCAT(&reqs, &q->done);
+    qemu_mutex_unlock(&q->lock);
+
+    if (QSIMPLEQ_EMPTY(&reqs)) {
+        return;
+    }
+    QSIMPLEQ_FOREACH_SAFE(req, &reqs, done_next, next) {
+        virtqueue_push(q->vq, &req->elem,
+                       req->qsgl.size + req->resp_iov.size);
+        virtio_scsi_free_req(req);
+    }
+    virtio_scsi_notify(q->dev, q->vq);
+}
+
+/*
+ * The AioContext of @d if it is not the one of @vq, in which case requests
+ * for @d must be submitted and completed with that AioContext held.
+ */
+static AioContext *virtio_scsi_remote_ctx(VirtIOSCSI *s, VirtQueue *vq,
+                                          SCSIDevice *d)
+{
+    AioContext *vq_ctx = virtio_scsi_vq_ctx(s, vq);
+    AioContext *ctx;
+
+    if (!vq_ctx || !blk_is_available(d->conf.blk)) {
+        return NULL;
+    }
+    ctx = blk_get_aio_context(d->conf.blk);
+    return ctx == vq_ctx ? NULL : ctx;
+}
+
 static void virtio_scsi_bad_req(VirtIOSCSIReq *req)
 {
     virtio_error(VIRTIO_DEVICE(req->dev), "wrong size for virtio-scsi headers");
@@ -191,7 +247,7 @@ static void virtio_scsi_save_request(QEMUFile *f, SCSIRequest *sreq)
 
     assert(n < vs->conf.num_queues);
     qemu_put_be32s(f, &n);
-    qemu_put_virtqueue_element(f, &req->elem);
+    qemu_put_virtqueue_element(VIRTIO_DEVICE(vs), f, &req->elem);
 }
 
 static void *virtio_scsi_load_request(QEMUFile *f, SCSIRequest *sreq)
@@ -217,6 +273,7 @@ static void *virtio_scsi_load_request(QEMUFile *f, SCSIRequest *sreq)
 
     scsi_req_ref(sreq);
     req->sreq = sreq;
+    req->remote = virtio_scsi_remote_ctx(s, req->vq, sreq->dev) != NULL;
     if (req->sreq->cmd.mode != SCSI_XFER_NONE) {
         assert(req->sreq->cmd.mode == req->mode);
     }
@@ -240,35 +297,46 @@ static void virtio_scsi_cancel_notify(Notifier *notifier, void *data)
     g_free(n);
 }
 
+static bool virtio_scsi_has_ctx(VirtIOSCSI *s, AioContext *ctx)
+{
+    int i;
+
+    for (i = 0; i < s->nb_ctxs; i++) {
+        if (s->ctxs[i] == ctx) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static inline void virtio_scsi_ctx_check(VirtIOSCSI *s, SCSIDevice *d)
 {
     if (s->dataplane_started && d && blk_is_available(d->conf.blk)) {
-        assert(blk_get_aio_context(d->conf.blk) == s->ctx);
+        assert(virtio_scsi_has_ctx(s, blk_get_aio_context(d->conf.blk)));
     }
 }
 
-/* Return 0 if the request is ready to be completed and return to guest;
- * -EINPROGRESS if the request is submitted and will be completed later, in the
- *  case of async cancellation. */
-static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
+static void virtio_scsi_reset_lun(VirtIOSCSI *s, SCSIDevice *d)
+{
+    AioContext *ctx = virtio_scsi_remote_ctx(s, s->parent_obj.ctrl_vq, d);
+
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
+    qdev_reset_all(&d->qdev);
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
+static int virtio_scsi_do_tmf_lun(VirtIOSCSI *s, VirtIOSCSIReq *req,
+                                  SCSIDevice *d)
 {
-    SCSIDevice *d = virtio_scsi_device_find(s, req->req.tmf.lun);
     SCSIRequest *r, *next;
     BusChild *kid;
     int target;
     int ret = 0;
 
-    virtio_scsi_ctx_check(s, d);
-    /* Here VIRTIO_SCSI_S_OK means "FUNCTION COMPLETE".  */
-    req->resp.tmf.response = VIRTIO_SCSI_S_OK;
-
-    /*
-     * req->req.tmf has the QEMU_PACKED attribute. Don't use virtio_tswap32s()
-     * to avoid compiler errors.
-     */
-    req->req.tmf.subtype =
-        virtio_tswap32(VIRTIO_DEVICE(s), req->req.tmf.subtype);
-
     switch (req->req.tmf.subtype) {
     case VIRTIO_SCSI_T_TMF_ABORT_TASK:
     case VIRTIO_SCSI_T_TMF_QUERY_TASK:
@@ -366,7 +434,7 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
         QTAILQ_FOREACH(kid, &s->bus.qbus.children, sibling) {
              d = SCSI_DEVICE(kid->child);
              if (d->channel == 0 && d->id == target) {
-                qdev_reset_all(&d->qdev);
+                virtio_scsi_reset_lun(s, d);
              }
         }
         s->resetting--;
@@ -389,6 +457,49 @@ fail:
     return ret;
 }
 
+/* Return 0 if the request is ready to be completed and return to guest;
+ * -EINPROGRESS if the request is submitted and will be completed later, in the
+ *  case of async cancellation. */
+static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
+{
+    SCSIDevice *d = virtio_scsi_device_find(s, req->req.tmf.lun);
+    AioContext *ctx = NULL;
+    int ret;
+
+    virtio_scsi_ctx_check(s, d);
+    /* Here VIRTIO_SCSI_S_OK means "FUNCTION COMPLETE".  */
+    req->resp.tmf.response = VIRTIO_SCSI_S_OK;
+
+    /*
+     * req->req.tmf has the QEMU_PACKED attribute. Don't use virtio_tswap32s()
+     * to avoid compiler errors.
+     */
+    req->req.tmf.subtype =
+        virtio_tswap32(VIRTIO_DEVICE(s), req->req.tmf.subtype);
+
+    /*
+     * A LUN in another AioContext is only touched with that AioContext
+     * held, and cancelled requests call back from there.  I_T nexus reset
+     * takes each LUN's AioContext in turn instead.
+     */
+    if (d && req->req.tmf.subtype != VIRTIO_SCSI_T_TMF_I_T_NEXUS_RESET) {
+        ctx = virtio_scsi_remote_ctx(s, req->vq, d);
+    }
+    if (ctx) {
+        req->remote = true;
+        aio_context_acquire(ctx);
+    }
+    ret = virtio_scsi_do_tmf_lun(s, req, d);
+    if (ctx) {
+        aio_context_release(ctx);
+        if (ret == 0) {
+            /* Nothing can complete it behind our back, do it right away */
+            req->remote = false;
+        }
+    }
+    return ret;
+}
+
 static void virtio_scsi_handle_ctrl_req(VirtIOSCSI *s, VirtIOSCSIReq *req)
 {
     VirtIODevice *vdev = (VirtIODevice *)s;
@@ -538,10 +649,61 @@ static void virtio_scsi_fail_cmd_req(VirtIOSCSIReq *req)
     virtio_scsi_complete_cmd_req(req);
 }
 
+static int virtio_scsi_handle_cmd_req_new(VirtIOSCSI *s, VirtIOSCSIReq *req,
+                                          SCSIDevice *d)
+{
+    req->sreq = scsi_req_new(d, req->req.cmd.tag,
+                             virtio_scsi_get_lun(req->req.cmd.lun),
+                             req->req.cmd.cdb, req);
+
+    if (req->sreq->cmd.mode != SCSI_XFER_NONE
+        && (req->sreq->cmd.mode != req->mode ||
+            req->sreq->cmd.xfer > req->qsgl.size)) {
+        req->resp.cmd.response = VIRTIO_SCSI_S_OVERRUN;
+        virtio_scsi_complete_cmd_req(req);
+        return -ENOBUFS;
+    }
+    scsi_req_ref(req->sreq);
+    blk_io_plug(d->conf.blk);
+    return 0;
+}
+
+static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
+{
+    SCSIRequest *sreq = req->sreq;
+    if (scsi_req_enqueue(sreq)) {
+        scsi_req_continue(sreq);
+    }
+    blk_io_unplug(sreq->dev->conf.blk);
+    scsi_req_unref(sreq);
+}
+
+/*
+ * Submit a request for a LUN in another AioContext than the virtqueue.
+ * The virtqueue's AioContext is dropped first, so that two threads
+ * submitting to each other's LUNs cannot deadlock.
+ */
+static void virtio_scsi_handle_cmd_req_remote(VirtIOSCSI *s,
+                                              VirtIOSCSIReq *req,
+                                              SCSIDevice *d, AioContext *ctx)
+{
+    AioContext *vq_ctx = virtio_scsi_vq_ctx(s, req->vq);
+
+    req->remote = true;
+    aio_context_release(vq_ctx);
+    aio_context_acquire(ctx);
+    if (virtio_scsi_handle_cmd_req_new(s, req, d) == 0) {
+        virtio_scsi_handle_cmd_req_submit(s, req);
+    }
+    aio_context_release(ctx);
+    aio_context_acquire(vq_ctx);
+}
+
 static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
 {
     VirtIOSCSICommon *vs = &s->parent_obj;
     SCSIDevice *d;
+    AioContext *ctx;
     int rc;
 
     rc = virtio_scsi_parse_req(req, sizeof(VirtIOSCSICmdReq) + vs->cdb_size,
@@ -563,30 +725,12 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
         return -ENOENT;
     }
     virtio_scsi_ctx_check(s, d);
-    req->sreq = scsi_req_new(d, req->req.cmd.tag,
-                             virtio_scsi_get_lun(req->req.cmd.lun),
-                             req->req.cmd.cdb, req);
-
-    if (req->sreq->cmd.mode != SCSI_XFER_NONE
-        && (req->sreq->cmd.mode != req->mode ||
-            req->sreq->cmd.xfer > req->qsgl.size)) {
-        req->resp.cmd.response = VIRTIO_SCSI_S_OVERRUN;
-        virtio_scsi_complete_cmd_req(req);
-        return -ENOBUFS;
+    ctx = virtio_scsi_remote_ctx(s, req->vq, d);
+    if (ctx) {
+        virtio_scsi_handle_cmd_req_remote(s, req, d, ctx);
+        return -EINPROGRESS;
     }
-    scsi_req_ref(req->sreq);
-    blk_io_plug(d->conf.blk);
-    return 0;
-}
-
-static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
-{
-    SCSIRequest *sreq = req->sreq;
-    if (scsi_req_enqueue(sreq)) {
-        scsi_req_continue(sreq);
-    }
-    blk_io_unplug(sreq->dev->conf.blk);
-    scsi_req_unref(sreq);
+    return virtio_scsi_handle_cmd_req_new(s, req, d);
 }
 
 bool virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
@@ -802,14 +946,17 @@ static void virtio_scsi_hotplug(HotplugHandler *hotplug_dev, DeviceState *dev,
             return;
         }
         ctx = blk_get_aio_context(sd->conf.blk);
-        if (ctx != s->ctx && ctx != qemu_get_aio_context()) {
+        if (ctx == qemu_get_aio_context()) {
+            /* Spread LUNs across the iothreads of the controller */
+            ctx = s->ctxs[s->next_lun_ctx++ % s->nb_ctxs];
+        } else if (!virtio_scsi_has_ctx(s, ctx)) {
             error_setg(errp, "Cannot attach a blockdev that is using "
                        "a different iothread");
             return;
         }
-        virtio_scsi_acquire(s);
-        blk_set_aio_context(sd->conf.blk, s->ctx);
-        virtio_scsi_release(s);
+        aio_context_acquire(ctx);
+        blk_set_aio_context(sd->conf.blk, ctx);
+        aio_context_release(ctx);
 
     }
 
@@ -838,9 +985,11 @@ static void virtio_scsi_hotunplug(HotplugHandler *hotplug_dev, DeviceState *dev,
     }
 
     if (s->ctx) {
-        virtio_scsi_acquire(s);
+        AioContext *ctx = blk_get_aio_context(sd->conf.blk);
+
+        aio_context_acquire(ctx);
         blk_set_aio_context(sd->conf.blk, qemu_get_aio_context());
-        virtio_scsi_release(s);
+        aio_context_release(ctx);
     }
 
     qdev_simple_device_unplug_cb(hotplug_dev, dev, errp);
@@ -931,6 +1080,7 @@ static void virtio_scsi_device_unrealize(DeviceState *dev, Error **errp)
     VirtIOSCSI *s = VIRTIO_SCSI(dev);
 
     qbus_set_hotplug_handler(BUS(&s->bus), NULL, &error_abort);
+    virtio_scsi_dataplane_cleanup(s);
     virtio_scsi_common_unrealize(dev, errp);
 }
 
@@ -948,6 +1098,9 @@ static Property virtio_scsi_properties[] = {
                                                 VIRTIO_SCSI_F_CHANGE, true),
     DEFINE_PROP_LINK("iothread", VirtIOSCSI, parent_obj.conf.iothread,
                      TYPE_IOTHREAD, IOThread *),
+    DEFINE_PROP_ARRAY("cmd-iothreads", VirtIOSCSI,
+                      parent_obj.conf.num_cmd_iothreads,
+                      parent_obj.conf.cmd_iothreads, qdev_prop_string, char *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -34,15 +34,15 @@
  */
 
 #include "qemu/osdep.h"
-#ifndef CONFIG_WIN32
-#include <poll.h>
-#endif
 #include <libusb.h>
 
 #include "qapi/error.h"
 #include "qemu-common.h"
 #include "monitor/monitor.h"
 #include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
 #include "sysemu/sysemu.h"
 #include "trace.h"
 
@@ -67,6 +67,10 @@ struct USBAutoFilter {
     uint32_t product_id;
 };
 
+/* See usb_host_iso_nr_xfers() */
+#define USB_HOST_ISO_SPEED_FACTOR   8
+#define USB_HOST_ISO_MAX_RING_SIZE  (4 * MiB)
+
 enum USBHostDeviceOptions {
     USB_HOST_OPT_PIPELINE,
 };
@@ -133,6 +137,7 @@ struct USBHostIsoXfer {
 struct USBHostIsoRing {
     USBHostDevice                    *host;
     USBEndpoint                      *ep;
+    unsigned int                     nr_xfers;
     QTAILQ_HEAD(, USBHostIsoXfer)    unused;
     QTAILQ_HEAD(, USBHostIsoXfer)    inflight;
     QTAILQ_HEAD(, USBHostIsoXfer)    copy;
@@ -211,34 +216,76 @@ static const char *err_names[] = {
 static libusb_context *ctx;
 static uint32_t loglevel;
 
-#ifndef CONFIG_WIN32
+/*
+ * libusb events are handled by a thread of their own, so that a busy
+ * main loop does not delay the resubmission of transfers.  The transfer
+ * callbacks touch the emulated devices, so that thread hands them over
+ * to the main loop.  It must not take the BQL itself: libusb_close()
+ * waits for the event handler while holding it.
+ */
+typedef struct USBHostCompletion {
+    struct libusb_transfer           *xfer;
+    libusb_transfer_cb_fn            cb;
+    QSIMPLEQ_ENTRY(USBHostCompletion) next;
+} USBHostCompletion;
+
+static QemuThread event_thread;
+static QemuMutex completion_lock;
+static QSIMPLEQ_HEAD(, USBHostCompletion) completions =
+    QSIMPLEQ_HEAD_INITIALIZER(completions);
+static QEMUBH *completion_bh;
 
-static void usb_host_handle_fd(void *opaque)
+static void *usb_host_event_thread(void *opaque)
 {
-    struct timeval tv = { 0, 0 };
-    libusb_handle_events_timeout(ctx, &tv);
+    for (;;) {
+        libusb_handle_events(ctx);
+    }
+    return NULL;
 }
 
-static void usb_host_add_fd(int fd, short events, void *user_data)
+static void usb_host_completion_bh(void *opaque)
 {
-    qemu_set_fd_handler(fd,
-                        (events & POLLIN)  ? usb_host_handle_fd : NULL,
-                        (events & POLLOUT) ? usb_host_handle_fd : NULL,
-                        ctx);
+    QSIMPLEQ_HEAD(, USBHostCompletion) list =
+        QSIMPLEQ_HEAD_INITIALIZER(list);
+    USBHostCompletion *c;
+
+    qemu_mutex_lock(&completion_lock);
+    QSIMPLEQ_CONCAT(&list, &completions);
+    qemu_mutex_unlock(&completion_lock);
+
+    while ((c = QSIMPLEQ_FIRST(&list)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(&list, next);
+        c->cb(c->xfer);
+        g_free(c);
+    }
 }
 
-static void usb_host_del_fd(int fd, void *user_data)
+/*
+ * Called first by the transfer callbacks; returns true if @cb has to
+ * run later in the main loop.  libusb runs the callbacks directly when
+ * the main loop itself handles events, e.g. in synchronous calls.
+ */
+static bool usb_host_defer_completion(struct libusb_transfer *xfer,
+                                      libusb_transfer_cb_fn cb)
 {
-    qemu_set_fd_handler(fd, NULL, NULL, NULL);
-}
+    USBHostCompletion *c;
+
+    if (qemu_mutex_iothread_locked()) {
+        return false;
+    }
 
-#endif /* !CONFIG_WIN32 */
+    c = g_new(USBHostCompletion, 1);
+    c->xfer = xfer;
+    c->cb = cb;
+    qemu_mutex_lock(&completion_lock);
+    QSIMPLEQ_INSERT_TAIL(&completions, c, next);
+    qemu_mutex_unlock(&completion_lock);
+    qemu_bh_schedule(completion_bh);
+    return true;
+}
 
 static int usb_host_init(void)
 {
-#ifndef CONFIG_WIN32
-    const struct libusb_pollfd **poll;
-#endif
     int rc;
 
     if (ctx) {
@@ -253,21 +300,10 @@ static int usb_host_init(void)
 #else
     libusb_set_debug(ctx, loglevel);
 #endif
-#ifdef CONFIG_WIN32
-    /* FIXME: add support for Windows. */
-#else
-    libusb_set_pollfd_notifiers(ctx, usb_host_add_fd,
-                                usb_host_del_fd,
-                                ctx);
-    poll = libusb_get_pollfds(ctx);
-    if (poll) {
-        int i;
-        for (i = 0; poll[i] != NULL; i++) {
-            usb_host_add_fd(poll[i]->fd, poll[i]->events, ctx);
-        }
-    }
-    free(poll);
-#endif
+    qemu_mutex_init(&completion_lock);
+    completion_bh = qemu_bh_new(usb_host_completion_bh, NULL);
+    qemu_thread_create(&event_thread, "usb-host-events",
+                       usb_host_event_thread, NULL, QEMU_THREAD_DETACHED);
     return 0;
 }
 
@@ -369,9 +405,17 @@ static USBHostRequest *usb_host_req_find(USBHostDevice *s, USBPacket *p)
 
 static void LIBUSB_CALL usb_host_req_complete_ctrl(struct libusb_transfer *xfer)
 {
-    USBHostRequest *r = xfer->user_data;
-    USBHostDevice  *s = r->host;
-    bool disconnect = (xfer->status == LIBUSB_TRANSFER_NO_DEVICE);
+    USBHostRequest *r;
+    USBHostDevice  *s;
+    bool disconnect;
+
+    if (usb_host_defer_completion(xfer, usb_host_req_complete_ctrl)) {
+        return;
+    }
+
+    r = xfer->user_data;
+    s = r->host;
+    disconnect = (xfer->status == LIBUSB_TRANSFER_NO_DEVICE);
 
     if (r->p == NULL) {
         goto out; /* request was canceled */
@@ -402,9 +446,17 @@ out:
 
 static void LIBUSB_CALL usb_host_req_complete_data(struct libusb_transfer *xfer)
 {
-    USBHostRequest *r = xfer->user_data;
-    USBHostDevice  *s = r->host;
-    bool disconnect = (xfer->status == LIBUSB_TRANSFER_NO_DEVICE);
+    USBHostRequest *r;
+    USBHostDevice  *s;
+    bool disconnect;
+
+    if (usb_host_defer_completion(xfer, usb_host_req_complete_data)) {
+        return;
+    }
+
+    r = xfer->user_data;
+    s = r->host;
+    disconnect = (xfer->status == LIBUSB_TRANSFER_NO_DEVICE);
 
     if (r->p == NULL) {
         goto out; /* request was canceled */
@@ -459,8 +511,13 @@ static void usb_host_req_abort(USBHostRequest *r)
 static void LIBUSB_CALL
 usb_host_req_complete_iso(struct libusb_transfer *transfer)
 {
-    USBHostIsoXfer *xfer = transfer->user_data;
+    USBHostIsoXfer *xfer;
+
+    if (usb_host_defer_completion(transfer, usb_host_req_complete_iso)) {
+        return;
+    }
 
+    xfer = transfer->user_data;
     if (!xfer) {
         /* USBHostIsoXfer released while inflight */
         g_free(transfer->buffer);
@@ -481,6 +538,25 @@ usb_host_req_complete_iso(struct libusb_transfer *transfer)
     }
 }
 
+/*
+ * isobufs transfers of isobsize packets cover isobufs * isobsize frames
+ * at full speed, but only an eighth of that at high speed and above,
+ * where an endpoint can move a packet every microframe.  Give these
+ * rings more transfers, as long as their buffers stay reasonably small.
+ */
+static unsigned int usb_host_iso_nr_xfers(USBHostDevice *s, USBEndpoint *ep)
+{
+    size_t xfer_size = ep->max_packet_size * s->iso_urb_frames;
+    unsigned int nr = s->iso_urb_count;
+
+    if (USB_DEVICE(s)->speed >= USB_SPEED_HIGH && xfer_size) {
+        nr = MIN(nr * USB_HOST_ISO_SPEED_FACTOR,
+                 USB_HOST_ISO_MAX_RING_SIZE / xfer_size);
+        nr = MAX(nr, s->iso_urb_count);
+    }
+    return nr;
+}
+
 static USBHostIsoRing *usb_host_iso_alloc(USBHostDevice *s, USBEndpoint *ep)
 {
     USBHostIsoRing *ring = g_new0(USBHostIsoRing, 1);
@@ -491,12 +567,13 @@ static USBHostIsoRing *usb_host_iso_alloc(USBHostDevice *s, USBEndpoint *ep)
 
     ring->host = s;
     ring->ep = ep;
+    ring->nr_xfers = usb_host_iso_nr_xfers(s, ep);
     QTAILQ_INIT(&ring->unused);
     QTAILQ_INIT(&ring->inflight);
     QTAILQ_INIT(&ring->copy);
     QTAILQ_INSERT_TAIL(&s->isorings, ring, next);
 
-    for (i = 0; i < s->iso_urb_count; i++) {
+    for (i = 0; i < ring->nr_xfers; i++) {
         xfer = g_new0(USBHostIsoXfer, 1);
         xfer->ring = ring;
         xfer->xfer = libusb_alloc_transfer(packets);
@@ -685,7 +762,7 @@ static void usb_host_iso_data_out(USBHostDevice *s, USBPacket *p)
     if (QTAILQ_EMPTY(&ring->inflight)) {
         /* wait until half of our buffers are filled
            before kicking the iso out stream */
-        if (filled*2 < s->iso_urb_count) {
+        if (filled*2 < ring->nr_xfers) {
             return;
         }
     }
@@ -848,6 +925,14 @@ static void usb_host_ep_update(USBHostDevice *s)
             usb_ep_set_type(udev, pid, ep, type);
             usb_ep_set_ifnum(udev, pid, ep, i);
             usb_ep_set_halted(udev, pid, ep, 0);
+            /*
+             * Keep several bulk transfers in flight; bulk in packets are
+             * also combined, see usb_host_use_combining().
+             */
+            if (type == USB_ENDPOINT_XFER_BULK &&
+                (s->options & (1 << USB_HOST_OPT_PIPELINE))) {
+                usb_ep_get(udev, pid, ep)->pipeline = true;
+            }
 #ifdef HAVE_STREAMS
             if (type == LIBUSB_TRANSFER_TYPE_BULK &&
                     libusb_get_ss_endpoint_companion_descriptor(ctx, endp,
@@ -29,9 +29,13 @@
 #include "hw/vfio/vfio.h"
 #include "exec/address-spaces.h"
 #include "exec/memory.h"
+#include "exec/ram_addr.h"
 #include "hw/hw.h"
 #include "qemu/error-report.h"
 #include "qemu/range.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
 #include "sysemu/balloon.h"
 #include "sysemu/kvm.h"
 #include "trace.h"
@@ -276,6 +280,127 @@ static int vfio_dma_map(VFIOContainer *container, hwaddr iova,
     return -errno;
 }
 
+/*
+ * Pinning and mapping guest RAM dominates the time needed to set up a
+ * container for a large guest.  While the memory listener is first
+ * registered, RAM sections are therefore only queued, split at 1GiB
+ * boundaries so that huge page mappings are preserved, and then mapped
+ * from several threads at once.
+ */
+#define VFIO_DMA_MAP_CHUNK        (1 * GiB)
+#define VFIO_DMA_MAP_MAX_THREADS  8
+
+typedef struct VFIODMAMapJob {
+    hwaddr iova;
+    ram_addr_t size;
+    void *vaddr;
+    bool readonly;
+    int ret;
+    int64_t ns;
+} VFIODMAMapJob;
+
+typedef struct VFIODMAMapWork {
+    VFIOContainer *container;
+    VFIODMAMapJob *jobs;
+    unsigned int nr_jobs;
+    unsigned int next_job;
+} VFIODMAMapWork;
+
+static void vfio_dma_map_account(VFIOContainer *container, ram_addr_t size,
+                                 int64_t ns)
+{
+    container->dma_map_count++;
+    container->dma_map_bytes += size;
+    container->dma_map_ns += ns;
+}
+
+static void vfio_dma_map_queue(VFIOContainer *container, hwaddr iova,
+                               ram_addr_t size, void *vaddr, bool readonly)
+{
+    while (size) {
+        ram_addr_t len = MIN(size, QEMU_ALIGN_UP(iova + 1, VFIO_DMA_MAP_CHUNK)
+                                   - iova);
+        VFIODMAMapJob job = {
+            .iova = iova,
+            .size = len,
+            .vaddr = vaddr,
+            .readonly = readonly,
+        };
+
+        g_array_append_val(container->dma_map_pending, job);
+        iova += len;
+        vaddr += len;
+        size -= len;
+    }
+}
+
+static void *vfio_dma_map_thread(void *opaque)
+{
+    VFIODMAMapWork *work = opaque;
+    unsigned int i;
+
+    while ((i = atomic_fetch_inc(&work->next_job)) < work->nr_jobs) {
+        VFIODMAMapJob *job = &work->jobs[i];
+        int64_t start = get_clock();
+
+        job->ret = vfio_dma_map(work->container, job->iova, job->size,
+                                job->vaddr, job->readonly);
+        job->ns = get_clock() - start;
+    }
+    return NULL;
+}
+
+/* Issue the queued mappings; the first error is stored in the container */
+static void vfio_dma_map_flush(VFIOContainer *container)
+{
+    GArray *pending = container->dma_map_pending;
+    VFIODMAMapWork work = {
+        .container = container,
+        .jobs = (VFIODMAMapJob *)pending->data,
+        .nr_jobs = pending->len,
+    };
+    long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int nr_threads = MIN(work.nr_jobs, VFIO_DMA_MAP_MAX_THREADS);
+    QemuThread *threads;
+    int64_t start = get_clock();
+    unsigned int i;
+
+    container->dma_map_pending = NULL;
+    if (host_procs > 0) {
+        nr_threads = MIN(nr_threads, host_procs);
+    }
+
+    threads = g_new(QemuThread, nr_threads);
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_create(&threads[i], "vfio_dma_map", vfio_dma_map_thread,
+                           &work, QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    g_free(threads);
+
+    for (i = 0; i < work.nr_jobs; i++) {
+        VFIODMAMapJob *job = &work.jobs[i];
+
+        if (job->ret) {
+            error_report("vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
+                         "0x%"HWADDR_PRIx", %p) = %d (%s)",
+                         container, job->iova, (hwaddr)job->size, job->vaddr,
+                         job->ret, strerror(-job->ret));
+            if (!container->error) {
+                container->error = job->ret;
+            }
+            continue;
+        }
+        vfio_dma_map_account(container, job->size, job->ns);
+    }
+
+    trace_vfio_dma_map_flush(container->fd, work.nr_jobs, nr_threads,
+                             get_clock() - start);
+    g_array_free(pending, true);
+}
+
 static void vfio_host_win_add(VFIOContainer *container,
                               hwaddr min_iova, hwaddr max_iova,
                               uint64_t iova_pgsizes)
@@ -426,6 +551,7 @@ static void vfio_listener_region_add(MemoryListener *listener,
     hwaddr iova, end;
     Int128 llend, llsize;
     void *vaddr;
+    int64_t start;
     int ret;
     VFIOHostDMAWindow *hostwin;
     bool hostwin_found;
@@ -581,9 +707,20 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
+    if (container->dma_map_pending &&
+        !memory_region_is_ram_device(section->mr)) {
+        vfio_dma_map_queue(container, iova, int128_get64(llsize),
+                           vaddr, section->readonly);
+        return;
+    }
+
+    start = get_clock();
     ret = vfio_dma_map(container, iova, int128_get64(llsize),
                        vaddr, section->readonly);
-    if (ret) {
+    if (!ret) {
+        vfio_dma_map_account(container, int128_get64(llsize),
+                             get_clock() - start);
+    } else {
         error_report("vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
                      "0x%"HWADDR_PRIx", %p) = %d (%m)",
                      container, iova, int128_get64(llsize), vaddr, ret);
@@ -716,9 +853,155 @@ static void vfio_listener_region_del(MemoryListener *listener,
     }
 }
 
+static bool vfio_devices_all_migratable(VFIOContainer *container)
+{
+    VFIOGroup *group;
+    VFIODevice *vbasedev;
+
+    QLIST_FOREACH(group, &container->group_list, container_next) {
+        QLIST_FOREACH(vbasedev, &group->device_list, next) {
+            if (!vbasedev->migration) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void vfio_set_dirty_page_tracking(VFIOContainer *container, bool start)
+{
+    struct vfio_iommu_type1_dirty_bitmap dirty = {
+        .argsz = sizeof(dirty),
+    };
+
+    dirty.flags = start ? VFIO_IOMMU_DIRTY_PAGES_FLAG_START :
+                          VFIO_IOMMU_DIRTY_PAGES_FLAG_STOP;
+
+    if (ioctl(container->fd, VFIO_IOMMU_DIRTY_PAGES, &dirty)) {
+        error_report("vfio: Failed to %s dirty page tracking: %m",
+                     start ? "start" : "stop");
+        return;
+    }
+
+    container->dirty_tracking = start;
+    trace_vfio_set_dirty_page_tracking(container->fd, start);
+}
+
+static void vfio_listener_log_global_start(MemoryListener *listener)
+{
+    VFIOContainer *container = container_of(listener, VFIOContainer, listener);
+
+    if (container->dirty_pages_supported &&
+        vfio_devices_all_migratable(container)) {
+        vfio_set_dirty_page_tracking(container, true);
+    }
+}
+
+static void vfio_listener_log_global_stop(MemoryListener *listener)
+{
+    VFIOContainer *container = container_of(listener, VFIOContainer, listener);
+
+    if (container->dirty_tracking) {
+        vfio_set_dirty_page_tracking(container, false);
+    }
+}
+
+static int vfio_get_dirty_bitmap(VFIOContainer *container, uint64_t iova,
+                                 uint64_t size, ram_addr_t ram_addr)
+{
+    struct vfio_iommu_type1_dirty_bitmap *dbitmap;
+    struct vfio_iommu_type1_dirty_bitmap_get *range;
+    uint64_t pages;
+    int ret;
+
+    dbitmap = g_malloc0(sizeof(*dbitmap) + sizeof(*range));
+    dbitmap->argsz = sizeof(*dbitmap) + sizeof(*range);
+    dbitmap->flags = VFIO_IOMMU_DIRTY_PAGES_FLAG_GET_BITMAP;
+    range = (struct vfio_iommu_type1_dirty_bitmap_get *)&dbitmap->data;
+    range->iova = iova;
+    range->size = size;
+
+    /*
+     * The bitmap is reported in host pages so that it can be merged
+     * directly by cpu_physical_memory_set_dirty_lebitmap().
+     */
+    range->bitmap.pgsize = qemu_real_host_page_size;
+    pages = REAL_HOST_PAGE_ALIGN(size) / qemu_real_host_page_size;
+    range->bitmap.size = ROUND_UP(pages, sizeof(__u64) * BITS_PER_BYTE) /
+                         BITS_PER_BYTE;
+    if (range->bitmap.size > container->max_dirty_bitmap_size) {
+        error_report("vfio: Dirty bitmap of 0x%"PRIx64" bytes for iova "
+                     "0x%"PRIx64" exceeds the host limit of 0x%"PRIx64,
+                     (uint64_t)range->bitmap.size, iova,
+                     container->max_dirty_bitmap_size);
+        ret = -E2BIG;
+        goto out;
+    }
+
+    range->bitmap.data = g_try_malloc0(range->bitmap.size);
+    if (!range->bitmap.data) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = ioctl(container->fd, VFIO_IOMMU_DIRTY_PAGES, dbitmap);
+    if (ret) {
+        ret = -errno;
+        error_report("vfio: Failed to get dirty bitmap for iova 0x%"PRIx64
+                     " size 0x%"PRIx64": %m", iova, size);
+        goto out;
+    }
+
+    cpu_physical_memory_set_dirty_lebitmap((unsigned long *)range->bitmap.data,
+                                           ram_addr, pages);
+    trace_vfio_get_dirty_bitmap(container->fd, iova, size,
+                                range->bitmap.size, ram_addr);
+out:
+    g_free(range->bitmap.data);
+    g_free(dbitmap);
+    return ret;
+}
+
+static void vfio_listener_log_sync(MemoryListener *listener,
+                                   MemoryRegionSection *section)
+{
+    VFIOContainer *container = container_of(listener, VFIOContainer, listener);
+    ram_addr_t ram_addr;
+    hwaddr iova;
+    Int128 llend;
+
+    if (!container->dirty_tracking ||
+        vfio_listener_skipped_section(section) ||
+        memory_region_is_iommu(section->mr) ||
+        memory_region_is_ram_device(section->mr)) {
+        return;
+    }
+
+    iova = TARGET_PAGE_ALIGN(section->offset_within_address_space);
+    llend = int128_make64(section->offset_within_address_space);
+    llend = int128_add(llend, section->size);
+    llend = int128_and(llend, int128_exts64(TARGET_PAGE_MASK));
+
+    if (int128_ge(int128_make64(iova), llend)) {
+        return;
+    }
+
+    ram_addr = memory_region_get_ram_addr(section->mr) +
+               section->offset_within_region +
+               (iova - section->offset_within_address_space);
+
+    vfio_get_dirty_bitmap(container, iova,
+                          int128_get64(int128_sub(llend, int128_make64(iova))),
+                          ram_addr);
+}
+
 static const MemoryListener vfio_memory_listener = {
     .region_add = vfio_listener_region_add,
     .region_del = vfio_listener_region_del,
+    .log_global_start = vfio_listener_log_global_start,
+    .log_global_stop = vfio_listener_log_global_stop,
+    .log_sync = vfio_listener_log_sync,
 };
 
 static void vfio_listener_release(VFIOContainer *container)
@@ -748,6 +1031,71 @@ vfio_get_region_info_cap(struct vfio_region_info *info, uint16_t id)
     return NULL;
 }
 
+static int vfio_get_iommu_info(VFIOContainer *container,
+                               struct vfio_iommu_type1_info **info)
+{
+    size_t argsz = sizeof(struct vfio_iommu_type1_info);
+
+    *info = g_new0(struct vfio_iommu_type1_info, 1);
+again:
+    (*info)->argsz = argsz;
+
+    if (ioctl(container->fd, VFIO_IOMMU_GET_INFO, *info)) {
+        g_free(*info);
+        *info = NULL;
+        return -errno;
+    }
+
+    if ((*info)->argsz > argsz) {
+        argsz = (*info)->argsz;
+        *info = g_realloc(*info, argsz);
+        goto again;
+    }
+
+    return 0;
+}
+
+static struct vfio_info_cap_header *
+vfio_get_iommu_info_cap(struct vfio_iommu_type1_info *info, uint16_t id)
+{
+    struct vfio_info_cap_header *hdr;
+    void *ptr = info;
+
+    if (!(info->flags & VFIO_IOMMU_INFO_CAPS)) {
+        return NULL;
+    }
+
+    for (hdr = ptr + info->cap_offset; hdr != ptr; hdr = ptr + hdr->next) {
+        if (hdr->id == id) {
+            return hdr;
+        }
+    }
+
+    return NULL;
+}
+
+static void vfio_get_iommu_info_migration(VFIOContainer *container,
+                                          struct vfio_iommu_type1_info *info)
+{
+    struct vfio_info_cap_header *hdr;
+    struct vfio_iommu_type1_info_cap_migration *cap_mig;
+
+    hdr = vfio_get_iommu_info_cap(info, VFIO_IOMMU_TYPE1_INFO_CAP_MIGRATION);
+    if (!hdr) {
+        return;
+    }
+
+    cap_mig = container_of(hdr, struct vfio_iommu_type1_info_cap_migration,
+                           header);
+
+    /* Dirty bitmaps are only consumed at host page granularity */
+    if (cap_mig->pgsize_bitmap & qemu_real_host_page_size) {
+        container->dirty_pages_supported = true;
+        container->max_dirty_bitmap_size = cap_mig->max_dirty_bitmap_size;
+        container->dirty_pgsizes = cap_mig->pgsize_bitmap;
+    }
+}
+
 static int vfio_setup_region_sparse_mmaps(VFIORegion *region,
                                           struct vfio_region_info *info)
 {
@@ -1183,7 +1531,8 @@ static int vfio_connect_container(VFIOGroup *group, AddressSpace *as,
     case VFIO_TYPE1v2_IOMMU:
     case VFIO_TYPE1_IOMMU:
     {
-        struct vfio_iommu_type1_info info;
+        struct vfio_iommu_type1_info *info;
+        uint64_t iova_pgsizes = 4096;
 
         /*
          * FIXME: This assumes that a Type1 IOMMU can map any 64-bit
@@ -1192,15 +1541,16 @@ static int vfio_connect_container(VFIOGroup *group, AddressSpace *as,
          * existing Type1 IOMMUs generally support any IOVA we're
          * going to actually try in practice.
          */
-        info.argsz = sizeof(info);
-        ret = ioctl(fd, VFIO_IOMMU_GET_INFO, &info);
-        /* Ignore errors */
-        if (ret || !(info.flags & VFIO_IOMMU_INFO_PGSIZES)) {
-            /* Assume 4k IOVA page size */
-            info.iova_pgsizes = 4096;
+        /* Ignore errors, assuming a 4k IOVA page size */
+        if (!vfio_get_iommu_info(container, &info)) {
+            if (info->flags & VFIO_IOMMU_INFO_PGSIZES) {
+                iova_pgsizes = info->iova_pgsizes;
+            }
+            vfio_get_iommu_info_migration(container, info);
+            g_free(info);
         }
-        vfio_host_win_add(container, 0, (hwaddr)-1, info.iova_pgsizes);
-        container->pgsizes = info.iova_pgsizes;
+        vfio_host_win_add(container, 0, (hwaddr)-1, iova_pgsizes);
+        container->pgsizes = iova_pgsizes;
         break;
     }
     case VFIO_SPAPR_TCE_v2_IOMMU:
@@ -1282,8 +1632,21 @@ static int vfio_connect_container(VFIOGroup *group, AddressSpace *as,
 
     container->listener = vfio_memory_listener;
 
+    if (container->iommu_type == VFIO_TYPE1_IOMMU ||
+        container->iommu_type == VFIO_TYPE1v2_IOMMU) {
+        container->dma_map_pending = g_array_new(false, false,
+                                                 sizeof(VFIODMAMapJob));
+    }
+
     memory_listener_register(&container->listener, container->space->as);
 
+    if (container->dma_map_pending) {
+        vfio_dma_map_flush(container);
+    }
+    trace_vfio_dma_map_stats(container->fd, container->dma_map_count,
+                             container->dma_map_bytes,
+                             container->dma_map_ns / SCALE_MS);
+
     if (container->error) {
         ret = container->error;
         error_setg_errno(errp, -ret,
@@ -0,0 +1,765 @@
+/*
+ * Migration support for VFIO devices
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <linux/vfio.h>
+
+#include "sysemu/sysemu.h"
+#include "hw/hw.h"
+#include "hw/vfio/vfio-common.h"
+#include "migration/blocker.h"
+#include "migration/misc.h"
+#include "migration/qemu-file.h"
+#include "migration/register.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "trace.h"
+
+/*
+ * Flags used as delimiters in the device state stream.  The upper 32 bits
+ * are an arbitrary magic, so that a misparsed stream is spotted rather than
+ * silently accepted.
+ */
+#define VFIO_MIG_FLAG_END_OF_STATE      (0xffffffffef100001ULL)
+#define VFIO_MIG_FLAG_DEV_CONFIG_STATE  (0xffffffffef100002ULL)
+#define VFIO_MIG_FLAG_DEV_SETUP_STATE   (0xffffffffef100003ULL)
+#define VFIO_MIG_FLAG_DEV_DATA_STATE    (0xffffffffef100004ULL)
+
+#define VFIO_MIG_STRUCT_OFFSET(f) \
+    offsetof(struct vfio_device_migration_info, f)
+
+struct VFIOMigration {
+    VFIODevice *vbasedev;
+    VMChangeStateEntry *vm_state;
+    VFIORegion region;
+    uint32_t device_state;
+    Notifier migration_state;
+    uint64_t pending_bytes;
+};
+
+static int vfio_mig_access(VFIODevice *vbasedev, void *val, size_t count,
+                           off_t off, bool iswrite)
+{
+    uint8_t *buf = val;
+
+    while (count) {
+        ssize_t ret;
+
+        ret = iswrite ? pwrite(vbasedev->fd, buf, count, off) :
+                        pread(vbasedev->fd, buf, count, off);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ret = -errno;
+            error_report("%s: Failed to %s migration region at 0x%"PRIx64
+                         ": %s", vbasedev->name, iswrite ? "write" : "read",
+                         (uint64_t)off, strerror(-ret));
+            return ret;
+        }
+        if (ret == 0) {
+            error_report("%s: Short %s of migration region at 0x%"PRIx64,
+                         vbasedev->name, iswrite ? "write" : "read",
+                         (uint64_t)off);
+            return -EINVAL;
+        }
+        buf += ret;
+        off += ret;
+        count -= ret;
+    }
+
+    return 0;
+}
+
+static int vfio_mig_read(VFIODevice *vbasedev, void *val, size_t count,
+                         off_t off)
+{
+    return vfio_mig_access(vbasedev, val, count, off, false);
+}
+
+static int vfio_mig_write(VFIODevice *vbasedev, void *val, size_t count,
+                          off_t off)
+{
+    return vfio_mig_access(vbasedev, val, count, off, true);
+}
+
+static int vfio_migration_set_state(VFIODevice *vbasedev, uint32_t mask,
+                                    uint32_t value)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    VFIORegion *region = &migration->region;
+    off_t dev_state_off = region->fd_offset +
+                          VFIO_MIG_STRUCT_OFFSET(device_state);
+    uint32_t device_state;
+    int ret;
+
+    ret = vfio_mig_read(vbasedev, &device_state, sizeof(device_state),
+                        dev_state_off);
+    if (ret) {
+        return ret;
+    }
+
+    device_state = (device_state & mask) | value;
+
+    if (!VFIO_DEVICE_STATE_VALID(device_state)) {
+        return -EINVAL;
+    }
+
+    ret = vfio_mig_write(vbasedev, &device_state, sizeof(device_state),
+                         dev_state_off);
+    if (ret) {
+        int rret;
+
+        /*
+         * A failed transition leaves the device either in its old state or
+         * in the error state, from which only a reset recovers.
+         */
+        rret = vfio_mig_read(vbasedev, &device_state, sizeof(device_state),
+                             dev_state_off);
+        if (rret || VFIO_DEVICE_STATE_IS_ERROR(device_state)) {
+            hw_error("%s: Device in error state 0x%x", vbasedev->name,
+                     device_state);
+        }
+        return ret;
+    }
+
+    migration->device_state = device_state;
+    trace_vfio_migration_set_state(vbasedev->name, device_state);
+    return 0;
+}
+
+/*
+ * Return a pointer into the mmap'ed part of the migration region at
+ * @data_offset, or NULL if that offset has to be accessed through the
+ * device fd.  Either way, @size is set to the length that can be accessed
+ * the same way, up to @data_size.
+ */
+static void *vfio_mig_data_section(VFIORegion *region, uint64_t data_offset,
+                                   uint64_t data_size, uint64_t *size)
+{
+    uint64_t limit = 0;
+    int i;
+
+    for (i = 0; i < region->nr_mmaps; i++) {
+        VFIOMmap *map = region->mmaps + i;
+
+        if (!map->mmap) {
+            continue;
+        }
+
+        if (data_offset >= map->offset &&
+            data_offset < map->offset + map->size) {
+            *size = MIN(data_size, map->offset + map->size - data_offset);
+            return map->mmap + data_offset - map->offset;
+        }
+
+        if (data_offset < map->offset && (!limit || limit > map->offset)) {
+            limit = map->offset;
+        }
+    }
+
+    *size = limit ? MIN(data_size, limit - data_offset) : data_size;
+    return NULL;
+}
+
+static int vfio_update_pending(VFIODevice *vbasedev)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    VFIORegion *region = &migration->region;
+    uint64_t pending_bytes = 0;
+    int ret;
+
+    ret = vfio_mig_read(vbasedev, &pending_bytes, sizeof(pending_bytes),
+                        region->fd_offset +
+                        VFIO_MIG_STRUCT_OFFSET(pending_bytes));
+    if (ret) {
+        migration->pending_bytes = 0;
+        return ret;
+    }
+
+    migration->pending_bytes = pending_bytes;
+    trace_vfio_update_pending(vbasedev->name, pending_bytes);
+    return 0;
+}
+
+static int vfio_save_buffer(QEMUFile *f, VFIODevice *vbasedev, uint64_t *size)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    VFIORegion *region = &migration->region;
+    uint64_t data_offset = 0, data_size = 0, sz;
+    int ret;
+
+    ret = vfio_mig_read(vbasedev, &data_offset, sizeof(data_offset),
+                        region->fd_offset +
+                        VFIO_MIG_STRUCT_OFFSET(data_offset));
+    if (ret) {
+        return ret;
+    }
+
+    /* Reading data_size is what makes the device produce the data */
+    ret = vfio_mig_read(vbasedev, &data_size, sizeof(data_size),
+                        region->fd_offset + VFIO_MIG_STRUCT_OFFSET(data_size));
+    if (ret) {
+        return ret;
+    }
+
+    trace_vfio_save_buffer(vbasedev->name, data_offset, data_size,
+                           migration->pending_bytes);
+
+    qemu_put_be64(f, data_size);
+    sz = data_size;
+
+    while (sz) {
+        uint64_t sec_size;
+        void *buf;
+
+        buf = vfio_mig_data_section(region, data_offset, sz, &sec_size);
+        if (buf) {
+            qemu_put_buffer(f, buf, sec_size);
+        } else {
+            buf = g_try_malloc(sec_size);
+            if (!buf) {
+                error_report("%s: Failed to allocate 0x%"PRIx64" bytes",
+                             vbasedev->name, sec_size);
+                return -ENOMEM;
+            }
+            ret = vfio_mig_read(vbasedev, buf, sec_size,
+                                region->fd_offset + data_offset);
+            if (ret) {
+                g_free(buf);
+                return ret;
+            }
+            qemu_put_buffer(f, buf, sec_size);
+            g_free(buf);
+        }
+
+        sz -= sec_size;
+        data_offset += sec_size;
+    }
+
+    ret = qemu_file_get_error(f);
+    if (!ret && size) {
+        *size = data_size;
+    }
+    return ret;
+}
+
+static int vfio_load_buffer(QEMUFile *f, VFIODevice *vbasedev,
+                            uint64_t data_size)
+{
+    VFIORegion *region = &vbasedev->migration->region;
+    uint64_t data_offset = 0, size, report_size;
+    int ret;
+
+    do {
+        ret = vfio_mig_read(vbasedev, &data_offset, sizeof(data_offset),
+                            region->fd_offset +
+                            VFIO_MIG_STRUCT_OFFSET(data_offset));
+        if (ret) {
+            return ret;
+        }
+
+        if (data_offset >= region->size) {
+            error_report("%s: Invalid data offset 0x%"PRIx64,
+                         vbasedev->name, data_offset);
+            return -EINVAL;
+        }
+
+        /*
+         * The data area on the destination may be smaller than on the
+         * source; feed the data to the device a section at a time.
+         */
+        report_size = size = MIN(data_size, region->size - data_offset);
+        data_size -= size;
+
+        trace_vfio_load_state_device_data(vbasedev->name, data_offset, size);
+
+        while (size) {
+            uint64_t sec_size;
+            void *buf;
+
+            buf = vfio_mig_data_section(region, data_offset, size, &sec_size);
+            if (buf) {
+                qemu_get_buffer(f, buf, sec_size);
+            } else {
+                buf = g_try_malloc(sec_size);
+                if (!buf) {
+                    error_report("%s: Failed to allocate 0x%"PRIx64" bytes",
+                                 vbasedev->name, sec_size);
+                    return -ENOMEM;
+                }
+                qemu_get_buffer(f, buf, sec_size);
+                ret = vfio_mig_write(vbasedev, buf, sec_size,
+                                     region->fd_offset + data_offset);
+                g_free(buf);
+                if (ret) {
+                    return ret;
+                }
+            }
+
+            size -= sec_size;
+            data_offset += sec_size;
+        }
+
+        ret = qemu_file_get_error(f);
+        if (ret) {
+            return ret;
+        }
+
+        /* Writing data_size is what makes the device consume the data */
+        ret = vfio_mig_write(vbasedev, &report_size, sizeof(report_size),
+                             region->fd_offset +
+                             VFIO_MIG_STRUCT_OFFSET(data_size));
+        if (ret) {
+            return ret;
+        }
+    } while (data_size);
+
+    return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static int vfio_save_setup(QEMUFile *f, void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    int ret;
+
+    trace_vfio_save_setup(vbasedev->name);
+
+    /*
+     * With a vIOMMU the guest can change the IOVA mappings at any time, and
+     * the dirty pages reported by the host could not be attributed.
+     */
+    if (!QLIST_EMPTY(&vbasedev->group->container->giommu_list)) {
+        error_report("%s: Migration with a vIOMMU is not supported",
+                     vbasedev->name);
+        return -EOPNOTSUPP;
+    }
+
+    qemu_put_be64(f, VFIO_MIG_FLAG_DEV_SETUP_STATE);
+
+    ret = vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_MASK,
+                                   VFIO_DEVICE_STATE_SAVING);
+    if (ret) {
+        error_report("%s: Failed to set state SAVING", vbasedev->name);
+        return ret;
+    }
+
+    qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
+
+    return qemu_file_get_error(f);
+}
+
+static void vfio_save_pending(QEMUFile *f, void *opaque,
+                              uint64_t threshold_size,
+                              uint64_t *res_precopy_only,
+                              uint64_t *res_compatible,
+                              uint64_t *res_postcopy_only)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+
+    if (vfio_update_pending(vbasedev)) {
+        return;
+    }
+
+    *res_precopy_only += migration->pending_bytes;
+
+    trace_vfio_save_pending(vbasedev->name, *res_precopy_only,
+                            *res_postcopy_only, *res_compatible);
+}
+
+static int vfio_save_iterate(QEMUFile *f, void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    uint64_t data_size = 0;
+    int ret;
+
+    qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
+
+    if (!migration->pending_bytes) {
+        ret = vfio_update_pending(vbasedev);
+        if (ret) {
+            return ret;
+        }
+
+        if (!migration->pending_bytes) {
+            qemu_put_be64(f, 0);
+            qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
+            /* Nothing left to iterate on, move on to the completion */
+            return 1;
+        }
+    }
+
+    ret = vfio_save_buffer(f, vbasedev, &data_size);
+    if (ret) {
+        error_report("%s: Failed to save device data: %s", vbasedev->name,
+                     strerror(-ret));
+        return ret;
+    }
+
+    qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
+
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+
+    /*
+     * save_live_pending is not called for savevm, so make the next
+     * iteration read the pending bytes itself.
+     */
+    migration->pending_bytes = 0;
+
+    trace_vfio_save_iterate(vbasedev->name, data_size);
+    return 0;
+}
+
+static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    uint64_t data_size;
+    int ret;
+
+    ret = vfio_migration_set_state(vbasedev, ~VFIO_DEVICE_STATE_RUNNING,
+                                   VFIO_DEVICE_STATE_SAVING);
+    if (ret) {
+        error_report("%s: Failed to set state STOP and SAVING",
+                     vbasedev->name);
+        return ret;
+    }
+
+    ret = vfio_update_pending(vbasedev);
+    if (ret) {
+        return ret;
+    }
+
+    while (migration->pending_bytes) {
+        qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
+        ret = vfio_save_buffer(f, vbasedev, &data_size);
+        if (ret) {
+            error_report("%s: Failed to save device data: %s",
+                         vbasedev->name, strerror(-ret));
+            return ret;
+        }
+
+        if (!data_size) {
+            break;
+        }
+
+        ret = vfio_update_pending(vbasedev);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
+
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+
+    ret = vfio_migration_set_state(vbasedev, ~VFIO_DEVICE_STATE_SAVING, 0);
+    if (ret) {
+        error_report("%s: Failed to set state STOPPED", vbasedev->name);
+        return ret;
+    }
+
+    trace_vfio_save_complete_precopy(vbasedev->name);
+    return 0;
+}
+
+static void vfio_save_state(QEMUFile *f, void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+
+    qemu_put_be64(f, VFIO_MIG_FLAG_DEV_CONFIG_STATE);
+
+    if (vbasedev->ops && vbasedev->ops->vfio_save_config) {
+        vbasedev->ops->vfio_save_config(vbasedev, f);
+    }
+
+    qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
+
+    trace_vfio_save_device_config_state(vbasedev->name);
+}
+
+static int vfio_load_setup(QEMUFile *f, void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    int ret;
+
+    ret = vfio_migration_set_state(vbasedev, ~VFIO_DEVICE_STATE_MASK,
+                                   VFIO_DEVICE_STATE_RESUMING);
+    if (ret) {
+        error_report("%s: Failed to set state RESUMING", vbasedev->name);
+    }
+    return ret;
+}
+
+static int vfio_load_device_config_state(QEMUFile *f, VFIODevice *vbasedev)
+{
+    uint64_t data;
+    int ret;
+
+    if (vbasedev->ops && vbasedev->ops->vfio_load_config) {
+        ret = vbasedev->ops->vfio_load_config(vbasedev, f);
+        if (ret) {
+            error_report("%s: Failed to load device config space",
+                         vbasedev->name);
+            return ret;
+        }
+    }
+
+    data = qemu_get_be64(f);
+    if (data != VFIO_MIG_FLAG_END_OF_STATE) {
+        error_report("%s: Failed loading device config space, "
+                     "end flag incorrect 0x%"PRIx64, vbasedev->name, data);
+        return -EINVAL;
+    }
+
+    trace_vfio_load_device_config_state(vbasedev->name);
+    return qemu_file_get_error(f);
+}
+
+static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
+{
+    VFIODevice *vbasedev = opaque;
+    uint64_t data, data_size;
+    int ret;
+
+    data = qemu_get_be64(f);
+    while (data != VFIO_MIG_FLAG_END_OF_STATE) {
+        trace_vfio_load_state(vbasedev->name, data);
+
+        switch (data) {
+        case VFIO_MIG_FLAG_DEV_CONFIG_STATE:
+            return vfio_load_device_config_state(f, vbasedev);
+        case VFIO_MIG_FLAG_DEV_SETUP_STATE:
+            data = qemu_get_be64(f);
+            if (data != VFIO_MIG_FLAG_END_OF_STATE) {
+                error_report("%s: SETUP STATE: end flag incorrect 0x%"PRIx64,
+                             vbasedev->name, data);
+                return -EINVAL;
+            }
+            return qemu_file_get_error(f);
+        case VFIO_MIG_FLAG_DEV_DATA_STATE:
+            data_size = qemu_get_be64(f);
+            if (data_size) {
+                ret = vfio_load_buffer(f, vbasedev, data_size);
+                if (ret) {
+                    return ret;
+                }
+            }
+            break;
+        default:
+            error_report("%s: Unknown tag 0x%"PRIx64, vbasedev->name, data);
+            return -EINVAL;
+        }
+
+        data = qemu_get_be64(f);
+        ret = qemu_file_get_error(f);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static SaveVMHandlers savevm_vfio_handlers = {
+    .save_setup = vfio_save_setup,
+    .save_live_pending = vfio_save_pending,
+    .save_live_iterate = vfio_save_iterate,
+    .save_live_complete_precopy = vfio_save_complete_precopy,
+    .save_state = vfio_save_state,
+    .load_setup = vfio_load_setup,
+    .load_state = vfio_load_state,
+};
+
+/* ---------------------------------------------------------------------- */
+
+static void vfio_vmstate_change(void *opaque, int running, RunState state)
+{
+    VFIODevice *vbasedev = opaque;
+    uint32_t mask, value;
+    int ret;
+
+    if (running) {
+        /*
+         * Coming from SAVING after a failed migration, or from RESUMING
+         * at the end of an incoming one: only RUNNING remains set.
+         */
+        mask = ~VFIO_DEVICE_STATE_MASK;
+        value = VFIO_DEVICE_STATE_RUNNING;
+    } else {
+        /* Either RUNNING or RUNNING | SAVING; stop the device either way */
+        mask = ~VFIO_DEVICE_STATE_RUNNING;
+        value = 0;
+    }
+
+    ret = vfio_migration_set_state(vbasedev, mask, value);
+    if (ret) {
+        error_report("%s: Failed to set device state 0x%x", vbasedev->name,
+                     (vbasedev->migration->device_state & mask) | value);
+    }
+
+    trace_vfio_vmstate_change(vbasedev->name, running, RunState_str(state),
+                              vbasedev->migration->device_state);
+}
+
+static void vfio_migration_state_notifier(Notifier *notifier, void *data)
+{
+    MigrationState *s = data;
+    VFIOMigration *migration = container_of(notifier, VFIOMigration,
+                                            migration_state);
+    VFIODevice *vbasedev = migration->vbasedev;
+    int ret;
+
+    if (!migration_has_failed(s)) {
+        return;
+    }
+
+    /*
+     * The VM has already been restarted if it was running, so only the
+     * SAVING bit is left to drop.
+     */
+    ret = vfio_migration_set_state(vbasedev,
+                                   ~(VFIO_DEVICE_STATE_SAVING |
+                                     VFIO_DEVICE_STATE_RESUMING),
+                                   runstate_is_running() ?
+                                   VFIO_DEVICE_STATE_RUNNING : 0);
+    if (ret) {
+        error_report("%s: Failed to leave the migration state",
+                     vbasedev->name);
+    }
+
+    trace_vfio_migration_state_notifier(vbasedev->name,
+                                        migration->device_state);
+}
+
+static int vfio_migration_init(VFIODevice *vbasedev,
+                               struct vfio_region_info *info)
+{
+    VFIOMigration *migration;
+    int ret;
+
+    if (!vbasedev->ops->vfio_save_config || !vbasedev->ops->vfio_load_config) {
+        error_report("%s: VFIO device doesn't support device state transfer",
+                     vbasedev->name);
+        return -EINVAL;
+    }
+
+    migration = g_new0(VFIOMigration, 1);
+    migration->vbasedev = vbasedev;
+
+    ret = vfio_region_setup(OBJECT(vbasedev->dev), vbasedev,
+                            &migration->region, info->index, "migration");
+    if (ret) {
+        error_report("%s: Failed to setup VFIO migration region %d: %s",
+                     vbasedev->name, info->index, strerror(-ret));
+        goto err;
+    }
+
+    if (!migration->region.size) {
+        error_report("%s: Invalid zero-sized VFIO migration region %d",
+                     vbasedev->name, info->index);
+        ret = -EINVAL;
+        goto err;
+    }
+
+    /* The data area is accessed through the device fd where not mmap'ed */
+    if (vfio_region_mmap(&migration->region)) {
+        warn_report("%s: Failed to mmap VFIO migration region %d, "
+                    "falling back to the slow path", vbasedev->name,
+                    info->index);
+    }
+
+    vbasedev->migration = migration;
+
+    register_savevm_live(vbasedev->dev, "vfio", -1, 1, &savevm_vfio_handlers,
+                         vbasedev);
+    migration->vm_state = qemu_add_vm_change_state_handler(vfio_vmstate_change,
+                                                           vbasedev);
+    migration->migration_state.notify = vfio_migration_state_notifier;
+    add_migration_state_change_notifier(&migration->migration_state);
+    return 0;
+
+err:
+    vfio_region_exit(&migration->region);
+    vfio_region_finalize(&migration->region);
+    g_free(migration);
+    return ret;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int vfio_migration_probe(VFIODevice *vbasedev, Error **errp)
+{
+    VFIOContainer *container = vbasedev->group->container;
+    struct vfio_region_info *info = NULL;
+    Error *local_err = NULL;
+    int ret;
+
+    /* Without dirty page tracking, DMA writes by the device would be lost */
+    if (!container->dirty_pages_supported) {
+        goto add_blocker;
+    }
+
+    ret = vfio_get_dev_region_info(vbasedev, VFIO_REGION_TYPE_MIGRATION,
+                                   VFIO_REGION_SUBTYPE_MIGRATION, &info);
+    if (ret) {
+        goto add_blocker;
+    }
+
+    ret = vfio_migration_init(vbasedev, info);
+    if (ret) {
+        goto add_blocker;
+    }
+
+    trace_vfio_migration_probe(vbasedev->name, info->index);
+    g_free(info);
+    return 0;
+
+add_blocker:
+    error_setg(&vbasedev->migration_blocker,
+               "VFIO device %s doesn't support migration", vbasedev->name);
+    g_free(info);
+
+    ret = migrate_add_blocker(vbasedev->migration_blocker, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        error_free(vbasedev->migration_blocker);
+        vbasedev->migration_blocker = NULL;
+    }
+    return ret;
+}
+
+void vfio_migration_finalize(VFIODevice *vbasedev)
+{
+    VFIOMigration *migration = vbasedev->migration;
+
+    if (migration) {
+        remove_migration_state_change_notifier(&migration->migration_state);
+        qemu_del_vm_change_state_handler(migration->vm_state);
+        unregister_savevm(vbasedev->dev, "vfio", vbasedev);
+        vfio_region_exit(&migration->region);
+        vfio_region_finalize(&migration->region);
+        g_free(migration);
+        vbasedev->migration = NULL;
+    }
+
+    if (vbasedev->migration_blocker) {
+        migrate_del_blocker(vbasedev->migration_blocker);
+        error_free(vbasedev->migration_blocker);
+        vbasedev->migration_blocker = NULL;
+    }
+}
@@ -366,6 +366,8 @@ static void vfio_msi_interrupt(void *opaque)
         return;
     }
 
+    vector->userspace_interrupts++;
+
     if (vdev->interrupt == VFIO_INT_MSIX) {
         get_msg = msix_get_message;
         notify = msix_notify;
@@ -463,8 +465,20 @@ static void vfio_add_kvm_msi_virq(VFIOPCIDevice *vdev, VFIOMSIVector *vector,
 
 static void vfio_remove_kvm_msi_virq(VFIOMSIVector *vector)
 {
-    kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state, &vector->kvm_interrupt,
-                                          vector->virq);
+    if (vector->kvm_masked) {
+        VFIOPCIDevice *vdev = vector->vdev;
+
+        /* The irqfd is already detached, only the pending bit is left */
+        if (event_notifier_test_and_clear(&vector->kvm_interrupt)) {
+            msix_set_pending(&vdev->pdev, vector - vdev->msi_vectors);
+        }
+        vector->kvm_masked = false;
+        vdev->msix->nr_kvm_masked--;
+    } else {
+        kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state,
+                                              &vector->kvm_interrupt,
+                                              vector->virq);
+    }
     kvm_irqchip_release_virq(kvm_state, vector->virq);
     vector->virq = -1;
     event_notifier_cleanup(&vector->kvm_interrupt);
@@ -522,7 +536,21 @@ static int vfio_msix_vector_do_use(PCIDevice *pdev, unsigned int nr,
      * for a device if they're not in use, so we shutdown and incrementally
      * increase them as needed.
      */
-    if (vdev->nr_vectors < nr + 1) {
+    if (vector->kvm_masked) {
+        /*
+         * Unmasking a vector masked in KVM only needs the irqfd back; the
+         * device has been signalling kvm_interrupt all along, and KVM
+         * injects the interrupt right away if it fired while masked.
+         */
+        vector->kvm_masked = false;
+        vdev->msix->nr_kvm_masked--;
+        if (kvm_irqchip_add_irqfd_notifier_gsi(kvm_state,
+                                               &vector->kvm_interrupt,
+                                               NULL, vector->virq) < 0) {
+            error_report("vfio: failed to unmask vector %u in KVM", nr);
+        }
+        trace_vfio_msix_vector_kvm_unmask(vdev->vbasedev.name, nr);
+    } else if (vdev->nr_vectors < nr + 1) {
         vfio_disable_irqindex(&vdev->vbasedev, VFIO_PCI_MSIX_IRQ_INDEX);
         vdev->nr_vectors = nr + 1;
         ret = vfio_enable_vectors(vdev, true);
@@ -560,7 +588,8 @@ static int vfio_msix_vector_do_use(PCIDevice *pdev, unsigned int nr,
 
     /* Disable PBA emulation when nothing more is pending. */
     clear_bit(nr, vdev->msix->pending);
-    if (find_first_bit(vdev->msix->pending,
+    if (!vdev->msix->nr_kvm_masked &&
+        find_first_bit(vdev->msix->pending,
                        vdev->nr_vectors) == vdev->nr_vectors) {
         memory_region_set_enabled(&vdev->pdev.msix_pba_mmio, false);
         trace_vfio_msix_pba_disable(vdev->vbasedev.name);
@@ -582,6 +611,25 @@ static void vfio_msix_vector_release(PCIDevice *pdev, unsigned int nr)
 
     trace_vfio_msix_vector_release(vdev->vbasedev.name, nr);
 
+    /*
+     * Masking in KVM detaches the irqfd and nothing else, so a guest
+     * masking and unmasking a vector costs a KVM_IRQFD call each way
+     * rather than reprogramming the vector in VFIO.  The pending bit is
+     * read back from the eventfd when the guest reads the PBA.
+     */
+    if (vector->virq >= 0 && !vector->kvm_masked &&
+        !vdev->no_kvm_msix_mask) {
+        if (!kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state,
+                                                   &vector->kvm_interrupt,
+                                                   vector->virq)) {
+            vector->kvm_masked = true;
+            vdev->msix->nr_kvm_masked++;
+            memory_region_set_enabled(&vdev->pdev.msix_pba_mmio, true);
+            trace_vfio_msix_vector_kvm_mask(vdev->vbasedev.name, nr);
+            return;
+        }
+    }
+
     /*
      * There are still old guests that mask and unmask vectors on every
      * interrupt.  If we're using QEMU bypass with a KVM irqfd, leave all of
@@ -614,6 +662,27 @@ static void vfio_msix_vector_release(PCIDevice *pdev, unsigned int nr)
     }
 }
 
+static void vfio_msix_vector_poll(PCIDevice *pdev,
+                                  unsigned int vector_start,
+                                  unsigned int vector_end)
+{
+    VFIOPCIDevice *vdev = PCI_VFIO(pdev);
+    unsigned int nr;
+
+    if (!vdev->msix->nr_kvm_masked) {
+        return;
+    }
+
+    for (nr = vector_start; nr < MIN(vector_end, vdev->nr_vectors); nr++) {
+        VFIOMSIVector *vector = &vdev->msi_vectors[nr];
+
+        if (vector->kvm_masked &&
+            event_notifier_test_and_clear(&vector->kvm_interrupt)) {
+            msix_set_pending(pdev, nr);
+        }
+    }
+}
+
 static void vfio_msix_enable(VFIOPCIDevice *vdev)
 {
     vfio_disable_interrupts(vdev);
@@ -639,7 +708,8 @@ static void vfio_msix_enable(VFIOPCIDevice *vdev)
     vfio_msix_vector_release(&vdev->pdev, 0);
 
     if (msix_set_vector_notifiers(&vdev->pdev, vfio_msix_vector_use,
-                                  vfio_msix_vector_release, NULL)) {
+                                  vfio_msix_vector_release,
+                                  vfio_msix_vector_poll)) {
         error_report("vfio: msix_set_vector_notifiers failed");
     }
 
@@ -729,6 +799,10 @@ static void vfio_msi_disable_common(VFIOPCIDevice *vdev)
     for (i = 0; i < vdev->nr_vectors; i++) {
         VFIOMSIVector *vector = &vdev->msi_vectors[i];
         if (vdev->msi_vectors[i].use) {
+            if (vector->userspace_interrupts) {
+                trace_vfio_msi_vector_stats(vdev->vbasedev.name, i,
+                                            vector->userspace_interrupts);
+            }
             if (vector->virq >= 0) {
                 vfio_remove_kvm_msi_virq(vector);
             }
@@ -2434,10 +2508,74 @@ static void vfio_pci_compute_needs_reset(VFIODevice *vbasedev)
     }
 }
 
+static bool vfio_msix_present(void *opaque, int version_id)
+{
+    VFIOPCIDevice *vdev = opaque;
+
+    return msix_present(&vdev->pdev);
+}
+
+static const VMStateDescription vmstate_vfio_pci_config = {
+    .name = "VFIOPCIDevice",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_PCI_DEVICE(pdev, VFIOPCIDevice),
+        VMSTATE_MSIX_TEST(pdev, VFIOPCIDevice, vfio_msix_present),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void vfio_pci_save_config(VFIODevice *vbasedev, QEMUFile *f)
+{
+    VFIOPCIDevice *vdev = container_of(vbasedev, VFIOPCIDevice, vbasedev);
+
+    vmstate_save_state(f, &vmstate_vfio_pci_config, vdev, NULL);
+}
+
+static int vfio_pci_load_config(VFIODevice *vbasedev, QEMUFile *f)
+{
+    VFIOPCIDevice *vdev = container_of(vbasedev, VFIOPCIDevice, vbasedev);
+    PCIDevice *pdev = &vdev->pdev;
+    pcibus_t old_addr[PCI_ROM_SLOT];
+    int bar, ret;
+
+    for (bar = 0; bar < PCI_ROM_SLOT; bar++) {
+        old_addr[bar] = pdev->io_regions[bar].addr;
+    }
+
+    ret = vmstate_load_state(f, &vmstate_vfio_pci_config, vdev, 1);
+    if (ret) {
+        return ret;
+    }
+
+    /* The loaded config space is emulated; push what the device owns */
+    vfio_pci_write_config(pdev, PCI_COMMAND,
+                          pci_get_word(pdev->config + PCI_COMMAND), 2);
+
+    for (bar = 0; bar < PCI_ROM_SLOT; bar++) {
+        if (old_addr[bar] != pdev->io_regions[bar].addr &&
+            vdev->bars[bar].region.size > 0 &&
+            vdev->bars[bar].region.size < qemu_real_host_page_size) {
+            vfio_sub_page_bar_update_mapping(pdev, bar);
+        }
+    }
+
+    if (msi_enabled(pdev)) {
+        vfio_msi_enable(vdev);
+    } else if (msix_enabled(pdev)) {
+        vfio_msix_enable(vdev);
+    }
+
+    return 0;
+}
+
 static VFIODeviceOps vfio_pci_ops = {
     .vfio_compute_needs_reset = vfio_pci_compute_needs_reset,
     .vfio_hot_reset_multi = vfio_pci_hot_reset_multi,
     .vfio_eoi = vfio_intx_eoi,
+    .vfio_save_config = vfio_pci_save_config,
+    .vfio_load_config = vfio_pci_load_config,
 };
 
 int vfio_populate_vga(VFIOPCIDevice *vdev, Error **errp)
@@ -3079,6 +3217,11 @@ static void vfio_realize(PCIDevice *pdev, Error **errp)
         }
     }
 
+    ret = vfio_migration_probe(&vdev->vbasedev, errp);
+    if (ret) {
+        goto out_teardown;
+    }
+
     vfio_register_err_notifier(vdev);
     vfio_register_req_notifier(vdev);
     vfio_setup_resetfn_quirk(vdev);
@@ -3126,6 +3269,7 @@ static void vfio_exitfn(PCIDevice *pdev)
     }
     vfio_teardown_msi(vdev);
     vfio_bars_exit(vdev);
+    vfio_migration_finalize(&vdev->vbasedev);
 }
 
 static void vfio_pci_reset(DeviceState *dev)
@@ -3208,6 +3352,8 @@ static Property vfio_pci_dev_properties[] = {
     DEFINE_PROP_BOOL("x-no-kvm-intx", VFIOPCIDevice, no_kvm_intx, false),
     DEFINE_PROP_BOOL("x-no-kvm-msi", VFIOPCIDevice, no_kvm_msi, false),
     DEFINE_PROP_BOOL("x-no-kvm-msix", VFIOPCIDevice, no_kvm_msix, false),
+    DEFINE_PROP_BOOL("x-no-kvm-msix-mask", VFIOPCIDevice,
+                     no_kvm_msix_mask, false),
     DEFINE_PROP_BOOL("x-no-geforce-quirks", VFIOPCIDevice,
                      no_geforce_quirks, false),
     DEFINE_PROP_BOOL("x-no-kvm-ioeventfd", VFIOPCIDevice, no_kvm_ioeventfd,
@@ -3234,11 +3380,6 @@ static Property vfio_pci_dev_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static const VMStateDescription vfio_pci_vmstate = {
-    .name = "vfio-pci",
-    .unmigratable = 1,
-};
-
 static void vfio_pci_dev_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
@@ -3246,7 +3387,6 @@ static void vfio_pci_dev_class_init(ObjectClass *klass, void *data)
 
     dc->reset = vfio_pci_reset;
     dc->props = vfio_pci_dev_properties;
-    dc->vmsd = &vfio_pci_vmstate;
     dc->desc = "VFIO-based PCI device assignment";
     set_bit(DEVICE_CATEGORY_MISC, dc->categories);
     pdc->realize = vfio_realize;
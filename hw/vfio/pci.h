@@ -89,12 +89,19 @@ typedef struct VFIOMSIVector {
      * but requires masking at the device.  virq is used to track the MSI route
      * through KVM, thus kvm_interrupt is only available when virq is set to a
      * valid (>= 0) value.
+     *
+     * An MSI-X vector masked by the guest while using the KVM path may
+     * instead only have its irqfd detached (kvm_masked).  The device keeps
+     * signalling kvm_interrupt, whose counter then holds the pending bit
+     * until the irqfd is attached again on unmask.
      */
     EventNotifier interrupt;
     EventNotifier kvm_interrupt;
     struct VFIOPCIDevice *vdev; /* back pointer to device */
     int virq;
     bool use;
+    bool kvm_masked;
+    uint64_t userspace_interrupts; /* injected through QEMU */
 } VFIOMSIVector;
 
 enum {
@@ -112,6 +119,7 @@ typedef struct VFIOMSIXInfo {
     uint32_t table_offset;
     uint32_t pba_offset;
     unsigned long *pending;
+    unsigned int nr_kvm_masked;
 } VFIOMSIXInfo;
 
 typedef struct VFIOPCIDevice {
@@ -164,6 +172,7 @@ typedef struct VFIOPCIDevice {
     bool no_kvm_intx;
     bool no_kvm_msi;
     bool no_kvm_msix;
+    bool no_kvm_msix_mask;
     bool no_geforce_quirks;
     bool no_kvm_ioeventfd;
     bool no_vfio_ioeventfd;
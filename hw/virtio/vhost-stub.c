@@ -7,6 +7,11 @@ bool vhost_has_free_slot(void)
     return true;
 }
 
+VhostLogSyncInfoList *vhost_log_sync_info(void)
+{
+    return NULL;
+}
+
 bool vhost_user_init(VhostUserState *user, CharBackend *chr, Error **errp)
 {
     return false;
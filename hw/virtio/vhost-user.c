@@ -35,6 +35,8 @@
 #endif
 
 #define VHOST_MEMORY_MAX_NREGIONS    8
+/* Most memory slots used with VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS */
+#define VHOST_USER_MAX_RAM_SLOTS     512
 #define VHOST_USER_F_PROTOCOL_FEATURES 30
 #define VHOST_USER_SLAVE_MAX_FDS     8
 
@@ -57,10 +59,13 @@ enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD = 10,
     VHOST_USER_PROTOCOL_F_HOST_NOTIFIER = 11,
     VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD = 12,
+    /* 13 and 14 are allocated by the specification but not implemented */
+    VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 15,
     VHOST_USER_PROTOCOL_F_MAX
 };
 
-#define VHOST_USER_PROTOCOL_FEATURE_MASK ((1 << VHOST_USER_PROTOCOL_F_MAX) - 1)
+#define VHOST_USER_PROTOCOL_FEATURE_MASK \
+    (((1 << VHOST_USER_PROTOCOL_F_MAX) - 1) & ~((1 << 13) | (1 << 14)))
 
 typedef enum VhostUserRequest {
     VHOST_USER_NONE = 0,
@@ -96,6 +101,9 @@ typedef enum VhostUserRequest {
     VHOST_USER_POSTCOPY_END     = 30,
     VHOST_USER_GET_INFLIGHT_FD = 31,
     VHOST_USER_SET_INFLIGHT_FD = 32,
+    VHOST_USER_GET_MAX_MEM_SLOTS = 36,
+    VHOST_USER_ADD_MEM_REG = 37,
+    VHOST_USER_REM_MEM_REG = 38,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -104,6 +112,8 @@ typedef enum VhostUserSlaveRequest {
     VHOST_USER_SLAVE_IOTLB_MSG = 1,
     VHOST_USER_SLAVE_CONFIG_CHANGE_MSG = 2,
     VHOST_USER_SLAVE_VRING_HOST_NOTIFIER_MSG = 3,
+    VHOST_USER_SLAVE_FS_MAP = 6,
+    VHOST_USER_SLAVE_FS_UNMAP = 7,
     VHOST_USER_SLAVE_MAX
 }  VhostUserSlaveRequest;
 
@@ -120,6 +130,11 @@ typedef struct VhostUserMemory {
     VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
 } VhostUserMemory;
 
+typedef struct VhostUserMemRegMsg {
+    uint64_t padding;
+    VhostUserMemoryRegion region;
+} VhostUserMemRegMsg;
+
 typedef struct VhostUserLog {
     uint64_t mmap_size;
     uint64_t mmap_offset;
@@ -161,6 +176,22 @@ typedef struct VhostUserInflight {
     uint16_t queue_size;
 } VhostUserInflight;
 
+#define VHOST_USER_FS_SLAVE_ENTRIES 8
+
+/* The slave maps the range for reading and/or writing by the guest */
+#define VHOST_USER_FS_FLAG_MAP_R (1ULL << 0)
+#define VHOST_USER_FS_FLAG_MAP_W (1ULL << 1)
+
+typedef struct VhostUserFSSlaveMsg {
+    /* Offsets within the file passed with the message */
+    uint64_t fd_offset[VHOST_USER_FS_SLAVE_ENTRIES];
+    /* Offsets within the cache window */
+    uint64_t c_offset[VHOST_USER_FS_SLAVE_ENTRIES];
+    /* Lengths of the ranges, unused entries are zero */
+    uint64_t len[VHOST_USER_FS_SLAVE_ENTRIES];
+    uint64_t flags[VHOST_USER_FS_SLAVE_ENTRIES];
+} VhostUserFSSlaveMsg;
+
 typedef struct {
     VhostUserRequest request;
 
@@ -178,12 +209,14 @@ typedef union {
         struct vhost_vring_state state;
         struct vhost_vring_addr addr;
         VhostUserMemory memory;
+        VhostUserMemRegMsg mem_reg;
         VhostUserLog log;
         struct vhost_iotlb_msg iotlb;
         VhostUserConfig config;
         VhostUserCryptoSession session;
         VhostUserVringArea area;
         VhostUserInflight inflight;
+        VhostUserFSSlaveMsg fs;
 } VhostUserPayload;
 
 typedef struct VhostUserMsg {
@@ -218,6 +251,12 @@ struct vhost_user {
 
     /* True once we've entered postcopy_listen */
     bool               postcopy_listen;
+
+    /* Number of memory slots the back-end supports */
+    uint64_t           memory_slots;
+    /* The regions the back-end currently has mapped */
+    VhostUserMemoryRegion shadow_regions[VHOST_USER_MAX_RAM_SLOTS];
+    int                num_shadow_regions;
 };
 
 static bool ioeventfd_enabled(void)
@@ -312,6 +351,8 @@ static bool vhost_user_one_time_request(VhostUserRequest request)
     case VHOST_USER_SET_OWNER:
     case VHOST_USER_RESET_OWNER:
     case VHOST_USER_SET_MEM_TABLE:
+    case VHOST_USER_ADD_MEM_REG:
+    case VHOST_USER_REM_MEM_REG:
     case VHOST_USER_GET_QUEUE_NUM:
     case VHOST_USER_NET_SET_MTU:
         return true;
@@ -408,6 +449,14 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
         .hdr.flags = VHOST_USER_VERSION,
     };
 
+    /* The postcopy reply carries the whole table in a single message */
+    if (dev->mem->nregions > VHOST_MEMORY_MAX_NREGIONS) {
+        error_report("%s: postcopy supports at most %d memory regions, "
+                     "%d in use", __func__, VHOST_MEMORY_MAX_NREGIONS,
+                     dev->mem->nregions);
+        return -1;
+    }
+
     if (u->region_rb_len < dev->mem->nregions) {
         u->region_rb = g_renew(RAMBlock*, u->region_rb, dev->mem->nregions);
         u->region_rb_offset = g_renew(ram_addr_t, u->region_rb_offset,
@@ -516,6 +565,11 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
      * because now we're in the position to be able to deal with any faults
      * it generates.
      */
+    /* The back-end replaced its whole table */
+    memcpy(u->shadow_regions, msg.payload.memory.regions,
+           fd_num * sizeof(VhostUserMemoryRegion));
+    u->num_shadow_regions = fd_num;
+
     /* TODO: Use this for failure cases as well with a bad value */
     msg.hdr.size = sizeof(msg.payload.u64);
     msg.payload.u64 = 0; /* OK */
@@ -526,6 +580,188 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
     return 0;
 }
 
+/*
+ * Collect the regions of dev->mem that the back-end can map, i.e. the
+ * ones backed by a file descriptor.  Returns the number of regions.
+ */
+static int vhost_user_fill_mem_regions(struct vhost_dev *dev,
+                                       VhostUserMemoryRegion *regions,
+                                       int *fds)
+{
+    int i, fd, fd_num = 0;
+
+    for (i = 0; i < dev->mem->nregions; ++i) {
+        struct vhost_memory_region *reg = dev->mem->regions + i;
+        ram_addr_t offset;
+        MemoryRegion *mr;
+
+        assert((uintptr_t)reg->userspace_addr == reg->userspace_addr);
+        mr = memory_region_from_host((void *)(uintptr_t)reg->userspace_addr,
+                                     &offset);
+        fd = memory_region_get_fd(mr);
+        if (fd > 0) {
+            regions[fd_num].userspace_addr = reg->userspace_addr;
+            regions[fd_num].memory_size = reg->memory_size;
+            regions[fd_num].guest_phys_addr = reg->guest_phys_addr;
+            regions[fd_num].mmap_offset = offset;
+            fds[fd_num++] = fd;
+        }
+    }
+
+    return fd_num;
+}
+
+static bool vhost_user_mem_region_equal(const VhostUserMemoryRegion *a,
+                                        const VhostUserMemoryRegion *b)
+{
+    return a->guest_phys_addr == b->guest_phys_addr &&
+           a->memory_size == b->memory_size &&
+           a->userspace_addr == b->userspace_addr &&
+           a->mmap_offset == b->mmap_offset;
+}
+
+static int vhost_user_send_mem_reg(struct vhost_dev *dev,
+                                   VhostUserRequest request,
+                                   const VhostUserMemoryRegion *reg, int fd,
+                                   bool reply_supported,
+                                   VhostUserRequest *pending, int *num_pending)
+{
+    VhostUserMsg msg = {
+        .hdr.request = request,
+        .hdr.flags = VHOST_USER_VERSION,
+        .payload.mem_reg.region = *reg,
+        .hdr.size = sizeof(msg.payload.mem_reg),
+    };
+
+    if (reply_supported) {
+        msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
+    }
+
+    if (vhost_user_write(dev, &msg, fd < 0 ? NULL : &fd, fd < 0 ? 0 : 1) < 0) {
+        return -1;
+    }
+
+    if (msg.hdr.flags & VHOST_USER_NEED_REPLY_MASK) {
+        pending[(*num_pending)++] = request;
+    }
+
+    return 0;
+}
+
+/*
+ * With VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS only the regions that
+ * changed since the last update are sent, instead of the whole table.
+ */
+static int vhost_user_add_remove_regions(struct vhost_dev *dev,
+                                         bool reply_supported)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserMemoryRegion *regions;
+    VhostUserRequest *pending;
+    VhostUserMsg msg_reply;
+    int *fds;
+    int i, j, fd_num, num_pending = 0;
+    int ret = -1;
+
+    if (dev->vq_index != 0) {
+        /* The memory table is shared by all the queue pairs */
+        return 0;
+    }
+
+    regions = g_new0(VhostUserMemoryRegion, dev->mem->nregions);
+    fds = g_new(int, dev->mem->nregions);
+    pending = g_new(VhostUserRequest,
+                    u->num_shadow_regions + dev->mem->nregions);
+
+    fd_num = vhost_user_fill_mem_regions(dev, regions, fds);
+    if (!fd_num) {
+        error_report("Failed initializing vhost-user memory map, "
+                     "consider using -object memory-backend-file share=on");
+        goto out;
+    }
+    if (fd_num > u->memory_slots) {
+        error_report("vhost-user back-end supports %" PRIu64 " memory "
+                     "slots, %d needed", u->memory_slots, fd_num);
+        goto out;
+    }
+
+    /* Drop the regions that went away first, so that their slots are free */
+    for (i = 0; i < u->num_shadow_regions; ) {
+        for (j = 0; j < fd_num; j++) {
+            if (vhost_user_mem_region_equal(&u->shadow_regions[i],
+                                            &regions[j])) {
+                break;
+            }
+        }
+        if (j < fd_num) {
+            i++;
+            continue;
+        }
+
+        trace_vhost_user_rem_mem_reg(u->shadow_regions[i].guest_phys_addr,
+                                     u->shadow_regions[i].memory_size);
+        if (vhost_user_send_mem_reg(dev, VHOST_USER_REM_MEM_REG,
+                                    &u->shadow_regions[i], -1,
+                                    reply_supported,
+                                    pending, &num_pending) < 0) {
+            goto out;
+        }
+        u->shadow_regions[i] = u->shadow_regions[--u->num_shadow_regions];
+    }
+
+    for (j = 0; j < fd_num; j++) {
+        for (i = 0; i < u->num_shadow_regions; i++) {
+            if (vhost_user_mem_region_equal(&u->shadow_regions[i],
+                                            &regions[j])) {
+                break;
+            }
+        }
+        if (i < u->num_shadow_regions) {
+            continue;
+        }
+
+        trace_vhost_user_add_mem_reg(regions[j].guest_phys_addr,
+                                     regions[j].memory_size,
+                                     regions[j].userspace_addr,
+                                     regions[j].mmap_offset);
+        if (vhost_user_send_mem_reg(dev, VHOST_USER_ADD_MEM_REG,
+                                    &regions[j], fds[j], reply_supported,
+                                    pending, &num_pending) < 0) {
+            goto out;
+        }
+        u->shadow_regions[u->num_shadow_regions++] = regions[j];
+    }
+
+    /*
+     * The back-end answers in order, so the acks are only collected
+     * once the whole batch is written; it then works through all the
+     * updates without waiting for a round trip per region.
+     */
+    for (i = 0; i < num_pending; i++) {
+        if (vhost_user_read(dev, &msg_reply) < 0) {
+            goto out;
+        }
+        if (msg_reply.hdr.request != pending[i]) {
+            error_report("Received unexpected msg type."
+                         "Expected %d received %d",
+                         pending[i], msg_reply.hdr.request);
+            goto out;
+        }
+        if (msg_reply.payload.u64) {
+            error_report("vhost-user back-end failed memory region "
+                         "update %d", i);
+            goto out;
+        }
+    }
+
+    ret = 0;
+out:
+    g_free(pending);
+    g_free(fds);
+    g_free(regions);
+    return ret;
+}
+
 static int vhost_user_set_mem_table(struct vhost_dev *dev,
                                     struct vhost_memory *mem)
 {
@@ -544,6 +780,11 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
         return vhost_user_set_mem_table_postcopy(dev, mem);
     }
 
+    if (virtio_has_feature(dev->protocol_features,
+                           VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
+        return vhost_user_add_remove_regions(dev, reply_supported);
+    }
+
     VhostUserMsg msg = {
         .hdr.request = VHOST_USER_SET_MEM_TABLE,
         .hdr.flags = VHOST_USER_VERSION,
@@ -964,6 +1205,95 @@ static int vhost_user_slave_handle_vring_host_notifier(struct vhost_dev *dev,
     return 0;
 }
 
+static bool vhost_user_fs_range_valid(VhostUserState *user,
+                                      uint64_t offset, uint64_t len)
+{
+    return user->cache_addr && offset + len >= offset &&
+           offset + len <= user->cache_size &&
+           QEMU_IS_ALIGNED(offset | len, qemu_real_host_page_size);
+}
+
+static int vhost_user_slave_handle_fs_map(struct vhost_dev *dev,
+                                          VhostUserFSSlaveMsg *sm, int fd)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserState *user = u->user;
+    int i;
+
+    if (fd < 0) {
+        error_report("vhost-user-fs: map request without a file descriptor");
+        return -1;
+    }
+
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES; i++) {
+        int prot = 0;
+        void *ptr;
+
+        if (!sm->len[i]) {
+            continue;
+        }
+        if (!vhost_user_fs_range_valid(user, sm->c_offset[i], sm->len[i])) {
+            error_report("vhost-user-fs: bad map range 0x%" PRIx64
+                         "+0x%" PRIx64, sm->c_offset[i], sm->len[i]);
+            return -1;
+        }
+
+        if (sm->flags[i] & VHOST_USER_FS_FLAG_MAP_R) {
+            prot |= PROT_READ;
+        }
+        if (sm->flags[i] & VHOST_USER_FS_FLAG_MAP_W) {
+            prot |= PROT_WRITE;
+        }
+
+        ptr = mmap((uint8_t *)user->cache_addr + sm->c_offset[i], sm->len[i],
+                   prot, MAP_SHARED | MAP_FIXED, fd, sm->fd_offset[i]);
+        if (ptr == MAP_FAILED) {
+            error_report("vhost-user-fs: map failed: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int vhost_user_slave_handle_fs_unmap(struct vhost_dev *dev,
+                                            VhostUserFSSlaveMsg *sm)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserState *user = u->user;
+    int i;
+
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES; i++) {
+        uint64_t offset = sm->c_offset[i];
+        uint64_t len = sm->len[i];
+        void *ptr;
+
+        if (!len) {
+            continue;
+        }
+        /* All ones stands for the whole window */
+        if (len == ~(uint64_t)0) {
+            offset = 0;
+            len = user->cache_size;
+        }
+        if (!vhost_user_fs_range_valid(user, offset, len)) {
+            error_report("vhost-user-fs: bad unmap range 0x%" PRIx64
+                         "+0x%" PRIx64, offset, len);
+            return -1;
+        }
+
+        /* Leave an inaccessible hole rather than give the range back */
+        ptr = mmap((uint8_t *)user->cache_addr + offset, len, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if (ptr == MAP_FAILED) {
+            error_report("vhost-user-fs: unmap failed: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 static void slave_read(void *opaque)
 {
     struct vhost_dev *dev = opaque;
@@ -1042,6 +1372,12 @@ static void slave_read(void *opaque)
         ret = vhost_user_slave_handle_vring_host_notifier(dev, &payload.area,
                                                           fd[0]);
         break;
+    case VHOST_USER_SLAVE_FS_MAP:
+        ret = vhost_user_slave_handle_fs_map(dev, &payload.fs, fd[0]);
+        break;
+    case VHOST_USER_SLAVE_FS_UNMAP:
+        ret = vhost_user_slave_handle_fs_unmap(dev, &payload.fs);
+        break;
     default:
         error_report("Received unexpected msg type.");
         ret = -EINVAL;
@@ -1378,6 +1714,7 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque)
     u->user = opaque;
     u->slave_fd = -1;
     u->dev = dev;
+    u->memory_slots = VHOST_MEMORY_MAX_NREGIONS;
     dev->opaque = u;
 
     err = vhost_user_get_features(dev, &features);
@@ -1421,6 +1758,22 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque)
             }
         }
 
+        if (virtio_has_feature(dev->protocol_features,
+                               VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
+            uint64_t ram_slots;
+
+            err = vhost_user_get_u64(dev, VHOST_USER_GET_MAX_MEM_SLOTS,
+                                     &ram_slots);
+            if (err < 0) {
+                return err;
+            }
+            if (!ram_slots) {
+                error_report("vhost-user back-end reports no memory slots");
+                return -1;
+            }
+            u->memory_slots = MIN(ram_slots, VHOST_USER_MAX_RAM_SLOTS);
+        }
+
         if (virtio_has_feature(features, VIRTIO_F_IOMMU_PLATFORM) &&
                 !(virtio_has_feature(dev->protocol_features,
                     VHOST_USER_PROTOCOL_F_SLAVE_REQ) &&
@@ -1493,7 +1846,9 @@ static int vhost_user_get_vq_index(struct vhost_dev *dev, int idx)
 
 static int vhost_user_memslots_limit(struct vhost_dev *dev)
 {
-    return VHOST_MEMORY_MAX_NREGIONS;
+    struct vhost_user *u = dev->opaque;
+
+    return u->memory_slots;
 }
 
 static bool vhost_user_requires_shm_log(struct vhost_dev *dev)
@@ -21,6 +21,8 @@
 #include "qemu/range.h"
 #include "qemu/error-report.h"
 #include "qemu/memfd.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
 #include "standard-headers/linux/vhost_types.h"
 #include "exec/address-spaces.h"
 #include "hw/virtio/virtio-bus.h"
@@ -60,6 +62,9 @@ bool vhost_has_free_slot(void)
     return slots_limit > used_memslots;
 }
 
+/* Number of log chunks tested for dirty bits at once */
+#define VHOST_LOG_SCAN_CHUNKS 64
+
 static void vhost_dev_sync_region(struct vhost_dev *dev,
                                   MemoryRegionSection *section,
                                   uint64_t mfirst, uint64_t mlast,
@@ -79,29 +84,42 @@ static void vhost_dev_sync_region(struct vhost_dev *dev,
     assert(end / VHOST_LOG_CHUNK < dev->log_size);
     assert(start / VHOST_LOG_CHUNK < dev->log_size);
 
-    for (;from < to; ++from) {
-        vhost_log_chunk_t log;
-        /* We first check with non-atomic: much cheaper,
-         * and we expect non-dirty to be the common case. */
-        if (!*from) {
-            addr += VHOST_LOG_CHUNK;
+    while (from < to) {
+        size_t n = MIN(to - from, VHOST_LOG_SCAN_CHUNKS);
+
+        /* Most of the log is clean, so skip whole blocks of it with the
+         * vectorized zero test before looking at single chunks.  Like
+         * the per-chunk test below this read need not be atomic. */
+        if (buffer_is_zero(from, n * sizeof(*from))) {
+            from += n;
+            addr += n * VHOST_LOG_CHUNK;
             continue;
         }
-        /* Data must be read atomically. We don't really need barrier semantics
-         * but it's easier to use atomic_* than roll our own. */
-        log = atomic_xchg(from, 0);
-        while (log) {
-            int bit = ctzl(log);
-            hwaddr page_addr;
-            hwaddr section_offset;
-            hwaddr mr_offset;
-            page_addr = addr + bit * VHOST_LOG_PAGE;
-            section_offset = page_addr - section->offset_within_address_space;
-            mr_offset = section_offset + section->offset_within_region;
-            memory_region_set_dirty(section->mr, mr_offset, VHOST_LOG_PAGE);
-            log &= ~(0x1ull << bit);
+
+        for (; n; n--, from++, addr += VHOST_LOG_CHUNK) {
+            vhost_log_chunk_t log;
+            /* We first check with non-atomic: much cheaper,
+             * and we expect non-dirty to be the common case. */
+            if (!*from) {
+                continue;
+            }
+            /* Data must be read atomically. We don't really need barrier
+             * semantics but it's easier to use atomic_* than roll our own. */
+            log = atomic_xchg(from, 0);
+            while (log) {
+                int bit = ctzl(log);
+                hwaddr page_addr;
+                hwaddr section_offset;
+                hwaddr mr_offset;
+                page_addr = addr + bit * VHOST_LOG_PAGE;
+                section_offset = page_addr -
+                                 section->offset_within_address_space;
+                mr_offset = section_offset + section->offset_within_region;
+                memory_region_set_dirty(section->mr, mr_offset,
+                                        VHOST_LOG_PAGE);
+                log &= ~(0x1ull << bit);
+            }
         }
-        addr += VHOST_LOG_CHUNK;
     }
 }
 
@@ -142,7 +160,32 @@ static void vhost_log_sync(MemoryListener *listener,
 {
     struct vhost_dev *dev = container_of(listener, struct vhost_dev,
                                          memory_listener);
+    int64_t start = get_clock();
+
     vhost_sync_dirty_bitmap(dev, section, 0x0, ~0x0ULL);
+    dev->log_sync_ns += get_clock() - start;
+}
+
+VhostLogSyncInfoList *vhost_log_sync_info(void)
+{
+    VhostLogSyncInfoList *head = NULL, **tail = &head;
+    struct vhost_dev *hdev;
+
+    QLIST_FOREACH(hdev, &vhost_devices, entry) {
+        VhostLogSyncInfoList *entry;
+
+        if (!hdev->started || !hdev->vdev) {
+            continue;
+        }
+        entry = g_new0(VhostLogSyncInfoList, 1);
+        entry->value = g_new0(VhostLogSyncInfo, 1);
+        entry->value->device = object_get_canonical_path(OBJECT(hdev->vdev));
+        entry->value->vq_index = hdev->vq_index;
+        entry->value->time = hdev->log_sync_ns / SCALE_US;
+        *tail = entry;
+        tail = &entry->next;
+    }
+    return head;
 }
 
 static void vhost_log_sync_range(struct vhost_dev *dev,
@@ -807,8 +850,11 @@ static int vhost_migration_log(MemoryListener *listener, int enable)
 
 static void vhost_log_global_start(MemoryListener *listener)
 {
+    struct vhost_dev *dev = container_of(listener, struct vhost_dev,
+                                         memory_listener);
     int r;
 
+    dev->log_sync_ns = 0;
     r = vhost_migration_log(listener, true);
     if (r < 0) {
         abort();
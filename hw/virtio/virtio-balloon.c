@@ -40,42 +40,34 @@ struct PartiallyBalloonedPage {
     unsigned long bitmap[];
 };
 
-static void balloon_inflate_page(VirtIOBalloon *balloon,
-                                 MemoryRegion *mr, hwaddr offset)
-{
-    void *addr = memory_region_get_ram_ptr(mr) + offset;
+/*
+ * A run of contiguous balloon pages within one RAMBlock.  PFNs are
+ * accumulated into runs across queue elements, so that a single
+ * ram_block_discard_range() or madvise() covers e.g. a whole 2MiB
+ * transparent huge page, which the kernel can then drop without
+ * splitting it.
+ */
+typedef struct BalloonRange {
     RAMBlock *rb;
-    size_t rb_page_size;
-    int subpages;
-    ram_addr_t ram_offset, host_page_base;
-
-    /* XXX is there a better way to get to the RAMBlock than via a
-     * host address? */
-    rb = qemu_ram_block_from_host(addr, false, &ram_offset);
-    rb_page_size = qemu_ram_pagesize(rb);
-    host_page_base = ram_offset & ~(rb_page_size - 1);
+    void *host;
+    ram_addr_t start;
+    ram_addr_t end;
+} BalloonRange;
 
-    if (rb_page_size == BALLOON_PAGE_SIZE) {
-        /* Easy case */
-
-        ram_block_discard_range(rb, ram_offset, rb_page_size);
-        /* We ignore errors from ram_block_discard_range(), because it
-         * has already reported them, and failing to discard a balloon
-         * page is not fatal */
-        return;
-    }
+/*
+ * Balloon part of a host page.  We need to keep track until we have a
+ * whole host page to discard.
+ */
+static void balloon_inflate_subpages(VirtIOBalloon *balloon, RAMBlock *rb,
+                                     ram_addr_t ram_offset, size_t len)
+{
+    size_t rb_page_size = qemu_ram_pagesize(rb);
+    ram_addr_t host_page_base = ram_offset & ~(rb_page_size - 1);
+    int subpages = rb_page_size / BALLOON_PAGE_SIZE;
 
-    /* Hard case
-     *
-     * We've put a piece of a larger host page into the balloon - we
-     * need to keep track until we have a whole host page to
-     * discard
-     */
     warn_report_once(
 "Balloon used with backing page size > 4kiB, this may not be reliable");
 
-    subpages = rb_page_size / BALLOON_PAGE_SIZE;
-
     if (balloon->pbp
         && (rb != balloon->pbp->rb
             || host_page_base != balloon->pbp->base)) {
@@ -96,7 +88,7 @@ static void balloon_inflate_page(VirtIOBalloon *balloon,
 
     bitmap_set(balloon->pbp->bitmap,
                (ram_offset - balloon->pbp->base) / BALLOON_PAGE_SIZE,
-               subpages);
+               len / BALLOON_PAGE_SIZE);
 
     if (bitmap_full(balloon->pbp->bitmap, subpages)) {
         /* We've accumulated a full host page, we can actually discard
@@ -112,26 +104,52 @@ static void balloon_inflate_page(VirtIOBalloon *balloon,
     }
 }
 
-static void balloon_deflate_page(VirtIOBalloon *balloon,
-                                 MemoryRegion *mr, hwaddr offset)
+static void balloon_inflate_range(VirtIOBalloon *balloon, BalloonRange *range)
 {
-    void *addr = memory_region_get_ram_ptr(mr) + offset;
-    RAMBlock *rb;
-    size_t rb_page_size;
-    ram_addr_t ram_offset, host_page_base;
-    void *host_addr;
-    int ret;
+    size_t rb_page_size = qemu_ram_pagesize(range->rb);
+    ram_addr_t head = QEMU_ALIGN_UP(range->start, rb_page_size);
+    ram_addr_t tail = QEMU_ALIGN_DOWN(range->end, rb_page_size);
 
-    /* XXX is there a better way to get to the RAMBlock than via a
-     * host address? */
-    rb = qemu_ram_block_from_host(addr, false, &ram_offset);
-    rb_page_size = qemu_ram_pagesize(rb);
-    host_page_base = ram_offset & ~(rb_page_size - 1);
+    if (rb_page_size == BALLOON_PAGE_SIZE) {
+        /* Easy case */
+        head = range->start;
+        tail = range->end;
+    } else if (head >= range->end) {
+        /* The range lies within a single host page */
+        balloon_inflate_subpages(balloon, range->rb, range->start,
+                                 range->end - range->start);
+        return;
+    }
+
+    if (range->start < head) {
+        balloon_inflate_subpages(balloon, range->rb, range->start,
+                                 head - range->start);
+    }
+    if (head < tail) {
+        ram_block_discard_range(range->rb, head, tail - head);
+        /* We ignore errors from ram_block_discard_range(), because it
+         * has already reported them, and failing to discard a balloon
+         * page is not fatal */
+    }
+    if (tail < range->end && tail >= head) {
+        balloon_inflate_subpages(balloon, range->rb, tail,
+                                 range->end - tail);
+    }
+}
+
+static void balloon_deflate_range(VirtIOBalloon *balloon, BalloonRange *range)
+{
+    size_t rb_page_size = qemu_ram_pagesize(range->rb);
+    uintptr_t host_start, host_end;
+    int ret;
 
     if (balloon->pbp
-        && rb == balloon->pbp->rb
-        && host_page_base == balloon->pbp->base) {
+        && range->rb == balloon->pbp->rb
+        && range->start < balloon->pbp->base + rb_page_size
+        && range->end > balloon->pbp->base) {
         int subpages = rb_page_size / BALLOON_PAGE_SIZE;
+        ram_addr_t start = MAX(range->start, balloon->pbp->base);
+        ram_addr_t end = MIN(range->end, balloon->pbp->base + rb_page_size);
 
         /*
          * This means the guest has asked to discard some of the 4kiB
@@ -141,8 +159,8 @@ static void balloon_deflate_page(VirtIOBalloon *balloon,
          * since getting it wrong could mean discarding memory the
          * guest is still using. */
         bitmap_clear(balloon->pbp->bitmap,
-                     (ram_offset - balloon->pbp->base) / BALLOON_PAGE_SIZE,
-                     subpages);
+                     (start - balloon->pbp->base) / BALLOON_PAGE_SIZE,
+                     (end - start) / BALLOON_PAGE_SIZE);
 
         if (bitmap_empty(balloon->pbp->bitmap, subpages)) {
             g_free(balloon->pbp);
@@ -150,11 +168,13 @@ static void balloon_deflate_page(VirtIOBalloon *balloon,
         }
     }
 
-    host_addr = (void *)((uintptr_t)addr & ~(rb_page_size - 1));
-
-    /* When a page is deflated, we hint the whole host page it lives
+    /* When pages are deflated, we hint the whole host pages they live
      * on, since we can't do anything smaller */
-    ret = qemu_madvise(host_addr, rb_page_size, QEMU_MADV_WILLNEED);
+    host_start = QEMU_ALIGN_DOWN((uintptr_t)range->host, rb_page_size);
+    host_end = QEMU_ALIGN_UP((uintptr_t)range->host +
+                             (range->end - range->start), rb_page_size);
+    ret = qemu_madvise((void *)host_start, host_end - host_start,
+                       QEMU_MADV_WILLNEED);
     if (ret != 0) {
         warn_report("Couldn't MADV_WILLNEED on balloon deflate: %s",
                     strerror(errno));
@@ -162,6 +182,43 @@ static void balloon_deflate_page(VirtIOBalloon *balloon,
     }
 }
 
+static void balloon_range_flush(VirtIOBalloon *balloon, BalloonRange *range,
+                                bool inflate)
+{
+    if (!range->rb) {
+        return;
+    }
+    if (inflate) {
+        balloon_inflate_range(balloon, range);
+    } else {
+        balloon_deflate_range(balloon, range);
+    }
+    range->rb = NULL;
+}
+
+static void balloon_range_add(VirtIOBalloon *balloon, BalloonRange *range,
+                              MemoryRegion *mr, hwaddr offset, bool inflate)
+{
+    void *addr = memory_region_get_ram_ptr(mr) + offset;
+    ram_addr_t ram_offset;
+    RAMBlock *rb;
+
+    /* XXX is there a better way to get to the RAMBlock than via a
+     * host address? */
+    rb = qemu_ram_block_from_host(addr, false, &ram_offset);
+
+    if (range->rb == rb && range->end == ram_offset) {
+        range->end += BALLOON_PAGE_SIZE;
+        return;
+    }
+
+    balloon_range_flush(balloon, range, inflate);
+    range->rb = rb;
+    range->host = addr;
+    range->start = ram_offset;
+    range->end = ram_offset + BALLOON_PAGE_SIZE;
+}
+
 static const char *balloon_stat_names[] = {
    [VIRTIO_BALLOON_S_SWAP_IN] = "stat-swap-in",
    [VIRTIO_BALLOON_S_SWAP_OUT] = "stat-swap-out",
@@ -333,13 +390,17 @@ static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
     VirtQueueElement *elem;
     MemoryRegionSection section;
+    BalloonRange range = { NULL };
+    bool inflate = vq == s->ivq;
+    bool pushed = false;
 
+    g_assert(vq == s->ivq || vq == s->dvq);
     for (;;) {
         size_t offset = 0;
         uint32_t pfn;
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
         while (iov_to_buf(elem->out_sg, elem->out_num, offset, &pfn, 4) == 4) {
@@ -366,21 +427,126 @@ static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
             trace_virtio_balloon_handle_output(memory_region_name(section.mr),
                                                pa);
             if (!qemu_balloon_is_inhibited()) {
-                if (vq == s->ivq) {
-                    balloon_inflate_page(s, section.mr,
-                                         section.offset_within_region);
-                } else if (vq == s->dvq) {
-                    balloon_deflate_page(s, section.mr, section.offset_within_region);
-                } else {
-                    g_assert_not_reached();
-                }
+                balloon_range_add(s, &range, section.mr,
+                                  section.offset_within_region, inflate);
             }
             memory_region_unref(section.mr);
         }
 
         virtqueue_push(vq, elem, offset);
-        virtio_notify(vdev, vq);
         g_free(elem);
+        pushed = true;
+    }
+
+    /*
+     * Inflated pages are not touched by the guest after they have been
+     * pushed back, so the last run can be handled after the guest has
+     * been told about it.  Deflated pages are only hinted.
+     */
+    balloon_range_flush(s, &range, inflate);
+    if (pushed) {
+        virtio_notify(vdev, vq);
+    }
+}
+
+/*
+ * Free page reports are batched: up to REPORT_BATCH_ELEMS elements are
+ * popped before any of them is returned, so that adjacent reported ranges
+ * can be discarded with a single, large ram_block_discard_range() and the
+ * guest is notified once per batch.  Ranges must be discarded before the
+ * elements are pushed back, as the guest may reuse the pages afterwards.
+ */
+#define REPORT_BATCH_ELEMS 16
+
+typedef struct BalloonReportRange {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t end;
+} BalloonReportRange;
+
+static void balloon_report_flush(BalloonReportRange *range)
+{
+    size_t rb_page_size;
+    ram_addr_t start, end;
+
+    if (!range->rb) {
+        return;
+    }
+
+    /*
+     * Only discard whole host pages, so that huge pages are not split
+     * and ram_block_discard_range() does not fail on hugetlbfs.
+     */
+    rb_page_size = qemu_ram_pagesize(range->rb);
+    start = QEMU_ALIGN_UP(range->start, rb_page_size);
+    end = QEMU_ALIGN_DOWN(range->end, rb_page_size);
+    if (start < end) {
+        trace_virtio_balloon_handle_report(qemu_ram_get_idstr(range->rb),
+                                           start, end - start);
+        ram_block_discard_range(range->rb, start, end - start);
+        /* Errors have been reported already, and are not fatal */
+    }
+    range->rb = NULL;
+}
+
+static void balloon_report_add(BalloonReportRange *range,
+                               void *addr, size_t len)
+{
+    ram_addr_t offset;
+    RAMBlock *rb;
+
+    rb = qemu_ram_block_from_host(addr, false, &offset);
+    if (!rb) {
+        return;
+    }
+
+    if (range->rb == rb && range->end == offset) {
+        range->end += len;
+        return;
+    }
+
+    balloon_report_flush(range);
+    range->rb = rb;
+    range->start = offset;
+    range->end = offset + len;
+}
+
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtQueueElement *batch[REPORT_BATCH_ELEMS];
+    BalloonReportRange range = { NULL };
+    bool done = false;
+
+    while (!done) {
+        unsigned int n, i, j;
+
+        for (n = 0; n < REPORT_BATCH_ELEMS; n++) {
+            VirtQueueElement *elem = virtqueue_pop(vq,
+                                                   sizeof(VirtQueueElement));
+            if (!elem) {
+                done = true;
+                break;
+            }
+
+            batch[n] = elem;
+            if (qemu_balloon_is_inhibited()) {
+                continue;
+            }
+            for (j = 0; j < elem->in_num; j++) {
+                balloon_report_add(&range, elem->in_sg[j].iov_base,
+                                   elem->in_sg[j].iov_len);
+            }
+        }
+        if (!n) {
+            break;
+        }
+
+        balloon_report_flush(&range);
+        for (i = 0; i < n; i++) {
+            virtqueue_push(vq, batch[i], 0);
+            g_free(batch[i]);
+        }
+        virtio_notify(vdev, vq);
     }
 }
 
@@ -804,6 +970,11 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
             virtio_error(vdev, "iothread is missing");
         }
     }
+
+    if (virtio_has_feature(s->host_features, VIRTIO_BALLOON_F_REPORTING)) {
+        s->reporting_vq = virtio_add_queue(vdev, 32,
+                                           virtio_balloon_handle_report);
+    }
     reset_stats(s);
 }
 
@@ -897,6 +1068,8 @@ static Property virtio_balloon_properties[] = {
                     VIRTIO_BALLOON_F_DEFLATE_ON_OOM, false),
     DEFINE_PROP_BIT("free-page-hint", VirtIOBalloon, host_features,
                     VIRTIO_BALLOON_F_FREE_PAGE_HINT, false),
+    DEFINE_PROP_BIT("free-page-reporting", VirtIOBalloon, host_features,
+                    VIRTIO_BALLOON_F_REPORTING, false),
     DEFINE_PROP_LINK("iothread", VirtIOBalloon, iothread, TYPE_IOTHREAD,
                      IOThread *),
     DEFINE_PROP_END_OF_LIST(),
@@ -175,6 +175,13 @@ static inline void virtio_pci_disable_modern(VirtIOPCIProxy *proxy)
     proxy->disable_modern = true;
 }
 
+/*
+ * Describe a shared memory region of the device, @length bytes at @offset
+ * in @bar, to the driver.  @id tells regions of the same device apart.
+ */
+int virtio_pci_add_shm_cap(VirtIOPCIProxy *proxy, uint8_t bar,
+                           uint64_t offset, uint64_t length, uint8_t id);
+
 /*
  * virtio-input-pci: This extends VirtioPCIProxy.
  */
@@ -233,6 +240,7 @@ typedef struct VirtioPCIDeviceTypeInfo {
     size_t class_size;
     void (*instance_init)(Object *obj);
     void (*class_init)(ObjectClass *klass, void *data);
+    InterfaceInfo *interfaces;
 } VirtioPCIDeviceTypeInfo;
 
 /* Register virtio-pci type(s).  @t must be static. */
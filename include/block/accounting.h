@@ -32,13 +32,26 @@
 typedef struct BlockAcctTimedStats BlockAcctTimedStats;
 typedef struct BlockAcctStats BlockAcctStats;
 
+/* Number of buckets of the internal latency histograms: four per power
+ * of two microseconds, up to 2^31 us */
+#define BLOCK_ACCT_LATENCY_BUCKETS 128
+
 enum BlockAcctType {
     BLOCK_ACCT_READ,
     BLOCK_ACCT_WRITE,
     BLOCK_ACCT_FLUSH,
+    BLOCK_ACCT_UNMAP,
     BLOCK_MAX_IOTYPE,
 };
 
+/* Stages of the requests of a device model, as seen by the guest */
+enum BlockAcctStage {
+    BLOCK_ACCT_STAGE_QUEUE,     /* received -> submitted to the block layer */
+    BLOCK_ACCT_STAGE_DEVICE,    /* received -> completed to the guest */
+    BLOCK_ACCT_STAGE_NOTIFY,    /* completed -> guest notified */
+    BLOCK_MAX_STAGE,
+};
+
 struct BlockAcctTimedStats {
     BlockAcctStats *stats;
     TimedAverage latency[BLOCK_MAX_IOTYPE];
@@ -85,10 +98,16 @@ struct BlockAcctStats {
     uint64_t total_time_ns[BLOCK_MAX_IOTYPE];
     uint64_t merged[BLOCK_MAX_IOTYPE];
     int64_t last_access_time_ns;
+    /* When any of the counters last changed, for incremental queries */
+    int64_t last_update_ns;
     QSLIST_HEAD(, BlockAcctTimedStats) intervals;
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    /* Always enabled, for latency percentiles */
+    uint64_t latency_buckets[BLOCK_MAX_IOTYPE][BLOCK_ACCT_LATENCY_BUCKETS];
+    /* Filled by the device models that account the stages of requests */
+    uint64_t stage_buckets[BLOCK_MAX_STAGE][BLOCK_ACCT_LATENCY_BUCKETS];
 };
 
 typedef struct BlockAcctCookie {
@@ -112,10 +131,22 @@ void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type);
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
                            int num_requests);
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
+int64_t block_acct_last_update_ns(BlockAcctStats *stats);
+int64_t block_acct_time_ns(void);
+void block_acct_stage_done(BlockAcctStats *stats, enum BlockAcctStage stage,
+                           int64_t start_ns, int64_t end_ns);
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
                               enum BlockAcctType type);
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
+void block_acct_get_latency_buckets(BlockAcctStats *stats,
+                                    enum BlockAcctType type,
+                                    uint64_t *buckets);
+void block_acct_get_stage_buckets(BlockAcctStats *stats,
+                                  enum BlockAcctStage stage,
+                                  uint64_t *buckets);
+int64_t block_acct_latency_percentile(const uint64_t *buckets,
+                                      unsigned permille);
 
 #endif
@@ -116,6 +116,8 @@ struct AioContext {
      * Has its own locking.
      */
     struct ThreadPool *thread_pool;
+    int64_t thread_pool_min;    /* worker threads kept even when idle */
+    int64_t thread_pool_max;    /* maximum number of worker threads */
 
 #ifdef CONFIG_LINUX_AIO
     /* State for native Linux AIO.  Uses aio_context_acquire/release for
@@ -123,6 +125,13 @@ struct AioContext {
      */
     struct LinuxAioState *linux_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * State for Linux io_uring.  Uses aio_context_acquire/release for
+     * locking.
+     */
+    struct LuringState *linux_io_uring;
+#endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
      * locking.
@@ -140,6 +149,14 @@ struct AioContext {
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
 
+    /*
+     * Time spent busy polling and running handlers, the latter only
+     * accounted while polling is enabled.  Only written by the thread
+     * running the context.
+     */
+    int64_t poll_time_ns;
+    int64_t dispatch_time_ns;
+
     /* Are we in polling mode or monitoring file descriptors? */
     bool poll_started;
 
@@ -186,7 +203,9 @@ void aio_context_unref(AioContext *ctx);
  * Bottom halves, timers and callbacks can be created or removed without
  * acquiring the AioContext.
  */
-void aio_context_acquire(AioContext *ctx);
+void aio_context_acquire_impl(AioContext *ctx, const char *file, int line);
+#define aio_context_acquire(ctx) \
+        aio_context_acquire_impl(ctx, __FILE__, __LINE__)
 
 /* Relinquish ownership of the AioContext. */
 void aio_context_release(AioContext *ctx);
@@ -387,6 +406,12 @@ struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
+/* Setup the LuringState bound to this AioContext */
+struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+
+/* Return the LuringState bound to this AioContext */
+struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -623,4 +648,16 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_thread_pool_params:
+ * @ctx: the aio context
+ * @min: minimum number of worker threads, kept alive even when idle
+ * @max: maximum number of worker threads
+ *
+ * Applies to the context's thread pool, whether it has already been
+ * created or not.
+ */
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, Error **errp);
+
 #endif
@@ -88,6 +88,15 @@ typedef enum {
      * fallback. */
     BDRV_REQ_NO_FALLBACK        = 0x100,
 
+    /*
+     * Priority class of a request to a BlockBackend, for the scheduler of
+     * its node (see blk_set_io_priority()).  They are not passed to the
+     * node, and are not part of BDRV_REQ_MASK.  Requests with neither
+     * have the class of their BlockBackend.
+     */
+    BDRV_REQ_PRIO_HIGH          = 0x200,
+    BDRV_REQ_PRIO_LOW           = 0x400,
+
     /* Mask of valid flags */
     BDRV_REQ_MASK               = 0x1ff,
 } BdrvRequestFlags;
@@ -121,6 +130,7 @@ typedef struct HDGeometry {
                                       ignoring the format layer */
 #define BDRV_O_NO_IO       0x10000 /* don't initialize for I/O */
 #define BDRV_O_AUTO_RDONLY 0x20000 /* degrade to read-only if opening read-write fails */
+#define BDRV_O_IO_URING    0x40000 /* use io_uring instead of the thread pool */
 
 #define BDRV_O_CACHE_MASK  (BDRV_O_NOCACHE | BDRV_O_NO_FLUSH)
 
@@ -384,7 +394,12 @@ typedef enum {
     BDRV_FIX_ERRORS   = 2,
 } BdrvCheckMode;
 
-int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix);
+/* The units of offset and total_work_size may be chosen arbitrarily by the
+ * block driver; total_work_size may change during the course of the check */
+typedef void BlockDriverCheckStatusCB(BlockDriverState *bs, int64_t offset,
+                                      int64_t total_work_size, void *opaque);
+int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix,
+               BlockDriverCheckStatusCB *status_cb, void *cb_opaque);
 
 /* The units of offset and total_work_size may be chosen arbitrarily by the
  * block driver; total_work_size may change during the course of the amendment
@@ -32,6 +32,7 @@
 #include "qemu/stats64.h"
 #include "qemu/timer.h"
 #include "qemu/hbitmap.h"
+#include "qemu/interval-tree.h"
 #include "block/snapshot.h"
 #include "qemu/main-loop.h"
 #include "qemu/throttle.h"
@@ -58,6 +59,7 @@
 #define BLOCK_OPT_REFCOUNT_BITS     "refcount_bits"
 #define BLOCK_OPT_DATA_FILE         "data_file"
 #define BLOCK_OPT_DATA_FILE_RAW     "data_file_raw"
+#define BLOCK_OPT_JOURNAL_SIZE      "journal_size"
 
 #define BLOCK_PROBE_BUF_SIZE        512
 
@@ -68,6 +70,20 @@ enum BdrvTrackedRequestType {
     BDRV_TRACKED_TRUNCATE,
 };
 
+/*
+ * The last data extent reported by a protocol driver's block status.
+ * Scanning a file then costs one driver query per extent instead of
+ * one per call, e.g. one lseek(SEEK_DATA/SEEK_HOLE) pair with
+ * file-posix.  Only data is cached: reporting data where there is a
+ * hole is always correct, just less precise, so a racing fill is
+ * harmless.
+ */
+typedef struct BdrvBlockStatusCache {
+    bool valid;
+    int64_t data_start;
+    int64_t data_end;
+} BdrvBlockStatusCache;
+
 typedef struct BdrvTrackedRequest {
     BlockDriverState *bs;
     int64_t offset;
@@ -79,6 +95,8 @@ typedef struct BdrvTrackedRequest {
     uint64_t overlap_bytes;
 
     QLIST_ENTRY(BdrvTrackedRequest) list;
+    /* [overlap_offset, overlap_offset + overlap_bytes) in bs->tracked_tree */
+    IntervalTreeNode overlap_node;
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
 
@@ -398,7 +416,9 @@ struct BlockDriver {
      */
     int coroutine_fn (*bdrv_co_check)(BlockDriverState *bs,
                                       BdrvCheckResult *result,
-                                      BdrvCheckMode fix);
+                                      BdrvCheckMode fix,
+                                      BlockDriverCheckStatusCB *status_cb,
+                                      void *cb_opaque);
 
     int (*bdrv_amend_options)(BlockDriverState *bs, QemuOpts *opts,
                               BlockDriverAmendStatusCB *status_cb,
@@ -850,6 +870,14 @@ struct BlockDriverState {
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
+    /* See BdrvBlockStatusCache; protected by the AioContext lock */
+    BdrvBlockStatusCache block_status_cache;
+
+    /* Times a request waited for an overlapping serialising one, and
+     * the total time spent waiting */
+    Stat64 serialising_waits;
+    Stat64 serialising_wait_ns;
+
     /* If true, copy read backing sectors into image.  Can be >1 if more
      * than one client has requested copy-on-read.  Accessed with atomic
      * ops.
@@ -862,6 +890,10 @@ struct BlockDriverState {
     unsigned int in_flight;
     unsigned int serialising_in_flight;
 
+    /* Scheduler of the requests of the BlockBackends on this node, see
+     * blk_set_io_priority(); NULL until they use priority classes. */
+    struct BlockSched *sched;
+
     /* counter for nested bdrv_io_plug.
      * Accessed with atomic ops.
     */
@@ -879,6 +911,8 @@ struct BlockDriverState {
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
+    /* The same requests, by overlap range */
+    IntervalTreeRoot tracked_tree;
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
@@ -926,6 +960,7 @@ int coroutine_fn bdrv_co_pwritev(BdrvChild *child,
     BdrvRequestFlags flags);
 
 extern unsigned int bdrv_drain_all_count;
+extern unsigned int bdrv_in_flight_total;
 void bdrv_apply_subtree_drain(BdrvChild *child, BlockDriverState *new_parent);
 void bdrv_unapply_subtree_drain(BdrvChild *child, BlockDriverState *old_parent);
 
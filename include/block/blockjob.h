@@ -28,6 +28,7 @@
 
 #include "qemu/job.h"
 #include "block/block.h"
+#include "block/accounting.h"
 #include "qemu/ratelimit.h"
 
 #define BLOCK_JOB_SLICE_TIME 100000000ULL /* ns */
@@ -55,6 +56,22 @@ typedef struct BlockJob {
     /** Rate limiting data structure for implementing @speed. */
     RateLimit limit;
 
+    /**
+     * Guest latency target set with @block_job_set_latency_target, in ns,
+     * or 0 if none.
+     */
+    int64_t latency_target_ns;
+
+    /** Speed currently used to meet @latency_target_ns, at most @speed. */
+    int64_t latency_speed;
+
+    /** Guest BlockBackends whose latency is checked against the target. */
+    GSList *latency_blks;
+
+    /** Summed latency histograms of @latency_blks at the last check. */
+    uint64_t latency_buckets[BLOCK_ACCT_LATENCY_BUCKETS];
+    int64_t latency_check_ns;
+
     /** Block other operations when block job is running */
     Error *blocker;
 
@@ -132,6 +149,20 @@ void block_job_remove_all_bdrv(BlockJob *job);
  */
 void block_job_set_speed(BlockJob *job, int64_t speed, Error **errp);
 
+/**
+ * block_job_set_latency_target:
+ * @job: The job to set the latency target for.
+ * @target_us: The 99th percentile of guest request latency, in
+ * microseconds, that the job should try to keep, or 0 to disable.
+ * @errp: Error object.
+ *
+ * Let the job adjust its rate limit to the latency of the guest devices
+ * that use the job's node.  The speed set with block_job_set_speed()
+ * remains the upper limit.
+ */
+void block_job_set_latency_target(BlockJob *job, int64_t target_us,
+                                  Error **errp);
+
 /**
  * block_job_query:
  * @job: The job to get information about.
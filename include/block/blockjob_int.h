@@ -63,6 +63,12 @@ struct BlockJobDriver {
      * stuff.
      */
     void (*drain)(BlockJob *job);
+
+    /*
+     * If the callback is not NULL, it is called by block_job_query() to
+     * add information specific to the job type to @info.
+     */
+    void (*query)(BlockJob *job, BlockJobInfo *info);
 };
 
 /**
@@ -139,6 +139,7 @@ typedef struct NBDExtent {
 #define NBD_FLAG_CAN_MULTI_CONN    (1 << 8) /* Multi-client cache consistent */
 #define NBD_FLAG_SEND_RESIZE       (1 << 9) /* Send resize */
 #define NBD_FLAG_SEND_CACHE        (1 << 10) /* Send CACHE (prefetch) */
+#define NBD_FLAG_SEND_FAST_ZERO    (1 << 11) /* Send FAST_ZERO */
 
 /* New-style handshake (global) flags, sent from server to client, and
    control what will happen during handshake phase. */
@@ -191,6 +192,7 @@ typedef struct NBDExtent {
 #define NBD_CMD_FLAG_DF         (1 << 2) /* don't fragment structured read */
 #define NBD_CMD_FLAG_REQ_ONE    (1 << 3) /* only one extent in BLOCK_STATUS
                                           * reply chunk */
+#define NBD_CMD_FLAG_FAST_ZERO  (1 << 4) /* fail if WRITE_ZEROES is not fast */
 
 /* Supported request types */
 enum {
@@ -256,6 +258,7 @@ static inline bool nbd_reply_type_is_error(int type)
 #define NBD_EINVAL     22
 #define NBD_ENOSPC     28
 #define NBD_EOVERFLOW  75
+#define NBD_ENOTSUP    95
 #define NBD_ESHUTDOWN  108
 
 /* Details collected by NBD_OPT_EXPORT_NAME and NBD_OPT_GO */
@@ -56,11 +56,19 @@ typedef struct ThrottleGroupMember {
     unsigned       pending_reqs[2];
     QLIST_ENTRY(ThrottleGroupMember) round_robin;
 
+    /* Number of requests this member may send in a row when it gets its
+     * round-robin turn; 0 means 1.  rr_credit is what is left of the
+     * current turn. */
+    unsigned       shares;
+    unsigned       rr_credit[2];
+
 } ThrottleGroupMember;
 
 #define TYPE_THROTTLE_GROUP "throttle-group"
 #define THROTTLE_GROUP(obj) OBJECT_CHECK(ThrottleGroup, (obj), TYPE_THROTTLE_GROUP)
 
+#define THROTTLE_GROUP_MAX_SHARES 1000
+
 const char *throttle_group_get_name(ThrottleGroupMember *tgm);
 
 ThrottleState *throttle_group_incref(const char *name);
@@ -74,6 +82,7 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
                                 AioContext *ctx);
 void throttle_group_unregister_tgm(ThrottleGroupMember *tgm);
 void throttle_group_restart_tgm(ThrottleGroupMember *tgm);
+void throttle_group_set_shares(ThrottleGroupMember *tgm, unsigned shares);
 
 void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm,
                                                         unsigned int bytes,
@@ -319,4 +319,32 @@ int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
  */
 char *qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess);
 
+typedef enum {
+    QCRYPTO_TLS_OFFLOAD_READ = 1 << 0,
+    QCRYPTO_TLS_OFFLOAD_WRITE = 1 << 1,
+} QCryptoTLSSessionOffload;
+
+/**
+ * qcrypto_tls_session_offload:
+ * @sess: the TLS session object
+ * @fd: the TCP socket carrying the session
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Hand the keys of a session whose handshake is complete
+ * over to the kernel, so that records are encrypted and
+ * decrypted by the TCP socket @fd itself.  This requires
+ * Linux kernel TLS support, TLS 1.2 and an AES-GCM cipher.
+ *
+ * For each direction that is offloaded, payload data must
+ * from then on be read from or written to @fd directly,
+ * and not through qcrypto_tls_session_read() or
+ * qcrypto_tls_session_write().
+ *
+ * Returns: a mask of QCryptoTLSSessionOffload flags, or
+ * -1 if neither direction could be offloaded
+ */
+int qcrypto_tls_session_offload(QCryptoTLSSession *sess,
+                                int fd,
+                                Error **errp);
+
 #endif /* QCRYPTO_TLSSESSION_H */
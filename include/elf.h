@@ -1661,6 +1661,9 @@ typedef struct elf64_shdr {
  */
 #define XEN_ELFNOTE_PHYS32_ENTRY    18  /* 0x12 */
 
+/* Notes with the "GNU" name */
+#define NT_GNU_BUILD_ID 3
+
 /* Note header in a PT_NOTE section */
 typedef struct elf32_note {
   Elf32_Word	n_namesz;	/* Name size */
@@ -259,6 +259,8 @@ int walk_memory_regions(void *, walk_memory_regions_fn);
 
 int page_get_flags(target_ulong address);
 void page_set_flags(target_ulong start, target_ulong end, int flags);
+bool page_range_busy(target_ulong start, target_ulong last,
+                     target_ulong *vma_start);
 int page_check_range(target_ulong start, target_ulong len, int flags);
 #endif
 
@@ -81,6 +81,8 @@ void qemu_ram_set_uf_zeroable(RAMBlock *rb);
 bool qemu_ram_is_migratable(RAMBlock *rb);
 void qemu_ram_set_migratable(RAMBlock *rb);
 void qemu_ram_unset_migratable(RAMBlock *rb);
+bool qemu_ram_is_image(RAMBlock *rb);
+void qemu_ram_unset_image(RAMBlock *rb);
 
 size_t qemu_ram_pagesize(RAMBlock *block);
 size_t qemu_ram_pagesize_largest(void);
@@ -102,8 +104,6 @@ void *cpu_physical_memory_map(hwaddr addr,
                               int is_write);
 void cpu_physical_memory_unmap(void *buffer, hwaddr len,
                                int is_write, hwaddr access_len);
-void cpu_register_map_client(QEMUBH *bh);
-void cpu_unregister_map_client(QEMUBH *bh);
 
 bool cpu_physical_memory_is_io(hwaddr phys_addr);
 
@@ -113,6 +113,7 @@ bool cpu_physical_memory_is_io(hwaddr phys_addr);
  * virtualization.
  */
 void qemu_flush_coalesced_mmio_buffer(void);
+bool qemu_coalesced_mmio_pending(void);
 
 void cpu_flush_icache_range(hwaddr start, hwaddr len);
 
@@ -58,8 +58,15 @@ typedef uint64_t target_ulong;
 #endif
 
 #if !defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
-/* use a fully associative victim tlb of 8 entries */
-#define CPU_VTLB_SIZE 8
+/*
+ * use a fully associative victim tlb, of 8 entries unless overridden
+ * with -accel tcg,vtlb-size=n
+ */
+#define CPU_VTLB_SIZE_DEFAULT 8
+#define CPU_VTLB_SIZE_MAX 256
+
+/* Number of large pages remembered per MMU mode, see CPUTLBLargePage */
+#define CPU_TLB_LARGE_SIZE 4
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -139,6 +146,26 @@ typedef struct CPUTLBWindow {
     size_t max_entries;
 } CPUTLBWindow;
 
+/**
+ * struct CPUTLBLargePage
+ * @vaddr: virtual address of the start of the page
+ * @size: size of the page, or 0 if the entry is unused
+ * @paddr: physical address of the start of the page
+ * @attrs: memory transaction attributes of the page
+ * @prot: protection flags of the page
+ *
+ * A page larger than TARGET_PAGE_SIZE, as passed to tlb_set_page_with_attrs().
+ * Misses on other target pages within it are filled from here rather than
+ * through tlb_fill(), until the MMU mode is flushed.
+ */
+typedef struct CPUTLBLargePage {
+    target_ulong vaddr;
+    target_ulong size;
+    hwaddr paddr;
+    MemTxAttrs attrs;
+    int prot;
+} CPUTLBLargePage;
+
 typedef struct CPUTLBDesc {
     /*
      * Describe a region covering all of the large pages allocated
@@ -152,6 +179,18 @@ typedef struct CPUTLBDesc {
     size_t vindex;
     CPUTLBWindow window;
     size_t n_used_entries;
+    /* Recently added large pages, and the next index to use in them.  */
+    CPUTLBLargePage large[CPU_TLB_LARGE_SIZE];
+    size_t lindex;
+    /*
+     * Statistics, as for CPUTLBCommon: flushes of this MMU mode, and
+     * misses in the main tlb that were resolved from the victim tlb,
+     * from a large page, or by tlb_fill().
+     */
+    size_t flush_count;
+    size_t victim_hit_count;
+    size_t large_hit_count;
+    size_t fill_count;
 } CPUTLBDesc;
 
 /*
@@ -192,9 +231,10 @@ typedef struct CPUTLBCommon {
     CPUTLBCommon tlb_c;                                                 \
     CPUTLBDesc tlb_d[NB_MMU_MODES];                                     \
     CPU_TLB                                                             \
-    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    /* tlb_v_table[i] and iotlb_v[i] have cpu_vtlb_size entries */     \
+    CPUTLBEntry *tlb_v_table[NB_MMU_MODES];                             \
     CPU_IOTLB                                                           \
-    CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];
+    CPUIOTLBEntry *iotlb_v[NB_MMU_MODES];
 
 #else
 
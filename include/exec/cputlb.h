@@ -24,5 +24,10 @@
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code(ram_addr_t ram_addr);
 void tlb_flush_counts(size_t *full, size_t *part, size_t *elide);
+void tlb_mmu_idx_counts(int mmu_idx, size_t *flush, size_t *victim_hit,
+                        size_t *large_hit, size_t *fill);
+
+/* Number of victim tlb entries per MMU mode, set before any CPU is created */
+extern unsigned int cpu_vtlb_size;
 #endif
 #endif
@@ -7,6 +7,37 @@
 
 static TCGOp *icount_start_insn;
 
+/*
+ * Count the executions of the TB.  When the count reaches the
+ * threshold, the TB is queued for retranslation and an exit is
+ * requested, so that cpu_exec() gets to retranslate it before the next
+ * TB runs.
+ */
+static inline void gen_tb_count(TranslationBlock *tb)
+{
+    TCGLabel *not_hot = gen_new_label();
+    TCGv_ptr ptr = tcg_const_ptr(tb);
+    TCGv_i32 count = tcg_temp_new_i32();
+
+    tcg_gen_ld_i32(count, ptr, offsetof(TranslationBlock, exec_count));
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, offsetof(TranslationBlock, exec_count));
+    tcg_gen_brcondi_i32(TCG_COND_NE, count, tcg_hot_tb_threshold, not_hot);
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i32(count);
+
+    /* Temps don't live across the branch */
+    ptr = tcg_const_ptr(tb);
+    tcg_gen_st_ptr(ptr, cpu_env, -ENV_OFFSET + offsetof(CPUState, hot_tb));
+    tcg_temp_free_ptr(ptr);
+    count = tcg_const_i32(-1);
+    tcg_gen_st16_i32(count, cpu_env,
+                     -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.high));
+    tcg_temp_free_i32(count);
+
+    gen_set_label(not_hot);
+}
+
 static inline void gen_tb_start(TranslationBlock *tb)
 {
     TCGv_i32 count, imm;
@@ -41,6 +72,10 @@ static inline void gen_tb_start(TranslationBlock *tb)
     }
 
     tcg_temp_free_i32(count);
+
+    if (tcg_hot_tb_threshold && !(tb_cflags(tb) & (CF_HOT | CF_NOCACHE))) {
+        gen_tb_count(tb);
+    }
 }
 
 static inline void gen_tb_end(TranslationBlock *tb, int num_insns)
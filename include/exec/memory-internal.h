@@ -21,9 +21,18 @@
 #define MEMORY_INTERNAL_H
 
 #ifndef CONFIG_USER_ONLY
+AddressSpaceDispatch *flatview_build_dispatch(FlatView *fv);
+
+/*
+ * The dispatch tree of a FlatView is only built the first time it is
+ * needed, so that views which are replaced before anybody looks up an
+ * address in them never pay for it.
+ */
 static inline AddressSpaceDispatch *flatview_to_dispatch(FlatView *fv)
 {
-    return fv->dispatch;
+    AddressSpaceDispatch *d = atomic_rcu_read(&fv->dispatch);
+
+    return d ? d : flatview_build_dispatch(fv);
 }
 
 static inline AddressSpaceDispatch *address_space_to_dispatch(AddressSpace *as)
@@ -32,6 +41,9 @@ static inline AddressSpaceDispatch *address_space_to_dispatch(AddressSpace *as)
 }
 
 FlatView *address_space_get_flatview(AddressSpace *as);
+
+/* Bumped whenever an address space switches to a different FlatView */
+extern unsigned int flatview_generation;
 void flatview_unref(FlatView *view);
 
 extern const MemoryRegionOps unassigned_mem_ops;
@@ -40,7 +52,8 @@ bool memory_region_access_valid(MemoryRegion *mr, hwaddr addr,
                                 unsigned size, bool is_write,
                                 MemTxAttrs attrs);
 
-void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section);
+void flatview_add_to_dispatch(AddressSpaceDispatch *d, FlatView *fv,
+                              MemoryRegionSection *section);
 AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv);
 void address_space_dispatch_compact(AddressSpaceDispatch *d);
 void address_space_dispatch_free(AddressSpaceDispatch *d);
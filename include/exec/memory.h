@@ -25,6 +25,7 @@
 #include "qemu/notify.h"
 #include "qom/object.h"
 #include "qemu/rcu.h"
+#include "qemu/thread.h"
 #include "hw/qdev-core.h"
 
 #define RAM_ADDR_INVALID (~(ram_addr_t)0)
@@ -126,6 +127,13 @@ typedef struct IOMMUNotifier IOMMUNotifier;
 /* RAM is a persistent kind memory */
 #define RAM_PMEM (1 << 5)
 
+/*
+ * RAM is a private mapping of a file that holds a saved image of its
+ * contents, which migration with x-ignore-shared does not transfer again.
+ * Cleared once the guest runs and the contents diverge from the file.
+ */
+#define RAM_IMAGE (1 << 6)
+
 static inline void iommu_notifier_init(IOMMUNotifier *n, IOMMUNotify fn,
                                        IOMMUNotifierFlag flags,
                                        hwaddr start, hwaddr end,
@@ -414,6 +422,19 @@ struct MemoryListener {
     void (*log_stop)(MemoryListener *listener, MemoryRegionSection *section,
                      int old, int new);
     void (*log_sync)(MemoryListener *listener, MemoryRegionSection *section);
+    /*
+     * Alternative to @log_sync for listeners that cannot sync a single
+     * section; it is called once per dirty log sync and must sync the
+     * whole address space.  Only one of the two may be set.
+     */
+    void (*log_sync_global)(MemoryListener *listener);
+    /*
+     * Called before the dirty bits of @section are cleared in QEMU's
+     * bitmaps, so that listeners which only report dirty pages until
+     * told otherwise (e.g. KVM with manual dirty log protection) can
+     * resume tracking them.
+     */
+    void (*log_clear)(MemoryListener *listener, MemoryRegionSection *section);
     void (*log_global_start)(MemoryListener *listener);
     void (*log_global_stop)(MemoryListener *listener);
     void (*eventfd_add)(MemoryListener *listener, MemoryRegionSection *section,
@@ -434,6 +455,9 @@ struct MemoryListener {
 /**
  * AddressSpace: describes a mapping of addresses to #MemoryRegion objects
  */
+/* Bounce buffer space of an AddressSpace, one page as it always was */
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE 4096
+
 struct AddressSpace {
     /* All fields are private. */
     struct rcu_head rcu;
@@ -447,6 +471,13 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /* Bounce buffers of address_space_map(), and who waits for them */
+    QemuMutex bounce_lock;
+    size_t bounce_buffer_size;
+    size_t max_bounce_buffer_size;
+    QLIST_HEAD(, BounceBuffer) bounce_buffers;
+    QLIST_HEAD(, MapClient) map_client_list;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -647,6 +678,7 @@ void memory_region_init_resizeable_ram(MemoryRegion *mr,
  * @ram_flags: Memory region features:
  *             - RAM_SHARED: memory must be mmaped with the MAP_SHARED flag
  *             - RAM_PMEM: the memory is persistent memory
+ *             - RAM_IMAGE: the file at @path holds the initial contents
  *             Other bits are ignored now.
  * @path: the path in which to allocate the RAM.
  * @errp: pointer to Error*, to store an error if it happens.
@@ -1329,6 +1361,22 @@ bool memory_region_snapshot_get_dirty(MemoryRegion *mr,
                                       DirtyBitmapSnapshot *snap,
                                       hwaddr addr, hwaddr size);
 
+/**
+ * memory_region_clear_dirty_bitmap: clear dirty bitmap for memory range
+ *
+ * This function is called when the caller wants to clear the remote
+ * dirty bitmap of a memory range within the memory region.  This can
+ * be used by e.g. KVM to manually clear dirty log when
+ * KVM_CAP_MANUAL_DIRTY_LOG_PROTECT is declared support by the host
+ * kernel.
+ *
+ * @mr:     the memory region to clear the dirty log upon
+ * @start:  start address offset within the memory region
+ * @len:    length of the memory region to clear dirty bitmap
+ */
+void memory_region_clear_dirty_bitmap(MemoryRegion *mr, hwaddr start,
+                                      hwaddr len);
+
 /**
  * memory_region_reset_dirty: Mark a range of pages as clean, for a specified
  *                            client.
@@ -1793,6 +1841,27 @@ MemTxResult address_space_rw(AddressSpace *as, hwaddr addr,
                              MemTxAttrs attrs, uint8_t *buf,
                              hwaddr len, bool is_write);
 
+/**
+ * address_space_mmio_rw: read from or write to an address space on
+ * behalf of a vCPU's MMIO exit.
+ *
+ * Same as address_space_rw(), but the translation of @addr is looked
+ * up in a small per-vCPU cache first, so that accesses to hot device
+ * registers skip the dispatch tree walk.  Must be called from the
+ * thread running @cpu.
+ *
+ * @cpu: the vCPU performing the access
+ * @as: #AddressSpace to be accessed
+ * @addr: address within that address space
+ * @attrs: memory transaction attributes
+ * @buf: buffer with the data transferred
+ * @len: the number of bytes to read or write
+ * @is_write: indicates the transfer direction
+ */
+MemTxResult address_space_mmio_rw(CPUState *cpu, AddressSpace *as,
+                                  hwaddr addr, MemTxAttrs attrs,
+                                  uint8_t *buf, hwaddr len, bool is_write);
+
 /**
  * address_space_write: write to address space.
  *
@@ -2043,8 +2112,12 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, hwaddr len,
  * May map a subset of the requested range, given by and returned in @plen.
  * May return %NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
+ *
+ * Non-RAM regions are mapped through bounce buffers, of which up to
+ * @as->max_bounce_buffer_size bytes (%DEFAULT_MAX_BOUNCE_BUFFER_SIZE
+ * unless the owner of @as changes it) can be in use at the same time.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -2069,6 +2142,23 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len);
 
+/* address_space_register_map_client: wait for address_space_map() on @as
+ *
+ * Schedule @bh once bounce buffers of @as are available again, which may
+ * be right away.  @bh is only scheduled once.
+ *
+ * @as: #AddressSpace whose address_space_map() failed
+ * @bh: bottom half to schedule
+ */
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh);
+
+/* address_space_unregister_map_client: stop waiting for address_space_map()
+ *
+ * @as: #AddressSpace passed to address_space_register_map_client()
+ * @bh: bottom half passed to address_space_register_map_client()
+ */
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh);
+
 
 /* Internal functions, part of the implementation of address_space_read.  */
 MemTxResult address_space_read_full(AddressSpace *as, hwaddr addr,
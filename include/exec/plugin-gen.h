@@ -0,0 +1,57 @@
+/*
+ * Instrumentation of translated code for TCG plugins
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_PLUGIN_GEN_H
+#define QEMU_PLUGIN_GEN_H
+
+#include "qemu/plugin.h"
+#include "tcg/tcg.h"
+
+struct DisasContextBase;
+
+/* Set for the memory info of stores, on top of the TCGMemOp */
+#define PLUGIN_MEMINFO_STORE (1 << 16)
+
+#ifdef CONFIG_PLUGIN
+
+/*
+ * Called by translator_loop(); the plugins see the block once all of it
+ * is translated, and the code for the callbacks they register is then
+ * put at the start of the instructions they are for.
+ */
+bool plugin_gen_tb_start(CPUState *cpu, const TranslationBlock *tb);
+void plugin_gen_insn_start(CPUState *cpu, const struct DisasContextBase *db);
+void plugin_gen_insn_end(CPUState *cpu, const struct DisasContextBase *db);
+void plugin_gen_tb_end(CPUState *cpu);
+
+/* Called by tcg-op.c after the guest memory access op it just emitted */
+void plugin_gen_mem_access(TCGv vaddr, uint32_t info);
+
+#else /* !CONFIG_PLUGIN */
+
+static inline bool plugin_gen_tb_start(CPUState *cpu,
+                                       const TranslationBlock *tb)
+{
+    return false;
+}
+
+static inline void plugin_gen_insn_start(CPUState *cpu,
+                                         const struct DisasContextBase *db)
+{
+}
+
+static inline void plugin_gen_insn_end(CPUState *cpu,
+                                       const struct DisasContextBase *db)
+{
+}
+
+static inline void plugin_gen_tb_end(CPUState *cpu)
+{
+}
+
+#endif /* CONFIG_PLUGIN */
+
+#endif /* QEMU_PLUGIN_GEN_H */
@@ -141,4 +141,18 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
 void translator_loop_temp_check(DisasContextBase *db);
 
+/**
+ * translator_trace_jump:
+ * @db: Disassembly context.
+ * @dest: Virtual address of the target of a direct jump.
+ *
+ * Return true if the frontend may go on translating at @dest instead of
+ * ending the TB with a jump there.  Only hot (CF_HOT) TBs are built this
+ * way, into a trace of the blocks that the jumps link, and only for
+ * forward jumps within the first page of the TB, so that the code
+ * between @pc_first and @pc_next still covers all the translated
+ * instructions.
+ */
+bool translator_trace_jump(DisasContextBase *db, target_ulong dest);
+
 #endif  /* EXEC__TRANSLATOR_H */
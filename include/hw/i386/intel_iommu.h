@@ -63,6 +63,7 @@ typedef struct VTDContextCacheEntry VTDContextCacheEntry;
 typedef struct IntelIOMMUState IntelIOMMUState;
 typedef struct VTDAddressSpace VTDAddressSpace;
 typedef struct VTDIOTLBEntry VTDIOTLBEntry;
+typedef struct VTDIOTLBDomain VTDIOTLBDomain;
 typedef struct VTDBus VTDBus;
 typedef union VTD_IR_TableEntry VTD_IR_TableEntry;
 typedef union VTD_IR_MSIAddress VTD_IR_MSIAddress;
@@ -122,11 +123,21 @@ struct VTDBus {
 };
 
 struct VTDIOTLBEntry {
+    uint64_t key;                   /* Key in IntelIOMMUState.iotlb */
     uint64_t gfn;
     uint16_t domain_id;
     uint64_t slpte;
     uint64_t mask;
     uint8_t access_flags;
+    VTDIOTLBDomain *domain;
+    QLIST_ENTRY(VTDIOTLBEntry) domain_link;
+    QTAILQ_ENTRY(VTDIOTLBEntry) lru_link;
+};
+
+/* The IOTLB entries of a domain, so that invalidations only visit those */
+struct VTDIOTLBDomain {
+    uint16_t domain_id;
+    QLIST_HEAD(, VTDIOTLBEntry) entries;
 };
 
 /* VT-d Source-ID Qualifier types */
@@ -255,6 +266,9 @@ struct IntelIOMMUState {
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
     GHashTable *iotlb;              /* IOTLB */
+    GHashTable *iotlb_domains;      /* VTDIOTLBDomain by domain ID */
+    QTAILQ_HEAD(, VTDIOTLBEntry) iotlb_lru; /* Least recently used first */
+    uint32_t iotlb_size;            /* Max number of IOTLB entries */
 
     GHashTable *vtd_as_by_busptr;   /* VTDBus objects indexed by PCIBus* reference */
     VTDBus *vtd_as_by_bus_num[VTD_PCI_BUS_MAX]; /* VTDBus objects indexed by bus number */
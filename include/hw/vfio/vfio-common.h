@@ -75,6 +75,11 @@ typedef struct VFIOContainer {
     int error;
     bool initialized;
     unsigned long pgsizes;
+    /* Host dirty page tracking, from the Type1 migration capability */
+    bool dirty_pages_supported;
+    bool dirty_tracking;
+    uint64_t dirty_pgsizes;
+    uint64_t max_dirty_bitmap_size;
     /*
      * This assumes the host IOMMU can support only a single
      * contiguous IOVA window.  We may need to generalize that in
@@ -84,6 +89,15 @@ typedef struct VFIOContainer {
     QLIST_HEAD(, VFIOHostDMAWindow) hostwin_list;
     QLIST_HEAD(, VFIOGroup) group_list;
     QLIST_ENTRY(VFIOContainer) next;
+    /*
+     * RAM mappings queued while the memory listener is registered, to be
+     * issued in parallel; NULL once the container is set up.
+     */
+    GArray *dma_map_pending;
+    /* Statistics on the RAM mappings done by the memory listener */
+    uint64_t dma_map_count;
+    uint64_t dma_map_bytes;
+    int64_t dma_map_ns;
 } VFIOContainer;
 
 typedef struct VFIOGuestIOMMU {
@@ -102,6 +116,7 @@ typedef struct VFIOHostDMAWindow {
 } VFIOHostDMAWindow;
 
 typedef struct VFIODeviceOps VFIODeviceOps;
+typedef struct VFIOMigration VFIOMigration;
 
 typedef struct VFIODevice {
     QLIST_ENTRY(VFIODevice) next;
@@ -119,12 +134,16 @@ typedef struct VFIODevice {
     unsigned int num_irqs;
     unsigned int num_regions;
     unsigned int flags;
+    VFIOMigration *migration;
+    Error *migration_blocker;
 } VFIODevice;
 
 struct VFIODeviceOps {
     void (*vfio_compute_needs_reset)(VFIODevice *vdev);
     int (*vfio_hot_reset_multi)(VFIODevice *vdev);
     void (*vfio_eoi)(VFIODevice *vdev);
+    void (*vfio_save_config)(VFIODevice *vdev, QEMUFile *f);
+    int (*vfio_load_config)(VFIODevice *vdev, QEMUFile *f);
 };
 
 typedef struct VFIOGroup {
@@ -195,6 +214,9 @@ int vfio_get_dev_region_info(VFIODevice *vbasedev, uint32_t type,
 bool vfio_has_region_cap(VFIODevice *vbasedev, int region, uint16_t cap_type);
 struct vfio_info_cap_header *
 vfio_get_region_info_cap(struct vfio_region_info *info, uint16_t id);
+
+int vfio_migration_probe(VFIODevice *vbasedev, Error **errp);
+void vfio_migration_finalize(VFIODevice *vbasedev);
 #endif
 extern const MemoryListener vfio_prereg_listener;
 
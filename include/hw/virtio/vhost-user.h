@@ -20,6 +20,12 @@ typedef struct VhostUserHostNotifier {
 typedef struct VhostUserState {
     CharBackend *chr;
     VhostUserHostNotifier notifier[VIRTIO_QUEUE_MAX];
+    /*
+     * Window of guest visible memory, set up by the device, into which the
+     * slave may map ranges of its files with VHOST_USER_SLAVE_FS_MAP.
+     */
+    void *cache_addr;
+    uint64_t cache_size;
 } VhostUserState;
 
 bool vhost_user_init(VhostUserState *user, CharBackend *chr, Error **errp);
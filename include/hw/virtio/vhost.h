@@ -5,6 +5,7 @@
 #include "hw/virtio/vhost-backend.h"
 #include "hw/virtio/virtio.h"
 #include "exec/memory.h"
+#include "qapi/qapi-types-migration.h"
 
 /* Generic structures common for any vhost based device. */
 
@@ -83,6 +84,8 @@ struct vhost_dev {
     bool started;
     bool log_enabled;
     uint64_t log_size;
+    /* Time spent in log_sync since logging was last enabled */
+    int64_t log_sync_ns;
     Error *migration_blocker;
     const VhostOps *vhost_ops;
     void *opaque;
@@ -116,6 +119,7 @@ uint64_t vhost_get_features(struct vhost_dev *hdev, const int *feature_bits,
 void vhost_ack_features(struct vhost_dev *hdev, const int *feature_bits,
                         uint64_t features);
 bool vhost_has_free_slot(void);
+VhostLogSyncInfoList *vhost_log_sync_info(void);
 
 int vhost_net_set_backend(struct vhost_dev *hdev,
                           struct vhost_vring_file *file);
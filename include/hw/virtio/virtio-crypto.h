@@ -95,6 +95,8 @@ typedef struct VirtIOCrypto {
 
     int multiqueue;
     uint32_t curr_queues;
+    /* Requests that the backend has not completed yet */
+    uint32_t inflight;
     size_t config_size;
     uint8_t vhost_started;
 } VirtIOCrypto;
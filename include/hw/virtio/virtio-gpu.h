@@ -39,6 +39,7 @@ struct virtio_gpu_simple_resource {
     uint32_t scanout_bitmask;
     pixman_image_t *image;
     uint64_t hostmem;
+    bool zero_copy;     /* image points straight at the guest backing */
     QTAILQ_ENTRY(virtio_gpu_simple_resource) next;
 };
 
@@ -62,6 +63,7 @@ enum virtio_gpu_conf_flags {
     VIRTIO_GPU_FLAG_VIRGL_ENABLED = 1,
     VIRTIO_GPU_FLAG_STATS_ENABLED,
     VIRTIO_GPU_FLAG_EDID_ENABLED,
+    VIRTIO_GPU_FLAG_ZERO_COPY_ENABLED,
 };
 
 #define virtio_gpu_virgl_enabled(_cfg) \
@@ -70,6 +72,8 @@ enum virtio_gpu_conf_flags {
     (_cfg.flags & (1 << VIRTIO_GPU_FLAG_STATS_ENABLED))
 #define virtio_gpu_edid_enabled(_cfg) \
     (_cfg.flags & (1 << VIRTIO_GPU_FLAG_EDID_ENABLED))
+#define virtio_gpu_zero_copy_enabled(_cfg) \
+    (_cfg.flags & (1 << VIRTIO_GPU_FLAG_ZERO_COPY_ENABLED))
 
 struct virtio_gpu_conf {
     uint64_t max_hostmem;
@@ -124,12 +124,30 @@ typedef struct VirtioNetRscChain {
 /* Maximum packet size we can receive from tap device: header + 64k */
 #define VIRTIO_NET_MAX_BUFSIZE (sizeof(struct virtio_net_hdr) + (64 * KiB))
 
+#define VIRTIO_NET_RSS_MAX_KEY_SIZE     40
+#define VIRTIO_NET_RSS_MAX_TABLE_LEN    128
+
+/* Receive steering state programmed with VIRTIO_NET_CTRL_MQ_*_CONFIG */
+typedef struct VirtioNetRssData {
+    bool    enabled;
+    bool    redirect;       /* steer packets, not just report the hash */
+    bool    populate_hash;  /* fill in virtio_net_hdr_v1_hash */
+    uint32_t hash_types;
+    uint8_t key[VIRTIO_NET_RSS_MAX_KEY_SIZE];
+    uint16_t indirections_len;
+    uint16_t *indirections_table;
+    uint16_t default_queue;
+} VirtioNetRssData;
+
 typedef struct VirtIONetQueue {
     VirtQueue *rx_vq;
     VirtQueue *tx_vq;
     QEMUTimer *tx_timer;
     QEMUBH *tx_bh;
     uint32_t tx_waiting;
+    /* Notifies the guest once for all packets received in a burst */
+    QEMUBH *rx_notify_bh;
+    bool rx_notify_pending;
     struct {
         VirtQueueElement *elem;
     } async_tx;
@@ -185,6 +203,8 @@ struct VirtIONet {
     AnnounceTimer announce_timer;
     bool needs_vnet_hdr_swap;
     bool mtu_bypass_backend;
+    VirtioNetRssData rss_data;
+    struct NetRxPkt *rx_pkt;
 };
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -57,6 +57,8 @@ struct VirtIOSCSIConf {
     CharBackend chardev;
     uint32_t boot_tpgt;
     IOThread *iothread;
+    uint32_t num_cmd_iothreads;
+    char **cmd_iothreads;
 };
 
 struct VirtIOSCSI;
@@ -72,6 +74,20 @@ typedef struct VirtIOSCSICommon {
     VirtQueue **cmd_vqs;
 } VirtIOSCSICommon;
 
+/*
+ * Per-virtqueue dataplane state.  Requests whose LUN lives in another
+ * AioContext than the virtqueue are completed there, and then handed
+ * over to the virtqueue's AioContext through @done and @bh.
+ */
+typedef struct VirtIOSCSIQueue {
+    struct VirtIOSCSI *dev;
+    VirtQueue *vq;
+    AioContext *ctx;
+    QEMUBH *bh;
+    QemuMutex lock;
+    QSIMPLEQ_HEAD(, VirtIOSCSIReq) done;
+} VirtIOSCSIQueue;
+
 typedef struct VirtIOSCSI {
     VirtIOSCSICommon parent_obj;
 
@@ -80,7 +96,11 @@ typedef struct VirtIOSCSI {
     bool events_dropped;
 
     /* Fields for dataplane below */
-    AioContext *ctx; /* one iothread per virtio-scsi-pci for now */
+    AioContext *ctx; /* control and event virtqueues */
+    VirtIOSCSIQueue *queues; /* indexed by virtqueue number */
+    AioContext **ctxs; /* distinct AioContexts, ctxs[0] is ctx */
+    int nb_ctxs;
+    int next_lun_ctx; /* where the next hotplugged LUN goes */
 
     bool dataplane_started;
     bool dataplane_starting;
@@ -109,6 +129,10 @@ typedef struct VirtIOSCSIReq {
         int remaining;
     };
 
+    /* Used to complete the request in another AioContext */
+    QSIMPLEQ_ENTRY(VirtIOSCSIReq) done_next;
+    bool remote;
+
     SCSIRequest *sreq;
     size_t resp_size;
     enum SCSIXferMode mode;
@@ -139,6 +163,18 @@ static inline void virtio_scsi_release(VirtIOSCSI *s)
     }
 }
 
+/*
+ * The AioContext that protects @vq; NULL if the device runs in the
+ * main loop under the BQL.
+ */
+static inline AioContext *virtio_scsi_vq_ctx(VirtIOSCSI *s, VirtQueue *vq)
+{
+    if (!s->queues || s->dataplane_fenced) {
+        return s->ctx;
+    }
+    return s->queues[virtio_get_queue_index(vq)].ctx;
+}
+
 void virtio_scsi_common_realize(DeviceState *dev,
                                 VirtIOHandleOutput ctrl,
                                 VirtIOHandleOutput evt,
@@ -153,8 +189,10 @@ void virtio_scsi_init_req(VirtIOSCSI *s, VirtQueue *vq, VirtIOSCSIReq *req);
 void virtio_scsi_free_req(VirtIOSCSIReq *req);
 void virtio_scsi_push_event(VirtIOSCSI *s, SCSIDevice *dev,
                             uint32_t event, uint32_t reason);
+void virtio_scsi_complete_deferred(VirtIOSCSIQueue *q);
 
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp);
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s);
 int virtio_scsi_dataplane_start(VirtIODevice *s);
 void virtio_scsi_dataplane_stop(VirtIODevice *s);
 
@@ -82,6 +82,12 @@ typedef struct VirtIOSerialPortClass {
      */
     ssize_t (*have_data)(VirtIOSerialPort *port, const uint8_t *buf,
                          ssize_t len);
+    /*
+     * Optional; if present, it is used instead of have_data and gets
+     * the data of several buffers of the guest at once.
+     */
+    ssize_t (*have_data_iov)(VirtIOSerialPort *port, const struct iovec *iov,
+                             unsigned int iovcnt);
 } VirtIOSerialPortClass;
 
 /*
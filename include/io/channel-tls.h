@@ -49,6 +49,7 @@ struct QIOChannelTLS {
     QIOChannel *master;
     QCryptoTLSSession *session;
     QIOChannelShutdown shutdown;
+    int offload;    /* QCryptoTLSSessionOffload flags */
 };
 
 /**
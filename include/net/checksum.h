@@ -33,6 +33,29 @@ net_checksum_add(int len, uint8_t *buf)
     return net_checksum_add_cont(len, buf, 0);
 }
 
+/**
+ * net_checksum_combine: append a partial checksum to another one
+ *
+ * @sum: checksum accumulated so far
+ * @sum2: checksum of a block that was computed on its own with
+ *        net_checksum_add(), e.g. while copying it
+ * @offset: offset of that block from the start of the checksummed data
+ *
+ * Blocks that start at an odd offset have their bytes placed in the other
+ * half of each 16-bit word, which for a one's complement sum amounts to
+ * swapping the bytes of the partial sum.
+ */
+static inline uint32_t
+net_checksum_combine(uint32_t sum, uint32_t sum2, size_t offset)
+{
+    if (offset & 1) {
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+        sum2 = bswap16(sum2);
+    }
+    return sum + sum2;
+}
+
 static inline uint16_t
 net_checksum_finish_nozero(uint32_t sum)
 {
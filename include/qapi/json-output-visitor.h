@@ -0,0 +1,35 @@
+/*
+ * JSON Output Visitor
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#ifndef JSON_OUTPUT_VISITOR_H
+#define JSON_OUTPUT_VISITOR_H
+
+#include "qapi/visitor.h"
+
+typedef struct JSONOutputVisitor JSONOutputVisitor;
+
+/**
+ * Create a JSON output visitor for @result
+ *
+ * A JSON output visitor visit writes the JSON text of a QAPI object
+ * directly, without building the QObject tree that the QObject
+ * output visitor builds for qobject_to_json() to walk afterwards.
+ * The text is the same that qobject_to_json() returns for the
+ * QObject output visitor's result, except for the order of struct
+ * members: they come in the order they are visited, not in QDict
+ * hash order.
+ *
+ * On visit_complete(), @result becomes a new QString holding the
+ * text.  Errors are not expected to happen.
+ *
+ * The caller is responsible for freeing the visitor with
+ * visit_free().
+ */
+Visitor *json_output_visitor_new(QString **result);
+
+#endif
@@ -27,5 +27,6 @@ QDict *qdict_from_jsonf_nofail(const char *string, ...)
 
 QString *qobject_to_json(const QObject *obj);
 QString *qobject_to_json_pretty(const QObject *obj);
+void qjson_append_str(QString *str, const char *val);
 
 #endif /* QJSON_H */
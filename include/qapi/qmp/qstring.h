@@ -20,6 +20,8 @@ struct QString {
     char *string;
     size_t length;
     size_t capacity;
+    /* @string is JSON text, which qobject_to_json() copies as is */
+    bool json;
 };
 
 QString *qstring_new(void);
@@ -31,6 +33,7 @@ const char *qstring_get_try_str(const QString *qstring);
 const char *qobject_get_try_str(const QObject *qstring);
 void qstring_append_int(QString *qstring, int64_t value);
 void qstring_append(QString *qstring, const char *str);
+void qstring_append_len(QString *qstring, const char *str, size_t len);
 void qstring_append_chr(QString *qstring, int c);
 bool qstring_is_equal(const QObject *x, const QObject *y);
 void qstring_destroy_obj(QObject *obj);
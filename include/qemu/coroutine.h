@@ -15,6 +15,7 @@
 #ifndef QEMU_COROUTINE_H
 #define QEMU_COROUTINE_H
 
+#include "qemu/atomic.h"
 #include "qemu/queue.h"
 #include "qemu/timer.h"
 
@@ -122,6 +123,19 @@ bool qemu_in_coroutine(void);
  */
 bool qemu_coroutine_entered(Coroutine *co);
 
+/**
+ * Increase the number of coroutines kept in the free lists
+ *
+ * Devices call this for the requests they can have in flight, so that
+ * heavy I/O does not keep allocating and freeing coroutine stacks.
+ */
+void qemu_coroutine_increase_pool_batch_size(unsigned int additional_pool_size);
+
+/**
+ * Undo a qemu_coroutine_increase_pool_batch_size() call
+ */
+void qemu_coroutine_decrease_pool_batch_size(unsigned int removing_pool_size);
+
 /**
  * Provides a mutex that can be used to synchronise coroutines
  */
@@ -159,7 +173,23 @@ void qemu_co_mutex_init(CoMutex *mutex);
  * Locks the mutex. If the lock cannot be taken immediately, control is
  * transferred to the caller of the current coroutine.
  */
-void coroutine_fn qemu_co_mutex_lock(CoMutex *mutex);
+void coroutine_fn qemu_co_mutex_lock_impl(CoMutex *mutex, const char *file,
+                                          int line);
+
+typedef void coroutine_fn (*QemuCoMutexLockFunc)(CoMutex *m, const char *f,
+                                                 int l);
+extern QemuCoMutexLockFunc qemu_co_mutex_lock_func;
+
+/* The indirection lets the synchronization profiler intercept the call.  */
+#define qemu_co_mutex_lock(m) ({                                        \
+            QemuCoMutexLockFunc _f = atomic_read(&qemu_co_mutex_lock_func); \
+            _f(m, __FILE__, __LINE__);                                  \
+        })
+
+static inline void coroutine_fn (qemu_co_mutex_lock)(CoMutex *mutex)
+{
+    qemu_co_mutex_lock(mutex);
+}
 
 /**
  * Unlocks the mutex and schedules the next coroutine that was waiting for this
@@ -235,12 +265,23 @@ typedef struct CoRwlock {
  */
 void qemu_co_rwlock_init(CoRwlock *lock);
 
+typedef void coroutine_fn (*QemuCoRwlockLockFunc)(CoRwlock *l, const char *f,
+                                                  int line);
+extern QemuCoRwlockLockFunc qemu_co_rwlock_rdlock_func;
+extern QemuCoRwlockLockFunc qemu_co_rwlock_wrlock_func;
+
 /**
  * Read locks the CoRwlock. If the lock cannot be taken immediately because
  * of a parallel writer, control is transferred to the caller of the current
  * coroutine.
  */
-void qemu_co_rwlock_rdlock(CoRwlock *lock);
+void qemu_co_rwlock_rdlock_impl(CoRwlock *lock, const char *file, int line);
+
+#define qemu_co_rwlock_rdlock(l) ({                                     \
+            QemuCoRwlockLockFunc _f;                                    \
+            _f = atomic_read(&qemu_co_rwlock_rdlock_func);              \
+            _f(l, __FILE__, __LINE__);                                  \
+        })
 
 /**
  * Write Locks the CoRwlock from a reader.  This is a bit more efficient than
@@ -265,7 +306,13 @@ void qemu_co_rwlock_downgrade(CoRwlock *lock);
  * of a parallel reader, control is transferred to the caller of the current
  * coroutine.
  */
-void qemu_co_rwlock_wrlock(CoRwlock *lock);
+void qemu_co_rwlock_wrlock_impl(CoRwlock *lock, const char *file, int line);
+
+#define qemu_co_rwlock_wrlock(l) ({                                     \
+            QemuCoRwlockLockFunc _f;                                    \
+            _f = atomic_read(&qemu_co_rwlock_wrlock_func);              \
+            _f(l, __FILE__, __LINE__);                                  \
+        })
 
 /**
  * Unlocks the read/write lock and schedules the next coroutine that was
@@ -0,0 +1,66 @@
+/*
+ * Interval tree for overlap queries on half-open 64-bit ranges
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+/*
+ * The tree is intrusive: embed an IntervalTreeNode in the tracked object
+ * and use container_of() to get back to it.  Nodes may overlap each other
+ * and may be empty; an empty interval [x, x) overlaps any query that
+ * strictly contains x.
+ *
+ * Internally this is a treap ordered by start, where every node also
+ * records the largest end in its subtree so that the subtrees that can
+ * not overlap a query are skipped.  Insertion, removal and finding the
+ * first overlapping node all take O(log n) expected time.
+ *
+ * There is no locking; callers must serialise accesses to a tree.
+ */
+
+typedef struct IntervalTreeNode {
+    uint64_t start;
+    uint64_t end;               /* Exclusive */
+
+    /* Private */
+    uint64_t subtree_end;
+    uint64_t priority;
+    struct IntervalTreeNode *left, *right;
+} IntervalTreeNode;
+
+typedef struct IntervalTreeRoot {
+    IntervalTreeNode *root;
+    uint64_t seed;
+} IntervalTreeRoot;
+
+/* Return true to stop the search at @node */
+typedef bool (*IntervalTreeFunc)(IntervalTreeNode *node, void *opaque);
+
+#define INTERVAL_TREE_ROOT_INITIALIZER { NULL, 0 }
+
+static inline bool interval_tree_empty(const IntervalTreeRoot *root)
+{
+    return root->root == NULL;
+}
+
+/*
+ * Add @node to @root; node->start and node->end must be set and must not
+ * change while the node is in the tree.
+ */
+void interval_tree_insert(IntervalTreeRoot *root, IntervalTreeNode *node);
+
+/* Remove @node, which must have been inserted in @root */
+void interval_tree_remove(IntervalTreeRoot *root, IntervalTreeNode *node);
+
+/*
+ * Walk the nodes that overlap [@start, @end) by increasing start, and
+ * return the first one for which @func returns true, or NULL.
+ */
+IntervalTreeNode *interval_tree_find(IntervalTreeRoot *root,
+                                     uint64_t start, uint64_t end,
+                                     IntervalTreeFunc func, void *opaque);
+
+#endif
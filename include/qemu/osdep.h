@@ -570,6 +570,56 @@ void qemu_set_tty_echo(int fd, bool echo);
 void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
                      Error **errp);
 
+typedef struct MemPrealloc MemPrealloc;
+
+/**
+ * os_mem_prealloc_start:
+ * @fd: the file descriptor backing @area, or -1
+ * @area: the memory to preallocate
+ * @sz: the size of @area
+ * @smp_cpus: the number of guest CPUs, used to pick the default thread count
+ * @nthreads: the number of threads to use, or 0 for the default
+ * @host_nodes: bitmap of host NUMA nodes, or NULL
+ * @max_node: the number of bits in @host_nodes
+ *
+ * Start faulting in @area from background threads and return a handle
+ * that must be passed to os_mem_prealloc_finish(); other threads can
+ * keep using @area meanwhile.  If @host_nodes has bits set, the threads
+ * only run on the CPUs of those nodes, so that the kernel zeroes the
+ * pages close to where the memory policy places them.
+ *
+ * Returns NULL and sets @errp on failure.
+ */
+MemPrealloc *os_mem_prealloc_start(int fd, char *area, size_t sz,
+                                   int smp_cpus, int nthreads,
+                                   const unsigned long *host_nodes,
+                                   unsigned long max_node, Error **errp);
+
+/**
+ * os_mem_prealloc_finish:
+ * @prealloc: the handle returned by os_mem_prealloc_start()
+ * @errp: set if the memory could not be preallocated
+ *
+ * Wait for the preallocation to complete and free @prealloc.
+ */
+void os_mem_prealloc_finish(MemPrealloc *prealloc, Error **errp);
+
+/**
+ * qemu_get_host_node_cpus:
+ * @host_nodes: bitmap of host NUMA nodes
+ * @max_node: the number of bits in @host_nodes
+ * @host_cpus: bitmap of host CPUs
+ * @max_cpu: the number of bits in @host_cpus
+ *
+ * Add to @host_cpus the CPUs of the host NUMA nodes in @host_nodes that
+ * QEMU may run on.
+ *
+ * Returns: false if there are none or they cannot be determined
+ */
+bool qemu_get_host_node_cpus(const unsigned long *host_nodes,
+                             unsigned long max_node,
+                             unsigned long *host_cpus, unsigned long max_cpu);
+
 /**
  * qemu_get_pmem_size:
  * @filename: path to a pmem file
@@ -0,0 +1,99 @@
+/*
+ * TCG plugin support, as seen from the rest of QEMU
+ *
+ * The plugins themselves only see include/qemu/qemu-plugin.h.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_PLUGIN_H
+#define QEMU_PLUGIN_H
+
+#include "qemu/qemu-plugin.h"
+
+enum plugin_dyn_cb_type {
+    PLUGIN_CB_REGULAR,
+    PLUGIN_CB_MEM,
+    PLUGIN_CB_INLINE,
+};
+
+/* A callback or inline op that the generated code runs */
+struct qemu_plugin_dyn_cb {
+    enum plugin_dyn_cb_type type;
+    void *userp;
+    enum qemu_plugin_mem_rw rw;     /* PLUGIN_CB_MEM only */
+    union {
+        qemu_plugin_vcpu_udata_cb_t f;
+        qemu_plugin_vcpu_mem_cb_t mem_f;
+        struct {
+            enum qemu_plugin_op op;
+            uint64_t imm;
+        } inline_insn;
+    };
+};
+
+struct qemu_plugin_insn {
+    uint64_t vaddr;
+    size_t size;
+    GByteArray *data;
+    GArray *exec_cbs;           /* of struct qemu_plugin_dyn_cb */
+    GArray *mem_cbs;            /* ditto */
+
+    /* Where the translator put the instruction, see plugin-gen.c */
+    struct TCGOp *start;
+    GArray *mem_ops;
+};
+
+struct qemu_plugin_tb {
+    uint64_t vaddr;
+    GPtrArray *insns;           /* of struct qemu_plugin_insn */
+    GArray *exec_cbs;           /* of struct qemu_plugin_dyn_cb */
+};
+
+#ifdef CONFIG_PLUGIN
+
+/*
+ * qemu_plugin_opt_parse:
+ * @optarg: the argument of -plugin, "[file=]<path>[,arg=<string>]..."
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Queue a plugin for qemu_plugin_load_list().
+ */
+void qemu_plugin_opt_parse(const char *optarg, Error **errp);
+
+/*
+ * qemu_plugin_load_list:
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Load and install the plugins queued by qemu_plugin_opt_parse(), which
+ * must happen before any guest code is translated.
+ */
+void qemu_plugin_load_list(Error **errp);
+
+/* Whether any plugin wants to instrument translated blocks */
+bool qemu_plugin_tb_trans_enabled(void);
+
+/* Let the plugins see @tb and register their callbacks on it */
+void qemu_plugin_tb_trans_cb(struct qemu_plugin_tb *tb);
+
+/* Call the exit callbacks of the plugins; only the first call does it */
+void qemu_plugin_atexit_cb(void);
+
+#else /* !CONFIG_PLUGIN */
+
+static inline void qemu_plugin_load_list(Error **errp)
+{
+}
+
+static inline bool qemu_plugin_tb_trans_enabled(void)
+{
+    return false;
+}
+
+static inline void qemu_plugin_atexit_cb(void)
+{
+}
+
+#endif /* !CONFIG_PLUGIN */
+
+#endif /* QEMU_PLUGIN_H */
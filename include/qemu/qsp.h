@@ -21,9 +21,23 @@ enum QSPSortBy {
 void qsp_report(FILE *f, fprintf_function cpu_fprintf, size_t max,
                 enum QSPSortBy sort_by, bool callsite_coalesce);
 
+/*
+ * Called for each of the first @max rows of the report, in order.  @n_objs
+ * is the number of objects coalesced into the row; if it is at most 1, @obj
+ * is the only object.
+ */
+typedef void (*QSPReportFunc)(void *opaque, const char *type, const void *obj,
+                              unsigned int n_objs, const char *callsite,
+                              uint64_t ns, uint64_t n_acqs);
+void qsp_report_foreach(size_t max, enum QSPSortBy sort_by,
+                        bool callsite_coalesce, QSPReportFunc func,
+                        void *opaque);
+
 bool qsp_is_enabled(void);
 void qsp_enable(void);
 void qsp_disable(void);
 void qsp_reset(void);
+unsigned int qsp_get_sample_rate(void);
+void qsp_set_sample_rate(unsigned int rate);
 
 #endif /* QEMU_QSP_H */
@@ -112,6 +112,14 @@ static inline void rcu_read_unlock(void)
 
 extern void synchronize_rcu(void);
 
+/*
+ * Like synchronize_rcu(), but busy-wait for a while for the readers to
+ * exit their critical sections instead of sleeping right away.  This
+ * trades CPU time for latency, so use it only on paths where the caller
+ * is waiting for the grace period to end.
+ */
+extern void synchronize_rcu_expedited(void);
+
 /*
  * Reader thread registration.
  */
@@ -134,6 +142,15 @@ struct rcu_head {
 
 extern void call_rcu1(struct rcu_head *head, RCUCBFunc *func);
 
+/*
+ * Callbacks queued with call_rcu() by the current thread between
+ * call_rcu_batch_begin() and call_rcu_batch_end() are handed to the
+ * call_rcu thread all at once when the outermost call_rcu_batch_end()
+ * runs.  Batches can nest.
+ */
+extern void call_rcu_batch_begin(void);
+extern void call_rcu_batch_end(void);
+
 /* The operands of the minus operator must have the same type,
  * which must be the one that we specify in the cast.
  */
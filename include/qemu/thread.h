@@ -41,6 +41,8 @@ extern QemuMutexTrylockFunc qemu_mutex_trylock_func;
 extern QemuRecMutexLockFunc qemu_rec_mutex_lock_func;
 extern QemuRecMutexTrylockFunc qemu_rec_mutex_trylock_func;
 extern QemuCondWaitFunc qemu_cond_wait_func;
+/* used by aio_context_acquire() on the AioContext's recursive mutex */
+extern QemuRecMutexLockFunc qemu_aio_context_lock_func;
 
 /* convenience macros to bypass the profiler */
 #define qemu_mutex_lock__raw(m)                         \
@@ -161,6 +163,26 @@ bool qemu_thread_is_self(QemuThread *thread);
 void qemu_thread_exit(void *retval);
 void qemu_thread_naming(bool enable);
 
+/* Size of the host CPU bitmaps passed to qemu_thread_set_affinity() */
+#define QEMU_THREAD_MAX_CPUS 1024
+
+/*
+ * qemu_thread_set_affinity:
+ * @thread: the thread to pin
+ * @host_cpus: bitmap of host CPUs
+ * @max_cpu: the number of bits in @host_cpus
+ *
+ * Only let @thread run on the host CPUs in @host_cpus.  Threads that
+ * @thread creates afterwards inherit this, so it should be done before
+ * @thread starts any helper threads of its own.
+ *
+ * Returns 0 on success, -ENOSYS if the host does not support it or another
+ * negative errno value.
+ */
+int qemu_thread_set_affinity(QemuThread *thread,
+                             const unsigned long *host_cpus,
+                             unsigned long max_cpu);
+
 struct Notifier;
 /**
  * qemu_thread_atexit_add:
@@ -85,9 +85,10 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
     int attributes;
     int scale;
+    int heap_index;             /* position in timer_list, if pending */
+    unsigned int seq;           /* orders timers with equal expire_time */
 };
 
 extern QEMUTimerListGroup main_loop_tlg;
@@ -258,11 +258,22 @@ struct CPUWatchpoint {
 
 struct KVMState;
 struct kvm_run;
+struct kvm_dirty_gfn;
 
 struct hax_vcpu_state;
 
-#define TB_JMP_CACHE_BITS 12
-#define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+/*
+ * Size of the per-vCPU TB jump cache, in bits.  It must be set before the
+ * CPUs are created, with -accel tcg,tb-jmp-cache-bits=N.
+ */
+#define TB_JMP_CACHE_BITS_DEFAULT 12
+#define TB_JMP_CACHE_BITS_MIN 8
+#define TB_JMP_CACHE_BITS_MAX 20
+extern unsigned int tb_jmp_cache_bits;
+/* Initial halt_poll_ns of the vCPUs, set with -accel halt-poll-ns */
+extern uint64_t halt_poll_ns_default;
+#define HALT_POLL_NS_MAX (10 * 1000 * 1000)
+#define TB_JMP_CACHE_SIZE (1u << tb_jmp_cache_bits)
 
 /* work queue */
 
@@ -289,6 +300,22 @@ struct qemu_work_item;
 #define CPU_UNSET_NUMA_NODE_ID -1
 #define CPU_TRACE_DSTATE_MAX_EVENTS 32
 
+#define CPU_MMIO_CACHE_SIZE 8
+
+/*
+ * One translation remembered by address_space_mmio_rw(): the
+ * MemoryRegionSection covering [@addr, @addr + @size) of @as maps to
+ * @mr at offset @xlat.  Valid only while @generation is current.
+ */
+typedef struct CPUMMIOCacheEntry {
+    AddressSpace *as;
+    hwaddr addr;
+    hwaddr size;
+    hwaddr xlat;
+    MemoryRegion *mr;
+    unsigned int generation;
+} CPUMMIOCacheEntry;
+
 /**
  * CPUState:
  * @cpu_index: CPU index (informative).
@@ -311,6 +338,12 @@ struct qemu_work_item;
  * @crash_occurred: Indicates the OS reported a crash (panic) for this CPU
  * @singlestep_enabled: Flags for single-stepping.
  * @icount_extra: Instructions until next timer event.
+ * @icount_quantum_done: Instructions run in the current icount quantum,
+ * with MTTCG.
+ * @icount_quantum_gen: The icount quantum that @icount_quantum_done is for.
+ * @icount_in_quantum: Whether the CPU takes part in the current quantum.
+ * @icount_quantum_wait: Whether the CPU finished the current quantum and
+ * waits for the others to finish it too.
  * @icount_decr: Low 16 bits: number of cycles left, only used in icount mode.
  * High 16 bits: Set to -1 to force TCG to stop executing linked TBs for this
  * CPU and return to its top level loop (even in non-icount mode).
@@ -333,6 +366,11 @@ struct qemu_work_item;
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @mem_io_vaddr: Target virtual address at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
+ * @kvm_exit_stats: Number of exits and time spent handling them, by KVM
+ *                  exit reason; only updated from the vCPU thread.
+ * @mmio_cache: MMIO translations used by address_space_mmio_rw(), only
+ *              accessed from the vCPU thread.
+ * @mmio_cache_next: Next @mmio_cache entry to replace.
  * @work_mutex: Lock to prevent multiple access to queued_work_*.
  * @queued_work_first: First asynchronous work pending.
  * @trace_dstate_delayed: Delayed changes to trace_dstate (includes all changes
@@ -366,12 +404,25 @@ struct CPUState {
     bool unplug;
     bool crash_occurred;
     bool exit_request;
+    /*
+     * How long the vCPU thread polls for a wakeup before sleeping on
+     * halt_cond, and how often that avoided the sleep.
+     */
+    uint64_t halt_poll_ns;
+    uint64_t halt_poll_successes;
+    uint64_t halt_poll_failures;
     uint32_t cflags_next_tb;
+    /* TB that reached tcg_hot_tb_threshold, to be retranslated */
+    struct TranslationBlock *hot_tb;
     /* updates protected by BQL */
     uint32_t interrupt_request;
     int singlestep_enabled;
     int64_t icount_budget;
     int64_t icount_extra;
+    int64_t icount_quantum_done;
+    uint64_t icount_quantum_gen;
+    bool icount_in_quantum;
+    bool icount_quantum_wait;
     sigjmp_buf jmp_env;
 
     QemuMutex work_mutex;
@@ -385,7 +436,10 @@ struct CPUState {
     void *env_ptr; /* CPUArchState */
 
     /* Accessed in parallel; all accesses must be atomic */
-    struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    struct TranslationBlock **tb_jmp_cache;
+    /* Lookups that did and did not find their TB in tb_jmp_cache */
+    size_t tb_jmp_cache_hits;
+    size_t tb_jmp_cache_misses;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -412,9 +466,17 @@ struct CPUState {
      */
     MMUAccessType mem_io_access_type;
 
+    CPUMMIOCacheEntry mmio_cache[CPU_MMIO_CACHE_SIZE];
+    unsigned int mmio_cache_next;
+
     int kvm_fd;
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
+    struct kvm_dirty_gfn *kvm_dirty_gfns;
+    uint32_t kvm_fetch_index;
+    struct KVMExitStats *kvm_exit_stats;
+    /* Number of pages harvested from the dirty ring of this vcpu */
+    uint64_t dirty_pages;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
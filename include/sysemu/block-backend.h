@@ -25,6 +25,20 @@
  */
 #include "block/block.h"
 
+/*
+ * Priority classes of the requests to a node.  While a BlockBackend
+ * of the node uses anything but BLK_IO_PRIO_NORMAL, the requests of
+ * all of them are scheduled: only a limited number run at once, and
+ * the next one to run is the oldest that has waited beyond the
+ * deadline of its class, or else the first of the highest class.
+ */
+typedef enum BlockIOPriority {
+    BLK_IO_PRIO_HIGH,           /* latency-sensitive */
+    BLK_IO_PRIO_NORMAL,
+    BLK_IO_PRIO_LOW,            /* background: block jobs, backups */
+    BLK_IO_PRIO__MAX,
+} BlockIOPriority;
+
 /* Callbacks for block device models */
 typedef struct BlockDevOps {
     /*
@@ -171,6 +185,7 @@ bool blk_is_read_only(BlockBackend *blk);
 bool blk_is_sg(BlockBackend *blk);
 bool blk_enable_write_cache(BlockBackend *blk);
 void blk_set_enable_write_cache(BlockBackend *blk, bool wce);
+void blk_set_io_priority(BlockBackend *blk, BlockIOPriority prio);
 void blk_invalidate_cache(BlockBackend *blk, Error **errp);
 bool blk_is_inserted(BlockBackend *blk);
 bool blk_is_available(BlockBackend *blk);
@@ -146,6 +146,9 @@ typedef struct CryptoDevBackendSymOpInfo {
     uint8_t data[0];
 } CryptoDevBackendSymOpInfo;
 
+/* Result of an asynchronous operation: VIRTIO_CRYPTO_OK or -VIRTIO_CRYPTO_* */
+typedef void CryptoDevCompletionFunc(void *opaque, int ret);
+
 typedef struct CryptoDevBackendClass {
     ObjectClass parent_class;
 
@@ -161,6 +164,14 @@ typedef struct CryptoDevBackendClass {
     int (*do_sym_op)(CryptoDevBackend *backend,
                      CryptoDevBackendSymOpInfo *op_info,
                      uint32_t queue_index, Error **errp);
+    /*
+     * Optional; calls @cb once the operation is done, which may be
+     * before it returns.  Errors are reported by the backend.
+     */
+    void (*do_sym_op_async)(CryptoDevBackend *backend,
+                            CryptoDevBackendSymOpInfo *op_info,
+                            uint32_t queue_index,
+                            CryptoDevCompletionFunc *cb, void *opaque);
 } CryptoDevBackendClass;
 
 typedef enum CryptoDevBackendOptionsType {
@@ -305,6 +316,24 @@ int cryptodev_backend_crypto_operation(
                  void *opaque,
                  uint32_t queue_index, Error **errp);
 
+/**
+ * cryptodev_backend_crypto_operation_async:
+ * @backend: the cryptodev backend object
+ * @opaque: pointer to a VirtIOCryptoReq object
+ * @queue_index: queue index of cryptodev backend client
+ * @cb: function called with @opaque and the result of the operation
+ *
+ * Like cryptodev_backend_crypto_operation(), but lets the backend
+ * run the operation in the background if it can.  @cb is called in
+ * the main loop once the operation is done, possibly before this
+ * function returns, with VIRTIO_CRYPTO_OK or -VIRTIO_CRYPTO_*.
+ * Errors are reported rather than returned.
+ */
+void cryptodev_backend_crypto_operation_async(
+                 CryptoDevBackend *backend,
+                 void *opaque, uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb);
+
 /**
  * cryptodev_backend_set_used:
  * @backend: the cryptodev backend object
@@ -195,6 +195,15 @@ typedef struct DumpState {
                                   * finished. */
     uint8_t *guest_note;         /* ELF note content */
     size_t guest_note_size;
+
+    uint32_t nr_threads;         /* threads compressing kdump pages */
+    bool live;                   /* resume the guest while dumping pages */
+    int uffd;                    /* write-protect faults of live dumps */
+    QemuThread wp_thread;        /* saves the pages the guest writes to */
+    bool wp_quit;
+    QemuMutex wp_lock;           /* protects wp_copies */
+    GHashTable *wp_copies;       /* host page -> copy, for pages written
+                                  * by the guest before they were dumped */
 } DumpState;
 
 uint16_t cpu_to_dump16(DumpState *s, uint16_t val);
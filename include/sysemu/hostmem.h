@@ -45,6 +45,10 @@ struct HostMemoryBackendClass {
  *
  * @parent: opaque parent object container
  * @size: amount of memory backend provides
+ * @prealloc_threads: number of threads that preallocate memory, 0 for default
+ * @prealloc_async: whether preallocation started before machine init done
+ *                  runs in the background until then
+ * @prealloc_pending: background preallocation in progress, if any
  * @mr: MemoryRegion representing host memory belonging to backend
  */
 struct HostMemoryBackend {
@@ -55,6 +59,9 @@ struct HostMemoryBackend {
     uint64_t size;
     bool merge, dump, use_canonical_path;
     bool prealloc, force_prealloc, is_mapped, share;
+    uint32_t prealloc_threads;
+    bool prealloc_async;
+    MemPrealloc *prealloc_pending;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
 
@@ -15,7 +15,9 @@
 #define IOTHREAD_H
 
 #include "block/aio.h"
+#include "qemu/bitmap.h"
 #include "qemu/thread.h"
+#include "sysemu/sysemu.h" /* for MAX_NODES */
 
 #define TYPE_IOTHREAD "iothread"
 
@@ -36,6 +38,14 @@ typedef struct {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* Parameters of the AioContext's thread pool */
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+
+    /* Host CPUs that the thread and its thread pool run on, if any */
+    DECLARE_BITMAP(host_cpus, QEMU_THREAD_MAX_CPUS);
+    DECLARE_BITMAP(host_nodes, MAX_NODES);
 } IOThread;
 
 #define IOTHREAD(obj) \
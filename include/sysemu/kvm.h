@@ -207,6 +207,21 @@ extern KVMState *kvm_state;
 
 bool kvm_has_free_slot(MachineState *ms);
 bool kvm_has_sync_mmu(void);
+/**
+ * kvm_dirty_ring_enabled:
+ *
+ * Returns: true if dirty pages are tracked with the per-vcpu dirty
+ * rings, in which case CPUState::dirty_pages counts the pages that
+ * each vcpu dirtied.
+ */
+bool kvm_dirty_ring_enabled(void);
+/**
+ * kvm_dirty_ring_sync:
+ *
+ * Harvest the dirty rings of all vcpus.  Must be called with the BQL
+ * held.
+ */
+void kvm_dirty_ring_sync(void);
 int kvm_has_vcpu_events(void);
 int kvm_has_robust_singlestep(void);
 int kvm_has_debugregs(void);
@@ -251,6 +266,7 @@ int kvm_memcrypt_encrypt_data(uint8_t *ptr, uint64_t len);
 #include "cpu.h"
 
 void kvm_flush_coalesced_mmio_buffer(void);
+bool kvm_coalesced_mmio_pending(void);
 
 int kvm_insert_breakpoint(CPUState *cpu, target_ulong addr,
                           target_ulong len, int type);
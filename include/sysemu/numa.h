@@ -2,6 +2,7 @@
 #define SYSEMU_NUMA_H
 
 #include "qemu/bitmap.h"
+#include "qemu/thread.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/hostmem.h"
 #include "hw/boards.h"
@@ -14,6 +15,8 @@ struct NodeInfo {
     struct HostMemoryBackend *node_memdev;
     bool present;
     uint8_t distance[MAX_NODES];
+    /* Where the VCPU threads of the node run, empty if anywhere */
+    DECLARE_BITMAP(host_cpus, QEMU_THREAD_MAX_CPUS);
 };
 
 struct NumaNodeMem {
@@ -28,6 +28,8 @@
 /* in ms */
 #define GUI_REFRESH_INTERVAL_DEFAULT    30
 #define GUI_REFRESH_INTERVAL_IDLE     3000
+/* the listener has nobody to show updates to and needs no refresh */
+#define GUI_REFRESH_INTERVAL_NONE     UINT64_MAX
 
 /* Color number is match to standard vga palette */
 enum qemu_color_names {
@@ -237,6 +239,7 @@ typedef struct DisplayChangeListenerOps {
 
 struct DisplayChangeListener {
     uint64_t update_interval;
+    uint64_t last_update;
     const DisplayChangeListenerOps *ops;
     DisplayState *ds;
     QemuConsole *con;
@@ -366,6 +369,12 @@ typedef struct GraphicHwOps {
     void (*gfx_update)(void *opaque);
     void (*text_update)(void *opaque, console_ch_t *text);
     void (*update_interval)(void *opaque, uint64_t interval);
+    /*
+     * No listener wants updates any more (or again).  While idle, the
+     * device may stop tracking dirty memory, but it still has to produce
+     * a correct picture when gfx_update is called.
+     */
+    void (*display_idle)(void *opaque, bool idle);
     int (*ui_info)(void *opaque, uint32_t head, QemuUIInfo *info);
     void (*gl_block)(void *opaque, bool block);
 } GraphicHwOps;
@@ -81,6 +81,21 @@ typedef struct SimpleSpiceDisplay SimpleSpiceDisplay;
 typedef struct SimpleSpiceUpdate SimpleSpiceUpdate;
 typedef struct SimpleSpiceCursor SimpleSpiceCursor;
 
+/*
+ * Recently sent update bitmaps, looked up by content so that a repeated
+ * bitmap goes out with the image id it had before and the client can take
+ * it from its cache.  Direct mapped on the crc of the pixels.
+ */
+#define SPICE_IMAGE_CACHE_SLOTS     256
+#define SPICE_IMAGE_CACHE_MAX_SIZE  (64 * 1024)
+
+typedef struct SimpleSpiceCachedImage {
+    uint64_t id;
+    uint32_t crc;
+    int width, height;
+    uint8_t *data;
+} SimpleSpiceCachedImage;
+
 struct SimpleSpiceDisplay {
     DisplaySurface *ds;
     DisplayChangeListener dcl;
@@ -102,6 +117,9 @@ struct SimpleSpiceDisplay {
      */
     QemuMutex lock;
     QTAILQ_HEAD(, SimpleSpiceUpdate) updates;
+    SimpleSpiceCachedImage image_cache[SPICE_IMAGE_CACHE_SLOTS];
+    uint64_t image_cache_hits;
+    uint64_t image_cache_misses;
 
     /* cursor (without qxl): displaychangelistener -> spice server */
     SimpleSpiceCursor *ptr_define;
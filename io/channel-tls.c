@@ -21,6 +21,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 
 
@@ -140,6 +141,36 @@ qio_channel_tls_new_client(QIOChannel *master,
     return NULL;
 }
 
+/*
+ * Let the kernel encrypt and decrypt the records once the handshake
+ * is done, so that payload goes straight between the caller's buffers
+ * and the socket.  Whatever cannot be offloaded stays with gnutls.
+ */
+static void qio_channel_tls_offload(QIOChannelTLS *ioc)
+{
+    QIOChannelSocket *sioc;
+    Error *err = NULL;
+    int ret;
+
+    if (!object_dynamic_cast(OBJECT(ioc->master), TYPE_QIO_CHANNEL_SOCKET)) {
+        return;
+    }
+    sioc = QIO_CHANNEL_SOCKET(ioc->master);
+    if (sioc->localAddr.ss_family != AF_INET &&
+        sioc->localAddr.ss_family != AF_INET6) {
+        return;
+    }
+
+    ret = qcrypto_tls_session_offload(ioc->session, sioc->fd, &err);
+    if (ret < 0) {
+        trace_qio_channel_tls_offload_fail(ioc, error_get_pretty(err));
+        error_free(err);
+        return;
+    }
+    trace_qio_channel_tls_offload(ioc, ret);
+    ioc->offload = ret;
+}
+
 struct QIOChannelTLSData {
     QIOTask *task;
     GMainContext *context;
@@ -173,6 +204,7 @@ static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
             qio_task_set_error(task, err);
         } else {
             trace_qio_channel_tls_credentials_allow(ioc);
+            qio_channel_tls_offload(ioc);
         }
         qio_task_complete(task);
     } else {
@@ -264,6 +296,11 @@ static ssize_t qio_channel_tls_readv(QIOChannel *ioc,
     size_t i;
     ssize_t got = 0;
 
+    if (tioc->offload & QCRYPTO_TLS_OFFLOAD_READ) {
+        return qio_channel_readv_full(tioc->master, iov, niov,
+                                      NULL, NULL, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_read(tioc->session,
                                                iov[i].iov_base,
@@ -298,12 +335,18 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
                                       size_t niov,
                                       int *fds,
                                       size_t nfds,
+                                      int flags,
                                       Error **errp)
 {
     QIOChannelTLS *tioc = QIO_CHANNEL_TLS(ioc);
     size_t i;
     ssize_t done = 0;
 
+    if (tioc->offload & QCRYPTO_TLS_OFFLOAD_WRITE) {
+        return qio_channel_writev_full(tioc->master, iov, niov,
+                                       NULL, 0, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
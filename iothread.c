@@ -17,9 +17,11 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-misc.h"
+#include "qapi/qapi-builtin-visit.h"
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
@@ -115,6 +117,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -161,6 +164,31 @@ static void iothread_init_gcontext(IOThread *iothread)
     iothread->main_loop = g_main_loop_new(iothread->worker_context, TRUE);
 }
 
+/*
+ * Pin the thread to host-cpus and to the CPUs of host-nodes.  Nothing has
+ * submitted work to the thread pool yet, and its workers are all created
+ * from this thread or from each other, so they inherit the affinity.
+ */
+static void iothread_set_affinity(IOThread *iothread, Error **errp)
+{
+    DECLARE_BITMAP(cpus, QEMU_THREAD_MAX_CPUS);
+    int ret;
+
+    bitmap_copy(cpus, iothread->host_cpus, QEMU_THREAD_MAX_CPUS);
+    if (!bitmap_empty(iothread->host_nodes, MAX_NODES) &&
+        !qemu_get_host_node_cpus(iothread->host_nodes, MAX_NODES,
+                                 cpus, QEMU_THREAD_MAX_CPUS)) {
+        error_setg(errp, "No usable CPUs in host-nodes");
+        return;
+    }
+
+    ret = qemu_thread_set_affinity(&iothread->thread, cpus,
+                                   QEMU_THREAD_MAX_CPUS);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not set the CPU affinity");
+    }
+}
+
 static void iothread_complete(UserCreatable *obj, Error **errp)
 {
     Error *local_error = NULL;
@@ -186,6 +214,12 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
                                 iothread->poll_grow,
                                 iothread->poll_shrink,
                                 &local_error);
+    if (!local_error) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           &local_error);
+    }
     if (local_error) {
         error_propagate(errp, local_error);
         aio_context_unref(iothread->ctx);
@@ -207,6 +241,11 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
     while (iothread->thread_id == -1) {
         qemu_sem_wait(&iothread->init_done_sem);
     }
+
+    if (!bitmap_empty(iothread->host_cpus, QEMU_THREAD_MAX_CPUS) ||
+        !bitmap_empty(iothread->host_nodes, MAX_NODES)) {
+        iothread_set_affinity(iothread, errp);
+    }
 }
 
 typedef struct {
@@ -223,6 +262,12 @@ static PollParamInfo poll_grow_info = {
 static PollParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
+static PollParamInfo thread_pool_min_info = {
+    "thread-pool-min", offsetof(IOThread, thread_pool_min),
+};
+static PollParamInfo thread_pool_max_info = {
+    "thread-pool-max", offsetof(IOThread, thread_pool_max),
+};
 
 static void iothread_get_poll_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
@@ -268,6 +313,110 @@ out:
     error_propagate(errp, local_err);
 }
 
+static void iothread_set_thread_pool_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    PollParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    int64_t value;
+
+    visit_type_int64(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    if (value < 0 || value > INT_MAX) {
+        error_setg(&local_err, "%s value must be in range [0, %d]",
+                   info->name, INT_MAX);
+        goto out;
+    }
+
+    *field = value;
+
+    if (iothread->ctx) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           &local_err);
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+typedef struct {
+    const char *name;
+    ptrdiff_t offset; /* field's byte offset in IOThread struct */
+    unsigned long nbits;
+} HostBitmapInfo;
+
+static HostBitmapInfo host_cpus_info = {
+    "host-cpus", offsetof(IOThread, host_cpus), QEMU_THREAD_MAX_CPUS,
+};
+static HostBitmapInfo host_nodes_info = {
+    "host-nodes", offsetof(IOThread, host_nodes), MAX_NODES,
+};
+
+static void iothread_get_host_bitmap(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    HostBitmapInfo *info = opaque;
+    unsigned long *bitmap = (void *)iothread + info->offset;
+    uint16List *list = NULL, **tail = &list;
+    unsigned long value;
+
+    for (value = find_first_bit(bitmap, info->nbits); value < info->nbits;
+         value = find_next_bit(bitmap, info->nbits, value + 1)) {
+        *tail = g_new0(uint16List, 1);
+        (*tail)->value = value;
+        tail = &(*tail)->next;
+    }
+
+    visit_type_uint16List(v, name, &list, errp);
+    qapi_free_uint16List(list);
+}
+
+static void iothread_set_host_bitmap(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    HostBitmapInfo *info = opaque;
+    unsigned long *bitmap = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    uint16List *l, *list = NULL;
+
+    if (iothread->ctx) {
+        error_setg(&local_err, "%s cannot be changed once the IOThread runs",
+                   info->name);
+        goto out;
+    }
+
+    visit_type_uint16List(v, name, &list, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    for (l = list; l; l = l->next) {
+        if (l->value >= info->nbits) {
+            error_setg(&local_err, "Invalid %s value: %d", info->name,
+                       l->value);
+            goto out;
+        }
+    }
+
+    bitmap_zero(bitmap, info->nbits);
+    for (l = list; l; l = l->next) {
+        set_bit(l->value, bitmap);
+    }
+
+out:
+    qapi_free_uint16List(list);
+    error_propagate(errp, local_err);
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -285,6 +434,22 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info, &error_abort);
+    object_class_property_add(klass, "thread-pool-min", "int",
+                              iothread_get_poll_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_min_info, &error_abort);
+    object_class_property_add(klass, "thread-pool-max", "int",
+                              iothread_get_poll_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_max_info, &error_abort);
+    object_class_property_add(klass, "host-cpus", "int",
+                              iothread_get_host_bitmap,
+                              iothread_set_host_bitmap,
+                              NULL, &host_cpus_info, &error_abort);
+    object_class_property_add(klass, "host-nodes", "int",
+                              iothread_get_host_bitmap,
+                              iothread_set_host_bitmap,
+                              NULL, &host_nodes_info, &error_abort);
 }
 
 static const TypeInfo iothread_info = {
@@ -335,6 +500,11 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    if (iothread->ctx) {
+        info->poll_time_ns = atomic_read__nocheck(&iothread->ctx->poll_time_ns);
+        info->dispatch_time_ns =
+            atomic_read__nocheck(&iothread->ctx->dispatch_time_ns);
+    }
 
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
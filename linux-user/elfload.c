@@ -1593,6 +1593,49 @@ static int elf_core_dump(int, const CPUArchState *);
 #endif /* USE_ELF_CORE_DUMP */
 static void load_symbols(struct elfhdr *hdr, int fd, abi_ulong load_bias);
 
+/* Look for the NT_GNU_BUILD_ID note of an image, return its length */
+static size_t elf_build_id(int fd, struct elf_phdr *phdr, int phnum,
+                           uint8_t *id, size_t max)
+{
+    int i;
+
+    for (i = 0; i < phnum; i++) {
+        uint8_t buf[256];
+        size_t len = MIN(phdr[i].p_filesz, sizeof(buf));
+        size_t pos = 0;
+
+        if (phdr[i].p_type != PT_NOTE ||
+            pread(fd, buf, len, phdr[i].p_offset) != len) {
+            continue;
+        }
+        while (pos + sizeof(struct elf_note) <= len) {
+            struct elf_note note;
+            size_t name, desc;
+
+            memcpy(&note, buf + pos, sizeof(note));
+#ifdef BSWAP_NEEDED
+            bswap32s(&note.n_namesz);
+            bswap32s(&note.n_descsz);
+            bswap32s(&note.n_type);
+#endif
+            name = pos + sizeof(note);
+            desc = name + QEMU_ALIGN_UP(note.n_namesz, 4);
+            if (note.n_namesz > len || note.n_descsz > len ||
+                desc + note.n_descsz > len) {
+                break;
+            }
+            if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4 &&
+                !memcmp(buf + name, "GNU", 4) &&
+                note.n_descsz && note.n_descsz <= max) {
+                memcpy(id, buf + desc, note.n_descsz);
+                return note.n_descsz;
+            }
+            pos = desc + QEMU_ALIGN_UP(note.n_descsz, 4);
+        }
+    }
+    return 0;
+}
+
 /* Verify the portions of EHDR within E_IDENT for the target.
    This can be performed before bswapping the entire header.  */
 static bool elf_check_ident(struct elfhdr *ehdr)
@@ -2463,6 +2506,16 @@ static void load_elf_image(const char *image_name, int image_fd,
 
     mmap_unlock();
 
+    if (tb_cache_dir) {
+        uint8_t build_id[64];
+        size_t len = elf_build_id(image_fd, phdr, ehdr->e_phnum,
+                                  build_id, sizeof(build_id));
+
+        if (len) {
+            tb_cache_add_image(info, build_id, len);
+        }
+    }
+
     close(image_fd);
     return;
 
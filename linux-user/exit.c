@@ -18,6 +18,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu.h"
+#include "qemu/plugin.h"
 
 #ifdef CONFIG_GCOV
 extern void __gcov_dump(void);
@@ -31,5 +32,10 @@ void preexit_cleanup(CPUArchState *env, int code)
 #ifdef CONFIG_GCOV
         __gcov_dump();
 #endif
+        if (do_strace_stats) {
+            print_syscall_stats();
+        }
+        tb_cache_save();
+        qemu_plugin_atexit_cb();
         gdb_exit(env, code);
 }
@@ -36,6 +36,7 @@
 #include "qemu/envlist.h"
 #include "elf.h"
 #include "trace/control.h"
+#include "qemu/plugin.h"
 #include "target_elf.h"
 #include "cpu_loop-common.h"
 
@@ -117,6 +118,7 @@ int cpu_get_pic_interrupt(CPUX86State *env)
 void fork_start(void)
 {
     start_exclusive();
+    tb_gen_fork_start();
     mmap_fork_start();
     cpu_list_lock();
 }
@@ -124,6 +126,7 @@ void fork_start(void)
 void fork_end(int child)
 {
     mmap_fork_end(child);
+    tb_gen_fork_end(child);
     if (child) {
         CPUState *cpu, *next_cpu;
         /* Child processes created by fork() only have a single thread.
@@ -408,6 +411,23 @@ static void handle_arg_strace(const char *arg)
     do_strace = 1;
 }
 
+static void handle_arg_strace_stats(const char *arg)
+{
+    do_strace_stats = 1;
+}
+
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_dir = arg;
+}
+
+#ifdef CONFIG_PLUGIN
+static void handle_arg_plugin(const char *arg)
+{
+    qemu_plugin_opt_parse(arg, &error_fatal);
+}
+#endif
+
 static void handle_arg_version(const char *arg)
 {
     printf("qemu-" TARGET_NAME " version " QEMU_FULL_VERSION
@@ -471,8 +491,16 @@ static const struct qemu_argument arg_table[] = {
      "",           "run in singlestep mode"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
+    {"strace-stats", "QEMU_STRACE_STATS", false, handle_arg_strace_stats,
+     "",           "count time, calls and errors of system calls"},
+#ifdef CONFIG_PLUGIN
+    {"plugin",     "QEMU_PLUGIN",      true,  handle_arg_plugin,
+     "",           "[file=]<file>[,arg=<string>]"},
+#endif
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_randseed,
      "",           "Seed for pseudo-random number generator"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "keep the translated blocks of each binary in 'dir'"},
     {"trace",      "QEMU_TRACE",       true,  handle_arg_trace,
      "",           "[[enable=]<pattern>][,events=<file>][,file=<file>]"},
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
@@ -690,6 +718,7 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
     trace_init_file(trace_file);
+    qemu_plugin_load_list(&error_fatal);
 
     /* Zero out regs */
     memset(regs, 0, sizeof(struct target_pt_regs));
@@ -871,6 +900,9 @@ int main(int argc, char **argv, char **envp)
             exit(EXIT_FAILURE);
         }
         gdb_handlesig(cpu, 0);
+    } else {
+        /* Breakpoints set later would not make it into the copied vCPU */
+        tb_cache_start(env);
     }
     cpu_loop(env);
     /* never exits */
@@ -202,12 +202,18 @@ unsigned long last_brk;
 
 /* Subroutine of mmap_find_vma, used when we have pre-allocated a chunk
    of guest address space.  */
+/*
+ * Find the highest free range of @size bytes ending at or below
+ * @start + @size, wrapping around to the top of the reserved space once.
+ * Each busy candidate moves the search below the mapping it hits, so the
+ * cost depends on the number of mappings rather than on their size.
+ */
 static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
 {
     abi_ulong addr;
     abi_ulong end_addr;
-    int prot;
-    int looped = 0;
+    target_ulong vma_start;
+    bool looped = false;
 
     if (size > reserved_va) {
         return (abi_ulong)-1;
@@ -218,26 +224,22 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
     if (end_addr > reserved_va) {
         end_addr = reserved_va;
     }
-    addr = end_addr - qemu_host_page_size;
 
     while (1) {
-        if (addr > end_addr) {
+        /* Address 0 is never handed out */
+        if (end_addr < size || end_addr - size < qemu_host_page_size) {
             if (looped) {
                 return (abi_ulong)-1;
             }
             end_addr = reserved_va;
-            addr = end_addr - qemu_host_page_size;
-            looped = 1;
+            looped = true;
             continue;
         }
-        prot = page_get_flags(addr);
-        if (prot) {
-            end_addr = addr;
-        }
-        if (addr && addr + size == end_addr) {
+        addr = end_addr - size;
+        if (!page_range_busy(addr, addr + size - 1, &vma_start)) {
             break;
         }
-        addr -= qemu_host_page_size;
+        end_addr = vma_start & qemu_host_page_mask;
     }
 
     if (start == mmap_next_start) {
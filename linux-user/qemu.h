@@ -388,6 +388,17 @@ void print_syscall_ret(int num, abi_long arg1);
  */
 void print_taken_signal(int target_signum, const target_siginfo_t *tinfo);
 extern int do_strace;
+/* Count calls, errors and time of each syscall, printed on exit */
+void record_syscall_stats(int num, abi_long ret, int64_t ns);
+void print_syscall_stats(void);
+extern int do_strace_stats;
+
+/* tbcache.c */
+extern const char *tb_cache_dir;
+void tb_cache_add_image(struct image_info *info,
+                        const uint8_t *build_id, size_t len);
+void tb_cache_start(CPUArchState *env);
+void tb_cache_save(void);
 
 /* signal.c */
 void process_pending_signals(CPUArchState *cpu_env);
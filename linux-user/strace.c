@@ -10,8 +10,10 @@
 #include <linux/if_packet.h>
 #include <sched.h>
 #include "qemu.h"
+#include "qemu/thread.h"
 
 int do_strace=0;
+int do_strace_stats;
 
 struct syscallname {
     int nr;
@@ -2676,6 +2678,112 @@ print_syscall_ret(int num, abi_long ret)
         }
 }
 
+/*
+ * Counters for -strace-stats.  Syscall numbers are hashed into a fixed
+ * table; a number whose slot is already taken by another one is counted
+ * as unaccounted for.
+ */
+#define SYSCALL_STATS_SLOTS 4096
+
+typedef struct SyscallStats {
+    int num;                /* Syscall number plus one, 0 if unused */
+    uint64_t calls;
+    uint64_t errors;
+    int64_t ns;
+} SyscallStats;
+
+static SyscallStats syscall_stats[SYSCALL_STATS_SLOTS];
+static uint64_t syscall_stats_lost;
+static QemuSpin syscall_stats_lock;
+
+void record_syscall_stats(int num, abi_long ret, int64_t ns)
+{
+    SyscallStats *s = &syscall_stats[(unsigned)num % SYSCALL_STATS_SLOTS];
+
+    qemu_spin_lock(&syscall_stats_lock);
+    if (!s->num) {
+        s->num = num + 1;
+    }
+    if (s->num == num + 1) {
+        s->calls++;
+        s->ns += ns;
+        if (is_error(ret)) {
+            s->errors++;
+        }
+    } else {
+        syscall_stats_lost++;
+    }
+    qemu_spin_unlock(&syscall_stats_lock);
+}
+
+static const char *syscall_name(int num)
+{
+    int i;
+
+    for (i = 0; i < nsyscalls; i++) {
+        if (scnames[i].nr == num) {
+            return scnames[i].name;
+        }
+    }
+    return NULL;
+}
+
+static gint syscall_stats_cmp(gconstpointer a, gconstpointer b)
+{
+    const SyscallStats *sa = *(const SyscallStats **)a;
+    const SyscallStats *sb = *(const SyscallStats **)b;
+
+    return sa->ns < sb->ns ? 1 : sa->ns > sb->ns ? -1 : 0;
+}
+
+/* Print a summary in the format of "strace -c" */
+void print_syscall_stats(void)
+{
+    GPtrArray *used = g_ptr_array_new();
+    uint64_t calls = 0, errors = 0;
+    int64_t ns = 0;
+    int i;
+
+    qemu_spin_lock(&syscall_stats_lock);
+    for (i = 0; i < SYSCALL_STATS_SLOTS; i++) {
+        if (syscall_stats[i].num) {
+            g_ptr_array_add(used, &syscall_stats[i]);
+            calls += syscall_stats[i].calls;
+            errors += syscall_stats[i].errors;
+            ns += syscall_stats[i].ns;
+        }
+    }
+    g_ptr_array_sort(used, syscall_stats_cmp);
+
+    gemu_log("%6s %11s %11s %9s %9s %s\n",
+             "% time", "seconds", "usecs/call", "calls", "errors", "syscall");
+    gemu_log("------ ----------- ----------- --------- --------- "
+             "----------------\n");
+    for (i = 0; i < used->len; i++) {
+        SyscallStats *s = g_ptr_array_index(used, i);
+        const char *name = syscall_name(s->num - 1);
+
+        gemu_log("%6.2f %11.6f %11" PRId64 " %9" PRIu64 " %9" PRIu64 " ",
+                 ns ? 100.0 * s->ns / ns : 0.0, s->ns / 1e9,
+                 s->ns / 1000 / s->calls, s->calls, s->errors);
+        if (name) {
+            gemu_log("%s\n", name);
+        } else {
+            gemu_log("syscall_%d\n", s->num - 1);
+        }
+    }
+    gemu_log("------ ----------- ----------- --------- --------- "
+             "----------------\n");
+    gemu_log("100.00 %11.6f %11s %9" PRIu64 " %9" PRIu64 " total\n",
+             ns / 1e9, "", calls, errors);
+    if (syscall_stats_lost) {
+        gemu_log("%" PRIu64 " calls not accounted for\n", syscall_stats_lost);
+    }
+    qemu_spin_unlock(&syscall_stats_lock);
+
+    g_ptr_array_free(used, true);
+}
+
 void print_taken_signal(int target_signum, const target_siginfo_t *tinfo)
 {
     /* Print the strace output for a signal being taken:
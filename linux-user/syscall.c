@@ -20,6 +20,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/path.h"
+#include "qemu/timer.h"
 #include <elf.h>
 #include <endian.h>
 #include <grp.h>
@@ -11658,12 +11659,132 @@ static abi_long do_syscall1(void *cpu_env, int num, abi_long arg1,
     return ret;
 }
 
+/*
+ * When the guest has the same ABI as the host, the syscalls below only take
+ * integers and flat buffers whose layout does not depend on the ABI.  They
+ * are handed straight to the host kernel, with the buffer only checked and
+ * translated with g2h(), instead of going through do_syscall1().
+ */
+#if !defined(DEBUG_REMAP) && \
+    ((defined(TARGET_X86_64) && defined(__x86_64__) && !defined(__ILP32__)) || \
+     (defined(TARGET_AARCH64) && !defined(TARGET_WORDS_BIGENDIAN) && \
+      defined(__aarch64__) && !defined(__AARCH64EB__)))
+#define SYSCALL_DIRECT
+
+typedef struct SyscallDirect {
+    int host_nr;        /* 0 if the syscall must be emulated */
+    int8_t buf;         /* Index of the buffer argument, -1 if none */
+    int8_t len;         /* Index of the argument with its length */
+    int8_t type;        /* VERIFY_READ or VERIFY_WRITE */
+    bool blocking;      /* May sleep until a signal, see safe_syscall */
+} SyscallDirect;
+
+#define DIRECT(name) \
+    [TARGET_NR_##name] = { .host_nr = __NR_##name, .buf = -1 }
+#define DIRECT_BLOCKING(name) \
+    [TARGET_NR_##name] = { .host_nr = __NR_##name, .buf = -1, \
+                           .blocking = true }
+#define DIRECT_BUF(name, b, l, t, blk) \
+    [TARGET_NR_##name] = { .host_nr = __NR_##name, .buf = b, .len = l, \
+                           .type = t, .blocking = blk }
+
+static const SyscallDirect syscall_direct[] = {
+    DIRECT_BUF(read, 1, 2, VERIFY_WRITE, true),
+    DIRECT_BUF(write, 1, 2, VERIFY_READ, true),
+    DIRECT_BUF(pread64, 1, 2, VERIFY_WRITE, false),
+    DIRECT_BUF(pwrite64, 1, 2, VERIFY_READ, false),
+    DIRECT(lseek),
+    DIRECT(fsync),
+    DIRECT(fdatasync),
+    DIRECT(ftruncate),
+    DIRECT_BLOCKING(flock),
+    DIRECT(umask),
+    DIRECT(getpid),
+    DIRECT(getppid),
+    DIRECT(gettid),
+    DIRECT(getuid),
+    DIRECT(geteuid),
+    DIRECT(getgid),
+    DIRECT(getegid),
+    DIRECT(sched_yield),
+};
+
+#undef DIRECT
+#undef DIRECT_BLOCKING
+#undef DIRECT_BUF
+
+/* Return false if @num must go through do_syscall1() */
+static bool do_syscall_direct(int num, abi_long arg1, abi_long arg2,
+                              abi_long arg3, abi_long arg4, abi_long arg5,
+                              abi_long arg6, abi_long *ret)
+{
+    abi_long args[6] = { arg1, arg2, arg3, arg4, arg5, arg6 };
+    const SyscallDirect *d;
+    long host_args[6];
+    int i;
+
+    if (num < 0 || num >= ARRAY_SIZE(syscall_direct) ||
+        !syscall_direct[num].host_nr) {
+        return false;
+    }
+    d = &syscall_direct[num];
+
+    for (i = 0; i < ARRAY_SIZE(host_args); i++) {
+        host_args[i] = args[i];
+    }
+
+    if (d->buf >= 0) {
+        abi_ulong addr = args[d->buf];
+        abi_ulong len = args[d->len];
+
+        /* The buffers hold file data, which fd_trans may need to convert */
+        if (fd_trans_target_to_host_data(args[0]) ||
+            fd_trans_host_to_target_data(args[0])) {
+            return false;
+        }
+        /* Keep a NULL buffer of zero length NULL, like do_syscall1() */
+        if (addr || len) {
+            if (!access_ok(d->type, addr, len)) {
+                *ret = -TARGET_EFAULT;
+                return true;
+            }
+            host_args[d->buf] = (long)g2h(addr);
+        }
+    }
+
+    /*
+     * Only a syscall that can sleep needs safe_syscall() to close the race
+     * with signal delivery; the others return soon enough for the pending
+     * signal to be handled after them.
+     */
+    if (d->blocking) {
+        *ret = get_errno(safe_syscall(d->host_nr, host_args[0], host_args[1],
+                                      host_args[2], host_args[3],
+                                      host_args[4], host_args[5]));
+    } else {
+        *ret = get_errno(syscall(d->host_nr, host_args[0], host_args[1],
+                                 host_args[2], host_args[3], host_args[4],
+                                 host_args[5]));
+    }
+    return true;
+}
+#else
+static inline bool do_syscall_direct(int num, abi_long arg1, abi_long arg2,
+                                     abi_long arg3, abi_long arg4,
+                                     abi_long arg5, abi_long arg6,
+                                     abi_long *ret)
+{
+    return false;
+}
+#endif
+
 abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
                     abi_long arg2, abi_long arg3, abi_long arg4,
                     abi_long arg5, abi_long arg6, abi_long arg7,
                     abi_long arg8)
 {
     CPUState *cpu = ENV_GET_CPU(cpu_env);
+    int64_t start = 0;
     abi_long ret;
 
 #ifdef DEBUG_ERESTARTSYS
@@ -11683,16 +11804,25 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
     trace_guest_user_syscall(cpu, num, arg1, arg2, arg3, arg4,
                              arg5, arg6, arg7, arg8);
 
+    if (unlikely(do_strace_stats)) {
+        start = get_clock();
+    }
+
     if (unlikely(do_strace)) {
         print_syscall(num, arg1, arg2, arg3, arg4, arg5, arg6);
         ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
                           arg5, arg6, arg7, arg8);
         print_syscall_ret(num, ret);
-    } else {
+    } else if (!do_syscall_direct(num, arg1, arg2, arg3, arg4, arg5, arg6,
+                                  &ret)) {
         ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
                           arg5, arg6, arg7, arg8);
     }
 
+    if (unlikely(do_strace_stats)) {
+        record_syscall_stats(num, ret, get_clock() - start);
+    }
+
     trace_guest_user_syscall_ret(cpu, num, ret);
     return ret;
 }
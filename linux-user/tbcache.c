@@ -0,0 +1,357 @@
+/*
+ *  On-disk cache of the translation blocks of guest binaries
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host code cannot be kept across runs: it calls helpers and the
+ * prologue at addresses that move with every start of QEMU.  What we
+ * keep instead is which blocks of each ELF image were translated, and
+ * with which flags.  The file is named after the build-id of the image,
+ * and every page the blocks came from is checksummed so that blocks of
+ * a page that is not the same any more are dropped.
+ *
+ * On the next run of the same binary a helper thread translates the
+ * recorded blocks while the guest starts up, so that the guest finds
+ * them in the hash table instead of translating them itself.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu.h"
+#include "qemu/crc32c.h"
+#include "exec/exec-all.h"
+#include "tcg.h"
+
+#define TB_CACHE_MAGIC      0x43425451  /* "QTBC" in host byte order */
+#define TB_CACHE_VERSION    1
+#define TB_CACHE_MAX_IMAGES 2           /* the program and its interpreter */
+#define TB_CACHE_MAX_TBS    65536       /* per image */
+
+typedef struct TBCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nb_pages;
+    uint32_t nb_tbs;
+} TBCacheHeader;
+
+/* Offsets are from the load bias of the image */
+typedef struct TBCachePage {
+    uint64_t offset;
+    uint32_t crc;
+    uint32_t pad;
+} TBCachePage;
+
+typedef struct TBCacheTB {
+    uint64_t offset;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+} TBCacheTB;
+
+typedef struct TBCacheImage {
+    char *path;
+    abi_ulong load_bias;
+    abi_ulong start_code;
+    abi_ulong end_code;
+    /* Blocks to translate ahead of the guest */
+    TBCacheTB *tbs;
+    uint32_t nb_tbs;
+} TBCacheImage;
+
+const char *tb_cache_dir;
+
+static TBCacheImage tb_cache_images[TB_CACHE_MAX_IMAGES];
+static int tb_cache_nb_images;
+static bool tb_cache_stop;
+
+static uint32_t tb_cache_page_crc(abi_ulong addr)
+{
+    return crc32c(0xffffffff, (uint8_t *)g2h(addr), TARGET_PAGE_SIZE);
+}
+
+static bool tb_cache_page_ok(abi_ulong addr)
+{
+    return (page_get_flags(addr) & (PAGE_READ | PAGE_EXEC)) ==
+           (PAGE_READ | PAGE_EXEC);
+}
+
+/* Keep the recorded blocks whose pages have not changed since */
+static void tb_cache_read(TBCacheImage *img)
+{
+    TBCacheHeader *hdr;
+    TBCachePage *pages;
+    TBCacheTB *tbs;
+    GHashTable *same;
+    gchar *buf;
+    gsize len;
+    uint32_t i;
+
+    if (!g_file_get_contents(img->path, &buf, &len, NULL)) {
+        return;
+    }
+    hdr = (TBCacheHeader *)buf;
+    if (len < sizeof(*hdr) ||
+        hdr->magic != TB_CACHE_MAGIC || hdr->version != TB_CACHE_VERSION ||
+        hdr->nb_tbs > TB_CACHE_MAX_TBS || hdr->nb_pages > hdr->nb_tbs * 2 ||
+        len != sizeof(*hdr) + hdr->nb_pages * sizeof(TBCachePage) +
+               hdr->nb_tbs * sizeof(TBCacheTB)) {
+        g_free(buf);
+        return;
+    }
+    pages = (TBCachePage *)(hdr + 1);
+    tbs = (TBCacheTB *)(pages + hdr->nb_pages);
+
+    same = g_hash_table_new(NULL, NULL);
+    for (i = 0; i < hdr->nb_pages; i++) {
+        abi_ulong addr = img->load_bias + pages[i].offset;
+
+        if (addr >= img->start_code && addr < img->end_code &&
+            !(addr & ~TARGET_PAGE_MASK) && tb_cache_page_ok(addr) &&
+            tb_cache_page_crc(addr) == pages[i].crc) {
+            g_hash_table_add(same, GSIZE_TO_POINTER(addr));
+        }
+    }
+
+    img->tbs = g_new(TBCacheTB, hdr->nb_tbs);
+    for (i = 0; i < hdr->nb_tbs; i++) {
+        abi_ulong page = (img->load_bias + tbs[i].offset) & TARGET_PAGE_MASK;
+
+        if (g_hash_table_contains(same, GSIZE_TO_POINTER(page))) {
+            img->tbs[img->nb_tbs++] = tbs[i];
+        }
+    }
+    g_hash_table_destroy(same);
+    g_free(buf);
+}
+
+void tb_cache_add_image(struct image_info *info,
+                        const uint8_t *build_id, size_t len)
+{
+    TBCacheImage *img;
+    GString *name;
+    size_t i;
+
+    if (tb_cache_nb_images == TB_CACHE_MAX_IMAGES ||
+        info->start_code >= info->end_code) {
+        return;
+    }
+    img = &tb_cache_images[tb_cache_nb_images++];
+
+    name = g_string_new(NULL);
+    g_string_printf(name, "%s/%s-", tb_cache_dir, TARGET_NAME);
+    for (i = 0; i < len; i++) {
+        g_string_append_printf(name, "%02x", build_id[i]);
+    }
+    g_string_append(name, ".tbc");
+    img->path = g_string_free(name, false);
+    img->load_bias = info->load_bias;
+    img->start_code = info->start_code;
+    img->end_code = info->end_code;
+
+    tb_cache_read(img);
+}
+
+static void tb_cache_translate(CPUState *cpu, TBCacheImage *img,
+                               TBCacheTB *e)
+{
+    target_ulong pc = img->load_bias + e->offset;
+
+    /*
+     * mmap_lock is held for the whole translation, so that guest memory
+     * cannot go away under it and so that flushes wait for it: we are
+     * not a vCPU, start_exclusive() does not stop us.  A block never
+     * spans more than two pages, and both must be there to be read.
+     */
+    tb_gen_lock();
+    mmap_lock();
+    if (tb_cache_page_ok(pc) && tb_cache_page_ok(pc + TARGET_PAGE_SIZE) &&
+        !tb_htable_lookup(cpu, pc, e->cs_base, e->flags, e->cflags)) {
+        tb_gen_code(cpu, pc, e->cs_base, e->flags, e->cflags);
+    }
+    mmap_unlock();
+    tb_gen_unlock();
+}
+
+static void *tb_cache_thread(void *opaque)
+{
+    CPUState *cpu = opaque;
+    int i;
+    uint32_t j;
+
+    rcu_register_thread();
+    rcu_read_lock();
+    if (sigsetjmp(cpu->jmp_env, 0) == 0) {
+        for (i = 0; i < tb_cache_nb_images; i++) {
+            TBCacheImage *img = &tb_cache_images[i];
+
+            for (j = 0; j < img->nb_tbs; j++) {
+                /* Leave room for what the guest translates itself */
+                if (atomic_read(&tb_cache_stop) ||
+                    tcg_code_size() > tcg_code_capacity() / 2) {
+                    goto out;
+                }
+                tb_cache_translate(cpu, img, &img->tbs[j]);
+            }
+        }
+    } else {
+        /* tb_gen_code() ran out of space anyway and gave up tb_gen_lock */
+        if (have_mmap_lock()) {
+            mmap_unlock();
+        }
+    }
+out:
+    rcu_read_unlock();
+    object_unref(OBJECT(cpu));
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void tb_cache_start(CPUArchState *env)
+{
+    CPUState *cpu;
+    QemuThread thread;
+    int i;
+
+    for (i = 0; i < tb_cache_nb_images; i++) {
+        if (tb_cache_images[i].nb_tbs) {
+            break;
+        }
+    }
+    if (i == tb_cache_nb_images) {
+        return;
+    }
+
+    /*
+     * Translate with a copy of the vCPU, which must not be seen as a
+     * thread of the guest.
+     */
+    cpu = ENV_GET_CPU(cpu_copy(env));
+    cpu_list_remove(cpu);
+    qemu_thread_create(&thread, "tb-cache", tb_cache_thread, cpu,
+                       QEMU_THREAD_DETACHED);
+}
+
+typedef struct TBCacheSave {
+    TBCacheImage *img;
+    GArray *tbs;
+    GHashTable *pages;
+} TBCacheSave;
+
+static void tb_cache_add_page(TBCacheSave *s, abi_ulong addr)
+{
+    gpointer key = GSIZE_TO_POINTER(addr & TARGET_PAGE_MASK);
+
+    if (!g_hash_table_contains(s->pages, key) &&
+        tb_cache_page_ok(addr & TARGET_PAGE_MASK)) {
+        g_hash_table_insert(s->pages, key, GUINT_TO_POINTER(
+                            tb_cache_page_crc(addr & TARGET_PAGE_MASK)));
+    }
+}
+
+static gboolean tb_cache_collect(gpointer key, gpointer value, gpointer data)
+{
+    const TranslationBlock *tb = value;
+    TBCacheSave *s = data;
+    TBCacheTB e = {};
+    uint32_t cflags = tb_cflags(tb);
+
+    if (cflags & (CF_NOCACHE | CF_INVALID) ||
+        tb->pc < s->img->start_code || tb->pc >= s->img->end_code) {
+        return false;
+    }
+
+    e.offset = tb->pc - s->img->load_bias;
+    e.cs_base = tb->cs_base;
+    e.flags = tb->flags;
+    e.cflags = cflags & CF_HASH_MASK & ~CF_CLUSTER_MASK;
+    g_array_append_val(s->tbs, e);
+    tb_cache_add_page(s, tb->pc);
+    tb_cache_add_page(s, tb->pc + tb->size - 1);
+
+    return s->tbs->len == TB_CACHE_MAX_TBS;
+}
+
+static void tb_cache_write(TBCacheSave *s)
+{
+    TBCacheHeader hdr = {
+        .magic = TB_CACHE_MAGIC,
+        .version = TB_CACHE_VERSION,
+        .nb_pages = g_hash_table_size(s->pages),
+        .nb_tbs = s->tbs->len,
+    };
+    GHashTableIter iter;
+    gpointer key, value;
+    char *tmp;
+    FILE *f;
+    bool ok;
+
+    /* Other runs of the binary may want the file at the same time */
+    tmp = g_strdup_printf("%s.%d", s->img->path, getpid());
+    f = fopen(tmp, "w");
+    if (!f) {
+        g_free(tmp);
+        return;
+    }
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    g_hash_table_iter_init(&iter, s->pages);
+    while (ok && g_hash_table_iter_next(&iter, &key, &value)) {
+        TBCachePage page = {
+            .offset = (abi_ulong)GPOINTER_TO_SIZE(key) - s->img->load_bias,
+            .crc = GPOINTER_TO_UINT(value),
+        };
+        ok = fwrite(&page, sizeof(page), 1, f) == 1;
+    }
+    if (ok && s->tbs->len) {
+        ok = fwrite(s->tbs->data, sizeof(TBCacheTB), s->tbs->len, f) ==
+             s->tbs->len;
+    }
+    if (fclose(f) == 0 && ok) {
+        ok = rename(tmp, s->img->path) == 0;
+    }
+    if (!ok) {
+        unlink(tmp);
+    }
+    g_free(tmp);
+}
+
+void tb_cache_save(void)
+{
+    int i;
+
+    if (!tb_cache_nb_images) {
+        return;
+    }
+
+    /* Stop the helper thread; it won't get tb_gen_lock back */
+    atomic_set(&tb_cache_stop, true);
+    tb_gen_lock();
+    mmap_lock();
+    for (i = 0; i < tb_cache_nb_images; i++) {
+        TBCacheSave s = {
+            .img = &tb_cache_images[i],
+            .tbs = g_array_new(false, false, sizeof(TBCacheTB)),
+            .pages = g_hash_table_new(NULL, NULL),
+        };
+
+        tcg_tb_foreach(tb_cache_collect, &s);
+        if (s.tbs->len) {
+            tb_cache_write(&s);
+        }
+        g_array_free(s.tbs, true);
+        g_hash_table_destroy(s.pages);
+    }
+    mmap_unlock();
+    tb_gen_unlock();
+}
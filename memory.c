@@ -39,6 +39,15 @@ static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
 static bool global_dirty_log = false;
 
+/*
+ * Regions changed by the current transaction, so that only the FlatViews
+ * that can reach one of them are rendered again.  If
+ * memory_region_update_all is set, the change may affect any region and
+ * all FlatViews are rendered again.
+ */
+static GHashTable *memory_region_updated;
+static bool memory_region_update_all;
+
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
 
@@ -47,6 +56,23 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
 
 static GHashTable *flat_views;
 
+unsigned int flatview_generation;
+
+/* Record that @mr changed in a way that affects rendering; NULL for all */
+static void memory_region_mark_update(MemoryRegion *mr)
+{
+    memory_region_update_pending = true;
+    if (!mr) {
+        memory_region_update_all = true;
+        return;
+    }
+    if (!memory_region_updated) {
+        memory_region_updated = g_hash_table_new(g_direct_hash,
+                                                 g_direct_equal);
+    }
+    g_hash_table_add(memory_region_updated, mr);
+}
+
 typedef struct AddrRange AddrRange;
 
 /*
@@ -725,9 +751,38 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
 }
 
 /* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+/* Serializes flatview_build_dispatch(), which can run outside the BQL */
+static QemuMutex flatview_dispatch_lock;
+
+AddressSpaceDispatch *flatview_build_dispatch(FlatView *view)
 {
+    AddressSpaceDispatch *d;
     int i;
+
+    qemu_mutex_lock(&flatview_dispatch_lock);
+    d = atomic_rcu_read(&view->dispatch);
+    if (d) {
+        /* Somebody else got here first */
+        goto out;
+    }
+
+    trace_flatview_build_dispatch(view, view->root);
+    d = address_space_dispatch_new(view);
+    for (i = 0; i < view->nr; i++) {
+        MemoryRegionSection mrs =
+            section_from_flat_range(&view->ranges[i], view);
+        flatview_add_to_dispatch(d, view, &mrs);
+    }
+    address_space_dispatch_compact(d);
+    atomic_rcu_set(&view->dispatch, d);
+
+out:
+    qemu_mutex_unlock(&flatview_dispatch_lock);
+    return d;
+}
+
+static FlatView *generate_memory_topology(MemoryRegion *mr)
+{
     FlatView *view;
 
     view = flatview_new(mr);
@@ -739,13 +794,7 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
-    view->dispatch = address_space_dispatch_new(view);
-    for (i = 0; i < view->nr; i++) {
-        MemoryRegionSection mrs =
-            section_from_flat_range(&view->ranges[i], view);
-        flatview_add_to_dispatch(view, &mrs);
-    }
-    address_space_dispatch_compact(view->dispatch);
+    /* The dispatch tree is built on first use by flatview_to_dispatch() */
     g_hash_table_replace(flat_views, mr, view);
 
     return view;
@@ -972,6 +1021,7 @@ static void flatviews_init(void)
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
     if (!empty_view) {
+        qemu_mutex_init(&flatview_dispatch_lock);
         empty_view = generate_memory_topology(NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
@@ -981,29 +1031,83 @@ static void flatviews_init(void)
     }
 }
 
+/*
+ * Whether the rendering of @mr may have changed in this transaction, i.e.
+ * whether one of the updated regions is reachable from it through enabled
+ * subregions and aliases.  @visited avoids walking shared subtrees twice.
+ */
+static bool memory_region_update_reaches(MemoryRegion *mr,
+                                         GHashTable *visited)
+{
+    MemoryRegion *subregion;
+
+    if (g_hash_table_contains(visited, mr)) {
+        return false;
+    }
+    g_hash_table_add(visited, mr);
+
+    if (g_hash_table_contains(memory_region_updated, mr)) {
+        return true;
+    }
+    if (!mr->enabled) {
+        return false;
+    }
+    if (mr->alias) {
+        return memory_region_update_reaches(mr->alias, visited);
+    }
+    QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
+        if (memory_region_update_reaches(subregion, visited)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
+    GHashTable *visited = NULL;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /* Render unique FVs, keeping those that no update can reach */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *old_view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
+        old_view = old_views && physmr && !memory_region_update_all ?
+                   g_hash_table_lookup(old_views, physmr) : NULL;
+        if (old_view) {
+            if (!visited) {
+                visited = g_hash_table_new(g_direct_hash, g_direct_equal);
+            }
+            g_hash_table_remove_all(visited);
+            if (!memory_region_update_reaches(physmr, visited)) {
+                flatview_ref(old_view);
+                g_hash_table_replace(flat_views, physmr, old_view);
+                continue;
+            }
+        }
+
         generate_memory_topology(physmr);
     }
+
+    if (visited) {
+        g_hash_table_destroy(visited);
+    }
+    if (old_views) {
+        g_hash_table_unref(old_views);
+    }
 }
 
-static void address_space_set_flatview(AddressSpace *as)
+/* Returns true if @as now uses a different FlatView */
+static bool address_space_set_flatview(AddressSpace *as)
 {
     FlatView *old_view = address_space_to_flatview(as);
     MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
@@ -1012,7 +1116,7 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
-        return;
+        return false;
     }
 
     if (old_view) {
@@ -1033,6 +1137,12 @@ static void address_space_set_flatview(AddressSpace *as)
 
     /* Writes are protected by the BQL.  */
     atomic_rcu_set(&as->current_map, new_view);
+
+    /*
+     * Translations cached from old_view become invalid; the bump must be
+     * visible before old_view can be freed at the end of a grace period.
+     */
+    atomic_inc(&flatview_generation);
     if (old_view) {
         flatview_unref(old_view);
     }
@@ -1046,6 +1156,7 @@ static void address_space_set_flatview(AddressSpace *as)
     if (old_view) {
         flatview_unref(old_view);
     }
+    return true;
 }
 
 static void address_space_update_topology(AddressSpace *as)
@@ -1075,17 +1186,26 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
+            /* Every address space drops its old FlatView below.  */
+            call_rcu_batch_begin();
             flatviews_reset();
 
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (address_space_set_flatview(as) ||
+                    ioeventfd_update_pending) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
+            memory_region_update_all = false;
+            if (memory_region_updated) {
+                g_hash_table_remove_all(memory_region_updated);
+            }
             ioeventfd_update_pending = false;
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+            call_rcu_batch_end();
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -1758,6 +1878,14 @@ static void memory_region_finalize(Object *obj)
     }
     memory_region_transaction_commit();
 
+    /*
+     * Unreachable regions cannot affect any FlatView, but a pending
+     * transaction must not keep a dangling pointer
+     */
+    if (memory_region_updated) {
+        g_hash_table_remove(memory_region_updated, mr);
+    }
+
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
     g_free((char *)mr->name);
@@ -2022,7 +2150,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_mark_update(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2056,16 +2186,73 @@ static void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
      * address space once.
      */
     QTAILQ_FOREACH(listener, &memory_listeners, link) {
-        if (!listener->log_sync) {
+        if (listener->log_sync) {
+            as = listener->address_space;
+            view = address_space_get_flatview(as);
+            FOR_EACH_FLAT_RANGE(fr, view) {
+                if (fr->dirty_log_mask && (!mr || fr->mr == mr)) {
+                    MemoryRegionSection mrs = section_from_flat_range(fr, view);
+                    listener->log_sync(listener, &mrs);
+                }
+            }
+            flatview_unref(view);
+        } else if (listener->log_sync_global) {
+            /*
+             * No matter whether MR is specified, what we can do here
+             * is to do a global sync, because we are not capable to
+             * sync in a finer granularity.
+             */
+            listener->log_sync_global(listener);
+        }
+    }
+}
+
+void memory_region_clear_dirty_bitmap(MemoryRegion *mr, hwaddr start,
+                                      hwaddr len)
+{
+    MemoryRegionSection mrs;
+    MemoryListener *listener;
+    AddressSpace *as;
+    FlatView *view;
+    FlatRange *fr;
+    hwaddr sec_start, sec_end, sec_size;
+
+    QTAILQ_FOREACH(listener, &memory_listeners, link) {
+        if (!listener->log_clear) {
             continue;
         }
         as = listener->address_space;
         view = address_space_get_flatview(as);
         FOR_EACH_FLAT_RANGE(fr, view) {
-            if (fr->dirty_log_mask && (!mr || fr->mr == mr)) {
-                MemoryRegionSection mrs = section_from_flat_range(fr, view);
-                listener->log_sync(listener, &mrs);
+            if (!fr->dirty_log_mask || fr->mr != mr) {
+                /*
+                 * Clear dirty bitmap operation only applies to those
+                 * regions whose dirty logging is at least enabled
+                 */
+                continue;
             }
+
+            mrs = section_from_flat_range(fr, view);
+
+            sec_start = MAX(mrs.offset_within_region, start);
+            sec_end = mrs.offset_within_region + int128_get64(mrs.size);
+            sec_end = MIN(sec_end, start + len);
+
+            if (sec_start >= sec_end) {
+                /*
+                 * If this memory region section has no intersection
+                 * with the requested range, skip.
+                 */
+                continue;
+            }
+
+            /* Valid case; shrink the section if needed */
+            mrs.offset_within_address_space +=
+                sec_start - mrs.offset_within_region;
+            mrs.offset_within_region = sec_start;
+            sec_size = sec_end - sec_start;
+            mrs.size = int128_make64(sec_size);
+            listener->log_clear(listener, &mrs);
         }
         flatview_unref(view);
     }
@@ -2076,10 +2263,14 @@ DirtyBitmapSnapshot *memory_region_snapshot_and_clear_dirty(MemoryRegion *mr,
                                                             hwaddr size,
                                                             unsigned client)
 {
+    DirtyBitmapSnapshot *snap;
+
     assert(mr->ram_block);
     memory_region_sync_dirty_bitmap(mr);
-    return cpu_physical_memory_snapshot_and_clear_dirty(
+    snap = cpu_physical_memory_snapshot_and_clear_dirty(
                 memory_region_get_ram_addr(mr) + addr, size, client);
+    memory_region_clear_dirty_bitmap(mr, addr, size);
+    return snap;
 }
 
 bool memory_region_snapshot_get_dirty(MemoryRegion *mr, DirtyBitmapSnapshot *snap,
@@ -2095,7 +2286,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_update(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2105,7 +2298,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_update(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2115,7 +2310,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_update(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2358,7 +2555,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_mark_update(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2397,7 +2596,9 @@ void memory_region_del_subregion(MemoryRegion *mr,
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_mark_update(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2408,7 +2609,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_mark_update(mr);
     memory_region_transaction_commit();
 }
 
@@ -2424,7 +2625,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_mark_update(mr);
     memory_region_transaction_commit();
 }
 
@@ -2461,7 +2662,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_mark_update(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2585,7 +2788,7 @@ void memory_global_dirty_log_start(void)
 
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
-    memory_region_update_pending = true;
+    memory_region_mark_update(NULL);
     memory_region_transaction_commit();
 }
 
@@ -2595,7 +2798,7 @@ static void memory_global_dirty_log_do_stop(void)
 
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
-    memory_region_update_pending = true;
+    memory_region_mark_update(NULL);
     memory_region_transaction_commit();
 
     MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
@@ -2740,6 +2943,11 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
     as->name = g_strdup(name ? name : "anonymous");
+    qemu_mutex_init(&as->bounce_lock);
+    as->bounce_buffer_size = 0;
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    QLIST_INIT(&as->bounce_buffers);
+    QLIST_INIT(&as->map_client_list);
     address_space_update_topology(as);
     address_space_update_ioeventfds(as);
 }
@@ -2747,8 +2955,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 static void do_address_space_destroy(AddressSpace *as)
 {
     assert(QTAILQ_EMPTY(&as->listeners));
+    assert(QLIST_EMPTY(&as->bounce_buffers));
 
     flatview_unref(as->current_map);
+    qemu_mutex_destroy(&as->bounce_lock);
     g_free(as->name);
     g_free(as->ioeventfds);
     memory_region_unref(as->root);
@@ -3018,7 +3228,7 @@ static void mtree_print_flatview(gpointer key, gpointer value,
 
 #if !defined(CONFIG_USER_ONLY)
     if (fvi->dispatch_tree && view->root) {
-        mtree_print_dispatch(p, f, view->dispatch, view->root);
+        mtree_print_dispatch(p, f, flatview_to_dispatch(view), view->root);
     }
 #endif
 
@@ -0,0 +1,283 @@
+/*
+ * Dirty page rate limit for virtual CPUs
+ *
+ * Unlike the auto-converge throttle, which slows down all vcpus alike,
+ * this measures the rate at which each vcpu dirties memory, harvested
+ * from the KVM dirty rings, and only throttles the vcpus that go above
+ * their quota, by just as much as needed to bring them back under it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "qom/cpu.h"
+#include "sysemu/kvm.h"
+#include "sysemu/sysemu.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-migration.h"
+#include "dirtylimit.h"
+#include "trace.h"
+
+/* Each vcpu sleeps (throttle_pct)% of every timeslice */
+#define DIRTYLIMIT_TIMESLICE_NS    10000000
+/* The dirty page rates are measured over this many timeslices */
+#define DIRTYLIMIT_CALC_TIMESLICES 100
+#define DIRTYLIMIT_PCT_MAX         99
+/* Leave the throttle alone while within 1/N of the quota */
+#define DIRTYLIMIT_TOLERANCE       20
+
+typedef struct VcpuDirtyLimitState {
+    bool enabled;
+    /* MB/s */
+    uint64_t quota;
+    /* MB/s, as of the last measurement */
+    uint64_t current_rate;
+    uint64_t last_pages;
+    int throttle_pct;
+    bool scheduled;
+} VcpuDirtyLimitState;
+
+static struct {
+    VcpuDirtyLimitState *states;
+    int limited_nvcpu;
+    QEMUTimer *timer;
+    unsigned int ticks;
+    int64_t last_calc_ns;
+} dirtylimit;
+
+static void dirtylimit_vcpu_sleep(CPUState *cpu, run_on_cpu_data opaque)
+{
+    VcpuDirtyLimitState *st = &dirtylimit.states[cpu->cpu_index];
+    int pct = atomic_read(&st->throttle_pct);
+
+    if (pct) {
+        qemu_mutex_unlock_iothread();
+        g_usleep((int64_t)pct * DIRTYLIMIT_TIMESLICE_NS / 100 / SCALE_US);
+        qemu_mutex_lock_iothread();
+    }
+    atomic_set(&st->scheduled, false);
+}
+
+/*
+ * The measured rate already accounts for the current throttling, so
+ * scale the rate the vcpu would reach on its own down to the quota.
+ */
+static int dirtylimit_throttle_pct(int pct, uint64_t quota, uint64_t rate)
+{
+    double next;
+
+    if (!rate) {
+        return 0;
+    }
+
+    if (rate <= quota + quota / DIRTYLIMIT_TOLERANCE &&
+        rate + quota / DIRTYLIMIT_TOLERANCE >= quota) {
+        return pct;
+    }
+
+    next = 100.0 - (double)quota * (100 - pct) / rate;
+    if (next <= 0) {
+        return 0;
+    }
+    return MIN((int)(next + 0.5), DIRTYLIMIT_PCT_MAX);
+}
+
+static void dirtylimit_calc(int64_t now)
+{
+    int64_t period_ms = (now - dirtylimit.last_calc_ns) / SCALE_MS;
+    VcpuDirtyLimitState *st;
+    uint64_t pages;
+    CPUState *cpu;
+
+    kvm_dirty_ring_sync();
+
+    CPU_FOREACH(cpu) {
+        st = &dirtylimit.states[cpu->cpu_index];
+        pages = cpu->dirty_pages - st->last_pages;
+        st->last_pages = cpu->dirty_pages;
+        st->current_rate = pages * qemu_real_host_page_size * 1000 /
+                           (MAX(period_ms, 1) * MiB);
+        if (st->enabled) {
+            st->throttle_pct = dirtylimit_throttle_pct(st->throttle_pct,
+                                                       st->quota,
+                                                       st->current_rate);
+            trace_dirtylimit_calc(cpu->cpu_index, st->quota,
+                                  st->current_rate, st->throttle_pct);
+        }
+    }
+
+    dirtylimit.last_calc_ns = now;
+}
+
+static void dirtylimit_timer_tick(void *opaque)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT);
+    VcpuDirtyLimitState *st;
+    CPUState *cpu;
+
+    if (!dirtylimit.limited_nvcpu) {
+        return;
+    }
+
+    if (++dirtylimit.ticks >= DIRTYLIMIT_CALC_TIMESLICES) {
+        dirtylimit.ticks = 0;
+        dirtylimit_calc(now);
+    }
+
+    CPU_FOREACH(cpu) {
+        st = &dirtylimit.states[cpu->cpu_index];
+        if (st->throttle_pct && !atomic_xchg(&st->scheduled, true)) {
+            async_run_on_cpu(cpu, dirtylimit_vcpu_sleep, RUN_ON_CPU_NULL);
+        }
+    }
+
+    timer_mod(dirtylimit.timer, now + DIRTYLIMIT_TIMESLICE_NS);
+}
+
+static void dirtylimit_start(void)
+{
+    CPUState *cpu;
+
+    if (!dirtylimit.timer) {
+        dirtylimit.states = g_new0(VcpuDirtyLimitState, max_cpus);
+        dirtylimit.timer = timer_new_ns(QEMU_CLOCK_VIRTUAL_RT,
+                                        dirtylimit_timer_tick, NULL);
+    }
+
+    /* Only count what gets dirtied from now on */
+    kvm_dirty_ring_sync();
+    CPU_FOREACH(cpu) {
+        dirtylimit.states[cpu->cpu_index].last_pages = cpu->dirty_pages;
+    }
+    dirtylimit.ticks = 0;
+    dirtylimit.last_calc_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT);
+    timer_mod(dirtylimit.timer,
+              dirtylimit.last_calc_ns + DIRTYLIMIT_TIMESLICE_NS);
+}
+
+void dirtylimit_set_vcpu(int cpu_index, uint64_t quota, bool enable)
+{
+    VcpuDirtyLimitState *st;
+
+    if (enable && !dirtylimit.limited_nvcpu) {
+        dirtylimit_start();
+    } else if (!dirtylimit.states) {
+        return;
+    }
+
+    st = &dirtylimit.states[cpu_index];
+    if (enable) {
+        if (!st->enabled) {
+            st->enabled = true;
+            dirtylimit.limited_nvcpu++;
+        }
+        st->quota = quota;
+    } else if (st->enabled) {
+        st->enabled = false;
+        st->quota = 0;
+        atomic_set(&st->throttle_pct, 0);
+        if (!--dirtylimit.limited_nvcpu) {
+            timer_del(dirtylimit.timer);
+        }
+    }
+    trace_dirtylimit_set_vcpu(cpu_index, quota, enable);
+}
+
+void dirtylimit_set_all(uint64_t quota, bool enable)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        dirtylimit_set_vcpu(cpu->cpu_index, quota, enable);
+    }
+}
+
+bool dirtylimit_in_service(void)
+{
+    return dirtylimit.limited_nvcpu != 0;
+}
+
+static bool dirtylimit_check(bool has_cpu_index, int64_t cpu_index,
+                             Error **errp)
+{
+    if (!kvm_dirty_ring_enabled()) {
+        error_setg(errp, "dirty page rate limit requires the KVM dirty ring");
+        error_append_hint(errp, "Set the kvm-dirty-ring-size property of "
+                          "the machine to enable it.\n");
+        return false;
+    }
+
+    if (has_cpu_index && !qemu_get_cpu(cpu_index)) {
+        error_setg(errp, "cpu index out of range");
+        return false;
+    }
+
+    return true;
+}
+
+void qmp_set_vcpu_dirty_limit(bool has_cpu_index, int64_t cpu_index,
+                              uint64_t dirty_rate, Error **errp)
+{
+    if (!dirtylimit_check(has_cpu_index, cpu_index, errp)) {
+        return;
+    }
+
+    if (!dirty_rate) {
+        error_setg(errp, "dirty-rate must be greater than 0, use "
+                   "cancel-vcpu-dirty-limit to lift the limit");
+        return;
+    }
+
+    if (has_cpu_index) {
+        dirtylimit_set_vcpu(cpu_index, dirty_rate, true);
+    } else {
+        dirtylimit_set_all(dirty_rate, true);
+    }
+}
+
+void qmp_cancel_vcpu_dirty_limit(bool has_cpu_index, int64_t cpu_index,
+                                 Error **errp)
+{
+    if (!dirtylimit_check(has_cpu_index, cpu_index, errp)) {
+        return;
+    }
+
+    if (has_cpu_index) {
+        dirtylimit_set_vcpu(cpu_index, 0, false);
+    } else {
+        dirtylimit_set_all(0, false);
+    }
+}
+
+DirtyLimitInfoList *qmp_query_vcpu_dirty_limit(Error **errp)
+{
+    DirtyLimitInfoList *head = NULL, **tail = &head;
+    DirtyLimitInfoList *entry;
+    VcpuDirtyLimitState *st;
+    CPUState *cpu;
+
+    if (!dirtylimit_in_service()) {
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        st = &dirtylimit.states[cpu->cpu_index];
+        if (!st->enabled) {
+            continue;
+        }
+        entry = g_new0(DirtyLimitInfoList, 1);
+        entry->value = g_new0(DirtyLimitInfo, 1);
+        entry->value->cpu_index = cpu->cpu_index;
+        entry->value->limit_rate = st->quota;
+        entry->value->current_rate = st->current_rate;
+        entry->value->throttle_percentage = st->throttle_pct;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return head;
+}
@@ -0,0 +1,36 @@
+/*
+ * Dirty page rate limit for virtual CPUs
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_DIRTYLIMIT_H
+#define QEMU_MIGRATION_DIRTYLIMIT_H
+
+/**
+ * dirtylimit_set_vcpu:
+ * @cpu_index: index of the vcpu to limit
+ * @quota: dirty page rate limit, in MB/s
+ * @enable: whether to set or lift the limit of the vcpu
+ *
+ * A limited vcpu is only throttled while it dirties memory faster than
+ * @quota.  Must be called with the BQL held.
+ */
+void dirtylimit_set_vcpu(int cpu_index, uint64_t quota, bool enable);
+
+/**
+ * dirtylimit_set_all:
+ *
+ * Like dirtylimit_set_vcpu(), for every vcpu of the machine.
+ */
+void dirtylimit_set_all(uint64_t quota, bool enable);
+
+/**
+ * dirtylimit_in_service:
+ *
+ * Returns: true if the dirty page rate of any vcpu is limited.
+ */
+bool dirtylimit_in_service(void);
+
+#endif
@@ -0,0 +1,272 @@
+/*
+ * Dirty page rate measurement
+ *
+ * Estimates how fast the guest dirties its memory without starting a
+ * migration (and so without touching the dirty log): a random sample
+ * of the pages of each RAMBlock is hashed, and hashed again after the
+ * measurement period; the share of sampled pages whose hash changed
+ * gives the share of the RAMBlock that was dirtied.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <zlib.h>
+#include "qemu/units.h"
+#include "qemu/timer.h"
+#include "qemu/thread.h"
+#include "qemu/rcu.h"
+#include "exec/cpu-common.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-migration.h"
+#include "trace.h"
+
+#define DIRTYRATE_MIN_CALC_TIME         1
+#define DIRTYRATE_MAX_CALC_TIME         60
+/* Number of pages sampled per GiB of RAMBlock */
+#define DIRTYRATE_DEFAULT_SAMPLE_PAGES  512
+#define DIRTYRATE_MIN_SAMPLE_PAGES      128
+#define DIRTYRATE_MAX_SAMPLE_PAGES      4096
+
+typedef struct RAMBlockDirtyInfo {
+    char idstr[256];
+    uint64_t size;
+    uint64_t *sample_page_vfn;
+    uint32_t *hash;
+    uint32_t sample_pages;
+    uint32_t dirty_pages;
+    /* The RAMBlock went away or was resized before the end */
+    bool gone;
+} RAMBlockDirtyInfo;
+
+typedef struct DirtyRateSample {
+    RAMBlockDirtyInfo *blocks;
+    int nblocks;
+    int64_t sample_pages;
+    GRand *rand;
+} DirtyRateSample;
+
+/* Owned by the measuring thread while the status is "measuring" */
+static struct {
+    int status;
+    int64_t start_time;
+    int64_t calc_time;
+    int64_t sample_pages;
+    int64_t dirty_rate;
+    DirtyRateSample sample;
+} dirtyrate;
+
+static uint32_t dirtyrate_page_hash(void *host, uint64_t vfn)
+{
+    size_t page_size = qemu_target_page_size();
+
+    return crc32(0, (uint8_t *)host + vfn * page_size, page_size);
+}
+
+static int dirtyrate_record_block(RAMBlock *rb, void *opaque)
+{
+    DirtyRateSample *sample = opaque;
+    uint64_t size = qemu_ram_get_used_length(rb);
+    uint64_t npages = size / qemu_target_page_size();
+    void *host = qemu_ram_get_host_addr(rb);
+    RAMBlockDirtyInfo *info;
+    uint32_t i;
+
+    if (!qemu_ram_is_migratable(rb) || !npages) {
+        return 0;
+    }
+
+    sample->blocks = g_renew(RAMBlockDirtyInfo, sample->blocks,
+                             sample->nblocks + 1);
+    info = &sample->blocks[sample->nblocks++];
+    memset(info, 0, sizeof(*info));
+    pstrcpy(info->idstr, sizeof(info->idstr), qemu_ram_get_idstr(rb));
+    info->size = size;
+    info->sample_pages = MIN(npages,
+                             DIV_ROUND_UP(sample->sample_pages * size, GiB));
+    info->sample_page_vfn = g_new(uint64_t, info->sample_pages);
+    info->hash = g_new(uint32_t, info->sample_pages);
+
+    for (i = 0; i < info->sample_pages; i++) {
+        info->sample_page_vfn[i] = (uint64_t)g_rand_double_range(sample->rand,
+                                                                 0, npages);
+        info->hash[i] = dirtyrate_page_hash(host, info->sample_page_vfn[i]);
+    }
+
+    return 0;
+}
+
+static int dirtyrate_compare_block(RAMBlock *rb, void *opaque)
+{
+    DirtyRateSample *sample = opaque;
+    void *host = qemu_ram_get_host_addr(rb);
+    RAMBlockDirtyInfo *info;
+    uint32_t i;
+    int n;
+
+    for (n = 0; n < sample->nblocks; n++) {
+        info = &sample->blocks[n];
+        if (!strcmp(info->idstr, qemu_ram_get_idstr(rb))) {
+            break;
+        }
+    }
+    if (n == sample->nblocks) {
+        /* Added during the measurement */
+        return 0;
+    }
+
+    if (info->size != qemu_ram_get_used_length(rb)) {
+        return 0;
+    }
+
+    for (i = 0; i < info->sample_pages; i++) {
+        if (dirtyrate_page_hash(host, info->sample_page_vfn[i]) !=
+            info->hash[i]) {
+            info->dirty_pages++;
+        }
+    }
+    info->gone = false;
+
+    return 0;
+}
+
+static void dirtyrate_sample_free(DirtyRateSample *sample)
+{
+    int n;
+
+    for (n = 0; n < sample->nblocks; n++) {
+        g_free(sample->blocks[n].sample_page_vfn);
+        g_free(sample->blocks[n].hash);
+    }
+    g_free(sample->blocks);
+    sample->blocks = NULL;
+    sample->nblocks = 0;
+}
+
+/* MB/s dirtied in the block, extrapolated from the sampled pages */
+static int64_t dirtyrate_block_rate(RAMBlockDirtyInfo *info,
+                                    int64_t calc_time)
+{
+    if (info->gone || !info->sample_pages) {
+        return 0;
+    }
+
+    return (double)info->size / MiB * info->dirty_pages /
+           info->sample_pages / calc_time;
+}
+
+static void *dirtyrate_thread(void *opaque)
+{
+    DirtyRateSample *sample = &dirtyrate.sample;
+    int64_t rate = 0;
+    int n;
+
+    rcu_register_thread();
+
+    sample->rand = g_rand_new();
+    sample->sample_pages = dirtyrate.sample_pages;
+    qemu_ram_foreach_block(dirtyrate_record_block, sample);
+
+    g_usleep(dirtyrate.calc_time * G_USEC_PER_SEC);
+
+    for (n = 0; n < sample->nblocks; n++) {
+        sample->blocks[n].gone = true;
+    }
+    qemu_ram_foreach_block(dirtyrate_compare_block, sample);
+
+    for (n = 0; n < sample->nblocks; n++) {
+        rate += dirtyrate_block_rate(&sample->blocks[n], dirtyrate.calc_time);
+        trace_dirtyrate_block(sample->blocks[n].idstr,
+                              sample->blocks[n].sample_pages,
+                              sample->blocks[n].dirty_pages);
+    }
+    dirtyrate.dirty_rate = rate;
+    g_rand_free(sample->rand);
+    sample->rand = NULL;
+    trace_dirtyrate_measured(rate);
+
+    atomic_mb_set(&dirtyrate.status, DIRTY_RATE_STATUS_MEASURED);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void qmp_calc_dirty_rate(int64_t calc_time, bool has_sample_pages,
+                         int64_t sample_pages, Error **errp)
+{
+    QemuThread thread;
+
+    if (atomic_mb_read(&dirtyrate.status) == DIRTY_RATE_STATUS_MEASURING) {
+        error_setg(errp, "the dirty page rate is already being measured");
+        return;
+    }
+
+    if (calc_time < DIRTYRATE_MIN_CALC_TIME ||
+        calc_time > DIRTYRATE_MAX_CALC_TIME) {
+        error_setg(errp, "calc-time is out of range [%d, %d]",
+                   DIRTYRATE_MIN_CALC_TIME, DIRTYRATE_MAX_CALC_TIME);
+        return;
+    }
+
+    if (!has_sample_pages) {
+        sample_pages = DIRTYRATE_DEFAULT_SAMPLE_PAGES;
+    } else if (sample_pages < DIRTYRATE_MIN_SAMPLE_PAGES ||
+               sample_pages > DIRTYRATE_MAX_SAMPLE_PAGES) {
+        error_setg(errp, "sample-pages is out of range [%d, %d]",
+                   DIRTYRATE_MIN_SAMPLE_PAGES, DIRTYRATE_MAX_SAMPLE_PAGES);
+        return;
+    }
+
+    /* The previous thread, if any, is done with the results */
+    dirtyrate_sample_free(&dirtyrate.sample);
+    dirtyrate.start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) / 1000;
+    dirtyrate.calc_time = calc_time;
+    dirtyrate.sample_pages = sample_pages;
+    dirtyrate.dirty_rate = 0;
+    atomic_mb_set(&dirtyrate.status, DIRTY_RATE_STATUS_MEASURING);
+
+    qemu_thread_create(&thread, "dirtyrate", dirtyrate_thread, NULL,
+                       QEMU_THREAD_DETACHED);
+}
+
+DirtyRateInfo *qmp_query_dirty_rate(Error **errp)
+{
+    DirtyRateInfo *info = g_new0(DirtyRateInfo, 1);
+    RAMBlockDirtyRateList **tail = &info->ramblocks;
+    RAMBlockDirtyRateList *entry;
+    RAMBlockDirtyInfo *block;
+    int n;
+
+    info->status = atomic_mb_read(&dirtyrate.status);
+    info->start_time = dirtyrate.start_time;
+    info->calc_time = dirtyrate.calc_time;
+    info->sample_pages = dirtyrate.sample_pages;
+
+    if (info->status != DIRTY_RATE_STATUS_MEASURED) {
+        return info;
+    }
+
+    info->has_dirty_rate = true;
+    info->dirty_rate = dirtyrate.dirty_rate;
+    info->has_ramblocks = true;
+    for (n = 0; n < dirtyrate.sample.nblocks; n++) {
+        block = &dirtyrate.sample.blocks[n];
+        if (block->gone) {
+            continue;
+        }
+        entry = g_new0(RAMBlockDirtyRateList, 1);
+        entry->value = g_new0(RAMBlockDirtyRate, 1);
+        entry->value->id = g_strdup(block->idstr);
+        entry->value->size = block->size;
+        entry->value->sample_pages = block->sample_pages;
+        entry->value->dirty_pages = block->dirty_pages;
+        entry->value->dirty_rate = dirtyrate_block_rate(block,
+                                                        dirtyrate.calc_time);
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return info;
+}
@@ -19,6 +19,7 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "rdma.h"
 #include "ram.h"
@@ -46,8 +47,12 @@
 #include "io/channel-buffer.h"
 #include "migration/colo.h"
 #include "hw/boards.h"
+#include "hw/virtio/vhost.h"
+#include "sysemu/kvm.h"
+#include "sysemu/cpus.h"
 #include "monitor/monitor.h"
 #include "net/announce.h"
+#include "dirtylimit.h"
 
 #define MAX_THROTTLE  (32 << 20)      /* Migration transfer speed throttling */
 
@@ -82,6 +87,21 @@
 /* The delay time (in ms) between two COLO checkpoints */
 #define DEFAULT_MIGRATE_X_CHECKPOINT_DELAY (200 * 100)
 #define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
+#define DEFAULT_MIGRATE_MULTIFD_COMPRESSION MULTIFD_COMPRESSION_NONE
+/* 0: means nocompress, 1: best speed, ... 9: best compress ratio */
+#define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
+/* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
+#define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
+/* Dirty page rate limit of each vcpu for the dirty-limit capability, MB/s */
+#define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT 1
+/* Host pages requested after a faulting one in postcopy, 0 disables it */
+#define DEFAULT_MIGRATE_POSTCOPY_FAULT_AROUND 0
+#define MAX_MIGRATE_POSTCOPY_FAULT_AROUND 64
+/* Threads writing the received pages into guest memory, 0 disables them */
+#define DEFAULT_MIGRATE_LOAD_THREADS 0
+/* Threads writing or reading the pages of a mapped-ram file */
+#define DEFAULT_MIGRATE_MAPPED_RAM_THREADS 4
+#define MAX_MIGRATE_MAPPED_RAM_THREADS 64
 
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
@@ -208,6 +228,11 @@ void migration_incoming_state_destroy(void)
         qemu_fclose(mis->from_src_file);
         mis->from_src_file = NULL;
     }
+    postcopy_preempt_thread_stop(mis);
+    if (mis->postcopy_qemufile_dst) {
+        qemu_fclose(mis->postcopy_qemufile_dst);
+        mis->postcopy_qemufile_dst = NULL;
+    }
     if (mis->postcopy_remote_fds) {
         g_array_free(mis->postcopy_remote_fds, TRUE);
         mis->postcopy_remote_fds = NULL;
@@ -364,6 +389,8 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
         unix_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -598,6 +625,10 @@ void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
          * right now.  Multifd needs more than one channel, we wait.
          */
         start_migration = !migrate_use_multifd();
+    } else if (migrate_postcopy_preempt()) {
+        /* The second connection, for the postcopy requested pages */
+        postcopy_preempt_new_channel(mis, qemu_fopen_channel_input(ioc));
+        start_migration = false;
     } else {
         Error *local_err = NULL;
         /* Multiple connections */
@@ -626,6 +657,9 @@ bool migration_has_all_channels(void)
     bool all_channels;
 
     all_channels = multifd_recv_all_channels_created();
+    if (migrate_postcopy_preempt()) {
+        all_channels = all_channels && mis->postcopy_qemufile_dst != NULL;
+    }
 
     return all_channels && mis->from_src_file != NULL;
 }
@@ -769,6 +803,20 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->block_incremental = s->parameters.block_incremental;
     params->has_multifd_channels = true;
     params->multifd_channels = s->parameters.multifd_channels;
+    params->has_multifd_compression = true;
+    params->multifd_compression = s->parameters.multifd_compression;
+    params->has_multifd_zlib_level = true;
+    params->multifd_zlib_level = s->parameters.multifd_zlib_level;
+    params->has_multifd_zstd_level = true;
+    params->multifd_zstd_level = s->parameters.multifd_zstd_level;
+    params->has_vcpu_dirty_limit = true;
+    params->vcpu_dirty_limit = s->parameters.vcpu_dirty_limit;
+    params->has_postcopy_fault_around = true;
+    params->postcopy_fault_around = s->parameters.postcopy_fault_around;
+    params->has_load_threads = true;
+    params->load_threads = s->parameters.load_threads;
+    params->has_mapped_ram_threads = true;
+    params->mapped_ram_threads = s->parameters.mapped_ram_threads;
     params->has_xbzrle_cache_size = true;
     params->xbzrle_cache_size = s->parameters.xbzrle_cache_size;
     params->has_max_postcopy_bandwidth = true;
@@ -841,6 +889,10 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->page_size = qemu_target_page_size();
     info->ram->multifd_bytes = ram_counters.multifd_bytes;
     info->ram->pages_per_second = s->pages_per_second;
+    info->ram->free_pages = ram_counters.free_pages;
+    info->ram->free_pages_round = ram_counters.free_pages_round;
+    info->ram->copied_bytes = ram_counters.copied_bytes;
+    info->ram->copied_bytes_round = ram_counters.copied_bytes_round;
 
     if (migrate_use_xbzrle()) {
         info->has_xbzrle_cache = true;
@@ -851,6 +903,8 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->xbzrle_cache->cache_miss = xbzrle_counters.cache_miss;
         info->xbzrle_cache->cache_miss_rate = xbzrle_counters.cache_miss_rate;
         info->xbzrle_cache->overflow = xbzrle_counters.overflow;
+        info->xbzrle_cache->cache_hit_rate = xbzrle_counters.cache_hit_rate;
+        info->xbzrle_cache->cache_evictions = xbzrle_counters.cache_evictions;
     }
 
     if (migrate_use_compression()) {
@@ -870,6 +924,9 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->cpu_throttle_percentage = cpu_throttle_get_percentage();
     }
 
+    info->vhost_log_sync = vhost_log_sync_info();
+    info->has_vhost_log_sync = info->vhost_log_sync != NULL;
+
     if (s->state != MIGRATION_STATUS_COMPLETED) {
         info->ram->remaining = ram_bytes_remaining();
         info->ram->dirty_pages_rate = ram_counters.dirty_pages_rate;
@@ -933,6 +990,10 @@ static void fill_source_migration_info(MigrationInfo *info)
         info->downtime = s->downtime;
         info->has_setup_time = true;
         info->setup_time = s->setup_time;
+        if (!info->has_device_state) {
+            info->device_state = qemu_savevm_device_times();
+            info->has_device_state = info->device_state != NULL;
+        }
 
         populate_ram_info(info, s);
         break;
@@ -1022,6 +1083,96 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
+        if (!cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Postcopy preempt requires postcopy-ram");
+            return false;
+        }
+        if (cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Postcopy preempt is not compatible with "
+                       "multifd");
+            return false;
+        }
+    }
+
+#ifdef CONFIG_LINUX
+    if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND]) {
+        if (!cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Zero copy send requires multifd");
+            return false;
+        }
+        if (migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+            error_setg(errp, "Zero copy send is not compatible with "
+                       "multifd compression");
+            return false;
+        }
+    }
+#endif
+
+    if (cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
+        static const MigrationCapability incompatible[] = {
+            MIGRATION_CAPABILITY_POSTCOPY_RAM,
+            MIGRATION_CAPABILITY_COMPRESS,
+            MIGRATION_CAPABILITY_X_COLO,
+            MIGRATION_CAPABILITY_RELEASE_RAM,
+            MIGRATION_CAPABILITY_BLOCK,
+            MIGRATION_CAPABILITY_MULTIFD,
+            MIGRATION_CAPABILITY_DIRTY_BITMAPS,
+        };
+        int i;
+
+        for (i = 0; i < ARRAY_SIZE(incompatible); i++) {
+            if (cap_list[incompatible[i]]) {
+                error_setg(errp, "Background snapshot is not compatible "
+                           "with %s", MigrationCapability_str(incompatible[i]));
+                return false;
+            }
+        }
+
+        if (!uffd_wp_supported_by_host()) {
+            error_setg(errp, "Background snapshot is not supported by the "
+                       "host kernel");
+            error_append_hint(errp, "It needs Linux 5.7 or newer with "
+                              "userfaultfd write-protect support.\n");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        static const MigrationCapability incompatible[] = {
+            MIGRATION_CAPABILITY_POSTCOPY_RAM,
+            MIGRATION_CAPABILITY_XBZRLE,
+            MIGRATION_CAPABILITY_COMPRESS,
+            MIGRATION_CAPABILITY_X_COLO,
+            MIGRATION_CAPABILITY_MULTIFD,
+            MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT,
+        };
+        int i;
+
+        for (i = 0; i < ARRAY_SIZE(incompatible); i++) {
+            if (cap_list[incompatible[i]]) {
+                error_setg(errp, "Mapped RAM is not compatible with %s",
+                           MigrationCapability_str(incompatible[i]));
+                return false;
+            }
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_DIRTY_LIMIT]) {
+        if (cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE]) {
+            error_setg(errp, "dirty-limit is not compatible with "
+                       "auto-converge");
+            return false;
+        }
+        if (!kvm_enabled() || !kvm_dirty_ring_enabled()) {
+            error_setg(errp, "dirty-limit requires KVM with the dirty ring "
+                       "enabled");
+            error_append_hint(errp, "Set the kvm-dirty-ring-size property "
+                              "of the machine to enable it.\n");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -1052,6 +1203,8 @@ static void fill_destination_migration_info(MigrationInfo *info)
         break;
     case MIGRATION_STATUS_COMPLETED:
         info->has_status = true;
+        info->device_state = qemu_savevm_device_times();
+        info->has_device_state = info->device_state != NULL;
         fill_destination_postcopy_migration_info(info);
         break;
     }
@@ -1158,6 +1311,60 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_multifd_zlib_level &&
+        (params->multifd_zlib_level > 9)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_zlib_level",
+                   "is invalid, it should be in the range of 0 to 9");
+        return false;
+    }
+
+    if (params->has_multifd_zstd_level &&
+        (params->multifd_zstd_level > 20)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_zstd_level",
+                   "is invalid, it should be in the range of 0 to 20");
+        return false;
+    }
+
+    if (params->has_vcpu_dirty_limit &&
+        params->vcpu_dirty_limit < 1) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "vcpu_dirty_limit",
+                   "is invalid, it must be greater than 0 MB/s");
+        return false;
+    }
+
+    if (params->has_postcopy_fault_around &&
+        (params->postcopy_fault_around > MAX_MIGRATE_POSTCOPY_FAULT_AROUND)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_fault_around",
+                   "is invalid, it should be in the range of 0 to 64");
+        return false;
+    }
+
+    if (params->has_load_threads &&
+        (params->load_threads < 0 || params->load_threads > 255)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "load_threads",
+                   "is invalid, it should be in the range of 0 to 255");
+        return false;
+    }
+
+    if (params->has_mapped_ram_threads &&
+        (params->mapped_ram_threads < 1 ||
+         params->mapped_ram_threads > MAX_MIGRATE_MAPPED_RAM_THREADS)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "mapped_ram_threads",
+                   "is invalid, it should be in the range of 1 to 64");
+        return false;
+    }
+
+    if (params->has_multifd_compression &&
+        params->multifd_compression != MULTIFD_COMPRESSION_NONE &&
+        migrate_use_zero_copy_send()) {
+        error_setg(errp, "Zero copy send is not compatible with "
+                   "multifd compression");
+        return false;
+    }
+
     if (params->has_xbzrle_cache_size &&
         (params->xbzrle_cache_size < qemu_target_page_size() ||
          !is_power_of_2(params->xbzrle_cache_size))) {
@@ -1268,6 +1475,27 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_multifd_channels) {
         dest->multifd_channels = params->multifd_channels;
     }
+    if (params->has_multifd_compression) {
+        dest->multifd_compression = params->multifd_compression;
+    }
+    if (params->has_multifd_zlib_level) {
+        dest->multifd_zlib_level = params->multifd_zlib_level;
+    }
+    if (params->has_multifd_zstd_level) {
+        dest->multifd_zstd_level = params->multifd_zstd_level;
+    }
+    if (params->has_vcpu_dirty_limit) {
+        dest->vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
+    if (params->has_postcopy_fault_around) {
+        dest->postcopy_fault_around = params->postcopy_fault_around;
+    }
+    if (params->has_load_threads) {
+        dest->load_threads = params->load_threads;
+    }
+    if (params->has_mapped_ram_threads) {
+        dest->mapped_ram_threads = params->mapped_ram_threads;
+    }
     if (params->has_xbzrle_cache_size) {
         dest->xbzrle_cache_size = params->xbzrle_cache_size;
     }
@@ -1364,6 +1592,27 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_multifd_channels) {
         s->parameters.multifd_channels = params->multifd_channels;
     }
+    if (params->has_multifd_compression) {
+        s->parameters.multifd_compression = params->multifd_compression;
+    }
+    if (params->has_multifd_zlib_level) {
+        s->parameters.multifd_zlib_level = params->multifd_zlib_level;
+    }
+    if (params->has_multifd_zstd_level) {
+        s->parameters.multifd_zstd_level = params->multifd_zstd_level;
+    }
+    if (params->has_vcpu_dirty_limit) {
+        s->parameters.vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
+    if (params->has_postcopy_fault_around) {
+        s->parameters.postcopy_fault_around = params->postcopy_fault_around;
+    }
+    if (params->has_load_threads) {
+        s->parameters.load_threads = params->load_threads;
+    }
+    if (params->has_mapped_ram_threads) {
+        s->parameters.mapped_ram_threads = params->mapped_ram_threads;
+    }
     if (params->has_xbzrle_cache_size) {
         s->parameters.xbzrle_cache_size = params->xbzrle_cache_size;
         xbzrle_cache_resize(params->xbzrle_cache_size, errp);
@@ -1527,6 +1776,8 @@ static void migrate_fd_cleanup(void *opaque)
         qemu_fclose(tmp);
     }
 
+    postcopy_preempt_close(s);
+
     assert((s->state != MIGRATION_STATUS_ACTIVE) &&
            (s->state != MIGRATION_STATUS_POSTCOPY_ACTIVE));
 
@@ -1594,6 +1845,13 @@ static void migrate_fd_cancel(MigrationState *s)
     if (s->state == MIGRATION_STATUS_CANCELLING && f) {
         qemu_file_shutdown(f);
     }
+    if (s->state == MIGRATION_STATUS_CANCELLING) {
+        qemu_mutex_lock(&s->qemu_file_lock);
+        if (s->postcopy_qemufile_src) {
+            qemu_file_shutdown(s->postcopy_qemufile_src);
+        }
+        qemu_mutex_unlock(&s->qemu_file_lock);
+    }
     if (s->state == MIGRATION_STATUS_CANCELLING && s->block_inactive) {
         Error *local_err = NULL;
 
@@ -1924,6 +2182,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         unix_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "uri",
                    "a valid migration protocol");
@@ -2019,6 +2279,24 @@ bool migrate_postcopy_ram(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM];
 }
 
+bool migrate_postcopy_preempt(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT];
+}
+
+bool migrate_background_snapshot(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT];
+}
+
 bool migrate_postcopy(void)
 {
     return migrate_postcopy_ram() || migrate_dirty_bitmaps();
@@ -2033,6 +2311,51 @@ bool migrate_auto_converge(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_AUTO_CONVERGE];
 }
 
+bool migrate_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_LIMIT];
+}
+
+uint64_t migrate_vcpu_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.vcpu_dirty_limit;
+}
+
+int migrate_postcopy_fault_around(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.postcopy_fault_around;
+}
+
+int migrate_mapped_ram_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.mapped_ram_threads;
+}
+
+int migrate_load_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.load_threads;
+}
+
 bool migrate_zero_blocks(void)
 {
     MigrationState *s;
@@ -2114,6 +2437,24 @@ bool migrate_ignore_shared(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_X_IGNORE_SHARED];
 }
 
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+bool migrate_hugepage_dirty(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_HUGEPAGE_DIRTY];
+}
+
 bool migrate_use_events(void)
 {
     MigrationState *s;
@@ -2132,6 +2473,19 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_use_zero_copy_send(void)
+{
+#ifdef CONFIG_LINUX
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ZERO_COPY_SEND];
+#else
+    return false;
+#endif
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -2151,6 +2505,33 @@ int migrate_multifd_channels(void)
     return s->parameters.multifd_channels;
 }
 
+MultiFDCompression migrate_multifd_compression(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_compression;
+}
+
+int migrate_multifd_zlib_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_zlib_level;
+}
+
+int migrate_multifd_zstd_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_zstd_level;
+}
+
 int migrate_use_xbzrle(void)
 {
     MigrationState *s;
@@ -2905,6 +3286,12 @@ static MigThrError postcopy_pause(MigrationState *s)
         qemu_file_shutdown(file);
         qemu_fclose(file);
 
+        /*
+         * The preempt channel is not set up again on recovery: it may
+         * be broken too, and requested pages go back to the main one.
+         */
+        postcopy_preempt_close(s);
+
         error_report("Detected IO failure for postcopy. "
                      "Migration paused.");
 
@@ -3105,6 +3492,10 @@ static void migration_iteration_finish(MigrationState *s)
     cpu_throttle_stop();
 
     qemu_mutex_lock_iothread();
+    if (migrate_dirty_limit()) {
+        /* Likewise for the dirty page rate limits */
+        dirtylimit_set_all(0, false);
+    }
     switch (s->state) {
     case MIGRATION_STATUS_COMPLETED:
         migration_calculate_complete(s);
@@ -3174,6 +3565,13 @@ static void *migration_thread(void *opaque)
     object_ref(OBJECT(s));
     s->iteration_start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
+    if (postcopy_preempt_wait_channel(s)) {
+        /* The connection error has been recorded already */
+        migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                          MIGRATION_STATUS_FAILED);
+        goto out;
+    }
+
     qemu_savevm_state_header(s->to_dst_file);
 
     /*
@@ -3267,14 +3665,127 @@ static void *migration_thread(void *opaque)
     }
 
     trace_migration_thread_after_loop();
+out:
     migration_iteration_finish(s);
     object_unref(OBJECT(s));
     rcu_unregister_thread();
     return NULL;
 }
 
+/*
+ * Migration thread of a background snapshot.
+ * The device state is saved into a buffer with the guest stopped, and
+ * RAM is then sent while it runs; the page writes it attempts come in
+ * through the userfaultfd and are served before the rest.  The buffer
+ * goes last, so that the destination has all of RAM by the time it
+ * loads the devices.
+ */
+static void *bg_migration_thread(void *opaque)
+{
+    MigrationState *s = opaque;
+    int64_t setup_start = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    QIOChannelBuffer *bioc;
+    QEMUFile *fb;
+    Error *local_err = NULL;
+    int ret;
+
+    rcu_register_thread();
+    object_ref(OBJECT(s));
+
+    /* Faulting vCPUs wait for the pages to be sent, don't rate limit */
+    qemu_file_set_rate_limit(s->to_dst_file, INT64_MAX);
+
+    bioc = qio_channel_buffer_new(512 * 1024);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "vmstate-buffer");
+    fb = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    qemu_savevm_state_header(s->to_dst_file);
+    qemu_savevm_state_setup(s->to_dst_file);
+
+    s->setup_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) - setup_start;
+    migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                      MIGRATION_STATUS_ACTIVE);
+    trace_migration_thread_setup_complete();
+
+    /* This is the point in time the snapshot is taken at */
+    qemu_mutex_lock_iothread();
+    s->downtime_start = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    s->vm_was_running = runstate_is_running();
+    ret = global_state_store();
+    if (!ret) {
+        ret = vm_stop_force_state(RUN_STATE_PAUSED);
+    }
+    if (!ret) {
+        cpu_synchronize_all_states();
+        ret = qemu_savevm_state_complete_precopy_non_iterable(fb, false,
+                                                              false);
+    }
+    if (!ret) {
+        ret = ram_write_tracking_start(&local_err);
+        if (ret) {
+            migrate_set_error(s, local_err);
+            error_report_err(local_err);
+        }
+    }
+    s->downtime = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - s->downtime_start;
+    if (s->vm_was_running) {
+        vm_start();
+    }
+    qemu_mutex_unlock_iothread();
+
+    if (ret) {
+        migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                          MIGRATION_STATUS_FAILED);
+        goto out;
+    }
+    trace_bg_migration_thread_snapshot(s->downtime);
+
+    while (s->state == MIGRATION_STATUS_ACTIVE) {
+        ret = qemu_savevm_state_iterate(s->to_dst_file, false);
+        if (ret > 0) {
+            /* All of RAM has been sent */
+            qemu_savevm_state_complete_precopy(s->to_dst_file, true, false);
+            ram_write_tracking_stop();
+            qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
+            qemu_fflush(s->to_dst_file);
+            if (qemu_file_get_error(s->to_dst_file)) {
+                migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                                  MIGRATION_STATUS_FAILED);
+            } else {
+                migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                                  MIGRATION_STATUS_COMPLETED);
+            }
+            break;
+        }
+
+        if (migration_detect_error(s) == MIG_THR_ERR_FATAL) {
+            break;
+        }
+        migration_update_counters(s, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+    }
+
+    trace_migration_thread_after_loop();
+out:
+    /* The vCPUs must not wait for ever on a failed snapshot */
+    ram_write_tracking_stop();
+    qemu_fclose(fb);
+
+    qemu_mutex_lock_iothread();
+    if (s->state == MIGRATION_STATUS_COMPLETED) {
+        migration_calculate_complete(s);
+    }
+    qemu_bh_schedule(s->cleanup_bh);
+    qemu_mutex_unlock_iothread();
+
+    object_unref(OBJECT(s));
+    rcu_unregister_thread();
+    return NULL;
+}
+
 void migrate_fd_connect(MigrationState *s, Error *error_in)
 {
+    Error *local_err = NULL;
     int64_t rate_limit;
     bool resume = s->state == MIGRATION_STATUS_POSTCOPY_PAUSED;
 
@@ -3328,8 +3839,23 @@ void migrate_fd_connect(MigrationState *s, Error *error_in)
         migrate_fd_cleanup(s);
         return;
     }
-    qemu_thread_create(&s->thread, "live_migration", migration_thread, s,
-                       QEMU_THREAD_JOINABLE);
+
+    if (postcopy_preempt_setup(s, &local_err)) {
+        migrate_set_error(s, local_err);
+        error_report_err(local_err);
+        migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                          MIGRATION_STATUS_FAILED);
+        migrate_fd_cleanup(s);
+        return;
+    }
+
+    if (migrate_background_snapshot()) {
+        qemu_thread_create(&s->thread, "bg_snapshot", bg_migration_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    } else {
+        qemu_thread_create(&s->thread, "live_migration", migration_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    }
     s->migration_thread_running = true;
 }
 
@@ -3362,6 +3888,8 @@ static Property migration_properties[] = {
                      send_section_footer, true),
     DEFINE_PROP_BOOL("decompress-error-check", MigrationState,
                       decompress_error_check, true),
+    DEFINE_PROP_UINT8("x-clear-bitmap-shift", MigrationState,
+                      clear_bitmap_shift, CLEAR_BITMAP_SHIFT_DEFAULT),
 
     /* Migration parameters */
     DEFINE_PROP_UINT8("x-compress-level", MigrationState,
@@ -3392,6 +3920,27 @@ static Property migration_properties[] = {
     DEFINE_PROP_UINT8("multifd-channels", MigrationState,
                       parameters.multifd_channels,
                       DEFAULT_MIGRATE_MULTIFD_CHANNELS),
+    DEFINE_PROP_MULTIFD_COMPRESSION("multifd-compression", MigrationState,
+                      parameters.multifd_compression,
+                      DEFAULT_MIGRATE_MULTIFD_COMPRESSION),
+    DEFINE_PROP_UINT8("multifd-zlib-level", MigrationState,
+                      parameters.multifd_zlib_level,
+                      DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL),
+    DEFINE_PROP_UINT8("multifd-zstd-level", MigrationState,
+                      parameters.multifd_zstd_level,
+                      DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL),
+    DEFINE_PROP_UINT64("vcpu-dirty-limit", MigrationState,
+                      parameters.vcpu_dirty_limit,
+                      DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT),
+    DEFINE_PROP_UINT8("postcopy-fault-around", MigrationState,
+                      parameters.postcopy_fault_around,
+                      DEFAULT_MIGRATE_POSTCOPY_FAULT_AROUND),
+    DEFINE_PROP_UINT8("load-threads", MigrationState,
+                      parameters.load_threads,
+                      DEFAULT_MIGRATE_LOAD_THREADS),
+    DEFINE_PROP_UINT8("mapped-ram-threads", MigrationState,
+                      parameters.mapped_ram_threads,
+                      DEFAULT_MIGRATE_MAPPED_RAM_THREADS),
     DEFINE_PROP_SIZE("xbzrle-cache-size", MigrationState,
                       parameters.xbzrle_cache_size,
                       DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE),
@@ -3452,6 +4001,7 @@ static void migration_instance_finalize(Object *obj)
     qemu_sem_destroy(&ms->pause_sem);
     qemu_sem_destroy(&ms->postcopy_pause_sem);
     qemu_sem_destroy(&ms->postcopy_pause_rp_sem);
+    qemu_sem_destroy(&ms->postcopy_qemufile_src_sem);
     qemu_sem_destroy(&ms->rp_state.rp_sem);
     error_free(ms->error);
 }
@@ -3481,6 +4031,13 @@ static void migration_instance_init(Object *obj)
     params->has_x_checkpoint_delay = true;
     params->has_block_incremental = true;
     params->has_multifd_channels = true;
+    params->has_multifd_compression = true;
+    params->has_multifd_zlib_level = true;
+    params->has_multifd_zstd_level = true;
+    params->has_vcpu_dirty_limit = true;
+    params->has_postcopy_fault_around = true;
+    params->has_load_threads = true;
+    params->has_mapped_ram_threads = true;
     params->has_xbzrle_cache_size = true;
     params->has_max_postcopy_bandwidth = true;
     params->has_max_cpu_throttle = true;
@@ -3491,6 +4048,7 @@ static void migration_instance_init(Object *obj)
 
     qemu_sem_init(&ms->postcopy_pause_sem, 0);
     qemu_sem_init(&ms->postcopy_pause_rp_sem, 0);
+    qemu_sem_init(&ms->postcopy_qemufile_src_sem, 0);
     qemu_sem_init(&ms->rp_state.rp_sem, 0);
     qemu_sem_init(&ms->rate_limit_sem, 0);
     qemu_mutex_init(&ms->qemu_file_lock);
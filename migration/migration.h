@@ -27,6 +27,15 @@ struct PostcopyBlocktimeContext;
 
 #define  MIGRATION_RESUME_ACK_VALUE  (1)
 
+/* Channels that the RAM pages of a migration are received from */
+enum {
+    /* The main migration stream */
+    RAM_CHANNEL_PRECOPY = 0,
+    /* The postcopy-preempt channel, carrying requested pages only */
+    RAM_CHANNEL_POSTCOPY,
+    RAM_CHANNEL_MAX,
+};
+
 /* State for the incoming migration */
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
@@ -59,8 +68,15 @@ struct MigrationIncomingState {
     QemuMutex rp_mutex;    /* We send replies from multiple threads */
     /* RAMBlock of last request sent to source */
     RAMBlock *last_rb;
-    void     *postcopy_tmp_page;
+    /* One per channel, since both place pages concurrently */
+    void     *postcopy_tmp_pages[RAM_CHANNEL_MAX];
     void     *postcopy_tmp_zero_page;
+    /* The postcopy-preempt channel, and the thread loading from it */
+    QEMUFile *postcopy_qemufile_dst;
+    bool      have_preempt_thread;
+    QemuThread preempt_thread;
+    /* Set this when we want the preempt thread to quit */
+    bool      preempt_thread_quit;
     /* PostCopyFD's for external userfaultfds & handlers of shared memory */
     GArray   *postcopy_remote_fds;
 
@@ -121,6 +137,13 @@ struct MigrationState
     QemuThread thread;
     QEMUBH *cleanup_bh;
     QEMUFile *to_dst_file;
+    /*
+     * The postcopy-preempt channel for the pages requested by the
+     * destination; set, or left NULL on failure, before
+     * postcopy_qemufile_src_sem is posted.
+     */
+    QEMUFile *postcopy_qemufile_src;
+    QemuSemaphore postcopy_qemufile_src_sem;
     /*
      * Protects to_dst_file pointer.  We need to make sure we won't
      * yield or hang during the critical section, since this lock will
@@ -234,8 +257,27 @@ struct MigrationState
      * do not trigger spurious decompression errors.
      */
     bool decompress_error_check;
+
+    /*
+     * This decides the size of guest memory chunk that will be used
+     * to track dirty bitmap clearing.  The size of memory chunk will
+     * be GUEST_PAGE_SIZE << N.  Say, N=0 means we will clear dirty
+     * bitmap for each page to send (1<<0=1); N=10 means we will clear
+     * dirty bitmap only once for 1<<10=1K continuous guest pages
+     * (which is in 4M chunk).
+     */
+    uint8_t clear_bitmap_shift;
 };
 
+/*
+ * Clear dirty bitmap chunks are at least 64 pages, so that they always
+ * cover whole words of the dirty bitmaps, and at most 2^31 pages.  The
+ * default of 2^18 pages is 1GB with 4K target pages.
+ */
+#define CLEAR_BITMAP_SHIFT_MIN             6
+#define CLEAR_BITMAP_SHIFT_DEFAULT         18
+#define CLEAR_BITMAP_SHIFT_MAX             31
+
 void migrate_set_state(int *state, int old_state, int new_state);
 
 void migration_fd_process_incoming(QEMUFile *f);
@@ -263,14 +305,27 @@ bool migrate_postcopy(void);
 
 bool migrate_release_ram(void);
 bool migrate_postcopy_ram(void);
+bool migrate_postcopy_preempt(void);
+bool migrate_background_snapshot(void);
 bool migrate_zero_blocks(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_ignore_shared(void);
+bool migrate_hugepage_dirty(void);
+bool migrate_mapped_ram(void);
 
 bool migrate_auto_converge(void);
+bool migrate_dirty_limit(void);
+uint64_t migrate_vcpu_dirty_limit(void);
+int migrate_postcopy_fault_around(void);
+int migrate_load_threads(void);
+int migrate_mapped_ram_threads(void);
 bool migrate_use_multifd(void);
+bool migrate_use_zero_copy_send(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
+MultiFDCompression migrate_multifd_compression(void);
+int migrate_multifd_zlib_level(void);
+int migrate_multifd_zstd_level(void);
 
 int migrate_use_xbzrle(void);
 int64_t migrate_xbzrle_cache_size(void);
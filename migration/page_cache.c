@@ -1,6 +1,7 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is base on a hash of the page address, which selects a set
+ * of CACHE_WAYS pages that the page can be cached in
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -31,6 +32,14 @@
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/*
+ * Number of pages in each set.  A direct-mapped cache thrashes as soon
+ * as two pages of the working set hash to the same entry, which gets
+ * likely with large guests; looking up a few more entries is cheap
+ * compared to sending the page in full.
+ */
+#define CACHE_WAYS 8
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -44,6 +53,11 @@ struct PageCache {
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    size_t num_sets;
+    size_t num_ways;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
 };
 
 PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
@@ -75,8 +89,15 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
     cache->page_size = page_size;
     cache->num_items = 0;
     cache->max_num_items = num_pages;
+    /* both are powers of two */
+    cache->num_ways = MIN(CACHE_WAYS, num_pages);
+    cache->num_sets = num_pages / cache->num_ways;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
 
-    DPRINTF("Setting cache buckets to %" PRId64 "\n", cache->max_num_items);
+    DPRINTF("Setting cache buckets to %zu sets of %zu pages\n",
+            cache->num_sets, cache->num_ways);
 
     /* We prefer not to abort if there is no memory */
     cache->page_cache = g_try_malloc((cache->max_num_items) *
@@ -116,11 +137,12 @@ void cache_fini(PageCache *cache)
 static size_t cache_get_cache_pos(const PageCache *cache,
                                   uint64_t address)
 {
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
+    g_assert(cache->num_sets);
+    return (address / cache->page_size) & (cache->num_sets - 1);
 }
 
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+/* Returns the first of the num_ways items of the set of @addr */
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t addr)
 {
     size_t pos;
 
@@ -129,43 +151,72 @@ static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
 
     pos = cache_get_cache_pos(cache, addr);
 
-    return &cache->page_cache[pos];
+    return &cache->page_cache[pos * cache->num_ways];
+}
+
+static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    size_t i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+    return NULL;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age)
+bool cache_is_cached(PageCache *cache, uint64_t addr, uint64_t current_age)
 {
     CacheItem *it;
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
+        cache->hits++;
         return true;
     }
+    cache->misses++;
     return false;
 }
 
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age)
 {
+    CacheItem *set, *it;
+    size_t i;
 
-    CacheItem *it;
-
-    /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
+    if (!it) {
+        /* take a free entry of the set, or else the least recently used */
+        set = cache_get_set(cache, addr);
+        for (i = 0; i < cache->num_ways; i++) {
+            if (!set[i].it_data) {
+                it = &set[i];
+                break;
+            }
+            if (!it || set[i].it_age < it->it_age) {
+                it = &set[i];
+            }
+        }
 
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
+        if (it->it_data &&
+            it->it_age + CACHED_PAGE_LIFETIME > current_age) {
+            /* even the oldest page of the set is fresh, don't replace it */
+            return -1;
+        }
     }
+
     /* allocate page */
     if (!it->it_data) {
         it->it_data = g_try_malloc(cache->page_size);
@@ -174,6 +225,8 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
             return -1;
         }
         cache->num_items++;
+    } else if (it->it_addr != addr) {
+        cache->evictions++;
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
@@ -183,3 +236,11 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
 
     return 0;
 }
+
+void cache_get_stats(const PageCache *cache, uint64_t *hits, uint64_t *misses,
+                     uint64_t *evictions)
+{
+    *hits = cache->hits;
+    *misses = cache->misses;
+    *evictions = cache->evictions;
+}
@@ -44,8 +44,7 @@ void cache_fini(PageCache *cache);
  * @addr: page addr
  * @current_age: current bitmap generation
  */
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age);
+bool cache_is_cached(PageCache *cache, uint64_t addr, uint64_t current_age);
 
 /**
  * get_cached_data: Get the data cached for an addr
@@ -71,4 +70,15 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age);
 
+/**
+ * cache_get_stats: get the lookup statistics of the cache
+ *
+ * @cache pointer to the PageCache struct
+ * @hits: number of cache_is_cached calls that found the page
+ * @misses: number of cache_is_cached calls that did not
+ * @evictions: number of cached pages that were replaced by another page
+ */
+void cache_get_stats(const PageCache *cache, uint64_t *hits, uint64_t *misses,
+                     uint64_t *evictions);
+
 #endif
@@ -20,7 +20,9 @@
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
+#include "qemu-file-channel.h"
 #include "savevm.h"
+#include "socket.h"
 #include "postcopy-ram.h"
 #include "ram.h"
 #include "qapi/error.h"
@@ -28,6 +30,7 @@
 #include "sysemu/sysemu.h"
 #include "sysemu/balloon.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "trace.h"
 
 /* Arbitrary limit on size of each discard command,
@@ -90,9 +93,14 @@ int postcopy_notify(enum PostcopyNotifyReason reason, Error **errp)
 #include <sys/eventfd.h>
 #include <linux/userfaultfd.h>
 
+/* Bucket i counts the faults resolved in [2^i, 2^(i+1)) microseconds */
+#define POSTCOPY_LATENCY_BUCKETS 24
+
 typedef struct PostcopyBlocktimeContext {
     /* time when page fault initiated per vCPU */
     uint32_t *page_fault_vcpu_time;
+    /* same, in microseconds, for the latency histogram */
+    int64_t *page_fault_vcpu_time_us;
     /* page address per vCPU */
     uintptr_t *vcpu_addr;
     uint32_t total_blocktime;
@@ -103,6 +111,7 @@ typedef struct PostcopyBlocktimeContext {
     /* number of vCPU are suspended */
     int smp_cpus_down;
     uint64_t start_time;
+    uint64_t latency_hist[POSTCOPY_LATENCY_BUCKETS];
 
     /*
      * Handler for exit event, necessary for
@@ -114,6 +123,7 @@ typedef struct PostcopyBlocktimeContext {
 static void destroy_blocktime_context(struct PostcopyBlocktimeContext *ctx)
 {
     g_free(ctx->page_fault_vcpu_time);
+    g_free(ctx->page_fault_vcpu_time_us);
     g_free(ctx->vcpu_addr);
     g_free(ctx->vcpu_blocktime);
     g_free(ctx);
@@ -130,6 +140,7 @@ static struct PostcopyBlocktimeContext *blocktime_context_new(void)
 {
     PostcopyBlocktimeContext *ctx = g_new0(PostcopyBlocktimeContext, 1);
     ctx->page_fault_vcpu_time = g_new0(uint32_t, smp_cpus);
+    ctx->page_fault_vcpu_time_us = g_new0(int64_t, smp_cpus);
     ctx->vcpu_addr = g_new0(uintptr_t, smp_cpus);
     ctx->vcpu_blocktime = g_new0(uint32_t, smp_cpus);
 
@@ -154,6 +165,32 @@ static uint32List *get_vcpu_blocktime_list(PostcopyBlocktimeContext *ctx)
     return list;
 }
 
+static uint64List *get_latency_histogram_list(PostcopyBlocktimeContext *ctx)
+{
+    uint64List *list = NULL, *entry = NULL;
+    int i;
+
+    for (i = POSTCOPY_LATENCY_BUCKETS - 1; i >= 0; i--) {
+        entry = g_new0(uint64List, 1);
+        entry->value = ctx->latency_hist[i];
+        entry->next = list;
+        list = entry;
+    }
+
+    return list;
+}
+
+static void account_postcopy_latency(PostcopyBlocktimeContext *dc,
+                                     int64_t latency_us)
+{
+    int bucket = 0;
+
+    if (latency_us > 1) {
+        bucket = MIN(63 - clz64(latency_us), POSTCOPY_LATENCY_BUCKETS - 1);
+    }
+    dc->latency_hist[bucket]++;
+}
+
 /*
  * This function just populates MigrationInfo from postcopy's
  * blocktime context. It will not populate MigrationInfo,
@@ -174,6 +211,8 @@ void fill_destination_postcopy_migration_info(MigrationInfo *info)
     info->postcopy_blocktime = bc->total_blocktime;
     info->has_postcopy_vcpu_blocktime = true;
     info->postcopy_vcpu_blocktime = get_vcpu_blocktime_list(bc);
+    info->has_postcopy_latency_histogram = true;
+    info->postcopy_latency_histogram = get_latency_histogram_list(bc);
 }
 
 static uint32_t get_postcopy_total_blocktime(void)
@@ -534,8 +573,13 @@ static void postcopy_balloon_inhibit(bool state)
  */
 int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 {
+    int i;
+
     trace_postcopy_ram_incoming_cleanup_entry();
 
+    /* It places pages through the userfaultfd, so it goes first */
+    postcopy_preempt_thread_stop(mis);
+
     if (mis->have_fault_thread) {
         Error *local_err = NULL;
 
@@ -574,9 +618,11 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 
     postcopy_state_set(POSTCOPY_INCOMING_END);
 
-    if (mis->postcopy_tmp_page) {
-        munmap(mis->postcopy_tmp_page, mis->largest_page_size);
-        mis->postcopy_tmp_page = NULL;
+    for (i = 0; i < RAM_CHANNEL_MAX; i++) {
+        if (mis->postcopy_tmp_pages[i]) {
+            munmap(mis->postcopy_tmp_pages[i], mis->largest_page_size);
+            mis->postcopy_tmp_pages[i] = NULL;
+        }
     }
     if (mis->postcopy_tmp_zero_page) {
         munmap(mis->postcopy_tmp_zero_page, mis->largest_page_size);
@@ -761,6 +807,7 @@ static void mark_postcopy_blocktime_begin(uintptr_t addr, uint32_t ptid,
 
     atomic_xchg(&dc->last_begin, low_time_offset);
     atomic_xchg(&dc->page_fault_vcpu_time[cpu], low_time_offset);
+    dc->page_fault_vcpu_time_us[cpu] = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     atomic_xchg(&dc->vcpu_addr[cpu], addr);
 
     /* check it here, not at the begining of the function,
@@ -810,12 +857,14 @@ static void mark_postcopy_blocktime_end(uintptr_t addr)
     int i, affected_cpu = 0;
     bool vcpu_total_blocktime = false;
     uint32_t read_vcpu_time, low_time_offset;
+    int64_t now_us;
 
     if (!dc) {
         return;
     }
 
     low_time_offset = get_low_time_offset(dc);
+    now_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     /* lookup cpu, to clear it,
      * that algorithm looks straighforward, but it's not
      * optimal, more optimal algorithm is keeping tree or hash
@@ -840,6 +889,7 @@ static void mark_postcopy_blocktime_end(uintptr_t addr)
         }
         /* continue cycle, due to one page could affect several vCPUs */
         dc->vcpu_blocktime[i] += vcpu_blocktime;
+        account_postcopy_latency(dc, now_us - dc->page_fault_vcpu_time_us[i]);
     }
 
     atomic_sub(&dc->smp_cpus_down, affected_cpu);
@@ -862,6 +912,33 @@ static bool postcopy_pause_fault_thread(MigrationIncomingState *mis)
     return true;
 }
 
+/*
+ * Length of the request for a fault at @rb_offset: the faulting host
+ * page, followed by up to postcopy-fault-around more of them.  Guests
+ * that touch memory sequentially then take one round trip for several
+ * pages instead of one per page.  The request stops at the first page
+ * we already have, so that it never makes the source resend anything,
+ * and at the end of the RAMBlock.
+ */
+static size_t postcopy_fault_around_len(RAMBlock *rb, ram_addr_t rb_offset)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    ram_addr_t end = rb_offset + pagesize;
+    int n = migrate_postcopy_fault_around();
+
+    while (n-- && end + pagesize <= qemu_ram_get_used_length(rb) &&
+           !ramblock_recv_bitmap_test_byte_offset(rb, end)) {
+        end += pagesize;
+    }
+
+    if (end - rb_offset > pagesize) {
+        trace_postcopy_fault_around(qemu_ram_get_idstr(rb), rb_offset,
+                                    (end - rb_offset) / pagesize);
+    }
+
+    return end - rb_offset;
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
@@ -899,6 +976,7 @@ static void *postcopy_ram_fault_thread(void *opaque)
 
     while (true) {
         ram_addr_t rb_offset;
+        size_t req_len;
         int poll_result;
 
         /*
@@ -990,24 +1068,26 @@ static void *postcopy_ram_fault_thread(void *opaque)
             mark_postcopy_blocktime_begin(
                     (uintptr_t)(msg.arg.pagefault.address),
                                 msg.arg.pagefault.feat.ptid, rb);
+            req_len = postcopy_fault_around_len(rb, rb_offset);
 
 retry:
             /*
              * Send the request to the source - we want to request one
-             * of our host page sizes (which is >= TPS)
+             * of our host page sizes (which is >= TPS), and possibly
+             * the ones after it
              */
             if (rb != mis->last_rb) {
                 mis->last_rb = rb;
                 ret = migrate_send_rp_req_pages(mis,
                                                 qemu_ram_get_idstr(rb),
                                                 rb_offset,
-                                                qemu_ram_pagesize(rb));
+                                                req_len);
             } else {
                 /* Save some space */
                 ret = migrate_send_rp_req_pages(mis,
                                                 NULL,
                                                 rb_offset,
-                                                qemu_ram_pagesize(rb));
+                                                req_len);
             }
 
             if (ret) {
@@ -1256,25 +1336,179 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
 /*
  * Returns a target page of memory that can be mapped at a later point in time
  * using postcopy_place_page
- * The same address is used repeatedly, postcopy_place_page just takes the
- * backing page away.
+ * The same address is used repeatedly for a given channel,
+ * postcopy_place_page just takes the backing page away.
  * Returns: Pointer to allocated page
  *
  */
-void *postcopy_get_tmp_page(MigrationIncomingState *mis)
-{
-    if (!mis->postcopy_tmp_page) {
-        mis->postcopy_tmp_page = mmap(NULL, mis->largest_page_size,
-                             PROT_READ | PROT_WRITE, MAP_PRIVATE |
-                             MAP_ANONYMOUS, -1, 0);
-        if (mis->postcopy_tmp_page == MAP_FAILED) {
-            mis->postcopy_tmp_page = NULL;
+void *postcopy_get_tmp_page(MigrationIncomingState *mis, int channel)
+{
+    void **page = &mis->postcopy_tmp_pages[channel];
+
+    if (!*page) {
+        *page = mmap(NULL, mis->largest_page_size,
+                     PROT_READ | PROT_WRITE, MAP_PRIVATE |
+                     MAP_ANONYMOUS, -1, 0);
+        if (*page == MAP_FAILED) {
+            *page = NULL;
             error_report("%s: %s", __func__, strerror(errno));
             return NULL;
         }
     }
 
-    return mis->postcopy_tmp_page;
+    return *page;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Write-protect faults, to track guest writes during background snapshots */
+
+/**
+ * uffd_wp_open: open a userfaultfd that reports write-protect faults
+ *
+ * Returns the non-blocking fd, or -1 with @errp set
+ *
+ * @errp: error if the host does not support write-protect faults
+ */
+int uffd_wp_open(Error **errp)
+{
+    struct uffdio_api api_struct = {0};
+    uint64_t ioctl_mask = (__u64)1 << _UFFDIO_REGISTER |
+                          (__u64)1 << _UFFDIO_UNREGISTER;
+    int ufd;
+
+    ufd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (ufd == -1) {
+        error_setg_errno(errp, errno, "Failed to open userfault fd");
+        return -1;
+    }
+
+    api_struct.api = UFFD_API;
+    api_struct.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+    if (ioctl(ufd, UFFDIO_API, &api_struct)) {
+        error_setg_errno(errp, errno, "Userfault write-protect not supported");
+        close(ufd);
+        return -1;
+    }
+
+    if ((api_struct.ioctls & ioctl_mask) != ioctl_mask) {
+        error_setg(errp, "Missing userfault features: %" PRIx64,
+                   (uint64_t)(~api_struct.ioctls & ioctl_mask));
+        close(ufd);
+        return -1;
+    }
+
+    return ufd;
+}
+
+/* Returns true if the host kernel reports write-protect faults */
+bool uffd_wp_supported_by_host(void)
+{
+    int ufd = uffd_wp_open(NULL);
+
+    if (ufd < 0) {
+        return false;
+    }
+    close(ufd);
+    return true;
+}
+
+/**
+ * uffd_wp_register: make a range of memory report write-protect faults
+ *
+ * Returns 0 on success, negative errno on failure
+ *
+ * @ufd: fd from uffd_wp_open()
+ * @addr, @len: the range, which must be page aligned
+ */
+int uffd_wp_register(int ufd, void *addr, uint64_t len)
+{
+    struct uffdio_register reg_struct;
+
+    reg_struct.range.start = (uintptr_t)addr;
+    reg_struct.range.len = len;
+    reg_struct.mode = UFFDIO_REGISTER_MODE_WP;
+
+    if (ioctl(ufd, UFFDIO_REGISTER, &reg_struct)) {
+        return -errno;
+    }
+    if (!(reg_struct.ioctls & ((__u64)1 << _UFFDIO_WRITEPROTECT))) {
+        ioctl(ufd, UFFDIO_UNREGISTER, &reg_struct.range);
+        return -ENOTSUP;
+    }
+
+    return 0;
+}
+
+int uffd_wp_unregister(int ufd, void *addr, uint64_t len)
+{
+    struct uffdio_range range_struct;
+
+    range_struct.start = (uintptr_t)addr;
+    range_struct.len = len;
+
+    if (ioctl(ufd, UFFDIO_UNREGISTER, &range_struct)) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+/**
+ * uffd_wp_protect: set or clear write protection on a range of memory
+ *
+ * Clearing it wakes up the threads that faulted on the range.
+ *
+ * Returns 0 on success, negative errno on failure
+ *
+ * @ufd: fd from uffd_wp_open()
+ * @addr, @len: the range, registered with uffd_wp_register()
+ * @wp: whether to protect or unprotect it
+ */
+int uffd_wp_protect(int ufd, void *addr, uint64_t len, bool wp)
+{
+    struct uffdio_writeprotect wp_struct;
+
+    wp_struct.range.start = (uintptr_t)addr;
+    wp_struct.range.len = len;
+    wp_struct.mode = wp ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+
+    if (ioctl(ufd, UFFDIO_WRITEPROTECT, &wp_struct)) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+/**
+ * uffd_wp_read_fault: fetch a pending write-protect fault, if any
+ *
+ * Returns the faulting address, or NULL if there is none
+ *
+ * @ufd: fd from uffd_wp_open()
+ */
+void *uffd_wp_read_fault(int ufd)
+{
+    struct uffd_msg msg;
+    int ret;
+
+    do {
+        ret = read(ufd, &msg, sizeof(msg));
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret != sizeof(msg)) {
+        if (ret >= 0 || errno != EAGAIN) {
+            error_report_once("%s: failed to read userfault: %s", __func__,
+                              ret < 0 ? strerror(errno) : "short read");
+        }
+        return NULL;
+    }
+
+    if (msg.event != UFFD_EVENT_PAGEFAULT ||
+        !(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)) {
+        return NULL;
+    }
+
+    return (void *)(uintptr_t)msg.arg.pagefault.address;
 }
 
 #else
@@ -1334,7 +1568,7 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
     return -1;
 }
 
-void *postcopy_get_tmp_page(MigrationIncomingState *mis)
+void *postcopy_get_tmp_page(MigrationIncomingState *mis, int channel)
 {
     assert(0);
     return NULL;
@@ -1347,6 +1581,41 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
     assert(0);
     return -1;
 }
+
+int uffd_wp_open(Error **errp)
+{
+    error_setg(errp, "Userfault write-protect: No OS support");
+    return -1;
+}
+
+bool uffd_wp_supported_by_host(void)
+{
+    return false;
+}
+
+int uffd_wp_register(int ufd, void *addr, uint64_t len)
+{
+    assert(0);
+    return -1;
+}
+
+int uffd_wp_unregister(int ufd, void *addr, uint64_t len)
+{
+    assert(0);
+    return -1;
+}
+
+int uffd_wp_protect(int ufd, void *addr, uint64_t len, bool wp)
+{
+    assert(0);
+    return -1;
+}
+
+void *uffd_wp_read_fault(int ufd)
+{
+    assert(0);
+    return NULL;
+}
 #endif
 
 /* ------------------------------------------------------------------------- */
@@ -1366,6 +1635,148 @@ void postcopy_fault_thread_notify(MigrationIncomingState *mis)
     }
 }
 
+/*
+ * Postcopy preemption: the pages requested by the destination are sent
+ * over a channel of their own, so that they don't queue up behind the
+ * background transfer on the main stream.  The source connects it as
+ * soon as the main channel is up; only the migration thread writes to
+ * it, and only while in postcopy.  On the destination, a thread loads
+ * the pages from it once postcopy listens.
+ */
+static void postcopy_preempt_send_channel_new(QIOTask *task, gpointer opaque)
+{
+    MigrationState *s = opaque;
+    QIOChannel *ioc = QIO_CHANNEL(qio_task_get_source(task));
+    Error *local_err = NULL;
+
+    if (qio_task_propagate_error(task, &local_err)) {
+        migrate_set_error(s, local_err);
+        error_free(local_err);
+    } else {
+        qio_channel_set_name(ioc, "migration-postcopy-preempt");
+        qio_channel_set_delay(ioc, false);
+        s->postcopy_qemufile_src = qemu_fopen_channel_output(ioc);
+        trace_postcopy_preempt_new_channel();
+    }
+    object_unref(OBJECT(ioc));
+    qemu_sem_post(&s->postcopy_qemufile_src_sem);
+}
+
+int postcopy_preempt_setup(MigrationState *s, Error **errp)
+{
+    if (!migrate_postcopy_preempt()) {
+        return 0;
+    }
+
+    if (!socket_send_channel_available() ||
+        (s->parameters.tls_creds && *s->parameters.tls_creds)) {
+        error_setg(errp, "postcopy-preempt requires a tcp or unix "
+                   "migration without TLS");
+        return -1;
+    }
+
+    socket_send_channel_create(postcopy_preempt_send_channel_new, s);
+    return 0;
+}
+
+int postcopy_preempt_wait_channel(MigrationState *s)
+{
+    if (!migrate_postcopy_preempt()) {
+        return 0;
+    }
+
+    trace_postcopy_preempt_wait_channel();
+    qemu_sem_wait(&s->postcopy_qemufile_src_sem);
+
+    return s->postcopy_qemufile_src ? 0 : -1;
+}
+
+void postcopy_preempt_close(MigrationState *s)
+{
+    QEMUFile *file;
+
+    qemu_mutex_lock(&s->qemu_file_lock);
+    file = s->postcopy_qemufile_src;
+    s->postcopy_qemufile_src = NULL;
+    qemu_mutex_unlock(&s->qemu_file_lock);
+
+    if (file) {
+        qemu_file_shutdown(file);
+        qemu_fclose(file);
+    }
+}
+
+static void *postcopy_preempt_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    QEMUFile *f = mis->postcopy_qemufile_dst;
+    int ret = 0;
+
+    rcu_register_thread();
+    trace_postcopy_preempt_thread_entry();
+
+    qemu_file_set_blocking(f, true);
+    /*
+     * Every requested page is followed by an EOS, so that we don't sit
+     * in the RCU critical section while waiting for the next one.
+     */
+    while (!ret && !atomic_read(&mis->preempt_thread_quit)) {
+        rcu_read_lock();
+        ret = ram_load_postcopy(f, RAM_CHANNEL_POSTCOPY);
+        rcu_read_unlock();
+    }
+
+    /*
+     * This is also how we learn that the source closed the channel at
+     * the end of migration.  If it broke instead, the source notices,
+     * and uses the main channel after recovering, which resends all
+     * the pages that we didn't get here.
+     */
+    trace_postcopy_preempt_thread_exit(ret);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void postcopy_preempt_thread_start(MigrationIncomingState *mis)
+{
+    PostcopyState ps = postcopy_state_get();
+
+    if (mis->have_preempt_thread || !mis->postcopy_qemufile_dst ||
+        ps < POSTCOPY_INCOMING_LISTENING || ps >= POSTCOPY_INCOMING_END) {
+        return;
+    }
+
+    mis->preempt_thread_quit = false;
+    mis->have_preempt_thread = true;
+    qemu_thread_create(&mis->preempt_thread, "postcopy/preempt",
+                       postcopy_preempt_thread, mis, QEMU_THREAD_JOINABLE);
+}
+
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *f)
+{
+    trace_postcopy_preempt_new_channel();
+    mis->postcopy_qemufile_dst = f;
+    /* In case postcopy started listening before the channel got here */
+    postcopy_preempt_thread_start(mis);
+}
+
+void postcopy_preempt_listen(MigrationIncomingState *mis)
+{
+    postcopy_preempt_thread_start(mis);
+}
+
+void postcopy_preempt_thread_stop(MigrationIncomingState *mis)
+{
+    if (!mis->have_preempt_thread) {
+        return;
+    }
+
+    atomic_set(&mis->preempt_thread_quit, true);
+    qemu_file_shutdown(mis->postcopy_qemufile_dst);
+    qemu_thread_join(&mis->preempt_thread);
+    mis->have_preempt_thread = false;
+}
+
 /**
  * postcopy_discard_send_init: Called at the start of each RAMBlock before
  *   asking to discard individual ranges.
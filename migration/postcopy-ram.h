@@ -105,10 +105,10 @@ typedef enum {
 
 /*
  * Allocate a page of memory that can be mapped at a later point in time
- * using postcopy_place_page
+ * using postcopy_place_page, for the pages received on @channel
  * Returns: Pointer to allocated page
  */
-void *postcopy_get_tmp_page(MigrationIncomingState *mis);
+void *postcopy_get_tmp_page(MigrationIncomingState *mis, int channel);
 
 PostcopyState postcopy_state_get(void);
 /* Set the state and return the old state */
@@ -116,6 +116,18 @@ PostcopyState postcopy_state_set(PostcopyState new_state);
 
 void postcopy_fault_thread_notify(MigrationIncomingState *mis);
 
+/*
+ * Postcopy preemption: the source connects the channel for requested
+ * pages at the start of migration, and waits for it before postcopy.
+ */
+int postcopy_preempt_setup(MigrationState *s, Error **errp);
+int postcopy_preempt_wait_channel(MigrationState *s);
+void postcopy_preempt_close(MigrationState *s);
+/* On the destination, the channel may come before or after the listen */
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *f);
+void postcopy_preempt_listen(MigrationIncomingState *mis);
+void postcopy_preempt_thread_stop(MigrationIncomingState *mis);
+
 /*
  * To be called once at the start before any device initialisation
  */
@@ -189,4 +201,16 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd, uint64_t client_addr,
 int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                  uint64_t client_addr, uint64_t offset);
 
+/*
+ * Userfault write-protection, used on the source by background snapshots
+ * to find out which pages the guest is about to modify.
+ */
+int uffd_wp_open(Error **errp);
+bool uffd_wp_supported_by_host(void);
+int uffd_wp_register(int ufd, void *addr, uint64_t len);
+int uffd_wp_unregister(int ufd, void *addr, uint64_t len);
+int uffd_wp_protect(int ufd, void *addr, uint64_t len, bool wp);
+/* Non-blocking, returns the address written to or NULL */
+void *uffd_wp_read_fault(int ufd);
+
 #endif
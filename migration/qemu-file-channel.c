@@ -27,6 +27,7 @@
 #include "exec/cpu-common.h"
 #include "qemu-file.h"
 #include "io/channel-socket.h"
+#include "io/channel-file.h"
 #include "qemu/iov.h"
 
 
@@ -100,6 +101,120 @@ static ssize_t channel_get_buffer(void *opaque,
 }
 
 
+static ssize_t channel_readv_buffer(void *opaque,
+                                    struct iovec *iov,
+                                    int iovcnt,
+                                    int64_t pos)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    ssize_t ret;
+
+    do {
+        ret = qio_channel_readv(ioc, iov, iovcnt, NULL);
+        if (ret < 0) {
+            if (ret == QIO_CHANNEL_ERR_BLOCK) {
+                if (qemu_in_coroutine()) {
+                    qio_channel_yield(ioc, G_IO_IN);
+                } else {
+                    qio_channel_wait(ioc, G_IO_IN);
+                }
+            } else {
+                /* XXX handle Error * object */
+                return -EIO;
+            }
+        }
+    } while (ret == QIO_CHANNEL_ERR_BLOCK);
+
+    return ret;
+}
+
+
+static ssize_t channel_pwrite(void *opaque,
+                              const uint8_t *buf,
+                              size_t size,
+                              int64_t pos)
+{
+#ifdef _WIN32
+    return -ENOTSUP;
+#else
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    size_t done = 0;
+    int fd;
+
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        return -ENOTSUP;
+    }
+    fd = QIO_CHANNEL_FILE(ioc)->fd;
+
+    while (done < size) {
+        ssize_t len = pwrite(fd, buf + done, size - done, pos + done);
+
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        done += len;
+    }
+    return done;
+#endif
+}
+
+
+static ssize_t channel_pread(void *opaque,
+                             uint8_t *buf,
+                             size_t size,
+                             int64_t pos)
+{
+#ifdef _WIN32
+    return -ENOTSUP;
+#else
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    size_t done = 0;
+    int fd;
+
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        return -ENOTSUP;
+    }
+    fd = QIO_CHANNEL_FILE(ioc)->fd;
+
+    while (done < size) {
+        ssize_t len = pread(fd, buf + done, size - done, pos + done);
+
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (len == 0) {
+            /* XXX the file is too short */
+            return -EIO;
+        }
+        done += len;
+    }
+    return done;
+#endif
+}
+
+
+static int64_t channel_seek(void *opaque,
+                            int64_t offset,
+                            int whence)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    off_t ret;
+
+    ret = qio_channel_io_seek(ioc, offset, whence, NULL);
+    if (ret == (off_t)-1) {
+        /* XXX handle Error * object */
+        return -ENOTSUP;
+    }
+    return ret;
+}
+
+
 static int channel_close(void *opaque)
 {
     QIOChannel *ioc = QIO_CHANNEL(opaque);
@@ -161,6 +276,9 @@ static QEMUFile *channel_get_output_return_path(void *opaque)
 
 static const QEMUFileOps channel_input_ops = {
     .get_buffer = channel_get_buffer,
+    .readv_buffer = channel_readv_buffer,
+    .pread = channel_pread,
+    .seek = channel_seek,
     .close = channel_close,
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
@@ -170,6 +288,8 @@ static const QEMUFileOps channel_input_ops = {
 
 static const QEMUFileOps channel_output_ops = {
     .writev_buffer = channel_writev_buffer,
+    .pwrite = channel_pwrite,
+    .seek = channel_seek,
     .close = channel_close,
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
@@ -26,12 +26,26 @@
 #include "qemu-common.h"
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
+#include "qemu/bitmap.h"
 #include "migration.h"
 #include "qemu-file.h"
 #include "trace.h"
 
+/*
+ * The write buffer and the iovec start small and double, up to the
+ * maximum, each time they fill up before a flush; a stream made of large
+ * records or of many pages then needs fewer writes.
+ */
 #define IO_BUF_SIZE 32768
-#define MAX_IOV_SIZE MIN(IOV_MAX, 64)
+#define IO_BUF_SIZE_MAX (256 * 1024)
+#define MIN_IOV_SIZE MIN(IOV_MAX, 64)
+#define MAX_IOV_SIZE IOV_MAX
+
+/*
+ * Reads of at least this size that find the buffer empty go straight
+ * into the caller's memory, see qemu_get_buffer()
+ */
+#define DIRECT_READ_MIN 1024
 
 struct QEMUFile {
     const QEMUFileOps *ops;
@@ -45,11 +59,20 @@ struct QEMUFile {
                     when reading */
     int buf_index;
     int buf_size; /* 0 when writing */
-    uint8_t buf[IO_BUF_SIZE];
+    int buf_len;  /* allocated size of buf */
+    uint8_t *buf;
 
-    DECLARE_BITMAP(may_free, MAX_IOV_SIZE);
-    struct iovec iov[MAX_IOV_SIZE];
+    unsigned long *may_free;
+    struct iovec *iov;
     unsigned int iovcnt;
+    unsigned int iov_len; /* allocated entries of iov and may_free */
+
+    bool buf_full; /* buf or iov filled up since the last flush */
+    bool iov_full;
+
+    /* Bytes that went through buf, and bytes read without it */
+    uint64_t bytes_copied;
+    uint64_t bytes_direct;
 
     int last_error;
 };
@@ -98,6 +121,11 @@ QEMUFile *qemu_fopen_ops(void *opaque, const QEMUFileOps *ops)
 
     f->opaque = opaque;
     f->ops = ops;
+    f->buf_len = IO_BUF_SIZE;
+    f->buf = g_malloc(f->buf_len);
+    f->iov_len = MIN_IOV_SIZE;
+    f->iov = g_new(struct iovec, f->iov_len);
+    f->may_free = bitmap_new(f->iov_len);
     return f;
 }
 
@@ -163,7 +191,28 @@ static void qemu_iovec_release_ram(QEMUFile *f)
             error_report("migrate: madvise DONTNEED failed %p %zd: %s",
                          iov.iov_base, iov.iov_len, strerror(errno));
     }
-    memset(f->may_free, 0, sizeof(f->may_free));
+    bitmap_zero(f->may_free, f->iov_len);
+}
+
+/*
+ * Grow whatever filled up before the flush that just completed; nothing
+ * points into buf or iov at this point.
+ */
+static void qemu_file_grow(QEMUFile *f)
+{
+    if (f->buf_full && f->buf_len < IO_BUF_SIZE_MAX) {
+        f->buf_len *= 2;
+        f->buf = g_realloc(f->buf, f->buf_len);
+    }
+    if (f->iov_full && f->iov_len < MAX_IOV_SIZE) {
+        unsigned int len = MIN(f->iov_len * 2, MAX_IOV_SIZE);
+
+        f->iov = g_renew(struct iovec, f->iov, len);
+        f->may_free = bitmap_zero_extend(f->may_free, f->iov_len, len);
+        f->iov_len = len;
+    }
+    f->buf_full = false;
+    f->iov_full = false;
 }
 
 /**
@@ -200,6 +249,7 @@ void qemu_fflush(QEMUFile *f)
     }
     f->buf_index = 0;
     f->iovcnt = 0;
+    qemu_file_grow(f);
 }
 
 void ram_control_before_iterate(QEMUFile *f, uint64_t flags)
@@ -295,7 +345,7 @@ static ssize_t qemu_fill_buffer(QEMUFile *f)
     f->buf_size = pending;
 
     len = f->ops->get_buffer(f->opaque, f->buf + pending, f->pos,
-                        IO_BUF_SIZE - pending);
+                        f->buf_len - pending);
     if (len > 0) {
         f->buf_size += len;
         f->pos += len;
@@ -308,6 +358,44 @@ static ssize_t qemu_fill_buffer(QEMUFile *f)
     return len;
 }
 
+/*
+ * Read into @buf, which gets at most @size bytes, and into the rest of
+ * the (empty) internal buffer at the same time.  This saves a copy of
+ * @buf while still reading ahead, and is how pages land directly in
+ * guest memory on the destination.
+ *
+ * Returns the number of bytes that went to @buf, or what
+ * qemu_fill_buffer() would on error.
+ */
+static ssize_t qemu_fill_direct(QEMUFile *f, uint8_t *buf, size_t size)
+{
+    struct iovec iov[2] = {
+        { .iov_base = buf, .iov_len = size },
+        { .iov_base = f->buf, .iov_len = f->buf_len },
+    };
+    ssize_t len;
+
+    assert(f->buf_index == f->buf_size);
+    f->buf_index = 0;
+    f->buf_size = 0;
+
+    len = f->ops->readv_buffer(f->opaque, iov, ARRAY_SIZE(iov), f->pos);
+    if (len > 0) {
+        f->pos += len;
+        if (len > size) {
+            f->buf_size = len - size;
+            len = size;
+        }
+        f->bytes_direct += len;
+    } else if (len == 0) {
+        qemu_file_set_error(f, -EIO);
+    } else if (len != -EAGAIN) {
+        qemu_file_set_error(f, len);
+    }
+
+    return len;
+}
+
 void qemu_update_position(QEMUFile *f, size_t size)
 {
     f->pos += size;
@@ -339,8 +427,11 @@ int qemu_fclose(QEMUFile *f)
     if (f->last_error) {
         ret = f->last_error;
     }
+    trace_qemu_file_fclose(f->bytes_copied, f->bytes_direct);
+    g_free(f->may_free);
+    g_free(f->iov);
+    g_free(f->buf);
     g_free(f);
-    trace_qemu_file_fclose();
     return ret;
 }
 
@@ -361,7 +452,8 @@ static void add_to_iovec(QEMUFile *f, const uint8_t *buf, size_t size,
         f->iov[f->iovcnt++].iov_len = size;
     }
 
-    if (f->iovcnt >= MAX_IOV_SIZE) {
+    if (f->iovcnt >= f->iov_len) {
+        f->iov_full = true;
         qemu_fflush(f);
     }
 }
@@ -386,15 +478,17 @@ void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, size_t size)
     }
 
     while (size > 0) {
-        l = IO_BUF_SIZE - f->buf_index;
+        l = f->buf_len - f->buf_index;
         if (l > size) {
             l = size;
         }
         memcpy(f->buf + f->buf_index, buf, l);
         f->bytes_xfer += l;
+        f->bytes_copied += l;
         add_to_iovec(f, f->buf + f->buf_index, l, false);
         f->buf_index += l;
-        if (f->buf_index == IO_BUF_SIZE) {
+        if (f->buf_index == f->buf_len) {
+            f->buf_full = true;
             qemu_fflush(f);
         }
         if (qemu_file_get_error(f)) {
@@ -413,9 +507,11 @@ void qemu_put_byte(QEMUFile *f, int v)
 
     f->buf[f->buf_index] = v;
     f->bytes_xfer++;
+    f->bytes_copied++;
     add_to_iovec(f, f->buf + f->buf_index, 1, false);
     f->buf_index++;
-    if (f->buf_index == IO_BUF_SIZE) {
+    if (f->buf_index == f->buf_len) {
+        f->buf_full = true;
         qemu_fflush(f);
     }
 }
@@ -441,8 +537,8 @@ size_t qemu_peek_buffer(QEMUFile *f, uint8_t **buf, size_t size, size_t offset)
     size_t index;
 
     assert(!qemu_file_is_writable(f));
-    assert(offset < IO_BUF_SIZE);
-    assert(size <= IO_BUF_SIZE - offset);
+    assert(offset < f->buf_len);
+    assert(size <= f->buf_len - offset);
 
     /* The 1st byte to read from */
     index = f->buf_index + offset;
@@ -479,6 +575,9 @@ size_t qemu_peek_buffer(QEMUFile *f, uint8_t **buf, size_t size, size_t offset)
  * Read 'size' bytes of data from the file into buf.
  * 'size' can be larger than the internal buffer.
  *
+ * Once the internal buffer is drained, large reads go straight into buf
+ * if the backend can read into an iovec.
+ *
  * It will return size bytes unless there was an error, in which case it will
  * return as many as it managed to read (assuming blocking fd's which
  * all current QEMUFile are)
@@ -492,11 +591,25 @@ size_t qemu_get_buffer(QEMUFile *f, uint8_t *buf, size_t size)
         size_t res;
         uint8_t *src;
 
-        res = qemu_peek_buffer(f, &src, MIN(pending, IO_BUF_SIZE), 0);
+        if (f->buf_index == f->buf_size && pending >= DIRECT_READ_MIN &&
+            f->ops->readv_buffer) {
+            ssize_t len = qemu_fill_direct(f, buf, pending);
+
+            if (len <= 0) {
+                return done;
+            }
+            buf += len;
+            pending -= len;
+            done += len;
+            continue;
+        }
+
+        res = qemu_peek_buffer(f, &src, MIN(pending, f->buf_len), 0);
         if (res == 0) {
             return done;
         }
         memcpy(buf, src, res);
+        f->bytes_copied += res;
         qemu_file_skip(f, res);
         buf += res;
         pending -= res;
@@ -526,7 +639,7 @@ size_t qemu_get_buffer(QEMUFile *f, uint8_t *buf, size_t size)
  */
 size_t qemu_get_buffer_in_place(QEMUFile *f, uint8_t **buf, size_t size)
 {
-    if (size < IO_BUF_SIZE) {
+    if (size < f->buf_len) {
         size_t res;
         uint8_t *src;
 
@@ -551,7 +664,7 @@ int qemu_peek_byte(QEMUFile *f, int offset)
     int index = f->buf_index + offset;
 
     assert(!qemu_file_is_writable(f));
-    assert(offset < IO_BUF_SIZE);
+    assert(offset < f->buf_len);
 
     if (index >= f->buf_size) {
         qemu_fill_buffer(f);
@@ -590,6 +703,61 @@ int64_t qemu_ftell(QEMUFile *f)
     return f->pos;
 }
 
+/*
+ * Continue the stream at another offset of the file, as with lseek()
+ *
+ * What was read ahead is dropped, so only SEEK_SET is meaningful when
+ * reading.  The position of the stream, as qemu_ftell() reports it,
+ * keeps counting the bytes transferred.
+ *
+ * Returns the new offset, or a negative errno value, which is -ENOTSUP
+ * if the file cannot be seeked.
+ */
+int64_t qemu_fseek(QEMUFile *f, int64_t offset, int whence)
+{
+    int ret;
+
+    if (!f->ops->seek) {
+        return -ENOTSUP;
+    }
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+        ret = qemu_file_get_error(f);
+        if (ret < 0) {
+            return ret;
+        }
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    return f->ops->seek(f->opaque, offset, whence);
+}
+
+/*
+ * Write @size bytes at @pos of the file, without touching the stream
+ *
+ * Unlike the other functions, these two can be called from any thread.
+ * The errors are returned rather than recorded in @f.
+ */
+ssize_t qemu_file_pwrite(QEMUFile *f, const uint8_t *buf, size_t size,
+                         int64_t pos)
+{
+    if (!f->ops->pwrite) {
+        return -ENOTSUP;
+    }
+    return f->ops->pwrite(f->opaque, buf, size, pos);
+}
+
+/* Read @size bytes at @pos of the file, without touching the stream */
+ssize_t qemu_file_pread(QEMUFile *f, uint8_t *buf, size_t size, int64_t pos)
+{
+    if (!f->ops->pread) {
+        return -ENOTSUP;
+    }
+    return f->ops->pread(f->opaque, buf, size, pos);
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (qemu_file_get_error(f)) {
@@ -601,6 +769,12 @@ int qemu_file_rate_limit(QEMUFile *f)
     return 0;
 }
 
+/* Number of bytes that went through the internal buffer of @f */
+uint64_t qemu_file_get_copied_bytes(QEMUFile *f)
+{
+    return f->bytes_copied;
+}
+
 int64_t qemu_file_get_rate_limit(QEMUFile *f)
 {
     return f->xfer_limit;
@@ -698,14 +872,14 @@ static int qemu_compress_data(z_stream *stream, uint8_t *dest, size_t dest_len,
 ssize_t qemu_put_compression_data(QEMUFile *f, z_stream *stream,
                                   const uint8_t *p, size_t size)
 {
-    ssize_t blen = IO_BUF_SIZE - f->buf_index - sizeof(int32_t);
+    ssize_t blen = f->buf_len - f->buf_index - sizeof(int32_t);
 
     if (blen < compressBound(size)) {
         if (!qemu_file_is_writable(f)) {
             return -1;
         }
         qemu_fflush(f);
-        blen = IO_BUF_SIZE - sizeof(int32_t);
+        blen = f->buf_len - sizeof(int32_t);
         if (blen < compressBound(size)) {
             return -1;
         }
@@ -722,7 +896,8 @@ ssize_t qemu_put_compression_data(QEMUFile *f, z_stream *stream,
         add_to_iovec(f, f->buf + f->buf_index, blen, false);
     }
     f->buf_index += blen;
-    if (f->buf_index == IO_BUF_SIZE) {
+    if (f->buf_index == f->buf_len) {
+        f->buf_full = true;
         qemu_fflush(f);
     }
     return blen + sizeof(int32_t);
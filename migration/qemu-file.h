@@ -58,6 +58,29 @@ typedef int (QEMUFileSetBlocking)(void *opaque, bool enabled);
 typedef ssize_t (QEMUFileWritevBufferFunc)(void *opaque, struct iovec *iov,
                                            int iovcnt, int64_t pos);
 
+/*
+ * Like QEMUFileGetBufferFunc, but scatters what it reads over an iovec.
+ * It may return after filling only part of it.
+ */
+typedef ssize_t (QEMUFileReadvBufferFunc)(void *opaque, struct iovec *iov,
+                                          int iovcnt, int64_t pos);
+
+/*
+ * Write or read at a given position of the file, independently of the
+ * stream and possibly from several threads at once.  The handler must
+ * transfer all of the data or return a negative errno value.
+ */
+typedef ssize_t (QEMUFilePwriteFunc)(void *opaque, const uint8_t *buf,
+                                     size_t size, int64_t pos);
+typedef ssize_t (QEMUFilePreadFunc)(void *opaque, uint8_t *buf,
+                                    size_t size, int64_t pos);
+
+/*
+ * Move the stream within the file, as lseek() does.  Returns the new
+ * offset or a negative errno value.
+ */
+typedef int64_t (QEMUFileSeekFunc)(void *opaque, int64_t offset, int whence);
+
 /*
  * This function provides hooks around different
  * stages of RAM migration.
@@ -106,6 +129,10 @@ typedef struct QEMUFileOps {
     QEMUFileWritevBufferFunc *writev_buffer;
     QEMURetPathFunc *get_return_path;
     QEMUFileShutdownFunc *shut_down;
+    QEMUFileReadvBufferFunc *readv_buffer;
+    QEMUFilePwriteFunc *pwrite;
+    QEMUFilePreadFunc *pread;
+    QEMUFileSeekFunc *seek;
 } QEMUFileOps;
 
 typedef struct QEMUFileHooks {
@@ -121,6 +148,10 @@ int qemu_get_fd(QEMUFile *f);
 int qemu_fclose(QEMUFile *f);
 int64_t qemu_ftell(QEMUFile *f);
 int64_t qemu_ftell_fast(QEMUFile *f);
+int64_t qemu_fseek(QEMUFile *f, int64_t offset, int whence);
+ssize_t qemu_file_pwrite(QEMUFile *f, const uint8_t *buf, size_t size,
+                         int64_t pos);
+ssize_t qemu_file_pread(QEMUFile *f, uint8_t *buf, size_t size, int64_t pos);
 /*
  * put_buffer without copying the buffer.
  * The buffer should be available till it is sent asynchronously.
@@ -149,6 +180,7 @@ void qemu_update_position(QEMUFile *f, size_t size);
 void qemu_file_reset_rate_limit(QEMUFile *f);
 void qemu_file_set_rate_limit(QEMUFile *f, int64_t new_rate);
 int64_t qemu_file_get_rate_limit(QEMUFile *f);
+uint64_t qemu_file_get_copied_bytes(QEMUFile *f);
 void qemu_file_set_error(QEMUFile *f, int ret);
 int qemu_file_shutdown(QEMUFile *f);
 QEMUFile *qemu_file_get_return_path(QEMUFile *f);
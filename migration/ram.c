@@ -34,6 +34,7 @@
 #include "qemu/bitmap.h"
 #include "qemu/main-loop.h"
 #include "qemu/pmem.h"
+#include "qemu/units.h"
 #include "xbzrle.h"
 #include "ram.h"
 #include "migration.h"
@@ -57,6 +58,10 @@
 #include "qemu/uuid.h"
 #include "savevm.h"
 #include "qemu/iov.h"
+#include "dirtylimit.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 /***********************************************************/
 /* ram save/restore */
@@ -76,6 +81,16 @@
 #define RAM_SAVE_FLAG_XBZRLE   0x40
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
+/* The whole host page is zero; only sent with hugepage-dirty */
+#define RAM_SAVE_FLAG_ZERO_HOST_PAGE   0x200
+
+/*
+ * With hugepage-dirty, a huge page with at least 1/HUGEPAGE_FULL_RATIO
+ * of its target pages dirty is sent whole: the clean pieces cost little
+ * next to the dirty ones, and the page no longer needs its dirty pieces
+ * picked out and resent one by one in the next iterations.
+ */
+#define HUGEPAGE_FULL_RATIO 2
 
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
@@ -159,10 +174,16 @@ out:
     return ret;
 }
 
+/*
+ * With x-ignore-shared, both sides already see the same contents of shared
+ * RAM, and of RAM freshly mapped from a saved image that the source has in
+ * its shared mapping of the same file.
+ */
 static bool ramblock_is_ignored(RAMBlock *block)
 {
     return !qemu_ram_is_migratable(block) ||
-           (migrate_ignore_shared() && qemu_ram_is_shared(block));
+           (migrate_ignore_shared() &&
+            (qemu_ram_is_shared(block) || qemu_ram_is_image(block)));
 }
 
 /* Should be holding either ram_list.mutex, or the RCU lock. */
@@ -302,6 +323,23 @@ struct RAMSrcPageRequest {
     QSIMPLEQ_ENTRY(RAMSrcPageRequest) next_req;
 };
 
+/*
+ * After a postcopy page request, the background search sweeps the
+ * region following the requested page first, since the guest is likely
+ * to fault there next.  When another request comes in meanwhile, the
+ * sweep of the current region is suspended; it resumes once the sweep
+ * of the new region is done, most recent region first.
+ */
+#define POSTCOPY_HOT_REGION_SIZE    (2 * MiB)
+#define POSTCOPY_HOT_REGIONS_MAX    16
+
+struct RAMHotRegion {
+    RAMBlock *block;
+    /* Next target page to look at, and end of the region */
+    unsigned long page;
+    unsigned long end;
+};
+
 /* State of RAM for migration */
 struct RAMState {
     /* QEMUFile used for this migration */
@@ -310,6 +348,8 @@ struct RAMState {
     RAMBlock *last_seen_block;
     /* Last block from where we have sent data */
     RAMBlock *last_sent_block;
+    /* Same, on the postcopy-preempt channel */
+    RAMBlock *last_sent_block_preempt;
     /* Last dirty target page we have sent */
     ram_addr_t last_page;
     /* last ram version we have seen */
@@ -325,6 +365,8 @@ struct RAMState {
     int64_t time_last_bitmap_sync;
     /* bytes transferred at start_time */
     uint64_t bytes_xfer_prev;
+    /* bytes copied into the stream buffer at the last bitmap sync */
+    uint64_t bytes_copied_prev;
     /* number of dirty pages since start_time */
     uint64_t num_dirty_pages_period;
     /* xbzrle misses since the beginning of the period */
@@ -351,6 +393,17 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* Region being swept after a page request, block is NULL if none */
+    struct RAMHotRegion hot_region;
+    /* Suspended regions, the most recent one last */
+    struct RAMHotRegion hot_regions[POSTCOPY_HOT_REGIONS_MAX];
+    unsigned int hot_regions_num;
+    /* Write-protect userfaultfd of a background snapshot, or -1 */
+    int uffdio_fd;
+    /* mapped-ram: pages not yet handed to a thread, run_len 0 if none */
+    RAMBlock *run_block;
+    ram_addr_t run_offset;
+    size_t run_len;
 };
 typedef struct RAMState RAMState;
 
@@ -457,6 +510,40 @@ static QemuThread *decompress_threads;
 static QemuMutex decomp_done_lock;
 static QemuCond decomp_done_cond;
 
+/* Pages handed to a load thread at a time */
+#define LOAD_BATCH_PAGES 64
+
+/*
+ * A load thread writes a batch of received pages into guest memory.
+ * The pages are copied out of the migration stream into @buf by the
+ * loading coroutine, which is cheap: it's the first touch of guest
+ * memory that is slow.
+ */
+struct LoadParam {
+    /* Protected by load_done_lock: the batch is free to be filled */
+    bool done;
+    bool quit;
+    /* Set with @mutex held when the batch is ready to be loaded */
+    bool pending;
+    QemuMutex mutex;
+    QemuCond cond;
+    unsigned int num;
+    void *host[LOAD_BATCH_PAGES];
+    /* Byte the page is filled with, or -1 if its data is in @buf */
+    int fill[LOAD_BATCH_PAGES];
+    uint8_t *buf;
+};
+typedef struct LoadParam LoadParam;
+
+static LoadParam *load_param;
+static QemuThread *load_threads;
+/* The batch being filled by the loading coroutine, if any */
+static LoadParam *load_cur;
+/* Threads started by ram_load_setup(), in case the parameter changes */
+static int load_thread_count;
+static QemuMutex load_done_lock;
+static QemuCond load_done_cond;
+
 static bool do_compress_ram_page(QEMUFile *f, z_stream *stream, RAMBlock *block,
                                  ram_addr_t offset, uint8_t *source_buf);
 
@@ -583,6 +670,13 @@ exit:
 
 #define MULTIFD_FLAG_SYNC (1 << 0)
 
+/* We reserve 4 bits for compression methods */
+#define MULTIFD_FLAG_COMPRESSION_MASK (0xf << 1)
+/* we need to be compatible. Before compression value was 0 */
+#define MULTIFD_FLAG_NOCOMP (0 << 1)
+#define MULTIFD_FLAG_ZLIB (1 << 1)
+#define MULTIFD_FLAG_ZSTD (2 << 1)
+
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
 
@@ -663,6 +757,8 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* used for compression methods */
+    void *data;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -698,8 +794,532 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* used for de-compression methods */
+    void *data;
 } MultiFDRecvParams;
 
+typedef struct {
+    /* Setup for sending side */
+    int (*send_setup)(MultiFDSendParams *p, Error **errp);
+    /* Cleanup for sending side */
+    void (*send_cleanup)(MultiFDSendParams *p);
+    /* Prepare the send packet, sets p->next_packet_size */
+    int (*send_prepare)(MultiFDSendParams *p, uint32_t used, Error **errp);
+    /* Write the send packet */
+    int (*send_write)(MultiFDSendParams *p, uint32_t used, Error **errp);
+    /* Setup for receiving side */
+    int (*recv_setup)(MultiFDRecvParams *p, Error **errp);
+    /* Cleanup for receiving side */
+    void (*recv_cleanup)(MultiFDRecvParams *p);
+    /* Read all pages */
+    int (*recv_pages)(MultiFDRecvParams *p, uint32_t used, Error **errp);
+    /* Compression flag carried by each packet */
+    uint32_t flag;
+} MultiFDMethods;
+
+/* Multifd without compression */
+
+static int nocomp_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    return 0;
+}
+
+static void nocomp_send_cleanup(MultiFDSendParams *p)
+{
+}
+
+static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    p->next_packet_size = used * qemu_target_page_size();
+    return 0;
+}
+
+static int nocomp_send_write(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    int flags = 0;
+
+    if (migrate_use_zero_copy_send()) {
+        flags |= QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+    }
+    return qio_channel_writev_full_all(p->c, p->pages->iov, used,
+                                       NULL, 0, flags, errp);
+}
+
+static int nocomp_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    return 0;
+}
+
+static void nocomp_recv_cleanup(MultiFDRecvParams *p)
+{
+}
+
+static int nocomp_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                             Error **errp)
+{
+    return qio_channel_readv_all(p->c, p->pages->iov, used, errp);
+}
+
+static MultiFDMethods multifd_nocomp_ops = {
+    .send_setup = nocomp_send_setup,
+    .send_cleanup = nocomp_send_cleanup,
+    .send_prepare = nocomp_send_prepare,
+    .send_write = nocomp_send_write,
+    .recv_setup = nocomp_recv_setup,
+    .recv_cleanup = nocomp_recv_cleanup,
+    .recv_pages = nocomp_recv_pages,
+    .flag = MULTIFD_FLAG_NOCOMP,
+};
+
+/*
+ * Multifd with zlib compression
+ *
+ * Each channel keeps a single deflate/inflate stream for the whole
+ * migration.  Every packet ends with a Z_SYNC_FLUSH, so that the
+ * receiving side can decompress it as soon as it arrives.
+ */
+
+typedef struct {
+    /* stream for compression/decompression */
+    z_stream zs;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+} MultiFDZlibData;
+
+static int zlib_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDZlibData *z = g_new0(MultiFDZlibData, 1);
+    z_stream *zs = &z->zs;
+
+    if (deflateInit(zs, migrate_multifd_zlib_level()) != Z_OK) {
+        g_free(z);
+        error_setg(errp, "multifd %d: deflate init failed", p->id);
+        return -1;
+    }
+    /* Twice the packet size, so that uncompressible data always fits */
+    z->zbuff_len = MULTIFD_PACKET_SIZE * 2;
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        deflateEnd(zs);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+static void zlib_send_cleanup(MultiFDSendParams *p)
+{
+    MultiFDZlibData *z = p->data;
+
+    if (!z) {
+        return;
+    }
+    deflateEnd(&z->zs);
+    g_free(z->zbuff);
+    g_free(z);
+    p->data = NULL;
+}
+
+static int zlib_send_prepare(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    MultiFDZlibData *z = p->data;
+    z_stream *zs = &z->zs;
+    uint32_t out_size = 0;
+    int ret;
+    uint32_t i;
+
+    for (i = 0; i < used; i++) {
+        uint32_t available = z->zbuff_len - out_size;
+        int flush = Z_NO_FLUSH;
+
+        if (i == used - 1) {
+            flush = Z_SYNC_FLUSH;
+        }
+
+        zs->avail_in = iov[i].iov_len;
+        zs->next_in = iov[i].iov_base;
+
+        zs->avail_out = available;
+        zs->next_out = z->zbuff + out_size;
+
+        /*
+         * Keep calling deflate() while it makes progress and there is
+         * both input left and room left in the output buffer.
+         */
+        do {
+            ret = deflate(zs, flush);
+        } while (ret == Z_OK && zs->avail_in && zs->avail_out);
+        if (ret != Z_OK) {
+            error_setg(errp, "multifd %d: deflate returned %d instead of Z_OK",
+                       p->id, ret);
+            return -1;
+        }
+        if (zs->avail_in || !zs->avail_out) {
+            error_setg(errp, "multifd %d: deflate output buffer too small",
+                       p->id);
+            return -1;
+        }
+        out_size += available - zs->avail_out;
+    }
+    p->next_packet_size = out_size;
+
+    return 0;
+}
+
+static int zlib_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    MultiFDZlibData *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+static int zlib_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDZlibData *z = g_new0(MultiFDZlibData, 1);
+    z_stream *zs = &z->zs;
+
+    zs->next_in = Z_NULL;
+    zs->avail_in = 0;
+    if (inflateInit(zs) != Z_OK) {
+        g_free(z);
+        error_setg(errp, "multifd %d: inflate init failed", p->id);
+        return -1;
+    }
+    /* Must match the sending side, see zlib_send_setup() */
+    z->zbuff_len = MULTIFD_PACKET_SIZE * 2;
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        inflateEnd(zs);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+static void zlib_recv_cleanup(MultiFDRecvParams *p)
+{
+    MultiFDZlibData *z = p->data;
+
+    if (!z) {
+        return;
+    }
+    inflateEnd(&z->zs);
+    g_free(z->zbuff);
+    g_free(z);
+    p->data = NULL;
+}
+
+static int zlib_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
+{
+    MultiFDZlibData *z = p->data;
+    z_stream *zs = &z->zs;
+    uint32_t in_size = p->next_packet_size;
+    /* we measure the change of total_out */
+    uLong start_out = zs->total_out;
+    uint32_t expected_size = used * qemu_target_page_size();
+    int ret;
+    uint32_t i;
+
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet of %u bytes is bigger than "
+                   "the buffer of %u bytes", p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    zs->avail_in = in_size;
+    zs->next_in = z->zbuff;
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        int flush = Z_NO_FLUSH;
+
+        if (i == used - 1) {
+            flush = Z_SYNC_FLUSH;
+        }
+
+        zs->avail_out = iov->iov_len;
+        zs->next_out = iov->iov_base;
+
+        do {
+            ret = inflate(zs, flush);
+        } while (ret == Z_OK && zs->avail_in && zs->avail_out);
+        if (ret != Z_OK) {
+            error_setg(errp, "multifd %d: inflate returned %d instead of Z_OK",
+                       p->id, ret);
+            return -1;
+        }
+        if (zs->avail_out) {
+            error_setg(errp, "multifd %d: inflate generated too few output",
+                       p->id);
+            return -1;
+        }
+    }
+
+    if (zs->total_out - start_out != expected_size) {
+        error_setg(errp, "multifd %d: packet size received %lu size "
+                   "expected %u", p->id, zs->total_out - start_out,
+                   expected_size);
+        return -1;
+    }
+
+    return 0;
+}
+
+static MultiFDMethods multifd_zlib_ops = {
+    .send_setup = zlib_send_setup,
+    .send_cleanup = zlib_send_cleanup,
+    .send_prepare = zlib_send_prepare,
+    .send_write = zlib_send_write,
+    .recv_setup = zlib_recv_setup,
+    .recv_cleanup = zlib_recv_cleanup,
+    .recv_pages = zlib_recv_pages,
+    .flag = MULTIFD_FLAG_ZLIB,
+};
+
+#ifdef CONFIG_ZSTD
+/*
+ * Multifd with zstd compression
+ *
+ * Like zlib, each channel keeps a single stream and flushes it at the
+ * end of every packet.
+ */
+
+typedef struct {
+    /* stream for compression */
+    ZSTD_CStream *zcs;
+    /* stream for decompression */
+    ZSTD_DStream *zds;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+} MultiFDZstdData;
+
+static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDZstdData *z = g_new0(MultiFDZstdData, 1);
+    size_t res;
+
+    z->zcs = ZSTD_createCStream();
+    if (!z->zcs) {
+        g_free(z);
+        error_setg(errp, "multifd %d: zstd createCStream failed", p->id);
+        return -1;
+    }
+
+    res = ZSTD_initCStream(z->zcs, migrate_multifd_zstd_level());
+    if (ZSTD_isError(res)) {
+        ZSTD_freeCStream(z->zcs);
+        g_free(z);
+        error_setg(errp, "multifd %d: initCStream failed with error %s",
+                   p->id, ZSTD_getErrorName(res));
+        return -1;
+    }
+    /* Twice the packet size, so that uncompressible data always fits */
+    z->zbuff_len = MULTIFD_PACKET_SIZE * 2;
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        ZSTD_freeCStream(z->zcs);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+static void zstd_send_cleanup(MultiFDSendParams *p)
+{
+    MultiFDZstdData *z = p->data;
+
+    if (!z) {
+        return;
+    }
+    ZSTD_freeCStream(z->zcs);
+    g_free(z->zbuff);
+    g_free(z);
+    p->data = NULL;
+}
+
+static int zstd_send_prepare(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    MultiFDZstdData *z = p->data;
+    ZSTD_outBuffer out = { .dst = z->zbuff, .size = z->zbuff_len, .pos = 0 };
+    size_t ret;
+    uint32_t i;
+
+    for (i = 0; i < used; i++) {
+        ZSTD_inBuffer in = {
+            .src = iov[i].iov_base, .size = iov[i].iov_len, .pos = 0
+        };
+        ZSTD_EndDirective flush = ZSTD_e_continue;
+
+        if (i == used - 1) {
+            flush = ZSTD_e_flush;
+        }
+
+        /*
+         * With ZSTD_e_continue, loop until all input is consumed; with
+         * ZSTD_e_flush, also until the stream is fully flushed (ret == 0).
+         */
+        do {
+            ret = ZSTD_compressStream2(z->zcs, &out, &in, flush);
+        } while (!ZSTD_isError(ret) && out.pos < out.size &&
+                 (in.pos < in.size || (flush == ZSTD_e_flush && ret > 0)));
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd %d: compressStream error %s",
+                       p->id, ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (in.pos < in.size || (flush == ZSTD_e_flush && ret > 0)) {
+            error_setg(errp, "multifd %d: compressStream buffer too small",
+                       p->id);
+            return -1;
+        }
+    }
+    p->next_packet_size = out.pos;
+
+    return 0;
+}
+
+static int zstd_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    MultiFDZstdData *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+static int zstd_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDZstdData *z = g_new0(MultiFDZstdData, 1);
+    size_t ret;
+
+    z->zds = ZSTD_createDStream();
+    if (!z->zds) {
+        g_free(z);
+        error_setg(errp, "multifd %d: zstd createDStream failed", p->id);
+        return -1;
+    }
+
+    ret = ZSTD_initDStream(z->zds);
+    if (ZSTD_isError(ret)) {
+        ZSTD_freeDStream(z->zds);
+        g_free(z);
+        error_setg(errp, "multifd %d: initDStream failed with error %s",
+                   p->id, ZSTD_getErrorName(ret));
+        return -1;
+    }
+
+    /* Must match the sending side, see zstd_send_setup() */
+    z->zbuff_len = MULTIFD_PACKET_SIZE * 2;
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        ZSTD_freeDStream(z->zds);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+static void zstd_recv_cleanup(MultiFDRecvParams *p)
+{
+    MultiFDZstdData *z = p->data;
+
+    if (!z) {
+        return;
+    }
+    ZSTD_freeDStream(z->zds);
+    g_free(z->zbuff);
+    g_free(z);
+    p->data = NULL;
+}
+
+static int zstd_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
+{
+    MultiFDZstdData *z = p->data;
+    uint32_t in_size = p->next_packet_size;
+    ZSTD_inBuffer in = { .src = z->zbuff, .size = in_size, .pos = 0 };
+    size_t ret;
+    int err;
+    uint32_t i;
+
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet of %u bytes is bigger than "
+                   "the buffer of %u bytes", p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+
+    err = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+    if (err != 0) {
+        return err;
+    }
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        ZSTD_outBuffer out = {
+            .dst = iov->iov_base, .size = iov->iov_len, .pos = 0
+        };
+
+        do {
+            ret = ZSTD_decompressStream(z->zds, &out, &in);
+        } while (!ZSTD_isError(ret) && in.pos < in.size &&
+                 out.pos < out.size);
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd %d: decompressStream returned %s",
+                       p->id, ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (out.pos < out.size) {
+            error_setg(errp, "multifd %d: decompressStream generated too "
+                       "few output", p->id);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static MultiFDMethods multifd_zstd_ops = {
+    .send_setup = zstd_send_setup,
+    .send_cleanup = zstd_send_cleanup,
+    .send_prepare = zstd_send_prepare,
+    .send_write = zstd_send_write,
+    .recv_setup = zstd_recv_setup,
+    .recv_cleanup = zstd_recv_cleanup,
+    .recv_pages = zstd_recv_pages,
+    .flag = MULTIFD_FLAG_ZSTD,
+};
+#endif /* CONFIG_ZSTD */
+
+static MultiFDMethods *multifd_ops[MULTIFD_COMPRESSION__MAX] = {
+    [MULTIFD_COMPRESSION_NONE] = &multifd_nocomp_ops,
+    [MULTIFD_COMPRESSION_ZLIB] = &multifd_zlib_ops,
+#ifdef CONFIG_ZSTD
+    [MULTIFD_COMPRESSION_ZSTD] = &multifd_zstd_ops,
+#endif
+};
+
 static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
 {
     MultiFDInit_t msg;
@@ -904,6 +1524,8 @@ struct {
     uint64_t packet_num;
     /* send channels ready */
     QemuSemaphore channels_ready;
+    /* multifd ops */
+    MultiFDMethods *ops;
 } *multifd_send_state;
 
 /*
@@ -1023,6 +1645,7 @@ void multifd_save_cleanup(void)
         if (p->running) {
             qemu_thread_join(&p->thread);
         }
+        multifd_send_state->ops->send_cleanup(p);
         socket_send_channel_destroy(p->c);
         p->c = NULL;
         qemu_mutex_destroy(&p->mutex);
@@ -1087,6 +1710,10 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
+    if (multifd_send_state->ops->send_setup(p, &local_err)) {
+        goto out;
+    }
+
     if (multifd_send_initial_packet(p, &local_err) < 0) {
         goto out;
     }
@@ -1102,7 +1729,8 @@ static void *multifd_send_thread(void *opaque)
             uint64_t packet_num = p->packet_num;
             uint32_t flags = p->flags;
 
-            p->next_packet_size = used * qemu_target_page_size();
+            p->flags |= multifd_send_state->ops->flag;
+            p->next_packet_size = 0;
             multifd_send_fill_packet(p);
             p->flags = 0;
             p->num_packets++;
@@ -1110,6 +1738,21 @@ static void *multifd_send_thread(void *opaque)
             p->pages->used = 0;
             qemu_mutex_unlock(&p->mutex);
 
+            /*
+             * The pages belong to this channel until pending_job is
+             * decremented, so they can be compressed without holding the
+             * mutex; the migration thread only needs it to find an idle
+             * channel.
+             */
+            if (used) {
+                ret = multifd_send_state->ops->send_prepare(p, used,
+                                                            &local_err);
+                if (ret != 0) {
+                    break;
+                }
+                p->packet->next_packet_size = cpu_to_be32(p->next_packet_size);
+            }
+
             trace_multifd_send(p->id, packet_num, used, flags,
                                p->next_packet_size);
 
@@ -1120,8 +1763,7 @@ static void *multifd_send_thread(void *opaque)
             }
 
             if (used) {
-                ret = qio_channel_writev_all(p->c, p->pages->iov,
-                                             used, &local_err);
+                ret = multifd_send_state->ops->send_write(p, used, &local_err);
                 if (ret != 0) {
                     break;
                 }
@@ -1132,6 +1774,16 @@ static void *multifd_send_thread(void *opaque)
             qemu_mutex_unlock(&p->mutex);
 
             if (flags & MULTIFD_FLAG_SYNC) {
+                /*
+                 * Pages written with zero copy are only referenced by the
+                 * kernel; make sure it is done with them before the sync
+                 * point is reported, so no page of this round is still in
+                 * flight when the migration thread moves on.
+                 */
+                if (migrate_use_zero_copy_send() &&
+                    qio_channel_flush(p->c, &local_err) < 0) {
+                    break;
+                }
                 qemu_sem_post(&multifd_send_state->sem_sync);
             }
             qemu_sem_post(&multifd_send_state->channels_ready);
@@ -1168,6 +1820,15 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
     if (qio_task_propagate_error(task, &local_err)) {
         migrate_set_error(migrate_get_current(), local_err);
         multifd_save_cleanup();
+    } else if (migrate_use_zero_copy_send() &&
+               !qio_channel_has_feature(sioc,
+                                        QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        error_setg(&local_err, "multifd: zero-copy-send is not supported "
+                   "by this channel");
+        migrate_set_error(migrate_get_current(), local_err);
+        error_free(local_err);
+        object_unref(OBJECT(sioc));
+        multifd_save_cleanup();
     } else {
         p->c = QIO_CHANNEL(sioc);
         qio_channel_set_delay(p->c, false);
@@ -1195,6 +1856,7 @@ int multifd_save_setup(void)
     multifd_send_state->pages = multifd_pages_init(page_count);
     qemu_sem_init(&multifd_send_state->sem_sync, 0);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
+    multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
 
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
@@ -1223,6 +1885,8 @@ struct {
     QemuSemaphore sem_sync;
     /* global number of generated multifd packets */
     uint64_t packet_num;
+    /* multifd ops */
+    MultiFDMethods *ops;
 } *multifd_recv_state;
 
 static void multifd_recv_terminate_threads(Error *err)
@@ -1267,6 +1931,7 @@ int multifd_load_cleanup(Error **errp)
         if (p->running) {
             qemu_thread_join(&p->thread);
         }
+        multifd_recv_state->ops->recv_cleanup(p);
         object_unref(OBJECT(p->c));
         p->c = NULL;
         qemu_mutex_destroy(&p->mutex);
@@ -1324,6 +1989,10 @@ static void *multifd_recv_thread(void *opaque)
     trace_multifd_recv_thread_start(p->id);
     rcu_register_thread();
 
+    if (multifd_recv_state->ops->recv_setup(p, &local_err)) {
+        goto out;
+    }
+
     while (true) {
         uint32_t used;
         uint32_t flags;
@@ -1352,9 +2021,17 @@ static void *multifd_recv_thread(void *opaque)
         p->num_pages += used;
         qemu_mutex_unlock(&p->mutex);
 
+        if ((flags & MULTIFD_FLAG_COMPRESSION_MASK) !=
+            multifd_recv_state->ops->flag) {
+            error_setg(&local_err, "multifd %d: flags received %x "
+                       "and expected %x", p->id,
+                       flags & MULTIFD_FLAG_COMPRESSION_MASK,
+                       multifd_recv_state->ops->flag);
+            break;
+        }
+
         if (used) {
-            ret = qio_channel_readv_all(p->c, p->pages->iov,
-                                        used, &local_err);
+            ret = multifd_recv_state->ops->recv_pages(p, used, &local_err);
             if (ret != 0) {
                 break;
             }
@@ -1366,6 +2043,7 @@ static void *multifd_recv_thread(void *opaque)
         }
     }
 
+out:
     if (local_err) {
         multifd_recv_terminate_threads(local_err);
     }
@@ -1393,6 +2071,7 @@ int multifd_load_setup(void)
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
     atomic_set(&multifd_recv_state->count, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
 
     for (i = 0; i < thread_count; i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
@@ -1512,6 +2191,15 @@ static void mig_throttle_guest_down(void)
     uint64_t pct_icrement = s->parameters.cpu_throttle_increment;
     int pct_max = s->parameters.max_cpu_throttle;
 
+    if (migrate_dirty_limit()) {
+        /*
+         * Only the vcpus that dirty memory faster than the limit get
+         * throttled, and only as much as needed to respect it.
+         */
+        dirtylimit_set_all(migrate_vcpu_dirty_limit(), true);
+        return;
+    }
+
     /* We have not started throttling yet. Let's start it. */
     if (!cpu_throttle_active()) {
         cpu_throttle_set(pct_initial);
@@ -1670,12 +2358,37 @@ static inline bool migration_bitmap_clear_dirty(RAMState *rs,
     bool ret;
 
     qemu_mutex_lock(&rs->bitmap_mutex);
-    ret = test_and_clear_bit(page, rb->bmap);
-
-    if (ret) {
-        rs->migration_dirty_pages--;
-    }
-    qemu_mutex_unlock(&rs->bitmap_mutex);
+
+    /*
+     * Clear dirty bitmap if needed.  This _must_ be called before we
+     * send any of the page in the chunk because we need to make sure
+     * we can capture further page content changes when we sync dirty
+     * log the next time.  So as long as we are going to send any of
+     * the page in the chunk we clear the remote dirty bitmap for all.
+     * Clearing it earlier won't be a problem, but too late will.
+     */
+    if (rb->clear_bmap && clear_bmap_test_and_clear(rb, page)) {
+        uint8_t shift = rb->clear_bmap_shift;
+        hwaddr size = 1ULL << (TARGET_PAGE_BITS + shift);
+        hwaddr start = (((ram_addr_t)page) << TARGET_PAGE_BITS) & (-size);
+
+        /*
+         * CLEAR_BITMAP_SHIFT_MIN should always guarantee this... this
+         * can make things easier sometimes since then start address
+         * of the small chunk will always be 64 pages aligned so the
+         * bitmap will always be aligned to unsigned long.
+         */
+        assert(shift >= CLEAR_BITMAP_SHIFT_MIN);
+        trace_migration_bitmap_clear_dirty(rb->idstr, start, size, page);
+        memory_region_clear_dirty_bitmap(rb->mr, start, size);
+    }
+
+    ret = test_and_clear_bit(page, rb->bmap);
+
+    if (ret) {
+        rs->migration_dirty_pages--;
+    }
+    qemu_mutex_unlock(&rs->bitmap_mutex);
 
     return ret;
 }
@@ -1688,6 +2401,39 @@ static void migration_bitmap_sync_range(RAMState *rs, RAMBlock *rb,
                                               &rs->num_dirty_pages_period);
 }
 
+/*
+ * migration_bitmap_widen_hostpages: mark the mostly dirty huge pages of
+ * @rb dirty as a whole
+ *
+ * Called with bitmap_mutex held, for hugepage-dirty during precopy;
+ * postcopy canonicalizes the bitmap in host pages itself.
+ *
+ * @rs: current RAM state
+ * @rb: RAMBlock backed by huge pages
+ */
+static void migration_bitmap_widen_hostpages(RAMState *rs, RAMBlock *rb)
+{
+    unsigned long pages = rb->used_length >> TARGET_PAGE_BITS;
+    unsigned long host_pages = rb->page_size >> TARGET_PAGE_BITS;
+    unsigned long page = find_next_bit(rb->bmap, pages, 0);
+    uint64_t widened = 0;
+
+    while (page < pages) {
+        unsigned long start = QEMU_ALIGN_DOWN(page, host_pages);
+        unsigned long n = MIN(host_pages, pages - start);
+        unsigned long dirty = bitmap_count_one_with_offset(rb->bmap,
+                                                           start, n);
+
+        if (dirty < n && dirty * HUGEPAGE_FULL_RATIO >= n) {
+            bitmap_set(rb->bmap, start, n);
+            rs->migration_dirty_pages += n - dirty;
+            widened += n - dirty;
+        }
+        page = find_next_bit(rb->bmap, pages, start + n);
+    }
+    trace_migration_bitmap_widen_hostpages(rb->idstr, widened);
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1729,9 +2475,22 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
     }
 
     if (migrate_use_xbzrle()) {
+        uint64_t hits, misses, evictions;
+
         xbzrle_counters.cache_miss_rate = (double)(xbzrle_counters.cache_miss -
             rs->xbzrle_cache_miss_prev) / page_count;
         rs->xbzrle_cache_miss_prev = xbzrle_counters.cache_miss;
+
+        XBZRLE_cache_lock();
+        if (XBZRLE.cache) {
+            cache_get_stats(XBZRLE.cache, &hits, &misses, &evictions);
+            if (hits + misses) {
+                xbzrle_counters.cache_hit_rate = (double)hits /
+                                                 (hits + misses);
+            }
+            xbzrle_counters.cache_evictions = evictions;
+        }
+        XBZRLE_cache_unlock();
     }
 
     if (migrate_use_compression()) {
@@ -1763,6 +2522,18 @@ static void migration_bitmap_sync(RAMState *rs)
 
     ram_counters.dirty_sync_count++;
 
+    if (rs->f) {
+        uint64_t copied = qemu_file_get_copied_bytes(rs->f);
+
+        /* The stream starts over when postcopy recovers */
+        if (copied < rs->bytes_copied_prev) {
+            rs->bytes_copied_prev = 0;
+        }
+        ram_counters.copied_bytes = copied;
+        ram_counters.copied_bytes_round = copied - rs->bytes_copied_prev;
+        rs->bytes_copied_prev = copied;
+    }
+
     if (!rs->time_last_bitmap_sync) {
         rs->time_last_bitmap_sync = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     }
@@ -1774,6 +2545,10 @@ static void migration_bitmap_sync(RAMState *rs)
     rcu_read_lock();
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         migration_bitmap_sync_range(rs, block, 0, block->used_length);
+        if (migrate_hugepage_dirty() && !rs->ram_bulk_stage &&
+            !migration_in_postcopy() && block->page_size > TARGET_PAGE_SIZE) {
+            migration_bitmap_widen_hostpages(rs, block);
+        }
     }
     ram_counters.remaining = ram_bytes_remaining();
     rcu_read_unlock();
@@ -1790,7 +2565,8 @@ static void migration_bitmap_sync(RAMState *rs)
         /* During block migration the auto-converge logic incorrectly detects
          * that ram migration makes no progress. Avoid this by disabling the
          * throttling logic during the bulk phase of block migration. */
-        if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+        if ((migrate_auto_converge() || migrate_dirty_limit()) &&
+            !blk_mig_bulk_active()) {
             /* The following detection logic can be refined later. For now:
                Check to see if the dirtied bytes is 50% more than the approx.
                amount of bytes that just got transferred since the last time we
@@ -1834,6 +2610,13 @@ static void migration_bitmap_sync_precopy(RAMState *rs)
 
     migration_bitmap_sync(rs);
 
+    /* Free page hints start over for the round that begins now */
+    if (rs->fpo_enabled) {
+        trace_ram_free_page_round(ram_counters.dirty_sync_count,
+                                  ram_counters.free_pages_round);
+    }
+    ram_counters.free_pages_round = 0;
+
     if (precopy_notify(PRECOPY_NOTIFY_AFTER_BITMAP_SYNC, &local_err)) {
         error_report_err(local_err);
     }
@@ -1985,6 +2768,11 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
     p = block->host + offset;
     trace_ram_save_page(block->idstr, (uint64_t)offset, p);
 
+    /* The page is made writable again once sent */
+    if (migrate_background_snapshot()) {
+        send_async = false;
+    }
+
     XBZRLE_cache_lock();
     if (!rs->ram_bulk_stage && !migration_in_postcopy() &&
         migrate_use_xbzrle()) {
@@ -2237,6 +3025,210 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
     return block;
 }
 
+/*
+ * Background snapshots save RAM as it was when the guest was stopped to
+ * save the device state.  RAM is write-protected through a userfaultfd
+ * at that point, and the migration thread sends each page the guest
+ * tries to write to before lifting the protection on it.
+ */
+
+/**
+ * ram_write_tracking_prepare: map all the RAM that will be protected
+ *
+ * Write protection only applies to pages that are mapped, so a write to
+ * a page the guest never touched would go unnoticed.  Reading the pages
+ * maps them, to the zero page if need be.
+ *
+ * Called within an RCU critical section.
+ */
+static void ram_write_tracking_prepare(void)
+{
+    RAMBlock *block;
+    ram_addr_t offset;
+    size_t pagesize;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        pagesize = qemu_ram_pagesize(block);
+        for (offset = 0; offset < block->used_length; offset += pagesize) {
+            (void)*(volatile uint8_t *)(block->host + offset);
+        }
+    }
+}
+
+/**
+ * ram_write_tracking_start: write-protect all of RAM
+ *
+ * Called with the guest stopped.
+ *
+ * Returns 0 on success, -1 with @errp set on failure
+ *
+ * @errp: pointer to an error
+ */
+int ram_write_tracking_start(Error **errp)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+    int ufd, ret;
+
+    ufd = uffd_wp_open(errp);
+    if (ufd < 0) {
+        return -1;
+    }
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ret = uffd_wp_register(ufd, block->host, block->max_length);
+        if (!ret) {
+            ret = uffd_wp_protect(ufd, block->host, block->used_length, true);
+        }
+        if (ret) {
+            error_setg_errno(errp, -ret, "Failed to write-protect RAMBlock %s",
+                             block->idstr);
+            goto fail;
+        }
+        trace_ram_write_tracking_start(block->idstr, block->used_length);
+    }
+    rcu_read_unlock();
+
+    rs->uffdio_fd = ufd;
+    return 0;
+
+fail:
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        uffd_wp_protect(ufd, block->host, block->max_length, false);
+        uffd_wp_unregister(ufd, block->host, block->max_length);
+    }
+    rcu_read_unlock();
+    close(ufd);
+    return -1;
+}
+
+/**
+ * ram_write_tracking_stop: lift the write protection of RAM, if any
+ *
+ * Wakes up the vCPUs still waiting for their page to be saved, so it
+ * must be called when a background snapshot ends, whatever the reason.
+ */
+void ram_write_tracking_stop(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+
+    if (!rs || rs->uffdio_fd < 0) {
+        return;
+    }
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        uffd_wp_protect(rs->uffdio_fd, block->host, block->max_length, false);
+        uffd_wp_unregister(rs->uffdio_fd, block->host, block->max_length);
+    }
+    rcu_read_unlock();
+
+    close(rs->uffdio_fd);
+    rs->uffdio_fd = -1;
+}
+
+/**
+ * ram_write_tracking_fault: get the next page the guest wants to write to
+ *
+ * Returns the block of the page (or NULL if none)
+ *
+ * Called within an RCU critical section.
+ *
+ * @rs: current RAM state
+ * @offset: used to return the offset of the host page within the RAMBlock
+ */
+static RAMBlock *ram_write_tracking_fault(RAMState *rs, ram_addr_t *offset)
+{
+    RAMBlock *block;
+    void *addr;
+
+    if (rs->uffdio_fd < 0) {
+        return NULL;
+    }
+
+    addr = uffd_wp_read_fault(rs->uffdio_fd);
+    if (!addr) {
+        return NULL;
+    }
+
+    block = qemu_ram_block_from_host(addr, false, offset);
+    if (!block) {
+        error_report_once("%s: fault at %p outside of RAM", __func__, addr);
+        return NULL;
+    }
+    *offset = QEMU_ALIGN_DOWN(*offset, qemu_ram_pagesize(block));
+    trace_ram_write_tracking_fault(block->idstr, *offset);
+
+    return block;
+}
+
+/**
+ * ram_write_tracking_release: lift the write protection of saved pages
+ *
+ * Returns 0 on success, negative errno on failure
+ *
+ * @rs: current RAM state
+ * @block: RAMBlock of the pages
+ * @start: first target page of the range
+ * @end: first target page after the range
+ */
+static int ram_write_tracking_release(RAMState *rs, RAMBlock *block,
+                                      unsigned long start, unsigned long end)
+{
+    int ret;
+
+    ret = uffd_wp_protect(rs->uffdio_fd,
+                          block->host + (start << TARGET_PAGE_BITS),
+                          (end - start) << TARGET_PAGE_BITS, false);
+    if (ret) {
+        error_report("%s: failed to unprotect %s: %s", __func__,
+                     block->idstr, strerror(-ret));
+    }
+
+    return ret;
+}
+
+/**
+ * hot_region_enter: start sweeping the region after a requested page
+ *
+ * The region currently being swept, if any, is suspended.  The oldest
+ * suspended region is dropped when there are too many of them.
+ *
+ * @rs: current RAM state
+ * @pss: data about the state of the current dirty page scan
+ * @block: RAMBlock of the requested page
+ * @page: requested target page
+ */
+static void hot_region_enter(RAMState *rs, PageSearchStatus *pss,
+                             RAMBlock *block, unsigned long page)
+{
+    struct RAMHotRegion *hr = &rs->hot_region;
+    unsigned long npages = block->used_length >> TARGET_PAGE_BITS;
+
+    if (hr->block == block && page >= hr->page && page < hr->end) {
+        /* e.g. the next page of a multi-page request */
+        return;
+    }
+
+    if (hr->block && pss->block == hr->block && pss->page < hr->end) {
+        if (rs->hot_regions_num == POSTCOPY_HOT_REGIONS_MAX) {
+            memmove(&rs->hot_regions[0], &rs->hot_regions[1],
+                    sizeof(rs->hot_regions[0]) * --rs->hot_regions_num);
+        }
+        hr->page = pss->page;
+        rs->hot_regions[rs->hot_regions_num++] = *hr;
+    }
+
+    hr->block = block;
+    hr->page = page;
+    hr->end = MIN(page + (POSTCOPY_HOT_REGION_SIZE >> TARGET_PAGE_BITS),
+                  npages);
+    trace_ram_hot_region_enter(block->idstr, page, hr->end,
+                               rs->hot_regions_num);
+}
+
 /**
  * get_queued_page: unqueue a page from the postocpy requests
  *
@@ -2255,6 +3247,9 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
 
     do {
         block = unqueue_page(rs, &offset);
+        if (!block) {
+            block = ram_write_tracking_fault(rs, &offset);
+        }
         /*
          * We're sending this page, and since it's postcopy nothing else
          * will dirty it, and we must make sure it doesn't get sent again
@@ -2290,6 +3285,7 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
          * since the guest is likely to want other pages near to the page
          * it just requested.
          */
+        hot_region_enter(rs, pss, block, offset >> TARGET_PAGE_BITS);
         pss->block = block;
         pss->page = offset >> TARGET_PAGE_BITS;
     }
@@ -2297,6 +3293,35 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
     return !!block;
 }
 
+/**
+ * hot_region_next: move the background search to a suspended hot region
+ *
+ * Once the search has gone past the end of the current hot region, it
+ * goes back to the most recently suspended one, if any.
+ *
+ * @rs: current RAM state
+ * @pss: data about the state of the current dirty page scan
+ */
+static void hot_region_next(RAMState *rs, PageSearchStatus *pss)
+{
+    struct RAMHotRegion *hr = &rs->hot_region;
+
+    if (!hr->block ||
+        (pss->block == hr->block && pss->page < hr->end)) {
+        return;
+    }
+
+    if (!rs->hot_regions_num) {
+        hr->block = NULL;
+        return;
+    }
+
+    *hr = rs->hot_regions[--rs->hot_regions_num];
+    trace_ram_hot_region_resume(hr->block->idstr, hr->page, hr->end);
+    pss->block = hr->block;
+    pss->page = hr->page;
+}
+
 /**
  * migration_page_queue_free: drop any remaining pages in the ram
  * request queue
@@ -2375,70 +3400,454 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
     new_entry->offset = start;
     new_entry->len = len;
 
-    memory_region_ref(ramblock->mr);
-    qemu_mutex_lock(&rs->src_page_req_mutex);
-    QSIMPLEQ_INSERT_TAIL(&rs->src_page_requests, new_entry, next_req);
-    migration_make_urgent_request();
-    qemu_mutex_unlock(&rs->src_page_req_mutex);
-    rcu_read_unlock();
+    memory_region_ref(ramblock->mr);
+    qemu_mutex_lock(&rs->src_page_req_mutex);
+    QSIMPLEQ_INSERT_TAIL(&rs->src_page_requests, new_entry, next_req);
+    migration_make_urgent_request();
+    qemu_mutex_unlock(&rs->src_page_req_mutex);
+    rcu_read_unlock();
+
+    return 0;
+
+err:
+    rcu_read_unlock();
+    return -1;
+}
+
+static bool save_page_use_compression(RAMState *rs)
+{
+    if (!migrate_use_compression()) {
+        return false;
+    }
+
+    /*
+     * If xbzrle is on, stop using the data compression after first
+     * round of migration even if compression is enabled. In theory,
+     * xbzrle can do better than compression.
+     */
+    if (rs->ram_bulk_stage || !migrate_use_xbzrle()) {
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * try to compress the page before posting it out, return true if the page
+ * has been properly handled by compression, otherwise needs other
+ * paths to handle it
+ */
+static bool save_compress_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
+{
+    if (!save_page_use_compression(rs)) {
+        return false;
+    }
+
+    /*
+     * When starting the process of a new block, the first page of
+     * the block should be sent out before other pages in the same
+     * block, and all the pages in last block should have been sent
+     * out, keeping this order is important, because the 'cont' flag
+     * is used to avoid resending the block name.
+     *
+     * We post the fist page as normal page as compression will take
+     * much CPU resource.
+     */
+    if (block != rs->last_sent_block) {
+        flush_compressed_data(rs);
+        return false;
+    }
+
+    if (compress_page_with_multi_thread(rs, block, offset) > 0) {
+        return true;
+    }
+
+    compression_counters.busy++;
+    return false;
+}
+
+/*
+ * mapped-ram: the pages of each RAMBlock are a copy of its memory at a
+ * fixed place of the file, so that a page dirtied again overwrites its
+ * earlier copy.  Right after the entry of the block in the
+ * RAM_SAVE_FLAG_MEM_SIZE record come the offsets of a bitmap of the
+ * pages that were saved, with one bit per target page, and of the
+ * pages.  The stream goes on after the pages:
+ *
+ *   ... | idstr, length, ... | bitmap offset | pages offset |
+ *   bitmap | padding | pages of the block | rest of the stream
+ *
+ * Pages that are all zero are not written, and are clear in the bitmap.
+ * The pages start on a MAPPED_RAM_ALIGN boundary, so that the file can
+ * also be mapped.
+ */
+#define MAPPED_RAM_ALIGN (1 * MiB)
+/* Largest run of contiguous pages a thread writes or reads at once */
+#define MAPPED_RAM_RUN_MAX (1 * MiB)
+
+/*
+ * A mapped-ram thread writes a run of contiguous pages to their place
+ * in the file, or reads them from it, or clears them in guest memory.
+ */
+struct FileParam {
+    /* Protected by file_done_lock: the thread is free for another run */
+    bool done;
+    bool quit;
+    /* Set with @mutex held when the run is ready */
+    bool pending;
+    QemuMutex mutex;
+    QemuCond cond;
+    bool write;
+    uint8_t *host;
+    size_t len;
+    /* Offset of the run in the file, or -1 to clear it */
+    int64_t pos;
+};
+typedef struct FileParam FileParam;
+
+static FileParam *file_param;
+static QemuThread *file_threads;
+static int file_thread_count;
+static QEMUFile *file_file;
+static QemuMutex file_done_lock;
+static QemuCond file_done_cond;
+/* First error of the threads, protected by file_done_lock */
+static int file_error;
+
+static void *do_mapped_ram_run(void *opaque)
+{
+    FileParam *param = opaque;
+    ssize_t ret;
+
+    qemu_mutex_lock(&param->mutex);
+    while (!param->quit) {
+        if (param->pending) {
+            param->pending = false;
+            qemu_mutex_unlock(&param->mutex);
+
+            if (param->pos < 0) {
+                ram_handle_compressed(param->host, 0, param->len);
+                ret = 0;
+            } else if (param->write) {
+                ret = qemu_file_pwrite(file_file, param->host, param->len,
+                                       param->pos);
+            } else {
+                ret = qemu_file_pread(file_file, param->host, param->len,
+                                      param->pos);
+            }
+
+            qemu_mutex_lock(&file_done_lock);
+            if (ret < 0 && !file_error) {
+                file_error = ret;
+            }
+            param->done = true;
+            qemu_cond_signal(&file_done_cond);
+            qemu_mutex_unlock(&file_done_lock);
+
+            qemu_mutex_lock(&param->mutex);
+        } else {
+            qemu_cond_wait(&param->cond, &param->mutex);
+        }
+    }
+    qemu_mutex_unlock(&param->mutex);
+
+    return NULL;
+}
+
+static void mapped_ram_threads_cleanup(void)
+{
+    int i;
+
+    if (!file_param) {
+        return;
+    }
+
+    for (i = 0; i < file_thread_count; i++) {
+        qemu_mutex_lock(&file_param[i].mutex);
+        file_param[i].quit = true;
+        qemu_cond_signal(&file_param[i].cond);
+        qemu_mutex_unlock(&file_param[i].mutex);
+    }
+    for (i = 0; i < file_thread_count; i++) {
+        qemu_thread_join(file_threads + i);
+        qemu_mutex_destroy(&file_param[i].mutex);
+        qemu_cond_destroy(&file_param[i].cond);
+    }
+    qemu_mutex_destroy(&file_done_lock);
+    qemu_cond_destroy(&file_done_cond);
+    g_free(file_threads);
+    g_free(file_param);
+    file_threads = NULL;
+    file_param = NULL;
+    file_file = NULL;
+}
+
+static void mapped_ram_threads_setup(QEMUFile *f)
+{
+    int i;
+
+    if (!migrate_mapped_ram()) {
+        return;
+    }
+
+    file_thread_count = migrate_mapped_ram_threads();
+    file_threads = g_new0(QemuThread, file_thread_count);
+    file_param = g_new0(FileParam, file_thread_count);
+    file_file = f;
+    file_error = 0;
+    qemu_mutex_init(&file_done_lock);
+    qemu_cond_init(&file_done_cond);
+    for (i = 0; i < file_thread_count; i++) {
+        qemu_mutex_init(&file_param[i].mutex);
+        qemu_cond_init(&file_param[i].cond);
+        file_param[i].done = true;
+        qemu_thread_create(file_threads + i, "mapped-ram",
+                           do_mapped_ram_run, file_param + i,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+/* Hand a run to the first free thread, waiting for one if needed */
+static void mapped_ram_submit(bool write, uint8_t *host, size_t len,
+                              int64_t pos)
+{
+    FileParam *param = NULL;
+    int idx;
+
+    qemu_mutex_lock(&file_done_lock);
+    while (!param) {
+        for (idx = 0; idx < file_thread_count; idx++) {
+            if (file_param[idx].done) {
+                param = &file_param[idx];
+                param->done = false;
+                break;
+            }
+        }
+        if (!param) {
+            qemu_cond_wait(&file_done_cond, &file_done_lock);
+        }
+    }
+    qemu_mutex_unlock(&file_done_lock);
+
+    qemu_mutex_lock(&param->mutex);
+    param->write = write;
+    param->host = host;
+    param->len = len;
+    param->pos = pos;
+    param->pending = true;
+    qemu_cond_signal(&param->cond);
+    qemu_mutex_unlock(&param->mutex);
+}
+
+/* Wait for all the runs, returns the first error of the threads if any */
+static int mapped_ram_wait(void)
+{
+    int idx, ret;
+
+    qemu_mutex_lock(&file_done_lock);
+    for (idx = 0; idx < file_thread_count; idx++) {
+        while (!file_param[idx].done) {
+            qemu_cond_wait(&file_done_cond, &file_done_lock);
+        }
+    }
+    ret = file_error;
+    qemu_mutex_unlock(&file_done_lock);
+    return ret;
+}
+
+/*
+ * mapped_ram_flush: write out everything that was saved so far
+ *
+ * A page must be on disk before it is written again, by a later
+ * iteration, from another thread; just like the load threads, the runs
+ * are therefore waited for at the end of each iteration.
+ *
+ * @rs: current RAM state
+ */
+static void mapped_ram_flush(RAMState *rs)
+{
+    int ret;
+
+    if (!migrate_mapped_ram()) {
+        return;
+    }
+
+    if (rs->run_len) {
+        mapped_ram_submit(true, rs->run_block->host + rs->run_offset,
+                          rs->run_len,
+                          rs->run_block->pages_offset + rs->run_offset);
+        rs->run_len = 0;
+    }
+    ret = mapped_ram_wait();
+    if (ret < 0) {
+        qemu_file_set_error(rs->f, ret);
+    }
+}
+
+/* Bitmap of the pages of @block that are in the file, as stored there */
+static size_t mapped_ram_bitmap_size(RAMBlock *block)
+{
+    return DIV_ROUND_UP(block->used_length >> TARGET_PAGE_BITS,
+                        BITS_PER_BYTE);
+}
+
+/*
+ * mapped_ram_reserve: write the offsets of @block, and continue the
+ * stream after its pages
+ *
+ * Returns zero on success, negative on error
+ *
+ * @f: QEMUFile where to send the data
+ * @block: block being announced in the RAM_SAVE_FLAG_MEM_SIZE record
+ */
+static int mapped_ram_reserve(QEMUFile *f, RAMBlock *block)
+{
+    int64_t offset = qemu_fseek(f, 0, SEEK_CUR);
+
+    if (offset < 0) {
+        error_report("mapped-ram needs the migration to go to a file");
+        return offset;
+    }
 
-    return 0;
+    block->bitmap_offset = offset + 2 * sizeof(uint64_t);
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   mapped_ram_bitmap_size(block),
+                                   MAPPED_RAM_ALIGN);
+    if (!ramblock_is_ignored(block)) {
+        block->file_bmap = bitmap_new(block->used_length >> TARGET_PAGE_BITS);
+    }
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
 
-err:
-    rcu_read_unlock();
-    return -1;
+    offset = qemu_fseek(f, block->pages_offset + block->used_length,
+                        SEEK_SET);
+    return offset < 0 ? offset : 0;
 }
 
-static bool save_page_use_compression(RAMState *rs)
+/* Write the bitmaps of all blocks, once all their pages are written */
+static int mapped_ram_save_bitmaps(QEMUFile *f)
 {
-    if (!migrate_use_compression()) {
-        return false;
+    RAMBlock *block;
+    ssize_t ret = 0;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        unsigned long *le_bmap = bitmap_new(pages);
+
+        bitmap_to_le(le_bmap, block->file_bmap, pages);
+        ret = qemu_file_pwrite(f, (uint8_t *)le_bmap,
+                               mapped_ram_bitmap_size(block),
+                               block->bitmap_offset);
+        g_free(le_bmap);
+        if (ret < 0) {
+            break;
+        }
     }
+    return ret < 0 ? ret : 0;
+}
 
-    /*
-     * If xbzrle is on, stop using the data compression after first
-     * round of migration even if compression is enabled. In theory,
-     * xbzrle can do better than compression.
-     */
-    if (rs->ram_bulk_stage || !migrate_use_xbzrle()) {
-        return true;
+/*
+ * ram_save_mapped_page: save a target page to its place in the file
+ *
+ * Contiguous pages are gathered into a run, which a thread writes.
+ *
+ * Returns the number of pages written
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ */
+static int ram_save_mapped_page(RAMState *rs, PageSearchStatus *pss)
+{
+    RAMBlock *block = pss->block;
+    ram_addr_t offset = pss->page << TARGET_PAGE_BITS;
+
+    if (is_zero_range(block->host + offset, TARGET_PAGE_SIZE)) {
+        clear_bit(pss->page, block->file_bmap);
+        acct_update_position(rs->f, TARGET_PAGE_SIZE, true);
+        return 1;
     }
+    set_bit(pss->page, block->file_bmap);
 
-    return false;
+    if (rs->run_len && (rs->run_block != block ||
+                        rs->run_offset + rs->run_len != offset ||
+                        rs->run_len >= MAPPED_RAM_RUN_MAX)) {
+        mapped_ram_submit(true, rs->run_block->host + rs->run_offset,
+                          rs->run_len,
+                          rs->run_block->pages_offset + rs->run_offset);
+        rs->run_len = 0;
+    }
+    if (!rs->run_len) {
+        rs->run_block = block;
+        rs->run_offset = offset;
+    }
+    rs->run_len += TARGET_PAGE_SIZE;
+
+    /* Counted in the bandwidth like the pages RDMA sends */
+    acct_update_position(rs->f, TARGET_PAGE_SIZE, false);
+    return 1;
 }
 
 /*
- * try to compress the page before posting it out, return true if the page
- * has been properly handled by compression, otherwise needs other
- * paths to handle it
+ * mapped_ram_load_block: load @block from its place in the file
+ *
+ * The pages that the bitmap has are read by the threads, the others are
+ * cleared.  The stream then goes on after the pages.
+ *
+ * Returns zero on success, negative on error
+ *
+ * @f: QEMUFile where to receive the data
+ * @block: block announced in the RAM_SAVE_FLAG_MEM_SIZE record
  */
-static bool save_compress_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
+static int mapped_ram_load_block(QEMUFile *f, RAMBlock *block)
 {
-    if (!save_page_use_compression(rs)) {
-        return false;
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    unsigned long run_pages = MAPPED_RAM_RUN_MAX >> TARGET_PAGE_BITS;
+    unsigned long *le_bmap, *bmap;
+    unsigned long page, end;
+    int64_t bitmap_offset = qemu_get_be64(f);
+    int64_t pages_offset = qemu_get_be64(f);
+    int64_t ret;
+
+    if (bitmap_offset < 0 || !QEMU_IS_ALIGNED(pages_offset, MAPPED_RAM_ALIGN) ||
+        pages_offset < bitmap_offset + mapped_ram_bitmap_size(block)) {
+        error_report("Invalid mapped-ram offsets for block %s", block->idstr);
+        return -EINVAL;
     }
 
-    /*
-     * When starting the process of a new block, the first page of
-     * the block should be sent out before other pages in the same
-     * block, and all the pages in last block should have been sent
-     * out, keeping this order is important, because the 'cont' flag
-     * is used to avoid resending the block name.
-     *
-     * We post the fist page as normal page as compression will take
-     * much CPU resource.
-     */
-    if (block != rs->last_sent_block) {
-        flush_compressed_data(rs);
-        return false;
+    le_bmap = bitmap_new(pages);
+    bmap = bitmap_new(pages);
+    ret = qemu_file_pread(f, (uint8_t *)le_bmap,
+                          mapped_ram_bitmap_size(block), bitmap_offset);
+    if (ret < 0) {
+        error_report("Failed to read the mapped-ram bitmap of block %s",
+                     block->idstr);
+        goto out;
     }
+    bitmap_from_le(bmap, le_bmap, pages);
 
-    if (compress_page_with_multi_thread(rs, block, offset) > 0) {
-        return true;
+    for (page = ramblock_is_ignored(block) ? pages : 0; page < pages;
+         page = end) {
+        bool saved = test_bit(page, bmap);
+
+        end = saved ? find_next_zero_bit(bmap, pages, page)
+                    : find_next_bit(bmap, pages, page);
+        end = MIN(end, page + run_pages);
+        mapped_ram_submit(false, block->host + (page << TARGET_PAGE_BITS),
+                          (end - page) << TARGET_PAGE_BITS,
+                          saved ? pages_offset + (page << TARGET_PAGE_BITS)
+                                : -1);
+    }
+    ret = mapped_ram_wait();
+    if (ret < 0) {
+        error_report("Failed to read the pages of block %s", block->idstr);
+        goto out;
     }
 
-    compression_counters.busy++;
-    return false;
+    ret = qemu_fseek(f, pages_offset + block->used_length, SEEK_SET);
+out:
+    g_free(le_bmap);
+    g_free(bmap);
+    return ret < 0 ? ret : 0;
 }
 
 /**
@@ -2457,6 +3866,10 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
     ram_addr_t offset = pss->page << TARGET_PAGE_BITS;
     int res;
 
+    if (migrate_mapped_ram()) {
+        return ram_save_mapped_page(rs, pss);
+    }
+
     if (control_save_page(rs, block, offset, &res)) {
         return res;
     }
@@ -2490,6 +3903,52 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
     return ram_save_page(rs, pss, last_stage);
 }
 
+/**
+ * save_zero_host_page: send a dirty huge page that is all zero as one record
+ *
+ * Only for hugepage-dirty, and for the cases where a zero page would go
+ * through save_zero_page() anyway.
+ *
+ * Returns the number of target pages written, or 0 if the page has to
+ * be sent piece by piece
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send, at the start of a host page
+ * @pagesize_bits: number of target pages in a host page
+ */
+static int save_zero_host_page(RAMState *rs, PageSearchStatus *pss,
+                               size_t pagesize_bits)
+{
+    RAMBlock *block = pss->block;
+    ram_addr_t offset = pss->page << TARGET_PAGE_BITS;
+    unsigned long page;
+
+    if (!migrate_hugepage_dirty() || pagesize_bits == 1 ||
+        migration_in_postcopy() || migrate_use_xbzrle() ||
+        save_page_use_compression(rs) || migrate_use_multifd() ||
+        migrate_mapped_ram() ||
+        offset + block->page_size > block->used_length) {
+        return 0;
+    }
+    if (bitmap_count_one_with_offset(block->bmap, pss->page,
+                                     pagesize_bits) != pagesize_bits ||
+        !is_zero_range(block->host + offset, block->page_size)) {
+        return 0;
+    }
+
+    for (page = pss->page; page < pss->page + pagesize_bits; page++) {
+        migration_bitmap_clear_dirty(rs, block, page);
+    }
+    if (block->unsentmap) {
+        bitmap_clear(block->unsentmap, pss->page, pagesize_bits);
+    }
+    ram_counters.transferred +=
+        save_page_header(rs, rs->f, block,
+                         offset | RAM_SAVE_FLAG_ZERO_HOST_PAGE);
+    ram_counters.duplicate += pagesize_bits;
+    return pagesize_bits;
+}
+
 /**
  * ram_save_host_page: save a whole host page
  *
@@ -2514,6 +3973,7 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
     int tmppages, pages = 0;
     size_t pagesize_bits =
         qemu_ram_pagesize(pss->block) >> TARGET_PAGE_BITS;
+    unsigned long start_page = QEMU_ALIGN_DOWN(pss->page, pagesize_bits);
 
     if (ramblock_is_ignored(pss->block)) {
         error_report("block %s should not be migrated !", pss->block->idstr);
@@ -2521,6 +3981,15 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
     }
 
     do {
+        if (pss->page == start_page) {
+            tmppages = save_zero_host_page(rs, pss, pagesize_bits);
+            if (tmppages > 0) {
+                pages = tmppages;
+                pss->page += pagesize_bits;
+                break;
+            }
+        }
+
         /* Check the pages is dirty and if it is send it */
         if (!migration_bitmap_clear_dirty(rs, pss->block, pss->page)) {
             pss->page++;
@@ -2541,6 +4010,15 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
     } while ((pss->page & (pagesize_bits - 1)) &&
              offset_in_ramblock(pss->block, pss->page << TARGET_PAGE_BITS));
 
+    /* The data of the pages has been copied, the guest may modify them */
+    if (pages > 0 && rs->uffdio_fd >= 0) {
+        tmppages = ram_write_tracking_release(rs, pss->block, start_page,
+                                              pss->page);
+        if (tmppages < 0) {
+            return tmppages;
+        }
+    }
+
     /* The offset we leave with is the last one we looked at */
     pss->page--;
     return pages;
@@ -2561,11 +4039,60 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
  * pages in a host page that are dirty.
  */
 
+/**
+ * ram_save_host_page_preempt: send a requested host page on the
+ * postcopy-preempt channel
+ *
+ * The usual send path is used, pointed at the preempt channel for the
+ * time being.  The page is followed by an EOS and flushed right away:
+ * the destination is waiting for it.  A failure of the preempt channel
+ * fails the main one too, so that migration goes through the usual
+ * postcopy pause.
+ *
+ * Returns the number of pages written, or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ * @last_stage: if we are at the completion stage
+ * @file: the postcopy-preempt channel
+ */
+static int ram_save_host_page_preempt(RAMState *rs, PageSearchStatus *pss,
+                                      bool last_stage, QEMUFile *file)
+{
+    QEMUFile *main_file = rs->f;
+    RAMBlock *main_last_sent_block = rs->last_sent_block;
+    int pages, ret;
+
+    rs->f = file;
+    rs->last_sent_block = rs->last_sent_block_preempt;
+
+    pages = ram_save_host_page(rs, pss, last_stage);
+    if (pages > 0) {
+        qemu_put_be64(file, RAM_SAVE_FLAG_EOS);
+        ram_counters.transferred += 8;
+        qemu_fflush(file);
+    }
+
+    rs->last_sent_block_preempt = rs->last_sent_block;
+    rs->last_sent_block = main_last_sent_block;
+    rs->f = main_file;
+
+    ret = qemu_file_get_error(file);
+    if (ret) {
+        qemu_file_set_error(main_file, ret);
+        return ret;
+    }
+    trace_ram_save_host_page_preempt(pss->block->idstr, pss->page, pages);
+
+    return pages;
+}
+
 static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 {
+    QEMUFile *preempt_file = migrate_get_current()->postcopy_qemufile_src;
     PageSearchStatus pss;
     int pages = 0;
-    bool again, found;
+    bool again, found, urgent;
 
     /* No dirty page as there is zero RAM */
     if (!ram_bytes_total()) {
@@ -2582,14 +4109,20 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 
     do {
         again = true;
-        found = get_queued_page(rs, &pss);
+        found = urgent = get_queued_page(rs, &pss);
 
         if (!found) {
+            if (!pss.complete_round) {
+                hot_region_next(rs, &pss);
+            }
             /* priority queue empty, so just search for something dirty */
             found = find_dirty_block(rs, &pss, &again);
         }
 
-        if (found) {
+        if (urgent && preempt_file) {
+            pages = ram_save_host_page_preempt(rs, &pss, last_stage,
+                                               preempt_file);
+        } else if (found) {
             pages = ram_save_host_page(rs, &pss, last_stage);
         }
     } while (!pages && again);
@@ -2683,17 +4216,26 @@ static void ram_save_cleanup(void *opaque)
     /* caller have hold iothread lock or is in a bh, so there is
      * no writing race against this migration_bitmap
      */
-    memory_global_dirty_log_stop();
+    if (migrate_background_snapshot()) {
+        ram_write_tracking_stop();
+    } else {
+        memory_global_dirty_log_stop();
+    }
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        g_free(block->clear_bmap);
+        block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
         g_free(block->unsentmap);
         block->unsentmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
     compress_threads_save_cleanup();
+    mapped_ram_threads_cleanup();
     ram_state_cleanup(rsp);
 }
 
@@ -2701,10 +4243,13 @@ static void ram_state_reset(RAMState *rs)
 {
     rs->last_seen_block = NULL;
     rs->last_sent_block = NULL;
+    rs->last_sent_block_preempt = NULL;
     rs->last_page = 0;
     rs->last_version = ram_list.version;
     rs->ram_bulk_stage = true;
     rs->fpo_enabled = false;
+    rs->hot_region.block = NULL;
+    rs->hot_regions_num = 0;
 }
 
 #define MAX_WAIT 50 /* ms, half buffered_file limit */
@@ -3182,6 +4727,7 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    (*rsp)->uffdio_fd = -1;
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -3196,15 +4742,30 @@ static int ram_state_init(RAMState **rsp)
 
 static void ram_list_init_bitmaps(void)
 {
+    MigrationState *ms = migrate_get_current();
     RAMBlock *block;
     unsigned long pages;
+    uint8_t shift;
 
     /* Skip setting bitmap if there is no RAM */
     if (ram_bytes_total()) {
+        shift = ms->clear_bitmap_shift;
+        if (shift > CLEAR_BITMAP_SHIFT_MAX) {
+            error_report("clear_bitmap_shift (%u) too big, using "
+                         "max value (%u)", shift, CLEAR_BITMAP_SHIFT_MAX);
+            shift = CLEAR_BITMAP_SHIFT_MAX;
+        } else if (shift < CLEAR_BITMAP_SHIFT_MIN) {
+            error_report("clear_bitmap_shift (%u) too small, using "
+                         "min value (%u)", shift, CLEAR_BITMAP_SHIFT_MIN);
+            shift = CLEAR_BITMAP_SHIFT_MIN;
+        }
+
         RAMBLOCK_FOREACH_NOT_IGNORED(block) {
             pages = block->max_length >> TARGET_PAGE_BITS;
             block->bmap = bitmap_new(pages);
             bitmap_set(block->bmap, 0, pages);
+            block->clear_bmap_shift = shift;
+            block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
             if (migrate_postcopy_ram()) {
                 block->unsentmap = bitmap_new(pages);
                 bitmap_set(block->unsentmap, 0, pages);
@@ -3221,8 +4782,13 @@ static void ram_init_bitmaps(RAMState *rs)
     rcu_read_lock();
 
     ram_list_init_bitmaps();
-    memory_global_dirty_log_start();
-    migration_bitmap_sync_precopy(rs);
+    /* A background snapshot sends each page once, as it was at the start */
+    if (migrate_background_snapshot()) {
+        ram_write_tracking_prepare();
+    } else {
+        memory_global_dirty_log_start();
+        migration_bitmap_sync_precopy(rs);
+    }
 
     rcu_read_unlock();
     qemu_mutex_unlock_ramlist();
@@ -3290,7 +4856,7 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
 {
     RAMBlock *block;
     ram_addr_t offset;
-    size_t used_len, start, npages;
+    size_t used_len, start, npages, cleared;
     MigrationState *s = migrate_get_current();
 
     /* This function is currently expected to be used during live migration */
@@ -3320,8 +4886,10 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
         npages = used_len >> TARGET_PAGE_BITS;
 
         qemu_mutex_lock(&ram_state->bitmap_mutex);
-        ram_state->migration_dirty_pages -=
-                      bitmap_count_one_with_offset(block->bmap, start, npages);
+        cleared = bitmap_count_one_with_offset(block->bmap, start, npages);
+        ram_state->migration_dirty_pages -= cleared;
+        ram_counters.free_pages += cleared;
+        ram_counters.free_pages_round += cleared;
         bitmap_clear(block->bmap, start, npages);
         qemu_mutex_unlock(&ram_state->bitmap_mutex);
     }
@@ -3346,6 +4914,7 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
     RAMBlock *block;
+    int ret;
 
     if (compress_threads_save_setup()) {
         return -1;
@@ -3375,9 +4944,17 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             qemu_put_be64(f, block->mr->addr);
             qemu_put_byte(f, ramblock_is_ignored(block) ? 1 : 0);
         }
+        if (migrate_mapped_ram()) {
+            ret = mapped_ram_reserve(f, block);
+            if (ret < 0) {
+                rcu_read_unlock();
+                return ret;
+            }
+        }
     }
 
     rcu_read_unlock();
+    mapped_ram_threads_setup(f);
 
     ram_control_before_iterate(f, RAM_CONTROL_SETUP);
     ram_control_after_iterate(f, RAM_CONTROL_SETUP);
@@ -3470,10 +5047,12 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
     ram_control_after_iterate(f, RAM_CONTROL_ROUND);
 
     multifd_send_sync_main();
+    mapped_ram_flush(rs);
 out:
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
     qemu_fflush(f);
     ram_counters.transferred += 8;
+    ram_counters.copied_bytes = qemu_file_get_copied_bytes(f);
 
     ret = qemu_file_get_error(f);
     if (ret < 0) {
@@ -3501,7 +5080,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     rcu_read_lock();
 
-    if (!migration_in_postcopy()) {
+    if (!migration_in_postcopy() && !migrate_background_snapshot()) {
         migration_bitmap_sync_precopy(rs);
     }
 
@@ -3525,6 +5104,10 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     }
 
     flush_compressed_data(rs);
+    mapped_ram_flush(rs);
+    if (!ret && migrate_mapped_ram()) {
+        ret = mapped_ram_save_bitmaps(f);
+    }
     ram_control_after_iterate(f, RAM_CONTROL_FINISH);
 
     rcu_read_unlock();
@@ -3547,7 +5130,7 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
 
     remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
 
-    if (!migration_in_postcopy() &&
+    if (!migration_in_postcopy() && !migrate_background_snapshot() &&
         remaining_size < max_size) {
         qemu_mutex_lock_iothread();
         rcu_read_lock();
@@ -3608,26 +5191,29 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
  *
  * @f: QEMUFile where to read the data from
  * @flags: Page flags (mostly to see if it's a continuation of previous block)
+ * @channel: the channel @f is, each has its own previous block
  */
-static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
+static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags,
+                                              int channel)
 {
-    static RAMBlock *block = NULL;
+    static RAMBlock *last_block[RAM_CHANNEL_MAX];
+    RAMBlock *block;
     char id[256];
     uint8_t len;
 
     if (flags & RAM_SAVE_FLAG_CONTINUE) {
-        if (!block) {
+        if (!last_block[channel]) {
             error_report("Ack, bad migration stream!");
             return NULL;
         }
-        return block;
+        return last_block[channel];
     }
 
     len = qemu_get_byte(f);
     qemu_get_buffer(f, (uint8_t *)id, len);
     id[len] = 0;
 
-    block = qemu_ram_block_by_name(id);
+    block = last_block[channel] = qemu_ram_block_by_name(id);
     if (!block) {
         error_report("Can't find block %s", id);
         return NULL;
@@ -3878,6 +5464,187 @@ static void decompress_data_with_multi_threads(QEMUFile *f,
     qemu_mutex_unlock(&decomp_done_lock);
 }
 
+static void *do_data_load(void *opaque)
+{
+    LoadParam *param = opaque;
+    unsigned int i;
+
+    qemu_mutex_lock(&param->mutex);
+    while (!param->quit) {
+        if (param->pending) {
+            param->pending = false;
+            qemu_mutex_unlock(&param->mutex);
+
+            for (i = 0; i < param->num; i++) {
+                if (param->fill[i] < 0) {
+                    memcpy(param->host[i], param->buf + i * TARGET_PAGE_SIZE,
+                           TARGET_PAGE_SIZE);
+                } else {
+                    ram_handle_compressed(param->host[i], param->fill[i],
+                                          TARGET_PAGE_SIZE);
+                }
+            }
+            param->num = 0;
+
+            qemu_mutex_lock(&load_done_lock);
+            param->done = true;
+            qemu_cond_signal(&load_done_cond);
+            qemu_mutex_unlock(&load_done_lock);
+
+            qemu_mutex_lock(&param->mutex);
+        } else {
+            qemu_cond_wait(&param->cond, &param->mutex);
+        }
+    }
+    qemu_mutex_unlock(&param->mutex);
+
+    return NULL;
+}
+
+static void load_threads_submit(void)
+{
+    qemu_mutex_lock(&load_cur->mutex);
+    load_cur->pending = true;
+    qemu_cond_signal(&load_cur->cond);
+    qemu_mutex_unlock(&load_cur->mutex);
+    load_cur = NULL;
+}
+
+/*
+ * Returns the batch to add a page to, after handing the current one to
+ * its thread if it is full.
+ */
+static LoadParam *load_threads_get_batch(void)
+{
+    int idx, thread_count;
+
+    if (load_cur && load_cur->num < LOAD_BATCH_PAGES) {
+        return load_cur;
+    }
+    if (load_cur) {
+        load_threads_submit();
+    }
+
+    thread_count = load_thread_count;
+    qemu_mutex_lock(&load_done_lock);
+    while (!load_cur) {
+        for (idx = 0; idx < thread_count; idx++) {
+            if (load_param[idx].done) {
+                load_param[idx].done = false;
+                load_cur = &load_param[idx];
+                break;
+            }
+        }
+        if (!load_cur) {
+            qemu_cond_wait(&load_done_cond, &load_done_lock);
+        }
+    }
+    qemu_mutex_unlock(&load_done_lock);
+
+    return load_cur;
+}
+
+static void load_page_with_threads(QEMUFile *f, void *host)
+{
+    LoadParam *param = load_threads_get_batch();
+
+    qemu_get_buffer(f, param->buf + param->num * TARGET_PAGE_SIZE,
+                    TARGET_PAGE_SIZE);
+    param->host[param->num] = host;
+    param->fill[param->num++] = -1;
+}
+
+static void load_zero_page_with_threads(void *host, uint8_t ch)
+{
+    LoadParam *param = load_threads_get_batch();
+
+    param->host[param->num] = host;
+    param->fill[param->num++] = ch;
+}
+
+/*
+ * Pages must have landed by the time ram_load() returns: the source
+ * may send them again in a later iteration, and the next section may
+ * be the device state.
+ */
+static void wait_for_load_done(void)
+{
+    int idx, thread_count;
+
+    if (!load_param) {
+        return;
+    }
+
+    if (load_cur) {
+        load_threads_submit();
+    }
+
+    thread_count = load_thread_count;
+    qemu_mutex_lock(&load_done_lock);
+    for (idx = 0; idx < thread_count; idx++) {
+        while (!load_param[idx].done) {
+            qemu_cond_wait(&load_done_cond, &load_done_lock);
+        }
+    }
+    qemu_mutex_unlock(&load_done_lock);
+}
+
+static void load_threads_cleanup(void)
+{
+    int i, thread_count;
+
+    if (!load_param) {
+        return;
+    }
+
+    wait_for_load_done();
+    thread_count = load_thread_count;
+    for (i = 0; i < thread_count; i++) {
+        qemu_mutex_lock(&load_param[i].mutex);
+        load_param[i].quit = true;
+        qemu_cond_signal(&load_param[i].cond);
+        qemu_mutex_unlock(&load_param[i].mutex);
+    }
+    for (i = 0; i < thread_count; i++) {
+        qemu_thread_join(load_threads + i);
+        qemu_mutex_destroy(&load_param[i].mutex);
+        qemu_cond_destroy(&load_param[i].cond);
+        qemu_vfree(load_param[i].buf);
+    }
+    qemu_mutex_destroy(&load_done_lock);
+    qemu_cond_destroy(&load_done_cond);
+    g_free(load_threads);
+    g_free(load_param);
+    load_threads = NULL;
+    load_param = NULL;
+}
+
+static void load_threads_setup(void)
+{
+    int i, thread_count;
+
+    thread_count = migrate_load_threads();
+    if (!thread_count) {
+        return;
+    }
+
+    load_thread_count = thread_count;
+    load_threads = g_new0(QemuThread, thread_count);
+    load_param = g_new0(LoadParam, thread_count);
+    qemu_mutex_init(&load_done_lock);
+    qemu_cond_init(&load_done_cond);
+    for (i = 0; i < thread_count; i++) {
+        load_param[i].buf = qemu_memalign(TARGET_PAGE_SIZE,
+                                          LOAD_BATCH_PAGES * TARGET_PAGE_SIZE);
+        qemu_mutex_init(&load_param[i].mutex);
+        qemu_cond_init(&load_param[i].cond);
+        load_param[i].done = true;
+        qemu_thread_create(load_threads + i, "load",
+                           do_data_load, load_param + i,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
 /*
  * colo cache: this is for secondary VM, we cache the whole
  * memory of the secondary VM, it is need to hold the global lock
@@ -3977,6 +5744,8 @@ static int ram_load_setup(QEMUFile *f, void *opaque)
     }
 
     xbzrle_load_setup();
+    load_threads_setup();
+    mapped_ram_threads_setup(f);
     ramblock_recv_map_init();
 
     return 0;
@@ -3994,6 +5763,8 @@ static int ram_load_cleanup(void *opaque)
 
     xbzrle_load_cleanup();
     compress_threads_load_cleanup();
+    load_threads_cleanup();
+    mapped_ram_threads_cleanup();
 
     RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
         g_free(rb->receivedmap);
@@ -4024,19 +5795,21 @@ int ram_postcopy_incoming_init(MigrationIncomingState *mis)
  *
  * Returns 0 for success or -errno in case of error
  *
- * Called in postcopy mode by ram_load().
+ * Called in postcopy mode by ram_load(), and by the postcopy-preempt
+ * thread for the pages of the preempt channel.
  * rcu_read_lock is taken prior to this being called.
  *
  * @f: QEMUFile where to send the data
+ * @channel: RAM_CHANNEL_* that @f is
  */
-static int ram_load_postcopy(QEMUFile *f)
+int ram_load_postcopy(QEMUFile *f, int channel)
 {
     int flags = 0, ret = 0;
     bool place_needed = false;
     bool matches_target_page_size = false;
     MigrationIncomingState *mis = migration_incoming_get_current();
     /* Temporary page that is later 'placed' */
-    void *postcopy_host_page = postcopy_get_tmp_page(mis);
+    void *postcopy_host_page = postcopy_get_tmp_page(mis, channel);
     void *last_host = NULL;
     bool all_zero = false;
 
@@ -4065,7 +5838,7 @@ static int ram_load_postcopy(QEMUFile *f)
         trace_ram_load_postcopy_loop((uint64_t)addr, flags);
         place_needed = false;
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE)) {
-            block = ram_block_from_stream(f, flags);
+            block = ram_block_from_stream(f, flags, channel);
 
             host = host_from_ram_block_offset(block, addr);
             if (!host) {
@@ -4139,7 +5912,9 @@ static int ram_load_postcopy(QEMUFile *f)
             break;
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
-            multifd_recv_sync_main();
+            if (channel == RAM_CHANNEL_PRECOPY) {
+                multifd_recv_sync_main();
+            }
             break;
         default:
             error_report("Unknown combination of migration flags: %#x"
@@ -4252,11 +6027,12 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
     rcu_read_lock();
 
     if (postcopy_running) {
-        ret = ram_load_postcopy(f);
+        ret = ram_load_postcopy(f, RAM_CHANNEL_PRECOPY);
     }
 
     while (!postcopy_running && !ret && !(flags & RAM_SAVE_FLAG_EOS)) {
         ram_addr_t addr, total_ram_bytes;
+        size_t host_page_size = TARGET_PAGE_SIZE;
         void *host = NULL;
         uint8_t ch;
 
@@ -4274,8 +6050,21 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
         }
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
-                     RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(f, flags);
+                     RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE |
+                     RAM_SAVE_FLAG_ZERO_HOST_PAGE)) {
+            RAMBlock *block = ram_block_from_stream(f, flags,
+                                                    RAM_CHANNEL_PRECOPY);
+
+            if (block && (flags & RAM_SAVE_FLAG_ZERO_HOST_PAGE)) {
+                if (!QEMU_IS_ALIGNED(addr, block->page_size) ||
+                    addr + block->page_size > block->used_length) {
+                    error_report("Illegal host page offset " RAM_ADDR_FMT,
+                                 addr);
+                    ret = -EINVAL;
+                    break;
+                }
+                host_page_size = block->page_size;
+            }
 
             /*
              * After going into COLO, we should load the Page into colo_cache.
@@ -4292,7 +6081,8 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
             }
 
             if (!migration_incoming_in_colo_state()) {
-                ramblock_recv_bitmap_set(block, host);
+                ramblock_recv_bitmap_set_range(block, host,
+                                       host_page_size >> TARGET_PAGE_BITS);
             }
 
             trace_ram_load_loop(block->idstr, (uint64_t)addr, flags, host);
@@ -4355,6 +6145,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = mapped_ram_load_block(f, block);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -4369,11 +6162,28 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
 
         case RAM_SAVE_FLAG_ZERO:
             ch = qemu_get_byte(f);
-            ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
+            if (load_param) {
+                load_zero_page_with_threads(host, ch);
+            } else {
+                ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
+            }
+            break;
+
+        case RAM_SAVE_FLAG_ZERO_HOST_PAGE:
+            /*
+             * No earlier piece of the page can still be in flight in the
+             * load threads: a page is sent once per iteration, and they
+             * are waited for at the end of each.
+             */
+            ram_handle_compressed(host, 0, host_page_size);
             break;
 
         case RAM_SAVE_FLAG_PAGE:
-            qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            if (load_param) {
+                load_page_with_threads(f, host);
+            } else {
+                qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            }
             break;
 
         case RAM_SAVE_FLAG_COMPRESS_PAGE:
@@ -4412,6 +6222,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
         }
     }
 
+    wait_for_load_done();
     ret |= wait_for_decompress_done();
     rcu_read_unlock();
     trace_ram_load_complete(ret, seq_iter);
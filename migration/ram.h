@@ -60,6 +60,10 @@ int ram_postcopy_send_discard_bitmap(MigrationState *ms);
 /* For incoming postcopy discard */
 int ram_discard_range(const char *block_name, uint64_t start, size_t length);
 int ram_postcopy_incoming_init(MigrationIncomingState *mis);
+int ram_load_postcopy(QEMUFile *f, int channel);
+/* Write tracking of the guest RAM for background snapshots */
+int ram_write_tracking_start(Error **errp);
+void ram_write_tracking_stop(void);
 
 void ram_handle_compressed(void *host, uint8_t ch, uint64_t size);
 
@@ -50,6 +50,12 @@
 #define RDMA_MERGE_MAX (2 * 1024 * 1024)
 #define RDMA_SIGNALED_SEND_MAX (RDMA_MERGE_MAX / 4096)
 
+/*
+ * RDMA writes are queued and handed to the HCA this many at a time,
+ * with a single ibv_post_send() call and doorbell.
+ */
+#define RDMA_WRITE_BATCH_MAX 16
+
 #define RDMA_REG_CHUNK_SHIFT 20 /* 1 MB */
 
 /*
@@ -219,7 +225,7 @@ typedef struct RDMALocalBlock {
     unsigned int   src_index;       /* (Only used on dest) */
     bool           is_ram_block;
     int            nb_chunks;
-    unsigned long *transit_bitmap;
+    uint16_t      *transit_writes;  /* RDMA writes in flight per chunk */
     unsigned long *unregister_bitmap;
 } RDMALocalBlock;
 
@@ -327,6 +333,11 @@ typedef struct RDMAContext {
     /* number of outstanding writes */
     int nb_sent;
 
+    /* RDMA writes that are not posted yet, see qemu_rdma_post_writes() */
+    struct ibv_send_wr write_wrs[RDMA_WRITE_BATCH_MAX];
+    struct ibv_sge write_sges[RDMA_WRITE_BATCH_MAX];
+    int nb_write_wrs;
+
     /* store info about current buffer so that we can
        merge it with future sends */
     uint64_t current_addr;
@@ -594,8 +605,7 @@ static int rdma_add_block(RDMAContext *rdma, const char *block_name,
     block->index = local->nb_blocks;
     block->src_index = ~0U; /* Filled in by the receipt of the block list */
     block->nb_chunks = ram_chunk_index(host_addr, host_addr + length) + 1UL;
-    block->transit_bitmap = bitmap_new(block->nb_chunks);
-    bitmap_clear(block->transit_bitmap, 0, block->nb_chunks);
+    block->transit_writes = g_new0(uint16_t, block->nb_chunks);
     block->unregister_bitmap = bitmap_new(block->nb_chunks);
     bitmap_clear(block->unregister_bitmap, 0, block->nb_chunks);
     block->remote_keys = g_new0(uint32_t, block->nb_chunks);
@@ -689,8 +699,8 @@ static int rdma_delete_block(RDMAContext *rdma, RDMALocalBlock *block)
         block->mr = NULL;
     }
 
-    g_free(block->transit_bitmap);
-    block->transit_bitmap = NULL;
+    g_free(block->transit_writes);
+    block->transit_writes = NULL;
 
     g_free(block->unregister_bitmap);
     block->unregister_bitmap = NULL;
@@ -1340,7 +1350,7 @@ static int qemu_rdma_unregister_waiting(RDMAContext *rdma)
          */
         clear_bit(chunk, block->unregister_bitmap);
 
-        if (test_bit(chunk, block->transit_bitmap)) {
+        if (block->transit_writes[chunk]) {
             trace_qemu_rdma_unregister_waiting_inflight(chunk);
             continue;
         }
@@ -1462,7 +1472,9 @@ static uint64_t qemu_rdma_poll(RDMAContext *rdma, uint64_t *wr_id_out,
                                    index, chunk, block->local_host_addr,
                                    (void *)(uintptr_t)block->remote_host_addr);
 
-        clear_bit(chunk, block->transit_bitmap);
+        if (block->transit_writes[chunk] > 0) {
+            block->transit_writes[chunk]--;
+        }
 
         if (rdma->nb_sent > 0) {
             rdma->nb_sent--;
@@ -1676,6 +1688,55 @@ err_block_for_wrid:
  * Post a SEND message work request for the control channel
  * containing some data and block until the post completes.
  */
+/*
+ * Post the RDMA writes queued by qemu_rdma_write_one() as one list.
+ *
+ * They must be posted before anything else goes out on the QP, so that
+ * the destination sees the RAM and the control messages in the order
+ * the source sent them, and before waiting for their completion.
+ */
+static int qemu_rdma_post_writes(RDMAContext *rdma)
+{
+    struct ibv_send_wr *first = &rdma->write_wrs[0];
+    struct ibv_send_wr *bad_wr;
+    int ret;
+
+    if (!rdma->nb_write_wrs) {
+        return 0;
+    }
+
+    trace_qemu_rdma_post_writes(rdma->nb_write_wrs);
+    rdma->write_wrs[rdma->nb_write_wrs - 1].next = NULL;
+    rdma->nb_write_wrs = 0;
+
+    for (;;) {
+        /*
+         * ibv_post_send() does not return negative error numbers,
+         * per the specification they are positive - no idea why.
+         */
+        ret = ibv_post_send(rdma->qp, first, &bad_wr);
+        if (ret != ENOMEM) {
+            break;
+        }
+
+        /* The writes before bad_wr went out, wait for room for the rest */
+        trace_qemu_rdma_write_one_queue_full();
+        first = bad_wr;
+        ret = qemu_rdma_block_for_wrid(rdma, RDMA_WRID_RDMA_WRITE, NULL);
+        if (ret < 0) {
+            error_report("rdma migration: failed to make "
+                         "room in full send queue! %d", ret);
+            return ret;
+        }
+    }
+
+    if (ret > 0) {
+        perror("rdma migration: post rdma write failed");
+        return -ret;
+    }
+    return 0;
+}
+
 static int qemu_rdma_post_send_control(RDMAContext *rdma, uint8_t *buf,
                                        RDMAControlHeader *head)
 {
@@ -1713,6 +1774,10 @@ static int qemu_rdma_post_send_control(RDMAContext *rdma, uint8_t *buf,
         memcpy(wr->control + sizeof(RDMAControlHeader), buf, head->len);
     }
 
+    ret = qemu_rdma_post_writes(rdma);
+    if (ret < 0) {
+        return ret;
+    }
 
     ret = ibv_post_send(rdma->qp, &send_wr, &bad_wr);
 
@@ -1973,8 +2038,7 @@ static int qemu_rdma_write_one(QEMUFile *f, RDMAContext *rdma,
 {
     struct ibv_sge sge;
     struct ibv_send_wr send_wr = { 0 };
-    struct ibv_send_wr *bad_wr;
-    int reg_result_idx, ret, count = 0;
+    int reg_result_idx, ret;
     uint64_t chunk, chunks;
     uint8_t *chunk_start, *chunk_end;
     RDMALocalBlock *block = &(rdma->local_ram_blocks.block[current_index]);
@@ -1986,7 +2050,6 @@ static int qemu_rdma_write_one(QEMUFile *f, RDMAContext *rdma,
                                .repeat = 1,
                              };
 
-retry:
     sge.addr = (uintptr_t)(block->local_host_addr +
                             (current_addr - block->offset));
     sge.length = length;
@@ -2021,22 +2084,11 @@ retry:
 #endif
     }
 
-    while (test_bit(chunk, block->transit_bitmap)) {
-        (void)count;
-        trace_qemu_rdma_write_one_block(count++, current_index, chunk,
-                sge.addr, length, rdma->nb_sent, block->nb_chunks);
-
-        ret = qemu_rdma_block_for_wrid(rdma, RDMA_WRID_RDMA_WRITE, NULL);
-
-        if (ret < 0) {
-            error_report("Failed to Wait for previous write to complete "
-                    "block %d chunk %" PRIu64
-                    " current %" PRIu64 " len %" PRIu64 " %d",
-                    current_index, chunk, sge.addr, length, rdma->nb_sent);
-            return ret;
-        }
-    }
-
+    /*
+     * Earlier writes to the same chunk may still be in flight: the chunk
+     * stays registered until they complete, so there is no need to wait
+     * for them.
+     */
     if (!rdma->pin_all || !block->is_ram_block) {
         if (!block->remote_keys[chunk]) {
             /*
@@ -2144,7 +2196,6 @@ retry:
 
     send_wr.opcode = IBV_WR_RDMA_WRITE;
     send_wr.send_flags = IBV_SEND_SIGNALED;
-    send_wr.sg_list = &sge;
     send_wr.num_sge = 1;
     send_wr.wr.rdma.remote_addr = block->remote_host_addr +
                                 (current_addr - block->offset);
@@ -2152,32 +2203,28 @@ retry:
     trace_qemu_rdma_write_one_post(chunk, sge.addr, send_wr.wr.rdma.remote_addr,
                                    sge.length);
 
-    /*
-     * ibv_post_send() does not return negative error numbers,
-     * per the specification they are positive - no idea why.
-     */
-    ret = ibv_post_send(rdma->qp, &send_wr, &bad_wr);
+    /* Queue the write, it is posted along with the next ones */
+    rdma->write_sges[rdma->nb_write_wrs] = sge;
+    send_wr.sg_list = &rdma->write_sges[rdma->nb_write_wrs];
+    rdma->write_wrs[rdma->nb_write_wrs] = send_wr;
+    if (rdma->nb_write_wrs > 0) {
+        rdma->write_wrs[rdma->nb_write_wrs - 1].next =
+            &rdma->write_wrs[rdma->nb_write_wrs];
+    }
+    rdma->nb_write_wrs++;
 
-    if (ret == ENOMEM) {
-        trace_qemu_rdma_write_one_queue_full();
-        ret = qemu_rdma_block_for_wrid(rdma, RDMA_WRID_RDMA_WRITE, NULL);
+    block->transit_writes[chunk]++;
+    rdma->nb_sent++;
+    acct_update_position(f, sge.length, false);
+    rdma->total_writes++;
+
+    if (rdma->nb_write_wrs == RDMA_WRITE_BATCH_MAX) {
+        ret = qemu_rdma_post_writes(rdma);
         if (ret < 0) {
-            error_report("rdma migration: failed to make "
-                         "room in full send queue! %d", ret);
             return ret;
         }
-
-        goto retry;
-
-    } else if (ret > 0) {
-        perror("rdma migration: post rdma write failed");
-        return -ret;
     }
 
-    set_bit(chunk, block->transit_bitmap);
-    acct_update_position(f, sge.length, false);
-    rdma->total_writes++;
-
     return 0;
 }
 
@@ -2203,7 +2250,6 @@ static int qemu_rdma_write_flush(QEMUFile *f, RDMAContext *rdma)
     }
 
     if (ret == 0) {
-        rdma->nb_sent++;
         trace_qemu_rdma_write_flush(rdma->nb_sent);
     }
 
@@ -2667,6 +2713,7 @@ static ssize_t qio_channel_rdma_writev(QIOChannel *ioc,
                                        size_t niov,
                                        int *fds,
                                        size_t nfds,
+                                       int flags,
                                        Error **errp)
 {
     QIOChannelRDMA *rioc = QIO_CHANNEL_RDMA(ioc);
@@ -2836,7 +2883,7 @@ static int qemu_rdma_drain_cq(QEMUFile *f, RDMAContext *rdma)
 {
     int ret;
 
-    if (qemu_rdma_write_flush(f, rdma) < 0) {
+    if (qemu_rdma_write_flush(f, rdma) < 0 || qemu_rdma_post_writes(rdma) < 0) {
         return -EIO;
     }
 
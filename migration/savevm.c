@@ -242,6 +242,11 @@ typedef struct SaveStateEntry {
     void *opaque;
     CompatEntry *compat;
     int is_ram;
+    /* last time the whole state was saved or loaded, for query-migrate */
+    bool state_timed;
+    bool state_loaded;
+    uint64_t state_time;            /* in microseconds */
+    uint64_t state_size;
 } SaveStateEntry;
 
 typedef struct SaveState {
@@ -265,6 +270,8 @@ static bool should_validate_capability(int capability)
     /* Validate only new capabilities to keep compatibility. */
     switch (capability) {
     case MIGRATION_CAPABILITY_X_IGNORE_SHARED:
+    case MIGRATION_CAPABILITY_HUGEPAGE_DIRTY:
+    case MIGRATION_CAPABILITY_MAPPED_RAM:
         return true;
     default:
         return false;
@@ -773,6 +780,7 @@ int vmstate_register_with_alias_id(DeviceState *dev, int instance_id,
     se->opaque = opaque;
     se->vmsd = vmsd;
     se->alias_id = alias_id;
+    vmstate_compile(vmsd);
 
     if (dev) {
         char *id = qdev_get_dev_path(dev);
@@ -1248,23 +1256,12 @@ void qemu_savevm_state_complete_postcopy(QEMUFile *f)
     qemu_fflush(f);
 }
 
-int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
-                                       bool inactivate_disks)
+static int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f,
+                                                       bool in_postcopy,
+                                                       bool iterable_only)
 {
-    QJSON *vmdesc;
-    int vmdesc_len;
     SaveStateEntry *se;
     int ret;
-    bool in_postcopy = migration_in_postcopy();
-    Error *local_err = NULL;
-
-    if (precopy_notify(PRECOPY_NOTIFY_COMPLETE, &local_err)) {
-        error_report_err(local_err);
-    }
-
-    trace_savevm_state_complete_precopy();
-
-    cpu_synchronize_all_states();
 
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
         if (!se->ops ||
@@ -1293,10 +1290,79 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
         }
     }
 
-    if (iterable_only) {
-        return 0;
+    return 0;
+}
+
+/*
+ * Saves the state of the devices that are not iterated, followed by
+ * the end of the stream.  Also used on its own by background snapshots,
+ * which save it into a buffer while the guest is stopped and append it
+ * once RAM has been sent.
+ */
+static void savevm_reset_state_times(void)
+{
+    SaveStateEntry *se;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        se->state_timed = false;
     }
+}
 
+static gint savevm_state_time_cmp(gconstpointer a, gconstpointer b)
+{
+    const SaveStateEntry *se_a = *(SaveStateEntry * const *)a;
+    const SaveStateEntry *se_b = *(SaveStateEntry * const *)b;
+
+    return se_a->state_time < se_b->state_time ? 1 :
+           se_a->state_time > se_b->state_time ? -1 : 0;
+}
+
+/*
+ * The time spent on the state of each device the last time that the
+ * devices were saved or loaded, slowest first.
+ */
+MigrationDeviceTimeList *qemu_savevm_device_times(void)
+{
+    MigrationDeviceTimeList *head = NULL, *entry;
+    GPtrArray *timed = g_ptr_array_new();
+    SaveStateEntry *se;
+    int i;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (se->state_timed) {
+            g_ptr_array_add(timed, se);
+        }
+    }
+    g_ptr_array_sort(timed, savevm_state_time_cmp);
+
+    /* Built from the fastest, so that the list ends up slowest first */
+    for (i = timed->len - 1; i >= 0; i--) {
+        se = g_ptr_array_index(timed, i);
+        entry = g_new0(MigrationDeviceTimeList, 1);
+        entry->value = g_new0(MigrationDeviceTime, 1);
+        entry->value->name = g_strdup(se->idstr);
+        entry->value->instance_id = se->instance_id;
+        entry->value->time = se->state_time;
+        entry->value->has_size = !se->state_loaded;
+        entry->value->size = se->state_size;
+        entry->next = head;
+        head = entry;
+    }
+    g_ptr_array_free(timed, true);
+    return head;
+}
+
+int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
+                                                    bool in_postcopy,
+                                                    bool inactivate_disks)
+{
+    QJSON *vmdesc;
+    int vmdesc_len;
+    SaveStateEntry *se;
+    int64_t start_time, start_pos;
+    int ret;
+
+    savevm_reset_state_times();
     vmdesc = qjson_new();
     json_prop_int(vmdesc, "page_size", qemu_target_page_size());
     json_start_array(vmdesc, "devices");
@@ -1316,14 +1382,21 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
         json_prop_str(vmdesc, "name", se->idstr);
         json_prop_int(vmdesc, "instance_id", se->instance_id);
 
+        start_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        start_pos = qemu_ftell_fast(f);
         save_section_header(f, se, QEMU_VM_SECTION_FULL);
         ret = vmstate_save(f, se, vmdesc);
         if (ret) {
             qemu_file_set_error(f, ret);
+            qjson_destroy(vmdesc);
             return ret;
         }
         trace_savevm_section_end(se->idstr, se->section_id, 0);
         save_section_footer(f, se);
+        se->state_timed = true;
+        se->state_loaded = false;
+        se->state_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_time;
+        se->state_size = qemu_ftell_fast(f) - start_pos;
 
         json_end_object(vmdesc);
     }
@@ -1336,6 +1409,7 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
             error_report("%s: bdrv_inactivate_all() failed (%d)",
                          __func__, ret);
             qemu_file_set_error(f, ret);
+            qjson_destroy(vmdesc);
             return ret;
         }
     }
@@ -1359,6 +1433,35 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
     return 0;
 }
 
+int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
+                                       bool inactivate_disks)
+{
+    int ret;
+    bool in_postcopy = migration_in_postcopy();
+    Error *local_err = NULL;
+
+    if (precopy_notify(PRECOPY_NOTIFY_COMPLETE, &local_err)) {
+        error_report_err(local_err);
+    }
+
+    trace_savevm_state_complete_precopy();
+
+    cpu_synchronize_all_states();
+
+    ret = qemu_savevm_state_complete_precopy_iterable(f, in_postcopy,
+                                                      iterable_only);
+    if (ret) {
+        return ret;
+    }
+
+    if (iterable_only) {
+        return 0;
+    }
+
+    return qemu_savevm_state_complete_precopy_non_iterable(f, in_postcopy,
+                                                           inactivate_disks);
+}
+
 /* Give an estimate of the amount left to be transferred,
  * the result is split into the amount for units that can and
  * for units that can't do postcopy.
@@ -1817,6 +1920,8 @@ static int loadvm_postcopy_handle_listen(MigrationIncomingState *mis)
             postcopy_ram_incoming_cleanup(mis);
             return -1;
         }
+        /* Requested pages may now come on their own channel too */
+        postcopy_preempt_listen(mis);
     }
 
     if (postcopy_notify(POSTCOPY_NOTIFY_INBOUND_LISTEN, &local_err)) {
@@ -2169,6 +2274,7 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
     uint32_t instance_id, version_id, section_id;
     SaveStateEntry *se;
     char idstr[256];
+    int64_t start_time;
     int ret;
 
     /* Read section start */
@@ -2215,6 +2321,7 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
         return -EINVAL;
     }
 
+    start_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     ret = vmstate_load(f, se);
     if (ret < 0) {
         error_report("error while loading state for instance 0x%x of"
@@ -2224,6 +2331,11 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
     if (!check_section_footer(f, se)) {
         return -EINVAL;
     }
+    if (se->vmsd || (se->ops && se->ops->save_state)) {
+        se->state_timed = true;
+        se->state_loaded = true;
+        se->state_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_time;
+    }
 
     return 0;
 }
@@ -2440,6 +2552,7 @@ int qemu_loadvm_state(QEMUFile *f)
         return -ENOTSUP;
     }
 
+    savevm_reset_state_times();
     if (qemu_loadvm_state_setup(f) != 0) {
         return -EINVAL;
     }
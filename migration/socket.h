@@ -21,6 +21,7 @@
 #include "io/task.h"
 
 void socket_send_channel_create(QIOTaskFunc f, void *data);
+bool socket_send_channel_available(void);
 int socket_send_channel_destroy(QIOChannel *send);
 
 void tcp_start_incoming_migration(const char *host_port, Error **errp);
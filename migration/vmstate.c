@@ -17,6 +17,8 @@
 #include "savevm.h"
 #include "qemu-file.h"
 #include "qemu/bitops.h"
+#include "qemu/bswap.h"
+#include "qemu/thread.h"
 #include "qemu/error-report.h"
 #include "trace.h"
 #include "qjson.h"
@@ -26,6 +28,39 @@ static int vmstate_subsection_save(QEMUFile *f, const VMStateDescription *vmsd,
 static int vmstate_subsection_load(QEMUFile *f, const VMStateDescription *vmsd,
                                    void *opaque);
 
+/*
+ * How a field whose layout is known when the description is compiled
+ * goes to and from the stream.  VMSTATE_COPY_NONE fields, and all fields
+ * of a description that is not at its current version, go through the
+ * interpreter.
+ */
+typedef enum VMStateCopyKind {
+    VMSTATE_COPY_NONE,
+    VMSTATE_COPY_8,
+    VMSTATE_COPY_16,
+    VMSTATE_COPY_32,
+    VMSTATE_COPY_64,
+    VMSTATE_COPY_BYTES,
+} VMStateCopyKind;
+
+typedef struct VMStateOp {
+    const VMStateField *field;
+    VMStateCopyKind kind;
+    unsigned int n;             /* elements, or bytes for VMSTATE_COPY_BYTES */
+    char *json_name;            /* unique name of the field in the vmdesc */
+    int json_size;              /* bytes of an element in the stream */
+} VMStateOp;
+
+/* One operation per entry of vmsd->fields */
+typedef struct VMStateCompiled {
+    int nb_ops;
+    VMStateOp ops[];
+} VMStateCompiled;
+
+static const VMStateCompiled *vmstate_compiled(const VMStateDescription *vmsd);
+static int vmstate_load_copy(QEMUFile *f, const VMStateDescription *vmsd,
+                             const VMStateOp *op, void *opaque);
+
 static int vmstate_n_elems(void *opaque, const VMStateField *field)
 {
     int n_elems = 1;
@@ -76,11 +111,58 @@ static void vmstate_handle_alloc(void *ptr, const VMStateField *field,
     }
 }
 
+static int vmstate_load_field(QEMUFile *f, const VMStateDescription *vmsd,
+                              const VMStateField *field, void *opaque)
+{
+    void *first_elem = opaque + field->offset;
+    int i, n_elems = vmstate_n_elems(opaque, field);
+    int size = vmstate_size(opaque, field);
+    int ret;
+
+    vmstate_handle_alloc(first_elem, field, opaque);
+    if (field->flags & VMS_POINTER) {
+        first_elem = *(void **)first_elem;
+        assert(first_elem || !n_elems || !size);
+    }
+    for (i = 0; i < n_elems; i++) {
+        void *curr_elem = first_elem + size * i;
+
+        if (field->flags & VMS_ARRAY_OF_POINTER) {
+            curr_elem = *(void **)curr_elem;
+        }
+        if (!curr_elem && size) {
+            /* if null pointer check placeholder and do not follow */
+            assert(field->flags & VMS_ARRAY_OF_POINTER);
+            ret = vmstate_info_nullptr.get(f, curr_elem, size, NULL);
+        } else if (field->flags & VMS_STRUCT) {
+            ret = vmstate_load_state(f, field->vmsd, curr_elem,
+                                     field->vmsd->version_id);
+        } else if (field->flags & VMS_VSTRUCT) {
+            ret = vmstate_load_state(f, field->vmsd, curr_elem,
+                                     field->struct_version_id);
+        } else {
+            ret = field->info->get(f, curr_elem, size, field);
+        }
+        if (ret >= 0) {
+            ret = qemu_file_get_error(f);
+        }
+        if (ret < 0) {
+            qemu_file_set_error(f, ret);
+            error_report("Failed to load %s:%s", vmsd->name,
+                         field->name);
+            trace_vmstate_load_field_error(field->name, ret);
+            return ret;
+        }
+    }
+    return 0;
+}
+
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id)
 {
     const VMStateField *field = vmsd->fields;
-    int ret = 0;
+    const VMStateCompiled *compiled;
+    int i, ret = 0;
 
     trace_vmstate_load_state(vmsd->name, version_id);
     if (version_id > vmsd->version_id) {
@@ -109,57 +191,29 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
             return ret;
         }
     }
-    while (field->name) {
+    compiled = version_id == vmsd->version_id ? vmstate_compiled(vmsd) : NULL;
+    for (i = 0; field->name; field++, i++) {
+        if (compiled && compiled->ops[i].kind != VMSTATE_COPY_NONE) {
+            ret = vmstate_load_copy(f, vmsd, &compiled->ops[i], opaque);
+            if (ret < 0) {
+                return ret;
+            }
+            continue;
+        }
         trace_vmstate_load_state_field(vmsd->name, field->name);
         if ((field->field_exists &&
              field->field_exists(opaque, version_id)) ||
             (!field->field_exists &&
              field->version_id <= version_id)) {
-            void *first_elem = opaque + field->offset;
-            int i, n_elems = vmstate_n_elems(opaque, field);
-            int size = vmstate_size(opaque, field);
-
-            vmstate_handle_alloc(first_elem, field, opaque);
-            if (field->flags & VMS_POINTER) {
-                first_elem = *(void **)first_elem;
-                assert(first_elem || !n_elems || !size);
-            }
-            for (i = 0; i < n_elems; i++) {
-                void *curr_elem = first_elem + size * i;
-
-                if (field->flags & VMS_ARRAY_OF_POINTER) {
-                    curr_elem = *(void **)curr_elem;
-                }
-                if (!curr_elem && size) {
-                    /* if null pointer check placeholder and do not follow */
-                    assert(field->flags & VMS_ARRAY_OF_POINTER);
-                    ret = vmstate_info_nullptr.get(f, curr_elem, size, NULL);
-                } else if (field->flags & VMS_STRUCT) {
-                    ret = vmstate_load_state(f, field->vmsd, curr_elem,
-                                             field->vmsd->version_id);
-                } else if (field->flags & VMS_VSTRUCT) {
-                    ret = vmstate_load_state(f, field->vmsd, curr_elem,
-                                             field->struct_version_id);
-                } else {
-                    ret = field->info->get(f, curr_elem, size, field);
-                }
-                if (ret >= 0) {
-                    ret = qemu_file_get_error(f);
-                }
-                if (ret < 0) {
-                    qemu_file_set_error(f, ret);
-                    error_report("Failed to load %s:%s", vmsd->name,
-                                 field->name);
-                    trace_vmstate_load_field_error(field->name, ret);
-                    return ret;
-                }
+            ret = vmstate_load_field(f, vmsd, field, opaque);
+            if (ret < 0) {
+                return ret;
             }
         } else if (field->flags & VMS_MUST_EXIST) {
             error_report("Input validation failed: %s/%s",
                          vmsd->name, field->name);
             return -1;
         }
-        field++;
     }
     ret = vmstate_subsection_load(f, vmsd, opaque);
     if (ret != 0) {
@@ -305,6 +359,218 @@ static void vmsd_desc_field_end(const VMStateDescription *vmsd, QJSON *vmdesc,
     json_end_object(vmdesc);
 }
 
+/*
+ * The descriptions are compiled when they are registered, which like
+ * saving and loading them happens under the BQL.  The lock only keeps
+ * the table consistent if a device is registered while another thread
+ * looks a description up.
+ */
+static GHashTable *vmstate_compiled_table;
+static QemuSpin vmstate_compiled_lock;  /* zero-initialized is unlocked */
+
+static VMStateCopyKind vmstate_copy_kind(const VMStateDescription *vmsd,
+                                         const VMStateField *field)
+{
+    if (field->field_exists || field->version_id > vmsd->version_id) {
+        return VMSTATE_COPY_NONE;
+    }
+    if (field->flags & ~(VMS_SINGLE | VMS_ARRAY | VMS_BUFFER |
+                         VMS_MUST_EXIST)) {
+        return VMSTATE_COPY_NONE;
+    }
+    if ((field->flags & VMS_ARRAY) && field->num <= 0) {
+        return VMSTATE_COPY_NONE;
+    }
+
+    if (field->info == &vmstate_info_buffer) {
+        return (field->flags & VMS_BUFFER) && !(field->flags & VMS_ARRAY) &&
+               field->size > 0 ? VMSTATE_COPY_BYTES : VMSTATE_COPY_NONE;
+    }
+    if ((field->info == &vmstate_info_uint8 ||
+         field->info == &vmstate_info_int8) && field->size == 1) {
+        return VMSTATE_COPY_8;
+    }
+    if ((field->info == &vmstate_info_uint16 ||
+         field->info == &vmstate_info_int16) && field->size == 2) {
+        return VMSTATE_COPY_16;
+    }
+    if ((field->info == &vmstate_info_uint32 ||
+         field->info == &vmstate_info_int32) && field->size == 4) {
+        return VMSTATE_COPY_32;
+    }
+    if ((field->info == &vmstate_info_uint64 ||
+         field->info == &vmstate_info_int64) && field->size == 8) {
+        return VMSTATE_COPY_64;
+    }
+    return VMSTATE_COPY_NONE;
+}
+
+static const VMStateCompiled *vmstate_compiled(const VMStateDescription *vmsd)
+{
+    const VMStateCompiled *compiled = NULL;
+
+    qemu_spin_lock(&vmstate_compiled_lock);
+    if (vmstate_compiled_table) {
+        compiled = g_hash_table_lookup(vmstate_compiled_table, vmsd);
+    }
+    qemu_spin_unlock(&vmstate_compiled_lock);
+    return compiled;
+}
+
+/*
+ * Turn the fields of @vmsd that are always there and are plain integers
+ * or buffers into copies, so that saving and loading them at the current
+ * version does not go through the VMStateInfo callbacks, and so that the
+ * vmdesc entry of each of them is known in advance.  The descriptions of
+ * the structs and subsections of @vmsd are compiled as well.
+ */
+void vmstate_compile(const VMStateDescription *vmsd)
+{
+    const VMStateDescription **sub;
+    const VMStateField *field;
+    VMStateCompiled *compiled;
+    int i, n_fields = 0, n_copies = 0;
+
+    qemu_spin_lock(&vmstate_compiled_lock);
+    if (!vmstate_compiled_table) {
+        vmstate_compiled_table = g_hash_table_new(NULL, NULL);
+    }
+    if (g_hash_table_contains(vmstate_compiled_table, vmsd)) {
+        qemu_spin_unlock(&vmstate_compiled_lock);
+        return;
+    }
+    /* Descriptions without copies stay NULL, and are not compiled again */
+    g_hash_table_insert(vmstate_compiled_table, (gpointer)vmsd, NULL);
+    qemu_spin_unlock(&vmstate_compiled_lock);
+
+    for (field = vmsd->fields; field->name; field++) {
+        n_fields++;
+    }
+    compiled = g_malloc0(sizeof(*compiled) + n_fields * sizeof(VMStateOp));
+    compiled->nb_ops = n_fields;
+
+    for (i = 0, field = vmsd->fields; i < n_fields; i++, field++) {
+        VMStateOp *op = &compiled->ops[i];
+
+        op->field = field;
+        op->kind = vmstate_copy_kind(vmsd, field);
+        if (op->kind == VMSTATE_COPY_NONE) {
+            if ((field->flags & (VMS_STRUCT | VMS_VSTRUCT)) && field->vmsd) {
+                vmstate_compile(field->vmsd);
+            }
+            continue;
+        }
+
+        n_copies++;
+        if (op->kind == VMSTATE_COPY_BYTES) {
+            op->n = field->size;
+            op->json_size = field->size;
+        } else {
+            op->n = field->flags & VMS_ARRAY ? field->num : 1;
+            op->json_size = field->size;
+        }
+        if (vmfield_name_is_unique(vmsd->fields, field)) {
+            op->json_name = g_strdup(field->name);
+        } else {
+            op->json_name = g_strdup_printf("%s[%d]", field->name,
+                                    vmfield_name_num(vmsd->fields, field));
+        }
+    }
+
+    for (sub = vmsd->subsections; sub && *sub; sub++) {
+        vmstate_compile(*sub);
+    }
+
+    if (!n_copies) {
+        g_free(compiled);
+        return;
+    }
+    qemu_spin_lock(&vmstate_compiled_lock);
+    g_hash_table_insert(vmstate_compiled_table, (gpointer)vmsd, compiled);
+    qemu_spin_unlock(&vmstate_compiled_lock);
+}
+
+static void vmstate_save_copy(QEMUFile *f, const VMStateOp *op, void *opaque,
+                              QJSON *vmdesc)
+{
+    uint8_t *p = opaque + op->field->offset;
+    unsigned int i;
+
+    if (vmdesc) {
+        /* What vmsd_desc_field_start() and _end() would have written */
+        json_start_object(vmdesc, NULL);
+        json_prop_str(vmdesc, "name", op->json_name);
+        if (op->kind != VMSTATE_COPY_BYTES && op->n > 1) {
+            json_prop_int(vmdesc, "array_len", op->n);
+        }
+        json_prop_str(vmdesc, "type", op->field->info->name);
+        json_prop_int(vmdesc, "size", op->json_size);
+        json_end_object(vmdesc);
+    }
+
+    switch (op->kind) {
+    case VMSTATE_COPY_8:
+    case VMSTATE_COPY_BYTES:
+        qemu_put_buffer(f, p, op->n);
+        break;
+    case VMSTATE_COPY_16:
+        for (i = 0; i < op->n; i++) {
+            qemu_put_be16(f, lduw_he_p(p + i * 2));
+        }
+        break;
+    case VMSTATE_COPY_32:
+        for (i = 0; i < op->n; i++) {
+            qemu_put_be32(f, ldl_he_p(p + i * 4));
+        }
+        break;
+    case VMSTATE_COPY_64:
+        for (i = 0; i < op->n; i++) {
+            qemu_put_be64(f, ldq_he_p(p + i * 8));
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static int vmstate_load_copy(QEMUFile *f, const VMStateDescription *vmsd,
+                             const VMStateOp *op, void *opaque)
+{
+    uint8_t *p = opaque + op->field->offset;
+    unsigned int i;
+    int ret;
+
+    switch (op->kind) {
+    case VMSTATE_COPY_8:
+    case VMSTATE_COPY_BYTES:
+        qemu_get_buffer(f, p, op->n);
+        break;
+    case VMSTATE_COPY_16:
+        for (i = 0; i < op->n; i++) {
+            stw_he_p(p + i * 2, qemu_get_be16(f));
+        }
+        break;
+    case VMSTATE_COPY_32:
+        for (i = 0; i < op->n; i++) {
+            stl_he_p(p + i * 4, qemu_get_be32(f));
+        }
+        break;
+    case VMSTATE_COPY_64:
+        for (i = 0; i < op->n; i++) {
+            stq_he_p(p + i * 8, qemu_get_be64(f));
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    ret = qemu_file_get_error(f);
+    if (ret < 0) {
+        error_report("Failed to load %s:%s", vmsd->name, op->field->name);
+        trace_vmstate_load_field_error(op->field->name, ret);
+    }
+    return ret;
+}
 
 bool vmstate_save_needed(const VMStateDescription *vmsd, void *opaque)
 {
@@ -322,11 +588,70 @@ int vmstate_save_state(QEMUFile *f, const VMStateDescription *vmsd,
     return vmstate_save_state_v(f, vmsd, opaque, vmdesc_id, vmsd->version_id);
 }
 
+static int vmstate_save_field(QEMUFile *f, const VMStateDescription *vmsd,
+                              const VMStateField *field, void *opaque,
+                              QJSON *vmdesc)
+{
+    void *first_elem = opaque + field->offset;
+    int i, n_elems = vmstate_n_elems(opaque, field);
+    int size = vmstate_size(opaque, field);
+    int64_t old_offset, written_bytes;
+    QJSON *vmdesc_loop = vmdesc;
+    int ret;
+
+    trace_vmstate_save_state_loop(vmsd->name, field->name, n_elems);
+    if (field->flags & VMS_POINTER) {
+        first_elem = *(void **)first_elem;
+        assert(first_elem || !n_elems || !size);
+    }
+    for (i = 0; i < n_elems; i++) {
+        void *curr_elem = first_elem + size * i;
+
+        vmsd_desc_field_start(vmsd, vmdesc_loop, field, i, n_elems);
+        old_offset = qemu_ftell_fast(f);
+        if (field->flags & VMS_ARRAY_OF_POINTER) {
+            assert(curr_elem);
+            curr_elem = *(void **)curr_elem;
+        }
+        if (!curr_elem && size) {
+            /* if null pointer write placeholder and do not follow */
+            assert(field->flags & VMS_ARRAY_OF_POINTER);
+            ret = vmstate_info_nullptr.put(f, curr_elem, size, NULL,
+                                           NULL);
+        } else if (field->flags & VMS_STRUCT) {
+            ret = vmstate_save_state(f, field->vmsd, curr_elem,
+                                     vmdesc_loop);
+        } else if (field->flags & VMS_VSTRUCT) {
+            ret = vmstate_save_state_v(f, field->vmsd, curr_elem,
+                                       vmdesc_loop,
+                                       field->struct_version_id);
+        } else {
+            ret = field->info->put(f, curr_elem, size, field,
+                                   vmdesc_loop);
+        }
+        if (ret) {
+            error_report("Save of field %s/%s failed",
+                         vmsd->name, field->name);
+            return ret;
+        }
+
+        written_bytes = qemu_ftell_fast(f) - old_offset;
+        vmsd_desc_field_end(vmsd, vmdesc_loop, field, written_bytes, i);
+
+        /* Compressed arrays only care about the first element */
+        if (vmdesc_loop && vmsd_can_compress(field)) {
+            vmdesc_loop = NULL;
+        }
+    }
+    return 0;
+}
+
 int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
                          void *opaque, QJSON *vmdesc, int version_id)
 {
-    int ret = 0;
+    int i, ret = 0;
     const VMStateField *field = vmsd->fields;
+    const VMStateCompiled *compiled;
 
     trace_vmstate_save_state_top(vmsd->name);
 
@@ -345,64 +670,22 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
         json_start_array(vmdesc, "fields");
     }
 
-    while (field->name) {
+    compiled = version_id == vmsd->version_id ? vmstate_compiled(vmsd) : NULL;
+    for (i = 0; field->name; field++, i++) {
+        if (compiled && compiled->ops[i].kind != VMSTATE_COPY_NONE) {
+            vmstate_save_copy(f, &compiled->ops[i], opaque, vmdesc);
+            continue;
+        }
         if ((field->field_exists &&
              field->field_exists(opaque, version_id)) ||
             (!field->field_exists &&
              field->version_id <= version_id)) {
-            void *first_elem = opaque + field->offset;
-            int i, n_elems = vmstate_n_elems(opaque, field);
-            int size = vmstate_size(opaque, field);
-            int64_t old_offset, written_bytes;
-            QJSON *vmdesc_loop = vmdesc;
-
-            trace_vmstate_save_state_loop(vmsd->name, field->name, n_elems);
-            if (field->flags & VMS_POINTER) {
-                first_elem = *(void **)first_elem;
-                assert(first_elem || !n_elems || !size);
-            }
-            for (i = 0; i < n_elems; i++) {
-                void *curr_elem = first_elem + size * i;
-                ret = 0;
-
-                vmsd_desc_field_start(vmsd, vmdesc_loop, field, i, n_elems);
-                old_offset = qemu_ftell_fast(f);
-                if (field->flags & VMS_ARRAY_OF_POINTER) {
-                    assert(curr_elem);
-                    curr_elem = *(void **)curr_elem;
-                }
-                if (!curr_elem && size) {
-                    /* if null pointer write placeholder and do not follow */
-                    assert(field->flags & VMS_ARRAY_OF_POINTER);
-                    ret = vmstate_info_nullptr.put(f, curr_elem, size, NULL,
-                                                   NULL);
-                } else if (field->flags & VMS_STRUCT) {
-                    ret = vmstate_save_state(f, field->vmsd, curr_elem,
-                                             vmdesc_loop);
-                } else if (field->flags & VMS_VSTRUCT) {
-                    ret = vmstate_save_state_v(f, field->vmsd, curr_elem,
-                                               vmdesc_loop,
-                                               field->struct_version_id);
-                } else {
-                    ret = field->info->put(f, curr_elem, size, field,
-                                     vmdesc_loop);
-                }
-                if (ret) {
-                    error_report("Save of field %s/%s failed",
-                                 vmsd->name, field->name);
-                    if (vmsd->post_save) {
-                        vmsd->post_save(opaque);
-                    }
-                    return ret;
-                }
-
-                written_bytes = qemu_ftell_fast(f) - old_offset;
-                vmsd_desc_field_end(vmsd, vmdesc_loop, field, written_bytes, i);
-
-                /* Compressed arrays only care about the first element */
-                if (vmdesc_loop && vmsd_can_compress(field)) {
-                    vmdesc_loop = NULL;
+            ret = vmstate_save_field(f, vmsd, field, opaque, vmdesc);
+            if (ret) {
+                if (vmsd->post_save) {
+                    vmsd->post_save(opaque);
                 }
+                return ret;
             }
         } else {
             if (field->flags & VMS_MUST_EXIST) {
@@ -411,7 +694,6 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
                 assert(!(field->flags & VMS_MUST_EXIST));
             }
         }
-        field++;
     }
 
     if (vmdesc) {
@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
 /*
@@ -24,8 +25,8 @@
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
@@ -126,6 +127,231 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+/*
+ * The vector encoders below compare a whole vector of bytes at once,
+ * and get the length of a run from the mask of the bytes that are
+ * equal in the old and new pages; the encoding they produce is the
+ * same as the one of xbzrle_encode_buffer_int.
+ */
+typedef int (*XBZRLERunEnd)(const uint8_t *old_buf, const uint8_t *new_buf,
+                            int i, int slen);
+
+static inline __attribute__((always_inline))
+int xbzrle_encode_buffer_vec(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                             uint8_t *dst, int dlen,
+                             XBZRLERunEnd zrun_end, XBZRLERunEnd nzrun_end)
+{
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, start;
+
+    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
+               sizeof(long)));
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        start = i;
+        i = zrun_end(old_buf, new_buf, i, slen);
+        zrun_len = i - start;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        start = i;
+        i = nzrun_end(old_buf, new_buf, i, slen);
+        nzrun_len = i - start;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + start, nzrun_len);
+        d += nzrun_len;
+    }
+
+    return d;
+}
+
+static int (*xbzrle_encode_accel)(uint8_t *, uint8_t *, int,
+                                  uint8_t *, int) = xbzrle_encode_buffer_int;
+
+#if defined(CONFIG_AVX2_OPT)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/* Bit n is set if byte n is the same in both 32-byte vectors */
+static inline uint32_t xbzrle_eq_mask_avx2(const uint8_t *old_buf,
+                                           const uint8_t *new_buf)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)old_buf);
+    __m256i b = _mm256_loadu_si256((const __m256i *)new_buf);
+
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+}
+
+static int xbzrle_zrun_end_avx2(const uint8_t *old_buf,
+                                const uint8_t *new_buf, int i, int slen)
+{
+    uint32_t mask;
+
+    for (; i + 32 <= slen; i += 32) {
+        mask = xbzrle_eq_mask_avx2(old_buf + i, new_buf + i);
+        if (mask != UINT32_MAX) {
+            return i + cto32(mask);
+        }
+    }
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_nzrun_end_avx2(const uint8_t *old_buf,
+                                 const uint8_t *new_buf, int i, int slen)
+{
+    uint32_t mask;
+
+    for (; i + 32 <= slen; i += 32) {
+        mask = xbzrle_eq_mask_avx2(old_buf + i, new_buf + i);
+        if (mask) {
+            return i + ctz32(mask);
+        }
+    }
+    while (i < slen && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer_vec(old_buf, new_buf, slen, dst, dlen,
+                                    xbzrle_zrun_end_avx2,
+                                    xbzrle_nzrun_end_avx2);
+}
+#pragma GCC pop_options
+
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_xbzrle_accel(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                xbzrle_encode_accel = xbzrle_encode_buffer_avx2;
+            }
+        }
+    }
+}
+#elif defined(__aarch64__) && !defined(HOST_WORDS_BIGENDIAN)
+#include <arm_neon.h>
+
+/*
+ * Nibble n is set if byte n is the same in both 16-byte vectors; the
+ * narrowing shift stands in for the movemask AArch64 doesn't have.
+ */
+static inline uint64_t xbzrle_eq_mask_neon(const uint8_t *old_buf,
+                                           const uint8_t *new_buf)
+{
+    uint8x16_t eq = vceqq_u8(vld1q_u8(old_buf), vld1q_u8(new_buf));
+
+    return vget_lane_u64(vreinterpret_u64_u8(
+                         vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+static int xbzrle_zrun_end_neon(const uint8_t *old_buf,
+                                const uint8_t *new_buf, int i, int slen)
+{
+    uint64_t mask;
+
+    for (; i + 16 <= slen; i += 16) {
+        mask = xbzrle_eq_mask_neon(old_buf + i, new_buf + i);
+        if (mask != UINT64_MAX) {
+            return i + cto64(mask) / 4;
+        }
+    }
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_nzrun_end_neon(const uint8_t *old_buf,
+                                 const uint8_t *new_buf, int i, int slen)
+{
+    uint64_t mask;
+
+    for (; i + 16 <= slen; i += 16) {
+        mask = xbzrle_eq_mask_neon(old_buf + i, new_buf + i);
+        if (mask) {
+            return i + ctz64(mask) / 4;
+        }
+    }
+    while (i < slen && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_buffer_neon(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer_vec(old_buf, new_buf, slen, dst, dlen,
+                                    xbzrle_zrun_end_neon,
+                                    xbzrle_nzrun_end_neon);
+}
+
+/* Advanced SIMD is architecturally mandatory on AArch64 */
+static void __attribute__((constructor)) init_xbzrle_accel(void)
+{
+    xbzrle_encode_accel = xbzrle_encode_buffer_neon;
+}
+#endif
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /* Once the vector encoder is tested, fall back to the scalar one */
+    if (xbzrle_encode_accel == xbzrle_encode_buffer_int) {
+        return false;
+    }
+    xbzrle_encode_accel = xbzrle_encode_buffer_int;
+    return true;
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
@@ -18,4 +18,10 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen);
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
+
+/*
+ * For the tests: switch xbzrle_encode_buffer to the next, less
+ * preferred, implementation.  Returns false if there is none left.
+ */
+bool test_xbzrle_encode_next_accel(void);
 #endif
@@ -74,6 +74,7 @@
 #include "qemu/option.h"
 #include "hmp.h"
 #include "qemu/thread.h"
+#include "qemu/coroutine.h"
 #include "block/qapi.h"
 #include "qapi/qapi-commands.h"
 #include "qapi/qapi-emit-events.h"
@@ -247,6 +248,12 @@ IOThread *mon_iothread;
 /* Bottom half to dispatch the requests received from I/O thread */
 QEMUBH *qmp_dispatcher_bh;
 
+/*
+ * Set while a command declared with 'coroutine': true runs in a
+ * coroutine; requests are dispatched one at a time, so the others wait.
+ */
+static bool qmp_dispatcher_co_busy;
+
 struct QMPRequest {
     /* Owner of the request */
     Monitor *mon;
@@ -256,6 +263,8 @@ struct QMPRequest {
      */
     QObject *req;
     Error *err;
+    /* Resume @mon once the request is done */
+    bool need_resume;
 };
 typedef struct QMPRequest QMPRequest;
 
@@ -1095,6 +1104,35 @@ CommandInfoList *qmp_query_commands(Error **errp)
     return list;
 }
 
+static void query_command_stats_cb(QmpCommand *cmd, void *opaque)
+{
+    CommandStatsList *info, **list = opaque;
+    uint64_t calls = stat64_get(&cmd->calls);
+
+    if (!calls) {
+        return;
+    }
+
+    info = g_malloc0(sizeof(*info));
+    info->value = g_malloc0(sizeof(*info->value));
+    info->value->name = g_strdup(cmd->name);
+    info->value->calls = calls;
+    info->value->total_ns = stat64_get(&cmd->total_ns);
+    info->value->max_ns = stat64_get(&cmd->max_ns);
+    info->next = *list;
+    *list = info;
+}
+
+CommandStatsList *qmp_query_command_stats(Error **errp)
+{
+    CommandStatsList *list = NULL;
+
+    qmp_for_each_command(cur_mon->qmp.commands, query_command_stats_cb,
+                         &list);
+
+    return list;
+}
+
 EventInfoList *qmp_query_events(Error **errp)
 {
     /*
@@ -1151,6 +1189,8 @@ static void monitor_init_qmp_commands(void)
                          QCO_NO_OPTIONS);
     qmp_register_command(&qmp_commands, "netdev_add", qmp_netdev_add,
                          QCO_NO_OPTIONS);
+    qmp_register_command(&qmp_commands, "query-blockstats-delta",
+                         qmp_query_blockstats_delta, QCO_NO_OPTIONS);
 
     QTAILQ_INIT(&qmp_cap_negotiation_commands);
     qmp_register_command(&qmp_cap_negotiation_commands, "qmp_capabilities",
@@ -4184,26 +4224,66 @@ static QMPRequest *monitor_qmp_requests_pop_any_with_lock(void)
     return req_obj;
 }
 
+static void monitor_qmp_request_done(QMPRequest *req_obj)
+{
+    if (req_obj->need_resume) {
+        /* Pairs with the monitor_suspend() in handle_qmp_command() */
+        monitor_resume(req_obj->mon);
+    }
+    qmp_request_free(req_obj);
+
+    /* Reschedule instead of looping so the main loop stays responsive */
+    qemu_bh_schedule(qmp_dispatcher_bh);
+}
+
+static void coroutine_fn monitor_qmp_dispatch_co(void *opaque)
+{
+    QMPRequest *req_obj = opaque;
+
+    monitor_qmp_dispatch(req_obj->mon, req_obj->req);
+    qmp_dispatcher_co_busy = false;
+    monitor_qmp_request_done(req_obj);
+}
+
 static void monitor_qmp_bh_dispatcher(void *data)
 {
-    QMPRequest *req_obj = monitor_qmp_requests_pop_any_with_lock();
+    QMPRequest *req_obj;
     QDict *rsp;
-    bool need_resume;
     Monitor *mon;
 
+    if (qmp_dispatcher_co_busy) {
+        /* monitor_qmp_request_done() reschedules us */
+        return;
+    }
+
+    req_obj = monitor_qmp_requests_pop_any_with_lock();
     if (!req_obj) {
         return;
     }
 
     mon = req_obj->mon;
     /*  qmp_oob_enabled() might change after "qmp_capabilities" */
-    need_resume = !qmp_oob_enabled(mon) ||
+    req_obj->need_resume = !qmp_oob_enabled(mon) ||
         mon->qmp.qmp_requests->length == QMP_REQ_QUEUE_LEN_MAX - 1;
     qemu_mutex_unlock(&mon->qmp.qmp_queue_lock);
     if (req_obj->req) {
         QDict *qdict = qobject_to(QDict, req_obj->req);
         QObject *id = qdict ? qdict_get(qdict, "id") : NULL;
         trace_monitor_qmp_cmd_in_band(qobject_get_try_str(id) ?: "");
+
+        if (qdict && qmp_is_coroutine(mon->qmp.commands, qdict)) {
+            /*
+             * Let the command yield to the main loop while it waits for
+             * I/O.  The coroutine runs in the iohandler AioContext, so
+             * that nested event loops such as BDRV_POLL_WHILE() don't
+             * dispatch further requests meanwhile.
+             */
+            qmp_dispatcher_co_busy = true;
+            aio_co_enter(iohandler_get_aio_context(),
+                         qemu_coroutine_create(monitor_qmp_dispatch_co,
+                                               req_obj));
+            return;
+        }
         monitor_qmp_dispatch(mon, req_obj->req);
     } else {
         assert(req_obj->err);
@@ -4213,14 +4293,7 @@ static void monitor_qmp_bh_dispatcher(void *data)
         qobject_unref(rsp);
     }
 
-    if (need_resume) {
-        /* Pairs with the monitor_suspend() in handle_qmp_command() */
-        monitor_resume(mon);
-    }
-    qmp_request_free(req_obj);
-
-    /* Reschedule instead of looping so the main loop stays responsive */
-    qemu_bh_schedule(qmp_dispatcher_bh);
+    monitor_qmp_request_done(req_obj);
 }
 
 static void handle_qmp_command(void *opaque, QObject *req, Error *err)
@@ -25,11 +25,15 @@
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_DIRTY_BITMAP 1
 
-/* NBD_MAX_BITMAP_EXTENTS: 1 mb of extents data. An empirical
- * constant. If an increase is needed, note that the NBD protocol
- * recommends no larger than 32 mb, so that the client won't consider
- * the reply as a denial of service attack. */
-#define NBD_MAX_BITMAP_EXTENTS (0x100000 / 8)
+/* NBD_MAX_BITMAP_EXTENTS: 8 mb of extents data, enough to describe a
+ * full 4G request at 4k granularity. If an increase is needed, note that
+ * the NBD protocol recommends no larger than 32 mb, so that the client
+ * won't consider the reply as a denial of service attack. The reply
+ * buffer only grows to this size when the extents actually need it. */
+#define NBD_MAX_BITMAP_EXTENTS (0x800000 / 8)
+
+/* Extents allocated up front for a block status reply */
+#define NBD_INITIAL_EXTENTS 64
 
 static int system_errno_to_nbd_errno(int err)
 {
@@ -53,6 +57,11 @@ static int system_errno_to_nbd_errno(int err)
         return NBD_EOVERFLOW;
     case ESHUTDOWN:
         return NBD_ESHUTDOWN;
+    case ENOTSUP:
+#if ENOTSUP != EOPNOTSUPP
+    case EOPNOTSUPP:
+#endif
+        return NBD_ENOTSUP;
     case EINVAL:
     default:
         return NBD_EINVAL;
@@ -1257,7 +1266,8 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
     int ret;
     const uint16_t myflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_TRIM |
                               NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_FUA |
-                              NBD_FLAG_SEND_WRITE_ZEROES | NBD_FLAG_SEND_CACHE);
+                              NBD_FLAG_SEND_WRITE_ZEROES | NBD_FLAG_SEND_CACHE |
+                              NBD_FLAG_SEND_FAST_ZERO);
 
     /* Old style negotiation header, no room for options
         [ 0 ..   7]   passwd       ("NBDMAGIC")
@@ -1491,6 +1501,8 @@ NBDExport *nbd_export_new(BlockDriverState *bs, uint64_t dev_offset,
         goto fail;
     }
     blk_set_enable_write_cache(blk, !writethrough);
+    /* Mostly used to back the node up, which the guest should not wait for */
+    blk_set_io_priority(blk, BLK_IO_PRIO_LOW);
 
     exp->refcount = 1;
     QTAILQ_INIT(&exp->clients);
@@ -1860,21 +1872,28 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
 }
 
 /*
- * Populate @extents from block status. Update @bytes to be the actual
- * length encoded (which may be smaller than the original), and update
- * @nb_extents to the number of extents used.
+ * Populate @extents from block status. At most @nb_extents extents are
+ * used; the array starts with room for NBD_INITIAL_EXTENTS of them (or
+ * @nb_extents if that is fewer) and is reallocated as needed. Update
+ * @bytes to be the actual length encoded (which may be smaller than the
+ * original), and update @nb_extents to the number of extents used.
  *
  * Returns zero on success and -errno on bdrv_block_status_above failure.
  */
 static int blockstatus_to_extents(BlockDriverState *bs, uint64_t offset,
-                                  uint64_t *bytes, NBDExtent *extents,
+                                  uint64_t *bytes, NBDExtent **extents,
                                   unsigned int *nb_extents)
 {
     uint64_t remaining_bytes = *bytes;
-    NBDExtent *extent = extents, *extents_end = extents + *nb_extents;
+    unsigned int max_extents = *nb_extents;
+    unsigned int nb_alloc = MIN(max_extents, NBD_INITIAL_EXTENTS);
+    NBDExtent *extent;
+    unsigned int i = 0;
     bool first_extent = true;
 
-    assert(*nb_extents);
+    assert(max_extents);
+    *extents = g_new(NBDExtent, nb_alloc);
+    extent = *extents;
     while (remaining_bytes) {
         uint32_t flags;
         int64_t num;
@@ -1896,12 +1915,16 @@ static int blockstatus_to_extents(BlockDriverState *bs, uint64_t offset,
             /* extend current extent */
             extent->length += num;
         } else {
-            if (extent + 1 == extents_end) {
+            if (i + 1 == max_extents) {
                 break;
             }
+            if (i + 1 == nb_alloc) {
+                nb_alloc = MIN(nb_alloc * 2, max_extents);
+                *extents = g_renew(NBDExtent, *extents, nb_alloc);
+            }
 
             /* start new extent */
-            extent++;
+            extent = &(*extents)[++i];
             extent->flags = flags;
             extent->length = num;
         }
@@ -1909,15 +1932,13 @@ static int blockstatus_to_extents(BlockDriverState *bs, uint64_t offset,
         remaining_bytes -= num;
     }
 
-    extents_end = extent + 1;
-
-    for (extent = extents; extent < extents_end; extent++) {
-        extent->flags = cpu_to_be32(extent->flags);
-        extent->length = cpu_to_be32(extent->length);
+    *nb_extents = i + 1;
+    for (i = 0; i < *nb_extents; i++) {
+        (*extents)[i].flags = cpu_to_be32((*extents)[i].flags);
+        (*extents)[i].length = cpu_to_be32((*extents)[i].length);
     }
 
     *bytes -= remaining_bytes;
-    *nb_extents = extents_end - extents;
 
     return 0;
 }
@@ -1959,10 +1980,10 @@ static int nbd_co_send_block_status(NBDClient *client, uint64_t handle,
 {
     int ret;
     unsigned int nb_extents = dont_fragment ? 1 : NBD_MAX_BITMAP_EXTENTS;
-    NBDExtent *extents = g_new(NBDExtent, nb_extents);
+    NBDExtent *extents;
     uint64_t final_length = length;
 
-    ret = blockstatus_to_extents(bs, offset, &final_length, extents,
+    ret = blockstatus_to_extents(bs, offset, &final_length, &extents,
                                  &nb_extents);
     if (ret < 0) {
         g_free(extents);
@@ -1983,6 +2004,9 @@ static int nbd_co_send_block_status(NBDClient *client, uint64_t handle,
  * final extent may exceed the original @length. Store in @length the
  * byte length encoded (which may be smaller or larger than the
  * original), and return the number of extents used.
+ *
+ * Each dirty area is found with a single walk of the bitmap, and also
+ * gives the end of the clean extent before it.
  */
 static unsigned int bitmap_to_extents(BdrvDirtyBitmap *bitmap, uint64_t offset,
                                       uint64_t *length, NBDExtent *extents,
@@ -1991,45 +2015,42 @@ static unsigned int bitmap_to_extents(BdrvDirtyBitmap *bitmap, uint64_t offset,
 {
     uint64_t begin = offset, end = offset;
     uint64_t overall_end = offset + *length;
+    uint64_t search_end = dont_fragment ? overall_end
+                                        : bdrv_dirty_bitmap_size(bitmap);
+    uint64_t dirty_start = 0, dirty_end = 0;
     unsigned int i = 0;
-    BdrvDirtyBitmapIter *it;
     bool dirty;
 
     bdrv_dirty_bitmap_lock(bitmap);
 
-    it = bdrv_dirty_iter_new(bitmap);
-    dirty = bdrv_get_dirty_locked(NULL, bitmap, offset);
-
     assert(begin < overall_end && nb_extents);
     while (begin < overall_end && i < nb_extents) {
-        bool next_dirty = !dirty;
-
-        if (dirty) {
-            end = bdrv_dirty_bitmap_next_zero(bitmap, begin, UINT64_MAX);
-        } else {
-            bdrv_set_dirty_iter(it, begin);
-            end = bdrv_dirty_iter_next(it);
+        if (dirty_end <= begin) {
+            uint64_t dirty_bytes = search_end - begin;
+
+            dirty_start = begin;
+            if (bdrv_dirty_bitmap_next_dirty_area(bitmap, &dirty_start,
+                                                  &dirty_bytes)) {
+                dirty_end = dirty_start + dirty_bytes;
+            } else {
+                dirty_start = dirty_end = search_end;
+            }
         }
-        if (end == -1 || end - begin > UINT32_MAX) {
+
+        dirty = dirty_start <= begin;
+        end = dirty ? dirty_end : dirty_start;
+        if (end - begin > UINT32_MAX) {
             /* Cap to an aligned value < 4G beyond begin. */
-            end = MIN(bdrv_dirty_bitmap_size(bitmap),
-                      begin + UINT32_MAX + 1 -
-                      bdrv_dirty_bitmap_granularity(bitmap));
-            next_dirty = dirty;
-        }
-        if (dont_fragment && end > overall_end) {
-            end = overall_end;
+            end = begin + UINT32_MAX + 1 -
+                  bdrv_dirty_bitmap_granularity(bitmap);
         }
 
         extents[i].length = cpu_to_be32(end - begin);
         extents[i].flags = cpu_to_be32(dirty ? NBD_STATE_DIRTY : 0);
         i++;
         begin = end;
-        dirty = next_dirty;
     }
 
-    bdrv_dirty_iter_free(it);
-
     bdrv_dirty_bitmap_unlock(bitmap);
 
     assert(offset < end);
@@ -2043,10 +2064,19 @@ static int nbd_co_send_bitmap(NBDClient *client, uint64_t handle,
                               uint32_t context_id, Error **errp)
 {
     int ret;
+    uint64_t granularity = bdrv_dirty_bitmap_granularity(bitmap);
     unsigned int nb_extents = dont_fragment ? 1 : NBD_MAX_BITMAP_EXTENTS;
-    NBDExtent *extents = g_new(NBDExtent, nb_extents);
+    NBDExtent *extents;
     uint64_t final_length = length;
 
+    /*
+     * Apart from the first one and one cut short by the 4G cap, every
+     * extent starts on a granularity boundary inside the request, so
+     * there can't be more than this.
+     */
+    nb_extents = MIN(nb_extents, DIV_ROUND_UP(length, granularity) + 2);
+    extents = g_new(NBDExtent, nb_extents);
+
     nb_extents = bitmap_to_extents(bitmap, offset, &final_length, extents,
                                    nb_extents, dont_fragment);
 
@@ -2148,7 +2178,7 @@ static int nbd_co_receive_request(NBDRequestData *req, NBDRequest *request,
     if (request->type == NBD_CMD_READ && client->structured_reply) {
         valid_flags |= NBD_CMD_FLAG_DF;
     } else if (request->type == NBD_CMD_WRITE_ZEROES) {
-        valid_flags |= NBD_CMD_FLAG_NO_HOLE;
+        valid_flags |= NBD_CMD_FLAG_NO_HOLE | NBD_CMD_FLAG_FAST_ZERO;
     } else if (request->type == NBD_CMD_BLOCK_STATUS) {
         valid_flags |= NBD_CMD_FLAG_REQ_ONE;
     }
@@ -2263,6 +2293,9 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         if (!(request->flags & NBD_CMD_FLAG_NO_HOLE)) {
             flags |= BDRV_REQ_MAY_UNMAP;
         }
+        if (request->flags & NBD_CMD_FLAG_FAST_ZERO) {
+            flags |= BDRV_REQ_NO_FALLBACK;
+        }
         ret = blk_pwrite_zeroes(exp->blk, request->from + exp->dev_offset,
                                 request->len, flags);
         return nbd_send_generic_reply(client, request->handle, ret,
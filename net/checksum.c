@@ -20,24 +20,59 @@
 #include "net/checksum.h"
 #include "net/eth.h"
 
+/*
+ * The data is summed as host-endian 64-bit words: in one's complement
+ * arithmetic the sum of wider words folds to the sum of their 16-bit
+ * halves, and the byte order of the result can be fixed up at the end
+ * (RFC 1071).  Adding up the 32-bit halves of each word into 64-bit
+ * accumulators needs no carry handling, and the independent accumulators
+ * of the main loop let the compiler vectorize it.
+ *
+ * The result is folded to 16 bits, so callers can keep adding partial sums
+ * into a uint32_t without overflowing it.  It is zero only if all the data
+ * is, as net_checksum_finish() relies on.
+ */
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
-
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    uint64_t sum1 = 0, sum2 = 0, sum3 = 0, sum4 = 0;
+    uint64_t w1, w2, w3, w4;
+    uint32_t sum;
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        w1 = ldq_he_p(buf + i);
+        w2 = ldq_he_p(buf + i + 8);
+        w3 = ldq_he_p(buf + i + 16);
+        w4 = ldq_he_p(buf + i + 24);
+        sum1 += (uint32_t)w1 + (w1 >> 32);
+        sum2 += (uint32_t)w2 + (w2 >> 32);
+        sum3 += (uint32_t)w3 + (w3 >> 32);
+        sum4 += (uint32_t)w4 + (w4 >> 32);
     }
-    if (i < len) {
-        sum1 += (uint32_t)buf[i];
+    for (; i + 8 <= len; i += 8) {
+        w1 = ldq_he_p(buf + i);
+        sum1 += (uint32_t)w1 + (w1 >> 32);
     }
+    sum1 += sum2 + sum3 + sum4;
+    for (; i + 2 <= len; i += 2) {
+        sum1 += lduw_he_p(buf + i);
+    }
+    if (i < len) {
+        /* A trailing byte is the first half of a zero padded word */
+        uint8_t last[2] = { buf[i], 0 };
 
-    if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
+        sum1 += lduw_he_p(last);
     }
+
+    sum1 = (sum1 & 0xffffffff) + (sum1 >> 32);
+    sum1 = (sum1 & 0xffffffff) + (sum1 >> 32);
+    sum = (sum1 & 0xffff) + (sum1 >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    /* Big-endian words, byte swapped if the data starts at an odd offset */
+    sum = be16_to_cpu(sum);
+    return seq & 1 ? bswap16(sum) : sum;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -180,7 +215,8 @@ net_checksum_add_iov(const struct iovec *iov, const unsigned int iov_cnt,
             size_t len = MIN((iovec_off + iov[i].iov_len) - iov_off , size);
             void *chunk_buf = iov[i].iov_base + (iov_off - iovec_off);
 
-            res += net_checksum_add_cont(len, chunk_buf, csum_offset);
+            res = net_checksum_combine(res, net_checksum_add(len, chunk_buf),
+                                       csum_offset);
             csum_offset += len;
 
             buf_off += len;
@@ -163,10 +163,19 @@ static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
     if (g_queue_get_length(queue) <= MAX_QUEUE_SIZE) {
         if (pkt->ip->ip_p == IPPROTO_TCP) {
             fill_pkt_tcp_info(pkt, max_ack);
-            g_queue_insert_sorted(queue,
-                                  pkt,
-                                  (GCompareDataFunc)seq_sorter,
-                                  NULL);
+            /*
+             * Segments mostly arrive in order: append them directly rather
+             * than walking the whole queue to find their place.
+             */
+            if (g_queue_is_empty(queue) ||
+                seq_sorter(g_queue_peek_tail(queue), pkt, NULL) < 0) {
+                g_queue_push_tail(queue, pkt);
+            } else {
+                g_queue_insert_sorted(queue,
+                                      pkt,
+                                      (GCompareDataFunc)seq_sorter,
+                                      NULL);
+            }
         } else {
             g_queue_push_tail(queue, pkt);
         }
@@ -175,6 +184,40 @@ static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
     return 0;
 }
 
+static gboolean colo_connection_idle(gpointer key, gpointer value,
+                                     gpointer user_data)
+{
+    Connection *conn = value;
+
+    return g_queue_is_empty(&conn->primary_list) &&
+           g_queue_is_empty(&conn->secondary_list);
+}
+
+/*
+ * Connections are never closed here, so the table fills up over time and
+ * connection_get() would end up dropping every one of them, queued packets
+ * included.  Before that happens, forget the connections that have nothing
+ * left to compare.
+ */
+static void colo_compare_reclaim_connections(CompareState *s)
+{
+    GList *l = s->conn_list.head;
+    guint n;
+
+    while (l) {
+        GList *next = l->next;
+
+        if (colo_connection_idle(NULL, l->data, NULL)) {
+            g_queue_delete_link(&s->conn_list, l);
+        }
+        l = next;
+    }
+
+    n = g_hash_table_foreach_remove(s->connection_track_table,
+                                    colo_connection_idle, NULL);
+    trace_colo_compare_reclaim(n, g_hash_table_size(s->connection_track_table));
+}
+
 /*
  * Return 0 on success, if return -1 means the pkt
  * is unsupported(arp and ipv6) and will be sent later
@@ -202,6 +245,10 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
     }
     fill_connection_key(pkt, &key);
 
+    if (g_hash_table_size(s->connection_track_table) >= HASHTABLE_MAX_SIZE) {
+        colo_compare_reclaim_connections(s);
+    }
+
     conn = connection_get(s->connection_track_table,
                           &key,
                           &s->conn_list);
@@ -210,10 +210,11 @@ Connection *connection_get(GHashTable *connection_track_table,
                                   " clear it");
             connection_hashtable_reset(connection_track_table);
             /*
-             * clear the conn_list
+             * clear the conn_list; the hashtable owned its connections
+             * and has already destroyed them
              */
-            while (!g_queue_is_empty(conn_list)) {
-                connection_destroy(g_queue_pop_head(conn_list));
+            if (conn_list) {
+                g_queue_clear(conn_list);
             }
         }
 
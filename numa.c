@@ -110,6 +110,34 @@ static void parse_numa_node(MachineState *ms, NumaNodeOptions *node,
         return;
     }
 
+    for (cpus = node->host_cpus; cpus; cpus = cpus->next) {
+        if (cpus->value >= QEMU_THREAD_MAX_CPUS) {
+            error_setg(errp, "Invalid host-cpus value: %" PRIu16,
+                       cpus->value);
+            return;
+        }
+        set_bit(cpus->value, numa_info[nodenr].host_cpus);
+    }
+    if (node->has_host_nodes) {
+        DECLARE_BITMAP(host_nodes, MAX_NODES);
+
+        bitmap_zero(host_nodes, MAX_NODES);
+        for (cpus = node->host_nodes; cpus; cpus = cpus->next) {
+            if (cpus->value >= MAX_NODES) {
+                error_setg(errp, "Invalid host-nodes value: %" PRIu16,
+                           cpus->value);
+                return;
+            }
+            set_bit(cpus->value, host_nodes);
+        }
+        if (!qemu_get_host_node_cpus(host_nodes, MAX_NODES,
+                                     numa_info[nodenr].host_cpus,
+                                     QEMU_THREAD_MAX_CPUS)) {
+            error_setg(errp, "No usable CPUs in host-nodes");
+            return;
+        }
+    }
+
     if (have_memdevs == -1) {
         have_memdevs = node->has_memdev;
     }
@@ -549,6 +577,7 @@ static void numa_stat_memory_devices(NumaNodeMem node_mem[])
     MemoryDeviceInfoList *info_list = qmp_memory_device_list();
     MemoryDeviceInfoList *info;
     PCDIMMDeviceInfo     *pcdimm_info;
+    VirtioMEMDeviceInfo  *vmi;
 
     for (info = info_list; info; info = info->next) {
         MemoryDeviceInfo *value = info->value;
@@ -563,6 +592,13 @@ static void numa_stat_memory_devices(NumaNodeMem node_mem[])
                 pcdimm_info = value->u.nvdimm.data;
                 break;
 
+            case MEMORY_DEVICE_INFO_KIND_VIRTIO_MEM:
+                vmi = value->u.virtio_mem.data;
+                node_mem[vmi->node].node_mem += vmi->size;
+                node_mem[vmi->node].node_plugged_mem += vmi->size;
+                pcdimm_info = NULL;
+                break;
+
             default:
                 pcdimm_info = NULL;
                 break;
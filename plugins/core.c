@@ -0,0 +1,286 @@
+/*
+ * TCG plugins: loading, and the callbacks they register
+ *
+ * All plugins are loaded and installed before the guest runs, and the
+ * callbacks that are not tied to a block can only be registered while
+ * they install.  The lists of these callbacks are therefore read without
+ * locking once the guest runs.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/queue.h"
+#include "plugin.h"
+#include <gmodule.h>
+
+typedef int (*qemu_plugin_install_func_t)(qemu_plugin_id_t id,
+                                          const qemu_info_t *info,
+                                          int argc, char **argv);
+
+/* A plugin given on the command line, until it is loaded */
+struct qemu_plugin_desc {
+    char *path;
+    GPtrArray *argv;            /* NULL-terminated */
+    QTAILQ_ENTRY(qemu_plugin_desc) entry;
+};
+
+typedef struct PluginCB {
+    qemu_plugin_id_t id;
+    union {
+        qemu_plugin_vcpu_tb_trans_cb_t tb_trans;
+        qemu_plugin_udata_cb_t udata_cb;
+    };
+    void *udata;
+} PluginCB;
+
+static QTAILQ_HEAD(, qemu_plugin_desc) plugin_descs =
+    QTAILQ_HEAD_INITIALIZER(plugin_descs);
+
+static qemu_plugin_id_t plugin_next_id;
+static GArray *plugin_tb_trans_cbs;     /* of PluginCB */
+static GArray *plugin_atexit_cbs;       /* ditto */
+static bool plugin_exited;
+
+void qemu_plugin_opt_parse(const char *optarg, Error **errp)
+{
+    struct qemu_plugin_desc *desc;
+    gchar **opts = g_strsplit(optarg, ",", 0);
+    const char *val;
+    int i;
+
+    desc = g_new0(struct qemu_plugin_desc, 1);
+    desc->argv = g_ptr_array_new_with_free_func(g_free);
+    for (i = 0; opts[i]; i++) {
+        if (strstart(opts[i], "file=", &val)) {
+            g_free(desc->path);
+            desc->path = g_strdup(val);
+        } else if (strstart(opts[i], "arg=", &val)) {
+            g_ptr_array_add(desc->argv, g_strdup(val));
+        } else if (i == 0 && !strchr(opts[i], '=')) {
+            desc->path = g_strdup(opts[i]);
+        } else {
+            error_setg(errp, "Unknown -plugin option '%s'", opts[i]);
+            goto fail;
+        }
+    }
+    if (!desc->path) {
+        error_setg(errp, "-plugin needs the file of the plugin");
+        goto fail;
+    }
+    g_ptr_array_add(desc->argv, NULL);
+    QTAILQ_INSERT_TAIL(&plugin_descs, desc, entry);
+    g_strfreev(opts);
+    return;
+
+fail:
+    g_free(desc->path);
+    g_ptr_array_free(desc->argv, true);
+    g_free(desc);
+    g_strfreev(opts);
+}
+
+/* Forget the callbacks of a plugin that failed to install */
+static void plugin_drop_cbs(GArray *cbs, qemu_plugin_id_t id)
+{
+    guint i = 0;
+
+    while (cbs && i < cbs->len) {
+        if (g_array_index(cbs, PluginCB, i).id == id) {
+            g_array_remove_index(cbs, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+static bool plugin_load(struct qemu_plugin_desc *desc,
+                        const qemu_info_t *info, Error **errp)
+{
+    qemu_plugin_install_func_t install;
+    qemu_plugin_id_t id = plugin_next_id++;
+    GModule *handle;
+    int *version;
+
+    handle = g_module_open(desc->path, G_MODULE_BIND_LOCAL);
+    if (!handle) {
+        error_setg(errp, "Could not load plugin %s: %s", desc->path,
+                   g_module_error());
+        return false;
+    }
+
+    if (!g_module_symbol(handle, "qemu_plugin_version",
+                         (gpointer *)&version)) {
+        error_setg(errp, "Plugin %s does not export qemu_plugin_version",
+                   desc->path);
+        goto err;
+    }
+    if (*version < QEMU_PLUGIN_MIN_VERSION || *version > QEMU_PLUGIN_VERSION) {
+        error_setg(errp, "Plugin %s was built for API version %d, but this "
+                   "QEMU supports versions %d to %d", desc->path, *version,
+                   QEMU_PLUGIN_MIN_VERSION, QEMU_PLUGIN_VERSION);
+        goto err;
+    }
+
+    if (!g_module_symbol(handle, "qemu_plugin_install",
+                         (gpointer *)&install)) {
+        error_setg(errp, "Plugin %s does not export qemu_plugin_install",
+                   desc->path);
+        goto err;
+    }
+    if (install(id, info, desc->argv->len - 1, (char **)desc->argv->pdata)) {
+        error_setg(errp, "Plugin %s failed to install", desc->path);
+        plugin_drop_cbs(plugin_tb_trans_cbs, id);
+        plugin_drop_cbs(plugin_atexit_cbs, id);
+        goto err;
+    }
+    /* Never unloaded: the generated code calls into it */
+    return true;
+
+err:
+    g_module_close(handle);
+    return false;
+}
+
+static void plugin_atexit(void)
+{
+    qemu_plugin_atexit_cb();
+}
+
+void qemu_plugin_load_list(Error **errp)
+{
+    struct qemu_plugin_desc *desc, *next;
+    qemu_info_t info = {
+        .target_name = TARGET_NAME,
+        .version.min = QEMU_PLUGIN_MIN_VERSION,
+        .version.cur = QEMU_PLUGIN_VERSION,
+#ifdef CONFIG_SOFTMMU
+        .system_emulation = true,
+#endif
+    };
+    Error *local_err = NULL;
+
+    if (QTAILQ_EMPTY(&plugin_descs)) {
+        return;
+    }
+
+    QTAILQ_FOREACH_SAFE(desc, &plugin_descs, entry, next) {
+        if (!local_err) {
+            plugin_load(desc, &info, &local_err);
+        }
+        QTAILQ_REMOVE(&plugin_descs, desc, entry);
+        g_free(desc->path);
+        g_ptr_array_free(desc->argv, true);
+        g_free(desc);
+    }
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+    atexit(plugin_atexit);
+}
+
+static void plugin_add_cb(GArray **cbs, const PluginCB *cb)
+{
+    if (!*cbs) {
+        *cbs = g_array_new(false, false, sizeof(PluginCB));
+    }
+    g_array_append_val(*cbs, *cb);
+}
+
+void plugin_register_tb_trans_cb(qemu_plugin_id_t id,
+                                 qemu_plugin_vcpu_tb_trans_cb_t cb)
+{
+    PluginCB pcb = { .id = id, .tb_trans = cb };
+
+    plugin_add_cb(&plugin_tb_trans_cbs, &pcb);
+}
+
+void plugin_register_atexit_cb(qemu_plugin_id_t id,
+                               qemu_plugin_udata_cb_t cb, void *udata)
+{
+    PluginCB pcb = { .id = id, .udata_cb = cb, .udata = udata };
+
+    plugin_add_cb(&plugin_atexit_cbs, &pcb);
+}
+
+bool qemu_plugin_tb_trans_enabled(void)
+{
+    return plugin_tb_trans_cbs && plugin_tb_trans_cbs->len;
+}
+
+void qemu_plugin_tb_trans_cb(struct qemu_plugin_tb *tb)
+{
+    guint i;
+
+    for (i = 0; i < plugin_tb_trans_cbs->len; i++) {
+        PluginCB *cb = &g_array_index(plugin_tb_trans_cbs, PluginCB, i);
+
+        cb->tb_trans(cb->id, tb);
+    }
+}
+
+void qemu_plugin_atexit_cb(void)
+{
+    guint i;
+
+    if (plugin_exited || !plugin_atexit_cbs) {
+        return;
+    }
+    plugin_exited = true;
+    for (i = 0; i < plugin_atexit_cbs->len; i++) {
+        PluginCB *cb = &g_array_index(plugin_atexit_cbs, PluginCB, i);
+
+        cb->udata_cb(cb->id, cb->udata);
+    }
+}
+
+static struct qemu_plugin_dyn_cb *plugin_get_dyn_cb(GArray **arr)
+{
+    GArray *cbs = *arr;
+
+    if (!cbs) {
+        cbs = *arr = g_array_new(false, true,
+                                 sizeof(struct qemu_plugin_dyn_cb));
+    }
+    g_array_set_size(cbs, cbs->len + 1);
+    return &g_array_index(cbs, struct qemu_plugin_dyn_cb, cbs->len - 1);
+}
+
+void plugin_register_dyn_cb__udata(GArray **arr,
+                                   qemu_plugin_vcpu_udata_cb_t cb,
+                                   enum qemu_plugin_cb_flags flags,
+                                   void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->type = PLUGIN_CB_REGULAR;
+    dyn_cb->userp = udata;
+    dyn_cb->f = cb;
+}
+
+void plugin_register_inline_op(GArray **arr, enum qemu_plugin_op op,
+                               void *ptr, uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->userp = ptr;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.imm = imm;
+}
+
+void plugin_register_vcpu_mem_cb(GArray **arr, qemu_plugin_vcpu_mem_cb_t cb,
+                                 enum qemu_plugin_cb_flags flags,
+                                 enum qemu_plugin_mem_rw rw, void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->type = PLUGIN_CB_MEM;
+    dyn_cb->userp = udata;
+    dyn_cb->rw = rw;
+    dyn_cb->mem_f = cb;
+}
@@ -0,0 +1,30 @@
+/*
+ * TCG plugin state shared by the plugins/ files
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef PLUGINS_PLUGIN_H
+#define PLUGINS_PLUGIN_H
+
+#include "qemu/plugin.h"
+
+void plugin_register_tb_trans_cb(qemu_plugin_id_t id,
+                                 qemu_plugin_vcpu_tb_trans_cb_t cb);
+
+void plugin_register_atexit_cb(qemu_plugin_id_t id,
+                               qemu_plugin_udata_cb_t cb, void *udata);
+
+void plugin_register_dyn_cb__udata(GArray **arr,
+                                   qemu_plugin_vcpu_udata_cb_t cb,
+                                   enum qemu_plugin_cb_flags flags,
+                                   void *udata);
+
+void plugin_register_inline_op(GArray **arr, enum qemu_plugin_op op,
+                               void *ptr, uint64_t imm);
+
+void plugin_register_vcpu_mem_cb(GArray **arr, qemu_plugin_vcpu_mem_cb_t cb,
+                                 enum qemu_plugin_cb_flags flags,
+                                 enum qemu_plugin_mem_rw rw, void *udata);
+
+#endif /* PLUGINS_PLUGIN_H */
@@ -0,0 +1,251 @@
+/*
+ * JSON Output Visitor
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/json-output-visitor.h"
+#include "qapi/visitor-impl.h"
+#include "qemu/queue.h"
+#include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qnum.h"
+#include "qapi/qmp/qstring.h"
+
+typedef struct JSONStackEntry {
+    bool is_list;
+    unsigned int count; /* Members or elements written so far */
+    void *qapi; /* sanity check that caller uses same pointer */
+    QSLIST_ENTRY(JSONStackEntry) node;
+} JSONStackEntry;
+
+struct JSONOutputVisitor {
+    Visitor visitor;
+    QSLIST_HEAD(, JSONStackEntry) stack; /* Stack of unfinished containers */
+    QString *str; /* The text written so far */
+    bool done; /* Whether the root value has been written */
+    QString **result; /* User's storage location for result */
+};
+
+static JSONOutputVisitor *to_jov(Visitor *v)
+{
+    return container_of(v, JSONOutputVisitor, visitor);
+}
+
+/* Write the separator and the member name, if any, for the next value */
+static void json_output_add(JSONOutputVisitor *jov, const char *name)
+{
+    JSONStackEntry *e = QSLIST_FIRST(&jov->stack);
+
+    if (!e) {
+        /* Don't allow reuse of visitor on more than one root */
+        assert(!jov->done);
+        jov->done = true;
+        return;
+    }
+
+    if (e->count++) {
+        qstring_append(jov->str, ", ");
+    }
+    if (e->is_list) {
+        assert(!name);
+    } else {
+        assert(name);
+        qjson_append_str(jov->str, name);
+        qstring_append(jov->str, ": ");
+    }
+}
+
+static void json_output_push(JSONOutputVisitor *jov, bool is_list,
+                             void *qapi)
+{
+    JSONStackEntry *e = g_new0(JSONStackEntry, 1);
+
+    e->is_list = is_list;
+    e->qapi = qapi;
+    QSLIST_INSERT_HEAD(&jov->stack, e, node);
+    qstring_append(jov->str, is_list ? "[" : "{");
+}
+
+static void json_output_pop(JSONOutputVisitor *jov, bool is_list, void *qapi)
+{
+    JSONStackEntry *e = QSLIST_FIRST(&jov->stack);
+
+    assert(e);
+    assert(e->qapi == qapi);
+    assert(e->is_list == is_list);
+    QSLIST_REMOVE_HEAD(&jov->stack, node);
+    g_free(e);
+    qstring_append(jov->str, is_list ? "]" : "}");
+}
+
+static void json_output_start_struct(Visitor *v, const char *name,
+                                     void **obj, size_t unused, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_add(jov, name);
+    json_output_push(jov, false, obj);
+}
+
+static void json_output_end_struct(Visitor *v, void **obj)
+{
+    json_output_pop(to_jov(v), false, obj);
+}
+
+static void json_output_start_list(Visitor *v, const char *name,
+                                   GenericList **listp, size_t size,
+                                   Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_add(jov, name);
+    json_output_push(jov, true, listp);
+}
+
+static GenericList *json_output_next_list(Visitor *v, GenericList *tail,
+                                          size_t size)
+{
+    return tail->next;
+}
+
+static void json_output_end_list(Visitor *v, void **obj)
+{
+    json_output_pop(to_jov(v), true, obj);
+}
+
+static void json_output_type_int64(Visitor *v, const char *name,
+                                   int64_t *obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+    char buf[32];
+
+    json_output_add(jov, name);
+    snprintf(buf, sizeof(buf), "%" PRId64, *obj);
+    qstring_append(jov->str, buf);
+}
+
+static void json_output_type_uint64(Visitor *v, const char *name,
+                                    uint64_t *obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+    char buf[32];
+
+    json_output_add(jov, name);
+    snprintf(buf, sizeof(buf), "%" PRIu64, *obj);
+    qstring_append(jov->str, buf);
+}
+
+static void json_output_type_bool(Visitor *v, const char *name, bool *obj,
+                                  Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_add(jov, name);
+    qstring_append(jov->str, *obj ? "true" : "false");
+}
+
+static void json_output_type_str(Visitor *v, const char *name, char **obj,
+                                 Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_add(jov, name);
+    qjson_append_str(jov->str, *obj ? *obj : "");
+}
+
+static void json_output_type_number(Visitor *v, const char *name,
+                                    double *obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+    QNum *qn = qnum_from_double(*obj);
+    char *buf;
+
+    /* Format it exactly like qobject_to_json() does */
+    json_output_add(jov, name);
+    buf = qnum_to_string(qn);
+    qstring_append(jov->str, buf);
+    g_free(buf);
+    qobject_unref(qn);
+}
+
+static void json_output_type_any(Visitor *v, const char *name,
+                                 QObject **obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+    QString *json = qobject_to_json(*obj);
+
+    json_output_add(jov, name);
+    qstring_append(jov->str, qstring_get_str(json));
+    qobject_unref(json);
+}
+
+static void json_output_type_null(Visitor *v, const char *name,
+                                  QNull **obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_add(jov, name);
+    qstring_append(jov->str, "null");
+}
+
+/* Finish writing, and return the text.
+ * The caller becomes the QString's owner, and should use
+ * qobject_unref() when done with it.  */
+static void json_output_complete(Visitor *v, void *opaque)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    /* A visit must have occurred, with each start paired with end.  */
+    assert(jov->done && QSLIST_EMPTY(&jov->stack));
+    assert(opaque == jov->result);
+
+    *jov->result = qobject_ref(jov->str);
+    jov->result = NULL;
+}
+
+static void json_output_free(Visitor *v)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+    JSONStackEntry *e;
+
+    while (!QSLIST_EMPTY(&jov->stack)) {
+        e = QSLIST_FIRST(&jov->stack);
+        QSLIST_REMOVE_HEAD(&jov->stack, node);
+        g_free(e);
+    }
+
+    qobject_unref(jov->str);
+    g_free(jov);
+}
+
+Visitor *json_output_visitor_new(QString **result)
+{
+    JSONOutputVisitor *v;
+
+    v = g_malloc0(sizeof(*v));
+
+    v->visitor.type = VISITOR_OUTPUT;
+    v->visitor.start_struct = json_output_start_struct;
+    v->visitor.end_struct = json_output_end_struct;
+    v->visitor.start_list = json_output_start_list;
+    v->visitor.next_list = json_output_next_list;
+    v->visitor.end_list = json_output_end_list;
+    v->visitor.type_int64 = json_output_type_int64;
+    v->visitor.type_uint64 = json_output_type_uint64;
+    v->visitor.type_bool = json_output_type_bool;
+    v->visitor.type_str = json_output_type_str;
+    v->visitor.type_number = json_output_type_number;
+    v->visitor.type_any = json_output_type_any;
+    v->visitor.type_null = json_output_type_null;
+    v->visitor.complete = json_output_complete;
+    v->visitor.free = json_output_free;
+
+    v->str = qstring_new();
+    *result = NULL;
+    v->result = result;
+
+    return &v->visitor;
+}
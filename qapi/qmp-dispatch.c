@@ -17,7 +17,9 @@
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qbool.h"
+#include "qemu/timer.h"
 #include "sysemu/sysemu.h"
+#include "trace.h"
 
 static QDict *qmp_dispatch_check_obj(const QObject *request, bool allow_oob,
                                      Error **errp)
@@ -84,6 +86,7 @@ static QObject *do_qmp_dispatch(QmpCommandList *cmds, QObject *request,
     QDict *args, *dict;
     QmpCommand *cmd;
     QObject *ret = NULL;
+    int64_t start, elapsed;
 
     dict = qmp_dispatch_check_obj(request, allow_oob, errp);
     if (!dict) {
@@ -128,7 +131,16 @@ static QObject *do_qmp_dispatch(QmpCommandList *cmds, QObject *request,
         qobject_ref(args);
     }
 
+    start = get_clock();
     cmd->fn(args, &ret, &local_err);
+    elapsed = get_clock() - start;
+
+    /* Out-of-band commands may run concurrently in the monitor I/O thread */
+    stat64_add(&cmd->calls, 1);
+    stat64_add(&cmd->total_ns, elapsed);
+    stat64_max(&cmd->max_ns, elapsed);
+    trace_qmp_dispatch_done(cmd->name, elapsed);
+
     if (local_err) {
         error_propagate(errp, local_err);
     } else if (cmd->options & QCO_NO_SUCCESS_RESP) {
@@ -163,6 +175,19 @@ bool qmp_is_oob(const QDict *dict)
         && !qdict_haskey(dict, "execute");
 }
 
+/*
+ * Does @dict run a command declared with 'coroutine': true?  Such a
+ * command may yield when dispatched in coroutine context, instead of
+ * blocking the thread until it is done.
+ */
+bool qmp_is_coroutine(QmpCommandList *cmds, const QDict *dict)
+{
+    const char *command = qdict_get_try_str(dict, "execute");
+    QmpCommand *cmd = command ? qmp_find_command(cmds, command) : NULL;
+
+    return cmd && (cmd->options & QCO_COROUTINE);
+}
+
 QDict *qmp_dispatch(QmpCommandList *cmds, QObject *request,
                     bool allow_oob)
 {
@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include <getopt.h>
+#include <math.h>
 
 #include "qemu-version.h"
 #include "qapi/error.h"
@@ -37,6 +38,8 @@
 #include "qemu/option.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
 #include "qom/object_interfaces.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/block-backend.h"
@@ -66,6 +69,10 @@ enum {
     OPTION_SIZE = 264,
     OPTION_PREALLOCATION = 265,
     OPTION_SHRINK = 266,
+    OPTION_STATS = 267,
+    OPTION_RW_MIX = 268,
+    OPTION_RANDOM = 269,
+    OPTION_ZIPF = 270,
 };
 
 typedef enum OutputFormat {
@@ -176,6 +183,8 @@ static void QEMU_NORETURN help(void)
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '--stats' prints the number of requests, the bytes transferred and the\n"
+           "       time spent in each stage of the conversion when it is done\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -603,6 +612,13 @@ static void dump_human_image_check(ImageCheck *check, bool quiet)
     }
 }
 
+static void check_status_cb(BlockDriverState *bs,
+                            int64_t offset, int64_t total_work_size,
+                            void *opaque)
+{
+    qemu_progress_print(100.f * offset / total_work_size, 0);
+}
+
 static int collect_image_check(BlockDriverState *bs,
                    ImageCheck *check,
                    const char *filename,
@@ -612,7 +628,9 @@ static int collect_image_check(BlockDriverState *bs,
     int ret;
     BdrvCheckResult result;
 
-    ret = bdrv_check(bs, &result, fix);
+    qemu_progress_print(0.f, 0);
+    ret = bdrv_check(bs, &result, fix, &check_status_cb, NULL);
+    qemu_progress_print(100.f, 0);
     if (ret < 0) {
         return ret;
     }
@@ -663,6 +681,7 @@ static int img_check(int argc, char **argv)
     bool writethrough;
     ImageCheck *check;
     bool quiet = false;
+    bool progress = false;
     bool image_opts = false;
     bool force_share = false;
 
@@ -682,7 +701,7 @@ static int img_check(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:r:T:qU",
+        c = getopt_long(argc, argv, ":hf:r:T:pqU",
                         long_options, &option_index);
         if (c == -1) {
             break;
@@ -718,6 +737,9 @@ static int img_check(int argc, char **argv)
         case 'T':
             cache = optarg;
             break;
+        case 'p':
+            progress = true;
+            break;
         case 'q':
             quiet = true;
             break;
@@ -742,6 +764,11 @@ static int img_check(int argc, char **argv)
     }
     filename = argv[optind++];
 
+    /* Progress is not shown in Quiet mode */
+    if (quiet) {
+        progress = false;
+    }
+
     if (output && !strcmp(output, "json")) {
         output_format = OFORMAT_JSON;
     } else if (output && !strcmp(output, "human")) {
@@ -770,8 +797,10 @@ static int img_check(int argc, char **argv)
     }
     bs = blk_bs(blk);
 
+    qemu_progress_init(progress, 1.f);
     check = g_new0(ImageCheck, 1);
     ret = collect_image_check(bs, check, filename, fmt, fix);
+    qemu_progress_end();
 
     if (ret == -ENOTSUP) {
         error_report("This image format does not support checks");
@@ -795,7 +824,9 @@ static int img_check(int argc, char **argv)
                     check->corruptions_fixed);
         }
 
+        qemu_progress_init(progress, 1.f);
         ret = collect_image_check(bs, check, filename, fmt, 0);
+        qemu_progress_end();
 
         check->leaks_fixed          = leaks_fixed;
         check->corruptions_fixed    = corruptions_fixed;
@@ -1209,41 +1240,249 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
 
 #define IO_BUF_SIZE (2 * 1024 * 1024)
 
+/* Coroutines that qemu-img compare and rebase run at once */
+#define IMG_PIPELINE_COROUTINES 8
+
+typedef struct ImgCompareState {
+    BlockBackend *blk[2];
+    const char *filename[2];
+    int64_t size[2];
+    bool strict;
+    uint64_t progress_base;
+
+    /* The region to compare, or only check for data in image @over */
+    int64_t offset;
+    int64_t end;
+    int over;
+
+    CoMutex lock;
+    int running_coroutines;
+
+    /*
+     * The lowest offset where the comparison failed, the exit status for
+     * it, and the message to print; it is only printed at the end, so that
+     * the result is the same as that of comparing in order.
+     */
+    int64_t fail_offset;
+    int fail_ret;
+    char *fail_msg;
+} ImgCompareState;
+
+typedef enum ImgCompareAction {
+    COMPARE_FAILED,
+    COMPARE_SKIP,
+    COMPARE_DATA,
+    COMPARE_EMPTY,
+} ImgCompareAction;
+
+static void GCC_FMT_ATTR(4, 5)
+compare_fail(ImgCompareState *s, int64_t offset, int ret, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (offset >= s->fail_offset) {
+        return;
+    }
+    g_free(s->fail_msg);
+    va_start(ap, fmt);
+    s->fail_msg = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+    s->fail_offset = offset;
+    s->fail_ret = ret;
+}
+
 /*
  * Check if passed sectors are empty (not allocated or contain only 0 bytes)
  *
- * Intended for use by 'qemu-img compare': Returns 0 in case sectors are
- * filled with 0, 1 if sectors contain non-zero data (this is a comparison
- * failure), and 4 on error (the exit status for read errors), after emitting
- * an error message.
+ * Records a comparison failure if the sectors contain non-zero data, or
+ * a read error (exit status 4).
  *
- * @param blk:  BlockBackend for the image
+ * @param s: The state of the comparison
+ * @param i: Which image to check
  * @param offset: Starting offset to check
  * @param bytes: Number of bytes to check
- * @param filename: Name of disk file we are checking (logging purpose)
  * @param buffer: Allocated buffer for storing read data
- * @param quiet: Flag for quiet mode
  */
-static int check_empty_sectors(BlockBackend *blk, int64_t offset,
-                               int64_t bytes, const char *filename,
-                               uint8_t *buffer, bool quiet)
+static void coroutine_fn check_empty_sectors(ImgCompareState *s, int i,
+                                             int64_t offset, int64_t bytes,
+                                             uint8_t *buffer)
 {
-    int ret = 0;
+    int ret;
     int64_t idx;
 
-    ret = blk_pread(blk, offset, buffer, bytes);
+    ret = blk_pread(s->blk[i], offset, buffer, bytes);
     if (ret < 0) {
-        error_report("Error while reading offset %" PRId64 " of %s: %s",
-                     offset, filename, strerror(-ret));
-        return 4;
+        compare_fail(s, offset, 4, "Error while reading offset %" PRId64
+                     " of %s: %s", offset, s->filename[i], strerror(-ret));
+        return;
     }
     idx = find_nonzero(buffer, bytes);
     if (idx >= 0) {
-        qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                offset + idx);
-        return 1;
+        compare_fail(s, offset + idx, 1, "Content mismatch at offset %" PRId64
+                     "!", offset + idx);
+    }
+}
+
+/*
+ * Decides from the block status of the images what to do with the range
+ * at @offset, and how long it is.  Called with s->lock held, so that the
+ * ranges are handed out in order.
+ */
+static ImgCompareAction compare_next_chunk(ImgCompareState *s,
+                                           int64_t offset, int64_t *chunk,
+                                           int *which)
+{
+    int64_t pnum[2];
+    int status[2];
+    int i;
+
+    if (s->over >= 0) {
+        status[0] = bdrv_block_status_above(blk_bs(s->blk[s->over]), NULL,
+                                            offset, s->end - offset, chunk,
+                                            NULL, NULL);
+        if (status[0] < 0) {
+            compare_fail(s, offset, 3, "Sector allocation test failed for %s",
+                         s->filename[s->over]);
+            return COMPARE_FAILED;
+        }
+        if (status[0] & BDRV_BLOCK_ALLOCATED &&
+            !(status[0] & BDRV_BLOCK_ZERO)) {
+            *chunk = MIN(*chunk, IO_BUF_SIZE);
+            *which = s->over;
+            return COMPARE_EMPTY;
+        }
+        return COMPARE_SKIP;
+    }
+
+    for (i = 0; i < 2; i++) {
+        status[i] = bdrv_block_status_above(blk_bs(s->blk[i]), NULL, offset,
+                                            s->size[i] - offset, &pnum[i],
+                                            NULL, NULL);
+        if (status[i] < 0) {
+            compare_fail(s, offset, 3, "Sector allocation test failed for %s",
+                         s->filename[i]);
+            return COMPARE_FAILED;
+        }
+    }
+    assert(pnum[0] && pnum[1]);
+    *chunk = MIN(pnum[0], pnum[1]);
+
+    if (s->strict && status[0] != status[1]) {
+        compare_fail(s, offset, 1, "Strict mode: Offset %" PRId64
+                     " block status mismatch!", offset);
+        return COMPARE_FAILED;
+    }
+    if ((status[0] & BDRV_BLOCK_ZERO) && (status[1] & BDRV_BLOCK_ZERO)) {
+        return COMPARE_SKIP;
+    }
+    if ((status[0] & BDRV_BLOCK_ALLOCATED) ==
+        (status[1] & BDRV_BLOCK_ALLOCATED)) {
+        if (!(status[0] & BDRV_BLOCK_ALLOCATED)) {
+            return COMPARE_SKIP;
+        }
+        *chunk = MIN(*chunk, IO_BUF_SIZE);
+        return COMPARE_DATA;
+    }
+    *chunk = MIN(*chunk, IO_BUF_SIZE);
+    *which = status[0] & BDRV_BLOCK_ALLOCATED ? 0 : 1;
+    return COMPARE_EMPTY;
+}
+
+static void coroutine_fn compare_co(void *opaque)
+{
+    ImgCompareState *s = opaque;
+    uint8_t *buf1 = blk_blockalign(s->blk[0], IO_BUF_SIZE);
+    uint8_t *buf2 = blk_blockalign(s->blk[1], IO_BUF_SIZE);
+
+    s->running_coroutines++;
+    while (1) {
+        ImgCompareAction action;
+        int64_t offset, chunk, pnum;
+        int which, ret;
+
+        qemu_co_mutex_lock(&s->lock);
+        /* Nothing after a failure matters */
+        if (s->offset >= s->end || s->offset >= s->fail_offset) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        offset = s->offset;
+        action = compare_next_chunk(s, offset, &chunk, &which);
+        if (action != COMPARE_FAILED) {
+            s->offset += chunk;
+        }
+        qemu_co_mutex_unlock(&s->lock);
+
+        switch (action) {
+        case COMPARE_FAILED:
+        case COMPARE_SKIP:
+            break;
+        case COMPARE_DATA:
+            ret = blk_pread(s->blk[0], offset, buf1, chunk);
+            if (ret < 0) {
+                compare_fail(s, offset, 4, "Error while reading offset %"
+                             PRId64 " of %s: %s", offset, s->filename[0],
+                             strerror(-ret));
+                break;
+            }
+            ret = blk_pread(s->blk[1], offset, buf2, chunk);
+            if (ret < 0) {
+                compare_fail(s, offset, 4, "Error while reading offset %"
+                             PRId64 " of %s: %s", offset, s->filename[1],
+                             strerror(-ret));
+                break;
+            }
+            ret = compare_buffers(buf1, buf2, chunk, &pnum);
+            if (ret || pnum != chunk) {
+                compare_fail(s, offset + (ret ? 0 : pnum), 1,
+                             "Content mismatch at offset %" PRId64 "!",
+                             offset + (ret ? 0 : pnum));
+            }
+            break;
+        case COMPARE_EMPTY:
+            check_empty_sectors(s, which, offset, chunk, buf1);
+            break;
+        }
+        if (action != COMPARE_FAILED) {
+            qemu_progress_print(((float) chunk / s->progress_base) * 100, 100);
+        }
+    }
+
+    qemu_vfree(buf1);
+    qemu_vfree(buf2);
+    s->running_coroutines--;
+}
+
+/*
+ * Compares [@start, @end) of the images, or only checks image @over for
+ * data there if @over is not -1.  Returns 0 if they do not differ, or the
+ * exit status of qemu-img compare after printing why.
+ */
+static int compare_run(ImgCompareState *s, int64_t start, int64_t end,
+                       int over, bool quiet)
+{
+    int i;
+
+    s->offset = start;
+    s->end = end;
+    s->over = over;
+    for (i = 0; i < IMG_PIPELINE_COROUTINES; i++) {
+        qemu_coroutine_enter(qemu_coroutine_create(compare_co, s));
+    }
+    while (s->running_coroutines) {
+        main_loop_wait(false);
     }
 
+    if (s->fail_msg) {
+        if (s->fail_ret == 1) {
+            qprintf(quiet, "%s\n", s->fail_msg);
+        } else {
+            error_report("%s", s->fail_msg);
+        }
+        g_free(s->fail_msg);
+        s->fail_msg = NULL;
+        return s->fail_ret;
+    }
     return 0;
 }
 
@@ -1258,18 +1497,13 @@ static int img_compare(int argc, char **argv)
 {
     const char *fmt1 = NULL, *fmt2 = NULL, *cache, *filename1, *filename2;
     BlockBackend *blk1, *blk2;
-    BlockDriverState *bs1, *bs2;
     int64_t total_size1, total_size2;
-    uint8_t *buf1 = NULL, *buf2 = NULL;
-    int64_t pnum1, pnum2;
-    int allocated1, allocated2;
+    ImgCompareState s;
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
     bool writethrough;
     int64_t total_size;
-    int64_t offset = 0;
-    int64_t chunk;
     int c;
     uint64_t progress_base;
     bool image_opts = false;
@@ -1378,11 +1612,7 @@ static int img_compare(int argc, char **argv)
         ret = 2;
         goto out2;
     }
-    bs1 = blk_bs(blk1);
-    bs2 = blk_bs(blk2);
 
-    buf1 = blk_blockalign(blk1, IO_BUF_SIZE);
-    buf2 = blk_blockalign(blk2, IO_BUF_SIZE);
     total_size1 = blk_getlength(blk1);
     if (total_size1 < 0) {
         error_report("Can't get size of %s: %s",
@@ -1400,6 +1630,16 @@ static int img_compare(int argc, char **argv)
     total_size = MIN(total_size1, total_size2);
     progress_base = MAX(total_size1, total_size2);
 
+    s = (ImgCompareState) {
+        .blk            = { blk1, blk2 },
+        .filename       = { filename1, filename2 },
+        .size           = { total_size1, total_size2 },
+        .strict         = strict,
+        .progress_base  = progress_base,
+        .fail_offset    = INT64_MAX,
+    };
+    qemu_co_mutex_init(&s.lock);
+
     qemu_progress_print(0, 100);
 
     if (strict && total_size1 != total_size2) {
@@ -1408,122 +1648,17 @@ static int img_compare(int argc, char **argv)
         goto out;
     }
 
-    while (offset < total_size) {
-        int status1, status2;
-
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
-        if (status1 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename1);
-            goto out;
-        }
-        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
-
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
-        if (status2 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename2);
-            goto out;
-        }
-        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
-
-        assert(pnum1 && pnum2);
-        chunk = MIN(pnum1, pnum2);
-
-        if (strict) {
-            if (status1 != status2) {
-                ret = 1;
-                qprintf(quiet, "Strict mode: Offset %" PRId64
-                        " block status mismatch!\n", offset);
-                goto out;
-            }
-        }
-        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
-            /* nothing to do */
-        } else if (allocated1 == allocated2) {
-            if (allocated1) {
-                int64_t pnum;
-
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, buf1, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, buf2, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_buffers(buf1, buf2, chunk, &pnum);
-                if (ret || pnum != chunk) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            offset + (ret ? 0 : pnum));
-                    ret = 1;
-                    goto out;
-                }
-            }
-        } else {
-            chunk = MIN(chunk, IO_BUF_SIZE);
-            if (allocated1) {
-                ret = check_empty_sectors(blk1, offset, chunk,
-                                          filename1, buf1, quiet);
-            } else {
-                ret = check_empty_sectors(blk2, offset, chunk,
-                                          filename2, buf1, quiet);
-            }
-            if (ret) {
-                goto out;
-            }
-        }
-        offset += chunk;
-        qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+    ret = compare_run(&s, 0, total_size, -1, quiet);
+    if (ret) {
+        goto out;
     }
 
     if (total_size1 != total_size2) {
-        BlockBackend *blk_over;
-        const char *filename_over;
-
         qprintf(quiet, "Warning: Image size mismatch!\n");
-        if (total_size1 > total_size2) {
-            blk_over = blk1;
-            filename_over = filename1;
-        } else {
-            blk_over = blk2;
-            filename_over = filename2;
-        }
-
-        while (offset < progress_base) {
-            ret = bdrv_block_status_above(blk_bs(blk_over), NULL, offset,
-                                          progress_base - offset, &chunk,
-                                          NULL, NULL);
-            if (ret < 0) {
-                ret = 3;
-                error_report("Sector allocation test failed for %s",
-                             filename_over);
-                goto out;
-
-            }
-            if (ret & BDRV_BLOCK_ALLOCATED && !(ret & BDRV_BLOCK_ZERO)) {
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = check_empty_sectors(blk_over, offset, chunk,
-                                          filename_over, buf1, quiet);
-                if (ret) {
-                    goto out;
-                }
-            }
-            offset += chunk;
-            qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+        ret = compare_run(&s, total_size, progress_base,
+                          total_size1 > total_size2 ? 0 : 1, quiet);
+        if (ret) {
+            goto out;
         }
     }
 
@@ -1531,8 +1666,6 @@ static int img_compare(int argc, char **argv)
     ret = 0;
 
 out:
-    qemu_vfree(buf1);
-    qemu_vfree(buf2);
     blk_unref(blk2);
 out2:
     blk_unref(blk1);
@@ -1550,6 +1683,21 @@ enum ImgConvertBlockStatus {
 
 #define MAX_COROUTINES 16
 
+typedef enum ImgConvertStage {
+    CONVERT_STAGE_BLOCK_STATUS,
+    CONVERT_STAGE_READ,
+    CONVERT_STAGE_WRITE,
+    CONVERT_STAGE_WRITE_ZEROES,
+    CONVERT_STAGE_COPY_RANGE,
+    CONVERT_STAGE__MAX,
+} ImgConvertStage;
+
+typedef struct ImgConvertStageStats {
+    int64_t requests;
+    int64_t bytes;
+    int64_t busy_ns; /* summed up duration of the requests */
+} ImgConvertStageStats;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1579,8 +1727,54 @@ typedef struct ImgConvertState {
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+    bool stats;
+    int64_t start_ns;
+    ImgConvertStageStats stage_stats[CONVERT_STAGE__MAX];
 } ImgConvertState;
 
+static void convert_stage_account(ImgConvertState *s, ImgConvertStage stage,
+                                  int64_t bytes, int64_t start_ns)
+{
+    ImgConvertStageStats *st = &s->stage_stats[stage];
+
+    st->requests++;
+    st->bytes += bytes;
+    st->busy_ns += get_clock() - start_ns;
+}
+
+static void convert_print_stats(ImgConvertState *s)
+{
+    static const char *const stage_names[CONVERT_STAGE__MAX] = {
+        [CONVERT_STAGE_BLOCK_STATUS]    = "block-status",
+        [CONVERT_STAGE_READ]            = "read",
+        [CONVERT_STAGE_WRITE]           = "write",
+        [CONVERT_STAGE_WRITE_ZEROES]    = "write-zeroes",
+        [CONVERT_STAGE_COPY_RANGE]      = "copy-range",
+    };
+    int64_t elapsed_ns = MAX(get_clock() - s->start_ns, 1);
+    int i;
+
+    printf("Converted in %.3f s using %ld coroutines\n",
+           elapsed_ns / 1e9, s->num_coroutines);
+    printf("%-14s %10s %16s %12s %14s %12s\n", "stage", "requests",
+           "bytes", "busy (s)", "latency (us)", "MiB/s");
+    for (i = 0; i < CONVERT_STAGE__MAX; i++) {
+        ImgConvertStageStats *st = &s->stage_stats[i];
+
+        if (!st->requests) {
+            continue;
+        }
+        /*
+         * The coroutines overlap, so the busy time of a stage can exceed the
+         * elapsed time; the throughput is relative to the elapsed time.
+         */
+        printf("%-14s %10" PRId64 " %16" PRId64 " %12.3f %14.1f %12.1f\n",
+               stage_names[i], st->requests, st->bytes, st->busy_ns / 1e9,
+               st->busy_ns / 1e3 / st->requests,
+               (double)st->bytes / MiB * 1e9 / elapsed_ns);
+    }
+}
+
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
@@ -1616,6 +1810,7 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 
     if (s->sector_next_status <= sector_num) {
         int64_t count = n * BDRV_SECTOR_SIZE;
+        int64_t start_ns = get_clock();
 
         if (s->target_has_backing) {
 
@@ -1634,6 +1829,7 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
                          ": %s", sector_num, strerror(-ret));
             return ret;
         }
+        convert_stage_account(s, CONVERT_STAGE_BLOCK_STATUS, count, start_ns);
         n = DIV_ROUND_UP(count, BDRV_SECTOR_SIZE);
 
         if (ret & BDRV_BLOCK_ZERO) {
@@ -1678,6 +1874,7 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
         BlockBackend *blk;
         int src_cur;
         int64_t bs_sectors, src_cur_offset;
+        int64_t start_ns = get_clock();
 
         /* In the case of compression with multiple source files, we can get a
          * nb_sectors that spreads into the next part. So we must be able to
@@ -1695,6 +1892,8 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
         if (ret < 0) {
             return ret;
         }
+        convert_stage_account(s, CONVERT_STAGE_READ, n << BDRV_SECTOR_BITS,
+                              start_ns);
 
         sector_num += n;
         nb_sectors -= n;
@@ -1715,6 +1914,7 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
     while (nb_sectors > 0) {
         int n = nb_sectors;
         BdrvRequestFlags flags = s->compressed ? BDRV_REQ_WRITE_COMPRESSED : 0;
+        int64_t start_ns = get_clock();
 
         switch (status) {
         case BLK_BACKING_FILE:
@@ -1745,6 +1945,8 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                 if (ret < 0) {
                     return ret;
                 }
+                convert_stage_account(s, CONVERT_STAGE_WRITE,
+                                      n << BDRV_SECTOR_BITS, start_ns);
                 break;
             }
             /* fall-through */
@@ -1761,6 +1963,8 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
             if (ret < 0) {
                 return ret;
             }
+            convert_stage_account(s, CONVERT_STAGE_WRITE_ZEROES,
+                                  n << BDRV_SECTOR_BITS, start_ns);
             break;
         }
 
@@ -1782,6 +1986,7 @@ static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector
         int src_cur;
         int64_t bs_sectors, src_cur_offset;
         int64_t offset;
+        int64_t start_ns = get_clock();
 
         convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
         offset = (sector_num - src_cur_offset) << BDRV_SECTOR_BITS;
@@ -1796,6 +2001,8 @@ static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector
         if (ret < 0) {
             return ret;
         }
+        convert_stage_account(s, CONVERT_STAGE_COPY_RANGE,
+                              n << BDRV_SECTOR_BITS, start_ns);
 
         sector_num += n;
         nb_sectors -= n;
@@ -1927,6 +2134,8 @@ static int convert_do_copy(ImgConvertState *s)
     int ret, i, n;
     int64_t sector_num = 0;
 
+    s->start_ns = get_clock();
+
     /* Check whether we have zero initialisation or can get it efficiently */
     s->has_zero_init = s->min_sparse && !s->target_has_backing
                      ? bdrv_has_zero_init(blk_bs(s->target))
@@ -2027,6 +2236,7 @@ static int img_convert(int argc, char **argv)
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
             {"force-share", no_argument, 0, 'U'},
             {"target-image-opts", no_argument, 0, OPTION_TARGET_IMAGE_OPTS},
+            {"stats", no_argument, 0, OPTION_STATS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:Cco:l:S:pt:T:qnm:WU",
@@ -2147,6 +2357,9 @@ static int img_convert(int argc, char **argv)
         case OPTION_TARGET_IMAGE_OPTS:
             tgt_image_opts = true;
             break;
+        case OPTION_STATS:
+            s.stats = true;
+            break;
         }
     }
 
@@ -2457,6 +2670,9 @@ out:
         qemu_progress_print(100, 0);
     }
     qemu_progress_end();
+    if (!ret && s.stats && !quiet) {
+        convert_print_stats(&s);
+    }
     qemu_opts_del(opts);
     qemu_opts_free(create_opts);
     qemu_opts_del(sn_opts);
@@ -3154,11 +3370,158 @@ static int img_snapshot(int argc, char **argv)
     return 0;
 }
 
+typedef struct ImgRebaseState {
+    BlockBackend *blk;
+    BlockBackend *blk_old_backing;
+    BlockBackend *blk_new_backing;    /* NULL if there is none */
+    int64_t size;
+    int64_t old_backing_size;
+    int64_t new_backing_size;
+
+    int64_t offset;                   /* next range to look at */
+    CoMutex lock;
+    int running_coroutines;
+    int ret;
+} ImgRebaseState;
+
+/*
+ * Reads @n bytes at @offset of a backing file into @buf, or only zeroes
+ * them if its block status says they read as zeroes.  Returns -errno,
+ * 0 if it read data, or 1 if the bytes are zero.
+ */
+static int coroutine_fn rebase_read_backing(BlockBackend *blk,
+                                            int64_t offset, int64_t n,
+                                            uint8_t *buf)
+{
+    int64_t pnum;
+    int ret;
+
+    ret = bdrv_block_status_above(blk_bs(blk), NULL, offset, n, &pnum,
+                                  NULL, NULL);
+    if (ret >= 0 && (ret & BDRV_BLOCK_ZERO) && pnum == n) {
+        memset(buf, 0, n);
+        return 1;
+    }
+
+    ret = blk_pread(blk, offset, buf, n);
+    return ret < 0 ? ret : 0;
+}
+
+static void coroutine_fn rebase_co(void *opaque)
+{
+    ImgRebaseState *s = opaque;
+    uint8_t *buf_old = blk_blockalign(s->blk, IO_BUF_SIZE);
+    uint8_t *buf_new = blk_blockalign(s->blk, IO_BUF_SIZE);
+    float local_progress = 0;
+    int ret;
+
+    if (s->size != 0) {
+        local_progress = (float)100 / (s->size / MIN(s->size, IO_BUF_SIZE));
+    }
+
+    s->running_coroutines++;
+    while (1) {
+        int64_t offset, n;
+        uint64_t written = 0;
+        bool old_zero, new_zero;
+
+        /* Find the next range that is not allocated in the COW file */
+        qemu_co_mutex_lock(&s->lock);
+        while (s->ret == -EINPROGRESS && s->offset < s->size) {
+            /* How many bytes can we handle with the next read? */
+            n = MIN(IO_BUF_SIZE, s->size - s->offset);
+
+            /* If the cluster is allocated, we don't need to take action */
+            ret = bdrv_is_allocated(blk_bs(s->blk), s->offset, n, &n);
+            if (ret < 0) {
+                error_report("error while reading image metadata: %s",
+                             strerror(-ret));
+                s->ret = ret;
+                break;
+            }
+            if (!ret) {
+                break;
+            }
+            s->offset += n;
+        }
+        if (s->ret != -EINPROGRESS || s->offset >= s->size) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        offset = s->offset;
+
+        /*
+         * Take into consideration that backing files may be smaller than
+         * the COW image.
+         */
+        if (offset < s->old_backing_size) {
+            n = MIN(n, s->old_backing_size - offset);
+        }
+        if (s->blk_new_backing && offset < s->new_backing_size) {
+            n = MIN(n, s->new_backing_size - offset);
+        }
+        s->offset += n;
+        qemu_co_mutex_unlock(&s->lock);
+
+        /* Read old and new backing file, unless they read as zeroes */
+        if (offset >= s->old_backing_size) {
+            memset(buf_old, 0, n);
+            old_zero = true;
+        } else {
+            ret = rebase_read_backing(s->blk_old_backing, offset, n, buf_old);
+            if (ret < 0) {
+                error_report("error while reading from old backing file");
+                s->ret = ret;
+                break;
+            }
+            old_zero = ret;
+        }
+
+        if (offset >= s->new_backing_size || !s->blk_new_backing) {
+            memset(buf_new, 0, n);
+            new_zero = true;
+        } else {
+            ret = rebase_read_backing(s->blk_new_backing, offset, n, buf_new);
+            if (ret < 0) {
+                error_report("error while reading from new backing file");
+                s->ret = ret;
+                break;
+            }
+            new_zero = ret;
+        }
+
+        /* If they differ, we need to write to the COW file */
+        while (!(old_zero && new_zero) && written < n) {
+            int64_t pnum;
+
+            if (compare_buffers(buf_old + written, buf_new + written,
+                                n - written, &pnum))
+            {
+                ret = blk_pwrite(s->blk, offset + written,
+                                 buf_old + written, pnum, 0);
+                if (ret < 0) {
+                    error_report("Error while writing to COW image: %s",
+                        strerror(-ret));
+                    s->ret = ret;
+                    break;
+                }
+            }
+
+            written += pnum;
+        }
+        qemu_progress_print(local_progress, 100);
+    }
+
+    qemu_vfree(buf_old);
+    qemu_vfree(buf_new);
+    if (--s->running_coroutines == 0 && s->ret == -EINPROGRESS) {
+        s->ret = 0;
+    }
+}
+
 static int img_rebase(int argc, char **argv)
 {
     BlockBackend *blk = NULL, *blk_old_backing = NULL, *blk_new_backing = NULL;
-    uint8_t *buf_old = NULL;
-    uint8_t *buf_new = NULL;
     BlockDriverState *bs = NULL;
     char *filename;
     const char *fmt, *cache, *src_cache, *out_basefmt, *out_baseimg;
@@ -3381,12 +3744,8 @@ static int img_rebase(int argc, char **argv)
         int64_t size;
         int64_t old_backing_size;
         int64_t new_backing_size = 0;
-        uint64_t offset;
-        int64_t n;
-        float local_progress = 0;
-
-        buf_old = blk_blockalign(blk, IO_BUF_SIZE);
-        buf_new = blk_blockalign(blk, IO_BUF_SIZE);
+        ImgRebaseState rs;
+        int i;
 
         size = blk_getlength(blk);
         if (size < 0) {
@@ -3415,78 +3774,25 @@ static int img_rebase(int argc, char **argv)
             }
         }
 
-        if (size != 0) {
-            local_progress = (float)100 / (size / MIN(size, IO_BUF_SIZE));
+        rs = (ImgRebaseState) {
+            .blk                = blk,
+            .blk_old_backing    = blk_old_backing,
+            .blk_new_backing    = blk_new_backing,
+            .size               = size,
+            .old_backing_size   = old_backing_size,
+            .new_backing_size   = new_backing_size,
+            .ret                = -EINPROGRESS,
+        };
+        qemu_co_mutex_init(&rs.lock);
+        for (i = 0; i < IMG_PIPELINE_COROUTINES; i++) {
+            qemu_coroutine_enter(qemu_coroutine_create(rebase_co, &rs));
         }
-
-        for (offset = 0; offset < size; offset += n) {
-            /* How many bytes can we handle with the next read? */
-            n = MIN(IO_BUF_SIZE, size - offset);
-
-            /* If the cluster is allocated, we don't need to take action */
-            ret = bdrv_is_allocated(bs, offset, n, &n);
-            if (ret < 0) {
-                error_report("error while reading image metadata: %s",
-                             strerror(-ret));
-                goto out;
-            }
-            if (ret) {
-                continue;
-            }
-
-            /*
-             * Read old and new backing file and take into consideration that
-             * backing files may be smaller than the COW image.
-             */
-            if (offset >= old_backing_size) {
-                memset(buf_old, 0, n);
-            } else {
-                if (offset + n > old_backing_size) {
-                    n = old_backing_size - offset;
-                }
-
-                ret = blk_pread(blk_old_backing, offset, buf_old, n);
-                if (ret < 0) {
-                    error_report("error while reading from old backing file");
-                    goto out;
-                }
-            }
-
-            if (offset >= new_backing_size || !blk_new_backing) {
-                memset(buf_new, 0, n);
-            } else {
-                if (offset + n > new_backing_size) {
-                    n = new_backing_size - offset;
-                }
-
-                ret = blk_pread(blk_new_backing, offset, buf_new, n);
-                if (ret < 0) {
-                    error_report("error while reading from new backing file");
-                    goto out;
-                }
-            }
-
-            /* If they differ, we need to write to the COW file */
-            uint64_t written = 0;
-
-            while (written < n) {
-                int64_t pnum;
-
-                if (compare_buffers(buf_old + written, buf_new + written,
-                                    n - written, &pnum))
-                {
-                    ret = blk_pwrite(blk, offset + written,
-                                     buf_old + written, pnum, 0);
-                    if (ret < 0) {
-                        error_report("Error while writing to COW image: %s",
-                            strerror(-ret));
-                        goto out;
-                    }
-                }
-
-                written += pnum;
-            }
-            qemu_progress_print(local_progress, 100);
+        while (rs.running_coroutines) {
+            main_loop_wait(false);
+        }
+        ret = rs.ret;
+        if (ret < 0) {
+            goto out;
         }
     }
 
@@ -3523,8 +3829,6 @@ out:
         blk_unref(blk_old_backing);
         blk_unref(blk_new_backing);
     }
-    qemu_vfree(buf_old);
-    qemu_vfree(buf_new);
 
     blk_unref(blk);
     if (ret) {
@@ -3966,10 +4270,34 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+/*
+ * Request latencies, in buckets of 1/16 of a power of two of nanoseconds
+ * (the first 16 are one nanosecond each)
+ */
+#define BENCH_LAT_SUB_BITS  4
+#define BENCH_LAT_BUCKETS ((64 - BENCH_LAT_SUB_BITS + 1) << BENCH_LAT_SUB_BITS)
+
+typedef struct BenchLatency {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[BENCH_LAT_BUCKETS];
+} BenchLatency;
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchReq {
+    BenchData *b;
+    QEMUIOVector *qiov;
+    bool write;
+    int64_t start_ns;
+} BenchReq;
+
+struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
     bool write;
+    int read_pct;           /* of the requests of a write test */
     int bufsize;
     int step;
     int nrreq;
@@ -3979,10 +4307,149 @@ typedef struct BenchData {
     uint8_t *buf;
     QEMUIOVector *qiov;
 
+    /* Random offsets, uniform or with a Zipf distribution if zipf_theta */
+    bool random;
+    GRand *rand;
+    uint64_t nr_blocks;
+    double zipf_theta;
+    double zipf_zetan;
+    double zipf_alpha;
+    double zipf_eta;
+
+    BenchReq *reqs;
+    BenchReq **free_reqs;
+    int nr_free_reqs;
+    BenchLatency lat_read;
+    BenchLatency lat_write;
+
     int in_flight;
     bool in_flush;
     uint64_t offset;
-} BenchData;
+};
+
+static int bench_lat_bucket(uint64_t ns)
+{
+    int msb;
+
+    if (ns < (1 << BENCH_LAT_SUB_BITS)) {
+        return ns;
+    }
+    msb = 63 - clz64(ns);
+    return ((msb - BENCH_LAT_SUB_BITS + 1) << BENCH_LAT_SUB_BITS) +
+           ((ns >> (msb - BENCH_LAT_SUB_BITS)) &
+            ((1 << BENCH_LAT_SUB_BITS) - 1));
+}
+
+/* The lowest latency that falls into @bucket */
+static uint64_t bench_lat_bucket_ns(int bucket)
+{
+    int msb = (bucket >> BENCH_LAT_SUB_BITS) + BENCH_LAT_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << BENCH_LAT_SUB_BITS) - 1);
+
+    if (bucket < (1 << BENCH_LAT_SUB_BITS)) {
+        return bucket;
+    }
+    return (1ULL << msb) | (sub << (msb - BENCH_LAT_SUB_BITS));
+}
+
+static void bench_lat_add(BenchLatency *lat, uint64_t ns)
+{
+    lat->count++;
+    lat->total_ns += ns;
+    lat->max_ns = MAX(lat->max_ns, ns);
+    lat->buckets[bench_lat_bucket(ns)]++;
+}
+
+static uint64_t bench_lat_percentile(const BenchLatency *lat, double pct)
+{
+    uint64_t rank = MAX(1, (uint64_t)(lat->count * pct / 100 + 0.5));
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < BENCH_LAT_BUCKETS; i++) {
+        seen += lat->buckets[i];
+        if (seen >= rank) {
+            return MIN(bench_lat_bucket_ns(i), lat->max_ns);
+        }
+    }
+    return lat->max_ns;
+}
+
+static void bench_lat_print(const char *name, const BenchLatency *lat)
+{
+    static const double pcts[] = { 50, 90, 99, 99.9, 99.99 };
+    int i;
+
+    if (!lat->count) {
+        return;
+    }
+    printf("%s: %" PRIu64 " requests, latency (us): avg %.1f", name,
+           lat->count, (double)lat->total_ns / lat->count / SCALE_US);
+    for (i = 0; i < ARRAY_SIZE(pcts); i++) {
+        printf(", p%g %.1f", pcts[i],
+               (double)bench_lat_percentile(lat, pcts[i]) / SCALE_US);
+    }
+    printf(", max %.1f\n", (double)lat->max_ns / SCALE_US);
+}
+
+/*
+ * Constants for a Zipf distribution over nr_blocks ranks, as in Gray et
+ * al., "Quickly Generating Billion-Record Synthetic Databases"
+ */
+static void bench_zipf_init(BenchData *b)
+{
+    double theta = b->zipf_theta;
+    double zeta2 = 1 + pow(0.5, theta);
+    uint64_t i;
+
+    b->zipf_zetan = 0;
+    for (i = 1; i <= b->nr_blocks; i++) {
+        b->zipf_zetan += pow(1.0 / i, theta);
+    }
+    b->zipf_alpha = 1 / (1 - theta);
+    b->zipf_eta = (1 - pow(2.0 / b->nr_blocks, 1 - theta)) /
+                  (1 - zeta2 / b->zipf_zetan);
+}
+
+static uint64_t bench_zipf_next(BenchData *b)
+{
+    double u = g_rand_double(b->rand);
+    double uz = u * b->zipf_zetan;
+    uint64_t rank;
+
+    if (uz < 1) {
+        rank = 0;
+    } else if (uz < 1 + pow(0.5, b->zipf_theta)) {
+        rank = 1;
+    } else {
+        rank = b->nr_blocks * pow(b->zipf_eta * u - b->zipf_eta + 1,
+                                  b->zipf_alpha);
+        rank = MIN(rank, b->nr_blocks - 1);
+    }
+
+    /* Spread the popular blocks over the image instead of its start */
+    return (rank * 0x9e3779b97f4a7c15ULL) % b->nr_blocks;
+}
+
+static int64_t bench_next_offset(BenchData *b)
+{
+    int64_t offset = b->offset;
+    uint64_t block;
+
+    if (!b->random) {
+        b->offset += b->step;
+        b->offset %= b->image_size;
+        return offset;
+    }
+
+    if (b->zipf_theta) {
+        block = bench_zipf_next(b);
+    } else {
+        block = ((uint64_t)g_rand_int(b->rand) << 32 | g_rand_int(b->rand))
+                % b->nr_blocks;
+    }
+    return block * b->step;
+}
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
@@ -3992,6 +4459,19 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
+static void bench_cb(void *opaque, int ret);
+
+static void bench_rw_cb(void *opaque, int ret)
+{
+    BenchReq *req = opaque;
+    BenchData *b = req->b;
+    int64_t ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - req->start_ns;
+
+    bench_lat_add(req->write ? &b->lat_write : &b->lat_read, ns);
+    b->free_reqs[b->nr_free_reqs++] = req;
+    bench_cb(b, ret);
+}
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
@@ -4037,18 +4517,25 @@ static void bench_cb(void *opaque, int ret)
     }
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
+        int64_t offset = bench_next_offset(b);
+        BenchReq *req;
+
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        assert(b->nr_free_reqs > 0);
+        req = b->free_reqs[--b->nr_free_reqs];
+        req->write = b->write &&
+                     g_rand_int_range(b->rand, 0, 100) >= b->read_pct;
+        req->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        if (req->write) {
+            acb = blk_aio_pwritev(b->blk, offset, req->qiov, 0,
+                                  bench_rw_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, req->qiov, 0,
+                                 bench_rw_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4072,6 +4559,9 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    int read_pct = -1;
+    bool random = false;
+    double zipf_theta = 0;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
@@ -4086,9 +4576,13 @@ static int img_bench(int argc, char **argv)
         static const struct option long_options[] = {
             {"help", no_argument, 0, 'h'},
             {"flush-interval", required_argument, 0, OPTION_FLUSH_INTERVAL},
+            {"object", required_argument, 0, OPTION_OBJECT},
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
+            {"rw-mix", required_argument, 0, OPTION_RW_MIX},
+            {"random", no_argument, 0, OPTION_RANDOM},
+            {"zipf", required_argument, 0, OPTION_ZIPF},
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
@@ -4214,6 +4708,37 @@ static int img_bench(int argc, char **argv)
         case OPTION_NO_DRAIN:
             drain_on_flush = false;
             break;
+        case OPTION_RW_MIX:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid read percentage specified");
+                return 1;
+            }
+            read_pct = res;
+            break;
+        }
+        case OPTION_RANDOM:
+            random = true;
+            break;
+        case OPTION_ZIPF:
+            if (qemu_strtod(optarg, NULL, &zipf_theta) < 0 ||
+                !(zipf_theta > 0 && zipf_theta < 1)) {
+                error_report("Invalid Zipf theta specified "
+                             "(expecting a number between 0 and 1)");
+                return 1;
+            }
+            random = true;
+            break;
+        case OPTION_OBJECT: {
+            QemuOpts *opts;
+            opts = qemu_opts_parse_noisily(&qemu_object_opts,
+                                           optarg, true);
+            if (!opts) {
+                return 1;
+            }
+        }   break;
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
@@ -4225,11 +4750,22 @@ static int img_bench(int argc, char **argv)
     }
     filename = argv[argc - 1];
 
+    if (qemu_opts_foreach(&qemu_object_opts,
+                          user_creatable_add_opts_foreach,
+                          NULL, &error_fatal)) {
+        return 1;
+    }
+
     if (!is_write && flush_interval) {
         error_report("--flush-interval is only available in write tests");
         ret = -1;
         goto out;
     }
+    if (!is_write && read_pct >= 0) {
+        error_report("--rw-mix is only available in write tests");
+        ret = -1;
+        goto out;
+    }
     if (flush_interval && flush_interval < depth) {
         error_report("Flush interval can't be smaller than depth");
         ret = -1;
@@ -4260,11 +4796,36 @@ static int img_bench(int argc, char **argv)
         .write          = is_write,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
+        .read_pct       = MAX(read_pct, 0),
+        .random         = random,
+        /* Fixed seed, so that runs can be compared */
+        .rand           = g_rand_new_with_seed(0x5eed),
+        .zipf_theta     = zipf_theta,
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
+    if (random) {
+        if (image_size < data.bufsize) {
+            error_report("Image is smaller than the buffer size");
+            ret = -1;
+            goto out;
+        }
+        data.nr_blocks = (image_size - data.bufsize) / data.step + 1;
+        if (zipf_theta) {
+            bench_zipf_init(&data);
+        }
+        printf("Sending %d %s requests, %d bytes each, %d in parallel "
+               "(%s offsets, multiples of %d)\n",
+               data.n, data.write ? "write" : "read", data.bufsize,
+               data.nrreq, zipf_theta ? "Zipf distributed" : "random",
+               data.step);
+    } else {
+        printf("Sending %d %s requests, %d bytes each, %d in parallel "
+               "(starting at offset %" PRId64 ", step size %d)\n",
+               data.n, data.write ? "write" : "read", data.bufsize,
+               data.nrreq, data.offset, data.step);
+    }
+    if (data.write && data.read_pct) {
+        printf("Making %d%% of them reads\n", data.read_pct);
+    }
     if (flush_interval) {
         printf("Sending flush every %d requests\n", flush_interval);
     }
@@ -4276,11 +4837,19 @@ static int img_bench(int argc, char **argv)
     blk_register_buf(blk, data.buf, buf_size);
 
     data.qiov = g_new(QEMUIOVector, data.nrreq);
+    data.reqs = g_new(BenchReq, data.nrreq);
+    data.free_reqs = g_new(BenchReq *, data.nrreq);
     for (i = 0; i < data.nrreq; i++) {
         qemu_iovec_init(&data.qiov[i], 1);
         qemu_iovec_add(&data.qiov[i],
                        data.buf + i * data.bufsize, data.bufsize);
+        data.reqs[i] = (BenchReq) {
+            .b      = &data,
+            .qiov   = &data.qiov[i],
+        };
+        data.free_reqs[i] = &data.reqs[i];
     }
+    data.nr_free_reqs = data.nrreq;
 
     gettimeofday(&t1, NULL);
     bench_cb(&data, 0);
@@ -4293,12 +4862,19 @@ static int img_bench(int argc, char **argv)
     printf("Run completed in %3.3f seconds.\n",
            (t2.tv_sec - t1.tv_sec)
            + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    bench_lat_print("Reads", &data.lat_read);
+    bench_lat_print("Writes", &data.lat_write);
 
 out:
     if (data.buf) {
         blk_unregister_buf(blk, data.buf);
     }
     qemu_vfree(data.buf);
+    g_free(data.reqs);
+    g_free(data.free_reqs);
+    if (data.rand) {
+        g_rand_free(data.rand);
+    }
     blk_unref(blk);
 
     if (ret) {
@@ -131,7 +131,7 @@ static void usage(const char *name)
 "                            '[ID_OR_NAME]'\n"
 "  -n, --nocache             disable host cache\n"
 "      --cache=MODE          set cache mode (none, writeback, ...)\n"
-"      --aio=MODE            set AIO mode (native or threads)\n"
+"      --aio=MODE            set AIO mode (native, io_uring or threads)\n"
 "      --discard=MODE        set discard mode (ignore, unmap)\n"
 "      --detect-zeroes=MODE  set detect-zeroes mode (off, on, unmap)\n"
 "      --image-opts          treat FILE as a full set of image options\n"
@@ -311,6 +311,9 @@ static int qemu_nbd_client_list(SocketAddress *saddr, QCryptoTLSCreds *tls,
             if (list[i].flags & NBD_FLAG_SEND_CACHE) {
                 printf(" cache");
             }
+            if (list[i].flags & NBD_FLAG_SEND_FAST_ZERO) {
+                printf(" fast-zero");
+            }
             printf(" )\n");
         }
         if (list[i].min_block) {
@@ -726,6 +729,10 @@ int main(int argc, char **argv)
             seen_aio = true;
             if (!strcmp(optarg, "native")) {
                 flags |= BDRV_O_NATIVE_AIO;
+#ifdef CONFIG_LINUX_IO_URING
+            } else if (!strcmp(optarg, "io_uring")) {
+                flags |= BDRV_O_IO_URING;
+#endif
             } else if (!strcmp(optarg, "threads")) {
                 /* this is the default */
             } else {
@@ -1174,6 +1181,12 @@ int main(int argc, char **argv)
         fd_size = limit;
     }
 
+    /* All clients go through the same BlockBackend, so their caches are
+     * consistent and a flush from one of them covers everyone's writes */
+    if (shared > 1) {
+        nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+    }
+
     export = nbd_export_new(bs, dev_offset, fd_size, export_name,
                             export_description, bitmap, nbdflags,
                             nbd_export_closed, writethrough, NULL,
@@ -35,6 +35,7 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kernel_irqchip=on|off|split controls accelerated irqchip support (default=off)\n"
     "                vmport=on|off|auto controls emulation of vmport (default: auto)\n"
     "                kvm_shadow_mem=size of KVM shadow MMU in bytes\n"
+    "                kvm-dirty-ring-size=n number of entries of the per-vCPU KVM dirty ring (default=0)\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
     "                igd-passthru=on|off controls IGD GFX passthrough support (default=off)\n"
@@ -79,6 +80,12 @@ value based on accel. For accel=xen the default is off otherwise the default
 is on.
 @item kvm_shadow_mem=size
 Defines the size of the KVM shadow MMU.
+@item kvm-dirty-ring-size=@var{n}
+When non-zero, KVM reports dirty pages through a per-vCPU ring of @var{n}
+entries instead of a per-slot dirty bitmap, so that the cost of dirty page
+tracking grows with the number of dirtied pages rather than with the size
+of guest memory.  @var{n} must be a power of two; the host kernel may impose
+further limits.  The default of 0 uses the dirty bitmap.
 @item dump-guest-core=on|off
 Include guest memory in a core dump. The default is on.
 @item mem-merge=on|off
@@ -118,9 +125,15 @@ Select CPU model (@code{-cpu help} for list and additional feature selection)
 ETEXI
 
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
-    "-accel [accel=]accelerator[,thread=single|multi]\n"
+    "-accel [accel=]accelerator[,thread=single|multi][,hot-tb-threshold=n]\n"
+    "               [,tb-jmp-cache-bits=n][,vtlb-size=n][,halt-poll-ns=n]\n"
     "                select accelerator (kvm, xen, hax, hvf, whpx or tcg; use 'help' for a list)\n"
-    "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                hot-tb-threshold=n (retranslate TBs run n times)\n"
+    "                tb-jmp-cache-bits=n (size of the vCPU TB jump caches)\n"
+    "                vtlb-size=n (entries in each victim TLB)\n"
+    "                halt-poll-ns=n (poll n ns for wakeups of halted vCPUs)\n",
+    QEMU_ARCH_ALL)
 STEXI
 @item -accel @var{name}[,prop=@var{value}[,...]]
 @findex -accel
@@ -134,6 +147,28 @@ Controls number of TCG threads. When the TCG is multi-threaded there will be one
 thread per vCPU therefor taking advantage of additional host cores. The default
 is to enable multi-threading where both the back-end and front-ends support it and
 no incompatible TCG features have been enabled (e.g. icount/replay).
+@item hot-tb-threshold=@var{n}
+Count the executions of each TCG translation block, and translate a block
+again with extra optimizations once it has run @var{n} times.  The count
+adds a few host instructions to every block until it is retranslated.  The
+default of 0 disables counting.
+@item tb-jmp-cache-bits=@var{n}
+Set the number of entries in the cache that each vCPU uses to look up the
+translation block for a guest address to 2^@var{n}, between 2^8 and 2^20.
+The default is 2^12.  Guests with many indirect branches may benefit from a
+larger cache; "info jit" shows its hit and miss counts for each vCPU.
+@item vtlb-size=@var{n}
+Set the number of entries, between 1 and 256, of the fully associative
+victim TLB that backs each softmmu TLB.  The default is 8.  "info jit" shows
+how many TLB misses were resolved from the victim TLB for each MMU mode.
+@item halt-poll-ns=@var{n}
+Let a halted vCPU thread busy wait for up to @var{n} nanoseconds, at most
+10000000, for an interrupt before it goes to sleep.  This trades host CPU
+time for wakeup latency of guests that idle briefly and often.  The default
+of 0 disables polling.  It applies to TCG and to KVM without the in-kernel
+irqchip; the value of each vCPU can be changed at runtime through its
+"halt-poll-ns" property, and "halt-poll-successes" and "halt-poll-failures"
+count the polls that did or did not end with a wakeup.
 @end table
 ETEXI
 
@@ -161,13 +196,15 @@ ETEXI
 
 DEF("numa", HAS_ARG, QEMU_OPTION_numa,
     "-numa node[,mem=size][,cpus=firstcpu[-lastcpu]][,nodeid=node]\n"
+    "          [,host-cpus=cpu[-cpu]][,host-nodes=node[-node]]\n"
     "-numa node[,memdev=id][,cpus=firstcpu[-lastcpu]][,nodeid=node]\n"
+    "          [,host-cpus=cpu[-cpu]][,host-nodes=node[-node]]\n"
     "-numa dist,src=source,dst=destination,val=distance\n"
     "-numa cpu,node-id=node[,socket-id=x][,core-id=y][,thread-id=z]\n",
     QEMU_ARCH_ALL)
 STEXI
-@item -numa node[,mem=@var{size}][,cpus=@var{firstcpu}[-@var{lastcpu}]][,nodeid=@var{node}]
-@itemx -numa node[,memdev=@var{id}][,cpus=@var{firstcpu}[-@var{lastcpu}]][,nodeid=@var{node}]
+@item -numa node[,mem=@var{size}][,cpus=@var{firstcpu}[-@var{lastcpu}]][,nodeid=@var{node}][,host-cpus=@var{cpus}][,host-nodes=@var{nodes}]
+@itemx -numa node[,memdev=@var{id}][,cpus=@var{firstcpu}[-@var{lastcpu}]][,nodeid=@var{node}][,host-cpus=@var{cpus}][,host-nodes=@var{nodes}]
 @itemx -numa dist,src=@var{source},dst=@var{destination},val=@var{distance}
 @itemx -numa cpu,node-id=@var{node}[,socket-id=@var{x}][,core-id=@var{y}][,thread-id=@var{z}]
 @findex -numa
@@ -214,6 +251,21 @@ split equally between them.
 @samp{mem} and @samp{memdev} are mutually exclusive. Furthermore,
 if one node uses @samp{memdev}, all of them have to use it.
 
+@samp{host-cpus} and @samp{host-nodes} pin the threads of the VCPUs of
+a node to the given host CPUs, and to the CPUs of the given host NUMA
+nodes.  Together with the @samp{host-nodes} of the node's memory
+backend, this keeps the node on one host node:
+@example
+-object memory-backend-ram,id=ram0,size=4G,host-nodes=0,policy=bind \
+-numa node,memdev=ram0,cpus=0-3,host-nodes=0
+@end example
+VCPUs are not pinned with the single-threaded TCG accelerator.
+
+IOThreads are pinned in the same way with their own @samp{host-cpus}
+and @samp{host-nodes} properties, for example
+@code{-object iothread,id=io0,host-nodes=0}.  The worker threads that
+an IOThread starts for its AioContext inherit its affinity.
+
 @var{source} and @var{destination} are NUMA node IDs.
 @var{distance} is the NUMA distance from @var{source} to @var{destination}.
 The distance from a node to itself is always 10. If any pair of nodes is
@@ -1020,7 +1072,7 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "-drive [file=file][,if=type][,bus=n][,unit=m][,media=d][,index=i]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,snapshot=on|off][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -1088,7 +1140,8 @@ unsafe       │ on                off            on
 The default mode is @option{cache=writeback}.
 
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native", or "io_uring" and selects between pthread
+based disk I/O, native Linux AIO, or Linux io_uring API.
 @item format=@var{format}
 Specify which disk @var{format} will be used rather than detecting
 the format.  Can be used to specify format=raw to avoid interpreting
@@ -1916,6 +1969,15 @@ This can be really helpful to save bandwidth when playing videos. Disabling
 adaptive encodings restores the original static behavior of encodings
 like Tight.
 
+@item h264
+
+Stream the whole screen as H.264 video to clients that support the Open
+H.264 encoding while a sizable part of it is changing quickly, e.g. during
+video playback, and go back to their normal encoding, with a lossless
+refresh, once it settles.  With @option{non-adaptive} the stream is always
+used.  This requires QEMU to be built with GStreamer; hardware encoders are
+preferred over x264 and OpenH264 when available.
+
 @item share=[allow-exclusive|force-shared|ignore]
 
 Set display sharing policy.  'allow-exclusive' allows clients to ask
@@ -1937,6 +1999,14 @@ can help the device and guest to keep up and not lose events in case
 events are arriving in bulk.  Possible causes for the latter are flaky
 network connections, or scripts for automated testing.
 
+@item workers=@var{n}
+
+Use at least @var{n} threads, between 1 and 64, to encode framebuffer
+updates.  The threads are shared by all VNC displays and encode for
+different clients in parallel; the updates of a single client are always
+encoded in order by one thread at a time.  Default is 1.  Raising it helps
+when several clients view high resolution displays.
+
 @end table
 ETEXI
 
@@ -2160,6 +2230,15 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m][,busy-poll=usecs]\n"
+    "                attach to the existing network interface 'name' with AF_XDP, using\n"
+    "                'n' of its queues (default: 1) starting from 'm' (default: 0)\n"
+    "                use 'mode=native|skb' to choose the XDP attach mode (default: native,\n"
+    "                falling back to skb), use 'force-copy=on' to disable zero-copy\n"
+    "                use 'busy-poll=usecs' to let the kernel busy poll the device queues\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -2180,6 +2259,9 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
 #endif
@@ -2603,6 +2685,31 @@ vde_switch -F -sock /tmp/myswitch
 qemu-system-i386 linux.img -nic vde,sock=/tmp/myswitch
 @end example
 
+@item -netdev af-xdp,id=@var{id},ifname=@var{name}[,mode=native|skb][,force-copy=on|off][,queues=@var{n}][,start-queue=@var{m}][,busy-poll=@var{usecs}]
+Connect to the existing host network interface @var{name} with AF_XDP
+sockets, one per queue.  @option{queues} sets how many queues of the
+interface are used (default 1), starting from queue @var{m}; a multiqueue
+NIC uses one of them per queue pair.  The interface must be configured so that
+the traffic for QEMU is steered to these queues, for example with ethtool.
+
+The XDP program that redirects the packets to the sockets is attached in
+native mode if the driver supports it and in skb mode otherwise, unless
+@option{mode} asks for one of them.  Zero-copy is used when the device
+supports it, unless @option{force-copy=on}.  With
+@option{busy-poll=@var{usecs}} the kernel busy polls the device queues
+instead of waiting for interrupts.  This option is only available if QEMU
+has been compiled with AF_XDP support, and creating the sockets needs the
+CAP_NET_ADMIN and CAP_BPF (or CAP_SYS_ADMIN) capabilities.
+
+Example:
+@example
+# steer all traffic to the first two queues of eth0
+ethtool -L eth0 combined 2
+qemu-system-x86_64 linux.img \
+        -netdev af-xdp,id=n1,ifname=eth0,queues=2 \
+        -device virtio-net-pci,netdev=n1,mq=on,vectors=6
+@end example
+
 @item -netdev vhost-user,chardev=@var{id}[,vhostforce=on|off][,queues=n]
 
 Establish a vhost-user netdev, backed by a chardev @var{id}. The chardev should
@@ -3735,12 +3842,12 @@ re-inject them.
 ETEXI
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay,rrfile=<filename>,rrsnapshot=<snapshot>]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay,rrfile=<filename>,rrsnapshot=<snapshot>][,quantum=N]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping\n", QEMU_ARCH_ALL)
 STEXI
-@item -icount [shift=@var{N}|auto][,rr=record|replay,rrfile=@var{filename},rrsnapshot=@var{snapshot}]
+@item -icount [shift=@var{N}|auto][,rr=record|replay,rrfile=@var{filename},rrsnapshot=@var{snapshot}][,quantum=@var{N}]
 @findex -icount
 Enable virtual instruction counter.  The virtual cpu will execute one
 instruction every 2^@var{N} ns of virtual time.  If @code{auto} is specified
@@ -3777,6 +3884,15 @@ read from this file in replay mode.
 Option rrsnapshot is used to create new vm snapshot named @var{snapshot}
 at the start of execution recording. In replay mode this option is used
 to load the initial VM state.
+
+With @option{-accel tcg,thread=multi}, each virtual cpu runs in its own
+thread. Virtual time then advances in steps of @option{quantum}
+instructions (default 100000): each virtual cpu that is not sleeping runs
+that many instructions, and waits for the others to do the same. Timers
+expire at the end of a step, so a smaller quantum makes them more
+accurate, and a larger one lets the virtual cpus run in parallel for
+longer. Execution is not deterministic, since the virtual cpus can still
+access memory in any order, and record/replay is not available.
 ETEXI
 
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
@@ -3885,8 +4001,9 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "                specified protocol and socket address\n" \
     "-incoming fd:fd\n" \
     "-incoming exec:cmdline\n" \
-    "                accept incoming migration on given file descriptor\n" \
-    "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                accept incoming migration on given file descriptor,\n" \
+    "                from given external command or from given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -3905,6 +4022,9 @@ Accept incoming migration from a given filedescriptor.
 @item -incoming exec:@var{cmdline}
 Accept incoming migration as an output from specified external command.
 
+@item -incoming file:@var{filename}
+Accept incoming migration from a file written by @code{migrate file:}.
+
 @item -incoming defer
 Wait for the URI to be specified via migrate_incoming.  The monitor can
 be used to change settings (such as migration parameters) prior to issuing
@@ -4079,6 +4199,22 @@ HXCOMM HX does not support conditional compilation of text.
 @include qemu-option-trace.texi
 ETEXI
 
+#ifdef CONFIG_PLUGIN
+DEF("plugin", HAS_ARG, QEMU_OPTION_plugin, \
+    "-plugin [file=]<file>[,arg=<string>]\n"
+    "                load a TCG plugin\n",
+    QEMU_ARCH_ALL)
+#endif
+STEXI
+@item -plugin [file=]@var{file}[,arg=@var{string}]
+@findex -plugin
+Load a TCG instrumentation plugin from the shared object @var{file}.
+Each @var{string} is passed to the plugin as an argument, in order.
+The option can be given several times, to load several plugins.  Plugins
+write their output to the log, which @option{-d plugin} enables.  See
+@file{docs/devel/tcg-plugins.txt} for how to write one.
+ETEXI
+
 HXCOMM Internal use
 DEF("qtest", HAS_ARG, QEMU_OPTION_qtest, "", QEMU_ARCH_ALL)
 DEF("qtest-log", HAS_ARG, QEMU_OPTION_qtest_log, "", QEMU_ARCH_ALL)
@@ -4159,7 +4295,7 @@ property must be set.  These objects are placed in the
 
 @table @option
 
-@item -object memory-backend-file,id=@var{id},size=@var{size},mem-path=@var{dir},share=@var{on|off},discard-data=@var{on|off},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},align=@var{align}
+@item -object memory-backend-file,id=@var{id},size=@var{size},mem-path=@var{dir},share=@var{on|off},discard-data=@var{on|off},ram-image=@var{on|off},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},prealloc-threads=@var{threads},prealloc-async=@var{on|off},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},align=@var{align}
 
 Creates a memory file backend object, which can be used to back
 the guest RAM with huge pages.
@@ -4192,6 +4328,26 @@ that @option{discard-data} is only an optimization, and QEMU
 might not discard file contents if it aborts unexpectedly or is
 terminated using SIGKILL.
 
+Setting the @option{ram-image} boolean option to @var{on} declares that
+the file at @option{mem-path} already holds the guest RAM, e.g. because a
+template VM ran with share=on on the same file.  With share=off, each VM
+started this way maps the image privately: unchanged pages stay shared
+with its siblings through the page cache, and writes only go to private
+copies.  When migrating with the x-ignore-shared capability the image is
+not transferred, so only device state needs to be loaded:
+
+@example
+# template, once booted to the desired point
+(qemu) migrate_set_capability x-ignore-shared on
+(qemu) migrate "exec:cat > vm.state"
+# each clone, using the same mem-path with share=off,ram-image=on
+qemu ... -incoming defer
+(qemu) migrate_set_capability x-ignore-shared on
+(qemu) migrate_incoming "exec:cat vm.state"
+@end example
+
+Once the guest runs, its RAM is migrated normally again.
+
 The @option{merge} boolean option enables memory merge, also known as
 MADV_MERGEABLE, so that Kernel Samepage Merging will consider the pages for
 memory deduplication.
@@ -4200,6 +4356,16 @@ Setting the @option{dump} boolean option to @var{off} excludes the memory from
 core dumps. This feature is also known as MADV_DONTDUMP.
 
 The @option{prealloc} boolean option enables memory preallocation.
+When the memory is bound to host nodes, the preallocation threads run
+on the CPUs of those nodes.
+
+The @option{prealloc-threads} option sets the number of threads used for
+preallocation; the default is based on the number of guest and host CPUs.
+
+Setting the @option{prealloc-async} boolean option to @var{on} lets the
+preallocation of backends created on the command line continue in the
+background while the rest of the machine is created.  QEMU waits for it
+to complete, and exits if it fails, before the guest starts.
 
 The @option{host-nodes} option binds the memory range to a list of NUMA host
 nodes.
@@ -4459,7 +4625,7 @@ secondary:
 If you want to know the detail of above command line, you can read
 the colo-compare git log.
 
-@item -object cryptodev-backend-builtin,id=@var{id}[,queues=@var{queues}]
+@item -object cryptodev-backend-builtin,id=@var{id}[,queues=@var{queues}][,async=@var{on|off}][,batch-size=@var{n}]
 
 Creates a cryptodev backend which executes crypto opreation from
 the QEMU cipher APIS. The @var{id} parameter is
@@ -4468,6 +4634,11 @@ the @option{virtio-crypto} device. The @var{queues} parameter is optional,
 which specify the queue number of cryptodev backend, the default of
 @var{queues} is 1.
 
+With @option{async=on}, the operations run in worker threads instead of
+the main loop, and several requests can be in flight at once.  The requests
+that the guest queues together are handed to a worker in batches of at
+most @var{batch-size} requests, 32 by default.
+
 @example
 
  # qemu-system-x86_64 \
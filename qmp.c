@@ -717,3 +717,42 @@ MemoryInfo *qmp_query_memory_size_summary(Error **errp)
 
     return mem_info;
 }
+
+static void qmp_sync_profile_entry(void *opaque, const char *type,
+                                   const void *obj, unsigned int n_objs,
+                                   const char *callsite, uint64_t ns,
+                                   uint64_t n_acqs)
+{
+    SyncProfileEntryList ***prev = opaque;
+    SyncProfileEntryList *elem = g_new0(SyncProfileEntryList, 1);
+    SyncProfileEntry *e = g_new0(SyncProfileEntry, 1);
+
+    e->type = g_strdup(type);
+    e->call_site = g_strdup(callsite);
+    e->object = n_objs > 1 ? 0 : (uintptr_t)obj;
+    e->objects = MAX(n_objs, 1);
+    e->wait_time_ns = ns;
+    e->count = n_acqs;
+
+    elem->value = e;
+    **prev = elem;
+    *prev = &elem->next;
+}
+
+SyncProfileInfo *qmp_x_query_sync_profile(bool has_max, uint32_t max,
+                                          bool has_mean, bool mean,
+                                          bool has_coalesce, bool coalesce,
+                                          Error **errp)
+{
+    SyncProfileInfo *info = g_new0(SyncProfileInfo, 1);
+    SyncProfileEntryList **prev = &info->entries;
+
+    info->enabled = qsp_is_enabled();
+    info->sample_rate = qsp_get_sample_rate();
+    qsp_report_foreach(has_max ? max : 10,
+                       has_mean && mean ? QSP_SORT_BY_AVG_WAIT_TIME
+                                        : QSP_SORT_BY_TOTAL_WAIT_TIME,
+                       has_coalesce ? coalesce : true,
+                       qmp_sync_profile_entry, &prev);
+    return info;
+}
@@ -342,11 +342,42 @@ static void json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
     }
 }
 
-void json_lexer_feed(JSONLexer *lexer, const char *buffer, size_t size)
+/*
+ * Return how many of the @size bytes at @buffer continue the string
+ * that @lexer is in, without ending it or starting an escape sequence.
+ * These need not go through the state machine one by one.  Stay below
+ * MAX_TOKEN_SIZE so that json_lexer_feed_char() still enforces it.
+ */
+static size_t json_lexer_string_run(JSONLexer *lexer, const char *buffer,
+                                    size_t size)
 {
+    const uint8_t *state = json_lexer[lexer->state];
     size_t i;
 
+    if (lexer->state != IN_DQ_STRING && lexer->state != IN_SQ_STRING) {
+        return 0;
+    }
+    size = MIN(size, MAX_TOKEN_SIZE - MIN(lexer->token->len, MAX_TOKEN_SIZE));
+    for (i = 0; i < size && state[(uint8_t)buffer[i]] == lexer->state; i++) {
+    }
+    return i;
+}
+
+void json_lexer_feed(JSONLexer *lexer, const char *buffer, size_t size)
+{
+    size_t i, run;
+
     for (i = 0; i < size; i++) {
+        /* No newlines in strings, so only x moves */
+        run = json_lexer_string_run(lexer, buffer + i, size - i);
+        if (run) {
+            g_string_append_len(lexer->token, buffer + i, run);
+            lexer->x += run;
+            i += run;
+            if (i == size) {
+                break;
+            }
+        }
         json_lexer_feed_char(lexer, buffer[i], false);
     }
 }
@@ -144,6 +144,18 @@ static QString *parse_string(JSONParserContext *ctxt, JSONToken *token)
 
     while (*ptr != quote) {
         assert(*ptr);
+
+        /* Copy runs of plain ASCII characters in one go */
+        for (beg = ptr;
+             *ptr >= 0x20 && *ptr < 0x7F && *ptr != quote && *ptr != '\\' &&
+             *ptr != '%';
+             ptr++) {
+        }
+        if (ptr != beg) {
+            qstring_append_len(str, beg, ptr - beg);
+            continue;
+        }
+
         switch (*ptr) {
         case '\\':
             beg = ptr++;
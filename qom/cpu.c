@@ -20,6 +20,7 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "qemu-common.h"
 #include "qom/cpu.h"
 #include "sysemu/hw_accel.h"
@@ -34,6 +35,8 @@
 #include "trace-root.h"
 
 CPUInterruptHandler cpu_interrupt_handler;
+unsigned int tb_jmp_cache_bits = TB_JMP_CACHE_BITS_DEFAULT;
+uint64_t halt_poll_ns_default;
 
 CPUState *cpu_by_arch_id(int64_t id)
 {
@@ -370,10 +373,12 @@ static void cpu_common_initfn(Object *obj)
     /* the default value is changed by qemu_init_vcpu() for softmmu */
     cpu->nr_cores = 1;
     cpu->nr_threads = 1;
+    cpu->halt_poll_ns = halt_poll_ns_default;
 
     qemu_mutex_init(&cpu->work_mutex);
     QTAILQ_INIT(&cpu->breakpoints);
     QTAILQ_INIT(&cpu->watchpoints);
+    cpu->tb_jmp_cache = g_new0(struct TranslationBlock *, TB_JMP_CACHE_SIZE);
 
     cpu_exec_initfn(cpu);
 }
@@ -383,6 +388,7 @@ static void cpu_common_finalize(Object *obj)
     CPUState *cpu = CPU(obj);
 
     qemu_mutex_destroy(&cpu->work_mutex);
+    g_free(cpu->tb_jmp_cache);
 }
 
 static int64_t cpu_common_get_arch_id(CPUState *cpu)
@@ -406,6 +412,45 @@ static void generic_handle_interrupt(CPUState *cpu, int mask)
 
 CPUInterruptHandler cpu_interrupt_handler = generic_handle_interrupt;
 
+static void cpu_get_halt_poll_ns(Object *obj, Visitor *v, const char *name,
+                                 void *opaque, Error **errp)
+{
+    CPUState *cpu = CPU(obj);
+    uint64_t value = atomic_read(&cpu->halt_poll_ns);
+
+    visit_type_uint64(v, name, &value, errp);
+}
+
+static void cpu_set_halt_poll_ns(Object *obj, Visitor *v, const char *name,
+                                 void *opaque, Error **errp)
+{
+    CPUState *cpu = CPU(obj);
+    Error *local_err = NULL;
+    uint64_t value;
+
+    visit_type_uint64(v, name, &value, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    if (value > HALT_POLL_NS_MAX) {
+        error_setg(errp, "'%s' must be at most %" PRIu64, name,
+                   (uint64_t)HALT_POLL_NS_MAX);
+        return;
+    }
+
+    atomic_set(&cpu->halt_poll_ns, value);
+}
+
+static void cpu_get_halt_poll_stat(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    uint64_t value = *(uint64_t *)((char *)obj + (uintptr_t)opaque);
+
+    visit_type_uint64(v, name, &value, errp);
+}
+
 static void cpu_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
@@ -434,6 +479,18 @@ static void cpu_class_init(ObjectClass *klass, void *data)
     dc->realize = cpu_common_realizefn;
     dc->unrealize = cpu_common_unrealizefn;
     dc->props = cpu_common_props;
+    object_class_property_add(klass, "halt-poll-ns", "uint64",
+                              cpu_get_halt_poll_ns, cpu_set_halt_poll_ns,
+                              NULL, NULL, &error_abort);
+    object_class_property_add(klass, "halt-poll-successes", "uint64",
+                              cpu_get_halt_poll_stat, NULL, NULL,
+                              (void *)offsetof(CPUState,
+                                               halt_poll_successes),
+                              &error_abort);
+    object_class_property_add(klass, "halt-poll-failures", "uint64",
+                              cpu_get_halt_poll_stat, NULL, NULL,
+                              (void *)offsetof(CPUState, halt_poll_failures),
+                              &error_abort);
     /*
      * Reason: CPUs still need special care by board code: wiring up
      * IRQs, adding reset handlers, halting non-first CPUs, ...
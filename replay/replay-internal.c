@@ -15,6 +15,11 @@
 #include "replay-internal.h"
 #include "qemu/error-report.h"
 #include "sysemu/sysemu.h"
+#include "qemu/bswap.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include <zlib.h>
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -23,6 +28,57 @@
    written or read to the log. */
 static QemuMutex lock;
 
+/*
+ * The events are not written to the file as they come: they go to a
+ * buffer in memory, which is handed to a writer thread when it is full.
+ * That thread compresses it and writes it as a chunk of the log:
+ *
+ *   4-byte size of the events, 4-byte size of the compressed data,
+ *   compressed data
+ *
+ * The chunks are followed by an index of their offsets in the file, so
+ * that replay can seek to the position of a snapshot without reading
+ * the log up to there.  Positions in the log, see replay_log_tell(),
+ * are offsets in the stream of events, not in the file.
+ */
+#define REPLAY_CHUNK_SIZE   (1 * MiB)
+#define REPLAY_CHUNK_HEADER (2 * sizeof(uint32_t))
+/* Chunks waiting for the writer thread before events have to wait */
+#define REPLAY_MAX_PENDING  8
+
+typedef struct ReplayChunk {
+    uint8_t *data;
+    size_t size;
+    uint64_t offset;
+    QSIMPLEQ_ENTRY(ReplayChunk) next;
+} ReplayChunk;
+
+typedef struct ReplayIndexEntry {
+    uint64_t offset;        /* in the events */
+    uint64_t file_offset;
+} ReplayIndexEntry;
+
+static struct {
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, ReplayChunk) chunks;
+    unsigned int pending;
+    bool stop;
+    bool error;
+} replay_writer;
+
+/* The chunk being filled when recording, or being read when replaying */
+static uint8_t *log_buf;
+static size_t log_len;
+static size_t log_pos;
+static uint64_t log_base;
+/* Offsets of the chunks; the writer thread owns it when recording */
+static GArray *log_index;
+/* Next chunk to read when replaying */
+static unsigned int log_next;
+static bool log_eof;
+
 /* File for replay writing */
 static bool write_error;
 FILE *replay_file;
@@ -41,12 +97,304 @@ static void replay_read_error(void)
     exit(1);
 }
 
+static bool replay_write_chunk(ReplayChunk *c)
+{
+    uLongf len = compressBound(c->size);
+    uint8_t *buf = g_malloc(REPLAY_CHUNK_HEADER + len);
+    ReplayIndexEntry e = { .offset = c->offset };
+    long pos;
+    bool ok;
+
+    ok = compress2(buf + REPLAY_CHUNK_HEADER, &len, c->data, c->size,
+                   Z_BEST_SPEED) == Z_OK;
+    pos = ftell(replay_file);
+    if (ok && pos >= 0) {
+        stl_be_p(buf, c->size);
+        stl_be_p(buf + sizeof(uint32_t), len);
+        e.file_offset = pos;
+        ok = fwrite(buf, 1, REPLAY_CHUNK_HEADER + len, replay_file) ==
+             REPLAY_CHUNK_HEADER + len;
+        g_array_append_val(log_index, e);
+    }
+    g_free(buf);
+    return ok && pos >= 0;
+}
+
+static void *replay_writer_thread(void *opaque)
+{
+    ReplayChunk *c;
+    bool ok;
+
+    qemu_mutex_lock(&replay_writer.lock);
+    while (true) {
+        c = QSIMPLEQ_FIRST(&replay_writer.chunks);
+        if (!c) {
+            if (replay_writer.stop) {
+                break;
+            }
+            qemu_cond_wait(&replay_writer.cond, &replay_writer.lock);
+            continue;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&replay_writer.chunks, next);
+        qemu_mutex_unlock(&replay_writer.lock);
+
+        ok = replay_write_chunk(c);
+        g_free(c->data);
+        g_free(c);
+
+        qemu_mutex_lock(&replay_writer.lock);
+        replay_writer.pending--;
+        replay_writer.error |= !ok;
+        qemu_cond_broadcast(&replay_writer.cond);
+    }
+    qemu_mutex_unlock(&replay_writer.lock);
+    return NULL;
+}
+
+/* Hand the events buffered so far to the writer thread */
+static void replay_flush_buffer(void)
+{
+    ReplayChunk *c;
+
+    if (!log_len) {
+        return;
+    }
+
+    c = g_new0(ReplayChunk, 1);
+    c->data = log_buf;
+    c->size = log_len;
+    c->offset = log_base;
+    log_base += log_len;
+    log_len = 0;
+    log_buf = g_malloc(REPLAY_CHUNK_SIZE);
+
+    qemu_mutex_lock(&replay_writer.lock);
+    while (replay_writer.pending >= REPLAY_MAX_PENDING) {
+        qemu_cond_wait(&replay_writer.cond, &replay_writer.lock);
+    }
+    if (replay_writer.error) {
+        replay_write_error();
+    }
+    QSIMPLEQ_INSERT_TAIL(&replay_writer.chunks, c, next);
+    replay_writer.pending++;
+    qemu_cond_broadcast(&replay_writer.cond);
+    qemu_mutex_unlock(&replay_writer.lock);
+}
+
+/* Make chunk @i of the log the current one */
+static void replay_load_chunk(unsigned int i)
+{
+    ReplayIndexEntry *e = &g_array_index(log_index, ReplayIndexEntry, i);
+    uint8_t hdr[REPLAY_CHUNK_HEADER];
+    uint8_t *buf;
+    uLongf size;
+    size_t len;
+
+    if (fseek(replay_file, e->file_offset, SEEK_SET) ||
+        fread(hdr, 1, sizeof(hdr), replay_file) != sizeof(hdr)) {
+        replay_read_error();
+    }
+    size = ldl_be_p(hdr);
+    len = ldl_be_p(hdr + sizeof(uint32_t));
+    if (size > REPLAY_CHUNK_SIZE) {
+        replay_read_error();
+    }
+
+    buf = g_malloc(len);
+    if (fread(buf, 1, len, replay_file) != len ||
+        uncompress(log_buf, &size, buf, len) != Z_OK) {
+        replay_read_error();
+    }
+    g_free(buf);
+
+    log_base = e->offset;
+    log_len = size;
+    log_pos = 0;
+    log_next = i + 1;
+}
+
+/* Move to the next chunk, return false at the end of the log */
+static bool replay_next_chunk(void)
+{
+    if (log_next >= log_index->len) {
+        log_eof = true;
+        return false;
+    }
+    replay_load_chunk(log_next);
+    return true;
+}
+
+/* Rebuild the index of a log that was not closed properly */
+static void replay_scan_chunks(void)
+{
+    uint8_t hdr[REPLAY_CHUNK_HEADER];
+    ReplayIndexEntry e = { 0 };
+    long pos = HEADER_SIZE;
+
+    while (fseek(replay_file, pos, SEEK_SET) == 0 &&
+           fread(hdr, 1, sizeof(hdr), replay_file) == sizeof(hdr)) {
+        e.file_offset = pos;
+        g_array_append_val(log_index, e);
+        e.offset += ldl_be_p(hdr);
+        pos += REPLAY_CHUNK_HEADER + ldl_be_p(hdr + sizeof(uint32_t));
+    }
+}
+
+static void replay_read_index(uint64_t index_offset)
+{
+    uint8_t buf[2 * sizeof(uint64_t)];
+    ReplayIndexEntry e;
+    uint32_t i, count;
+
+    if (fseek(replay_file, index_offset, SEEK_SET) ||
+        fread(buf, 1, sizeof(uint32_t), replay_file) != sizeof(uint32_t)) {
+        replay_read_error();
+    }
+    count = ldl_be_p(buf);
+    for (i = 0; i < count; i++) {
+        if (fread(buf, 1, sizeof(buf), replay_file) != sizeof(buf)) {
+            replay_read_error();
+        }
+        e.offset = ldq_be_p(buf);
+        e.file_offset = ldq_be_p(buf + sizeof(uint64_t));
+        g_array_append_val(log_index, e);
+    }
+}
+
+static void replay_write_index(void)
+{
+    uint8_t buf[2 * sizeof(uint64_t)];
+    long pos = ftell(replay_file);
+    guint i;
+
+    stl_be_p(buf, log_index->len);
+    if (pos < 0 || fwrite(buf, 1, sizeof(uint32_t), replay_file) !=
+                   sizeof(uint32_t)) {
+        replay_write_error();
+        return;
+    }
+    for (i = 0; i < log_index->len; i++) {
+        ReplayIndexEntry *e = &g_array_index(log_index, ReplayIndexEntry, i);
+
+        stq_be_p(buf, e->offset);
+        stq_be_p(buf + sizeof(uint64_t), e->file_offset);
+        if (fwrite(buf, 1, sizeof(buf), replay_file) != sizeof(buf)) {
+            replay_write_error();
+            return;
+        }
+    }
+
+    /* The header points at the index once it is complete */
+    stl_be_p(buf, REPLAY_VERSION);
+    stq_be_p(buf + sizeof(uint32_t), pos);
+    if (fseek(replay_file, 0, SEEK_SET) ||
+        fwrite(buf, 1, HEADER_SIZE, replay_file) != HEADER_SIZE) {
+        replay_write_error();
+    }
+}
+
+void replay_log_open(void)
+{
+    uint8_t hdr[HEADER_SIZE];
+    uint64_t index_offset;
+
+    log_index = g_array_new(false, false, sizeof(ReplayIndexEntry));
+    log_buf = g_malloc(REPLAY_CHUNK_SIZE);
+    log_base = log_len = log_pos = 0;
+    log_next = 0;
+    log_eof = false;
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        /*
+         * Without an index, replay finds the chunks itself: that makes
+         * the log usable even if QEMU did not get to close it.
+         */
+        memset(hdr, 0, sizeof(hdr));
+        stl_be_p(hdr, REPLAY_VERSION);
+        if (fwrite(hdr, 1, sizeof(hdr), replay_file) != sizeof(hdr)) {
+            replay_write_error();
+        }
+        qemu_mutex_init(&replay_writer.lock);
+        qemu_cond_init(&replay_writer.cond);
+        QSIMPLEQ_INIT(&replay_writer.chunks);
+        qemu_thread_create(&replay_writer.thread, "replay-writer",
+                           replay_writer_thread, NULL, QEMU_THREAD_JOINABLE);
+        return;
+    }
+
+    if (fread(hdr, 1, sizeof(hdr), replay_file) != sizeof(hdr) ||
+        ldl_be_p(hdr) != REPLAY_VERSION) {
+        fprintf(stderr, "Replay: invalid input log file version\n");
+        exit(1);
+    }
+    index_offset = ldq_be_p(hdr + sizeof(uint32_t));
+    if (index_offset) {
+        replay_read_index(index_offset);
+    } else {
+        replay_scan_chunks();
+    }
+    replay_next_chunk();
+}
+
+void replay_log_close(void)
+{
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_flush_buffer();
+        qemu_mutex_lock(&replay_writer.lock);
+        replay_writer.stop = true;
+        qemu_cond_broadcast(&replay_writer.cond);
+        qemu_mutex_unlock(&replay_writer.lock);
+        qemu_thread_join(&replay_writer.thread);
+        if (replay_writer.error) {
+            replay_write_error();
+        }
+        replay_write_index();
+    }
+
+    fclose(replay_file);
+    replay_file = NULL;
+    g_array_free(log_index, true);
+    log_index = NULL;
+    g_free(log_buf);
+    log_buf = NULL;
+}
+
+uint64_t replay_log_tell(void)
+{
+    return log_base + (replay_mode == REPLAY_MODE_RECORD ? log_len : log_pos);
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    unsigned int lo = 0, hi = log_index->len;
+
+    /* Find the last chunk that starts at or before @offset */
+    while (hi - lo > 1) {
+        unsigned int mid = (lo + hi) / 2;
+
+        if (g_array_index(log_index, ReplayIndexEntry, mid).offset <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    log_eof = false;
+    if (!log_index->len) {
+        log_eof = true;
+        return;
+    }
+    replay_load_chunk(lo);
+    log_pos = MIN(offset - log_base, log_len);
+}
+
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
+        if (log_len == REPLAY_CHUNK_SIZE) {
+            replay_flush_buffer();
         }
+        log_buf[log_len++] = byte;
     }
 }
 
@@ -77,10 +425,19 @@ void replay_put_qword(int64_t qword)
 
 void replay_put_array(const uint8_t *buf, size_t size)
 {
+    size_t len;
+
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
+        while (size) {
+            if (log_len == REPLAY_CHUNK_SIZE) {
+                replay_flush_buffer();
+            }
+            len = MIN(size, REPLAY_CHUNK_SIZE - log_len);
+            memcpy(log_buf + log_len, buf, len);
+            log_len += len;
+            buf += len;
+            size -= len;
         }
     }
 }
@@ -89,11 +446,10 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
+        if (log_pos == log_len && !replay_next_chunk()) {
             replay_read_error();
         }
-        byte = r;
+        byte = log_buf[log_pos++];
     }
     return byte;
 }
@@ -131,13 +487,27 @@ int64_t replay_get_qword(void)
     return qword;
 }
 
+static void replay_read(uint8_t *buf, size_t size)
+{
+    size_t len;
+
+    while (size) {
+        if (log_pos == log_len && !replay_next_chunk()) {
+            replay_read_error();
+        }
+        len = MIN(size, log_len - log_pos);
+        memcpy(buf, log_buf + log_pos, len);
+        log_pos += len;
+        buf += len;
+        size -= len;
+    }
+}
+
 void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_read(buf, *size);
     }
 }
 
@@ -146,23 +516,17 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_read(*buf, *size);
     }
 }
 
 void replay_check_error(void)
 {
     if (replay_file) {
-        if (feof(replay_file)) {
+        if (log_eof) {
             error_report("replay file is over");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_PAUSED);
-        } else if (ferror(replay_file)) {
-            error_report("replay file is over or something goes wrong");
-            qemu_system_vmstop_request_prepare();
-            qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
         }
     }
 }
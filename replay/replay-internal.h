@@ -12,6 +12,12 @@
  *
  */
 
+/* Current version of the replay mechanism.
+   Increase it when file format changes. */
+#define REPLAY_VERSION              0xe02008
+/* Size of replay log header */
+#define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+
 /* Any changes to order/number of events will need to bump REPLAY_VERSION */
 enum ReplayEvents {
     /* for instruction event */
@@ -92,6 +98,15 @@ extern ReplayState replay_state;
 /* File for replay writing */
 extern FILE *replay_file;
 
+/*! Writes or checks the header of the log, and gets ready for the events. */
+void replay_log_open(void);
+/*! Writes the buffered events and the index of the log, closes the file. */
+void replay_log_close(void);
+/*! Returns the position in the log, for snapshots. */
+uint64_t replay_log_tell(void);
+/*! Continues replaying from a position returned by replay_log_tell(). */
+void replay_log_seek(uint64_t offset);
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
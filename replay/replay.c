@@ -20,12 +20,6 @@
 #include "sysemu/sysemu.h"
 #include "qemu/error-report.h"
 
-/* Current version of the replay mechanism.
-   Increase it when file format changes. */
-#define REPLAY_VERSION              0xe02007
-/* Size of replay log header */
-#define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
-
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
 
@@ -277,17 +271,9 @@ static void replay_enable(const char *fname, int mode)
     replay_state.current_step = 0;
     replay_state.has_unread_data = 0;
 
-    /* skip file header for RECORD and check it for PLAY */
-    if (replay_mode == REPLAY_MODE_RECORD) {
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
-    } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
-            fprintf(stderr, "Replay: invalid input log file version\n");
-            exit(1);
-        }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+    /* write file header for RECORD and check it for PLAY */
+    replay_log_open();
+    if (replay_mode == REPLAY_MODE_PLAY) {
         replay_fetch_data_kind();
     }
 
@@ -368,14 +354,10 @@ void replay_finish(void)
         if (replay_mode == REPLAY_MODE_RECORD) {
             /* write end event */
             replay_put_event(EVENT_END);
-
-            /* write header */
-            fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
         }
 
-        fclose(replay_file);
-        replay_file = NULL;
+        /* flush the events and write the index */
+        replay_log_close();
     }
     if (replay_filename) {
         g_free(replay_filename);
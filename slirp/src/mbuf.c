@@ -15,7 +15,12 @@
 
 #include "slirp.h"
 
-#define MBUF_THRESH 30
+/*
+ * Enough mbufs stay on the free list for a full window of segments in
+ * each direction, so that bulk transfers do not g_malloc and g_free
+ * each of them.
+ */
+#define MBUF_THRESH (30 + (TCP_SNDSPACE + TCP_RCVSPACE) / IF_MTU)
 
 /*
  * Find a nice value for msize
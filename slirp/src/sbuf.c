@@ -94,10 +94,15 @@ sbappend(struct socket *so, struct mbuf *m)
 	}
 
 	/*
+	 * Host sockets are written by sowrite() once the main loop polls
+	 * them, so that the segments the guest sends in a burst go out
+	 * with one or two send() calls rather than one each.  A guestfwd,
+	 * which is not polled, is written right away.
+	 *
 	 * We only write if there's nothing in the buffer,
 	 * ottherwise it'll arrive out of order, and hence corrupt
 	 */
-	if (!so->so_rcv.sb_cc)
+	if (so->s == -1 && !so->so_rcv.sb_cc)
 	   ret = slirp_send(so, m->m_data, m->m_len, 0);
 
 	if (ret <= 0) {
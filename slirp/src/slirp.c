@@ -899,11 +899,21 @@ int if_encap(Slirp *slirp, struct mbuf *ifm)
     struct ethhdr *eh = (struct ethhdr *)buf;
     uint8_t ethaddr[ETH_ALEN];
     const struct ip *iph = (const struct ip *)ifm->m_data;
+    char *start = ifm->m_flags & M_EXT ? ifm->m_ext : ifm->m_dat;
+    bool in_place = ifm->m_data - start >= ETH_HLEN;
     int ret;
 
     if (ifm->m_len + ETH_HLEN > sizeof(buf)) {
         return 1;
     }
+    /*
+     * Packets are built with room for the link header in front of
+     * them, into which the ethernet header goes so that the frame can
+     * be sent without copying it.
+     */
+    if (in_place) {
+        eh = (struct ethhdr *)(ifm->m_data - ETH_HLEN);
+    }
 
     switch (iph->ip_v) {
     case IPVERSION:
@@ -932,8 +942,10 @@ int if_encap(Slirp *slirp, struct mbuf *ifm)
     DEBUG_ARG("dst = %02x:%02x:%02x:%02x:%02x:%02x",
               eh->h_dest[0], eh->h_dest[1], eh->h_dest[2],
               eh->h_dest[3], eh->h_dest[4], eh->h_dest[5]);
-    memcpy(buf + sizeof(struct ethhdr), ifm->m_data, ifm->m_len);
-    slirp_send_packet_all(slirp, buf, ifm->m_len + ETH_HLEN);
+    if (!in_place) {
+        memcpy(buf + sizeof(struct ethhdr), ifm->m_data, ifm->m_len);
+    }
+    slirp_send_packet_all(slirp, eh, ifm->m_len + ETH_HLEN);
     return 1;
 }
 
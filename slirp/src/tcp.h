@@ -41,8 +41,12 @@ typedef	uint32_t tcp_seq;
 #define      PR_SLOWHZ       2               /* 2 slow timeouts per second (approx) */
 #define      PR_FASTHZ       5               /* 5 fast timeouts per second (not important) */
 
-#define TCP_SNDSPACE 8192
-#define TCP_RCVSPACE 8192
+/*
+ * Socket buffers as large as the largest window we can use without
+ * window scaling, so that a connection is not limited to 8k in flight.
+ */
+#define TCP_SNDSPACE (64 * 1024)
+#define TCP_RCVSPACE (64 * 1024)
 
 /*
  * TCP header.
@@ -320,6 +320,30 @@ LOGICAL_PPPP(sve_nand_pppp, DO_NAND)
 #undef DO_SEL
 #undef LOGICAL_PPPP
 
+/* Return true if every element of size 1 << @esz within the first
+ * @opr_sz bytes of the vector is active in the predicate @vg.
+ * Most loops are governed by PTRUE, and the expanders below then do
+ * without the per-element test of the predicate bits.
+ */
+static bool pred_all_true(void *vg, intptr_t opr_sz, int esz)
+{
+    uint64_t *g = vg, mask = pred_esz_masks[esz];
+    intptr_t i;
+
+    for (i = 0; i < opr_sz / 64; i++) {
+        if ((g[i] & mask) != mask) {
+            return false;
+        }
+    }
+    if (opr_sz & 63) {
+        mask &= MAKE_64BIT_MASK(0, opr_sz & 63);
+        if ((g[i] & mask) != mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /* Fully general three-operand expander, controlled by a predicate.
  * This is complicated by the host-endian storage of the register file.
  */
@@ -328,10 +352,7 @@ LOGICAL_PPPP(sve_nand_pppp, DO_NAND)
  * extra care wrt byte/word ordering we could use gcc generic vectors
  * and do 16 bytes at a time.
  */
-#define DO_ZPZZ(NAME, TYPE, H, OP)                                       \
-void HELPER(NAME)(void *vd, void *vn, void *vm, void *vg, uint32_t desc) \
-{                                                                       \
-    intptr_t i, opr_sz = simd_oprsz(desc);                              \
+#define DO_ZPZZ_PRED(TYPE, H, OP)                                       \
     for (i = 0; i < opr_sz; ) {                                         \
         uint16_t pg = *(uint16_t *)(vg + H1_2(i >> 3));                 \
         do {                                                            \
@@ -342,7 +363,41 @@ void HELPER(NAME)(void *vd, void *vn, void *vm, void *vg, uint32_t desc) \
             }                                                           \
             i += sizeof(TYPE), pg >>= sizeof(TYPE);                     \
         } while (i & 15);                                               \
+    }
+
+#define DO_ZPZZ(NAME, TYPE, H, OP)                                       \
+void HELPER(NAME)(void *vd, void *vn, void *vm, void *vg, uint32_t desc) \
+{                                                                       \
+    intptr_t i, opr_sz = simd_oprsz(desc);                              \
+    if (pred_all_true(vg, opr_sz, ctz32(sizeof(TYPE)))) {               \
+        for (i = 0; i < opr_sz; i += sizeof(TYPE)) {                    \
+            TYPE nn = *(TYPE *)(vn + H(i));                             \
+            TYPE mm = *(TYPE *)(vm + H(i));                             \
+            *(TYPE *)(vd + H(i)) = OP(nn, mm);                          \
+        }                                                               \
+        return;                                                         \
+    }                                                                   \
+    DO_ZPZZ_PRED(TYPE, H, OP)                                           \
+}
+
+/* Likewise, for an OP that also applies to gcc generic vectors.
+ * With every element active, the host byte order within each
+ * 64-bit unit does not matter, and we do 16 bytes at a time.
+ */
+#define DO_ZPZZ_VEC(NAME, TYPE, H, OP)                                   \
+void HELPER(NAME)(void *vd, void *vn, void *vm, void *vg, uint32_t desc) \
+{                                                                       \
+    intptr_t i, opr_sz = simd_oprsz(desc);                              \
+    if (pred_all_true(vg, opr_sz, ctz32(sizeof(TYPE)))) {               \
+        typedef TYPE vec __attribute__((vector_size(16)));              \
+        for (i = 0; i < opr_sz; i += sizeof(vec)) {                     \
+            vec nn = *(vec *)(vn + i);                                  \
+            vec mm = *(vec *)(vm + i);                                  \
+            *(vec *)(vd + i) = OP(nn, mm);                              \
+        }                                                               \
+        return;                                                         \
     }                                                                   \
+    DO_ZPZZ_PRED(TYPE, H, OP)                                           \
 }
 
 /* Similarly, specialized for 64-bit operands.  */
@@ -352,6 +407,13 @@ void HELPER(NAME)(void *vd, void *vn, void *vm, void *vg, uint32_t desc) \
     intptr_t i, opr_sz = simd_oprsz(desc) / 8;                  \
     TYPE *d = vd, *n = vn, *m = vm;                             \
     uint8_t *pg = vg;                                           \
+    if (pred_all_true(vg, opr_sz * 8, 3)) {                     \
+        for (i = 0; i < opr_sz; i += 1) {                       \
+            TYPE nn = n[i], mm = m[i];                          \
+            d[i] = OP(nn, mm);                                  \
+        }                                                       \
+        return;                                                 \
+    }                                                           \
     for (i = 0; i < opr_sz; i += 1) {                           \
         if (pg[H1(i)] & 1) {                                    \
             TYPE nn = n[i], mm = m[i];                          \
@@ -382,34 +444,34 @@ void HELPER(NAME)(void *vd, void *vn, void *vm, void *vg, uint32_t desc) \
 #define DO_SDIV(N, M) (unlikely(M == 0) ? 0 : unlikely(M == -1) ? -N : N / M)
 #define DO_UDIV(N, M) (unlikely(M == 0) ? 0 : N / M)
 
-DO_ZPZZ(sve_and_zpzz_b, uint8_t, H1, DO_AND)
-DO_ZPZZ(sve_and_zpzz_h, uint16_t, H1_2, DO_AND)
-DO_ZPZZ(sve_and_zpzz_s, uint32_t, H1_4, DO_AND)
+DO_ZPZZ_VEC(sve_and_zpzz_b, uint8_t, H1, DO_AND)
+DO_ZPZZ_VEC(sve_and_zpzz_h, uint16_t, H1_2, DO_AND)
+DO_ZPZZ_VEC(sve_and_zpzz_s, uint32_t, H1_4, DO_AND)
 DO_ZPZZ_D(sve_and_zpzz_d, uint64_t, DO_AND)
 
-DO_ZPZZ(sve_orr_zpzz_b, uint8_t, H1, DO_ORR)
-DO_ZPZZ(sve_orr_zpzz_h, uint16_t, H1_2, DO_ORR)
-DO_ZPZZ(sve_orr_zpzz_s, uint32_t, H1_4, DO_ORR)
+DO_ZPZZ_VEC(sve_orr_zpzz_b, uint8_t, H1, DO_ORR)
+DO_ZPZZ_VEC(sve_orr_zpzz_h, uint16_t, H1_2, DO_ORR)
+DO_ZPZZ_VEC(sve_orr_zpzz_s, uint32_t, H1_4, DO_ORR)
 DO_ZPZZ_D(sve_orr_zpzz_d, uint64_t, DO_ORR)
 
-DO_ZPZZ(sve_eor_zpzz_b, uint8_t, H1, DO_EOR)
-DO_ZPZZ(sve_eor_zpzz_h, uint16_t, H1_2, DO_EOR)
-DO_ZPZZ(sve_eor_zpzz_s, uint32_t, H1_4, DO_EOR)
+DO_ZPZZ_VEC(sve_eor_zpzz_b, uint8_t, H1, DO_EOR)
+DO_ZPZZ_VEC(sve_eor_zpzz_h, uint16_t, H1_2, DO_EOR)
+DO_ZPZZ_VEC(sve_eor_zpzz_s, uint32_t, H1_4, DO_EOR)
 DO_ZPZZ_D(sve_eor_zpzz_d, uint64_t, DO_EOR)
 
-DO_ZPZZ(sve_bic_zpzz_b, uint8_t, H1, DO_BIC)
-DO_ZPZZ(sve_bic_zpzz_h, uint16_t, H1_2, DO_BIC)
-DO_ZPZZ(sve_bic_zpzz_s, uint32_t, H1_4, DO_BIC)
+DO_ZPZZ_VEC(sve_bic_zpzz_b, uint8_t, H1, DO_BIC)
+DO_ZPZZ_VEC(sve_bic_zpzz_h, uint16_t, H1_2, DO_BIC)
+DO_ZPZZ_VEC(sve_bic_zpzz_s, uint32_t, H1_4, DO_BIC)
 DO_ZPZZ_D(sve_bic_zpzz_d, uint64_t, DO_BIC)
 
-DO_ZPZZ(sve_add_zpzz_b, uint8_t, H1, DO_ADD)
-DO_ZPZZ(sve_add_zpzz_h, uint16_t, H1_2, DO_ADD)
-DO_ZPZZ(sve_add_zpzz_s, uint32_t, H1_4, DO_ADD)
+DO_ZPZZ_VEC(sve_add_zpzz_b, uint8_t, H1, DO_ADD)
+DO_ZPZZ_VEC(sve_add_zpzz_h, uint16_t, H1_2, DO_ADD)
+DO_ZPZZ_VEC(sve_add_zpzz_s, uint32_t, H1_4, DO_ADD)
 DO_ZPZZ_D(sve_add_zpzz_d, uint64_t, DO_ADD)
 
-DO_ZPZZ(sve_sub_zpzz_b, uint8_t, H1, DO_SUB)
-DO_ZPZZ(sve_sub_zpzz_h, uint16_t, H1_2, DO_SUB)
-DO_ZPZZ(sve_sub_zpzz_s, uint32_t, H1_4, DO_SUB)
+DO_ZPZZ_VEC(sve_sub_zpzz_b, uint8_t, H1, DO_SUB)
+DO_ZPZZ_VEC(sve_sub_zpzz_h, uint16_t, H1_2, DO_SUB)
+DO_ZPZZ_VEC(sve_sub_zpzz_s, uint32_t, H1_4, DO_SUB)
 DO_ZPZZ_D(sve_sub_zpzz_d, uint64_t, DO_SUB)
 
 DO_ZPZZ(sve_smax_zpzz_b, int8_t, H1, DO_MAX)
@@ -473,9 +535,9 @@ static inline uint64_t do_umulh_d(uint64_t n, uint64_t m)
     return hi;
 }
 
-DO_ZPZZ(sve_mul_zpzz_b, uint8_t, H1, DO_MUL)
-DO_ZPZZ(sve_mul_zpzz_h, uint16_t, H1_2, DO_MUL)
-DO_ZPZZ(sve_mul_zpzz_s, uint32_t, H1_4, DO_MUL)
+DO_ZPZZ_VEC(sve_mul_zpzz_b, uint8_t, H1, DO_MUL)
+DO_ZPZZ_VEC(sve_mul_zpzz_h, uint16_t, H1_2, DO_MUL)
+DO_ZPZZ_VEC(sve_mul_zpzz_s, uint32_t, H1_4, DO_MUL)
 DO_ZPZZ_D(sve_mul_zpzz_d, uint64_t, DO_MUL)
 
 DO_ZPZZ(sve_smulh_zpzz_b, int8_t, H1, do_mulh_b)
@@ -517,6 +579,8 @@ DO_ZPZZ_D(sve_lsr_zpzz_d, uint64_t, DO_LSR)
 DO_ZPZZ_D(sve_lsl_zpzz_d, uint64_t, DO_LSL)
 
 #undef DO_ZPZZ
+#undef DO_ZPZZ_VEC
+#undef DO_ZPZZ_PRED
 #undef DO_ZPZZ_D
 
 /* Three-operand expander, controlled by a predicate, in which the
@@ -560,6 +624,13 @@ DO_ZPZW(sve_lsl_zpzw_s, uint32_t, uint64_t, H1_4, DO_LSL)
 void HELPER(NAME)(void *vd, void *vn, void *vg, uint32_t desc)  \
 {                                                               \
     intptr_t i, opr_sz = simd_oprsz(desc);                      \
+    if (pred_all_true(vg, opr_sz, ctz32(sizeof(TYPE)))) {       \
+        for (i = 0; i < opr_sz; i += sizeof(TYPE)) {            \
+            TYPE nn = *(TYPE *)(vn + H(i));                     \
+            *(TYPE *)(vd + H(i)) = OP(nn);                      \
+        }                                                       \
+        return;                                                 \
+    }                                                           \
     for (i = 0; i < opr_sz; ) {                                 \
         uint16_t pg = *(uint16_t *)(vg + H1_2(i >> 3));         \
         do {                                                    \
@@ -579,6 +650,13 @@ void HELPER(NAME)(void *vd, void *vn, void *vg, uint32_t desc)  \
     intptr_t i, opr_sz = simd_oprsz(desc) / 8;                  \
     TYPE *d = vd, *n = vn;                                      \
     uint8_t *pg = vg;                                           \
+    if (pred_all_true(vg, opr_sz * 8, 3)) {                     \
+        for (i = 0; i < opr_sz; i += 1) {                       \
+            TYPE nn = n[i];                                     \
+            d[i] = OP(nn);                                      \
+        }                                                       \
+        return;                                                 \
+    }                                                           \
     for (i = 0; i < opr_sz; i += 1) {                           \
         if (pg[H1(i)] & 1) {                                    \
             TYPE nn = n[i];                                     \
@@ -1391,6 +1391,7 @@ struct X86CPU {
     bool hyperv_synic;
     bool hyperv_synic_kvm_only;
     bool hyperv_stimer;
+    bool hyperv_stimer_direct;
     bool hyperv_frequencies;
     bool hyperv_reenlightenment;
     bool hyperv_tlbflush;
@@ -1780,13 +1781,31 @@ void tcg_x86_init(void);
 #include "hw/i386/apic.h"
 #endif
 
+/*
+ * The TB flags also carry CC_OP when it is one of the arithmetic and
+ * logic ones, so that the translator can compute the condition codes
+ * inline in a TB that starts with a consumer (e.g. the second Jcc after
+ * a CMP).  hflags do not use these bits; 0 means CC_OP_DYNAMIC.
+ */
+#define TB_FLAGS_CC_OP_SHIFT 27
+#define TB_FLAGS_CC_OP_MASK  (0x1f << TB_FLAGS_CC_OP_SHIFT)
+
+static inline uint32_t cpu_cc_op_tb_flags(int cc_op)
+{
+    if (cc_op >= CC_OP_ADDB && cc_op <= CC_OP_LOGICQ) {
+        return cc_op << TB_FLAGS_CC_OP_SHIFT;
+    }
+    return 0;
+}
+
 static inline void cpu_get_tb_cpu_state(CPUX86State *env, target_ulong *pc,
                                         target_ulong *cs_base, uint32_t *flags)
 {
     *cs_base = env->segs[R_CS].base;
     *pc = *cs_base + env->eip;
     *flags = env->hflags |
-        (env->eflags & (IOPL_MASK | TF_MASK | RF_MASK | VM_MASK | AC_MASK));
+        (env->eflags & (IOPL_MASK | TF_MASK | RF_MASK | VM_MASK | AC_MASK)) |
+        cpu_cc_op_tb_flags(env->cc_op);
 }
 
 void do_cpu_init(X86CPU *cpu);
@@ -641,6 +641,30 @@ static bool hyperv_hypercall_available(X86CPU *cpu)
            (cpu->hyperv_spinlock_attempts != HYPERV_SPINLOCK_NEVER_RETRY);
 }
 
+/*
+ * Direct mode synthetic timers have no capability of their own: the
+ * kernel reports them in the Hyper-V CPUID leaves it supports.
+ */
+static bool hyperv_stimer_direct_supported(CPUState *cs)
+{
+    struct {
+        struct kvm_cpuid2 cpuid;
+        struct kvm_cpuid_entry2 entries[16];
+    } hv_cpuid = { .cpuid.nent = ARRAY_SIZE(hv_cpuid.entries) };
+    int i;
+
+    if (kvm_check_extension(cs->kvm_state, KVM_CAP_HYPERV_CPUID) <= 0 ||
+        kvm_vcpu_ioctl(cs, KVM_GET_SUPPORTED_HV_CPUID, &hv_cpuid) < 0) {
+        return false;
+    }
+    for (i = 0; i < hv_cpuid.cpuid.nent; i++) {
+        if (hv_cpuid.entries[i].function == HV_CPUID_FEATURES) {
+            return hv_cpuid.entries[i].edx & HV_STIMER_DIRECT_MODE_AVAILABLE;
+        }
+    }
+    return false;
+}
+
 static bool hyperv_enabled(X86CPU *cpu)
 {
     CPUState *cs = CPU(cpu);
@@ -807,6 +831,21 @@ static int hyperv_handle_properties(CPUState *cs)
         }
         env->features[FEAT_HYPERV_EAX] |= HV_SYNTIMERS_AVAILABLE;
     }
+    if (cpu->hyperv_stimer_direct) {
+        if (!cpu->hyperv_stimer) {
+            fprintf(stderr, "Hyper-V direct mode timers "
+                    "(requested by 'hv-stimer-direct' cpu flag) "
+                    "require 'hv-stimer'\n");
+            return -ENOSYS;
+        }
+        if (!hyperv_stimer_direct_supported(cs)) {
+            fprintf(stderr, "Hyper-V direct mode timers "
+                    "(requested by 'hv-stimer-direct' cpu flag) "
+                    "are not supported by kernel\n");
+            return -ENOSYS;
+        }
+        env->features[FEAT_HYPERV_EDX] |= HV_STIMER_DIRECT_MODE_AVAILABLE;
+    }
     if (cpu->hyperv_relaxed_timing) {
         env->features[FEAT_HV_RECOMM_EAX] |= HV_RELAXED_TIMING_RECOMMENDED;
     }
@@ -544,7 +544,7 @@ static void do_pause(X86CPU *cpu)
     CPUState *cs = CPU(cpu);
 
     /* Just let another CPU run.  */
-    cs->exception_index = EXCP_INTERRUPT;
+    cs->exception_index = EXCP_YIELD;
     cpu_loop_exit(cs);
 }
 
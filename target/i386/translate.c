@@ -115,6 +115,7 @@ typedef struct DisasContext {
     int iopl;
     int tf;     /* TF cpu flag */
     int jmp_opt; /* use direct block chaining for direct jumps */
+    bool trace_side_exit; /* goto_tb slot 1 taken by a side exit of a trace */
     int repz_opt; /* optimize jumps within repz instructions */
     int mem_index; /* select memory access functions */
     uint64_t flags; /* all execution flags */
@@ -1194,6 +1195,8 @@ static inline void gen_repz_ ## op(DisasContext *s, TCGMemOp ot,              \
 {                                                                             \
     TCGLabel *l2;                                                             \
     gen_update_cc_op(s);                                                      \
+    /* The exit at l2 is also taken after op, with a different CC_OP */       \
+    set_cc_op(s, CC_OP_DYNAMIC);                                              \
     l2 = gen_jz_ecx_string(s, next_eip);                                      \
     gen_ ## op(s, ot);                                                        \
     gen_op_add_reg_im(s, s->aflag, R_ECX, -1);                                \
@@ -2225,7 +2228,12 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
 {
     target_ulong pc = s->cs_base + eip;
 
-    if (use_goto_tb(s, pc))  {
+    /*
+     * The CC_OP in the flags of the next TB must be the same on every
+     * pass through a direct jump, so it must be known here.
+     */
+    if (use_goto_tb(s, pc) && s->cc_op != CC_OP_DYNAMIC &&
+        !(tb_num == 1 && s->trace_side_exit)) {
         /* jump to same page: we can use a direct jump */
         tcg_gen_goto_tb(tb_num);
         gen_jmp_im(s, eip);
@@ -2234,7 +2242,7 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
     } else {
         /* jump to another page */
         gen_jmp_im(s, eip);
-        gen_jr(s, s->tmp0);
+        gen_jr_near(s, s->tmp0);
     }
 }
 
@@ -2243,7 +2251,18 @@ static inline void gen_jcc(DisasContext *s, int b,
 {
     TCGLabel *l1, *l2;
 
-    if (s->jmp_opt) {
+    if (s->jmp_opt && !s->trace_side_exit
+        && use_goto_tb(s, s->cs_base + val)
+        && translator_trace_jump(&s->base, s->cs_base + next_eip)) {
+        /* Keep translating the not taken path, and leave the trace
+           through goto_tb slot 1 if the jump is taken.  */
+        l1 = gen_new_label();
+        gen_jcc1(s, b ^ 1, l1);
+        gen_goto_tb(s, 1, val);
+        s->base.is_jmp = DISAS_NEXT;
+        s->trace_side_exit = true;
+        gen_set_label(l1);
+    } else if (s->jmp_opt) {
         l1 = gen_new_label();
         gen_jcc1(s, b, l1);
 
@@ -2629,6 +2648,30 @@ static void gen_jr(DisasContext *s, TCGv dest)
     do_gen_eob_worker(s, false, false, true);
 }
 
+/* Jump to the EIP in DEST, which was already stored; CS does not change.  */
+static void gen_jr_near(DisasContext *s, TCGv dest)
+{
+    TCGv pc;
+
+    if (!s->jmp_opt || s->flags != s->base.tb->flags
+        || (s->flags & HF_RF_MASK) || s->cc_op == CC_OP_DYNAMIC) {
+        /*
+         * do_gen_eob_worker changes the TB flags or raises #DB, or the
+         * CC_OP part of the flags of the next TB is not known.
+         */
+        gen_jr(s, dest);
+        return;
+    }
+    gen_update_cc_op(s);
+    pc = tcg_temp_new();
+    tcg_gen_addi_tl(pc, dest, s->cs_base);
+    tcg_gen_lookup_and_goto_ptr_cached(s->base.tb,
+                                       (s->flags & ~TB_FLAGS_CC_OP_MASK) |
+                                       cpu_cc_op_tb_flags(s->cc_op), pc);
+    tcg_temp_free(pc);
+    s->base.is_jmp = DISAS_NORETURN;
+}
+
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
@@ -2648,6 +2691,16 @@ static void gen_jmp(DisasContext *s, target_ulong eip)
     gen_jmp_tb(s, eip, 0);
 }
 
+/* Direct jump that a hot TB may follow, see translator_trace_jump */
+static void gen_jmp_trace(DisasContext *s, target_ulong eip)
+{
+    if (s->jmp_opt && translator_trace_jump(&s->base, s->cs_base + eip)) {
+        s->pc = s->cs_base + eip;
+    } else {
+        gen_jmp(s, eip);
+    }
+}
+
 static inline void gen_ldq_env_A0(DisasContext *s, int offset)
 {
     tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, MO_LEQ);
@@ -5065,7 +5118,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             gen_push_v(s, s->T1);
             gen_op_jmp_v(s->T0);
             gen_bnd_jmp(s);
-            gen_jr(s, s->T0);
+            gen_jr_near(s, s->T0);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_v(s, ot, s->T1, s->A0);
@@ -5092,7 +5145,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             }
             gen_op_jmp_v(s->T0);
             gen_bnd_jmp(s);
-            gen_jr(s, s->T0);
+            gen_jr_near(s, s->T0);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_v(s, ot, s->T1, s->A0);
@@ -6484,7 +6537,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(s->T0);
         gen_bnd_jmp(s);
-        gen_jr(s, s->T0);
+        gen_jr_near(s, s->T0);
         break;
     case 0xc3: /* ret */
         ot = gen_pop_T0(s);
@@ -6492,7 +6545,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(s->T0);
         gen_bnd_jmp(s);
-        gen_jr(s, s->T0);
+        gen_jr_near(s, s->T0);
         break;
     case 0xca: /* lret im */
         val = x86_ldsw_code(env, s);
@@ -6558,7 +6611,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tcg_gen_movi_tl(s->T0, next_eip);
             gen_push_v(s, s->T0);
             gen_bnd_jmp(s);
-            gen_jmp(s, tval);
+            gen_jmp_trace(s, tval);
         }
         break;
     case 0x9a: /* lcall im */
@@ -6588,7 +6641,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffffffff;
         }
         gen_bnd_jmp(s);
-        gen_jmp(s, tval);
+        gen_jmp_trace(s, tval);
         break;
     case 0xea: /* ljmp im */
         {
@@ -6610,7 +6663,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        gen_jmp_trace(s, tval);
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
@@ -8445,7 +8498,8 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
     dc->cpl = (flags >> HF_CPL_SHIFT) & 3;
     dc->iopl = (flags >> IOPL_SHIFT) & 3;
     dc->tf = (flags >> TF_SHIFT) & 1;
-    dc->cc_op = CC_OP_DYNAMIC;
+    /* env->cc_op already holds it */
+    dc->cc_op = (flags & TB_FLAGS_CC_OP_MASK) >> TB_FLAGS_CC_OP_SHIFT;
     dc->cc_op_dirty = false;
     dc->cs_base = cs_base;
     dc->popl_esp_hack = 0;
@@ -8478,6 +8532,7 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
        additional step for ecx=0 when icount is enabled.
      */
     dc->repz_opt = !dc->jmp_opt && !(tb_cflags(dc->base.tb) & CF_USE_ICOUNT);
+    dc->trace_side_exit = false;
 #if 0
     /* check addseg logic */
     if (!dc->addseg && (dc->vm86 || !dc->pe || !dc->code32))
@@ -8500,6 +8555,12 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
 
 static void i386_tr_tb_start(DisasContextBase *db, CPUState *cpu)
 {
+    DisasContext *dc = container_of(db, DisasContext, base);
+
+    /* cc_srcT does not live across TBs; CC_DST = CC_SRCT - CC_SRC */
+    if (dc->cc_op >= CC_OP_SUBB && dc->cc_op <= CC_OP_SUBQ) {
+        tcg_gen_add_tl(dc->cc_srcT, cpu_cc_dst, cpu_cc_src);
+    }
 }
 
 static void i386_tr_insn_start(DisasContextBase *dcbase, CPUState *cpu)
@@ -133,6 +133,12 @@ extern bool have_avx2;
 #define TCG_TARGET_HAS_mulsh_i32        0
 #define TCG_TARGET_HAS_goto_ptr         1
 #define TCG_TARGET_HAS_direct_jump      1
+/* The slow path takes six arguments, which must all be in registers.  */
+#if TCG_TARGET_REG_BITS == 64 && !defined(_WIN64)
+#define TCG_TARGET_HAS_qemu_cmpxchg     1
+#else
+#define TCG_TARGET_HAS_qemu_cmpxchg     0
+#endif
 
 #if TCG_TARGET_REG_BITS == 64
 /* Keep target addresses zero-extended in a register.  */
@@ -159,10 +159,14 @@ bool have_avx2;
 static bool have_movbe;
 static bool have_bmi2;
 static bool have_lzcnt;
+static bool have_avx512vl;
+static bool have_avx512dq;
 #else
 # define have_movbe 0
 # define have_bmi2 0
 # define have_lzcnt 0
+# define have_avx512vl 0
+# define have_avx512dq 0
 #endif
 
 static tcg_insn_unit *tb_ret_addr;
@@ -323,6 +327,8 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define P_SIMDF3        0x20000         /* 0xf3 opcode prefix */
 #define P_SIMDF2        0x40000         /* 0xf2 opcode prefix */
 #define P_VEXL          0x80000         /* Set VEX.L = 1 */
+#define P_VEXW          0x100000        /* Set VEX.W = 1 */
+#define P_EVEX          0x200000        /* Requires EVEX encoding */
 
 #define OPC_ARITH_EvIz	(0x81)
 #define OPC_ARITH_EvIb	(0x83)
@@ -337,6 +343,8 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_CALL_Jz	(0xe8)
 #define OPC_CMOVCC      (0x40 | P_EXT)  /* ... plus condition code */
 #define OPC_CMP_GvEv	(OPC_ARITH_GvEv | (ARITH_CMP << 3))
+#define OPC_CMPXCHG_EbGb (0xb0 | P_EXT)
+#define OPC_CMPXCHG_EvGv (0xb1 | P_EXT)
 #define OPC_DEC_r32	(0x48)
 #define OPC_IMUL_GvEv	(0xaf | P_EXT)
 #define OPC_IMUL_GvEvIb	(0x6b)
@@ -396,15 +404,19 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_PMAXSB      (0x3c | P_EXT38 | P_DATA16)
 #define OPC_PMAXSW      (0xee | P_EXT | P_DATA16)
 #define OPC_PMAXSD      (0x3d | P_EXT38 | P_DATA16)
+#define OPC_VPMAXSQ     (0x3d | P_EXT38 | P_DATA16 | P_VEXW | P_EVEX)
 #define OPC_PMAXUB      (0xde | P_EXT | P_DATA16)
 #define OPC_PMAXUW      (0x3e | P_EXT38 | P_DATA16)
 #define OPC_PMAXUD      (0x3f | P_EXT38 | P_DATA16)
+#define OPC_VPMAXUQ     (0x3f | P_EXT38 | P_DATA16 | P_VEXW | P_EVEX)
 #define OPC_PMINSB      (0x38 | P_EXT38 | P_DATA16)
 #define OPC_PMINSW      (0xea | P_EXT | P_DATA16)
 #define OPC_PMINSD      (0x39 | P_EXT38 | P_DATA16)
+#define OPC_VPMINSQ     (0x39 | P_EXT38 | P_DATA16 | P_VEXW | P_EVEX)
 #define OPC_PMINUB      (0xda | P_EXT | P_DATA16)
 #define OPC_PMINUW      (0x3a | P_EXT38 | P_DATA16)
 #define OPC_PMINUD      (0x3b | P_EXT38 | P_DATA16)
+#define OPC_VPMINUQ     (0x3b | P_EXT38 | P_DATA16 | P_VEXW | P_EVEX)
 #define OPC_PMOVSXBW    (0x20 | P_EXT38 | P_DATA16)
 #define OPC_PMOVSXWD    (0x23 | P_EXT38 | P_DATA16)
 #define OPC_PMOVSXDQ    (0x25 | P_EXT38 | P_DATA16)
@@ -413,6 +425,7 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_PMOVZXDQ    (0x35 | P_EXT38 | P_DATA16)
 #define OPC_PMULLW      (0xd5 | P_EXT | P_DATA16)
 #define OPC_PMULLD      (0x40 | P_EXT38 | P_DATA16)
+#define OPC_VPMULLQ     (0x40 | P_EXT38 | P_DATA16 | P_VEXW | P_EVEX)
 #define OPC_POR         (0xeb | P_EXT | P_DATA16)
 #define OPC_PSHUFB      (0x00 | P_EXT38 | P_DATA16)
 #define OPC_PSHUFD      (0x70 | P_EXT | P_DATA16)
@@ -421,6 +434,7 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_PSHIFTW_Ib  (0x71 | P_EXT | P_DATA16) /* /2 /6 /4 */
 #define OPC_PSHIFTD_Ib  (0x72 | P_EXT | P_DATA16) /* /2 /6 /4 */
 #define OPC_PSHIFTQ_Ib  (0x73 | P_EXT | P_DATA16) /* /2 /6 /4 */
+#define OPC_VPSRAQ_Ib   (0x72 | P_EXT | P_DATA16 | P_VEXW | P_EVEX) /* /4 */
 #define OPC_PSUBB       (0xf8 | P_EXT | P_DATA16)
 #define OPC_PSUBW       (0xf9 | P_EXT | P_DATA16)
 #define OPC_PSUBD       (0xfa | P_EXT | P_DATA16)
@@ -670,6 +684,52 @@ static void tcg_out_vex_modrm(TCGContext *s, int opc, int r, int v, int rm)
     tcg_out8(s, 0xc0 | (LOWREGMASK(r) << 3) | LOWREGMASK(rm));
 }
 
+/* Output a register to register AVX-512VL instruction on xmm/ymm registers,
+   without masking.  Only xmm0-15 are used, so EVEX.R' and EVEX.V' are 0.  */
+static void tcg_out_evex_modrm(TCGContext *s, int opc, int r, int v, int rm)
+{
+    int tmp;
+
+    tcg_debug_assert(have_avx512vl);
+    tcg_out8(s, 0x62);
+
+    /* EVEX.mm */
+    if (opc & P_EXT3A) {
+        tmp = 3;
+    } else if (opc & P_EXT38) {
+        tmp = 2;
+    } else if (opc & P_EXT) {
+        tmp = 1;
+    } else {
+        g_assert_not_reached();
+    }
+    tmp |= (r & 8 ? 0 : 0x80);             /* EVEX.R */
+    tmp |= 0x40;                           /* EVEX.X */
+    tmp |= (rm & 8 ? 0 : 0x20);            /* EVEX.B */
+    tmp |= 0x10;                           /* EVEX.R' */
+    tcg_out8(s, tmp);
+
+    tmp = (opc & P_VEXW ? 0x80 : 0);       /* EVEX.W */
+    tmp |= (~v & 15) << 3;                 /* EVEX.vvvv */
+    tmp |= 0x04;                           /* fixed 1 */
+    /* EVEX.pp */
+    if (opc & P_DATA16) {
+        tmp |= 1;                          /* 0x66 */
+    } else if (opc & P_SIMDF3) {
+        tmp |= 2;                          /* 0xf3 */
+    } else if (opc & P_SIMDF2) {
+        tmp |= 3;                          /* 0xf2 */
+    }
+    tcg_out8(s, tmp);
+
+    tmp = (opc & P_VEXL ? 0x20 : 0);       /* EVEX.L'L */
+    tmp |= 0x08;                           /* EVEX.V' */
+    tcg_out8(s, tmp);
+
+    tcg_out8(s, opc);
+    tcg_out8(s, 0xc0 | (LOWREGMASK(r) << 3) | LOWREGMASK(rm));
+}
+
 /* Output an opcode with a full "rm + (index<<shift) + offset" address mode.
    We handle either RM and INDEX missing with a negative value.  In 64-bit
    mode for absolute addresses, ~RM is the size of the immediate operand
@@ -1877,6 +1937,46 @@ static void tcg_out_qemu_st_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
     tcg_out_push(s, retaddr);
     tcg_out_jmp(s, qemu_st_helpers[opc & (MO_BSWAP | MO_SIZE)]);
 }
+
+#if TCG_TARGET_HAS_qemu_cmpxchg
+/* helper signature: helper_atomic_cmpxchg_mmu(CPUState *env, target_ulong addr,
+ *                                             uintxx_t cmpv, uintxx_t newv,
+ *                                             TCGMemOpIdx oi, uintptr_t ra)
+ */
+static void * const qemu_cmpxchg_helpers[4] = {
+    [MO_8]  = helper_atomic_cmpxchgb_mmu,
+    [MO_16] = helper_atomic_cmpxchgw_le_mmu,
+    [MO_32] = helper_atomic_cmpxchgl_le_mmu,
+    [MO_64] = helper_atomic_cmpxchgq_le_mmu,
+};
+
+/*
+ * Generate code for the slow path for a compare-and-swap at the end of block
+ */
+static void tcg_out_qemu_cmpxchg_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
+{
+    TCGMemOpIdx oi = l->oi;
+    TCGMemOp opc = get_memop(oi);
+    TCGType type = (opc & MO_SIZE) == MO_64 ? TCG_TYPE_I64 : TCG_TYPE_I32;
+    TCGReg retaddr = tcg_target_call_iarg_regs[5];
+
+    /* resolve label address */
+    tcg_patch32(l->label_ptr[0], s->code_ptr - l->label_ptr[0] - 4);
+
+    /* Move the new value first: it may be in the compare value's target.  */
+    tcg_out_mov(s, type, tcg_target_call_iarg_regs[3], l->newv_reg);
+    tcg_out_mov(s, type, tcg_target_call_iarg_regs[2], l->cmpv_reg);
+    tcg_out_mov(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[0], TCG_AREG0);
+    /* The second argument is already loaded with addrlo.  */
+    tcg_out_movi(s, TCG_TYPE_I32, tcg_target_call_iarg_regs[4], oi);
+    tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+
+    /* "Tail call" to the helper, with the return address back inline.
+       The helper returns the old value, zero-extended, in EAX.  */
+    tcg_out_push(s, retaddr);
+    tcg_out_jmp(s, qemu_cmpxchg_helpers[opc & MO_SIZE]);
+}
+#endif
 #elif TCG_TARGET_REG_BITS == 32
 # define x86_guest_base_seg     0
 # define x86_guest_base_index   -1
@@ -2172,6 +2272,90 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
 #endif
 }
 
+#if TCG_TARGET_HAS_qemu_cmpxchg
+/* lock cmpxchg of NEWV with the memory at BASE + INDEX + OFS; the compare
+   value is in EAX, which receives the old value zero-extended to IS64.  */
+static void tcg_out_qemu_cmpxchg_direct(TCGContext *s, TCGReg newv,
+                                        TCGReg base, int index, intptr_t ofs,
+                                        int seg, TCGMemOp memop, bool is64)
+{
+    static int const cmpxchg_insn[4] = {
+        OPC_CMPXCHG_EbGb + P_REXB_R,
+        OPC_CMPXCHG_EvGv + P_DATA16,
+        OPC_CMPXCHG_EvGv,
+        OPC_CMPXCHG_EvGv + P_REXW,
+    };
+
+    tcg_debug_assert(!(memop & (MO_BSWAP | MO_SIGN)));
+
+    /* lock */
+    tcg_out8(s, 0xf0);
+    tcg_out_modrm_sib_offset(s, cmpxchg_insn[memop & MO_SIZE] + seg, newv,
+                             base, index, 0, ofs);
+
+    /* On success EAX is unchanged, so its high part is that of cmpv.  */
+    switch (memop & MO_SIZE) {
+    case MO_8:
+        tcg_out_ext8u(s, TCG_REG_EAX, TCG_REG_EAX);
+        break;
+    case MO_16:
+        tcg_out_ext16u(s, TCG_REG_EAX, TCG_REG_EAX);
+        break;
+    case MO_32:
+        if (is64) {
+            tcg_out_ext32u(s, TCG_REG_EAX, TCG_REG_EAX);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void tcg_out_qemu_cmpxchg(TCGContext *s, const TCGArg *args, bool is64)
+{
+    TCGReg datalo = args[0];
+    TCGReg addrlo = args[1];
+    TCGReg cmpv = args[2];
+    TCGReg newv = args[3];
+    TCGMemOpIdx oi = args[4];
+    TCGMemOp opc = get_memop(oi);
+#if defined(CONFIG_SOFTMMU)
+    int mem_index = get_mmuidx(oi);
+    tcg_insn_unit *label_ptr[2];
+    TCGLabelQemuLdst *label;
+#endif
+
+    /* The constraints place both the result and the compare value in EAX.  */
+    tcg_debug_assert(datalo == TCG_REG_EAX && cmpv == TCG_REG_EAX);
+
+#if defined(CONFIG_SOFTMMU)
+    /* Leave unaligned accesses to the helper.  */
+    tcg_out_tlb_load(s, addrlo, 0, mem_index, (opc & ~MO_AMASK) | MO_ALIGN,
+                     label_ptr, offsetof(CPUTLBEntry, addr_write));
+
+    /* TLB Hit.  */
+    tcg_out_qemu_cmpxchg_direct(s, newv, TCG_REG_L1, -1, 0, 0, opc, is64);
+
+    /* Record the current context of a compare-and-swap into ldst label */
+    label = new_ldst_label(s);
+    label->is_ld = false;
+    label->is_cmpxchg = true;
+    label->oi = oi;
+    label->type = is64 ? TCG_TYPE_I64 : TCG_TYPE_I32;
+    label->datalo_reg = datalo;
+    label->addrlo_reg = addrlo;
+    label->cmpv_reg = cmpv;
+    label->newv_reg = newv;
+    label->raddr = s->code_ptr;
+    label->label_ptr[0] = label_ptr[0];
+#else
+    tcg_out_qemu_cmpxchg_direct(s, newv, addrlo, x86_guest_base_index,
+                                x86_guest_base_offset, x86_guest_base_seg,
+                                opc, is64);
+#endif
+}
+#endif
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -2456,6 +2640,14 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
     case INDEX_op_qemu_st_i64:
         tcg_out_qemu_st(s, args, 1);
         break;
+#if TCG_TARGET_HAS_qemu_cmpxchg
+    case INDEX_op_qemu_cmpxchg_i32:
+        tcg_out_qemu_cmpxchg(s, args, 0);
+        break;
+    case INDEX_op_qemu_cmpxchg_i64:
+        tcg_out_qemu_cmpxchg(s, args, 1);
+        break;
+#endif
 
     OP_32_64(mulu2):
         tcg_out_modrm(s, OPC_GRP3_Ev + rexw, EXT3_MUL, args[3]);
@@ -2627,7 +2819,7 @@ static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
         OPC_PSUBUB, OPC_PSUBUW, OPC_UD2, OPC_UD2
     };
     static int const mul_insn[4] = {
-        OPC_UD2, OPC_PMULLW, OPC_PMULLD, OPC_UD2
+        OPC_UD2, OPC_PMULLW, OPC_PMULLD, OPC_VPMULLQ
     };
     static int const shift_imm_insn[4] = {
         OPC_UD2, OPC_PSHIFTW_Ib, OPC_PSHIFTD_Ib, OPC_PSHIFTQ_Ib
@@ -2651,16 +2843,16 @@ static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
         OPC_PACKUSWB, OPC_PACKUSDW, OPC_UD2, OPC_UD2
     };
     static int const smin_insn[4] = {
-        OPC_PMINSB, OPC_PMINSW, OPC_PMINSD, OPC_UD2
+        OPC_PMINSB, OPC_PMINSW, OPC_PMINSD, OPC_VPMINSQ
     };
     static int const smax_insn[4] = {
-        OPC_PMAXSB, OPC_PMAXSW, OPC_PMAXSD, OPC_UD2
+        OPC_PMAXSB, OPC_PMAXSW, OPC_PMAXSD, OPC_VPMAXSQ
     };
     static int const umin_insn[4] = {
-        OPC_PMINUB, OPC_PMINUW, OPC_PMINUD, OPC_UD2
+        OPC_PMINUB, OPC_PMINUW, OPC_PMINUD, OPC_VPMINUQ
     };
     static int const umax_insn[4] = {
-        OPC_PMAXUB, OPC_PMAXUW, OPC_PMAXUD, OPC_UD2
+        OPC_PMAXUB, OPC_PMAXUW, OPC_PMAXUD, OPC_VPMAXUQ
     };
 
     TCGType type = vecl + TCG_TYPE_V64;
@@ -2737,7 +2929,11 @@ static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
         if (type == TCG_TYPE_V256) {
             insn |= P_VEXL;
         }
-        tcg_out_vex_modrm(s, insn, a0, a1, a2);
+        if (insn & P_EVEX) {
+            tcg_out_evex_modrm(s, insn, a0, a1, a2);
+        } else {
+            tcg_out_vex_modrm(s, insn, a0, a1, a2);
+        }
         break;
 
     case INDEX_op_cmp_vec:
@@ -2766,15 +2962,23 @@ static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
         sub = 2;
         goto gen_shift;
     case INDEX_op_sari_vec:
-        tcg_debug_assert(vece != MO_64);
         sub = 4;
+        if (vece == MO_64) {
+            insn = OPC_VPSRAQ_Ib;
+            goto gen_shift_insn;
+        }
     gen_shift:
         tcg_debug_assert(vece != MO_8);
         insn = shift_imm_insn[vece];
+    gen_shift_insn:
         if (type == TCG_TYPE_V256) {
             insn |= P_VEXL;
         }
-        tcg_out_vex_modrm(s, insn, sub, a0, a1);
+        if (insn & P_EVEX) {
+            tcg_out_evex_modrm(s, insn, sub, a0, a1);
+        } else {
+            tcg_out_vex_modrm(s, insn, sub, a0, a1);
+        }
         tcg_out8(s, a2);
         break;
 
@@ -3050,6 +3254,13 @@ static const TCGTargetOpDef *tcg_target_op_def(TCGOpcode op)
         return (TCG_TARGET_REG_BITS == 64 ? &L_L
                 : TARGET_LONG_BITS <= TCG_TARGET_REG_BITS ? &L_L_L
                 : &L_L_L_L);
+    case INDEX_op_qemu_cmpxchg_i32:
+    case INDEX_op_qemu_cmpxchg_i64:
+        {
+            static const TCGTargetOpDef cmpxchg
+                = { .args_ct_str = { "a", "L", "0", "L" } };
+            return &cmpxchg;
+        }
 
     case INDEX_op_brcond2_i32:
         {
@@ -3133,9 +3344,12 @@ int tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece)
         if (vece == MO_8) {
             return -1;
         }
-        /* We can emulate this for MO_64, but it does not pay off
-           unless we're producing at least 4 values.  */
+        /* AVX-512VL has VPSRAQ.  Otherwise we can emulate this for MO_64,
+           but it does not pay off unless we're producing at least 4 values.  */
         if (vece == MO_64) {
+            if (have_avx512vl) {
+                return 1;
+            }
             return type >= TCG_TYPE_V256 ? -1 : 0;
         }
         return 1;
@@ -3146,7 +3360,8 @@ int tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece)
             return -1;
         }
         if (vece == MO_64) {
-            return 0;
+            /* VPMULLQ */
+            return have_avx512vl && have_avx512dq;
         }
         return 1;
 
@@ -3159,7 +3374,7 @@ int tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece)
     case INDEX_op_smax_vec:
     case INDEX_op_umin_vec:
     case INDEX_op_umax_vec:
-        return vece <= MO_32 ? 1 : -1;
+        return vece <= MO_32 || have_avx512vl ? 1 : -1;
 
     default:
         return 0;
@@ -3609,6 +3824,11 @@ static void tcg_target_init(TCGContext *s)
                 have_avx1 = (c & bit_AVX) != 0;
                 have_avx2 = (b7 & bit_AVX2) != 0;
             }
+            /* The opmask and zmm state must also be enabled for EVEX.  */
+            if ((xcrl & 0xe6) == 0xe6 && (b7 & bit_AVX512F)) {
+                have_avx512vl = (b7 & bit_AVX512VL) != 0;
+                have_avx512dq = (b7 & bit_AVX512DQ) != 0;
+            }
         }
     }
 
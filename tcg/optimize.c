@@ -42,9 +42,16 @@ struct tcg_temp_info {
     TCGTemp *prev_copy;
     TCGTemp *next_copy;
     tcg_target_ulong val;
-    tcg_target_ulong mask;
+    tcg_target_ulong mask;      /* bits that may be set */
+    tcg_target_ulong o_mask;    /* bits known to be set */
+    tcg_target_ulong s_mask;    /* leading bits known equal to the msb */
 };
 
+/* The values of 32-bit temps are only defined in their low 32 bits, so
+   o_mask then only has these bits.  s_mask is kept sign-extended from
+   bit 31 instead, which makes a 32-bit value sign-extended from N bits
+   have the same s_mask as a 64-bit one.  */
+
 static inline struct tcg_temp_info *ts_info(TCGTemp *ts)
 {
     return ts->state_ptr;
@@ -83,6 +90,8 @@ static void reset_ts(TCGTemp *ts)
     ti->prev_copy = ts;
     ti->is_const = false;
     ti->mask = -1;
+    ti->o_mask = 0;
+    ti->s_mask = 0;
 }
 
 static void reset_temp(TCGArg arg)
@@ -103,6 +112,8 @@ static void init_ts_info(struct tcg_temp_info *infos,
         ti->prev_copy = ts;
         ti->is_const = false;
         ti->mask = -1;
+        ti->o_mask = 0;
+        ti->s_mask = 0;
         set_bit(idx, temps_used->l);
     }
 }
@@ -113,6 +124,44 @@ static void init_arg_info(struct tcg_temp_info *infos,
     init_ts_info(infos, temps_used, arg_temp(arg));
 }
 
+/* The leading bits of VAL that are copies of its most significant bit,
+   as an s_mask.  */
+static tcg_target_ulong smask_from_value(uint64_t val, bool is64)
+{
+    int rep;
+
+    if (is64) {
+        rep = clrsb64(val);
+        return ~(UINT64_MAX >> rep >> 1);
+    }
+    rep = clrsb32(val);
+    return (int32_t)~(UINT32_MAX >> rep >> 1);
+}
+
+/* Likewise, for the leading bits that MASK shows to be zero.  */
+static tcg_target_ulong smask_from_zmask(uint64_t mask, bool is64)
+{
+    int rep = is64 ? clz64(mask) : clz32(mask);
+
+    if (rep == 0) {
+        return 0;
+    }
+    if (is64) {
+        return ~(UINT64_MAX >> (rep - 1) >> 1);
+    }
+    return (int32_t)~(UINT32_MAX >> (rep - 1) >> 1);
+}
+
+/* Count an op that the known bits of its inputs simplified.  */
+static inline void count_known_bits(void)
+{
+#ifdef CONFIG_PROFILER
+    TCGProfile *prof = &tcg_ctx->prof;
+
+    atomic_set(&prof->known_bits_count, prof->known_bits_count + 1);
+#endif
+}
+
 static TCGTemp *find_better_copy(TCGContext *s, TCGTemp *ts)
 {
     TCGTemp *i;
@@ -197,6 +246,12 @@ static void tcg_opt_gen_movi(TCGContext *s, TCGOp *op, TCGArg dst, TCGArg val)
         mask |= ~0xffffffffull;
     }
     di->mask = mask;
+    if (new_op != INDEX_op_dupi_vec) {
+        bool is64 = new_op == INDEX_op_movi_i64;
+
+        di->o_mask = is64 ? val : (uint32_t)val;
+        di->s_mask = smask_from_value(val, is64);
+    }
 }
 
 static void tcg_opt_gen_mov(TCGContext *s, TCGOp *op, TCGArg dst, TCGArg src)
@@ -236,6 +291,14 @@ static void tcg_opt_gen_mov(TCGContext *s, TCGOp *op, TCGArg dst, TCGArg src)
         mask |= ~0xffffffffull;
     }
     di->mask = mask;
+    if (new_op != INDEX_op_mov_vec) {
+        mask = si->o_mask;
+        if (new_op == INDEX_op_mov_i32) {
+            mask = (uint32_t)mask;
+        }
+        di->o_mask = mask;
+        di->s_mask = si->s_mask;
+    }
 
     if (src_ts->type == dst_ts->type) {
         struct tcg_temp_info *ni = ts_info(si->next_copy);
@@ -498,6 +561,66 @@ static bool do_constant_folding_cond_eq(TCGCond c)
     }
 }
 
+/* Return 2 if the comparison of X with the constant Y can't be decided
+   from the bits known in X, and its result (0 or 1) if it can.  These
+   bits give the range [o_mask, mask] of X as an unsigned value.  */
+static TCGArg do_known_bits_cond(TCGOpcode op, TCGArg x,
+                                 uint64_t y, TCGCond c)
+{
+    struct tcg_temp_info *xi = arg_info(x);
+    uint64_t min = xi->o_mask, max = xi->mask, sign = INT64_MIN;
+
+    if (!(tcg_op_defs[op].flags & TCG_OPF_64BIT)) {
+        min = (uint32_t)min;
+        max = (uint32_t)max;
+        y = (uint32_t)y;
+        sign = 0x80000000u;
+    }
+
+    switch (c) {
+    case TCG_COND_LT:
+    case TCG_COND_GE:
+    case TCG_COND_LE:
+    case TCG_COND_GT:
+        /* With the sign of X known, this is either decided by the sign
+           of Y or the same as the unsigned comparison.  */
+        if ((min ^ max) & sign) {
+            return 2;
+        }
+        if ((min ^ y) & sign) {
+            return (c == TCG_COND_LT || c == TCG_COND_LE) == !!(min & sign);
+        }
+        c = tcg_unsigned_cond(c);
+        break;
+    default:
+        break;
+    }
+
+    switch (c) {
+    case TCG_COND_EQ:
+    case TCG_COND_NE:
+        if ((y & ~max) || (min & ~y)) {
+            return c == TCG_COND_NE;
+        }
+        break;
+    case TCG_COND_LTU:
+    case TCG_COND_GEU:
+        if (max < y || min >= y) {
+            return (max < y) == (c == TCG_COND_LTU);
+        }
+        break;
+    case TCG_COND_LEU:
+    case TCG_COND_GTU:
+        if (max <= y || min > y) {
+            return (max <= y) == (c == TCG_COND_LEU);
+        }
+        break;
+    default:
+        tcg_abort();
+    }
+    return 2;
+}
+
 /* Return 2 if the condition can't be simplified, and the result
    of the condition (0 or 1) if it can */
 static TCGArg do_constant_folding_cond(TCGOpcode op, TCGArg x,
@@ -515,15 +638,13 @@ static TCGArg do_constant_folding_cond(TCGOpcode op, TCGArg x,
         }
     } else if (args_are_copies(x, y)) {
         return do_constant_folding_cond_eq(c);
-    } else if (arg_is_const(y) && yv == 0) {
-        switch (c) {
-        case TCG_COND_LTU:
-            return 0;
-        case TCG_COND_GEU:
-            return 1;
-        default:
-            return 2;
+    } else if (arg_is_const(y)) {
+        TCGArg ret = do_known_bits_cond(op, x, yv, c);
+
+        if (ret != 2) {
+            count_known_bits();
         }
+        return ret;
     }
     return 2;
 }
@@ -615,7 +736,7 @@ void tcg_optimize(TCGContext *s)
     infos = tcg_malloc(sizeof(struct tcg_temp_info) * nb_temps);
 
     QTAILQ_FOREACH_SAFE(op, &s->ops, link, op_next) {
-        tcg_target_ulong mask, partmask, affected;
+        tcg_target_ulong mask, partmask, affected, o_mask, s_mask;
         int nb_oargs, nb_iargs, i;
         TCGArg tmp;
         TCGOpcode opc = op->opc;
@@ -844,52 +965,97 @@ void tcg_optimize(TCGContext *s)
             break;
         }
 
+        /* Simplify using known sign bits: the sign extension of a value
+           that is already sign-extended is a move.  */
+        switch (opc) {
+        CASE_OP_32_64(ext8s):
+            tmp = ~(tcg_target_ulong)0x7f;
+            goto do_sext;
+        CASE_OP_32_64(ext16s):
+            tmp = ~(tcg_target_ulong)0x7fff;
+            goto do_sext;
+        case INDEX_op_ext32s_i64:
+            tmp = ~(tcg_target_ulong)0x7fffffff;
+        do_sext:
+            if (!arg_is_const(op->args[1])
+                && (arg_info(op->args[1])->s_mask & tmp) == tmp) {
+                count_known_bits();
+                tcg_opt_gen_mov(s, op, op->args[0], op->args[1]);
+                continue;
+            }
+            break;
+        default:
+            break;
+        }
+
         /* Simplify using known-zero bits. Currently only ops with a single
-           output argument is supported. */
+           output argument is supported.  Along the way, compute the known
+           one and sign bits of the output.  */
         mask = -1;
         affected = -1;
+        o_mask = 0;
+        s_mask = 0;
         switch (opc) {
         CASE_OP_32_64(ext8s):
             if ((arg_info(op->args[1])->mask & 0x80) != 0) {
-                break;
+                tmp = 8;
+                goto sext_bits;
             }
         CASE_OP_32_64(ext8u):
             mask = 0xff;
             goto and_const;
         CASE_OP_32_64(ext16s):
             if ((arg_info(op->args[1])->mask & 0x8000) != 0) {
-                break;
+                tmp = 16;
+                goto sext_bits;
             }
         CASE_OP_32_64(ext16u):
             mask = 0xffff;
             goto and_const;
         case INDEX_op_ext32s_i64:
             if ((arg_info(op->args[1])->mask & 0x80000000) != 0) {
-                break;
+                tmp = 32;
+                goto sext_bits;
             }
         case INDEX_op_ext32u_i64:
             mask = 0xffffffffU;
             goto and_const;
 
+        sext_bits:
+            mask = sextract64(arg_info(op->args[1])->mask, 0, tmp);
+            o_mask = sextract64(arg_info(op->args[1])->o_mask, 0, tmp);
+            s_mask = (tcg_target_ulong)-1 << (tmp - 1);
+            break;
+
         CASE_OP_32_64(and):
             mask = arg_info(op->args[2])->mask;
+            o_mask = arg_info(op->args[2])->o_mask;
+            s_mask = arg_info(op->args[1])->s_mask
+                     & arg_info(op->args[2])->s_mask;
             if (arg_is_const(op->args[2])) {
         and_const:
                 affected = arg_info(op->args[1])->mask & ~mask;
+                o_mask = mask;
             }
             mask = arg_info(op->args[1])->mask & mask;
+            o_mask &= arg_info(op->args[1])->o_mask;
             break;
 
         case INDEX_op_ext_i32_i64:
+            o_mask = (int32_t)arg_info(op->args[1])->o_mask;
+            s_mask = arg_info(op->args[1])->s_mask | (tcg_target_ulong)-1 << 31;
             if ((arg_info(op->args[1])->mask & 0x80000000) != 0) {
                 break;
             }
         case INDEX_op_extu_i32_i64:
             /* We do not compute affected as it is a size changing op.  */
             mask = (uint32_t)arg_info(op->args[1])->mask;
+            o_mask = (uint32_t)arg_info(op->args[1])->o_mask;
             break;
 
         CASE_OP_32_64(andc):
+            s_mask = arg_info(op->args[1])->s_mask
+                     & arg_info(op->args[2])->s_mask;
             /* Known-zeros does not imply known-ones.  Therefore unless
                op->args[2] is constant, we can't infer anything from it.  */
             if (arg_is_const(op->args[2])) {
@@ -898,18 +1064,26 @@ void tcg_optimize(TCGContext *s)
             }
             /* But we certainly know nothing outside args[1] may be set. */
             mask = arg_info(op->args[1])->mask;
+            o_mask = arg_info(op->args[1])->o_mask
+                     & ~arg_info(op->args[2])->mask;
             break;
 
         case INDEX_op_sar_i32:
             if (arg_is_const(op->args[2])) {
                 tmp = arg_info(op->args[2])->val & 31;
                 mask = (int32_t)arg_info(op->args[1])->mask >> tmp;
+                o_mask = (int32_t)arg_info(op->args[1])->o_mask >> tmp;
+                s_mask = (int32_t)arg_info(op->args[1])->s_mask >> tmp;
+                s_mask |= (int32_t)~(UINT32_MAX >> tmp >> 1);
             }
             break;
         case INDEX_op_sar_i64:
             if (arg_is_const(op->args[2])) {
                 tmp = arg_info(op->args[2])->val & 63;
                 mask = (int64_t)arg_info(op->args[1])->mask >> tmp;
+                o_mask = (int64_t)arg_info(op->args[1])->o_mask >> tmp;
+                s_mask = (int64_t)arg_info(op->args[1])->s_mask >> tmp;
+                s_mask |= ~(UINT64_MAX >> tmp >> 1);
             }
             break;
 
@@ -917,26 +1091,34 @@ void tcg_optimize(TCGContext *s)
             if (arg_is_const(op->args[2])) {
                 tmp = arg_info(op->args[2])->val & 31;
                 mask = (uint32_t)arg_info(op->args[1])->mask >> tmp;
+                o_mask = (uint32_t)arg_info(op->args[1])->o_mask >> tmp;
             }
             break;
         case INDEX_op_shr_i64:
             if (arg_is_const(op->args[2])) {
                 tmp = arg_info(op->args[2])->val & 63;
                 mask = (uint64_t)arg_info(op->args[1])->mask >> tmp;
+                o_mask = (uint64_t)arg_info(op->args[1])->o_mask >> tmp;
             }
             break;
 
         case INDEX_op_extrl_i64_i32:
             mask = (uint32_t)arg_info(op->args[1])->mask;
+            o_mask = (uint32_t)arg_info(op->args[1])->o_mask;
+            s_mask = (int32_t)arg_info(op->args[1])->s_mask;
             break;
         case INDEX_op_extrh_i64_i32:
             mask = (uint64_t)arg_info(op->args[1])->mask >> 32;
+            o_mask = (uint64_t)arg_info(op->args[1])->o_mask >> 32;
+            s_mask = (int32_t)((uint64_t)arg_info(op->args[1])->s_mask >> 32);
             break;
 
         CASE_OP_32_64(shl):
             if (arg_is_const(op->args[2])) {
                 tmp = arg_info(op->args[2])->val & (TCG_TARGET_REG_BITS - 1);
                 mask = arg_info(op->args[1])->mask << tmp;
+                o_mask = arg_info(op->args[1])->o_mask << tmp;
+                s_mask = arg_info(op->args[1])->s_mask << tmp;
             }
             break;
 
@@ -946,15 +1128,26 @@ void tcg_optimize(TCGContext *s)
                      & -arg_info(op->args[1])->mask);
             break;
 
+        CASE_OP_32_64(not):
+            mask = ~arg_info(op->args[1])->o_mask;
+            o_mask = ~arg_info(op->args[1])->mask;
+            s_mask = arg_info(op->args[1])->s_mask;
+            break;
+
         CASE_OP_32_64(deposit):
             mask = deposit64(arg_info(op->args[1])->mask,
                              op->args[3], op->args[4],
                              arg_info(op->args[2])->mask);
+            o_mask = deposit64(arg_info(op->args[1])->o_mask,
+                               op->args[3], op->args[4],
+                               arg_info(op->args[2])->o_mask);
             break;
 
         CASE_OP_32_64(extract):
             mask = extract64(arg_info(op->args[1])->mask,
                              op->args[2], op->args[3]);
+            o_mask = extract64(arg_info(op->args[1])->o_mask,
+                               op->args[2], op->args[3]);
             if (op->args[2] == 0) {
                 affected = arg_info(op->args[1])->mask & ~mask;
             }
@@ -962,14 +1155,34 @@ void tcg_optimize(TCGContext *s)
         CASE_OP_32_64(sextract):
             mask = sextract64(arg_info(op->args[1])->mask,
                               op->args[2], op->args[3]);
+            o_mask = sextract64(arg_info(op->args[1])->o_mask,
+                                op->args[2], op->args[3]);
+            s_mask = (tcg_target_ulong)-1 << (op->args[3] - 1);
             if (op->args[2] == 0 && (tcg_target_long)mask >= 0) {
                 affected = arg_info(op->args[1])->mask & ~mask;
             }
             break;
 
         CASE_OP_32_64(or):
+            mask = arg_info(op->args[1])->mask | arg_info(op->args[2])->mask;
+            o_mask = arg_info(op->args[1])->o_mask
+                     | arg_info(op->args[2])->o_mask;
+            s_mask = arg_info(op->args[1])->s_mask
+                     & arg_info(op->args[2])->s_mask;
+            /* Or'ing in bits that are known to be set changes nothing.  */
+            if (arg_is_const(op->args[2])) {
+                affected = arg_info(op->args[2])->val
+                           & ~arg_info(op->args[1])->o_mask;
+            }
+            break;
         CASE_OP_32_64(xor):
             mask = arg_info(op->args[1])->mask | arg_info(op->args[2])->mask;
+            o_mask = (arg_info(op->args[1])->o_mask
+                      & ~arg_info(op->args[2])->mask)
+                     | (arg_info(op->args[2])->o_mask
+                        & ~arg_info(op->args[1])->mask);
+            s_mask = arg_info(op->args[1])->s_mask
+                     & arg_info(op->args[2])->s_mask;
             break;
 
         case INDEX_op_clz_i32:
@@ -996,6 +1209,10 @@ void tcg_optimize(TCGContext *s)
 
         CASE_OP_32_64(movcond):
             mask = arg_info(op->args[3])->mask | arg_info(op->args[4])->mask;
+            o_mask = arg_info(op->args[3])->o_mask
+                     & arg_info(op->args[4])->o_mask;
+            s_mask = arg_info(op->args[3])->s_mask
+                     & arg_info(op->args[4])->s_mask;
             break;
 
         CASE_OP_32_64(ld8u):
@@ -1008,12 +1225,25 @@ void tcg_optimize(TCGContext *s)
             mask = 0xffffffffu;
             break;
 
+        CASE_OP_32_64(ld8s):
+            s_mask = (tcg_target_ulong)-1 << 7;
+            break;
+        CASE_OP_32_64(ld16s):
+            s_mask = (tcg_target_ulong)-1 << 15;
+            break;
+        case INDEX_op_ld32s_i64:
+            s_mask = (tcg_target_ulong)-1 << 31;
+            break;
+
         CASE_OP_32_64(qemu_ld):
             {
                 TCGMemOpIdx oi = op->args[nb_oargs + nb_iargs];
                 TCGMemOp mop = get_memop(oi);
                 if (!(mop & MO_SIGN)) {
                     mask = (2ULL << ((8 << (mop & MO_SIZE)) - 1)) - 1;
+                } else if ((mop & MO_SIZE) < MO_64) {
+                    tmp = (8 << (mop & MO_SIZE)) - 1;
+                    s_mask = (tcg_target_ulong)-1 << tmp;
                 }
             }
             break;
@@ -1030,6 +1260,8 @@ void tcg_optimize(TCGContext *s)
             mask |= ~(tcg_target_ulong)0xffffffffu;
             partmask &= 0xffffffffu;
             affected &= 0xffffffffu;
+            o_mask &= 0xffffffffu;
+            s_mask = (int32_t)s_mask;
         }
 
         if (partmask == 0) {
@@ -1042,6 +1274,16 @@ void tcg_optimize(TCGContext *s)
             tcg_opt_gen_mov(s, op, op->args[0], op->args[1]);
             continue;
         }
+        if ((partmask & ~o_mask) == 0 && !arg_is_const(op->args[1])) {
+            /* Every bit that may be set is known to be set.  */
+            tcg_debug_assert(nb_oargs == 1);
+            count_known_bits();
+            tcg_opt_gen_movi(s, op, op->args[0],
+                             def->flags & TCG_OPF_64BIT
+                             ? partmask : (int32_t)partmask);
+            continue;
+        }
+        s_mask |= smask_from_zmask(partmask, def->flags & TCG_OPF_64BIT);
 
         /* Simplify expression for "op r, a, 0 => movi r, 0" cases */
         switch (opc) {
@@ -1467,9 +1709,12 @@ void tcg_optimize(TCGContext *s)
                 for (i = 0; i < nb_oargs; i++) {
                     reset_temp(op->args[i]);
                     /* Save the corresponding known-zero bits mask for the
-                       first output argument (only one supported so far). */
+                       first output argument (only one supported so far),
+                       together with its known one and sign bits.  */
                     if (i == 0) {
                         arg_info(op->args[i])->mask = mask;
+                        arg_info(op->args[i])->o_mask = o_mask;
+                        arg_info(op->args[i])->s_mask = s_mask;
                     }
                 }
             }
@@ -1505,6 +1750,8 @@ void tcg_optimize(TCGContext *s)
             case INDEX_op_qemu_ld_i64:
             case INDEX_op_qemu_st_i32:
             case INDEX_op_qemu_st_i64:
+            case INDEX_op_qemu_cmpxchg_i32:
+            case INDEX_op_qemu_cmpxchg_i64:
             case INDEX_op_call:
                 /* Opcodes that touch guest memory stop the optimization.  */
                 prev_mb = NULL;
@@ -1515,3 +1762,161 @@ void tcg_optimize(TCGContext *s)
         }
     }
 }
+
+/*
+ * Forward values stored to, or loaded from, fixed offsets of env to later
+ * loads of the same field within a basic block.  Frontends reload CPU
+ * state fields that are not TCG globals for every guest instruction that
+ * uses them; this turns the repeated loads into moves, which
+ * tcg_optimize can then propagate as copies.  Only used for hot TBs,
+ * since the extra pass is not worth it for code that runs a few times.
+ *
+ * The table is conservative: it is flushed at the end of each basic
+ * block, by helper calls and by any op with side effects, and by stores
+ * through a base other than env, which may point into env.
+ */
+#define ENV_FWD_ENTRIES 16
+
+struct env_fwd_entry {
+    intptr_t ofs;
+    int size;
+    TCGTemp *val;
+};
+
+static void env_fwd_invalidate(struct env_fwd_entry *tab, int *nb,
+                               intptr_t ofs, int size)
+{
+    int i;
+
+    for (i = 0; i < *nb; ) {
+        if (tab[i].ofs < ofs + size && ofs < tab[i].ofs + tab[i].size) {
+            tab[i] = tab[--*nb];
+        } else {
+            i++;
+        }
+    }
+}
+
+static void env_fwd_record(struct env_fwd_entry *tab, int *nb,
+                           intptr_t ofs, int size, TCGTemp *val)
+{
+    if (*nb == ENV_FWD_ENTRIES) {
+        /* Make room by dropping the first entry.  */
+        memmove(tab, tab + 1, sizeof(*tab) * (ENV_FWD_ENTRIES - 1));
+        --*nb;
+    }
+    tab[*nb].ofs = ofs;
+    tab[*nb].size = size;
+    tab[*nb].val = val;
+    ++*nb;
+}
+
+void tcg_optimize_env_loads(TCGContext *s)
+{
+    struct env_fwd_entry tab[ENV_FWD_ENTRIES];
+    TCGTemp *env = tcgv_ptr_temp(cpu_env);
+    TCGOp *op;
+    int nb = 0;
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        TCGTemp *forward = NULL;
+        intptr_t ofs = 0;
+        int i, size = 0;
+
+        switch (opc) {
+        case INDEX_op_ld_i32:
+        case INDEX_op_ld_i64:
+            if (arg_temp(op->args[1]) != env) {
+                goto reset_output;
+            }
+            ofs = op->args[2];
+            size = opc == INDEX_op_ld_i32 ? 4 : 8;
+            for (i = 0; i < nb; i++) {
+                if (tab[i].ofs == ofs && tab[i].size == size) {
+                    forward = tab[i].val;
+                    break;
+                }
+            }
+            if (forward && forward != arg_temp(op->args[0])) {
+                op->opc = (opc == INDEX_op_ld_i32
+                           ? INDEX_op_mov_i32 : INDEX_op_mov_i64);
+                op->args[1] = temp_arg(forward);
+                goto reset_output;
+            }
+            break;
+
+        CASE_OP_32_64(st8):
+        CASE_OP_32_64(st16):
+        case INDEX_op_st32_i64:
+        case INDEX_op_st_i32:
+        case INDEX_op_st_i64:
+            if (arg_temp(op->args[1]) != env) {
+                nb = 0;
+                continue;
+            }
+            ofs = op->args[2];
+            switch (opc) {
+            CASE_OP_32_64(st8):
+                size = 1;
+                break;
+            CASE_OP_32_64(st16):
+                size = 2;
+                break;
+            case INDEX_op_st32_i64:
+            case INDEX_op_st_i32:
+                size = 4;
+                break;
+            default:
+                size = 8;
+                break;
+            }
+            env_fwd_invalidate(tab, &nb, ofs, size);
+            if (opc == INDEX_op_st_i32 || opc == INDEX_op_st_i64) {
+                env_fwd_record(tab, &nb, ofs, size, arg_temp(op->args[0]));
+            }
+            continue;
+
+        case INDEX_op_st_vec:
+        case INDEX_op_call:
+            nb = 0;
+            continue;
+
+        default:
+            if (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS
+                              | TCG_OPF_CALL_CLOBBER)) {
+                nb = 0;
+                continue;
+            }
+            goto reset_output;
+        }
+
+        /* A load that is kept: its output becomes the cached value, once
+           the entries held in the same temp are dropped.  */
+        for (i = 0; i < nb; ) {
+            if (tab[i].val == arg_temp(op->args[0])) {
+                tab[i] = tab[--nb];
+            } else {
+                i++;
+            }
+        }
+        env_fwd_record(tab, &nb, ofs, size, arg_temp(op->args[0]));
+        continue;
+
+    reset_output:
+        /* Entries held in a temp that is redefined are stale.  */
+        for (i = 0; i < def->nb_oargs; i++) {
+            TCGTemp *ts = arg_temp(op->args[i]);
+            int j;
+
+            for (j = 0; j < nb; ) {
+                if (tab[j].val == ts) {
+                    tab[j] = tab[--nb];
+                } else {
+                    j++;
+                }
+            }
+        }
+    }
+}
@@ -30,6 +30,9 @@ typedef struct TCGLabelQemuLdst {
     TCGReg datahi_reg;      /* reg index for high word to be loaded or stored */
     tcg_insn_unit *raddr;   /* gen code addr of the next IR of qemu_ld/st IR */
     tcg_insn_unit *label_ptr[2]; /* label pointers to be updated */
+    bool is_cmpxchg;        /* qemu_cmpxchg: true, with is_ld false */
+    TCGReg cmpv_reg;        /* reg index for the compare value of cmpxchg */
+    TCGReg newv_reg;        /* reg index for the new value of cmpxchg */
     QSIMPLEQ_ENTRY(TCGLabelQemuLdst) next;
 } TCGLabelQemuLdst;
 
@@ -40,6 +43,9 @@ typedef struct TCGLabelQemuLdst {
 
 static void tcg_out_qemu_ld_slow_path(TCGContext *s, TCGLabelQemuLdst *l);
 static void tcg_out_qemu_st_slow_path(TCGContext *s, TCGLabelQemuLdst *l);
+#if TCG_TARGET_HAS_qemu_cmpxchg
+static void tcg_out_qemu_cmpxchg_slow_path(TCGContext *s, TCGLabelQemuLdst *l);
+#endif
 
 static bool tcg_out_ldst_finalize(TCGContext *s)
 {
@@ -49,6 +55,10 @@ static bool tcg_out_ldst_finalize(TCGContext *s)
     QSIMPLEQ_FOREACH(lb, &s->ldst_labels, next) {
         if (lb->is_ld) {
             tcg_out_qemu_ld_slow_path(s, lb);
+#if TCG_TARGET_HAS_qemu_cmpxchg
+        } else if (lb->is_cmpxchg) {
+            tcg_out_qemu_cmpxchg_slow_path(s, lb);
+#endif
         } else {
             tcg_out_qemu_st_slow_path(s, lb);
         }
@@ -72,6 +82,7 @@ static inline TCGLabelQemuLdst *new_ldst_label(TCGContext *s)
 {
     TCGLabelQemuLdst *l = tcg_malloc(sizeof(*l));
 
+    l->is_cmpxchg = false;
     QSIMPLEQ_INSERT_TAIL(&s->ldst_labels, l, next);
 
     return l;
@@ -26,11 +26,13 @@
 #include "qemu-common.h"
 #include "cpu.h"
 #include "exec/exec-all.h"
+#include "exec/tb-hash.h"
 #include "tcg.h"
 #include "tcg-op.h"
 #include "tcg-mo.h"
 #include "trace-tcg.h"
 #include "trace/mem.h"
+#include "exec/plugin-gen.h"
 
 /* Reduce the number of ifdefs below.  This assumes that all uses of
    TCGV_HIGH and TCGV_LOW are properly protected by a conditional that
@@ -2620,6 +2622,91 @@ void tcg_gen_lookup_and_goto_ptr(void)
     }
 }
 
+void tcg_gen_lookup_and_goto_ptr_cached(const TranslationBlock *tb,
+                                        uint32_t flags, TCGv addr)
+{
+    /* As computed by tb_lookup__cpu_state(), from curr_cflags() */
+    uint32_t cf_mask = tb->cflags & (CF_PARALLEL | CF_USE_ICOUNT |
+                                     CF_CLUSTER_MASK);
+    TCGLabel *miss;
+    TCGv t0, t1, pc;
+    TCGv_i32 c, t32;
+    TCGv_ptr ptr, ofs;
+
+    if (!TCG_TARGET_HAS_goto_ptr || qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
+        tcg_gen_exit_tb(NULL, 0);
+        return;
+    }
+
+    miss = gen_new_label();
+    t0 = tcg_temp_new();
+    t1 = tcg_temp_new();
+
+    /* tb_jmp_cache_hash_func(addr) */
+#ifdef CONFIG_SOFTMMU
+    tcg_gen_shri_tl(t0, addr, TARGET_PAGE_BITS - TB_JMP_PAGE_BITS);
+    tcg_gen_xor_tl(t0, t0, addr);
+    tcg_gen_shri_tl(t1, t0, TARGET_PAGE_BITS - TB_JMP_PAGE_BITS);
+    tcg_gen_andi_tl(t1, t1, TB_JMP_PAGE_MASK);
+    tcg_gen_andi_tl(t0, t0, TB_JMP_ADDR_MASK);
+    tcg_gen_or_tl(t0, t0, t1);
+#else
+    tcg_gen_shri_tl(t0, addr, tb_jmp_cache_bits);
+    tcg_gen_xor_tl(t0, t0, addr);
+    tcg_gen_andi_tl(t0, t0, TB_JMP_CACHE_SIZE - 1);
+#endif
+
+    t32 = tcg_temp_new_i32();
+    tcg_gen_trunc_tl_i32(t32, t0);
+    tcg_gen_shli_i32(t32, t32, ctz32(sizeof(TranslationBlock *)));
+    ofs = tcg_temp_new_ptr();
+    tcg_gen_ext_i32_ptr(ofs, t32);
+
+    /* Both are needed after the NULL check ends the basic block */
+    ptr = tcg_temp_local_new_ptr();
+    pc = tcg_temp_local_new();
+    tcg_gen_mov_tl(pc, addr);
+    tcg_gen_ld_ptr(ptr, cpu_env,
+                   -ENV_OFFSET + offsetof(CPUState, tb_jmp_cache));
+    tcg_gen_add_ptr(ptr, ptr, ofs);
+    tcg_gen_ld_ptr(ptr, ptr, 0);
+    tcg_temp_free_ptr(ofs);
+    tcg_gen_brcondi_ptr(TCG_COND_EQ, ptr, 0, miss);
+
+    /*
+     * Same checks as tb_lookup__cpu_state(), except for trace_vcpu_dstate:
+     * the jump cache is cleared whenever that changes, so the entries
+     * always match it.
+     */
+    c = tcg_temp_new_i32();
+    tcg_gen_ld_tl(t0, ptr, offsetof(TranslationBlock, pc));
+    tcg_gen_setcond_tl(TCG_COND_NE, t0, t0, pc);
+    tcg_gen_ld_tl(t1, ptr, offsetof(TranslationBlock, cs_base));
+    tcg_gen_setcondi_tl(TCG_COND_NE, t1, t1, tb->cs_base);
+    tcg_gen_or_tl(t0, t0, t1);
+    tcg_gen_trunc_tl_i32(c, t0);
+    tcg_gen_ld_i32(t32, ptr, offsetof(TranslationBlock, flags));
+    tcg_gen_xori_i32(t32, t32, flags);
+    tcg_gen_or_i32(c, c, t32);
+    tcg_gen_ld_i32(t32, ptr, offsetof(TranslationBlock, cflags));
+    tcg_gen_andi_i32(t32, t32, CF_HASH_MASK | CF_INVALID);
+    tcg_gen_xori_i32(t32, t32, cf_mask);
+    tcg_gen_or_i32(c, c, t32);
+    tcg_gen_brcondi_i32(TCG_COND_NE, c, 0, miss);
+    tcg_temp_free_i32(c);
+    tcg_temp_free_i32(t32);
+    tcg_temp_free(t0);
+    tcg_temp_free(t1);
+    tcg_temp_free(pc);
+
+    tcg_gen_ld_ptr(ptr, ptr, offsetof(TranslationBlock, tc.ptr));
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(ptr));
+    tcg_temp_free_ptr(ptr);
+
+    gen_set_label(miss);
+    tcg_gen_lookup_and_goto_ptr();
+}
+
 static inline TCGMemOp tcg_canonicalize_memop(TCGMemOp op, bool is64, bool st)
 {
     /* Trigger the asserts within as early as possible.  */
@@ -2683,6 +2770,32 @@ static void gen_ldst_i64(TCGOpcode opc, TCGv_i64 val, TCGv addr,
 #endif
 }
 
+/* Keep the address of an access for the plugins, see plugin-gen.c */
+static inline TCGv plugin_prep_mem_callbacks(TCGv vaddr)
+{
+#ifdef CONFIG_PLUGIN
+    if (tcg_ctx->plugin_insn) {
+        TCGv copy = tcg_temp_new();
+
+        tcg_gen_mov_tl(copy, vaddr);
+        return copy;
+    }
+#endif
+    return vaddr;
+}
+
+static inline void plugin_gen_mem_callbacks(TCGv vaddr, TCGMemOp memop,
+                                            bool is_store)
+{
+#ifdef CONFIG_PLUGIN
+    if (tcg_ctx->plugin_insn) {
+        plugin_gen_mem_access(vaddr, memop |
+                              (is_store ? PLUGIN_MEMINFO_STORE : 0));
+        tcg_temp_free(vaddr);
+    }
+#endif
+}
+
 static void tcg_gen_req_mo(TCGBar type)
 {
 #ifdef TCG_GUEST_DEFAULT_MO
@@ -2697,6 +2810,7 @@ static void tcg_gen_req_mo(TCGBar type)
 void tcg_gen_qemu_ld_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 {
     TCGMemOp orig_memop;
+    TCGv plugin_addr;
 
     tcg_gen_req_mo(TCG_MO_LD_LD | TCG_MO_ST_LD);
     memop = tcg_canonicalize_memop(memop, 0, 0);
@@ -2712,7 +2826,9 @@ void tcg_gen_qemu_ld_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
         }
     }
 
+    plugin_addr = plugin_prep_mem_callbacks(addr);
     gen_ldst_i32(INDEX_op_qemu_ld_i32, val, addr, memop, idx);
+    plugin_gen_mem_callbacks(plugin_addr, orig_memop, false);
 
     if ((orig_memop ^ memop) & MO_BSWAP) {
         switch (orig_memop & MO_SIZE) {
@@ -2734,12 +2850,15 @@ void tcg_gen_qemu_ld_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 void tcg_gen_qemu_st_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 {
     TCGv_i32 swap = NULL;
+    TCGMemOp orig_memop;
+    TCGv plugin_addr;
 
     tcg_gen_req_mo(TCG_MO_LD_ST | TCG_MO_ST_ST);
     memop = tcg_canonicalize_memop(memop, 0, 1);
     trace_guest_mem_before_tcg(tcg_ctx->cpu, cpu_env,
                                addr, trace_mem_get_info(memop, 1));
 
+    orig_memop = memop;
     if (!TCG_TARGET_HAS_MEMORY_BSWAP && (memop & MO_BSWAP)) {
         swap = tcg_temp_new_i32();
         switch (memop & MO_SIZE) {
@@ -2757,7 +2876,9 @@ void tcg_gen_qemu_st_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
         memop &= ~MO_BSWAP;
     }
 
+    plugin_addr = plugin_prep_mem_callbacks(addr);
     gen_ldst_i32(INDEX_op_qemu_st_i32, val, addr, memop, idx);
+    plugin_gen_mem_callbacks(plugin_addr, orig_memop, true);
 
     if (swap) {
         tcg_temp_free_i32(swap);
@@ -2767,6 +2888,7 @@ void tcg_gen_qemu_st_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 void tcg_gen_qemu_ld_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 {
     TCGMemOp orig_memop;
+    TCGv plugin_addr;
 
     if (TCG_TARGET_REG_BITS == 32 && (memop & MO_SIZE) < MO_64) {
         tcg_gen_qemu_ld_i32(TCGV_LOW(val), addr, idx, memop);
@@ -2792,7 +2914,9 @@ void tcg_gen_qemu_ld_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
         }
     }
 
+    plugin_addr = plugin_prep_mem_callbacks(addr);
     gen_ldst_i64(INDEX_op_qemu_ld_i64, val, addr, memop, idx);
+    plugin_gen_mem_callbacks(plugin_addr, orig_memop, false);
 
     if ((orig_memop ^ memop) & MO_BSWAP) {
         switch (orig_memop & MO_SIZE) {
@@ -2820,6 +2944,8 @@ void tcg_gen_qemu_ld_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 {
     TCGv_i64 swap = NULL;
+    TCGMemOp orig_memop;
+    TCGv plugin_addr;
 
     if (TCG_TARGET_REG_BITS == 32 && (memop & MO_SIZE) < MO_64) {
         tcg_gen_qemu_st_i32(TCGV_LOW(val), addr, idx, memop);
@@ -2831,6 +2957,7 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     trace_guest_mem_before_tcg(tcg_ctx->cpu, cpu_env,
                                addr, trace_mem_get_info(memop, 1));
 
+    orig_memop = memop;
     if (!TCG_TARGET_HAS_MEMORY_BSWAP && (memop & MO_BSWAP)) {
         swap = tcg_temp_new_i64();
         switch (memop & MO_SIZE) {
@@ -2852,7 +2979,9 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
         memop &= ~MO_BSWAP;
     }
 
+    plugin_addr = plugin_prep_mem_callbacks(addr);
     gen_ldst_i64(INDEX_op_qemu_st_i64, val, addr, memop, idx);
+    plugin_gen_mem_callbacks(plugin_addr, orig_memop, true);
 
     if (swap) {
         tcg_temp_free_i64(swap);
@@ -2939,6 +3068,29 @@ static void * const table_cmpxchg[16] = {
     WITH_ATOMIC64([MO_64 | MO_BE] = gen_helper_atomic_cmpxchgq_be)
 };
 
+/*
+ * Emit an inline, TLB checked host compare-and-swap; the backend calls the
+ * atomic helpers only on a TLB miss.  MEMOP must be host endian and unsigned.
+ */
+static void gen_qemu_cmpxchg(TCGOpcode opc, TCGArg retv, TCGv addr,
+                             TCGArg cmpv, TCGArg newv, TCGMemOp memop,
+                             TCGArg idx)
+{
+#if TARGET_LONG_BITS == 32
+    TCGArg a = tcgv_i32_arg(addr);
+#else
+    TCGArg a = tcgv_i64_arg(addr);
+#endif
+
+    tcg_debug_assert(!(memop & (MO_BSWAP | MO_SIGN)));
+    /* As ATOMIC_TRACE_RMW does in the helpers.  */
+    trace_guest_mem_before_tcg(tcg_ctx->cpu, cpu_env,
+                               addr, trace_mem_get_info(memop, 0));
+    trace_guest_mem_before_tcg(tcg_ctx->cpu, cpu_env,
+                               addr, trace_mem_get_info(memop, 1));
+    tcg_gen_op5(opc, retv, a, cmpv, newv, make_memop_idx(memop, idx));
+}
+
 void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
                                 TCGv_i32 newv, TCGArg idx, TCGMemOp memop)
 {
@@ -2961,6 +3113,13 @@ void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
             tcg_gen_mov_i32(retv, t1);
         }
         tcg_temp_free_i32(t1);
+    } else if (TCG_TARGET_HAS_qemu_cmpxchg && !(memop & MO_BSWAP)) {
+        gen_qemu_cmpxchg(INDEX_op_qemu_cmpxchg_i32, tcgv_i32_arg(retv), addr,
+                         tcgv_i32_arg(cmpv), tcgv_i32_arg(newv),
+                         memop & ~MO_SIGN, idx);
+        if (memop & MO_SIGN) {
+            tcg_gen_ext_i32(retv, retv, memop);
+        }
     } else {
         gen_atomic_cx_i32 gen;
 
@@ -3005,6 +3164,13 @@ void tcg_gen_atomic_cmpxchg_i64(TCGv_i64 retv, TCGv addr, TCGv_i64 cmpv,
             tcg_gen_mov_i64(retv, t1);
         }
         tcg_temp_free_i64(t1);
+    } else if (TCG_TARGET_HAS_qemu_cmpxchg && !(memop & MO_BSWAP)) {
+        gen_qemu_cmpxchg(INDEX_op_qemu_cmpxchg_i64, tcgv_i64_arg(retv), addr,
+                         tcgv_i64_arg(cmpv), tcgv_i64_arg(newv),
+                         memop & ~MO_SIGN, idx);
+        if (memop & MO_SIGN) {
+            tcg_gen_ext_i64(retv, retv, memop);
+        }
     } else if ((memop & MO_SIZE) == MO_64) {
 #ifdef CONFIG_ATOMIC64
         gen_atomic_cx_i64 gen;
@@ -827,6 +827,23 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_lookup_and_goto_ptr_cached() - tcg_gen_lookup_and_goto_ptr(), with
+ * the vCPU's TB jump cache probed inline
+ * @tb: The TB being translated
+ * @flags: The TB flags that the CPU state yields at this point
+ * @addr: Guest virtual address of the target TB
+ *
+ * If the jump cache entry for @addr holds a valid TB for @addr with the
+ * cs_base of @tb and @flags, jump straight to it without leaving generated
+ * code; otherwise fall back to tcg_gen_lookup_and_goto_ptr().
+ *
+ * Only usable when the CPU state at this point yields the same cs_base as
+ * @tb, e.g. for near indirect jumps and returns.
+ */
+void tcg_gen_lookup_and_goto_ptr_cached(const TranslationBlock *tb,
+                                        uint32_t flags, TCGv addr);
+
 #if TARGET_LONG_BITS == 32
 #define tcg_temp_new() tcg_temp_new_i32()
 #define tcg_global_reg_new tcg_global_reg_new_i32
@@ -1224,6 +1241,11 @@ static inline void tcg_gen_ld_ptr(TCGv_ptr r, TCGv_ptr a, intptr_t o)
     glue(tcg_gen_ld_,PTR)((NAT)r, a, o);
 }
 
+static inline void tcg_gen_st_ptr(TCGv_ptr r, TCGv_ptr a, intptr_t o)
+{
+    glue(tcg_gen_st_,PTR)((NAT)r, a, o);
+}
+
 static inline void tcg_gen_discard_ptr(TCGv_ptr a)
 {
     glue(tcg_gen_discard_,PTR)((NAT)a);
@@ -61,6 +61,11 @@
 #include "exec/log.h"
 #include "sysemu/sysemu.h"
 
+#ifdef CONFIG_LINUX
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
 /* Forward declarations for functions declared in tcg-target.inc.c and
    used here. */
 static void tcg_target_init(TCGContext *s);
@@ -158,10 +163,13 @@ struct tcg_region_state {
     size_t n;
     size_t size; /* size of one region */
     size_t stride; /* .size + guard size */
+    size_t ctx_stride; /* regions between the first ones of two contexts */
 
     /* fields protected by the lock */
-    size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t *alloc_seq; /* per region, when it was handed out; 0 if unused */
+    uint64_t seq; /* last alloc_seq */
+    size_t n_free; /* regions with alloc_seq 0 */
 };
 
 static struct tcg_region_state region;
@@ -378,22 +386,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+static size_t tc_ptr_to_region_idx(void *p)
 {
-    size_t region_idx;
-
     if (p < region.start_aligned) {
-        region_idx = 0;
+        return 0;
     } else {
         ptrdiff_t offset = p - region.start_aligned;
 
         if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
+            return region.n - 1;
         }
+        return offset / region.stride;
     }
-    return region_trees + region_idx * tree_size;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+{
+    return region_trees + tc_ptr_to_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -526,13 +535,27 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
     s->code_gen_highwater = end - TCG_HIGHWATER;
 }
 
-static bool tcg_region_alloc__locked(TCGContext *s)
+/*
+ * Hand out the first unused region from @hint on.  A context asks for
+ * the one after the region it filled, so that its TBs stay together in
+ * as few host pages, and iTLB entries, as possible.
+ */
+static bool tcg_region_alloc__locked(TCGContext *s, size_t hint)
 {
-    if (region.current == region.n) {
+    size_t i, curr_region = 0;
+
+    if (!region.n_free) {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    for (i = 0; i < region.n; i++) {
+        curr_region = (hint + i) % region.n;
+        if (!region.alloc_seq[curr_region]) {
+            break;
+        }
+    }
+    region.n_free--;
+    tcg_region_assign(s, curr_region);
+    region.alloc_seq[curr_region] = ++region.seq;
     return false;
 }
 
@@ -545,9 +568,10 @@ static bool tcg_region_alloc(TCGContext *s)
     bool err;
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t next = tc_ptr_to_region_idx(s->code_gen_buffer) + 1;
 
     qemu_mutex_lock(&region.lock);
-    err = tcg_region_alloc__locked(s);
+    err = tcg_region_alloc__locked(s, next);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
     }
@@ -556,12 +580,14 @@ static bool tcg_region_alloc(TCGContext *s)
 }
 
 /*
- * Perform a context's first region allocation.
+ * Perform the first region allocation of the @n-th context, leaving room
+ * after the region for those it will fill next.
  * This function does _not_ increment region.agg_size_full.
  */
-static inline bool tcg_region_initial_alloc__locked(TCGContext *s)
+static inline bool tcg_region_initial_alloc__locked(TCGContext *s,
+                                                    unsigned int n)
 {
-    return tcg_region_alloc__locked(s);
+    return tcg_region_alloc__locked(s, n * region.ctx_stride);
 }
 
 /* Call from a safe-work context */
@@ -571,12 +597,14 @@ void tcg_region_reset_all(void)
     unsigned int i;
 
     qemu_mutex_lock(&region.lock);
-    region.current = 0;
     region.agg_size_full = 0;
+    region.seq = 0;
+    region.n_free = region.n;
+    memset(region.alloc_seq, 0, region.n * sizeof(*region.alloc_seq));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = atomic_read(&tcg_ctxs[i]);
-        bool err = tcg_region_initial_alloc__locked(s);
+        bool err = tcg_region_initial_alloc__locked(s, i);
 
         g_assert(!err);
     }
@@ -585,6 +613,89 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+static bool tcg_region_in_use(size_t curr_region)
+{
+    unsigned int n_ctxs = atomic_read(&n_tcg_ctxs);
+    unsigned int i;
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = atomic_read(&tcg_ctxs[i]);
+
+        if (tc_ptr_to_region_idx(s->code_gen_buffer) == curr_region) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static gboolean tcg_region_collect_tb(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return FALSE;
+}
+
+/*
+ * Make a region available again to a context that ran out of space, by
+ * evicting the one handed out the longest time ago that no context is
+ * filling.  @invalidate is called on each of its TBs, and must unlink
+ * them from the rest of the code cache.
+ *
+ * Returns false if all the regions are in use, in which case only a
+ * full flush can make room.
+ *
+ * Call from a safe-work context.
+ */
+bool tcg_region_evict(void (*invalidate)(TranslationBlock *tb))
+{
+    struct tcg_region_tree *rt;
+    size_t i, victim = region.n;
+    void *start, *end;
+    GPtrArray *tbs;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.n_free) {
+        /* another vCPU asked first, and there is room already */
+        qemu_mutex_unlock(&region.lock);
+        return true;
+    }
+    for (i = 0; i < region.n; i++) {
+        if (region.alloc_seq[i]
+            && (victim == region.n
+                || region.alloc_seq[i] < region.alloc_seq[victim])
+            && !tcg_region_in_use(i)) {
+            victim = i;
+        }
+    }
+    if (victim == region.n) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+    region.alloc_seq[victim] = 0;
+    region.n_free++;
+    tcg_region_bounds(victim, &start, &end);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    qemu_mutex_unlock(&region.lock);
+
+    rt = region_trees + victim * tree_size;
+    tbs = g_ptr_array_new();
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, tcg_region_collect_tb, tbs);
+    qemu_mutex_unlock(&rt->lock);
+
+    for (i = 0; i < tbs->len; i++) {
+        invalidate(g_ptr_array_index(tbs, i));
+    }
+    g_ptr_array_free(tbs, true);
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+    return true;
+}
+
 #ifdef CONFIG_USER_ONLY
 static size_t tcg_n_regions(void)
 {
@@ -657,22 +768,32 @@ void tcg_region_init(void)
     void *aligned;
     size_t size = tcg_init_ctx.code_gen_buffer_size;
     size_t page_size = qemu_real_host_page_size;
+    size_t region_align = page_size;
     size_t region_size;
     size_t n_regions;
     size_t i;
 
     n_regions = tcg_n_regions();
 
+    /*
+     * Start the regions on huge pages if they are large enough, so that
+     * the host can back them with transparent huge pages; only the last
+     * huge page of each region is split by its guard page.
+     */
+    if (size / n_regions >= 4 * QEMU_VMALLOC_ALIGN) {
+        region_align = QEMU_VMALLOC_ALIGN;
+    }
+
     /* The first region will be 'aligned - buf' bytes larger than the others */
-    aligned = QEMU_ALIGN_PTR_UP(buf, page_size);
+    aligned = QEMU_ALIGN_PTR_UP(buf, region_align);
     g_assert(aligned < tcg_init_ctx.code_gen_buffer + size);
     /*
-     * Make region_size a multiple of page_size, using aligned as the start.
+     * Make region_size a multiple of region_align, using aligned as the start.
      * As a result of this we might end up with a few extra pages at the end of
      * the buffer; we will assign those to the last region.
      */
     region_size = (size - (aligned - buf)) / n_regions;
-    region_size = QEMU_ALIGN_DOWN(region_size, page_size);
+    region_size = QEMU_ALIGN_DOWN(region_size, region_align);
 
     /* A region must have at least 2 pages; one code, one guard */
     g_assert(region_size >= 2 * page_size);
@@ -680,8 +801,13 @@ void tcg_region_init(void)
     /* init the region struct */
     qemu_mutex_init(&region.lock);
     region.n = n_regions;
+    region.alloc_seq = g_new0(uint64_t, n_regions);
+    region.n_free = n_regions;
     region.size = region_size - page_size;
     region.stride = region_size;
+#ifndef CONFIG_USER_ONLY
+    region.ctx_stride = n_regions / max_cpus;
+#endif
     region.start = buf;
     region.start_aligned = aligned;
     /* page-align the end, since its last page will be a guard page */
@@ -704,7 +830,7 @@ void tcg_region_init(void)
     /* In user-mode we support only one ctx, so do the initial allocation now */
 #ifdef CONFIG_USER_ONLY
     {
-        bool err = tcg_region_initial_alloc__locked(tcg_ctx);
+        bool err = tcg_region_initial_alloc__locked(tcg_ctx, 0);
 
         g_assert(!err);
     }
@@ -726,6 +852,43 @@ void tcg_region_init(void)
  * Not tracking tcg_init_ctx in tcg_ctxs[] in softmmu keeps code that iterates
  * over the array (e.g. tcg_code_size() the same for both softmmu and user-mode.
  */
+#ifndef CONFIG_USER_ONLY
+#ifdef CONFIG_LINUX
+/*
+ * Count an event of the host CPU in user space, for the calling thread.
+ * Returns the file descriptor of the counter, or -1 if the host cannot
+ * count it, or does not let us.
+ */
+static int tcg_perf_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr = {
+        .type = type,
+        .size = sizeof(attr),
+        .config = config,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Start the counters of tcg_itlb_counts() for the calling thread */
+static void tcg_perf_init(TCGContext *s)
+{
+    s->perf_itlb_miss_fd = tcg_perf_open(PERF_TYPE_HW_CACHE,
+                                         PERF_COUNT_HW_CACHE_ITLB |
+                                         PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                         PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    s->perf_insn_fd = tcg_perf_open(PERF_TYPE_HARDWARE,
+                                    PERF_COUNT_HW_INSTRUCTIONS);
+}
+#else
+static void tcg_perf_init(TCGContext *s)
+{
+}
+#endif
+#endif /* !CONFIG_USER_ONLY */
+
 #ifdef CONFIG_USER_ONLY
 void tcg_register_thread(void)
 {
@@ -756,9 +919,11 @@ void tcg_register_thread(void)
 
     tcg_ctx = s;
     qemu_mutex_lock(&region.lock);
-    err = tcg_region_initial_alloc__locked(tcg_ctx);
+    err = tcg_region_initial_alloc__locked(tcg_ctx, n);
     g_assert(!err);
     qemu_mutex_unlock(&region.lock);
+
+    tcg_perf_init(s);
 }
 #endif /* !CONFIG_USER_ONLY */
 
@@ -819,6 +984,51 @@ size_t tcg_tb_phys_invalidate_count(void)
     return total;
 }
 
+/*
+ * Sum up the host iTLB misses and instructions counted in user space by
+ * the TCG threads, which include those of QEMU itself as well as those
+ * of the translated code.  Returns false if the host does not count them.
+ */
+bool tcg_itlb_counts(uint64_t *misses, uint64_t *insns)
+{
+    unsigned int n_ctxs = atomic_read(&n_tcg_ctxs);
+    unsigned int i;
+    uint64_t val;
+    bool ok = false;
+
+    *misses = *insns = 0;
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = atomic_read(&tcg_ctxs[i]);
+
+        if (s->perf_itlb_miss_fd < 0 || s->perf_insn_fd < 0) {
+            continue;
+        }
+        if (read(s->perf_itlb_miss_fd, &val, sizeof(val)) == sizeof(val)) {
+            *misses += val;
+            ok = true;
+        }
+        if (read(s->perf_insn_fd, &val, sizeof(val)) == sizeof(val)) {
+            *insns += val;
+        }
+    }
+    return ok;
+}
+
+void tcg_smc_counts(size_t *writes, size_t *fast_writes, size_t *lock_retries)
+{
+    unsigned int n_ctxs = atomic_read(&n_tcg_ctxs);
+    unsigned int i;
+
+    *writes = *fast_writes = *lock_retries = 0;
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = atomic_read(&tcg_ctxs[i]);
+
+        *writes += atomic_read(&s->smc_write_count);
+        *fast_writes += atomic_read(&s->smc_fast_write_count);
+        *lock_retries += atomic_read(&s->page_lock_retry_count);
+    }
+}
+
 /* pool based memory allocation */
 void *tcg_malloc_internal(TCGContext *s, int size)
 {
@@ -957,6 +1167,7 @@ void tcg_context_init(TCGContext *s)
      * reasoning behind this.
      * In softmmu we will have at most max_cpus TCG threads.
      */
+    s->perf_itlb_miss_fd = s->perf_insn_fd = -1;
 #ifdef CONFIG_USER_ONLY
     tcg_ctxs = &tcg_ctx;
     n_tcg_ctxs = 1;
@@ -1382,6 +1593,10 @@ bool tcg_op_supported(TCGOpcode op)
     case INDEX_op_goto_ptr:
         return TCG_TARGET_HAS_goto_ptr;
 
+    case INDEX_op_qemu_cmpxchg_i32:
+    case INDEX_op_qemu_cmpxchg_i64:
+        return TCG_TARGET_HAS_qemu_cmpxchg;
+
     case INDEX_op_mov_i32:
     case INDEX_op_movi_i32:
     case INDEX_op_setcond_i32:
@@ -2015,6 +2230,8 @@ static void tcg_dump_ops(TCGContext *s, bool have_prefs)
             case INDEX_op_qemu_st_i32:
             case INDEX_op_qemu_ld_i64:
             case INDEX_op_qemu_st_i64:
+            case INDEX_op_qemu_cmpxchg_i32:
+            case INDEX_op_qemu_cmpxchg_i64:
                 {
                     TCGMemOpIdx oi = op->args[k++];
                     TCGMemOp op = get_memop(oi);
@@ -2445,6 +2662,29 @@ static void la_global_sync(TCGContext *s, int ng)
     }
 }
 
+/* liveness analysis: conditional branch: all temps are dead, globals
+   and local temps should be synced, so that they are in memory at the
+   label whichever way it is reached, but can stay in registers on the
+   path that falls through. */
+static void la_bb_sync(TCGContext *s, int ng, int nt)
+{
+    int i;
+
+    la_global_sync(s, ng);
+    for (i = ng; i < nt; ++i) {
+        if (s->temps[i].temp_local) {
+            int state = s->temps[i].state;
+            s->temps[i].state = state | TS_MEM;
+            if (state != TS_DEAD) {
+                continue;
+            }
+        } else {
+            s->temps[i].state = TS_DEAD;
+        }
+        la_reset_pref(&s->temps[i]);
+    }
+}
+
 /* liveness analysis: sync globals back to memory and kill.  */
 static void la_global_kill(TCGContext *s, int ng)
 {
@@ -2721,6 +2961,8 @@ static void liveness_pass_1(TCGContext *s)
             /* If end of basic block, update.  */
             if (def->flags & TCG_OPF_BB_EXIT) {
                 la_func_end(s, nb_globals, nb_temps);
+            } else if (def->flags & TCG_OPF_COND_BRANCH) {
+                la_bb_sync(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_BB_END) {
                 la_bb_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -2833,7 +3075,10 @@ static bool liveness_pass_2(TCGContext *s)
             nb_oargs = def->nb_oargs;
 
             /* Set flags similar to how calls require.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                /* Like reading globals: sync_globals */
+                call_flags = TCG_CALL_NO_WRITE_GLOBALS;
+            } else if (def->flags & TCG_OPF_BB_END) {
                 /* Like writing globals: save_globals */
                 call_flags = 0;
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -3271,6 +3516,28 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     save_globals(s, allocated_regs);
 }
 
+/* at a conditional branch, we assume all temporaries are dead and all
+   globals and local temps are synced to their canonical location, so
+   that the code that falls through can keep using their registers. */
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+{
+    int i;
+
+    sync_globals(s, allocated_regs);
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+        /* The liveness analysis already ensures that temps are dead and
+           local temps synced.  Keep tcg_debug_asserts for safety. */
+        if (ts->temp_local) {
+            tcg_debug_assert(ts->val_type != TEMP_VAL_REG
+                             || ts->mem_coherent);
+        } else {
+            tcg_debug_assert(ts->val_type == TEMP_VAL_DEAD);
+        }
+    }
+}
+
 static void tcg_reg_alloc_do_movi(TCGContext *s, TCGTemp *ots,
                                   tcg_target_ulong val, TCGLifeData arg_life,
                                   TCGRegSet preferred_regs)
@@ -3482,7 +3749,9 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if (def->flags & TCG_OPF_COND_BRANCH) {
+        tcg_reg_alloc_cbranch(s, i_allocated_regs);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -3735,6 +4004,7 @@ void tcg_profile_snapshot(TCGProfile *prof, bool counters, bool table)
             PROF_ADD(prof, orig, temp_count);
             PROF_MAX(prof, orig, temp_count_max);
             PROF_ADD(prof, orig, del_op_count);
+            PROF_ADD(prof, orig, known_bits_count);
             PROF_ADD(prof, orig, code_in_len);
             PROF_ADD(prof, orig, code_out_len);
             PROF_ADD(prof, orig, search_out_len);
@@ -3869,6 +4139,9 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #endif
 
 #ifdef USE_TCG_OPTIMIZATIONS
+    if (tb_cflags(tb) & CF_HOT) {
+        tcg_optimize_env_loads(s);
+    }
     tcg_optimize(s);
 #endif
 
@@ -4038,6 +4311,8 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
                 (double)s->op_count / tb_div_count, s->op_count_max);
     cpu_fprintf(f, "deleted ops/TB      %0.2f\n",
                 (double)s->del_op_count / tb_div_count);
+    cpu_fprintf(f, "known-bits ops/TB   %0.2f\n",
+                (double)s->known_bits_count / tb_div_count);
     cpu_fprintf(f, "avg temps/TB        %0.2f max=%d\n",
                 (double)s->temp_count / tb_div_count, s->temp_count_max);
     cpu_fprintf(f, "avg host code/TB    %0.1f\n",
@@ -649,6 +649,7 @@ typedef struct TCGProfile {
     int temp_count_max;
     int64_t temp_count;
     int64_t del_op_count;
+    int64_t known_bits_count; /* ops simplified by tcg_optimize's known bits */
     int64_t code_in_len;
     int64_t code_out_len;
     int64_t search_out_len;
@@ -710,6 +711,14 @@ struct TCGContext {
     void *code_gen_highwater;
 
     size_t tb_phys_invalidate_count;
+    /* Writes to pages with code, and those the code bitmap let through */
+    size_t smc_write_count;
+    size_t smc_fast_write_count;
+    /* page_collection_lock() backoffs because a page lock was taken */
+    size_t page_lock_retry_count;
+    /* host perf counters of the thread, or -1; see tcg_itlb_counts() */
+    int perf_itlb_miss_fd;
+    int perf_insn_fd;
 
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
@@ -724,6 +733,12 @@ struct TCGContext {
 
     TCGLabel *exitreq_label;
 
+#ifdef CONFIG_PLUGIN
+    /* The block being translated and its current instruction, if any */
+    struct qemu_plugin_tb *plugin_tb;
+    struct qemu_plugin_insn *plugin_insn;
+#endif
+
     TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
     TCGTemp temps[TCG_MAX_TEMPS]; /* globals first, temps after */
 
@@ -880,6 +895,7 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_init(void);
 void tcg_region_reset_all(void);
+bool tcg_region_evict(void (*invalidate)(TranslationBlock *tb));
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -887,6 +903,8 @@ size_t tcg_code_capacity(void);
 void tcg_tb_insert(TranslationBlock *tb);
 void tcg_tb_remove(TranslationBlock *tb);
 size_t tcg_tb_phys_invalidate_count(void);
+void tcg_smc_counts(size_t *writes, size_t *fast_writes, size_t *lock_retries);
+bool tcg_itlb_counts(uint64_t *misses, uint64_t *insns);
 TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr);
 void tcg_tb_foreach(GTraverseFunc func, gpointer user_data);
 size_t tcg_nb_tbs(void);
@@ -1054,6 +1072,9 @@ enum {
     TCG_OPF_NOT_PRESENT  = 0x20,
     /* Instruction operands are vectors.  */
     TCG_OPF_VECTOR       = 0x40,
+    /* Instruction is a conditional branch: unlike at the other ends of
+       basic blocks, globals and local temps only need to be synced.  */
+    TCG_OPF_COND_BRANCH  = 0x80,
 };
 
 typedef struct TCGOpDef {
@@ -1091,6 +1112,7 @@ TCGOp *tcg_op_insert_before(TCGContext *s, TCGOp *op, TCGOpcode opc);
 TCGOp *tcg_op_insert_after(TCGContext *s, TCGOp *op, TCGOpcode opc);
 
 void tcg_optimize(TCGContext *s);
+void tcg_optimize_env_loads(TCGContext *s);
 
 TCGv_i32 tcg_const_i32(int32_t val);
 TCGv_i64 tcg_const_i64(int64_t val);
@@ -481,7 +481,7 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
     tci_assert(tb_ptr);
 
     for (;;) {
-        TCGOpcode opc = tb_ptr[0];
+        uint8_t opc = tb_ptr[0];    /* TCGOpcode or TCIOpcode */
 #if defined(CONFIG_DEBUG_TCG) && !defined(NDEBUG)
         uint8_t op_size = tb_ptr[1];
         uint8_t *old_code_ptr = tb_ptr;
@@ -1249,6 +1249,86 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             /* Ensure ordering for all kinds */
             smp_mb();
             break;
+
+            /* Pre-decoded ops and superinstructions, see tcg-target.h. */
+
+#define CASE_TCI_BINARY(NAME, BITS, EXPR)                               \
+        case TCI_op_##NAME##_rr_i##BITS:                                \
+            t0 = *tb_ptr++;                                             \
+            t1 = tci_read_r##BITS(regs, &tb_ptr);                       \
+            t2 = tci_read_r##BITS(regs, &tb_ptr);                       \
+            tci_write_reg##BITS(regs, t0, EXPR);                        \
+            break;                                                      \
+        case TCI_op_##NAME##_ri_i##BITS:                                \
+            t0 = *tb_ptr++;                                             \
+            t1 = tci_read_r##BITS(regs, &tb_ptr);                       \
+            t2 = tci_read_i##BITS(&tb_ptr);                             \
+            tci_write_reg##BITS(regs, t0, EXPR);                        \
+            break;
+
+        CASE_TCI_BINARY(add, 32, t1 + t2)
+        CASE_TCI_BINARY(sub, 32, t1 - t2)
+        CASE_TCI_BINARY(mul, 32, t1 * t2)
+        CASE_TCI_BINARY(and, 32, t1 & t2)
+        CASE_TCI_BINARY(or, 32, t1 | t2)
+        CASE_TCI_BINARY(xor, 32, t1 ^ t2)
+        CASE_TCI_BINARY(shl, 32, t1 << (t2 & 31))
+        CASE_TCI_BINARY(shr, 32, t1 >> (t2 & 31))
+        CASE_TCI_BINARY(sar, 32, ((int32_t)t1 >> (t2 & 31)))
+        case TCI_op_sti_i32:
+            t1 = tci_read_r(regs, &tb_ptr);
+            t2 = tci_read_s32(&tb_ptr);
+            tci_assert(t1 != sp_value || (int32_t)t2 < 0);
+            *(uint32_t *)(t1 + t2) = tci_read_i32(&tb_ptr);
+            break;
+        case TCI_op_ld_brcond_i32:
+            t0 = *tb_ptr++;
+            t1 = tci_read_r(regs, &tb_ptr);
+            t2 = tci_read_s32(&tb_ptr);
+            tmp32 = *(uint32_t *)(t1 + t2);
+            tci_write_reg32(regs, t0, tmp32);
+            t1 = tci_read_i32(&tb_ptr);
+            condition = *tb_ptr++;
+            label = tci_read_label(&tb_ptr);
+            if (tci_compare32(tmp32, t1, condition)) {
+                tci_assert(tb_ptr == old_code_ptr + op_size);
+                tb_ptr = (uint8_t *)label;
+                continue;
+            }
+            break;
+#if TCG_TARGET_REG_BITS == 64
+        CASE_TCI_BINARY(add, 64, t1 + t2)
+        CASE_TCI_BINARY(sub, 64, t1 - t2)
+        CASE_TCI_BINARY(mul, 64, t1 * t2)
+        CASE_TCI_BINARY(and, 64, t1 & t2)
+        CASE_TCI_BINARY(or, 64, t1 | t2)
+        CASE_TCI_BINARY(xor, 64, t1 ^ t2)
+        CASE_TCI_BINARY(shl, 64, t1 << (t2 & 63))
+        CASE_TCI_BINARY(shr, 64, t1 >> (t2 & 63))
+        CASE_TCI_BINARY(sar, 64, ((int64_t)t1 >> (t2 & 63)))
+        case TCI_op_sti_i64:
+            t1 = tci_read_r(regs, &tb_ptr);
+            t2 = tci_read_s32(&tb_ptr);
+            tci_assert(t1 != sp_value || (int32_t)t2 < 0);
+            *(uint64_t *)(t1 + t2) = tci_read_i64(&tb_ptr);
+            break;
+        case TCI_op_ld_brcond_i64:
+            t0 = *tb_ptr++;
+            t1 = tci_read_r(regs, &tb_ptr);
+            t2 = tci_read_s32(&tb_ptr);
+            tmp64 = *(uint64_t *)(t1 + t2);
+            tci_write_reg64(regs, t0, tmp64);
+            t1 = tci_read_i64(&tb_ptr);
+            condition = *tb_ptr++;
+            label = tci_read_label(&tb_ptr);
+            if (tci_compare64(tmp64, t1, condition)) {
+                tci_assert(tb_ptr == old_code_ptr + op_size);
+                tb_ptr = (uint8_t *)label;
+                continue;
+            }
+            break;
+#endif
+#undef CASE_TCI_BINARY
         default:
             TODO();
             break;
@@ -86,6 +86,7 @@
 #define TCG_TARGET_HAS_muluh_i32        0
 #define TCG_TARGET_HAS_mulsh_i32        0
 #define TCG_TARGET_HAS_goto_ptr         0
+#define TCG_TARGET_HAS_qemu_cmpxchg     0
 #define TCG_TARGET_HAS_direct_jump      1
 
 #if TCG_TARGET_REG_BITS == 64
@@ -185,6 +186,42 @@ typedef enum {
 #define TCG_TARGET_CALL_STACK_OFFSET    0
 #define TCG_TARGET_STACK_ALIGN          16
 
+/* Opcodes of TCI's own, numbered after those of TCG.
+ *
+ * The common binary ops have forms whose operands the interpreter does
+ * not have to decode, with two registers (_rr) or a register and a
+ * constant (_ri): tcg_out_op uses them unless the first operand is a
+ * constant.  The others are superinstructions for frequent pairs of
+ * ops: a store of a constant (tcg_out_sti), and a load followed by the
+ * comparison of the loaded value with a constant, like the check of
+ * the exit request at the start of each TB.
+ */
+#define TCI_OP_BINARY(name) \
+    TCI_op_##name##_rr_i32, TCI_op_##name##_ri_i32, \
+    TCI_op_##name##_rr_i64, TCI_op_##name##_ri_i64
+
+typedef enum {
+    TCI_op_add_rr_i32 = 192,
+    TCI_op_add_ri_i32,
+    TCI_op_add_rr_i64,
+    TCI_op_add_ri_i64,
+    TCI_OP_BINARY(sub),
+    TCI_OP_BINARY(mul),
+    TCI_OP_BINARY(and),
+    TCI_OP_BINARY(or),
+    TCI_OP_BINARY(xor),
+    TCI_OP_BINARY(shl),
+    TCI_OP_BINARY(shr),
+    TCI_OP_BINARY(sar),
+    TCI_op_sti_i32,
+    TCI_op_sti_i64,
+    TCI_op_ld_brcond_i32,
+    TCI_op_ld_brcond_i64,
+    TCI_op_last
+} TCIOpcode;
+
+#define TCI_op_first  TCI_op_add_rr_i32
+
 void tci_disas(uint8_t opc);
 
 #define HAVE_TCG_QEMU_TB_EXEC
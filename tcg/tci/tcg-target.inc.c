@@ -421,9 +421,13 @@ static void tcg_out_i(TCGContext *s, tcg_target_ulong v)
     }
 }
 
-/* Write opcode. */
-static void tcg_out_op_t(TCGContext *s, TCGOpcode op)
+/* The last op emitted, if it is a load: see tci_can_fuse_ld. */
+static __thread uint8_t *tci_ld_ptr;
+
+/* Write opcode, of TCG or TCI. */
+static void tcg_out_op_t(TCGContext *s, uint8_t op)
 {
+    tci_ld_ptr = NULL;
     tcg_out8(s, op);
     tcg_out8(s, 0);
 }
@@ -507,6 +511,7 @@ static void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg1,
 #endif
     }
     old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tci_ld_ptr = old_code_ptr;
 }
 
 static void tcg_out_mov(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg)
@@ -553,10 +558,74 @@ static inline void tcg_out_call(TCGContext *s, tcg_insn_unit *arg)
     old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
+/* The TCI opcode of the form of OPC with register operands, if OPC
+   is one of the binary ops that have forms with pre-decoded operands,
+   or 0.  The form with a constant second operand follows it.  */
+static int tci_binary_op(TCGOpcode opc)
+{
+    switch (opc) {
+    case INDEX_op_add_i32:
+        return TCI_op_add_rr_i32;
+    case INDEX_op_sub_i32:
+        return TCI_op_sub_rr_i32;
+    case INDEX_op_mul_i32:
+        return TCI_op_mul_rr_i32;
+    case INDEX_op_and_i32:
+        return TCI_op_and_rr_i32;
+    case INDEX_op_or_i32:
+        return TCI_op_or_rr_i32;
+    case INDEX_op_xor_i32:
+        return TCI_op_xor_rr_i32;
+    case INDEX_op_shl_i32:
+        return TCI_op_shl_rr_i32;
+    case INDEX_op_shr_i32:
+        return TCI_op_shr_rr_i32;
+    case INDEX_op_sar_i32:
+        return TCI_op_sar_rr_i32;
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_add_i64:
+        return TCI_op_add_rr_i64;
+    case INDEX_op_sub_i64:
+        return TCI_op_sub_rr_i64;
+    case INDEX_op_mul_i64:
+        return TCI_op_mul_rr_i64;
+    case INDEX_op_and_i64:
+        return TCI_op_and_rr_i64;
+    case INDEX_op_or_i64:
+        return TCI_op_or_rr_i64;
+    case INDEX_op_xor_i64:
+        return TCI_op_xor_rr_i64;
+    case INDEX_op_shl_i64:
+        return TCI_op_shl_rr_i64;
+    case INDEX_op_shr_i64:
+        return TCI_op_shr_rr_i64;
+    case INDEX_op_sar_i64:
+        return TCI_op_sar_rr_i64;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Whether the brcond about to be emitted at CODE_PTR, of register REG,
+ * can be merged into the load at LD_PTR.  The load must be the op just
+ * before, and must set REG.  No label can be in between: all the temps
+ * are saved at a label, so that REG would have to be loaded again.
+ */
+static bool tci_can_fuse_ld(uint8_t *ld_ptr, uint8_t *code_ptr,
+                            TCGOpcode ld_opc, TCGReg reg)
+{
+    return ld_ptr && ld_ptr[0] == ld_opc && ld_ptr + ld_ptr[1] == code_ptr
+           && ld_ptr[2] == reg;
+}
+
 static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
                        const int *const_args)
 {
     uint8_t *old_code_ptr = s->code_ptr;
+    uint8_t *ld_ptr = tci_ld_ptr;
+    int tci_op;
 
     tcg_out_op_t(s, opc);
 
@@ -604,11 +673,19 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         tcg_out8(s, args[3]);   /* condition */
         break;
 #endif
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld_i64:
+        tcg_out_r(s, args[0]);
+        tcg_out_r(s, args[1]);
+        tcg_debug_assert(args[2] == (int32_t)args[2]);
+        tcg_out32(s, args[2]);
+        old_code_ptr[1] = s->code_ptr - old_code_ptr;
+        tci_ld_ptr = old_code_ptr;
+        return;
     case INDEX_op_ld8u_i32:
     case INDEX_op_ld8s_i32:
     case INDEX_op_ld16u_i32:
     case INDEX_op_ld16s_i32:
-    case INDEX_op_ld_i32:
     case INDEX_op_st8_i32:
     case INDEX_op_st16_i32:
     case INDEX_op_st_i32:
@@ -618,7 +695,6 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_ld16s_i64:
     case INDEX_op_ld32u_i64:
     case INDEX_op_ld32s_i64:
-    case INDEX_op_ld_i64:
     case INDEX_op_st8_i64:
     case INDEX_op_st16_i64:
     case INDEX_op_st32_i64:
@@ -645,6 +721,17 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_rotl_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
     case INDEX_op_rotr_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
         tcg_out_r(s, args[0]);
+        tci_op = tci_binary_op(opc);
+        if (tci_op && !const_args[1]) {
+            old_code_ptr[0] = tci_op + const_args[2];
+            tcg_out_r(s, args[1]);
+            if (const_args[2]) {
+                tcg_out32(s, args[2]);
+            } else {
+                tcg_out_r(s, args[2]);
+            }
+            break;
+        }
         tcg_out_ri32(s, const_args[1], args[1]);
         tcg_out_ri32(s, const_args[2], args[2]);
         break;
@@ -676,6 +763,17 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_rotl_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
     case INDEX_op_rotr_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
         tcg_out_r(s, args[0]);
+        tci_op = tci_binary_op(opc);
+        if (tci_op && !const_args[1]) {
+            old_code_ptr[0] = tci_op + const_args[2];
+            tcg_out_r(s, args[1]);
+            if (const_args[2]) {
+                tcg_out64(s, args[2]);
+            } else {
+                tcg_out_r(s, args[2]);
+            }
+            break;
+        }
         tcg_out_ri64(s, const_args[1], args[1]);
         tcg_out_ri64(s, const_args[2], args[2]);
         break;
@@ -699,8 +797,17 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         TODO();
         break;
     case INDEX_op_brcond_i64:
-        tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
+        if (const_args[1]
+            && tci_can_fuse_ld(ld_ptr, old_code_ptr, INDEX_op_ld_i64,
+                               args[0])) {
+            s->code_ptr = old_code_ptr;
+            old_code_ptr = ld_ptr;
+            old_code_ptr[0] = TCI_op_ld_brcond_i64;
+            tcg_out64(s, args[1]);
+        } else {
+            tcg_out_r(s, args[0]);
+            tcg_out_ri64(s, const_args[1], args[1]);
+        }
         tcg_out8(s, args[2]);           /* condition */
         tci_out_label(s, arg_label(args[3]));
         break;
@@ -767,8 +874,17 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         break;
 #endif
     case INDEX_op_brcond_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
+        if (const_args[1]
+            && tci_can_fuse_ld(ld_ptr, old_code_ptr, INDEX_op_ld_i32,
+                               args[0])) {
+            s->code_ptr = old_code_ptr;
+            old_code_ptr = ld_ptr;
+            old_code_ptr[0] = TCI_op_ld_brcond_i32;
+            tcg_out32(s, args[1]);
+        } else {
+            tcg_out_r(s, args[0]);
+            tcg_out_ri32(s, const_args[1], args[1]);
+        }
         tcg_out8(s, args[2]);           /* condition */
         tci_out_label(s, arg_label(args[3]));
         break;
@@ -849,7 +965,27 @@ static void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg, TCGReg arg1,
 static inline bool tcg_out_sti(TCGContext *s, TCGType type, TCGArg val,
                                TCGReg base, intptr_t ofs)
 {
-    return false;
+    uint8_t *old_code_ptr = s->code_ptr;
+
+    tcg_debug_assert(ofs == (int32_t)ofs);
+    if (type == TCG_TYPE_I32) {
+        tcg_out_op_t(s, TCI_op_sti_i32);
+        tcg_out_r(s, base);
+        tcg_out32(s, ofs);
+        tcg_out32(s, val);
+    } else {
+        tcg_debug_assert(type == TCG_TYPE_I64);
+#if TCG_TARGET_REG_BITS == 64
+        tcg_out_op_t(s, TCI_op_sti_i64);
+        tcg_out_r(s, base);
+        tcg_out32(s, ofs);
+        tcg_out64(s, val);
+#else
+        return false;
+#endif
+    }
+    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    return true;
 }
 
 /* Test if a constant matches the constraint. */
@@ -869,8 +1005,10 @@ static void tcg_target_init(TCGContext *s)
     }
 #endif
 
-    /* The current code uses uint8_t for tcg operations. */
-    tcg_debug_assert(tcg_op_defs_max <= UINT8_MAX);
+    /* The current code uses uint8_t for tcg operations, and numbers
+       the opcodes of TCI after those of TCG. */
+    tcg_debug_assert(tcg_op_defs_max <= TCI_op_first);
+    QEMU_BUILD_BUG_ON(TCI_op_last > UINT8_MAX + 1);
 
     /* Registers available for 32 bit operations. */
     tcg_target_available_regs[TCG_TYPE_I32] = BIT(TCG_TARGET_NB_REGS) - 1;
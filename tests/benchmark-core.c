@@ -0,0 +1,215 @@
+/*
+ * Microbenchmarks of core hot paths
+ *
+ * Each benchmark prints one line of the form
+ *
+ *   bench=<name> ops=<count> secs=<seconds> ns_per_op=<nanoseconds>
+ *
+ * so that results can be collected and compared by scripts.  They run for
+ * a second each, or for five seconds with -m=perf.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "block/block.h"
+#include "block/thread-pool.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/coroutine.h"
+#include "qemu/main-loop.h"
+#include "sysemu/block-backend.h"
+
+/* How many operations to run between two looks at the clock */
+#define BENCH_BATCH 1024
+
+static AioContext *ctx;
+
+static double bench_duration(void)
+{
+    return g_test_perf() ? 5.0 : 1.0;
+}
+
+static void bench_report(const char *name, uint64_t ops)
+{
+    double secs = g_test_timer_last();
+
+    g_print("bench=%s ops=%" PRIu64 " secs=%.3f ns_per_op=%.1f\n",
+            name, ops, secs, secs * 1e9 / ops);
+}
+
+/* Run @fn in batches until the time is up, and report it as @name */
+static void bench_run(const char *name, void (*fn)(void *opaque, int n),
+                      void *opaque)
+{
+    double duration = bench_duration();
+    uint64_t ops = 0;
+
+    g_test_timer_start();
+    do {
+        fn(opaque, BENCH_BATCH);
+        ops += BENCH_BATCH;
+    } while (g_test_timer_elapsed() < duration);
+    bench_report(name, ops);
+}
+
+/* AioContext: schedule a bottom half and dispatch it */
+
+static int bh_count;
+
+static void bh_cb(void *opaque)
+{
+    bh_count++;
+}
+
+static void bh_batch(void *opaque, int n)
+{
+    QEMUBH *bh = opaque;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        qemu_bh_schedule(bh);
+        aio_poll(ctx, false);
+    }
+}
+
+static void bench_aio_bh(void)
+{
+    QEMUBH *bh = aio_bh_new(ctx, bh_cb, NULL);
+
+    bh_count = 0;
+    bench_run("aio/bh-dispatch", bh_batch, bh);
+    g_assert_cmpint(bh_count, >, 0);
+    qemu_bh_delete(bh);
+}
+
+/* AioContext: signal an event notifier and dispatch its handler */
+
+static void notifier_cb(EventNotifier *e)
+{
+    event_notifier_test_and_clear(e);
+}
+
+static void notifier_batch(void *opaque, int n)
+{
+    EventNotifier *e = opaque;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        event_notifier_set(e);
+        aio_poll(ctx, true);
+    }
+}
+
+static void bench_aio_fd(void)
+{
+    EventNotifier e;
+
+    event_notifier_init(&e, false);
+    aio_set_event_notifier(ctx, &e, false, notifier_cb, NULL);
+    bench_run("aio/fd-dispatch", notifier_batch, &e);
+    aio_set_event_notifier(ctx, &e, false, NULL, NULL);
+    event_notifier_cleanup(&e);
+}
+
+/* Thread pool: submit a request that does nothing and wait for it */
+
+static int pool_worker(void *opaque)
+{
+    return 0;
+}
+
+static void pool_done(void *opaque, int ret)
+{
+    int *inflight = opaque;
+
+    (*inflight)--;
+}
+
+static void pool_batch(void *opaque, int n)
+{
+    ThreadPool *pool = aio_get_thread_pool(ctx);
+    int inflight = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        inflight++;
+        thread_pool_submit_aio(pool, pool_worker, NULL, pool_done, &inflight);
+        while (inflight) {
+            aio_poll(ctx, true);
+        }
+    }
+}
+
+static void bench_thread_pool(void)
+{
+    bench_run("thread-pool/round-trip", pool_batch, NULL);
+}
+
+/* Block layer: read through a raw node on top of null-co */
+
+typedef struct {
+    BlockBackend *blk;
+    QEMUIOVector qiov;
+    int n;
+} BlockBench;
+
+static void coroutine_fn block_co(void *opaque)
+{
+    BlockBench *b = opaque;
+    int i;
+
+    for (i = 0; i < b->n; i++) {
+        int ret = blk_co_preadv(b->blk, 0, b->qiov.size, &b->qiov, 0);
+        g_assert_cmpint(ret, ==, 0);
+    }
+    b->n = 0;
+}
+
+static void block_batch(void *opaque, int n)
+{
+    BlockBench *b = opaque;
+
+    b->n = n;
+    qemu_coroutine_enter(qemu_coroutine_create(block_co, b));
+    while (b->n) {
+        aio_poll(ctx, true);
+    }
+}
+
+static void bench_block_null(void)
+{
+    QDict *options = qdict_new();
+    BlockBench b = { 0 };
+    void *buf = g_malloc(4096);
+
+    qdict_put_str(options, "driver", "raw");
+    qdict_put_str(options, "file.driver", "null-co");
+    b.blk = blk_new_open(NULL, NULL, options, 0, &error_abort);
+    qemu_iovec_init(&b.qiov, 1);
+    qemu_iovec_add(&b.qiov, buf, 4096);
+
+    bench_run("block/null-co-preadv-4k", block_batch, &b);
+
+    qemu_iovec_destroy(&b.qiov);
+    blk_unref(b.blk);
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+    ctx = qemu_get_current_aio_context();
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bench/aio/bh-dispatch", bench_aio_bh);
+    g_test_add_func("/bench/aio/fd-dispatch", bench_aio_fd);
+    g_test_add_func("/bench/thread-pool/round-trip", bench_thread_pool);
+    g_test_add_func("/bench/block/null-co-preadv", bench_block_null);
+
+    return g_test_run();
+}
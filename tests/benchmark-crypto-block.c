@@ -0,0 +1,253 @@
+/*
+ * QEMU Crypto block encryption speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "crypto/init.h"
+#include "crypto/block.h"
+#include "crypto/hash.h"
+#include "crypto/secret.h"
+#include "qemu/buffer.h"
+
+#if defined(CONFIG_GCRYPT)
+#define BENCH_BACKEND "gcrypt"
+#elif defined(CONFIG_NETTLE)
+#define BENCH_BACKEND "nettle"
+#else
+#define BENCH_BACKEND "builtin"
+#endif
+
+/* LUKS needs PBKDF2 from one of the libraries */
+#if defined(CONFIG_NETTLE) || defined(CONFIG_GCRYPT)
+#define BENCH_LUKS
+#endif
+
+typedef struct QCryptoBlockBenchData {
+    const char *name;
+    QCryptoBlockFormat format;
+    QCryptoCipherAlgorithm cipher_alg;
+    QCryptoCipherMode cipher_mode;
+    QCryptoIVGenAlgorithm ivgen_alg;
+    QCryptoHashAlgorithm ivgen_hash;
+} QCryptoBlockBenchData;
+
+static const QCryptoBlockBenchData bench_data[] = {
+    {
+        .name = "qcow-aes-128-cbc-plain64",
+        .format = Q_CRYPTO_BLOCK_FORMAT_QCOW,
+        .cipher_alg = QCRYPTO_CIPHER_ALG_AES_128,
+        .cipher_mode = QCRYPTO_CIPHER_MODE_CBC,
+        .ivgen_alg = QCRYPTO_IVGEN_ALG_PLAIN64,
+    },
+#ifdef BENCH_LUKS
+    {
+        .name = "luks-aes-256-xts-plain64",
+        .format = Q_CRYPTO_BLOCK_FORMAT_LUKS,
+        .cipher_alg = QCRYPTO_CIPHER_ALG_AES_256,
+        .cipher_mode = QCRYPTO_CIPHER_MODE_XTS,
+        .ivgen_alg = QCRYPTO_IVGEN_ALG_PLAIN64,
+    },
+    {
+        .name = "luks-aes-128-xts-plain64",
+        .format = Q_CRYPTO_BLOCK_FORMAT_LUKS,
+        .cipher_alg = QCRYPTO_CIPHER_ALG_AES_128,
+        .cipher_mode = QCRYPTO_CIPHER_MODE_XTS,
+        .ivgen_alg = QCRYPTO_IVGEN_ALG_PLAIN64,
+    },
+    {
+        .name = "luks-aes-256-xts-essiv-sha256",
+        .format = Q_CRYPTO_BLOCK_FORMAT_LUKS,
+        .cipher_alg = QCRYPTO_CIPHER_ALG_AES_256,
+        .cipher_mode = QCRYPTO_CIPHER_MODE_XTS,
+        .ivgen_alg = QCRYPTO_IVGEN_ALG_ESSIV,
+        .ivgen_hash = QCRYPTO_HASH_ALG_SHA256,
+    },
+    {
+        .name = "luks-aes-256-cbc-plain64",
+        .format = Q_CRYPTO_BLOCK_FORMAT_LUKS,
+        .cipher_alg = QCRYPTO_CIPHER_ALG_AES_256,
+        .cipher_mode = QCRYPTO_CIPHER_MODE_CBC,
+        .ivgen_alg = QCRYPTO_IVGEN_ALG_PLAIN64,
+    },
+    {
+        .name = "luks-aes-256-cbc-essiv-sha256",
+        .format = Q_CRYPTO_BLOCK_FORMAT_LUKS,
+        .cipher_alg = QCRYPTO_CIPHER_ALG_AES_256,
+        .cipher_mode = QCRYPTO_CIPHER_MODE_CBC,
+        .ivgen_alg = QCRYPTO_IVGEN_ALG_ESSIV,
+        .ivgen_hash = QCRYPTO_HASH_ALG_SHA256,
+    },
+#endif
+};
+
+static const size_t bench_chunks[] = { 512, 4096, 65536, 1 * MiB };
+
+typedef struct QCryptoBlockBenchCase {
+    const QCryptoBlockBenchData *data;
+    size_t chunk_size;
+} QCryptoBlockBenchCase;
+
+
+static ssize_t bench_block_init_func(QCryptoBlock *block,
+                                     size_t headerlen,
+                                     void *opaque,
+                                     Error **errp)
+{
+    Buffer *header = opaque;
+
+    buffer_reserve(header, headerlen);
+
+    return headerlen;
+}
+
+
+static ssize_t bench_block_write_func(QCryptoBlock *block,
+                                      size_t offset,
+                                      const uint8_t *buf,
+                                      size_t buflen,
+                                      void *opaque,
+                                      Error **errp)
+{
+    Buffer *header = opaque;
+
+    g_assert_cmpint(buflen + offset, <=, header->capacity);
+
+    memcpy(header->buffer + offset, buf, buflen);
+    header->offset = offset + buflen;
+
+    return buflen;
+}
+
+
+static QCryptoBlock *bench_block_create(const QCryptoBlockBenchData *data,
+                                        Buffer *header)
+{
+    QCryptoBlockCreateOptions opts = {
+        .format = data->format,
+    };
+
+    if (data->format == Q_CRYPTO_BLOCK_FORMAT_QCOW) {
+        opts.u.qcow.has_key_secret = true;
+        opts.u.qcow.key_secret = (char *)"sec0";
+    } else {
+        opts.u.luks = (QCryptoBlockCreateOptionsLUKS) {
+            .has_key_secret = true,
+            .key_secret = (char *)"sec0",
+            .has_cipher_alg = true,
+            .cipher_alg = data->cipher_alg,
+            .has_cipher_mode = true,
+            .cipher_mode = data->cipher_mode,
+            .has_ivgen_alg = true,
+            .ivgen_alg = data->ivgen_alg,
+            .has_ivgen_hash_alg = data->ivgen_alg == QCRYPTO_IVGEN_ALG_ESSIV,
+            .ivgen_hash_alg = data->ivgen_hash,
+            /* Key derivation is not what we are timing */
+            .has_iter_time = true,
+            .iter_time = 10,
+        };
+    }
+
+    return qcrypto_block_create(&opts, NULL,
+                                bench_block_init_func,
+                                bench_block_write_func,
+                                header,
+                                &error_abort);
+}
+
+
+static void test_block_speed(const void *opaque)
+{
+    const QCryptoBlockBenchCase *bench = opaque;
+    size_t chunk_size = bench->chunk_size;
+    QCryptoBlock *blk;
+    Buffer header;
+    uint8_t *buf;
+    uint64_t offset;
+    double total;
+
+    buffer_init(&header, "header");
+    blk = bench_block_create(bench->data, &header);
+    g_assert(blk);
+
+    buf = g_new0(uint8_t, chunk_size);
+    memset(buf, g_test_rand_int(), chunk_size);
+
+    /* Walk through the disk so that every sector gets its own IV */
+    total = 0.0;
+    offset = 0;
+    g_test_timer_start();
+    do {
+        g_assert(qcrypto_block_encrypt(blk, offset, buf, chunk_size,
+                                       &error_abort) == 0);
+        offset += chunk_size;
+        total += chunk_size;
+    } while (g_test_timer_elapsed() < 1.0);
+
+    total /= MiB;
+    g_print("%s Enc chunk %zu bytes ", BENCH_BACKEND, chunk_size);
+    g_print("%.2f MB/sec ", total / g_test_timer_last());
+
+    total = 0.0;
+    offset = 0;
+    g_test_timer_start();
+    do {
+        g_assert(qcrypto_block_decrypt(blk, offset, buf, chunk_size,
+                                       &error_abort) == 0);
+        offset += chunk_size;
+        total += chunk_size;
+    } while (g_test_timer_elapsed() < 1.0);
+
+    total /= MiB;
+    g_print("Dec chunk %zu bytes ", chunk_size);
+    g_print("%.2f MB/sec ", total / g_test_timer_last());
+
+    qcrypto_block_free(blk);
+    buffer_free(&header);
+    g_free(buf);
+}
+
+
+int main(int argc, char **argv)
+{
+    size_t i, j;
+
+    module_call_init(MODULE_INIT_QOM);
+    g_test_init(&argc, &argv, NULL);
+    g_assert(qcrypto_init(NULL) == 0);
+
+    object_new_with_props(TYPE_QCRYPTO_SECRET,
+                          object_get_objects_root(),
+                          "sec0",
+                          &error_abort,
+                          "data", "123456",
+                          NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(bench_data); i++) {
+        const QCryptoBlockBenchData *data = &bench_data[i];
+
+        if (!qcrypto_cipher_supports(data->cipher_alg, data->cipher_mode) ||
+            (data->ivgen_alg == QCRYPTO_IVGEN_ALG_ESSIV &&
+             !qcrypto_hash_supports(data->ivgen_hash))) {
+            continue;
+        }
+
+        for (j = 0; j < G_N_ELEMENTS(bench_chunks); j++) {
+            QCryptoBlockBenchCase *bench = g_new0(QCryptoBlockBenchCase, 1);
+            char *path;
+
+            bench->data = data;
+            bench->chunk_size = bench_chunks[j];
+            path = g_strdup_printf("/crypto/block/%s/chunk-%zu",
+                                   data->name, bench->chunk_size);
+            g_test_add_data_func_full(path, bench, test_block_speed, g_free);
+            g_free(path);
+        }
+    }
+
+    return g_test_run();
+}
@@ -14,6 +14,7 @@
 #include "qemu/osdep.h"
 
 #include "qapi/error.h"
+#include "qapi/qmp/json-parser.h"
 #include "qapi/qmp/qbool.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qlit.h"
@@ -1150,6 +1151,116 @@ static void large_dict(void)
     g_string_free(gstr, true);
 }
 
+/*
+ * Generate a document shaped like a large QMP reply: a list of
+ * dictionaries whose values are mostly strings, some with characters
+ * that need escaping.
+ */
+static void gen_test_document(GString *gstr, int elem_count)
+{
+    int i;
+
+    g_string_append(gstr, "[");
+    for (i = 0; i < elem_count; i++) {
+        g_string_append_printf(gstr,
+            "%s{\"node-name\": \"#block%03d\", "
+            "\"filename\": \"/var/lib/libvirt/images/guest-%d.qcow2\", "
+            "\"description\": \"tab\\t, \\\"quotes\\\", "
+            "caf\xc3\xa9 and \\u00e9t\\u00e9\", "
+            "\"size\": %d, \"ro\": %s}",
+            i ? ", " : "", i, i, i * 4096, i % 2 ? "true" : "false");
+    }
+    g_string_append(gstr, "]");
+}
+
+static void large_document(void)
+{
+    GString *gstr = g_string_new("");
+    QObject *obj, *obj2;
+    QString *json;
+
+    gen_test_document(gstr, 1000);
+    obj = qobject_from_json(gstr->str, &error_abort);
+    g_assert(obj);
+
+    json = qobject_to_json(obj);
+    obj2 = qobject_from_json(qstring_get_str(json), &error_abort);
+    g_assert(qobject_is_equal(obj, obj2));
+
+    qobject_unref(obj2);
+    qobject_unref(json);
+    qobject_unref(obj);
+    g_string_free(gstr, true);
+}
+
+static void large_document_emit(void *opaque, QObject *json, Error *err)
+{
+    QObject **obj = opaque;
+
+    g_assert(!err);
+    g_assert(!*obj);
+    *obj = json;
+}
+
+/* Tokens, strings in particular, may be split across reads */
+static void large_document_split(void)
+{
+    GString *gstr = g_string_new("");
+    JSONMessageParser parser;
+    QObject *obj, *obj2 = NULL;
+    size_t i;
+
+    gen_test_document(gstr, 100);
+    obj = qobject_from_json(gstr->str, &error_abort);
+
+    json_message_parser_init(&parser, large_document_emit, &obj2, NULL);
+    for (i = 0; i < gstr->len; i += 7) {
+        json_message_parser_feed(&parser, gstr->str + i,
+                                 MIN(7, gstr->len - i));
+    }
+    json_message_parser_flush(&parser);
+    json_message_parser_destroy(&parser);
+
+    g_assert(obj2);
+    g_assert(qobject_is_equal(obj, obj2));
+
+    qobject_unref(obj2);
+    qobject_unref(obj);
+    g_string_free(gstr, true);
+}
+
+static void perf_large_document(void)
+{
+    GString *gstr = g_string_new("");
+    QObject *obj;
+    QString *json;
+    int i, count;
+    double elapsed;
+
+    gen_test_document(gstr, 2000);
+
+    g_test_timer_start();
+    for (count = 0; (elapsed = g_test_timer_elapsed()) < 1.0; count++) {
+        obj = qobject_from_json(gstr->str, &error_abort);
+        qobject_unref(obj);
+    }
+    g_test_message("parse %zu bytes: %.2f MB/sec", gstr->len,
+                   gstr->len * count / elapsed / 1e6);
+
+    obj = qobject_from_json(gstr->str, &error_abort);
+    g_test_timer_start();
+    for (i = 0; (elapsed = g_test_timer_elapsed()) < 1.0; i++) {
+        json = qobject_to_json(obj);
+        count = qstring_get_length(json);
+        qobject_unref(json);
+    }
+    g_test_message("serialize %d bytes: %.2f MB/sec", count,
+                   (double)count * i / elapsed / 1e6);
+
+    qobject_unref(obj);
+    g_string_free(gstr, true);
+}
+
 static void simple_list(void)
 {
     int i;
@@ -1483,6 +1594,11 @@ int main(int argc, char **argv)
 
     g_test_add_func("/dicts/simple_dict", simple_dict);
     g_test_add_func("/dicts/large_dict", large_dict);
+    g_test_add_func("/lists/large_document", large_document);
+    g_test_add_func("/lists/large_document_split", large_document_split);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/large_document", perf_large_document);
+    }
     g_test_add_func("/lists/simple_list", simple_list);
 
     g_test_add_func("/mixed/simple_whitespace", simple_whitespace);
@@ -121,4 +121,35 @@ COMPARISONS = [
         Scenario("compr-xbzrle-cache-50",
                  compression_xbzrle=True, compression_xbzrle_cache=50),
     ]),
+
+
+    # Looking at effect of multifd with varying numbers
+    # of channels
+    Comparison("multifd", scenarios = [
+        Scenario("multifd-channels-1",
+                 multifd=True, multifd_channels=1),
+        Scenario("multifd-channels-2",
+                 multifd=True, multifd_channels=2),
+        Scenario("multifd-channels-4",
+                 multifd=True, multifd_channels=4),
+        Scenario("multifd-channels-8",
+                 multifd=True, multifd_channels=8),
+    ]),
+
+
+    # Looking at how precopy, post-copy, multifd and
+    # compression cope with different guest workloads
+    Comparison("dirty-pattern", scenarios = [
+        Scenario("%s-%s" % (strategy, pattern),
+                 dirty_pattern=pattern, **options)
+        for pattern in ("uniform", "hot", "zero")
+        for strategy, options in (
+            ("precopy", {}),
+            ("post-copy", {"post_copy": True}),
+            ("multifd", {"multifd": True, "multifd_channels": 4}),
+            ("compr-mt", {"compression_mt": True,
+                          "compression_mt_threads": 4}),
+            ("compr-xbzrle", {"compression_xbzrle": True}),
+        )
+    ]),
 ]
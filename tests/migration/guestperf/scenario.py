@@ -29,7 +29,9 @@ class Scenario(object):
                  post_copy=False, post_copy_iters=5,
                  auto_converge=False, auto_converge_step=10,
                  compression_mt=False, compression_mt_threads=1,
-                 compression_xbzrle=False, compression_xbzrle_cache=10):
+                 compression_xbzrle=False, compression_xbzrle_cache=10,
+                 multifd=False, multifd_channels=2,
+                 dirty_pattern="uniform"):
 
         self._name = name
 
@@ -56,6 +58,12 @@ class Scenario(object):
         self._compression_xbzrle = compression_xbzrle
         self._compression_xbzrle_cache = compression_xbzrle_cache # percentage of guest RAM
 
+        self._multifd = multifd
+        self._multifd_channels = multifd_channels
+
+        # Guest workload, one of "uniform", "hot" or "zero"
+        self._dirty_pattern = dirty_pattern
+
     def serialize(self):
         return {
             "name": self._name,
@@ -73,6 +81,9 @@ class Scenario(object):
             "compression_mt_threads": self._compression_mt_threads,
             "compression_xbzrle": self._compression_xbzrle,
             "compression_xbzrle_cache": self._compression_xbzrle_cache,
+            "multifd": self._multifd,
+            "multifd_channels": self._multifd_channels,
+            "dirty_pattern": self._dirty_pattern,
         }
 
     @classmethod
@@ -92,4 +103,8 @@ class Scenario(object):
             data["compression_mt"],
             data["compression_mt_threads"],
             data["compression_xbzrle"],
-            data["compression_xbzrle_cache"])
+            data["compression_xbzrle_cache"],
+            # Absent from reports made before these were added
+            data.get("multifd", False),
+            data.get("multifd_channels", 2),
+            data.get("dirty_pattern", "uniform"))
@@ -29,6 +29,19 @@ const char *argv0;
 
 #define PAGE_SIZE 4096
 
+/* How the guest dirties its RAM */
+enum {
+    PATTERN_UNIFORM,    /* all of RAM, with random data */
+    PATTERN_HOT,        /* only the first HOT_SET_PERCENT of RAM */
+    PATTERN_ZERO,       /* all of RAM, but only one page in ZERO_RATIO
+                         * gets data, the others are cleared */
+};
+
+#define HOT_SET_PERCENT 10
+#define ZERO_RATIO 16
+
+static int pattern = PATTERN_UNIFORM;
+
 static int gettid(void)
 {
     return syscall(SYS_gettid);
@@ -167,9 +180,26 @@ static unsigned long long now(void)
     return (tv.tv_sec * 1000ull) + (tv.tv_usec / 1000ull);
 }
 
+static int parse_pattern(const char *str)
+{
+    if (!strcmp(str, "uniform")) {
+        pattern = PATTERN_UNIFORM;
+    } else if (!strcmp(str, "hot")) {
+        pattern = PATTERN_HOT;
+    } else if (!strcmp(str, "zero")) {
+        pattern = PATTERN_ZERO;
+    } else {
+        fprintf(stderr, "%s (%05d): ERROR: unknown dirty pattern %s\n",
+                argv0, gettid(), str);
+        return -1;
+    }
+    return 0;
+}
+
 static int stressone(unsigned long long ramsizeMB)
 {
     size_t pagesPerMB = 1024 * 1024 / PAGE_SIZE;
+    unsigned long long dirtyMB = ramsizeMB;
     char *ram = malloc(ramsizeMB * 1024 * 1024);
     char *ramptr;
     size_t i, j, k;
@@ -203,13 +233,25 @@ static int stressone(unsigned long long ramsizeMB)
         return -1;
     }
 
+    if (pattern == PATTERN_HOT) {
+        dirtyMB = ramsizeMB * HOT_SET_PERCENT / 100;
+        if (!dirtyMB) {
+            dirtyMB = 1;
+        }
+    }
+
     before = now();
 
     while (1) {
 
         ramptr = ram;
-        for (i = 0; i < ramsizeMB; i++, nMB++) {
+        for (i = 0; i < dirtyMB; i++, nMB++) {
             for (j = 0; j < pagesPerMB; j++) {
+                if (pattern == PATTERN_ZERO && j % ZERO_RATIO) {
+                    memset(ramptr, 0, PAGE_SIZE);
+                    ramptr += PAGE_SIZE;
+                    continue;
+                }
                 dataptr = data;
                 for (k = 0; k < PAGE_SIZE; k += sizeof(long long)) {
                     ramptr += sizeof(long long);
@@ -296,11 +338,13 @@ int main(int argc, char **argv)
     char *end;
     int ch;
     int opt_ind = 0;
-    const char *sopt = "hr:c:";
+    char *patternstr;
+    const char *sopt = "hr:c:p:";
     struct option lopt[] = {
         { "help", no_argument, NULL, 'h' },
         { "ramsize", required_argument, NULL, 'r' },
         { "cpus", required_argument, NULL, 'c' },
+        { "pattern", required_argument, NULL, 'p' },
         { NULL, 0, NULL, 0 }
     };
     int ret;
@@ -330,9 +374,16 @@ int main(int argc, char **argv)
             }
             break;
 
+        case 'p':
+            if (parse_pattern(optarg) < 0) {
+                exit_failure();
+            }
+            break;
+
         case '?':
         case 'h':
-            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]\n", argv0);
+            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]"
+                    "[--pattern uniform|hot|zero]\n", argv0);
             exit_failure();
         }
     }
@@ -344,6 +395,16 @@ int main(int argc, char **argv)
         ret = get_command_arg_ull("ramsize", &ramsizeGB);
         if (ret < 0)
             exit_failure();
+
+        ret = get_command_arg_str("pattern", &patternstr);
+        if (ret < 0)
+            exit_failure();
+        if (ret > 0) {
+            ret = parse_pattern(patternstr);
+            free(patternstr);
+            if (ret < 0)
+                exit_failure();
+        }
     }
 
     if (ncpus == 0)
@@ -0,0 +1,95 @@
+/*
+ * Report the most executed blocks of the guest
+ *
+ * Usage: -plugin tests/plugin/libhotblocks.so[,arg=<count>] -d plugin
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+typedef struct {
+    uint64_t vaddr;
+    uint64_t exec_count;
+    size_t insns;
+} BlockInfo;
+
+static GMutex lock;
+static GHashTable *blocks;
+static unsigned int limit = 20;
+
+static gint cmp_exec_count(gconstpointer a, gconstpointer b)
+{
+    const BlockInfo *ea = a;
+    const BlockInfo *eb = b;
+
+    return ea->exec_count > eb->exec_count ? -1 :
+           ea->exec_count < eb->exec_count;
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    GString *report = g_string_new("vaddr, executions, instructions\n");
+    GList *sorted, *it;
+    unsigned int i;
+
+    g_mutex_lock(&lock);
+    sorted = g_list_sort(g_hash_table_get_values(blocks), cmp_exec_count);
+    for (it = sorted, i = 0; it && i < limit; it = it->next, i++) {
+        BlockInfo *bi = it->data;
+
+        g_string_append_printf(report, "0x%016" PRIx64 ", %" PRIu64 ", %zu\n",
+                               bi->vaddr, bi->exec_count, bi->insns);
+    }
+    g_list_free(sorted);
+    g_mutex_unlock(&lock);
+
+    qemu_plugin_outs(report->str);
+    g_string_free(report, true);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    uint64_t vaddr = qemu_plugin_tb_vaddr(tb);
+    BlockInfo *bi;
+
+    /* A block is translated again after a flush, or for another vCPU */
+    g_mutex_lock(&lock);
+    bi = g_hash_table_lookup(blocks, &vaddr);
+    if (!bi) {
+        bi = g_new0(BlockInfo, 1);
+        bi->vaddr = vaddr;
+        bi->insns = qemu_plugin_tb_n_insns(tb);
+        g_hash_table_insert(blocks, &bi->vaddr, bi);
+    }
+    g_mutex_unlock(&lock);
+
+    /* Not atomic: counts of blocks that run on several vCPUs may be low */
+    qemu_plugin_register_vcpu_tb_exec_inline(tb, QEMU_PLUGIN_INLINE_ADD_U64,
+                                             &bi->exec_count, 1);
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    if (argc > 1) {
+        fprintf(stderr, "hotblocks: at most one argument, the count\n");
+        return -1;
+    }
+    if (argc) {
+        limit = strtoul(argv[0], NULL, 0);
+    }
+
+    blocks = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
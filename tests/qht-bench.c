@@ -9,8 +9,12 @@
 #include "qemu/atomic.h"
 #include "qemu/qht.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "qemu/xxhash.h"
 
+/* latencies are bucketed by their base-2 logarithm, in ns */
+#define LAT_BUCKETS 64
+
 struct thread_stats {
     size_t rd;
     size_t not_rd;
@@ -20,6 +24,8 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    size_t lat[LAT_BUCKETS];
+    uint64_t lat_max;
 };
 
 struct thread_info {
@@ -54,6 +60,7 @@ static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
+static bool measure_latency;
 
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
@@ -86,7 +93,9 @@ static const char commands_string[] =
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
-    " -N = number of resize threads";
+    " -N = number of resize threads\n"
+    "\n"
+    " -L = measure the latency distribution of lookups and updates";
 
 static void usage_complete(int argc, char *argv[])
 {
@@ -148,12 +157,26 @@ static void do_rz(struct thread_info *info)
     g_usleep(resize_delay);
 }
 
+static void account_latency(struct thread_stats *stats, int64_t start)
+{
+    uint64_t delta = get_clock() - start;
+
+    stats->lat[63 - clz64(delta | 1)]++;
+    if (delta > stats->lat_max) {
+        stats->lat_max = delta;
+    }
+}
+
 static void do_rw(struct thread_info *info)
 {
     struct thread_stats *stats = &info->stats;
+    int64_t start = 0;
     uint32_t hash;
     long *p;
 
+    if (measure_latency) {
+        start = get_clock();
+    }
     if (info->r >= update_threshold) {
         bool read;
 
@@ -193,6 +216,9 @@ static void do_rw(struct thread_info *info)
         }
         info->write_op = !info->write_op;
     }
+    if (measure_latency) {
+        account_latency(stats, start);
+    }
 }
 
 static void *thread_func(void *p)
@@ -267,6 +293,7 @@ static void pr_params(void)
     printf(" initial size hint: %zu\n", qht_n_elems);
     printf(" auto-resize:       %s\n",
            qht_mode & QHT_MODE_AUTO_RESIZE ? "on" : "off");
+    printf(" latency tracking:  %s\n", measure_latency ? "on" : "off");
     if (resize_rate) {
         printf(" resize_rate:       %f%%\n", resize_rate * 100.0);
         printf(" resize range:      %zu-%zu\n", resize_min, resize_max);
@@ -344,7 +371,7 @@ static void htable_init(void)
 
 static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 {
-    int i;
+    int i, j;
 
     for (i = 0; i < n; i++) {
         struct thread_stats *stats = &info[i].stats;
@@ -360,9 +387,33 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        for (j = 0; j < LAT_BUCKETS; j++) {
+            s->lat[j] += stats->lat[j];
+        }
+        s->lat_max = MAX(s->lat_max, stats->lat_max);
     }
 }
 
+/* upper bound, in ns, of the latency of the @pct percentile */
+static uint64_t lat_percentile(const struct thread_stats *s, double pct)
+{
+    size_t total = 0;
+    size_t sum = 0;
+    int i;
+
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        total += s->lat[i];
+    }
+    for (i = 0; i < LAT_BUCKETS - 1; i++) {
+        sum += s->lat[i];
+        if (sum >= total * pct / 100.0) {
+            break;
+        }
+    }
+    return MIN(UINT64_C(2) << i, s->lat_max);
+}
+
 static void pr_stats(void)
 {
     struct thread_stats s = {};
@@ -394,6 +445,15 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+
+    /* resize threads do not record latencies; s has the rw threads' */
+    if (measure_latency) {
+        printf(" Latency p50:       %" PRIu64 " ns\n", lat_percentile(&s, 50));
+        printf(" Latency p99:       %" PRIu64 " ns\n", lat_percentile(&s, 99));
+        printf(" Latency p99.9:     %" PRIu64 " ns\n",
+               lat_percentile(&s, 99.9));
+        printf(" Latency max:       %" PRIu64 " ns\n", s.lat_max);
+    }
 }
 
 static void run_test(void)
@@ -421,7 +481,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:Lhn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -451,6 +511,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
@@ -135,6 +135,8 @@ static void *rcu_read_perf_test(void *arg)
     return NULL;
 }
 
+static bool expedited;
+
 static void *rcu_update_perf_test(void *arg)
 {
     long long n_updates_local = 0;
@@ -147,7 +149,11 @@ static void *rcu_update_perf_test(void *arg)
         g_usleep(1000);
     }
     while (goflag == GOFLAG_RUN) {
-        synchronize_rcu();
+        if (expedited) {
+            synchronize_rcu_expedited();
+        } else {
+            synchronize_rcu();
+        }
         n_updates_local++;
     }
     qemu_mutex_lock(&counts_mutex);
@@ -216,6 +222,76 @@ static void uperftest(int nupdaters, int duration)
     perftestrun(i, duration, 0, nupdaters);
 }
 
+/*
+ * call_rcu() performance test: each updater queues RCU_CALL_BATCH
+ * callbacks at a time, optionally inside call_rcu_batch_begin/end, and
+ * waits for the call_rcu thread to run them.
+ */
+
+#define RCU_CALL_BATCH 64
+
+static bool batched;
+
+struct rcu_call_perf {
+    struct rcu_head rcu;
+    int *pending;
+};
+
+static void rcu_call_perf_cb(struct rcu_call_perf *p)
+{
+    atomic_dec(p->pending);
+}
+
+static void *rcu_call_perf_test(void *arg)
+{
+    struct rcu_call_perf items[RCU_CALL_BATCH];
+    long long n_updates_local = 0;
+    int pending;
+    int i;
+
+    rcu_register_thread();
+
+    *(struct rcu_reader_data **)arg = &rcu_reader;
+    atomic_inc(&nthreadsrunning);
+    while (goflag == GOFLAG_INIT) {
+        g_usleep(1000);
+    }
+    while (goflag == GOFLAG_RUN) {
+        pending = RCU_CALL_BATCH;
+        if (batched) {
+            call_rcu_batch_begin();
+        }
+        for (i = 0; i < RCU_CALL_BATCH; i++) {
+            items[i].pending = &pending;
+            call_rcu(&items[i], rcu_call_perf_cb, rcu);
+        }
+        if (batched) {
+            call_rcu_batch_end();
+        }
+        while (atomic_read(&pending)) {
+            g_usleep(100);
+        }
+        n_updates_local += RCU_CALL_BATCH;
+    }
+    qemu_mutex_lock(&counts_mutex);
+    n_updates += n_updates_local;
+    qemu_mutex_unlock(&counts_mutex);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void cperftest(int nupdaters, int duration)
+{
+    int i;
+
+    perftestinit();
+    for (i = 0; i < nupdaters; i++) {
+        create_thread(rcu_call_perf_test);
+    }
+    perftestrun(i, duration, 0, nupdaters);
+}
+
 /*
  * Stress test.
  */
@@ -308,7 +384,11 @@ static void *rcu_update_stress_test(void *arg)
                 rcu_stress_array[i].pipe_count++;
             }
         }
-        synchronize_rcu();
+        if (expedited) {
+            synchronize_rcu_expedited();
+        } else {
+            synchronize_rcu();
+        }
         n_updates++;
     }
 
@@ -407,13 +487,20 @@ static void gtest_stress_10_5(void)
     gtest_stress(10, 5);
 }
 
+static void gtest_stress_expedited_10_1(void)
+{
+    expedited = true;
+    gtest_stress(10, 1);
+}
+
 /*
  * Mainprogram.
  */
 
 static void usage(int argc, char *argv[])
 {
-    fprintf(stderr, "Usage: %s [nreaders [ perf | stress ] ]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [nreaders [ { perf | rperf | uperf | cperf |"
+            " stress }[-exp | -batch] [duration] ] ]\n", argv[0]);
     exit(-1);
 }
 
@@ -428,9 +515,13 @@ int main(int argc, char *argv[])
         if (g_test_quick()) {
             g_test_add_func("/rcu/torture/1reader", gtest_stress_1_1);
             g_test_add_func("/rcu/torture/10readers", gtest_stress_10_1);
+            g_test_add_func("/rcu/torture/expedited",
+                            gtest_stress_expedited_10_1);
         } else {
             g_test_add_func("/rcu/torture/1reader", gtest_stress_1_5);
             g_test_add_func("/rcu/torture/10readers", gtest_stress_10_5);
+            g_test_add_func("/rcu/torture/expedited",
+                            gtest_stress_expedited_10_1);
         }
         return g_test_run();
     }
@@ -441,12 +532,26 @@ int main(int argc, char *argv[])
     if (argc > 3) {
         duration = strtoul(argv[3], NULL, 0);
     }
+    if (argc >= 3) {
+        /* A "-exp" or "-batch" suffix selects the faster variants.  */
+        char *suffix = strchr(argv[2], '-');
+
+        if (suffix && strcmp(suffix, "-exp") == 0) {
+            expedited = true;
+            *suffix = 0;
+        } else if (suffix && strcmp(suffix, "-batch") == 0) {
+            batched = true;
+            *suffix = 0;
+        }
+    }
     if (argc < 3 || strcmp(argv[2], "stress") == 0) {
         stresstest(nreaders, duration);
     } else if (strcmp(argv[2], "rperf") == 0) {
         rperftest(nreaders, duration);
     } else if (strcmp(argv[2], "uperf") == 0) {
         uperftest(nreaders, duration);
+    } else if (strcmp(argv[2], "cperf") == 0) {
+        cperftest(nreaders, duration);
     } else if (strcmp(argv[2], "perf") == 0) {
         perftest(nreaders, duration);
     }
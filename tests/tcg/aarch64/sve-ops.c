@@ -0,0 +1,123 @@
+/*
+ * Predicated SVE integer ops, with all-true and partial predicates
+ *
+ * Checks the results against C and reports how long a loop of
+ * PTRUE-governed ops takes, which is the common case.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+asm(".arch armv8.2-a+sve");
+
+#define MAX_VL   256            /* bytes */
+#define LOOPS    1000000
+
+static uint8_t n[MAX_VL], m[MAX_VL], d[MAX_VL], pred[MAX_VL / 8];
+
+/*
+ * The compiler knows nothing of SVE here, and does not use the predicate
+ * registers, so only the vector registers need to be clobbered.
+ */
+#define SVE_OP(NAME, SZ, INSN)                                          \
+static void NAME(void)                                                  \
+{                                                                       \
+    asm volatile("ptrue p1." SZ "\n\t"                                  \
+                 "ld1b {z0.b}, p1/z, [%1]\n\t"                          \
+                 "ld1b {z1.b}, p1/z, [%2]\n\t"                          \
+                 "ldr p0, [%3]\n\t"                                     \
+                 INSN " z0." SZ ", p0/m, z0." SZ ", z1." SZ "\n\t"      \
+                 "st1b {z0.b}, p1, [%0]"                                \
+                 : : "r"(d), "r"(n), "r"(m), "r"(pred)                  \
+                 : "v0", "v1", "memory");                               \
+}
+
+SVE_OP(add_b, "b", "add")
+SVE_OP(sub_h, "h", "sub")
+SVE_OP(eor_s, "s", "eor")
+SVE_OP(mul_d, "d", "mul")
+SVE_OP(umax_b, "b", "umax")
+
+static unsigned vl;
+
+static uint64_t elt(const uint8_t *v, unsigned i, unsigned esz)
+{
+    uint64_t r = 0;
+
+    memcpy(&r, v + i * esz, esz);
+    return r;
+}
+
+static void check(void (*op)(void), unsigned esz, const char *name,
+                  uint64_t (*ref)(uint64_t, uint64_t))
+{
+    uint64_t mask = esz == 8 ? -1ull : (1ull << (esz * 8)) - 1;
+    unsigned i, p;
+
+    /* All true, every other element, and only the first element */
+    for (p = 0; p < 3; p++) {
+        memset(pred, 0, sizeof(pred));
+        for (i = 0; i < vl / esz; i++) {
+            if (p == 0 || (p == 1 && !(i & 1)) || i == 0) {
+                pred[i * esz / 8] |= 1 << (i * esz % 8);
+            }
+        }
+        op();
+        for (i = 0; i < vl / esz; i++) {
+            uint64_t nn = elt(n, i, esz), mm = elt(m, i, esz);
+            uint64_t exp = pred[i * esz / 8] & (1 << (i * esz % 8))
+                           ? ref(nn, mm) & mask : nn;
+
+            if (elt(d, i, esz) != exp) {
+                printf("%s: element %u is %#llx, expected %#llx\n", name, i,
+                       (unsigned long long)elt(d, i, esz),
+                       (unsigned long long)exp);
+                assert(0);
+            }
+        }
+    }
+}
+
+static uint64_t ref_add(uint64_t a, uint64_t b) { return a + b; }
+static uint64_t ref_sub(uint64_t a, uint64_t b) { return a - b; }
+static uint64_t ref_eor(uint64_t a, uint64_t b) { return a ^ b; }
+static uint64_t ref_mul(uint64_t a, uint64_t b) { return a * b; }
+static uint64_t ref_umax(uint64_t a, uint64_t b) { return a > b ? a : b; }
+
+int main()
+{
+    struct timespec t0, t1;
+    unsigned i;
+
+    asm("cntb %0" : "=r"(vl));
+    for (i = 0; i < MAX_VL; i++) {
+        n[i] = i * 7 + 3;
+        m[i] = 0xa5 ^ (i * 13);
+    }
+
+    check(add_b, 1, "add.b", ref_add);
+    check(sub_h, 2, "sub.h", ref_sub);
+    check(eor_s, 4, "eor.s", ref_eor);
+    check(mul_d, 8, "mul.d", ref_mul);
+    check(umax_b, 1, "umax.b", ref_umax);
+
+    memset(pred, 0xff, sizeof(pred));
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    asm volatile("ptrue p0.b\n\t"
+                 "mov x0, %0\n"
+                 "1:\n\t"
+                 "add z0.b, p0/m, z0.b, z1.b\n\t"
+                 "mul z2.h, p0/m, z2.h, z1.h\n\t"
+                 "eor z3.s, p0/m, z3.s, z0.s\n\t"
+                 "subs x0, x0, #1\n\t"
+                 "b.ne 1b"
+                 : : "r"((uint64_t)LOOPS) : "x0", "v0", "v2", "v3", "cc");
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("VL %u bytes, %.1f ns per loop of 3 all-true ops\n", vl,
+           ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec))
+           / LOOPS);
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Benchmark for the guest mmap tracking of linux-user.
+ *
+ * Maps large regions and then lots of small ones with hints that fall
+ * inside the large regions, so that every allocation has to search its
+ * way past a big mapping.  The runtime used to grow with the size of the
+ * mappings that are skipped, it should now only grow with their number.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define fail_unless(x)                                         \
+do                                                             \
+{                                                              \
+  if (!(x)) {                                                  \
+    fprintf(stderr, "FAILED at %s:%d\n", __FILE__, __LINE__); \
+    exit(EXIT_FAILURE);                                       \
+  }                                                            \
+} while (0)
+
+#define NR_LARGE     8
+#define LARGE_SIZE   (16 * 1024 * 1024)
+#define NR_SMALL     512
+#define ITERATIONS   16
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    static char *small[NR_SMALL];
+    char *large[NR_LARGE];
+    size_t pagesize = getpagesize();
+    unsigned long nr_maps = 0;
+    double start;
+    int i, j, k;
+
+    for (i = 0; i < NR_LARGE; i++) {
+        large[i] = mmap(NULL, LARGE_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        fail_unless(large[i] != MAP_FAILED);
+    }
+
+    start = now();
+    for (k = 0; k < ITERATIONS; k++) {
+        for (j = 0; j < NR_SMALL; j++) {
+            char *hint = large[j % NR_LARGE] + LARGE_SIZE / 2;
+
+            small[j] = mmap(hint, pagesize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            fail_unless(small[j] != MAP_FAILED);
+            /* Not a MAP_FIXED mapping, it must not clobber a large one */
+            for (i = 0; i < NR_LARGE; i++) {
+                fail_unless(small[j] + pagesize <= large[i] ||
+                            small[j] >= large[i] + LARGE_SIZE);
+            }
+            small[j][0] = j;
+            nr_maps++;
+        }
+        for (j = 0; j < NR_SMALL; j++) {
+            fail_unless(small[j][0] == (char)j);
+            fail_unless(munmap(small[j], pagesize) == 0);
+        }
+    }
+
+    printf("%lu mmaps in %.3f seconds\n", nr_maps, now() - start);
+
+    for (i = 0; i < NR_LARGE; i++) {
+        fail_unless(munmap(large[i], LARGE_SIZE) == 0);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,105 @@
+/*
+ * Benchmark for address space operations in threaded linux-user guests.
+ *
+ * Every thread keeps mapping, touching, write-protecting and unmapping
+ * memory while also running through freshly reached code, so that guest
+ * mmap/mprotect/munmap calls compete with each other and with the
+ * translator.  Prints the time taken; it should not grow much faster
+ * than the number of threads.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define fail_unless(x)                                         \
+do                                                             \
+{                                                              \
+  if (!(x)) {                                                  \
+    fprintf(stderr, "FAILED at %s:%d\n", __FILE__, __LINE__); \
+    exit(EXIT_FAILURE);                                       \
+  }                                                            \
+} while (0)
+
+#define NR_THREADS   8
+#define ITERATIONS   2000
+#define NR_PAGES     4
+
+static size_t pagesize;
+
+/* Different switch arms end up in different translation blocks */
+static unsigned long work(unsigned long x, int i)
+{
+    switch (i % 8) {
+    case 0: return x * 3 + 1;
+    case 1: return x ^ (x >> 3);
+    case 2: return x + 0x9e3779b9;
+    case 3: return x * 5 - 7;
+    case 4: return (x << 7) | (x >> 9);
+    case 5: return x - (x >> 2);
+    case 6: return x * 11 + 13;
+    default: return ~x;
+    }
+}
+
+static void *thread_func(void *arg)
+{
+    unsigned long x = (unsigned long)arg;
+    int i, j;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        char *p = mmap(NULL, NR_PAGES * pagesize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        fail_unless(p != MAP_FAILED);
+        for (j = 0; j < NR_PAGES; j++) {
+            p[j * pagesize] = j;
+            x = work(x, i + j);
+        }
+        fail_unless(mprotect(p, NR_PAGES * pagesize, PROT_READ) == 0);
+        for (j = 0; j < NR_PAGES; j++) {
+            fail_unless(p[j * pagesize] == j);
+        }
+        fail_unless(munmap(p, NR_PAGES * pagesize) == 0);
+    }
+    return (void *)x;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[NR_THREADS];
+    double start;
+    int i;
+
+    pagesize = getpagesize();
+
+    start = now();
+    for (i = 0; i < NR_THREADS; i++) {
+        fail_unless(pthread_create(&threads[i], NULL, thread_func,
+                                   (void *)(unsigned long)i) == 0);
+    }
+    for (i = 0; i < NR_THREADS; i++) {
+        fail_unless(pthread_join(threads[i], NULL) == 0);
+    }
+
+    printf("%d threads x %d mappings in %.3f seconds\n",
+           NR_THREADS, ITERATIONS, now() - start);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+/*
+ * Bitmap.c unit-tests.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+
+#define BMAP_SIZE  1024
+
+static void test_bitmap_copy_with_src_offset(void)
+{
+    unsigned long *bmap1, *bmap2, *bmap3, total;
+
+    bmap1 = bitmap_new(BMAP_SIZE);
+    bmap2 = bitmap_new(BMAP_SIZE);
+    bmap3 = bitmap_new(BMAP_SIZE);
+
+    /* Fill bmap1 with a pattern that differs from word to word */
+    bitmap_set(bmap1, 0, BMAP_SIZE);
+    bitmap_clear(bmap1, 100, 50);
+    bitmap_clear(bmap1, 400, 3);
+    bitmap_clear(bmap1, 777, 80);
+
+    /* Shifting by whole words takes the fast path */
+    bitmap_copy_with_src_offset(bmap2, bmap1, BITS_PER_LONG, 128);
+    bitmap_copy(bmap3, bmap1 + 1, 128);
+    g_assert(bitmap_equal(bmap2, bmap3, 128));
+
+    /* Compare against a bit by bit copy for unaligned shifts and sizes */
+    for (total = 1; total < BMAP_SIZE / 2; total += 37) {
+        unsigned long shift, i;
+
+        for (shift = 1; shift < BITS_PER_LONG * 3; shift += 7) {
+            bitmap_zero(bmap2, BMAP_SIZE);
+            bitmap_zero(bmap3, BMAP_SIZE);
+
+            bitmap_copy_with_src_offset(bmap2, bmap1, shift, total);
+            for (i = 0; i < total; i++) {
+                if (test_bit(shift + i, bmap1)) {
+                    set_bit(i, bmap3);
+                }
+            }
+            g_assert(bitmap_equal(bmap2, bmap3, total));
+            /* Nothing is written past the last word holding "total" bits */
+            g_assert(find_next_bit(bmap2, BMAP_SIZE,
+                                   BITS_TO_LONGS(total) * BITS_PER_LONG)
+                     == BMAP_SIZE);
+        }
+    }
+
+    g_free(bmap1);
+    g_free(bmap2);
+    g_free(bmap3);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/bitmap/bitmap_copy_with_src_offset",
+                    test_bitmap_copy_with_src_offset);
+
+    g_test_run();
+
+    return 0;
+}
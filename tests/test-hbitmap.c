@@ -410,6 +410,63 @@ static void test_hbitmap_reset_all(TestHBitmapData *data,
     hbitmap_test_reset_all(data);
 }
 
+static void test_hbitmap_merge_check(HBitmap *result, HBitmap *a,
+                                     HBitmap *b, uint64_t size)
+{
+    uint64_t i, count = 0;
+
+    for (i = 0; i < size; i++) {
+        bool set = hbitmap_get(a, i) || hbitmap_get(b, i);
+
+        g_assert_cmpint(hbitmap_get(result, i), ==, set);
+        count += set;
+    }
+    g_assert_cmpint(hbitmap_count(result), ==, count);
+}
+
+static void test_hbitmap_merge(TestHBitmapData *data,
+                               const void *unused)
+{
+    HBitmap *a = hbitmap_alloc(L3 * 2, 0);
+    HBitmap *b = hbitmap_alloc(L3 * 2, 0);
+    HBitmap *a_copy = hbitmap_alloc(L3 * 2, 0);
+    HBitmap *result = hbitmap_alloc(L3 * 2, 0);
+
+    /* Empty B into a different result must still give A */
+    hbitmap_set(a, L1 - 1, 3);
+    hbitmap_set(result, L2, L1);
+    g_assert(hbitmap_merge(a, b, result));
+    test_hbitmap_merge_check(result, a, b, L3 * 2);
+
+    /* Overlapping and disjoint words, crossing all levels */
+    hbitmap_set(a, L2 - 1, L1 + 2);
+    hbitmap_set(b, 0, L1);
+    hbitmap_set(b, L2, 5);
+    hbitmap_set(b, L3 + L2 + 7, 1);
+    hbitmap_set(b, L3 * 2 - 1, 1);
+    g_assert(hbitmap_merge(a, b, result));
+    test_hbitmap_merge_check(result, a, b, L3 * 2);
+
+    /* In place, with the result on either side */
+    g_assert(hbitmap_merge(a, a, a_copy));
+    g_assert(hbitmap_merge(a, b, a));
+    test_hbitmap_merge_check(a, a_copy, b, L3 * 2);
+    g_assert(hbitmap_merge(a_copy, b, b));
+    test_hbitmap_merge_check(b, a, a, L3 * 2);
+
+    /* The result is still a consistent HBitmap */
+    hbitmap_reset_all(result);
+    g_assert(hbitmap_merge(b, result, result));
+    hbitmap_reset(result, 0, L3 * 2);
+    g_assert_cmpint(hbitmap_count(result), ==, 0);
+    g_assert(hbitmap_empty(result));
+
+    hbitmap_free(a);
+    hbitmap_free(b);
+    hbitmap_free(a_copy);
+    hbitmap_free(result);
+}
+
 static void test_hbitmap_granularity(TestHBitmapData *data,
                                      const void *unused)
 {
@@ -1123,6 +1180,7 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/reset/empty", test_hbitmap_reset_empty);
     hbitmap_test_add("/hbitmap/reset/general", test_hbitmap_reset);
     hbitmap_test_add("/hbitmap/reset/all", test_hbitmap_reset_all);
+    hbitmap_test_add("/hbitmap/merge", test_hbitmap_merge);
     hbitmap_test_add("/hbitmap/granularity", test_hbitmap_granularity);
 
     hbitmap_test_add("/hbitmap/truncate/nop", test_hbitmap_truncate_nop);
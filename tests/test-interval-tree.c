@@ -0,0 +1,136 @@
+/*
+ * Tests for the interval tree
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+#define N_NODES 512
+#define RANGE   4096
+
+typedef struct {
+    IntervalTreeNode *exclude;
+    unsigned count;
+} CountData;
+
+static bool overlaps(IntervalTreeNode *n, uint64_t start, uint64_t end)
+{
+    return n->start < end && start < n->end;
+}
+
+static bool count_node(IntervalTreeNode *node, void *opaque)
+{
+    CountData *data = opaque;
+
+    if (node != data->exclude) {
+        data->count++;
+    }
+    return false;
+}
+
+static bool first_node(IntervalTreeNode *node, void *opaque)
+{
+    return true;
+}
+
+static void check_query(IntervalTreeRoot *root, IntervalTreeNode *nodes,
+                        bool *present, uint64_t start, uint64_t end)
+{
+    CountData data = { .exclude = NULL };
+    IntervalTreeNode *found;
+    unsigned expected = 0;
+    int i;
+
+    for (i = 0; i < N_NODES; i++) {
+        if (present[i] && overlaps(&nodes[i], start, end)) {
+            expected++;
+        }
+    }
+
+    interval_tree_find(root, start, end, count_node, &data);
+    g_assert_cmpuint(data.count, ==, expected);
+
+    found = interval_tree_find(root, start, end, first_node, NULL);
+    g_assert(!found == !expected);
+    if (found) {
+        g_assert(overlaps(found, start, end));
+    }
+}
+
+static void test_interval_tree_random(void)
+{
+    IntervalTreeRoot root = INTERVAL_TREE_ROOT_INITIALIZER;
+    IntervalTreeNode *nodes = g_new0(IntervalTreeNode, N_NODES);
+    bool *present = g_new0(bool, N_NODES);
+    int i, round;
+
+    for (round = 0; round < 8 * N_NODES; round++) {
+        i = g_test_rand_int_range(0, N_NODES);
+        if (present[i]) {
+            interval_tree_remove(&root, &nodes[i]);
+            present[i] = false;
+        } else {
+            nodes[i].start = g_test_rand_int_range(0, RANGE);
+            /* Empty intervals are allowed as well */
+            nodes[i].end = nodes[i].start + g_test_rand_int_range(0, 64);
+            interval_tree_insert(&root, &nodes[i]);
+            present[i] = true;
+        }
+
+        if (round % 16 == 0) {
+            uint64_t start = g_test_rand_int_range(0, RANGE);
+            uint64_t end = start + g_test_rand_int_range(0, 256);
+
+            check_query(&root, nodes, present, start, end);
+        }
+    }
+
+    for (i = 0; i < N_NODES; i++) {
+        if (present[i]) {
+            interval_tree_remove(&root, &nodes[i]);
+        }
+    }
+    g_assert(interval_tree_empty(&root));
+
+    g_free(present);
+    g_free(nodes);
+}
+
+static void test_interval_tree_edges(void)
+{
+    IntervalTreeRoot root = INTERVAL_TREE_ROOT_INITIALIZER;
+    IntervalTreeNode a = { .start = 100, .end = 200 };
+    IntervalTreeNode empty = { .start = 150, .end = 150 };
+    IntervalTreeNode same = { .start = 100, .end = 200 };
+
+    interval_tree_insert(&root, &a);
+    interval_tree_insert(&root, &empty);
+    interval_tree_insert(&root, &same);
+
+    /* Touching ranges do not overlap */
+    g_assert(!interval_tree_find(&root, 0, 100, first_node, NULL));
+    g_assert(!interval_tree_find(&root, 200, 300, first_node, NULL));
+    g_assert(interval_tree_find(&root, 199, 300, first_node, NULL));
+
+    /* An empty range overlaps what strictly contains it */
+    g_assert(interval_tree_find(&root, 150, 150, first_node, NULL));
+    g_assert(!interval_tree_find(&root, 100, 100, first_node, NULL));
+
+    interval_tree_remove(&root, &a);
+    interval_tree_remove(&root, &same);
+    g_assert(interval_tree_find(&root, 140, 160, first_node, NULL) == &empty);
+    g_assert(!interval_tree_find(&root, 150, 160, first_node, NULL));
+    interval_tree_remove(&root, &empty);
+    g_assert(interval_tree_empty(&root));
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/random", test_interval_tree_random);
+    g_test_add_func("/interval-tree/edges", test_interval_tree_edges);
+    return g_test_run();
+}
@@ -442,6 +442,7 @@ static void test_io_channel_unix_fd_pass(void)
                             G_N_ELEMENTS(iosend),
                             fdsend,
                             G_N_ELEMENTS(fdsend),
+                            0,
                             &error_abort);
 
     qio_channel_readv_full(dst,
@@ -550,6 +551,58 @@ static void test_io_channel_ipv4_fd(void)
 }
 
 
+static void test_io_channel_ipv4_zero_copy(void)
+{
+    SocketAddress *listen_addr = g_new0(SocketAddress, 1);
+    SocketAddress *connect_addr = g_new0(SocketAddress, 1);
+    QIOChannel *src, *dst, *srv;
+    char *bufsend = g_malloc(64 * 1024);
+    char *bufrecv = g_malloc0(64 * 1024);
+    struct iovec iosend = { .iov_base = bufsend, .iov_len = 64 * 1024 };
+
+    listen_addr->type = SOCKET_ADDRESS_TYPE_INET;
+    listen_addr->u.inet = (InetSocketAddress) {
+        .host = g_strdup("127.0.0.1"),
+        .port = NULL, /* Auto-select */
+    };
+
+    connect_addr->type = SOCKET_ADDRESS_TYPE_INET;
+    connect_addr->u.inet = (InetSocketAddress) {
+        .host = g_strdup("127.0.0.1"),
+        .port = NULL, /* Filled in later */
+    };
+
+    test_io_channel_setup_sync(listen_addr, connect_addr, &srv, &src, &dst);
+
+    if (!qio_channel_has_feature(src, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        g_test_skip("MSG_ZEROCOPY is not supported by this host");
+        goto cleanup;
+    }
+
+    memset(bufsend, 0x5a, 64 * 1024);
+    g_assert_cmpint(qio_channel_writev_full_all(
+                        src, &iosend, 1, NULL, 0,
+                        QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                        &error_abort), ==, 0);
+    g_assert_cmpint(qio_channel_read_all(dst, bufrecv, 64 * 1024,
+                                         &error_abort), ==, 0);
+    g_assert_cmpint(qio_channel_flush(src, &error_abort), >=, 0);
+    g_assert(memcmp(bufsend, bufrecv, 64 * 1024) == 0);
+
+    /* Nothing is pending any more, so this must return immediately */
+    g_assert_cmpint(qio_channel_flush(src, &error_abort), ==, 0);
+
+ cleanup:
+    object_unref(OBJECT(src));
+    object_unref(OBJECT(dst));
+    object_unref(OBJECT(srv));
+    qapi_free_SocketAddress(listen_addr);
+    qapi_free_SocketAddress(connect_addr);
+    g_free(bufsend);
+    g_free(bufrecv);
+}
+
+
 int main(int argc, char **argv)
 {
     bool has_ipv4, has_ipv6;
@@ -575,6 +628,8 @@ int main(int argc, char **argv)
                         test_io_channel_ipv4_async);
         g_test_add_func("/io/channel/socket/ipv4-fd",
                         test_io_channel_ipv4_fd);
+        g_test_add_func("/io/channel/socket/ipv4-zero-copy",
+                        test_io_channel_ipv4_zero_copy);
     }
     if (has_ipv6) {
         g_test_add_func("/io/channel/socket/ipv6-sync",
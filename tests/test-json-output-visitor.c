@@ -0,0 +1,189 @@
+/*
+ * JSON Output Visitor unit-tests.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qemu-common.h"
+#include "qapi/error.h"
+#include "qapi/json-output-visitor.h"
+#include "test-qapi-visit.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qnull.h"
+#include "qapi/qmp/qstring.h"
+
+typedef struct TestOutputVisitorData {
+    Visitor *ov;
+    QString *str;
+} TestOutputVisitorData;
+
+static void visitor_output_setup(TestOutputVisitorData *data,
+                                 const void *unused)
+{
+    data->ov = json_output_visitor_new(&data->str);
+    g_assert(data->ov);
+}
+
+static void visitor_output_teardown(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    visit_free(data->ov);
+    data->ov = NULL;
+    qobject_unref(data->str);
+    data->str = NULL;
+}
+
+static const char *visitor_get(TestOutputVisitorData *data)
+{
+    visit_complete(data->ov, &data->str);
+    g_assert(data->str);
+    return qstring_get_str(data->str);
+}
+
+static void test_visitor_out_int(TestOutputVisitorData *data,
+                                 const void *unused)
+{
+    int64_t value = -42;
+
+    visit_type_int(data->ov, NULL, &value, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "-42");
+}
+
+static void test_visitor_out_number(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    double value = 3.5;
+
+    visit_type_number(data->ov, NULL, &value, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "3.5");
+}
+
+static void test_visitor_out_string(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    char *string = (char *) "a \"b\"\n\\";
+
+    visit_type_str(data->ov, NULL, &string, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "\"a \\\"b\\\"\\n\\\\\"");
+}
+
+static void test_visitor_out_struct(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    UserDefOne ud = {
+        .integer = 42,
+        .string = (char *) "foo",
+        .has_enum1 = true,
+        .enum1 = ENUM_ONE_VALUE2,
+    };
+    UserDefOne *p = &ud;
+
+    visit_type_UserDefOne(data->ov, "unused", &p, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==,
+                    "{\"integer\": 42, \"string\": \"foo\", "
+                    "\"enum1\": \"value2\"}");
+}
+
+static void test_visitor_out_list(TestOutputVisitorData *data,
+                                  const void *unused)
+{
+    UserDefOne ud[2] = {
+        { .integer = 1, .string = (char *) "a" },
+        { .integer = 2, .string = (char *) "b" },
+    };
+    UserDefOneList tail = { .value = &ud[1] };
+    UserDefOneList head = { .next = &tail, .value = &ud[0] };
+    UserDefOneList *p = &head;
+
+    visit_type_UserDefOneList(data->ov, NULL, &p, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==,
+                    "[{\"integer\": 1, \"string\": \"a\"}, "
+                    "{\"integer\": 2, \"string\": \"b\"}]");
+}
+
+static void test_visitor_out_empty_list(TestOutputVisitorData *data,
+                                        const void *unused)
+{
+    UserDefOneList *p = NULL;
+
+    visit_type_UserDefOneList(data->ov, NULL, &p, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "[]");
+}
+
+static void test_visitor_out_any(TestOutputVisitorData *data,
+                                 const void *unused)
+{
+    QDict *qdict = qdict_new();
+    QObject *qobj;
+    QNull *null = NULL;
+
+    qdict_put_bool(qdict, "b", true);
+    qobj = QOBJECT(qdict);
+
+    visit_start_struct(data->ov, NULL, NULL, 0, &error_abort);
+    visit_type_any(data->ov, "any", &qobj, &error_abort);
+    visit_type_null(data->ov, "null", &null, &error_abort);
+    visit_check_struct(data->ov, &error_abort);
+    visit_end_struct(data->ov, NULL);
+    g_assert_cmpstr(visitor_get(data), ==,
+                    "{\"any\": {\"b\": true}, \"null\": null}");
+    qobject_unref(qdict);
+}
+
+/* Text from this visitor can be embedded in a QObject and sent as is */
+static void test_visitor_out_embed(TestOutputVisitorData *data,
+                                   const void *unused)
+{
+    int64_t value = 7;
+    QDict *qdict = qdict_new();
+    QString *json;
+
+    visit_type_int(data->ov, NULL, &value, &error_abort);
+    visitor_get(data);
+    data->str->json = true;
+    qdict_put(qdict, "return", qobject_ref(data->str));
+    json = qobject_to_json(QOBJECT(qdict));
+    g_assert_cmpstr(qstring_get_str(json), ==, "{\"return\": 7}");
+    qobject_unref(json);
+    qobject_unref(qdict);
+}
+
+static void output_visitor_test_add(const char *testpath,
+                                    TestOutputVisitorData *data,
+                                    void (*test_func)(TestOutputVisitorData *data, const void *user_data))
+{
+    g_test_add(testpath, TestOutputVisitorData, data, visitor_output_setup,
+               test_func, visitor_output_teardown);
+}
+
+int main(int argc, char **argv)
+{
+    TestOutputVisitorData out_visitor_data;
+
+    g_test_init(&argc, &argv, NULL);
+
+    output_visitor_test_add("/visitor/json/int",
+                            &out_visitor_data, test_visitor_out_int);
+    output_visitor_test_add("/visitor/json/number",
+                            &out_visitor_data, test_visitor_out_number);
+    output_visitor_test_add("/visitor/json/string",
+                            &out_visitor_data, test_visitor_out_string);
+    output_visitor_test_add("/visitor/json/struct",
+                            &out_visitor_data, test_visitor_out_struct);
+    output_visitor_test_add("/visitor/json/list",
+                            &out_visitor_data, test_visitor_out_list);
+    output_visitor_test_add("/visitor/json/empty-list",
+                            &out_visitor_data, test_visitor_out_empty_list);
+    output_visitor_test_add("/visitor/json/any",
+                            &out_visitor_data, test_visitor_out_any);
+    output_visitor_test_add("/visitor/json/embed",
+                            &out_visitor_data, test_visitor_out_embed);
+
+    g_test_run();
+
+    return 0;
+}
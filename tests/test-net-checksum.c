@@ -0,0 +1,110 @@
+/*
+ * Tests for the IP checksumming functions
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "net/checksum.h"
+
+#define BUF_SIZE (64 * 1024 + 64)
+
+/* The plain byte-at-a-time algorithm the optimized code must agree with */
+static uint16_t ref_checksum(const uint8_t *buf, int len)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        sum += i & 1 ? buf[i] : (uint32_t)buf[i] << 8;
+    }
+    return net_checksum_finish(sum);
+}
+
+static void fill(uint8_t *buf, size_t size, int pattern)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        buf[i] = pattern < 0 ? g_test_rand_int() : pattern;
+    }
+}
+
+static void test_checksum_add(void)
+{
+    static const int patterns[] = { 0, 0xff, -1 };
+    uint8_t *buf = g_malloc(BUF_SIZE);
+    int p, len, align;
+
+    for (p = 0; p < ARRAY_SIZE(patterns); p++) {
+        fill(buf, BUF_SIZE, patterns[p]);
+        for (align = 0; align < 16; align++) {
+            for (len = 0; len < 300; len++) {
+                g_assert_cmphex(net_raw_checksum(buf + align, len), ==,
+                                ref_checksum(buf + align, len));
+            }
+            for (len = 64 * 1024 - 3; len <= 64 * 1024; len++) {
+                g_assert_cmphex(net_raw_checksum(buf + align, len), ==,
+                                ref_checksum(buf + align, len));
+            }
+        }
+    }
+    g_free(buf);
+}
+
+static void test_checksum_combine(void)
+{
+    uint8_t *buf = g_malloc(BUF_SIZE);
+    int len, split;
+
+    fill(buf, BUF_SIZE, -1);
+    for (len = 1; len < 200; len++) {
+        for (split = 0; split <= len; split++) {
+            uint32_t sum = net_checksum_combine(
+                net_checksum_add(split, buf),
+                net_checksum_add(len - split, buf + split), split);
+
+            g_assert_cmphex(net_checksum_finish(sum), ==,
+                            ref_checksum(buf, len));
+        }
+    }
+    g_free(buf);
+}
+
+static void test_checksum_add_iov(void)
+{
+    uint8_t *buf = g_malloc(BUF_SIZE);
+    struct iovec iov[8];
+    int i, n, off, len;
+    size_t pos;
+
+    fill(buf, BUF_SIZE, -1);
+    for (n = 0; n < 200; n++) {
+        /* Split the first 8K into chunks of random, often odd, sizes */
+        pos = 0;
+        for (i = 0; i < ARRAY_SIZE(iov); i++) {
+            iov[i].iov_base = buf + pos;
+            iov[i].iov_len = g_test_rand_int_range(0, 1024);
+            pos += iov[i].iov_len;
+        }
+        off = g_test_rand_int_range(0, pos + 1);
+        len = g_test_rand_int_range(0, pos - off + 1);
+
+        g_assert_cmphex(net_checksum_finish(
+                            net_checksum_add_iov(iov, ARRAY_SIZE(iov),
+                                                 off, len, 0)), ==,
+                        ref_checksum(buf + off, len));
+    }
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/checksum/add", test_checksum_add);
+    g_test_add_func("/net/checksum/combine", test_checksum_combine);
+    g_test_add_func("/net/checksum/add_iov", test_checksum_add_iov);
+    return g_test_run();
+}
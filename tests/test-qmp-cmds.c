@@ -5,6 +5,7 @@
 #include "qapi/qmp/qstring.h"
 #include "qapi/error.h"
 #include "qemu/module.h"
+#include "qemu/coroutine.h"
 #include "qapi/qobject-input-visitor.h"
 #include "tests/test-qapi-types.h"
 #include "tests/test-qapi-visit.h"
@@ -36,6 +37,16 @@ void qmp_cmd_success_response(Error **errp)
 {
 }
 
+static bool coroutine_cmd_yielded;
+
+void qmp_coroutine_cmd(Error **errp)
+{
+    if (qemu_in_coroutine()) {
+        coroutine_cmd_yielded = true;
+        qemu_coroutine_yield();
+    }
+}
+
 Empty2 *qmp_user_def_cmd0(Error **errp)
 {
     return g_new0(Empty2, 1);
@@ -141,6 +152,65 @@ static void test_dispatch_cmd_oob(void)
     qobject_unref(req);
 }
 
+static void coroutine_fn dispatch_coroutine_cmd_co(void *opaque)
+{
+    QDict **resp = opaque;
+    QDict *req = qdict_new();
+
+    qdict_put_str(req, "execute", "coroutine-cmd");
+    g_assert(qmp_is_coroutine(&qmp_commands, req));
+    *resp = qmp_dispatch(&qmp_commands, QOBJECT(req), false);
+    qobject_unref(req);
+}
+
+/* test that coroutine commands can yield through qmp_dispatch() */
+static void test_dispatch_cmd_coroutine(void)
+{
+    Coroutine *co;
+    QDict *req = qdict_new();
+    QDict *resp;
+
+    /* Outside of coroutine context, the command runs to completion */
+    qdict_put_str(req, "execute", "coroutine-cmd");
+    resp = qmp_dispatch(&qmp_commands, QOBJECT(req), false);
+    assert(resp != NULL);
+    assert(!qdict_haskey(resp, "error"));
+    g_assert(!coroutine_cmd_yielded);
+    qobject_unref(resp);
+
+    qdict_put_str(req, "execute", "user_def_cmd");
+    g_assert(!qmp_is_coroutine(&qmp_commands, req));
+    qobject_unref(req);
+
+    resp = NULL;
+    co = qemu_coroutine_create(dispatch_coroutine_cmd_co, &resp);
+    qemu_coroutine_enter(co);
+    g_assert(coroutine_cmd_yielded);
+    g_assert(resp == NULL);
+
+    qemu_coroutine_enter(co);
+    assert(resp != NULL);
+    assert(!qdict_haskey(resp, "error"));
+    qobject_unref(resp);
+}
+
+/* test that dispatching a command accounts for its execution time */
+static void test_dispatch_cmd_stats(void)
+{
+    QDict *req = qdict_new();
+    QmpCommand *cmd = qmp_find_command(&qmp_commands, "user_def_cmd");
+    uint64_t calls = stat64_get(&cmd->calls);
+
+    qdict_put_str(req, "execute", "user_def_cmd");
+    qobject_unref(qmp_dispatch(&qmp_commands, QOBJECT(req), false));
+    qobject_unref(qmp_dispatch(&qmp_commands, QOBJECT(req), false));
+    qobject_unref(req);
+
+    g_assert_cmpuint(stat64_get(&cmd->calls), ==, calls + 2);
+    g_assert_cmpuint(stat64_get(&cmd->max_ns), <=,
+                     stat64_get(&cmd->total_ns));
+}
+
 /* test commands that return an error due to invalid parameters */
 static void test_dispatch_cmd_failure(void)
 {
@@ -318,6 +388,9 @@ int main(int argc, char **argv)
 
     g_test_add_func("/qmp/dispatch_cmd", test_dispatch_cmd);
     g_test_add_func("/qmp/dispatch_cmd_oob", test_dispatch_cmd_oob);
+    g_test_add_func("/qmp/dispatch_cmd_coroutine",
+                    test_dispatch_cmd_coroutine);
+    g_test_add_func("/qmp/dispatch_cmd_stats", test_dispatch_cmd_stats);
     g_test_add_func("/qmp/dispatch_cmd_failure", test_dispatch_cmd_failure);
     g_test_add_func("/qmp/dispatch_cmd_io", test_dispatch_cmd_io);
     g_test_add_func("/qmp/dispatch_cmd_success_response",
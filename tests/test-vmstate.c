@@ -31,6 +31,7 @@
 #include "../migration/qemu-file.h"
 #include "../migration/qemu-file-channel.h"
 #include "../migration/savevm.h"
+#include "../migration/qjson.h"
 #include "qemu/coroutine.h"
 #include "io/channel-file.h"
 
@@ -902,6 +903,133 @@ static void test_tmp_struct(void)
     g_assert_cmpint(obj.f, ==, 8); /* From the child->parent */
 }
 
+/* The same fields, compiled and interpreted */
+
+typedef struct TestCompiled {
+    bool     b;
+    uint8_t  u8;
+    uint16_t u16[3];
+    int32_t  i32;
+    uint64_t u64;
+    uint8_t  buf[3];
+    uint32_t u32_v2;
+} TestCompiled;
+
+TestCompiled obj_compiled = {
+    .b = true,
+    .u8 = 130,
+    .u16 = { 0x0102, 0x0304, 0x0506 },
+    .i32 = -70000,
+    .u64 = 12121212,
+    .buf = "abc",
+    .u32_v2 = 70000,
+};
+
+static VMStateField vmstate_compiled_fields[] = {
+    VMSTATE_BOOL(b, TestCompiled),
+    VMSTATE_UINT8(u8, TestCompiled),
+    VMSTATE_UINT16_ARRAY(u16, TestCompiled, 3),
+    VMSTATE_INT32(i32, TestCompiled),
+    VMSTATE_UINT64(u64, TestCompiled),
+    VMSTATE_BUFFER(buf, TestCompiled),
+    VMSTATE_UINT32_V(u32_v2, TestCompiled, 2),
+    VMSTATE_END_OF_LIST()
+};
+
+static const VMStateDescription vmstate_interpreted = {
+    .name = "test/compiled",
+    .version_id = 2,
+    .minimum_version_id = 1,
+    .fields = vmstate_compiled_fields,
+};
+
+static const VMStateDescription vmstate_compiled = {
+    .name = "test/compiled",
+    .version_id = 2,
+    .minimum_version_id = 1,
+    .fields = vmstate_compiled_fields,
+};
+
+uint8_t wire_compiled[] = {
+    /* b */      0x01,
+    /* u8 */     0x82,
+    /* u16 */    0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    /* i32 */    0xff, 0xfe, 0xee, 0x90,
+    /* u64 */    0x00, 0x00, 0x00, 0x00, 0x00, 0xb8, 0xf4, 0x7c,
+    /* buf */    0x61, 0x62, 0x63,
+    /* u32_v2 */ 0x00, 0x01, 0x11, 0x70,
+    QEMU_VM_EOF, /* just to ensure we won't get EOF reported prematurely */
+};
+
+static void obj_compiled_copy(void *target, void *source)
+{
+    memcpy(target, source, sizeof(TestCompiled));
+}
+
+static char *save_vmstate_vmdesc(const VMStateDescription *desc, void *obj)
+{
+    QEMUFile *f = open_test_file(true);
+    QJSON *vmdesc = qjson_new();
+    char *json;
+
+    SUCCESS(vmstate_save_state(f, desc, obj, vmdesc));
+    qemu_put_byte(f, QEMU_VM_EOF);
+    g_assert(!qemu_file_get_error(f));
+    qemu_fclose(f);
+
+    qjson_finish(vmdesc);
+    json = g_strdup(qjson_get_str(vmdesc));
+    qjson_destroy(vmdesc);
+    return json;
+}
+
+static void test_compiled_save(void)
+{
+    char *interpreted, *compiled;
+
+    vmstate_compile(&vmstate_compiled);
+
+    interpreted = save_vmstate_vmdesc(&vmstate_interpreted, &obj_compiled);
+    compare_vmstate(wire_compiled, sizeof(wire_compiled));
+    compiled = save_vmstate_vmdesc(&vmstate_compiled, &obj_compiled);
+    compare_vmstate(wire_compiled, sizeof(wire_compiled));
+
+    g_assert_cmpstr(compiled, ==, interpreted);
+    g_free(compiled);
+    g_free(interpreted);
+}
+
+static void test_compiled_load(void)
+{
+    TestCompiled obj, obj_clone;
+
+    vmstate_compile(&vmstate_compiled);
+
+    memset(&obj, 0, sizeof(obj));
+    SUCCESS(load_vmstate(&vmstate_compiled, &obj, &obj_clone,
+                         obj_compiled_copy, 2, wire_compiled,
+                         sizeof(wire_compiled)));
+    g_assert(!memcmp(&obj, &obj_compiled, sizeof(obj)));
+}
+
+static void test_compiled_load_v1(void)
+{
+    uint8_t wire[sizeof(wire_compiled) - 4];
+    TestCompiled obj, obj_clone;
+
+    vmstate_compile(&vmstate_compiled);
+
+    /* Older versions go through the interpreter, without u32_v2 */
+    memcpy(wire, wire_compiled, sizeof(wire) - 1);
+    wire[sizeof(wire) - 1] = QEMU_VM_EOF;
+    memset(&obj, 0, sizeof(obj));
+    SUCCESS(load_vmstate(&vmstate_compiled, &obj, &obj_clone,
+                         obj_compiled_copy, 1, wire, sizeof(wire)));
+    g_assert_cmpint(obj.u32_v2, ==, 0);
+    obj.u32_v2 = obj_compiled.u32_v2;
+    g_assert(!memcmp(&obj, &obj_compiled, sizeof(obj)));
+}
+
 int main(int argc, char **argv)
 {
     temp_fd = mkstemp(temp_file);
@@ -933,6 +1061,9 @@ int main(int argc, char **argv)
     g_test_add_func("/vmstate/qtailq/save/saveq", test_save_q);
     g_test_add_func("/vmstate/qtailq/load/loadq", test_load_q);
     g_test_add_func("/vmstate/tmp_struct", test_tmp_struct);
+    g_test_add_func("/vmstate/compiled/save", test_compiled_save);
+    g_test_add_func("/vmstate/compiled/load", test_compiled_load);
+    g_test_add_func("/vmstate/compiled/load/v1", test_compiled_load_v1);
     g_test_run();
 
     close(temp_fd);
@@ -13,7 +13,9 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
 #include "qemu/cutils.h"
+#include "qapi/error.h"
 #include "../migration/xbzrle.h"
+#include "../migration/page_cache.h"
 
 #define PAGE_SIZE 4096
 
@@ -174,6 +176,110 @@ static void test_encode_decode(void)
     }
 }
 
+static void test_page_cache(void)
+{
+    /* 2 sets of 8 pages */
+    PageCache *cache = cache_init(16 * PAGE_SIZE, PAGE_SIZE, &error_abort);
+    uint8_t *page = g_malloc0(PAGE_SIZE);
+    uint64_t hits, misses, evictions;
+    int i;
+
+    /* Pages that land in the same set don't evict each other */
+    for (i = 0; i < 8; i++) {
+        page[0] = i;
+        g_assert(!cache_is_cached(cache, i * 2 * PAGE_SIZE, 1));
+        g_assert_cmpint(cache_insert(cache, i * 2 * PAGE_SIZE, page, 1), ==, 0);
+    }
+    for (i = 0; i < 8; i++) {
+        g_assert(cache_is_cached(cache, i * 2 * PAGE_SIZE, i < 4 ? 2 : 1));
+        g_assert_cmpint(get_cached_data(cache, i * 2 * PAGE_SIZE)[0], ==, i);
+    }
+    g_assert(get_cached_data(cache, 16 * PAGE_SIZE) == NULL);
+
+    /* The set is full of fresh pages */
+    g_assert_cmpint(cache_insert(cache, 16 * PAGE_SIZE, page, 2), ==, -1);
+
+    /* Once they get old, the least recently used page goes first */
+    g_assert_cmpint(cache_insert(cache, 16 * PAGE_SIZE, page, 3), ==, 0);
+    g_assert(!cache_is_cached(cache, 8 * PAGE_SIZE, 3));
+    g_assert(cache_is_cached(cache, 0, 3));
+
+    cache_get_stats(cache, &hits, &misses, &evictions);
+    g_assert_cmpint(hits, ==, 9);
+    g_assert_cmpint(misses, ==, 9);
+    g_assert_cmpint(evictions, ==, 1);
+
+    g_free(page);
+    cache_fini(cache);
+}
+
+#define ACCEL_ROUNDS 256
+
+/* Fill a pair of pages to encode, and return the size to encode them to */
+static int encode_accel_page(uint8_t *old_buf, uint8_t *new_buf, GRand *rand)
+{
+    int i, j, pos, len;
+
+    for (i = 0; i < PAGE_SIZE; i++) {
+        old_buf[i] = g_rand_int(rand);
+    }
+    memcpy(new_buf, old_buf, PAGE_SIZE);
+
+    /* Runs of all lengths, that straddle vector boundaries */
+    for (i = g_rand_int_range(rand, 0, 64); i > 0; i--) {
+        pos = g_rand_int_range(rand, 0, PAGE_SIZE);
+        len = g_rand_int_range(rand, 1, 128);
+        for (j = pos; j < pos + len && j < PAGE_SIZE; j++) {
+            new_buf[j] = g_rand_int_range(rand, 0, 4) ? old_buf[j] + 1 : 0;
+        }
+    }
+
+    /* Half of the time with a destination small enough to overflow */
+    return g_rand_boolean(rand) ? PAGE_SIZE :
+                                  g_rand_int_range(rand, 0, PAGE_SIZE);
+}
+
+static void test_encode_accel(void)
+{
+    uint8_t *old_buf = g_malloc(PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *ref = g_malloc(ACCEL_ROUNDS * PAGE_SIZE);
+    int ref_len[ACCEL_ROUNDS];
+    uint32_t seed = g_test_rand_int();
+    GRand *rand;
+    int i, rc, dlen;
+
+    /* Record what the preferred implementation encodes */
+    rand = g_rand_new_with_seed(seed);
+    for (i = 0; i < ACCEL_ROUNDS; i++) {
+        dlen = encode_accel_page(old_buf, new_buf, rand);
+        ref_len[i] = xbzrle_encode_buffer(old_buf, new_buf, PAGE_SIZE,
+                                          ref + i * PAGE_SIZE, dlen);
+    }
+    g_rand_free(rand);
+
+    /* Every other implementation must produce the very same encoding */
+    while (test_xbzrle_encode_next_accel()) {
+        rand = g_rand_new_with_seed(seed);
+        for (i = 0; i < ACCEL_ROUNDS; i++) {
+            dlen = encode_accel_page(old_buf, new_buf, rand);
+            rc = xbzrle_encode_buffer(old_buf, new_buf, PAGE_SIZE,
+                                      compressed, dlen);
+            g_assert_cmpint(rc, ==, ref_len[i]);
+            if (rc > 0) {
+                g_assert(memcmp(compressed, ref + i * PAGE_SIZE, rc) == 0);
+            }
+        }
+        g_rand_free(rand);
+    }
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(compressed);
+    g_free(ref);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +292,9 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/page_cache", test_page_cache);
+    /* Last, as it leaves xbzrle_encode_buffer with the slowest encoder */
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
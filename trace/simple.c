@@ -29,9 +29,6 @@
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
-
 /*
  * Trace records are written out by a dedicated thread.  The thread waits for
  * records to become available, writes them out, and then waits again.
@@ -43,14 +40,34 @@ static GCond trace_empty_cond;
 static bool trace_available;
 static bool trace_writeout_enabled;
 
+/*
+ * Each thread puts its records in a ring buffer of its own, so that threads
+ * that trace do not contend with each other.  The owner thread is the only
+ * one that moves @head and the writeout thread the only one that moves
+ * @tail; the writeout thread is kicked once a buffer is a quarter full.
+ */
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    TRACE_BUF_LEN = 4096 * 16,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
+typedef struct TraceThreadBuf {
+    unsigned int head;
+    bool kicked;
+    uint8_t buf[TRACE_BUF_LEN];
+    unsigned int tail;
+    unsigned int snap_head;     /* head seen by the writeout thread */
+    bool exited;                /* freed by the writeout thread once empty */
+    struct TraceThreadBuf *next;
+} TraceThreadBuf;
+
+static void trace_thread_exit(gpointer opaque);
+
+static __thread TraceThreadBuf *trace_thread_buf;
+static GPrivate trace_thread_key = G_PRIVATE_INIT(trace_thread_exit);
+static GMutex trace_bufs_lock;
+static TraceThreadBuf *trace_bufs;
+
 static volatile gint dropped_events;
 static uint32_t trace_pid;
 static FILE *trace_fp;
@@ -75,53 +92,56 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_buffer(TraceThreadBuf *b, unsigned int idx,
+                             void *dataptr, size_t size)
+{
+    size_t first;
+
+    idx %= TRACE_BUF_LEN;
+    first = MIN(size, TRACE_BUF_LEN - idx);
+    memcpy(dataptr, &b->buf[idx], first);
+    memcpy((uint8_t *)dataptr + first, b->buf, size - first);
+}
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static unsigned int write_to_buffer(TraceThreadBuf *b, unsigned int idx,
+                                    void *dataptr, size_t size)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
-    }
+    size_t first;
+
+    idx %= TRACE_BUF_LEN;
+    first = MIN(size, TRACE_BUF_LEN - idx);
+    memcpy(&b->buf[idx], dataptr, first);
+    memcpy(b->buf, (uint8_t *)dataptr + first, size - first);
+    return idx + size; /* most callers wants to know where to write next */
 }
-/**
- * Read a trace record from the trace buffer
- *
- * @idx         Trace buffer index
- * @record      Trace record to fill
- *
- * Returns false if the record is not valid.
- */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+
+static TraceThreadBuf *get_thread_buf(void)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    TraceThreadBuf *b = trace_thread_buf;
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+    if (likely(b)) {
+        return b;
     }
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
+    /* don't use g_malloc, can deadlock when traced */
+    b = calloc(1, sizeof(*b));
+    if (!b) {
+        return NULL;
+    }
+    g_private_set(&trace_thread_key, b);
+    g_mutex_lock(&trace_bufs_lock);
+    b->next = trace_bufs;
+    trace_bufs = b;
+    g_mutex_unlock(&trace_bufs_lock);
+    trace_thread_buf = b;
+    return b;
+}
+
+static void trace_thread_exit(gpointer opaque)
+{
+    TraceThreadBuf *b = opaque;
+
+    atomic_set(&b->exited, true);
 }
 
 /**
@@ -153,14 +173,75 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
+static void write_record(TraceThreadBuf *b, unsigned int idx, uint32_t len)
+{
+    static const uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    size_t first = MIN(len, TRACE_BUF_LEN - idx % TRACE_BUF_LEN);
+    size_t unused __attribute__ ((unused));
+
+    unused = fwrite(&type, sizeof(type), 1, trace_fp);
+    unused = fwrite(&b->buf[idx % TRACE_BUF_LEN], first, 1, trace_fp);
+    if (first < len) {
+        unused = fwrite(b->buf, len - first, 1, trace_fp);
+    }
+}
+
+/*
+ * Write out what the threads recorded so far, merged in timestamp order.
+ * Context: writeout thread, trace_bufs_lock held
+ */
+static void writeout_buffers(void)
+{
+    TraceThreadBuf *b, **pb;
+
+    for (b = trace_bufs; b; b = b->next) {
+        b->snap_head = atomic_read(&b->head);
+    }
+    smp_rmb(); /* read the records only after their head */
+
+    for (;;) {
+        TraceThreadBuf *first = NULL;
+        uint64_t first_ts = 0;
+        TraceRecord record;
+
+        for (b = trace_bufs; b; b = b->next) {
+            if (b->tail == b->snap_head) {
+                continue;
+            }
+            read_from_buffer(b, b->tail, &record, sizeof(record));
+            if (!first || record.timestamp_ns < first_ts) {
+                first = b;
+                first_ts = record.timestamp_ns;
+            }
+        }
+        if (!first) {
+            break;
+        }
+        read_from_buffer(first, first->tail, &record, sizeof(record));
+        write_record(first, first->tail, record.length);
+        first->tail += record.length;
+    }
+
+    smp_mb(); /* done with the records before they can be overwritten */
+    pb = &trace_bufs;
+    while ((b = *pb)) {
+        atomic_set(&b->tail, b->tail);
+        atomic_set(&b->kicked, false);
+        if (atomic_read(&b->exited) && b->tail == atomic_read(&b->head)) {
+            *pb = b->next;
+            free(b);
+        } else {
+            pb = &b->next;
+        }
+    }
+}
+
 static gpointer writeout_thread(gpointer opaque)
 {
-    TraceRecord *recordptr;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
     int dropped_count;
     size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
@@ -182,13 +263,9 @@ static gpointer writeout_thread(gpointer opaque)
             unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
-        }
+        g_mutex_lock(&trace_bufs_lock);
+        writeout_buffers();
+        g_mutex_unlock(&trace_bufs_lock);
 
         fflush(trace_fp);
     }
@@ -197,84 +274,57 @@ static gpointer writeout_thread(gpointer opaque)
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off,
+                                   &val, sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off,
+                                   &slen, sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, (void *)s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuf *b = get_thread_buf();
+    unsigned int rec_off;
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
     uint64_t event_u64 = event;
     uint64_t timestamp_ns = get_clock();
 
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
-        }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
-
-    idx = old_idx % TRACE_BUF_LEN;
+    if (!b || b->head + rec_len - atomic_read(&b->tail) > TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        g_atomic_int_inc(&dropped_events);
+        return -ENOSPC;
+    }
 
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    rec_off = b->head;
+    rec_off = write_to_buffer(b, rec_off, &event_u64, sizeof(event_u64));
+    rec_off = write_to_buffer(b, rec_off, &timestamp_ns, sizeof(timestamp_ns));
+    rec_off = write_to_buffer(b, rec_off, &rec_len, sizeof(rec_len));
+    rec_off = write_to_buffer(b, rec_off, &trace_pid, sizeof(trace_pid));
 
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
+    rec->tbuf = b;
+    rec->tbuf_idx = b->head;
+    rec->rec_off = rec_off;
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
-    }
-}
-
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
-    }
-    return idx; /* most callers wants to know where to write next */
-}
-
 void trace_record_finish(TraceBufferRecord *rec)
 {
+    TraceThreadBuf *b = rec->tbuf;
     TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+    read_from_buffer(b, rec->tbuf_idx, &record, sizeof(TraceRecord));
+    smp_wmb(); /* write barrier before publishing the record */
+    atomic_set(&b->head, rec->tbuf_idx + record.length);
+
+    if (!atomic_read(&b->kicked) &&
+        b->head - atomic_read(&b->tail) > TRACE_BUF_FLUSH_THRESHOLD) {
+        atomic_set(&b->kicked, true);
         flush_trace_file(false);
     }
 }
@@ -171,9 +171,9 @@ struct QemuConsole {
 
 struct DisplayState {
     QEMUTimer *gui_timer;
-    uint64_t last_update;
     uint64_t update_interval;
     bool refreshing;
+    bool idle;
     bool have_gfx;
     bool have_text;
 
@@ -188,30 +188,74 @@ static bool cursor_visible_phase;
 static QEMUTimer *cursor_timer;
 
 static void text_console_do_init(Chardev *chr, DisplayState *ds);
-static void dpy_refresh(DisplayState *s);
+static void dpy_refresh(DisplayState *s, uint64_t now);
 static DisplayState *get_alloc_displaystate(void);
 static void text_console_update_cursor_timer(void);
 static void text_console_update_cursor(void *opaque);
 
+static uint64_t dcl_update_interval(DisplayChangeListener *dcl)
+{
+    return dcl->update_interval ?
+        dcl->update_interval : GUI_REFRESH_INTERVAL_DEFAULT;
+}
+
+static void gui_set_idle(DisplayState *ds, bool idle)
+{
+    QemuConsole *con;
+
+    if (ds->idle == idle) {
+        return;
+    }
+    ds->idle = idle;
+    QTAILQ_FOREACH(con, &consoles, next) {
+        if (con->hw_ops->display_idle) {
+            con->hw_ops->display_idle(con->hw, idle);
+        }
+    }
+    trace_console_idle(idle);
+}
+
+/*
+ * Each listener is refreshed at its own rate, and the timer only fires
+ * when the next of them is due.  Once no listener wants updates at all
+ * the timer is left alone and the devices are told the display is idle,
+ * until update_displaychangelistener() asks for a refresh again.
+ */
 static void gui_update(void *opaque)
 {
     uint64_t interval = GUI_REFRESH_INTERVAL_IDLE;
+    uint64_t next = GUI_REFRESH_INTERVAL_NONE;
+    uint64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     uint64_t dcl_interval;
     DisplayState *ds = opaque;
     DisplayChangeListener *dcl;
     QemuConsole *con;
 
     ds->refreshing = true;
-    dpy_refresh(ds);
+    dpy_refresh(ds, now);
     ds->refreshing = false;
 
     QLIST_FOREACH(dcl, &ds->listeners, next) {
-        dcl_interval = dcl->update_interval ?
-            dcl->update_interval : GUI_REFRESH_INTERVAL_DEFAULT;
+        if (!dcl->ops->dpy_refresh) {
+            continue;
+        }
+        dcl_interval = dcl_update_interval(dcl);
+        if (dcl_interval == GUI_REFRESH_INTERVAL_NONE) {
+            continue;
+        }
         if (interval > dcl_interval) {
             interval = dcl_interval;
         }
+        if (next > dcl->last_update + dcl_interval) {
+            next = dcl->last_update + dcl_interval;
+        }
+    }
+
+    gui_set_idle(ds, next == GUI_REFRESH_INTERVAL_NONE);
+    if (ds->idle) {
+        return;
     }
+
     if (ds->update_interval != interval) {
         ds->update_interval = interval;
         QTAILQ_FOREACH(con, &consoles, next) {
@@ -221,8 +265,7 @@ static void gui_update(void *opaque)
         }
         trace_console_refresh(interval);
     }
-    ds->last_update = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
-    timer_mod(ds->gui_timer, ds->last_update + interval);
+    timer_mod(ds->gui_timer, next);
 }
 
 static void gui_setup_refresh(DisplayState *ds)
@@ -246,12 +289,17 @@ static void gui_setup_refresh(DisplayState *ds)
 
     if (need_timer && ds->gui_timer == NULL) {
         ds->gui_timer = timer_new_ms(QEMU_CLOCK_REALTIME, gui_update, ds);
-        timer_mod(ds->gui_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+    }
+    if (need_timer) {
+        /* new listeners may want updates even if the display was idle */
+        timer_mod_anticipate(ds->gui_timer,
+                             qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
     }
     if (!need_timer && ds->gui_timer != NULL) {
         timer_del(ds->gui_timer);
         timer_free(ds->gui_timer);
         ds->gui_timer = NULL;
+        gui_set_idle(ds, true);
     }
 
     ds->have_gfx = have_gfx;
@@ -1475,8 +1523,10 @@ void update_displaychangelistener(DisplayChangeListener *dcl,
     DisplayState *ds = dcl->ds;
 
     dcl->update_interval = interval;
-    if (!ds->refreshing && ds->update_interval > interval) {
-        timer_mod(ds->gui_timer, ds->last_update + interval);
+    if (!ds->refreshing && ds->gui_timer &&
+        interval != GUI_REFRESH_INTERVAL_NONE) {
+        timer_mod_anticipate(ds->gui_timer,
+                             dcl->last_update + dcl_update_interval(dcl));
     }
 }
 
@@ -1613,14 +1663,22 @@ bool dpy_gfx_check_format(QemuConsole *con,
     return true;
 }
 
-static void dpy_refresh(DisplayState *s)
+static void dpy_refresh(DisplayState *s, uint64_t now)
 {
     DisplayChangeListener *dcl;
+    uint64_t interval;
 
     QLIST_FOREACH(dcl, &s->listeners, next) {
-        if (dcl->ops->dpy_refresh) {
-            dcl->ops->dpy_refresh(dcl);
+        if (!dcl->ops->dpy_refresh) {
+            continue;
         }
+        interval = dcl_update_interval(dcl);
+        if (interval == GUI_REFRESH_INTERVAL_NONE ||
+            now < dcl->last_update + interval) {
+            continue;
+        }
+        dcl->last_update = now;
+        dcl->ops->dpy_refresh(dcl);
     }
 }
 
@@ -1900,6 +1958,9 @@ QemuConsole *graphic_console_init(DeviceState *dev, uint32_t head,
                                    dpy_set_ui_info_timer, s);
     }
     graphic_console_set_hwops(s, hw_ops, opaque);
+    if (ds->idle && hw_ops->display_idle) {
+        hw_ops->display_idle(opaque, true);
+    }
     if (dev) {
         object_property_set_link(OBJECT(s), OBJECT(dev), "device",
                                  &error_abort);
@@ -22,6 +22,7 @@
 #include "qemu/queue.h"
 #include "ui/console.h"
 #include "sysemu/sysemu.h"
+#include "qemu/crc32c.h"
 #include "trace.h"
 
 #include "ui/spice-display.h"
@@ -115,6 +116,45 @@ void qemu_spice_wakeup(SimpleSpiceDisplay *ssd)
     spice_qxl_wakeup(&ssd->qxl);
 }
 
+/*
+ * Give @image the id of an identical bitmap sent before, or a new one.
+ * The pixels are compared in full, so a crc collision only costs a miss.
+ */
+static void qemu_spice_set_image_id(SimpleSpiceDisplay *ssd, QXLImage *image,
+                                    uint8_t *data, int width, int height)
+{
+    size_t size = width * height * 4;
+    SimpleSpiceCachedImage *entry;
+    uint32_t crc;
+
+    if (size > SPICE_IMAGE_CACHE_MAX_SIZE) {
+        QXL_SET_IMAGE_ID(image, QXL_IMAGE_GROUP_DEVICE, ssd->unique++);
+        return;
+    }
+
+    crc = crc32c(0xffffffff, data, size);
+    entry = &ssd->image_cache[crc % SPICE_IMAGE_CACHE_SLOTS];
+    if (entry->data && entry->crc == crc &&
+        entry->width == width && entry->height == height &&
+        memcmp(entry->data, data, size) == 0) {
+        ssd->image_cache_hits++;
+        image->descriptor.id = entry->id;
+    } else {
+        ssd->image_cache_misses++;
+        QXL_SET_IMAGE_ID(image, QXL_IMAGE_GROUP_DEVICE, ssd->unique++);
+        g_free(entry->data);
+        entry->data = g_memdup(data, size);
+        entry->id = image->descriptor.id;
+        entry->crc = crc;
+        entry->width = width;
+        entry->height = height;
+    }
+    image->descriptor.flags = QXL_IMAGE_CACHE;
+    trace_qemu_spice_image_cache(ssd->qxl.id, width, height,
+                                 ssd->image_cache_hits,
+                                 ssd->image_cache_misses);
+}
+
 static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
                                          QXLRect *rect)
 {
@@ -157,7 +197,6 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
     drawable->u.copy.src_area.right  = bw;
     drawable->u.copy.src_area.bottom = bh;
 
-    QXL_SET_IMAGE_ID(image, QXL_IMAGE_GROUP_DEVICE, ssd->unique++);
     image->descriptor.type   = SPICE_IMAGE_TYPE_BITMAP;
     image->bitmap.flags      = QXL_BITMAP_DIRECT | QXL_BITMAP_TOP_DOWN;
     image->bitmap.stride     = bw * 4;
@@ -176,6 +215,7 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
                            rect->left, rect->top, 0, 0,
                            0, 0, bw, bh);
     pixman_image_unref(dest);
+    qemu_spice_set_image_id(ssd, image, update->bitmap, bw, bh);
 
     cmd->type = QXL_CMD_DRAW;
     cmd->data = (uintptr_t)drawable;
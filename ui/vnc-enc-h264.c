@@ -0,0 +1,263 @@
+/*
+ * QEMU VNC display driver: Open H.264 encoding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "vnc.h"
+#include "trace.h"
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+/*
+ * Each rectangle carries a U32 length and U32 flags, followed by H.264 NAL
+ * units in byte-stream format.  The client keeps one decoder context per
+ * rectangle geometry; we only ever use the full screen.
+ */
+#define VNC_H264_FLAG_RESET_CONTEXT       (1 << 0)
+#define VNC_H264_FLAG_RESET_ALL_CONTEXTS  (1 << 1)
+
+/* Frames pushed without getting any output before giving up on an encoder */
+#define VNC_H264_MAX_PENDING 8
+
+/* How long to wait for the encoder to produce a frame */
+#define VNC_H264_TIMEOUT (GST_SECOND / 10)
+
+/*
+ * Encoders in order of preference: VA-API and NVENC run on the host GPU if
+ * there is one, x264 and OpenH264 on its CPUs.  An encoder that cannot be
+ * created or that produces nothing is skipped for the rest of the session.
+ */
+static const char *const vnc_h264_encoders[] = {
+    "vaapih264enc rate-control=cbr",
+    "nvh264enc preset=low-latency-hq",
+    "x264enc tune=zerolatency speed-preset=ultrafast",
+    "openh264enc complexity=low",
+};
+
+struct VncH264 {
+    GstElement *pipeline;
+    GstElement *source;
+    GstElement *sink;
+    unsigned int encoder;   /* Index in vnc_h264_encoders */
+    int width;
+    int height;
+    unsigned int pending;   /* Frames without output since the last one */
+    bool reset;             /* The client must start a new context */
+    Buffer data;
+};
+
+static void vnc_h264_stop(VncH264 *h264)
+{
+    if (!h264->pipeline) {
+        return;
+    }
+    gst_element_set_state(h264->pipeline, GST_STATE_NULL);
+    gst_object_unref(h264->source);
+    gst_object_unref(h264->sink);
+    gst_object_unref(h264->pipeline);
+    h264->pipeline = NULL;
+    h264->source = NULL;
+    h264->sink = NULL;
+}
+
+static bool vnc_h264_start(VncH264 *h264, int width, int height)
+{
+    GError *err = NULL;
+
+    if (!gst_init_check(NULL, NULL, &err)) {
+        g_clear_error(&err);
+        h264->encoder = ARRAY_SIZE(vnc_h264_encoders);
+        return false;
+    }
+
+    for (; h264->encoder < ARRAY_SIZE(vnc_h264_encoders); h264->encoder++) {
+        GstCaps *caps;
+        char *desc;
+
+        desc = g_strdup_printf("appsrc name=src is-live=true format=time "
+                               "do-timestamp=true ! videoconvert ! %s ! "
+                               "video/x-h264,stream-format=byte-stream,"
+                               "alignment=au ! appsink name=sink sync=false",
+                               vnc_h264_encoders[h264->encoder]);
+        h264->pipeline = gst_parse_launch(desc, &err);
+        g_free(desc);
+        if (err) {
+            trace_vnc_h264_encoder_failed(vnc_h264_encoders[h264->encoder],
+                                          err->message);
+            g_clear_error(&err);
+            if (h264->pipeline) {
+                gst_object_unref(h264->pipeline);
+                h264->pipeline = NULL;
+            }
+            continue;
+        }
+
+        h264->source = gst_bin_get_by_name(GST_BIN(h264->pipeline), "src");
+        h264->sink = gst_bin_get_by_name(GST_BIN(h264->pipeline), "sink");
+        caps = gst_caps_new_simple("video/x-raw",
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+                                   "format", G_TYPE_STRING, "BGRx",
+#else
+                                   "format", G_TYPE_STRING, "xRGB",
+#endif
+                                   "width", G_TYPE_INT, width,
+                                   "height", G_TYPE_INT, height,
+                                   "framerate", GST_TYPE_FRACTION, 30, 1,
+                                   NULL);
+        gst_app_src_set_caps(GST_APP_SRC(h264->source), caps);
+        gst_caps_unref(caps);
+
+        if (gst_element_set_state(h264->pipeline, GST_STATE_PLAYING) ==
+            GST_STATE_CHANGE_FAILURE) {
+            trace_vnc_h264_encoder_failed(vnc_h264_encoders[h264->encoder],
+                                          "cannot start pipeline");
+            vnc_h264_stop(h264);
+            continue;
+        }
+
+        trace_vnc_h264_encoder_start(vnc_h264_encoders[h264->encoder],
+                                     width, height);
+        h264->width = width;
+        h264->height = height;
+        h264->pending = 0;
+        h264->reset = true;
+        return true;
+    }
+    return false;
+}
+
+static bool vnc_h264_push_frame(VncState *vs, VncH264 *h264,
+                                int x, int y, int w, int h)
+{
+    size_t linesize = w * VNC_SERVER_FB_BYTES;
+    GstBuffer *buf = gst_buffer_new_allocate(NULL, linesize * h, NULL);
+    GstMapInfo map;
+    int i;
+
+    if (!gst_buffer_map(buf, &map, GST_MAP_WRITE)) {
+        gst_buffer_unref(buf);
+        return false;
+    }
+    for (i = 0; i < h; i++) {
+        memcpy(map.data + i * linesize, vnc_server_fb_ptr(vs->vd, x, y + i),
+               linesize);
+    }
+    gst_buffer_unmap(buf, &map);
+
+    /* Takes ownership of buf */
+    return gst_app_src_push_buffer(GST_APP_SRC(h264->source), buf) ==
+           GST_FLOW_OK;
+}
+
+/* Collect whatever the encoder has produced, waiting a bit for the first */
+static void vnc_h264_pull_frames(VncH264 *h264)
+{
+    GstClockTime timeout = VNC_H264_TIMEOUT;
+    GstSample *sample;
+
+    buffer_reset(&h264->data);
+    while ((sample = gst_app_sink_try_pull_sample(GST_APP_SINK(h264->sink),
+                                                  timeout))) {
+        GstBuffer *buf = gst_sample_get_buffer(sample);
+        GstMapInfo map;
+
+        if (buf && gst_buffer_map(buf, &map, GST_MAP_READ)) {
+            buffer_reserve(&h264->data, map.size);
+            buffer_append(&h264->data, map.data, map.size);
+            gst_buffer_unmap(buf, &map);
+        }
+        gst_sample_unref(sample);
+        timeout = 0;
+    }
+}
+
+int vnc_h264_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
+{
+    VncH264 *h264 = vs->h264;
+    uint32_t flags = 0;
+
+    if (!h264) {
+        h264 = vs->h264 = g_new0(VncH264, 1);
+        buffer_init(&h264->data, "vnc-h264/%p", vs);
+    }
+
+    if (h264->pipeline && (h264->width != w || h264->height != h)) {
+        vnc_h264_stop(h264);
+    }
+    if (!h264->pipeline && !vnc_h264_start(h264, w, h)) {
+        /* No usable encoder, send the update normally */
+        return vnc_send_framebuffer_update(vs, x, y, w, h);
+    }
+
+    if (!vnc_h264_push_frame(vs, h264, x, y, w, h)) {
+        vnc_h264_stop(h264);
+        return vnc_send_framebuffer_update(vs, x, y, w, h);
+    }
+
+    vnc_h264_pull_frames(h264);
+    if (!h264->data.offset) {
+        if (++h264->pending > VNC_H264_MAX_PENDING) {
+            trace_vnc_h264_encoder_failed(vnc_h264_encoders[h264->encoder],
+                                          "no output");
+            vnc_h264_stop(h264);
+            h264->encoder++;
+            return vnc_send_framebuffer_update(vs, x, y, w, h);
+        }
+        /* The frame is still in the encoder, a later update carries it */
+        return 0;
+    }
+    h264->pending = 0;
+
+    if (h264->reset) {
+        flags |= VNC_H264_FLAG_RESET_ALL_CONTEXTS;
+        h264->reset = false;
+    }
+
+    vnc_framebuffer_update(vs, x, y, w, h, VNC_ENCODING_OPEN_H264);
+    vnc_write_u32(vs, h264->data.offset);
+    vnc_write_u32(vs, flags);
+    vnc_write(vs, h264->data.buffer, h264->data.offset);
+    return 1;
+}
+
+/* Called by the main thread while a worker may be encoding for @vs */
+bool vnc_h264_usable(VncState *vs)
+{
+    VncH264 *h264 = atomic_read(&vs->h264);
+
+    return !h264 ||
+           atomic_read(&h264->encoder) < ARRAY_SIZE(vnc_h264_encoders);
+}
+
+void vnc_h264_clear(VncState *vs)
+{
+    VncH264 *h264 = vs->h264;
+
+    if (!h264) {
+        return;
+    }
+    vnc_h264_stop(h264);
+    buffer_free(&h264->data);
+    g_free(h264);
+    vs->h264 = NULL;
+}
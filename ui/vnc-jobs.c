@@ -44,28 +44,32 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
- * its own output buffer.
+ * While a VNC worker thread is working, it holds the VncDisplay global lock
+ * in shared mode to avoid screen corruption (this does not block
+ * vnc_refresh() because it uses trylock()) but the output lock is not held
+ * because the thread works on its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * Several worker threads can take jobs from the queue.  Each client's
+ * encoders keep compression state (e.g. the zlib streams of tight and zrle)
+ * that its viewer mirrors, so the jobs of one client are encoded one at a
+ * time and in order: a worker skips the jobs of clients for which another
+ * worker is busy (VncState::job_running).  The workers scale with the
+ * number of clients, not with the size of one client's update.
  */
 
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
+    unsigned int nr_threads;
     bool exit;
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
 typedef struct VncJobQueue VncJobQueue;
 
-/*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
- */
+/* We use a single global queue, shared by all encoding threads */
 static VncJobQueue *queue;
 
 static void vnc_lock_queue(VncJobQueue *queue)
@@ -189,6 +193,7 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
     local->zlib = orig->zlib;
     local->hextile = orig->hextile;
     local->zrle = orig->zrle;
+    local->h264 = orig->h264;
 }
 
 static void vnc_async_encoding_end(VncState *orig, VncState *local)
@@ -198,9 +203,35 @@ static void vnc_async_encoding_end(VncState *orig, VncState *local)
     orig->zlib = local->zlib;
     orig->hextile = local->hextile;
     orig->zrle = local->zrle;
+    orig->h264 = local->h264;
     orig->lossy_rect = local->lossy_rect;
 }
 
+static int vnc_job_send_rect(VncJob *job, VncState *vs, VncRect *rect)
+{
+#ifdef CONFIG_VNC_H264
+    if (job->h264) {
+        return vnc_h264_send_framebuffer_update(vs, rect->x, rect->y,
+                                                rect->w, rect->h);
+    }
+#endif
+    return vnc_send_framebuffer_update(vs, rect->x, rect->y,
+                                       rect->w, rect->h);
+}
+
+/* The oldest job of a client that no other worker is encoding for */
+static VncJob *vnc_next_job_locked(VncJobQueue *queue)
+{
+    VncJob *job;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (!job->vs->job_running) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
 static int vnc_worker_thread_loop(VncJobQueue *queue)
 {
     VncJob *job;
@@ -210,17 +241,16 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     int saved_offset;
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    while (!queue->exit && !(job = vnc_next_job_locked(queue))) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
-    vnc_unlock_queue(queue);
-    assert(job->vs->magic == VNC_MAGIC);
-
     if (queue->exit) {
+        vnc_unlock_queue(queue);
         return -1;
     }
+    job->vs->job_running = true;
+    vnc_unlock_queue(queue);
+    assert(job->vs->magic == VNC_MAGIC);
 
     vnc_lock_output(job->vs);
     if (job->vs->ioc == NULL || job->vs->abort == true) {
@@ -248,26 +278,25 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
-    vnc_lock_display(job->vs->vd);
+    vnc_lock_display_shared(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->ioc == NULL) {
-            vnc_unlock_display(job->vs->vd);
+            vnc_unlock_display_shared(job->vs->vd);
             /* Copy persistent encoding data */
             vnc_async_encoding_end(job->vs, &vs);
             goto disconnected;
         }
 
-        n = vnc_send_framebuffer_update(&vs, entry->rect.x, entry->rect.y,
-                                        entry->rect.w, entry->rect.h);
+        n = vnc_job_send_rect(job, &vs, &entry->rect);
 
         if (n >= 0) {
             n_rectangles += n;
         }
         g_free(entry);
     }
-    vnc_unlock_display(job->vs->vd);
+    vnc_unlock_display_shared(job->vs->vd);
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
@@ -289,6 +318,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
 
 disconnected:
     vnc_lock_queue(queue);
+    job->vs->job_running = false;
     QTAILQ_REMOVE(&queue->jobs, job, next);
     vnc_unlock_queue(queue);
     qemu_cond_broadcast(&queue->cond);
@@ -318,28 +348,36 @@ static void vnc_queue_clear(VncJobQueue *q)
 static void *vnc_worker_thread(void *arg)
 {
     VncJobQueue *queue = arg;
-
-    qemu_thread_get_self(&queue->thread);
+    bool last;
 
     while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+
+    vnc_lock_queue(queue);
+    last = --queue->nr_threads == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
-static bool vnc_worker_thread_running(void)
+/* Start encoding threads until there are at least @n of them */
+void vnc_start_worker_threads(unsigned int n)
 {
-    return queue; /* Check global queue */
-}
+    QemuThread thread;
 
-void vnc_start_worker_thread(void)
-{
-    VncJobQueue *q;
+    if (!queue) {
+        queue = vnc_queue_init(); /* Set global queue */
+    }
 
-    if (vnc_worker_thread_running())
-        return ;
+    vnc_lock_queue(queue);
+    while (queue->nr_threads < n) {
+        char name[16];
 
-    q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
-    queue = q; /* Set global queue */
+        snprintf(name, sizeof(name), "vnc_worker/%u", queue->nr_threads);
+        qemu_thread_create(&thread, queue->nr_threads ? name : "vnc_worker",
+                           vnc_worker_thread, queue, QEMU_THREAD_DETACHED);
+        queue->nr_threads++;
+    }
+    vnc_unlock_queue(queue);
 }
@@ -37,24 +37,47 @@ void vnc_job_push(VncJob *job);
 void vnc_jobs_join(VncState *vs);
 
 void vnc_jobs_consume_buffer(VncState *vs);
-void vnc_start_worker_thread(void);
+void vnc_start_worker_threads(unsigned int n);
 
-/* Locks */
+#define VNC_MAX_WORKERS 64
+
+/*
+ * Locks
+ *
+ * Any number of workers can encode from the server surface at the same
+ * time, each for a different client, while vnc_refresh() updates it alone.
+ * vnc_refresh() never waits for the workers: it only tries to take the
+ * display for itself and retries later when it fails.
+ */
 static inline int vnc_trylock_display(VncDisplay *vd)
 {
-    return qemu_mutex_trylock(&vd->mutex);
+    if (qemu_mutex_trylock(&vd->mutex)) {
+        return -EBUSY;
+    }
+    if (atomic_read(&vd->encoders)) {
+        qemu_mutex_unlock(&vd->mutex);
+        return -EBUSY;
+    }
+    return 0;
 }
 
-static inline void vnc_lock_display(VncDisplay *vd)
+static inline void vnc_unlock_display(VncDisplay *vd)
 {
-    qemu_mutex_lock(&vd->mutex);
+    qemu_mutex_unlock(&vd->mutex);
 }
 
-static inline void vnc_unlock_display(VncDisplay *vd)
+static inline void vnc_lock_display_shared(VncDisplay *vd)
 {
+    qemu_mutex_lock(&vd->mutex);
+    atomic_inc(&vd->encoders);
     qemu_mutex_unlock(&vd->mutex);
 }
 
+static inline void vnc_unlock_display_shared(VncDisplay *vd)
+{
+    atomic_dec(&vd->encoders);
+}
+
 static inline void vnc_lock_output(VncState *vs)
 {
     qemu_mutex_lock(&vs->output_mutex);
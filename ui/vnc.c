@@ -45,6 +45,7 @@
 #include "crypto/tlscredsx509.h"
 #include "qom/object_interfaces.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "io/dns-resolver.h"
 
 #define VNC_REFRESH_INTERVAL_BASE GUI_REFRESH_INTERVAL_DEFAULT
@@ -603,6 +604,7 @@ static void framebuffer_update_request(VncState *vs, int incremental,
                                        int w, int h);
 static void vnc_refresh(DisplayChangeListener *dcl);
 static int vnc_refresh_server_surface(VncDisplay *vd);
+static VncRectStat *vnc_stat_rect(VncDisplay *vd, int x, int y);
 
 static int vnc_width(VncDisplay *vd)
 {
@@ -1087,6 +1089,63 @@ static bool vnc_should_update(VncState *vs)
     return false;
 }
 
+/*
+ * While at least 1/VNC_H264_AREA_DIV of the screen changes faster than
+ * VNC_H264_FREQ_MIN, clients that support it get the whole screen as a
+ * single H.264 stream instead of separate rectangles.
+ */
+#define VNC_H264_FREQ_MIN 10.
+#define VNC_H264_AREA_DIV 32
+
+static bool vnc_h264_motion(VncDisplay *vd, int width, int height)
+{
+    int x, y, area = 0;
+
+    if (vd->non_adaptive) {
+        return true;
+    }
+    for (y = 0; y < height; y += VNC_STAT_RECT) {
+        for (x = 0; x < width; x += VNC_STAT_RECT) {
+            if (vnc_stat_rect(vd, x, y)->freq >= VNC_H264_FREQ_MIN) {
+                area += VNC_STAT_RECT * VNC_STAT_RECT;
+            }
+        }
+    }
+    return area * VNC_H264_AREA_DIV >= width * height;
+}
+
+/*
+ * Switch @vs between the H.264 stream and its normal encoding, and queue a
+ * frame of the stream in @job if anything is dirty.  The dirty map is
+ * consumed in that case.  Returns the number of rectangles added.
+ */
+static int vnc_h264_update(VncState *vs, VncJob *job, int width, int height)
+{
+    VncDisplay *vd = vs->vd;
+    unsigned long bits = height * VNC_DIRTY_BPL(vs);
+
+    if (!vd->h264 || !vnc_has_feature(vs, VNC_FEATURE_H264)) {
+        return 0;
+    }
+
+    if (!vnc_h264_usable(vs) || !vnc_h264_motion(vd, width, height)) {
+        if (vs->h264_active) {
+            /* Replace the last lossy frame with a lossless update */
+            vnc_set_area_dirty(vs->dirty, vd, 0, 0, width, height);
+            vs->h264_active = false;
+        }
+        return 0;
+    }
+
+    vs->h264_active = true;
+    if (find_next_bit((unsigned long *) &vs->dirty, bits, 0) == bits) {
+        return 0;
+    }
+    bitmap_zero((unsigned long *) &vs->dirty, bits);
+    job->h264 = true;
+    return vnc_job_add_rect(job, 0, 0, width, height);
+}
+
 static int vnc_update_client(VncState *vs, int has_dirty)
 {
     VncDisplay *vd = vs->vd;
@@ -1120,6 +1179,9 @@ static int vnc_update_client(VncState *vs, int has_dirty)
     height = pixman_image_get_height(vd->server);
     width = pixman_image_get_width(vd->server);
 
+    /* Leaves nothing dirty for the loop below if it took the update */
+    n = vnc_h264_update(vs, job, width, height);
+
     y = 0;
     for (;;) {
         int x, h;
@@ -1268,6 +1330,9 @@ void vnc_disconnect_finish(VncState *vs)
     vnc_zlib_clear(vs);
     vnc_tight_clear(vs);
     vnc_zrle_clear(vs);
+#ifdef CONFIG_VNC_H264
+    vnc_h264_clear(vs);
+#endif
 
 #ifdef CONFIG_VNC_SASL
     vnc_sasl_client_cleanup(vs);
@@ -2097,6 +2162,12 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
             vs->features |= VNC_FEATURE_ZYWRLE_MASK;
             vs->vnc_encoding = enc;
             break;
+#ifdef CONFIG_VNC_H264
+        case VNC_ENCODING_OPEN_H264:
+            /* Only used while the screen shows motion, see vnc_h264_update */
+            vs->features |= VNC_FEATURE_H264_MASK;
+            break;
+#endif
         case VNC_ENCODING_DESKTOPRESIZE:
             vs->features |= VNC_FEATURE_RESIZE_MASK;
             break;
@@ -2902,6 +2973,7 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     int height = MIN(pixman_image_get_height(vd->guest.fb),
                      pixman_image_get_height(vd->server));
     int cmp_bytes, server_stride, line_bytes, guest_ll, guest_stride, y = 0;
+    int nr_bits;
     uint8_t *guest_row0 = NULL, *server_row0;
     VncState *vs;
     int has_dirty = 0;
@@ -2936,10 +3008,13 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
                    * DIV_ROUND_UP(guest_bpp, 8);
     }
     line_bytes = MIN(server_stride, guest_ll);
+    nr_bits = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
 
     for (;;) {
-        int x;
+        DECLARE_BITMAP(changed, VNC_DIRTY_BITS);
         uint8_t *guest_ptr, *server_ptr;
+        bool row_changed = false;
+        int i;
         unsigned long offset = find_next_bit((unsigned long *) &vd->guest.dirty,
                                              height * VNC_DIRTY_BPL(&vd->guest),
                                              y * VNC_DIRTY_BPL(&vd->guest));
@@ -2948,9 +3023,8 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
             break;
         }
         y = offset / VNC_DIRTY_BPL(&vd->guest);
-        x = offset % VNC_DIRTY_BPL(&vd->guest);
 
-        server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+        server_ptr = server_row0 + y * server_stride;
 
         if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
             qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
@@ -2958,30 +3032,50 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
         } else {
             guest_ptr = guest_row0 + y * guest_stride;
         }
-        guest_ptr += x * cmp_bytes;
 
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
-             x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-            int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
-                continue;
-            }
-            if ((x + 1) * cmp_bytes > line_bytes) {
-                _cmp_bytes = line_bytes - x * cmp_bytes;
-            }
-            assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
-                continue;
-            }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
-            if (!vd->non_adaptive) {
-                vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
-                                 y, &tv);
+        /*
+         * Consume the row's dirty map a word at a time, only visiting the
+         * set bits, and collect the chunks that really changed in a
+         * bitmap that is merged into each client's map in one go.
+         */
+        for (i = 0; i < BITS_TO_LONGS(nr_bits); i++) {
+            unsigned long dirty = vd->guest.dirty[y][i];
+
+            vd->guest.dirty[y][i] = 0;
+            changed[i] = 0;
+            while (dirty) {
+                int bit = ctzl(dirty);
+                int x = i * BITS_PER_LONG + bit;
+                int _cmp_bytes = cmp_bytes;
+
+                dirty &= dirty - 1;
+                if (x >= nr_bits) {
+                    break;
+                }
+                if ((x + 1) * cmp_bytes > line_bytes) {
+                    _cmp_bytes = line_bytes - x * cmp_bytes;
+                }
+                assert(_cmp_bytes >= 0);
+                if (memcmp(server_ptr + x * cmp_bytes,
+                           guest_ptr + x * cmp_bytes, _cmp_bytes) == 0) {
+                    continue;
+                }
+                memcpy(server_ptr + x * cmp_bytes,
+                       guest_ptr + x * cmp_bytes, _cmp_bytes);
+                if (!vd->non_adaptive) {
+                    vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
+                                     y, &tv);
+                }
+                changed[i] |= 1UL << bit;
+                has_dirty++;
             }
+            row_changed |= changed[i] != 0;
+        }
+
+        if (row_changed) {
             QTAILQ_FOREACH(vs, &vd->clients, next) {
-                set_bit(x, vs->dirty[y]);
+                bitmap_or(vs->dirty[y], vs->dirty[y], changed, nr_bits);
             }
-            has_dirty++;
         }
 
         y++;
@@ -2997,7 +3091,8 @@ static void vnc_refresh(DisplayChangeListener *dcl)
     int has_dirty, rects = 0;
 
     if (QTAILQ_EMPTY(&vd->clients)) {
-        update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_MAX);
+        /* vnc_connect() asks for refreshes again */
+        update_displaychangelistener(&vd->dcl, GUI_REFRESH_INTERVAL_NONE);
         return;
     }
 
@@ -3202,7 +3297,7 @@ void vnc_display_init(const char *id, Error **errp)
     vd->connections_limit = 32;
 
     qemu_mutex_init(&vd->mutex);
-    vnc_start_worker_thread();
+    vnc_start_worker_threads(1);
 
     vd->dcl.ops = &dcl_ops;
     register_displaychangelistener(&vd->dcl);
@@ -3336,6 +3431,9 @@ static QemuOptsList qemu_vnc_opts = {
         },{
             .name = "connections",
             .type = QEMU_OPT_NUMBER,
+        },{
+            .name = "workers",
+            .type = QEMU_OPT_NUMBER,
         },{
             .name = "to",
             .type = QEMU_OPT_NUMBER,
@@ -3375,6 +3473,9 @@ static QemuOptsList qemu_vnc_opts = {
         },{
             .name = "non-adaptive",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "h264",
+            .type = QEMU_OPT_BOOL,
         },
         { /* end of list */ }
     },
@@ -3812,6 +3913,7 @@ void vnc_display_open(const char *id, Error **errp)
     const char *saslauthz;
     int lock_key_sync = 1;
     int key_delay_ms;
+    uint64_t workers;
 
     if (!vd) {
         error_setg(errp, "VNC display not active");
@@ -3926,14 +4028,26 @@ void vnc_display_open(const char *id, Error **errp)
     }
     vd->connections_limit = qemu_opt_get_number(opts, "connections", 32);
 
+    workers = qemu_opt_get_number(opts, "workers", 1);
+    if (workers < 1 || workers > VNC_MAX_WORKERS) {
+        error_setg(errp, "vnc workers must be between 1 and %d",
+                   VNC_MAX_WORKERS);
+        goto fail;
+    }
+    /* The pool is shared by all displays and only ever grows */
+    vnc_start_worker_threads(workers);
+
 #ifdef CONFIG_VNC_JPEG
     vd->lossy = qemu_opt_get_bool(opts, "lossy", false);
+#endif
+#ifdef CONFIG_VNC_H264
+    vd->h264 = qemu_opt_get_bool(opts, "h264", false);
 #endif
     vd->non_adaptive = qemu_opt_get_bool(opts, "non-adaptive", false);
     /* adaptive updates are only used with tight encoding and
-     * if lossy updates are enabled so we can disable all the
-     * calculations otherwise */
-    if (!vd->lossy) {
+     * if lossy updates are enabled, or to decide when to use H.264,
+     * so we can disable all the calculations otherwise */
+    if (!vd->lossy && !vd->h264) {
         vd->non_adaptive = true;
     }
 
@@ -63,6 +63,7 @@
 
 typedef struct VncState VncState;
 typedef struct VncJob VncJob;
+typedef struct VncH264 VncH264;
 typedef struct VncRect VncRect;
 typedef struct VncRectEntry VncRectEntry;
 
@@ -159,6 +160,7 @@ struct VncDisplay
     int ledstate;
     QKbdState *kbd;
     QemuMutex mutex;
+    int encoders; /* Workers reading the server surface, see vnc-jobs.h */
 
     QEMUCursor *cursor;
     int cursor_msize;
@@ -178,6 +180,7 @@ struct VncDisplay
     int ws_subauth; /* Used by websockets */
     bool lossy;
     bool non_adaptive;
+    bool h264;
     QCryptoTLSCreds *tlscreds;
     QAuthZ *tlsauthz;
     char *tlsauthzid;
@@ -247,6 +250,7 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    bool h264; /* A single full screen rectangle of the H.264 stream */
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -275,6 +279,7 @@ struct VncState
     VncDisplay *vd;
     VncStateUpdate update; /* Most recent pending request from client */
     VncStateUpdate job_update; /* Currently processed by job thread */
+    bool job_running; /* A worker is encoding for us, under the queue lock */
     int has_dirty;
     uint32_t features;
     int absolute;
@@ -343,6 +348,8 @@ struct VncState
     VncHextile hextile;
     VncZrle zrle;
     VncZywrle zywrle;
+    VncH264 *h264;
+    bool h264_active; /* Updates currently go through the H.264 stream */
 
     Notifier mouse_mode_notifier;
 
@@ -399,6 +406,7 @@ enum {
 #define VNC_ENCODING_TRLE                 0x0000000f
 #define VNC_ENCODING_ZRLE                 0x00000010
 #define VNC_ENCODING_ZYWRLE               0x00000011
+#define VNC_ENCODING_OPEN_H264            0x00000032
 #define VNC_ENCODING_COMPRESSLEVEL0       0xFFFFFF00 /* -256 */
 #define VNC_ENCODING_QUALITYLEVEL0        0xFFFFFFE0 /* -32  */
 #define VNC_ENCODING_XCURSOR              0xFFFFFF10 /* -240 */
@@ -450,6 +458,7 @@ enum {
 #define VNC_FEATURE_ZRLE                     9
 #define VNC_FEATURE_ZYWRLE                  10
 #define VNC_FEATURE_LED_STATE               11
+#define VNC_FEATURE_H264                    12
 
 #define VNC_FEATURE_RESIZE_MASK              (1 << VNC_FEATURE_RESIZE)
 #define VNC_FEATURE_HEXTILE_MASK             (1 << VNC_FEATURE_HEXTILE)
@@ -463,6 +472,7 @@ enum {
 #define VNC_FEATURE_ZRLE_MASK                (1 << VNC_FEATURE_ZRLE)
 #define VNC_FEATURE_ZYWRLE_MASK              (1 << VNC_FEATURE_ZYWRLE)
 #define VNC_FEATURE_LED_STATE_MASK           (1 << VNC_FEATURE_LED_STATE)
+#define VNC_FEATURE_H264_MASK                (1 << VNC_FEATURE_H264)
 
 
 /* Client -> Server message IDs */
@@ -598,4 +608,15 @@ int vnc_zrle_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
 int vnc_zywrle_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
 void vnc_zrle_clear(VncState *vs);
 
+#ifdef CONFIG_VNC_H264
+int vnc_h264_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
+bool vnc_h264_usable(VncState *vs);
+void vnc_h264_clear(VncState *vs);
+#else
+static inline bool vnc_h264_usable(VncState *vs)
+{
+    return false;
+}
+#endif
+
 #endif /* QEMU_VNC_H */
@@ -35,6 +35,8 @@ struct AioHandler
     int deleted;
     void *opaque;
     bool is_external;
+    int64_t poll_ns;        /* how long to keep polling this handler */
+    bool poll_ready;        /* io_poll() made progress in this aio_poll() */
     QLIST_ENTRY(AioHandler) node;
 };
 
@@ -272,6 +274,7 @@ void aio_set_fd_handler(AioContext *ctx,
             new_node->pfd.fd = fd;
         } else {
             new_node->pfd = node->pfd;
+            new_node->poll_ns = node->poll_ns;
         }
         g_source_add_poll(&ctx->source, &new_node->pfd);
 
@@ -510,16 +513,26 @@ static void add_pollfd(AioHandler *node)
     npfd++;
 }
 
-static bool run_poll_handlers_once(AioContext *ctx, int64_t *timeout)
+/*
+ * Handlers are only polled within their own polling time, so that one
+ * busy handler does not make the others poll for as long as it needs.
+ * An @elapsed_ns of zero polls every handler once.
+ */
+static bool run_poll_handlers_once(AioContext *ctx, int64_t elapsed_ns,
+                                   int64_t *timeout)
 {
     bool progress = false;
     AioHandler *node;
 
     QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        if (elapsed_ns && elapsed_ns >= node->poll_ns) {
+            continue;
+        }
         if (!node->deleted && node->io_poll &&
             aio_node_check(ctx, node->is_external) &&
             node->io_poll(node->opaque)) {
             *timeout = 0;
+            node->poll_ready = true;
             if (node->opaque != &ctx->notifier) {
                 progress = true;
             }
@@ -555,11 +568,13 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
     trace_run_poll_handlers_begin(ctx, max_ns, *timeout);
 
     start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    elapsed_time = 0;
     do {
-        progress = run_poll_handlers_once(ctx, timeout);
+        progress = run_poll_handlers_once(ctx, elapsed_time, timeout);
         elapsed_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_time;
     } while (!progress && elapsed_time < max_ns
              && !atomic_read(&ctx->poll_disable_cnt));
+    ctx->poll_time_ns += elapsed_time;
 
     /* If time has passed with no successful polling, adjust *timeout to
      * keep the same ending time.
@@ -601,7 +616,85 @@ static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
     /* Even if we don't run busy polling, try polling once in case it can make
      * progress and the caller will be able to avoid ppoll(2)/epoll_wait(2).
      */
-    return run_poll_handlers_once(ctx, timeout);
+    return run_poll_handlers_once(ctx, 0, timeout);
+}
+
+static void shrink_polling_time(AioContext *ctx, int64_t *poll_ns)
+{
+    int64_t old = *poll_ns;
+
+    if (ctx->poll_shrink) {
+        *poll_ns /= ctx->poll_shrink;
+    } else {
+        *poll_ns = 0;
+    }
+
+    trace_poll_shrink(ctx, old, *poll_ns);
+}
+
+static void grow_polling_time(AioContext *ctx, int64_t *poll_ns)
+{
+    int64_t old = *poll_ns;
+    int64_t grow = ctx->poll_grow;
+
+    if (grow == 0) {
+        grow = 2;
+    }
+
+    if (*poll_ns) {
+        *poll_ns *= grow;
+    } else {
+        *poll_ns = 4000; /* start polling at 4 microseconds */
+    }
+
+    if (*poll_ns > ctx->poll_max_ns) {
+        *poll_ns = ctx->poll_max_ns;
+    }
+
+    trace_poll_grow(ctx, old, *poll_ns);
+}
+
+/*
+ * Adjust the polling time of each handler after blocking for @block_ns.
+ * Handlers that had an event get the usual grow/shrink treatment, the
+ * others are polled less if polling them would not have avoided the
+ * wait.  The context polls for as long as its most demanding handler.
+ */
+static void adjust_polling_time(AioContext *ctx, int64_t block_ns)
+{
+    AioHandler *node;
+    int64_t max_ns = 0;
+
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        if (node->deleted || !node->io_poll) {
+            continue;
+        }
+
+        if (node->poll_ready || (node->pfd.revents & node->pfd.events)) {
+            if (node->poll_ns > ctx->poll_max_ns) {
+                /* poll-max-ns was lowered */
+                node->poll_ns = ctx->poll_max_ns;
+            }
+
+            if (block_ns <= node->poll_ns) {
+                /* This is the sweet spot, no adjustment needed */
+            } else if (block_ns > ctx->poll_max_ns) {
+                /* We'd have to poll for too long, poll less */
+                shrink_polling_time(ctx, &node->poll_ns);
+            } else if (node->poll_ns < ctx->poll_max_ns) {
+                /* There is room to grow, poll longer */
+                grow_polling_time(ctx, &node->poll_ns);
+            }
+        } else if (node->poll_ns && block_ns > node->poll_ns) {
+            /* Polling this handler did not help */
+            shrink_polling_time(ctx, &node->poll_ns);
+        }
+
+        node->poll_ready = false;
+        max_ns = MAX(max_ns, node->poll_ns);
+    }
+
+    ctx->poll_ns = max_ns;
 }
 
 bool aio_poll(AioContext *ctx, bool blocking)
@@ -672,47 +765,6 @@ bool aio_poll(AioContext *ctx, bool blocking)
         aio_notify_accept(ctx);
     }
 
-    /* Adjust polling time */
-    if (ctx->poll_max_ns) {
-        int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
-
-        if (block_ns <= ctx->poll_ns) {
-            /* This is the sweet spot, no adjustment needed */
-        } else if (block_ns > ctx->poll_max_ns) {
-            /* We'd have to poll for too long, poll less */
-            int64_t old = ctx->poll_ns;
-
-            if (ctx->poll_shrink) {
-                ctx->poll_ns /= ctx->poll_shrink;
-            } else {
-                ctx->poll_ns = 0;
-            }
-
-            trace_poll_shrink(ctx, old, ctx->poll_ns);
-        } else if (ctx->poll_ns < ctx->poll_max_ns &&
-                   block_ns < ctx->poll_max_ns) {
-            /* There is room to grow, poll longer */
-            int64_t old = ctx->poll_ns;
-            int64_t grow = ctx->poll_grow;
-
-            if (grow == 0) {
-                grow = 2;
-            }
-
-            if (ctx->poll_ns) {
-                ctx->poll_ns *= grow;
-            } else {
-                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
-            }
-
-            if (ctx->poll_ns > ctx->poll_max_ns) {
-                ctx->poll_ns = ctx->poll_max_ns;
-            }
-
-            trace_poll_grow(ctx, old, ctx->poll_ns);
-        }
-    }
-
     /* if we have any readable fds, dispatch event */
     if (ret > 0) {
         for (i = 0; i < npfd; i++) {
@@ -722,6 +774,14 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     npfd = 0;
 
+    /* Adjust polling time */
+    if (ctx->poll_max_ns) {
+        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+        adjust_polling_time(ctx, now - start);
+        start = now;
+    }
+
     progress |= aio_bh_poll(ctx);
 
     if (ret > 0) {
@@ -732,6 +792,10 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     progress |= timerlistgroup_run_timers(&ctx->tlg);
 
+    if (start) {
+        ctx->dispatch_time_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+    }
+
     return progress;
 }
 
@@ -0,0 +1,441 @@
+/*
+ * Coroutine backend with a hand-written context switch
+ *
+ * Copyright (C) 2006  Anthony Liguori <anthony@codemonkey.ws>
+ * Copyright (C) 2011  Kevin Wolf <kwolf@redhat.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/coroutine_int.h"
+
+#ifdef CONFIG_VALGRIND_H
+#include <valgrind/valgrind.h>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__) || __has_feature(address_sanitizer)
+#ifdef CONFIG_ASAN_IFACE_FIBER
+#define CONFIG_ASAN 1
+#include <sanitizer/asan_interface.h>
+#endif
+#endif
+
+typedef struct {
+    Coroutine base;
+    void *sp;
+    void *stack;
+    size_t stack_size;
+
+#ifdef CONFIG_VALGRIND_H
+    unsigned int valgrind_stack_id;
+#endif
+
+} CoroutineAsm;
+
+/**
+ * Per-thread coroutine bookkeeping
+ */
+static __thread CoroutineAsm leader;
+static __thread Coroutine *current;
+
+/*
+ * Save the callee-saved registers on the current stack, store the stack
+ * pointer in *from_sp and resume the context saved at to_sp, which then
+ * returns action from its own call to coroutine_asm_switch().
+ *
+ * Caller-saved registers need no saving, since the compiler already
+ * treats them as clobbered by the call.  A new coroutine's stack is
+ * prepared by coroutine_asm_init_stack() so that the first switch to it
+ * "returns" into coroutine_trampoline().
+ */
+int coroutine_asm_switch(void **from_sp, void *to_sp, int action);
+
+#define COROUTINE_ASM_BEGIN                           \
+    ".text\n"                                         \
+    ".globl coroutine_asm_switch\n"                   \
+    ".hidden coroutine_asm_switch\n"                  \
+    ".type coroutine_asm_switch, %function\n"         \
+    "coroutine_asm_switch:\n"
+
+#define COROUTINE_ASM_END                             \
+    ".size coroutine_asm_switch, .-coroutine_asm_switch\n"
+
+#if defined(__x86_64__)
+/* rdi = from_sp, rsi = to_sp, edx = action */
+asm(COROUTINE_ASM_BEGIN
+    "pushq %rbp\n"
+    "pushq %rbx\n"
+    "pushq %r12\n"
+    "pushq %r13\n"
+    "pushq %r14\n"
+    "pushq %r15\n"
+    "movq %rsp, (%rdi)\n"
+    "movq %rsi, %rsp\n"
+    "popq %r15\n"
+    "popq %r14\n"
+    "popq %r13\n"
+    "popq %r12\n"
+    "popq %rbx\n"
+    "popq %rbp\n"
+    "movl %edx, %eax\n"
+    "ret\n"
+    COROUTINE_ASM_END);
+
+/* r15, r14, r13, r12, rbx, rbp, return address, and a dummy one */
+#define COROUTINE_FRAME_WORDS   8
+#define COROUTINE_FRAME_PC      6
+
+#elif defined(__aarch64__)
+/* x0 = from_sp, x1 = to_sp, w2 = action */
+asm(COROUTINE_ASM_BEGIN
+    "sub sp, sp, #160\n"
+    "stp x19, x20, [sp, #0]\n"
+    "stp x21, x22, [sp, #16]\n"
+    "stp x23, x24, [sp, #32]\n"
+    "stp x25, x26, [sp, #48]\n"
+    "stp x27, x28, [sp, #64]\n"
+    "stp x29, x30, [sp, #80]\n"
+    "stp d8, d9, [sp, #96]\n"
+    "stp d10, d11, [sp, #112]\n"
+    "stp d12, d13, [sp, #128]\n"
+    "stp d14, d15, [sp, #144]\n"
+    "mov x3, sp\n"
+    "str x3, [x0]\n"
+    "mov sp, x1\n"
+    "ldp x19, x20, [sp, #0]\n"
+    "ldp x21, x22, [sp, #16]\n"
+    "ldp x23, x24, [sp, #32]\n"
+    "ldp x25, x26, [sp, #48]\n"
+    "ldp x27, x28, [sp, #64]\n"
+    "ldp x29, x30, [sp, #80]\n"
+    "ldp d8, d9, [sp, #96]\n"
+    "ldp d10, d11, [sp, #112]\n"
+    "ldp d12, d13, [sp, #128]\n"
+    "ldp d14, d15, [sp, #144]\n"
+    "add sp, sp, #160\n"
+    "mov w0, w2\n"
+    "ret\n"
+    COROUTINE_ASM_END);
+
+/* x19-x28, x29 (frame pointer), x30 (link register), d8-d15 */
+#define COROUTINE_FRAME_WORDS   20
+#define COROUTINE_FRAME_PC      11
+
+#elif defined(__powerpc64__) && defined(_CALL_ELF) && _CALL_ELF == 2
+/*
+ * r3 = from_sp, r4 = to_sp, r5 = action.  The frame holds the back
+ * chain, CR, LR, the TOC pointer, r14-r31, f14-f31 and v20-v31.  r12
+ * is loaded with the return address so that the first switch enters
+ * coroutine_trampoline() through its global entry point.
+ */
+asm(COROUTINE_ASM_BEGIN
+    "mflr 0\n"
+    "mfcr 6\n"
+    "stdu 1,-512(1)\n"
+    "std 6,8(1)\n"
+    "std 0,16(1)\n"
+    "std 2,24(1)\n"
+    "std 14,32(1)\n"
+    "std 15,40(1)\n"
+    "std 16,48(1)\n"
+    "std 17,56(1)\n"
+    "std 18,64(1)\n"
+    "std 19,72(1)\n"
+    "std 20,80(1)\n"
+    "std 21,88(1)\n"
+    "std 22,96(1)\n"
+    "std 23,104(1)\n"
+    "std 24,112(1)\n"
+    "std 25,120(1)\n"
+    "std 26,128(1)\n"
+    "std 27,136(1)\n"
+    "std 28,144(1)\n"
+    "std 29,152(1)\n"
+    "std 30,160(1)\n"
+    "std 31,168(1)\n"
+    "stfd 14,176(1)\n"
+    "stfd 15,184(1)\n"
+    "stfd 16,192(1)\n"
+    "stfd 17,200(1)\n"
+    "stfd 18,208(1)\n"
+    "stfd 19,216(1)\n"
+    "stfd 20,224(1)\n"
+    "stfd 21,232(1)\n"
+    "stfd 22,240(1)\n"
+    "stfd 23,248(1)\n"
+    "stfd 24,256(1)\n"
+    "stfd 25,264(1)\n"
+    "stfd 26,272(1)\n"
+    "stfd 27,280(1)\n"
+    "stfd 28,288(1)\n"
+    "stfd 29,296(1)\n"
+    "stfd 30,304(1)\n"
+    "stfd 31,312(1)\n"
+    "li 7,320\n"  "stvx 20,1,7\n"
+    "li 7,336\n"  "stvx 21,1,7\n"
+    "li 7,352\n"  "stvx 22,1,7\n"
+    "li 7,368\n"  "stvx 23,1,7\n"
+    "li 7,384\n"  "stvx 24,1,7\n"
+    "li 7,400\n"  "stvx 25,1,7\n"
+    "li 7,416\n"  "stvx 26,1,7\n"
+    "li 7,432\n"  "stvx 27,1,7\n"
+    "li 7,448\n"  "stvx 28,1,7\n"
+    "li 7,464\n"  "stvx 29,1,7\n"
+    "li 7,480\n"  "stvx 30,1,7\n"
+    "li 7,496\n"  "stvx 31,1,7\n"
+    "std 1,0(3)\n"
+    "mr 1,4\n"
+    "ld 14,32(1)\n"
+    "ld 15,40(1)\n"
+    "ld 16,48(1)\n"
+    "ld 17,56(1)\n"
+    "ld 18,64(1)\n"
+    "ld 19,72(1)\n"
+    "ld 20,80(1)\n"
+    "ld 21,88(1)\n"
+    "ld 22,96(1)\n"
+    "ld 23,104(1)\n"
+    "ld 24,112(1)\n"
+    "ld 25,120(1)\n"
+    "ld 26,128(1)\n"
+    "ld 27,136(1)\n"
+    "ld 28,144(1)\n"
+    "ld 29,152(1)\n"
+    "ld 30,160(1)\n"
+    "ld 31,168(1)\n"
+    "lfd 14,176(1)\n"
+    "lfd 15,184(1)\n"
+    "lfd 16,192(1)\n"
+    "lfd 17,200(1)\n"
+    "lfd 18,208(1)\n"
+    "lfd 19,216(1)\n"
+    "lfd 20,224(1)\n"
+    "lfd 21,232(1)\n"
+    "lfd 22,240(1)\n"
+    "lfd 23,248(1)\n"
+    "lfd 24,256(1)\n"
+    "lfd 25,264(1)\n"
+    "lfd 26,272(1)\n"
+    "lfd 27,280(1)\n"
+    "lfd 28,288(1)\n"
+    "lfd 29,296(1)\n"
+    "lfd 30,304(1)\n"
+    "lfd 31,312(1)\n"
+    "li 7,320\n"  "lvx 20,1,7\n"
+    "li 7,336\n"  "lvx 21,1,7\n"
+    "li 7,352\n"  "lvx 22,1,7\n"
+    "li 7,368\n"  "lvx 23,1,7\n"
+    "li 7,384\n"  "lvx 24,1,7\n"
+    "li 7,400\n"  "lvx 25,1,7\n"
+    "li 7,416\n"  "lvx 26,1,7\n"
+    "li 7,432\n"  "lvx 27,1,7\n"
+    "li 7,448\n"  "lvx 28,1,7\n"
+    "li 7,464\n"  "lvx 29,1,7\n"
+    "li 7,480\n"  "lvx 30,1,7\n"
+    "li 7,496\n"  "lvx 31,1,7\n"
+    "ld 6,8(1)\n"
+    "ld 0,16(1)\n"
+    "ld 2,24(1)\n"
+    "mtcrf 0x38,6\n"
+    "mtlr 0\n"
+    "mr 12,0\n"
+    "addi 1,1,512\n"
+    "mr 3,5\n"
+    "blr\n"
+    COROUTINE_ASM_END);
+
+/* Our 512 byte frame plus a minimal one for coroutine_trampoline() */
+#define COROUTINE_FRAME_WORDS   68
+#define COROUTINE_FRAME_PC      2
+#define COROUTINE_FRAME_CHAIN   64
+
+#elif defined(__s390x__)
+/*
+ * r2 = from_sp, r3 = to_sp, r4 = action.  r6-r14 go to the register
+ * save area that the caller reserves for us, f8-f15 to a 64 byte frame
+ * below it.
+ */
+asm(COROUTINE_ASM_BEGIN
+    "stmg %r6,%r14,48(%r15)\n"
+    "aghi %r15,-64\n"
+    "std %f8,0(%r15)\n"
+    "std %f9,8(%r15)\n"
+    "std %f10,16(%r15)\n"
+    "std %f11,24(%r15)\n"
+    "std %f12,32(%r15)\n"
+    "std %f13,40(%r15)\n"
+    "std %f14,48(%r15)\n"
+    "std %f15,56(%r15)\n"
+    "stg %r15,0(%r2)\n"
+    "lgr %r15,%r3\n"
+    "ld %f8,0(%r15)\n"
+    "ld %f9,8(%r15)\n"
+    "ld %f10,16(%r15)\n"
+    "ld %f11,24(%r15)\n"
+    "ld %f12,32(%r15)\n"
+    "ld %f13,40(%r15)\n"
+    "ld %f14,48(%r15)\n"
+    "ld %f15,56(%r15)\n"
+    "aghi %r15,64\n"
+    "lmg %r6,%r14,48(%r15)\n"
+    "lgr %r2,%r4\n"
+    "br %r14\n"
+    COROUTINE_ASM_END);
+
+/* The f8-f15 frame plus the register save area of the trampoline */
+#define COROUTINE_FRAME_WORDS   28
+#define COROUTINE_FRAME_PC      22
+
+#else
+#error The asm coroutine backend does not support this host
+#endif
+
+static void finish_switch_fiber(void *fake_stack_save)
+{
+#ifdef CONFIG_ASAN
+    const void *bottom_old;
+    size_t size_old;
+
+    __sanitizer_finish_switch_fiber(fake_stack_save, &bottom_old, &size_old);
+
+    if (!leader.stack) {
+        leader.stack = (void *)bottom_old;
+        leader.stack_size = size_old;
+    }
+#endif
+}
+
+static void start_switch_fiber(void **fake_stack_save,
+                               const void *bottom, size_t size)
+{
+#ifdef CONFIG_ASAN
+    __sanitizer_start_switch_fiber(fake_stack_save, bottom, size);
+#endif
+}
+
+/*
+ * Entered by the first switch to a coroutine.  Coroutines are never
+ * returned from: when the entry point completes, the coroutine switches
+ * back to its caller and waits here to be reused from the pool.
+ */
+static void QEMU_NORETURN coroutine_trampoline(void)
+{
+    Coroutine *co = current;
+
+    finish_switch_fiber(NULL);
+
+    while (true) {
+        co->entry(co->entry_arg);
+        qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
+    }
+}
+
+static void *coroutine_asm_init_stack(CoroutineAsm *co)
+{
+    uintptr_t *sp = (uintptr_t *)(co->stack + co->stack_size);
+
+    sp -= COROUTINE_FRAME_WORDS;
+    memset(sp, 0, COROUTINE_FRAME_WORDS * sizeof(uintptr_t));
+    sp[COROUTINE_FRAME_PC] = (uintptr_t)coroutine_trampoline;
+#ifdef COROUTINE_FRAME_CHAIN
+    sp[0] = (uintptr_t)&sp[COROUTINE_FRAME_CHAIN];
+#endif
+    return sp;
+}
+
+Coroutine *qemu_coroutine_new(void)
+{
+    CoroutineAsm *co;
+
+    co = g_malloc0(sizeof(*co));
+    co->stack_size = COROUTINE_STACK_SIZE;
+    co->stack = qemu_alloc_stack(&co->stack_size);
+    co->sp = coroutine_asm_init_stack(co);
+
+#ifdef CONFIG_VALGRIND_H
+    co->valgrind_stack_id =
+        VALGRIND_STACK_REGISTER(co->stack, co->stack + co->stack_size);
+#endif
+
+    return &co->base;
+}
+
+#ifdef CONFIG_VALGRIND_H
+#if defined(CONFIG_PRAGMA_DIAGNOSTIC_AVAILABLE) && !defined(__clang__)
+/* Work around an unused variable in the valgrind.h macro... */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#endif
+static inline void valgrind_stack_deregister(CoroutineAsm *co)
+{
+    VALGRIND_STACK_DEREGISTER(co->valgrind_stack_id);
+}
+#if defined(CONFIG_PRAGMA_DIAGNOSTIC_AVAILABLE) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+void qemu_coroutine_delete(Coroutine *co_)
+{
+    CoroutineAsm *co = DO_UPCAST(CoroutineAsm, base, co_);
+
+#ifdef CONFIG_VALGRIND_H
+    valgrind_stack_deregister(co);
+#endif
+
+    qemu_free_stack(co->stack, co->stack_size);
+    g_free(co);
+}
+
+/* This function is marked noinline to prevent GCC from inlining it
+ * into coroutine_trampoline(). If we allow it to do that then it
+ * hoists the code to get the address of the TLS variable "current"
+ * out of the while() loop. This is an invalid transformation because
+ * the switch may be started when running thread A but return in
+ * thread B, and so we might be in a different thread context each
+ * time round the loop.
+ */
+CoroutineAction __attribute__((noinline))
+qemu_coroutine_switch(Coroutine *from_, Coroutine *to_,
+                      CoroutineAction action)
+{
+    CoroutineAsm *from = DO_UPCAST(CoroutineAsm, base, from_);
+    CoroutineAsm *to = DO_UPCAST(CoroutineAsm, base, to_);
+    void *fake_stack_save = NULL;
+    int ret;
+
+    current = to_;
+
+    start_switch_fiber(action == COROUTINE_TERMINATE ?
+                       NULL : &fake_stack_save, to->stack, to->stack_size);
+    ret = coroutine_asm_switch(&from->sp, to->sp, action);
+    finish_switch_fiber(fake_stack_save);
+
+    return ret;
+}
+
+Coroutine *qemu_coroutine_self(void)
+{
+    if (!current) {
+        current = &leader.base;
+    }
+    return current;
+}
+
+bool qemu_in_coroutine(void)
+{
+    return current && current->caller;
+}
@@ -13,6 +13,7 @@
 #include "qemu/hbitmap.h"
 #include "qemu/host-utils.h"
 #include "trace.h"
+#include "qemu/cutils.h"
 #include "crypto/hash.h"
 
 /* HBitmaps provides an array of bits.  The bits are stored as usual in an
@@ -489,12 +490,44 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     }
 }
 
+/* Clear the words of @elem that are set, in chunks of @len words.  Zero
+ * words are left alone, so that the parts of a large bitmap that were never
+ * dirtied need not be backed by memory.
+ */
+static void hb_clear_words(unsigned long *elem, uint64_t len)
+{
+    const uint64_t chunk = 4096 / sizeof(unsigned long);
+    uint64_t n;
+
+    while (len) {
+        n = MIN(len, chunk);
+        if (!buffer_is_zero(elem, n * sizeof(unsigned long))) {
+            memset(elem, 0, n * sizeof(unsigned long));
+        }
+        elem += n;
+        len -= n;
+    }
+}
+
 void hbitmap_reset_all(HBitmap *hb)
 {
+    HBitmapIter hbi;
+    unsigned long cur;
+    size_t pos;
     unsigned int i;
 
-    /* Same as hbitmap_alloc() except for memset() instead of malloc() */
-    for (i = HBITMAP_LEVELS; --i >= 1; ) {
+    /* Only visit the words that are set in the last level, which is by far
+     * the largest; the levels above it are needed to find them.
+     */
+    if (hb->count) {
+        hbitmap_iter_init(&hbi, hb, 0);
+        while ((pos = hbitmap_iter_next_word(&hbi, &cur)) != (size_t)-1) {
+            hb->levels[HBITMAP_LEVELS - 1][pos] = 0;
+        }
+    }
+
+    /* Same as hbitmap_alloc() except for clearing instead of malloc() */
+    for (i = HBITMAP_LEVELS - 1; --i >= 1; ) {
         memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
     }
 
@@ -588,6 +621,9 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
+#ifndef HOST_WORDS_BIGENDIAN
+    memcpy(buf, cur, el_count * sizeof(unsigned long));
+#else
     while (cur != end) {
         unsigned long el =
             (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
@@ -596,6 +632,7 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
         buf += sizeof(el);
         cur++;
     }
+#endif
 }
 
 void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
@@ -612,12 +649,19 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     end = cur + el_count;
 
     while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+        unsigned long el;
+
+        memcpy(&el, buf, sizeof(el));
 
         if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
+            le32_to_cpus((uint32_t *)&el);
         } else {
-            le64_to_cpus((uint64_t *)cur);
+            le64_to_cpus((uint64_t *)&el);
+        }
+
+        /* Keep clean parts of the bitmap untouched */
+        if (el || *cur) {
+            *cur = el;
         }
 
         buf += sizeof(unsigned long);
@@ -639,7 +683,7 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0, el_count * sizeof(unsigned long));
+    hb_clear_words(first, el_count);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -780,6 +824,41 @@ bool hbitmap_can_merge(const HBitmap *a, const HBitmap *b)
     return (a->size == b->size) && (a->granularity == b->granularity);
 }
 
+/* Let DST := DST (BITOR) SRC, visiting only the words that are set in SRC.
+ * The levels above the last one and the count of DST are kept up to date
+ * as words are added, so that nothing needs to be recomputed afterwards.
+ */
+static void hb_merge_into(HBitmap *dst, const HBitmap *src)
+{
+    HBitmapIter hbi;
+    unsigned long cur, old;
+    size_t pos;
+    int i;
+
+    if (!src->count) {
+        return;
+    }
+
+    hbitmap_iter_init(&hbi, src, 0);
+    while ((pos = hbitmap_iter_next_word(&hbi, &cur)) != (size_t)-1) {
+        old = dst->levels[HBITMAP_LEVELS - 1][pos];
+        if ((old | cur) == old) {
+            continue;
+        }
+        dst->levels[HBITMAP_LEVELS - 1][pos] = old | cur;
+        dst->count += ctpopl(cur & ~old);
+
+        /* A word that becomes nonzero sets its bit in the level above */
+        for (i = HBITMAP_LEVELS - 2; i >= 0 && !old; i--) {
+            unsigned long *elem = &dst->levels[i][pos >> BITS_PER_LEVEL];
+
+            old = *elem;
+            *elem |= 1UL << (pos & (BITS_PER_LONG - 1));
+            pos >>= BITS_PER_LEVEL;
+        }
+    }
+}
+
 /**
  * Given HBitmaps A and B, let A := A (BITOR) B.
  * Bitmap B will not be modified.
@@ -789,30 +868,27 @@ bool hbitmap_can_merge(const HBitmap *a, const HBitmap *b)
  */
 bool hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
-    int i;
-    uint64_t j;
-
     if (!hbitmap_can_merge(a, b) || !hbitmap_can_merge(a, result)) {
         return false;
     }
     assert(hbitmap_can_merge(b, result));
 
-    if (hbitmap_count(b) == 0) {
-        return true;
-    }
-
-    /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+    /* The merge costs O(number of words set in the bitmaps merged into
+     * RESULT), rather than O(size): persistent bitmaps of large disks are
+     * mostly clean.  The merge is symmetric, so swap A and B if B is the
+     * one already in RESULT.
      */
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
-        }
+    if (result == b) {
+        b = a;
+        a = result;
+    }
+    if (result != a) {
+        hbitmap_reset_all(result);
+        hb_merge_into(result, a);
+    }
+    if (result != b) {
+        hb_merge_into(result, b);
     }
-
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
 
     return true;
 }
@@ -0,0 +1,168 @@
+/*
+ * Interval tree for overlap queries on half-open 64-bit ranges
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+static inline uint64_t subtree_end(IntervalTreeNode *node)
+{
+    return node ? node->subtree_end : 0;
+}
+
+static inline void update(IntervalTreeNode *node)
+{
+    node->subtree_end = MAX(node->end, MAX(subtree_end(node->left),
+                                           subtree_end(node->right)));
+}
+
+/* Total order on the nodes: by start, ties broken by address */
+static inline bool node_before(IntervalTreeNode *a, IntervalTreeNode *b)
+{
+    return a->start < b->start ||
+           (a->start == b->start && (uintptr_t)a < (uintptr_t)b);
+}
+
+static IntervalTreeNode *rotate_right(IntervalTreeNode *node)
+{
+    IntervalTreeNode *left = node->left;
+
+    node->left = left->right;
+    left->right = node;
+    update(node);
+    update(left);
+    return left;
+}
+
+static IntervalTreeNode *rotate_left(IntervalTreeNode *node)
+{
+    IntervalTreeNode *right = node->right;
+
+    node->right = right->left;
+    right->left = node;
+    update(node);
+    update(right);
+    return right;
+}
+
+static IntervalTreeNode *do_insert(IntervalTreeNode *tree,
+                                   IntervalTreeNode *node)
+{
+    if (!tree) {
+        return node;
+    }
+
+    if (node_before(node, tree)) {
+        tree->left = do_insert(tree->left, node);
+        if (tree->left->priority > tree->priority) {
+            return rotate_right(tree);
+        }
+    } else {
+        tree->right = do_insert(tree->right, node);
+        if (tree->right->priority > tree->priority) {
+            return rotate_left(tree);
+        }
+    }
+    update(tree);
+    return tree;
+}
+
+/* Join two treaps where every node of @a comes before every node of @b */
+static IntervalTreeNode *merge(IntervalTreeNode *a, IntervalTreeNode *b)
+{
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+
+    if (a->priority > b->priority) {
+        a->right = merge(a->right, b);
+        update(a);
+        return a;
+    } else {
+        b->left = merge(a, b->left);
+        update(b);
+        return b;
+    }
+}
+
+static IntervalTreeNode *do_remove(IntervalTreeNode *tree,
+                                   IntervalTreeNode *node)
+{
+    assert(tree);
+
+    if (tree == node) {
+        return merge(node->left, node->right);
+    }
+
+    if (node_before(node, tree)) {
+        tree->left = do_remove(tree->left, node);
+    } else {
+        tree->right = do_remove(tree->right, node);
+    }
+    update(tree);
+    return tree;
+}
+
+void interval_tree_insert(IntervalTreeRoot *root, IntervalTreeNode *node)
+{
+    assert(node->start <= node->end);
+
+    /* xorshift64*; the seed only needs to be different for each node */
+    if (!root->seed) {
+        root->seed = 0x9e3779b97f4a7c15ULL;
+    }
+    root->seed ^= root->seed >> 12;
+    root->seed ^= root->seed << 25;
+    root->seed ^= root->seed >> 27;
+
+    node->priority = root->seed * 0x2545f4914f6cdd1dULL;
+    node->left = node->right = NULL;
+    node->subtree_end = node->end;
+    root->root = do_insert(root->root, node);
+}
+
+void interval_tree_remove(IntervalTreeRoot *root, IntervalTreeNode *node)
+{
+    root->root = do_remove(root->root, node);
+    node->left = node->right = NULL;
+}
+
+static IntervalTreeNode *do_find(IntervalTreeNode *tree,
+                                 uint64_t start, uint64_t end,
+                                 IntervalTreeFunc func, void *opaque)
+{
+    IntervalTreeNode *found;
+
+    /* No node below here ends after @start */
+    if (!tree || tree->subtree_end <= start) {
+        return NULL;
+    }
+
+    found = do_find(tree->left, start, end, func, opaque);
+    if (found) {
+        return found;
+    }
+
+    /* This node and all those on its right start too late */
+    if (tree->start >= end) {
+        return NULL;
+    }
+    if (start < tree->end && func(tree, opaque)) {
+        return tree;
+    }
+
+    return do_find(tree->right, start, end, func, opaque);
+}
+
+IntervalTreeNode *interval_tree_find(IntervalTreeRoot *root,
+                                     uint64_t start, uint64_t end,
+                                     IntervalTreeFunc func, void *opaque)
+{
+    return do_find(root->root, start, end, func, opaque);
+}
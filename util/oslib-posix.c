@@ -38,8 +38,10 @@
 #include <libgen.h>
 #include <sys/signal.h>
 #include "qemu/cutils.h"
+#include "qemu/bitops.h"
 
 #ifdef CONFIG_LINUX
+#include <sched.h>
 #include <sys/syscall.h>
 #endif
 
@@ -61,18 +63,32 @@
 
 #define MAX_MEM_PREALLOC_THREAD_COUNT 16
 
+typedef struct MemsetThread MemsetThread;
+
+struct MemPrealloc {
+    MemsetThread *threads;
+    int num_threads;
+    bool failed;
+};
+
 struct MemsetThread {
+    MemPrealloc *prealloc;
     char *addr;
     size_t numpages;
     size_t hpagesize;
+#ifdef CONFIG_LINUX
+    cpu_set_t *cpus;
+#endif
     QemuThread pgthread;
     sigjmp_buf env;
 };
-typedef struct MemsetThread MemsetThread;
 
-static MemsetThread *memset_thread;
-static int memset_num_threads;
-static bool memset_thread_failed;
+/* The preallocation thread that the SIGBUS handler should bail out of */
+static __thread MemsetThread *memset_thread;
+
+/* Preallocations can overlap, so SIGBUS is restored when the last ends */
+static int memset_sigbus_users;
+static struct sigaction memset_sigbus_oldact;
 
 int qemu_get_thread_id(void)
 {
@@ -386,13 +402,8 @@ char *qemu_get_exec_dir(void)
 
 static void sigbus_handler(int signal)
 {
-    int i;
     if (memset_thread) {
-        for (i = 0; i < memset_num_threads; i++) {
-            if (qemu_thread_is_self(&memset_thread[i].pgthread)) {
-                siglongjmp(memset_thread[i].env, 1);
-            }
-        }
+        siglongjmp(memset_thread->env, 1);
     }
 }
 
@@ -401,13 +412,21 @@ static void *do_touch_pages(void *arg)
     MemsetThread *memset_args = (MemsetThread *)arg;
     sigset_t set, oldset;
 
+#ifdef CONFIG_LINUX
+    if (memset_args->cpus) {
+        /* Best effort: the pages are still touched if this fails */
+        sched_setaffinity(0, sizeof(cpu_set_t), memset_args->cpus);
+    }
+#endif
+
     /* unblock SIGBUS */
     sigemptyset(&set);
     sigaddset(&set, SIGBUS);
     pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
 
+    memset_thread = memset_args;
     if (sigsetjmp(memset_args->env, 1)) {
-        memset_thread_failed = true;
+        atomic_set(&memset_args->prealloc->failed, true);
     } else {
         char *addr = memset_args->addr;
         size_t numpages = memset_args->numpages;
@@ -417,99 +436,242 @@ static void *do_touch_pages(void *arg)
             /*
              * Read & write back the same value, so we don't
              * corrupt existing user/app data that might be
-             * stored.
-             *
-             * 'volatile' to stop compiler optimizing this away
-             * to a no-op
+             * stored.  The atomic no-op read-modify-write also
+             * keeps concurrent writes intact, so other threads
+             * can use the memory while it is being preallocated.
              *
              * TODO: get a better solution from kernel so we
              * don't need to write at all so we don't cause
              * wear on the storage backing the region...
              */
-            *(volatile char *)addr = *addr;
+            atomic_fetch_or(addr, 0);
             addr += hpagesize;
         }
     }
+    memset_thread = NULL;
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
     return NULL;
 }
 
-static inline int get_memset_num_threads(int smp_cpus)
+#ifdef CONFIG_LINUX
+/* Add the CPUs in a sysfs cpulist, such as "0-3,8,10-11", to @set */
+static void add_cpulist(cpu_set_t *set, const char *list)
 {
-    long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
-    int ret = 1;
+    const char *p = list;
+    unsigned long first, last;
 
-    if (host_procs > 0) {
-        ret = MIN(MIN(host_procs, MAX_MEM_PREALLOC_THREAD_COUNT), smp_cpus);
+    while (*p && *p != '\n') {
+        if (qemu_strtoul(p, &p, 10, &first) < 0) {
+            return;
+        }
+        last = first;
+        if (*p == '-' && qemu_strtoul(p + 1, &p, 10, &last) < 0) {
+            return;
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            CPU_SET(first, set);
+        }
+        if (*p == ',') {
+            p++;
+        }
     }
-    /* In case sysconf() fails, we fall back to single threaded */
-    return ret;
 }
 
-static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                            int smp_cpus)
+/*
+ * Return the set of CPUs that belong to the host NUMA nodes in @host_nodes
+ * and that QEMU may run on, or NULL if it is empty or cannot be determined.
+ */
+static cpu_set_t *get_node_cpus(const unsigned long *host_nodes,
+                                unsigned long max_node)
 {
-    size_t numpages_per_thread;
-    size_t size_per_thread;
-    char *addr = area;
-    int i = 0;
-
-    memset_thread_failed = false;
-    memset_num_threads = get_memset_num_threads(smp_cpus);
-    memset_thread = g_new0(MemsetThread, memset_num_threads);
-    numpages_per_thread = (numpages / memset_num_threads);
-    size_per_thread = (hpagesize * numpages_per_thread);
-    for (i = 0; i < memset_num_threads; i++) {
-        memset_thread[i].addr = addr;
-        memset_thread[i].numpages = (i == (memset_num_threads - 1)) ?
-                                    numpages : numpages_per_thread;
-        memset_thread[i].hpagesize = hpagesize;
-        qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
-                           do_touch_pages, &memset_thread[i],
-                           QEMU_THREAD_JOINABLE);
-        addr += size_per_thread;
-        numpages -= numpages_per_thread;
+    cpu_set_t *set = g_new0(cpu_set_t, 1);
+    cpu_set_t allowed;
+    unsigned long node;
+
+    for (node = find_first_bit(host_nodes, max_node); node < max_node;
+         node = find_next_bit(host_nodes, max_node, node + 1)) {
+        char *path, *list;
+
+        path = g_strdup_printf("/sys/devices/system/node/node%lu/cpulist",
+                               node);
+        if (g_file_get_contents(path, &list, NULL, NULL)) {
+            add_cpulist(set, list);
+            g_free(list);
+        }
+        g_free(path);
     }
-    for (i = 0; i < memset_num_threads; i++) {
-        qemu_thread_join(&memset_thread[i].pgthread);
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        CPU_AND(set, set, &allowed);
     }
-    g_free(memset_thread);
-    memset_thread = NULL;
+    if (CPU_COUNT(set) == 0) {
+        g_free(set);
+        return NULL;
+    }
+    return set;
+}
+#endif
 
-    return memset_thread_failed;
+static int get_memset_num_threads(int smp_cpus, int nthreads, int host_procs)
+{
+    if (host_procs <= 0) {
+        /* In case sysconf() fails, we fall back to single threaded */
+        return 1;
+    }
+    if (nthreads > 0) {
+        return MIN(nthreads, host_procs);
+    }
+    return MAX(MIN(MIN(host_procs, MAX_MEM_PREALLOC_THREAD_COUNT), smp_cpus),
+               1);
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+/* Called from the main thread, like the rest of os_mem_prealloc_*() */
+static void memset_sigbus_get(Error **errp)
 {
-    int ret;
-    struct sigaction act, oldact;
-    size_t hpagesize = qemu_fd_getpagesize(fd);
-    size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+    struct sigaction act;
+
+    if (memset_sigbus_users++) {
+        return;
+    }
 
     memset(&act, 0, sizeof(act));
     act.sa_handler = &sigbus_handler;
     act.sa_flags = 0;
 
-    ret = sigaction(SIGBUS, &act, &oldact);
-    if (ret) {
+    if (sigaction(SIGBUS, &act, &memset_sigbus_oldact)) {
+        memset_sigbus_users--;
         error_setg_errno(errp, errno,
             "os_mem_prealloc: failed to install signal handler");
+    }
+}
+
+static void memset_sigbus_put(void)
+{
+    if (--memset_sigbus_users) {
         return;
     }
 
+    if (sigaction(SIGBUS, &memset_sigbus_oldact, NULL)) {
+        /* Terminate QEMU since it can't recover from error */
+        perror("os_mem_prealloc: failed to reinstall signal handler");
+        exit(1);
+    }
+}
+
+MemPrealloc *os_mem_prealloc_start(int fd, char *area, size_t memory,
+                                   int smp_cpus, int nthreads,
+                                   const unsigned long *host_nodes,
+                                   unsigned long max_node, Error **errp)
+{
+    Error *local_err = NULL;
+    size_t hpagesize = qemu_fd_getpagesize(fd);
+    size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+    long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t numpages_per_thread;
+    size_t size_per_thread;
+    MemPrealloc *prealloc;
+    char *addr = area;
+    void *cpus = NULL;
+    int i;
+
+    memset_sigbus_get(&local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return NULL;
+    }
+
+#ifdef CONFIG_LINUX
+    if (host_nodes && find_first_bit(host_nodes, max_node) < max_node) {
+        cpus = get_node_cpus(host_nodes, max_node);
+        if (cpus) {
+            host_procs = CPU_COUNT((cpu_set_t *)cpus);
+        }
+    }
+#endif
+
+    prealloc = g_new0(MemPrealloc, 1);
+    prealloc->num_threads = get_memset_num_threads(smp_cpus, nthreads,
+                                                   host_procs);
+    prealloc->threads = g_new0(MemsetThread, prealloc->num_threads);
+    numpages_per_thread = numpages / prealloc->num_threads;
+    size_per_thread = hpagesize * numpages_per_thread;
+
     /* touch pages simultaneously */
-    if (touch_all_pages(area, hpagesize, numpages, smp_cpus)) {
+    for (i = 0; i < prealloc->num_threads; i++) {
+        MemsetThread *t = &prealloc->threads[i];
+
+        t->prealloc = prealloc;
+        t->addr = addr;
+        t->numpages = (i == (prealloc->num_threads - 1)) ?
+                      numpages : numpages_per_thread;
+        t->hpagesize = hpagesize;
+#ifdef CONFIG_LINUX
+        t->cpus = cpus;
+#endif
+        qemu_thread_create(&t->pgthread, "touch_pages", do_touch_pages, t,
+                           QEMU_THREAD_JOINABLE);
+        addr += size_per_thread;
+        numpages -= numpages_per_thread;
+    }
+    return prealloc;
+}
+
+void os_mem_prealloc_finish(MemPrealloc *prealloc, Error **errp)
+{
+    void *cpus = NULL;
+    int i;
+
+    for (i = 0; i < prealloc->num_threads; i++) {
+        qemu_thread_join(&prealloc->threads[i].pgthread);
+    }
+#ifdef CONFIG_LINUX
+    cpus = prealloc->threads[0].cpus;
+#endif
+
+    if (prealloc->failed) {
         error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
             "pages available to allocate guest RAM");
     }
+    memset_sigbus_put();
 
-    ret = sigaction(SIGBUS, &oldact, NULL);
-    if (ret) {
-        /* Terminate QEMU since it can't recover from error */
-        perror("os_mem_prealloc: failed to reinstall signal handler");
-        exit(1);
+    g_free(cpus);
+    g_free(prealloc->threads);
+    g_free(prealloc);
+}
+
+void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
+                     Error **errp)
+{
+    MemPrealloc *prealloc;
+
+    prealloc = os_mem_prealloc_start(fd, area, memory, smp_cpus, 0, NULL, 0,
+                                     errp);
+    if (prealloc) {
+        os_mem_prealloc_finish(prealloc, errp);
+    }
+}
+
+bool qemu_get_host_node_cpus(const unsigned long *host_nodes,
+                             unsigned long max_node,
+                             unsigned long *host_cpus, unsigned long max_cpu)
+{
+#ifdef CONFIG_LINUX
+    cpu_set_t *set = get_node_cpus(host_nodes, max_node);
+    unsigned long cpu;
+
+    if (!set) {
+        return false;
+    }
+    for (cpu = 0; cpu < max_cpu && cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, set)) {
+            set_bit(cpu, host_cpus);
+        }
     }
+    g_free(set);
+    return true;
+#else
+    return false;
+#endif
 }
 
 uint64_t qemu_get_pmem_size(const char *filename, Error **errp)
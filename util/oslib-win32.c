@@ -560,6 +560,38 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 }
 
+/* There is no background preallocation; the work is done synchronously.  */
+struct MemPrealloc {
+    int dummy;
+};
+
+MemPrealloc *os_mem_prealloc_start(int fd, char *area, size_t sz,
+                                   int smp_cpus, int nthreads,
+                                   const unsigned long *host_nodes,
+                                   unsigned long max_node, Error **errp)
+{
+    Error *local_err = NULL;
+
+    os_mem_prealloc(fd, area, sz, smp_cpus, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return NULL;
+    }
+    return g_new0(MemPrealloc, 1);
+}
+
+void os_mem_prealloc_finish(MemPrealloc *prealloc, Error **errp)
+{
+    g_free(prealloc);
+}
+
+bool qemu_get_host_node_cpus(const unsigned long *host_nodes,
+                             unsigned long max_node,
+                             unsigned long *host_cpus, unsigned long max_cpu)
+{
+    return false;
+}
+
 uint64_t qemu_get_pmem_size(const char *filename, Error **errp)
 {
     error_setg(errp, "pmem support not available");
@@ -236,7 +236,8 @@ static void coroutine_fn qemu_co_mutex_lock_slowpath(AioContext *ctx,
     trace_qemu_co_mutex_lock_return(mutex, self);
 }
 
-void coroutine_fn qemu_co_mutex_lock(CoMutex *mutex)
+void coroutine_fn qemu_co_mutex_lock_impl(CoMutex *mutex, const char *file,
+                                          int line)
 {
     AioContext *ctx = qemu_get_current_aio_context();
     Coroutine *self = qemu_coroutine_self();
@@ -338,11 +339,11 @@ void qemu_co_rwlock_init(CoRwlock *lock)
     qemu_co_mutex_init(&lock->mutex);
 }
 
-void qemu_co_rwlock_rdlock(CoRwlock *lock)
+void qemu_co_rwlock_rdlock_impl(CoRwlock *lock, const char *file, int line)
 {
     Coroutine *self = qemu_coroutine_self();
 
-    qemu_co_mutex_lock(&lock->mutex);
+    qemu_co_mutex_lock_impl(&lock->mutex, file, line);
     /* For fairness, wait if a writer is in line.  */
     while (lock->pending_writer) {
         qemu_co_queue_wait(&lock->queue, &lock->mutex);
@@ -391,9 +392,9 @@ void qemu_co_rwlock_downgrade(CoRwlock *lock)
     self->locks_held++;
 }
 
-void qemu_co_rwlock_wrlock(CoRwlock *lock)
+void qemu_co_rwlock_wrlock_impl(CoRwlock *lock, const char *file, int line)
 {
-    qemu_co_mutex_lock(&lock->mutex);
+    qemu_co_mutex_lock_impl(&lock->mutex, file, line);
     lock->pending_writer++;
     while (lock->reader) {
         qemu_co_queue_wait(&lock->queue, &lock->mutex);
@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
+#include "qemu/bitops.h"
 #include "qemu/notify.h"
 #include "qemu-thread-common.h"
 
@@ -562,6 +563,27 @@ void qemu_thread_exit(void *retval)
     pthread_exit(retval);
 }
 
+int qemu_thread_set_affinity(QemuThread *thread,
+                             const unsigned long *host_cpus,
+                             unsigned long max_cpu)
+{
+#ifdef CONFIG_LINUX
+    cpu_set_t set;
+    unsigned long cpu;
+
+    CPU_ZERO(&set);
+    for (cpu = find_first_bit(host_cpus, max_cpu); cpu < max_cpu;
+         cpu = find_next_bit(host_cpus, max_cpu, cpu + 1)) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return -pthread_setaffinity_np(thread->thread, sizeof(set), &set);
+#else
+    return -ENOSYS;
+#endif
+}
+
 void *qemu_thread_join(QemuThread *thread)
 {
     int err;
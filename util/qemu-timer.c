@@ -25,6 +25,7 @@
 #include "qemu/osdep.h"
 #include "qemu/main-loop.h"
 #include "qemu/timer.h"
+#include "qemu/seqlock.h"
 #include "sysemu/replay.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/cpus.h"
@@ -68,7 +69,18 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+    /* Binary min-heap of the pending timers, ordered by timer_before() */
+    QEMUTimer **active_timers;
+    int nr_active_timers;
+    int max_active_timers;
+    unsigned int timer_seq;
+    /*
+     * expire_time of the first timer in the heap, or -1.  Written with
+     * active_timers_lock held, so that the deadline can be peeked at
+     * without taking the lock.
+     */
+    QemuSeqLock deadline_seqlock;
+    int64_t deadline;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -95,6 +107,28 @@ static bool timer_expired_ns(QEMUTimer *timer_head, int64_t current_time)
     return timer_head && (timer_head->expire_time <= current_time);
 }
 
+/* Timers with the same expire_time fire in the order they were armed */
+static bool timer_before(QEMUTimer *a, QEMUTimer *b)
+{
+    if (a->expire_time != b->expire_time) {
+        return a->expire_time < b->expire_time;
+    }
+    return (int)(a->seq - b->seq) < 0;
+}
+
+static int64_t timerlist_get_deadline(QEMUTimerList *timer_list)
+{
+    int64_t deadline;
+    unsigned start;
+
+    do {
+        start = seqlock_read_begin(&timer_list->deadline_seqlock);
+        deadline = timer_list->deadline;
+    } while (seqlock_read_retry(&timer_list->deadline_seqlock, start));
+
+    return deadline;
+}
+
 QEMUTimerList *timerlist_new(QEMUClockType type,
                              QEMUTimerListNotifyCB *cb,
                              void *opaque)
@@ -108,6 +142,8 @@ QEMUTimerList *timerlist_new(QEMUClockType type,
     timer_list->notify_cb = cb;
     timer_list->notify_opaque = opaque;
     qemu_mutex_init(&timer_list->active_timers_lock);
+    seqlock_init(&timer_list->deadline_seqlock);
+    timer_list->deadline = -1;
     QLIST_INSERT_HEAD(&clock->timerlists, timer_list, list);
     return timer_list;
 }
@@ -119,6 +155,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -175,7 +212,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!atomic_read(&timer_list->active_timers);
+    return !!atomic_read(&timer_list->nr_active_timers);
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -188,17 +225,14 @@ bool timerlist_expired(QEMUTimerList *timer_list)
 {
     int64_t expire_time;
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (!atomic_read(&timer_list->nr_active_timers)) {
         return false;
     }
 
-    qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
-        qemu_mutex_unlock(&timer_list->active_timers_lock);
+    expire_time = timerlist_get_deadline(timer_list);
+    if (expire_time == -1) {
         return false;
     }
-    expire_time = timer_list->active_timers->expire_time;
-    qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     return expire_time <= qemu_clock_get_ns(timer_list->clock->type);
 }
@@ -219,7 +253,7 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     int64_t delta;
     int64_t expire_time;
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (!atomic_read(&timer_list->nr_active_timers)) {
         return -1;
     }
 
@@ -231,13 +265,10 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
      * value but ->notify_cb() is called when the deadline changes.  Therefore
      * the caller should notice the change and there is no race condition.
      */
-    qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
-        qemu_mutex_unlock(&timer_list->active_timers_lock);
+    expire_time = timerlist_get_deadline(timer_list);
+    if (expire_time == -1) {
         return -1;
     }
-    expire_time = timer_list->active_timers->expire_time;
-    qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
 
@@ -361,43 +392,110 @@ void timer_deinit(QEMUTimer *ts)
     ts->timer_list = NULL;
 }
 
-static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+static void timer_heap_set(QEMUTimerList *timer_list, int i, QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
+    timer_list->active_timers[i] = ts;
+    ts->heap_index = i;
+}
 
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            atomic_set(pt, t->next);
+static void timer_heap_sift_up(QEMUTimerList *timer_list, int i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->active_timers[parent])) {
             break;
         }
-        pt = &t->next;
+        timer_heap_set(timer_list, i, timer_list->active_timers[parent]);
+        i = parent;
     }
+    timer_heap_set(timer_list, i, ts);
 }
 
-static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
-                                QEMUTimer *ts, int64_t expire_time)
+static void timer_heap_sift_down(QEMUTimerList *timer_list, int i)
 {
-    QEMUTimer **pt, *t;
+    QEMUTimer *ts = timer_list->active_timers[i];
+    int n = timer_list->nr_active_timers;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
     for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
+        int child = 2 * i + 1;
+
+        if (child >= n) {
             break;
         }
-        pt = &t->next;
+        if (child + 1 < n &&
+            timer_before(timer_list->active_timers[child + 1],
+                         timer_list->active_timers[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->active_timers[child], ts)) {
+            break;
+        }
+        timer_heap_set(timer_list, i, timer_list->active_timers[child]);
+        i = child;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timerlist_update_deadline(QEMUTimerList *timer_list)
+{
+    int64_t deadline = -1;
+
+    if (timer_list->nr_active_timers) {
+        deadline = timer_list->active_timers[0]->expire_time;
+    }
+    if (deadline != timer_list->deadline) {
+        seqlock_write_begin(&timer_list->deadline_seqlock);
+        timer_list->deadline = deadline;
+        seqlock_write_end(&timer_list->deadline_seqlock);
+    }
+}
+
+static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    QEMUTimer *last;
+    int i;
+
+    if (ts->expire_time == -1) {
+        return;
+    }
+
+    ts->expire_time = -1;
+    i = ts->heap_index;
+    atomic_set(&timer_list->nr_active_timers,
+               timer_list->nr_active_timers - 1);
+    last = timer_list->active_timers[timer_list->nr_active_timers];
+    if (last != ts) {
+        /* Move the last timer into the hole, then restore the heap */
+        timer_heap_set(timer_list, i, last);
+        timer_heap_sift_up(timer_list, i);
+        timer_heap_sift_down(timer_list, last->heap_index);
+    }
+    timerlist_update_deadline(timer_list);
+}
+
+static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
+                                QEMUTimer *ts, int64_t expire_time)
+{
+    int i = timer_list->nr_active_timers;
+
+    /* add the timer to the heap */
+    if (i == timer_list->max_active_timers) {
+        timer_list->max_active_timers = MAX(16, i * 2);
+        timer_list->active_timers = g_renew(QEMUTimer *,
+                                            timer_list->active_timers,
+                                            timer_list->max_active_timers);
     }
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    atomic_set(pt, ts);
+    ts->seq = timer_list->timer_seq++;
+    timer_list->active_timers[i] = ts;
+    atomic_set(&timer_list->nr_active_timers, i + 1);
+    timer_heap_sift_up(timer_list, i);
+    timerlist_update_deadline(timer_list);
 
-    return pt == &timer_list->active_timers;
+    return ts->heap_index == 0;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -491,7 +589,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     void *opaque;
     bool need_replay_checkpoint = false;
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (!atomic_read(&timer_list->nr_active_timers)) {
         return false;
     }
 
@@ -540,7 +638,8 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
      */
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    while ((ts = timer_list->active_timers)) {
+    while (timer_list->nr_active_timers) {
+        ts = timer_list->active_timers[0];
         if (!timer_expired_ns(ts, current_time)) {
             /* No expired timers left.  The checkpoint can be skipped
              * if no timers fired or they were all external.
@@ -562,10 +661,8 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
             continue;
         }
 
-        /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        /* remove timer from the heap before calling the callback */
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 
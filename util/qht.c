@@ -22,8 +22,8 @@
  * - Writes (i.e. insertions/removals) can be concurrent with writes to
  *   different buckets; writes to the same bucket are serialized through a lock.
  * - Optional auto-resizing: the hash table resizes up if the load surpasses
- *   a certain threshold. Resizing is done concurrently with readers; writes
- *   are serialized with the resize operation.
+ *   a certain threshold. Resizing is done concurrently with readers and
+ *   writers; a writer only waits for the migration of the bucket it needs.
  *
  * The key structure is the bucket, which is cacheline-sized. Buckets
  * contain a few hash values and pointers; the u32 hash values are stored in
@@ -43,14 +43,25 @@
  * just-removed entry. This makes lookups slightly faster, since the moment an
  * invalid entry is found, the (failed) lookup is over.
  *
- * Resizing is done by taking all bucket spinlocks (so that no other writers can
- * race with us) and then copying all entries into a new hash map. Then, the
- * ht->map pointer is set, and the old map is freed once no RCU readers can see
- * it anymore.
+ * Resizing does not stop the world. The resizer publishes the new map, with
+ * new->old pointing to the map being replaced, and then migrates the old head
+ * buckets to the new map one at a time. Each old bucket is migrated under its
+ * own lock; once it is empty, it is marked in old->migrated. Other threads
+ * keep going meanwhile:
+ * - Lookups check the old bucket (unless it is marked as migrated) before the
+ *   new one. Since entries are added to the new map before being removed from
+ *   the old one, an entry is always found in at least one of the two.
+ * - Writers migrate the old bucket for their hash themselves before touching
+ *   the new map, so that duplicate checks and removals only need to look at
+ *   the new map.
+ * When all buckets are migrated, new->old is cleared and the old map is freed
+ * once no RCU readers can see it anymore.
  *
  * Writers check for concurrent resizes by comparing ht->map before and after
  * acquiring their bucket lock. If they don't match, a resize has occured
- * while the bucket spinlock was being acquired.
+ * while the bucket spinlock was being acquired. Migration of an old bucket
+ * happens after ht->map is set, thus writers that still see the old map
+ * are flushed out by the migration of their bucket.
  *
  * Related Work:
  * - Idea of cacheline-sized buckets with full hashes taken from:
@@ -68,6 +79,7 @@
 #include "qemu/osdep.h"
 #include "qemu/qht.h"
 #include "qemu/atomic.h"
+#include "qemu/bitmap.h"
 #include "qemu/rcu.h"
 
 //#define QHT_DEBUG
@@ -138,7 +150,9 @@ static inline void qht_unlock(struct qht *ht)
  * atomic_read's are of course not necessary when the bucket lock is held.
  *
  * If both ht->lock and b->lock are grabbed, ht->lock should always
- * be grabbed first.
+ * be grabbed first. If the locks of a bucket in the old map and of a
+ * bucket in the new map are both grabbed during a resize, the old one
+ * should always be grabbed first.
  */
 struct qht_bucket {
     QemuSpin lock;
@@ -159,6 +173,9 @@ QEMU_BUILD_BUG_ON(sizeof(struct qht_bucket) > QHT_BUCKET_ALIGN);
  * @n_added_buckets: number of added (i.e. "non-head") buckets
  * @n_added_buckets_threshold: threshold to trigger an upward resize once the
  *                             number of added buckets surpasses it.
+ * @old: map whose entries are being migrated to this one, or NULL.
+ * @migrated: bitmap of the head buckets already migrated to the new map.
+ *            Only allocated while the map is being replaced.
  *
  * Buckets are tracked in what we call a "map", i.e. this structure.
  */
@@ -168,13 +185,13 @@ struct qht_map {
     size_t n_buckets;
     size_t n_added_buckets;
     size_t n_added_buckets_threshold;
+    struct qht_map *old;
+    unsigned long *migrated;
 };
 
 /* trigger a resize when n_added_buckets > n_buckets / div */
 #define QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV 8
 
-static void qht_do_resize_reset(struct qht *ht, struct qht_map *new,
-                                bool reset);
 static void qht_grow_maybe(struct qht *ht);
 
 #ifdef QHT_DEBUG
@@ -235,10 +252,28 @@ static inline void qht_head_init(struct qht_bucket *b)
     seqlock_init(&b->sequence);
 }
 
+static inline size_t qht_map_to_index(const struct qht_map *map, uint32_t hash)
+{
+    return hash & (map->n_buckets - 1);
+}
+
 static inline
 struct qht_bucket *qht_map_to_bucket(const struct qht_map *map, uint32_t hash)
 {
-    return &map->buckets[hash & (map->n_buckets - 1)];
+    return &map->buckets[qht_map_to_index(map, hash)];
+}
+
+/*
+ * Check whether head bucket @idx of @old has been moved to the new map.
+ * The acquire pairs with set_bit_atomic() in qht_map_migrate_bucket(), so
+ * that the entries added to the new map are visible when this returns true.
+ */
+static inline bool qht_map_bucket_is_migrated(const struct qht_map *old,
+                                              size_t idx)
+{
+    unsigned long word = atomic_load_acquire(&old->migrated[BIT_WORD(idx)]);
+
+    return word & BIT_MASK(idx);
 }
 
 /* acquire all bucket locks from a map */
@@ -275,32 +310,28 @@ static inline bool qht_map_is_stale__locked(const struct qht *ht,
 }
 
 /*
- * Grab all bucket locks, and set @pmap after making sure the map isn't stale.
+ * Grab ht->lock and all bucket locks of ht->map; the lock excludes resizes,
+ * so there is no migration in progress and @pmap holds all the entries.
  *
- * Pairs with qht_map_unlock_buckets(), hence the pass-by-reference.
- *
- * Note: callers cannot have ht->lock held.
+ * Pairs with qht_map_unlock_buckets__all(), hence the pass-by-reference.
  */
-static inline
-void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
+static inline void qht_map_lock_buckets__all(struct qht *ht,
+                                             struct qht_map **pmap)
 {
     struct qht_map *map;
 
-    map = atomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return;
-    }
-    qht_map_unlock_buckets(map);
-
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
     qht_lock(ht);
     map = ht->map;
+    qht_debug_assert(map->old == NULL);
     qht_map_lock_buckets(map);
-    qht_unlock(ht);
     *pmap = map;
-    return;
+}
+
+static inline void qht_map_unlock_buckets__all(struct qht *ht,
+                                               struct qht_map *map)
+{
+    qht_map_unlock_buckets(map);
+    qht_unlock(ht);
 }
 
 /*
@@ -309,7 +340,9 @@ void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
  *
  * Unlock with qemu_spin_unlock(&b->lock).
  *
- * Note: callers cannot have ht->lock held.
+ * Note: ht->lock is held by the resizer for the whole migration, so do
+ * not take it here; ht->map is set before any old bucket is migrated,
+ * so the retry below cannot spin for long.
  */
 static inline
 struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
@@ -318,24 +351,18 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     struct qht_bucket *b;
     struct qht_map *map;
 
-    map = atomic_rcu_read(&ht->map);
-    b = qht_map_to_bucket(map, hash);
+    for (;;) {
+        map = atomic_rcu_read(&ht->map);
+        b = qht_map_to_bucket(map, hash);
 
-    qemu_spin_lock(&b->lock);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return b;
+        qemu_spin_lock(&b->lock);
+        if (likely(!qht_map_is_stale__locked(ht, map))) {
+            *pmap = map;
+            return b;
+        }
+        /* we raced with a resize; retry with the updated ht->map */
+        qemu_spin_unlock(&b->lock);
     }
-    qemu_spin_unlock(&b->lock);
-
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
-    qht_lock(ht);
-    map = ht->map;
-    b = qht_map_to_bucket(map, hash);
-    qemu_spin_lock(&b->lock);
-    qht_unlock(ht);
-    *pmap = map;
-    return b;
 }
 
 static inline bool qht_map_needs_resize(const struct qht_map *map)
@@ -364,6 +391,7 @@ static void qht_map_destroy(struct qht_map *map)
         qht_chain_destroy(&map->buckets[i]);
     }
     qemu_vfree(map->buckets);
+    g_free(map->migrated);
     g_free(map);
 }
 
@@ -374,6 +402,8 @@ static struct qht_map *qht_map_create(size_t n_buckets)
 
     map = g_malloc(sizeof(*map));
     map->n_buckets = n_buckets;
+    map->old = NULL;
+    map->migrated = NULL;
 
     map->n_added_buckets = 0;
     map->n_added_buckets_threshold = n_buckets /
@@ -448,19 +478,31 @@ void qht_reset(struct qht *ht)
 {
     struct qht_map *map;
 
-    qht_map_lock_buckets__no_stale(ht, &map);
+    qht_map_lock_buckets__all(ht, &map);
     qht_map_reset__all_locked(map);
-    qht_map_unlock_buckets(map);
+    qht_map_unlock_buckets__all(ht, map);
 }
 
-static inline void qht_do_resize(struct qht *ht, struct qht_map *new)
+/*
+ * Reset the hash table and, if @new is not NULL, replace its map with @new.
+ * The old map is empty after the reset, so there is nothing to migrate.
+ * Call with ht->lock held.
+ */
+static void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
 {
-    qht_do_resize_reset(ht, new, false);
-}
+    struct qht_map *old = ht->map;
 
-static inline void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
-{
-    qht_do_resize_reset(ht, new, true);
+    qht_map_lock_buckets(old);
+    qht_map_reset__all_locked(old);
+    if (new == NULL) {
+        qht_map_unlock_buckets(old);
+        return;
+    }
+
+    g_assert(new->n_buckets != old->n_buckets);
+    atomic_rcu_set(&ht->map, new);
+    qht_map_unlock_buckets(old);
+    call_rcu(old, qht_map_destroy, rcu);
 }
 
 bool qht_reset_size(struct qht *ht, size_t n_elems)
@@ -523,15 +565,40 @@ void *qht_lookup__slowpath(const struct qht_bucket *b, qht_lookup_func_t func,
     return ret;
 }
 
+/*
+ * Look up @hash in the map being replaced.  This must be done before looking
+ * into the new map: entries are removed from the old map only after being
+ * added to the new one.
+ */
+static __attribute__((noinline))
+void *qht_lookup__old(const struct qht_map *old, qht_lookup_func_t func,
+                      const void *userp, uint32_t hash)
+{
+    size_t idx = qht_map_to_index(old, hash);
+
+    if (qht_map_bucket_is_migrated(old, idx)) {
+        return NULL;
+    }
+    return qht_lookup__slowpath(&old->buckets[idx], func, userp, hash);
+}
+
 void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
                         qht_lookup_func_t func)
 {
     const struct qht_bucket *b;
     const struct qht_map *map;
+    const struct qht_map *old;
     unsigned int version;
     void *ret;
 
     map = atomic_rcu_read(&ht->map);
+    old = atomic_rcu_read(&map->old);
+    if (unlikely(old)) {
+        ret = qht_lookup__old(old, func, userp, hash);
+        if (ret) {
+            return ret;
+        }
+    }
     b = qht_map_to_bucket(map, hash);
 
     version = seqlock_read_begin(&b->sequence);
@@ -601,6 +668,97 @@ static void *qht_insert__locked(const struct qht *ht, struct qht_map *map,
     return NULL;
 }
 
+/*
+ * Move the entries of head bucket @idx of @old to @new, and mark the bucket
+ * as migrated.  Readers can see the entries in either map at all times.
+ */
+static void qht_map_migrate_bucket(const struct qht *ht, struct qht_map *new,
+                                   struct qht_map *old, size_t idx)
+{
+    struct qht_bucket *head = &old->buckets[idx];
+    struct qht_bucket *b = head;
+    int i;
+
+    qemu_spin_lock(&head->lock);
+    if (qht_map_bucket_is_migrated(old, idx)) {
+        qemu_spin_unlock(&head->lock);
+        return;
+    }
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            struct qht_bucket *to;
+
+            if (b->pointers[i] == NULL) {
+                goto done;
+            }
+            to = qht_map_to_bucket(new, b->hashes[i]);
+            qemu_spin_lock(&to->lock);
+            qht_insert__locked(ht, new, to, b->pointers[i], b->hashes[i],
+                               NULL);
+            qht_bucket_debug__locked(to);
+            qemu_spin_unlock(&to->lock);
+        }
+        b = b->next;
+    } while (b);
+ done:
+    qht_bucket_reset__locked(head);
+    set_bit_atomic(idx, old->migrated);
+    qemu_spin_unlock(&head->lock);
+}
+
+/*
+ * Like qht_bucket_lock__no_stale(), but also make sure that no entry for
+ * @hash is left in the map being replaced, if any.  The returned bucket
+ * then has all the entries that could match @hash.
+ */
+static inline
+struct qht_bucket *qht_bucket_lock__migrated(struct qht *ht, uint32_t hash,
+                                             struct qht_map **pmap)
+{
+    struct qht_bucket *b;
+    struct qht_map *old;
+    size_t idx;
+
+    for (;;) {
+        b = qht_bucket_lock__no_stale(ht, hash, pmap);
+        old = atomic_rcu_read(&(*pmap)->old);
+        if (likely(old == NULL)) {
+            return b;
+        }
+        idx = qht_map_to_index(old, hash);
+        if (qht_map_bucket_is_migrated(old, idx)) {
+            return b;
+        }
+
+        /* old buckets are locked before new ones, so drop b->lock first */
+        qemu_spin_unlock(&b->lock);
+        qht_map_migrate_bucket(ht, *pmap, old, idx);
+    }
+}
+
+/*
+ * Replace ht->map with @new, migrating the entries one head bucket at a
+ * time.  Lookups and writers that do not need a resize proceed in parallel.
+ * Call with ht->lock held.
+ */
+static void qht_do_resize(struct qht *ht, struct qht_map *new)
+{
+    struct qht_map *old = ht->map;
+    size_t i;
+
+    g_assert(new->n_buckets != old->n_buckets);
+    old->migrated = bitmap_new(old->n_buckets);
+    new->old = old;
+    atomic_rcu_set(&ht->map, new);
+
+    for (i = 0; i < old->n_buckets; i++) {
+        qht_map_migrate_bucket(ht, new, old, i);
+    }
+
+    atomic_set(&new->old, NULL);
+    call_rcu(old, qht_map_destroy, rcu);
+}
+
 static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
 {
     struct qht_map *map;
@@ -632,7 +790,7 @@ bool qht_insert(struct qht *ht, void *p, uint32_t hash, void **existing)
     /* NULL pointers are not supported */
     qht_debug_assert(p);
 
-    b = qht_bucket_lock__no_stale(ht, hash, &map);
+    b = qht_bucket_lock__migrated(ht, hash, &map);
     prev = qht_insert__locked(ht, map, b, p, hash, &needs_resize);
     qht_bucket_debug__locked(b);
     qemu_spin_unlock(&b->lock);
@@ -743,7 +901,7 @@ bool qht_remove(struct qht *ht, const void *p, uint32_t hash)
     /* NULL pointers are not supported */
     qht_debug_assert(p);
 
-    b = qht_bucket_lock__no_stale(ht, hash, &map);
+    b = qht_bucket_lock__migrated(ht, hash, &map);
     ret = qht_remove__locked(b, p, hash);
     qht_bucket_debug__locked(b);
     qemu_spin_unlock(&b->lock);
@@ -802,10 +960,9 @@ do_qht_iter(struct qht *ht, const struct qht_iter *iter, void *userp)
 {
     struct qht_map *map;
 
-    map = atomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
+    qht_map_lock_buckets__all(ht, &map);
     qht_map_iter__all_locked(map, iter, userp);
-    qht_map_unlock_buckets(map);
+    qht_map_unlock_buckets__all(ht, map);
 }
 
 void qht_iter(struct qht *ht, qht_iter_func_t func, void *userp)
@@ -828,58 +985,6 @@ void qht_iter_remove(struct qht *ht, qht_iter_bool_func_t func, void *userp)
     do_qht_iter(ht, &iter, userp);
 }
 
-struct qht_map_copy_data {
-    struct qht *ht;
-    struct qht_map *new;
-};
-
-static void qht_map_copy(void *p, uint32_t hash, void *userp)
-{
-    struct qht_map_copy_data *data = userp;
-    struct qht *ht = data->ht;
-    struct qht_map *new = data->new;
-    struct qht_bucket *b = qht_map_to_bucket(new, hash);
-
-    /* no need to acquire b->lock because no thread has seen this map yet */
-    qht_insert__locked(ht, new, b, p, hash, NULL);
-}
-
-/*
- * Atomically perform a resize and/or reset.
- * Call with ht->lock held.
- */
-static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
-{
-    struct qht_map *old;
-    const struct qht_iter iter = {
-        .f.retvoid = qht_map_copy,
-        .type = QHT_ITER_VOID,
-    };
-    struct qht_map_copy_data data;
-
-    old = ht->map;
-    qht_map_lock_buckets(old);
-
-    if (reset) {
-        qht_map_reset__all_locked(old);
-    }
-
-    if (new == NULL) {
-        qht_map_unlock_buckets(old);
-        return;
-    }
-
-    g_assert(new->n_buckets != old->n_buckets);
-    data.ht = ht;
-    data.new = new;
-    qht_map_iter__all_locked(old, &iter, &data);
-    qht_map_debug__all_locked(new);
-
-    atomic_rcu_set(&ht->map, new);
-    qht_map_unlock_buckets(old);
-    call_rcu(old, qht_map_destroy, rcu);
-}
-
 bool qht_resize(struct qht *ht, size_t n_elems)
 {
     size_t n_buckets = qht_elems_to_buckets(n_elems);
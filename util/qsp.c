@@ -10,11 +10,16 @@
  * help diagnose performance problems, e.g. scalability issues when
  * contention is high.
  *
- * The primitives currently supported are mutexes, recursive mutexes and
- * condition variables. Note that not all related functions are intercepted;
- * instead we profile only those functions that can have a performance impact,
- * either due to blocking (e.g. cond_wait, mutex_lock) or cache line
- * contention (e.g. mutex_lock, mutex_trylock).
+ * The primitives currently supported are mutexes, recursive mutexes,
+ * condition variables, AioContext locks, and coroutine mutexes and rwlocks.
+ * Note that not all related functions are intercepted; instead we profile only
+ * those functions that can have a performance impact, either due to blocking
+ * (e.g. cond_wait, mutex_lock) or cache line contention (e.g. mutex_lock,
+ * mutex_trylock).
+ *
+ * To keep the overhead low enough for production use, QSP can sample the
+ * acquisitions: with a sample rate of N, each thread only times one of every
+ * N calls, and accounts it as N calls that took the measured time each.
  *
  * QSP's design focuses on speed and scalability. This is achieved
  * by having threads do their profiling entirely on thread-local data.
@@ -58,6 +63,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/thread.h"
+#include "qemu/coroutine.h"
 #include "qemu/timer.h"
 #include "qemu/qht.h"
 #include "qemu/rcu.h"
@@ -68,6 +74,9 @@ enum QSPType {
     QSP_BQL_MUTEX,
     QSP_REC_MUTEX,
     QSP_CONDVAR,
+    QSP_AIO_CONTEXT,
+    QSP_CO_MUTEX,
+    QSP_CO_RWLOCK,
 };
 
 struct QSPCallSite {
@@ -105,6 +114,10 @@ static size_t qsp_qemu_path_len;
 /* the address of qsp_thread gives us a unique 'thread ID' */
 static __thread int qsp_thread;
 
+/* profile one of every qsp_sample_rate calls */
+static unsigned int qsp_sample_rate = 1;
+static __thread unsigned int qsp_sample_count;
+
 /*
  * Call sites are the same for all threads, so we track them in a separate hash
  * table to save memory.
@@ -120,6 +133,9 @@ static const char * const qsp_typenames[] = {
     [QSP_BQL_MUTEX] = "BQL mutex",
     [QSP_REC_MUTEX] = "rec_mutex",
     [QSP_CONDVAR]   = "condvar",
+    [QSP_AIO_CONTEXT] = "aio_ctx",
+    [QSP_CO_MUTEX]  = "co_mutex",
+    [QSP_CO_RWLOCK] = "co_rwlock",
 };
 
 QemuMutexLockFunc qemu_bql_mutex_lock_func = qemu_mutex_lock_impl;
@@ -129,6 +145,10 @@ QemuRecMutexLockFunc qemu_rec_mutex_lock_func = qemu_rec_mutex_lock_impl;
 QemuRecMutexTrylockFunc qemu_rec_mutex_trylock_func =
     qemu_rec_mutex_trylock_impl;
 QemuCondWaitFunc qemu_cond_wait_func = qemu_cond_wait_impl;
+QemuRecMutexLockFunc qemu_aio_context_lock_func = qemu_rec_mutex_lock_impl;
+QemuCoMutexLockFunc qemu_co_mutex_lock_func = qemu_co_mutex_lock_impl;
+QemuCoRwlockLockFunc qemu_co_rwlock_rdlock_func = qemu_co_rwlock_rdlock_impl;
+QemuCoRwlockLockFunc qemu_co_rwlock_wrlock_func = qemu_co_rwlock_wrlock_impl;
 
 /*
  * It pays off to _not_ hash callsite->file; hashing a string is slow, and
@@ -337,53 +357,112 @@ static QSPEntry *qsp_entry_get(const void *obj, const char *file, int line,
     return qsp_entry_find(&qsp_ht, &orig, hash);
 }
 
+/*
+ * Return how many calls the current one stands for, or 0 if it should not be
+ * profiled.
+ */
+static inline unsigned int qsp_sample(void)
+{
+    unsigned int rate = atomic_read(&qsp_sample_rate);
+
+    if (likely(rate <= 1)) {
+        return 1;
+    }
+    if (++qsp_sample_count < rate) {
+        return 0;
+    }
+    qsp_sample_count = 0;
+    return rate;
+}
+
 /*
  * @e is in the global hash table; it is only written to by the current thread,
  * so we write to it atomically (as in "write once") to prevent torn reads.
  */
-static inline void do_qsp_entry_record(QSPEntry *e, int64_t delta, bool acq)
+static inline void do_qsp_entry_record(QSPEntry *e, int64_t delta,
+                                       unsigned int weight, bool acq)
 {
-    atomic_set_u64(&e->ns, e->ns + delta);
+    atomic_set_u64(&e->ns, e->ns + delta * weight);
     if (acq) {
-        atomic_set_u64(&e->n_acqs, e->n_acqs + 1);
+        atomic_set_u64(&e->n_acqs, e->n_acqs + weight);
     }
 }
 
-static inline void qsp_entry_record(QSPEntry *e, int64_t delta)
+static inline void qsp_entry_record(QSPEntry *e, int64_t delta,
+                                    unsigned int weight)
 {
-    do_qsp_entry_record(e, delta, true);
+    do_qsp_entry_record(e, delta, weight, true);
 }
 
 #define QSP_GEN_VOID(type_, qsp_t_, func_, impl_)                       \
     static void func_(type_ *obj, const char *file, int line)           \
     {                                                                   \
+        unsigned int weight = qsp_sample();                             \
         QSPEntry *e;                                                    \
         int64_t t0, t1;                                                 \
                                                                         \
+        if (!weight) {                                                  \
+            impl_(obj, file, line);                                     \
+            return;                                                     \
+        }                                                               \
         t0 = get_clock();                                               \
         impl_(obj, file, line);                                         \
         t1 = get_clock();                                               \
                                                                         \
         e = qsp_entry_get(obj, file, line, qsp_t_);                     \
-        qsp_entry_record(e, t1 - t0);                                   \
+        qsp_entry_record(e, t1 - t0, weight);                           \
     }
 
 #define QSP_GEN_RET1(type_, qsp_t_, func_, impl_)                       \
     static int func_(type_ *obj, const char *file, int line)            \
     {                                                                   \
+        unsigned int weight = qsp_sample();                             \
         QSPEntry *e;                                                    \
         int64_t t0, t1;                                                 \
         int err;                                                        \
                                                                         \
+        if (!weight) {                                                  \
+            return impl_(obj, file, line);                              \
+        }                                                               \
         t0 = get_clock();                                               \
         err = impl_(obj, file, line);                                   \
         t1 = get_clock();                                               \
                                                                         \
         e = qsp_entry_get(obj, file, line, qsp_t_);                     \
-        do_qsp_entry_record(e, t1 - t0, !err);                          \
+        do_qsp_entry_record(e, t1 - t0, weight, !err);                  \
         return err;                                                     \
     }
 
+/*
+ * A coroutine can be resumed in a different thread than the one it blocked
+ * in, so the entry must be looked up after the wait, out of line: otherwise
+ * the compiler could reuse the address of qsp_thread that it computed before.
+ */
+static __attribute__((noinline))
+void qsp_co_entry_record(const void *obj, const char *file, int line,
+                         enum QSPType type, int64_t delta, unsigned int weight)
+{
+    QSPEntry *e = qsp_entry_get(obj, file, line, type);
+
+    qsp_entry_record(e, delta, weight);
+}
+
+#define QSP_GEN_CO(type_, qsp_t_, func_, impl_)                         \
+    static void coroutine_fn func_(type_ *obj, const char *file, int line) \
+    {                                                                   \
+        unsigned int weight = qsp_sample();                             \
+        int64_t t0;                                                     \
+                                                                        \
+        if (!weight) {                                                  \
+            impl_(obj, file, line);                                     \
+            return;                                                     \
+        }                                                               \
+        t0 = get_clock();                                               \
+        impl_(obj, file, line);                                         \
+        qsp_co_entry_record(obj, file, line, qsp_t_, get_clock() - t0,  \
+                            weight);                                    \
+    }
+
 QSP_GEN_VOID(QemuMutex, QSP_BQL_MUTEX, qsp_bql_mutex_lock, qemu_mutex_lock_impl)
 QSP_GEN_VOID(QemuMutex, QSP_MUTEX, qsp_mutex_lock, qemu_mutex_lock_impl)
 QSP_GEN_RET1(QemuMutex, QSP_MUTEX, qsp_mutex_trylock, qemu_mutex_trylock_impl)
@@ -392,22 +471,36 @@ QSP_GEN_VOID(QemuRecMutex, QSP_REC_MUTEX, qsp_rec_mutex_lock,
              qemu_rec_mutex_lock_impl)
 QSP_GEN_RET1(QemuRecMutex, QSP_REC_MUTEX, qsp_rec_mutex_trylock,
              qemu_rec_mutex_trylock_impl)
+QSP_GEN_VOID(QemuRecMutex, QSP_AIO_CONTEXT, qsp_aio_context_lock,
+             qemu_rec_mutex_lock_impl)
+
+QSP_GEN_CO(CoMutex, QSP_CO_MUTEX, qsp_co_mutex_lock, qemu_co_mutex_lock_impl)
+QSP_GEN_CO(CoRwlock, QSP_CO_RWLOCK, qsp_co_rwlock_rdlock,
+           qemu_co_rwlock_rdlock_impl)
+QSP_GEN_CO(CoRwlock, QSP_CO_RWLOCK, qsp_co_rwlock_wrlock,
+           qemu_co_rwlock_wrlock_impl)
 
+#undef QSP_GEN_CO
 #undef QSP_GEN_RET1
 #undef QSP_GEN_VOID
 
 static void
 qsp_cond_wait(QemuCond *cond, QemuMutex *mutex, const char *file, int line)
 {
+    unsigned int weight = qsp_sample();
     QSPEntry *e;
     int64_t t0, t1;
 
+    if (!weight) {
+        qemu_cond_wait_impl(cond, mutex, file, line);
+        return;
+    }
     t0 = get_clock();
     qemu_cond_wait_impl(cond, mutex, file, line);
     t1 = get_clock();
 
     e = qsp_entry_get(cond, file, line, QSP_CONDVAR);
-    qsp_entry_record(e, t1 - t0);
+    qsp_entry_record(e, t1 - t0, weight);
 }
 
 bool qsp_is_enabled(void)
@@ -423,6 +516,10 @@ void qsp_enable(void)
     atomic_set(&qemu_rec_mutex_lock_func, qsp_rec_mutex_lock);
     atomic_set(&qemu_rec_mutex_trylock_func, qsp_rec_mutex_trylock);
     atomic_set(&qemu_cond_wait_func, qsp_cond_wait);
+    atomic_set(&qemu_aio_context_lock_func, qsp_aio_context_lock);
+    atomic_set(&qemu_co_mutex_lock_func, qsp_co_mutex_lock);
+    atomic_set(&qemu_co_rwlock_rdlock_func, qsp_co_rwlock_rdlock);
+    atomic_set(&qemu_co_rwlock_wrlock_func, qsp_co_rwlock_wrlock);
 }
 
 void qsp_disable(void)
@@ -433,6 +530,20 @@ void qsp_disable(void)
     atomic_set(&qemu_rec_mutex_lock_func, qemu_rec_mutex_lock_impl);
     atomic_set(&qemu_rec_mutex_trylock_func, qemu_rec_mutex_trylock_impl);
     atomic_set(&qemu_cond_wait_func, qemu_cond_wait_impl);
+    atomic_set(&qemu_aio_context_lock_func, qemu_rec_mutex_lock_impl);
+    atomic_set(&qemu_co_mutex_lock_func, qemu_co_mutex_lock_impl);
+    atomic_set(&qemu_co_rwlock_rdlock_func, qemu_co_rwlock_rdlock_impl);
+    atomic_set(&qemu_co_rwlock_wrlock_func, qemu_co_rwlock_wrlock_impl);
+}
+
+unsigned int qsp_get_sample_rate(void)
+{
+    return atomic_read(&qsp_sample_rate);
+}
+
+void qsp_set_sample_rate(unsigned int rate)
+{
+    atomic_set(&qsp_sample_rate, MAX(rate, 1));
 }
 
 static gint qsp_tree_cmp(gconstpointer ap, gconstpointer bp, gpointer up)
@@ -642,6 +753,7 @@ struct QSPReportEntry {
     const void *obj;
     char *callsite_at;
     const char *typename;
+    uint64_t ns;
     double time_s;
     double ns_avg;
     uint64_t n_acqs;
@@ -672,6 +784,7 @@ static gboolean qsp_tree_report(gpointer key, gpointer value, gpointer udata)
     entry->n_objs = e->n_objs;
     entry->callsite_at = qsp_at(e->callsite);
     entry->typename = qsp_typenames[e->callsite->type];
+    entry->ns = e->ns;
     entry->time_s = e->ns * 1e-9;
     entry->n_acqs = e->n_acqs;
     entry->ns_avg = e->n_acqs ? e->ns / e->n_acqs : 0;
@@ -746,26 +859,49 @@ static void report_destroy(QSPReport *rep)
     g_free(rep->entries);
 }
 
-void qsp_report(FILE *f, fprintf_function cpu_fprintf, size_t max,
-                enum QSPSortBy sort_by, bool callsite_coalesce)
+static void report_init(QSPReport *rep, size_t max, enum QSPSortBy sort_by,
+                        bool callsite_coalesce)
 {
     GTree *tree = g_tree_new_full(qsp_tree_cmp, &sort_by, g_free, NULL);
-    QSPReport rep;
 
     qsp_init();
 
-    rep.entries = g_new0(QSPReportEntry, max);
-    rep.n_entries = 0;
-    rep.max_n_entries = max;
+    rep->entries = g_new0(QSPReportEntry, max);
+    rep->n_entries = 0;
+    rep->max_n_entries = max;
 
     qsp_mktree(tree, callsite_coalesce);
-    g_tree_foreach(tree, qsp_tree_report, &rep);
+    g_tree_foreach(tree, qsp_tree_report, rep);
     g_tree_destroy(tree);
+}
+
+void qsp_report(FILE *f, fprintf_function cpu_fprintf, size_t max,
+                enum QSPSortBy sort_by, bool callsite_coalesce)
+{
+    QSPReport rep;
 
+    report_init(&rep, max, sort_by, callsite_coalesce);
     pr_report(&rep, f, cpu_fprintf);
     report_destroy(&rep);
 }
 
+void qsp_report_foreach(size_t max, enum QSPSortBy sort_by,
+                        bool callsite_coalesce, QSPReportFunc func,
+                        void *opaque)
+{
+    QSPReport rep;
+    size_t i;
+
+    report_init(&rep, max, sort_by, callsite_coalesce);
+    for (i = 0; i < rep.n_entries; i++) {
+        const QSPReportEntry *e = &rep.entries[i];
+
+        func(opaque, e->typename, e->obj, e->n_objs, e->callsite_at,
+             e->ns, e->n_acqs);
+    }
+    report_destroy(&rep);
+}
+
 static void qsp_snapshot_destroy(QSPSnapshot *snap)
 {
     qht_iter(&snap->ht, qsp_ht_delete, NULL);
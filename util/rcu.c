@@ -70,11 +70,35 @@ __thread struct rcu_reader_data rcu_reader;
 typedef QLIST_HEAD(, rcu_reader_data) ThreadList;
 static ThreadList registry = QLIST_HEAD_INITIALIZER(registry);
 
+/* Number of times an expedited grace period rescans the readers before
+ * going to sleep on rcu_gp_event.
+ */
+#define RCU_EXPEDITED_SPIN       1000
+
+/* Move the readers that have crossed a quiescent state to @qsreaders.  */
+static void move_quiescent_readers(ThreadList *qsreaders)
+{
+    struct rcu_reader_data *index, *tmp;
+
+    QLIST_FOREACH_SAFE(index, &registry, node, tmp) {
+        if (!rcu_gp_ongoing(&index->ctr)) {
+            QLIST_REMOVE(index, node);
+            QLIST_INSERT_HEAD(qsreaders, index, node);
+
+            /* No need for mb_set here, worst of all we
+             * get some extra futex wakeups.
+             */
+            atomic_set(&index->waiting, false);
+        }
+    }
+}
+
 /* Wait for previous parity/grace period to be empty of readers.  */
-static void wait_for_readers(void)
+static void wait_for_readers(bool expedited)
 {
     ThreadList qsreaders = QLIST_HEAD_INITIALIZER(qsreaders);
-    struct rcu_reader_data *index, *tmp;
+    struct rcu_reader_data *index;
+    int spin;
 
     for (;;) {
         /* We want to be notified of changes made to rcu_gp_ongoing
@@ -98,16 +122,19 @@ static void wait_for_readers(void)
          */
         smp_mb_global();
 
-        QLIST_FOREACH_SAFE(index, &registry, node, tmp) {
-            if (!rcu_gp_ongoing(&index->ctr)) {
-                QLIST_REMOVE(index, node);
-                QLIST_INSERT_HEAD(&qsreaders, index, node);
+        move_quiescent_readers(&qsreaders);
 
-                /* No need for mb_set here, worst of all we
-                 * get some extra futex wakeups.
-                 */
-                atomic_set(&index->waiting, false);
+        /* An expedited grace period expects the remaining readers to leave
+         * their critical sections soon, so poll them for a while instead
+         * of paying for a futex wakeup and a context switch.  The loads
+         * of index->ctr are still ordered after the global barrier above.
+         */
+        for (spin = 0; expedited && spin < RCU_EXPEDITED_SPIN; spin++) {
+            if (QLIST_EMPTY(&registry)) {
+                break;
             }
+            cpu_relax();
+            move_quiescent_readers(&qsreaders);
         }
 
         if (QLIST_EMPTY(&registry)) {
@@ -140,7 +167,7 @@ static void wait_for_readers(void)
     QLIST_SWAP(&registry, &qsreaders, node);
 }
 
-void synchronize_rcu(void)
+static void do_synchronize_rcu(bool expedited)
 {
     qemu_mutex_lock(&rcu_sync_lock);
 
@@ -161,20 +188,30 @@ void synchronize_rcu(void)
              * Switch parity: 0 -> 1, 1 -> 0.
              */
             atomic_mb_set(&rcu_gp_ctr, rcu_gp_ctr ^ RCU_GP_CTR);
-            wait_for_readers();
+            wait_for_readers(expedited);
             atomic_mb_set(&rcu_gp_ctr, rcu_gp_ctr ^ RCU_GP_CTR);
         } else {
             /* Increment current grace period.  */
             atomic_mb_set(&rcu_gp_ctr, rcu_gp_ctr + RCU_GP_CTR);
         }
 
-        wait_for_readers();
+        wait_for_readers(expedited);
     }
 
     qemu_mutex_unlock(&rcu_registry_lock);
     qemu_mutex_unlock(&rcu_sync_lock);
 }
 
+void synchronize_rcu(void)
+{
+    do_synchronize_rcu(false);
+}
+
+void synchronize_rcu_expedited(void)
+{
+    do_synchronize_rcu(true);
+}
+
 
 #define RCU_CALL_MIN_SIZE        30
 
@@ -186,13 +223,24 @@ static struct rcu_head *head = &dummy, **tail = &dummy.next;
 static int rcu_call_count;
 static QemuEvent rcu_call_ready_event;
 
-static void enqueue(struct rcu_head *node)
+/* Callbacks queued by this thread inside call_rcu_batch_begin/end.  */
+static __thread struct rcu_head *batch_head, **batch_tail = &batch_head;
+static __thread int batch_count;
+static __thread int batch_depth;
+
+/* Append the chain from @first to @last to the global queue.  */
+static void enqueue_list(struct rcu_head *first, struct rcu_head *last)
 {
     struct rcu_head **old_tail;
 
-    node->next = NULL;
-    old_tail = atomic_xchg(&tail, &node->next);
-    atomic_mb_set(old_tail, node);
+    last->next = NULL;
+    old_tail = atomic_xchg(&tail, &last->next);
+    atomic_mb_set(old_tail, first);
+}
+
+static void enqueue(struct rcu_head *node)
+{
+    enqueue_list(node, node);
 }
 
 static struct rcu_head *try_dequeue(void)
@@ -291,11 +339,47 @@ static void *call_rcu_thread(void *opaque)
 void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
     node->func = func;
+    if (batch_depth) {
+        /* Only this thread sees the batch, no atomics needed.  */
+        node->next = NULL;
+        *batch_tail = node;
+        batch_tail = &node->next;
+        batch_count++;
+        return;
+    }
+
     enqueue(node);
     atomic_inc(&rcu_call_count);
     qemu_event_set(&rcu_call_ready_event);
 }
 
+void call_rcu_batch_begin(void)
+{
+    batch_depth++;
+}
+
+void call_rcu_batch_end(void)
+{
+    struct rcu_head *last;
+
+    assert(batch_depth > 0);
+    if (--batch_depth || !batch_count) {
+        return;
+    }
+
+    /* Publish the whole batch with a single exchange on the queue tail
+     * and a single update of rcu_call_count.
+     */
+    last = container_of(batch_tail, struct rcu_head, next);
+    enqueue_list(batch_head, last);
+    atomic_add(&rcu_call_count, batch_count);
+    qemu_event_set(&rcu_call_ready_event);
+
+    batch_head = NULL;
+    batch_tail = &batch_head;
+    batch_count = 0;
+}
+
 void rcu_register_thread(void)
 {
     assert(rcu_reader.ctr == 0);
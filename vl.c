@@ -109,6 +109,7 @@ int main(int argc, char **argv)
 #include "trace-root.h"
 #include "trace/control.h"
 #include "qemu/queue.h"
+#include "qemu/plugin.h"
 #include "sysemu/arch_init.h"
 
 #include "ui/qemu-spice.h"
@@ -306,6 +307,26 @@ static QemuOptsList qemu_accel_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
         },
+        {
+            .name = "hot-tb-threshold",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Retranslate TBs executed this many times (0 = off)",
+        },
+        {
+            .name = "tb-jmp-cache-bits",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Size of the per-vCPU TB jump cache, in bits",
+        },
+        {
+            .name = "vtlb-size",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of victim TLB entries per MMU mode",
+        },
+        {
+            .name = "halt-poll-ns",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Time halted vCPU threads poll before sleeping",
+        },
         { /* end of list */ }
     },
 };
@@ -495,6 +516,9 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "quantum",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -2664,6 +2688,23 @@ static void qemu_run_machine_init_done_notifiers(void)
     notifier_list_notify(&machine_init_done_notifiers, NULL);
 }
 
+/*
+ * Startup profiling: each call traces the time spent since the previous
+ * phase ended and since main() was entered, so that "-trace startup_phase"
+ * together with "-trace qdev_realize" shows where initialization goes.
+ */
+static int64_t startup_start_ns;
+static int64_t startup_phase_ns;
+
+static void startup_phase_done(const char *phase)
+{
+    int64_t now = get_clock();
+
+    trace_startup_phase(phase, now - startup_phase_ns,
+                        now - startup_start_ns);
+    startup_phase_ns = now;
+}
+
 static const QEMUOption *lookup_opt(int argc, char **argv,
                                     const char **poptarg, int *poptind)
 {
@@ -3023,6 +3064,7 @@ int main(int argc, char **argv, char **envp)
     BlockdevOptionsQueue bdo_queue = QSIMPLEQ_HEAD_INITIALIZER(bdo_queue);
 
     module_call_init(MODULE_INIT_TRACE);
+    startup_start_ns = startup_phase_ns = get_clock();
 
     qemu_init_cpu_list();
     qemu_init_cpu_loop();
@@ -3831,6 +3873,11 @@ int main(int argc, char **argv, char **envp)
                 g_free(trace_file);
                 trace_file = trace_opt_parse(optarg);
                 break;
+#ifdef CONFIG_PLUGIN
+            case QEMU_OPTION_plugin:
+                qemu_plugin_opt_parse(optarg, &error_fatal);
+                break;
+#endif
             case QEMU_OPTION_readconfig:
                 {
                     int ret = qemu_read_config_file(optarg);
@@ -4078,6 +4125,9 @@ int main(int argc, char **argv, char **envp)
         qemu_set_log(0);
     }
 
+    /* Before anything is translated; plugins may log */
+    qemu_plugin_load_list(&error_fatal);
+
     /* add configured firmware directories */
     dirs = g_strsplit(CONFIG_QEMU_FIRMWAREPATH, G_SEARCHPATH_SEPARATOR_S, 0);
     for (i = 0; dirs[i] != NULL; i++) {
@@ -4290,7 +4340,9 @@ int main(int argc, char **argv, char **envp)
      * Note: uses machine properties such as kernel-irqchip, must run
      * after machine_set_property().
      */
+    startup_phase_done("options");
     configure_accelerator(current_machine, argv[0]);
+    startup_phase_done("accel");
 
     /*
      * Beware, QOM objects created before this point miss global and
@@ -4389,6 +4441,7 @@ int main(int argc, char **argv, char **envp)
     if (tcg_enabled()) {
         qemu_tcg_configure(accel_opts, &error_fatal);
     }
+    qemu_halt_poll_configure(accel_opts, &error_fatal);
 
     if (default_net) {
         QemuOptsList *net = qemu_find_opts("net");
@@ -4470,13 +4523,17 @@ int main(int argc, char **argv, char **envp)
     }
     parse_numa_opts(current_machine);
 
+    startup_phase_done("backends");
+
     /* do monitor/qmp handling at preconfig state if requested */
     main_loop();
+    startup_phase_done("preconfig");
 
     audio_init_audiodevs();
 
     /* from here on runstate is RUN_STATE_PRELAUNCH */
     machine_run_board_init(current_machine);
+    startup_phase_done("board");
 
     realtime_init();
 
@@ -4502,6 +4559,7 @@ int main(int argc, char **argv, char **envp)
     rom_set_order_override(FW_CFG_ORDER_OVERRIDE_DEVICE);
     qemu_opts_foreach(qemu_find_opts("device"),
                       device_init_func, NULL, &error_fatal);
+    startup_phase_done("devices");
 
     cpu_synchronize_all_post_init();
 
@@ -4548,6 +4606,8 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
 
+    startup_phase_done("displays");
+
     qdev_machine_creation_done();
 
     /* TODO: once all bus devices are qdevified, this should be done
@@ -4559,6 +4619,7 @@ int main(int argc, char **argv, char **envp)
         error_report("rom check and register reset failed");
         exit(1);
     }
+    startup_phase_done("machine-done");
 
     replay_start();
 
@@ -4567,6 +4628,7 @@ int main(int argc, char **argv, char **envp)
        clock values from the log. */
     replay_checkpoint(CHECKPOINT_RESET);
     qemu_system_reset(SHUTDOWN_CAUSE_NONE);
+    startup_phase_done("reset");
     register_global_state();
     if (loadvm) {
         Error *local_err = NULL;
@@ -4600,6 +4662,7 @@ int main(int argc, char **argv, char **envp)
 
     accel_setup_post(current_machine);
     os_setup_post();
+    startup_phase_done("start");
 
     main_loop();
 